@@ -13,10 +13,13 @@
 #include "bolt/Passes/ReorderFunctions.h"
 #include "bolt/Passes/HFSort.h"
 #include "bolt/Utils/Utils.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Utils/CodeLayout.h"
 #include <fstream>
+#include <functional>
 
 #define DEBUG_TYPE "hfsort"
 
@@ -91,6 +94,15 @@ static cl::opt<bool> CgIgnoreRecursiveCalls(
     cl::desc("ignore recursive calls when constructing the call graph"),
     cl::init(true), cl::cat(BoltOptCategory));
 
+static cl::opt<bool> ClusterTapirHelpers(
+    "cluster-tapir-helpers",
+    cl::desc("place the hot task-parallel runtime functions (OpenCilk's "
+             "__cilkrts_*, the scheduler loop) together at the front of the "
+             "function order and each Tapir-outlined helper right after the "
+             "function that spawns it (works with hfsort, hfsort+, cdsort "
+             "and pettis-hansen)"),
+    cl::init(false), cl::ZeroOrMore, cl::cat(BoltOptCategory));
+
 static cl::opt<bool> CgUseSplitHotSize(
     "cg-use-split-hot-size",
     cl::desc("use hot/cold data on basic blocks to determine hot sizes for "
@@ -242,6 +254,95 @@ void ReorderFunctions::printStats(const std::vector<Cluster> &Clusters,
                      TotalCalls2MB, 100 * TotalCalls2MB / TotalCalls);
 }
 
+/// Return the name of function F without the suffix that BOLT gives to
+/// local symbols (e.g., "foo/1").
+static StringRef getBaseName(const BinaryFunction &F) {
+  return F.getOneName().split('/').first;
+}
+
+/// Returns true if F is a hot path of a Tapir runtime: the OpenCilk (cheetah)
+/// spawn, sync and frame routines and the work-stealing scheduler loop, or
+/// the generic __rts_* ABI.
+static bool isTapirRuntimeFunction(const BinaryFunction &F) {
+  static const char *const Prefixes[] = {
+      "__cilkrts_", "cilkrts_",         "__cilk_",          "Cilk_",
+      "Closure_",   "worker_scheduler", "do_what_it_says", "__rts_"};
+  StringRef Name = getBaseName(F);
+  return llvm::any_of(Prefixes,
+                      [&](const char *P) { return Name.starts_with(P); });
+}
+
+/// Return the name of the function that spawns Tapir helper F, or an empty
+/// string if F is not a helper.  Tapir outlines the body of a spawned task or
+/// parallel loop of function foo as foo.outline_<block>.otd<N> or
+/// foo.outline_<block>.ls<N>.
+static StringRef getTapirHelperParent(const BinaryFunction &F) {
+  StringRef Name = getBaseName(F);
+  size_t Pos = Name.rfind(".outline_");
+  return Pos == StringRef::npos ? StringRef() : Name.take_front(Pos);
+}
+
+/// Reorder the hot functions of Clusters so that the hot paths of the Tapir
+/// runtime form one cluster at the front of the text, and each outlined
+/// helper immediately follows its spawning function.  A spawn runs the
+/// parent, the runtime's detach and sync, and the helper in quick
+/// succession (and thieves run the scheduler loop and then the helper), so
+/// keeping them adjacent saves I-cache and iTLB misses on fine-grained
+/// tasks.
+static std::vector<Cluster>
+clusterTapirHelpers(const std::vector<Cluster> &Clusters,
+                    const BinaryFunctionCallGraph &Cg) {
+  std::vector<NodeId> Order;
+  for (const Cluster &C : Clusters)
+    llvm::append_range(Order, C.targets());
+
+  // The helpers of each hot spawning function, in their current order.
+  StringMap<std::vector<NodeId>> Helpers;
+  StringSet<> HotFunctions;
+  for (NodeId Id : Order)
+    HotFunctions.insert(getBaseName(*Cg.nodeIdToFunc(Id)));
+  for (NodeId Id : Order) {
+    StringRef Parent = getTapirHelperParent(*Cg.nodeIdToFunc(Id));
+    if (!Parent.empty() && HotFunctions.contains(Parent))
+      Helpers[Parent].push_back(Id);
+  }
+
+  std::vector<NodeId> Runtime;
+  for (NodeId Id : Order)
+    if (isTapirRuntimeFunction(*Cg.nodeIdToFunc(Id)))
+      Runtime.push_back(Id);
+  if (Runtime.empty() && Helpers.empty())
+    return Clusters;
+
+  std::vector<NodeId> NewOrder;
+  DenseSet<NodeId> Placed;
+  std::function<void(NodeId)> Place = [&](NodeId Id) {
+    if (!Placed.insert(Id).second)
+      return;
+    NewOrder.push_back(Id);
+    auto It = Helpers.find(getBaseName(*Cg.nodeIdToFunc(Id)));
+    if (It != Helpers.end())
+      for (NodeId Helper : It->second)
+        Place(Helper);
+  };
+  for (NodeId Id : Runtime)
+    Placed.insert(Id);
+  for (NodeId Id : Order) {
+    StringRef Parent = getTapirHelperParent(*Cg.nodeIdToFunc(Id));
+    if (Parent.empty() || !HotFunctions.contains(Parent))
+      Place(Id);
+  }
+  // Helpers of helpers that were never placed (e.g., in a cycle of names).
+  for (NodeId Id : Order)
+    Place(Id);
+
+  std::vector<Cluster> NewClusters;
+  if (!Runtime.empty())
+    NewClusters.emplace_back(Runtime, Cg);
+  NewClusters.emplace_back(NewOrder, Cg);
+  return NewClusters;
+}
+
 std::vector<std::string> ReorderFunctions::readFunctionOrderFile() {
   std::vector<std::string> FunctionNames;
   std::ifstream FuncsFile(opts::FunctionOrderFile, std::ios::in);
@@ -425,6 +526,9 @@ void ReorderFunctions::runOnFunctions(BinaryContext &BC) {
   } break;
   }
 
+  if (opts::ClusterTapirHelpers && !Clusters.empty())
+    Clusters = clusterTapirHelpers(Clusters, Cg);
+
   reorder(std::move(Clusters), BFs);
 
   BC.HasFinalizedFunctionOrder = true;
@@ -2109,6 +2109,9 @@ public:
                                  SourceLocation AttrLoc);
 
   CodeAlignAttr *BuildCodeAlignAttr(const AttributeCommonInfo &CI, Expr *E);
+  KitsuneSpecializeAttr *
+  BuildKitsuneSpecializeAttr(const AttributeCommonInfo &CI,
+                             ArrayRef<Expr *> Args);
   bool CheckRebuiltStmtAttributes(ArrayRef<const Attr *> Attrs);
 
   bool CheckQualifiedFunctionForTypeId(QualType T, SourceLocation Loc);
@@ -5412,14 +5412,15 @@ RValue CodeGenFunction::EmitCallExpr(const CallExpr *E,
                                      ReturnValueSlot ReturnValue) {
   // kitsune: handle kokkos-centric details -- specifically we are
   // dealing with a case where we transform a lambda construct into
-  // a traditional loop construct; thus our parallel_for and
-  // parallel_reduce calls result in the removal of a lambda/call.
-  if (getLangOpts().KitsuneOpts.getKokkos()) {
+  // a traditional loop construct; thus our parallel_for, parallel_reduce
+  // and parallel_scan calls result in the removal of a lambda/call.
+  if (getLangOpts().KitsuneOpts.getKokkos() && !InKokkosLibraryCall) {
     const FunctionDecl *fdecl = E->getDirectCallee();
     if (fdecl) {
       std::string qname = fdecl->getQualifiedNameAsString();
       if (qname == "Kokkos::parallel_for" ||
-          qname == "Kokkos::parallel_reduce") {
+          qname == "Kokkos::parallel_reduce" ||
+          qname == "Kokkos::parallel_scan") {
 	// We handle the special case of Tapir target attributes on a
 	// Kokkos "statement" elsewhere (as the attribute is not
 	// really attached to the CallExpr but instead the C++ goop
@@ -5429,6 +5430,16 @@ RValue CodeGenFunction::EmitCallExpr(const CallExpr *E,
 	// transformation/generation.
         if (EmitKokkosConstruct(E, TapirAttrs))
           return RValue::get(nullptr);
+        KokkosLibraryConstructs = true;
+      } else if (qname == "Kokkos::deep_copy") {
+        if (EmitKokkosDeepCopy(E, TapirAttrs))
+          return RValue::get(nullptr);
+      } else if (qname == "Kokkos::fence" ||
+                 (isa<CXXMethodDecl>(fdecl) && fdecl->getIdentifier() &&
+                  fdecl->getName() == "fence" &&
+                  StringRef(qname).starts_with("Kokkos::"))) {
+        if (EmitKokkosFence(E))
+          return RValue::get(nullptr);
       } else if (getLangOpts().KitsuneOpts.getKokkosNoInit() &&
                  (qname == "Kokkos::initialize" ||
                   qname == "Kokkos::finalize"))
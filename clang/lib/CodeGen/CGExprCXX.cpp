@@ -210,6 +210,11 @@ RValue CodeGenFunction::EmitCXXMemberCallExpr(const CXXMemberCallExpr *CE,
                     ReturnValue);
   }
 
+  // kitsune: calls on the team handle of a Kokkos TeamPolicy construct.
+  if (InKokkosConstruct)
+    if (std::optional<RValue> RV = EmitKokkosTeamMemberCall(CE))
+      return *RV;
+
   bool HasQualifier = ME->hasQualifier();
   NestedNameSpecifier *Qualifier = HasQualifier ? ME->getQualifier() : nullptr;
   bool IsArrow = ME->isArrow();
@@ -513,6 +518,11 @@ CodeGenFunction::EmitCXXOperatorMemberCallExpr(const CXXOperatorCallExpr *E,
                                                ReturnValueSlot ReturnValue) {
   assert(MD->isImplicitObjectMemberFunction() &&
          "Trying to emit a member call expr on a static method!");
+  // kitsune: Kokkos::View accesses in a Kokkos construct become plain
+  // address arithmetic.
+  if (InKokkosConstruct)
+    if (std::optional<Address> Elt = EmitKokkosViewAccess(E))
+      return RValue::get(Elt->getPointer());
   return EmitCXXMemberOrOperatorMemberCallExpr(
       E, MD, ReturnValue, /*HasQualifier=*/false, /*Qualifier=*/nullptr,
       /*IsArrow=*/false, E->getArg(0));
@@ -64,37 +64,49 @@ using namespace CodeGen;
 
 LoopAttributes::LSStrategy
 CodeGenFunction::GetTapirStrategyAttr(ArrayRef<const Attr *> Attrs) {
-
-  LoopAttributes::LSStrategy Strategy = LoopAttributes::SEQ;
-
-  auto curAttr = Attrs.begin();
-
-  while (curAttr != Attrs.end()) {
-
-    const attr::Kind AttrKind = (*curAttr)->getKind();
-
-    if (AttrKind == attr::TapirStrategy) {
-      const auto *SAttr = cast<const TapirStrategyAttr>(*curAttr);
-
-      switch (SAttr->getTapirStrategyType()) {
-      case TapirStrategyAttr::SEQ:
-        Strategy = LoopAttributes::SEQ;
-        break;
-      case TapirStrategyAttr::DAC:
-        Strategy = LoopAttributes::DAC;
-        break;
-      case TapirStrategyAttr::GPU:
-        Strategy = LoopAttributes::GPU;
-        break;
-      default:
-        llvm_unreachable("all strategies should be handled before this!");
-        break;
-      }
+  // Forall loops use divide-and-conquer spawning unless a strategy attribute
+  // says otherwise.
+  LoopAttributes::LSStrategy Strategy = LoopAttributes::DAC;
+
+  for (const Attr *curAttr : Attrs) {
+    if (curAttr->getKind() != attr::TapirStrategy)
+      continue;
+
+    const auto *SAttr = cast<const TapirStrategyAttr>(curAttr);
+    switch (SAttr->getTapirStrategyType()) {
+    case TapirStrategyAttr::SEQ:
+      Strategy = LoopAttributes::SEQ;
+      break;
+    case TapirStrategyAttr::DAC:
+    // GPU code generation is selected by the tapir target attribute, so GPU
+    // loops are spawned like any other forall.
+    case TapirStrategyAttr::GPU:
+      Strategy = LoopAttributes::DAC;
+      break;
+    case TapirStrategyAttr::STATIC:
+      Strategy = LoopAttributes::STATIC;
+      break;
+    case TapirStrategyAttr::DYNAMIC:
+      Strategy = LoopAttributes::DYNAMIC;
+      break;
+    case TapirStrategyAttr::GUIDED:
+      Strategy = LoopAttributes::GUIDED;
+      break;
     }
   }
   return Strategy;
 }
 
+// Returns the chunk size of a dynamic or guided strategy attribute, or 0 if
+// there is none.
+unsigned
+CodeGenFunction::GetTapirStrategyChunkAttr(ArrayRef<const Attr *> Attrs) {
+  for (const Attr *curAttr : Attrs)
+    if (const auto *SAttr = dyn_cast<TapirStrategyAttr>(curAttr))
+      return SAttr->getChunk();
+  return 0;
+}
+
 // If a tapir target attribute exists, it will override the tapir target
 // specified on the command line - if any. If a tapir target attribute does not
 // exist and one was specified on the command line, that will be returned.
@@ -114,6 +126,8 @@ CodeGenFunction::GetTapirTargetAttr(ArrayRef<const Attr *> Attrs) {
         return llvm::TapirTargetID::Cuda;
       case TapirTargetAttr::Hip:
         return llvm::TapirTargetID::Hip;
+      case TapirTargetAttr::LevelZero:
+        return llvm::TapirTargetID::LevelZero;
       case TapirTargetAttr::OpenCilk:
         return llvm::TapirTargetID::OpenCilk;
       case TapirTargetAttr::OpenMP:
@@ -122,6 +136,12 @@ CodeGenFunction::GetTapirTargetAttr(ArrayRef<const Attr *> Attrs) {
         return llvm::TapirTargetID::Qthreads;
       case TapirTargetAttr::Realm:
         return llvm::TapirTargetID::Realm;
+      // The loops of hybrid targets are outlined by the GPU target, which
+      // also runs part of them on the host (see IsHybridTapirTargetAttr).
+      case TapirTargetAttr::CudaOpenCilk:
+        return llvm::TapirTargetID::Cuda;
+      case TapirTargetAttr::HipOpenCilk:
+        return llvm::TapirTargetID::Hip;
       default:
         llvm_unreachable("unhandled tapir target attribute!");
       }
@@ -130,6 +150,49 @@ CodeGenFunction::GetTapirTargetAttr(ArrayRef<const Attr *> Attrs) {
   return CGM.getLangOpts().KitsuneOpts.getTapirTarget();
 }
 
+// Return true if the tapir target attribute (if any) asks for hybrid
+// execution on both the host and a GPU.
+bool CodeGenFunction::IsHybridTapirTargetAttr(ArrayRef<const Attr *> Attrs) {
+  for (auto curAttr : Attrs) {
+    if (curAttr->getKind() == attr::TapirTarget) {
+      switch (cast<const TapirTargetAttr>(curAttr)->getTapirTargetAttrType()) {
+      case TapirTargetAttr::CudaOpenCilk:
+      case TapirTargetAttr::HipOpenCilk:
+        return true;
+      default:
+        return false;
+      }
+    }
+  }
+  return false;
+}
+
+// Return true if the loop's completion is waited on at the enclosing sync
+// rather than at the end of the loop.
+bool CodeGenFunction::HasKitsuneAsyncAttr(ArrayRef<const Attr *> Attrs) {
+  for (auto curAttr : Attrs)
+    if (curAttr->getKind() == attr::KitsuneAsync)
+      return true;
+  return false;
+}
+
+// Return the value of the loop's tapir.loop.kitsune.priority metadata: 0
+// for the default priority, 1 for high and 2 for low (the runtimes'
+// KitRTPriority).
+unsigned CodeGenFunction::GetKitsunePriorityAttr(ArrayRef<const Attr *> Attrs) {
+  for (auto curAttr : Attrs)
+    if (const auto *PA = dyn_cast<KitsunePriorityAttr>(curAttr))
+      switch (PA->getPriority()) {
+      case KitsunePriorityAttr::High:
+        return 1;
+      case KitsunePriorityAttr::Low:
+        return 2;
+      case KitsunePriorityAttr::Normal:
+        return 0;
+      }
+  return 0;
+}
+
 llvm::Value *
 CodeGenFunction::GetKitsuneLaunchAttr(ArrayRef<const Attr *> Attrs) {
 
@@ -144,6 +207,86 @@ CodeGenFunction::GetKitsuneLaunchAttr(ArrayRef<const Attr *> Attrs) {
   return nullptr;
 }
 
+// Pass the launch attribute of a GPU forall on to the Tapir target.  The
+// launch configuration is attached to the loop.  The CUDA target also
+// expects the threads-per-block expression as the argument of a
+// placeholder call ahead of the loop that it pairs with the kernel
+// launch (see CudaABI::finalizeLaunchCalls()).
+void CodeGenFunction::EmitKitsuneLaunchAttr(
+    ArrayRef<const Attr *> Attrs, std::optional<llvm::TapirTargetID> TT) {
+  if (TT != llvm::TapirTargetID::Cuda && TT != llvm::TapirTargetID::Hip)
+    return;
+
+  const KitsuneLaunchAttr *LaunchAttr = nullptr;
+  for (const auto *curAttr : Attrs)
+    if (curAttr->getKind() == attr::KitsuneLaunch)
+      LaunchAttr = cast<const KitsuneLaunchAttr>(curAttr);
+  if (not LaunchAttr)
+    return;
+
+  // Sema has verified that the parameters are integer constants.
+  auto GetParam = [&](const Expr *E) -> unsigned {
+    return E ? E->EvaluateKnownConstInt(getContext()).getZExtValue() : 0;
+  };
+  LoopStack.setLoopLaunch(GetParam(LaunchAttr->getThreadsPerBlock()),
+                          GetParam(LaunchAttr->getMaxBlocksPerGrid()),
+                          GetParam(LaunchAttr->getMinBlocksPerMultiproc()),
+                          GetParam(LaunchAttr->getSharedMemBytes()),
+                          GetParam(LaunchAttr->getIterationsPerThread()));
+
+  if (TT == llvm::TapirTargetID::Cuda) {
+    llvm::Value *ThreadsPerBlock = GetKitsuneLaunchAttr(Attrs);
+    llvm::Module &Mod = CGM.getModule();
+    llvm::LLVMContext &Ctx = Mod.getContext();
+    llvm::Type *VoidTy = llvm::Type::getVoidTy(Ctx);
+    llvm::Type *IntTy = llvm::Type::getInt32Ty(Ctx);
+    llvm::FunctionCallee TPBRTCall = Mod.getOrInsertFunction(
+        "__kitrt_dummy_threads_per_blk", VoidTy, IntTy);
+    Builder.CreateCall(TPBRTCall, {ThreadsPerBlock});
+  }
+}
+
+// Pass the values a GPU forall is specialized on to the Tapir target.  The
+// values are the arguments of a placeholder call ahead of the loop, and an
+// ID unique to the loop in the module pairs the call with the loop's
+// metadata.  The CUDA target specializes the kernel on the kernel inputs
+// that are among the values (see CudaLoop::processOutlinedLoopCall()) and
+// removes the call.
+void CodeGenFunction::EmitKitsuneSpecializeAttr(
+    ArrayRef<const Attr *> Attrs, std::optional<llvm::TapirTargetID> TT) {
+  if (TT != llvm::TapirTargetID::Cuda)
+    return;
+
+  const KitsuneSpecializeAttr *SpecAttr = nullptr;
+  for (const auto *curAttr : Attrs)
+    if (curAttr->getKind() == attr::KitsuneSpecialize)
+      SpecAttr = cast<const KitsuneSpecializeAttr>(curAttr);
+  if (not SpecAttr)
+    return;
+
+  llvm::Module &Mod = CGM.getModule();
+  llvm::LLVMContext &Ctx = Mod.getContext();
+  llvm::Type *IntTy = llvm::Type::getInt32Ty(Ctx);
+  llvm::FunctionType *SpecFnTy = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(Ctx), {IntTy}, /*isVarArg=*/true);
+  llvm::FunctionCallee SpecRTCall =
+      Mod.getOrInsertFunction("__kitrt_dummy_specialize", SpecFnTy);
+  // The placeholder must stay ahead of the loop but not keep the values
+  // in memory or block the optimization of the code around it.
+  if (auto *SpecFn = dyn_cast<llvm::Function>(SpecRTCall.getCallee())) {
+    SpecFn->setDoesNotThrow();
+    SpecFn->setWillReturn();
+    SpecFn->setOnlyAccessesInaccessibleMemory();
+  }
+
+  unsigned ID = SpecRTCall.getCallee()->getNumUses() + 1;
+  SmallVector<llvm::Value *, 8> Args = {llvm::ConstantInt::get(IntTy, ID)};
+  for (const Expr *E : SpecAttr->args())
+    Args.push_back(EmitScalarExpr(E));
+  Builder.CreateCall(SpecRTCall, Args);
+  LoopStack.setLoopSpecialize(ID);
+}
+
 llvm::Instruction *CodeGenFunction::EmitLabeledSyncRegionStart(StringRef SV) {
   // Start the sync region.  To ensure the syncregion.start call dominates all
   // uses of the generated token, we insert this call at the alloca insertion
@@ -321,23 +464,12 @@ void CodeGenFunction::EmitForallStmt(const ForallStmt &S,
   // check if the attributes are empty.
   std::optional<llvm::TapirTargetID> TT = GetTapirTargetAttr(ForallAttr);
   LoopStack.setLoopTarget(TT);
+  LoopStack.setLoopHybrid(IsHybridTapirTargetAttr(ForallAttr));
+  LoopStack.setLoopAsync(HasKitsuneAsyncAttr(ForallAttr));
+  LoopStack.setLoopPriority(GetKitsunePriorityAttr(ForallAttr));
 
-  if (TT == llvm::TapirTargetID::Cuda) {
-    llvm::Value *ThreadsPerBlock = GetKitsuneLaunchAttr(ForallAttr);
-    if (ThreadsPerBlock) {
-      // If we have a threads-per-block launch attribute, it is an expression
-      // that we need to insert code gen for.  While it can simple (contsant)
-      // more complex (a runtime computation) we need to worry about aspects
-      // like DCE removal before we get to the Tapir transformation stage.
-      llvm::Module &Mod = CGM.getModule();
-      llvm::LLVMContext &Ctx = Mod.getContext();
-      llvm::Type *VoidTy = llvm::Type::getVoidTy(Ctx);
-      llvm::Type *IntTy = llvm::Type::getInt32Ty(Ctx);
-      llvm::FunctionCallee TPBRTCall = Mod.getOrInsertFunction(
-          "__kitrt_dummy_threads_per_blk", VoidTy, IntTy);
-      Builder.CreateCall(TPBRTCall, {ThreadsPerBlock});
-    }
-  }
+  EmitKitsuneLaunchAttr(ForallAttr, TT);
+  EmitKitsuneSpecializeAttr(ForallAttr, TT);
 
   // New basic blocks and jump destinations with Tapir terminators
   llvm::BasicBlock *Detach = createBasicBlock("forall.detach");
@@ -354,7 +486,9 @@ void CodeGenFunction::EmitForallStmt(const ForallStmt &S,
   PushSyncRegion();
   llvm::Instruction *SRStart = EmitSyncRegionStart();
   CurSyncRegion->setSyncRegionStart(SRStart);
-  LoopStack.setSpawnStrategy(LoopAttributes::DAC);
+  LoopStack.setSpawnStrategy(GetTapirStrategyAttr(ForallAttr));
+  if (unsigned Chunk = GetTapirStrategyChunkAttr(ForallAttr))
+    LoopStack.setTapirGrainsize(Chunk);
 
   JumpDest LoopExit = getJumpDestInCurrentScope("forall.end");
 
@@ -502,23 +636,12 @@ void CodeGenFunction::EmitCXXForallRangeStmt(
 
   std::optional<llvm::TapirTargetID> TT = GetTapirTargetAttr(ForallAttr);
   LoopStack.setLoopTarget(TT);
+  LoopStack.setLoopHybrid(IsHybridTapirTargetAttr(ForallAttr));
+  LoopStack.setLoopAsync(HasKitsuneAsyncAttr(ForallAttr));
+  LoopStack.setLoopPriority(GetKitsunePriorityAttr(ForallAttr));
 
-  if (TT == llvm::TapirTargetID::Cuda) {
-    llvm::Value *ThreadsPerBlock = GetKitsuneLaunchAttr(ForallAttr);
-    if (ThreadsPerBlock) {
-      // If we have a threads-per-block launch attribute, it is an expression
-      // that we need to insert code gen for.  While it can simple (constant)
-      // more complex (a runtime computation) we need to worry about aspects
-      // like DCE removal before we get to the Tapir transformation stage.
-      llvm::Module &Mod = CGM.getModule();
-      llvm::LLVMContext &Ctx = Mod.getContext();
-      llvm::Type *VoidTy = llvm::Type::getVoidTy(Ctx);
-      llvm::Type *IntTy = llvm::Type::getInt32Ty(Ctx);
-      llvm::FunctionCallee TPBRTCall = Mod.getOrInsertFunction(
-          "__kitrt_dummy_threads_per_blk", VoidTy, IntTy);
-      Builder.CreateCall(TPBRTCall, {ThreadsPerBlock});
-    }
-  }
+  EmitKitsuneLaunchAttr(ForallAttr, TT);
+  EmitKitsuneSpecializeAttr(ForallAttr, TT);
 
   // Code modifications necessary for implementing parallel loops not required
   // by serial loops.
@@ -538,7 +661,9 @@ void CodeGenFunction::EmitCXXForallRangeStmt(
   PushSyncRegion();
   llvm::Instruction *SRStart = EmitSyncRegionStart();
   CurSyncRegion->setSyncRegionStart(SRStart);
-  LoopStack.setSpawnStrategy(LoopAttributes::DAC);
+  LoopStack.setSpawnStrategy(GetTapirStrategyAttr(ForallAttr));
+  if (unsigned Chunk = GetTapirStrategyChunkAttr(ForallAttr))
+    LoopStack.setTapirGrainsize(Chunk);
 
   llvm::BasicBlock *End = createBasicBlock("forall.end");
 
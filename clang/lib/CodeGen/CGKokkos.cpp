@@ -50,8 +50,11 @@
  *z
  ***************************************************************************/
 #include "CodeGenFunction.h"
+#include "clang/AST/ExprCXX.h"
 #include "clang/CodeGen/CGFunctionInfo.h"
 #include "clang/Frontend/FrontendDiagnostic.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringSwitch.h"
 #include <cstdio>
 
 using namespace clang;
@@ -70,6 +73,237 @@ namespace {
 static const Expr *SimplifyExpr(const Expr *E) {
   return E->IgnoreImplicit()->IgnoreImpCasts();
 }
+
+// TeamPolicy(league_size, team_size[, vector_length]) as the policy of a
+// parallel construct.
+static const CXXConstructExpr *GetKokkosTeamPolicy(const Expr *E) {
+  E = SimplifyExpr(E);
+  if (const auto *FCE = dyn_cast<CXXFunctionalCastExpr>(E))
+    E = SimplifyExpr(FCE->getSubExpr());
+  const auto *CCE = dyn_cast<CXXConstructExpr>(E);
+  if (!CCE || CCE->getNumArgs() < 1 ||
+      CCE->getConstructor()->getParent()->getQualifiedNameAsString() !=
+          "Kokkos::TeamPolicy")
+    return nullptr;
+  return CCE;
+}
+
+// TeamThreadRange, ThreadVectorRange or TeamVectorRange(team, [begin,] end)
+// as the policy of a parallel construct nested in a team.
+static const CallExpr *GetKokkosThreadRange(const Expr *E) {
+  const auto *Call = dyn_cast<CallExpr>(SimplifyExpr(E));
+  if (!Call || !Call->getDirectCallee() || Call->getNumArgs() < 2 ||
+      Call->getNumArgs() > 3)
+    return nullptr;
+  std::string Name = Call->getDirectCallee()->getQualifiedNameAsString();
+  if (Name != "Kokkos::TeamThreadRange" && Name != "Kokkos::ThreadVectorRange" &&
+      Name != "Kokkos::TeamVectorRange")
+    return nullptr;
+  return Call;
+}
+
+static bool IsKokkosTeamMember(const Expr *E, const ParmVarDecl *Member) {
+  const auto *DRE = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+  return DRE && DRE->getDecl() == Member;
+}
+
+// The methods of the team handle that are emitted for a team of one thread.
+static bool IsKokkosTeamMethod(const CXXMethodDecl *MD) {
+  if (!MD->getIdentifier())
+    return false;
+  return llvm::StringSwitch<bool>(MD->getName())
+      .Cases("league_rank", "league_size", "team_rank", "team_size",
+             "team_barrier", true)
+      .Default(false);
+}
+
+// Check that S uses the team handle Member only in calls of the methods
+// above and as the team of the thread ranges of nested parallel_for and
+// parallel_reduce constructs, none of which need the handle itself.  Team
+// scratch memory, broadcasts, team-level reductions and single() need a
+// runtime team and are not supported.
+static bool CheckKokkosTeamUses(const Stmt *S, const ParmVarDecl *Member) {
+  if (!S)
+    return true;
+  if (const auto *LE = dyn_cast<LambdaExpr>(S))
+    return CheckKokkosTeamUses(LE->getBody(), Member);
+  if (const auto *DRE = dyn_cast<DeclRefExpr>(S))
+    return DRE->getDecl() != Member;
+  if (const auto *MCE = dyn_cast<CXXMemberCallExpr>(S))
+    if (IsKokkosTeamMember(MCE->getImplicitObjectArgument(), Member))
+      return MCE->getNumArgs() == 0 && IsKokkosTeamMethod(MCE->getMethodDecl());
+  if (const auto *Call = dyn_cast<CallExpr>(S))
+    if (const FunctionDecl *FD = Call->getDirectCallee()) {
+      std::string Name = FD->getQualifiedNameAsString();
+      if (Name == "Kokkos::parallel_for" || Name == "Kokkos::parallel_reduce") {
+        for (const Expr *Arg : Call->arguments()) {
+          const CallExpr *Range = GetKokkosThreadRange(Arg);
+          if (!Range) {
+            if (!CheckKokkosTeamUses(Arg, Member))
+              return false;
+            continue;
+          }
+          for (unsigned i = 1; i < Range->getNumArgs(); ++i)
+            if (!CheckKokkosTeamUses(Range->getArg(i), Member))
+              return false;
+        }
+        return true;
+      }
+    }
+  for (const Stmt *Child : S->children())
+    if (!CheckKokkosTeamUses(Child, Member))
+      return false;
+  return true;
+}
+
+// Kokkos::View element accesses -- view(i, j, ...) -- are calls to a
+// templated operator() that reloads the data pointer and the strides from the
+// View on every access.  In the body of a parallel construct we instead
+// compute them once, before the loop, and emit each access as a GEP off the
+// data pointer.  Only views with an affine layout are handled: the unit
+// stride of LayoutRight (last index) and LayoutLeft (first index) is folded
+// statically, all other strides are found by taking the address of
+// neighboring elements through operator() itself (so any padding of the
+// layout is respected and nothing beyond operator() has to be instantiated).
+// Note that with Kokkos' debug bounds checking enabled these probes are
+// checked against the extents of the View.
+
+// Return the record of the array_layout of the View record RD.
+static const CXXRecordDecl *GetKokkosViewLayout(const CXXRecordDecl *RD) {
+  IdentifierInfo &II = RD->getASTContext().Idents.get("array_layout");
+  for (const NamedDecl *ND : RD->lookup(&II))
+    if (const auto *TD = dyn_cast<TypedefNameDecl>(ND))
+      return TD->getUnderlyingType()->getAsCXXRecordDecl();
+  for (const CXXBaseSpecifier &Base : RD->bases())
+    if (const CXXRecordDecl *BaseRD = Base.getType()->getAsCXXRecordDecl())
+      if (const CXXRecordDecl *Layout = GetKokkosViewLayout(BaseRD))
+        return Layout;
+  return nullptr;
+}
+
+// Is E a call to Kokkos::View::operator() with integer indices that returns
+// a reference to the element?
+static bool IsKokkosViewAccess(const CXXOperatorCallExpr *E) {
+  if (E->getOperator() != OO_Call || E->getNumArgs() < 2)
+    return false;
+  const auto *MD = dyn_cast_or_null<CXXMethodDecl>(E->getCalleeDecl());
+  if (!MD || MD->isVirtual() || !MD->isImplicitObjectMemberFunction() ||
+      MD->getParent()->getQualifiedNameAsString() != "Kokkos::View" ||
+      !MD->getReturnType()->isLValueReferenceType())
+    return false;
+  const auto *FPT = MD->getType()->castAs<FunctionProtoType>();
+  if (FPT->isVariadic() || FPT->getNumParams() != E->getNumArgs() - 1)
+    return false;
+  for (QualType ParamTy : FPT->getParamTypes())
+    if (!ParamTy.getNonReferenceType()->isIntegerType())
+      return false;
+  for (unsigned i = 1; i < E->getNumArgs(); ++i)
+    if (!E->getArg(i)->getType()->isIntegerType())
+      return false;
+  return true;
+}
+
+// Collect the View accesses in S, outside of any nested lambda.
+static void FindKokkosViewAccesses(
+    const Stmt *S, SmallVectorImpl<const CXXOperatorCallExpr *> &Accesses) {
+  if (!S || isa<LambdaExpr>(S))
+    return;
+  if (const auto *OCE = dyn_cast<CXXOperatorCallExpr>(S))
+    if (IsKokkosViewAccess(OCE))
+      Accesses.push_back(OCE);
+  for (const Stmt *Child : S->children())
+    FindKokkosViewAccesses(Child, Accesses);
+}
+
+// The View accessed by E, if it is a variable captured by copy by Lambda (or
+// a field of one); such a View cannot change during the loop.
+using KokkosViewKey = std::pair<const VarDecl *, const FieldDecl *>;
+static std::optional<KokkosViewKey>
+GetKokkosViewKey(const Expr *E, const LambdaExpr *Lambda) {
+  E = E->IgnoreParenImpCasts();
+  const FieldDecl *FD = nullptr;
+  if (const auto *ME = dyn_cast<MemberExpr>(E)) {
+    FD = dyn_cast<FieldDecl>(ME->getMemberDecl());
+    if (!FD || ME->isArrow())
+      return std::nullopt;
+    E = ME->getBase()->IgnoreParenImpCasts();
+  }
+  const auto *DRE = dyn_cast<DeclRefExpr>(E);
+  if (!DRE || !DRE->refersToEnclosingVariableOrCapture())
+    return std::nullopt;
+  const auto *VD = dyn_cast<VarDecl>(DRE->getDecl());
+  if (!VD)
+    return std::nullopt;
+  for (const LambdaCapture &C : Lambda->captures())
+    if (C.capturesVariable() && C.getCapturedVar() == VD)
+      return C.getCaptureKind() == LCK_ByCopy
+                 ? std::optional<KokkosViewKey>({VD->getCanonicalDecl(), FD})
+                 : std::nullopt;
+  return std::nullopt;
+}
+
+// Return the View member function Name of RD that takes no arguments, if
+// it has been instantiated (e.g., by the Kokkos function being replaced).
+static const CXXMethodDecl *GetKokkosViewMethod(const CXXRecordDecl *RD,
+                                                StringRef Name) {
+  IdentifierInfo &II = RD->getASTContext().Idents.get(Name);
+  for (const NamedDecl *ND : RD->lookup(&II))
+    if (const auto *MD = dyn_cast<CXXMethodDecl>(ND))
+      if (MD->getNumParams() == 0 && !MD->isVirtual() &&
+          MD->isImplicitObjectMemberFunction() && MD->isDefined())
+        return MD;
+  return nullptr;
+}
+
+// Emit a call of the View member function MD, which takes no arguments,
+// on This.
+static llvm::Value *EmitKokkosViewMethodCall(CodeGenFunction &CGF,
+                                             const CXXMethodDecl *MD,
+                                             llvm::Value *This) {
+  CodeGenModule &CGM = CGF.CGM;
+  const auto *FPT = MD->getType()->castAs<FunctionProtoType>();
+  CallArgList Args;
+  Args.add(RValue::get(This),
+           CGM.getTypes().DeriveThisType(MD->getParent(), MD));
+  const CGFunctionInfo &FnInfo = CGM.getTypes().arrangeCXXMethodCall(
+      Args, FPT, RequiredArgs::forPrototypePlus(FPT, 1), 0);
+  llvm::FunctionType *FnTy = CGM.getTypes().GetFunctionType(
+      CGM.getTypes().arrangeCXXMethodDeclaration(MD));
+  CGCallee Callee =
+      CGCallee::forDirect(CGM.GetAddrOfFunction(MD, FnTy), GlobalDecl(MD));
+  return CGF.EmitCall(FnInfo, Callee, ReturnValueSlot(), Args).getScalarVal();
+}
+
+// Emit a call of the View operator() MD on This with the constant Index.
+static llvm::Value *EmitKokkosViewElementAddress(CodeGenFunction &CGF,
+                                                 const CXXMethodDecl *MD,
+                                                 llvm::Value *This,
+                                                 ArrayRef<uint64_t> Index) {
+  CodeGenModule &CGM = CGF.CGM;
+  const auto *FPT = MD->getType()->castAs<FunctionProtoType>();
+  CallArgList Args;
+  Args.add(RValue::get(This),
+           CGM.getTypes().DeriveThisType(MD->getParent(), MD));
+  for (unsigned i = 0; i < Index.size(); ++i) {
+    QualType ParamTy = FPT->getParamType(i);
+    QualType IdxTy = ParamTy.getNonReferenceType().getUnqualifiedType();
+    llvm::Value *Idx =
+        llvm::ConstantInt::get(CGF.ConvertType(IdxTy), Index[i]);
+    if (ParamTy->isReferenceType()) {
+      Address Tmp = CGF.CreateMemTemp(IdxTy, "kokkos.view.idx");
+      CGF.Builder.CreateStore(Idx, Tmp);
+      Idx = Tmp.getPointer();
+    }
+    Args.add(RValue::get(Idx), ParamTy);
+  }
+  const CGFunctionInfo &FnInfo = CGM.getTypes().arrangeCXXMethodCall(
+      Args, FPT, RequiredArgs::forPrototypePlus(FPT, 1), 0);
+  llvm::FunctionType *FnTy = CGM.getTypes().GetFunctionType(
+      CGM.getTypes().arrangeCXXMethodDeclaration(MD));
+  CGCallee Callee =
+      CGCallee::forDirect(CGM.GetAddrOfFunction(MD, FnTy), GlobalDecl(MD));
+  return CGF.EmitCall(FnInfo, Callee, ReturnValueSlot(), Args).getScalarVal();
+}
 } // namespace
 
 // Sort through what sort of Kokkos construct we're looking at
@@ -87,6 +321,8 @@ bool CodeGenFunction::EmitKokkosConstruct(const CallExpr *CE,
     return EmitKokkosParallelFor(CE, Attrs);
   } else if (Func->getQualifiedNameAsString() == "Kokkos::parallel_reduce") {
     return EmitKokkosParallelReduce(CE, Attrs);
+  } else if (Func->getQualifiedNameAsString() == "Kokkos::parallel_scan") {
+    return EmitKokkosParallelScan(CE, Attrs);
   } else {
     return false;
   }
@@ -116,7 +352,8 @@ bool CodeGenFunction::ParseAndValidateParallelFor(
     SmallVector<
         std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>,
         6> &IVInfos,
-    const LambdaExpr *&LE, DiagnosticsEngine &Diags) {
+    const LambdaExpr *&LE, const Expr *&LeagueSize, DiagnosticsEngine &Diags,
+    unsigned NumReductionParams) {
   // Recognized constructs:
   //
   //   1. parallel_for(["name"], N, lambda_expr...);
@@ -124,6 +361,18 @@ bool CodeGenFunction::ParseAndValidateParallelFor(
   //   2. parallel_for(["name"],
   //   Kokkos::MDRangePolicy<Kokkos::Rank<DIM>>({0,0,...},{N,K,...}),
   //   lambda_expr...);
+  //
+  //   3. parallel_for(["name"], Kokkos::TeamPolicy<>(N, team_size, ...),
+  //   lambda_expr(team)...);
+  //
+  //   4. parallel_for(Kokkos::TeamThreadRange(team, [begin,] end),
+  //   lambda_expr...) within the body of a TeamPolicy construct (also
+  //   ThreadVectorRange and TeamVectorRange).
+  //
+  // For a TeamPolicy, LeagueSize is set to the number of teams and no
+  // induction variables are returned; the lambda's first parameter is the
+  // team handle.
+  LeagueSize = nullptr;
 
   unsigned int curArgIndex = 0;
   const Expr *SE =
@@ -146,7 +395,18 @@ bool CodeGenFunction::ParseAndValidateParallelFor(
   SmallVector<std::pair<const Expr *, const Expr *>, 6> BoundsList;
 
   const CXXTemporaryObjectExpr *CXXTO = dyn_cast<CXXTemporaryObjectExpr>(SE);
-  if (CXXTO &&
+  if (const CXXConstructExpr *Team = GetKokkosTeamPolicy(SE)) {
+    // The team and vector sizes are hints for the runtime; each team is run
+    // by a single thread.
+    LeagueSize = Team->getArg(0);
+  } else if (const CallExpr *Range = GetKokkosThreadRange(SE)) {
+    if (Range->getNumArgs() == 3)
+      BoundsList.push_back(std::pair<const Expr *, const Expr *>(
+          Range->getArg(1), Range->getArg(2)));
+    else
+      BoundsList.push_back(
+          std::pair<const Expr *, const Expr *>(nullptr, Range->getArg(1)));
+  } else if (CXXTO &&
       CXXTO->getBestDynamicClassType()->getNameAsString() == "MDRangePolicy") {
     // The first non-name argument is an MDRangePolicy, extract both lower and
     // upper bounds for multiple induction variables
@@ -209,8 +469,31 @@ bool CodeGenFunction::ParseAndValidateParallelFor(
 
   // TODO: DO WAY MORE ERROR CHECKING...
 
-  // Pack everything up
-  for (unsigned i = 0; i < Params.size(); ++i)
+  if (LeagueSize) {
+    const ParmVarDecl *Member = Params[0];
+    if (Params.size() != 1 + NumReductionParams ||
+        !Member->getType()->isReferenceType() ||
+        !Member->getType().getNonReferenceType()->isRecordType()) {
+      Diags.Report(CE->getExprLoc(), diag::warn_kokkos_team_unsupported)
+          << "the lambda must take the team handle by reference";
+      return false;
+    }
+    if (!CheckKokkosTeamUses(LE->getBody(), Member)) {
+      Diags.Report(CE->getExprLoc(), diag::warn_kokkos_team_unsupported)
+          << "the team handle is used other than for its league and team "
+             "ranks and sizes, barriers and thread ranges";
+      return false;
+    }
+    return true;
+  }
+
+  // Pack everything up -- any trailing reduction parameters are not
+  // induction variables.
+  if (Params.size() - NumReductionParams > BoundsList.size()) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_unknown_bounds_expr);
+    return false;
+  }
+  for (unsigned i = 0; i < Params.size() - NumReductionParams; ++i)
     IVInfos.push_back({Params[i], BoundsList[i]});
 
   // Everything was parsed correctly
@@ -239,8 +522,9 @@ void CodeGenFunction::EmitAndInitializeKokkosIV(
   Builder.CreateStore(InitValue, GetAddrOfLocalVar(IV));
 }
 
-// Emit a Kokkos parallel for condition
-llvm::Value *CodeGenFunction::EmitKokkosParallelForCond(
+// Emit the upper bound of a Kokkos induction variable (converted to the
+// type of the induction variable).
+llvm::Value *CodeGenFunction::EmitKokkosUpperBound(
     const std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>
         &IVInfo) {
 
@@ -269,8 +553,16 @@ llvm::Value *CodeGenFunction::EmitKokkosParallelForCond(
   } else {
     // bit count matches, nothing to do...
   }
+  return LoopEnd;
+}
 
-  llvm::Value *InductionVal = Builder.CreateLoad(GetAddrOfLocalVar(IV));
+// Emit a Kokkos parallel for condition
+llvm::Value *CodeGenFunction::EmitKokkosParallelForCond(
+    const std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>
+        &IVInfo) {
+  llvm::Value *LoopEnd = EmitKokkosUpperBound(IVInfo);
+  llvm::Value *InductionVal =
+      Builder.CreateLoad(GetAddrOfLocalVar(IVInfo.first));
   return Builder.CreateICmpULT(InductionVal, LoopEnd);
 }
 
@@ -289,11 +581,159 @@ void CodeGenFunction::EmitKokkosIncrement(const ParmVarDecl *IV) {
   Builder.CreateStore(IncVal, GetAddrOfLocalVar(IV));
 }
 
+// Emit a call of a method of the team handle of the TeamPolicy construct
+// being emitted, for a team of one thread.
+std::optional<RValue>
+CodeGenFunction::EmitKokkosTeamMemberCall(const CXXMemberCallExpr *CE) {
+  if (!KokkosTeam.Member ||
+      !IsKokkosTeamMember(CE->getImplicitObjectArgument(), KokkosTeam.Member))
+    return std::nullopt;
+  const CXXMethodDecl *MD = CE->getMethodDecl();
+  if (!IsKokkosTeamMethod(MD))
+    return std::nullopt;
+
+  // The nested constructs sync before they return, so there is nothing for
+  // a barrier to wait for.
+  StringRef Name = MD->getName();
+  if (Name == "team_barrier")
+    return RValue::get(nullptr);
+
+  llvm::Value *V = nullptr;
+  if (Name == "league_rank")
+    V = KokkosTeam.LeagueRank;
+  else if (Name == "league_size")
+    V = KokkosTeam.LeagueSize;
+  else if (Name == "team_rank")
+    V = llvm::ConstantInt::get(Int64Ty, 0);
+  else
+    V = llvm::ConstantInt::get(Int64Ty, 1);
+  return RValue::get(
+      Builder.CreateIntCast(V, ConvertType(CE->getType()), /*isSigned=*/false));
+}
+
+// Compute the data pointer and strides of each View accessed in the body
+// of Lambda, and record them for its accesses.
+void CodeGenFunction::EmitKokkosViewAccessInfo(const LambdaExpr *Lambda) {
+  KokkosViewAccesses.clear();
+  // A mutable lambda may assign to its copy of a View.
+  if (Lambda->isMutable())
+    return;
+
+  SmallVector<const CXXOperatorCallExpr *, 16> Accesses;
+  FindKokkosViewAccesses(Lambda->getBody(), Accesses);
+  llvm::MapVector<KokkosViewKey, SmallVector<const CXXOperatorCallExpr *, 4>>
+      Views;
+  for (const CXXOperatorCallExpr *E : Accesses)
+    if (std::optional<KokkosViewKey> Key = GetKokkosViewKey(E->getArg(0),
+                                                            Lambda))
+      Views[*Key].push_back(E);
+
+  for (const auto &View : Views) {
+    const CXXOperatorCallExpr *First = View.second.front();
+    const unsigned Rank = First->getNumArgs() - 1;
+    if (llvm::any_of(View.second, [Rank](const CXXOperatorCallExpr *E) {
+          return E->getNumArgs() - 1 != Rank;
+        }))
+      continue;
+
+    const auto *MD = cast<CXXMethodDecl>(First->getCalleeDecl());
+    const CXXRecordDecl *Layout = GetKokkosViewLayout(MD->getParent());
+    if (!Layout)
+      continue;
+    std::string LayoutName = Layout->getQualifiedNameAsString();
+    std::optional<unsigned> UnitStride;
+    if (LayoutName == "Kokkos::LayoutRight")
+      UnitStride = Rank - 1;
+    else if (LayoutName == "Kokkos::LayoutLeft")
+      UnitStride = 0;
+    else if (LayoutName != "Kokkos::LayoutStride")
+      continue;
+
+    QualType EltTy = MD->getReturnType()->getPointeeType();
+    KokkosViewInfo Info;
+    Info.ElemTy = ConvertTypeForMem(EltTy);
+    Info.Align = getContext().getTypeAlignInChars(EltTy);
+
+    // The View is a capture of the lambda, so look it up as the body would.
+    const bool OuterInKokkosConstruct = InKokkosConstruct;
+    InKokkosConstruct = true;
+    llvm::Value *This = EmitLValue(First->getArg(0)).getPointer(*this);
+    InKokkosConstruct = OuterInKokkosConstruct;
+
+    SmallVector<uint64_t, 4> Index(Rank, 0);
+    Info.Data = EmitKokkosViewElementAddress(*this, MD, This, Index);
+    for (unsigned i = 0; i < Rank; ++i) {
+      if (UnitStride && *UnitStride == i) {
+        Info.Strides.push_back(llvm::ConstantInt::get(Int64Ty, 1));
+        continue;
+      }
+      Index[i] = 1;
+      llvm::Value *Next = EmitKokkosViewElementAddress(*this, MD, This, Index);
+      Index[i] = 0;
+      Info.Strides.push_back(Builder.CreatePtrDiff(Info.ElemTy, Next,
+                                                   Info.Data,
+                                                   "kokkos.view.stride"));
+    }
+    for (const CXXOperatorCallExpr *E : View.second)
+      KokkosViewAccesses[E] = Info;
+  }
+}
+
+// Emit the address of the element accessed by E, if its View was recorded
+// by EmitKokkosViewAccessInfo().
+std::optional<Address>
+CodeGenFunction::EmitKokkosViewAccess(const CXXOperatorCallExpr *E) {
+  auto It = KokkosViewAccesses.find(E);
+  if (It == KokkosViewAccesses.end())
+    return std::nullopt;
+  const KokkosViewInfo &Info = It->second;
+
+  llvm::Value *Offset = nullptr;
+  for (unsigned i = 0; i < Info.Strides.size(); ++i) {
+    const Expr *Arg = E->getArg(i + 1);
+    if (const auto *MTE = dyn_cast<MaterializeTemporaryExpr>(Arg))
+      Arg = MTE->getSubExpr();
+    llvm::Value *Idx = Arg->isGLValue()
+                           ? EmitLoadOfScalar(EmitLValue(Arg), Arg->getExprLoc())
+                           : EmitScalarExpr(Arg);
+    Idx = Builder.CreateIntCast(Idx, Int64Ty,
+                                Arg->getType()->isSignedIntegerType());
+    auto *Stride = dyn_cast<llvm::ConstantInt>(Info.Strides[i]);
+    if (!Stride || !Stride->isOne())
+      Idx = Builder.CreateMul(Idx, Info.Strides[i]);
+    Offset = Offset ? Builder.CreateAdd(Offset, Idx) : Idx;
+  }
+  return Address(Builder.CreateInBoundsGEP(Info.ElemTy, Info.Data, Offset,
+                                           "kokkos.view.elt"),
+                 Info.ElemTy, Info.Align);
+}
+
 // Emit the whole Kokkos parallel for
 bool CodeGenFunction::EmitKokkosParallelFor(
-    const CallExpr *CE, ArrayRef<const Attr *> KokkosAttrs) {
+    const CallExpr *CE, ArrayRef<const Attr *> KokkosAttrs,
+    const KokkosReduction *Reduction) {
+  // Parse and validate the parallel for.  Nothing has been emitted yet, so
+  // an unrecognized construct falls back to the standard C++ mode.
+  std::string PFName; // construct name (for kokkos profiling)
+  SmallVector<
+      std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>, 6>
+      IVInfos;
+  const LambdaExpr *Lambda = nullptr; // the lambda (loop body)
+  const Expr *LeagueSize = nullptr;   // the number of teams of a TeamPolicy
+  DiagnosticsEngine &Diags = CGM.getDiags();
+  if (!ParseAndValidateParallelFor(CE, PFName, IVInfos, Lambda, LeagueSize,
+                                   Diags, Reduction ? 1 : 0)) {
+    llvm::dbgs() << "  warning: unrecognized kokkos::parallel_for...\n";
+    return false;
+  }
+  const unsigned int numIVs = IVInfos.size();
+
   std::optional<llvm::TapirTargetID> TT = GetTapirTargetAttr(KokkosAttrs);
   LoopStack.setLoopTarget(TT);
+  LoopStack.setLoopHybrid(IsHybridTapirTargetAttr(KokkosAttrs));
+  // An asynchronous parallel_for is waited for by the next Kokkos::fence
+  // (see EmitKokkosFence()).
+  LoopStack.setLoopAsync(!Reduction && HasKitsuneAsyncAttr(KokkosAttrs));
 
   // New basic blocks and jump destinations with Tapir terminators
   // Note that we only need one of each of these regardless of the number of
@@ -314,18 +754,32 @@ bool CodeGenFunction::EmitKokkosParallelFor(
   CurSyncRegion->setSyncRegionStart(SRStart);
   LoopStack.setSpawnStrategy(LoopAttributes::DAC);
 
-  // Parse and validate the parallel for
-  std::string PFName; // construct name (for kokkos profiling)
-  SmallVector<
-      std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>, 6>
-      IVInfos;
-  const LambdaExpr *Lambda = nullptr; // the lambda (loop body)
-  DiagnosticsEngine &Diags = CGM.getDiags();
-  if (!ParseAndValidateParallelFor(CE, PFName, IVInfos, Lambda, Diags)) {
-    llvm::dbgs() << "  warning: unrecognized kokkos::parallel_for...\n";
-    return true;
-  }
-  const unsigned int numIVs = IVInfos.size();
+  // Compute the data pointers and strides of the Views used in the body.
+  llvm::DenseMap<const CXXOperatorCallExpr *, KokkosViewInfo>
+      OuterViewAccesses;
+  std::swap(OuterViewAccesses, KokkosViewAccesses);
+  EmitKokkosViewAccessInfo(Lambda);
+
+  // Multi-dimensional (MDRangePolicy) loops are collapsed into a single
+  // parallel loop over the flattened, row-major, iteration space (the
+  // last induction variable varies the fastest).  Each iteration
+  // recovers its induction variables with a division and remainder by
+  // the extents -- the form the GPU targets launch with a matching 2D/3D
+  // geometry -- instead of running the outer loops serially with a
+  // parallel loop (and launch) per outer iteration.
+  //
+  // A TeamPolicy is a single parallel loop over the league (see
+  // KokkosTeamInfo); the thread ranges in its body are emitted as nested
+  // constructs.
+  const bool Collapse = numIVs > 1;
+  const bool Team = LeagueSize != nullptr;
+  const unsigned int numLoops = (Collapse || Team) ? 1 : numIVs;
+  KokkosTeamInfo OuterTeam = KokkosTeam;
+  const bool OuterInKokkosConstruct = InKokkosConstruct;
+  SmallVector<llvm::Value *, 6> IVLowers;
+  SmallVector<llvm::Value *, 6> IVExtents;
+  Address FlatIV = Address::invalid();
+  llvm::Value *FlatTripCount = nullptr;
 
   JumpDest LoopExit = getJumpDestInCurrentScope("kokkos.forall.end");
 
@@ -341,7 +795,7 @@ bool CodeGenFunction::EmitKokkosParallelFor(
   // Break from precedent and create all the basic blocks first because in the
   // codegen we need to link to the *next* increment block. Could probably move
   // the Increment creation to the code, but since I already have the loop...
-  for (unsigned int i = 0; i < numIVs; ++i) {
+  for (unsigned int i = 0; i < numLoops; ++i) {
     Condition.push_back(getJumpDestInCurrentScope("kokkos.forall.cond"));
     CondBlock.push_back(Condition.back().getBlock());
     Increment.push_back(getJumpDestInCurrentScope("kokkos.forall.inc"));
@@ -349,14 +803,42 @@ bool CodeGenFunction::EmitKokkosParallelFor(
 
   // Emit and initialize the outermost IV initialization before the loop. This
   // is the analog of EmitStmt(S.getInit());
-  EmitAndInitializeKokkosIV(IVInfos[0]);
+  if (Collapse) {
+    // The bounds are evaluated once; an empty range in any dimension
+    // has no iterations.
+    FlatTripCount = llvm::ConstantInt::get(Int64Ty, 1);
+    for (const auto &IVInfo : IVInfos) {
+      EmitAndInitializeKokkosIV(IVInfo);
+      llvm::Value *Lower = Builder.CreateLoad(GetAddrOfLocalVar(IVInfo.first));
+      llvm::Value *Upper = EmitKokkosUpperBound(IVInfo);
+      llvm::Value *Extent = Builder.CreateSelect(
+          Builder.CreateICmpUGT(Upper, Lower), Builder.CreateSub(Upper, Lower),
+          llvm::Constant::getNullValue(Lower->getType()));
+      Extent = Builder.CreateZExt(Extent, Int64Ty, "kokkos.forall.extent");
+      IVLowers.push_back(Lower);
+      IVExtents.push_back(Extent);
+      FlatTripCount = Builder.CreateMul(FlatTripCount, Extent);
+    }
+    FlatIV = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.forall.flat");
+    Builder.CreateStore(llvm::ConstantInt::get(Int64Ty, 0), FlatIV);
+  } else if (Team) {
+    llvm::Value *NumTeams = EmitScalarExpr(LeagueSize);
+    FlatTripCount = Builder.CreateIntCast(
+        NumTeams, Int64Ty, LeagueSize->getType()->isSignedIntegerType(),
+        "kokkos.league.size");
+    KokkosTeam.Member = Lambda->getCallOperator()->getParamDecl(0);
+    KokkosTeam.LeagueSize = FlatTripCount;
+    FlatIV = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.league.rank");
+    Builder.CreateStore(llvm::ConstantInt::get(Int64Ty, 0), FlatIV);
+  } else
+    EmitAndInitializeKokkosIV(IVInfos[0]);
 
   // Get the source range of the parallel_for once
   const SourceRange &R = CE->getSourceRange();
 
   // loop over induction variables to create nested loop conditions and
   // increments
-  for (unsigned int i = 0; i < numIVs; ++i) {
+  for (unsigned int i = 0; i < numLoops; ++i) {
 
     // Create a lexical scope for each induction variable. Using new, allows us
     // defer creation to here
@@ -369,7 +851,7 @@ bool CodeGenFunction::EmitKokkosParallelFor(
     // EmitStmt(S.getInit());
     // The allocas all go to the top, but the variable reset of the next IV will
     // correctly happen in the nested condition blocks.
-    if (i < numIVs - 1)
+    if (i < numLoops - 1)
       EmitAndInitializeKokkosIV(IVInfos[i + 1]);
 
     LoopStack.push(CondBlock[i], CGM.getContext(), CGM.getCodeGenOpts(),
@@ -391,9 +873,12 @@ bool CodeGenFunction::EmitKokkosParallelFor(
     // C99 6.8.5p2/p4: The first substatement is executed if the expression
     // compares unequal to 0.  The condition must be a scalar type.
     // Create the conditional.
-    llvm::Value *BoolCondVal = EmitKokkosParallelForCond(IVInfos[i]);
+    llvm::Value *BoolCondVal =
+        FlatIV.isValid()
+            ? Builder.CreateICmpULT(Builder.CreateLoad(FlatIV), FlatTripCount)
+            : EmitKokkosParallelForCond(IVInfos[i]);
     Builder.CreateCondBr(
-        BoolCondVal, (i < numIVs - 1 ? CondBlock[i + 1] : Detach),
+        BoolCondVal, (i < numLoops - 1 ? CondBlock[i + 1] : Detach),
         (i == 0 ? Sync.getBlock() : Increment[i - 1].getBlock()));
     // DWS fix profile weights
     // ,createProfileWeightsForLoop(S.getCond(), getProfileCount(S.getBody()))
@@ -405,6 +890,27 @@ bool CodeGenFunction::EmitKokkosParallelFor(
 
   EmitBlock(Detach);
 
+  // Recover the induction variables of a collapsed loop from the
+  // flattened index.
+  if (Collapse) {
+    llvm::Value *Flat = Builder.CreateLoad(FlatIV);
+    for (int i = numIVs - 1; i >= 0; --i) {
+      llvm::Value *Coord = Flat;
+      if (i > 0) {
+        Coord = Builder.CreateURem(Flat, IVExtents[i]);
+        Flat = Builder.CreateUDiv(Flat, IVExtents[i]);
+      }
+      llvm::Value *Lower = IVLowers[i];
+      Builder.CreateStore(
+          Builder.CreateAdd(Lower, Builder.CreateTrunc(Coord, Lower->getType())),
+          GetAddrOfLocalVar(IVInfos[i].first));
+    }
+  }
+
+  // The league rank of a team is read by value before the detach.
+  if (Team)
+    KokkosTeam.LeagueRank = Builder.CreateLoad(FlatIV);
+
   // Create threadsafe induction variables before the detach and put them in
   // IVInfoDeclMap
   for (const auto &IVInfo : IVInfos)
@@ -443,9 +949,28 @@ bool CodeGenFunction::EmitKokkosParallelFor(
     for (const auto &ivp : IVDeclMap)
       EmitThreadSafeIV(ivp.first, ivp.second.second);
 
+    // Bind the reduction's update parameter to a private copy of the
+    // value for this iteration.
+    Address ReducePriv = Address::invalid();
+    if (Reduction) {
+      const ParmVarDecl *UpdateParm = Reduction->UpdateParm;
+      ReducePriv = CreateMemTemp(UpdateParm->getType().getNonReferenceType(),
+                                 "kokkos.reduce.priv");
+      Builder.CreateStore(Reduction->Identity, ReducePriv);
+      EmitVarDecl(*UpdateParm);
+      Builder.CreateStore(ReducePriv.getPointer(),
+                          GetAddrOfLocalVar(UpdateParm));
+    }
+
     // emit the body of the lambda expression
     EmitStmt(Lambda->getBody());
-    InKokkosConstruct = false;
+
+    // Combine this iteration's value with the result.
+    if (Reduction && HaveInsertPoint())
+      Builder.CreateAtomicRMW(Reduction->Op, Reduction->Result,
+                              Builder.CreateLoad(ReducePriv),
+                              llvm::AtomicOrdering::Monotonic);
+    InKokkosConstruct = OuterInKokkosConstruct;
   }
 
   // Unwind the codegen of the induction variable from the current local thread
@@ -465,11 +990,17 @@ bool CodeGenFunction::EmitKokkosParallelFor(
   AllocaInsertPt->removeFromParent();
   AllocaInsertPt = OldAllocaInsertPt;
 
-  for (int i = numIVs - 1; i >= 0; --i) {
+  for (int i = numLoops - 1; i >= 0; --i) {
     // Emit the increment basic block
     EmitBlock(Increment[i].getBlock());
     // Emit the actual increment code
-    EmitKokkosIncrement(IVInfos[i].first);
+    if (FlatIV.isValid())
+      Builder.CreateStore(
+          Builder.CreateAdd(Builder.CreateLoad(FlatIV),
+                            llvm::ConstantInt::get(Int64Ty, 1)),
+          FlatIV);
+    else
+      EmitKokkosIncrement(IVInfos[i].first);
     BreakContinueStack.pop_back();
     EmitStopPoint(CE);
     EmitBranch(CondBlock[i]);
@@ -484,16 +1015,596 @@ bool CodeGenFunction::EmitKokkosParallelFor(
   EmitBlock(LoopExit.getBlock(), true);
 
   // Clean up the ForScope new's
-  for (unsigned int i = 0; i < numIVs; ++i)
+  for (unsigned int i = 0; i < numLoops; ++i)
     delete ForScope[i];
 
+  std::swap(OuterViewAccesses, KokkosViewAccesses);
+  KokkosTeam = OuterTeam;
+
   // DWS remove after type change???
   return true;
 }
 
+// Break apart a Kokkos parallel_reduce.  Recognized constructs:
+//
+//   1. parallel_reduce(["name"], N, lambda_expr, result);
+//
+//   2. parallel_reduce(["name"], N, lambda_expr, Kokkos::Sum<T>(result));
+//
+// along with the MDRangePolicy form of the bounds (see
+// ParseAndValidateParallelFor()).  The lambda's last parameter is the
+// (T&) value each iteration updates.  The built-in Sum, Min, Max, BAnd
+// and BOr reducers of scalar integer and floating point values are
+// supported; other reducers and custom joiners (functors) fall back to
+// the standard C++ mode.  The loop is emitted as a parallel_for where
+// each iteration atomically combines a private value with the result.
+//
 bool CodeGenFunction::EmitKokkosParallelReduce(const CallExpr *CE,
                                                ArrayRef<const Attr *> Attrs) {
   DiagnosticsEngine &Diags = CGM.getDiags();
-  Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported);
-  return false;
+  unsigned NumArgs = CE->getNumArgs();
+  if (NumArgs < 3) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported)
+        << "expected bounds, lambda and result arguments";
+    return false;
+  }
+
+  const auto *Lambda =
+      dyn_cast<LambdaExpr>(SimplifyExpr(CE->getArg(NumArgs - 2)));
+  if (Lambda == nullptr) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported)
+        << "functors and multiple results are not supported";
+    return false;
+  }
+
+  // Sort out the reducer (a plain value is summed).
+  std::string Kind = "Sum";
+  const Expr *ResultExpr = CE->getArg(NumArgs - 1);
+  const Expr *RE = SimplifyExpr(ResultExpr);
+  if (const auto *FCE = dyn_cast<CXXFunctionalCastExpr>(RE))
+    RE = SimplifyExpr(FCE->getSubExpr());
+  if (const auto *CCE = dyn_cast<CXXConstructExpr>(RE)) {
+    std::string QName =
+        CCE->getConstructor()->getParent()->getQualifiedNameAsString();
+    StringRef RName(QName);
+    if (!RName.consume_front("Kokkos::") || CCE->getNumArgs() != 1) {
+      Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported)
+          << "custom reducers are not supported";
+      return false;
+    }
+    Kind = RName.str();
+    ResultExpr = CCE->getArg(0);
+  }
+
+  if (!ResultExpr->isLValue()) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_bad_final_vardecl);
+    return false;
+  }
+  QualType Ty = ResultExpr->getType().getNonReferenceType().getUnqualifiedType();
+  llvm::Type *LTy = ConvertType(Ty);
+  bool IsInt = Ty->isIntegerType() && !Ty->isBooleanType();
+  bool IsFP = LTy->isFloatTy() || LTy->isDoubleTy();
+  if (!IsInt && !IsFP) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported)
+        << "only integer, float and double results are supported";
+    return false;
+  }
+
+  // The lambda's update parameter must be a reference to the result type.
+  const CXXMethodDecl *CallOp = Lambda->getCallOperator();
+  const ParmVarDecl *UpdateParm =
+      CallOp->getNumParams() > 1
+          ? CallOp->getParamDecl(CallOp->getNumParams() - 1)
+          : nullptr;
+  if (UpdateParm == nullptr ||
+      !UpdateParm->getType()->isLValueReferenceType() ||
+      !getContext().hasSameUnqualifiedType(
+          UpdateParm->getType().getNonReferenceType(), Ty)) {
+    Diags.Report(CE->getExprLoc(),
+                 diag::warn_kokkos_reduce_bad_intermediate_vardecl);
+    return false;
+  }
+
+  // The identity initializes both the private values and the result
+  // (matching the initialization done by Kokkos' reducers).
+  bool IsSigned = Ty->isSignedIntegerType();
+  unsigned NBits = LTy->getPrimitiveSizeInBits();
+  KokkosReduction Reduction{UpdateParm, Address::invalid(),
+                            llvm::AtomicRMWInst::BAD_BINOP, nullptr};
+  if (Kind == "Sum") {
+    Reduction.Op = IsFP ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add;
+    Reduction.Identity = llvm::Constant::getNullValue(LTy);
+  } else if (Kind == "Min") {
+    if (IsFP) {
+      Reduction.Op = llvm::AtomicRMWInst::FMin;
+      Reduction.Identity = llvm::ConstantFP::get(
+          LTy, llvm::APFloat::getLargest(LTy->getFltSemantics()));
+    } else {
+      Reduction.Op =
+          IsSigned ? llvm::AtomicRMWInst::Min : llvm::AtomicRMWInst::UMin;
+      Reduction.Identity = llvm::ConstantInt::get(
+          LTy, IsSigned ? llvm::APInt::getSignedMaxValue(NBits)
+                        : llvm::APInt::getMaxValue(NBits));
+    }
+  } else if (Kind == "Max") {
+    if (IsFP) {
+      Reduction.Op = llvm::AtomicRMWInst::FMax;
+      Reduction.Identity = llvm::ConstantFP::get(
+          LTy, llvm::APFloat::getLargest(LTy->getFltSemantics(), true));
+    } else {
+      Reduction.Op =
+          IsSigned ? llvm::AtomicRMWInst::Max : llvm::AtomicRMWInst::UMax;
+      Reduction.Identity = llvm::ConstantInt::get(
+          LTy, IsSigned ? llvm::APInt::getSignedMinValue(NBits)
+                        : llvm::APInt::getMinValue(NBits));
+    }
+  } else if (IsInt && Kind == "BAnd") {
+    Reduction.Op = llvm::AtomicRMWInst::And;
+    Reduction.Identity = llvm::Constant::getAllOnesValue(LTy);
+  } else if (IsInt && Kind == "BOr") {
+    Reduction.Op = llvm::AtomicRMWInst::Or;
+    Reduction.Identity = llvm::Constant::getNullValue(LTy);
+  } else {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_unsupported)
+        << ("the '" + Kind + "' reducer is not supported");
+    return false;
+  }
+
+  Reduction.Result = EmitLValue(ResultExpr).getAddress(*this);
+  Builder.CreateStore(Reduction.Identity, Reduction.Result);
+  return EmitKokkosParallelFor(CE, Attrs, &Reduction);
+}
+
+// Break apart a Kokkos parallel_scan.  Recognized constructs:
+//
+//   parallel_scan(["name"], N, lambda_expr(i, T &update, const bool final)
+//                 [, result]);
+//
+// The built-in (sum) scan of scalar integer and floating point values is
+// supported.  The iteration space is split into blocks that are scanned in
+// two parallel passes: the first computes the sum of each block, a serial
+// exclusive scan of those sums gives the offset of each block, and the
+// second rescans each block from its offset with final set.  The lambda
+// body is emitted once for each pass.  The partial sums live in memory the
+// target can reach from its parallel loops (managed memory on the GPU
+// targets).
+bool CodeGenFunction::EmitKokkosParallelScan(const CallExpr *CE,
+                                             ArrayRef<const Attr *> Attrs) {
+  DiagnosticsEngine &Diags = CGM.getDiags();
+  std::string PFName;
+  SmallVector<
+      std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>, 6>
+      IVInfos;
+  const LambdaExpr *Lambda = nullptr;
+  const Expr *LeagueSize = nullptr;
+  if (!ParseAndValidateParallelFor(CE, PFName, IVInfos, Lambda, LeagueSize,
+                                   Diags, /*NumReductionParams=*/2))
+    return false;
+  if (LeagueSize || IVInfos.size() != 1) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_scan_unsupported)
+        << "only one-dimensional ranges are supported";
+    return false;
+  }
+
+  // The lambda takes (index, T &update, bool final).
+  const CXXMethodDecl *CallOp = Lambda->getCallOperator();
+  const ParmVarDecl *IV = IVInfos[0].first;
+  const ParmVarDecl *UpdateParm = CallOp->getParamDecl(1);
+  const ParmVarDecl *FinalParm = CallOp->getParamDecl(2);
+  QualType Ty =
+      UpdateParm->getType().getNonReferenceType().getUnqualifiedType();
+  llvm::Type *LTy = ConvertType(Ty);
+  bool IsInt = Ty->isIntegerType() && !Ty->isBooleanType();
+  bool IsFP = LTy->isFloatTy() || LTy->isDoubleTy();
+  if (!UpdateParm->getType()->isLValueReferenceType() ||
+      !FinalParm->getType()->isBooleanType() || (!IsInt && !IsFP)) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_scan_unsupported)
+        << "the lambda must take an index, a reference to an integer, float "
+           "or double value and a bool";
+    return false;
+  }
+
+  // An optional trailing argument receives the total.
+  const Expr *ResultExpr = CE->getArg(CE->getNumArgs() - 1);
+  if (SimplifyExpr(ResultExpr) == Lambda)
+    ResultExpr = nullptr;
+  else if (!ResultExpr->isLValue() ||
+           !getContext().hasSameUnqualifiedType(
+               ResultExpr->getType().getNonReferenceType(), Ty)) {
+    Diags.Report(CE->getExprLoc(), diag::warn_kokkos_reduce_bad_final_vardecl);
+    return false;
+  }
+
+  std::optional<llvm::TapirTargetID> TT = GetTapirTargetAttr(Attrs);
+  const bool Hybrid = IsHybridTapirTargetAttr(Attrs);
+  const SourceRange &R = CE->getSourceRange();
+  llvm::Value *Undef = llvm::UndefValue::get(Int32Ty);
+  llvm::Constant *Identity = llvm::Constant::getNullValue(LTy);
+  CharUnits Align = getContext().getTypeAlignInChars(Ty);
+  auto I64 = [this](uint64_t V) { return llvm::ConstantInt::get(Int64Ty, V); };
+
+  // The iteration space [Lower, Upper) is split into at most MaxBlocks
+  // blocks; the GPU targets run each block as one thread.
+  llvm::Type *IVTy = ConvertType(IV->getType());
+  const Expr *LowerExpr = IVInfos[0].second.first;
+  llvm::Value *Lower =
+      LowerExpr ? Builder.CreateIntCast(EmitScalarExpr(LowerExpr), IVTy,
+                                        LowerExpr->getType()
+                                            ->isSignedIntegerType())
+                : llvm::ConstantInt::get(IVTy, 0);
+  llvm::Value *Upper = EmitKokkosUpperBound(IVInfos[0]);
+  llvm::Value *NonEmpty = IV->getType()->isSignedIntegerType()
+                             ? Builder.CreateICmpSGT(Upper, Lower)
+                             : Builder.CreateICmpUGT(Upper, Lower);
+  llvm::Value *N = Builder.CreateZExt(
+      Builder.CreateSelect(NonEmpty,
+                           Builder.CreateSub(Upper, Lower),
+                           llvm::Constant::getNullValue(IVTy)),
+      Int64Ty, "kokkos.scan.n");
+  const bool GPU = TT && (*TT == llvm::TapirTargetID::Cuda ||
+                          *TT == llvm::TapirTargetID::Hip);
+  const uint64_t MaxBlocks = GPU ? 65536 : 1024;
+  llvm::Value *BlockSize = Builder.CreateBinaryIntrinsic(
+      llvm::Intrinsic::umax,
+      Builder.CreateUDiv(Builder.CreateAdd(N, I64(MaxBlocks - 1)),
+                         I64(MaxBlocks)),
+      I64(1));
+  llvm::Value *NumBlocks = Builder.CreateUDiv(
+      Builder.CreateAdd(N, Builder.CreateSub(BlockSize, I64(1))), BlockSize,
+      "kokkos.scan.blocks");
+
+  // Allocate the partial sums of the blocks.
+  StringRef AllocFn = "malloc", FreeFn = "free";
+  if (TT == llvm::TapirTargetID::Cuda) {
+    AllocFn = "__kitcuda_mem_alloc_managed";
+    FreeFn = "__kitcuda_mem_free";
+  } else if (TT == llvm::TapirTargetID::Hip) {
+    AllocFn = "__kithip_mem_alloc_managed";
+    FreeFn = "__kithip_mem_free";
+  }
+  llvm::FunctionCallee Alloc = CGM.CreateRuntimeFunction(
+      llvm::FunctionType::get(VoidPtrTy, {SizeTy}, false), AllocFn);
+  llvm::FunctionCallee Free = CGM.CreateRuntimeFunction(
+      llvm::FunctionType::get(VoidTy, {VoidPtrTy}, false), FreeFn);
+  uint64_t EltSize = CGM.getDataLayout().getTypeAllocSize(LTy);
+  llvm::Value *Partials = EmitRuntimeCall(
+      Alloc,
+      {Builder.CreateZExtOrTrunc(Builder.CreateMul(NumBlocks, I64(EltSize)),
+                                 SizeTy)},
+      "kokkos.scan.partials");
+  auto PartialAddr = [&](llvm::Value *Block) {
+    return Address(Builder.CreateInBoundsGEP(LTy, Partials, Block), LTy,
+                   Align);
+  };
+
+  // Compute the data pointers and strides of the Views used in the body.
+  llvm::DenseMap<const CXXOperatorCallExpr *, KokkosViewInfo>
+      OuterViewAccesses;
+  std::swap(OuterViewAccesses, KokkosViewAccesses);
+  EmitKokkosViewAccessInfo(Lambda);
+
+  // Emit a parallel loop over the blocks that scans each block, starting
+  // from 0 (the first pass, which records the sum of the block) or from
+  // the offset of the block (the final pass).
+  auto EmitPass = [&](bool Final) {
+    LoopStack.setLoopTarget(TT);
+    LoopStack.setLoopHybrid(Hybrid);
+    PushSyncRegion();
+    llvm::Instruction *SRStart = EmitSyncRegionStart();
+    CurSyncRegion->setSyncRegionStart(SRStart);
+    LoopStack.setSpawnStrategy(LoopAttributes::DAC);
+
+    Address BlockIV = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.scan.block");
+    Builder.CreateStore(I64(0), BlockIV);
+    llvm::BasicBlock *Cond = createBasicBlock("kokkos.scan.cond");
+    llvm::BasicBlock *Detach = createBasicBlock("kokkos.scan.detach");
+    llvm::BasicBlock *Body = createBasicBlock("kokkos.scan.body");
+    llvm::BasicBlock *Inc = createBasicBlock("kokkos.scan.inc");
+    llvm::BasicBlock *Sync = createBasicBlock("kokkos.scan.sync");
+    llvm::BasicBlock *End = createBasicBlock("kokkos.scan.end");
+
+    EmitBlock(Cond);
+    LoopStack.push(Cond, CGM.getContext(), CGM.getCodeGenOpts(), Attrs,
+                   SourceLocToDebugLoc(R.getBegin()),
+                   SourceLocToDebugLoc(R.getEnd()));
+    Builder.CreateCondBr(
+        Builder.CreateICmpULT(Builder.CreateLoad(BlockIV), NumBlocks), Detach,
+        Sync);
+
+    EmitBlock(Detach);
+    llvm::Value *Block = Builder.CreateLoad(BlockIV);
+    Builder.CreateDetach(Body, Inc, SRStart);
+
+    EmitBlock(Body);
+    llvm::AssertingVH<llvm::Instruction> OldAllocaInsertPt = AllocaInsertPt;
+    SetAllocaInsertPoint(Undef, Body);
+    {
+      // The block [Begin, BlockEnd), scanned serially into Acc.
+      llvm::Value *Begin = Builder.CreateMul(Block, BlockSize);
+      llvm::Value *BlockEnd = Builder.CreateBinaryIntrinsic(
+          llvm::Intrinsic::umin, Builder.CreateAdd(Begin, BlockSize), N);
+      Address Acc = CreateMemTemp(Ty, "kokkos.scan.acc");
+      Builder.CreateStore(
+          Final ? Builder.CreateLoad(PartialAddr(Block)) : Identity, Acc);
+      Address Idx = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.scan.idx");
+      Builder.CreateStore(Begin, Idx);
+
+      llvm::BasicBlock *ICond = createBasicBlock("kokkos.scan.icond");
+      llvm::BasicBlock *IBody = createBasicBlock("kokkos.scan.ibody");
+      JumpDest IInc = getJumpDestInCurrentScope("kokkos.scan.iinc");
+      JumpDest IEnd = getJumpDestInCurrentScope("kokkos.scan.iend");
+      EmitBlock(ICond);
+      Builder.CreateCondBr(
+          Builder.CreateICmpULT(Builder.CreateLoad(Idx), BlockEnd), IBody,
+          IEnd.getBlock());
+      EmitBlock(IBody);
+      {
+        // The body is emitted once per pass; forget its declarations
+        // afterwards.
+        DeclMapTy SavedDecls = LocalDeclMap;
+        const bool OuterInKokkosConstruct = InKokkosConstruct;
+        InKokkosConstruct = true;
+        RunCleanupsScope BodyScope(*this);
+
+        EmitVarDecl(*IV);
+        Builder.CreateStore(
+            Builder.CreateAdd(Lower,
+                              Builder.CreateTrunc(Builder.CreateLoad(Idx), IVTy)),
+            GetAddrOfLocalVar(IV));
+        EmitVarDecl(*UpdateParm);
+        Builder.CreateStore(Acc.getPointer(), GetAddrOfLocalVar(UpdateParm));
+        EmitVarDecl(*FinalParm);
+        EmitStoreOfScalar(Builder.getInt1(Final), GetAddrOfLocalVar(FinalParm),
+                          /*Volatile=*/false, FinalParm->getType());
+
+        BreakContinueStack.push_back(BreakContinue(IEnd, IInc));
+        EmitStmt(Lambda->getBody());
+        BreakContinueStack.pop_back();
+
+        BodyScope.ForceCleanup();
+        InKokkosConstruct = OuterInKokkosConstruct;
+        LocalDeclMap = SavedDecls;
+      }
+      EmitBlock(IInc.getBlock());
+      Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Idx), I64(1)),
+                          Idx);
+      EmitBranch(ICond);
+      EmitBlock(IEnd.getBlock());
+
+      if (!Final)
+        Builder.CreateStore(Builder.CreateLoad(Acc), PartialAddr(Block));
+    }
+    Builder.CreateReattach(Inc, SRStart);
+    AllocaInsertPt->removeFromParent();
+    AllocaInsertPt = OldAllocaInsertPt;
+
+    EmitBlock(Inc);
+    Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(BlockIV), I64(1)),
+                        BlockIV);
+    EmitBranch(Cond);
+    LoopStack.pop();
+
+    EmitBlock(Sync);
+    Builder.CreateSync(End, SRStart);
+    PopSyncRegion();
+    EmitBlock(End);
+  };
+
+  EmitPass(/*Final=*/false);
+
+  // Turn the block sums into the offsets of the blocks.
+  Address Total = CreateMemTemp(Ty, "kokkos.scan.total");
+  Builder.CreateStore(Identity, Total);
+  Address BlockIV = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.scan.b");
+  Builder.CreateStore(I64(0), BlockIV);
+  llvm::BasicBlock *Cond = createBasicBlock("kokkos.scan.offsets.cond");
+  llvm::BasicBlock *Body = createBasicBlock("kokkos.scan.offsets.body");
+  llvm::BasicBlock *End = createBasicBlock("kokkos.scan.offsets.end");
+  EmitBlock(Cond);
+  Builder.CreateCondBr(
+      Builder.CreateICmpULT(Builder.CreateLoad(BlockIV), NumBlocks), Body, End);
+  EmitBlock(Body);
+  {
+    llvm::Value *Block = Builder.CreateLoad(BlockIV);
+    Address Partial = PartialAddr(Block);
+    llvm::Value *Sum = Builder.CreateLoad(Partial);
+    llvm::Value *Offset = Builder.CreateLoad(Total);
+    Builder.CreateStore(Offset, Partial);
+    Builder.CreateStore(IsFP ? Builder.CreateFAdd(Offset, Sum)
+                             : Builder.CreateAdd(Offset, Sum),
+                        Total);
+    Builder.CreateStore(Builder.CreateAdd(Block, I64(1)), BlockIV);
+  }
+  EmitBranch(Cond);
+  EmitBlock(End);
+
+  EmitPass(/*Final=*/true);
+
+  if (ResultExpr)
+    Builder.CreateStore(Builder.CreateLoad(Total),
+                        EmitLValue(ResultExpr).getAddress(*this));
+  EmitRuntimeCall(Free, {Partials});
+
+  std::swap(OuterViewAccesses, KokkosViewAccesses);
+  return true;
+}
+
+// Kokkos::deep_copy and Kokkos::fence go through the backends of the Kokkos
+// library, which copy with their own kernels and fence with a full device
+// synchronization.  With -fkokkos a deep_copy between two Views of the same
+// element type and layout, or from a scalar to a View, is instead emitted as
+// a parallel loop over the elements of the Views -- which the GPU targets
+// turn into a copy or fill on the copy engines, ordered on the launch
+// stream -- and a fence becomes a sync of the function, which waits for
+// the asynchronous constructs before it.
+//
+//   1. deep_copy([exec_space,] dst_view, src_view);
+//
+//   2. deep_copy([exec_space,] dst_view, value);
+//
+// The Views must be variables (or fields of them).  Views that are not
+// contiguous, or whose spans differ, are copied by the library at run time.
+bool CodeGenFunction::EmitKokkosDeepCopy(const CallExpr *CE,
+                                         ArrayRef<const Attr *> Attrs) {
+  const unsigned NumArgs = CE->getNumArgs();
+  if (NumArgs != 2 && NumArgs != 3)
+    return false;
+  const Expr *DstExpr = CE->getArg(NumArgs - 2)->IgnoreImplicit();
+  const Expr *SrcExpr = CE->getArg(NumArgs - 1)->IgnoreImplicit();
+  ASTContext &Ctx = getContext();
+  // Both arguments are evaluated again by the library's deep_copy.
+  if (!DstExpr->isGLValue() || DstExpr->HasSideEffects(Ctx) ||
+      SrcExpr->HasSideEffects(Ctx))
+    return false;
+
+  // The data pointer and the (contiguous) span of a View.
+  struct ViewMethods {
+    const CXXMethodDecl *Data, *Span, *Contiguous;
+    const CXXRecordDecl *Layout;
+  };
+  auto GetViewMethods = [](QualType Ty) -> std::optional<ViewMethods> {
+    const CXXRecordDecl *RD = Ty->getAsCXXRecordDecl();
+    if (!RD || RD->getQualifiedNameAsString() != "Kokkos::View")
+      return std::nullopt;
+    ViewMethods VM = {GetKokkosViewMethod(RD, "data"),
+                      GetKokkosViewMethod(RD, "span"),
+                      GetKokkosViewMethod(RD, "span_is_contiguous"),
+                      GetKokkosViewLayout(RD)};
+    if (!VM.Data || !VM.Span || !VM.Contiguous || !VM.Layout ||
+        !VM.Data->getReturnType()->isPointerType() ||
+        !VM.Span->getReturnType()->isIntegerType() ||
+        VM.Layout->getQualifiedNameAsString() == "Kokkos::LayoutStride")
+      return std::nullopt;
+    return VM;
+  };
+  std::optional<ViewMethods> Dst = GetViewMethods(DstExpr->getType());
+  if (!Dst)
+    return false;
+  QualType EltTy = Dst->Data->getReturnType()->getPointeeType();
+  if (EltTy.isConstQualified() || !EltTy->isScalarType())
+    return false;
+
+  std::optional<ViewMethods> Src = GetViewMethods(SrcExpr->getType());
+  if (Src) {
+    QualType SrcEltTy = Src->Data->getReturnType()->getPointeeType();
+    if (!SrcExpr->isGLValue() || Src->Layout != Dst->Layout ||
+        !Ctx.hasSameUnqualifiedType(SrcEltTy, EltTy))
+      return false;
+  } else if (!SrcExpr->getType()->isArithmeticType() ||
+             !EltTy->isArithmeticType()) {
+    return false;
+  }
+
+  llvm::Type *LTy = ConvertTypeForMem(EltTy);
+  CharUnits Align = Ctx.getTypeAlignInChars(EltTy);
+  auto Int64 = [this](llvm::Value *V) {
+    return Builder.CreateZExtOrTrunc(V, Int64Ty);
+  };
+  llvm::Value *DstThis = EmitLValue(DstExpr).getPointer(*this);
+  llvm::Value *DstData = EmitKokkosViewMethodCall(*this, Dst->Data, DstThis);
+  llvm::Value *N =
+      Int64(EmitKokkosViewMethodCall(*this, Dst->Span, DstThis));
+  llvm::Value *Contiguous = Builder.CreateIsNotNull(
+      EmitKokkosViewMethodCall(*this, Dst->Contiguous, DstThis));
+  llvm::Value *SrcData = nullptr, *Value = nullptr;
+  if (Src) {
+    llvm::Value *SrcThis = EmitLValue(SrcExpr).getPointer(*this);
+    SrcData = EmitKokkosViewMethodCall(*this, Src->Data, SrcThis);
+    llvm::Value *SrcN =
+        Int64(EmitKokkosViewMethodCall(*this, Src->Span, SrcThis));
+    Contiguous = Builder.CreateAnd(
+        Contiguous,
+        Builder.CreateAnd(
+            Builder.CreateIsNotNull(
+                EmitKokkosViewMethodCall(*this, Src->Contiguous, SrcThis)),
+            Builder.CreateICmpEQ(N, SrcN)));
+  } else {
+    Value = EmitScalarConversion(EmitScalarExpr(SrcExpr), SrcExpr->getType(),
+                                 EltTy, CE->getExprLoc());
+  }
+
+  llvm::BasicBlock *Loop = createBasicBlock("kokkos.deep_copy.loop");
+  llvm::BasicBlock *Library = createBasicBlock("kokkos.deep_copy.library");
+  llvm::BasicBlock *Done = createBasicBlock("kokkos.deep_copy.done");
+  Builder.CreateCondBr(Contiguous, Loop, Library);
+
+  EmitBlock(Library);
+  {
+    const bool OuterInKokkosLibraryCall = InKokkosLibraryCall;
+    InKokkosLibraryCall = true;
+    EmitCallExpr(CE);
+    InKokkosLibraryCall = OuterInKokkosLibraryCall;
+  }
+  EmitBranch(Done);
+
+  // The parallel loop over the elements [0, N).
+  EmitBlock(Loop);
+  const SourceRange &R = CE->getSourceRange();
+  llvm::Value *Undef = llvm::UndefValue::get(Int32Ty);
+  LoopStack.setLoopTarget(GetTapirTargetAttr(Attrs));
+  LoopStack.setLoopHybrid(IsHybridTapirTargetAttr(Attrs));
+  LoopStack.setLoopAsync(HasKitsuneAsyncAttr(Attrs));
+  PushSyncRegion();
+  llvm::Instruction *SRStart = EmitSyncRegionStart();
+  CurSyncRegion->setSyncRegionStart(SRStart);
+  LoopStack.setSpawnStrategy(LoopAttributes::DAC);
+
+  Address IV = CreateDefaultAlignTempAlloca(Int64Ty, "kokkos.deep_copy.iv");
+  Builder.CreateStore(llvm::ConstantInt::get(Int64Ty, 0), IV);
+  llvm::BasicBlock *Cond = createBasicBlock("kokkos.deep_copy.cond");
+  llvm::BasicBlock *Detach = createBasicBlock("kokkos.deep_copy.detach");
+  llvm::BasicBlock *Body = createBasicBlock("kokkos.deep_copy.body");
+  llvm::BasicBlock *Inc = createBasicBlock("kokkos.deep_copy.inc");
+  llvm::BasicBlock *Sync = createBasicBlock("kokkos.deep_copy.sync");
+
+  EmitBlock(Cond);
+  LoopStack.push(Cond, CGM.getContext(), CGM.getCodeGenOpts(), Attrs,
+                 SourceLocToDebugLoc(R.getBegin()),
+                 SourceLocToDebugLoc(R.getEnd()));
+  Builder.CreateCondBr(Builder.CreateICmpULT(Builder.CreateLoad(IV), N),
+                       Detach, Sync);
+
+  EmitBlock(Detach);
+  llvm::Value *I = Builder.CreateLoad(IV);
+  Builder.CreateDetach(Body, Inc, SRStart);
+
+  EmitBlock(Body);
+  llvm::AssertingVH<llvm::Instruction> OldAllocaInsertPt = AllocaInsertPt;
+  SetAllocaInsertPoint(Undef, Body);
+  if (Src)
+    Value = Builder.CreateLoad(
+        Address(Builder.CreateInBoundsGEP(LTy, SrcData, I), LTy, Align));
+  Builder.CreateStore(
+      Value, Address(Builder.CreateInBoundsGEP(LTy, DstData, I), LTy, Align));
+  Builder.CreateReattach(Inc, SRStart);
+  AllocaInsertPt->removeFromParent();
+  AllocaInsertPt = OldAllocaInsertPt;
+
+  EmitBlock(Inc);
+  Builder.CreateStore(
+      Builder.CreateAdd(Builder.CreateLoad(IV),
+                        llvm::ConstantInt::get(Int64Ty, 1)),
+      IV);
+  EmitBranch(Cond);
+  LoopStack.pop();
+
+  EmitBlock(Sync);
+  Builder.CreateSync(Done, SRStart);
+  PopSyncRegion();
+  EmitBlock(Done);
+  return true;
+}
+
+// Emit a Kokkos::fence (or the fence of an execution space) as a sync of
+// the function.  The constructs that fell back to the Kokkos library are
+// not waited for by the sync, so the library's fence is still called after
+// them (and false returned).
+bool CodeGenFunction::EmitKokkosFence(const CallExpr *CE) {
+  if (HaveInsertPoint())
+    EmitStopPoint(CE);
+  llvm::BasicBlock *Continue = createBasicBlock("kokkos.fence.continue");
+  Builder.CreateSync(
+      Continue, getOrCreateLabeledSyncRegion("")->getSyncRegionStart());
+  EmitBlock(Continue);
+  return !KokkosLibraryConstructs;
 }
@@ -508,7 +508,11 @@ LoopAttributes::LoopAttributes(bool IsParallel)
       TapirGrainsize(0),
       DistributeEnable(LoopAttributes::Unspecified), PipelineDisabled(false),
       PipelineInitiationInterval(0), CodeAlign(0), MustProgress(false),
-      SpawnStrategy(LoopAttributes::SEQ) {}
+      SpawnStrategy(LoopAttributes::SEQ), LoopHybrid(false),
+      LoopAsync(false), LaunchPriority(0), LaunchThreadsPerBlock(0),
+      LaunchMaxBlocksPerGrid(0),
+      LaunchMinBlocksPerMultiproc(0), LaunchSharedMemBytes(0),
+      LaunchItersPerThread(0), SpecializeID(0) {}
 
 void LoopAttributes::clear() {
   IsParallel = false;
@@ -528,6 +532,15 @@ void LoopAttributes::clear() {
   CodeAlign = 0;
   MustProgress = false;
   SpawnStrategy = LoopAttributes::SEQ;
+  LoopHybrid = false;
+  LoopAsync = false;
+  LaunchPriority = 0;
+  LaunchThreadsPerBlock = 0;
+  LaunchMaxBlocksPerGrid = 0;
+  LaunchMinBlocksPerMultiproc = 0;
+  LaunchSharedMemBytes = 0;
+  LaunchItersPerThread = 0;
+  SpecializeID = 0;
 }
 
 LoopInfo::LoopInfo(BasicBlock *Header, const LoopAttributes &Attrs,
@@ -594,6 +607,47 @@ void LoopInfo::getTapirLoopProperties(
                                                  unsigned(*Attrs.LoopTarget)))};
     LoopProperties.push_back(MDNode::get(Ctx, Vals));
   }
+
+  // Setting tapir.loop.hybrid
+  if (Attrs.LoopHybrid) {
+    Metadata *Vals[] = {
+        MDString::get(Ctx, "tapir.loop.hybrid"),
+        ConstantAsMetadata::get(
+            ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 1))};
+    LoopProperties.push_back(MDNode::get(Ctx, Vals));
+  }
+
+  // Setting tapir.loop.async
+  if (Attrs.LoopAsync) {
+    Metadata *Vals[] = {
+        MDString::get(Ctx, "tapir.loop.async"),
+        ConstantAsMetadata::get(
+            ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 1))};
+    LoopProperties.push_back(MDNode::get(Ctx, Vals));
+  }
+
+  // Setting tapir.loop.kitsune.launch.*, tapir.loop.kitsune.priority and
+  // tapir.loop.kitsune.specialize
+  std::pair<const char *, unsigned> LaunchParams[] = {
+      {"tapir.loop.kitsune.launch.threads.per.block",
+       Attrs.LaunchThreadsPerBlock},
+      {"tapir.loop.kitsune.launch.max.blocks", Attrs.LaunchMaxBlocksPerGrid},
+      {"tapir.loop.kitsune.launch.min.blocks.per.multiproc",
+       Attrs.LaunchMinBlocksPerMultiproc},
+      {"tapir.loop.kitsune.launch.shared.bytes", Attrs.LaunchSharedMemBytes},
+      {"tapir.loop.kitsune.launch.iters.per.thread",
+       Attrs.LaunchItersPerThread},
+      {"tapir.loop.kitsune.priority", Attrs.LaunchPriority},
+      {"tapir.loop.kitsune.specialize", Attrs.SpecializeID}};
+  for (auto &[Name, Value] : LaunchParams) {
+    if (Value == 0)
+      continue;
+    Metadata *Vals[] = {
+        MDString::get(Ctx, Name),
+        ConstantAsMetadata::get(
+            ConstantInt::get(llvm::Type::getInt32Ty(Ctx), Value))};
+    LoopProperties.push_back(MDNode::get(Ctx, Vals));
+  }
 }
 
 void LoopInfo::finish() {
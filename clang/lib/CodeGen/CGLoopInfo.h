@@ -89,14 +89,34 @@ struct LoopAttributes {
   /// Value for whether the loop is required to make progress.
   bool MustProgress;
 
-  /// Tapir-loop spawning strategy.
-  enum LSStrategy { SEQ, DAC, GPU };
+  /// Tapir-loop spawning strategy.  The values match
+  /// llvm::TapirLoopHints::SpawningStrategy.
+  enum LSStrategy { SEQ, DAC, STATIC, DYNAMIC, GUIDED };
 
   /// Value for tapir.loop.spawn.strategy metadata.
   LSStrategy SpawnStrategy;
 
   /// Value for tapir.loop.target metadata.
   std::optional<llvm::TapirTargetID> LoopTarget;
+
+  /// Value for tapir.loop.hybrid metadata.
+  bool LoopHybrid;
+
+  /// Value for tapir.loop.async metadata.
+  bool LoopAsync;
+
+  /// Value for tapir.loop.kitsune.priority metadata (zero if unset).
+  unsigned LaunchPriority;
+
+  /// Values for the tapir.loop.kitsune.launch.* metadata (zero if unset).
+  unsigned LaunchThreadsPerBlock;
+  unsigned LaunchMaxBlocksPerGrid;
+  unsigned LaunchMinBlocksPerMultiproc;
+  unsigned LaunchSharedMemBytes;
+  unsigned LaunchItersPerThread;
+
+  /// Value for tapir.loop.kitsune.specialize metadata (zero if unset).
+  unsigned SpecializeID;
 };
 
 /// Information used when generating a structured loop.
@@ -324,6 +344,32 @@ public:
     StagedAttrs.LoopTarget = LT;
   }
 
+  /// Set whether the Tapir loop also runs on the host (see the loop target).
+  void setLoopHybrid(bool H) { StagedAttrs.LoopHybrid = H; }
+
+  /// Set whether the Tapir loop is waited on at the enclosing sync.
+  void setLoopAsync(bool A) { StagedAttrs.LoopAsync = A; }
+
+  /// Set the priority of the stream the Tapir loop's kernel is launched
+  /// on (see CodeGenFunction::GetKitsunePriorityAttr()).
+  void setLoopPriority(unsigned P) { StagedAttrs.LaunchPriority = P; }
+
+  /// Set the GPU launch configuration of the Tapir loop (zero values are
+  /// left to the runtime).
+  void setLoopLaunch(unsigned ThreadsPerBlock, unsigned MaxBlocksPerGrid,
+                     unsigned MinBlocksPerMultiproc, unsigned SharedMemBytes,
+                     unsigned ItersPerThread) {
+    StagedAttrs.LaunchThreadsPerBlock = ThreadsPerBlock;
+    StagedAttrs.LaunchMaxBlocksPerGrid = MaxBlocksPerGrid;
+    StagedAttrs.LaunchMinBlocksPerMultiproc = MinBlocksPerMultiproc;
+    StagedAttrs.LaunchSharedMemBytes = SharedMemBytes;
+    StagedAttrs.LaunchItersPerThread = ItersPerThread;
+  }
+
+  /// Set the ID pairing the Tapir loop with the values its kernel is
+  /// specialized on (see CodeGenFunction::EmitKitsuneSpecializeAttr()).
+  void setLoopSpecialize(unsigned ID) { StagedAttrs.SpecializeID = ID; }
+
 private:
   /// Returns true if there is LoopInfo on the stack.
   bool hasInfo() const { return !Active.empty(); }
@@ -3990,31 +3990,88 @@ public:
   llvm::Value *EmitSEHAbnormalTermination();
 
   LoopAttributes::LSStrategy GetTapirStrategyAttr(ArrayRef<const Attr *> Attrs);
+  unsigned GetTapirStrategyChunkAttr(ArrayRef<const Attr *> Attrs);
   std::optional<llvm::TapirTargetID>
   GetTapirTargetAttr(ArrayRef<const Attr *> Attrs);
+  bool IsHybridTapirTargetAttr(ArrayRef<const Attr *> Attrs);
+  bool HasKitsuneAsyncAttr(ArrayRef<const Attr *> Attrs);
+  unsigned GetKitsunePriorityAttr(ArrayRef<const Attr *> Attrs);
   llvm::Value *GetKitsuneLaunchAttr(ArrayRef<const Attr *> Attrs);
+  void EmitKitsuneLaunchAttr(ArrayRef<const Attr *> Attrs,
+                             std::optional<llvm::TapirTargetID> TT);
+  void EmitKitsuneSpecializeAttr(ArrayRef<const Attr *> Attrs,
+                                 std::optional<llvm::TapirTargetID> TT);
 
   // Kitsune support for Kokkos.
   bool InKokkosConstruct = false; // FIXME: Should/can we refactor this away?
   bool
   EmitKokkosConstruct(const CallExpr *CE,
                       ArrayRef<const Attr *> Attrs = ArrayRef<const Attr *>());
-  bool EmitKokkosParallelFor(const CallExpr *CE, ArrayRef<const Attr *> Attrs);
+  // A Kokkos reduction.  Each iteration updates a private copy of the
+  // value (bound to the lambda's update parameter) that is atomically
+  // combined with the result.  The GPU targets turn these atomics into
+  // block-wide tree reductions.
+  struct KokkosReduction {
+    const ParmVarDecl *UpdateParm;  // The lambda's (reference) parameter.
+    Address Result;                 // The reduction result.
+    llvm::AtomicRMWInst::BinOp Op;  // The combining operation.
+    llvm::Constant *Identity;       // The identity value of Op.
+  };
+  bool EmitKokkosParallelFor(const CallExpr *CE, ArrayRef<const Attr *> Attrs,
+                             const KokkosReduction *Reduction = nullptr);
   bool EmitKokkosParallelReduce(const CallExpr *CE,
                                 ArrayRef<const Attr *> Attrs);
+  bool EmitKokkosParallelScan(const CallExpr *CE,
+                              ArrayRef<const Attr *> Attrs);
   bool ParseAndValidateParallelFor(
       const CallExpr *CE, std::string &CN,
       SmallVector<
           std::pair<const ParmVarDecl *, std::pair<const Expr *, const Expr *>>,
           6> &IVinfos,
-      const LambdaExpr *&LE, DiagnosticsEngine &Diags);
+      const LambdaExpr *&LE, const Expr *&LeagueSize,
+      DiagnosticsEngine &Diags, unsigned NumReductionParams = 0);
   void EmitAndInitializeKokkosIV(
       const std::pair<const ParmVarDecl *,
                       std::pair<const Expr *, const Expr *>> &IVInfo);
+  llvm::Value *EmitKokkosUpperBound(
+      const std::pair<const ParmVarDecl *,
+                      std::pair<const Expr *, const Expr *>> &IVInfo);
   llvm::Value *EmitKokkosParallelForCond(
       const std::pair<const ParmVarDecl *,
                       std::pair<const Expr *, const Expr *>> &IVInfo);
   void EmitKokkosIncrement(const ParmVarDecl *IV);
+  // A Kokkos::View whose element accesses in the body of a Kokkos construct
+  // are emitted as arithmetic on its data pointer and strides (in elements),
+  // computed once before the loop.
+  struct KokkosViewInfo {
+    llvm::Value *Data;
+    SmallVector<llvm::Value *, 4> Strides;
+    llvm::Type *ElemTy;
+    CharUnits Align;
+  };
+  llvm::DenseMap<const CXXOperatorCallExpr *, KokkosViewInfo>
+      KokkosViewAccesses;
+  // The TeamPolicy construct being emitted.  Each team is an iteration of a
+  // parallel loop over the league, run by a team of one thread, so that the
+  // nested thread and vector ranges become parallel loops of their own.
+  struct KokkosTeamInfo {
+    const ParmVarDecl *Member = nullptr; // The team handle of the lambda.
+    llvm::Value *LeagueRank = nullptr;
+    llvm::Value *LeagueSize = nullptr;
+  };
+  KokkosTeamInfo KokkosTeam;
+  std::optional<RValue> EmitKokkosTeamMemberCall(const CXXMemberCallExpr *CE);
+  void EmitKokkosViewAccessInfo(const LambdaExpr *Lambda);
+  std::optional<Address>
+  EmitKokkosViewAccess(const CXXOperatorCallExpr *E);
+  // Kokkos::deep_copy and fences (see EmitKokkosDeepCopy()).  A Kokkos call
+  // emitted while InKokkosLibraryCall is set is a call to the library, and
+  // KokkosLibraryConstructs is set once a construct of the function falls
+  // back to the library.
+  bool InKokkosLibraryCall = false;
+  bool KokkosLibraryConstructs = false;
+  bool EmitKokkosDeepCopy(const CallExpr *CE, ArrayRef<const Attr *> Attrs);
+  bool EmitKokkosFence(const CallExpr *CE);
 
   /// Emit simple code for OpenMP directives in Simd-only mode.
   void EmitSimpleOMPExecutableDirective(const OMPExecutableDirective &D);
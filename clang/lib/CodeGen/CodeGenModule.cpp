@@ -2352,6 +2352,15 @@ void CodeGenModule::GenKitsuneArgMetadata(llvm::Function *Fn,
               fnArg->addAttr(
                   llvm::Attribute::get(Context, "kitsune.readwrite"));
           }
+          // The grainsize of a recursive function is read by the Tapir
+          // recursion coarsening pass.
+          if (const auto *G = parm->getAttr<TapirGrainsizeAttr>()) {
+            Expr::EvalResult Result;
+            if (G->getGrainsize()->EvaluateAsInt(Result, getContext()))
+              fnArg->addAttr(llvm::Attribute::get(
+                  Context, "tapir.grainsize",
+                  llvm::utostr(Result.Val.getInt().getZExtValue())));
+          }
           break;
         }
       }
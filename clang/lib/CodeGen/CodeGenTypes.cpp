@@ -22,6 +22,7 @@
 #include "clang/AST/Expr.h"
 #include "clang/AST/RecordLayout.h"
 #include "clang/CodeGen/CGFunctionInfo.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Module.h"
@@ -760,6 +761,15 @@ llvm::StructType *CodeGenTypes::ConvertRecordDeclType(const RecordDecl *RD) {
   std::unique_ptr<CGRecordLayout> Layout = ComputeRecordLayout(RD, Ty);
   CGRecordLayouts[Key] = std::move(Layout);
 
+  // Tell the Tapir stage which arrays of structs it may store as structures
+  // of arrays.
+  if (RD->hasAttr<KitsuneSoAAttr>()) {
+    llvm::LLVMContext &Ctx = getLLVMContext();
+    TheModule.getOrInsertNamedMetadata("kitsune.soa")
+        ->addOperand(llvm::MDNode::get(
+            Ctx, llvm::ConstantAsMetadata::get(llvm::PoisonValue::get(Ty))));
+  }
+
   // If this struct blocked a FunctionType conversion, then recompute whatever
   // was derived from that.
   // FIXME: This is hugely overconservative.
@@ -728,6 +728,21 @@ void Driver::setLTOMode(const llvm::opt::ArgList &Args) {
   LTOMode =
       parseLTOMode(*this, Args, options::OPT_flto_EQ, options::OPT_fno_lto);
 
+  // The GPU Tapir targets generate code for the kernels of a module all at
+  // once (one device module, fat binary and constructor per module).  The
+  // ThinLTO backends would each do so for their own module, so use full LTO
+  // to compile all the kernels of the program into a single device module.
+  if (LTOMode == LTOK_Thin) {
+    std::optional<llvm::TapirTargetID> TapirTarget = parseTapirTarget(Args);
+    if (TapirTarget && (*TapirTarget == llvm::TapirTargetID::Cuda ||
+                        *TapirTarget == llvm::TapirTargetID::Hip ||
+                        *TapirTarget == llvm::TapirTargetID::Multi)) {
+      Diag(diag::warn_drv_kitsune_thin_lto_gpu_target)
+          << Args.getLastArg(options::OPT_ftapir_EQ)->getValue();
+      LTOMode = LTOK_Full;
+    }
+  }
+
   OffloadLTOMode = parseLTOMode(*this, Args, options::OPT_foffload_lto_EQ,
                                 options::OPT_fno_offload_lto);
 
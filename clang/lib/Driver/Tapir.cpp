@@ -28,10 +28,12 @@ std::optional<TapirTargetID> clang::parseTapirTarget(const opt::ArgList &Args) {
         .Case("serial", TapirTargetID::Serial)
         .Case("cuda", TapirTargetID::Cuda)
         .Case("hip", TapirTargetID::Hip)
+        .Case("levelzero", TapirTargetID::LevelZero)
         .Case("opencilk", TapirTargetID::OpenCilk)
         .Case("openmp", TapirTargetID::OpenMP)
         .Case("qthreads", TapirTargetID::Qthreads)
         .Case("realm", TapirTargetID::Realm)
+        .Case("multi", TapirTargetID::Multi)
         .Default(std::nullopt);
   return std::nullopt;
 }
@@ -67,6 +69,8 @@ clang::getTargetConfigFileName(const opt::ArgList &Args) {
       return "cuda.cfg";
     case TapirTargetID::Hip:
       return "hip.cfg";
+    case TapirTargetID::LevelZero:
+      return "levelzero.cfg";
     case TapirTargetID::OpenCilk:
       return "opencilk.cfg";
     case TapirTargetID::OpenMP:
@@ -75,6 +79,8 @@ clang::getTargetConfigFileName(const opt::ArgList &Args) {
       return "qthreads.cfg";
     case TapirTargetID::Realm:
       return "realm.cfg";
+    case TapirTargetID::Multi:
+      return "multi.cfg";
     default:
       return std::nullopt;
     }
@@ -1580,6 +1580,20 @@ void ToolChain::AddKitsunePreprocessorArgs(const ArgList &Args,
   std::optional<llvm::TapirTargetID> TapirTarget = parseTapirTarget(Args);
   bool IsKokkos = D.CCCIsCXX() && Args.hasArg(options::OPT_fkokkos);
 
+  unsigned HostOptLevel = getKitsuneHostOptLevel(Args);
+  auto AddHostOptLevel = [&](StringRef ABI) {
+    if (HostOptLevel == 0)
+      return;
+    // A level given explicitly (or in the configured flags) is kept.
+    std::string Opt = ("-" + ABI + "-host-opt-level=").str();
+    auto IsHostOpt = [&](StringRef A) { return A.starts_with(Opt); };
+    if (llvm::any_of(Args.getAllArgValues(options::OPT_mllvm), IsHostOpt) ||
+        llvm::any_of(CmdArgs, IsHostOpt))
+      return;
+    CmdArgs.push_back("-mllvm");
+    CmdArgs.push_back(Args.MakeArgString(Opt + Twine(HostOptLevel)));
+  };
+
   if (TapirTarget) {
     switch (*TapirTarget) {
     case TapirTargetID::Serial:
@@ -1595,6 +1609,11 @@ void ToolChain::AddKitsunePreprocessorArgs(const ArgList &Args,
       ExtractArgsFromString(KITSUNE_HIP_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
                             Args);
       break;
+    case llvm::TapirTargetID::LevelZero:
+      CmdArgs.push_back("-D_tapir_levelzero_target");
+      ExtractArgsFromString(KITSUNE_LEVELZERO_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
+                            Args);
+      break;
     case llvm::TapirTargetID::OpenCilk:
       ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
                             Args);
@@ -1608,6 +1627,19 @@ void ToolChain::AddKitsunePreprocessorArgs(const ArgList &Args,
     case llvm::TapirTargetID::Realm:
       ExtractArgsFromString(KITSUNE_REALM_EXTRA_PREPROCESSOR_FLAGS, CmdArgs, Args);
       break;
+    case llvm::TapirTargetID::Multi:
+      // The multi target compiles loops for each of the enabled GPU
+      // targets and OpenCilk (see AddKitsuneCompilerArgs).
+      CmdArgs.push_back("-D_tapir_multi_target");
+      if (KITSUNE_CUDA_ENABLE)
+        ExtractArgsFromString(KITSUNE_CUDA_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
+                              Args);
+      if (KITSUNE_HIP_ENABLE)
+        ExtractArgsFromString(KITSUNE_HIP_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
+                              Args);
+      ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_PREPROCESSOR_FLAGS, CmdArgs,
+                            Args);
+      break;
     default:
       llvm::report_fatal_error("internal error -- unhandled tapir target ID!");
       break;
@@ -1627,11 +1659,46 @@ void ToolChain::AddKitsunePreprocessorArgs(const ArgList &Args,
   }
 }
 
+// The level of the GPU ABIs' cleanup of the host code that launches
+// kernels: the optimization level at -O2 and above (as computed by
+// CompilerInvocation), and zero, no cleanup, below.
+static unsigned getKitsuneHostOptLevel(const ArgList &Args) {
+  Arg *A = Args.getLastArg(options::OPT_O_Group);
+  if (!A)
+    return 0;
+  if (A->getOption().matches(options::OPT_O4) ||
+      A->getOption().matches(options::OPT_Ofast))
+    return 3;
+  if (!A->getOption().matches(options::OPT_O))
+    return 0;
+  StringRef OOpt = A->getValue();
+  if (OOpt == "s" || OOpt == "z")
+    return 2;
+  unsigned Level;
+  if (OOpt.getAsInteger(10, Level) || Level < 2)
+    return 0;
+  return std::min(Level, 3u);
+}
+
 void ToolChain::AddKitsuneCompilerArgs(const ArgList& Args,
                                        ArgStringList& CmdArgs) const {
   std::optional<llvm::TapirTargetID> TapirTarget = parseTapirTarget(Args);
   bool IsKokkos = D.CCCIsCXX() && Args.hasArg(options::OPT_fkokkos);
 
+  unsigned HostOptLevel = getKitsuneHostOptLevel(Args);
+  auto AddHostOptLevel = [&](StringRef ABI) {
+    if (HostOptLevel == 0)
+      return;
+    // A level given explicitly (or in the configured flags) is kept.
+    std::string Opt = ("-" + ABI + "-host-opt-level=").str();
+    auto IsHostOpt = [&](StringRef A) { return A.starts_with(Opt); };
+    if (llvm::any_of(Args.getAllArgValues(options::OPT_mllvm), IsHostOpt) ||
+        llvm::any_of(CmdArgs, IsHostOpt))
+      return;
+    CmdArgs.push_back("-mllvm");
+    CmdArgs.push_back(Args.MakeArgString(Opt + Twine(HostOptLevel)));
+  };
+
   if (TapirTarget) {
     switch (*TapirTarget) {
     case TapirTargetID::Serial:
@@ -1639,9 +1706,30 @@ void ToolChain::AddKitsuneCompilerArgs(const ArgList& Args,
       break;
     case llvm::TapirTargetID::Cuda:
       ExtractArgsFromString(KITSUNE_CUDA_EXTRA_COMPILER_FLAGS, CmdArgs, Args);
+      // Relocatable device code allows kernels to call device functions
+      // defined in other translation units.
+      if (Args.hasFlag(options::OPT_fgpu_rdc, options::OPT_fno_gpu_rdc,
+                       false)) {
+        CmdArgs.push_back("-mllvm");
+        CmdArgs.push_back("-cuabi-rdc");
+      }
+      // The runtime's launch and sync fast paths, inlined into host code.
+      if (std::string RuntimeBC = concat(D.ResourceDir, "lib",
+                                         "libkitcuda-rt.bc");
+          getVFS().exists(RuntimeBC)) {
+        CmdArgs.push_back("-mllvm");
+        CmdArgs.push_back(
+            Args.MakeArgString("-cuabi-runtime-bc-path=" + RuntimeBC));
+      }
+      AddHostOptLevel("cuabi");
       break;
     case llvm::TapirTargetID::Hip:
       ExtractArgsFromString(KITSUNE_HIP_EXTRA_COMPILER_FLAGS, CmdArgs, Args);
+      AddHostOptLevel("hipabi");
+      break;
+    case llvm::TapirTargetID::LevelZero:
+      ExtractArgsFromString(KITSUNE_LEVELZERO_EXTRA_COMPILER_FLAGS, CmdArgs,
+                            Args);
       break;
     case llvm::TapirTargetID::OpenCilk:
       ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_COMPILER_FLAGS, CmdArgs,
@@ -1656,6 +1744,27 @@ void ToolChain::AddKitsuneCompilerArgs(const ArgList& Args,
     case llvm::TapirTargetID::Realm:
       ExtractArgsFromString(KITSUNE_REALM_EXTRA_COMPILER_FLAGS, CmdArgs, Args);
       break;
+    case llvm::TapirTargetID::Multi: {
+      // Loops are versioned for the GPU targets that are enabled; the
+      // host version uses OpenCilk.
+      std::string GPUTargets;
+      if (KITSUNE_CUDA_ENABLE) {
+        ExtractArgsFromString(KITSUNE_CUDA_EXTRA_COMPILER_FLAGS, CmdArgs, Args);
+        AddHostOptLevel("cuabi");
+        GPUTargets += "cuda";
+      }
+      if (KITSUNE_HIP_ENABLE) {
+        ExtractArgsFromString(KITSUNE_HIP_EXTRA_COMPILER_FLAGS, CmdArgs, Args);
+        AddHostOptLevel("hipabi");
+        GPUTargets += GPUTargets.empty() ? "hip" : ",hip";
+      }
+      ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_COMPILER_FLAGS, CmdArgs,
+                            Args);
+      CmdArgs.push_back("-mllvm");
+      CmdArgs.push_back(
+          Args.MakeArgString("-tapir-multi-targets=" + GPUTargets));
+      break;
+    }
     default:
       llvm::report_fatal_error("internal error -- unhandled tapir target ID!");
       break;
@@ -1698,6 +1807,50 @@ void ToolChain::AddKitsuneLinkerArgs(const ArgList &Args,
   std::optional<llvm::TapirTargetID> TapirTarget = parseTapirTarget(Args);
   bool IsKokkos = D.CCCIsCXX() && Args.hasArg(options::OPT_fkokkos);
 
+  // Link the OpenCilk runtime (used by the opencilk and multi targets).
+  auto AddOpenCilkRuntime = [&]() {
+    bool StaticOpenCilk = Args.hasArg(options::OPT_static);
+    bool UseAsan = getSanitizerArgs(Args).needsAsanRt();
+
+    // Link the correct Cilk personality fn
+    if (getDriver().CCCIsCXX())
+      CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
+          Args,
+          UseAsan ? "opencilk-asan-personality-cpp"
+                  : "opencilk-personality-cpp",
+          StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
+    else
+      CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
+          Args,
+          UseAsan ? "opencilk-asan-personality-c" : "opencilk-personality-c",
+          StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
+
+    // Link the opencilk runtime.  We do this after linking the personality
+    // function, to ensure that symbols are resolved correctly when using
+    // static linking.
+    CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
+        Args, UseAsan ? "opencilk-asan" : "opencilk",
+        StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
+
+    // Add to the executable's runpath the default directory containing
+    // OpenCilk runtime.
+    addOpenCilkRuntimeRunPath(*this, Args, CmdArgs, Triple);
+  };
+
+  unsigned HostOptLevel = getKitsuneHostOptLevel(Args);
+  auto AddHostOptLevel = [&](StringRef ABI) {
+    if (HostOptLevel == 0)
+      return;
+    // A level given explicitly (or in the configured flags) is kept.
+    std::string Opt = ("-" + ABI + "-host-opt-level=").str();
+    auto IsHostOpt = [&](StringRef A) { return A.starts_with(Opt); };
+    if (llvm::any_of(Args.getAllArgValues(options::OPT_mllvm), IsHostOpt) ||
+        llvm::any_of(CmdArgs, IsHostOpt))
+      return;
+    CmdArgs.push_back("-mllvm");
+    CmdArgs.push_back(Args.MakeArgString(Opt + Twine(HostOptLevel)));
+  };
+
   if (TapirTarget) {
     switch (*TapirTarget) {
     case TapirTargetID::Serial:
@@ -1720,34 +1873,14 @@ void ToolChain::AddKitsuneLinkerArgs(const ArgList &Args,
       ExtractArgsFromString(KITSUNE_HIP_EXTRA_LINKER_FLAGS, CmdArgs, Args);
       break;
 
-    case llvm::TapirTargetID::OpenCilk: {
-      bool StaticOpenCilk = Args.hasArg(options::OPT_static);
-      bool UseAsan = getSanitizerArgs(Args).needsAsanRt();
-
-      // Link the correct Cilk personality fn
-      if (getDriver().CCCIsCXX())
-        CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
-            Args,
-            UseAsan ? "opencilk-asan-personality-cpp"
-                    : "opencilk-personality-cpp",
-            StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
-      else
-        CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
-            Args,
-            UseAsan ? "opencilk-asan-personality-c" : "opencilk-personality-c",
-            StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
-
-      // Link the opencilk runtime.  We do this after linking the personality
-      // function, to ensure that symbols are resolved correctly when using
-      // static linking.
-      CmdArgs.push_back(Args.MakeArgString(getOpenCilkRT(
-          Args, UseAsan ? "opencilk-asan" : "opencilk",
-          StaticOpenCilk ? ToolChain::FT_Static : ToolChain::FT_Shared)));
-
-      // Add to the executable's runpath the default directory containing
-      // OpenCilk runtime.
-      addOpenCilkRuntimeRunPath(*this, Args, CmdArgs, Triple);
+    case llvm::TapirTargetID::LevelZero:
+      // The runtime opens the Level Zero loader itself.
+      ExtractArgsFromString(KITSUNE_LEVELZERO_EXTRA_LINKER_FLAGS, CmdArgs,
+                            Args);
+      break;
 
+    case llvm::TapirTargetID::OpenCilk: {
+      AddOpenCilkRuntime();
       ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_LINKER_FLAGS, CmdArgs, Args);
       break;
     }
@@ -1764,6 +1897,26 @@ void ToolChain::AddKitsuneLinkerArgs(const ArgList &Args,
       ExtractArgsFromString(KITSUNE_REALM_EXTRA_LINKER_FLAGS, CmdArgs, Args);
       break;
 
+    case llvm::TapirTargetID::Multi:
+      // The binary must start on systems without a GPU (or its driver):
+      // the CUDA driver library is loaded by the runtime and only linked
+      // through the (driver-independent) CUDA runtime library.
+      if (KITSUNE_CUDA_ENABLE) {
+        CmdArgs.push_back(
+            Args.MakeArgString(StringRef("-L") + KITSUNE_CUDA_LIBRARY_DIR));
+        ExtractArgsFromString("-lcudart", CmdArgs, Args);
+        ExtractArgsFromString(KITSUNE_CUDA_EXTRA_LINKER_FLAGS, CmdArgs, Args);
+      }
+      if (KITSUNE_HIP_ENABLE) {
+        CmdArgs.push_back(
+            Args.MakeArgString(StringRef("-L") + KITSUNE_HIP_LIBRARY_DIR));
+        ExtractArgsFromString("-lamdhip64", CmdArgs, Args);
+        ExtractArgsFromString(KITSUNE_HIP_EXTRA_LINKER_FLAGS, CmdArgs, Args);
+      }
+      AddOpenCilkRuntime();
+      ExtractArgsFromString(KITSUNE_OPENCILK_EXTRA_LINKER_FLAGS, CmdArgs, Args);
+      break;
+
     default:
       llvm::report_fatal_error("internal error -- unhandled tapir target ID!");
       break;
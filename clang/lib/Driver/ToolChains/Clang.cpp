@@ -6430,7 +6430,9 @@ void Clang::ConstructJob(Compilation &C, const JobAction &JA,
     bool CustomTarget = false;
 
     if (Arg *TapirRuntime = Args.getLastArgNoClaim(options::OPT_ftapir_EQ)) {
-      if (TapirRuntime->getValue() == StringRef("opencilk")) {
+      // The host code of the multi target also uses OpenCilk.
+      if (TapirRuntime->getValue() == StringRef("opencilk") ||
+          TapirRuntime->getValue() == StringRef("multi")) {
         OpenCilk = true;
       } else {
         CustomTarget = true;
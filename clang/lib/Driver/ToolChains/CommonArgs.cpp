@@ -293,7 +293,8 @@ static void renderTapirLoweringOptions(const ArgList &Args,
     if (const Arg *A = Args.getLastArg(options::OPT_ftapir_EQ)) {
       CmdArgs.push_back(Args.MakeArgString(
           Twine("--plugin-opt=tapir-target=") + A->getValue()));
-      if (std::string(A->getValue()) == std::string("opencilk"))
+      if (std::string(A->getValue()) == std::string("opencilk") ||
+          std::string(A->getValue()) == std::string("multi"))
         TC.AddOpenCilkABIBitcode(Args, CmdArgs, /*IsLTO=*/true);
     }
   }
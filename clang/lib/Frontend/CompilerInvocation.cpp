@@ -4302,6 +4302,10 @@ bool CompilerInvocation::ParseKitsuneArgs(KitsuneOptions &Opts, ArgList &Args,
       if (!KITSUNE_HIP_ENABLE)
         Diags.Report(diag::err_drv_kitsune_hip_target_disabled);
       break;
+    case llvm::TapirTargetID::LevelZero:
+      if (!KITSUNE_LEVELZERO_ENABLE)
+        Diags.Report(diag::err_drv_kitsune_levelzero_target_disabled);
+      break;
     case llvm::TapirTargetID::OpenCilk:
       if (!KITSUNE_OPENCILK_ENABLE)
         Diags.Report(diag::err_drv_kitsune_opencilk_target_disabled);
@@ -4318,6 +4322,11 @@ bool CompilerInvocation::ParseKitsuneArgs(KitsuneOptions &Opts, ArgList &Args,
       if (!KITSUNE_REALM_ENABLE)
         Diags.Report(diag::err_drv_kitsune_realm_target_disabled);
       break;
+    case llvm::TapirTargetID::Multi:
+      if (!KITSUNE_OPENCILK_ENABLE ||
+          !(KITSUNE_CUDA_ENABLE || KITSUNE_HIP_ENABLE))
+        Diags.Report(diag::err_drv_kitsune_multi_target_disabled);
+      break;
     default:
       llvm_unreachable("ParseKitsuneArgs: Tapir target not handled");
     }
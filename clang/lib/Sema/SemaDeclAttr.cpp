@@ -8656,6 +8656,30 @@ static void handleKitsuneMemAccessAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   D->addAttr(::new (S.Context) KitsuneMemAccessAttr(S.Context, AL));
 }
 
+static void handleTapirGrainsizeAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
+  auto *PD = cast<ParmVarDecl>(D);
+  if (!PD->getType()->isDependentType() &&
+      !PD->getType()->isIntegerType()) {
+    S.Diag(AL.getLoc(), diag::err_tapir_grainsize_param_type)
+        << PD->getType() << AL.getRange();
+    return;
+  }
+
+  Expr *E = AL.getArgAsExpr(0);
+  uint32_t Grainsize;
+  if (!E->isValueDependent()) {
+    if (!checkUInt32Argument(S, AL, E, Grainsize, UINT_MAX,
+                             /*StrictlyUnsigned=*/true))
+      return;
+    if (!Grainsize) {
+      S.Diag(AL.getLoc(), diag::err_tapir_grainsize_zero) << AL.getRange();
+      return;
+    }
+  }
+
+  D->addAttr(::new (S.Context) TapirGrainsizeAttr(S.Context, AL, E));
+}
+
 static void handleSYCLKernelAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   // The 'sycl_kernel' attribute applies only to function templates.
   const auto *FD = cast<FunctionDecl>(D);
@@ -9598,6 +9622,9 @@ ProcessDeclAttribute(Sema &S, Scope *scope, Decl *D, const ParsedAttr &AL,
   case ParsedAttr::AT_KitsuneMemAccess:
     handleKitsuneMemAccessAttr(S, D, AL);
     break;
+  case ParsedAttr::AT_TapirGrainsize:
+    handleTapirGrainsizeAttr(S, D, AL);
+    break;
   case ParsedAttr::AT_OpenCLNoSVM:
     handleOpenCLNoSVMAttr(S, D, AL);
     break;
@@ -3375,6 +3375,8 @@ StmtResult Sema::BuildCXXForallRangeStmt(
 
   StmtResult BeginDeclStmt = Begin;
   StmtResult EndDeclStmt = End;
+  StmtResult IndexDeclStmt = Index;
+  StmtResult IndexEndDeclStmt = IndexEnd;
   ExprResult NotEqExpr = Cond, IncrExpr = Inc;
 
   if (RangeVarType->isDependentType()) {
@@ -3596,50 +3598,92 @@ StmtResult Sema::BuildCXXForallRangeStmt(
     if (EndRef.isInvalid())
       return StmtError();
 
-    // Build and check __begin != __end expression.
-    NotEqExpr = ActOnBinOp(S, ColonLoc, tok::exclaimequal, BeginRef.get(),
-                           EndRef.get());
+    // The iterations of a forall run in parallel, so they can not step an
+    // iterator from one to the next.  Instead, iteration i reads
+    // *(__begin + i), which requires random-access iterators:
+    //
+    //   auto __index_end = __end - __begin;
+    //   for (decltype(__index_end) __index = 0; __index < __index_end;
+    //        ++__index)
+    //     loop-var = *(__begin + __index);
+    //
+    // For a contiguous container this is a flat indexed loop over the data
+    // pointer, with no iterator objects left in the body.
+    ExprResult DiffExpr =
+        ActOnBinOp(S, ColonLoc, tok::minus, EndRef.get(), BeginRef.get());
+    if (DiffExpr.isInvalid()) {
+      Diag(RangeLoc, diag::note_forall_range_invalid_iterator)
+          << 0 << BeginRangeRef.get()->getType();
+      NoteForRangeBeginEndFunction(*this, BeginExpr.get(), BEF_begin);
+      return StmtError();
+    }
+    VarDecl *IndexEndVar = BuildForRangeVarDecl(
+        *this, ColonLoc, AutoType, std::string("__index_end") + DepthStr);
+    if (FinishForRangeVarDecl(*this, IndexEndVar, DiffExpr.get(), ColonLoc,
+                              diag::err_for_range_iter_deduction_failure))
+      return StmtError();
+    VarDecl *IndexVar =
+        BuildForRangeVarDecl(*this, ColonLoc, IndexEndVar->getType(),
+                             std::string("__index") + DepthStr);
+    AddInitializerToDecl(
+        IndexVar,
+        IntegerLiteral::Create(Context, llvm::APInt(32, 0), Context.IntTy,
+                               ColonLoc),
+        /*DirectInit=*/false);
+    if (IndexVar->isInvalidDecl())
+      return StmtError();
+
+    IndexDeclStmt =
+        ActOnDeclStmt(ConvertDeclToDeclGroup(IndexVar), ColonLoc, ColonLoc);
+    IndexEndDeclStmt =
+        ActOnDeclStmt(ConvertDeclToDeclGroup(IndexEndVar), ColonLoc, ColonLoc);
+
+    QualType IndexType = IndexVar->getType().getNonReferenceType();
+    ExprResult IndexRef =
+        BuildDeclRefExpr(IndexVar, IndexType, VK_LValue, ColonLoc);
+    ExprResult IndexEndRef = BuildDeclRefExpr(
+        IndexEndVar, IndexEndVar->getType().getNonReferenceType(), VK_LValue,
+        ColonLoc);
+    if (IndexRef.isInvalid() || IndexEndRef.isInvalid())
+      return StmtError();
+
+    // Build and check __index < __index_end expression.
+    NotEqExpr = ActOnBinOp(S, ColonLoc, tok::less, IndexRef.get(),
+                           IndexEndRef.get());
     if (!NotEqExpr.isInvalid())
       NotEqExpr = CheckBooleanCondition(ColonLoc, NotEqExpr.get());
     if (!NotEqExpr.isInvalid())
       NotEqExpr =
           ActOnFinishFullExpr(NotEqExpr.get(), /*DiscardedValue*/ false);
-    if (NotEqExpr.isInvalid()) {
-      Diag(RangeLoc, diag::note_for_range_invalid_iterator)
-          << RangeLoc << 0 << BeginRangeRef.get()->getType();
-      NoteForRangeBeginEndFunction(*this, BeginExpr.get(), BEF_begin);
-      if (!Context.hasSameType(BeginType, EndType))
-        NoteForRangeBeginEndFunction(*this, EndExpr.get(), BEF_end);
-      return StmtError();
-    }
-    // Build and check ++__begin expression.
-    BeginRef =
-        BuildDeclRefExpr(BeginVar, BeginRefNonRefType, VK_LValue, ColonLoc);
-    if (BeginRef.isInvalid())
+    if (NotEqExpr.isInvalid())
       return StmtError();
 
-    IncrExpr = ActOnUnaryOp(S, ColonLoc, tok::plusplus, BeginRef.get());
-    if (!IncrExpr.isInvalid() && CoawaitLoc.isValid())
-      // FIXME: getCurScope() should not be used during template instantiation.
-      // We should pick up the set of unqualified lookup results for operator
-      // co_await during the initial parse.
-      IncrExpr = ActOnCoawaitExpr(S, CoawaitLoc, IncrExpr.get());
+    // Build and check ++__index expression.
+    IndexRef = BuildDeclRefExpr(IndexVar, IndexType, VK_LValue, ColonLoc);
+    if (IndexRef.isInvalid())
+      return StmtError();
+    IncrExpr = ActOnUnaryOp(S, ColonLoc, tok::plusplus, IndexRef.get());
     if (!IncrExpr.isInvalid())
       IncrExpr = ActOnFinishFullExpr(IncrExpr.get(), /*DiscardedValue*/ false);
-    if (IncrExpr.isInvalid()) {
-      Diag(RangeLoc, diag::note_for_range_invalid_iterator)
-          << RangeLoc << 2 << BeginRangeRef.get()->getType();
-      NoteForRangeBeginEndFunction(*this, BeginExpr.get(), BEF_begin);
+    if (IncrExpr.isInvalid())
       return StmtError();
-    }
 
-    // Build and check *__begin  expression.
+    // Build and check *(__begin + __index) expression.
     BeginRef =
         BuildDeclRefExpr(BeginVar, BeginRefNonRefType, VK_LValue, ColonLoc);
-    if (BeginRef.isInvalid())
+    IndexRef = BuildDeclRefExpr(IndexVar, IndexType, VK_LValue, ColonLoc);
+    if (BeginRef.isInvalid() || IndexRef.isInvalid())
       return StmtError();
+    ExprResult IterExpr =
+        ActOnBinOp(S, ColonLoc, tok::plus, BeginRef.get(), IndexRef.get());
+    if (IterExpr.isInvalid()) {
+      Diag(RangeLoc, diag::note_forall_range_invalid_iterator)
+          << 1 << BeginRangeRef.get()->getType();
+      NoteForRangeBeginEndFunction(*this, BeginExpr.get(), BEF_begin);
+      return StmtError();
+    }
 
-    ExprResult DerefExpr = ActOnUnaryOp(S, ColonLoc, tok::star, BeginRef.get());
+    ExprResult DerefExpr = ActOnUnaryOp(S, ColonLoc, tok::star, IterExpr.get());
     if (DerefExpr.isInvalid()) {
       Diag(RangeLoc, diag::note_for_range_invalid_iterator)
           << RangeLoc << 1 << BeginRangeRef.get()->getType();
@@ -3667,9 +3711,11 @@ StmtResult Sema::BuildCXXForallRangeStmt(
   if (getLangOpts().OpenMP >= 50 && BeginDeclStmt.isUsable())
     ActOnOpenMPLoopInitialization(ForLoc, BeginDeclStmt.get());
 
-  return new (Context) CXXForRangeStmt(
+  return new (Context) CXXForallRangeStmt(
       InitStmt, RangeDS, cast_or_null<DeclStmt>(BeginDeclStmt.get()),
-      cast_or_null<DeclStmt>(EndDeclStmt.get()), NotEqExpr.get(),
+      cast_or_null<DeclStmt>(EndDeclStmt.get()),
+      cast_or_null<DeclStmt>(IndexDeclStmt.get()),
+      cast_or_null<DeclStmt>(IndexEndDeclStmt.get()), NotEqExpr.get(),
       IncrExpr.get(), LoopVarDS, /*Body=*/nullptr, ForLoc, CoawaitLoc, ColonLoc,
       RParenLoc);
 }
@@ -653,45 +653,130 @@ static Attr *handleTapirStrategyAttr(Sema &S, Stmt *St, const ParsedAttr &A,
     errState = true;
   }
 
+  // The dynamic and guided strategies take an optional chunk size, written as
+  // "dynamic(N)" or "guided(N)".
+  StringRef chunkStr;
+  unsigned chunk = 0;
+  if (strategyStr.consume_back(")")) {
+    std::tie(strategyStr, chunkStr) = strategyStr.split('(');
+    if (chunkStr.getAsInteger(10, chunk) || chunk == 0) {
+      S.Diag(A.getLoc(), diag::err_tapir_strategy_chunk) << argLoc;
+      errState = true;
+    }
+  }
+
   TapirStrategyAttr::TapirStrategyTy strategyKind;
   if (!TapirStrategyAttr::ConvertStrToTapirStrategyTy(strategyStr,
                                                       strategyKind)) {
     S.Diag(A.getLoc(), diag::err_tapir_strategy_unknown)
            << strategyStr << argLoc;
     errState = true;
+  } else if (!chunkStr.empty() && strategyKind != TapirStrategyAttr::DYNAMIC &&
+             strategyKind != TapirStrategyAttr::GUIDED) {
+    S.Diag(A.getLoc(), diag::err_tapir_strategy_chunk) << argLoc;
+    errState = true;
   }
 
   if (errState)
     return nullptr;
 
-  return ::new (S.Context) TapirStrategyAttr(S.Context, A, strategyKind);
+  return ::new (S.Context) TapirStrategyAttr(S.Context, A, strategyKind, chunk);
 }
 
-static Attr *handleKitsuneLaunchAttr(Sema &S, Stmt *St, const ParsedAttr &A,
-                                     SourceRange Range) {
-  Expr *TPBExpr = A.getArgAsExpr(0);
-  QualType QTy = TPBExpr->getType();
-
-  if (not QTy->isBuiltinType() || not QTy->isIntegerType()) {
-    S.Diag(TPBExpr->getExprLoc(), diag::err_kitsune_launch_non_integral_type);
+static Attr *handleKitsunePriorityAttr(Sema &S, Stmt *St,
+                                       const ParsedAttr &A) {
+  // The priority is written as an identifier, as in priority(high), or
+  // as a string like the tapir attributes.
+  StringRef priorityStr;
+  SourceLocation argLoc;
+  if (A.isArgIdent(0)) {
+    IdentifierLoc *IL = A.getArgAsIdent(0);
+    priorityStr = IL->Ident->getName();
+    argLoc = IL->Loc;
+  } else if (!S.checkStringLiteralArgumentAttr(A, 0, priorityStr, &argLoc)) {
     return nullptr;
   }
 
-  llvm::APSInt ValueAPS;
-  ExprResult R = S.VerifyIntegerConstantExpression(TPBExpr, &ValueAPS);
-  if (R.isInvalid()) {
-    // We don't need to issue a diagnostic here because
-    // VerifyIntegerConstantExpression will already have done so.
+  KitsunePriorityAttr::KitsunePriorityTy priority;
+  if (!KitsunePriorityAttr::ConvertStrToKitsunePriorityTy(priorityStr,
+                                                          priority)) {
+    S.Diag(argLoc, diag::err_kitsune_priority_unknown) << priorityStr;
     return nullptr;
   }
+  return ::new (S.Context) KitsunePriorityAttr(S.Context, A, priority);
+}
+
+static Attr *handleKitsuneLaunchAttr(Sema &S, Stmt *St, const ParsedAttr &A,
+                                     SourceRange Range) {
+  // The launch parameters in attribute order: threads-per-block and the
+  // optional blocks-per-grid cap, minimum blocks per multiprocessor,
+  // dynamic shared memory and iterations per thread.  All of them must
+  // be integer constants; zero leaves an optional parameter to the
+  // runtime.
+  Expr *Params[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+  for (unsigned I = 0; I < A.getNumArgs(); ++I) {
+    Expr *E = A.getArgAsExpr(I);
+    QualType QTy = E->getType();
+    if (not QTy->isBuiltinType() || not QTy->isIntegerType()) {
+      S.Diag(E->getExprLoc(), diag::err_kitsune_launch_non_integral_type)
+          << I;
+      return nullptr;
+    }
+
+    llvm::APSInt ValueAPS;
+    ExprResult R = S.VerifyIntegerConstantExpression(E, &ValueAPS);
+    if (R.isInvalid()) {
+      // We don't need to issue a diagnostic here because
+      // VerifyIntegerConstantExpression will already have done so.
+      return nullptr;
+    }
+
+    if (I == 0 && not ValueAPS.isStrictlyPositive()) {
+      S.Diag(E->getExprLoc(), diag::err_kitsune_launch_tpb_must_be_positive);
+      return nullptr;
+    }
+    if (ValueAPS.isNegative()) {
+      S.Diag(E->getExprLoc(), diag::err_kitsune_launch_param_negative) << I;
+      return nullptr;
+    }
+    Params[I] = E;
+  }
 
-  if (not ValueAPS.isStrictlyPositive()) {
-    S.Diag(TPBExpr->getExprLoc(),
-           diag::err_kitsune_launch_tpb_must_be_positive);
+  return ::new (S.Context) KitsuneLaunchAttr(
+      S.Context, A, Params[0], Params[1], Params[2], Params[3], Params[4]);
+}
+
+KitsuneSpecializeAttr *
+Sema::BuildKitsuneSpecializeAttr(const AttributeCommonInfo &CI,
+                                 ArrayRef<Expr *> Args) {
+  // Each argument is a value the kernel is specialized on: a scalar that
+  // can be folded into the kernel as a constant.  Dependent arguments are
+  // checked when the template is instantiated.
+  if (Args.empty()) {
+    Diag(CI.getLoc(), diag::err_kitsune_specialize_no_args);
     return nullptr;
   }
+  for (Expr *E : Args) {
+    if (E->isTypeDependent())
+      continue;
+    QualType QTy = E->getType().getNonReferenceType();
+    if (not QTy->isIntegralOrEnumerationType() &&
+        not QTy->isRealFloatingType()) {
+      Diag(E->getExprLoc(), diag::err_kitsune_specialize_arg_type) << QTy;
+      return nullptr;
+    }
+  }
+  return ::new (Context)
+      KitsuneSpecializeAttr(Context, CI, const_cast<Expr **>(Args.data()),
+                            Args.size());
+}
 
-  return ::new (S.Context) KitsuneLaunchAttr(S.Context, A, TPBExpr);
+static Attr *handleKitsuneSpecializeAttr(Sema &S, Stmt *St,
+                                         const ParsedAttr &A) {
+  SmallVector<Expr *, 4> Args;
+  for (unsigned I = 0; I < A.getNumArgs(); ++I)
+    Args.push_back(A.getArgAsExpr(I));
+  return S.BuildKitsuneSpecializeAttr(A, Args);
 }
 
 static Attr *ProcessStmtAttribute(Sema &S, Stmt *St, const ParsedAttr &A,
@@ -748,6 +833,12 @@ static Attr *ProcessStmtAttribute(Sema &S, Stmt *St, const ParsedAttr &A,
     return handleTapirTargetAttr(S, St, A, Range);
   case ParsedAttr::AT_KitsuneLaunch:
     return handleKitsuneLaunchAttr(S, St, A, Range);
+  case ParsedAttr::AT_KitsuneAsync:
+    return ::new (S.Context) KitsuneAsyncAttr(S.Context, A);
+  case ParsedAttr::AT_KitsunePriority:
+    return handleKitsunePriorityAttr(S, St, A);
+  case ParsedAttr::AT_KitsuneSpecialize:
+    return handleKitsuneSpecializeAttr(S, St, A);
   default:
     // N.B., ClangAttrEmitter.cpp emits a diagnostic helper that ensures a
     // declaration attribute is not written on a statement, but this code is
@@ -1390,6 +1390,8 @@ namespace {
     TransformStmtAlwaysInlineAttr(const Stmt *OrigS, const Stmt *InstS,
                                   const AlwaysInlineAttr *A);
     const CodeAlignAttr *TransformCodeAlignAttr(const CodeAlignAttr *CA);
+    const KitsuneSpecializeAttr *
+    TransformKitsuneSpecializeAttr(const KitsuneSpecializeAttr *KS);
     ExprResult TransformPredefinedExpr(PredefinedExpr *E);
     ExprResult TransformDeclRefExpr(DeclRefExpr *E);
     ExprResult TransformCXXDefaultArgExpr(CXXDefaultArgExpr *E);
@@ -1935,6 +1937,19 @@ TemplateInstantiator::TransformCodeAlignAttr(const CodeAlignAttr *CA) {
   return getSema().BuildCodeAlignAttr(*CA, TransformedExpr);
 }
 
+const KitsuneSpecializeAttr *
+TemplateInstantiator::TransformKitsuneSpecializeAttr(
+    const KitsuneSpecializeAttr *KS) {
+  SmallVector<Expr *, 4> TransformedArgs;
+  for (Expr *E : KS->args()) {
+    ExprResult R = getDerived().TransformExpr(E);
+    if (R.isInvalid())
+      return nullptr;
+    TransformedArgs.push_back(R.get());
+  }
+  return getSema().BuildKitsuneSpecializeAttr(*KS, TransformedArgs);
+}
+
 ExprResult TemplateInstantiator::transformNonTypeTemplateParmRef(
     Decl *AssociatedDecl, const NonTypeTemplateParmDecl *parm,
     SourceLocation loc, TemplateArgument arg,
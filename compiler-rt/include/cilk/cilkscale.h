@@ -0,0 +1,82 @@
+//===-- cilk/cilkscale.h - Cilkscale interface ------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale, a scalability analyzer for Tapir
+// programs.
+//
+// Public interface header.  A program brackets a region of interest with
+// work/span probes and dumps the difference:
+//
+//   wsp_t start = wsp_getworkspan();
+//   ... region of interest ...
+//   wsp_t end = wsp_getworkspan();
+//   wsp_dump(wsp_sub(end, start), "region of interest");
+//
+// With the Cilkscale runtime each dumped probe becomes a CSV row with the
+// work, span, parallelism, burdened span, burdened parallelism and the
+// estimated speedup on 1, 2, 4, ... processors of the region.  With the
+// Cilkscale benchmark runtime each row holds the wall-clock time of the
+// region instead.
+//===----------------------------------------------------------------------===//
+#ifndef CILK_CILKSCALE_H
+#define CILK_CILKSCALE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define CILKSCALE_EXTERN_C extern "C"
+#define CILKSCALE_NOTHROW noexcept
+#else
+#define CILKSCALE_EXTERN_C
+#define CILKSCALE_NOTHROW __attribute__((nothrow))
+#endif
+
+/// Raw duration in the units of the Cilkscale timer (nanoseconds, or
+/// instructions for the cilkscale-instructions runtime).
+typedef int64_t raw_duration_t;
+
+/// Work, span and burdened span of a computation.
+typedef struct wsp_t {
+  raw_duration_t work;
+  raw_duration_t span;
+  raw_duration_t bspan;
+} wsp_t;
+
+/// Return the work, span and burdened span of the execution so far.
+CILKSCALE_EXTERN_C wsp_t wsp_getworkspan(void) CILKSCALE_NOTHROW;
+
+CILKSCALE_EXTERN_C wsp_t wsp_zero(void) CILKSCALE_NOTHROW;
+CILKSCALE_EXTERN_C wsp_t wsp_add(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW;
+CILKSCALE_EXTERN_C wsp_t wsp_sub(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW;
+
+/// Add a row for the given measurement, labelled with tag, to the Cilkscale
+/// report.  The report is written to the file named by CILKSCALE_OUT or, if
+/// unset, to the standard output.
+CILKSCALE_EXTERN_C void wsp_dump(wsp_t wsp, const char *tag);
+
+#ifdef __cplusplus
+inline wsp_t &operator+=(wsp_t &lhs, const wsp_t &rhs) noexcept {
+  lhs = wsp_add(lhs, rhs);
+  return lhs;
+}
+
+inline wsp_t &operator-=(wsp_t &lhs, const wsp_t &rhs) noexcept {
+  lhs = wsp_sub(lhs, rhs);
+  return lhs;
+}
+
+inline wsp_t operator+(wsp_t lhs, const wsp_t &rhs) noexcept {
+  return lhs += rhs;
+}
+
+inline wsp_t operator-(wsp_t lhs, const wsp_t &rhs) noexcept {
+  return lhs -= rhs;
+}
+#endif
+
+#endif // CILK_CILKSCALE_H
@@ -0,0 +1,108 @@
+//===-- benchmark.cpp - Cilkscale benchmarking runtime ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// The benchmarking runtime implements the work/span probes of
+// <cilk/cilkscale.h> with wall-clock time, so the same probes time the
+// regions of an uninstrumented (parallel) run of the program.  Each
+// wsp_dump() writes a CSV row with the tag and the time of the region to the
+// file named by CILKSCALE_OUT (default: stdout).  Together with the report of
+// the Cilkscale analyzer this gives the measured speedup of each region next
+// to the estimated one.
+//===----------------------------------------------------------------------===//
+
+#include "csi.h"
+
+#include <cilk/cilkscale.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+namespace {
+
+FILE *out = nullptr;
+bool header_written = false;
+std::mutex out_mutex;
+
+void close_output() {
+  if (out && out != stdout)
+    fclose(out);
+  else
+    fflush(stdout);
+}
+
+FILE *get_output() {
+  if (out)
+    return out;
+  out = stdout;
+  const char *path = getenv("CILKSCALE_OUT");
+  if (path && *path) {
+    out = fopen(path, "w");
+    if (!out) {
+      fprintf(stderr, "cilkscale: cannot open '%s' for writing.\n", path);
+      out = stdout;
+    }
+  }
+  atexit(close_output);
+  return out;
+}
+
+std::string csv_quote(const std::string &field) {
+  if (field.find_first_of(",\"\n") == std::string::npos)
+    return field;
+  std::string quoted = "\"";
+  for (char c : field) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+} // namespace
+
+// The benchmarking runtime uses no instrumentation.
+CSIRT_API void __csi_init() {}
+
+CILKSCALE_EXTERN_C wsp_t wsp_getworkspan() CILKSCALE_NOTHROW {
+  wsp_t res = {0, 0, 0};
+  res.work = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count();
+  return res;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_zero() CILKSCALE_NOTHROW {
+  wsp_t res = {0, 0, 0};
+  return res;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_add(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW {
+  lhs.work += rhs.work;
+  return lhs;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_sub(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW {
+  lhs.work -= rhs.work;
+  return lhs;
+}
+
+CILKSCALE_EXTERN_C void wsp_dump(wsp_t wsp, const char *tag) {
+  std::lock_guard<std::mutex> lock(out_mutex);
+  FILE *f = get_output();
+  if (!header_written) {
+    fprintf(f, "tag,time (seconds)\n");
+    header_written = true;
+  }
+  fprintf(f, "%s,%g\n", csv_quote(tag ? tag : "").c_str(),
+          (double)wsp.work * 1.0e-9);
+}
@@ -0,0 +1,352 @@
+//===-- cilkscale.cpp - Cilkscale scalability analyzer ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// Cilkscale measures the work, span and burdened span of a CSI-instrumented
+// Tapir program as it runs, with the algorithm of Cilkview.  The burdened
+// span charges each spawn with the burden of a steal, so the burdened
+// parallelism reflects the scheduling overhead of fine-grained spawns.
+//
+// The tool writes a CSV report with one row per wsp_dump() probe (see
+// <cilk/cilkscale.h>), a row for the whole program (with an empty tag) and a
+// row for each of the parallel regions with the most work.  A parallel region
+// is the code between the first spawn after a sync and the next sync of the
+// same sync region; its row is tagged with the source location of the sync
+// and accumulates all of its executions.  Each row also estimates the
+// speedup on P = 1, 2, 4, ... processors with the burdened-dag bound
+// T_P <= min(T_1, T_1 / P + burdened span).
+//
+// The tool reads the following environment variables:
+//
+//   CILKSCALE_OUT        File to write the report to (default: stdout).
+//   CILKSCALE_MAX_PROCS  Largest P of the speedup estimates (default: the
+//                        number of hardware threads).
+//   CILKSCALE_REGIONS    Number of parallel regions to report (default: 10).
+//   CILKSCALE_BURDEN     Burden of a spawn, in the units of the timer.
+//
+// The tool itself is serial: run the instrumented program on one worker
+// (e.g., with the serial Tapir target).
+//===----------------------------------------------------------------------===//
+
+#include "cilkscale_timer.h"
+#include "csi.h"
+#include "shadow_stack.h"
+
+#include <cilk/cilkscale.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Accumulated cost of the executions of a parallel region.
+struct region_stats_t {
+  uint64_t count = 0;
+  cilk_time_t work = 0;
+  cilk_time_t span = 0;
+  cilk_time_t bspan = 0;
+};
+
+struct cilkscale_t {
+  shadow_stack_t stack;
+  cilkscale_timer_t timer;
+  cilk_time_t burden = cilkscale_timer_t::default_burden;
+
+  FILE *out = stdout;
+  bool header_written = false;
+  std::vector<unsigned> procs;
+
+  unsigned max_regions = 10;
+  std::unordered_map<csi_id_t, region_stats_t> regions;
+};
+
+cilkscale_t *tool = nullptr;
+
+unsigned env_unsigned(const char *name, unsigned default_value) {
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return default_value;
+  return (unsigned)strtoul(value, nullptr, 10);
+}
+
+// Charge the time since the last hook to the top frame.  Hooks call this
+// first and restart the timer last, so the time spent in the tool is
+// excluded.
+inline void tool_enter() { tool->stack.peek().add(tool->timer.elapsed()); }
+
+inline void tool_leave() { tool->timer.start(); }
+
+std::string csv_quote(const std::string &field) {
+  if (field.find_first_of(",\"\n") == std::string::npos)
+    return field;
+  std::string quoted = "\"";
+  for (char c : field) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+void write_header() {
+  const char *units = cilkscale_timer_t::units();
+  fprintf(tool->out,
+          "tag,work (%s),span (%s),parallelism,burdened_span (%s),"
+          "burdened_parallelism",
+          units, units, units);
+  for (unsigned p : tool->procs)
+    fprintf(tool->out, ",speedup (P=%u)", p);
+  fprintf(tool->out, "\n");
+  tool->header_written = true;
+}
+
+void write_row(const std::string &tag, cilk_time_t work, cilk_time_t span,
+               cilk_time_t bspan) {
+  if (!tool->header_written)
+    write_header();
+  double w = cilkscale_timer_t::to_output(work);
+  double s = cilkscale_timer_t::to_output(span);
+  double b = cilkscale_timer_t::to_output(bspan);
+  fprintf(tool->out, "%s,%g,%g,%g,%g,%g", csv_quote(tag).c_str(), w, s,
+          span > 0 ? w / s : 0.0, b, bspan > 0 ? w / b : 0.0);
+  // The burdened-dag bound T_P <= min(T_1, T_1 / P + burdened span).
+  for (unsigned p : tool->procs)
+    fprintf(tool->out, ",%g", w > 0 ? std::max(w / (w / p + b), 1.0) : 0.0);
+  fprintf(tool->out, "\n");
+}
+
+std::string region_tag(csi_id_t sync_id, uint64_t count) {
+  char buf[64];
+  std::string tag = "sync ";
+  const source_loc_t *loc = __csi_get_sync_source_loc(sync_id);
+  if (loc && loc->filename) {
+    snprintf(buf, sizeof(buf), ":%d:%d", loc->line, loc->column);
+    tag += loc->filename;
+    tag += buf;
+  } else {
+    snprintf(buf, sizeof(buf), "#%lld", (long long)sync_id);
+    tag += buf;
+  }
+  snprintf(buf, sizeof(buf), " (x%llu)", (unsigned long long)count);
+  return tag + buf;
+}
+
+void write_regions() {
+  std::vector<std::pair<csi_id_t, region_stats_t>> regions(
+      tool->regions.begin(), tool->regions.end());
+  std::sort(regions.begin(), regions.end(),
+            [](const std::pair<csi_id_t, region_stats_t> &a,
+               const std::pair<csi_id_t, region_stats_t> &b) {
+              return a.second.work > b.second.work;
+            });
+  if (regions.size() > tool->max_regions)
+    regions.resize(tool->max_regions);
+  for (const auto &region : regions)
+    write_row(region_tag(region.first, region.second.count),
+              region.second.work, region.second.span, region.second.bspan);
+}
+
+wsp_t get_workspan() {
+  // Cost of the execution so far, as if all outstanding spawns were synced
+  // now: the sum of the continuations of the frames, or a longer path
+  // through an outstanding child of one of the frames.
+  wsp_t wsp = wsp_zero();
+  const std::vector<shadow_stack_frame_t> &frames = tool->stack.get_frames();
+  cilk_time_t span = 0, bspan = 0, longest_span = 0, longest_bspan = 0;
+  for (const shadow_stack_frame_t &frame : frames) {
+    for (unsigned reg = 0; reg < frame.num_sync_reg; ++reg) {
+      const sync_region_t &r =
+          static_cast<const shadow_stack_t &>(tool->stack).region(frame, reg);
+      wsp.work += r.achild_work;
+      longest_span = std::max(longest_span, span + r.lchild_span);
+      longest_bspan = std::max(longest_bspan, bspan + r.lchild_bspan);
+    }
+    wsp.work += frame.contin_work;
+    span += frame.contin_span;
+    bspan += frame.contin_bspan;
+  }
+  wsp.span = std::max(span, longest_span);
+  wsp.bspan = std::max(bspan, longest_bspan);
+  return wsp;
+}
+
+void destroy() {
+  if (!tool)
+    return;
+  tool_enter();
+  wsp_t program = get_workspan();
+  write_row("", program.work, program.span, program.bspan);
+  write_regions();
+  if (tool->out != stdout)
+    fclose(tool->out);
+  else
+    fflush(stdout);
+  // Hooks from global destructors that run later are ignored.
+  delete tool;
+  tool = nullptr;
+}
+
+} // namespace
+
+// Initialization.
+
+CSIRT_API void __csi_init() {
+  tool = new cilkscale_t;
+  tool->stack.push(FRAME_FUNCTION, 1);
+
+  const char *out = getenv("CILKSCALE_OUT");
+  if (out && *out) {
+    tool->out = fopen(out, "w");
+    if (!tool->out) {
+      fprintf(stderr, "cilkscale: cannot open '%s' for writing.\n", out);
+      tool->out = stdout;
+    }
+  }
+
+  unsigned hw_procs = std::max(std::thread::hardware_concurrency(), 1u);
+  unsigned max_procs =
+      std::max(env_unsigned("CILKSCALE_MAX_PROCS", hw_procs), 1u);
+  for (unsigned p = 1; p < max_procs; p *= 2)
+    tool->procs.push_back(p);
+  tool->procs.push_back(max_procs);
+
+  tool->max_regions = env_unsigned("CILKSCALE_REGIONS", tool->max_regions);
+  tool->burden = env_unsigned("CILKSCALE_BURDEN", (unsigned)tool->burden);
+
+  atexit(destroy);
+  tool_leave();
+}
+
+// Hooks.
+
+CSIRT_API void __csi_func_entry(const csi_id_t func_id,
+                                const func_prop_t prop) {
+  if (!tool)
+    return;
+  tool_enter();
+  tool->stack.push(FRAME_FUNCTION, prop.num_sync_reg);
+  tool_leave();
+}
+
+CSIRT_API void __csi_func_exit(const csi_id_t func_exit_id,
+                               const csi_id_t func_id,
+                               const func_exit_prop_t prop) {
+  if (!tool)
+    return;
+  tool_enter();
+  // Never pop the bottom frame, which stands for the code outside of main.
+  if (tool->stack.get_frames().size() > 1) {
+    shadow_stack_frame_t callee = tool->stack.pop();
+    tool->stack.join_callee(callee);
+  }
+  tool_leave();
+}
+
+CSIRT_API void __csi_detach(const csi_id_t detach_id, const int32_t sync_reg,
+                            const detach_prop_t prop) {
+  if (!tool)
+    return;
+  tool_enter();
+  tool->stack.spawn(sync_reg);
+  tool_leave();
+}
+
+CSIRT_API void __csi_task(const csi_id_t task_id, const csi_id_t detach_id,
+                          const task_prop_t prop) {
+  if (!tool)
+    return;
+  tool_enter();
+  tool->stack.push(FRAME_TASK, prop.num_sync_reg);
+  tool_leave();
+}
+
+CSIRT_API void __csi_task_exit(const csi_id_t task_exit_id,
+                               const csi_id_t task_id,
+                               const csi_id_t detach_id,
+                               const int32_t sync_reg,
+                               const task_exit_prop_t prop) {
+  if (!tool)
+    return;
+  tool_enter();
+  if (tool->stack.get_frames().size() > 1) {
+    shadow_stack_frame_t child = tool->stack.pop();
+    tool->stack.join_child(child, sync_reg, tool->burden);
+  }
+  tool_leave();
+}
+
+CSIRT_API void __csi_after_sync(const csi_id_t sync_id,
+                                const int32_t sync_reg) {
+  if (!tool)
+    return;
+  tool_enter();
+  region_cost_t cost;
+  if (tool->stack.sync(sync_reg, cost) && tool->max_regions) {
+    region_stats_t &stats = tool->regions[sync_id];
+    ++stats.count;
+    stats.work += cost.work;
+    stats.span += cost.span;
+    stats.bspan += cost.bspan;
+  }
+  tool_leave();
+}
+
+#if CSCALETIMER == INST
+CSIRT_API void __csi_bb_entry(const csi_id_t bb_id, const bb_prop_t prop) {
+  if (!tool)
+    return;
+  if (const sizeinfo_t *size = __csi_get_bb_sizes(bb_id))
+    tool->stack.peek().add(size->non_empty_size);
+}
+#endif
+
+// Work/span probes.
+
+CILKSCALE_EXTERN_C wsp_t wsp_getworkspan() CILKSCALE_NOTHROW {
+  if (!tool)
+    return wsp_zero();
+  tool_enter();
+  wsp_t wsp = get_workspan();
+  tool_leave();
+  return wsp;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_zero() CILKSCALE_NOTHROW {
+  wsp_t res = {0, 0, 0};
+  return res;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_add(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW {
+  lhs.work += rhs.work;
+  lhs.span += rhs.span;
+  lhs.bspan += rhs.bspan;
+  return lhs;
+}
+
+CILKSCALE_EXTERN_C wsp_t wsp_sub(wsp_t lhs, wsp_t rhs) CILKSCALE_NOTHROW {
+  lhs.work -= rhs.work;
+  lhs.span -= rhs.span;
+  lhs.bspan -= rhs.bspan;
+  return lhs;
+}
+
+CILKSCALE_EXTERN_C void wsp_dump(wsp_t wsp, const char *tag) {
+  if (!tool)
+    return;
+  tool_enter();
+  write_row(tag ? tag : "", wsp.work, wsp.span, wsp.bspan);
+  tool_leave();
+}
@@ -0,0 +1,71 @@
+//===-- cilkscale_timer.h - Timers for Cilkscale ----------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// The timer that measures the strands of the computation.  CSCALETIMER
+// selects it:
+//
+//   CHRONO -- wall-clock time (in nanoseconds) of a monotonic clock.
+//   INST   -- the IR instructions of the executed basic blocks.  This timer
+//             is deterministic and unaffected by the instrumentation, but
+//             needs basic-block instrumentation.
+//===----------------------------------------------------------------------===//
+#ifndef CILKSCALE_TIMER_H
+#define CILKSCALE_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+
+#define CHRONO 0
+#define INST 1
+
+#ifndef CSCALETIMER
+#define CSCALETIMER CHRONO
+#endif
+
+typedef int64_t cilk_time_t;
+
+#if CSCALETIMER == INST
+
+// Instructions are counted by the basic-block hook, not by the timer.
+class cilkscale_timer_t {
+public:
+  void start() {}
+  cilk_time_t elapsed() const { return 0; }
+
+  static const char *units() { return "instructions"; }
+  static double to_output(cilk_time_t t) { return (double)t; }
+
+  // Cilkview's default burden of a spawn and its steal.
+  static constexpr cilk_time_t default_burden = 15000;
+};
+
+#else
+
+class cilkscale_timer_t {
+  std::chrono::steady_clock::time_point begin;
+
+public:
+  void start() { begin = std::chrono::steady_clock::now(); }
+  cilk_time_t elapsed() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - begin)
+        .count();
+  }
+
+  static const char *units() { return "seconds"; }
+  static double to_output(cilk_time_t t) { return (double)t * 1.0e-9; }
+
+  // 15us: roughly the cost of a steal plus the cache misses that follow it.
+  static constexpr cilk_time_t default_burden = 15000;
+};
+
+#endif
+
+#endif // CILKSCALE_TIMER_H
@@ -0,0 +1,266 @@
+//===-- csanrt.cpp - CSI runtime support for Cilkscale ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// The CSI runtime: assigns the global IDs of the objects of each
+// instrumented unit, collects the front-end data (FED) and size tables of
+// the units, and provides null definitions of the hooks a tool does not
+// use.  __csi_init is deliberately not defined here, so linking an
+// instrumented unit pulls in the tool (cilkscale.cpp or benchmark.cpp) from
+// the runtime archive.
+//===----------------------------------------------------------------------===//
+
+#include "csi.h"
+
+#include <vector>
+
+namespace {
+
+// The FED tables of a unit, in the order the CSI pass emits them.
+enum fed_type_t {
+  FED_TYPE_FUNCTIONS,
+  FED_TYPE_FUNCTION_EXIT,
+  FED_TYPE_LOOP,
+  FED_TYPE_LOOP_EXIT,
+  FED_TYPE_BASICBLOCK,
+  FED_TYPE_CALLSITE,
+  FED_TYPE_LOAD,
+  FED_TYPE_STORE,
+  FED_TYPE_DETACH,
+  FED_TYPE_TASK,
+  FED_TYPE_TASK_EXIT,
+  FED_TYPE_DETACH_CONTINUE,
+  FED_TYPE_SYNC,
+  FED_TYPE_ALLOCA,
+  FED_TYPE_ALLOCFN,
+  FED_TYPE_FREE,
+  NUM_FED_TYPES
+};
+
+// The size tables of a unit.
+enum sizeinfo_type_t { SIZEINFO_TYPE_BASICBLOCK, NUM_SIZEINFO_TYPES };
+
+// A FED table of a unit, as emitted by the CSI pass.
+typedef struct {
+  int64_t num_entries;
+  csi_id_t *id_base;
+  const source_loc_t *entries;
+} unit_fed_table_t;
+
+// A size table of a unit, as emitted by the CSI pass.
+typedef struct {
+  int64_t num_entries;
+  const sizeinfo_t *entries;
+} unit_size_table_t;
+
+typedef void (*__csi_init_callsite_to_functions)();
+
+// The tables of all units, indexed by global ID.
+std::vector<source_loc_t> *fed_tables = nullptr;
+std::vector<sizeinfo_t> *size_tables = nullptr;
+
+bool csi_init_called = false;
+
+void add_fed_tables(unit_fed_table_t *unit_fed_tables,
+                    instrumentation_counts_t &counts) {
+  csi_id_t *count = &counts.num_func;
+  for (unsigned i = 0; i < NUM_FED_TYPES; ++i) {
+    unit_fed_table_t &unit = unit_fed_tables[i];
+    std::vector<source_loc_t> &table = fed_tables[i];
+    // The objects of the unit are numbered after those of earlier units.
+    *unit.id_base = (csi_id_t)table.size();
+    table.insert(table.end(), unit.entries, unit.entries + unit.num_entries);
+    count[i] = unit.num_entries;
+  }
+}
+
+// The size tables are indexed by the IDs of the corresponding FED table.
+void add_size_tables(unit_size_table_t *unit_size_tables,
+                     unit_fed_table_t *unit_fed_tables) {
+  static const fed_type_t id_type[NUM_SIZEINFO_TYPES] = {FED_TYPE_BASICBLOCK};
+  for (unsigned i = 0; i < NUM_SIZEINFO_TYPES; ++i) {
+    unit_size_table_t &unit = unit_size_tables[i];
+    std::vector<sizeinfo_t> &table = size_tables[i];
+    size_t base = (size_t)*unit_fed_tables[id_type[i]].id_base;
+    if (table.size() < base + unit.num_entries)
+      table.resize(base + unit.num_entries, sizeinfo_t{0, 0});
+    for (int64_t j = 0; j < unit.num_entries; ++j)
+      table[base + j] = unit.entries[j];
+  }
+}
+
+inline const source_loc_t *get_source_loc(fed_type_t type, csi_id_t id) {
+  if (!fed_tables || id < 0 || (size_t)id >= fed_tables[type].size())
+    return nullptr;
+  return &fed_tables[type][id];
+}
+
+} // namespace
+
+CSIRT_API
+void __csirt_unit_init(const char *const name,
+                       unit_fed_table_t *unit_fed_tables,
+                       unit_size_table_t *unit_size_tables,
+                       __csi_init_callsite_to_functions callsite_to_func_init) {
+  // The tables are allocated on first use, since units are initialized by
+  // global constructors in no particular order.
+  if (!fed_tables) {
+    fed_tables = new std::vector<source_loc_t>[NUM_FED_TYPES];
+    size_tables = new std::vector<sizeinfo_t>[NUM_SIZEINFO_TYPES];
+  }
+  if (!csi_init_called) {
+    __csi_init();
+    csi_init_called = true;
+  }
+
+  instrumentation_counts_t counts;
+  add_fed_tables(unit_fed_tables, counts);
+  add_size_tables(unit_size_tables, unit_fed_tables);
+
+  if (callsite_to_func_init)
+    callsite_to_func_init();
+
+  __csi_unit_init(name, counts);
+}
+
+// FED accessors.
+
+CSIRT_API
+const source_loc_t *__csi_get_func_source_loc(const csi_id_t id) {
+  return get_source_loc(FED_TYPE_FUNCTIONS, id);
+}
+
+CSIRT_API
+const source_loc_t *__csi_get_bb_source_loc(const csi_id_t id) {
+  return get_source_loc(FED_TYPE_BASICBLOCK, id);
+}
+
+CSIRT_API
+const source_loc_t *__csi_get_loop_source_loc(const csi_id_t id) {
+  return get_source_loc(FED_TYPE_LOOP, id);
+}
+
+CSIRT_API
+const source_loc_t *__csi_get_detach_source_loc(const csi_id_t id) {
+  return get_source_loc(FED_TYPE_DETACH, id);
+}
+
+CSIRT_API
+const source_loc_t *__csi_get_sync_source_loc(const csi_id_t id) {
+  return get_source_loc(FED_TYPE_SYNC, id);
+}
+
+CSIRT_API
+const sizeinfo_t *__csi_get_bb_sizes(const csi_id_t id) {
+  if (!size_tables || id < 0 ||
+      (size_t)id >= size_tables[SIZEINFO_TYPE_BASICBLOCK].size())
+    return nullptr;
+  return &size_tables[SIZEINFO_TYPE_BASICBLOCK][id];
+}
+
+// Null hooks, for the instrumentation a tool does not use.
+
+CSIRT_API WEAK void __csi_unit_init(const char *const file_name,
+                                    const instrumentation_counts_t counts) {}
+
+CSIRT_API WEAK void __csi_func_entry(const csi_id_t func_id,
+                                     const func_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_func_exit(const csi_id_t func_exit_id,
+                                    const csi_id_t func_id,
+                                    const func_exit_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_bb_entry(const csi_id_t bb_id, const bb_prop_t prop) {
+}
+
+CSIRT_API WEAK void __csi_bb_exit(const csi_id_t bb_id, const bb_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_loop(const csi_id_t loop_id,
+                                      const int64_t trip_count,
+                                      const loop_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_loop(const csi_id_t loop_id,
+                                     const loop_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_loopbody_entry(const csi_id_t loop_id,
+                                         const loop_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_loopbody_exit(const csi_id_t loop_exit_id,
+                                        const csi_id_t loop_id,
+                                        const loop_exit_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_call(const csi_id_t call_id,
+                                      const csi_id_t func_id,
+                                      const call_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_call(const csi_id_t call_id,
+                                     const csi_id_t func_id,
+                                     const call_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_load(const csi_id_t load_id, const void *addr,
+                                      const int32_t num_bytes,
+                                      const load_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_load(const csi_id_t load_id, const void *addr,
+                                     const int32_t num_bytes,
+                                     const load_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_store(const csi_id_t store_id,
+                                       const void *addr,
+                                       const int32_t num_bytes,
+                                       const store_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_store(const csi_id_t store_id, const void *addr,
+                                      const int32_t num_bytes,
+                                      const store_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_alloca(const csi_id_t alloca_id,
+                                       const void *addr, size_t num_bytes,
+                                       const alloca_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_allocfn(const csi_id_t allocfn_id,
+                                         size_t size, size_t num,
+                                         size_t alignment, const void *oldaddr,
+                                         const allocfn_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_allocfn(const csi_id_t allocfn_id,
+                                        const void *addr, size_t size,
+                                        size_t num, size_t alignment,
+                                        const void *oldaddr,
+                                        const allocfn_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_free(const csi_id_t free_id, const void *ptr,
+                                      const free_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_after_free(const csi_id_t free_id, const void *ptr,
+                                     const free_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_detach(const csi_id_t detach_id,
+                                 const int32_t sync_reg,
+                                 const detach_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_task(const csi_id_t task_id, const csi_id_t detach_id,
+                               const task_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_task_exit(const csi_id_t task_exit_id,
+                                    const csi_id_t task_id,
+                                    const csi_id_t detach_id,
+                                    const int32_t sync_reg,
+                                    const task_exit_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_detach_continue(const csi_id_t detach_continue_id,
+                                          const csi_id_t detach_id,
+                                          const int32_t sync_reg,
+                                          const detach_continue_prop_t prop) {}
+
+CSIRT_API WEAK void __csi_before_sync(const csi_id_t sync_id,
+                                      const int32_t sync_reg) {}
+
+CSIRT_API WEAK void __csi_after_sync(const csi_id_t sync_id,
+                                     const int32_t sync_reg) {}
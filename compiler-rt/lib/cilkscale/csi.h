@@ -0,0 +1,190 @@
+//===-- csi.h - CSI hook interface ------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// Types and hooks of the ComprehensiveStaticInstrumentation (CSI) pass.  The
+// layouts here must match those built by the pass (see
+// llvm/Transforms/Instrumentation/CSI.h): each property is a 64-bit word
+// whose bit fields are in the order of the corresponding Csi*Property, and
+// the FED tables of a unit are passed to __csirt_unit_init in the order of
+// fed_type_t.
+//===----------------------------------------------------------------------===//
+#ifndef CILKSCALE_CSI_H
+#define CILKSCALE_CSI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CSIRT_API extern "C" __attribute__((visibility("default")))
+#define WEAK __attribute__((weak))
+
+typedef int64_t csi_id_t;
+
+#define UNKNOWN_CSI_ID ((csi_id_t)-1)
+
+typedef struct {
+  csi_id_t num_func;
+  csi_id_t num_func_exit;
+  csi_id_t num_loop;
+  csi_id_t num_loop_exit;
+  csi_id_t num_bb;
+  csi_id_t num_callsite;
+  csi_id_t num_load;
+  csi_id_t num_store;
+  csi_id_t num_detach;
+  csi_id_t num_task;
+  csi_id_t num_task_exit;
+  csi_id_t num_detach_continue;
+  csi_id_t num_sync;
+  csi_id_t num_alloca;
+  csi_id_t num_allocfn;
+  csi_id_t num_free;
+} instrumentation_counts_t;
+
+typedef struct {
+  uint64_t num_sync_reg : 8;
+  uint64_t may_spawn : 1;
+  uint64_t _padding : 55;
+} func_prop_t;
+
+typedef struct {
+  uint64_t may_spawn : 1;
+  uint64_t eh_return : 1;
+  uint64_t _padding : 62;
+} func_exit_prop_t;
+
+typedef struct {
+  uint64_t is_tapir_loop : 1;
+  uint64_t has_unique_exiting_block : 1;
+  uint64_t _padding : 62;
+} loop_prop_t;
+
+typedef struct {
+  uint64_t is_latch : 1;
+  uint64_t _padding : 63;
+} loop_exit_prop_t;
+
+typedef struct {
+  uint64_t is_landingpad : 1;
+  uint64_t is_ehpad : 1;
+  uint64_t _padding : 62;
+} bb_prop_t;
+
+typedef struct {
+  uint64_t is_indirect : 1;
+  uint64_t is_unwind : 1;
+  uint64_t _padding : 62;
+} call_prop_t;
+
+typedef struct {
+  uint64_t alignment : 8;
+  uint64_t is_vtable_access : 1;
+  uint64_t is_constant : 1;
+  uint64_t is_on_stack : 1;
+  uint64_t may_be_captured : 1;
+  uint64_t is_atomic : 1;
+  uint64_t is_thread_local : 1;
+  uint64_t load_read_before_write_in_bb : 1;
+  uint64_t _padding : 49;
+} load_prop_t, store_prop_t;
+
+typedef struct {
+  uint64_t is_static : 1;
+  uint64_t _padding : 63;
+} alloca_prop_t;
+
+typedef struct {
+  uint64_t allocfn_ty : 8;
+  uint64_t _padding : 56;
+} allocfn_prop_t;
+
+typedef struct {
+  uint64_t free_ty : 8;
+  uint64_t _padding : 56;
+} free_prop_t;
+
+typedef struct {
+  uint64_t for_tapir_loop_body : 1;
+  uint64_t _padding : 63;
+} detach_prop_t;
+
+typedef struct {
+  uint64_t is_tapir_loop_body : 1;
+  uint64_t num_sync_reg : 8;
+  uint64_t _padding : 55;
+} task_prop_t;
+
+typedef struct {
+  uint64_t is_tapir_loop_body : 1;
+  uint64_t _padding : 63;
+} task_exit_prop_t;
+
+typedef struct {
+  uint64_t is_unwind : 1;
+  uint64_t for_tapir_loop_body : 1;
+  uint64_t _padding : 62;
+} detach_continue_prop_t;
+
+// Front-end data (FED): the source location of an instrumented object.
+typedef struct {
+  char *name;
+  int32_t line;
+  int32_t column;
+  char *filename;
+} source_loc_t;
+
+// The IR size of a basic block.
+typedef struct {
+  int32_t full_ir_size;
+  int32_t non_empty_size;
+} sizeinfo_t;
+
+// Initialization hooks.
+CSIRT_API void __csi_init();
+CSIRT_API void __csi_unit_init(const char *const file_name,
+                               const instrumentation_counts_t counts);
+
+// Function, basic-block, loop and Tapir hooks.
+CSIRT_API void __csi_func_entry(const csi_id_t func_id, const func_prop_t prop);
+CSIRT_API void __csi_func_exit(const csi_id_t func_exit_id,
+                               const csi_id_t func_id,
+                               const func_exit_prop_t prop);
+CSIRT_API void __csi_bb_entry(const csi_id_t bb_id, const bb_prop_t prop);
+CSIRT_API void __csi_bb_exit(const csi_id_t bb_id, const bb_prop_t prop);
+CSIRT_API void __csi_before_loop(const csi_id_t loop_id,
+                                 const int64_t trip_count,
+                                 const loop_prop_t prop);
+CSIRT_API void __csi_after_loop(const csi_id_t loop_id, const loop_prop_t prop);
+CSIRT_API void __csi_detach(const csi_id_t detach_id, const int32_t sync_reg,
+                            const detach_prop_t prop);
+CSIRT_API void __csi_task(const csi_id_t task_id, const csi_id_t detach_id,
+                          const task_prop_t prop);
+CSIRT_API void __csi_task_exit(const csi_id_t task_exit_id,
+                               const csi_id_t task_id,
+                               const csi_id_t detach_id,
+                               const int32_t sync_reg,
+                               const task_exit_prop_t prop);
+CSIRT_API void __csi_detach_continue(const csi_id_t detach_continue_id,
+                                     const csi_id_t detach_id,
+                                     const int32_t sync_reg,
+                                     const detach_continue_prop_t prop);
+CSIRT_API void __csi_before_sync(const csi_id_t sync_id,
+                                 const int32_t sync_reg);
+CSIRT_API void __csi_after_sync(const csi_id_t sync_id,
+                                const int32_t sync_reg);
+
+// FED accessors.
+CSIRT_API const source_loc_t *__csi_get_func_source_loc(const csi_id_t id);
+CSIRT_API const source_loc_t *__csi_get_bb_source_loc(const csi_id_t id);
+CSIRT_API const source_loc_t *__csi_get_loop_source_loc(const csi_id_t id);
+CSIRT_API const source_loc_t *__csi_get_detach_source_loc(const csi_id_t id);
+CSIRT_API const source_loc_t *__csi_get_sync_source_loc(const csi_id_t id);
+CSIRT_API const sizeinfo_t *__csi_get_bb_sizes(const csi_id_t id);
+
+#endif // CILKSCALE_CSI_H
@@ -0,0 +1,383 @@
+//===-- perf.cpp - Hardware counters of Tapir regions -----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// The perf runtime reads hardware performance counters (cycles,
+// instructions, last-level-cache misses and stalled cycles) through
+// perf_event at the CSI hooks of Tapir loops and tasks, and reports them per
+// source location:
+//
+//   loop       a Tapir loop, from the thread that runs the loop.
+//   loop-body  the bodies of a Tapir loop, from all workers.
+//   task       a spawned task (outside of a Tapir loop), from all workers.
+//
+// Counts are inclusive of nested regions.  The counters of each thread are
+// opened on its first hook and read in user space with rdpmc where the
+// kernel allows it, and each thread aggregates its regions in its own table,
+// so the hooks neither make system calls nor synchronize.  The tables are
+// merged at exit.
+//
+// The hooks of loop bodies run once per iteration unless the program is
+// compiled with -mllvm -tapir-loop-hoist-csi-task-hooks, which hoists them
+// out of the leaf chunks of iterations of divide-and-conquer Tapir loops.
+//
+// The report is a CSV file named by CILKSCALE_PERF_OUT (default: stdout).
+// Counters the machine does not support are left empty.  The iterations of a
+// loop row sum the trip counts of its executions that were known on entry.
+// A report of a run on one worker can be passed back to the compiler with
+// -mllvm -stripmine-profile=<file> to choose the grainsize of each loop.
+//===----------------------------------------------------------------------===//
+
+#include "csi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum counter_t {
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_LLC_MISSES,
+  COUNTER_STALLED_CYCLES,
+  NUM_COUNTERS
+};
+
+enum region_kind_t : uint64_t { REGION_LOOP, REGION_LOOP_BODY, REGION_TASK };
+
+const char *const region_kind_names[] = {"loop", "loop-body", "task"};
+
+// Regions are keyed by their kind and the CSI ID of the loop or detach.
+inline uint64_t region_key(region_kind_t kind, csi_id_t id) {
+  return (kind << 56) | ((uint64_t)id & ((1ULL << 56) - 1));
+}
+
+struct counts_t {
+  uint64_t v[NUM_COUNTERS] = {0};
+};
+
+struct region_perf_t {
+  uint64_t count = 0;
+  uint64_t iterations = 0;
+  counts_t counts;
+};
+
+typedef std::unordered_map<uint64_t, region_perf_t> region_table_t;
+
+// A hardware counter of the calling thread.
+class perf_counter_t {
+  int fd = -1;
+#if defined(__linux__)
+  perf_event_mmap_page *page = nullptr;
+#endif
+
+public:
+  bool open(uint32_t type, uint64_t config, int group_fd);
+  bool is_open() const { return fd >= 0; }
+  int get_fd() const { return fd; }
+  uint64_t read() const;
+};
+
+#if defined(__linux__)
+bool perf_counter_t::open(uint32_t type, uint64_t config, int group_fd) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd = (int)syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1,
+                    group_fd, /*flags=*/0);
+  if (fd < 0)
+    return false;
+  // The mapped page lets the counter be read with rdpmc.
+  void *p = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+  page = p == MAP_FAILED ? nullptr : (perf_event_mmap_page *)p;
+  return true;
+}
+
+uint64_t perf_counter_t::read() const {
+#if defined(__x86_64__)
+  if (page && page->cap_user_rdpmc) {
+    uint32_t seq, idx;
+    uint64_t count;
+    do {
+      seq = page->lock;
+      __asm__ __volatile__("" ::: "memory");
+      idx = page->index;
+      count = page->offset;
+      if (idx) {
+        uint32_t lo, hi;
+        __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+        int64_t pmc = ((uint64_t)hi << 32) | lo;
+        unsigned shift = 64 - page->pmc_width;
+        count += (pmc << shift) >> shift;
+      }
+      __asm__ __volatile__("" ::: "memory");
+    } while (page->lock != seq);
+    if (idx)
+      return count;
+  }
+#endif
+  uint64_t value = 0;
+  if (::read(fd, &value, sizeof(value)) != sizeof(value))
+    return 0;
+  return value;
+}
+#else
+bool perf_counter_t::open(uint32_t, uint64_t, int) { return false; }
+uint64_t perf_counter_t::read() const { return 0; }
+#endif
+
+// The per-thread state: the counters, the stack of open regions and the
+// table of the completed ones.
+struct worker_t {
+  perf_counter_t counters[NUM_COUNTERS];
+  std::vector<std::pair<uint64_t, counts_t>> open_regions;
+  region_table_t regions;
+
+  worker_t();
+
+  counts_t read() const {
+    counts_t c;
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+      if (counters[i].is_open())
+        c.v[i] = counters[i].read();
+    return c;
+  }
+
+  void begin(uint64_t key) { open_regions.emplace_back(key, read()); }
+  void end(uint64_t key);
+};
+
+struct perf_tool_t {
+  std::mutex mutex;
+  std::vector<worker_t *> workers;
+  bool available[NUM_COUNTERS] = {false};
+  FILE *out = stdout;
+};
+
+perf_tool_t *tool = nullptr;
+thread_local worker_t *this_worker = nullptr;
+
+worker_t::worker_t() {
+#if defined(__linux__)
+  // Count the events as a group, so they are scheduled together.
+  int leader = -1;
+  if (counters[COUNTER_CYCLES].open(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_CPU_CYCLES, -1))
+    leader = counters[COUNTER_CYCLES].get_fd();
+  counters[COUNTER_INSTRUCTIONS].open(PERF_TYPE_HARDWARE,
+                                      PERF_COUNT_HW_INSTRUCTIONS, leader);
+  counters[COUNTER_LLC_MISSES].open(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_CACHE_MISSES, leader);
+  if (!counters[COUNTER_STALLED_CYCLES].open(
+          PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, leader))
+    counters[COUNTER_STALLED_CYCLES].open(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, leader);
+#endif
+}
+
+void worker_t::end(uint64_t key) {
+  counts_t now = read();
+  // Regions left open by unwinding are closed with this one.
+  while (!open_regions.empty()) {
+    std::pair<uint64_t, counts_t> r = open_regions.back();
+    open_regions.pop_back();
+    region_perf_t &perf = regions[r.first];
+    ++perf.count;
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+      perf.counts.v[i] += now.v[i] - r.second.v[i];
+    if (r.first == key)
+      break;
+  }
+}
+
+inline worker_t *get_worker() {
+  if (!this_worker) {
+    this_worker = new worker_t;
+    std::lock_guard<std::mutex> lock(tool->mutex);
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+      tool->available[i] |= this_worker->counters[i].is_open();
+    tool->workers.push_back(this_worker);
+  }
+  return this_worker;
+}
+
+std::string csv_quote(const std::string &field) {
+  if (field.find_first_of(",\"\n") == std::string::npos)
+    return field;
+  std::string quoted = "\"";
+  for (char c : field) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string location(uint64_t key) {
+  region_kind_t kind = (region_kind_t)(key >> 56);
+  csi_id_t id = (csi_id_t)(key & ((1ULL << 56) - 1));
+  const source_loc_t *loc = kind == REGION_LOOP
+                                ? __csi_get_loop_source_loc(id)
+                                : __csi_get_detach_source_loc(id);
+  char buf[64];
+  if (!loc || !loc->filename) {
+    snprintf(buf, sizeof(buf), "#%lld", (long long)id);
+    return buf;
+  }
+  snprintf(buf, sizeof(buf), ":%d:%d", loc->line, loc->column);
+  std::string name = loc->filename;
+  name += buf;
+  if (loc->name) {
+    name += " (";
+    name += loc->name;
+    name += ")";
+  }
+  return name;
+}
+
+void write_counter(bool available, uint64_t value) {
+  if (available)
+    fprintf(tool->out, ",%llu", (unsigned long long)value);
+  else
+    fprintf(tool->out, ",");
+}
+
+void write_ratio(bool available, double num, double den, double scale) {
+  if (available && den > 0)
+    fprintf(tool->out, ",%g", num / den * scale);
+  else
+    fprintf(tool->out, ",");
+}
+
+void destroy() {
+  if (!tool)
+    return;
+  std::lock_guard<std::mutex> lock(tool->mutex);
+
+  region_table_t merged;
+  for (worker_t *w : tool->workers)
+    for (const auto &entry : w->regions) {
+      region_perf_t &perf = merged[entry.first];
+      perf.count += entry.second.count;
+      perf.iterations += entry.second.iterations;
+      for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+        perf.counts.v[i] += entry.second.counts.v[i];
+    }
+
+  std::vector<std::pair<uint64_t, region_perf_t>> rows(merged.begin(),
+                                                       merged.end());
+  std::sort(rows.begin(), rows.end(),
+            [](const std::pair<uint64_t, region_perf_t> &a,
+               const std::pair<uint64_t, region_perf_t> &b) {
+              return a.second.counts.v[COUNTER_CYCLES] >
+                     b.second.counts.v[COUNTER_CYCLES];
+            });
+
+  const bool *avail = tool->available;
+  fprintf(tool->out, "kind,location,count,iterations,cycles,instructions,"
+                     "llc_misses,stalled_cycles,ipc,llc_misses_per_kinst,"
+                     "stall_ratio\n");
+  for (const auto &row : rows) {
+    const uint64_t *v = row.second.counts.v;
+    fprintf(tool->out, "%s,%s,%llu", region_kind_names[row.first >> 56],
+            csv_quote(location(row.first)).c_str(),
+            (unsigned long long)row.second.count);
+    write_counter((row.first >> 56) == REGION_LOOP, row.second.iterations);
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+      write_counter(avail[i], v[i]);
+    write_ratio(avail[COUNTER_CYCLES] && avail[COUNTER_INSTRUCTIONS],
+                v[COUNTER_INSTRUCTIONS], v[COUNTER_CYCLES], 1.0);
+    write_ratio(avail[COUNTER_LLC_MISSES] && avail[COUNTER_INSTRUCTIONS],
+                v[COUNTER_LLC_MISSES], v[COUNTER_INSTRUCTIONS], 1000.0);
+    write_ratio(avail[COUNTER_STALLED_CYCLES] && avail[COUNTER_CYCLES],
+                v[COUNTER_STALLED_CYCLES], v[COUNTER_CYCLES], 1.0);
+    fprintf(tool->out, "\n");
+  }
+  if (!avail[COUNTER_CYCLES])
+    fprintf(stderr, "cilkscale-perf: hardware counters are unavailable "
+                    "(check /proc/sys/kernel/perf_event_paranoid).\n");
+
+  if (tool->out != stdout)
+    fclose(tool->out);
+  else
+    fflush(stdout);
+  // The tool is not deleted: workers may still run hooks.
+  tool->out = nullptr;
+}
+
+} // namespace
+
+CSIRT_API void __csi_init() {
+  tool = new perf_tool_t;
+  const char *out = getenv("CILKSCALE_PERF_OUT");
+  if (out && *out) {
+    tool->out = fopen(out, "w");
+    if (!tool->out) {
+      fprintf(stderr, "cilkscale-perf: cannot open '%s' for writing.\n", out);
+      tool->out = stdout;
+    }
+  }
+  atexit(destroy);
+}
+
+CSIRT_API void __csi_before_loop(const csi_id_t loop_id,
+                                 const int64_t trip_count,
+                                 const loop_prop_t prop) {
+  if (!tool || !prop.is_tapir_loop)
+    return;
+  worker_t *w = get_worker();
+  uint64_t key = region_key(REGION_LOOP, loop_id);
+  if (trip_count > 0)
+    w->regions[key].iterations += trip_count;
+  w->begin(key);
+}
+
+CSIRT_API void __csi_after_loop(const csi_id_t loop_id,
+                                const loop_prop_t prop) {
+  if (!tool || !prop.is_tapir_loop)
+    return;
+  get_worker()->end(region_key(REGION_LOOP, loop_id));
+}
+
+CSIRT_API void __csi_task(const csi_id_t task_id, const csi_id_t detach_id,
+                          const task_prop_t prop) {
+  if (!tool)
+    return;
+  get_worker()->begin(region_key(
+      prop.is_tapir_loop_body ? REGION_LOOP_BODY : REGION_TASK, detach_id));
+}
+
+CSIRT_API void __csi_task_exit(const csi_id_t task_exit_id,
+                               const csi_id_t task_id,
+                               const csi_id_t detach_id,
+                               const int32_t sync_reg,
+                               const task_exit_prop_t prop) {
+  if (!tool)
+    return;
+  get_worker()->end(region_key(
+      prop.is_tapir_loop_body ? REGION_LOOP_BODY : REGION_TASK, detach_id));
+}
@@ -0,0 +1,173 @@
+//===-- shadow_stack.h - Shadow stack for Cilkscale -------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale.
+//
+// The shadow stack mirrors the functions and tasks executing in the
+// instrumented program.  Each frame holds the work, span and burdened span
+// of its continuation, i.e., of everything the frame executed since it was
+// entered, with its completed children and its synced spawns.  The spawns of
+// a frame that are not yet synced are accounted for by its sync regions:
+// each sync region holds the work of its spawned children and the longest
+// path through one of them.
+//===----------------------------------------------------------------------===//
+#ifndef CILKSCALE_SHADOW_STACK_H
+#define CILKSCALE_SHADOW_STACK_H
+
+#include "cilkscale_timer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum frame_type_t : uint8_t { FRAME_FUNCTION, FRAME_TASK };
+
+struct sync_region_t {
+  // Work of the spawned children since the last sync.
+  cilk_time_t achild_work = 0;
+  // Longest (burdened) span through a spawned child since the last sync,
+  // measured from the entry of the frame.
+  cilk_time_t lchild_span = 0;
+  cilk_time_t lchild_bspan = 0;
+  // The continuation of the frame at the first spawn since the last sync,
+  // i.e., where the parallel region started.
+  cilk_time_t start_work = 0;
+  cilk_time_t start_span = 0;
+  cilk_time_t start_bspan = 0;
+  bool active = false;
+};
+
+struct shadow_stack_frame_t {
+  cilk_time_t contin_work = 0;
+  cilk_time_t contin_span = 0;
+  cilk_time_t contin_bspan = 0;
+  // The sync regions of the frame are regions[sync_base, sync_base + num).
+  uint32_t sync_base = 0;
+  uint32_t num_sync_reg = 0;
+  frame_type_t type = FRAME_FUNCTION;
+
+  void add(cilk_time_t t) {
+    contin_work += t;
+    contin_span += t;
+    contin_bspan += t;
+  }
+};
+
+/// The work, span and burdened span of a completed parallel region.
+struct region_cost_t {
+  cilk_time_t work;
+  cilk_time_t span;
+  cilk_time_t bspan;
+};
+
+class shadow_stack_t {
+  std::vector<shadow_stack_frame_t> frames;
+  std::vector<sync_region_t> regions;
+
+public:
+  shadow_stack_t() {
+    frames.reserve(256);
+    regions.reserve(256);
+  }
+
+  shadow_stack_frame_t &peek() { return frames.back(); }
+  const std::vector<shadow_stack_frame_t> &get_frames() const {
+    return frames;
+  }
+
+  void push(frame_type_t type, unsigned num_sync_reg) {
+    // Every frame gets a sync region for its implicit sync.
+    num_sync_reg = std::max(num_sync_reg, 1u);
+    shadow_stack_frame_t frame;
+    frame.type = type;
+    frame.sync_base = (uint32_t)regions.size();
+    frame.num_sync_reg = num_sync_reg;
+    frames.push_back(frame);
+    regions.resize(regions.size() + num_sync_reg);
+  }
+
+  /// Pop the top frame, after syncing its outstanding spawns.
+  shadow_stack_frame_t pop() {
+    shadow_stack_frame_t frame = frames.back();
+    for (unsigned reg = 0; reg < frame.num_sync_reg; ++reg) {
+      region_cost_t unused;
+      sync(frame, regions[frame.sync_base + reg], unused);
+    }
+    frames.pop_back();
+    regions.resize(frame.sync_base);
+    return frame;
+  }
+
+  const sync_region_t &region(const shadow_stack_frame_t &frame,
+                              int32_t sync_reg) const {
+    unsigned reg = std::min((unsigned)std::max(sync_reg, 0),
+                            frame.num_sync_reg - 1);
+    return regions[frame.sync_base + reg];
+  }
+  sync_region_t &region(const shadow_stack_frame_t &frame, int32_t sync_reg) {
+    return const_cast<sync_region_t &>(
+        static_cast<const shadow_stack_t *>(this)->region(frame, sync_reg));
+  }
+
+  /// Record a spawn in the given sync region of the top frame.
+  void spawn(int32_t sync_reg) {
+    shadow_stack_frame_t &frame = peek();
+    sync_region_t &r = region(frame, sync_reg);
+    if (!r.active) {
+      r.active = true;
+      r.start_work = frame.contin_work;
+      r.start_span = frame.contin_span;
+      r.start_bspan = frame.contin_bspan;
+    }
+  }
+
+  /// Join a completed spawned child into the given sync region of the top
+  /// frame.  The burdened span of the child includes the burden of its spawn.
+  void join_child(const shadow_stack_frame_t &child, int32_t sync_reg,
+                  cilk_time_t burden) {
+    shadow_stack_frame_t &frame = peek();
+    sync_region_t &r = region(frame, sync_reg);
+    r.achild_work += child.contin_work;
+    r.lchild_span =
+        std::max(r.lchild_span, frame.contin_span + child.contin_span);
+    r.lchild_bspan = std::max(r.lchild_bspan, frame.contin_bspan +
+                                                  child.contin_bspan + burden);
+  }
+
+  /// Join a completed called function into the top frame.
+  void join_callee(const shadow_stack_frame_t &callee) {
+    shadow_stack_frame_t &frame = peek();
+    frame.contin_work += callee.contin_work;
+    frame.contin_span += callee.contin_span;
+    frame.contin_bspan += callee.contin_bspan;
+  }
+
+  /// Sync the given region of the top frame.  Return false if the region
+  /// spawned nothing since the last sync, or else true and the cost of the
+  /// parallel region that ends at this sync.
+  bool sync(int32_t sync_reg, region_cost_t &cost) {
+    shadow_stack_frame_t &frame = peek();
+    return sync(frame, region(frame, sync_reg), cost);
+  }
+
+  static bool sync(shadow_stack_frame_t &frame, sync_region_t &r,
+                   region_cost_t &cost) {
+    if (!r.active)
+      return false;
+    frame.contin_work += r.achild_work;
+    frame.contin_span = std::max(frame.contin_span, r.lchild_span);
+    frame.contin_bspan = std::max(frame.contin_bspan, r.lchild_bspan);
+    cost.work = frame.contin_work - r.start_work;
+    cost.span = frame.contin_span - r.start_span;
+    cost.bspan = frame.contin_bspan - r.start_bspan;
+    r = sync_region_t();
+    return true;
+  }
+};
+
+#endif // CILKSCALE_SHADOW_STACK_H
@@ -3434,6 +3434,9 @@ struct StoreOpConversion : public FIROpConversion<fir::StoreOp> {
       newStoreOp.setTBAATags(*optionalTag);
     else
       attachTBAATag(newStoreOp, storeTy, storeTy, nullptr);
+    // Stores of DO CONCURRENT loops carry the loop's access group.
+    if (auto groups = store->getAttrOfType<mlir::ArrayAttr>("access_groups"))
+      newStoreOp.setAccessGroupsAttr(groups);
     rewriter.eraseOp(store);
     return mlir::success();
   }
@@ -18,6 +18,7 @@
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "llvm/ADT/SmallSet.h"
@@ -33,6 +34,39 @@ using namespace mlir;
 
 namespace {
 
+/// Name of the attribute listing the LLVM access groups of a fir.load or
+/// fir.store.  It is the name of the LLVM dialect attribute that the
+/// memory operations are given when they are converted to LLVM.
+static constexpr llvm::StringLiteral accessGroupsAttrName = "access_groups";
+
+/// Mark the iterations of an unordered `fir.do_loop` (a DO CONCURRENT) as
+/// independent: put the loop's loads and stores into a fresh access group
+/// and return a loop annotation that lists the group as parallel.  The
+/// annotation goes on the back edge and becomes `llvm.loop.parallel_accesses`
+/// metadata, which the vectorizer and the Tapir loop passes understand.
+static mlir::LLVM::LoopAnnotationAttr
+markUnorderedLoop(fir::DoLoopOp loop, mlir::PatternRewriter &rewriter) {
+  auto *ctx = rewriter.getContext();
+  auto group = mlir::LLVM::AccessGroupAttr::get(ctx);
+  loop.getRegion().walk([&](mlir::Operation *op) {
+    if (!mlir::isa<fir::LoadOp, fir::StoreOp>(op))
+      return;
+    llvm::SmallVector<mlir::Attribute> groups;
+    if (auto old = op->getAttrOfType<mlir::ArrayAttr>(accessGroupsAttrName))
+      groups.append(old.begin(), old.end());
+    groups.push_back(group);
+    rewriter.modifyOpInPlace(op, [&]() {
+      op->setAttr(accessGroupsAttrName, mlir::ArrayAttr::get(ctx, groups));
+    });
+  });
+  return mlir::LLVM::LoopAnnotationAttr::get(
+      ctx, /*disableNonforced=*/{}, /*vectorize=*/{}, /*interleave=*/{},
+      /*unroll=*/{}, /*unrollAndJam=*/{}, /*licm=*/{}, /*distribute=*/{},
+      /*pipeline=*/{}, /*peeled=*/{}, /*unswitch=*/{}, /*mustProgress=*/{},
+      /*isVectorized=*/{}, /*startLoc=*/{}, /*endLoc=*/{},
+      /*parallelAccesses=*/{group});
+}
+
 // Conversion of fir control ops to more primitive control-flow.
 //
 // FIR loops that cannot be converted to the affine dialect will remain as
@@ -52,6 +86,12 @@ public:
                   mlir::PatternRewriter &rewriter) const override {
     auto loc = loop.getLoc();
 
+    // DO CONCURRENT iterations may run in any order; keep that fact on the
+    // loop's back edge once the structure is gone.
+    mlir::LLVM::LoopAnnotationAttr annotation;
+    if (loop.getUnordered())
+      annotation = markUnorderedLoop(loop, rewriter);
+
     // Create the start and end blocks that will wrap the DoLoopOp with an
     // initalizer and an end point
     auto *initBlock = rewriter.getInsertionBlock();
@@ -118,7 +158,10 @@ public:
                                       : terminator->operand_begin();
     loopCarried.append(begin, terminator->operand_end());
     loopCarried.push_back(itersMinusOne);
-    rewriter.create<mlir::cf::BranchOp>(loc, conditionalBlock, loopCarried);
+    auto backEdge =
+        rewriter.create<mlir::cf::BranchOp>(loc, conditionalBlock, loopCarried);
+    if (annotation)
+      backEdge->setAttr("loop_annotation", annotation);
     rewriter.eraseOp(terminator);
 
     // Conditional block
@@ -310,6 +353,12 @@ public:
 /// Convert FIR structured control flow ops to CFG ops.
 class CfgConversion : public fir::impl::CFGConversionBase<CfgConversion> {
 public:
+  void getDependentDialects(mlir::DialectRegistry &registry) const override {
+    CFGConversionBase::getDependentDialects(registry);
+    // Unordered loops are annotated with LLVM loop metadata attributes.
+    registry.insert<mlir::LLVM::LLVMDialect>();
+  }
+
   void runOnOperation() override {
     auto *context = &getContext();
     mlir::RewritePatternSet patterns(context);
@@ -0,0 +1,209 @@
+
+#ifndef __KIT_BENCH_H__
+#define __KIT_BENCH_H__
+
+//
+// A small harness for the benchmarks.  Each benchmark times one or
+// more kernels by running them opts.total_reps() times -- a number of
+// (untimed) warmup repetitions followed by the timed repetitions --
+// recording each time with result::record(), and then calls report()
+// to print a summary and (optionally) write it as JSON:
+//
+//    bench::result res("vecadd", bytes, flops);
+//    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+//      timer t;
+//      forall (...) { ... }
+//      res.record(opts, rep, t);
+//    }
+//    bench::report(opts, "vecadd_forall", {res});
+//
+// The harness options are given on the command line and removed from
+// argv before the benchmark parses its own arguments:
+//
+//    --warmup=N : the number of untimed repetitions (default: 1).
+//    --reps=N   : the number of timed repetitions (default: 5).
+//    --json=F   : write the results as JSON to file F.
+//
+// The bytes and flops given to a result are the minimum memory traffic
+// (each array read or written once) and the floating point operations
+// of a single repetition; they are used to compute the achieved GB/s
+// and GFLOP/s from the median time.
+//
+// The timer (kitsune_timer.h) waits for the device work of the kernel
+// on the GPU targets, so the recorded time includes it.  The time the
+// device spent on that work is also recorded and reported as the
+// "device" median when there was any.
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "timer.h"
+
+namespace kitsune
+{
+  namespace bench {
+
+    struct options {
+      unsigned warmup = 1;
+      unsigned reps = 5;
+      const char *json = nullptr;
+
+      unsigned total_reps() const { return warmup + reps; }
+    };
+
+    struct result {
+      std::string name;
+      double bytes = 0.0;
+      double flops = 0.0;
+      std::vector<double> seconds;        // sorted.
+      std::vector<double> device_seconds; // sorted.
+
+      result(const char *kernel, double kernel_bytes, double kernel_flops)
+        : name(kernel), bytes(kernel_bytes), flops(kernel_flops) {}
+
+      /// Record the time of the given repetition (warmups are ignored).
+      void record(const options &opts, unsigned rep, double secs) {
+        if (rep < opts.warmup)
+          return;
+        seconds.insert(std::upper_bound(seconds.begin(), seconds.end(), secs),
+                       secs);
+      }
+
+      /// Record the wall and device times of a timer that timed the
+      /// given repetition.
+      void record(const options &opts, unsigned rep, timer &t) {
+        record(opts, rep, t.seconds());
+        if (rep < opts.warmup || t.device_ops() == 0)
+          return;
+        double secs = t.device_seconds();
+        device_seconds.insert(std::upper_bound(device_seconds.begin(),
+                                               device_seconds.end(), secs),
+                              secs);
+      }
+
+      double percentile(double p) const {
+        if (seconds.empty())
+          return 0.0;
+        // Linear interpolation between the closest ranks.
+        double rank = p / 100.0 * (seconds.size() - 1);
+        size_t lo = (size_t)rank;
+        size_t hi = std::min(lo + 1, seconds.size() - 1);
+        return seconds[lo] + (rank - lo) * (seconds[hi] - seconds[lo]);
+      }
+
+      double median() const { return percentile(50.0); }
+
+      double device_median() const {
+        if (device_seconds.empty())
+          return 0.0;
+        size_t mid = device_seconds.size() / 2;
+        return device_seconds.size() % 2
+                   ? device_seconds[mid]
+                   : 0.5 * (device_seconds[mid - 1] + device_seconds[mid]);
+      }
+
+      double mean() const {
+        double sum = 0.0;
+        for(double s : seconds)
+          sum += s;
+        return seconds.empty() ? 0.0 : sum / seconds.size();
+      }
+
+      double stddev() const {
+        double m = mean(), sum = 0.0;
+        for(double s : seconds)
+          sum += (s - m) * (s - m);
+        return seconds.size() < 2 ? 0.0 : sqrt(sum / (seconds.size() - 1));
+      }
+
+      double gbytes_per_sec() const {
+        return median() > 0.0 ? bytes / median() / 1.0e9 : 0.0;
+      }
+
+      double gflops_per_sec() const {
+        return median() > 0.0 ? flops / median() / 1.0e9 : 0.0;
+      }
+    };
+
+    /// Parse (and remove) the harness options from the command line.
+    inline options parse_args(int &argc, char *argv[]) {
+      options opts;
+      int nargs = 1;
+      for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--warmup=", 9) == 0)
+          opts.warmup = atoi(arg + 9);
+        else if (strncmp(arg, "--reps=", 7) == 0)
+          opts.reps = atoi(arg + 7);
+        else if (strncmp(arg, "--json=", 7) == 0)
+          opts.json = arg + 7;
+        else
+          argv[nargs++] = argv[i];
+      }
+      argc = nargs;
+      argv[argc] = nullptr;
+      if (opts.reps == 0)
+        opts.reps = 1;
+      return opts;
+    }
+
+    /// Print a summary of the results and write them as JSON when
+    /// requested.  The median time of the first result is also printed
+    /// as "Time: <seconds>" for the older run scripts.
+    inline void report(const options &opts, const char *benchmark,
+                       const std::vector<result> &results) {
+      for(const result &res : results) {
+        if (res.seconds.empty())
+          continue;
+        fprintf(stderr, "  %-12s median: %9.6lf s  [p10: %9.6lf, p90: %9.6lf, "
+                "min: %9.6lf, max: %9.6lf]  %8.2lf GB/s  %8.2lf GFLOP/s\n",
+                res.name.c_str(), res.median(), res.percentile(10.0),
+                res.percentile(90.0), res.seconds.front(), res.seconds.back(),
+                res.gbytes_per_sec(), res.gflops_per_sec());
+        if (not res.device_seconds.empty())
+          fprintf(stderr, "  %-12s device: %9.6lf s\n", "",
+                  res.device_median());
+      }
+      if (not results.empty() && not results.front().seconds.empty())
+        fprintf(stdout, "Time: %lf\n", results.front().median());
+
+      if (opts.json == nullptr)
+        return;
+      FILE *fp = fopen(opts.json, "w");
+      if (fp == nullptr) {
+        fprintf(stderr, "bench: unable to open '%s' for writing.\n",
+                opts.json);
+        exit(1);
+      }
+      fprintf(fp, "{\n  \"benchmark\": \"%s\",\n  \"warmup\": %u,\n"
+              "  \"reps\": %u,\n  \"kernels\": [", benchmark, opts.warmup,
+              opts.reps);
+      for(size_t i = 0; i < results.size(); ++i) {
+        const result &res = results[i];
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"bytes\": %.0lf, "
+                "\"flops\": %.0lf,\n     \"min\": %.9lf, \"median\": %.9lf, "
+                "\"mean\": %.9lf, \"max\": %.9lf, \"stddev\": %.9lf,\n"
+                "     \"p10\": %.9lf, \"p90\": %.9lf, \"gbytes_per_sec\": %.4lf, "
+                "\"gflops_per_sec\": %.4lf,\n     \"device_median\": %.9lf, "
+                "\"seconds\": [",
+                i > 0 ? "," : "", res.name.c_str(), res.bytes, res.flops,
+                res.seconds.front(), res.median(), res.mean(),
+                res.seconds.back(), res.stddev(), res.percentile(10.0),
+                res.percentile(90.0), res.gbytes_per_sec(),
+                res.gflops_per_sec(), res.device_median());
+        for(size_t j = 0; j < res.seconds.size(); ++j)
+          fprintf(fp, "%s%.9lf", j > 0 ? ", " : "", res.seconds[j]);
+        fprintf(fp, "]}");
+      }
+      fprintf(fp, "\n  ]\n}\n");
+      fclose(fp);
+    }
+  }
+}
+
+#endif
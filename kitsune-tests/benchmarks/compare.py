@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Compare two sets of benchmark results (see run_benchmarks.py) -- e.g.,
+# from two compiler builds -- and flag regressions.  Kernels are matched
+# by benchmark, Tapir target and kernel name and compared by their
+# median times.  A kernel is a regression when its median time grew by
+# more than the threshold and its fastest time is also slower than the
+# baseline's median (i.e., the change is not within the noise).
+#
+# Exits with a non-zero status if any regressions are found.
+#
+import argparse
+import json
+import sys
+
+
+def load(path):
+  with open(path) as f:
+    results = json.load(f)
+  kernels = {}
+  for bench in results["benchmarks"]:
+    for kernel in bench["kernels"]:
+      key = (bench["benchmark"], bench.get("target", ""), kernel["name"])
+      kernels[key] = kernel
+  return results, kernels
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description="Compare two sets of Kitsune benchmark results.")
+  parser.add_argument("baseline", help="the baseline results (JSON)")
+  parser.add_argument("current", help="the results to compare (JSON)")
+  parser.add_argument("--threshold", type=float, default=5.0,
+                      help="percent slowdown of the median that is a "
+                           "regression (default: 5)")
+  args = parser.parse_args()
+
+  base_results, base = load(args.baseline)
+  cur_results, cur = load(args.current)
+  print("baseline: %s (%s)" % (base_results.get("compiler", "?"),
+                               base_results.get("date", "?")))
+  print("current : %s (%s)\n" % (cur_results.get("compiler", "?"),
+                                 cur_results.get("date", "?")))
+
+  limit = 1.0 + args.threshold / 100.0
+  regressions = 0
+  print("%-24s %-10s %-12s %12s %12s %8s" %
+        ("benchmark", "target", "kernel", "baseline (s)", "current (s)",
+         "change"))
+  for key in sorted(set(base) | set(cur)):
+    name = "%-24s %-10s %-12s" % key
+    if key not in base or key not in cur:
+      print("%s %s" % (name, "(baseline only)" if key in base
+                       else "(new)"))
+      continue
+    b, c = base[key], cur[key]
+    ratio = c["median"] / b["median"] if b["median"] > 0 else 1.0
+    status = ""
+    if ratio > limit and c["min"] > b["median"]:
+      status = "  REGRESSION"
+      regressions += 1
+    elif ratio < 1.0 / limit and c["median"] < b["min"]:
+      status = "  improved"
+    print("%s %12.6f %12.6f %+7.1f%%%s" %
+          (name, b["median"], c["median"], (ratio - 1.0) * 100.0, status))
+
+  print("\n%d regression(s) beyond %.1f%%." % (regressions, args.threshold))
+  return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
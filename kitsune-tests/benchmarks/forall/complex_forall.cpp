@@ -16,7 +16,7 @@
 #include <cstdlib>
 #include <kitsune.h>
 
-#include "timer.h"
+#include "bench.h"
 
 using namespace std;
 using namespace kitsune;
@@ -37,6 +37,7 @@ void random_fill(my_complex *data, size_t N) {
 
 int main (int argc, char* argv[]) {
 
+  bench::options opts = bench::parse_args(argc, argv);
   fprintf(stderr, "**** kitsune+tapir kokkos example: complex\n");
 
   my_complex *A = new my_complex[VEC_SIZE];
@@ -46,8 +47,9 @@ int main (int argc, char* argv[]) {
   random_fill(A, VEC_SIZE);
   random_fill(B, VEC_SIZE);
   
-  double loop_secs = 0;
-  for (int ii = 0; ii<4; ii++) {
+  bench::result res("complex", 3.0 * VEC_SIZE * sizeof(my_complex),
+                     6.0 * VEC_SIZE);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
       timer t;
       { 
         forall (int i = 0; i<VEC_SIZE; i++) {
@@ -55,14 +57,13 @@ int main (int argc, char* argv[]) {
           C[i].img  = (A[i].real * B[i].img) - (A[i].img * B[i].real);
         }
       }
-      loop_secs += t.seconds();
+      res.record(opts, rep, t);
   }
-  loop_secs /= 4;
   
   fprintf(stderr, "(%s) %lf, %lf, %lf, %lf\n", 
           argv[0], C[0].real, C[0].img,
 	        C[VEC_SIZE/4].real, C[VEC_SIZE/4].img);
-  fprintf(stdout, "Time: %lf\n", loop_secs);
+  bench::report(opts, "complex_forall", {res});
 
   delete []A;
   delete []B;
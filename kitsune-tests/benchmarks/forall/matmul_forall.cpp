@@ -14,7 +14,7 @@
 #include <cstdlib>
 #include <kitsune.h>
 
-#include "timer.h"
+#include "bench.h"
 
 using namespace std;
 using namespace kitsune;
@@ -35,6 +35,7 @@ void zero_fill(float *data, size_t N) {
 
 int main (int argc, char* argv[]) {
 
+  bench::options opts = bench::parse_args(argc, argv);
   fprintf(stderr, "**** kitsune+tapir kokkos example: matrix multiply\n");
 
   float *A = new float[N*K];
@@ -45,8 +46,9 @@ int main (int argc, char* argv[]) {
   random_fill(B, M*K);
   zero_fill(C, N*M);
   
-  double loop_secs = 0;
-  for (int ii = 0; ii<4; ii++) {
+  bench::result res("matmul", (N*K + K*M + 2.0*N*M) * sizeof(float),
+                     2.0 * N * M * K);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
       timer t;  
       {
         forall (int i = 0; i<N; i++) {
@@ -57,13 +59,30 @@ int main (int argc, char* argv[]) {
           }
         }
       }
-      loop_secs += t.seconds();
+      res.record(opts, rep, t);
+  }
+
+  // The same product computed as one dot product per element of C, with
+  // B transposed (M x K).  Built with -ffast-math the compiler runs this
+  // form with cuBLAS when it is available.
+  bench::result dot_res("matmul_dot", (N*K + K*M + N*M) * sizeof(float),
+                         2.0 * N * M * K);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      forall (size_t ij = 0; ij < N*M; ij++) {
+        size_t i = ij / M;
+        size_t j = ij % M;
+        float sum = 0.0f;
+        for (size_t k = 0; k < K; k++)
+          sum += A[i*K + k] * B[j*K + k];
+        C[ij] = sum;
+      }
+      dot_res.record(opts, rep, t);
   }
-  loop_secs /= 4;
 
   fprintf(stderr, "(%s) %lf, %lf, %lf, %lf\n", 
          argv[0], C[0], C[(N*M)/4], C[(N*M)/2], C[(N*M)-1]);     
-  fprintf(stdout, "Time: %lf\n", loop_secs);
+  bench::report(opts, "matmul_forall", {res, dot_res});
 
   delete []A;
   delete []B;
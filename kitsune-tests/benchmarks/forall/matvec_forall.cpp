@@ -14,7 +14,7 @@
 #include <cstdlib>
 #include <kitsune.h>
 
-#include "timer.h"
+#include "bench.h"
 
 using namespace std;
 using namespace kitsune;
@@ -33,6 +33,7 @@ void zero_fill(float *data, size_t N) {
 
 int main (int argc, char* argv[]) {
 
+  bench::options opts = bench::parse_args(argc, argv);
   fprintf(stderr, "**** kitsune+tapir kokkos example: matrix-vector multiply\n");
 
   float *matrix = new float[N*N];
@@ -43,8 +44,9 @@ int main (int argc, char* argv[]) {
   random_fill(vector, N);
   zero_fill(result, N*N);
   
-  double loop_secs = 0;
-  for (int ii = 0; ii<4; ii++) {
+  bench::result res("matvec", (3.0*N*N + N) * sizeof(float),
+                     2.0 * N * N);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
       timer t;  
       {
         forall (int i = 0; i<N; i++) {
@@ -53,13 +55,12 @@ int main (int argc, char* argv[]) {
           }
         }
       }
-      loop_secs += t.seconds();
+      res.record(opts, rep, t);
   }
-  loop_secs /= 4;
 
   fprintf(stderr, "(%s) %lf, %lf, %lf, %lf\n", 
          argv[0], result[0], result[(N*N)/4], result[(N*N)/2], result[(N*N)-1]);     
-  fprintf(stdout, "Time: %lf\n", loop_secs);
+  bench::report(opts, "matvec_forall", {res});
 
   delete []matrix;
   delete []vector;
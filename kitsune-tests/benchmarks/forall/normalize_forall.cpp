@@ -15,7 +15,7 @@
 #include <cstdlib>
 #include <kitsune.h>
 
-#include "timer.h"
+#include "bench.h"
 
 using namespace std;
 using namespace kitsune;
@@ -36,6 +36,7 @@ __attribute__((const, noinline)) double norm(const double *in, size_t N) {
 
 int main (int argc, char* argv[]) {
 
+  bench::options opts = bench::parse_args(argc, argv);
   fprintf(stderr, "**** kitsune+tapir kokkos example: normalize (tapir paper)\n");
 
   double *in = new double[VEC_SIZE];
@@ -43,21 +44,21 @@ int main (int argc, char* argv[]) {
 
   random_fill(in, VEC_SIZE);
   
-  double loop_secs = 0;
-  for (int ii = 0; ii<4; ii++) {
+  bench::result res("normalize", 2.0 * VEC_SIZE * sizeof(double),
+                     VEC_SIZE * (2.0 * VEC_SIZE + 1));
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
       timer t;  
       {
         forall (int i = 0; i<VEC_SIZE; i++) {
           out[i] = in[i] / norm(in, VEC_SIZE);
         }
       }
-      loop_secs += t.seconds();
+      res.record(opts, rep, t);
   }
-  loop_secs /= 4;
 
   fprintf(stderr, "(%s) %lf, %lf, %lf, %lf\n", 
           argv[0], out[0], out[VEC_SIZE/4], out[VEC_SIZE/2], out[VEC_SIZE-1]); 
-  fprintf(stdout, "Time: %lf\n", loop_secs);
+  bench::report(opts, "normalize_forall", {res});
 
   delete []in;
   delete []out;
@@ -0,0 +1,79 @@
+//
+// Reduction benchmark for the reproducible reductions
+// (kitsune_reduce.h): the sum of an array of doubles with
+// reproducible_sum, compared with a forall that sums with
+// kitsune_reduce_add and with a serial loop.  The reproducible sum
+// should run at about the speed of the forall and give the same bits
+// in every repetition.
+//
+// Usage: reduce_forall [--warmup=N] [--reps=N] [--json=F] [num-values]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <kitsune.h>
+#include <kitsune_reduce.h>
+
+#include "bench.h"
+
+using namespace std;
+using namespace kitsune;
+
+int main(int argc, char *argv[]) {
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t n = 1 << 28;
+  if (argc > 1)
+    n = atol(argv[1]);
+  fprintf(stderr, "**** kitsune reduction benchmark: %zu values\n", n);
+
+  double *values = alloc<double>(n);
+  // Values of mixed magnitudes, so that the order of the additions
+  // shows in the sum.
+  forall(size_t i = 0; i < n; ++i)
+    values[i] = (double)((i * 2654435761u) % 1000003) * 1.0e-7 +
+                (i % 17 == 0 ? 1.0e6 : 0.0);
+
+  double bytes = n * sizeof(double);
+  bench::result repro_res("repro_sum", bytes, n);
+  bench::result atomic_res("forall_sum", bytes, n);
+  bench::result serial_res("serial_sum", bytes, n);
+
+  double repro = 0.0;
+  bool reproducible = true;
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    timer t;
+    double sum = reproducible_sum(values, n);
+    repro_res.record(opts, rep, t);
+    if (rep == 0)
+      repro = sum;
+    reproducible = reproducible && memcmp(&sum, &repro, sizeof(sum)) == 0;
+  }
+
+  double *sum = alloc<double>(1);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    *sum = 0.0;
+    timer t;
+    forall(size_t i = 0; i < n; ++i)
+      kitsune_reduce_add(*sum, values[i]);
+    atomic_res.record(opts, rep, t);
+  }
+
+  double serial = 0.0;
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    timer t;
+    serial = 0.0;
+    for (size_t i = 0; i < n; ++i)
+      serial += values[i];
+    serial_res.record(opts, rep, t);
+  }
+
+  fprintf(stderr, "  reproducible: %.17g, forall: %.17g, serial: %.17g\n",
+          repro, *sum, serial);
+  fprintf(stderr, "(%s) %s\n", argv[0],
+          reproducible ? "reproducible" : "NOT REPRODUCIBLE");
+  bench::report(opts, "reduce_forall", {repro_res, atomic_res, serial_res});
+
+  dealloc(sum);
+  dealloc(values);
+  return reproducible ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+//
+// Search benchmark for the early-exit searches (kitsune_search.h):
+// find_first and any_of of a key that is placed early, in the middle
+// and nowhere in an array of random 32-bit values, compared with a
+// full-scan forall that reduces to the first match.  The searches
+// should take time in proportion to the position of the key, the scan
+// the same time for all of them.
+//
+// Usage: search_forall [--warmup=N] [--reps=N] [--json=F] [num-values]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <kitsune.h>
+#include <kitsune_search.h>
+
+#include "bench.h"
+
+using namespace std;
+using namespace kitsune;
+
+// Values are random below KEY, so KEY is only found where it is placed.
+const unsigned KEY = 0xffffffffu;
+
+int main(int argc, char *argv[]) {
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t n = 1 << 28;
+  if (argc > 1)
+    n = atol(argv[1]);
+  fprintf(stderr, "**** kitsune search benchmark: %zu values\n", n);
+
+  unsigned *values = alloc<unsigned>(n);
+  srand(1);
+  for (size_t i = 0; i < n; ++i)
+    values[i] = (((unsigned)rand() << 16) ^ (unsigned)rand()) % KEY;
+
+  const size_t positions[] = {n / 100, n / 2, n};
+  const char *names[] = {"early", "middle", "none"};
+  vector<bench::result> results;
+  bool found = true;
+
+  for (unsigned p = 0; p < 3; p++) {
+    size_t pos = positions[p];
+    if (pos < n)
+      values[pos] = KEY;
+    // The bytes are those of the values up to the key (or all of them).
+    double bytes = (pos < n ? pos + 1 : n) * sizeof(unsigned);
+    bench::result first_res((string("find_first_") + names[p]).c_str(),
+                            bytes, 0.0);
+    bench::result any_res((string("any_of_") + names[p]).c_str(), bytes,
+                          0.0);
+    bench::result scan_res((string("full_scan_") + names[p]).c_str(),
+                           n * sizeof(unsigned), 0.0);
+
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      size_t at = find_first(n, [=](size_t i) { return values[i] == KEY; });
+      first_res.record(opts, rep, t);
+      found = found && at == pos;
+    }
+
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      bool any = kitsune::any_of(n, [=](size_t i) { return values[i] == KEY; });
+      any_res.record(opts, rep, t);
+      found = found && any == (pos < n);
+    }
+
+    size_t *first = alloc<size_t>(1);
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      *first = n;
+      timer t;
+      forall(size_t i = 0; i < n; ++i) {
+        if (values[i] == KEY)
+          kitsune_reduce_min(*first, i);
+      }
+      scan_res.record(opts, rep, t);
+      found = found && *first == pos;
+    }
+    dealloc(first);
+
+    if (pos < n)
+      values[pos] = 0;
+    results.push_back(first_res);
+    results.push_back(any_res);
+    results.push_back(scan_res);
+  }
+
+  fprintf(stderr, "(%s) %s\n", argv[0], found ? "found" : "NOT FOUND");
+  bench::report(opts, "search_forall", results);
+
+  dealloc(values);
+  return found ? 0 : 1;
+}
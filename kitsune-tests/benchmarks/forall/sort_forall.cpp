@@ -0,0 +1,112 @@
+//
+// Sorting benchmark for the Kitsune sorts (kitsune_sort.h): sort,
+// sort_by_key and segmented_sort of random 32-bit keys, and std::sort
+// (with the parallel execution policy when the C++ library provides it)
+// of the same keys on the host for comparison.  See sort/sort_gpu.cpp
+// for the CUB (and hipCUB) radix sort.  The keys are restored, untimed,
+// before each repetition.
+//
+// Usage: sort_forall [--warmup=N] [--reps=N] [--json=F] [num-keys]
+//
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <kitsune.h>
+#include <kitsune_sort.h>
+#if __has_include(<execution>)
+#include <execution>
+#endif
+
+#include "bench.h"
+
+using namespace std;
+using namespace kitsune;
+
+// The segments of the segmented sort have 1 to 2 * AVG_SEGMENT - 1 keys.
+const size_t AVG_SEGMENT = 32;
+
+void restore(unsigned *keys, unsigned *values, const unsigned *input,
+             size_t n) {
+  forall(size_t i = 0; i < n; ++i) {
+    keys[i] = input[i];
+    values[i] = i;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t n = 1 << 24;
+  if (argc > 1)
+    n = atol(argv[1]);
+  fprintf(stderr, "**** kitsune sort benchmark: %zu keys\n", n);
+
+  unsigned *input = alloc<unsigned>(n);
+  unsigned *keys = alloc<unsigned>(n);
+  unsigned *values = alloc<unsigned>(n);
+  size_t *offsets = alloc<size_t>(n + 1);
+  srand(1);
+  for (size_t i = 0; i < n; ++i)
+    input[i] = ((unsigned)rand() << 16) ^ (unsigned)rand();
+  size_t num_segments = 0;
+  offsets[0] = 0;
+  while (offsets[num_segments] < n) {
+    size_t len = 1 + rand() % (2 * AVG_SEGMENT - 1);
+    offsets[num_segments + 1] = min(n, offsets[num_segments] + len);
+    num_segments++;
+  }
+
+  double key_bytes = 2.0 * n * sizeof(unsigned);
+  bench::result sort_res("sort", key_bytes, 0.0);
+  bench::result by_key_res("sort_by_key", 2.0 * key_bytes, 0.0);
+  bench::result seg_res("segmented_sort", key_bytes, 0.0);
+  bench::result std_res("std_sort", key_bytes, 0.0);
+  bool sorted = true;
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(keys, values, input, n);
+    timer t;
+    kitsune::sort(keys, n);
+    sort_res.record(opts, rep, t);
+    sorted = sorted && is_sorted(keys, keys + n);
+  }
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(keys, values, input, n);
+    timer t;
+    kitsune::sort_by_key(keys, values, n);
+    by_key_res.record(opts, rep, t);
+    sorted = sorted && is_sorted(keys, keys + n) &&
+             keys[n / 2] == input[values[n / 2]];
+  }
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(keys, values, input, n);
+    timer t;
+    kitsune::segmented_sort(keys, offsets, num_segments);
+    seg_res.record(opts, rep, t);
+    for (size_t s = 0; s < num_segments; s += num_segments / 16 + 1)
+      sorted = sorted && is_sorted(keys + offsets[s], keys + offsets[s + 1]);
+  }
+
+  unsigned *host_keys = new unsigned[n];
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    copy(input, input + n, host_keys);
+    timer t;
+#if defined(__cpp_lib_execution)
+    std::sort(std::execution::par, host_keys, host_keys + n);
+#else
+    std::sort(host_keys, host_keys + n);
+#endif
+    std_res.record(opts, rep, t);
+  }
+
+  fprintf(stderr, "(%s) %s\n", argv[0], sorted ? "sorted" : "NOT SORTED");
+  bench::report(opts, "sort_forall", {sort_res, by_key_res, seg_res, std_res});
+
+  delete[] host_keys;
+  dealloc(input);
+  dealloc(keys);
+  dealloc(values);
+  dealloc(offsets);
+  return sorted ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+//
+// Stencil benchmark for kitsune::stencil_3d (kitsune_stencil.h): the
+// hotspot3D time step (kitsune/experiments/hotspot3D) run for a number of
+// steps with one forall sweep per step, and with stencil_3d, which
+// computes several steps per pass over the grid on the CPU targets.  The
+// temperatures are restored, untimed, before each repetition, and the
+// results of the two are compared.
+//
+// Usage: stencil_forall [--warmup=N] [--reps=N] [--json=F]
+//                       [nx [ny [nz [steps]]]]
+//
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <kitsune.h>
+#include <kitsune_stencil.h>
+
+#include "bench.h"
+
+using namespace std;
+using namespace kitsune;
+
+// The hotspot3D coefficients (of a 0.016 m square chip, 0.0005 m thick).
+struct coefficients {
+  float cc, cw, ce, cn, cs, cb, ct, sdc, amb;
+};
+
+coefficients make_coefficients(size_t nx, size_t ny, size_t nz) {
+  const float t_chip = 0.0005f, chip_height = 0.016f, chip_width = 0.016f;
+  float dx = chip_height / nx, dy = chip_width / ny, dz = t_chip / nz;
+  float cap = 0.5f * 1.75e6f * t_chip * dx * dy;
+  float rx = dy / (2.0f * 100 * t_chip * dx);
+  float ry = dx / (2.0f * 100 * t_chip * dy);
+  float rz = dz / (100 * dx * dy);
+  float max_slope = 3.0e6f / (0.5f * t_chip * 1.75e6f);
+  float dt = 0.001f / max_slope;
+  coefficients k;
+  k.sdc = dt / cap;
+  k.ce = k.cw = k.sdc / rx;
+  k.cn = k.cs = k.sdc / ry;
+  k.ct = k.cb = k.sdc / rz;
+  k.cc = 1.0f - (2.0f * k.ce + 2.0f * k.cn + 3.0f * k.ct);
+  k.amb = 80.0f;
+  return k;
+}
+
+void restore(float *temp, const float *input, size_t n) {
+  forall(size_t i = 0; i < n; ++i)
+    temp[i] = input[i];
+}
+
+int main(int argc, char *argv[]) {
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t nx = 512, ny = 512, nz = 8;
+  unsigned steps = 100;
+  if (argc > 1)
+    nx = ny = atol(argv[1]);
+  if (argc > 2)
+    ny = atol(argv[2]);
+  if (argc > 3)
+    nz = atol(argv[3]);
+  if (argc > 4)
+    steps = atoi(argv[4]);
+  size_t n = nx * ny * nz;
+  fprintf(stderr, "**** kitsune stencil benchmark: %zux%zux%zu, %u steps\n",
+          nx, ny, nz, steps);
+
+  float *power = alloc<float>(n);
+  float *input = alloc<float>(n);
+  float *a = alloc<float>(n);
+  float *b = alloc<float>(n);
+  float *sweep_result = alloc<float>(n);
+  srand(1);
+  for (size_t i = 0; i < n; ++i) {
+    power[i] = (float)rand() / RAND_MAX * 0.001f;
+    input[i] = 320.0f + (float)rand() / RAND_MAX * 20.0f;
+  }
+  const coefficients k = make_coefficients(nx, ny, nz);
+
+  // Each step reads the temperatures and the power and writes the
+  // temperatures.
+  double bytes = 3.0 * n * sizeof(float) * steps;
+  double flops = 15.0 * n * steps;
+  bench::result sweep_res("sweep", bytes, flops);
+  bench::result stencil_res("stencil_3d", bytes, flops);
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(a, input, n);
+    timer t;
+    float *in = a, *out = b;
+    for (unsigned s = 0; s < steps; ++s) {
+      forall(size_t c = 0; c < n; ++c) {
+        size_t x = c % nx, y = c / nx % ny, z = c / (nx * ny);
+        size_t w = x > 0 ? c - 1 : c, e = x < nx - 1 ? c + 1 : c;
+        size_t no = y > 0 ? c - nx : c, so = y < ny - 1 ? c + nx : c;
+        size_t bo = z > 0 ? c - nx * ny : c, to = z < nz - 1 ? c + nx * ny : c;
+        out[c] = k.cc * in[c] + k.cw * in[w] + k.ce * in[e] + k.cs * in[so] +
+                 k.cn * in[no] + k.cb * in[bo] + k.ct * in[to] +
+                 k.sdc * power[c] + k.ct * k.amb;
+      }
+      float *tmp = in;
+      in = out;
+      out = tmp;
+    }
+    sweep_res.record(opts, rep, t);
+    if (rep + 1 == opts.total_reps())
+      forall(size_t i = 0; i < n; ++i)
+        sweep_result[i] = in[i];
+  }
+
+  float *result = a;
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(a, input, n);
+    timer t;
+    result = stencil_3d(a, b, nx, ny, nz, steps,
+                        [=](const stencil_point<float> &p) {
+                          float c = p(0, 0, 0);
+                          float w = p.x > 0 ? p(-1, 0, 0) : c;
+                          float e = p.x < nx - 1 ? p(1, 0, 0) : c;
+                          float no = p.y > 0 ? p(0, -1, 0) : c;
+                          float so = p.y < ny - 1 ? p(0, 1, 0) : c;
+                          float bo = p.z > 0 ? p(0, 0, -1) : c;
+                          float to = p.z < nz - 1 ? p(0, 0, 1) : c;
+                          return k.cc * c + k.cw * w + k.ce * e + k.cs * so +
+                                 k.cn * no + k.cb * bo + k.ct * to +
+                                 k.sdc * power[p.index] + k.ct * k.amb;
+                        });
+    stencil_res.record(opts, rep, t);
+  }
+
+  double err = 0.0;
+  for (size_t i = 0; i < n; ++i)
+    err = fmax(err, fabs(result[i] - sweep_result[i]));
+  bool matched = err < 1e-3;
+  fprintf(stderr, "(%s) max difference %g: %s\n", argv[0], err,
+          matched ? "matched" : "DID NOT MATCH");
+  bench::report(opts, "stencil_forall", {sweep_res, stencil_res});
+
+  dealloc(power);
+  dealloc(input);
+  dealloc(a);
+  dealloc(b);
+  dealloc(sweep_result);
+  return matched ? 0 : 1;
+}
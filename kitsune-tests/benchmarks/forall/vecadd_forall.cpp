@@ -14,7 +14,7 @@
 #include <cstdlib>
 #include <kitsune.h>
 
-#include "timer.h"
+#include "bench.h"
 
 using namespace std;
 using namespace kitsune;
@@ -28,6 +28,7 @@ void random_fill(float *data, size_t N) {
 
 int main (int argc, char* argv[]) {
 
+  bench::options opts = bench::parse_args(argc, argv);
   fprintf(stderr, "kitsune+tapir kokkos example: element-wise vector addition\n");
   
   float *A = new float[VEC_SIZE];
@@ -37,24 +38,24 @@ int main (int argc, char* argv[]) {
   random_fill(A, VEC_SIZE);
   random_fill(B, VEC_SIZE);
   
-  double loop_secs = 0;
-  for (int ii = 0; ii<4; ii++) {
+  bench::result res("vecadd", 3.0 * VEC_SIZE * sizeof(float),
+                     VEC_SIZE);
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
       timer t;  
       {
         forall (int i = 0; i<VEC_SIZE; i++) {
           C[i] = A[i] + B[i];
         }
       }
-      loop_secs += t.seconds();
+      res.record(opts, rep, t);
   }
-  loop_secs /= 4;
 
   // Note: If we don't use the outputs there are cases where tapir+kitsune 
   // will simply remove the entire parallel loop above... 
   fprintf(stderr, "(%s) %lf, %lf, %lf, %lf\n", 
           argv[0], C[0], C[VEC_SIZE/4], C[VEC_SIZE/2], C[VEC_SIZE-1]);   
   
-  fprintf(stdout, "Time: %lf\n", loop_secs);
+  bench::report(opts, "vecadd_forall", {res});
 
   delete []A;
   delete []B;
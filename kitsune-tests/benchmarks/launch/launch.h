@@ -0,0 +1,75 @@
+
+#ifndef __KIT_LAUNCH_H__
+#define __KIT_LAUNCH_H__
+
+//
+// Common parameters of the launch overhead microbenchmarks.  Both the
+// forall version (launch_forall.cpp) and the hand-written CUDA/HIP
+// version (launch_gpu.cpp) run the same two sweeps:
+//
+//    * trips:N -- a copy kernel (two arguments) over N elements for N
+//      in 1, 10, ..., the maximum trip count (default: 1e9).
+//    * args:K  -- a kernel over a single element with K pointer
+//      arguments for K in 1, 2, 4, ..., 32.  With K > 1 the first
+//      argument is written with the sum of the others.
+//
+// Each time recorded is the average of a batch of back-to-back
+// (synchronous) launches so the fixed cost of short launches is above
+// the resolution of the timer.  The median of "trips:1" is reported as
+// the fixed per-launch overhead.
+//
+// Usage: <benchmark> [--warmup=N] [--reps=N] [--json=F] [max-trip-count]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../bench.h"
+
+namespace kitsune
+{
+  namespace launch {
+
+    const size_t DEFAULT_MAX_TRIPS = 1000000000;
+    const unsigned MAX_ARGS = 32;
+    const unsigned ARG_COUNTS[] = {1, 2, 4, 8, 16, 32};
+
+    inline size_t max_trips(int argc, char *argv[]) {
+      size_t max = (argc > 1) ? (size_t)atof(argv[1]) : DEFAULT_MAX_TRIPS;
+      return max > 0 ? max : 1;
+    }
+
+    inline std::vector<size_t> trip_counts(size_t max) {
+      std::vector<size_t> counts;
+      for(size_t n = 1; n <= max; n *= 10)
+        counts.push_back(n);
+      return counts;
+    }
+
+    /// The number of launches timed together for the given trip count.
+    inline unsigned batch(size_t trips) {
+      return trips <= 10000 ? 100 : (trips <= 1000000 ? 10 : 1);
+    }
+
+    inline std::string trips_name(size_t trips) {
+      return "trips:" + std::to_string(trips);
+    }
+
+    inline std::string args_name(unsigned args) {
+      return "args:" + std::to_string(args);
+    }
+
+    /// Print the fixed per-launch overhead (in microseconds) of each
+    /// sweep point of the argument sweep and the trips:1 launch.
+    inline void summary(const std::vector<bench::result> &results) {
+      fprintf(stderr, "\n  fixed per-launch overhead (median):\n");
+      for(const bench::result &res : results) {
+        if (res.name == "trips:1" || res.name.compare(0, 5, "args:") == 0)
+          fprintf(stderr, "    %-10s %10.2lf us\n", res.name.c_str(),
+                  res.median() * 1.0e6);
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,148 @@
+//
+// Launch overhead microbenchmark for forall.  Measures the fixed cost
+// of a forall -- e.g., on the GPU targets the runtime's context check,
+// module/kernel lookups, launch parameters, prefetch calls and the
+// launch itself -- over sweeps of the trip count and the number of
+// kernel arguments.  See launch.h for the details of the sweeps and
+// launch_gpu.cpp for the hand-written CUDA/HIP equivalent.
+//
+// Usage: launch_forall [--warmup=N] [--reps=N] [--json=F] [max-trip-count]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <kitsune.h>
+
+#include "launch.h"
+
+using namespace std;
+using namespace kitsune;
+
+__attribute__((noinline)) void copy_kernel(float *dst, const float *src,
+                                          size_t n) {
+  forall(size_t i = 0; i < n; i++)
+    dst[i] = src[i];
+}
+
+// The argument sweep kernels.  The pointers are loaded ahead of the
+// loop so each one is a separate kernel argument.
+__attribute__((noinline)) void args_1(float **p, size_t n) {
+  float *a0 = p[0];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = i;
+}
+
+__attribute__((noinline)) void args_2(float **p, size_t n) {
+  float *a0 = p[0], *a1 = p[1];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = a1[i];
+}
+
+__attribute__((noinline)) void args_4(float **p, size_t n) {
+  float *a0 = p[0], *a1 = p[1], *a2 = p[2], *a3 = p[3];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = a1[i] + a2[i] + a3[i];
+}
+
+__attribute__((noinline)) void args_8(float **p, size_t n) {
+  float *a0 = p[0], *a1 = p[1], *a2 = p[2], *a3 = p[3], *a4 = p[4],
+        *a5 = p[5], *a6 = p[6], *a7 = p[7];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = a1[i] + a2[i] + a3[i] + a4[i] + a5[i] + a6[i] + a7[i];
+}
+
+__attribute__((noinline)) void args_16(float **p, size_t n) {
+  float *a0 = p[0], *a1 = p[1], *a2 = p[2], *a3 = p[3], *a4 = p[4],
+        *a5 = p[5], *a6 = p[6], *a7 = p[7], *a8 = p[8], *a9 = p[9],
+        *a10 = p[10], *a11 = p[11], *a12 = p[12], *a13 = p[13],
+        *a14 = p[14], *a15 = p[15];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = a1[i] + a2[i] + a3[i] + a4[i] + a5[i] + a6[i] + a7[i] + a8[i] +
+            a9[i] + a10[i] + a11[i] + a12[i] + a13[i] + a14[i] + a15[i];
+}
+
+__attribute__((noinline)) void args_32(float **p, size_t n) {
+  float *a0 = p[0], *a1 = p[1], *a2 = p[2], *a3 = p[3], *a4 = p[4],
+        *a5 = p[5], *a6 = p[6], *a7 = p[7], *a8 = p[8], *a9 = p[9],
+        *a10 = p[10], *a11 = p[11], *a12 = p[12], *a13 = p[13],
+        *a14 = p[14], *a15 = p[15], *a16 = p[16], *a17 = p[17],
+        *a18 = p[18], *a19 = p[19], *a20 = p[20], *a21 = p[21],
+        *a22 = p[22], *a23 = p[23], *a24 = p[24], *a25 = p[25],
+        *a26 = p[26], *a27 = p[27], *a28 = p[28], *a29 = p[29],
+        *a30 = p[30], *a31 = p[31];
+  forall(size_t i = 0; i < n; i++)
+    a0[i] = a1[i] + a2[i] + a3[i] + a4[i] + a5[i] + a6[i] + a7[i] + a8[i] +
+            a9[i] + a10[i] + a11[i] + a12[i] + a13[i] + a14[i] + a15[i] +
+            a16[i] + a17[i] + a18[i] + a19[i] + a20[i] + a21[i] + a22[i] +
+            a23[i] + a24[i] + a25[i] + a26[i] + a27[i] + a28[i] + a29[i] +
+            a30[i] + a31[i];
+}
+
+void run_args(float **p, unsigned num_args) {
+  switch(num_args) {
+  case 1: args_1(p, 1); break;
+  case 2: args_2(p, 1); break;
+  case 4: args_4(p, 1); break;
+  case 8: args_8(p, 1); break;
+  case 16: args_16(p, 1); break;
+  case 32: args_32(p, 1); break;
+  default:
+    fprintf(stderr, "launch_forall: unexpected argument count %u!\n",
+            num_args);
+    exit(1);
+  }
+}
+
+int main (int argc, char* argv[]) {
+
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t max_trips = launch::max_trips(argc, argv);
+  fprintf(stderr, "**** kitsune+tapir launch overhead (forall): "
+          "max trip count %ld\n", max_trips);
+
+  float *src = alloc<float>(max_trips);
+  float *dst = alloc<float>(max_trips);
+  for(size_t i = 0; i < max_trips; ++i)
+    src[i] = i;
+
+  vector<bench::result> results;
+  for(size_t trips : launch::trip_counts(max_trips)) {
+    unsigned batch = launch::batch(trips);
+    results.emplace_back(launch::trips_name(trips).c_str(),
+                         2.0 * trips * sizeof(float), 0.0);
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      for(unsigned b = 0; b < batch; b++)
+        copy_kernel(dst, src, trips);
+      results.back().record(opts, rep, t.seconds() / batch);
+    }
+  }
+
+  float *args[launch::MAX_ARGS];
+  for(unsigned j = 0; j < launch::MAX_ARGS; ++j) {
+    args[j] = alloc<float>(1);
+    args[j][0] = j;
+  }
+  for(unsigned num_args : launch::ARG_COUNTS) {
+    unsigned batch = launch::batch(1);
+    results.emplace_back(launch::args_name(num_args).c_str(),
+                         num_args * sizeof(float), num_args - 1.0);
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      for(unsigned b = 0; b < batch; b++)
+        run_args(args, num_args);
+      results.back().record(opts, rep, t.seconds() / batch);
+    }
+  }
+
+  fprintf(stderr, "(%s) %lf, %lf, %lf\n", argv[0], dst[0],
+          dst[max_trips - 1], args[0][0]);
+  bench::report(opts, "launch_forall", results);
+  launch::summary(results);
+
+  for(unsigned j = 0; j < launch::MAX_ARGS; ++j)
+    dealloc(args[j]);
+  dealloc(src);
+  dealloc(dst);
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+//
+// Hand-written CUDA/HIP version of the launch overhead microbenchmark
+// (see launch_forall.cpp and launch.h).  Like copy-hip.cpp and
+// vecadd-hip.cpp in kitsune/experiments it uses managed memory and
+// launches with 256 threads per block, but only the launch and the
+// synchronization are timed (the data is made resident on the device
+// by the warmup launches).  The same source is compiled as CUDA
+// (-x cuda) or HIP (-x hip).
+//
+// Usage: launch_gpu [--warmup=N] [--reps=N] [--json=F] [max-trip-count]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+#if defined(__HIP__)
+#include <hip/hip_runtime.h>
+#define gpuError_t hipError_t
+#define gpuSuccess hipSuccess
+#define gpuGetErrorString hipGetErrorString
+#define gpuMallocManaged hipMallocManaged
+#define gpuFree hipFree
+#define gpuDeviceSynchronize hipDeviceSynchronize
+#define GPU_TARGET "hip"
+#else
+#include <cuda_runtime.h>
+#define gpuError_t cudaError_t
+#define gpuSuccess cudaSuccess
+#define gpuGetErrorString cudaGetErrorString
+#define gpuMallocManaged cudaMallocManaged
+#define gpuFree cudaFree
+#define gpuDeviceSynchronize cudaDeviceSynchronize
+#define GPU_TARGET "cuda"
+#endif
+
+#include "launch.h"
+
+#define GPUCHECK(error)                                         \
+  {                                                             \
+    gpuError_t err = (error);                                   \
+    if (err != gpuSuccess) {                                    \
+      fprintf(stderr, "error: '%s' (%d) at %s:%d\n",            \
+              gpuGetErrorString(err), err, __FILE__, __LINE__); \
+      exit(1);                                                  \
+    }                                                           \
+  }
+
+using namespace std;
+using namespace kitsune;
+
+const unsigned THREADS_PER_BLOCK = 256;
+
+__global__ void CopyKernel(float *dst, const float *src, size_t n) {
+  size_t i = (size_t)blockDim.x * blockIdx.x + threadIdx.x;
+  if (i < n)
+    dst[i] = src[i];
+}
+
+// The argument sweep kernel: each input is a separate kernel argument.
+template <typename... Inputs>
+__global__ void ArgsKernel(size_t n, float *out, Inputs... in) {
+  size_t i = (size_t)blockDim.x * blockIdx.x + threadIdx.x;
+  if (i < n) {
+    if constexpr (sizeof...(in) == 0)
+      out[i] = i;
+    else
+      out[i] = (... + in[i]);
+  }
+}
+
+template <size_t... I>
+void launch_args(float **p, size_t n, std::index_sequence<I...>) {
+  unsigned blocks = (n + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
+  ArgsKernel<<<blocks, THREADS_PER_BLOCK>>>(n, p[0], p[I + 1]...);
+  GPUCHECK(gpuDeviceSynchronize());
+}
+
+void run_copy(float *dst, const float *src, size_t n) {
+  unsigned blocks = (n + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
+  CopyKernel<<<blocks, THREADS_PER_BLOCK>>>(dst, src, n);
+  GPUCHECK(gpuDeviceSynchronize());
+}
+
+void run_args(float **p, unsigned num_args) {
+  switch(num_args) {
+  case 1: launch_args(p, 1, std::make_index_sequence<0>()); break;
+  case 2: launch_args(p, 1, std::make_index_sequence<1>()); break;
+  case 4: launch_args(p, 1, std::make_index_sequence<3>()); break;
+  case 8: launch_args(p, 1, std::make_index_sequence<7>()); break;
+  case 16: launch_args(p, 1, std::make_index_sequence<15>()); break;
+  case 32: launch_args(p, 1, std::make_index_sequence<31>()); break;
+  default:
+    fprintf(stderr, "launch_gpu: unexpected argument count %u!\n",
+            num_args);
+    exit(1);
+  }
+}
+
+int main (int argc, char* argv[]) {
+
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t max_trips = launch::max_trips(argc, argv);
+  fprintf(stderr, "**** launch overhead (hand-written %s): "
+          "max trip count %ld\n", GPU_TARGET, max_trips);
+
+  float *src, *dst;
+  GPUCHECK(gpuMallocManaged(&src, max_trips * sizeof(float)));
+  GPUCHECK(gpuMallocManaged(&dst, max_trips * sizeof(float)));
+  for(size_t i = 0; i < max_trips; ++i)
+    src[i] = i;
+
+  vector<bench::result> results;
+  for(size_t trips : launch::trip_counts(max_trips)) {
+    unsigned batch = launch::batch(trips);
+    results.emplace_back(launch::trips_name(trips).c_str(),
+                         2.0 * trips * sizeof(float), 0.0);
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      for(unsigned b = 0; b < batch; b++)
+        run_copy(dst, src, trips);
+      results.back().record(opts, rep, t.seconds() / batch);
+    }
+  }
+
+  float *args[launch::MAX_ARGS];
+  for(unsigned j = 0; j < launch::MAX_ARGS; ++j) {
+    GPUCHECK(gpuMallocManaged(&args[j], sizeof(float)));
+    args[j][0] = j;
+  }
+  for(unsigned num_args : launch::ARG_COUNTS) {
+    unsigned batch = launch::batch(1);
+    results.emplace_back(launch::args_name(num_args).c_str(),
+                         num_args * sizeof(float), num_args - 1.0);
+    for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+      timer t;
+      for(unsigned b = 0; b < batch; b++)
+        run_args(args, num_args);
+      results.back().record(opts, rep, t.seconds() / batch);
+    }
+  }
+
+  fprintf(stderr, "(%s) %lf, %lf, %lf\n", argv[0], dst[0],
+          dst[max_trips - 1], args[0][0]);
+  bench::report(opts, "launch_gpu", results);
+  launch::summary(results);
+
+  for(unsigned j = 0; j < launch::MAX_ARGS; ++j)
+    GPUCHECK(gpuFree(args[j]));
+  GPUCHECK(gpuFree(src));
+  GPUCHECK(gpuFree(dst));
+
+  return 0;
+}
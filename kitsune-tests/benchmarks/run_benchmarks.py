@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Run the Kitsune benchmarks and collect their results into a single
+# JSON file.  Benchmarks built with the harness (bench.h) time their own
+# kernels and write JSON (via --json); applications (e.g., those from
+# kitsune/experiments) are run once per repetition and report their
+# compute time on a line of the form "*** <seconds>, ...".
+#
+# Executables are named <benchmark>.<tapir-target>.  See compare.py to
+# compare the results of two (compiler) builds.
+#
+import argparse
+import json
+import math
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+from datetime import datetime
+
+APP_TIME = re.compile(r"^\*\*\*\s*([0-9.eE+-]+)", re.MULTILINE)
+
+
+def split_name(exe):
+  name = os.path.basename(exe)
+  benchmark, _, target = name.rpartition(".")
+  return (benchmark, target) if benchmark else (name, "")
+
+
+def percentile(seconds, p):
+  rank = p / 100.0 * (len(seconds) - 1)
+  lo = int(rank)
+  hi = min(lo + 1, len(seconds) - 1)
+  return seconds[lo] + (rank - lo) * (seconds[hi] - seconds[lo])
+
+
+def summarize(name, seconds):
+  # Matches the statistics reported by bench.h.
+  seconds = sorted(seconds)
+  mean = sum(seconds) / len(seconds)
+  var = 0.0
+  if len(seconds) > 1:
+    var = sum((s - mean) ** 2 for s in seconds) / (len(seconds) - 1)
+  return {"name": name, "bytes": 0, "flops": 0,
+          "min": seconds[0], "median": percentile(seconds, 50.0),
+          "mean": mean, "max": seconds[-1], "stddev": math.sqrt(var),
+          "p10": percentile(seconds, 10.0), "p90": percentile(seconds, 90.0),
+          "gbytes_per_sec": 0.0, "gflops_per_sec": 0.0, "seconds": seconds}
+
+
+def run_benchmark(exe, args):
+  with tempfile.NamedTemporaryFile(suffix=".json") as tmp:
+    cmd = [exe, "--warmup=%d" % args.warmup, "--reps=%d" % args.reps,
+           "--json=" + tmp.name]
+    proc = subprocess.run(cmd, capture_output=True, text=True)
+    if proc.returncode != 0:
+      raise RuntimeError("exited with status %d:\n%s" %
+                         (proc.returncode, proc.stderr))
+    with open(tmp.name) as f:
+      return json.load(f)
+
+
+def app_arguments(benchmark, args):
+  if benchmark.startswith("euler3d"):
+    if not args.euler3d_input:
+      return None
+    return [args.euler3d_input]
+  return []
+
+
+def run_app(exe, args):
+  benchmark, _ = split_name(exe)
+  app_args = app_arguments(benchmark, args)
+  if app_args is None:
+    return None
+  seconds = []
+  for rep in range(args.warmup + args.reps):
+    proc = subprocess.run([exe] + app_args, capture_output=True, text=True)
+    if proc.returncode != 0:
+      raise RuntimeError("exited with status %d:\n%s" %
+                         (proc.returncode, proc.stderr))
+    match = APP_TIME.search(proc.stdout)
+    if not match:
+      raise RuntimeError("no '*** <seconds>' line in the output")
+    if rep >= args.warmup:
+      seconds.append(float(match.group(1)))
+  return {"benchmark": benchmark, "warmup": args.warmup, "reps": args.reps,
+          "kernels": [summarize("total", seconds)]}
+
+
+def compiler_version(compiler):
+  if not compiler:
+    return ""
+  try:
+    proc = subprocess.run([compiler, "--version"], capture_output=True,
+                          text=True)
+    return proc.stdout.splitlines()[0] if proc.stdout else ""
+  except OSError:
+    return ""
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Run the Kitsune benchmarks.")
+  parser.add_argument("--benchmark", action="append", default=[],
+                      help="a benchmark built with the harness")
+  parser.add_argument("--app", action="append", default=[],
+                      help="an application reporting '*** <seconds>'")
+  parser.add_argument("--warmup", type=int, default=1)
+  parser.add_argument("--reps", type=int, default=5)
+  parser.add_argument("--output", default="benchmark-results.json")
+  parser.add_argument("--compiler", default="",
+                      help="the compiler used to build the benchmarks")
+  parser.add_argument("--euler3d-input", default="",
+                      help="the input mesh for euler3d")
+  args = parser.parse_args()
+
+  results = {"date": datetime.now().isoformat(timespec="seconds"),
+             "host": platform.node(), "arch": platform.machine(),
+             "compiler": compiler_version(args.compiler),
+             "warmup": args.warmup, "reps": args.reps, "benchmarks": []}
+  failed = 0
+  for kind, exes in (("benchmark", args.benchmark), ("app", args.app)):
+    for exe in exes:
+      print("  %-36s " % os.path.basename(exe), end="", flush=True)
+      try:
+        result = run_benchmark(exe, args) if kind == "benchmark" \
+                 else run_app(exe, args)
+      except (OSError, RuntimeError, ValueError) as err:
+        print("FAILED")
+        print(err, file=sys.stderr)
+        failed += 1
+        continue
+      if result is None:
+        print("skipped")
+        continue
+      result["benchmark"], result["target"] = split_name(exe)
+      result["executable"] = os.path.basename(exe)
+      results["benchmarks"].append(result)
+      print("  ".join("%s: %.6f s" % (k["name"], k["median"])
+                      for k in result["kernels"]))
+
+  with open(args.output, "w") as f:
+    json.dump(results, f, indent=2)
+  print("results written to '%s'." % args.output)
+  return 1 if failed else 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,100 @@
+//
+// Contention microbenchmark for the Kitsune runtime's allocation map.
+// A set of host threads concurrently register and unregister their
+// own allocations while issuing a stream of (interior pointer) lookups
+// against a shared set of allocations.  This mimics multiple host
+// workers allocating and launching kernels at the same time.
+//
+// The benchmark calls the runtime directly and does not require a GPU:
+//
+//    clang++ -O2 -I<kitsune>/runtime alloc_map_contention.cpp
+//        -L<install>/lib/clang/<version>/lib -lkitrt -lpthread
+//
+// Usage: alloc_map_contention [threads] [iterations]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "memory_map.h"
+
+#include "../timer.h"
+
+using namespace std;
+using namespace kitsune;
+
+const size_t NUM_SHARED_ALLOCS = 1024;
+const size_t ALLOC_SIZE = 1024 * 1024;
+const unsigned LOOKUPS_PER_UPDATE = 16;
+
+void worker(vector<char *> &shared_allocs, size_t iterations,
+            unsigned seed, size_t *hits) {
+  size_t local_hits = 0;
+  for(size_t i = 0; i < iterations; ++i) {
+    char *p = (char *)malloc(ALLOC_SIZE);
+    __kitrt_register_mem_alloc(p, ALLOC_SIZE);
+    for(unsigned j = 0; j < LOOKUPS_PER_UPDATE; ++j) {
+      seed = seed * 1103515245 + 12345;
+      char *base = shared_allocs[seed % NUM_SHARED_ALLOCS];
+      size_t size = 0;
+      __kitrt_is_mem_prefetched(base + (seed % ALLOC_SIZE), &size);
+      local_hits += (size == ALLOC_SIZE);
+    }
+    __kitrt_mark_mem_prefetched(p + ALLOC_SIZE / 2);
+    __kitrt_unregister_mem_alloc(p);
+    free(p);
+  }
+  *hits = local_hits;
+}
+
+int main (int argc, char* argv[]) {
+  unsigned num_threads = (argc > 1) ? atoi(argv[1]) :
+    thread::hardware_concurrency();
+  size_t iterations = (argc > 2) ? atol(argv[2]) : 100000;
+  if (num_threads == 0)
+    num_threads = 1;
+
+  fprintf(stderr, "kitsune runtime: allocation map contention benchmark\n");
+  fprintf(stderr, "  threads: %u, iterations per thread: %zu\n",
+          num_threads, iterations);
+
+  vector<char *> shared_allocs(NUM_SHARED_ALLOCS);
+  for(size_t i = 0; i < NUM_SHARED_ALLOCS; ++i) {
+    shared_allocs[i] = (char *)malloc(ALLOC_SIZE);
+    __kitrt_register_mem_alloc(shared_allocs[i], ALLOC_SIZE);
+  }
+
+  vector<size_t> hits(num_threads, 0);
+  vector<thread> threads;
+  timer t;
+  for(unsigned i = 0; i < num_threads; ++i)
+    threads.emplace_back(worker, ref(shared_allocs), iterations, i + 1,
+                         &hits[i]);
+  for(auto &th : threads)
+    th.join();
+  double secs = t.seconds();
+
+  size_t total_hits = 0, total_lookups = 0;
+  for(unsigned i = 0; i < num_threads; ++i) {
+    total_hits += hits[i];
+    total_lookups += iterations * LOOKUPS_PER_UPDATE;
+  }
+
+  for(size_t i = 0; i < NUM_SHARED_ALLOCS; ++i) {
+    __kitrt_unregister_mem_alloc(shared_allocs[i]);
+    free(shared_allocs[i]);
+  }
+
+  // Every lookup targets a live shared allocation so a miss indicates
+  // a broken map.
+  if (total_hits != total_lookups) {
+    fprintf(stderr, "error: %zu of %zu lookups failed!\n",
+            total_lookups - total_hits, total_lookups);
+    return 1;
+  }
+
+  fprintf(stdout, "Time: %lf\n", secs);
+  fprintf(stdout, "Operations/sec: %lf\n",
+          (num_threads * iterations * (LOOKUPS_PER_UPDATE + 3)) / secs);
+  return 0;
+}
@@ -0,0 +1,132 @@
+//
+// CUB (CUDA) / hipCUB (HIP) version of the sorting benchmark (see
+// forall/sort_forall.cpp): DeviceRadixSort::SortKeys and SortPairs of
+// the same random 32-bit keys in managed memory.  Like sort_forall the
+// keys are restored, untimed, before each repetition, and the time
+// includes the temporary storage allocation CUB asks for.  The same
+// source is compiled as CUDA (-x cuda) or HIP (-x hip).
+//
+// Usage: sort_gpu [--warmup=N] [--reps=N] [--json=F] [num-keys]
+//
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__HIP__)
+#include <hip/hip_runtime.h>
+#include <hipcub/hipcub.hpp>
+namespace gpucub = hipcub;
+#define gpuError_t hipError_t
+#define gpuSuccess hipSuccess
+#define gpuGetErrorString hipGetErrorString
+#define gpuMalloc hipMalloc
+#define gpuMallocManaged hipMallocManaged
+#define gpuFree hipFree
+#define gpuDeviceSynchronize hipDeviceSynchronize
+#else
+#include <cuda_runtime.h>
+#include <cub/cub.cuh>
+namespace gpucub = cub;
+#define gpuError_t cudaError_t
+#define gpuSuccess cudaSuccess
+#define gpuGetErrorString cudaGetErrorString
+#define gpuMalloc cudaMalloc
+#define gpuMallocManaged cudaMallocManaged
+#define gpuFree cudaFree
+#define gpuDeviceSynchronize cudaDeviceSynchronize
+#endif
+
+#include "bench.h"
+
+#define GPUCHECK(error)                                         \
+  {                                                             \
+    gpuError_t err = (error);                                   \
+    if (err != gpuSuccess) {                                    \
+      fprintf(stderr, "error: '%s' (%d) at %s:%d\n",            \
+              gpuGetErrorString(err), err, __FILE__, __LINE__); \
+      exit(1);                                                  \
+    }                                                           \
+  }
+
+using namespace std;
+using namespace kitsune;
+
+__global__ void RestoreKernel(unsigned *keys, unsigned *values,
+                              const unsigned *input, size_t n) {
+  size_t i = (size_t)blockDim.x * blockIdx.x + threadIdx.x;
+  if (i < n) {
+    keys[i] = input[i];
+    values[i] = i;
+  }
+}
+
+void restore(unsigned *keys, unsigned *values, const unsigned *input,
+             size_t n) {
+  RestoreKernel<<<(n + 255) / 256, 256>>>(keys, values, input, n);
+  GPUCHECK(gpuDeviceSynchronize());
+}
+
+int main(int argc, char *argv[]) {
+  bench::options opts = bench::parse_args(argc, argv);
+  size_t n = 1 << 24;
+  if (argc > 1)
+    n = atol(argv[1]);
+  fprintf(stderr, "**** cub sort benchmark: %zu keys\n", n);
+
+  unsigned *input, *keys, *values, *keys_out, *values_out;
+  GPUCHECK(gpuMallocManaged(&input, n * sizeof(unsigned)));
+  GPUCHECK(gpuMallocManaged(&keys, n * sizeof(unsigned)));
+  GPUCHECK(gpuMallocManaged(&values, n * sizeof(unsigned)));
+  GPUCHECK(gpuMallocManaged(&keys_out, n * sizeof(unsigned)));
+  GPUCHECK(gpuMallocManaged(&values_out, n * sizeof(unsigned)));
+  srand(1);
+  for (size_t i = 0; i < n; ++i)
+    input[i] = ((unsigned)rand() << 16) ^ (unsigned)rand();
+
+  double key_bytes = 2.0 * n * sizeof(unsigned);
+  bench::result sort_res("sort", key_bytes, 0.0);
+  bench::result by_key_res("sort_by_key", 2.0 * key_bytes, 0.0);
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(keys, values, input, n);
+    timer t;
+    void *tmp = nullptr;
+    size_t tmp_bytes = 0;
+    GPUCHECK(gpucub::DeviceRadixSort::SortKeys(tmp, tmp_bytes, keys, keys_out,
+                                               (int)n));
+    GPUCHECK(gpuMalloc(&tmp, tmp_bytes));
+    GPUCHECK(gpucub::DeviceRadixSort::SortKeys(tmp, tmp_bytes, keys, keys_out,
+                                               (int)n));
+    GPUCHECK(gpuDeviceSynchronize());
+    GPUCHECK(gpuFree(tmp));
+    sort_res.record(opts, rep, t.seconds());
+  }
+  bool sorted = is_sorted(keys_out, keys_out + n);
+
+  for (unsigned rep = 0; rep < opts.total_reps(); rep++) {
+    restore(keys, values, input, n);
+    timer t;
+    void *tmp = nullptr;
+    size_t tmp_bytes = 0;
+    GPUCHECK(gpucub::DeviceRadixSort::SortPairs(tmp, tmp_bytes, keys, keys_out,
+                                                values, values_out, (int)n));
+    GPUCHECK(gpuMalloc(&tmp, tmp_bytes));
+    GPUCHECK(gpucub::DeviceRadixSort::SortPairs(tmp, tmp_bytes, keys, keys_out,
+                                                values, values_out, (int)n));
+    GPUCHECK(gpuDeviceSynchronize());
+    GPUCHECK(gpuFree(tmp));
+    by_key_res.record(opts, rep, t.seconds());
+  }
+  sorted = sorted && is_sorted(keys_out, keys_out + n) &&
+           keys_out[n / 2] == input[values_out[n / 2]];
+
+  fprintf(stderr, "(%s) %s\n", argv[0], sorted ? "sorted" : "NOT SORTED");
+  bench::report(opts, "sort_gpu", {sort_res, by_key_res});
+
+  GPUCHECK(gpuFree(input));
+  GPUCHECK(gpuFree(keys));
+  GPUCHECK(gpuFree(values));
+  GPUCHECK(gpuFree(keys_out));
+  GPUCHECK(gpuFree(values_out));
+  return sorted ? 0 : 1;
+}
@@ -7,11 +7,11 @@ using namespace std;
 
 const size_t ROW_SIZE = 1024 * 1024 * 400;
 const size_t COL_SIZE = 8;
-const 
 
-// FIXME: If allowed to inline this generates bad code that
-// will fail within the runtime's assertion checks... 
-__attribute__ ((noinline))
+// Each (host) worker that runs an iteration of the outer forall
+// launches on, and waits for, its own stream so the kernels of
+// different rows run concurrently.  This holds whether or not the
+// call is inlined into the outer loop.
 void do_row_work(float *data_ptr, int col_id) {
   [[tapir::target("cuda")]]
   forall(size_t i = 0; i < ROW_SIZE; i++) {
@@ -39,7 +39,7 @@ int main (int argc, char* argv[]) {
   forall(unsigned ci = 0; ci < COL_SIZE; ci++) {
     // launch a kernel to do the work on each row.  
     do_row_work(data[ci], ci);
-    // there is a stream but not a device synchrnoize here...
+    // the inner forall's sync waits on this iteration's stream only.
   }
   auto end_time = chrono::steady_clock::now();
   auto elapsed_time = chrono::duration<double>(end_time-start_time).count();  
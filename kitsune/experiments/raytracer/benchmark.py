@@ -1,3 +1,5 @@
+import os
+import re
 import subprocess
 import platform
 import csv
@@ -30,11 +32,19 @@ for sc in (2**p for p in range(2, 6)):
 img_width = 2560
 img_height = 2048
 
-executables = ["raytracer-forall.cuda."+march,
-               "raytrace-kokkos.clang."+march,
-               "raytrace-kokkos.nvcc."+march,
-               "raytrace-openmp.clang."+march,
-               "raytrace-forall.cuda."+march]
+# The forall versions (one ray and a packet of rays per iteration) are
+# compared against the hand-written CUDA version (raytracer.cu).
+# Executables that have not been built are skipped.
+executables = ["raytracer-forall.opencilk."+march,
+               "raytracer-packet-forall.opencilk."+march,
+               "raytracer-forall.cuda."+march,
+               "raytracer-packet-forall.cuda."+march,
+               "raytracer-cuda."+march,
+               "raytracer-kokkos.nvcc."+march]
+executables = [exe for exe in executables if os.path.exists(exe)]
+
+# Each version reports its time on a line of the form "*** <seconds>, ...".
+time_pattern = re.compile(r"^\*\*\* ([0-9.eE+-]+)", re.MULTILINE)
 
 csv_filename = str("raytracer-benchmark-") + march + "-" + date_str + ".csv";
 
@@ -56,7 +66,7 @@ with open(csv_filename, 'w', newline='') as csvfile:
       print("    ", end="", flush=True)
       for rc in range(NUM_RUNS):
         result = subprocess.run([arg0,str(s),str(img_width),str(img_height)],  capture_output=True, text=True)
-        kernel_runtime = kernel_runtime + float(result.stdout)
+        kernel_runtime = kernel_runtime + float(time_pattern.search(result.stdout).group(1))
         print('#', end='', flush=True)
       print("")
       kernel_runtime = kernel_runtime / float(NUM_RUNS)
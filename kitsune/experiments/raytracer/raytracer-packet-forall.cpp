@@ -0,0 +1,451 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <iomanip>
+#include <cmath>
+#include <limits.h>
+#include <stdlib.h>
+#include <kitsune.h>
+
+// Packet version of raytracer-forall.cpp: each forall iteration traces
+// a packet of PACKET_SIZE neighboring pixels.  The rays of a packet are
+// held as vectors of lanes (one float per ray in each of x, y and z) and
+// the signed distance queries -- where the time goes -- are explicit
+// SIMD code.  Rays leave a packet at different times, so the marching
+// and bouncing keep a mask of the lanes that are still active.  Each ray
+// uses the same random numbers as in raytracer-forall.cpp, so the
+// images match.
+//
+// The packet size should be a multiple of the SIMD width of the CPU
+// (e.g., -DPACKET_SIZE=16 with AVX-512).  On GPU targets each thread
+// already traces one ray and a warp works on 32 neighboring pixels, so
+// packets default to a single ray there.
+#ifndef PACKET_SIZE
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target)
+#define PACKET_SIZE 1
+#else
+#define PACKET_SIZE 8
+#endif
+#endif
+
+#define LANES for (int l = 0; l < PACKET_SIZE; ++l)
+
+struct Pixel {
+  unsigned char r, g, b;
+};
+
+struct Vec {
+  float x,y,z;
+  __attribute__((always_inline)) Vec(float v = 0) {x = y = z = v;}
+  __attribute__((always_inline)) Vec(float a, float b, float c = 0.0f) {x = a; y = b; z = c;}
+  __attribute__((always_inline)) Vec operator+(const Vec r) const  { return Vec(x + r.x , y + r.y , z + r.z); }
+  __attribute__((always_inline)) Vec operator*(const Vec r) const { return   Vec(x * r.x , y * r.y , z * r.z); }
+  __attribute__((always_inline)) float operator%(const Vec r) const {return     x * r.x + y * r.y + z * r.z;}
+  __attribute__((always_inline)) Vec operator!() { return *this * (1.0/sqrtf(*this % *this)); }
+};
+
+// One float per ray of a packet.  The lanes are a vector of the
+// compiler (GCC and Clang's vector_size extension), so the arithmetic on
+// them is explicit SIMD code that lowers to one vector instruction per
+// operation.
+typedef float VFloat __attribute__((vector_size(PACKET_SIZE * sizeof(float))));
+typedef int VInt __attribute__((vector_size(PACKET_SIZE * sizeof(int))));
+
+struct Floats {
+  VFloat v;
+  __attribute__((always_inline)) Floats(float s = 0) { v = VFloat{} + s; }
+  __attribute__((always_inline)) Floats(VFloat s) { v = s; }
+  __attribute__((always_inline)) float &operator[](int l) { return ((float *)&v)[l]; }
+  __attribute__((always_inline)) float operator[](int l) const { return v[l]; }
+};
+
+// One int per ray of a packet.  Masks have all bits of the lanes that
+// are set, as the comparisons of Floats produce them.
+struct Ints {
+  VInt v;
+  __attribute__((always_inline)) Ints(int s = 0) { v = VInt{} + s; }
+  __attribute__((always_inline)) Ints(VInt s) { v = s; }
+  __attribute__((always_inline)) int &operator[](int l) { return ((int *)&v)[l]; }
+  __attribute__((always_inline)) int operator[](int l) const { return v[l]; }
+};
+
+#define FLOATS_OP(op)                                                   \
+  inline __attribute__((always_inline))                                 \
+  Floats operator op(const Floats &a, const Floats &b) {                \
+    return a.v op b.v;                                                  \
+  }
+FLOATS_OP(+)
+FLOATS_OP(-)
+FLOATS_OP(*)
+FLOATS_OP(/)
+#undef FLOATS_OP
+
+#define MASK_OP(type, op)                                               \
+  inline __attribute__((always_inline))                                 \
+  Ints operator op(const type &a, const type &b) {                      \
+    return a.v op b.v;                                                  \
+  }
+MASK_OP(Floats, <)
+MASK_OP(Floats, >)
+MASK_OP(Ints, ==)
+MASK_OP(Ints, >)
+MASK_OP(Ints, &)
+MASK_OP(Ints, |)
+MASK_OP(Ints, +)
+#undef MASK_OP
+
+inline __attribute__((always_inline))
+Ints operator~(const Ints &a) { return ~a.v; }
+
+inline __attribute__((always_inline))
+bool any(const Ints &mask) {
+  int r = 0;
+  LANES r |= mask[l];
+  return r != 0;
+}
+
+inline __attribute__((always_inline))
+Floats select(const Ints &mask, const Floats &a, const Floats &b) {
+  return mask.v ? a.v : b.v;
+}
+
+inline __attribute__((always_inline))
+Ints select(const Ints &mask, const Ints &a, const Ints &b) {
+  return mask.v ? a.v : b.v;
+}
+
+inline __attribute__((always_inline))
+Floats vmin(const Floats &a, const Floats &b) {
+  return select(a < b, a, b);
+}
+
+inline __attribute__((always_inline))
+Floats vabs(const Floats &a) {
+  return select(a < 0.0f, -a.v, a);
+}
+
+inline __attribute__((always_inline))
+Floats vsqrt(const Floats &a) {
+  Floats r;
+  LANES r[l] = sqrtf(a[l]);
+  return r;
+}
+
+inline __attribute__((always_inline))
+Floats vfloor(const Floats &a) {
+  Floats r;
+  LANES r[l] = floorf(a[l]);
+  return r;
+}
+
+// A vector per ray of a packet.
+struct PVec {
+  Floats x,y,z;
+  __attribute__((always_inline)) PVec(float v = 0.0f) {x = y = z = v;}
+  __attribute__((always_inline)) PVec(Floats v) {x = y = z = v;}
+  __attribute__((always_inline)) PVec(Floats a, Floats b, Floats c = 0.0f) {x = a; y = b; z = c;}
+  __attribute__((always_inline)) PVec(const Vec &r) {x = r.x; y = r.y; z = r.z;}
+  __attribute__((always_inline)) PVec operator+(const PVec &r) const { return PVec(x + r.x, y + r.y, z + r.z); }
+  __attribute__((always_inline)) PVec operator*(const PVec &r) const { return PVec(x * r.x, y * r.y, z * r.z); }
+  __attribute__((always_inline)) Floats operator%(const PVec &r) const { return x * r.x + y * r.y + z * r.z; }
+  __attribute__((always_inline)) PVec operator!() const {
+    Floats len2 = *this % *this, scale;
+    LANES scale[l] = 1.0/sqrtf(len2[l]);
+    return *this * scale;
+  }
+  __attribute__((always_inline)) Vec lane(int l) const { return Vec(x[l], y[l], z[l]); }
+  __attribute__((always_inline)) void set_lane(int l, const Vec &r) { x[l] = r.x; y[l] = r.y; z[l] = r.z; }
+};
+
+inline __attribute__((always_inline))
+PVec select(const Ints &mask, const PVec &a, const PVec &b) {
+  return PVec(select(mask, a.x, b.x), select(mask, a.y, b.y),
+              select(mask, a.z, b.z));
+}
+
+inline __attribute__((always_inline))
+float randomVal(unsigned int& x) {
+  x = (214013*x+2531011);
+  return ((x>>16)&0x7FFF) / 66635.0f;
+}
+
+// Rectangle CSG equation. Returns minimum signed distance from
+// space carved bylowerLeft vertex and opposite rectangle vertex
+// upperRight.
+inline __attribute__((always_inline))
+Floats BoxTest(const PVec &position, PVec lowerLeft, PVec upperRight) {
+  lowerLeft = position + lowerLeft * -1.0f;
+  upperRight = upperRight + position * -1.0f;
+  return Floats(0.0f) - vmin(vmin(vmin(lowerLeft.x, upperRight.x),
+                                  vmin(lowerLeft.y, upperRight.y)),
+                             vmin(lowerLeft.z, upperRight.z));
+}
+
+#define HIT_NONE 0
+#define HIT_LETTER 1
+#define HIT_WALL 2
+#define HIT_SUN 3
+
+// Sample the world using Signed Distance Fields.
+inline __attribute__((always_inline))
+Floats QueryDatabase(const PVec& position, Ints &hitType) {
+  Floats distance = 1e9;//FLT_MAX;
+  PVec f = position; // Flattened position (z=0)
+  f.z = 0.0f;
+  const float lines[10*4] = {
+    -20.0f,  0.0f, -20.0f, 16.0f,
+    -20.0f,  0.0f, -14.0f,  0.0f,
+    -11.0f,  0.0f,  -7.0f, 16.0f,
+     -3.0f,  0.0f,  -7.0f, 16.0f,
+     -5.5f,  5.0f,  -9.5f,  5.0f,
+      0.0f,  0.0f,   0.0f, 16.0f,
+      6.0f,  0.0f,   6.0f, 16.0f,
+      0.0f, 16.0f,   6.0f,  0.0f,
+      9.0f,  0.0f,   9.0f, 16.0f,
+      9.0f,  0.0f,  15.0f,  0.0f
+  };
+
+  for (unsigned i = 0; i < sizeof(lines)/sizeof(float); i += sizeof(float)) {
+    // The segments are the same for all rays.
+    Vec begin = Vec(lines[i], lines[i + 1]) * 0.5f;
+    Vec e = Vec(lines[i + 2], lines[i + 3]) * 0.5f + begin * -1.0f;
+    float ee = e % e;
+    Floats t = vmin(Floats(0.0f) - vmin(((PVec(begin) + f * -1.0f) % PVec(e)) / ee, 0.0f), 1.0f);
+    PVec o = f + (PVec(begin) + PVec(e) * t) * -1.0f;
+    distance = vmin(distance, o % o); // compare squared distance.
+  }
+
+  // Get real distance, not square distance: sqrt(d)^8 = d^4, and the
+  // eighth root is three square roots.
+  Floats d2 = distance * distance, z2 = position.z * position.z;
+  Floats z4 = z2 * z2;
+  distance = vsqrt(vsqrt(vsqrt(d2 * d2 + z4 * z4))) - 0.5f;
+  hitType = HIT_LETTER;
+
+  Floats roomDist;
+  roomDist = vmin(Floats(0.0f) - vmin(
+      BoxTest(position, Vec(-30.0f, -0.5f, -30.0f), Vec(30.0f, 18.0f, 30.0f)),
+      BoxTest(position, Vec(-25.0f, 17.0f, -25.0f), Vec(25.0f, 20.0f, 25.0f))),
+                  BoxTest( // Ceiling "planks" spaced 8 units apart.
+                      PVec(vabs(position.x) - vfloor(vabs(position.x) * 0.125f) * 8.0f,
+                           position.y, position.z),
+                      Vec(1.5f, 18.5f, -25.0f),
+                      Vec(6.5f, 20.0f,  25.0f)));
+  Floats sun = Floats(19.9f) - position.y; // Everything above 19.9 is light source.
+  Ints closer = roomDist < distance;
+  distance = select(closer, roomDist, distance);
+  hitType = select(closer, Ints(HIT_WALL), hitType);
+  closer = sun < distance;
+  distance = select(closer, sun, distance);
+  hitType = select(closer, Ints(HIT_SUN), hitType);
+  return distance;
+}
+
+// Perform signed sphere marching for the rays of the active lanes.
+// Returns hitType 0, 1, 2, or 3 for each ray and updates the hit
+// position/normal of the rays that hit something.
+inline __attribute__((always_inline))
+Ints RayMarching(const PVec& origin, const PVec& direction, PVec& hitPos,
+                 PVec& hitNorm, Ints active) {
+  Ints result = HIT_NONE;
+  Ints hit = 0;
+  Ints noHitCount = 0;
+  Floats total_d = 0.0f;
+  Floats hit_d = 0.0f;
+
+  // Signed distance marching.  Each ray stops when it hits something or
+  // leaves the scene; the packet stops when all of its rays have.
+  for (;;) {
+    active = active & (total_d < 100.0f);
+    if (!any(active))
+      break;
+    PVec position = origin + direction * total_d;
+    Ints hitType;
+    Floats d = QueryDatabase(position, hitType); // distance from closest object in world.
+    hitPos = select(active, position, hitPos);
+    noHitCount = noHitCount + (active & 1);
+    Ints stop = active & ((d < .01f) | (noHitCount > 99));
+    result = select(stop, hitType, result);
+    hit_d = select(stop, d, hit_d);
+    hit = hit | stop;
+    active = active & ~stop;
+    total_d = select(active, total_d + d, total_d);
+  }
+
+  if (any(hit)) {
+    Ints ignored;
+    PVec normal = !PVec(QueryDatabase(hitPos + Vec(0.01f, 0.00f), ignored) - hit_d,
+                        QueryDatabase(hitPos + Vec(0.00f, 0.01f), ignored) - hit_d,
+                        QueryDatabase(hitPos + Vec(0.00f, 0.00f, 0.01f), ignored) - hit_d);
+    hitNorm = select(hit, normal, hitNorm);
+  }
+  return result;
+}
+
+inline __attribute__((always_inline))
+PVec Trace(PVec origin, PVec direction, unsigned int *rn) {
+  PVec sampledPosition;
+  PVec normal;
+  PVec color(0.0f, 0.0f, 0.0f);
+  PVec attenuation(1.0f);
+  Vec lightDirection(!Vec(0.6f, 0.6f, 1.0f)); // Directional light
+  Ints active = -1;
+
+  for (int bounceCount = 8; bounceCount-- && any(active);) {
+    Ints hitType = RayMarching(origin, direction, sampledPosition, normal,
+                               active);
+    Floats incidence = normal % PVec(lightDirection);
+    Ints shadow = 0;
+    LANES {
+      if (!active[l])
+        continue;
+      Vec n = normal.lane(l);
+      Vec dir = direction.lane(l);
+      if (hitType[l] == HIT_NONE)
+        active[l] = 0;  // No hit, return color.
+      else if (hitType[l] == HIT_LETTER) { // Specular bounce on a letter. No color acc.
+        dir = dir + n * (n % dir * -2.0f);
+        direction.set_lane(l, dir);
+        origin.set_lane(l, sampledPosition.lane(l) + dir * 0.1f);
+        attenuation.set_lane(l, attenuation.lane(l) * 0.2f); // Attenuation via distance traveled.
+      } else if (hitType[l] == HIT_WALL) { // Wall hit uses color yellow?
+        float p = 6.283185f * randomVal(rn[l]);
+        float c = randomVal(rn[l]);
+        float s = sqrtf(1.0f - c);
+        float g = n.z < 0.0f ? -1.0f : 1.0f;
+        float u = (-1.0f / (g + n.z));
+        float v = n.x * n.y * u;
+        float sinp = sinf(p);
+        float cosp = cosf(p);
+        dir = Vec(v, g + n.y * n.y * u, -n.y) * (cosp * s) +
+              Vec(1 + g * n.x * n.x * u, g * v, -g * n.x) *
+              (sinp * s) + n * sqrtf(c);
+        direction.set_lane(l, dir);
+        origin.set_lane(l, sampledPosition.lane(l) + dir * 0.1f);
+        attenuation.set_lane(l, attenuation.lane(l) * 0.2f);
+        shadow[l] = incidence[l] > 0.0f ? -1 : 0;
+      } else if (hitType[l] == HIT_SUN) { //
+        color.set_lane(l, color.lane(l) + attenuation.lane(l) * Vec(50, 80, 100));
+        active[l] = 0; // Sun Color
+      }
+    }
+
+    // Rays that hit a wall facing the light look for the sun.
+    if (any(shadow)) {
+      Ints lit = RayMarching(sampledPosition + normal * 0.1f,
+                             PVec(lightDirection), sampledPosition, normal,
+                             shadow);
+      LANES {
+        if (shadow[l] && lit[l] == HIT_SUN)
+          color.set_lane(l, color.lane(l) + attenuation.lane(l) *
+                                                Vec(500, 400, 100) * incidence[l]);
+      }
+    }
+  }
+  return color;
+}
+
+
+int main(int argc, char **argv) {
+  using namespace std;
+
+  unsigned int sampleCount = 1 << 7;
+  unsigned int imageWidth = 1280;
+  unsigned int imageHeight = 1024;
+
+  if (argc > 1) {
+    if (argc == 2)
+      sampleCount = atoi(argv[1]);
+    else if (argc == 4) {
+      imageWidth = atoi(argv[2]);
+      sampleCount = atoi(argv[1]);
+      imageHeight = atoi(argv[3]);
+    } else {
+      cout << "usage: raytracer [#samples] [img-width img-height]\n";
+      return 1;
+    }
+  }
+
+  cout << "\n";
+  cout << "---- Raytracer benchmark (forall, packets) ----\n"
+       << "  Image size    : " << imageWidth << "x" << imageHeight << "\n"
+       << "  Samples/pixel : " << sampleCount << "\n"
+       << "  Packet size   : " << PACKET_SIZE << "\n\n";
+
+  cout << "  Allocating image..." << std::flush;
+  unsigned int totalPixels = imageWidth * imageHeight;
+  unsigned int totalPackets = (totalPixels + PACKET_SIZE - 1) / PACKET_SIZE;
+  Pixel *img = alloc<Pixel>(totalPixels);
+  cout << "  done.\n\n";
+
+  cout << "  Starting benchmark..." << std::flush;
+
+  auto start_time = chrono::steady_clock::now();
+  forall(unsigned int pk = 0; pk < totalPackets; ++pk) {
+    const Vec position(-12.0f, 5.0f, 25.0f);
+    const Vec goal = !(Vec(-3.0f, 4.0f, 0.0f) + position * -1.0f);
+    const Vec left = !Vec(goal.z, 0, -goal.x) * (1.0f / imageWidth);
+    // Cross-product to get the up vector
+    const Vec up(goal.y *left.z - goal.z * left.y,
+                 goal.z *left.x - goal.x * left.z,
+                 goal.x *left.y - goal.y * left.x);
+    // The lanes of the last packet past the end of the image trace the
+    // last pixel again.
+    unsigned int rn[PACKET_SIZE];
+    LANES {
+      unsigned int i = pk * PACKET_SIZE + l;
+      rn[l] = i < totalPixels ? i : totalPixels - 1;
+    }
+    PVec color;
+    for (unsigned int p = sampleCount; p--;) {
+      PVec direction;
+      LANES {
+        unsigned int i = pk * PACKET_SIZE + l;
+        if (i >= totalPixels)
+          i = totalPixels - 1;
+        int x = i % imageWidth;
+        int y = i / imageWidth;
+        unsigned int &v = rn[l];
+        Vec rand_left = Vec(randomVal(v), randomVal(v), randomVal(v))*.001;
+        float xf = x + randomVal(v);
+        float yf = y + randomVal(v);
+        direction.set_lane(l, !((goal+rand_left) + left *
+                                ((xf - imageWidth / 2.0f) + randomVal(v)) + up *
+                                ((yf - imageHeight / 2.0f) + randomVal(v))));
+      }
+      color = color + Trace(position, direction, rn);
+    }
+    LANES {
+      unsigned int i = pk * PACKET_SIZE + l;
+      if (i >= totalPixels)
+        continue;
+      // Reinhard tone mapping
+      Vec c = color.lane(l) * (1.0f / sampleCount) + 14.0f / 241.0f;
+      Vec o = c + 1.0f;
+      c = Vec(c.x / o.x, c.y / o.y, c.z / o.z) * 255.0f;
+      img[i].r = (unsigned char)c.x;
+      img[i].g = (unsigned char)c.y;
+      img[i].b = (unsigned char)c.z;
+    }
+  }
+  auto end_time = chrono::steady_clock::now();
+  double elapsed_time = chrono::duration<double>(end_time-start_time).count();
+
+  cout << "\n\n  Total time: " << elapsed_time << " seconds.\n";
+  cout << "  Pixels/second: " << totalPixels / elapsed_time << ".\n\n";
+
+  cout << "  Saving image...";
+  ofstream img_file;
+  img_file.open ("raytrace-packet-forall.ppm");
+  if (img_file.is_open()) {
+    img_file << "P6 " << imageWidth << " " << imageHeight << " 255 ";
+    for(int i = totalPixels-1; i >= 0; i--)
+      img_file << img[i].r << img[i].g << img[i].b;
+    img_file.close();
+    cout << "  done.\n\n"
+         << "*** " << elapsed_time << ", " << elapsed_time << "\n"
+         << "----\n\n";
+  }
+  dealloc(img);
+  return 0;
+}
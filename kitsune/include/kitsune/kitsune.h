@@ -33,14 +33,48 @@
 #define forall _kitsune_forall
 #endif
 
+/* Reductions in forall loops.  Each of these combines 'val' into 'var' with a
+ * relaxed atomic update.  The updates in each strip of a stripmined loop (e.g.,
+ * on the OpenCilk target) are accumulated in a register and applied with one
+ * atomic update per strip, and the GPU targets combine them with block-wide
+ * tree reductions.  kitsune_reduce_add supports integer and floating point
+ * variables; the other reductions support integers only.  The order of the
+ * updates varies from run to run, and so may the last bits of a floating
+ * point sum; kitsune_reduce.h has reductions whose results do not.
+ */
+#define kitsune_reduce_add(var, val) \
+  ((void)__atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED))
+#define kitsune_reduce_min(var, val) \
+  ((void)__atomic_fetch_min(&(var), (val), __ATOMIC_RELAXED))
+#define kitsune_reduce_max(var, val) \
+  ((void)__atomic_fetch_max(&(var), (val), __ATOMIC_RELAXED))
+#define kitsune_reduce_and(var, val) \
+  ((void)__atomic_fetch_and(&(var), (val), __ATOMIC_RELAXED))
+#define kitsune_reduce_or(var, val) \
+  ((void)__atomic_fetch_or(&(var), (val), __ATOMIC_RELAXED))
+#define kitsune_reduce_xor(var, val) \
+  ((void)__atomic_fetch_xor(&(var), (val), __ATOMIC_RELAXED))
+
+/* Allocation sites.  alloc<T>() tags each allocation with the file and
+ * line of its call, or with a label passed in place of the file (e.g.,
+ * alloc<double>(n, "halo")), so that the runtime can charge the data
+ * movement of the allocation to it (see KITRT_MEM_SITES).
+ */
+#ifdef __cplusplus
+extern "C" void __kitrt_set_mem_alloc_site(void *, const char *, unsigned);
+#endif
+
 #if defined(_tapir_cuda_target)
   #ifdef __cplusplus
     extern "C" __attribute__((malloc))
     void* __kitcuda_mem_alloc_managed(size_t);
     template <typename T>
     inline __attribute__((always_inline))
-      T* alloc(size_t N) {
-      return (T*)__kitcuda_mem_alloc_managed(sizeof(T) * N);
+      T* alloc(size_t N, const char *site = __builtin_FILE(),
+               unsigned line = __builtin_LINE()) {
+      T *array = (T*)__kitcuda_mem_alloc_managed(sizeof(T) * N);
+      __kitrt_set_mem_alloc_site(array, site, line);
+      return array;
     }
 
     extern "C" void __kitcuda_mem_free(void*);
@@ -66,8 +100,11 @@
     extern "C" __attribute__((malloc)) void* __kithip_mem_alloc_managed(size_t);
     template <typename T>
     inline __attribute__((always_inline))
-      T* alloc(size_t N) {
-      return (T*)__kithip_mem_alloc_managed(sizeof(T) * N);
+      T* alloc(size_t N, const char *site = __builtin_FILE(),
+               unsigned line = __builtin_LINE()) {
+      T *array = (T*)__kithip_mem_alloc_managed(sizeof(T) * N);
+      __kitrt_set_mem_alloc_site(array, site, line);
+      return array;
     }
 
     extern "C" void __kithip_mem_free(void*);
@@ -88,14 +125,78 @@
        __kithip_mem_free(array);
     }
   #endif
+#elif defined(_tapir_levelzero_target)
+  #ifdef __cplusplus
+    extern "C" __attribute__((malloc)) void* __kitze_mem_alloc_managed(size_t);
+    template <typename T>
+    inline __attribute__((always_inline))
+      T* alloc(size_t N, const char *site = __builtin_FILE(),
+               unsigned line = __builtin_LINE()) {
+      T *array = (T*)__kitze_mem_alloc_managed(sizeof(T) * N);
+      __kitrt_set_mem_alloc_site(array, site, line);
+      return array;
+    }
+
+    extern "C" void __kitze_mem_free(void*);
+    template <typename T>
+    void dealloc(T* array) {
+      __kitze_mem_free((void*)array);
+    }
+  #else
+    void* __attribute__((malloc)) __kitze_mem_alloc_managed(size_t);
+    inline __attribute__((always_inline))
+    void *alloc(size_t total_bytes) {
+      return __kitze_mem_alloc_managed(total_bytes);
+    }
+
+    void __kitze_mem_free(void*);
+    inline __attribute__((always_inline))
+    void dealloc(void *array) {
+       __kitze_mem_free(array);
+    }
+  #endif
+#elif defined(_tapir_multi_target)
+  #ifdef __cplusplus
+    extern "C" __attribute__((malloc))
+    void* __kitrt_multi_mem_alloc_managed(size_t);
+    template <typename T>
+    inline __attribute__((always_inline))
+      T* alloc(size_t N, const char *site = __builtin_FILE(),
+               unsigned line = __builtin_LINE()) {
+      T *array = (T*)__kitrt_multi_mem_alloc_managed(sizeof(T) * N);
+      __kitrt_set_mem_alloc_site(array, site, line);
+      return array;
+    }
+
+    extern "C" void __kitrt_multi_mem_free(void*);
+    template <typename T>
+    void dealloc(T* array) {
+      __kitrt_multi_mem_free((void*)array);
+    }
+  #else
+    void* __attribute__((malloc)) __kitrt_multi_mem_alloc_managed(size_t);
+    inline __attribute__((always_inline))
+    void *alloc(size_t total_bytes) {
+      return __kitrt_multi_mem_alloc_managed(total_bytes);
+    }
+
+    void __kitrt_multi_mem_free(void*);
+    inline __attribute__((always_inline))
+    void dealloc(void *array) {
+       __kitrt_multi_mem_free(array);
+    }
+  #endif
 #else
   #ifdef __cplusplus
     extern "C" __attribute__((malloc))
     void* __kitrt_default_mem_alloc(size_t);
     template <typename T>
     inline __attribute__((always_inline))
-    T* alloc(size_t N) {
-      return (T*)__kitrt_default_mem_alloc(sizeof(T) * N);
+    T* alloc(size_t N, const char *site = __builtin_FILE(),
+             unsigned line = __builtin_LINE()) {
+      T *array = (T*)__kitrt_default_mem_alloc(sizeof(T) * N);
+      __kitrt_set_mem_alloc_site(array, site, line);
+      return array;
     }
 
     extern "C" void __kitrt_default_mem_free(void*);
@@ -118,4 +219,585 @@
   #endif // __cplusplus
 #endif // cpu targets
 
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stdlib.h>
+#include <new>
+#include <utility>
+
+/* Growable arrays.  A kitsune::vector reserves the address space for its
+ * largest size up front and commits memory as it grows, so growing never
+ * moves the elements: pointers into the array (including those held by
+ * kernels still in flight) stay valid.  Memory is committed in chunks of
+ * at least 2 MiB that double with the array, which keeps the runtime
+ * calls off the push_back path.
+ */
+#if defined(_tapir_cuda_target)
+  extern "C" void* __kitcuda_mem_reserve_managed(size_t);
+  extern "C" void __kitcuda_mem_commit_managed(void*, size_t);
+  extern "C" void __kitcuda_mem_release_managed(void*, size_t);
+  extern "C" void* __kitcuda_mem_map_file(const char*, size_t*);
+  extern "C" void __kitcuda_mem_unmap_file(void*);
+  extern "C" void* __kitcuda_mem_alloc_pinned(size_t);
+  extern "C" void __kitcuda_mem_free_pinned(void*, void*);
+  extern "C" void* __kitcuda_mem_alloc_device(size_t);
+  extern "C" void __kitcuda_mem_free_device(void*);
+  extern "C" bool __kitcuda_mem_on_device(void*);
+  extern "C" void __kitcuda_mem_mark_cold(void*);
+  extern "C" void __kitcuda_heap_reset();
+  extern "C" void __kitcuda_mem_persist(void*);
+  extern "C" void __kitcuda_mem_persist_reset();
+  extern "C" void __kitcuda_mem_set_migrate_policy(void*, int);
+#elif defined(_tapir_hip_target)
+  extern "C" void* __kithip_mem_reserve_managed(size_t);
+  extern "C" void __kithip_mem_commit_managed(void*, size_t);
+  extern "C" void __kithip_mem_release_managed(void*, size_t);
+  extern "C" void* __kithip_mem_map_file(const char*, size_t*);
+  extern "C" void __kithip_mem_unmap_file(void*);
+  extern "C" void* __kithip_mem_alloc_pinned(size_t);
+  extern "C" void __kithip_mem_free_pinned(void*, void*);
+  extern "C" void* __kithip_mem_alloc_device(size_t);
+  extern "C" void __kithip_mem_free_device(void*);
+  extern "C" bool __kithip_mem_on_device(void*);
+  extern "C" void __kithip_mem_mark_cold(void*);
+#elif defined(_tapir_multi_target)
+  extern "C" void* __kitrt_multi_mem_reserve(size_t);
+  extern "C" void __kitrt_multi_mem_commit(void*, size_t);
+  extern "C" void __kitrt_multi_mem_release(void*, size_t);
+  extern "C" void* __kitrt_multi_mem_map_file(const char*, size_t*);
+  extern "C" void __kitrt_multi_mem_unmap_file(void*);
+  extern "C" void* __kitrt_multi_mem_alloc_pinned(size_t);
+  extern "C" void __kitrt_multi_mem_free_pinned(void*, void*);
+  extern "C" void* __kitrt_multi_mem_alloc_device(size_t);
+  extern "C" void __kitrt_multi_mem_free_device(void*);
+  extern "C" bool __kitrt_multi_mem_on_device(void*);
+  extern "C" void __kitrt_multi_mem_mark_cold(void*);
+#else
+  extern "C" void* __kitrt_default_mem_reserve(size_t);
+  extern "C" void __kitrt_default_mem_commit(void*, size_t);
+  extern "C" void __kitrt_default_mem_release(void*, size_t);
+  extern "C" void* __kitrt_default_mem_map_file(const char*, size_t*);
+  extern "C" void __kitrt_default_mem_unmap_file(void*);
+  extern "C" void* __kitrt_default_mem_alloc_pinned(size_t);
+  extern "C" void __kitrt_default_mem_free_pinned(void*, void*);
+  extern "C" void* __kitrt_default_mem_alloc_device(size_t);
+  extern "C" void __kitrt_default_mem_free_device(void*);
+  extern "C" bool __kitrt_default_mem_on_device(void*);
+  extern "C" void __kitrt_default_mem_mark_cold(void*);
+#endif
+
+namespace kitsune {
+
+namespace detail {
+
+inline void *mem_reserve(size_t max_bytes) {
+#if defined(_tapir_cuda_target)
+  return __kitcuda_mem_reserve_managed(max_bytes);
+#elif defined(_tapir_hip_target)
+  return __kithip_mem_reserve_managed(max_bytes);
+#elif defined(_tapir_multi_target)
+  return __kitrt_multi_mem_reserve(max_bytes);
+#else
+  return __kitrt_default_mem_reserve(max_bytes);
+#endif
+}
+
+inline void mem_commit(void *base, size_t nbytes) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_commit_managed(base, nbytes);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_commit_managed(base, nbytes);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_commit(base, nbytes);
+#else
+  __kitrt_default_mem_commit(base, nbytes);
+#endif
+}
+
+inline void mem_release(void *base, size_t max_bytes) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_release_managed(base, max_bytes);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_release_managed(base, max_bytes);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_release(base, max_bytes);
+#else
+  __kitrt_default_mem_release(base, max_bytes);
+#endif
+}
+
+inline void *mem_map_file(const char *path, size_t *nbytes) {
+#if defined(_tapir_cuda_target)
+  return __kitcuda_mem_map_file(path, nbytes);
+#elif defined(_tapir_hip_target)
+  return __kithip_mem_map_file(path, nbytes);
+#elif defined(_tapir_multi_target)
+  return __kitrt_multi_mem_map_file(path, nbytes);
+#else
+  return __kitrt_default_mem_map_file(path, nbytes);
+#endif
+}
+
+inline void mem_unmap_file(void *ptr) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_unmap_file(ptr);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_unmap_file(ptr);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_unmap_file(ptr);
+#else
+  __kitrt_default_mem_unmap_file(ptr);
+#endif
+}
+
+inline void *mem_alloc_pinned(size_t nbytes) {
+#if defined(_tapir_cuda_target)
+  return __kitcuda_mem_alloc_pinned(nbytes);
+#elif defined(_tapir_hip_target)
+  return __kithip_mem_alloc_pinned(nbytes);
+#elif defined(_tapir_multi_target)
+  return __kitrt_multi_mem_alloc_pinned(nbytes);
+#else
+  return __kitrt_default_mem_alloc_pinned(nbytes);
+#endif
+}
+
+inline void mem_free_pinned(void *ptr, void *stream) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_free_pinned(ptr, stream);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_free_pinned(ptr, stream);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_free_pinned(ptr, stream);
+#else
+  __kitrt_default_mem_free_pinned(ptr, stream);
+#endif
+}
+
+inline void *mem_alloc_device(size_t nbytes) {
+#if defined(_tapir_cuda_target)
+  return __kitcuda_mem_alloc_device(nbytes);
+#elif defined(_tapir_hip_target)
+  return __kithip_mem_alloc_device(nbytes);
+#elif defined(_tapir_multi_target)
+  return __kitrt_multi_mem_alloc_device(nbytes);
+#else
+  return __kitrt_default_mem_alloc_device(nbytes);
+#endif
+}
+
+inline void mem_free_device(void *ptr) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_free_device(ptr);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_free_device(ptr);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_free_device(ptr);
+#else
+  __kitrt_default_mem_free_device(ptr);
+#endif
+}
+
+inline bool mem_on_device(const void *ptr) {
+#if defined(_tapir_cuda_target)
+  return __kitcuda_mem_on_device(const_cast<void*>(ptr));
+#elif defined(_tapir_hip_target)
+  return __kithip_mem_on_device(const_cast<void*>(ptr));
+#elif defined(_tapir_multi_target)
+  return __kitrt_multi_mem_on_device(const_cast<void*>(ptr));
+#else
+  return __kitrt_default_mem_on_device(const_cast<void*>(ptr));
+#endif
+}
+
+inline void mem_mark_cold(void *ptr) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_mark_cold(ptr);
+#elif defined(_tapir_hip_target)
+  __kithip_mem_mark_cold(ptr);
+#elif defined(_tapir_multi_target)
+  __kitrt_multi_mem_mark_cold(ptr);
+#else
+  __kitrt_default_mem_mark_cold(ptr);
+#endif
+}
+
+} // namespace detail
+
+template <typename T>
+class vector {
+public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  static const size_t commit_granule = 2 * 1024 * 1024;
+
+  /// Create an empty array that can grow to 'max_size' elements.
+  explicit vector(size_t max_size)
+      : elems((T*)detail::mem_reserve(max_size * sizeof(T))),
+        count(0), committed(0), limit(max_size) {}
+
+  vector(const vector&) = delete;
+  vector& operator=(const vector&) = delete;
+
+  vector(vector &&other)
+      : elems(other.elems), count(other.count), committed(other.committed),
+        limit(other.limit) {
+    other.elems = nullptr;
+    other.count = other.committed = other.limit = 0;
+  }
+
+  vector& operator=(vector &&other) {
+    if (this != &other) {
+      release();
+      elems = other.elems;
+      count = other.count;
+      committed = other.committed;
+      limit = other.limit;
+      other.elems = nullptr;
+      other.count = other.committed = other.limit = 0;
+    }
+    return *this;
+  }
+
+  ~vector() { release(); }
+
+  size_t size() const { return count; }
+  size_t capacity() const { return committed; }
+  size_t max_size() const { return limit; }
+  bool empty() const { return count == 0; }
+
+  T* data() { return elems; }
+  const T* data() const { return elems; }
+
+  iterator begin() { return elems; }
+  iterator end() { return elems + count; }
+  const_iterator begin() const { return elems; }
+  const_iterator end() const { return elems + count; }
+
+  T& operator[](size_t i) { return elems[i]; }
+  const T& operator[](size_t i) const { return elems[i]; }
+
+  T& back() { return elems[count - 1]; }
+  const T& back() const { return elems[count - 1]; }
+
+  /// Commit memory for (at least) 'n' elements.  Never moves the
+  /// elements; aborts if 'n' exceeds the maximum size.
+  void reserve(size_t n) {
+    if (n <= committed)
+      return;
+    if (n > limit)
+      abort();
+    size_t bytes = committed * sizeof(T) * 2;
+    if (bytes < n * sizeof(T))
+      bytes = n * sizeof(T);
+    bytes = (bytes + commit_granule - 1) / commit_granule * commit_granule;
+    size_t n_committed = bytes / sizeof(T);
+    if (n_committed > limit)
+      n_committed = limit;
+    detail::mem_commit(elems, n_committed * sizeof(T));
+    committed = n_committed;
+  }
+
+  void resize(size_t n) {
+    reserve(n);
+    for (size_t i = count; i < n; i++)
+      new (elems + i) T();
+    for (size_t i = n; i < count; i++)
+      elems[i].~T();
+    count = n;
+  }
+
+  void push_back(const T &value) {
+    reserve(count + 1);
+    new (elems + count) T(value);
+    count++;
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    reserve(count + 1);
+    new (elems + count) T(std::forward<Args>(args)...);
+    return elems[count++];
+  }
+
+  void pop_back() {
+    elems[--count].~T();
+  }
+
+  void clear() {
+    for (size_t i = 0; i < count; i++)
+      elems[i].~T();
+    count = 0;
+  }
+
+private:
+  void release() {
+    if (elems == nullptr)
+      return;
+    clear();
+    detail::mem_release(elems, limit * sizeof(T));
+    elems = nullptr;
+  }
+
+  T *elems;
+  size_t count;     // elements constructed.
+  size_t committed; // elements with committed memory.
+  size_t limit;     // elements the reservation can hold.
+};
+
+/// Reduced-precision storage types.  Memory-bound loops can keep their
+/// arrays as 16-bit floats, halving the traffic, and still compute in
+/// float: a kitsune::half or kitsune::bfloat16 converts to float where it
+/// is read and is rounded back where it is written,
+///
+///   kitsune::half *x = alloc<kitsune::half>(n), *y = ...;
+///   forall(size_t i = 0; i < n; i++)
+///     y[i] = a * x[i] + y[i];      // fp32 arithmetic, fp16 loads/stores.
+///
+/// The conversions of half are the targets' native ones (cvt on NVIDIA,
+/// v_cvt on AMD, F16C or AVX512-FP16 on x86 when enabled with -mf16c or
+/// -march); bfloat16 converts with integer operations everywhere.
+#if defined(__FLT16_MAX__)
+struct half {
+  _Float16 value;
+
+  half() = default;
+  half(float f) : value((_Float16)f) {}
+  operator float() const { return (float)value; }
+
+  half& operator+=(float f) { return *this = (float)*this + f; }
+  half& operator-=(float f) { return *this = (float)*this - f; }
+  half& operator*=(float f) { return *this = (float)*this * f; }
+  half& operator/=(float f) { return *this = (float)*this / f; }
+};
+#endif
+
+struct bfloat16 {
+  uint16_t bits;
+
+  bfloat16() = default;
+  bfloat16(float f) {
+    uint32_t u;
+    __builtin_memcpy(&u, &f, sizeof(u));
+    if ((u & 0x7fffffffu) > 0x7f800000u)
+      bits = (uint16_t)((u >> 16) | 0x40);  // keep NaNs quiet.
+    else
+      bits = (uint16_t)((u + 0x7fffu + ((u >> 16) & 1)) >> 16);
+  }
+  operator float() const {
+    uint32_t u = (uint32_t)bits << 16;
+    float f;
+    __builtin_memcpy(&f, &u, sizeof(f));
+    return f;
+  }
+
+  bfloat16& operator+=(float f) { return *this = (float)*this + f; }
+  bfloat16& operator-=(float f) { return *this = (float)*this - f; }
+  bfloat16& operator*=(float f) { return *this = (float)*this * f; }
+  bfloat16& operator/=(float f) { return *this = (float)*this / f; }
+};
+
+/// A standard allocator over the same memory as alloc<T>(): managed
+/// memory on the GPU targets, registered with the runtime so kernels can
+/// use it in place.  Standard containers that use it, e.g.
+///
+///   std::vector<float, kitsune::allocator<float>> v(n);
+///   forall (float &x : v) ...
+///
+/// can be used directly in forall loops.  A range-based forall over a
+/// contiguous container (or a std::span of its elements) runs as a flat
+/// indexed loop over the container's data.
+template <typename T>
+struct allocator {
+  typedef T value_type;
+
+  allocator() noexcept = default;
+  template <typename U>
+  allocator(const allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    T *p = ::alloc<T>(n);
+    if (p == nullptr && n != 0)
+      abort();
+    return p;
+  }
+
+  void deallocate(T *p, size_t) noexcept { ::dealloc(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept {
+  return false;
+}
+
+namespace detail {
+
+/// The number of consecutive entries each iteration of forall_segments()
+/// runs.  GPU threads take a few entries, so that neighboring threads
+/// still access nearby entries; CPU iterations take enough to amortize
+/// the search for their first segment.
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+static const size_t segment_chunk = 4;
+#else
+static const size_t segment_chunk = 512;
+#endif
+
+} // namespace detail
+
+/// Call body(s, k) for every entry k of every segment s of a CSR-style
+/// segmented range: segment s holds entries offsets[s] through
+/// offsets[s + 1] - 1, and 'offsets' has num_segments + 1 elements.  The
+/// work is split evenly by entries rather than by segments (a merge-path
+/// partition): each iteration of the underlying forall runs a fixed number
+/// of consecutive entries, finds the segment of its first entry with a
+/// binary search over 'offsets', and walks segment boundaries from there.
+/// Segments of very different lengths therefore do not leave GPU threads
+/// or CPU workers idle.  Calls for the entries of one segment may run in
+/// parallel, so per-segment results must be combined with kitsune_reduce_*.
+/// On the GPU targets 'body' should capture by value.
+template <typename Offset, typename Body>
+void forall_segments(const Offset *offsets, size_t num_segments, Body body) {
+  if (num_segments == 0)
+    return;
+  const size_t first = offsets[0];
+  const size_t last = offsets[num_segments];
+  const size_t chunk = detail::segment_chunk;
+  const size_t num_chunks = (last - first + chunk - 1) / chunk;
+  forall(size_t c = 0; c < num_chunks; ++c) {
+    size_t k = first + c * chunk;
+    size_t end = last - k < chunk ? last : k + chunk;
+    // Find s with offsets[s] <= k < offsets[s + 1].
+    size_t lo = 0, hi = num_segments;
+    while (hi - lo > 1) {
+      size_t mid = lo + (hi - lo) / 2;
+      if ((size_t)offsets[mid] <= k)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    for (size_t s = lo; k < end; ++k) {
+      while ((size_t)offsets[s + 1] <= k)
+        ++s;
+      body(s, (Offset)k);
+    }
+  }
+}
+
+/// Map the file at 'path' as a read-only array of T, setting 'count'
+/// (if given) to the number of elements in it.  The file is not read
+/// up front: the host reads it in place and GPU targets load it to the
+/// device in the background, so the load overlaps the code that runs
+/// until the first kernel uses the array.  Returns null if the file
+/// cannot be mapped.
+template <typename T>
+const T* map_file(const char *path, size_t *count = nullptr) {
+  size_t nbytes = 0;
+  const T *array = (const T*)detail::mem_map_file(path, &nbytes);
+  if (count)
+    *count = nbytes / sizeof(T);
+  return array;
+}
+
+/// Release an array returned by map_file().
+inline void unmap_file(const void *array) {
+  detail::mem_unmap_file(const_cast<void*>(array));
+}
+
+/// Allocate an uninitialized page-locked (pinned) host buffer of
+/// 'count' elements of T.  Pinned buffers are the fast path for
+/// explicit transfers: copies to and from them run asynchronously at
+/// full bandwidth, and kernels can write them directly (e.g., to pack
+/// MPI halos).  Buffers are pooled by size class, so allocating them
+/// per exchange is cheap.
+template <typename T>
+T* alloc_pinned(size_t count) {
+  return (T*)detail::mem_alloc_pinned(count * sizeof(T));
+}
+
+/// Return a buffer from alloc_pinned() to the pool.  When 'stream' is
+/// given the buffer is only reused after the work issued on the stream
+/// so far has completed.
+inline void free_pinned(void *buffer, void *stream = nullptr) {
+  detail::mem_free_pinned(buffer, stream);
+}
+
+/// Mark an array allocated with alloc<T>() as cold: no forall will use
+/// it for a while (e.g., state that is only touched every few
+/// timesteps).  On GPU targets its data is moved out of device memory,
+/// which leaves room for the arrays that are in use, and moves back
+/// when the next forall that uses it is launched.
+inline void mark_cold(const void *array) {
+  detail::mem_mark_cold(const_cast<void*>(array));
+}
+
+/// Release all the memory that kernels have allocated with malloc() or
+/// new since the last reset.  Such allocations come from a heap on each
+/// device that is only reclaimed in bulk, so call this between the
+/// phases of a program, once no array allocated by a kernel is in use.
+/// This waits for the devices to finish their work, and does nothing on
+/// the targets without a device heap.
+inline void reset_device_heap() {
+#if defined(_tapir_cuda_target)
+  __kitcuda_heap_reset();
+#endif
+}
+
+/// Hint that an array allocated with alloc<T>() is hot: every forall
+/// for a while reads it (e.g., a coefficient table or a connectivity
+/// array used by each kernel of a timestep).  On GPUs with a persisting
+/// L2 region the array is kept in the L2 across the kernels instead of
+/// being evicted by the data they stream through.  Only one array is
+/// kept at a time.  Without a hint the runtime picks the read-only
+/// array that the most kernels use.
+inline void persist(const void *array) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_persist(const_cast<void*>(array));
+#endif
+}
+
+/// End the phase of the program whose hot array was kept in the L2
+/// (see persist()), releasing the L2 for normal use.
+inline void end_persist() {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_persist_reset();
+#endif
+}
+
+/// How the data of an array allocated with alloc<T>() moves to a GPU
+/// for the foralls that use it (see migrate()).
+enum class migration {
+  /// Prefetch the array, unless it keeps moving back and forth between
+  /// the host and the GPU; then access it as with 'counters' (on
+  /// coherent systems such as Grace-Hopper) or 'host'.
+  automatic = 0,
+  /// Prefetch the whole array ahead of each forall.
+  prefetch = 1,
+  /// Leave the array where it is and let the GPU's access counters
+  /// migrate the pages the foralls use often.
+  counters = 2,
+  /// Keep the array in host memory; the foralls access it remotely.
+  host = 3
+};
+
+/// Set how the data of an array allocated with alloc<T>() moves to
+/// the GPU.  Prefetching is best for arrays the foralls use in full.
+/// Arrays that the host and the foralls share (or that the foralls
+/// only touch sparsely) move less with 'counters' or 'host'.  This has
+/// no effect on the targets without managed memory.
+inline void migrate(const void *array, migration policy) {
+#if defined(_tapir_cuda_target)
+  __kitcuda_mem_set_migrate_policy(const_cast<void*>(array), (int)policy);
+#endif
+}
+
+} // namespace kitsune
+#endif // __cplusplus
+
 #endif // __KITSUNE_KITSUNE_H__
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_IO_H__
+#define __KITSUNE_KITSUNE_IO_H__
+
+/* Parallel file I/O for arrays allocated with alloc<T>():
+ *
+ *   kitsune::parallel_read("in.dat", a, n, [=](size_t begin, size_t end) {
+ *     forall(size_t i = begin; i < end; i++)
+ *       a[i] = ...;
+ *   });
+ *   ...
+ *   kitsune::parallel_write("checkpoint.dat", a, n);
+ *
+ * The files are read and written in chunks, each with several pread() or
+ * pwrite() calls issued by spawned tasks, so a chunk is transferred with
+ * as many requests in flight.  parallel_read() calls its (optional)
+ * on_chunk(begin, end) for the elements begin .. end - 1 of each chunk as
+ * soon as the chunk is read, while the next chunk is read, so a forall over
+ * the chunk overlaps the rest of the read (see kitsune_pipeline.h).
+ *
+ * On the GPU targets parallel_write() copies each chunk of the array to a
+ * buffer from the pinned buffer pool (alloc_pinned()) with a forall and
+ * writes the buffer while the next chunk is copied, so device-resident
+ * data is not migrated back to the host to be written.  A checkpoint can
+ * also be written while the next time step runs: spawn the write (of a
+ * copy of the state, if the time step updates it) and sync before the next
+ * checkpoint.
+ *
+ * Both return false if the file cannot be opened or a read or write fails
+ * (e.g., the file has fewer than 'count' elements).
+ */
+
+#include <kitsune.h>
+#include <kitsune_pipeline.h>
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+
+namespace kitsune {
+namespace detail {
+
+/// The number of requests each transfer is split into.
+const unsigned io_requests = 4;
+
+/// The number of elements of T in each chunk of a parallel read or write.
+template <typename T>
+size_t io_chunk() {
+  return sizeof(T) < (16 << 20) ? (16 << 20) / sizeof(T) : 1;
+}
+
+/// Read (or write) the nbytes at 'offset' of the file fd into (or from)
+/// buf, with up to 'requests' pread() (or pwrite()) calls in parallel.
+inline bool io_transfer(int fd, char *buf, size_t nbytes, off_t offset,
+                        bool write, unsigned requests) {
+  if (requests > 1 && nbytes >= 2 * 4096) {
+    // Split at a page boundary.
+    size_t half = (nbytes / 2 + 4095) & ~(size_t)4095;
+    bool lo_ok = false;
+    spawn lo {
+      lo_ok = io_transfer(fd, buf, half, offset, write, requests / 2);
+    }
+    bool hi_ok = io_transfer(fd, buf + half, nbytes - half, offset + half,
+                             write, requests - requests / 2);
+    sync lo;
+    return lo_ok && hi_ok;
+  }
+  while (nbytes > 0) {
+    ssize_t n = write ? pwrite(fd, buf, nbytes, offset)
+                      : pread(fd, buf, nbytes, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    nbytes -= n;
+    offset += n;
+  }
+  return true;
+}
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_GPU_IO 1
+#endif
+
+} // namespace detail
+
+/// Read 'count' elements of T from the start of the file at 'path' into
+/// 'array', calling on_chunk(begin, end) for each chunk of elements read
+/// while the next chunk is read.
+template <typename T, typename OnChunk>
+bool parallel_read(const char *path, T *array, size_t count,
+                   OnChunk on_chunk) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  const size_t chunk = detail::io_chunk<T>();
+  const size_t num_chunks = (count + chunk - 1) / chunk;
+  bool ok = true;
+  // A chunk whose read failed is not handed to on_chunk().
+  bool chunk_ok[2];
+  pipeline(num_chunks,
+           [&](size_t c, size_t slot) {
+             size_t end = count - c * chunk < chunk ? count : (c + 1) * chunk;
+             chunk_ok[slot] = detail::io_transfer(
+                 fd, (char *)(array + c * chunk), (end - c * chunk) * sizeof(T),
+                 (off_t)(c * chunk * sizeof(T)), false, detail::io_requests);
+             ok = ok && chunk_ok[slot];
+           },
+           [&](size_t c, size_t slot) {
+             size_t end = count - c * chunk < chunk ? count : (c + 1) * chunk;
+             if (chunk_ok[slot])
+               on_chunk(c * chunk, end);
+           });
+  close(fd);
+  return ok;
+}
+
+/// Read 'count' elements of T from the start of the file at 'path' into
+/// 'array'.
+template <typename T>
+bool parallel_read(const char *path, T *array, size_t count) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool ok = detail::io_transfer(fd, (char *)array, count * sizeof(T), 0,
+                                false, detail::io_requests);
+  close(fd);
+  return ok;
+}
+
+/// Write the 'count' elements of 'array' to the file at 'path', replacing
+/// its contents.
+template <typename T>
+bool parallel_write(const char *path, const T *array, size_t count) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  bool ok = true;
+#if defined(__KITSUNE_GPU_IO)
+  // Stage the chunks through two pinned buffers: one is filled by a
+  // forall while the other is written.
+  const size_t chunk = detail::io_chunk<T>();
+  const size_t num_chunks = (count + chunk - 1) / chunk;
+  T *staging[2] = {alloc_pinned<T>(chunk), alloc_pinned<T>(chunk)};
+  pipeline(num_chunks,
+           [&](size_t c, size_t slot) {
+             T *buf = staging[slot];
+             const T *src = array + c * chunk;
+             size_t n = count - c * chunk < chunk ? count - c * chunk : chunk;
+             forall(size_t i = 0; i < n; ++i)
+               buf[i] = src[i];
+           },
+           [&](size_t c, size_t slot) {
+             size_t n = count - c * chunk < chunk ? count - c * chunk : chunk;
+             ok = detail::io_transfer(fd, (char *)staging[slot], n * sizeof(T),
+                                      (off_t)(c * chunk * sizeof(T)), true,
+                                      detail::io_requests) &&
+                  ok;
+           });
+  free_pinned(staging[0]);
+  free_pinned(staging[1]);
+#else
+  ok = detail::io_transfer(fd, (char *)array, count * sizeof(T), 0, true,
+                           detail::io_requests);
+#endif
+  return close(fd) == 0 && ok;
+}
+
+#undef __KITSUNE_GPU_IO
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_IO_H__
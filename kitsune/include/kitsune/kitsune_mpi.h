@@ -0,0 +1,168 @@
+
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_MPI_H__
+#define __KITSUNE_KITSUNE_MPI_H__
+
+/* MPI halo exchanges for Kitsune allocations.  Handing an alloc<T>()
+ * buffer to MPI directly works, but MPI can not tell where its data is:
+ * a GPU-aware MPI usually stages managed memory through the host or
+ * touches it from the CPU, which migrates the whole allocation.  A
+ * kitsune::mpi::halo instead packs the elements to exchange into a
+ * separate buffer, using the runtime's record of where each allocation
+ * currently lives:
+ *
+ *   - data on the device is packed with a forall, into device memory
+ *     when MPI is GPU-aware (CUDA- or ROCm-aware) and into pinned host
+ *     memory otherwise;
+ *   - data on the host is packed by the host into pinned memory.
+ *
+ * Only the halo moves and the field stays where it is.  The pack and
+ * unpack foralls complete before they return, so a pack is ordered
+ * after the kernels that produced the field and the buffer is ready
+ * for MPI.  Posting the sends and receives before the interior update
+ * overlaps the exchange with the interior compute:
+ *
+ *   send.pack(u, send_index);
+ *   send.isend(neighbor, tag, comm, &reqs[0]);
+ *   recv.irecv(neighbor, tag, comm, &reqs[1]);
+ *   forall(...) { ... interior ... }
+ *   MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+ *   recv.unpack(u, recv_index);
+ *
+ * Index lists are read where the pack (or unpack) runs and should be
+ * allocated with alloc<>() as well.  On the CUDA target the kernels can
+ * also exchange halos themselves, without the host (see
+ * kitsune_shmem.h).
+ */
+
+#include <kitsune.h>
+#include <mpi.h>
+#if defined(OPEN_MPI) && OPEN_MPI
+#include <mpi-ext.h>
+#endif
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stdlib.h>
+#include <strings.h>
+
+namespace kitsune {
+namespace mpi {
+
+/// Return true if MPI accepts device pointers.  The KITSUNE_MPI_GPU_AWARE
+/// environment variable ("1"/"true" or "0"/"false") takes precedence;
+/// otherwise Open MPI is asked for CUDA (or ROCm) support and other
+/// implementations are assumed not to be GPU-aware.
+inline bool gpu_aware() {
+  static int aware = -1;
+  if (aware < 0) {
+    const char *env = getenv("KITSUNE_MPI_GPU_AWARE");
+    if (env)
+      aware = strcasecmp(env, "true") == 0 || atoi(env) != 0;
+    else {
+      aware = 0;
+#if defined(_tapir_cuda_target) && defined(MPIX_CUDA_AWARE_SUPPORT) && \
+    MPIX_CUDA_AWARE_SUPPORT
+      aware = MPIX_Query_cuda_support();
+#elif defined(_tapir_hip_target) && defined(MPIX_ROCM_AWARE_SUPPORT) && \
+    MPIX_ROCM_AWARE_SUPPORT
+      aware = MPIX_Query_rocm_support();
+#endif
+    }
+  }
+  return aware;
+}
+
+/// Return true if the data of the allocation holding 'ptr' is on the
+/// device.  Memory unknown to the runtime is on the host.
+inline bool on_device(const void *ptr) {
+  return detail::mem_on_device(ptr);
+}
+
+/// A buffer for the packed halo of a field.
+template <typename T>
+class halo {
+public:
+  /// Create a buffer for 'count' elements of 'field'.  The buffer is
+  /// placed in device memory if the field's data is on the device and
+  /// MPI is GPU-aware and in pinned host memory otherwise.
+  halo(size_t count, const T *field)
+      : count(count), device(gpu_aware() && mpi::on_device(field)) {
+    size_t nbytes = (count ? count : 1) * sizeof(T);
+    buffer = (T*)(device ? detail::mem_alloc_device(nbytes)
+                         : detail::mem_alloc_pinned(nbytes));
+  }
+
+  halo(const halo&) = delete;
+  halo& operator=(const halo&) = delete;
+
+  ~halo() {
+    if (device)
+      detail::mem_free_device(buffer);
+    else
+      detail::mem_free_pinned(buffer, nullptr);
+  }
+
+  T* data() { return buffer; }
+  const T* data() const { return buffer; }
+  size_t size() const { return count; }
+  bool on_device() const { return device; }
+
+  /// Gather field[index[i]] into the buffer.  The gather runs on the
+  /// device if the field's data (or the buffer) is there.
+  template <typename I>
+  void pack(const T *field, const I *index) {
+    T *buf = buffer;
+    size_t n = count;
+    if (device || mpi::on_device(field)) {
+      forall(size_t i = 0; i < n; i++)
+        buf[i] = field[index[i]];
+    } else {
+      for (size_t i = 0; i < n; i++)
+        buf[i] = field[index[i]];
+    }
+  }
+
+  /// Scatter the buffer into field[index[i]].  The scatter runs on the
+  /// device if the field's data (or the buffer) is there.
+  template <typename I>
+  void unpack(T *field, const I *index) const {
+    const T *buf = buffer;
+    size_t n = count;
+    if (device || mpi::on_device(field)) {
+      forall(size_t i = 0; i < n; i++)
+        field[index[i]] = buf[i];
+    } else {
+      for (size_t i = 0; i < n; i++)
+        field[index[i]] = buf[i];
+    }
+  }
+
+  /// Start sending the (packed) buffer.
+  int isend(int dest, int tag, MPI_Comm comm, MPI_Request *request) const {
+    return MPI_Isend(buffer, (int)(count * sizeof(T)), MPI_BYTE, dest, tag,
+                     comm, request);
+  }
+
+  /// Start receiving into the buffer; unpack once the request completes.
+  int irecv(int source, int tag, MPI_Comm comm, MPI_Request *request) {
+    return MPI_Irecv(buffer, (int)(count * sizeof(T)), MPI_BYTE, source, tag,
+                     comm, request);
+  }
+
+private:
+  T *buffer;
+  size_t count;
+  bool device; // the buffer is in device memory.
+};
+
+} // namespace mpi
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_MPI_H__
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_PIPELINE_H__
+#define __KITSUNE_KITSUNE_PIPELINE_H__
+
+/* Streaming pipelines over a sequence of chunks of work, e.g., reading,
+ * processing and writing a large file a block at a time:
+ *
+ *   float *buf[3] = { ... };   // one buffer per stage.
+ *   kitsune::pipeline(num_chunks,
+ *       [&](size_t chunk, size_t slot) { read_block(file, chunk, buf[slot]); },
+ *       [&](size_t chunk, size_t slot) {
+ *         float *b = buf[slot];
+ *         forall(size_t i = 0; i < block; i++)
+ *           b[i] = ...;
+ *       },
+ *       [&](size_t chunk, size_t slot) { write_block(out, chunk, buf[slot]); });
+ *
+ * Every chunk goes through the stages in order.  The pipeline advances in
+ * steps: in each step stage s runs on chunk k - s, for every stage that has
+ * a chunk, with the stages spawned in parallel, and the step ends when all
+ * of them are done.  So stage s + 1 of chunk k - 1 overlaps stage s of
+ * chunk k, while at most as many chunks as there are stages are in flight.
+ * A chunk keeps the same slot, chunk % (number of stages), from its first
+ * stage to its last, and no two chunks in flight share a slot: buffers
+ * indexed by the slot are enough to pass the chunks between the stages.
+ *
+ * Each stage runs on the chunks one at a time and in order, so a stage may
+ * keep state from one chunk to the next (e.g., a file position).  The
+ * foralls in a stage run on the target as usual; on the GPU targets an
+ * asynchronous ([[kitsune::async]]) forall is waited on when its stage
+ * returns, so its kernel overlaps the other stages of the step.
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus)
+#include <stddef.h>
+#include <tuple>
+
+namespace kitsune {
+namespace detail {
+
+/// Run stages I .. N - 1 of step 'step' of a pipeline of N stages, in
+/// parallel.
+template <size_t I, size_t N>
+struct pipeline_stages {
+  template <typename Stages>
+  static void run(Stages &stages, size_t step, size_t num_chunks) {
+    if (step < I || step - I >= num_chunks) {
+      pipeline_stages<I + 1, N>::run(stages, step, num_chunks);
+      return;
+    }
+    spawn stage {
+      size_t chunk = step - I;
+      std::get<I>(stages)(chunk, chunk % N);
+    }
+    pipeline_stages<I + 1, N>::run(stages, step, num_chunks);
+    sync stage;
+  }
+};
+
+template <size_t N>
+struct pipeline_stages<N, N> {
+  template <typename Stages>
+  static void run(Stages &, size_t, size_t) {}
+};
+
+} // namespace detail
+
+/// Run num_chunks chunks through the given stages, with the stages of
+/// consecutive chunks overlapped.  Each stage is called as
+/// stage(chunk, slot), the slot being in 0 .. number of stages - 1.
+template <typename... Stages>
+void pipeline(size_t num_chunks, Stages... stages) {
+  const size_t num_stages = sizeof...(Stages);
+  if (num_chunks == 0 || num_stages == 0)
+    return;
+  std::tuple<Stages...> all(stages...);
+  for (size_t step = 0; step < num_chunks + num_stages - 1; ++step)
+    detail::pipeline_stages<0, sizeof...(Stages)>::run(all, step, num_chunks);
+}
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_PIPELINE_H__
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_REDUCE_H__
+#define __KITSUNE_KITSUNE_REDUCE_H__
+
+/* Reproducible reductions.  The forall reductions of kitsune.h
+ * (kitsune_reduce_add and friends) combine the values in the order the
+ * workers or GPU threads happen to reach them, so a floating point sum
+ * may differ in its last bits from one run to the next.  These
+ * reductions combine the values in an order that only depends on n and
+ * the target -- not on the number of workers, the grain size or the
+ * scheduling -- so their results are bitwise reproducible:
+ *
+ *   double d = kitsune::reproducible_sum(n, [=](size_t i) {
+ *     return a[i] * b[i];
+ *   });
+ *   double s = kitsune::reproducible_sum(a, n);
+ *   float p = kitsune::reproducible_reduce(n, 1.0f, f,
+ *                                          std::multiplies<float>());
+ *
+ * The values are combined by a tree of fixed shape.  A forall computes
+ * partial reductions of groups of values, the partials are reduced the
+ * same way until few enough remain, and the host combines those in
+ * order:
+ *
+ *  - On the GPU targets partial p combines the values p, p + P, p + 2P,
+ *    ... (for a P that only depends on n), so that the threads of a warp
+ *    read neighboring values.
+ *  - On the CPU targets partial p combines a contiguous chunk of values
+ *    in a fixed number of interleaved lanes, which the vectorizer keeps
+ *    in vector registers, and then combines the lanes pairwise.
+ *
+ * Each value is read once and the partials are few, so a reproducible
+ * reduction runs at about the speed of the atomic reductions of a
+ * forall.  The results differ between targets (and may differ from a
+ * serial loop) but not between runs of the same program.  The map and
+ * combine functions are called where forall loops run, so on a GPU
+ * target they must capture by value (or use arrays allocated with
+ * alloc<T>()).
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stddef.h>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace kitsune {
+namespace detail {
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_GPU_REDUCE 1
+#endif
+
+#if defined(__KITSUNE_GPU_REDUCE)
+/// The largest number of partials of a level (P above) and the fewest
+/// values each partial combines.
+const size_t reduce_partials = size_t(1) << 16;
+const size_t reduce_min_values = 16;
+#else
+/// The number of values each partial combines and the number of lanes
+/// it combines them in.
+const size_t reduce_chunk = 4096;
+const size_t reduce_lanes = 8;
+#endif
+
+/// Levels of at most this many partials are combined on the host.
+const size_t reduce_host_values = 1024;
+
+/// Return the number of partials of a level of n values.
+inline size_t reduce_num_partials(size_t n) {
+#if defined(__KITSUNE_GPU_REDUCE)
+  size_t np = (n + reduce_min_values - 1) / reduce_min_values;
+  return np < reduce_partials ? np : reduce_partials;
+#else
+  return (n + reduce_chunk - 1) / reduce_chunk;
+#endif
+}
+
+/// Combine the values map(0) .. map(n - 1) into the partials
+/// partials[0] .. partials[reduce_num_partials(n) - 1].
+template <typename T, typename Map, typename Op>
+void reduce_level(size_t n, T identity, Map map, Op op, T *partials) {
+  const size_t np = reduce_num_partials(n);
+#if defined(__KITSUNE_GPU_REDUCE)
+  forall(size_t p = 0; p < np; ++p) {
+    T acc = identity;
+    for (size_t i = p; i < n; i += np)
+      acc = op(acc, (T)map(i));
+    partials[p] = acc;
+  }
+#else
+  forall(size_t p = 0; p < np; ++p) {
+    size_t i = p * reduce_chunk;
+    const size_t end = n - i < reduce_chunk ? n : i + reduce_chunk;
+    T acc[reduce_lanes];
+    for (size_t l = 0; l < reduce_lanes; ++l)
+      acc[l] = identity;
+    for (; end - i >= reduce_lanes; i += reduce_lanes)
+      for (size_t l = 0; l < reduce_lanes; ++l)
+        acc[l] = op(acc[l], (T)map(i + l));
+    for (size_t l = 0; i < end; ++i, ++l)
+      acc[l] = op(acc[l], (T)map(i));
+    for (size_t w = reduce_lanes / 2; w > 0; w /= 2)
+      for (size_t l = 0; l < w; ++l)
+        acc[l] = op(acc[l], acc[l + w]);
+    partials[p] = acc[0];
+  }
+#endif
+}
+
+} // namespace detail
+
+/// Return the combination with op of map(i) for the indices 0 .. n - 1,
+/// or identity if n is zero.  op must be associative (up to rounding)
+/// with the given identity; the order in which it combines the values
+/// is the same in every run.
+template <typename T, typename Map, typename Op>
+T reproducible_reduce(size_t n, T identity, Map map, Op op) {
+  if (n == 0)
+    return identity;
+  size_t np = detail::reduce_num_partials(n);
+  T *partials = ::alloc<T>(np);
+  detail::reduce_level(n, identity, map, op, partials);
+
+  // The levels of partials alternate between two buffers; the first
+  // level of partials is the largest.
+  T *next = nullptr;
+  while (np > detail::reduce_host_values) {
+    size_t next_np = detail::reduce_num_partials(np);
+    if (next == nullptr)
+      next = ::alloc<T>(next_np);
+    const T *values = partials;
+    detail::reduce_level(np, identity,
+                         [=](size_t i) { return values[i]; }, op, next);
+    std::swap(partials, next);
+    np = next_np;
+  }
+
+  T result = identity;
+  for (size_t p = 0; p < np; ++p)
+    result = op(result, partials[p]);
+  ::dealloc(partials);
+  if (next != nullptr)
+    ::dealloc(next);
+  return result;
+}
+
+/// Return the sum of map(i) for the indices 0 .. n - 1.
+template <typename Map>
+auto reproducible_sum(size_t n, Map map) ->
+    typename std::decay<decltype(map(size_t(0)))>::type {
+  typedef typename std::decay<decltype(map(size_t(0)))>::type T;
+  return reproducible_reduce(n, T(0), map, std::plus<T>());
+}
+
+/// Return the sum of the elements a[0] .. a[n - 1].
+template <typename T>
+T reproducible_sum(const T *a, size_t n) {
+  return reproducible_reduce(n, T(0), [=](size_t i) { return a[i]; },
+                             std::plus<T>());
+}
+
+#undef __KITSUNE_GPU_REDUCE
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_REDUCE_H__
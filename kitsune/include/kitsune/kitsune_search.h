@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_SEARCH_H__
+#define __KITSUNE_KITSUNE_SEARCH_H__
+
+/* Parallel searches that stop early.  A forall has no 'break', so a
+ * search written as a forall tests every index even when the first one
+ * matches.  These searches test the indices 0 .. n - 1 with a predicate
+ * and cancel the remaining work once the answer is known:
+ *
+ *   size_t i = kitsune::find_first(n, [=](size_t i) { return a[i] == x; });
+ *   size_t j = kitsune::find_any(n, pred);
+ *   bool b = kitsune::any_of(n, pred);    // also all_of() and none_of()
+ *
+ * find_first() returns the smallest index for which the predicate holds
+ * and find_any() returns any such index; both return n if there is none.
+ * The predicate is called where forall loops run, so on a GPU target it
+ * must capture by value (or use arrays allocated with alloc<T>()).  It
+ * may be called for indices past the result.
+ *
+ * The indices searched so far and the best match are shared through a
+ * flag that the workers poll:
+ *
+ *  - On the GPU targets the search is a sequence of foralls over waves
+ *    of indices.  Each thread reads the flag before it tests its index
+ *    and skips the test once a better match is known, and the host stops
+ *    launching waves once a wave finds a match.
+ *  - On the CPU targets the search divides the indices recursively with
+ *    spawns and checks the flag at each spawn point, so that whole
+ *    subranges past the best match are never spawned.
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stddef.h>
+
+namespace kitsune {
+namespace detail {
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_GPU_SEARCH 1
+#endif
+
+#if defined(__KITSUNE_GPU_SEARCH)
+/// The number of indices of each forall of a search.  Smaller waves
+/// stop sooner after a match and larger ones launch fewer kernels.
+const size_t search_wave = size_t(1) << 22;
+#else
+/// The number of indices a search tests serially, without checking
+/// whether it has been cancelled.
+const size_t search_grain = 2048;
+#endif
+
+/// The best match found so far by a search, or n.
+inline size_t search_found(const size_t *found) {
+  return __atomic_load_n(found, __ATOMIC_RELAXED);
+}
+
+/// Return true if a search of n indices that has found *found so far
+/// need not test index i.  A search for the first match is cancelled
+/// past the best match, and a search for any match once it has one.
+inline bool search_cancelled(const size_t *found, size_t i, size_t n,
+                             bool first) {
+  size_t best = search_found(found);
+  return first ? best <= i : best != n;
+}
+
+#if !defined(__KITSUNE_GPU_SEARCH)
+template <typename Pred>
+void search_range(size_t lo, size_t hi, const Pred &pred, size_t *found,
+                  size_t n, bool first) {
+  if (search_cancelled(found, lo, n, first))
+    return;
+  if (hi - lo <= search_grain) {
+    for (size_t i = lo; i < hi; ++i) {
+      if (pred(i)) {
+        __atomic_fetch_min(found, i, __ATOMIC_RELAXED);
+        return;
+      }
+    }
+    return;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  spawn lo_half { search_range(lo, mid, pred, found, n, first); }
+  search_range(mid, hi, pred, found, n, first);
+  sync lo_half;
+}
+#endif
+
+/// Return the smallest index (if first is set) or any index in 0 .. n - 1
+/// for which pred holds, or n.
+template <typename Pred>
+size_t search(size_t n, Pred pred, bool first) {
+  size_t *found = ::alloc<size_t>(1);
+  *found = n;
+#if defined(__KITSUNE_GPU_SEARCH)
+  // The waves run in order, so the match of the first wave that finds
+  // one is the first match.
+  for (size_t begin = 0; begin < n && search_found(found) == n;
+       begin += search_wave) {
+    size_t end = n - begin < search_wave ? n : begin + search_wave;
+    forall(size_t i = begin; i < end; ++i) {
+      if (!search_cancelled(found, i, n, first) && pred(i))
+        __atomic_fetch_min(found, i, __ATOMIC_RELAXED);
+    }
+  }
+#else
+  search_range(0, n, pred, found, n, first);
+#endif
+  size_t result = *found;
+  ::dealloc(found);
+  return result;
+}
+
+} // namespace detail
+
+/// Return the smallest index in 0 .. n - 1 for which pred holds, or n.
+template <typename Pred>
+size_t find_first(size_t n, Pred pred) {
+  return detail::search(n, pred, true);
+}
+
+/// Return an index in 0 .. n - 1 for which pred holds, or n.
+template <typename Pred>
+size_t find_any(size_t n, Pred pred) {
+  return detail::search(n, pred, false);
+}
+
+/// Return true if pred holds for some index in 0 .. n - 1.
+template <typename Pred>
+bool any_of(size_t n, Pred pred) {
+  return find_any(n, pred) != n;
+}
+
+/// Return true if pred holds for every index in 0 .. n - 1.
+template <typename Pred>
+bool all_of(size_t n, Pred pred) {
+  return find_any(n, [=](size_t i) { return !pred(i); }) == n;
+}
+
+/// Return true if pred holds for no index in 0 .. n - 1.
+template <typename Pred>
+bool none_of(size_t n, Pred pred) {
+  return !any_of(n, pred);
+}
+
+#undef __KITSUNE_GPU_SEARCH
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_SEARCH_H__
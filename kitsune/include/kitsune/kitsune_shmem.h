@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_SHMEM_H__
+#define __KITSUNE_KITSUNE_SHMEM_H__
+
+/* Device-initiated communication through symmetric memory (NVSHMEM).  A
+ * halo exchange driven by the host (see kitsune_mpi.h) leaves the GPU
+ * idle between the kernel that produces the halo and the one that uses
+ * it.  With symmetric memory the kernels communicate themselves: an
+ * array allocated with
+ *
+ *   double *u = alloc<double>(n + 2, kitsune::symmetric);
+ *
+ * exists on every processing element (PE, an MPI rank and its GPU) at
+ * the same address, and a forall can write the elements of another PE's
+ * copy directly, fusing the exchange into the boundary update:
+ *
+ *   int pe = kitsune::shmem::my_pe(), npes = kitsune::shmem::n_pes();
+ *   int left = (pe + npes - 1) % npes, right = (pe + 1) % npes;
+ *   forall(size_t i = 1; i <= n; ++i) {
+ *     unew[i] = ...;
+ *     if (i == 1)
+ *       kitsune::shmem::p(&unew[n + 1], unew[i], left);
+ *     if (i == n)
+ *       kitsune::shmem::p(&unew[0], unew[i], right);
+ *   }
+ *   kitsune::shmem::barrier_all();  // the halos have arrived.
+ *
+ * The puts and gets run in the kernel of the forall (the compiler links
+ * NVSHMEM's device library into the kernels that use them, see
+ * -cuabi-shmem-bc) and on the host in code that runs there.  A put
+ * returns once its source may be reused; puts to the same PE are only
+ * ordered by fence(), and all of them complete by quiet() or
+ * barrier_all().
+ *
+ * Symmetric allocations are collective: every PE must allocate (and
+ * deallocate) the same sizes in the same order.  They are device memory
+ * and the host must not access them directly.  NVSHMEM is initialized on
+ * first use, bootstrapped as its environment says (e.g.,
+ * NVSHMEM_BOOTSTRAP=MPI once MPI is initialized), and each PE uses a
+ * single GPU.  Programs that use MPI must call finalize() before
+ * MPI_Finalize().  The program must be linked with NVSHMEM's host
+ * library (-lnvshmem_host).  Only the CUDA target supports symmetric
+ * memory.
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus) && defined(_tapir_cuda_target)
+#include <stddef.h>
+
+extern "C" __attribute__((malloc)) void *
+__kitcuda_mem_alloc_symmetric(size_t);
+extern "C" void __kitcuda_mem_free_symmetric(void *);
+extern "C" void __kitcuda_shmem_init();
+extern "C" void __kitcuda_shmem_finalize();
+extern "C" int __kitcuda_shmem_my_pe();
+extern "C" int __kitcuda_shmem_n_pes();
+extern "C" void __kitcuda_shmem_barrier_all();
+
+// The NVSHMEM functions that kernels (and the host) call.
+extern "C" void nvshmem_putmem(void *dest, const void *source, size_t nbytes,
+                               int pe);
+extern "C" void nvshmem_putmem_nbi(void *dest, const void *source,
+                                   size_t nbytes, int pe);
+extern "C" void nvshmem_getmem(void *dest, const void *source, size_t nbytes,
+                               int pe);
+extern "C" void nvshmem_float_p(float *dest, float value, int pe);
+extern "C" void nvshmem_double_p(double *dest, double value, int pe);
+extern "C" void nvshmem_int_p(int *dest, int value, int pe);
+extern "C" void nvshmem_long_p(long *dest, long value, int pe);
+extern "C" float nvshmem_float_g(const float *source, int pe);
+extern "C" double nvshmem_double_g(const double *source, int pe);
+extern "C" int nvshmem_int_g(const int *source, int pe);
+extern "C" long nvshmem_long_g(const long *source, int pe);
+extern "C" void nvshmem_fence(void);
+extern "C" void nvshmem_quiet(void);
+
+namespace kitsune {
+
+/// The placement of alloc<T>(n, kitsune::symmetric): the symmetric heap.
+struct symmetric_t {};
+const symmetric_t symmetric = {};
+
+namespace shmem {
+
+/// Initialize NVSHMEM if it is not already (allocations and queries do
+/// this as needed).
+inline void init() { __kitcuda_shmem_init(); }
+
+/// Finalize NVSHMEM (collectively), after the last use of symmetric
+/// memory.
+inline void finalize() { __kitcuda_shmem_finalize(); }
+
+/// Return the index of this PE and the number of PEs.
+inline int my_pe() { return __kitcuda_shmem_my_pe(); }
+inline int n_pes() { return __kitcuda_shmem_n_pes(); }
+
+/// Wait (on the host) for all PEs to arrive and for all their puts and
+/// gets to complete.
+inline void barrier_all() { __kitcuda_shmem_barrier_all(); }
+
+/// Copy the n elements at src to dest on PE pe, where dest is in
+/// symmetric memory.  put_nbi() returns before src may be reused; the
+/// copy completes by quiet().
+template <typename T>
+inline void put(T *dest, const T *src, size_t n, int pe) {
+  nvshmem_putmem(dest, src, n * sizeof(T), pe);
+}
+
+template <typename T>
+inline void put_nbi(T *dest, const T *src, size_t n, int pe) {
+  nvshmem_putmem_nbi(dest, src, n * sizeof(T), pe);
+}
+
+/// Copy the n elements at src on PE pe, where src is in symmetric
+/// memory, to dest.
+template <typename T>
+inline void get(T *dest, const T *src, size_t n, int pe) {
+  nvshmem_getmem(dest, src, n * sizeof(T), pe);
+}
+
+/// Write a single value to dest on PE pe.
+inline void p(float *dest, float value, int pe) {
+  nvshmem_float_p(dest, value, pe);
+}
+inline void p(double *dest, double value, int pe) {
+  nvshmem_double_p(dest, value, pe);
+}
+inline void p(int *dest, int value, int pe) {
+  nvshmem_int_p(dest, value, pe);
+}
+inline void p(long *dest, long value, int pe) {
+  nvshmem_long_p(dest, value, pe);
+}
+
+/// Read a single value at src on PE pe.
+inline float g(const float *src, int pe) { return nvshmem_float_g(src, pe); }
+inline double g(const double *src, int pe) {
+  return nvshmem_double_g(src, pe);
+}
+inline int g(const int *src, int pe) { return nvshmem_int_g(src, pe); }
+inline long g(const long *src, int pe) { return nvshmem_long_g(src, pe); }
+
+/// Order the puts issued so far to each PE before the later ones.
+inline void fence() { nvshmem_fence(); }
+
+/// Wait for the puts and gets issued so far to complete.
+inline void quiet() { nvshmem_quiet(); }
+
+} // namespace shmem
+} // namespace kitsune
+
+/// Allocate N elements of T in the symmetric heap (collectively).
+template <typename T>
+inline T *alloc(size_t N, kitsune::symmetric_t) {
+  return (T *)__kitcuda_mem_alloc_symmetric(sizeof(T) * (N ? N : 1));
+}
+
+/// Release an array from alloc<T>(N, kitsune::symmetric) (collectively).
+template <typename T>
+inline void dealloc(T *array, kitsune::symmetric_t) {
+  __kitcuda_mem_free_symmetric((void *)array);
+}
+
+#elif defined(__cplusplus)
+#error "kitsune_shmem.h: symmetric memory requires the CUDA target"
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_SHMEM_H__
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_SORT_H__
+#define __KITSUNE_KITSUNE_SORT_H__
+
+/* Parallel sorts of arrays allocated with alloc<T>().  The arrays are
+ * sorted where forall loops run, so sorting on a GPU target does not copy
+ * the data to the host and back:
+ *
+ *   kitsune::sort(keys, n);
+ *   kitsune::sort_by_key(keys, values, n);
+ *   kitsune::segmented_sort(keys, offsets, num_segments);
+ *
+ * Keys are integers or floating point numbers and are sorted in ascending
+ * order.  On the GPU targets sort() and sort_by_key() are LSD radix sorts
+ * that make one pass per byte of the key, and sort_by_key() is stable.
+ * On the CPU targets they are sample sorts: the keys are split into
+ * buckets by splitters taken from a sample, and the buckets are sorted in
+ * parallel.  Each pass of either sort (a "partition") is a stable
+ * distribution of the keys into buckets in three foralls: count the keys
+ * of each bucket in each tile of the input, turn the counts into output
+ * positions, and scatter each tile's keys to those positions.
+ *
+ * segmented_sort() sorts each segment offsets[s] .. offsets[s + 1] - 1 of
+ * the array independently, one segment per forall iteration, and is meant
+ * for many short segments (e.g., neighbor lists).
+ *
+ * The sorts allocate scratch space of the size of the input with alloc<>().
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+namespace kitsune {
+namespace detail {
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_GPU_SORT 1
+#endif
+
+/// Map keys to unsigned integers in the same order, for radix sorting.
+template <typename T, typename Enable = void>
+struct sort_bits;
+
+template <typename T>
+struct sort_bits<T, typename std::enable_if<std::is_integral<T>::value &&
+                                           std::is_unsigned<T>::value>::type> {
+  typedef T type;
+  static type get(T key) { return key; }
+};
+
+template <typename T>
+struct sort_bits<T, typename std::enable_if<std::is_integral<T>::value &&
+                                           std::is_signed<T>::value>::type> {
+  typedef typename std::make_unsigned<T>::type type;
+  static type get(T key) {
+    return (type)key ^ ((type)1 << (sizeof(T) * 8 - 1));
+  }
+};
+
+template <>
+struct sort_bits<float> {
+  typedef uint32_t type;
+  static type get(float key) {
+    uint32_t u;
+    __builtin_memcpy(&u, &key, sizeof(u));
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+  }
+};
+
+template <>
+struct sort_bits<double> {
+  typedef uint64_t type;
+  static type get(double key) {
+    uint64_t u;
+    __builtin_memcpy(&u, &key, sizeof(u));
+    return (u & 0x8000000000000000ull) ? ~u : (u | 0x8000000000000000ull);
+  }
+};
+
+/// The number of keys each forall iteration of a partition counts and
+/// scatters.
+inline size_t partition_tile(size_t n) {
+#if defined(__KITSUNE_GPU_SORT)
+  (void)n;
+  return 2048;
+#else
+  size_t tile = n / 256;
+  return tile < 16384 ? 16384 : tile;
+#endif
+}
+
+/// Stably distribute the n keys (and values, if not null) of keys_in into
+/// num_buckets buckets, bucket(key) being the bucket of a key, writing them
+/// to keys_out (and values_out).  Sets starts[b] to the position of bucket
+/// b in the output, and starts[num_buckets] to n.
+template <typename K, typename V, typename Bucket>
+void partition(const K *keys_in, K *keys_out, const V *values_in,
+               V *values_out, size_t n, size_t num_buckets, Bucket bucket,
+               size_t *starts) {
+  const size_t tile = partition_tile(n);
+  const size_t num_tiles = (n + tile - 1) / tile;
+  size_t *counts = ::alloc<size_t>(num_tiles * num_buckets);
+
+  forall(size_t t = 0; t < num_tiles; ++t) {
+    size_t *count = counts + t * num_buckets;
+    for (size_t b = 0; b < num_buckets; ++b)
+      count[b] = 0;
+    size_t end = n - t * tile < tile ? n : (t + 1) * tile;
+    for (size_t i = t * tile; i < end; ++i)
+      count[bucket(keys_in[i])]++;
+  }
+
+  // Each bucket's keys go to the output in tile order.
+  forall(size_t b = 0; b < num_buckets; ++b) {
+    size_t sum = 0;
+    for (size_t t = 0; t < num_tiles; ++t) {
+      size_t c = counts[t * num_buckets + b];
+      counts[t * num_buckets + b] = sum;
+      sum += c;
+    }
+    starts[b] = sum;
+  }
+  size_t start = 0;
+  for (size_t b = 0; b < num_buckets; ++b) {
+    size_t size = starts[b];
+    starts[b] = start;
+    start += size;
+  }
+  starts[num_buckets] = n;
+
+  forall(size_t t = 0; t < num_tiles; ++t) {
+    size_t *pos = counts + t * num_buckets;
+    size_t end = n - t * tile < tile ? n : (t + 1) * tile;
+    for (size_t i = t * tile; i < end; ++i) {
+      size_t b = bucket(keys_in[i]);
+      size_t p = starts[b] + pos[b]++;
+      keys_out[p] = keys_in[i];
+      if (values_in)
+        values_out[p] = values_in[i];
+    }
+  }
+
+  ::dealloc(counts);
+}
+
+#if !defined(__KITSUNE_GPU_SORT)
+/// Stably sort the n keys (and values, if not null) of keys_in into
+/// keys_out (and values_out), serially.  The input and output may be the
+/// same arrays.
+template <typename K, typename V>
+void sort_range(const K *keys_in, const V *values_in, K *keys_out,
+                V *values_out, size_t n) {
+  if (!values_in) {
+    if (keys_out != keys_in)
+      std::copy(keys_in, keys_in + n, keys_out);
+    std::sort(keys_out, keys_out + n, [](K a, K b) {
+      return sort_bits<K>::get(a) < sort_bits<K>::get(b);
+    });
+    return;
+  }
+  size_t *perm = new size_t[n];
+  for (size_t i = 0; i < n; ++i)
+    perm[i] = i;
+  std::stable_sort(perm, perm + n, [=](size_t a, size_t b) {
+    return sort_bits<K>::get(keys_in[a]) < sort_bits<K>::get(keys_in[b]);
+  });
+  K *keys = new K[n];
+  V *values = new V[n];
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = keys_in[perm[i]];
+    values[i] = values_in[perm[i]];
+  }
+  std::copy(keys, keys + n, keys_out);
+  std::copy(values, values + n, values_out);
+  delete[] keys;
+  delete[] values;
+  delete[] perm;
+}
+#endif
+
+/// Sort keys (and values, if not null) in place through the scratch
+/// arrays keys_tmp and values_tmp.
+template <typename K, typename V>
+void sort(K *keys, V *values, K *keys_tmp, V *values_tmp, size_t n) {
+  typedef typename sort_bits<K>::type bits;
+  size_t *starts = ::alloc<size_t>(257);
+#if defined(__KITSUNE_GPU_SORT)
+  // One stable pass per byte, least significant first, alternating
+  // between the input and the scratch arrays.
+  K *kin = keys, *kout = keys_tmp;
+  V *vin = values, *vout = values_tmp;
+  for (unsigned shift = 0; shift < sizeof(bits) * 8; shift += 8) {
+    partition(kin, kout, vin, vout, n, 256,
+              [=](K key) {
+                return (size_t)((sort_bits<K>::get(key) >> shift) & 0xff);
+              },
+              starts);
+    std::swap(kin, kout);
+    std::swap(vin, vout);
+  }
+  if (kin != keys) {
+    forall(size_t i = 0; i < n; ++i) {
+      keys[i] = kin[i];
+      if (values)
+        values[i] = vin[i];
+    }
+  }
+#else
+  if (n < 65536) {
+    sort_range(keys, values, keys, values, n);
+    ::dealloc(starts);
+    return;
+  }
+
+  // Take the splitters of 256 buckets from a sorted sample of 16 keys per
+  // bucket.
+  const size_t num_buckets = 256, oversample = 16;
+  const size_t num_samples = num_buckets * oversample;
+  bits *splitters = ::alloc<bits>(num_buckets - 1);
+  bits *sample = ::alloc<bits>(num_samples);
+  for (size_t i = 0; i < num_samples; ++i)
+    sample[i] = sort_bits<K>::get(keys[i * (n / num_samples)]);
+  std::sort(sample, sample + num_samples);
+  for (size_t b = 0; b + 1 < num_buckets; ++b)
+    splitters[b] = sample[(b + 1) * oversample];
+  ::dealloc(sample);
+
+  partition(keys, keys_tmp, values, values_tmp, n, num_buckets,
+            [=](K key) {
+              return (size_t)(std::upper_bound(splitters,
+                                               splitters + num_buckets - 1,
+                                               sort_bits<K>::get(key)) -
+                              splitters);
+            },
+            starts);
+
+  forall(size_t b = 0; b < num_buckets; ++b) {
+    size_t begin = starts[b];
+    sort_range(keys_tmp + begin, values ? values_tmp + begin : nullptr,
+               keys + begin, values ? values + begin : nullptr,
+               starts[b + 1] - begin);
+  }
+  ::dealloc(splitters);
+#endif
+  ::dealloc(starts);
+}
+
+/// Sort keys[0 .. n - 1] in place with a serial shell sort, which needs
+/// neither recursion nor scratch space and so also runs in GPU threads.
+template <typename K>
+void serial_sort(K *keys, size_t n) {
+  static const size_t gaps[] = {701, 301, 132, 57, 23, 10, 4, 1};
+  for (size_t gap : gaps) {
+    for (size_t i = gap; i < n; ++i) {
+      K key = keys[i];
+      typename sort_bits<K>::type bits = sort_bits<K>::get(key);
+      size_t j = i;
+      for (; j >= gap && sort_bits<K>::get(keys[j - gap]) > bits; j -= gap)
+        keys[j] = keys[j - gap];
+      keys[j] = key;
+    }
+  }
+}
+
+} // namespace detail
+
+/// Sort the n keys in ascending order.
+template <typename K>
+void sort(K *keys, size_t n) {
+  if (n < 2)
+    return;
+  K *tmp = ::alloc<K>(n);
+  detail::sort(keys, (char *)nullptr, tmp, (char *)nullptr, n);
+  ::dealloc(tmp);
+}
+
+/// Sort the n keys in ascending order and permute the values with them.
+template <typename K, typename V>
+void sort_by_key(K *keys, V *values, size_t n) {
+  if (n < 2)
+    return;
+  K *keys_tmp = ::alloc<K>(n);
+  V *values_tmp = ::alloc<V>(n);
+  detail::sort(keys, values, keys_tmp, values_tmp, n);
+  ::dealloc(keys_tmp);
+  ::dealloc(values_tmp);
+}
+
+/// Sort each segment offsets[s] .. offsets[s + 1] - 1 of keys in ascending
+/// order, for s in 0 .. num_segments - 1.
+template <typename K, typename Offset>
+void segmented_sort(K *keys, const Offset *offsets, size_t num_segments) {
+  forall(size_t s = 0; s < num_segments; ++s) {
+    size_t begin = offsets[s], end = offsets[s + 1];
+#if defined(__KITSUNE_GPU_SORT)
+    detail::serial_sort(keys + begin, end - begin);
+#else
+    std::sort(keys + begin, keys + end, [](K a, K b) {
+      return detail::sort_bits<K>::get(a) < detail::sort_bits<K>::get(b);
+    });
+#endif
+  }
+}
+
+#undef __KITSUNE_GPU_SORT
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_SORT_H__
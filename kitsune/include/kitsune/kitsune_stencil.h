@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_STENCIL_H__
+#define __KITSUNE_KITSUNE_STENCIL_H__
+
+/* Iterative stencils on 2D and 3D grids of arrays allocated with alloc<T>()
+ * (e.g., hotspot3D).  Each time step computes every point of the grid from
+ * the points of the previous step within a given radius:
+ *
+ *   T *result = kitsune::stencil_3d(a, b, nx, ny, nz, steps,
+ *       [=](const kitsune::stencil_point<T> &p) {
+ *         T w = p.x > 0 ? p(-1, 0, 0) : p(0, 0, 0);
+ *         ...
+ *         return ...;
+ *       });
+ *
+ * The grid is stored x fastest, and the steps alternate between the two
+ * arrays a and b; the array holding the last step is returned.  An update
+ * only reads the points it is given within the radius (1 by default) and
+ * inside the grid, so it handles the boundaries itself, as above.
+ *
+ * On the CPU targets the steps are temporally blocked: each forall
+ * iteration computes time_block steps of one tile of the grid in scratch
+ * space local to the iteration, starting from the tile and a halo of
+ * time_block * radius points around it that shrinks by the radius with
+ * each step (overlapped, or trapezoid, tiles).  A tile and its halo fit in
+ * cache, so the grid is read and written once per time_block steps rather
+ * than once per step, at the cost of computing the halos more than once.
+ * On the GPU targets each step is a forall over the grid.
+ */
+
+#include <kitsune.h>
+
+#if defined(__cplusplus) && !defined(_tapir_levelzero_target)
+#include <stddef.h>
+#include <utility>
+
+namespace kitsune {
+
+/// A point of the grid given to a stencil update: its coordinates, its
+/// index in the grid, and its neighbors in the previous time step.
+template <typename T>
+struct stencil_point {
+  const T *p;
+  ptrdiff_t sy, sz; // the distances between neighbors in y and in z.
+  size_t x, y, z;
+  size_t index;     // x + y * nx + z * nx * ny, e.g., for other arrays.
+
+  /// The point at offset (dx, dy, dz) from this one.
+  const T &operator()(int dx, int dy, int dz = 0) const {
+    return p[dx + dy * sy + dz * sz];
+  }
+};
+
+namespace detail {
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_GPU_STENCIL 1
+#endif
+
+/// The points lo .. hi - 1 of one dimension of a tile, extended by halo
+/// points on each side but not beyond the grid of n points.
+inline void stencil_extend(size_t lo, size_t hi, size_t n, size_t halo,
+                           size_t &ext_lo, size_t &ext_hi) {
+  ext_lo = lo > halo ? lo - halo : 0;
+  ext_hi = n - hi > halo ? hi + halo : n;
+}
+
+/// Compute steps (at most time_block) time steps of the grid in into out
+/// with overlapped tiles of tx * ty * tz points.
+template <typename T, typename Update>
+void stencil_block(const T *in, T *out, size_t nx, size_t ny, size_t nz,
+                   unsigned steps, unsigned radius, size_t tx, size_t ty,
+                   size_t tz, Update update) {
+  const size_t ntx = (nx + tx - 1) / tx, nty = (ny + ty - 1) / ty;
+  const size_t ntz = (nz + tz - 1) / tz;
+  const size_t halo = (size_t)steps * radius;
+
+  forall(size_t t = 0; t < ntx * nty * ntz; ++t) {
+    size_t x0 = (t % ntx) * tx, y0 = (t / ntx % nty) * ty;
+    size_t z0 = t / (ntx * nty) * tz;
+    size_t x1 = nx - x0 < tx ? nx : x0 + tx, y1 = ny - y0 < ty ? ny : y0 + ty;
+    size_t z1 = nz - z0 < tz ? nz : z0 + tz;
+
+    // The tile with the full halo, and its layout in the scratch space.
+    size_t ex0, ex1, ey0, ey1, ez0, ez1;
+    stencil_extend(x0, x1, nx, halo, ex0, ex1);
+    stencil_extend(y0, y1, ny, halo, ey0, ey1);
+    stencil_extend(z0, z1, nz, halo, ez0, ez1);
+    const ptrdiff_t sy = ex1 - ex0, sz = sy * (ey1 - ey0);
+    T *cur = new T[2 * sz * (ez1 - ez0)];
+    T *next = cur + sz * (ez1 - ez0);
+    for (size_t z = ez0; z < ez1; ++z)
+      for (size_t y = ey0; y < ey1; ++y)
+        for (size_t x = ex0; x < ex1; ++x)
+          cur[(x - ex0) + (y - ey0) * sy + (z - ez0) * sz] =
+              in[x + y * nx + z * nx * ny];
+
+    for (unsigned s = 0; s < steps; ++s) {
+      // The points of this step are those whose neighbors were computed by
+      // the previous step; the last step computes just the tile.
+      size_t halo_s = (size_t)(steps - 1 - s) * radius;
+      size_t rx0, rx1, ry0, ry1, rz0, rz1;
+      stencil_extend(x0, x1, nx, halo_s, rx0, rx1);
+      stencil_extend(y0, y1, ny, halo_s, ry0, ry1);
+      stencil_extend(z0, z1, nz, halo_s, rz0, rz1);
+      bool last = s + 1 == steps;
+      for (size_t z = rz0; z < rz1; ++z)
+        for (size_t y = ry0; y < ry1; ++y)
+          for (size_t x = rx0; x < rx1; ++x) {
+            size_t l = (x - ex0) + (y - ey0) * sy + (z - ez0) * sz;
+            size_t i = x + y * nx + z * nx * ny;
+            stencil_point<T> p = {cur + l, sy, sz, x, y, z, i};
+            if (last)
+              out[i] = update(p);
+            else
+              next[l] = update(p);
+          }
+      std::swap(cur, next);
+    }
+    delete[] (cur < next ? cur : next);
+  }
+}
+
+} // namespace detail
+
+/// Compute steps time steps of a stencil of the given radius on the
+/// nx * ny * nz grid a, alternating between a and b, and return the array
+/// holding the last step.  update(p) computes point p of a step from its
+/// neighbors in the previous one.  On the CPU targets time_block steps are
+/// computed per pass over the grid, with tiles of tx * ty * tz points.
+template <typename T, typename Update>
+T *stencil_3d(T *a, T *b, size_t nx, size_t ny, size_t nz, unsigned steps,
+              Update update, unsigned radius = 1, unsigned time_block = 4,
+              size_t tx = 256, size_t ty = 16, size_t tz = 16) {
+#if defined(__KITSUNE_GPU_STENCIL)
+  (void)radius;
+  (void)time_block;
+  (void)tx;
+  (void)ty;
+  (void)tz;
+  for (unsigned s = 0; s < steps; ++s) {
+    forall(size_t i = 0; i < nx * ny * nz; ++i) {
+      stencil_point<T> p = {a + i, (ptrdiff_t)nx, (ptrdiff_t)(nx * ny),
+                            i % nx, i / nx % ny, i / (nx * ny), i};
+      b[i] = update(p);
+    }
+    std::swap(a, b);
+  }
+#else
+  if (time_block == 0)
+    time_block = 1;
+  for (unsigned s = 0; s < steps; s += time_block) {
+    unsigned block = steps - s < time_block ? steps - s : time_block;
+    detail::stencil_block(a, b, nx, ny, nz, block, radius, tx, ty, tz,
+                          update);
+    std::swap(a, b);
+  }
+#endif
+  return a;
+}
+
+/// Compute steps time steps of a stencil on the nx * ny grid a, as
+/// stencil_3d() with nz = 1.
+template <typename T, typename Update>
+T *stencil_2d(T *a, T *b, size_t nx, size_t ny, unsigned steps,
+              Update update, unsigned radius = 1, unsigned time_block = 4,
+              size_t tx = 256, size_t ty = 64) {
+  return stencil_3d(a, b, nx, ny, 1, steps, update, radius, time_block, tx,
+                    ty, 1);
+}
+
+#undef __KITSUNE_GPU_STENCIL
+
+} // namespace kitsune
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_STENCIL_H__
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2020 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the kitsune/llvm project.  It is released under
+ * the LLVM license.
+ */
+#ifndef __KITSUNE_KITSUNE_TIMER_H__
+#define __KITSUNE_KITSUNE_TIMER_H__
+
+/* Timers that account for the device work of the code they time.
+ * Launches and transfers on the GPU targets are asynchronous, so the
+ * host time of a forall may end before its kernel does.  A timer waits
+ * for the device work that its thread issued through the runtime before
+ * it reads the clock, without synchronizing the runtime's streams in
+ * between, and it splits the time into:
+ *
+ *   - seconds(): the wall time from the start of the timer until the
+ *     device work has completed.
+ *   - device_seconds(): the time the devices spent on that work
+ *     (overlapping kernels and transfers are only counted once).
+ *   - host_seconds(): the time spent in the runtime calls that issued
+ *     it -- the launch and transfer overhead.
+ *
+ * The work of the timed code can be declared to compute its throughput
+ * from the device time (or the wall time when there was none):
+ *
+ *   kitsune::timer t;
+ *   forall(size_t i = 0; i < n; ++i)
+ *     c[i] = a[i] + b[i];
+ *   t.stop();
+ *   t.add_bytes(3 * n * sizeof(float));
+ *   t.add_flops(n);
+ *   printf("%g s (device %g s) %g GB/s\n", t.seconds(),
+ *          t.device_seconds(), t.gbytes_per_sec());
+ *
+ * On the CPU targets all three times are the wall time.  A timer must
+ * be used by the thread that created it; the device work of other
+ * threads is not waited for.
+ */
+
+#if defined(__cplusplus)
+#include <chrono>
+#include <stdint.h>
+
+#if defined(_tapir_cuda_target) || defined(_tapir_hip_target) || \
+    defined(_tapir_multi_target)
+#define __KITSUNE_DEVICE_TIMER 1
+extern "C" int __kitrt_timer_begin();
+extern "C" void __kitrt_timer_query(int span, double *device_secs,
+                                    double *host_secs, uint64_t *ops);
+extern "C" void __kitrt_timer_end(int span);
+#endif
+
+namespace kitsune {
+
+class timer {
+public:
+  timer() { start(); }
+
+  ~timer() {
+#if defined(__KITSUNE_DEVICE_TIMER)
+    __kitrt_timer_end(span);
+#endif
+  }
+
+  timer(const timer &) = delete;
+  timer &operator=(const timer &) = delete;
+
+  /// Restart the timer and forget the declared work.
+  void reset() {
+#if defined(__KITSUNE_DEVICE_TIMER)
+    __kitrt_timer_end(span);
+#endif
+    start();
+  }
+
+  /// Stop the timer once the device work issued so far has completed.
+  /// The times read after stop() do not change.
+  void stop() {
+    if (running)
+      update();
+    running = false;
+  }
+
+  /// Return the wall time (in seconds) until now -- or until the timer
+  /// was stopped -- and the device work completed.
+  double seconds() {
+    if (running)
+      update();
+    return wall_secs;
+  }
+
+  /// Return the time the devices spent on the work issued since the
+  /// timer started.
+  double device_seconds() {
+    if (running)
+      update();
+    return device_secs;
+  }
+
+  /// Return the time spent in the runtime calls that issued the work.
+  double host_seconds() {
+    if (running)
+      update();
+    return host_secs;
+  }
+
+  /// Return the number of launches and transfers issued since the timer
+  /// started.
+  uint64_t device_ops() {
+    if (running)
+      update();
+    return ops;
+  }
+
+  /// Declare the bytes moved and floating-point operations of the timed
+  /// work.
+  void add_bytes(double nbytes) { bytes += nbytes; }
+  void add_flops(double nflops) { flops += nflops; }
+
+  /// Return the throughput of the declared work, from the device time
+  /// when there was device work and from the wall time otherwise.
+  double gbytes_per_sec() { return rate(bytes); }
+  double gflops_per_sec() { return rate(flops); }
+
+private:
+  void start() {
+    bytes = flops = 0.0;
+    wall_secs = device_secs = host_secs = 0.0;
+    ops = 0;
+    running = true;
+#if defined(__KITSUNE_DEVICE_TIMER)
+    span = __kitrt_timer_begin();
+#endif
+    stamp = std::chrono::steady_clock::now();
+  }
+
+  void update() {
+#if defined(__KITSUNE_DEVICE_TIMER)
+    __kitrt_timer_query(span, &device_secs, &host_secs, &ops);
+#endif
+    wall_secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - stamp)
+                    .count();
+#if !defined(__KITSUNE_DEVICE_TIMER)
+    device_secs = host_secs = wall_secs;
+#endif
+  }
+
+  double rate(double work) {
+    double secs = device_ops() != 0 ? device_seconds() : seconds();
+    return secs > 0.0 ? work / secs / 1.0e9 : 0.0;
+  }
+
+  std::chrono::steady_clock::time_point stamp;
+  bool running;
+  double wall_secs, device_secs, host_secs;
+  uint64_t ops;
+  double bytes, flops;
+#if defined(__KITSUNE_DEVICE_TIMER)
+  int span;
+#endif
+};
+
+} // namespace kitsune
+
+#undef __KITSUNE_DEVICE_TIMER
+
+#endif // __cplusplus
+
+#endif // __KITSUNE_KITSUNE_TIMER_H__
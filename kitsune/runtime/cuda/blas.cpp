@@ -0,0 +1,211 @@
+//===- blas.cpp - Kitsune runtime CUDA BLAS support -----------------------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+// Foralls that compute a matrix product (see tapir::findGPUBlasIdiom())
+// run as a cuBLAS GEMM (or GEMV) instead of the loop's kernel: the
+// naive kernel reads each element of A and B from memory once per
+// product it contributes to, while cuBLAS tiles the product through
+// shared memory and the tensor cores.  cuBLAS is loaded on first use so
+// the runtime does not depend on it otherwise; without it the compiler
+// launches the loop's kernel.
+//
+// The handle of a context is shared by all threads, so a call sets the
+// handle's stream and issues the product while holding a lock.
+//
+// The few cuBLAS entry points used are declared here rather than taken
+// from its headers, which are not needed to build the runtime.
+
+extern "C" {
+typedef struct cublasContext *cublasHandle_t;
+typedef int cublasStatus_t;    // CUBLAS_STATUS_SUCCESS is zero.
+typedef int cublasOperation_t; // CUBLAS_OP_N and CUBLAS_OP_T below.
+
+cublasStatus_t cublasCreate_v2(cublasHandle_t *handle);
+cublasStatus_t cublasSetStream_v2(cublasHandle_t handle, CUstream stream);
+cublasStatus_t cublasSgemm_v2(cublasHandle_t handle, cublasOperation_t transa,
+                              cublasOperation_t transb, int m, int n, int k,
+                              const float *alpha, const float *A, int lda,
+                              const float *B, int ldb, const float *beta,
+                              float *C, int ldc);
+cublasStatus_t cublasDgemm_v2(cublasHandle_t handle, cublasOperation_t transa,
+                              cublasOperation_t transb, int m, int n, int k,
+                              const double *alpha, const double *A, int lda,
+                              const double *B, int ldb, const double *beta,
+                              double *C, int ldc);
+cublasStatus_t cublasSgemv_v2(cublasHandle_t handle, cublasOperation_t trans,
+                              int m, int n, const float *alpha,
+                              const float *A, int lda, const float *x,
+                              int incx, const float *beta, float *y,
+                              int incy);
+cublasStatus_t cublasDgemv_v2(cublasHandle_t handle, cublasOperation_t trans,
+                              int m, int n, const double *alpha,
+                              const double *A, int lda, const double *x,
+                              int incx, const double *beta, double *y,
+                              int incy);
+}
+
+namespace {
+
+const cublasOperation_t CUBLAS_OP_N = 0;
+const cublasOperation_t CUBLAS_OP_T = 1;
+
+decltype(cublasCreate_v2) *cublasCreate_v2_p;
+decltype(cublasSetStream_v2) *cublasSetStream_v2_p;
+decltype(cublasSgemm_v2) *cublasSgemm_v2_p;
+decltype(cublasDgemm_v2) *cublasDgemm_v2_p;
+decltype(cublasSgemv_v2) *cublasSgemv_v2_p;
+decltype(cublasDgemv_v2) *cublasDgemv_v2_p;
+
+const char *CUBLAS_DSO_LIBNAME = "libcublas.so";
+
+std::mutex _kitcuda_blas_mutex;
+bool _kitcuda_blas_loaded = false;
+bool _kitcuda_blas_disabled = false;
+std::vector<std::pair<CUcontext, cublasHandle_t>> _kitcuda_blas_handles;
+
+bool load_cublas_symbols() {
+  void *kitrt_dl_handle = dlopen(CUBLAS_DSO_LIBNAME, RTLD_LAZY);
+  if (kitrt_dl_handle == NULL) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: unable to open '%s', matrix products "
+                      "launch their kernels.\n", CUBLAS_DSO_LIBNAME);
+    return false;
+  }
+  DLSYM_LOAD(cublasCreate_v2);
+  DLSYM_LOAD(cublasSetStream_v2);
+  DLSYM_LOAD(cublasSgemm_v2);
+  DLSYM_LOAD(cublasDgemm_v2);
+  DLSYM_LOAD(cublasSgemv_v2);
+  DLSYM_LOAD(cublasDgemv_v2);
+  return true;
+}
+
+#define CUBLAS_SAFE_CALL(x)                                                    \
+  {                                                                            \
+    cublasStatus_t status = x;                                                 \
+    if (status != 0) {                                                         \
+      fprintf(stderr, "kitrt %s:%d:\n", __FILE__, __LINE__);                   \
+      fprintf(stderr, "  %s failed (status %d)\n", #x, status);                \
+      abort();                                                                 \
+    }                                                                          \
+  }
+
+} // namespace
+
+void *_kitcuda_blas_handle() {
+  std::lock_guard<std::mutex> lock(_kitcuda_blas_mutex);
+  if (not _kitcuda_blas_loaded) {
+    _kitcuda_blas_loaded = true;
+    bool use_blas = true;
+    __kitrt_get_env_value("KITCUDA_USE_BLAS", use_blas);
+    _kitcuda_blas_disabled = not use_blas || not load_cublas_symbols();
+  }
+  if (_kitcuda_blas_disabled)
+    return nullptr;
+
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+  for (auto &entry : _kitcuda_blas_handles)
+    if (entry.first == ctx)
+      return entry.second;
+  cublasHandle_t handle;
+  if (cublasCreate_v2_p(&handle) != 0) {
+    fprintf(stderr, "kitcuda: unable to create a cuBLAS handle, matrix "
+                    "products launch their kernels.\n");
+    _kitcuda_blas_disabled = true;
+    return nullptr;
+  }
+  _kitcuda_blas_handles.push_back({ctx, handle});
+  return handle;
+}
+
+void _kitcuda_blas_gemm_nt(void *opaque_handle, CUstream stream,
+                           uint32_t elt_size, int m, int n, int k,
+                           const void *a, const void *b, void *c) {
+  // cuBLAS is column-major, where the row-major C = A * B^T is the
+  // column-major C^T = B^T * A of the N x K matrix B and the M x K
+  // matrix A.  A product with a single column is a matrix-vector
+  // product.
+  auto handle = (cublasHandle_t)opaque_handle;
+  std::lock_guard<std::mutex> lock(_kitcuda_blas_mutex);
+  CUBLAS_SAFE_CALL(cublasSetStream_v2_p(handle, stream));
+  if (elt_size == sizeof(double)) {
+    const double one = 1.0, zero = 0.0;
+    if (n == 1) {
+      CUBLAS_SAFE_CALL(cublasDgemv_v2_p(handle, CUBLAS_OP_T, k, m, &one,
+                                        (const double *)a, k,
+                                        (const double *)b, 1, &zero,
+                                        (double *)c, 1));
+    } else {
+      CUBLAS_SAFE_CALL(cublasDgemm_v2_p(handle, CUBLAS_OP_T, CUBLAS_OP_N, n,
+                                        m, k, &one, (const double *)b, k,
+                                        (const double *)a, k, &zero,
+                                        (double *)c, n));
+    }
+  } else {
+    assert(elt_size == sizeof(float) && "unexpected gemm element size!");
+    const float one = 1.0f, zero = 0.0f;
+    if (n == 1) {
+      CUBLAS_SAFE_CALL(cublasSgemv_v2_p(handle, CUBLAS_OP_T, k, m, &one,
+                                        (const float *)a, k,
+                                        (const float *)b, 1, &zero,
+                                        (float *)c, 1));
+    } else {
+      CUBLAS_SAFE_CALL(cublasSgemm_v2_p(handle, CUBLAS_OP_T, CUBLAS_OP_N, n,
+                                        m, k, &one, (const float *)b, k,
+                                        (const float *)a, k, &zero,
+                                        (float *)c, n));
+    }
+  }
+}
@@ -0,0 +1,494 @@
+//===- cupti.cpp - Kitsune runtime CUDA kernel metrics via CUPTI  ---------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include "memory_map.h"
+#include <algorithm>
+#include <chrono>
+#include <cupti.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// The kernel metrics of the profiler (KITRT_PROFILE_METRICS) are read
+// with CUPTI's event and metric API in kernel replay mode: CUPTI
+// replays each launch as many times as needed to count all the events
+// of the metrics.  CUPTI is loaded on first use so the runtime does not
+// depend on it otherwise.
+//
+// The event groups of a context are shared, so launches with metrics
+// are serialized: begin() holds a lock until end() has synchronized the
+// stream and read the events.
+//
+// NOTE: The event and metric API is not supported on devices of compute
+// capability 7.5 and above, which need the CUPTI profiling (perfworks)
+// API; metrics are then reported as unavailable.
+
+namespace {
+
+decltype(cuptiMetricGetIdFromName) *cuptiMetricGetIdFromName_p;
+decltype(cuptiMetricGetAttribute) *cuptiMetricGetAttribute_p;
+decltype(cuptiMetricCreateEventGroupSets)
+    *cuptiMetricCreateEventGroupSets_p;
+decltype(cuptiMetricGetValue) *cuptiMetricGetValue_p;
+decltype(cuptiSetEventCollectionMode) *cuptiSetEventCollectionMode_p;
+decltype(cuptiEnableKernelReplayMode) *cuptiEnableKernelReplayMode_p;
+decltype(cuptiEventGroupSetEnable) *cuptiEventGroupSetEnable_p;
+decltype(cuptiEventGroupSetDisable) *cuptiEventGroupSetDisable_p;
+decltype(cuptiEventGroupGetAttribute) *cuptiEventGroupGetAttribute_p;
+decltype(cuptiEventGroupReadAllEvents) *cuptiEventGroupReadAllEvents_p;
+decltype(cuptiDeviceGetEventDomainAttribute)
+    *cuptiDeviceGetEventDomainAttribute_p;
+decltype(cuptiGetResultString) *cuptiGetResultString_p;
+decltype(cuptiActivityConfigureUnifiedMemoryCounter)
+    *cuptiActivityConfigureUnifiedMemoryCounter_p;
+decltype(cuptiActivityRegisterCallbacks) *cuptiActivityRegisterCallbacks_p;
+decltype(cuptiActivityEnable) *cuptiActivityEnable_p;
+decltype(cuptiActivityGetNextRecord) *cuptiActivityGetNextRecord_p;
+decltype(cuptiActivityFlushAll) *cuptiActivityFlushAll_p;
+
+const char *CUPTI_DSO_LIBNAME = "libcupti.so";
+
+// The CUPTI metrics read for each profiler metric.  The DRAM traffic
+// is the sum of the bytes read and written.
+struct KitCudaCuptiMetric {
+  const char *name;
+  KitRTProfileMetric metric;
+  double scale;
+};
+
+const KitCudaCuptiMetric _kitcuda_cupti_metrics[] = {
+    {"dram_read_bytes", KITRT_METRIC_DRAM_BYTES, 1.0},
+    {"dram_write_bytes", KITRT_METRIC_DRAM_BYTES, 1.0},
+    {"achieved_occupancy", KITRT_METRIC_OCCUPANCY, 100.0},
+    {"l2_tex_hit_rate", KITRT_METRIC_L2_HIT_RATE, 1.0},
+    {"warp_execution_efficiency", KITRT_METRIC_WARP_EFFICIENCY, 1.0},
+};
+
+const size_t KITCUDA_NUM_CUPTI_METRICS =
+    sizeof(_kitcuda_cupti_metrics) / sizeof(_kitcuda_cupti_metrics[0]);
+
+// The metric collection state of a context.
+struct KitCudaCuptiContext {
+  CUcontext context;
+  CUdevice device;
+  CUpti_EventGroupSets *sets;
+  std::vector<const KitCudaCuptiMetric *> metrics;
+  std::vector<CUpti_MetricID> ids;
+};
+
+std::mutex _kitcuda_cupti_mutex;
+bool _kitcuda_cupti_loaded = false;
+bool _kitcuda_cupti_load_failed = false;
+bool _kitcuda_cupti_disabled = false;
+std::vector<KitCudaCuptiContext> _kitcuda_cupti_contexts;
+KitCudaCuptiContext *_kitcuda_cupti_active = nullptr;
+std::chrono::steady_clock::time_point _kitcuda_cupti_start;
+
+bool load_cupti_symbols() {
+  void *kitrt_dl_handle = dlopen(CUPTI_DSO_LIBNAME, RTLD_LAZY);
+  if (kitrt_dl_handle == NULL) {
+    fprintf(stderr, "kitcuda: unable to open '%s', kernel metrics and "
+                    "unified memory counters are disabled.\n",
+            CUPTI_DSO_LIBNAME);
+    return false;
+  }
+  DLSYM_LOAD(cuptiMetricGetIdFromName);
+  DLSYM_LOAD(cuptiMetricGetAttribute);
+  DLSYM_LOAD(cuptiMetricCreateEventGroupSets);
+  DLSYM_LOAD(cuptiMetricGetValue);
+  DLSYM_LOAD(cuptiSetEventCollectionMode);
+  DLSYM_LOAD(cuptiEnableKernelReplayMode);
+  DLSYM_LOAD(cuptiEventGroupSetEnable);
+  DLSYM_LOAD(cuptiEventGroupSetDisable);
+  DLSYM_LOAD(cuptiEventGroupGetAttribute);
+  DLSYM_LOAD(cuptiEventGroupReadAllEvents);
+  DLSYM_LOAD(cuptiDeviceGetEventDomainAttribute);
+  DLSYM_LOAD(cuptiGetResultString);
+  // The activity API is only used for the unified memory counters.
+  DLSYM_LOAD_OPTIONAL(cuptiActivityConfigureUnifiedMemoryCounter);
+  DLSYM_LOAD_OPTIONAL(cuptiActivityRegisterCallbacks);
+  DLSYM_LOAD_OPTIONAL(cuptiActivityEnable);
+  DLSYM_LOAD_OPTIONAL(cuptiActivityGetNextRecord);
+  DLSYM_LOAD_OPTIONAL(cuptiActivityFlushAll);
+  return true;
+}
+
+// Load CUPTI on first use.  The caller must hold the lock.
+bool load_cupti() {
+  if (not _kitcuda_cupti_loaded && not _kitcuda_cupti_load_failed) {
+    _kitcuda_cupti_loaded = load_cupti_symbols();
+    _kitcuda_cupti_load_failed = not _kitcuda_cupti_loaded;
+  }
+  return _kitcuda_cupti_loaded;
+}
+
+// Report a CUPTI failure and disable the metrics.
+bool cupti_failed(const char *call, CUptiResult result) {
+  const char *msg = "unknown error";
+  cuptiGetResultString_p(result, &msg);
+  fprintf(stderr, "kitcuda: %s failed ('%s'), kernel metrics are "
+                  "disabled.\n", call, msg);
+  _kitcuda_cupti_disabled = true;
+  return false;
+}
+
+#define CUPTI_CHECK(x)                                                         \
+  {                                                                            \
+    CUptiResult result = x;                                                    \
+    if (result != CUPTI_SUCCESS)                                               \
+      return cupti_failed(#x, result);                                         \
+  }
+
+CUdevice get_context_device(CUcontext ctx) {
+  for (int i = 0; i < __kitcuda_get_num_devices(); i++)
+    if (__kitcuda_get_context_at(i) == ctx)
+      return __kitcuda_get_device_at(i);
+  return __kitcuda_get_device_at(0);
+}
+
+// Set up the collection of the metrics in the given context.
+bool init_context(KitCudaCuptiContext &cc) {
+  for (size_t i = 0; i < KITCUDA_NUM_CUPTI_METRICS; i++) {
+    CUpti_MetricID id;
+    // Metrics that the device does not have are skipped.
+    if (cuptiMetricGetIdFromName_p(cc.device, _kitcuda_cupti_metrics[i].name,
+                                   &id) != CUPTI_SUCCESS)
+      continue;
+    cc.metrics.push_back(&_kitcuda_cupti_metrics[i]);
+    cc.ids.push_back(id);
+  }
+  if (cc.ids.empty()) {
+    fprintf(stderr, "kitcuda: the device has none of the kernel metrics.\n");
+    _kitcuda_cupti_disabled = true;
+    return false;
+  }
+  CUPTI_CHECK(cuptiSetEventCollectionMode_p(cc.context,
+                                            CUPTI_EVENT_COLLECTION_MODE_KERNEL));
+  CUPTI_CHECK(cuptiEnableKernelReplayMode_p(cc.context));
+  CUPTI_CHECK(cuptiMetricCreateEventGroupSets_p(
+      cc.context, cc.ids.size() * sizeof(CUpti_MetricID), cc.ids.data(),
+      &cc.sets));
+  return true;
+}
+
+KitCudaCuptiContext *get_context() {
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+  for (KitCudaCuptiContext &cc : _kitcuda_cupti_contexts)
+    if (cc.context == ctx)
+      return &cc;
+
+  KitCudaCuptiContext cc;
+  cc.context = ctx;
+  cc.device = get_context_device(ctx);
+  cc.sets = nullptr;
+  if (not init_context(cc))
+    return nullptr;
+  _kitcuda_cupti_contexts.push_back(cc);
+  return &_kitcuda_cupti_contexts.back();
+}
+
+bool set_enabled(CUpti_EventGroupSets *sets, bool enable) {
+  for (uint32_t i = 0; i < sets->numSets; i++) {
+    CUptiResult result = enable
+                             ? cuptiEventGroupSetEnable_p(&sets->sets[i])
+                             : cuptiEventGroupSetDisable_p(&sets->sets[i]);
+    if (result != CUPTI_SUCCESS)
+      return cupti_failed(enable ? "cuptiEventGroupSetEnable"
+                                 : "cuptiEventGroupSetDisable",
+                          result);
+  }
+  return true;
+}
+
+// Read the events of a group, normalized to all the instances of its
+// domain on the device.
+bool read_group(CUdevice device, CUpti_EventGroup group,
+                std::vector<CUpti_EventID> &event_ids,
+                std::vector<uint64_t> &event_values) {
+  uint32_t num_events, num_instances, total_instances;
+  CUpti_EventDomainID domain;
+  size_t size = sizeof(num_events);
+  CUPTI_CHECK(cuptiEventGroupGetAttribute_p(
+      group, CUPTI_EVENT_GROUP_ATTR_NUM_EVENTS, &size, &num_events));
+  size = sizeof(num_instances);
+  CUPTI_CHECK(cuptiEventGroupGetAttribute_p(
+      group, CUPTI_EVENT_GROUP_ATTR_INSTANCE_COUNT, &size, &num_instances));
+  size = sizeof(domain);
+  CUPTI_CHECK(cuptiEventGroupGetAttribute_p(
+      group, CUPTI_EVENT_GROUP_ATTR_EVENT_DOMAIN_ID, &size, &domain));
+  size = sizeof(total_instances);
+  CUPTI_CHECK(cuptiDeviceGetEventDomainAttribute_p(
+      device, domain, CUPTI_EVENT_DOMAIN_ATTR_TOTAL_INSTANCE_COUNT, &size,
+      &total_instances));
+
+  std::vector<CUpti_EventID> ids(num_events);
+  std::vector<uint64_t> values((size_t)num_events * num_instances);
+  size_t ids_size = ids.size() * sizeof(CUpti_EventID);
+  size_t values_size = values.size() * sizeof(uint64_t);
+  size_t num_read;
+  CUPTI_CHECK(cuptiEventGroupReadAllEvents_p(
+      group, CUPTI_EVENT_READ_FLAG_NONE, &values_size, values.data(),
+      &ids_size, ids.data(), &num_read));
+
+  // The values are laid out by instance, then by event.
+  for (uint32_t e = 0; e < num_events; e++) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < num_instances; i++)
+      sum += values[(size_t)i * num_events + e];
+    event_ids.push_back(ids[e]);
+    event_values.push_back(num_instances ? sum * total_instances /
+                                               num_instances
+                                         : 0);
+  }
+  return true;
+}
+
+double metric_value(CUpti_MetricID id, const CUpti_MetricValue &value) {
+  CUpti_MetricValueKind kind;
+  size_t size = sizeof(kind);
+  if (cuptiMetricGetAttribute_p(id, CUPTI_METRIC_ATTR_VALUE_KIND, &size,
+                                &kind) != CUPTI_SUCCESS)
+    return -1.0;
+  switch (kind) {
+  case CUPTI_METRIC_VALUE_KIND_DOUBLE:
+    return value.metricValueDouble;
+  case CUPTI_METRIC_VALUE_KIND_UINT64:
+    return (double)value.metricValueUint64;
+  case CUPTI_METRIC_VALUE_KIND_INT64:
+    return (double)value.metricValueInt64;
+  case CUPTI_METRIC_VALUE_KIND_PERCENT:
+    return value.metricValuePercent;
+  case CUPTI_METRIC_VALUE_KIND_THROUGHPUT:
+    return (double)value.metricValueThroughput;
+  default:
+    return -1.0;
+  }
+}
+
+bool read_metrics(KitCudaCuptiContext &cc, uint64_t duration_ns,
+                  double values[KITRT_PROFILE_NUM_METRICS]) {
+  std::vector<CUpti_EventID> event_ids;
+  std::vector<uint64_t> event_values;
+  for (uint32_t s = 0; s < cc.sets->numSets; s++) {
+    CUpti_EventGroupSet &set = cc.sets->sets[s];
+    for (uint32_t g = 0; g < set.numEventGroups; g++)
+      if (not read_group(cc.device, set.eventGroups[g], event_ids,
+                         event_values))
+        return false;
+  }
+
+  for (int m = 0; m < KITRT_PROFILE_NUM_METRICS; m++)
+    values[m] = -1.0;
+  for (size_t i = 0; i < cc.ids.size(); i++) {
+    CUpti_MetricValue value;
+    if (cuptiMetricGetValue_p(cc.device, cc.ids[i],
+                              event_ids.size() * sizeof(CUpti_EventID),
+                              event_ids.data(),
+                              event_values.size() * sizeof(uint64_t),
+                              event_values.data(), duration_ns,
+                              &value) != CUPTI_SUCCESS)
+      continue;
+    double v = metric_value(cc.ids[i], value);
+    if (v < 0.0)
+      continue;
+    double &result = values[cc.metrics[i]->metric];
+    result = std::max(result, 0.0) + v * cc.metrics[i]->scale;
+  }
+  return true;
+}
+
+bool _kitcuda_cupti_begin(void *stream) {
+  _kitcuda_cupti_mutex.lock();
+  if (not _kitcuda_cupti_disabled && not load_cupti())
+    _kitcuda_cupti_disabled = true;
+  KitCudaCuptiContext *cc =
+      _kitcuda_cupti_disabled ? nullptr : get_context();
+  if (cc == nullptr || not set_enabled(cc->sets, true)) {
+    _kitcuda_cupti_mutex.unlock();
+    return false;
+  }
+  _kitcuda_cupti_active = cc;
+  _kitcuda_cupti_start = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool _kitcuda_cupti_end(void *stream,
+                        double values[KITRT_PROFILE_NUM_METRICS]) {
+  KitCudaCuptiContext *cc = _kitcuda_cupti_active;
+  CU_SAFE_CALL(cuStreamSynchronize_p((CUstream)stream));
+  uint64_t duration_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - _kitcuda_cupti_start)
+          .count();
+  bool ok = read_metrics(*cc, duration_ns, values);
+  ok = set_enabled(cc->sets, false) && ok;
+  _kitcuda_cupti_active = nullptr;
+  _kitcuda_cupti_mutex.unlock();
+  return ok;
+}
+
+// The data movement of allocation sites (KITRT_MEM_SITES) is read
+// from CUPTI's unified memory counters: an activity record for each
+// migration and group of page faults, with the address it concerns.
+// CUPTI hands the records over in buffers, which are charged to the
+// sites as they complete and when the memory map asks for a flush
+// (before an allocation is freed and before the sites are reported).
+const size_t KITCUDA_CUPTI_BUFFER_SIZE = 1 << 20;
+const size_t KITCUDA_CUPTI_RECORD_ALIGN = 8;
+
+void CUPTIAPI uvm_buffer_requested(uint8_t **buffer, size_t *size,
+                                   size_t *max_records) {
+  *buffer = (uint8_t *)aligned_alloc(KITCUDA_CUPTI_RECORD_ALIGN,
+                                     KITCUDA_CUPTI_BUFFER_SIZE);
+  *size = *buffer != nullptr ? KITCUDA_CUPTI_BUFFER_SIZE : 0;
+  *max_records = 0;
+}
+
+void CUPTIAPI uvm_buffer_completed(CUcontext, uint32_t, uint8_t *buffer,
+                                   size_t, size_t valid_size) {
+  CUpti_Activity *record = nullptr;
+  while (cuptiActivityGetNextRecord_p(buffer, valid_size, &record) ==
+         CUPTI_SUCCESS) {
+    if (record->kind != CUPTI_ACTIVITY_KIND_UNIFIED_MEMORY_COUNTER)
+      continue;
+    const CUpti_ActivityUnifiedMemoryCounter2 *um =
+        (const CUpti_ActivityUnifiedMemoryCounter2 *)record;
+    void *addr = (void *)(uintptr_t)um->address;
+    switch (um->counterKind) {
+    case CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_BYTES_TRANSFER_HTOD:
+      __kitrt_count_mem_site(addr, KITRT_SITE_MIGRATE_TO_DEVICE, um->value);
+      break;
+    case CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_BYTES_TRANSFER_DTOH:
+      __kitrt_count_mem_site(addr, KITRT_SITE_MIGRATE_TO_HOST, um->value);
+      break;
+    case CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_GPU_PAGE_FAULT:
+      __kitrt_count_mem_site(addr, KITRT_SITE_DEVICE_FAULTS, um->value);
+      break;
+    case CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_CPU_PAGE_FAULT_COUNT:
+      __kitrt_count_mem_site(addr, KITRT_SITE_HOST_FAULTS, um->value);
+      break;
+    default:
+      break;
+    }
+  }
+  free(buffer);
+}
+
+void uvm_flush() { (void)cuptiActivityFlushAll_p(0); }
+
+bool uvm_failed(const char *call, CUptiResult result) {
+  const char *msg = "unknown error";
+  cuptiGetResultString_p(result, &msg);
+  fprintf(stderr, "kitcuda: %s failed ('%s'), unified memory counters are "
+                  "disabled.\n", call, msg);
+  return false;
+}
+
+#define UVM_CHECK(x)                                                           \
+  {                                                                            \
+    CUptiResult result = x;                                                    \
+    if (result != CUPTI_SUCCESS)                                               \
+      return uvm_failed(#x, result);                                           \
+  }
+
+} // namespace
+
+bool _kitcuda_cupti_enable_uvm_counters(int device_ordinal) {
+  std::lock_guard<std::mutex> lock(_kitcuda_cupti_mutex);
+  if (not load_cupti())
+    return false;
+  if (cuptiActivityConfigureUnifiedMemoryCounter_p == nullptr ||
+      cuptiActivityRegisterCallbacks_p == nullptr ||
+      cuptiActivityEnable_p == nullptr ||
+      cuptiActivityGetNextRecord_p == nullptr ||
+      cuptiActivityFlushAll_p == nullptr) {
+    fprintf(stderr, "kitcuda: CUPTI has no activity API, unified memory "
+                    "counters are disabled.\n");
+    return false;
+  }
+
+  const CUpti_ActivityUnifiedMemoryCounterKind kinds[] = {
+      CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_BYTES_TRANSFER_HTOD,
+      CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_BYTES_TRANSFER_DTOH,
+      CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_GPU_PAGE_FAULT,
+      CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_KIND_CPU_PAGE_FAULT_COUNT,
+  };
+  const uint32_t num_kinds = sizeof(kinds) / sizeof(kinds[0]);
+  CUpti_ActivityUnifiedMemoryCounterConfig config[num_kinds];
+  for (uint32_t i = 0; i < num_kinds; i++) {
+    config[i].scope =
+        CUPTI_ACTIVITY_UNIFIED_MEMORY_COUNTER_SCOPE_PROCESS_SINGLE_DEVICE;
+    config[i].kind = kinds[i];
+    config[i].deviceId = device_ordinal;
+    config[i].enable = 1;
+  }
+  UVM_CHECK(cuptiActivityConfigureUnifiedMemoryCounter_p(config, num_kinds));
+  UVM_CHECK(cuptiActivityRegisterCallbacks_p(uvm_buffer_requested,
+                                             uvm_buffer_completed));
+  UVM_CHECK(cuptiActivityEnable_p(CUPTI_ACTIVITY_KIND_UNIFIED_MEMORY_COUNTER));
+  __kitrt_set_mem_sites_flush(uvm_flush);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "  kitcuda: unified memory counters enabled.\n");
+  return true;
+}
+
+const KitRTProfileMetricOps _kitcuda_cupti_metric_ops = {
+    "cupti",
+    _kitcuda_cupti_begin,
+    _kitcuda_cupti_end,
+};
@@ -0,0 +1,349 @@
+//===- dataflow.cpp - Kitsune runtime CUDA dataflow launch support --------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include "memory_map.h"
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// The kernels launched by an instance of a sync region all go to the
+// region's stream and run one after the other even when they touch
+// disjoint data.  When dataflow launches are enabled the runtime uses
+// the access modes of the kernel arguments (see __kitcuda_mem_gpu_map())
+// to only order the launches that depend on each other.  Each launch
+// goes to one of a small set of worker streams owned by the region's
+// stream and waits (via events) on the last writer of the data it
+// reads and on the last writer and readers of the data it writes.
+// Independent launches are free to run concurrently.
+//
+// The region's stream still carries everything else: the copies and
+// prefetches issued while the arguments are mapped (every launch waits
+// on them) and launches whose data is not known to the runtime, which
+// act as barriers.  When the region is synchronized its stream waits
+// for the workers before any device-resident data is copied back.
+// Only the pointer arguments mapped by the compiler are tracked, so
+// the data a kernel reaches through other pointers (e.g., stored in
+// another allocation) must not be shared with concurrent launches.
+
+namespace {
+
+// A launch that touched an allocation: the event recorded after the
+// launch, the worker it ran on and its position in the region.
+struct KitCudaDataflowAccess {
+  CUevent event;
+  unsigned worker;
+  uint64_t seq;
+};
+
+struct KitCudaDataflowAlloc {
+  bool has_writer = false;
+  KitCudaDataflowAccess writer;
+  std::vector<KitCudaDataflowAccess> readers;
+};
+
+// The dataflow state of a region instance (i.e., a stream), from its
+// first launch until the stream is synchronized.
+struct KitCudaDataflowState {
+  std::unordered_map<void *, KitCudaDataflowAlloc> allocs;
+  std::vector<CUstream> workers;
+  std::vector<KitCudaDataflowAccess> tails; // last launch on each worker.
+  std::vector<CUevent> events; // all events recorded by the instance.
+  unsigned next_worker = 0;
+  uint64_t next_seq = 1;
+};
+
+// The allocations (and their access modes) mapped by the calling
+// thread for its next launch.  A null base stands for memory that is
+// unknown to the runtime.
+struct KitCudaDataflowArg {
+  void *base;
+  int access;
+};
+
+static bool _kitcuda_use_dataflow = false;
+static unsigned _kitcuda_dataflow_streams = 4;
+static std::unordered_map<CUstream, KitCudaDataflowState *>
+    _kitcuda_dataflow_states;
+static std::vector<CUevent> _kitcuda_dataflow_events;
+static std::mutex _kitcuda_dataflow_mutex;
+thread_local std::vector<KitCudaDataflowArg> _kitcuda_dataflow_args;
+
+// Return an event from the recycled events of all instances.  Must be
+// called with the dataflow mutex held.
+CUevent get_event(KitCudaDataflowState *state) {
+  CUevent event;
+  if (_kitcuda_dataflow_events.empty())
+    CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DISABLE_TIMING));
+  else {
+    event = _kitcuda_dataflow_events.back();
+    _kitcuda_dataflow_events.pop_back();
+  }
+  state->events.push_back(event);
+  return event;
+}
+
+// Keep the latest of the given launch and any earlier dependence on
+// the same worker (launches on a worker complete in order).
+void add_dependence(std::vector<KitCudaDataflowAccess> &deps,
+                    const KitCudaDataflowAccess &access) {
+  for (auto &dep : deps) {
+    if (dep.worker == access.worker) {
+      if (dep.seq < access.seq)
+        dep = access;
+      return;
+    }
+  }
+  deps.push_back(access);
+}
+
+// Order the instance's stream after all of its worker launches.  The
+// dependences recorded so far are then implied by the stream itself.
+// Must be called with the dataflow mutex held.
+void join_workers(KitCudaDataflowState *state, CUstream stream) {
+  for (auto &tail : state->tails) {
+    if (tail.event != nullptr)
+      CU_SAFE_CALL(cuStreamWaitEvent_p(stream, tail.event, 0));
+    tail.event = nullptr;
+  }
+  state->allocs.clear();
+}
+
+// Recycle the events and worker streams of a synchronized instance.
+// Must be called with the dataflow mutex held.
+void release_state(KitCudaDataflowState *state) {
+  _kitcuda_dataflow_events.insert(_kitcuda_dataflow_events.end(),
+                                  state->events.begin(), state->events.end());
+  for (CUstream worker : state->workers)
+    __kitcuda_recycle_thread_stream((void *)worker);
+  delete state;
+}
+
+} // namespace
+
+extern "C" {
+
+void __kitcuda_use_dataflow_launch(bool enable, unsigned num_streams) {
+  _kitcuda_use_dataflow = enable;
+  __kitcuda_advance_launch_epoch();
+  if (num_streams > 0)
+    _kitcuda_dataflow_streams = num_streams;
+}
+
+bool __kitcuda_dataflow_launch_enabled() {
+  return _kitcuda_use_dataflow;
+}
+
+void __kitcuda_dataflow_record(void *vp, int access) {
+  // Multi-device and out-of-core launches place their own data and
+  // always launch on the region's stream.
+  if (not _kitcuda_use_dataflow || __kitcuda_get_num_devices() > 1 ||
+      __kitcuda_get_out_of_core_budget() > 0)
+    return;
+  size_t size = 0;
+  void *base = vp;
+  __kitrt_get_mem_residency(vp, &size, &base);
+  _kitcuda_dataflow_args.push_back({size > 0 ? base : nullptr, access});
+}
+
+void __kitcuda_dataflow_discard() {
+  _kitcuda_dataflow_args.clear();
+}
+
+void *__kitcuda_dataflow_begin(void *opaque_stream, bool barrier) {
+  assert(opaque_stream && "unexpected null stream!");
+  if (not _kitcuda_use_dataflow)
+    return opaque_stream;
+
+  KIT_NVTX_PUSH("kitcuda:dataflow_begin", KIT_NVTX_STREAM);
+  CUstream stream = (CUstream)opaque_stream;
+  std::vector<KitCudaDataflowArg> &args = _kitcuda_dataflow_args;
+  for (auto &arg : args)
+    barrier = barrier || arg.base == nullptr;
+  // A launch without any (known) data might touch anything.
+  barrier = barrier || args.empty();
+
+  std::lock_guard<std::mutex> lock(_kitcuda_dataflow_mutex);
+  if (barrier) {
+    auto it = _kitcuda_dataflow_states.find(stream);
+    if (it != _kitcuda_dataflow_states.end())
+      join_workers(it->second, stream);
+    args.clear();
+    KIT_NVTX_POP();
+    return opaque_stream;
+  }
+  KitCudaDataflowState *&state = _kitcuda_dataflow_states[stream];
+  if (state == nullptr)
+    state = new KitCudaDataflowState;
+
+  // Reads depend on the last writer, writes also on the readers since
+  // that write.
+  std::vector<KitCudaDataflowAccess> deps;
+  for (auto &arg : args) {
+    auto it = state->allocs.find(arg.base);
+    if (it == state->allocs.end())
+      continue;
+    KitCudaDataflowAlloc &alloc = it->second;
+    if (alloc.has_writer)
+      add_dependence(deps, alloc.writer);
+    if (arg.access != KITRT_MEM_ACCESS_READ_ONLY)
+      for (auto &reader : alloc.readers)
+        add_dependence(deps, reader);
+  }
+
+  // Stay on the worker of the latest dependence (its ordering is then
+  // free), otherwise spread independent launches across the workers.
+  unsigned worker = 0;
+  if (not deps.empty()) {
+    uint64_t latest = 0;
+    for (auto &dep : deps) {
+      if (dep.seq > latest) {
+        latest = dep.seq;
+        worker = dep.worker;
+      }
+    }
+  } else if (state->workers.size() < _kitcuda_dataflow_streams) {
+    worker = state->workers.size();
+  } else
+    worker = state->next_worker++ % state->workers.size();
+  if (worker == state->workers.size()) {
+    state->workers.push_back((CUstream)__kitcuda_get_thread_stream());
+    state->tails.push_back({nullptr, worker, 0});
+  }
+  CUstream worker_stream = state->workers[worker];
+  for (auto &dep : deps)
+    if (dep.worker != worker)
+      CU_SAFE_CALL(cuStreamWaitEvent_p(worker_stream, dep.event, 0));
+
+  // The launch must also follow the copies (and barriers) issued on
+  // the region's stream.
+  CUevent mapped = get_event(state);
+  CU_SAFE_CALL(cuEventRecord_p(mapped, stream));
+  CU_SAFE_CALL(cuStreamWaitEvent_p(worker_stream, mapped, 0));
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "kitcuda: dataflow launch on worker %u of stream %p "
+            "(%zu dependences).\n",
+            worker, (void *)stream, deps.size());
+  KIT_NVTX_POP();
+  return (void *)worker_stream;
+}
+
+void __kitcuda_dataflow_end(void *opaque_stream, void *launch_stream) {
+  if (launch_stream == opaque_stream)
+    return;
+  CUstream stream = (CUstream)opaque_stream;
+  std::lock_guard<std::mutex> lock(_kitcuda_dataflow_mutex);
+  KitCudaDataflowState *state = _kitcuda_dataflow_states.at(stream);
+  unsigned worker = 0;
+  while (state->workers[worker] != (CUstream)launch_stream)
+    worker++;
+
+  KitCudaDataflowAccess access = {get_event(state), worker,
+                                  state->next_seq++};
+  CU_SAFE_CALL(cuEventRecord_p(access.event, (CUstream)launch_stream));
+  state->tails[worker] = access;
+  for (auto &arg : _kitcuda_dataflow_args) {
+    KitCudaDataflowAlloc &alloc = state->allocs[arg.base];
+    if (arg.access != KITRT_MEM_ACCESS_READ_ONLY) {
+      alloc.has_writer = true;
+      alloc.writer = access;
+      alloc.readers.clear();
+    } else
+      alloc.readers.push_back(access);
+  }
+  _kitcuda_dataflow_args.clear();
+}
+
+void __kitcuda_dataflow_join(void *opaque_stream) {
+  if (not _kitcuda_use_dataflow)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_dataflow_mutex);
+  auto it = _kitcuda_dataflow_states.find((CUstream)opaque_stream);
+  if (it != _kitcuda_dataflow_states.end())
+    join_workers(it->second, (CUstream)opaque_stream);
+}
+
+void __kitcuda_dataflow_release(void *opaque_stream) {
+  if (not _kitcuda_use_dataflow)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_dataflow_mutex);
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kitcuda_dataflow_states)
+      release_state(entry.second);
+    _kitcuda_dataflow_states.clear();
+    return;
+  }
+  auto it = _kitcuda_dataflow_states.find((CUstream)opaque_stream);
+  if (it == _kitcuda_dataflow_states.end())
+    return;
+  release_state(it->second);
+  _kitcuda_dataflow_states.erase(it);
+}
+
+void __kitcuda_destroy_dataflow() {
+  KIT_NVTX_PUSH("kitcuda:destroy_dataflow", KIT_NVTX_CLEANUP);
+  std::lock_guard<std::mutex> lock(_kitcuda_dataflow_mutex);
+  // NOTE: This assumes no other threads are actively using the
+  // runtime (e.g., at program exit).  The worker streams go back to
+  // the stream cache and are destroyed with the thread streams.
+  for (auto &entry : _kitcuda_dataflow_states)
+    release_state(entry.second);
+  _kitcuda_dataflow_states.clear();
+  for (CUevent event : _kitcuda_dataflow_events)
+    CU_SAFE_CALL(cuEventDestroy_v2_p(event));
+  _kitcuda_dataflow_events.clear();
+  KIT_NVTX_POP();
+}
+
+} // extern "C"
@@ -106,8 +106,10 @@ bool __kitcuda_load_symbols() {
   DLSYM_LOAD(cuInit);
   DLSYM_LOAD(cuDeviceGetCount);
   DLSYM_LOAD(cuDeviceGet);
+  DLSYM_LOAD(cuDeviceTotalMem_v2);
   DLSYM_LOAD(cuDeviceGetAttribute);
   DLSYM_LOAD(cuDeviceGetAttribute);
+  DLSYM_LOAD(cuDeviceCanAccessPeer);
   DLSYM_LOAD(cuDriverGetVersion);
   DLSYM_LOAD(cuFuncSetCacheConfig);
   DLSYM_LOAD(cuFuncGetName);
@@ -124,15 +126,53 @@ bool __kitcuda_load_symbols() {
   DLSYM_LOAD(cuDevicePrimaryCtxReset_v2);
   DLSYM_LOAD(cuCtxDestroy_v2);
   DLSYM_LOAD(cuCtxSynchronize);
+  DLSYM_LOAD(cuCtxEnablePeerAccess);
+  DLSYM_LOAD(cuCtxSetLimit);
+  DLSYM_LOAD(cuCtxResetPersistingL2Cache);
+  DLSYM_LOAD(cuCtxGetStreamPriorityRange);
+  DLSYM_LOAD(cuCtxGetExecAffinity);
+  DLSYM_LOAD(cuDeviceGetExecAffinitySupport);
+#if CUDA_VERSION >= 12040
+  DLSYM_LOAD_OPTIONAL(cuDeviceGetDevResource);
+  DLSYM_LOAD_OPTIONAL(cuDevSmResourceSplitByCount);
+  DLSYM_LOAD_OPTIONAL(cuDevResourceGenerateDesc);
+  DLSYM_LOAD_OPTIONAL(cuGreenCtxCreate);
+  DLSYM_LOAD_OPTIONAL(cuGreenCtxDestroy);
+  DLSYM_LOAD_OPTIONAL(cuGreenCtxGetDevResource);
+  DLSYM_LOAD_OPTIONAL(cuCtxFromGreenCtx);
+#endif
 
   /* Stream management */
   DLSYM_LOAD(cuStreamCreate);
+  DLSYM_LOAD(cuStreamCreateWithPriority);
   DLSYM_LOAD(cuStreamDestroy_v2);
   DLSYM_LOAD(cuStreamSynchronize);
   DLSYM_LOAD(cuStreamAttachMemAsync);
+  DLSYM_LOAD(cuStreamWaitEvent);
+  DLSYM_LOAD(cuStreamQuery);
+  DLSYM_LOAD(cuStreamSetAttribute);
+
+  /* Event management */
+  DLSYM_LOAD(cuEventCreate);
+  DLSYM_LOAD(cuEventRecord);
+  DLSYM_LOAD(cuEventDestroy_v2);
+  DLSYM_LOAD(cuEventQuery);
+  DLSYM_LOAD(cuEventSynchronize);
+  DLSYM_LOAD(cuEventElapsedTime);
+
+  /* Graph management */
+  DLSYM_LOAD(cuGraphCreate);
+  DLSYM_LOAD(cuGraphAddKernelNode_v2);
+  DLSYM_LOAD(cuGraphInstantiateWithFlags);
+  DLSYM_LOAD(cuGraphLaunch);
+  DLSYM_LOAD(cuGraphExecKernelNodeSetParams_v2);
+  DLSYM_LOAD(cuGraphNodeSetEnabled);
+  DLSYM_LOAD(cuGraphExecDestroy);
+  DLSYM_LOAD(cuGraphDestroy);
 
   /* Kernel launching, fat binary, module related */
   DLSYM_LOAD(cuLaunchKernel);
+  DLSYM_LOAD(cuLaunchCooperativeKernel);
   DLSYM_LOAD(cuModuleLoadDataEx);
   DLSYM_LOAD(cuModuleLoadData);
   DLSYM_LOAD(cuModuleLoadFatBinary);
@@ -140,20 +180,35 @@ bool __kitcuda_load_symbols() {
   DLSYM_LOAD(cuModuleUnload);
   DLSYM_LOAD(cuOccupancyMaxPotentialBlockSize);
   DLSYM_LOAD(cuOccupancyMaxPotentialBlockSizeWithFlags);
+  DLSYM_LOAD(cuOccupancyMaxActiveBlocksPerMultiprocessor);
   DLSYM_LOAD(cuModuleGetGlobal_v2);
+  DLSYM_LOAD(cuLinkCreate_v2);
+  DLSYM_LOAD(cuLinkAddData_v2);
+  DLSYM_LOAD(cuLinkComplete);
+  DLSYM_LOAD(cuLinkDestroy);
 
   /* Memory management and movement */
   DLSYM_LOAD(cuMemAllocManaged);
+  DLSYM_LOAD(cuMemAlloc_v2);
   DLSYM_LOAD(cuMemAllocHost);
   DLSYM_LOAD(cuMemHostAlloc);
+  DLSYM_LOAD(cuMemFreeHost);
+  DLSYM_LOAD(cuMemHostRegister_v2);
+  DLSYM_LOAD(cuMemHostUnregister);
+  DLSYM_LOAD(cuMemHostGetDevicePointer_v2);
   DLSYM_LOAD(cuMemsetD8Async);
+  DLSYM_LOAD(cuMemsetD16Async);
+  DLSYM_LOAD(cuMemsetD32Async);
   DLSYM_LOAD(cuMemFree_v2);
   DLSYM_LOAD(cuMemPrefetchAsync);
   DLSYM_LOAD(cuMemAdvise);
   DLSYM_LOAD(cuPointerGetAttribute);
   DLSYM_LOAD(cuPointerSetAttribute);
   DLSYM_LOAD(cuMemcpy);
+  DLSYM_LOAD(cuMemcpyAsync);
   DLSYM_LOAD(cuMemcpyHtoD_v2);
+  DLSYM_LOAD(cuMemcpyHtoDAsync_v2);
+  DLSYM_LOAD(cuMemcpyDtoHAsync_v2);
 
   /* Error handling */
   DLSYM_LOAD(cuGetErrorName);
@@ -0,0 +1,327 @@
+//===- graphs.cpp - Kitsune runtime CUDA graph launch support    ----------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// Kernel launches have a fixed host-side cost that dominates short
+// kernels.  When graph launches are enabled the runtime records the
+// sequence of kernels launched on a stream between the first launch
+// and the stream's synchronization -- i.e., the launches of a single
+// instance of a sync region -- into a CUDA graph.  Later instances of
+// the region that launch the same sequence of kernels replay the
+// graph: each launch only updates the arguments and geometry of its
+// node in the instantiated graph and the entire graph is launched
+// with a single call when the stream is synchronized.
+//
+// Graphs are keyed by the first kernel launched on the stream.  A
+// graph is only used by one region instance at a time; overlapping
+// instances (e.g., from other host threads) launch eagerly.  If a
+// replayed instance diverges from the recorded sequence the launches
+// matched so far are issued as a (partial) graph and the instance
+// continues with eager launches.  Graphs that diverge too often, or
+// that hold a single kernel (nothing to gain), are retired and their
+// regions go back to eager launches.
+
+namespace {
+
+static const size_t KITCUDA_GRAPH_MAX_NODES = 256;
+static const int KITCUDA_GRAPH_MAX_MISMATCHES = 4;
+
+struct KitCudaGraphNode {
+  CUfunction func;
+  CUgraphNode node;
+};
+
+struct KitCudaGraph {
+  CUgraph graph = nullptr;
+  CUgraphExec exec = nullptr;
+  std::vector<KitCudaGraphNode> nodes;
+  // The following are guarded by the graph mutex.
+  bool ready = false;   // has the graph been instantiated?
+  bool retired = false; // are regions back to eager launches?
+  bool busy = false;    // is a region instance replaying the graph?
+  int mismatches = 0;   // number of instances that diverged.
+};
+
+enum KitCudaGraphMode {
+  KITCUDA_GRAPH_RECORD, // launch eagerly and add each kernel to the graph.
+  KITCUDA_GRAPH_REPLAY, // update the graph's nodes, launch it at sync.
+  KITCUDA_GRAPH_EAGER,  // launch eagerly.
+};
+
+// The graph state of a region instance (i.e., a stream), from its
+// first launch until the stream is synchronized.
+struct KitCudaGraphInstance {
+  KitCudaGraphMode mode;
+  KitCudaGraph *graph;
+  size_t next_node; // index of the next node to replay.
+};
+
+typedef std::unordered_map<CUfunction, KitCudaGraph *> KitCudaGraphMap;
+typedef std::unordered_map<CUstream, KitCudaGraphInstance>
+    KitCudaGraphInstanceMap;
+
+static bool _kitcuda_use_graphs = false;
+static KitCudaGraphMap _kitcuda_graphs;
+static KitCudaGraphInstanceMap _kitcuda_graph_instances;
+static std::mutex _kitcuda_graph_mutex;
+
+// Launch the nodes of the graph that have been replayed so far.  The
+// remaining nodes are disabled for the duration of the launch.  Any
+// updates to the executable graph apply to subsequent launches only
+// so the nodes can be re-enabled as soon as the launch is issued.
+void launch_replayed_nodes(KitCudaGraph *graph, size_t num_nodes,
+                           CUstream stream) {
+  if (num_nodes == 0)
+    return;
+  for (size_t i = num_nodes; i < graph->nodes.size(); i++)
+    CU_SAFE_CALL(
+        cuGraphNodeSetEnabled_p(graph->exec, graph->nodes[i].node, 0));
+  CU_SAFE_CALL(cuGraphLaunch_p(graph->exec, stream));
+  for (size_t i = num_nodes; i < graph->nodes.size(); i++)
+    CU_SAFE_CALL(
+        cuGraphNodeSetEnabled_p(graph->exec, graph->nodes[i].node, 1));
+}
+
+// Hand the graph back once an instance stops replaying it.  Must be
+// called with the graph mutex held.
+void release_graph(KitCudaGraph *graph, bool diverged) {
+  graph->busy = false;
+  if (diverged && ++graph->mismatches >= KITCUDA_GRAPH_MAX_MISMATCHES) {
+    graph->retired = true;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: retiring graph %p (too many mismatches).\n",
+              (void *)graph->graph);
+  }
+}
+
+// Issue the replayed portion of an instance's graph and switch the
+// instance to eager launches.  Must be called with the graph mutex
+// held.
+void end_replay(KitCudaGraphInstance &inst, CUstream stream, bool diverged) {
+  launch_replayed_nodes(inst.graph, inst.next_node, stream);
+  release_graph(inst.graph, diverged);
+  inst.mode = KITCUDA_GRAPH_EAGER;
+  inst.graph = nullptr;
+}
+
+// Instantiate (or retire) a recorded graph.  Must be called with the
+// graph mutex held.
+void end_record(KitCudaGraphInstance &inst) {
+  KitCudaGraph *graph = inst.graph;
+  if (graph->nodes.size() < 2) {
+    graph->retired = true;
+  } else {
+    CU_SAFE_CALL(cuGraphInstantiateWithFlags_p(&graph->exec, graph->graph, 0));
+    graph->ready = true;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: instantiated graph %p with %zu kernels.\n",
+              (void *)graph->graph, graph->nodes.size());
+  }
+  inst.mode = KITCUDA_GRAPH_EAGER;
+  inst.graph = nullptr;
+}
+
+} // namespace
+
+extern "C" {
+
+void __kitcuda_use_graph_launch(bool enable) {
+  _kitcuda_use_graphs = enable;
+  __kitcuda_advance_launch_epoch();
+}
+
+bool __kitcuda_graph_launch_enabled() {
+  return _kitcuda_use_graphs;
+}
+
+bool __kitcuda_graph_launch(void *opaque_stream, CUfunction func,
+                            int blks_per_grid, int threads_per_blk,
+                            unsigned shared_mem_bytes, void **kern_args) {
+  if (not _kitcuda_use_graphs)
+    return false;
+
+  KIT_NVTX_PUSH("kitcuda:graph_launch", KIT_NVTX_LAUNCH);
+  CUstream stream = (CUstream)opaque_stream;
+  std::lock_guard<std::mutex> lock(_kitcuda_graph_mutex);
+
+  auto inst_it = _kitcuda_graph_instances.find(stream);
+  if (inst_it == _kitcuda_graph_instances.end()) {
+    // The first launch of a region instance picks the graph.
+    KitCudaGraphInstance inst = {KITCUDA_GRAPH_EAGER, nullptr, 0};
+    KitCudaGraph *&graph = _kitcuda_graphs[func];
+    if (graph == nullptr) {
+      graph = new KitCudaGraph;
+      CU_SAFE_CALL(cuGraphCreate_p(&graph->graph, 0));
+      inst.mode = KITCUDA_GRAPH_RECORD;
+      inst.graph = graph;
+    } else if (graph->ready && not graph->retired && not graph->busy) {
+      graph->busy = true;
+      inst.mode = KITCUDA_GRAPH_REPLAY;
+      inst.graph = graph;
+    }
+    inst_it = _kitcuda_graph_instances.emplace(stream, inst).first;
+  }
+
+  KitCudaGraphInstance &inst = inst_it->second;
+  CUDA_KERNEL_NODE_PARAMS params = {};
+  params.func = func;
+  params.gridDimX = blks_per_grid;
+  params.gridDimY = 1;
+  params.gridDimZ = 1;
+  params.blockDimX = threads_per_blk;
+  params.blockDimY = 1;
+  params.blockDimZ = 1;
+  params.sharedMemBytes = shared_mem_bytes;
+  params.kernelParams = kern_args;
+
+  bool deferred = false;
+  if (inst.mode == KITCUDA_GRAPH_RECORD) {
+    KitCudaGraph *graph = inst.graph;
+    if (graph->nodes.size() == KITCUDA_GRAPH_MAX_NODES) {
+      graph->retired = true;
+      inst.mode = KITCUDA_GRAPH_EAGER;
+      inst.graph = nullptr;
+    } else {
+      // The node's dependency on its predecessor preserves the stream
+      // ordering of the launches.  The arguments are copied when the
+      // node is added so the (eager) launch below can reuse them.
+      CUgraphNode node;
+      const CUgraphNode *deps =
+          graph->nodes.empty() ? nullptr : &graph->nodes.back().node;
+      CU_SAFE_CALL(cuGraphAddKernelNode_v2_p(&node, graph->graph, deps,
+                                             deps ? 1 : 0, &params));
+      graph->nodes.push_back({func, node});
+    }
+  } else if (inst.mode == KITCUDA_GRAPH_REPLAY) {
+    KitCudaGraph *graph = inst.graph;
+    if (inst.next_node < graph->nodes.size() &&
+        graph->nodes[inst.next_node].func == func) {
+      CU_SAFE_CALL(cuGraphExecKernelNodeSetParams_v2_p(
+          graph->exec, graph->nodes[inst.next_node].node, &params));
+      inst.next_node++;
+      deferred = true;
+    } else {
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: launch diverged from graph %p at "
+                "kernel %zu.\n", (void *)graph->graph, inst.next_node);
+      end_replay(inst, stream, true);
+    }
+  }
+  KIT_NVTX_POP();
+  return deferred;
+}
+
+void __kitcuda_graph_flush(void *opaque_stream) {
+  if (not _kitcuda_use_graphs)
+    return;
+
+  KIT_NVTX_PUSH("kitcuda:graph_flush", KIT_NVTX_LAUNCH);
+  std::lock_guard<std::mutex> lock(_kitcuda_graph_mutex);
+  // A null stream flushes the pending launches of all streams.
+  for (auto &entry : _kitcuda_graph_instances) {
+    if (opaque_stream != nullptr && entry.first != (CUstream)opaque_stream)
+      continue;
+    if (entry.second.mode == KITCUDA_GRAPH_REPLAY)
+      end_replay(entry.second, entry.first, false);
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_graph_sync(void *opaque_stream) {
+  if (not _kitcuda_use_graphs)
+    return;
+
+  KIT_NVTX_PUSH("kitcuda:graph_sync", KIT_NVTX_LAUNCH);
+  std::lock_guard<std::mutex> lock(_kitcuda_graph_mutex);
+  // A null stream completes the region instances of all streams (e.g.,
+  // when the context is synchronized and the streams are recycled).
+  for (auto inst_it = _kitcuda_graph_instances.begin();
+       inst_it != _kitcuda_graph_instances.end();) {
+    CUstream stream = inst_it->first;
+    if (opaque_stream != nullptr && stream != (CUstream)opaque_stream) {
+      ++inst_it;
+      continue;
+    }
+    KitCudaGraphInstance &inst = inst_it->second;
+    if (inst.mode == KITCUDA_GRAPH_RECORD)
+      end_record(inst);
+    else if (inst.mode == KITCUDA_GRAPH_REPLAY) {
+      bool diverged = inst.next_node != inst.graph->nodes.size();
+      end_replay(inst, stream, diverged);
+    }
+    inst_it = _kitcuda_graph_instances.erase(inst_it);
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_destroy_graphs() {
+  KIT_NVTX_PUSH("kitcuda:destroy_graphs", KIT_NVTX_CLEANUP);
+  std::lock_guard<std::mutex> lock(_kitcuda_graph_mutex);
+  // NOTE: This assumes no other threads are actively using the
+  // runtime (e.g., at program exit).
+  for (auto &entry : _kitcuda_graphs) {
+    KitCudaGraph *graph = entry.second;
+    if (graph->exec)
+      CU_SAFE_CALL(cuGraphExecDestroy_p(graph->exec));
+    CU_SAFE_CALL(cuGraphDestroy_p(graph->graph));
+    delete graph;
+  }
+  _kitcuda_graphs.clear();
+  _kitcuda_graph_instances.clear();
+  KIT_NVTX_POP();
+}
+
+} // extern "C"
@@ -0,0 +1,182 @@
+//===- heap.cpp - Kitsune runtime CUDA device heap  ----------------------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+// Calls to malloc() (and operator new) within kernels are lowered by
+// the compiler (see -cuabi-device-heap) to allocations from a heap the
+// runtime reserves on each device, rather than from CUDA's device heap,
+// which serializes the allocations of all threads.  The heap is a bump
+// allocator: a kernel reserves its bytes with an atomic add to 'top'
+// and falls back to CUDA's malloc() when the heap is exhausted.  Calls
+// to free() of heap memory are no-ops; the memory is released in bulk
+// when the heap is reset (see __kitcuda_heap_reset()).
+//
+// The layout of the heap must match the code the compiler generates
+// (see CudaLoop::lowerDeviceHeapCall()).  Each module that allocates
+// has a device-side global that holds the heap's device address.
+struct KitCudaHeap {
+  CUdeviceptr base; // the arena.
+  uint64_t size;    // of the arena in bytes.
+  uint64_t top;     // bytes allocated (may exceed 'size').
+};
+
+struct KitCudaHeapInfo {
+  CUdeviceptr heap;  // the device's KitCudaHeap.
+  CUdeviceptr arena;
+};
+
+static uint64_t _kitcuda_heap_size = 256ull << 20;
+static bool _kitcuda_heap_reset_on_sync = false;
+// The symbol of each registered module's heap global, by fat binary.
+static std::unordered_map<const void *, std::string> _kitcuda_heap_modules;
+// The heap of each context with a module that allocates.
+static std::unordered_map<CUcontext, KitCudaHeapInfo> _kitcuda_heaps;
+static std::mutex _kitcuda_heap_mutex;
+
+// Reset the heap of the current context; the context must be idle.
+static void _kitcuda_heap_reset(const KitCudaHeapInfo &info) {
+  uint64_t top = 0;
+  CU_SAFE_CALL(cuMemcpyHtoD_v2_p(info.heap + offsetof(KitCudaHeap, top),
+                                 &top, sizeof(top)));
+}
+
+extern "C" {
+
+void __kitcuda_set_heap_size(uint64_t bytes) {
+  _kitcuda_heap_size = bytes;
+}
+
+void __kitcuda_reset_heap_on_sync(bool enable) {
+  _kitcuda_heap_reset_on_sync = enable;
+}
+
+void __kitcuda_register_heap(const void *fat_bin, const char *sym_name) {
+  assert(fat_bin && sym_name && "unexpected null heap registration!");
+  std::lock_guard<std::mutex> lock(_kitcuda_heap_mutex);
+  _kitcuda_heap_modules[fat_bin] = sym_name;
+}
+
+void __kitcuda_heap_attach_module(const void *fat_bin, CUmodule cu_module) {
+  std::lock_guard<std::mutex> lock(_kitcuda_heap_mutex);
+  auto it = _kitcuda_heap_modules.find(fat_bin);
+  if (it == _kitcuda_heap_modules.end())
+    return;
+  // Without a heap the module's global stays null and its kernels
+  // allocate from CUDA's device heap.
+  if (_kitcuda_heap_size == 0)
+    return;
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+  auto heapit = _kitcuda_heaps.find(ctx);
+  if (heapit == _kitcuda_heaps.end()) {
+    KitCudaHeapInfo info;
+    if (cuMemAlloc_v2_p(&info.arena, _kitcuda_heap_size) != CUDA_SUCCESS) {
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: unable to reserve a %llu byte device "
+                "heap; kernels allocate from CUDA's heap.\n",
+                (unsigned long long)_kitcuda_heap_size);
+      return;
+    }
+    CU_SAFE_CALL(cuMemAlloc_v2_p(&info.heap, sizeof(KitCudaHeap)));
+    KitCudaHeap heap = {info.arena, _kitcuda_heap_size, 0};
+    CU_SAFE_CALL(cuMemcpyHtoD_v2_p(info.heap, &heap, sizeof(heap)));
+    heapit = _kitcuda_heaps.insert({ctx, info}).first;
+  }
+  CUdeviceptr sym_ptr;
+  size_t bytes;
+  if (cuModuleGetGlobal_v2_p(&sym_ptr, &bytes, cu_module,
+                             it->second.c_str()) != CUDA_SUCCESS)
+    return;
+  assert(bytes == sizeof(CUdeviceptr) && "unexpected device heap global!");
+  CU_SAFE_CALL(cuMemcpyHtoD_v2_p(sym_ptr, &heapit->second.heap,
+                                 sizeof(CUdeviceptr)));
+}
+
+void __kitcuda_heap_reset() {
+  std::lock_guard<std::mutex> lock(_kitcuda_heap_mutex);
+  for (auto &[ctx, info] : _kitcuda_heaps) {
+    CU_SAFE_CALL(cuCtxPushCurrent_v2_p(ctx));
+    CU_SAFE_CALL(cuCtxSynchronize_p());
+    _kitcuda_heap_reset(info);
+    CUcontext popped;
+    CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&popped));
+  }
+}
+
+void __kitcuda_heap_sync_context() {
+  if (!_kitcuda_heap_reset_on_sync)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_heap_mutex);
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+  auto it = _kitcuda_heaps.find(ctx);
+  if (it != _kitcuda_heaps.end())
+    _kitcuda_heap_reset(it->second);
+}
+
+void __kitcuda_destroy_heap() {
+  std::lock_guard<std::mutex> lock(_kitcuda_heap_mutex);
+  for (auto &[ctx, info] : _kitcuda_heaps) {
+    CU_SAFE_CALL(cuCtxPushCurrent_v2_p(ctx));
+    CU_SAFE_CALL(cuMemFree_v2_p(info.arena));
+    CU_SAFE_CALL(cuMemFree_v2_p(info.heap));
+    CUcontext popped;
+    CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&popped));
+  }
+  _kitcuda_heaps.clear();
+}
+
+} // extern "C"
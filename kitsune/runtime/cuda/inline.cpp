@@ -0,0 +1,120 @@
+//===- inline.cpp - Kitsune runtime CUDA inlinable fast paths  -------------===//
+// Copyright (c) 2021, 2024 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <stdio.h>
+
+// The fast paths of the runtime entry points that the compiler calls
+// for every launch and sync.  This file is part of the runtime library
+// and is also built as bitcode (libkitcuda-rt.bc).  The CUDA ABI
+// transform links the bitcode into host modules with its functions
+// made available_externally, so the host pipeline can inline them at
+// the call sites and fold what it knows there (e.g., a null stream);
+// calls that are not inlined still resolve to the runtime library.
+//
+// The functions here may only use the runtime's exported state and
+// must not define any state of their own -- an inlined copy would not
+// share it with the library.  Anything more goes to the out-of-line
+// (_slow) part of the entry point.
+
+extern "C" {
+
+void *__kitcuda_launch_kernel(const void *fat_bin, const char *kernel_name,
+                              void **kern_args, uint64_t trip_count,
+                              int threads_per_blk,
+                              const KitRTInstMix *inst_mix,
+                              void *opaque_stream,
+                              uint32_t iv_size,
+                              void **launch_handle) {
+  // A steady-state launch repeats the thread's previous launch of the
+  // kernel (see KitCudaFastLaunch).  The kernel's descriptor is only in
+  // the handle after its first launch.
+  const void *desc = launch_handle != nullptr
+                         ? __atomic_load_n(launch_handle, __ATOMIC_ACQUIRE)
+                         : nullptr;
+  if (desc != nullptr && not __kitrt_verbose_mode() &&
+      not __kitrt_profile_enabled()) {
+    uint64_t start = 0;
+    if (iv_size != 0) {
+      start = __kitcuda_read_iv_arg(kern_args[1], iv_size);
+      if (start > trip_count)
+        start = trip_count;
+    }
+    uint64_t work = trip_count - start;
+    const KitCudaFastLaunch *fast = __kitcuda_get_fast_launch(desc);
+    if (work != 0 && fast->desc == desc && fast->work == work &&
+        fast->inst_mix == inst_mix &&
+        fast->requested_threads_per_blk == threads_per_blk &&
+        fast->epoch ==
+            __atomic_load_n(&__kitcuda_launch_epoch, __ATOMIC_ACQUIRE)) {
+      CUstream cu_stream = opaque_stream != nullptr
+                               ? (CUstream)opaque_stream
+                               : (CUstream)__kitcuda_get_thread_stream();
+      CU_SAFE_CALL(cuLaunchKernel_p(fast->func, fast->blks_per_grid, 1, 1,
+                                    fast->threads_per_blk, 1, 1,
+                                    fast->shared_mem, cu_stream, kern_args,
+                                    NULL));
+      return (void *)cu_stream;
+    }
+  }
+  return __kitcuda_launch_kernel_slow(fat_bin, kernel_name, kern_args,
+                                      trip_count, threads_per_blk, inst_mix,
+                                      opaque_stream, iv_size, launch_handle);
+}
+
+void __kitcuda_sync_thread_stream(void *opaque_stream) {
+  // A null stream has no work to wait on (e.g., the code path that
+  // would have launched on the stream was not taken).
+  if (opaque_stream == nullptr)
+    return;
+  __kitcuda_sync_thread_stream_slow(opaque_stream);
+}
+
+} // extern "C"
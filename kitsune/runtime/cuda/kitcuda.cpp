@@ -49,6 +49,7 @@
 //
 //===----------------------------------------------------------------------===//
 #include <cassert>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -62,6 +63,7 @@
 #include <sstream>
 #include <stdbool.h>
 #include <sys/syscall.h>
+#include <thread>
 
 #include "kitcuda.h"
 #include "kitcuda_dylib.h"
@@ -70,20 +72,134 @@
 
 // Global state -- see accessors in kitcuda.h...
 bool _kitcuda_initialized = false;
+// Set once initialization has completed (see
+// __kitcuda_ensure_initialized()).
+bool _kitcuda_ready = false;
+
+// An initialization started by __kitcuda_initialize_async() runs on a
+// detached thread; other threads wait for it to complete.
+static std::mutex _kitcuda_init_mutex;
+static std::condition_variable _kitcuda_init_cv;
+static bool _kitcuda_init_running = false;
 int _kitcuda_device_id = -1;
 CUdevice _kitcuda_device = -1;
 CUcontext _kitcuda_context;
+unsigned _kitcuda_context_generation = 0;
+
+// The devices (and their primary contexts) that kernel launches may be
+// spread across.  Entry zero is always the primary device/context above.
+int _kitcuda_num_devices = 1;
+CUdevice _kitcuda_devices[KITCUDA_MAX_DEVICES];
+CUcontext _kitcuda_contexts[KITCUDA_MAX_DEVICES];
+
+// The properties of each device in the list above, queried once at
+// initialization (see __kitcuda_get_device_props_at()).
+KitCudaDeviceProps _kitcuda_device_props[KITCUDA_MAX_DEVICES];
 
-// TODO: We currently don't use these values within the runtime but
-// need to do so!
 static int _kitcuda_driver_version;
-static int _kitcuda_max_threads_per_blk;
-static int _kitcuda_warp_size;
-static int _kitcuda_supports_gpu_overlap;
-static int _kitcuda_supports_concurrent_kerns;
-static int _kitcuda_max_regs_per_blk;
-static int _kitcuda_major_compute_capability;
-static int _kitcuda_minor_compute_capability;
+static const char *_kitcuda_autotune_file = nullptr;
+
+namespace {
+
+// Snapshot the properties of the given device.  Some attributes are not
+// supported by all drivers and are left as zero when missing.
+void _kitcuda_query_device_props(CUdevice device, KitCudaDeviceProps *props) {
+  *props = KitCudaDeviceProps();
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->minor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->num_multiprocs, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+      device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->warp_size, CU_DEVICE_ATTRIBUTE_WARP_SIZE, device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->max_threads_per_blk, CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK,
+      device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->max_threads_per_multiproc,
+      CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR, device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->max_regs_per_blk, CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_BLOCK,
+      device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(
+      &props->max_shared_per_blk,
+      CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_BLOCK, device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(&props->supports_gpu_overlap,
+                                      CU_DEVICE_ATTRIBUTE_GPU_OVERLAP,
+                                      device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(&props->supports_concurrent_kerns,
+                                      CU_DEVICE_ATTRIBUTE_CONCURRENT_KERNELS,
+                                      device));
+  CU_SAFE_CALL(cuDeviceGetAttribute_p(&props->supports_coop_launch,
+                                      CU_DEVICE_ATTRIBUTE_COOPERATIVE_LAUNCH,
+                                      device));
+
+  struct {
+    int *value;
+    CUdevice_attribute attr;
+  } optional_attrs[] = {
+      {&props->l2_cache_bytes, CU_DEVICE_ATTRIBUTE_L2_CACHE_SIZE},
+      {&props->max_persisting_l2_bytes,
+       CU_DEVICE_ATTRIBUTE_MAX_PERSISTING_L2_CACHE_SIZE},
+      {&props->max_access_window_bytes,
+       CU_DEVICE_ATTRIBUTE_MAX_ACCESS_POLICY_WINDOW_SIZE},
+      {&props->clock_khz, CU_DEVICE_ATTRIBUTE_CLOCK_RATE},
+      {&props->mem_clock_khz, CU_DEVICE_ATTRIBUTE_MEMORY_CLOCK_RATE},
+      {&props->mem_bus_width, CU_DEVICE_ATTRIBUTE_GLOBAL_MEMORY_BUS_WIDTH},
+      {&props->host_page_tables,
+       CU_DEVICE_ATTRIBUTE_PAGEABLE_MEMORY_ACCESS_USES_HOST_PAGE_TABLES},
+  };
+  for (auto &opt : optional_attrs)
+    if (cuDeviceGetAttribute_p(opt.value, opt.attr, device) != CUDA_SUCCESS)
+      *opt.value = 0;
+  props->device_multiprocs = props->num_multiprocs;
+}
+
+void *_kitcuda_profile_event_create() {
+  CUevent event;
+  CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DEFAULT));
+  return (void *)event;
+}
+
+void _kitcuda_profile_event_record(void *event, void *stream) {
+  CU_SAFE_CALL(cuEventRecord_p((CUevent)event, (CUstream)stream));
+}
+
+bool _kitcuda_profile_event_query(void *event) {
+  CUresult result = cuEventQuery_p((CUevent)event);
+  if (result == CUDA_ERROR_NOT_READY)
+    return false;
+  CU_SAFE_CALL(result);
+  return true;
+}
+
+float _kitcuda_profile_event_elapsed(void *start, void *end) {
+  float msecs;
+  CU_SAFE_CALL(cuEventElapsedTime_p(&msecs, (CUevent)start, (CUevent)end));
+  return msecs;
+}
+
+void _kitcuda_profile_event_destroy(void *event) {
+  CU_SAFE_CALL(cuEventDestroy_v2_p((CUevent)event));
+}
+
+} // namespace
+
+const KitRTProfileEventOps _kitcuda_profile_ops = {
+    "cuda",
+    _kitcuda_profile_event_create,
+    _kitcuda_profile_event_record,
+    _kitcuda_profile_event_query,
+    _kitcuda_profile_event_elapsed,
+    _kitcuda_profile_event_destroy,
+#ifdef KITCUDA_ENABLE_CUPTI
+    &_kitcuda_cupti_metric_ops,
+#else
+    nullptr,
+#endif
+};
 
 #ifdef KITCUDA_ENABLE_NVTX
 const int KIT_NVTX_INIT = 0;
@@ -94,9 +210,41 @@ const int KIT_NVTX_CLEANUP = 4;
 
 #endif
 
+static bool _kitcuda_do_initialize();
+
 extern "C" {
 
 bool __kitcuda_initialize() {
+  std::unique_lock<std::mutex> lock(_kitcuda_init_mutex);
+  _kitcuda_init_cv.wait(lock, [] { return !_kitcuda_init_running; });
+  if (_kitcuda_ready) {
+    // The primary context was made current on the thread that did the
+    // initialization.
+    CUcontext ctx;
+    CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+    if (ctx == NULL)
+      CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+    return true;
+  }
+  return _kitcuda_do_initialize();
+}
+
+void __kitcuda_initialize_async() {
+  std::lock_guard<std::mutex> lock(_kitcuda_init_mutex);
+  if (_kitcuda_ready || _kitcuda_init_running)
+    return;
+  _kitcuda_init_running = true;
+  std::thread([] {
+    _kitcuda_do_initialize();
+    std::lock_guard<std::mutex> lock(_kitcuda_init_mutex);
+    _kitcuda_init_running = false;
+    _kitcuda_init_cv.notify_all();
+  }).detach();
+}
+
+} // extern "C"
+
+static bool _kitcuda_do_initialize() {
   KIT_NVTX_PUSH("kitcuda: initialize", KIT_NVTX_INIT);
   if (_kitcuda_initialized) {
     if (__kitrt_verbose_mode())
@@ -137,9 +285,18 @@ bool __kitcuda_initialize() {
 
   // On systems with multiple devices we can select one via the
   // environment.  This can be helpful when chasing issues related
-  // to GPU location within a node (e.g. NUMA-ness).
-  if (!__kitrt_get_env_value("KITCUDA_DEVICE_ID", _kitcuda_device_id))
+  // to GPU location within a node (e.g. NUMA-ness).  Otherwise, when
+  // started by an MPI launcher, the ranks on a node are spread
+  // round-robin across its devices.
+  int local_rank = 0;
+  bool rank_bound = false;
+  if (!__kitrt_get_env_value("KITCUDA_DEVICE_ID", _kitcuda_device_id)) {
     _kitcuda_device_id = 0;
+    if (__kitrt_get_local_rank(&local_rank)) {
+      _kitcuda_device_id = local_rank % device_count;
+      rank_bound = true;
+    }
+  }
 
   assert(_kitcuda_device_id < device_count &&
          "kitcuda: KITCUDA_DEVICE_ID value exceeds available number"
@@ -148,32 +305,46 @@ bool __kitcuda_initialize() {
   CU_SAFE_CALL(cuDeviceGet_p(&_kitcuda_device, _kitcuda_device_id));
   CU_SAFE_CALL(cuDevicePrimaryCtxRetain_p(&_kitcuda_context, _kitcuda_device));
   CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
-  _kitcuda_initialized = true;
 
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(&_kitcuda_max_threads_per_blk,
-                                      CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK,
-                                      _kitcuda_device));
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(
-      &_kitcuda_warp_size, CU_DEVICE_ATTRIBUTE_WARP_SIZE, _kitcuda_device));
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(&_kitcuda_supports_gpu_overlap,
-                                      CU_DEVICE_ATTRIBUTE_GPU_OVERLAP,
-                                      _kitcuda_device));
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(&_kitcuda_supports_concurrent_kerns,
-                                      CU_DEVICE_ATTRIBUTE_CONCURRENT_KERNELS,
-                                      _kitcuda_device));
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(
-      &_kitcuda_max_regs_per_blk, CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_BLOCK,
-      _kitcuda_device));
+  // Jobs that share the device (e.g., the members of an ensemble) can
+  // each be given a partition of its multiprocessors.
+  int partition_sms = 0;
+  if (__kitrt_get_env_value("KITCUDA_PARTITION_SMS", partition_sms) &&
+      partition_sms > 0) {
+    CUcontext partition =
+        __kitcuda_create_partition(_kitcuda_device, partition_sms);
+    if (partition) {
+      _kitcuda_context = partition;
+      CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+    }
+  }
+  _kitcuda_initialized = true;
 
-  CU_SAFE_CALL(cuDriverGetVersion_p(&_kitcuda_driver_version));
+  // Keep the host threads of a rank on the socket its device hangs
+  // off of.  KITRT_BIND_CPUS can be used to disable (or force) this.
+  bool bind_cpus = rank_bound;
+  (void)__kitrt_get_env_value("KITRT_BIND_CPUS", bind_cpus);
+  if (rank_bound && __kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: local rank %d bound to device %d.\n",
+            local_rank, _kitcuda_device_id);
+  if (bind_cpus) {
+    int pci_domain, pci_bus, pci_device;
+    CU_SAFE_CALL(cuDeviceGetAttribute_p(
+        &pci_domain, CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID, _kitcuda_device));
+    CU_SAFE_CALL(cuDeviceGetAttribute_p(
+        &pci_bus, CU_DEVICE_ATTRIBUTE_PCI_BUS_ID, _kitcuda_device));
+    CU_SAFE_CALL(cuDeviceGetAttribute_p(
+        &pci_device, CU_DEVICE_ATTRIBUTE_PCI_DEVICE_ID, _kitcuda_device));
+    (void)__kitrt_bind_to_pci_device(pci_domain, pci_bus, pci_device);
+  }
 
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(
-      &_kitcuda_major_compute_capability,
-      CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, _kitcuda_device));
+  const KitCudaDeviceProps *props = &_kitcuda_device_props[0];
+  _kitcuda_query_device_props(_kitcuda_device, &_kitcuda_device_props[0]);
+  // Size the launches to the partition (if any) rather than the device.
+  _kitcuda_device_props[0].num_multiprocs =
+      __kitcuda_query_partition_sms(props->device_multiprocs);
 
-  CU_SAFE_CALL(cuDeviceGetAttribute_p(
-      &_kitcuda_minor_compute_capability,
-      CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, _kitcuda_device));
+  CU_SAFE_CALL(cuDriverGetVersion_p(&_kitcuda_driver_version));
 
   if (__kitrt_verbose_mode()) {
     fprintf(stderr, "    kitcuda: found %d devices.\n", device_count);
@@ -181,19 +352,18 @@ bool __kitcuda_initialize() {
     fprintf(stderr, "             driver version:   %d\n",
             _kitcuda_driver_version);
     fprintf(stderr, "             compute capability: %d.%d (sm_%d)\n",
-            _kitcuda_major_compute_capability,
-            _kitcuda_minor_compute_capability,
-            _kitcuda_major_compute_capability * 10 +
-            _kitcuda_minor_compute_capability);
-    fprintf(stderr, "             warp size:        %d\n", _kitcuda_warp_size);
+            props->major, props->minor, props->major * 10 + props->minor);
+    fprintf(stderr, "             multiprocessors:  %d of %d\n",
+            props->num_multiprocs, props->device_multiprocs);
+    fprintf(stderr, "             warp size:        %d\n", props->warp_size);
     fprintf(stderr, "             max threads/blk:  %d\n",
-            _kitcuda_max_threads_per_blk);
+            props->max_threads_per_blk);
     fprintf(stderr, "             max regs/blk:     %d\n",
-            _kitcuda_max_regs_per_blk);
+            props->max_regs_per_blk);
     fprintf(stderr, "             concurrent kerns: %d\n",
-            _kitcuda_supports_concurrent_kerns);
+            props->supports_concurrent_kerns);
     fprintf(stderr, "             gpu overlap:      %d\n",
-            _kitcuda_supports_gpu_overlap);
+            props->supports_gpu_overlap);
   }
 
   // At this point we're ready to go as far as CUDA initialization
@@ -202,40 +372,306 @@ bool __kitcuda_initialize() {
 
   int threads_per_block = 256;
   if (__kitrt_get_env_value("KITCUDA_THREADS_PER_BLOCK", threads_per_block)) {
-    if (threads_per_block > _kitcuda_max_threads_per_blk)
-      threads_per_block = _kitcuda_max_threads_per_blk;
+    if (threads_per_block > props->max_threads_per_blk)
+      threads_per_block = props->max_threads_per_blk;
     __kitcuda_set_default_threads_per_blk(threads_per_block);
 
     if (__kitrt_verbose_mode())
       fprintf(stderr, "  kitcuda: threads/block: %d\n", threads_per_block);
   }
 
+  // Only override the launch settings when asked to: with asynchronous
+  // initialization (see __kitcuda_initialize_async()) the constructor
+  // of the module may already have set them.
   bool enable_occupancy_launch;
-  __kitrt_get_env_value("KITCUDA_USE_OCCUPANCY_LAUNCH",
-                        enable_occupancy_launch);
-  __kitcuda_use_occupancy_launch(enable_occupancy_launch);
-  if (__kitrt_verbose_mode())
-    fprintf(stderr, "  kitcuda: occupancy-based launches enabled.\n");
+  if (__kitrt_get_env_value("KITCUDA_USE_OCCUPANCY_LAUNCH",
+                            enable_occupancy_launch)) {
+    __kitcuda_use_occupancy_launch(enable_occupancy_launch);
+    if (__kitrt_verbose_mode() && enable_occupancy_launch)
+      fprintf(stderr, "  kitcuda: occupancy-based launches enabled.\n");
+  }
 
   bool enable_refine_occ_launch;
-  __kitrt_get_env_value("KITCUDA_REFINE_OCCUPANCY_LAUNCH",
-                        enable_refine_occ_launch);
-  __kitcuda_refine_occupancy_launches(enable_refine_occ_launch);
+  if (__kitrt_get_env_value("KITCUDA_REFINE_OCCUPANCY_LAUNCH",
+                            enable_refine_occ_launch))
+    __kitcuda_refine_occupancy_launches(enable_refine_occ_launch);
+
+  bool enable_device_resident = false;
+  __kitrt_get_env_value("KITCUDA_DEVICE_RESIDENT", enable_device_resident);
+  __kitcuda_use_device_resident_memory(enable_device_resident);
+  if (enable_device_resident && __kitrt_verbose_mode())
+    fprintf(stderr, "  kitcuda: device-resident memory enabled.\n");
+
+  bool enable_track_host_writes;
+  if (__kitrt_get_env_value("KITCUDA_TRACK_HOST_WRITES",
+                            enable_track_host_writes))
+    __kitcuda_track_host_writes(enable_track_host_writes);
+
+  bool enable_explicit_host_writes;
+  if (__kitrt_get_env_value("KITCUDA_EXPLICIT_HOST_WRITES",
+                            enable_explicit_host_writes))
+    __kitcuda_use_explicit_host_writes(enable_explicit_host_writes);
+
+  bool enable_lazy_host_prefetch = false;
+  __kitrt_get_env_value("KITCUDA_LAZY_HOST_PREFETCH",
+                        enable_lazy_host_prefetch);
+  __kitcuda_use_lazy_host_prefetch(enable_lazy_host_prefetch);
+
+  // The migration policy set by the environment overrides the one the
+  // compiler sets (see -cuabi-migrate).
+  if (const char *migrate = __kitrt_get_config("KITCUDA_MIGRATE_POLICY")) {
+    if (strcmp(migrate, "auto") == 0)
+      __kitcuda_set_migrate_policy(KITRT_MIGRATE_AUTO);
+    else if (strcmp(migrate, "prefetch") == 0)
+      __kitcuda_set_migrate_policy(KITRT_MIGRATE_PREFETCH);
+    else if (strcmp(migrate, "counters") == 0)
+      __kitcuda_set_migrate_policy(KITRT_MIGRATE_COUNTERS);
+    else if (strcmp(migrate, "host") == 0)
+      __kitcuda_set_migrate_policy(KITRT_MIGRATE_HOST);
+    else
+      fprintf(stderr, "kitcuda: warning, unknown KITCUDA_MIGRATE_POLICY "
+                      "'%s' (expected auto, prefetch, counters or host).\n",
+              migrate);
+  }
+  unsigned migrate_round_trips;
+  if (__kitrt_get_env_value("KITCUDA_MIGRATE_ROUND_TRIPS",
+                            migrate_round_trips))
+    __kitcuda_set_migrate_round_trips(migrate_round_trips);
+
+#ifdef KITCUDA_ENABLE_CUPTI
+  // The runtime charges its own prefetches to the allocation sites; the
+  // driver's migrations and page faults come from CUPTI.
+  if (__kitrt_mem_sites_enabled())
+    (void)_kitcuda_cupti_enable_uvm_counters(_kitcuda_device_id);
+#endif
+
+  bool enable_auto_persist = true;
+  unsigned persist_launches = 0;
+  __kitrt_get_env_value("KITCUDA_AUTO_PERSIST", enable_auto_persist);
+  __kitrt_get_env_value("KITCUDA_PERSIST_LAUNCHES", persist_launches);
+  __kitcuda_use_auto_persist(enable_auto_persist, persist_launches);
+
+  __kitcuda_create_mem_pool();
+
+  // Multiple devices within a node can be used to split the iteration
+  // space of large kernel launches.  Devices are selected starting
+  // with the primary device and wrapping around the device list.  A
+  // value of zero will use all the devices in the system.
+  _kitcuda_devices[0] = _kitcuda_device;
+  _kitcuda_contexts[0] = _kitcuda_context;
+  int num_devices = 1;
+  if (__kitrt_get_env_value("KITCUDA_NUM_DEVICES", num_devices)) {
+    if (num_devices <= 0 || num_devices > device_count)
+      num_devices = device_count;
+    if (num_devices > KITCUDA_MAX_DEVICES)
+      num_devices = KITCUDA_MAX_DEVICES;
+    if (num_devices > 1 && enable_device_resident) {
+      fprintf(stderr, "kitcuda: warning, multi-device launches are not "
+                      "supported with device-resident memory.\n");
+      num_devices = 1;
+    }
+  }
+  for (int i = 1; i < num_devices; i++) {
+    int id = (_kitcuda_device_id + i) % device_count;
+    CU_SAFE_CALL(cuDeviceGet_p(&_kitcuda_devices[i], id));
+    CU_SAFE_CALL(cuDevicePrimaryCtxRetain_p(&_kitcuda_contexts[i],
+                                            _kitcuda_devices[i]));
+    _kitcuda_query_device_props(_kitcuda_devices[i],
+                                &_kitcuda_device_props[i]);
+  }
+  _kitcuda_num_devices = num_devices;
+
+  // Peer access allows a kernel to directly touch the pages of a
+  // managed allocation that live on another device (e.g., at the
+  // edges of a partition) instead of faulting them over.
+  for (int i = 0; i < num_devices; i++) {
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_contexts[i]));
+    for (int j = 0; j < num_devices; j++) {
+      int can_access = 0;
+      if (i == j)
+        continue;
+      CU_SAFE_CALL(cuDeviceCanAccessPeer_p(&can_access, _kitcuda_devices[i],
+                                           _kitcuda_devices[j]));
+      if (can_access) {
+        CUresult result = cuCtxEnablePeerAccess_p(_kitcuda_contexts[j], 0);
+        if (result != CUDA_SUCCESS &&
+            result != CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED)
+          CU_SAFE_CALL(result);
+      }
+    }
+  }
+  CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  uint64_t min_trip_count;
+  if (__kitrt_get_env_value("KITCUDA_MULTI_DEVICE_MIN_TRIPS", min_trip_count))
+    __kitcuda_set_multi_device_min_trip_count(min_trip_count);
+
+  // The device memory of a job that shares the device is limited to a
+  // budget, by default that of its MPS client.
+  uint64_t mem_budget = __kitcuda_default_mem_budget(_kitcuda_device_id);
+  __kitrt_get_env_value("KITCUDA_MEM_BUDGET", mem_budget);
+  __kitcuda_set_mem_budget(mem_budget);
+  if (mem_budget && __kitrt_verbose_mode())
+    fprintf(stderr, "  kitcuda: device memory budget of %ld bytes.\n",
+            mem_budget);
+
+  // Launches whose managed data does not fit in device memory can be
+  // streamed through the device a chunk at a time.  This is enabled by
+  // default within a memory budget.
+  bool enable_out_of_core = mem_budget != 0;
+  __kitrt_get_env_value("KITCUDA_OUT_OF_CORE", enable_out_of_core);
+  if (enable_out_of_core) {
+    size_t total_mem;
+    CU_SAFE_CALL(cuDeviceTotalMem_v2_p(&total_mem, _kitcuda_device));
+    if (mem_budget && mem_budget < total_mem)
+      total_mem = mem_budget;
+    uint64_t budget = total_mem / 4 * 3;
+    __kitrt_get_env_value("KITCUDA_OUT_OF_CORE_BYTES", budget);
+    int buffers = 3;
+    __kitrt_get_env_value("KITCUDA_OUT_OF_CORE_BUFFERS", buffers);
+    __kitcuda_set_out_of_core(budget, buffers);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "  kitcuda: out-of-core launches above %ld bytes.\n",
+              budget);
+  }
+
+  bool enable_coarsen_launch = true;
+  __kitrt_get_env_value("KITCUDA_COARSEN_LAUNCH", enable_coarsen_launch);
+  __kitcuda_use_coarsened_launch(enable_coarsen_launch);
+  int max_iters_per_thread;
+  if (__kitrt_get_env_value("KITCUDA_MAX_ITERS_PER_THREAD",
+                            max_iters_per_thread))
+    __kitcuda_set_max_iters_per_thread(max_iters_per_thread);
+  int max_launch_waves;
+  if (__kitrt_get_env_value("KITCUDA_MAX_LAUNCH_WAVES", max_launch_waves))
+    __kitcuda_set_max_launch_waves(max_launch_waves);
+
+  bool enable_device_log = true;
+  __kitrt_get_env_value("KITCUDA_DEVICE_LOG", enable_device_log);
+  __kitcuda_enable_device_log(enable_device_log);
+  uint64_t log_records;
+  if (__kitrt_get_env_value("KITCUDA_LOG_RECORDS", log_records))
+    __kitcuda_set_log_records(log_records);
+
+  uint64_t heap_size;
+  if (__kitrt_get_env_value("KITCUDA_HEAP_SIZE", heap_size))
+    __kitcuda_set_heap_size(heap_size);
+  bool heap_reset = false;
+  __kitrt_get_env_value("KITCUDA_HEAP_RESET", heap_reset);
+  __kitcuda_reset_heap_on_sync(heap_reset);
+
+  bool enable_autotune = false;
+  __kitrt_get_env_value("KITCUDA_AUTOTUNE", enable_autotune);
+  __kitcuda_enable_autotune(enable_autotune);
+  int autotune_trials;
+  if (__kitrt_get_env_value("KITCUDA_AUTOTUNE_TRIALS", autotune_trials))
+    __kitcuda_set_autotune_trials(autotune_trials);
+  if (enable_autotune) {
+    _kitcuda_autotune_file = __kitrt_get_config("KITCUDA_AUTOTUNE_FILE");
+    if (_kitcuda_autotune_file)
+      __kitcuda_load_autotune_table(_kitcuda_autotune_file);
+  }
+
+  // Load modules (and resolve kernels) in the background as they are
+  // registered rather than on first launch.
+  bool enable_preload = false;
+  __kitrt_get_env_value("KITCUDA_PRELOAD_MODULES", enable_preload);
+  __kitcuda_enable_module_preload(enable_preload);
 
+  // Specialized launches compile a variant of the kernel for each of (up
+  // to this many) sets of values.
+  int max_specializations;
+  if (__kitrt_get_env_value("KITCUDA_MAX_SPECIALIZATIONS",
+                            max_specializations))
+    __kitcuda_set_max_specializations(max_specializations);
+
+  // Graph launches reorder kernels with respect to the copies of
+  // device-resident data and do not (yet) span multiple devices.
+  bool enable_graphs = false;
+  __kitrt_get_env_value("KITCUDA_USE_GRAPHS", enable_graphs);
+  __kitcuda_use_graph_launch(enable_graphs && not enable_device_resident &&
+                             num_devices == 1);
+
+  // Dataflow launches spread the kernels of a region across worker
+  // streams ordered by their data dependences.
+  bool enable_dataflow = false;
+  __kitrt_get_env_value("KITCUDA_DATAFLOW", enable_dataflow);
+  unsigned dataflow_streams = 0;
+  __kitrt_get_env_value("KITCUDA_DATAFLOW_STREAMS", dataflow_streams);
+  __kitcuda_use_dataflow_launch(enable_dataflow && num_devices == 1,
+                                dataflow_streams);
+
+  // Persistent kernels turn small launches into pushes onto the work
+  // queue of a resident worker kernel (see persistent.cpp).  Graph and
+  // dataflow launches reorder kernels and take precedence.
+  bool enable_persistent = false;
+  __kitrt_get_env_value("KITCUDA_PERSISTENT_KERNELS", enable_persistent);
+  uint64_t persistent_max_trips = 0;
+  __kitrt_get_env_value("KITCUDA_PERSISTENT_MAX_TRIPS", persistent_max_trips);
+  __kitcuda_use_persistent_kernels(enable_persistent && not enable_graphs &&
+                                       not enable_dataflow &&
+                                       num_devices == 1,
+                                   persistent_max_trips);
+
+  if (__kitrt_verbose_mode() && num_devices > 1)
+    fprintf(stderr, "  kitcuda: multi-device launches over %d devices.\n",
+            num_devices);
+
+  __atomic_fetch_add(&_kitcuda_context_generation, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&_kitcuda_ready, true, __ATOMIC_RELEASE);
   KIT_NVTX_POP();
   return _kitcuda_initialized;
 }
 
+extern "C" {
+
 void __kitcuda_destroy() {
+  {
+    std::unique_lock<std::mutex> lock(_kitcuda_init_mutex);
+    _kitcuda_init_cv.wait(lock, [] { return !_kitcuda_init_running; });
+  }
   if (not _kitcuda_initialized)
     return;
 
   KIT_NVTX_PUSH("kitcuda:destroy", KIT_NVTX_CLEANUP);
-  __kitcuda_destroy_thread_streams();
-  __kitrt_destroy_memory_map(__kitcuda_mem_destroy);
+  // The events of the profiler (and of timing spans, which use them when
+  // the profiler is disabled) must be resolved while the context is alive.
+  __kitrt_profile_flush(&_kitcuda_profile_ops);
+  __kitcuda_stop_module_preload();
+  if (_kitcuda_autotune_file)
+    __kitcuda_save_autotune_table(_kitcuda_autotune_file);
+  __kitcuda_destroy_persistent();
+  __kitcuda_destroy_shmem();
+  // Outside of the full exit mode the resources that the context owns
+  // are not released one by one (see KitRTExitMode).
+  KitRTExitMode exit_mode = __kitrt_get_exit_mode();
+  bool full_exit = exit_mode == KITRT_EXIT_FULL;
+  if (full_exit) {
+    __kitcuda_destroy_graphs();
+    __kitcuda_destroy_dataflow();
+    __kitcuda_destroy_heap();
+  }
+  __kitcuda_destroy_log();
+  __kitcuda_destroy_file_maps();
+  __kitcuda_destroy_persist();
+  if (full_exit) {
+    __kitcuda_destroy_prefetch_streams();
+    __kitcuda_destroy_reductions();
+    __kitcuda_destroy_thread_streams();
+    __kitcuda_destroy_mem_pool();
+  }
+  __kitrt_destroy_memory_map(__kitcuda_mem_destroy,
+                             __kitcuda_mem_destroy_mirror);
   // Note that all resources associated with the context will be destroyed.
-  CU_SAFE_CALL(cuDevicePrimaryCtxReset_v2_p(_kitcuda_device));
+  if (exit_mode != KITRT_EXIT_LEAK) {
+    __kitcuda_destroy_partition();
+    for (int i = 1; i < _kitcuda_num_devices; i++)
+      CU_SAFE_CALL(cuDevicePrimaryCtxRelease_v2_p(_kitcuda_devices[i]));
+    CU_SAFE_CALL(cuDevicePrimaryCtxReset_v2_p(_kitcuda_device));
+  }
+  _kitcuda_num_devices = 1;
   _kitcuda_initialized = false;
+  __atomic_store_n(&_kitcuda_ready, false, __ATOMIC_RELEASE);
   KIT_NVTX_POP();
 }
 
@@ -80,7 +80,8 @@ extern "C" {
  *
  * - Multiple calls to the function will guard against
  *   re-initialization if it was previously successful.
- * - This call is not thread safe.
+ * - Concurrent calls are serialized and calls made while an
+ *   asynchronous initialization is running wait for it.
  *
  * There are a number of environment variables that can tweak the
  * behavior of the runtime:
@@ -88,19 +89,101 @@ extern "C" {
  *    - **KITCUDA_THREADS_PER_BLOCK**: Number of threads per block of
  *      the kernel launch.  This number has an internal default
  *      (currently 256).  This is a global setting and will apply to
- *      all kernel launches.
+ *      all kernel launches.  A 'KITCUDA_THREADS_PER_BLOCK:<kernel>'
+ *      setting (see `__kitrt_get_config()`) overrides the block size
+ *      of a single kernel.
  *
  *    - **KITCUDA_DEVICE_ID**: Select a specific GPU device to use.
  *      This is intended to allow experimentation across different
- *      GPUs within a single system.  The runtime currently only
- *      supports a single GPU and this will default to the first GPU
- *      in the system if left unset.
+ *      GPUs within a single system.  This will default to the first
+ *      GPU in the system if left unset and is the primary device
+ *      when multiple devices are used.
+ *
+ *    - **KITCUDA_NUM_DEVICES**: The number of GPUs to spread large
+ *      kernel launches across (zero selects all GPUs in the system).
+ *      The iteration space of a launch is split evenly across the
+ *      devices and each slice's portion of the managed memory
+ *      arguments is prefetched to its device.  Defaults to one.
+ *
+ *    - **KITCUDA_MULTI_DEVICE_MIN_TRIPS**: The minimum number of
+ *      iterations each device must receive for a launch to be split
+ *      across multiple devices.  Smaller launches stay on the
+ *      primary device.
+ *
+ *    - **KITCUDA_COARSEN_LAUNCH**: Enable/disable assigning multiple
+ *      iterations to each thread of large launches (see
+ *      `__kitcuda_use_coarsened_launch()`).  Enabled by default.
+ *
+ *    - **KITCUDA_MAX_ITERS_PER_THREAD**: The maximum number of
+ *      iterations assigned to each thread (default 8).
+ *
+ *    - **KITCUDA_MAX_LAUNCH_WAVES**: The maximum number of waves of
+ *      threads in a coarsened launch (default 32, zero for no limit).
+ *
+ *    - **KITCUDA_AUTOTUNE**: Enable the online tuning of the
+ *      threads-per-block used by kernel launches (see
+ *      `__kitcuda_enable_autotune()`).  Disabled by default.
+ *
+ *    - **KITCUDA_AUTOTUNE_TRIALS**: The number of timed launches of
+ *      each candidate block size during tuning (default 3).
+ *
+ *    - **KITCUDA_AUTOTUNE_FILE**: A file that holds tuned launch
+ *      parameters between runs.  It is read at initialization and
+ *      (re)written with the current results by `__kitcuda_destroy()`.
+ *
+ *    - **KITCUDA_USE_GRAPHS**: Enable the capture and replay of the
+ *      kernels launched by a sync region as a CUDA graph (see
+ *      `__kitcuda_use_graph_launch()`).  Disabled by default and
+ *      ignored when device-resident memory or multiple devices are
+ *      used.
+ *
+ *    - **KITCUDA_PERSISTENT_KERNELS**: Enable pushing small launches
+ *      onto the work queue of a resident worker kernel (see
+ *      `__kitcuda_use_persistent_kernels()`).  Requires code built
+ *      with `-mllvm -cuabi-persistent-kernels`.  Disabled by default
+ *      and ignored when graph or dataflow launches or multiple
+ *      devices are used.
+ *
+ *    - **KITCUDA_PERSISTENT_MAX_TRIPS**: The largest trip count of a
+ *      pushed launch (default 262144).
+ *
+ *    - **KITCUDA_USE_BLAS**: Enable/disable running the matrix
+ *      products recognized by the compiler with cuBLAS (see
+ *      `__kitcuda_launch_gemm()`).  Enabled by default; cuBLAS is
+ *      loaded on first use.
  *
  * Applications should call `__kitcuda_destroy()` at program exit.
+ * The KITRT_EXIT_MODE environment variable can be used to skip the
+ * individual release of allocations and other resources it does (see
+ * `KitRTExitMode`).
  *
  **/
 extern bool __kitcuda_initialize();
 
+/**
+ * Start the initialization of the runtime on a background thread and
+ * return immediately, so the (expensive) driver and context setup
+ * overlaps with the host code that runs before the first allocation
+ * or kernel launch.  Those wait for the initialization to complete
+ * (see `__kitcuda_ensure_initialized()`), as does a later call to
+ * `__kitcuda_initialize()`.  The module constructors emitted by the
+ * compiler use this unless built with `-mllvm -cuabi-async-init=false`.
+ */
+extern void __kitcuda_initialize_async();
+
+/**
+ * Make sure the runtime is ready for use: wait for an initialization
+ * started by `__kitcuda_initialize_async()` or, if there is none,
+ * initialize the runtime.  This is a single (acquire) load once the
+ * runtime is initialized.
+ */
+inline void __kitcuda_ensure_initialized() {
+  extern bool _kitcuda_ready;
+  if (__builtin_expect(!__atomic_load_n(&_kitcuda_ready, __ATOMIC_ACQUIRE),
+                       0))
+    (void)__kitcuda_initialize();
+}
+
 /**
  * Load the requried CUDA dynamic symbols for use by the runtime.
  */
@@ -156,18 +239,31 @@ __kitcuda_mem_alloc_managed(size_t num_bytes);
  * system `calloc()` call and the entire allocated memory will be
  * set to zero.
  *
- * With managed memory it is important to note that this function
- * uses the CPU to zero-set the allocation -- this means the memory
- * will become fully host-side resident upon return.
+ * The allocation is zeroed on the device, ordered on a runtime stream
+ * that is synchronized before the call returns (the legacy default
+ * stream, and the work of other streams, is not waited on).
  *
  * @param nmemb The number of elements to allocate.
  * @param elem_size_in_bytes The size, in bytes, of a single element.
- *
- * @todo Make a path for device-side initialization.
  */
 extern __attribute__((malloc)) void *
 __kitcuda_mem_calloc_managed(size_t count, size_t elemsize);
 
+/**
+ * A stream-ordered version of `__kitcuda_mem_calloc_managed()`.  The
+ * allocation is zeroed asynchronously on the given stream -- the host
+ * must not access the memory until the stream is synchronized.  Kernel
+ * launches that use the allocation on other streams wait for the
+ * zeroing to complete.
+ *
+ * @param opaque_stream - The stream to zero the memory on.  If it
+ *                        points to null a stream is assigned and
+ *                        returned.
+ */
+extern __attribute__((malloc)) void *
+__kitcuda_mem_calloc_managed_async(size_t count, size_t elemsize,
+                                   void **opaque_stream);
+
 /**
  * Change the size of an existing managed memory allocation (a la
  * the `realloc()` system call). The current contents of the
@@ -184,6 +280,10 @@ __kitcuda_mem_calloc_managed(size_t count, size_t elemsize);
  *   - Like traditional system calls, the provided pointer must have
  *     been allocated by the kitsune runtime routines.  The allocation
  *     will fail if a non-kitsune allocation is referenced.
+ *   - The allocation is resized in place when it shrinks or when it
+ *     grows within the block it was served from by the memory pool.
+ *     Otherwise the contents are copied to a new allocation, ordered
+ *     on the calling thread's stream (only that stream is waited on).
  *
  * @param ptr - The pointer to *realloc* space for.
  * @param size - The size, in bytes, of the new allocation.
@@ -195,6 +295,63 @@ __kitcuda_mem_calloc_managed(size_t count, size_t elemsize);
 extern __attribute__((malloc)) void *__kitcuda_mem_realloc_managed(void *ptr,
                                                                    size_t size);
 
+/**
+ * Reserve `max_bytes` of managed memory for an array that grows in
+ * place (see `kitsune::vector`).  Managed pages are only populated
+ * when first touched, so the reservation costs address space rather
+ * than memory and the array never moves as it grows.  Reservations
+ * are not served from the memory pool.
+ *
+ * @param max_bytes - The largest size, in bytes, the array can reach.
+ */
+extern __attribute__((malloc)) void *
+__kitcuda_mem_reserve_managed(size_t max_bytes);
+
+/**
+ * Commit the leading `nbytes` of a reservation, which then behaves
+ * like an allocation of that size (e.g., for prefetching) until it is
+ * committed again.  Committing less than before keeps the memory.
+ *
+ * @param base - The pointer returned by the reservation.
+ * @param nbytes - The size, in bytes, of the array.
+ */
+extern void __kitcuda_mem_commit_managed(void *base, size_t nbytes);
+
+/**
+ * Release a reservation and all the memory committed within it.
+ *
+ * @param base - The pointer returned by the reservation.
+ * @param max_bytes - The size, in bytes, the range was reserved with.
+ */
+extern void __kitcuda_mem_release_managed(void *base, size_t max_bytes);
+
+/**
+ * Map the file at `path` as a read-only array (see `kitsune::map_file`).
+ * The host uses the file mapping in place.  The device uses a mirror
+ * that a background thread loads in chunks, through pinned staging
+ * buffers, while the host continues; the first kernel that uses the
+ * array waits for the load to complete.  Returns null if the file
+ * cannot be mapped.
+ *
+ * @param path - The path of the file.
+ * @param nbytes - If not null, set to the size of the file in bytes.
+ */
+extern void *__kitcuda_mem_map_file(const char *path, size_t *nbytes);
+
+/**
+ * Release a file mapped by `__kitcuda_mem_map_file()`.  Any kernels that
+ * use the array must be complete.
+ *
+ * @param ptr - The pointer returned by the mapping.
+ */
+extern void __kitcuda_mem_unmap_file(void *ptr);
+
+/**
+ * Release all the mapped files.  This is called as part of the
+ * runtime's cleanup at exit.
+ */
+extern void __kitcuda_destroy_file_maps();
+
 /**
  * Free the given managed memory allocation.  The allocation
  * referred to by `ptr` must have been previously allocated with one
@@ -225,6 +382,133 @@ extern void __kitcuda_mem_free(void *ptr);
  */
 extern void __kitcuda_mem_destroy(void *ptr);
 
+/**
+ * Free only the CUDA portions of a device-resident allocation (the
+ * pinned host-side buffer and its device-side mirror).  Like
+ * `__kitcuda_mem_destroy()` this is used by the runtime during cleanup
+ * at application exit.
+ *
+ * @param ptr - A pointer to the host-side buffer.
+ * @param mirror - A pointer to the device-side buffer.
+ */
+extern void __kitcuda_mem_destroy_mirror(void *ptr, void *mirror);
+
+/**
+ * Create the runtime's managed memory pool.  When enabled (see
+ * `mem_pool.h` for the controlling environment variables) managed
+ * memory allocations are carved out of larger slabs and freed blocks
+ * are cached for reuse instead of being returned to the driver.  This
+ * is called as part of runtime initialization.
+ */
+extern void __kitcuda_create_mem_pool();
+
+/**
+ * Release the managed memory pool and all of its slabs back to the
+ * driver.  This is called as part of the runtime's cleanup at exit
+ * and must occur before the memory map is destroyed.
+ */
+extern void __kitcuda_destroy_mem_pool();
+
+/**
+ * Note that the context has been synchronized.  Blocks freed to the
+ * managed memory pool before the synchronization may then be reused
+ * without checking their fences (kernels still in flight when they
+ * were freed have completed).
+ */
+extern void __kitcuda_mem_context_synced();
+
+/**
+ * Allocate a page-locked (pinned) host buffer.  Pinned buffers are the
+ * source and destination of explicit, asynchronous transfers (e.g.,
+ * packed MPI halos) and are also directly accessible by kernels.  They
+ * are served from a pool of size classes alongside the managed memory
+ * pool and are not tracked by the runtime's memory map.
+ *
+ * @param size - The size of the buffer in bytes.
+ */
+extern __attribute__((malloc)) void *__kitcuda_mem_alloc_pinned(size_t size);
+
+/**
+ * Return a pinned buffer to the pool.  If a stream is given the buffer
+ * is only reused once all the work issued on the stream so far has
+ * completed, so it may be freed directly behind asynchronous copies
+ * or kernels that use it.
+ *
+ * @param ptr - A buffer from `__kitcuda_mem_alloc_pinned()`.
+ * @param opaque_stream - The stream that last uses the buffer (or null
+ *                        when no work is outstanding).
+ */
+extern void __kitcuda_mem_free_pinned(void *ptr, void *opaque_stream);
+
+/**
+ * Allocate a buffer in device memory.  Device buffers are not tracked
+ * by the runtime's memory map and are never migrated; they are meant
+ * for data the host only hands to device-aware libraries (e.g., packed
+ * halos for CUDA-aware MPI).
+ *
+ * @param size - The size of the buffer in bytes.
+ */
+extern __attribute__((malloc)) void *__kitcuda_mem_alloc_device(size_t size);
+
+/**
+ * Release a buffer from `__kitcuda_mem_alloc_device()`.
+ */
+extern void __kitcuda_mem_free_device(void *ptr);
+
+/**
+ * Allocate a buffer in the symmetric heap (NVSHMEM), initializing
+ * NVSHMEM on first use.  The allocation is collective: every processing
+ * element must allocate the same sizes in the same order, and the
+ * buffer of each is at the same offset of its heap, so kernels can
+ * access the buffers of other processing elements.  Symmetric buffers
+ * are device memory and are not tracked by the runtime's memory map.
+ *
+ * @param size - The size of the buffer in bytes.
+ */
+extern __attribute__((malloc)) void *
+__kitcuda_mem_alloc_symmetric(size_t size);
+
+/**
+ * Release a buffer from `__kitcuda_mem_alloc_symmetric()`.  This is
+ * collective and waits for the work on the device to complete.
+ */
+extern void __kitcuda_mem_free_symmetric(void *ptr);
+
+/**
+ * Initialize NVSHMEM on the runtime's primary context, if it is not
+ * already.  It is bootstrapped as configured by its environment (e.g.,
+ * `NVSHMEM_BOOTSTRAP=MPI`).
+ */
+extern void __kitcuda_shmem_init();
+
+/**
+ * Finalize NVSHMEM (collectively).  Programs that use MPI must do so
+ * before `MPI_Finalize()`; otherwise it is done at exit.
+ */
+extern void __kitcuda_shmem_finalize();
+
+/**
+ * Return the index of this processing element and the number of
+ * processing elements.
+ */
+extern int __kitcuda_shmem_my_pe();
+extern int __kitcuda_shmem_n_pes();
+
+/**
+ * Wait for all processing elements to arrive and for their outstanding
+ * symmetric memory accesses to complete.
+ */
+extern void __kitcuda_shmem_barrier_all();
+
+/**
+ * Return `true` if the data of the allocation that holds the given
+ * pointer is on the device (i.e., kernels access it without moving
+ * it) and `false` if it is in host memory or unknown to the runtime.
+ * The host-side buffers of device-resident allocations are current
+ * once their stream is synchronized and count as host memory.
+ */
+extern bool __kitcuda_mem_on_device(void *ptr);
+
 /**
  * Request that the memory allocation associated with the given
  * pointer be prefetched to GPU memory.  The memory must have been
@@ -240,6 +524,30 @@ extern void __kitcuda_mem_destroy(void *ptr);
  */
 extern void* __kitcuda_mem_gpu_prefetch(void *ptr, void *opaque_stream);
 
+/**
+ * Request an early prefetch of the managed memory allocation that
+ * contains the given pointer.  The compiler issues this call at the
+ * earliest point ahead of a kernel launch where the host no longer
+ * writes the data.  The request is made on one of the runtime's
+ * dedicated prefetch streams (see `__kitrt_prefetchStreamsEnabled()`)
+ * and the launch's stream waits only on the prefetches for its own
+ * arguments (see `__kitcuda_mem_gpu_map()`).  This call is a no-op
+ * when prefetch streams are disabled, device-resident memory or
+ * multiple devices are in use, or the data has already been
+ * prefetched.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
+ * @param access - The access mode (KITRT_MEM_ACCESS_*) of the kernel
+ * argument.
+ */
+extern void __kitcuda_mem_gpu_prefetch_async(void *ptr, int access);
+
+/**
+ * Release the runtime's prefetch streams and any pending prefetch
+ * events.
+ */
+extern void __kitcuda_destroy_prefetch_streams();
+
 /**
  * Request that the memory allocation associated with the given
  * pointer be prefetched to the host (CPU) memory.  The memory must
@@ -256,208 +564,1531 @@ extern void* __kitcuda_mem_gpu_prefetch(void *ptr, void *opaque_stream);
 extern void* __kitcuda_mem_host_prefetch(void *ptr, void *opaque_stream);
 
 /**
- * Find the named symbol in the given CUDA module represented by
- * the provided fat binary.
+ * Mark the managed memory allocation that contains the given pointer
+ * as cold, i.e., not used by kernels for a while (e.g., state that is
+ * only touched every few timesteps).  Its pages are moved to host
+ * memory and kept there, freeing device memory for the data that is in
+ * use, instead of being evicted piecemeal when the device memory is
+ * oversubscribed.  The data returns to the device with the prefetch of
+ * the next kernel launch that uses it.  Device-resident allocations
+ * and pointers that are not recognized by the runtime are ignored.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
  */
-uint64_t __kitcuda_get_global_symbol(void *fat_bin, const char *sym_name);
+extern void __kitcuda_mem_mark_cold(void *ptr);
 
 /**
- * Copy the given symbol from host memory to device memory.  This is
- * most often used when doing code generation for global values that
- * need to have identical values on the device side (GPU).  These
- * calls are typically issued prior to kernel launch to make sure
- * values are synchronized.
+ * Keep the allocation that contains the given pointer resident in the
+ * device's L2 cache across kernel launches (e.g., a coefficient table
+ * or connectivity array that every kernel of a timestep reads).  Part
+ * of the L2 is set aside for the allocation's lines and an access
+ * policy window for it is set on the streams kernels are launched on.
+ * There is a single window: the hint replaces the current one and
+ * stops the automatic selection (see `__kitcuda_use_auto_persist()`)
+ * until `__kitcuda_mem_persist_reset()`.  Allocations larger than the
+ * maximum window only have their leading bytes persist.  This is a
+ * no-op on devices without a persisting L2 region (before Ampere) and
+ * for pointers that are not recognized by the runtime.
  *
- * @param host_sym - a pointer to the host-side symbol.
- * @param dev_sym - handle to the device-side symbol.
- * @param nbytes - size in bytes of the symbol.
+ * **NOTE**: Kernels launched from a graph (see
+ * `__kitcuda_use_graph_launch()`) do not use stream attributes.
+ *
+ * @param ptr - The pointer to (or into) the allocation.
  */
-extern void __kitcuda_memcpy_sym_to_device(void *host_sym, uint64_t dev_sym,
-                                           size_t nbytes);
+extern void __kitcuda_mem_persist(void *ptr);
 
 /**
- * Given a pointer to a fat binary, launch the named kernel with the
- * given arguments, and trip count.  For the current Kitsune use cases
- * the compiler will embed the fat binary into the final executable
- * and the arguments will be determined during outlining.
- *
- * The runtime will determine an underlying target stream based on
- * the calling thread.  It is currently assumed that the calling
- * thread will issue any prefetch, launch, and synchronization calls
- * on its assigned stream.  This implementation path deprecates
- * previous APIs that exposed streams as part of the API.
- *
- * @param fat_bin - The fat binary image containing the compiled kernel.
- * @param kern_name - The name of the kernel to launch.
- * @param kern_args - The argument buffer for the kernel.
- * @param trip_count - Total size of the work to execution (aka trip count).
- * @param threads_per_blk - threads per block (set to zero for auto determination).
+ * Drop the L2 persistence window and release the persisting lines for
+ * normal use.  Call this at a phase boundary, once the data persisted
+ * in the previous phase is no longer hot.  The automatic selection
+ * starts over.
  */
-extern void* __kitcuda_launch_kernel(const void *fat_bin, const char *kern_name,
-                                     void **kern_args, uint64_t trip_count, 
-                                     int threads_per_blk,
-				     const KitRTInstMix *inst_mix,
-                                     void *opaque_stream);
+extern void __kitcuda_mem_persist_reset();
 
 /**
- * Enable/Disable the use of occupancy calculations for the
- * determination of kernel launch parameters.  If the `enable`
- * parameter is set to `true` occupancy-based launches will be
- * used for *all* kernel launches.  `false` will disable and
- * the runtime will fall-back to either custom or default
- * launch parameters.
+ * Enable/disable the automatic selection of the data to persist in
+ * the L2 when no allocation has been given by `__kitcuda_mem_persist()`.
+ * The selected allocation is the read-only kernel argument mapped by
+ * the most launches (at least `num_launches`) in the current phase
+ * that fits within the device's persisting L2 region.  This is enabled
+ * by default and may be set with the `KITCUDA_AUTO_PERSIST` and
+ * `KITCUDA_PERSIST_LAUNCHES` (default 4) environment variables.
  *
- * @param enable - enable/disable occupancy-based launches
+ * @param enable - if `true` select the data automatically.
+ * @param num_launches - the launches that must read an allocation
+ *                       before it is selected (zero keeps the current
+ *                       setting).
  */
-extern void __kitcuda_use_occupancy_launch(bool enable);
+extern void __kitcuda_use_auto_persist(bool enable, unsigned num_launches);
 
-/** 
- * Enable/Disable the tuning of occupancy-based calculations for
- * the determination of kernel launch parameters.  If the `enable`
- * parameter is set to `true` both occupancy-based launches and 
- * the refinement of the occupancy-driven results will be used. 
- * `enable == true` will enable occupancy_launches. 
+/**
+ * Count a launch that reads (only) the given allocation as part of the
+ * automatic selection of the data to persist in the L2.
  *
- * @param enable - enable/disable tuned occupancy launches.
+ * @param base - The allocation's base address in the memory map.
+ * @param dev_base - The allocation's address on the device.
+ * @param size - The allocation's size in bytes.
  */
- extern void __kitcuda_refine_occupancy_launches(bool enable);
+extern void __kitcuda_mem_persist_note(void *base, void *dev_base,
+                                       size_t size);
 
 /**
- * Set the runtime's value for the number of threads-per-block used
- * in simple launch parameter calculations.
+ * Set the current L2 persistence window on the given stream, unless it
+ * is already set.  This is called for each stream handed out for a
+ * launch and is a no-op until a window is first selected.
  *
- * @param nthreads - number of threads per block
- * @todo The parameter value needs to be asserted or clamped!
+ * @param opaque_stream - The stream.
+ * @param new_stream - `true` if the stream was just created.
  */
-extern void __kitcuda_set_default_threads_per_blk(int nthreads);
+extern void __kitcuda_mem_persist_apply(void *opaque_stream,
+                                        bool new_stream);
 
 /**
- * Set the runtime's value for the maximum number of threads allowed
- * per block (typically a hardware limit).  The compiler will insert
- * a call to this function to match any specific code generation
- * settings that were used.  This mirrors some HIP functionality but
- * is not critical for CUDA -- given differences in the LLVM backends
- * for each target...
+ * Drop the L2 persistence window if it holds the given allocation,
+ * which is about to be freed.
  */
-extern void __kitcuda_set_default_max_threads_per_blk(int nthreads);
+extern void __kitcuda_mem_persist_forget(void *base);
 
 /**
- * Provide a set of set of launch parameters to use for subsequent
- * kernel launch calls.  If this call is not made prior to a launch
- * call a set of default values will be used.  Specifically a given
- * number of threads will be set and then a classic CUDA style
- * computation will be used to determine the other details.  At
- * present the default threads-per-block is set to `256` and may be
- * controlled via the `KITCUDA_THREADS_PER_BLOCK` environment variable
- * at runtime.
- *
- * **NOTE** These settings will remain in effect for all launch
- * calls from the calling point forward -- i.e., it tweaks a global
- * state.  Therefore this call is not thread safe as it is possible
- * to race over these values.
- *
- * @param `blks_per_grid`: The number of blocks in a grid for the
- *         subsequent launch call(s).
- * @param `threads_per_blk`: The number of threads in a block for
- *        the subsequent launch call(s).
+ * Release the runtime's L2 persistence state.
+ */
+extern void __kitcuda_destroy_persist();
+
+/**
+ * Enable (or disable) the device-resident memory mode.  By default
+ * the runtime allocates managed (unified) memory and relies on the
+ * driver to migrate pages between the host and device.  On systems
+ * where page migration is slow the device-resident mode instead
+ * returns a pinned host-side buffer from the allocation calls and
+ * pairs it with an (unmanaged) device-side buffer.  Data is moved
+ * between the two with explicit asynchronous copies at kernel launch
+ * and stream synchronization points.  This mode can also be enabled
+ * at runtime by setting the KITCUDA_DEVICE_RESIDENT environment
+ * variable.  It must be selected before any allocations are made.
  *
- * @todo Make these parameters thread safe and bound to the next
- * kernel launch call(s).
+ * @param enable - if `true` use device-resident allocations.
  */
-extern void __kitcuda_set_custom_launch_params(unsigned blks_per_grid,
-                                               unsigned threads_per_blk);
+extern void __kitcuda_use_device_resident_memory(bool enable);
 
 /**
- * Return a thread-aware stream. 
+ * Enable/Disable the tracking of host writes to device-resident data.
+ * When enabled the host-side buffers are write-protected once a
+ * synchronization has copied them back, and only the buffers the host
+ * then writes are copied to the device ahead of the next kernel that
+ * uses them.  The protection relies on a process-wide SIGSEGV handler
+ * that replaces the program's, and system calls (e.g., read(2)) fail
+ * with EFAULT rather than fault on a protected buffer.  Tracking is
+ * disabled by default; every buffer is then copied to the device again
+ * after each synchronization (but see
+ * `__kitcuda_use_explicit_host_writes()`).  This can also be set via
+ * the `KITCUDA_TRACK_HOST_WRITES` environment variable.
  */
-extern void* __kitcuda_get_thread_stream();
+extern void __kitcuda_track_host_writes(bool enable);
 
 /**
- * Synchronize the associated stream.
+ * Enable/Disable explicit host writes to device-resident data.  When
+ * enabled the program reports every host write to device-resident
+ * data made after a synchronization with `__kitrt_mem_host_write()`,
+ * and only the reported ranges are copied to the device ahead of the
+ * next kernel that uses the data.  Unreported writes are lost.  This
+ * can also be set via the `KITCUDA_EXPLICIT_HOST_WRITES` environment
+ * variable.
  */
-extern void __kitcuda_sync_thread_stream(void *opaque_stream);
+extern void __kitcuda_use_explicit_host_writes(bool enable);
 
 /**
- * Synchronize the host-side with **all** underlying streams in the
- * current CUDA context.  There a certain cases where we can't
- * guarantee correctness without blocking the CPU execution until
- * all work is complete on the GPU.  This is obviously not always
- * ideal in terms of performance but for correctness this makes code
- * generation sound when analysis is unavailable or inadequate.
+ * Enable/Disable lazy host prefetches.  When enabled, host prefetch
+ * requests (see `__kitcuda_mem_host_prefetch()`) leave managed data on
+ * the device rather than migrating the entire allocation.  The pages
+ * the host touches fault over on demand, and the ranges reported via
+ * `__kitrt_mem_host_write()` are the only data moved back to the
+ * device ahead of the next kernel.  This can also be set via the
+ * `KITCUDA_LAZY_HOST_PREFETCH` environment variable.
  */
-extern void __kitcuda_sync_context();
+extern void __kitcuda_use_lazy_host_prefetch(bool enable);
 
 /**
- * Destroy the stream that is associated with the calling thread.
- * If a stream has not been assigned to the thread this call will
- * simply return and function as a no-op.
+ * Set the migration policy (see `KitRTMigratePolicy`) of the managed
+ * allocations that have not been given one.  The default is
+ * `KITRT_MIGRATE_AUTO`.  The compiler sets the policy given by its
+ * `-cuabi-migrate` option and it can also be set via the
+ * `KITCUDA_MIGRATE_POLICY` environment variable (auto, prefetch,
+ * counters or host), which takes precedence.
  */
-extern void __kitcuda_delete_thread_stream(void *opaque_stream);
+extern void __kitcuda_set_migrate_policy(int policy);
 
 /**
- * Destroy all the thread-associated streams that are being managed
- * by the runtime.  This call will essentially use CUDA to destroy
- * each stream and the associated data structure entries used by the
- * runtime.
+ * Set the number of times the data of an allocation may move from the
+ * device back to the host before the automatic migration policy stops
+ * prefetching it (four by default).  This can also be set via the
+ * `KITCUDA_MIGRATE_ROUND_TRIPS` environment variable.
  */
-extern void __kitcuda_destroy_thread_streams();
+extern void __kitcuda_set_migrate_round_trips(unsigned round_trips);
 
-/*
- * The following global state lives within the runtime to avoid
- * exposing these details into the code generation details. These
- * calls are typically used within the runtime implementation and
- * not within generated code sections -- therefore we expose
- * CUDA-centric types.
+/**
+ * Set the migration policy (see `KitRTMigratePolicy`) of the managed
+ * allocation that contains the given pointer, e.g., to keep an array
+ * the host and the kernels share in host memory.
  */
+extern void __kitcuda_mem_set_migrate_policy(void *ptr, int policy);
 
 /**
- * Has the CUDA portion of the Kitsune runtime been successfully
- * initialized?
+ * Prepare the memory referenced by the given kernel argument for use
+ * on the GPU and return the pointer the kernel should use.  For
+ * managed allocations this is equivalent to a prefetch request and
+ * the provided pointer is returned.  For device-resident allocations
+ * the host-side data is copied to the device (unless the argument is
+ * write-only or the device copy is already current) and the matching
+ * device-side address is returned.  Device-side data written by the
+ * kernel (i.e., not read-only) is copied back to the host when the
+ * stream is synchronized.
+ *
+ * @param ptr - The (host-side) pointer passed as a kernel argument.
+ * @param access - The argument's access mode (see `KitRTMemAccess`).
+ * @param opaque_stream - The stream for the upcoming kernel launch.
+ *                        If it points to null a stream is assigned
+ *                        and returned.
  */
-inline bool __kitcuda_is_initialized() {
-  extern bool _kitcuda_initialized;
-  return _kitcuda_initialized;
-}
+extern void *__kitcuda_mem_gpu_map(void *ptr, int access,
+                                   void **opaque_stream);
 
 /**
- * Get the CUDA device associated with the currently initialized
- * runtime.  Note this call will assert if the runtime is not
- * initialized.
+ * Map the memory referenced by a kernel's pointer arguments with a
+ * single call (see `__kitcuda_mem_gpu_map()`).  Arguments that
+ * reference the same allocation are mapped once, with the union of
+ * their access modes, and pointers into an allocation that is already
+ * mapped are translated without another lookup.
+ *
+ * A launch site can also pass a cache of `num_ptrs + 1` entries.  When
+ * none of the arguments needed any work (all of them were already in
+ * place on the device) the entries are set to the epoch of the runtime's
+ * allocation map (see `__kitrt_mem_epoch`) followed by the pointers.
+ * As long as the epoch is unchanged, a later launch from the site with
+ * the same pointers does not need to map them and the compiler skips
+ * the call -- the steady-state check is a load and compare per pointer.
+ *
+ * @param ptrs - The (host-side) pointers, replaced in place by the
+ *               pointers the kernel should use.
+ * @param access - The access mode of each pointer.
+ * @param num_ptrs - The number of pointers.
+ * @param opaque_stream - The stream for the upcoming kernel launch.
+ *                        If it points to null a stream is assigned
+ *                        and returned.
+ * @param cache - The launch site's cache (may be null).
  */
-inline CUdevice __kitcuda_get_device() {
-  extern CUdevice _kitcuda_device;
-  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
-  return _kitcuda_device;
-}
+extern void __kitcuda_mem_gpu_map_batch(void **ptrs, const int *access,
+                                        int num_ptrs, void **opaque_stream,
+                                        void **cache);
 
 /**
- * Get the current CUDA device ID associated with the currently
- * initialized runtime.  Note this call will assert if the runtime
- * is not initialized.
+ * Enqueue copies of the device-resident data written by kernels on
+ * the given stream back to the host.  This is used as part of stream
+ * synchronization and is a no-op when device-resident memory is not
+ * enabled.
  */
-inline CUdevice __kitcuda_get_device_id() {
-  extern CUdevice _kitcuda_device_id;
-  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
-  return _kitcuda_device_id;
-}
+extern void __kitcuda_mem_flush_mirrors(void *opaque_stream);
 
 /**
- * Get the current CUDA context for the currently initialized
- * runtime.  Note that this code will assert if the runtime is not
- * initialized.
+ * Complete the synchronization of device-resident data referenced on
+ * the given stream.  Once the host regains control of the data the
+ * device copies are only assumed to be current until the host writes
+ * to them (see `__kitcuda_track_host_writes()`).  This must be called
+ * after the stream has been synchronized.
  */
-inline CUcontext __kitcuda_get_context() {
-  extern CUcontext _kitcuda_context;
-  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
-  return _kitcuda_context;
-}
+extern void __kitcuda_mem_release_mirrors(void *opaque_stream);
 
-#ifdef __cplusplus
-} // extern "C"
-#endif
+/**
+ * Provide the device-side location a kernel reduces into for the given
+ * host variable.  The compiler replaces the kernel argument for each
+ * reduction result with the returned pointer.  The location starts out
+ * with the host variable's current value and is copied back to the
+ * host variable when the stream is synchronized.
+ *
+ * @param ptr - The host-side pointer to the reduction result.
+ * @param size - The size of the result in bytes (at most 16).
+ * @param opaque_stream - The stream for the upcoming kernel launch.
+ *                        If it points to null a stream is assigned
+ *                        and returned.
+ */
+extern void *__kitcuda_mem_reduce_map(void *ptr, uint64_t size,
+                                      void **opaque_stream);
+
+/**
+ * Enqueue the copies of the reduction results of kernels on the given
+ * stream (or all streams if null) back to the host.  This is used as
+ * part of stream synchronization.
+ */
+extern void __kitcuda_mem_flush_reductions(void *opaque_stream);
+
+/**
+ * Recycle the device-side reduction locations used on the given stream
+ * (or all streams if null).  This must be called after the stream has
+ * been synchronized.
+ */
+extern void __kitcuda_mem_release_reductions(void *opaque_stream);
+
+/**
+ * Release the device memory used for reduction results.
+ */
+extern void __kitcuda_destroy_reductions();
+
+/**
+ * Enable/disable the background preloading of modules (see
+ * `__kitcuda_preload_module()`).  This is disabled by default and
+ * may be enabled by setting the `KITCUDA_PRELOAD_MODULES` environment
+ * variable.
+ */
+extern void __kitcuda_enable_module_preload(bool enable);
+
+/**
+ * Queue the given fat binary to be loaded in the background, along
+ * with the launch details of each of its kernels.  The compiler calls
+ * this from each module's constructor so that module loading (and any
+ * JIT compilation of embedded PTX) overlaps with program startup
+ * rather than occurring within the first launch.  Launches only block
+ * if the kernel they need has not been loaded yet.  This is a no-op
+ * unless preloading is enabled.
+ *
+ * @param fat_bin - The fat binary image.
+ * @param kernel_names - The names of the kernels in the image.
+ * @param handles - The launch handle of each kernel.
+ * @param num_kernels - The number of kernels.
+ */
+extern void __kitcuda_preload_module(const void *fat_bin,
+                                     const char **kernel_names,
+                                     void ***handles, int num_kernels);
+
+/**
+ * Stop any background preloading and wait for the worker thread to
+ * exit.  Modules that have not yet been loaded are loaded on first
+ * use.
+ */
+extern void __kitcuda_stop_module_preload();
+
+/**
+ * Set the maximum number of specialized variants of each specialized
+ * launch (see `__kitcuda_specialize_launch()`).  Launches with values
+ * beyond the limit use the generic kernel, and zero disables
+ * specialization.  The default is 8 and it may also be set via the
+ * `KITCUDA_MAX_SPECIALIZATIONS` environment variable.
+ */
+extern void __kitcuda_set_max_specializations(int max_variants);
+
+/**
+ * Return the launch handle to use for a launch of a kernel that is
+ * specialized on the values of some of its parameters (the
+ * `kitsune::specialize` attribute).  The first launch with a given set
+ * of values compiles a variant of the kernel from the module's PTX with
+ * the parameter loads replaced by the values, and later launches with
+ * the same values reuse it.  The launch passes the returned handle in
+ * place of its own, which is returned if the launch is not specialized.
+ *
+ * @param ptx - The (null terminated) PTX of the kernel's module.
+ * @param kernel_name - The name of the kernel.
+ * @param kern_args - The kernel arguments of the launch.
+ * @param params - The indices of the specialized parameters.
+ * @param num_params - The number of specialized parameters.
+ * @param site_handle - A (null initialized) handle for the launch site.
+ * @param launch_handle - The kernel's launch handle.
+ */
+extern void **__kitcuda_specialize_launch(const char *ptx,
+                                          const char *kernel_name,
+                                          void **kern_args, const int *params,
+                                          int num_params, void **site_handle,
+                                          void **launch_handle);
+
+/**
+ * Register a fat binary holding relocatable device code.  The compiler
+ * calls this from each module's constructor when relocatable device
+ * code is enabled (`-mllvm -cuabi-rdc`).  The first use of any of the
+ * registered fat binaries links all of them into a single module, so
+ * device code may call functions defined in other modules.  All such
+ * registrations must occur before the first launch.
+ *
+ * @param fat_bin - The fat binary image.
+ */
+extern void __kitcuda_register_rdc_module(const void *fat_bin);
+
+/**
+ * Return the named kernel of the given fat binary on the primary
+ * device, loading its module if needed.
+ */
+extern CUfunction __kitcuda_get_kernel(const void *fat_bin,
+                                       const char *kernel_name);
+
+/**
+ * Find the named symbol in the given CUDA module represented by
+ * the provided fat binary.
+ */
+uint64_t __kitcuda_get_global_symbol(void *fat_bin, const char *sym_name);
+
+/**
+ * Copy the given symbol from host memory to device memory.  This is
+ * most often used when doing code generation for global values that
+ * need to have identical values on the device side (GPU).  These
+ * calls are typically issued prior to kernel launch to make sure
+ * values are synchronized.
+ *
+ * @param host_sym - a pointer to the host-side symbol.
+ * @param dev_sym - handle to the device-side symbol.
+ * @param nbytes - size in bytes of the symbol.
+ */
+extern void __kitcuda_memcpy_sym_to_device(void *host_sym, uint64_t dev_sym,
+                                           size_t nbytes);
+
+/**
+ * A host global variable and its location within a module's block of
+ * device-side globals.
+ */
+typedef struct {
+  void *host_ptr;  // the host-side variable.
+  uint64_t offset; // byte offset within the device-side block.
+  uint64_t size;   // size in bytes of the variable.
+} KitCudaGlobalEntry;
+
+/**
+ * Bring a module's block of device-side global variables up to date
+ * with their host values prior to a kernel launch.  The block is
+ * resolved on first use and cached in the given handle.  Only the
+ * range of the block whose host values have changed since the last
+ * update is copied, with a single copy on the launch's stream.
+ *
+ * @param fat_bin - The fat binary containing the block.
+ * @param block_name - The (device-side) name of the block.
+ * @param entries - The host variables packed into the block.
+ * @param num_entries - The number of entries.
+ * @param block_size - The size in bytes of the block.
+ * @param handle - A (null-initialized) per-module handle.
+ * @param opaque_stream - A pointer to the launch's stream.  A stream
+ * is assigned if it is null.  If the pointer itself is null the copy
+ * is synchronous.
+ */
+extern void __kitcuda_update_globals(void *fat_bin, const char *block_name,
+                                     const KitCudaGlobalEntry *entries,
+                                     int num_entries, uint64_t block_size,
+                                     void **handle, void **opaque_stream);
+
+/**
+ * Release the runtime state held in the given global block handle.
+ */
+extern void __kitcuda_destroy_globals(void *handle);
+
+/**
+ * Given a pointer to a fat binary, launch the named kernel with the
+ * given arguments, and trip count.  For the current Kitsune use cases
+ * the compiler will embed the fat binary into the final executable
+ * and the arguments will be determined during outlining.
+ *
+ * The runtime will determine an underlying target stream based on
+ * the calling thread.  It is currently assumed that the calling
+ * thread will issue any prefetch, launch, and synchronization calls
+ * on its assigned stream.  This implementation path deprecates
+ * previous APIs that exposed streams as part of the API.
+ *
+ * When multiple devices are enabled (see `KITCUDA_NUM_DEVICES`) and
+ * the launch is large enough the iteration space is partitioned
+ * across the devices.  The first two kernel arguments must then be
+ * the end and start of the iteration space (matching the compiler's
+ * code generation) and `iv_size` gives their size in bytes.  Work on
+ * the other devices is joined back into the returned stream so the
+ * caller's synchronization is unchanged.
+ *
+ * Resolving the kernel (and its launch attributes) from the fat binary
+ * and name requires a lookup keyed on the kernel's name.  To avoid this
+ * on every launch the compiler passes a pointer to a per-kernel handle
+ * (`launch_handle`) that starts out null.  The first launch stores the
+ * runtime's cached kernel descriptor in the handle and later launches
+ * use it directly.  A null `launch_handle` is also accepted and always
+ * takes the lookup path.
+ *
+ * @param fat_bin - The fat binary image containing the compiled kernel.
+ * @param kern_name - The name of the kernel to launch.
+ * @param kern_args - The argument buffer for the kernel.
+ * @param trip_count - Total size of the work to execution (aka trip count).
+ * @param threads_per_blk - threads per block (set to zero for auto determination).
+ * @param iv_size - size in bytes of the iteration space arguments (zero
+ *                  if the launch can not be partitioned).
+ * @param launch_handle - pointer to the kernel's cached launch handle
+ *                        (may be null).
+ */
+extern void* __kitcuda_launch_kernel(const void *fat_bin, const char *kern_name,
+                                     void **kern_args, uint64_t trip_count, 
+                                     int threads_per_blk,
+				     const KitRTInstMix *inst_mix,
+                                     void *opaque_stream,
+                                     uint32_t iv_size,
+                                     void **launch_handle);
+
+/**
+ * The launch path of `__kitcuda_launch_kernel()` beyond its fast path
+ * (same arguments).  `__kitcuda_launch_kernel()` itself (inline.cpp)
+ * only relaunches a kernel with the geometry of the thread's previous
+ * launch of it and is also built as bitcode that the compiler links
+ * into host code, so steady-state launches are inlined at the launch
+ * site.  Everything else is done here.
+ */
+extern void *__kitcuda_launch_kernel_slow(const void *fat_bin,
+                                          const char *kern_name,
+                                          void **kern_args,
+                                          uint64_t trip_count,
+                                          int threads_per_blk,
+                                          const KitRTInstMix *inst_mix,
+                                          void *opaque_stream,
+                                          uint32_t iv_size,
+                                          void **launch_handle);
+
+/**
+ * The geometry of a thread's previous launch of a kernel.  Steady-state
+ * launches of a kernel (the same kernel, amount of work and requested
+ * block size as the previous launch) reuse it and go straight to the
+ * driver -- the launch parameters, block size limit, shared memory and
+ * iterations per thread are not recomputed.  Entries are per thread, so
+ * they are never shared (or invalidated) across threads, and are only
+ * recorded for launches that take none of the optional paths of a
+ * launch (multiple devices, persistent workers, autotuning,
+ * out-of-core, dataflow and graph launches, profiling or verbose
+ * output).
+ */
+typedef struct {
+  const void *desc;            // the kernel's launch descriptor.
+  CUfunction func;
+  const KitRTInstMix *inst_mix;
+  uint64_t work;
+  uint64_t epoch;              // see __kitcuda_launch_epoch.
+  int requested_threads_per_blk;
+  int blks_per_grid;
+  int threads_per_blk;
+  unsigned shared_mem;
+} KitCudaFastLaunch;
+
+#define KITCUDA_FAST_LAUNCH_ENTRIES 8
+
+extern __thread KitCudaFastLaunch
+    __kitcuda_fast_launches[KITCUDA_FAST_LAUNCH_ENTRIES];
+
+/**
+ * Return the calling thread's fast launch entry for the kernel with
+ * the given launch descriptor.
+ */
+static inline KitCudaFastLaunch *__kitcuda_get_fast_launch(const void *desc) {
+  return &__kitcuda_fast_launches[((uintptr_t)desc >> 4) %
+                                  KITCUDA_FAST_LAUNCH_ENTRIES];
+}
+
+/**
+ * The launch configuration epoch.  It advances whenever a setting that
+ * takes launches off the fast path changes (autotuning, dataflow,
+ * graph and persistent launches and the out-of-core budget), and fast
+ * launch entries recorded in an earlier epoch are not used.
+ */
+extern uint64_t __kitcuda_launch_epoch;
+
+static inline void __kitcuda_advance_launch_epoch() {
+  __atomic_fetch_add(&__kitcuda_launch_epoch, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Read an iteration space value (of `iv_size` bytes) from the kernel
+ * argument buffer.
+ */
+static inline uint64_t __kitcuda_read_iv_arg(void *arg, uint32_t iv_size) {
+  if (iv_size == sizeof(uint32_t))
+    return *(uint32_t *)arg;
+  else if (iv_size == sizeof(uint64_t))
+    return *(uint64_t *)arg;
+  return 0;
+}
+
+/**
+ * Launch the named kernel over a two or three dimensional iteration
+ * space.  The compiler uses this for kernels that split a flattened
+ * iteration space into coordinates (e.g., 'i = tid / N, j = tid % N'
+ * or a Kokkos MDRangePolicy) and take their coordinates from the
+ * block and thread indices in x, y (and z).  The arguments match
+ * `__kitcuda_launch_kernel()` with the addition of the geometry.
+ *
+ * The iteration space is row-major with x varying the fastest;
+ * `inner_extents` holds the `num_dims - 1` extents of the inner
+ * dimensions and the outermost extent follows from the trip count.
+ * Each block covers a tile of the iteration space: x spans (up to) a
+ * warp and the rest of the block is spread over the outer dimensions.
+ * The kernel skips the part of its tiles that falls outside the
+ * iteration space.  For 2D launches rows that do not fit in the grid's
+ * y dimension are placed in z.
+ *
+ * These launches always use a single device and are not captured in
+ * launch graphs or autotuned.
+ *
+ * @param num_dims - the number of dimensions (2 or 3).
+ * @param inner_extents - the extents of the inner dimensions (x first).
+ */
+extern void *__kitcuda_launch_kernel_nd(const void *fat_bin,
+                                        const char *kern_name,
+                                        void **kern_args, uint64_t trip_count,
+                                        int threads_per_blk,
+                                        const KitRTInstMix *inst_mix,
+                                        void *opaque_stream, uint32_t iv_size,
+                                        void **launch_handle,
+                                        uint32_t num_dims,
+                                        const uint64_t *inner_extents);
+
+/**
+ * Copy the elements [start, end) of `src` to `dst` on the copy engines
+ * in place of launching a kernel.  The compiler uses this for foralls
+ * whose body only copies an array (`dst[i] = src[i]`) -- the copy runs
+ * at full bandwidth and leaves the SMs free for concurrent kernels.
+ * The copy is ordered like a launch on the given stream (the calling
+ * thread's stream if null), which is returned.
+ *
+ * @param dst - the (device-side) destination of element zero.
+ * @param src - the (device-side) source of element zero.
+ * @param start - the first element to copy.
+ * @param end - the end of the elements to copy.
+ * @param elt_size - the size of an element in bytes.
+ * @param opaque_stream - the stream to copy on.
+ */
+extern void *__kitcuda_launch_memcpy(void *dst, const void *src,
+                                     uint64_t start, uint64_t end,
+                                     uint32_t elt_size, void *opaque_stream);
+
+/**
+ * Fill the elements [start, end) of `dst` with `value` on the copy
+ * engines in place of launching a kernel.  The compiler uses this for
+ * foralls whose body only stores a loop-invariant value (`dst[i] = 0`).
+ * Elements are 1, 2 or 4 bytes and take the low bytes of `value`.  The
+ * fill is ordered like a launch on the given stream (the calling
+ * thread's stream if null), which is returned.
+ */
+extern void *__kitcuda_launch_memset(void *dst, uint32_t value,
+                                     uint64_t start, uint64_t end,
+                                     uint32_t elt_size, void *opaque_stream);
+
+/**
+ * Compute the elements [start, end) of the row-major matrix product
+ * `c = a * transpose(b)` with cuBLAS in place of launching a kernel.
+ * The compiler uses this for foralls whose iterations each compute
+ * an element of the product,
+ *
+ *   forall(i = 0; i < m * n; i++)
+ *     c[i] = sum(a[(i / n) * k + j] * b[(i % n) * k + j], 0 <= j < k)
+ *
+ * of the m x k matrix `a` and the n x k matrix `b` (a matrix-vector
+ * product when n is one).  Elements are floats or doubles.  The
+ * product is ordered like a launch on the given stream (the calling
+ * thread's stream if null), which is returned.  Null is returned,
+ * and nothing is done, if cuBLAS is not available (or is disabled
+ * with the `KITCUDA_USE_BLAS` environment variable) or the loop does
+ * not cover the whole product; the caller then launches the kernel.
+ *
+ * @param c - the (device-side) product.
+ * @param a - the (device-side) m x k matrix.
+ * @param b - the (device-side) n x k matrix.
+ * @param start - the first element of the product to compute.
+ * @param end - the end of the elements to compute.
+ * @param n - the number of columns of the product.
+ * @param k - the length of the rows of a and b.
+ * @param elt_size - the size of an element in bytes.
+ * @param opaque_stream - the stream to compute the product on.
+ */
+extern void *__kitcuda_launch_gemm(void *c, const void *a, const void *b,
+                                   uint64_t start, uint64_t end, uint64_t n,
+                                   uint64_t k, uint32_t elt_size,
+                                   void *opaque_stream);
+
+/**
+ * Set the minimum number of iterations each device must be assigned
+ * before a kernel launch is partitioned across multiple devices.  This
+ * can also be set via the `KITCUDA_MULTI_DEVICE_MIN_TRIPS` environment
+ * variable.
+ */
+extern void __kitcuda_set_multi_device_min_trip_count(uint64_t trip_count);
+
+/**
+ * Issue the prefetches of the managed memory arguments that have been
+ * mapped (see `__kitcuda_mem_gpu_map()`) for a pending launch on the
+ * given stream.  The launch is split into `num_slices` slices of the
+ * iteration space, slice `i` covers `[bounds[i], bounds[i+1])` and
+ * runs on the runtime's i-th device using `slice_streams[i]`.  Each
+ * allocation is assumed to be accessed in proportion to the iteration
+ * space and the matching portion is prefetched to each device.
+ * Read-only data is duplicated on every device.  This is only used
+ * when multiple devices are enabled.
+ */
+extern void __kitcuda_mem_gpu_prefetch_slices(void *opaque_stream,
+                                              int num_slices,
+                                              const uint64_t *bounds,
+                                              void **slice_streams);
+
+/**
+ * Enable out-of-core launches.  When the managed data mapped for a
+ * (1-dimensional) launch exceeds `budget_bytes` the launch's iteration
+ * space is split into chunks whose share of the data is a
+ * `num_buffers` fraction of the budget.  Each chunk's data is
+ * prefetched on one of `num_buffers` streams, its kernel runs on the
+ * launch stream once the data has arrived, and the data is then
+ * evicted back to the host on the same stream -- so the prefetch of
+ * the next chunks, the kernel, and the eviction of the previous chunk
+ * overlap rather than the oversubscribed device thrashing on page
+ * faults.  A budget of zero disables out-of-core launches (the
+ * default).  These can also be set via the `KITCUDA_OUT_OF_CORE`,
+ * `KITCUDA_OUT_OF_CORE_BYTES` (3/4 of the device memory by default)
+ * and `KITCUDA_OUT_OF_CORE_BUFFERS` (2 to 4, default 3) environment
+ * variables.
+ */
+extern void __kitcuda_set_out_of_core(uint64_t budget_bytes, int num_buffers);
+extern uint64_t __kitcuda_get_out_of_core_budget();
+extern int __kitcuda_get_out_of_core_buffers();
+
+/**
+ * Return the total size of the managed allocations mapped for a
+ * pending launch on the given stream (when recorded, see
+ * `__kitcuda_mem_gpu_map()`).
+ */
+extern uint64_t __kitcuda_mem_pending_bytes(void *opaque_stream);
+
+/**
+ * Move the data of chunk `[lo, hi)` of a pending out-of-core launch
+ * over `[start, end)` on the given stream to the device (or, with
+ * `to_host`, back to the host).  Allocations larger than
+ * `split_bytes` are moved in proportion to the iteration space; the
+ * others are moved to the device with the first chunk and left there.
+ */
+extern void __kitcuda_mem_prefetch_chunk(void *opaque_stream, uint64_t start,
+                                         uint64_t end, uint64_t lo,
+                                         uint64_t hi, uint64_t split_bytes,
+                                         bool to_host, void *prefetch_stream);
+
+/**
+ * Release the allocations mapped for an out-of-core launch on the
+ * given stream.
+ */
+extern void __kitcuda_mem_release_pending(void *opaque_stream);
+
+/**
+ * Enable/Disable the use of occupancy calculations for the
+ * determination of kernel launch parameters.  If the `enable`
+ * parameter is set to `true` occupancy-based launches will be
+ * used for *all* kernel launches.  `false` will disable and
+ * the runtime will fall-back to either custom or default
+ * launch parameters.
+ *
+ * @param enable - enable/disable occupancy-based launches
+ */
+extern void __kitcuda_use_occupancy_launch(bool enable);
+
+/** 
+ * Enable/Disable the tuning of occupancy-based calculations for
+ * the determination of kernel launch parameters.  If the `enable`
+ * parameter is set to `true` both occupancy-based launches and 
+ * the refinement of the occupancy-driven results will be used. 
+ * `enable == true` will enable occupancy_launches.  Launches are
+ * refined when their blocks would load the multi-processors less
+ * than the machine profile's saturating load (see machine.h), or
+ * 75% without a profile.
+ *
+ * @param enable - enable/disable tuned occupancy launches.
+ */
+ extern void __kitcuda_refine_occupancy_launches(bool enable);
+
+/**
+ * Enable/Disable coarsened kernel launches.  Kernels generated as
+ * grid-stride loops (see `KITRT_KERNEL_GRID_STRIDE`) are correct for
+ * any grid size, so the runtime can have each thread execute several
+ * iterations.  The number of iterations per thread is chosen from a
+ * simple roofline model of the device: the kernel's instruction mix
+ * (operations per byte accessed) is compared against the ratio of the
+ * device's peak arithmetic rate and memory bandwidth.  Memory-bound
+ * kernels keep at least four waves of fully occupied multi-processors
+ * (to hide memory latency) and compute-bound kernels at least two.
+ * Smaller launches are not coarsened.
+ *
+ * @param enable - enable/disable coarsened launches.
+ */
+extern void __kitcuda_use_coarsened_launch(bool enable);
+
+/**
+ * Set the maximum number of iterations a thread is assigned in a
+ * coarsened launch.
+ */
+extern void __kitcuda_set_max_iters_per_thread(int num_iters);
+
+/**
+ * Set the maximum number of waves of fully occupied multi-processors
+ * in a coarsened launch.  Larger launches assign more iterations to
+ * each thread (overriding the maximum number of iterations per thread)
+ * so that their grid does not grow with the trip count.  Zero removes
+ * the limit.
+ */
+extern void __kitcuda_set_max_launch_waves(int num_waves);
+
+/**
+ * Enable/Disable the autotuning of kernel launch parameters.  When
+ * enabled, the first launches of each kernel for a given range of
+ * trip counts (bucketed by powers of two) are spent timing a set of
+ * candidate threads-per-block values.  The candidates are the
+ * value the runtime would otherwise use (e.g., the occupancy-based
+ * result) and the power-of-two multiples of the warp size that the
+ * kernel supports; with a machine profile (see machine.h) memory-bound
+ * kernels only try those within a factor of two of the block size
+ * that was fastest for the profile's copy kernel.  The fastest
+ * candidate, measured as time per
+ * iteration, is used for all subsequent launches in that range.
+ * Launches with an explicit threads-per-block value (e.g., from a
+ * launch attribute) and launches split across multiple devices are
+ * not tuned.
+ *
+ * @param enable - enable/disable autotuned launches.
+ */
+extern void __kitcuda_enable_autotune(bool enable);
+
+/**
+ * Set the number of timed launches used for each candidate block
+ * size when autotuning.  The best of the measured times is used.
+ */
+extern void __kitcuda_set_autotune_trials(int num_trials);
+
+/**
+ * Read previously tuned launch parameters from the given file.  Only
+ * the entries matching the compute capability of the runtime's device
+ * are used; this call must be made before the first kernel launch.
+ * A missing file is not an error.
+ */
+extern void __kitcuda_load_autotune_table(const char *path);
+
+/**
+ * Write the tuned launch parameters to the given file.  The entries
+ * previously read by `__kitcuda_load_autotune_table()` are included
+ * (updated with the results from this run).
+ */
+extern void __kitcuda_save_autotune_table(const char *path);
+
+/**
+ * Set the runtime's value for the number of threads-per-block used
+ * in simple launch parameter calculations.
+ *
+ * @param nthreads - number of threads per block
+ * @todo The parameter value needs to be asserted or clamped!
+ */
+extern void __kitcuda_set_default_threads_per_blk(int nthreads);
+
+/**
+ * Set the runtime's value for the maximum number of threads allowed
+ * per block (typically a hardware limit).  The compiler will insert
+ * a call to this function to match any specific code generation
+ * settings that were used.  This mirrors some HIP functionality but
+ * is not critical for CUDA -- given differences in the LLVM backends
+ * for each target...
+ */
+extern void __kitcuda_set_default_max_threads_per_blk(int nthreads);
+
+/**
+ * Provide a set of set of launch parameters to use for subsequent
+ * kernel launch calls.  If this call is not made prior to a launch
+ * call a set of default values will be used.  Specifically a given
+ * number of threads will be set and then a classic CUDA style
+ * computation will be used to determine the other details.  At
+ * present the default threads-per-block is set to `256` and may be
+ * controlled via the `KITCUDA_THREADS_PER_BLOCK` environment variable
+ * at runtime.
+ *
+ * **NOTE** These settings will remain in effect for all launch
+ * calls from the calling point forward -- i.e., it tweaks a global
+ * state.  Therefore this call is not thread safe as it is possible
+ * to race over these values.
+ *
+ * @param `blks_per_grid`: The number of blocks in a grid for the
+ *         subsequent launch call(s).
+ * @param `threads_per_blk`: The number of threads in a block for
+ *        the subsequent launch call(s).
+ *
+ * @todo Make these parameters thread safe and bound to the next
+ * kernel launch call(s).
+ */
+extern void __kitcuda_set_custom_launch_params(unsigned blks_per_grid,
+                                               unsigned threads_per_blk);
+
+/**
+ * Enable/Disable graph launches.  When enabled, the kernels launched
+ * on a stream between its first launch and its synchronization (i.e.,
+ * an instance of a sync region) are recorded into a CUDA graph.  Later
+ * instances that launch the same sequence of kernels replay the
+ * graph: each launch updates the arguments and geometry of its graph
+ * node and the graph is launched with a single call when the stream
+ * is synchronized.  Graphs are keyed by the first kernel launched on
+ * the stream; instances that diverge from the recorded sequence fall
+ * back to eager launches (and repeated divergence retires the graph).
+ * Multi-device and autotuning launches are always issued eagerly.
+ *
+ * @param enable - enable/disable graph launches.
+ */
+extern void __kitcuda_use_graph_launch(bool enable);
+
+/**
+ * Return true if graph launches are enabled.
+ */
+extern bool __kitcuda_graph_launch_enabled();
+
+/**
+ * Record or replay a kernel launch on the given stream's graph.
+ *
+ * @param opaque_stream - the stream of the launch.
+ * @param func - the kernel to launch.
+ * @param blks_per_grid - the number of blocks in the launch.
+ * @param threads_per_blk - the number of threads per block.
+ * @param shared_mem_bytes - the dynamic shared memory of each block.
+ * @param kern_args - the kernel arguments (copied by the call).
+ * @return `true` if the launch has been deferred until the stream is
+ * synchronized and `false` if the caller must launch the kernel.
+ */
+extern bool __kitcuda_graph_launch(void *opaque_stream, CUfunction func,
+                                   int blks_per_grid, int threads_per_blk,
+                                   unsigned shared_mem_bytes,
+                                   void **kern_args);
+
+/**
+ * Issue all deferred graph launches on the given stream (all streams
+ * if null).  This must be called before the host performs operations
+ * that are ordered with respect to previously launched kernels (e.g.,
+ * synchronous copies into device symbols).
+ */
+extern void __kitcuda_graph_flush(void *opaque_stream);
+
+/**
+ * Complete the graph recording or replay of the given stream (all
+ * streams if null).  This is called when the stream is synchronized
+ * and before any other work is queued on it.
+ */
+extern void __kitcuda_graph_sync(void *opaque_stream);
+
+/**
+ * Release all graphs created by the runtime.
+ */
+extern void __kitcuda_destroy_graphs();
+
+/**
+ * Enable/Disable dataflow launches.  When enabled, the kernels launched
+ * by an instance of a sync region are spread across (up to) the given
+ * number of worker streams and only wait on the launches they depend
+ * on: a kernel that reads an allocation waits on its last writer and
+ * a kernel that writes an allocation also waits on the readers since
+ * that write.  Dependences are derived from the access modes of the
+ * pointer arguments mapped via `__kitcuda_mem_gpu_map()`; a kernel
+ * with arguments unknown to the runtime is ordered after all prior
+ * launches (and before all later ones).  Multi-device, out-of-core
+ * and autotuning launches are issued on the region's stream.
+ *
+ * @param enable - enable/disable dataflow launches.
+ * @param num_streams - the maximum number of worker streams per region
+ * instance (zero keeps the current setting).
+ */
+extern void __kitcuda_use_dataflow_launch(bool enable, unsigned num_streams);
+
+/**
+ * Return true if dataflow launches are enabled.
+ */
+extern bool __kitcuda_dataflow_launch_enabled();
+
+/**
+ * Record an argument (and its access mode) of the calling thread's
+ * next kernel launch.
+ */
+extern void __kitcuda_dataflow_record(void *vp, int access);
+
+/**
+ * Drop the arguments recorded for a launch that is not issued.
+ */
+extern void __kitcuda_dataflow_discard();
+
+/**
+ * Pick the stream for a launch on the given (region) stream and make
+ * it wait on the launch's dependences.  A barrier launch, or a launch
+ * without known arguments, is placed on the region's stream after all
+ * prior launches.
+ *
+ * @param opaque_stream - the region's stream.
+ * @param barrier - order the launch after all prior launches.
+ * @return The stream to launch the kernel on.
+ */
+extern void *__kitcuda_dataflow_begin(void *opaque_stream, bool barrier);
+
+/**
+ * Complete a launch started with `__kitcuda_dataflow_begin()`.
+ *
+ * @param opaque_stream - the region's stream.
+ * @param launch_stream - the stream the kernel was launched on.
+ */
+extern void __kitcuda_dataflow_end(void *opaque_stream, void *launch_stream);
+
+/**
+ * Order the given stream after all dataflow launches of its region
+ * instance.  This is called when the stream is synchronized and
+ * before any other work is queued on it.
+ */
+extern void __kitcuda_dataflow_join(void *opaque_stream);
+
+/**
+ * Recycle the dataflow resources of a synchronized stream (of all
+ * streams if null).
+ */
+extern void __kitcuda_dataflow_release(void *opaque_stream);
+
+/**
+ * Release all dataflow resources held by the runtime.
+ */
+extern void __kitcuda_destroy_dataflow();
+
+/**
+ * Register the kernels that a module's persistent worker can run
+ * (see the compiler's -cuabi-persistent-kernels option).  This is
+ * called by the module's constructor.
+ *
+ * @param fat_bin - the module's fat binary.
+ * @param worker_name - the name of the worker kernel.
+ * @param kernel_names - the names of the kernels the worker runs.
+ * @param layouts - for each kernel, the number of arguments followed
+ * by the offset and size of each argument within a work item.
+ * @param num_kernels - the number of kernels.
+ */
+extern void __kitcuda_register_persistent_kernels(const void *fat_bin,
+                                                  const char *worker_name,
+                                                  const char **kernel_names,
+                                                  const uint32_t **layouts,
+                                                  int num_kernels);
+
+/**
+ * Enable/Disable persistent kernels.  When enabled, launches of
+ * registered kernels with (at most) the given number of iterations
+ * are pushed onto the work queue of their module's worker kernel,
+ * which is kept resident on the device.  Pushed launches run in
+ * order and are joined before any other launch and whenever a stream
+ * is synchronized.  Multi-device, out-of-core, autotuning, dataflow
+ * and graph launches are never pushed.
+ *
+ * @param enable - enable/disable persistent kernels.
+ * @param max_trips - the largest trip count of a pushed launch (zero
+ * keeps the current setting).
+ */
+extern void __kitcuda_use_persistent_kernels(bool enable, uint64_t max_trips);
+
+/**
+ * Return true if persistent kernels are enabled.
+ */
+extern bool __kitcuda_persistent_kernels_enabled();
+
+/**
+ * Return the largest trip count of a pushed launch.
+ */
+extern uint64_t __kitcuda_get_persistent_max_trips();
+
+/**
+ * Return the index of the named kernel within its module's persistent
+ * worker or -1 if the worker can not run it.
+ */
+extern int __kitcuda_persistent_kernel_index(const void *fat_bin,
+                                             const char *kernel_name);
+
+/**
+ * Push a launch of the kernel with the given index onto the work queue
+ * of its module's persistent worker, starting the worker if needed.
+ * The launch is only pushed if the given stream is idle.
+ *
+ * @param opaque_stream - the stream of the launch.
+ * @param fat_bin - the kernel's fat binary.
+ * @param index - the kernel's index within the worker.
+ * @param kern_args - the kernel arguments (copied by the call).
+ * @return `true` if the launch has been pushed and `false` if the
+ * caller must launch the kernel.
+ */
+extern bool __kitcuda_persistent_launch(void *opaque_stream,
+                                        const void *fat_bin, int index,
+                                        void **kern_args);
+
+/**
+ * Wait for all pushed launches to complete.
+ */
+extern void __kitcuda_persistent_join();
+
+/**
+ * Stop the running persistent worker (after its pushed launches have
+ * completed).  This must be called before operations that wait on
+ * all the work of the device (e.g., a context synchronization).
+ */
+extern void __kitcuda_persistent_stop();
+
+/**
+ * Stop the persistent worker and release its resources.
+ */
+extern void __kitcuda_destroy_persistent();
+
+/**
+ * Return a thread-aware stream.  Streams are recycled: idle streams
+ * are cached per host thread (with a shared overflow list) and a
+ * stream is returned to the calling thread's cache when it is
+ * synchronized via `__kitcuda_sync_thread_stream()`.  The caller owns
+ * the stream until then.
+ */
+extern void* __kitcuda_get_thread_stream();
+
+/**
+ * Return a stream of the given priority (see `KitRTPriority`); the
+ * default priority returns `__kitcuda_get_thread_stream()`.  Streams of
+ * the other priorities are recycled through pools of their own when
+ * they are synchronized.
+ */
+extern void *__kitcuda_get_priority_stream(int priority);
+
+/**
+ * Set the stream of an upcoming kernel launch to a stream of the given
+ * priority, unless the launch already has a stream (e.g., one it shares
+ * with earlier asynchronous launches).  The compiler issues this call
+ * ahead of the launch of a forall with a `[[kitsune::priority]]`
+ * attribute.
+ *
+ * @param opaque_stream - The stream for the upcoming kernel launch.
+ * @param priority - The priority (see `KitRTPriority`).
+ */
+extern void __kitcuda_use_priority_stream(void **opaque_stream,
+                                          int priority);
+
+/**
+ * Return the runtime's stream for the given device index (see
+ * `__kitcuda_get_num_devices()`).  Index zero returns a thread-aware
+ * stream on the primary device.  The streams of the other devices are
+ * owned (and shared) by the runtime and used for multi-device launches.
+ */
+extern void *__kitcuda_get_device_stream(int index);
+
+/**
+ * Synchronize the associated stream and recycle it for later use --
+ * the stream must not be used after this call.  A null stream is
+ * ignored.  The compiler emits a call for each stream launched within
+ * a sync region when the region is synchronized.  The null check is
+ * inlined into host code (see inline.cpp) and folds away where the
+ * compiler knows the stream.  The calling thread waits with the
+ * runtime's wait policy (see `KitRTWaitPolicy`).
+ */
+extern void __kitcuda_sync_thread_stream(void *opaque_stream);
+
+/**
+ * Synchronize and recycle a (non-null) stream, as
+ * `__kitcuda_sync_thread_stream()`.
+ */
+extern void __kitcuda_sync_thread_stream_slow(void *opaque_stream);
+
+/**
+ * Hand the stream of an asynchronous loop launched by a spawned task to
+ * the sync region of the task's spawn, when the task finishes.  The
+ * stream is synchronized (and recycled) by the region's next
+ * `__kitcuda_sync_region_wait()`, so the tasks of a region launch on
+ * their own streams and are only waited for by the syncs that join
+ * them.  A null stream is ignored.  Tasks may call this concurrently.
+ *
+ * @param region - The region's list of streams, in the spawning task's
+ *                 frame (initially null).
+ * @param opaque_stream - The task's stream.
+ */
+extern void __kitcuda_sync_region_defer(void **region, void *opaque_stream);
+
+/**
+ * Synchronize (and recycle) the streams handed to a sync region by its
+ * tasks, and empty the region's list.  The compiler emits a call at
+ * each sync of the region.
+ */
+extern void __kitcuda_sync_region_wait(void **region);
+
+/**
+ * Return a stream obtained from `__kitcuda_get_thread_stream()` to the
+ * calling thread's cache without synchronizing it.  The caller must
+ * know that all work on the stream has completed.
+ */
+extern void __kitcuda_recycle_thread_stream(void *opaque_stream);
+
+/**
+ * Synchronize the host-side with **all** underlying streams in the
+ * current CUDA context.  There a certain cases where we can't
+ * guarantee correctness without blocking the CPU execution until
+ * all work is complete on the GPU.  This is obviously not always
+ * ideal in terms of performance but for correctness this makes code
+ * generation sound when analysis is unavailable or inadequate.
+ */
+extern void __kitcuda_sync_context();
+
+/**
+ * Destroy the stream that is associated with the calling thread.
+ * If a stream has not been assigned to the thread this call will
+ * simply return and function as a no-op.
+ */
+extern void __kitcuda_delete_thread_stream(void *opaque_stream);
+
+/**
+ * Destroy all the thread-associated streams that are being managed
+ * by the runtime.  This call will essentially use CUDA to destroy
+ * each stream and the associated data structure entries used by the
+ * runtime.
+ */
+extern void __kitcuda_destroy_thread_streams();
+
+/**
+ * The maximum number of arguments of a printf() call within a kernel
+ * (see the compiler's -cuabi-device-log option).
+ */
+#define KITCUDA_LOG_MAX_ARGS 6
+
+/**
+ * Enable/disable device-side logging.  Calls to printf() within kernels
+ * are lowered to writes of records into a pinned host buffer that is
+ * drained (and formatted) when a stream is synchronized.  When disabled
+ * the calls are skipped.  This is enabled by default and may be
+ * disabled by setting the `KITCUDA_DEVICE_LOG` environment variable to
+ * false.  It must be set before any kernel is launched.
+ */
+extern void __kitcuda_enable_device_log(bool enable);
+
+/**
+ * Set the number of records (rounded up to a power of two) of the
+ * device log buffer.  Records written while the buffer is full are
+ * dropped (and counted).  The default is 65536 and it may be set with
+ * the `KITCUDA_LOG_RECORDS` environment variable.
+ */
+extern void __kitcuda_set_log_records(uint64_t num_records);
+
+/**
+ * Register the format and string arguments of the printf() calls of the
+ * kernels in the given fat binary.  The records written by the kernels
+ * refer to the strings by their index in the table.  The given symbol
+ * is the module's device-side global that is set to the location of
+ * the log buffer when the module is loaded.  The compiler emits this
+ * call in the module's constructor.
+ */
+extern void __kitcuda_register_log_strings(const void *fat_bin,
+                                           const char *sym_name,
+                                           const char **strings, int count);
+
+/**
+ * Format and print the records in the device log.  Records that are
+ * still being written are left for a later call unless all the work
+ * on the device is known to be complete ('quiescent').  This is used
+ * as part of stream and context synchronization.
+ */
+extern void __kitcuda_log_drain(bool quiescent);
+
+/**
+ * Drain and release the device log buffer.
+ */
+extern void __kitcuda_destroy_log();
+
+/**
+ * Set the size in bytes of the heap that the malloc() and new calls
+ * within kernels allocate from on each device (see -cuabi-device-heap).
+ * Allocations the heap cannot satisfy fall back to CUDA's device heap;
+ * a size of zero disables the heap.  The default is 256 MiB and it may
+ * be set with the `KITCUDA_HEAP_SIZE` environment variable.  It must be
+ * set before any kernel is launched.
+ */
+extern void __kitcuda_set_heap_size(uint64_t bytes);
+
+/**
+ * Enable/disable the reset of the device heap whenever the context is
+ * synchronized, which releases all the memory kernels allocated from
+ * the heap.  This is disabled by default and may be enabled by setting
+ * the `KITCUDA_HEAP_RESET` environment variable to true.
+ */
+extern void __kitcuda_reset_heap_on_sync(bool enable);
+
+/**
+ * Register the device heap global of the kernels in the given fat
+ * binary, which is set to the location of the device's heap when the
+ * module is loaded.  The compiler emits this call in the module's
+ * constructor.
+ */
+extern void __kitcuda_register_heap(const void *fat_bin,
+                                    const char *sym_name);
+
+/**
+ * Release, in bulk, all the memory that kernels allocated from the
+ * device heaps.  This waits for all the work on the devices to
+ * complete.
+ */
+extern void __kitcuda_heap_reset();
+
+/**
+ * Reset the heap of the current context if the heap is reset on
+ * synchronization.  This is used as part of context synchronization.
+ */
+extern void __kitcuda_heap_sync_context();
+
+/**
+ * Release the device heaps.
+ */
+extern void __kitcuda_destroy_heap();
+
+/**
+ * Create a context on the given device that is limited to (at least)
+ * the given number of multiprocessors, so that the jobs of an ensemble
+ * can share a device with predictable throughput.  Under MPS this is a
+ * context with an SM count execution affinity; otherwise it is a green
+ * context (CUDA 12.4 and later).  The runtime creates the partition
+ * when the `KITCUDA_PARTITION_SMS` environment variable is set.
+ *
+ * @param device - the device to partition.
+ * @param num_sms - the number of multiprocessors of the partition.
+ * @return the partition's context, or null if it could not be created.
+ */
+extern CUcontext __kitcuda_create_partition(CUdevice device, int num_sms);
+
+/**
+ * Return the number of multiprocessors available to the current
+ * context: the SM count of its partition (or of the MPS client's
+ * active thread percentage) or, when it is not partitioned, the given
+ * multiprocessor count of the whole device.  The launch heuristics are
+ * sized to this count.
+ */
+extern int __kitcuda_query_partition_sms(int device_sms);
+
+/**
+ * Release the context of the partition created by the runtime.
+ */
+extern void __kitcuda_destroy_partition();
+
+/**
+ * Set the budget in bytes of the device memory the runtime's managed
+ * allocations may occupy, zero for none.  Slabs of the memory pool
+ * beyond the budget prefer host memory and their pages are only
+ * migrated to the device as launches touch them.  The budget defaults
+ * to the MPS client's pinned memory limit and may be set with the
+ * `KITCUDA_MEM_BUDGET` environment variable.
+ */
+extern void __kitcuda_set_mem_budget(uint64_t bytes);
+extern uint64_t __kitcuda_get_mem_budget();
+
+/**
+ * Return the device memory limit of the MPS client for the given
+ * device (from `CUDA_MPS_PINNED_DEVICE_MEM_LIMIT`), or zero.
+ */
+extern uint64_t __kitcuda_default_mem_budget(int device_id);
+
+/**
+ * Account for a managed slab of the given size placed on the device.
+ * Return false, without accounting for it, if it does not fit within
+ * the memory budget.
+ */
+extern bool __kitcuda_mem_budget_place(void *slab, size_t size);
+
+/**
+ * Release the budget held by the given slab (if any).
+ */
+extern void __kitcuda_mem_budget_release(void *slab);
+
+/*
+ * The following global state lives within the runtime to avoid
+ * exposing these details into the code generation details. These
+ * calls are typically used within the runtime implementation and
+ * not within generated code sections -- therefore we expose
+ * CUDA-centric types.
+ */
+
+/**
+ * Has the CUDA portion of the Kitsune runtime been successfully
+ * initialized?
+ */
+inline bool __kitcuda_is_initialized() {
+  extern bool _kitcuda_initialized;
+  return _kitcuda_initialized;
+}
+
+/**
+ * Get the CUDA device associated with the currently initialized
+ * runtime.  Note this call will assert if the runtime is not
+ * initialized.
+ */
+inline CUdevice __kitcuda_get_device() {
+  extern CUdevice _kitcuda_device;
+  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
+  return _kitcuda_device;
+}
+
+/**
+ * Get the current CUDA device ID associated with the currently
+ * initialized runtime.  Note this call will assert if the runtime
+ * is not initialized.
+ */
+inline CUdevice __kitcuda_get_device_id() {
+  extern CUdevice _kitcuda_device_id;
+  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
+  return _kitcuda_device_id;
+}
+
+/**
+ * Get the current CUDA context for the currently initialized
+ * runtime.  Note that this code will assert if the runtime is not
+ * initialized.
+ */
+inline CUcontext __kitcuda_get_context() {
+  extern CUcontext _kitcuda_context;
+  assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
+  return _kitcuda_context;
+}
+
+/**
+ * The maximum number of devices a single kernel launch may be spread
+ * across.
+ */
+#define KITCUDA_MAX_DEVICES 16
+
+/**
+ * The maximum number of chunks an out-of-core launch keeps in flight
+ * (see `__kitcuda_set_out_of_core()`).
+ */
+#define KITCUDA_MAX_OUT_OF_CORE_BUFFERS 4
+
+/**
+ * Get the number of devices the runtime will spread kernel launches
+ * across.  This is always at least one (the primary device).
+ */
+inline int __kitcuda_get_num_devices() {
+  extern int _kitcuda_num_devices;
+  return _kitcuda_num_devices;
+}
+
+/**
+ * Get the CUDA device at the given index of the runtime's device list.
+ * Index zero is the primary device (see `__kitcuda_get_device()`).
+ */
+inline CUdevice __kitcuda_get_device_at(int index) {
+  extern CUdevice _kitcuda_devices[];
+  assert(index < __kitcuda_get_num_devices() && "device index out of range!");
+  return _kitcuda_devices[index];
+}
+
+/**
+ * Get the (primary) CUDA context of the device at the given index of
+ * the runtime's device list.
+ */
+inline CUcontext __kitcuda_get_context_at(int index) {
+  extern CUcontext _kitcuda_contexts[];
+  assert(index < __kitcuda_get_num_devices() && "device index out of range!");
+  return _kitcuda_contexts[index];
+}
+
+/**
+ * The (immutable) properties of a device.  These are queried once per
+ * device when the runtime is initialized so the launch path never has
+ * to go back to the driver for them.  Attributes not reported by the
+ * driver are zero.
+ */
+typedef struct {
+  int major, minor;              // compute capability.
+  int num_multiprocs;            // multi-processors of the partition.
+  int device_multiprocs;         // multi-processors of the whole device.
+  int warp_size;                 // threads per warp.
+  int max_threads_per_blk;       // max threads per block.
+  int max_threads_per_multiproc; // max resident threads per multi-proc.
+  int max_regs_per_blk;          // max registers per block.
+  int max_shared_per_blk;        // max (static) shared memory per block.
+  int l2_cache_bytes;            // L2 cache size in bytes.
+  int max_persisting_l2_bytes;   // max L2 set aside for persisting data.
+  int max_access_window_bytes;   // max size of an access policy window.
+  int clock_khz;                 // peak core clock.
+  int mem_clock_khz;             // peak memory clock.
+  int mem_bus_width;             // global memory bus width in bits.
+  int supports_gpu_overlap;      // can overlap copies and kernels.
+  int supports_concurrent_kerns; // can run kernels concurrently.
+  int supports_coop_launch;      // can launch cooperative kernels.
+  int host_page_tables;          // hardware-coherent access to host memory.
+} KitCudaDeviceProps;
+
+/**
+ * Get the properties of the device at the given index of the runtime's
+ * device list.
+ */
+inline const KitCudaDeviceProps *__kitcuda_get_device_props_at(int index) {
+  extern KitCudaDeviceProps _kitcuda_device_props[];
+  assert(index < __kitcuda_get_num_devices() && "device index out of range!");
+  return &_kitcuda_device_props[index];
+}
+
+/**
+ * Get the properties of the primary device.
+ */
+inline const KitCudaDeviceProps *__kitcuda_get_device_props() {
+  return __kitcuda_get_device_props_at(0);
+}
+
+/**
+ * Provide a newly loaded module (for the given fat binary) with the
+ * location of the device log buffer.  This is a no-op for modules
+ * without logging.  The module's context must be current.
+ */
+extern void __kitcuda_log_attach_module(const void *fat_bin,
+                                        CUmodule cu_module);
+
+/**
+ * Provide a newly loaded module (for the given fat binary) with the
+ * location of the device heap.  This is a no-op for modules whose
+ * kernels do not allocate.  The module's context must be current.
+ */
+extern void __kitcuda_heap_attach_module(const void *fat_bin,
+                                         CUmodule cu_module);
+
+/**
+ * Initialize the NVSHMEM device state of a newly loaded module (for the
+ * given fat binary), now or once NVSHMEM is initialized.  This is a
+ * no-op for modules that do not use symmetric memory.  The module's
+ * context must be current.
+ */
+extern void __kitcuda_shmem_attach_module(const void *fat_bin,
+                                          CUmodule cu_module);
+
+/**
+ * Finalize NVSHMEM if the program did not.
+ */
+extern void __kitcuda_destroy_shmem();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
 
 extern CUdevice _kitcuda_device;
 extern CUcontext _kitcuda_context;
+// Advanced by each initialization so threads notice that the context
+// they made current was destroyed (see set_thread_context()).
+extern unsigned _kitcuda_context_generation;
+
+#ifdef __cplusplus
+#include "profile.h"
+#include <vector>
+
+/// Record an event behind the work issued so far on each of the
+/// runtime's streams that is still busy and append it to 'events'.
+/// Memory freed now is no longer used by the device once the events
+/// have completed (see streams.cpp).
+extern void _kitcuda_record_busy_stream_events(std::vector<CUevent> &events);
+
+/// The CUDA event operations used by the launch and transfer profiler.
+extern const KitRTProfileEventOps _kitcuda_profile_ops;
+
+#ifdef KITCUDA_ENABLE_CUPTI
+/// The CUPTI operations that read the hardware metrics of kernel
+/// launches for the profiler (see cupti.cpp).
+extern const KitRTProfileMetricOps _kitcuda_cupti_metric_ops;
+
+/// Charge the migrations and page faults that CUPTI's unified memory
+/// counters report on the given device to the allocation sites
+/// (KITRT_MEM_SITES).  Returns false if the counters are unavailable.
+extern bool _kitcuda_cupti_enable_uvm_counters(int device_ordinal);
+#endif
+
+/// Return the cuBLAS handle of the calling thread's context, loading
+/// cuBLAS on first use, or null if cuBLAS is not available or disabled
+/// (see blas.cpp).
+extern void *_kitcuda_blas_handle();
+
+/// Compute the row-major product c = a * transpose(b) of the m x k
+/// matrix a and the n x k matrix b on the given stream.
+extern void _kitcuda_blas_gemm_nt(void *handle, CUstream stream,
+                                  uint32_t elt_size, int m, int n, int k,
+                                  const void *a, const void *b, void *c);
+#endif
 
 #define CU_SAFE_CALL(x)                                                        \
   {                                                                            \
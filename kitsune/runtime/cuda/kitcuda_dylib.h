@@ -75,7 +75,9 @@ extern bool __kitcuda_load_symbols();
 DECLARE_DLSYM(cuInit);
 DECLARE_DLSYM(cuDeviceGetCount);
 DECLARE_DLSYM(cuDeviceGet);
+DECLARE_DLSYM(cuDeviceTotalMem_v2);
 DECLARE_DLSYM(cuDeviceGetAttribute);
+DECLARE_DLSYM(cuDeviceCanAccessPeer);
 DECLARE_DLSYM(cuDriverGetVersion);
 DECLARE_DLSYM(cuFuncSetCacheConfig);
 DECLARE_DLSYM(cuFuncGetName);
@@ -92,15 +94,54 @@ DECLARE_DLSYM(cuDevicePrimaryCtxRelease_v2);
 DECLARE_DLSYM(cuDevicePrimaryCtxReset_v2);
 DECLARE_DLSYM(cuCtxDestroy_v2);
 DECLARE_DLSYM(cuCtxSynchronize);
+DECLARE_DLSYM(cuCtxEnablePeerAccess);
+DECLARE_DLSYM(cuCtxSetLimit);
+DECLARE_DLSYM(cuCtxResetPersistingL2Cache);
+DECLARE_DLSYM(cuCtxGetStreamPriorityRange);
+DECLARE_DLSYM(cuCtxGetExecAffinity);
+DECLARE_DLSYM(cuDeviceGetExecAffinitySupport);
+#if CUDA_VERSION >= 12040
+/* Green contexts (optional, null if the driver predates them) */
+DECLARE_DLSYM(cuDeviceGetDevResource);
+DECLARE_DLSYM(cuDevSmResourceSplitByCount);
+DECLARE_DLSYM(cuDevResourceGenerateDesc);
+DECLARE_DLSYM(cuGreenCtxCreate);
+DECLARE_DLSYM(cuGreenCtxDestroy);
+DECLARE_DLSYM(cuGreenCtxGetDevResource);
+DECLARE_DLSYM(cuCtxFromGreenCtx);
+#endif
 
 /* Stream management */
 DECLARE_DLSYM(cuStreamCreate);
+DECLARE_DLSYM(cuStreamCreateWithPriority);
 DECLARE_DLSYM(cuStreamDestroy_v2);
 DECLARE_DLSYM(cuStreamSynchronize);
 DECLARE_DLSYM(cuStreamAttachMemAsync);
+DECLARE_DLSYM(cuStreamWaitEvent);
+DECLARE_DLSYM(cuStreamQuery);
+DECLARE_DLSYM(cuStreamSetAttribute);
+
+/* Event management */
+DECLARE_DLSYM(cuEventCreate);
+DECLARE_DLSYM(cuEventRecord);
+DECLARE_DLSYM(cuEventDestroy_v2);
+DECLARE_DLSYM(cuEventQuery);
+DECLARE_DLSYM(cuEventSynchronize);
+DECLARE_DLSYM(cuEventElapsedTime);
+
+/* Graph management */
+DECLARE_DLSYM(cuGraphCreate);
+DECLARE_DLSYM(cuGraphAddKernelNode_v2);
+DECLARE_DLSYM(cuGraphInstantiateWithFlags);
+DECLARE_DLSYM(cuGraphLaunch);
+DECLARE_DLSYM(cuGraphExecKernelNodeSetParams_v2);
+DECLARE_DLSYM(cuGraphNodeSetEnabled);
+DECLARE_DLSYM(cuGraphExecDestroy);
+DECLARE_DLSYM(cuGraphDestroy);
 
 /* Kernel launching, fat binary, module related */
 DECLARE_DLSYM(cuLaunchKernel);
+DECLARE_DLSYM(cuLaunchCooperativeKernel);
 DECLARE_DLSYM(cuModuleLoadDataEx);
 DECLARE_DLSYM(cuModuleLoadData);
 DECLARE_DLSYM(cuModuleLoadFatBinary);
@@ -108,20 +149,35 @@ DECLARE_DLSYM(cuModuleGetFunction);
 DECLARE_DLSYM(cuModuleUnload);
 DECLARE_DLSYM(cuOccupancyMaxPotentialBlockSize);
 DECLARE_DLSYM(cuOccupancyMaxPotentialBlockSizeWithFlags);
+DECLARE_DLSYM(cuOccupancyMaxActiveBlocksPerMultiprocessor);
 DECLARE_DLSYM(cuModuleGetGlobal_v2);
+DECLARE_DLSYM(cuLinkCreate_v2);
+DECLARE_DLSYM(cuLinkAddData_v2);
+DECLARE_DLSYM(cuLinkComplete);
+DECLARE_DLSYM(cuLinkDestroy);
 
 /* Memory management and movement */
 DECLARE_DLSYM(cuMemAllocManaged);
+DECLARE_DLSYM(cuMemAlloc_v2);
 DECLARE_DLSYM(cuMemAllocHost);
 DECLARE_DLSYM(cuMemHostAlloc);
+DECLARE_DLSYM(cuMemFreeHost);
+DECLARE_DLSYM(cuMemHostRegister_v2);
+DECLARE_DLSYM(cuMemHostUnregister);
+DECLARE_DLSYM(cuMemHostGetDevicePointer_v2);
 DECLARE_DLSYM(cuMemsetD8Async);
+DECLARE_DLSYM(cuMemsetD16Async);
+DECLARE_DLSYM(cuMemsetD32Async);
 DECLARE_DLSYM(cuMemFree_v2);
 DECLARE_DLSYM(cuMemPrefetchAsync);
 DECLARE_DLSYM(cuMemAdvise);
 DECLARE_DLSYM(cuPointerGetAttribute);
 DECLARE_DLSYM(cuPointerSetAttribute);
 DECLARE_DLSYM(cuMemcpy);
+DECLARE_DLSYM(cuMemcpyAsync);
 DECLARE_DLSYM(cuMemcpyHtoD_v2);
+DECLARE_DLSYM(cuMemcpyHtoDAsync_v2);
+DECLARE_DLSYM(cuMemcpyDtoHAsync_v2);
 
 /* Error handling */
 DECLARE_DLSYM(cuGetErrorName);
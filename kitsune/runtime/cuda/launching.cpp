@@ -51,31 +51,615 @@
 
 #include "kitcuda.h"
 #include "kitcuda_dylib.h"
+#include "launch_cache.h"
+#include "machine.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <stdio.h>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 // *** EXPERIMENTAL: The runtime maintains a map from fatbinary images
 // to a supporting CUDA module.  The primary reason for this is
 // exploring reducing runtime overheads.
 //
 // TODO: Finish exploration of map vs. CUDA call overheads.
+//
+// Each device used by the runtime has its own map (the primary device
+// is at index zero).
 typedef std::unordered_map<const void *, CUmodule> KitCudaModuleMap;
-static KitCudaModuleMap _kitcuda_module_map;
+static KitCudaModuleMap _kitcuda_module_map[KITCUDA_MAX_DEVICES];
 static std::mutex _kitcuda_module_map_mutex;
 
-// *** EXPERIMENTAL: The runtime maintains a map from kernel names to
-// kernel functions.  This avoids searching a module repeatedly at
-// kernel launch time and is primiarly focused on reducing runtime
-// overheads.  The savings here still need to explored in more detail;
-// it is not clear how map overheads compare to the runtime lookup...
-//
-// TODO: Finish exploration of map vs. CUDA call overheads.
-typedef std::unordered_map<const char *, CUfunction> KitCudaKernelMap;
-static KitCudaKernelMap _kitcuda_kernel_map;
+struct KitCudaTuneState;
+
+// Each (fat binary, kernel) pair that is launched has a descriptor
+// that caches everything the runtime needs to launch it: the kernel
+// function on each device, its attributes, and the launch parameters
+// previously computed for it.  The compiler provides a (per-kernel)
+// global handle that the first launch fills in with the descriptor.
+// Subsequent launches only need to dereference the handle; there are
+// no map lookups, string operations or driver queries on the
+// steady-state launch path.
+struct KitCudaLaunchDesc {
+  const void *fat_bin;
+  std::string kernel_name;
+  CUfunction funcs[KITCUDA_MAX_DEVICES]; // kernel on each device.
+  int num_regs;            // registers used per thread.
+  int max_threads_per_blk; // the kernel-specific block size limit.
+  int num_multiprocs;      // of the primary device.
+  int warp_size;           // of the primary device.
+  int max_threads_per_multiproc; // of the primary device.
+  int max_shared_per_blk;        // shared memory (bytes) of the primary device.
+  // The block size from the runtime configuration (zero if none).
+  int fixed_threads_per_blk;
+  // Set once the kernel's cache configuration prefers shared memory.
+  std::atomic<bool> prefers_shared;
+  // Roofline classification of the kernel (-1 until first computed).
+  std::atomic<int> memory_bound;
+  // The occupancy-driven block size (zero until first computed).
+  std::atomic<int> occ_threads_per_blk;
+  // Previously determined threads-per-block values by trip count.
+  KitRTLaunchParamCache launch_params;
+  // Autotuned threads-per-block values for each trip count bucket (zero
+  // until tuned) and the state of any tuning in progress.
+  std::atomic<int> tuned_threads_per_blk[KitRTLaunchParamCache::NUM_BUCKETS];
+  std::atomic<KitCudaTuneState *>
+      tune_states[KitRTLaunchParamCache::NUM_BUCKETS];
+  // The kernel's index within its module's persistent worker (-1 if
+  // the worker can not run it).
+  int pk_index;
+};
+
+// Tuned launch parameters can be saved to (and restored from) a file.
+// Entries are specific to a kernel and the compute capability of the
+// device it was tuned on and are indexed by trip count bucket.  The
+// table holds every entry read from the file so entries for kernels
+// (or devices) not used in this run are written back out unchanged.
+typedef std::map<std::pair<std::string, unsigned>, int> KitCudaTuneTable;
+static KitCudaTuneTable _kitcuda_tune_table;
+static std::string _kitcuda_tune_arch;
+
+// Descriptors are also found by (fat binary, name) so that launches
+// without a handle, or multiple handles for the same kernel, share them.
+typedef std::map<std::pair<const void *, std::string>, KitCudaLaunchDesc *>
+    KitCudaLaunchDescMap;
+static KitCudaLaunchDescMap _kitcuda_launch_descs;
+
+// Relocatable device code (see the compiler's -cuabi-rdc option) is
+// linked when it is first used.  Each module's constructor registers its
+// fat binary (see __kitcuda_register_rdc_module()) and the first lookup
+// of any of them links all of the registered images, with the driver's
+// JIT linker, into a single module for the device.  Calls between the
+// device code of different modules are resolved by that link.
+static std::vector<const void *> _kitcuda_rdc_images;
+static CUmodule _kitcuda_rdc_module[KITCUDA_MAX_DEVICES];
+static bool _kitcuda_rdc_linked = false;
+
+// The size of a fat binary image: its header records the size of the
+// image that follows it.
+static size_t _kitcuda_fatbin_size(const void *fat_bin) {
+  struct FatbinHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t fat_size;
+  };
+  const FatbinHeader *header = (const FatbinHeader *)fat_bin;
+  assert(header->magic == 0xBA55ED50 && "unexpected fat binary magic!");
+  return header->header_size + header->fat_size;
+}
+
+// Link the registered relocatable device code for the device at the
+// given index.  The device's context must be current and the caller
+// must hold the module map mutex.
+static CUmodule _kitcuda_link_rdc_module(int index) {
+  if (_kitcuda_rdc_module[index] != nullptr)
+    return _kitcuda_rdc_module[index];
+
+  char error_log[8192] = "";
+  CUjit_option options[] = {CU_JIT_ERROR_LOG_BUFFER,
+                            CU_JIT_ERROR_LOG_BUFFER_SIZE_BYTES};
+  void *values[] = {error_log, (void *)(uintptr_t)sizeof(error_log)};
+  CUlinkState link_state;
+  CU_SAFE_CALL(cuLinkCreate_v2_p(2, options, values, &link_state));
+  for (const void *fat_bin : _kitcuda_rdc_images)
+    if (cuLinkAddData_v2_p(link_state, CU_JIT_INPUT_FATBINARY,
+                           (void *)fat_bin, _kitcuda_fatbin_size(fat_bin),
+                           "kitcuda_rdc", 0, nullptr,
+                           nullptr) != CUDA_SUCCESS) {
+      fprintf(stderr, "kitcuda: unable to add relocatable device code "
+              "to the device link:\n%s\n", error_log);
+      exit(EXIT_FAILURE);
+    }
+
+  void *cubin;
+  size_t cubin_size;
+  if (cuLinkComplete_p(link_state, &cubin, &cubin_size) != CUDA_SUCCESS) {
+    fprintf(stderr, "kitcuda: device link of relocatable device code "
+            "failed:\n%s\n", error_log);
+    exit(EXIT_FAILURE);
+  }
+  // The linked image belongs to the link state: load it before the state
+  // is destroyed.
+  CUmodule cu_module;
+  CU_SAFE_CALL(cuModuleLoadData_p(&cu_module, cubin));
+  CU_SAFE_CALL(cuLinkDestroy_p(link_state));
+  for (const void *fat_bin : _kitcuda_rdc_images) {
+    __kitcuda_log_attach_module(fat_bin, cu_module);
+    __kitcuda_heap_attach_module(fat_bin, cu_module);
+    __kitcuda_shmem_attach_module(fat_bin, cu_module);
+  }
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: linked %zu relocatable device module(s) "
+            "for device %d (%zu bytes).\n", _kitcuda_rdc_images.size(),
+            index, cubin_size);
+  _kitcuda_rdc_module[index] = cu_module;
+  _kitcuda_rdc_linked = true;
+  return cu_module;
+}
+
+void __kitcuda_register_rdc_module(const void *fat_bin) {
+  assert(fat_bin && "unexpected null fat binary!");
+  std::lock_guard<std::mutex> lock(_kitcuda_module_map_mutex);
+  if (_kitcuda_rdc_linked) {
+    fprintf(stderr, "kitcuda: relocatable device code registered after "
+            "the device link (was a kernel launched during static "
+            "initialization?).\n");
+    exit(EXIT_FAILURE);
+  }
+  _kitcuda_rdc_images.push_back(fat_bin);
+}
+
+// Get the module for the given fat binary on the device at the given
+// index of the runtime's device list.  The device's context must be
+// current and the caller must hold the module map mutex.
+static CUmodule _kitcuda_get_module(int index, const void *fat_bin) {
+  KitCudaModuleMap &module_map = _kitcuda_module_map[index];
+  KitCudaModuleMap::iterator modit = module_map.find(fat_bin);
+  if (modit != module_map.end())
+    return modit->second;
+  if (std::find(_kitcuda_rdc_images.begin(), _kitcuda_rdc_images.end(),
+                fat_bin) != _kitcuda_rdc_images.end()) {
+    CUmodule cu_module = _kitcuda_link_rdc_module(index);
+    module_map[fat_bin] = cu_module;
+    return cu_module;
+  }
+  // Create a supporting CUDA module and "register" the fat binary
+  // image in the map...  The fat binary may hold images for several
+  // architectures (see -cuabi-arch) and the driver picks the best
+  // match for the device, falling back to JIT compiling any embedded
+  // PTX.  Without a usable image there is nothing we can run.
+  CUmodule cu_module;
+  CUresult result = cuModuleLoadData_p(&cu_module, fat_bin);
+  if (result == CUDA_ERROR_NO_BINARY_FOR_GPU) {
+    const KitCudaDeviceProps *props = __kitcuda_get_device_props_at(index);
+    int major = props->major, minor = props->minor;
+    fprintf(stderr, "kitcuda: no kernel image for device %d (sm_%d).\n"
+            "  rebuild with '-mllvm -cuabi-arch=...,sm_%d' or with "
+            "'-mllvm -cuabi-embed-ptx'.\n",
+            index, major * 10 + minor, major * 10 + minor);
+    exit(EXIT_FAILURE);
+  }
+  CU_SAFE_CALL(result);
+  __kitcuda_log_attach_module(fat_bin, cu_module);
+  __kitcuda_heap_attach_module(fat_bin, cu_module);
+  __kitcuda_shmem_attach_module(fat_bin, cu_module);
+  module_map[fat_bin] = cu_module;
+  return cu_module;
+}
+
+// Return the launch descriptor for the named kernel within the given
+// fat binary, creating it on first use.  If non-null, the handle is
+// used to cache the descriptor.
+static KitCudaLaunchDesc *_kitcuda_get_launch_desc(void **handle,
+                                                   const void *fat_bin,
+                                                   const char *kernel_name) {
+  if (handle != nullptr) {
+    void *desc = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+    if (desc != nullptr)
+      return (KitCudaLaunchDesc *)desc;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:get_launch_desc", KIT_NVTX_LAUNCH);
+  std::lock_guard<std::mutex> lock(_kitcuda_module_map_mutex);
+  KitCudaLaunchDesc *&desc =
+      _kitcuda_launch_descs[std::make_pair(fat_bin, std::string(kernel_name))];
+  if (desc == nullptr) {
+    desc = new KitCudaLaunchDesc;
+    desc->fat_bin = fat_bin;
+    desc->kernel_name = kernel_name;
+    desc->occ_threads_per_blk = 0;
+    desc->memory_bound = -1;
+    desc->prefers_shared = false;
+    desc->pk_index = __kitcuda_persistent_kernel_index(fat_bin, kernel_name);
+    for (unsigned b = 0; b < KitRTLaunchParamCache::NUM_BUCKETS; b++) {
+      desc->tuned_threads_per_blk[b] = 0;
+      desc->tune_states[b] = nullptr;
+    }
+    // Pick up any previously tuned parameters for the kernel.
+    std::string tune_key = _kitcuda_tune_arch + " " + desc->kernel_name;
+    for (auto it = _kitcuda_tune_table.lower_bound(std::make_pair(tune_key, 0u));
+         it != _kitcuda_tune_table.end() && it->first.first == tune_key; ++it)
+      desc->tuned_threads_per_blk[it->first.second] = it->second;
+    for (int i = 0; i < __kitcuda_get_num_devices(); i++) {
+      CUcontext ctx;
+      CU_SAFE_CALL(cuCtxPushCurrent_v2_p(__kitcuda_get_context_at(i)));
+      CUmodule cu_module = _kitcuda_get_module(i, fat_bin);
+      CU_SAFE_CALL(
+          cuModuleGetFunction_p(&desc->funcs[i], cu_module, kernel_name));
+      // EXPERIMENTAL: Most of our 'forall' kernels have zero shared
+      // memory usage so tweak the kernel's cache configuration to prefer
+      // L1 usage vs. shared or 'split' usage of the local memory.
+      // Kernels with shared memory tiles switch to preferring shared
+      // memory on their first launch (see get_shared_mem_bytes()).
+      CU_SAFE_CALL(
+          cuFuncSetCacheConfig_p(desc->funcs[i], CU_FUNC_CACHE_PREFER_L1));
+      CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+    }
+    CU_SAFE_CALL(cuFuncGetAttribute_p(&desc->num_regs,
+                                      CU_FUNC_ATTRIBUTE_NUM_REGS,
+                                      desc->funcs[0]));
+    CU_SAFE_CALL(cuFuncGetAttribute_p(&desc->max_threads_per_blk,
+                                      CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK,
+                                      desc->funcs[0]));
+    // A block size can be set for the kernel in the runtime's
+    // configuration (see __kitrt_get_config()).
+    std::string setting = "KITCUDA_THREADS_PER_BLOCK:" + desc->kernel_name;
+    desc->fixed_threads_per_blk = 0;
+    if (__kitrt_get_env_value(setting.c_str(), desc->fixed_threads_per_blk))
+      desc->fixed_threads_per_blk = std::max(
+          0, std::min(desc->fixed_threads_per_blk, desc->max_threads_per_blk));
+    const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+    desc->num_multiprocs = props->num_multiprocs;
+    desc->warp_size = props->warp_size;
+    desc->max_threads_per_multiproc = props->max_threads_per_multiproc;
+    desc->max_shared_per_blk = props->max_shared_per_blk;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: created launch descriptor for '%s' "
+              "[registers: %d, max threads/blk: %d].\n", kernel_name,
+              desc->num_regs, desc->max_threads_per_blk);
+  }
+  if (handle != nullptr)
+    __atomic_store_n(handle, (void *)desc, __ATOMIC_RELEASE);
+  KIT_NVTX_POP();
+  return desc;
+}
+
+// Modules can be preloaded in the background at program startup (see
+// __kitcuda_preload_module()).  A single worker thread loads each
+// registered fat binary and creates the launch descriptors for its
+// kernels, filling in their handles.  The module map mutex is only
+// held per kernel so launches wait only if their own kernel (or its
+// module) is still being loaded.
+struct KitCudaPreloadRequest {
+  const void *fat_bin;
+  const char **kernel_names;
+  void ***handles;
+  int num_kernels;
+};
+static bool _kitcuda_preload_enabled = false;
+static std::deque<KitCudaPreloadRequest> _kitcuda_preload_queue;
+static std::mutex _kitcuda_preload_mutex;
+static std::condition_variable _kitcuda_preload_cv;
+static std::thread _kitcuda_preload_thread;
+static bool _kitcuda_preload_done = false;
+
+static void _kitcuda_preload_worker() {
+  __kitcuda_ensure_initialized();
+  CU_SAFE_CALL(cuCtxSetCurrent_p(__kitcuda_get_context_at(0)));
+  while (true) {
+    KitCudaPreloadRequest request;
+    {
+      std::unique_lock<std::mutex> lock(_kitcuda_preload_mutex);
+      _kitcuda_preload_cv.wait(lock, [] {
+        return _kitcuda_preload_done || not _kitcuda_preload_queue.empty();
+      });
+      if (_kitcuda_preload_done)
+        return;
+      request = _kitcuda_preload_queue.front();
+      _kitcuda_preload_queue.pop_front();
+    }
+    KIT_NVTX_PUSH("kitcuda:preload_module", KIT_NVTX_LAUNCH);
+    for (int i = 0; i < request.num_kernels; i++)
+      (void)_kitcuda_get_launch_desc(request.handles[i], request.fat_bin,
+                                     request.kernel_names[i]);
+    KIT_NVTX_POP();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: preloaded module %p (%d kernels).\n",
+              request.fat_bin, request.num_kernels);
+  }
+}
+
+// Launches can be specialized on the values of some of their kernel's
+// parameters (see __kitcuda_specialize_launch()).  Each launch site
+// keeps the module's PTX with the other kernels removed, split around
+// the loads of the specialized parameters, and a variant of the kernel
+// for each set of values it was launched with (up to a limit).  The
+// PTX of a variant replaces the loads with moves of the values, so
+// ptxas folds them into the kernel; the driver compiles it (and caches
+// the result) when the variant's launch descriptor is created.
+struct KitCudaSpecLoad {
+  size_t param;    // index of the parameter within the site's params.
+  char kind;       // the type of the load: 'u', 's', 'b' or 'f'...
+  unsigned bits;   // ...and its size.
+  std::string reg; // the register loaded.
+};
+
+struct KitCudaSpecVariant {
+  std::string key; // the values of the specialized parameters.
+  std::string ptx;
+  void *handle;    // the launch handle of the variant.
+};
+
+// Launches specialize on at most this many parameters of 8 bytes.
+#define KITCUDA_SPEC_MAX_PARAMS 32
+
+struct KitCudaSpecSite {
+  std::vector<int> params;      // the specialized kernel parameters...
+  std::vector<unsigned> sizes;  // ...and the bytes of each value.
+  std::vector<KitCudaSpecLoad> loads;
+  std::vector<std::string> text; // the PTX around the loads.
+  std::mutex mutex;
+  std::map<std::string, KitCudaSpecVariant *> variants;
+  std::atomic<KitCudaSpecVariant *> last; // the last variant launched.
+};
+static std::mutex _kitcuda_spec_mutex;
+static int _kitcuda_max_specializations = 8;
+
+// Find the next kernel entry of the PTX at or after pos: the start of the
+// line that declares it, its name, the opening brace of its body and the
+// end of the body.
+static bool _kitcuda_next_ptx_entry(const std::string &ptx, size_t pos,
+                                    size_t &begin, std::string &name,
+                                    size_t &body, size_t &end) {
+  size_t entry = ptx.find(".entry ", pos);
+  if (entry == std::string::npos)
+    return false;
+  size_t line = ptx.rfind('\n', entry);
+  begin = line == std::string::npos || line < pos ? pos : line + 1;
+  size_t name_begin = ptx.find_first_not_of(" \t", entry + 7);
+  size_t name_end = ptx.find_first_of("( \t\n", name_begin);
+  if (name_end == std::string::npos)
+    return false;
+  name = ptx.substr(name_begin, name_end - name_begin);
+  // The parameter list holds no braces.
+  body = ptx.find('{', name_end);
+  if (body == std::string::npos)
+    return false;
+  int depth = 0;
+  for (end = body; end < ptx.size(); end++) {
+    if (ptx[end] == '{')
+      depth++;
+    else if (ptx[end] == '}' && --depth == 0) {
+      end++;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Create the launch site of a kernel specialized on the given parameters:
+// find the loads of the parameters that can be replaced by a value, i.e.,
+// scalar loads of the whole parameter ('ld.param.<type> <reg>,
+// [<kernel>_param_<n>];').  A site without such loads is never
+// specialized.
+static KitCudaSpecSite *_kitcuda_create_spec_site(const char *module_ptx,
+                                                  const char *kernel_name,
+                                                  const int *params,
+                                                  int num_params) {
+  KitCudaSpecSite *site = new KitCudaSpecSite;
+  site->last = nullptr;
+  for (int p = 0; p < num_params && p < KITCUDA_SPEC_MAX_PARAMS; p++) {
+    site->params.push_back(params[p]);
+    site->sizes.push_back(0);
+  }
+
+  // The PTX of the module without its other kernels.
+  const std::string ptx(module_ptx);
+  std::string text, name;
+  size_t pos = 0, begin, body, end;
+  size_t kernel_body = std::string::npos, kernel_end = std::string::npos;
+  while (_kitcuda_next_ptx_entry(ptx, pos, begin, name, body, end)) {
+    if (name == kernel_name) {
+      text.append(ptx, pos, end - pos);
+      kernel_body = text.size() - (end - body);
+      kernel_end = text.size();
+    } else
+      text.append(ptx, pos, begin - pos);
+    pos = end;
+  }
+  text.append(ptx, pos, std::string::npos);
+  if (kernel_body == std::string::npos)
+    return site;
+
+  const std::string param_prefix = std::string(kernel_name) + "_param_";
+  size_t text_begin = 0;
+  for (size_t at = text.find("ld.param.", kernel_body); at < kernel_end;
+       at = text.find("ld.param.", at + 1)) {
+    KitCudaSpecLoad load;
+    const char *type = text.c_str() + at + 9;
+    load.kind = type[0];
+    if (load.kind != 'u' && load.kind != 's' && load.kind != 'b' &&
+        load.kind != 'f')
+      continue; // vector loads.
+    char *type_end;
+    load.bits = strtoul(type + 1, &type_end, 10);
+    if ((load.bits != 8 && load.bits != 16 && load.bits != 32 &&
+         load.bits != 64) ||
+        (load.kind == 'f' && load.bits < 32) ||
+        (*type_end != ' ' && *type_end != '\t'))
+      continue;
+    size_t reg_begin = text.find_first_not_of(" \t", type_end - text.c_str());
+    size_t reg_end = text.find_first_of(", \t", reg_begin);
+    size_t addr_begin = text.find('[', reg_end);
+    size_t addr_end = text.find("];", addr_begin);
+    if (addr_end == std::string::npos || addr_end >= kernel_end)
+      continue;
+    std::string addr = text.substr(addr_begin + 1, addr_end - addr_begin - 1);
+    if (addr.compare(0, param_prefix.size(), param_prefix) != 0)
+      continue;
+    const char *index_str = addr.c_str() + param_prefix.size();
+    char *index_end;
+    long index = strtol(index_str, &index_end, 10);
+    if (index_end == index_str || *index_end != '\0')
+      continue; // loads at an offset within the parameter.
+    auto param = std::find(site->params.begin(), site->params.end(), index);
+    if (param == site->params.end())
+      continue;
+    load.param = param - site->params.begin();
+    load.reg = text.substr(reg_begin, reg_end - reg_begin);
+    site->sizes[load.param] = std::max(site->sizes[load.param], load.bits / 8);
+    site->text.push_back(text.substr(text_begin, at - text_begin));
+    site->loads.push_back(load);
+    text_begin = addr_end + 2;
+  }
+  site->text.push_back(text.substr(text_begin));
+  return site;
+}
+
+// Create the variant of a site's kernel for the values of the launch's
+// specialized parameters.  Each load of a parameter becomes a move of
+// its value (8-bit loads fill a 16-bit register).
+static KitCudaSpecVariant *
+_kitcuda_create_spec_variant(KitCudaSpecSite *site, const char *kernel_name,
+                             void **kern_args, const std::string &key) {
+  KitCudaSpecVariant *variant = new KitCudaSpecVariant;
+  variant->key = key;
+  variant->handle = nullptr;
+  for (size_t l = 0; l < site->loads.size(); l++) {
+    const KitCudaSpecLoad &load = site->loads[l];
+    uint64_t value = 0;
+    memcpy(&value, kern_args[site->params[load.param]], load.bits / 8);
+    char imm[32];
+    if (load.kind == 'f' && load.bits == 32)
+      snprintf(imm, sizeof(imm), "0f%08X", (uint32_t)value);
+    else if (load.kind == 'f')
+      snprintf(imm, sizeof(imm), "0d%016llX", (unsigned long long)value);
+    else if (load.kind == 's')
+      snprintf(imm, sizeof(imm), "%lld",
+               (long long)((int64_t)(value << (64 - load.bits)) >>
+                           (64 - load.bits)));
+    else
+      snprintf(imm, sizeof(imm), "%llu", (unsigned long long)value);
+    char mov[32];
+    snprintf(mov, sizeof(mov), "mov.%c%u ", load.kind,
+             std::max(load.bits, 16u));
+    variant->ptx += site->text[l];
+    variant->ptx += mov + load.reg + ", " + imm + ";";
+  }
+  variant->ptx += site->text.back();
+  (void)_kitcuda_get_launch_desc(&variant->handle, variant->ptx.c_str(),
+                                 kernel_name);
+  return variant;
+}
 
 extern "C" {
 
+void __kitcuda_enable_module_preload(bool enable) {
+  _kitcuda_preload_enabled = enable;
+}
+
+void __kitcuda_preload_module(const void *fat_bin, const char **kernel_names,
+                              void ***handles, int num_kernels) {
+  assert(fat_bin && "unexpected null fat binary!");
+  if (not _kitcuda_preload_enabled || num_kernels <= 0)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_preload_mutex);
+  _kitcuda_preload_queue.push_back(
+      {fat_bin, kernel_names, handles, num_kernels});
+  if (not _kitcuda_preload_thread.joinable()) {
+    _kitcuda_preload_done = false;
+    _kitcuda_preload_thread = std::thread(_kitcuda_preload_worker);
+  }
+  _kitcuda_preload_cv.notify_one();
+}
+
+void __kitcuda_stop_module_preload() {
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_preload_mutex);
+    _kitcuda_preload_done = true;
+    _kitcuda_preload_queue.clear();
+  }
+  _kitcuda_preload_cv.notify_one();
+  if (_kitcuda_preload_thread.joinable())
+    _kitcuda_preload_thread.join();
+}
+
+void __kitcuda_set_max_specializations(int max_variants) {
+  _kitcuda_max_specializations = max_variants;
+}
+
+void **__kitcuda_specialize_launch(const char *ptx, const char *kernel_name,
+                                   void **kern_args, const int *params,
+                                   int num_params, void **site_handle,
+                                   void **launch_handle) {
+  assert(ptx && "kitcuda: specialized launch with null PTX!");
+  assert(site_handle && "kitcuda: specialized launch with null site!");
+  if (_kitcuda_max_specializations <= 0)
+    return launch_handle;
+
+  KitCudaSpecSite *site =
+      (KitCudaSpecSite *)__atomic_load_n(site_handle, __ATOMIC_ACQUIRE);
+  if (site == nullptr) {
+    std::lock_guard<std::mutex> lock(_kitcuda_spec_mutex);
+    site = (KitCudaSpecSite *)__atomic_load_n(site_handle, __ATOMIC_ACQUIRE);
+    if (site == nullptr) {
+      site = _kitcuda_create_spec_site(ptx, kernel_name, params, num_params);
+      __atomic_store_n(site_handle, (void *)site, __ATOMIC_RELEASE);
+    }
+  }
+  if (site->loads.empty())
+    return launch_handle;
+
+  char key[KITCUDA_SPEC_MAX_PARAMS * sizeof(uint64_t)];
+  size_t key_size = 0;
+  for (size_t p = 0; p < site->params.size(); p++) {
+    memcpy(key + key_size, kern_args[site->params[p]], site->sizes[p]);
+    key_size += site->sizes[p];
+  }
+  // Launches mostly repeat the values of the previous one.
+  KitCudaSpecVariant *variant = site->last.load(std::memory_order_acquire);
+  if (variant != nullptr && variant->key.size() == key_size &&
+      memcmp(variant->key.data(), key, key_size) == 0)
+    return &variant->handle;
+
+  std::lock_guard<std::mutex> lock(site->mutex);
+  std::string key_str(key, key_size);
+  auto it = site->variants.find(key_str);
+  if (it != site->variants.end())
+    variant = it->second;
+  else {
+    if ((int)site->variants.size() >= _kitcuda_max_specializations)
+      return launch_handle;
+    KIT_NVTX_PUSH("kitcuda:specialize_kernel", KIT_NVTX_LAUNCH);
+    __kitcuda_ensure_initialized();
+    variant = _kitcuda_create_spec_variant(site, kernel_name, kern_args,
+                                           key_str);
+    site->variants[key_str] = variant;
+    KIT_NVTX_POP();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: specialized '%s' on %zu load(s) "
+              "(variant %zu).\n", kernel_name, site->loads.size(),
+              site->variants.size());
+  }
+  site->last.store(variant, std::memory_order_release);
+  return &variant->handle;
+}
+
+// The placeholder calls of the values that loops are specialized on are
+// removed by the compiler; this covers any left by loops that were
+// removed before they were lowered.
+void __kitrt_dummy_specialize(int, ...) {}
+
 // *** EXPERIMENTAL: First some background. In general, the details of
 // picking launch parameters can be a challenge and occupancy is often
 // one of the driving factors.  Occupancy is defined as the ratio of
@@ -93,8 +677,10 @@ extern "C" {
 // parameters (set externally) or use a very simple default
 // computation that will be hit-or-miss based on the kernel.
 //
-static bool _kitcuda_use_occupancy_calc = true;
-static bool _kitcuda_refine_occupancy_calc = true;
+// The flags are set by the module constructors and by the (possibly
+// asynchronous) runtime initialization.
+static std::atomic<bool> _kitcuda_use_occupancy_calc{true};
+static std::atomic<bool> _kitcuda_refine_occupancy_calc{true};
 static int _kitcuda_default_max_threads_per_blk = 1024;
 static int _kitcuda_default_threads_per_blk =
     _kitcuda_default_max_threads_per_blk;
@@ -138,6 +724,30 @@ void __kitcuda_refine_occupancy_launches(bool enable) {
     _kitcuda_refine_occupancy_calc = false;
 }
 
+// *** EXPERIMENTAL: When autotuning is enabled the runtime measures the
+// execution time of the first launches of each kernel (for each trip
+// count bucket) over a set of candidate block sizes and then uses the
+// fastest for all remaining launches.  The tuning launches are timed
+// with events and the measurement is collected at a later launch (when
+// the events have completed) so tuning never blocks the caller.  Each
+// candidate is timed `_kitcuda_autotune_trials` times and the best
+// time is kept (the first launches of a kernel often include one-time
+// costs such as page migration).
+static bool _kitcuda_autotune = false;
+static int _kitcuda_autotune_trials = 3;
+
+void __kitcuda_enable_autotune(bool enable) {
+  _kitcuda_autotune = enable;
+  __kitcuda_advance_launch_epoch();
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: %s autotuned launch parameters.\n",
+            enable ? "enabling" : "disabling");
+}
+
+void __kitcuda_set_autotune_trials(int num_trials) {
+  _kitcuda_autotune_trials = num_trials > 0 ? num_trials : 1;
+}
+
 void __kitcuda_set_default_max_threads_per_blk(int num_threads) {
   _kitcuda_default_max_threads_per_blk = num_threads;
 }
@@ -148,9 +758,6 @@ void __kitcuda_set_default_threads_per_blk(int threads_per_blk) {
   _kitcuda_default_threads_per_blk = threads_per_blk;
 }
 
-typedef std::unordered_map<std::string, int> KitCudaLaunchParamMap;
-static KitCudaLaunchParamMap _kitcuda_launch_param_map;
-
 namespace {
 
 int next_lowest_factor(int n, int m) {
@@ -164,6 +771,22 @@ int next_lowest_factor(int n, int m) {
   return m;
 }
 
+// The multi-processor load (blocks per multi-processor, in percent)
+// below which occupancy launches are refined.  The machine profile
+// gives the load at which a copy kernel reaches 90% of the device's
+// bandwidth; without a profile the refinement starts below 75%.
+float min_sm_load() {
+  static const float load = []() {
+    const KitRTMachineProfile *profile = __kitrt_get_machine_profile();
+    if (profile != nullptr && profile->device_saturating_load > 0.0)
+      return (float)profile->device_saturating_load;
+    return 75.0f;
+  }();
+  return load;
+}
+
+bool is_memory_bound(KitCudaLaunchDesc *desc, const KitRTInstMix *inst_mix);
+
 } // namespace
 
 /**
@@ -177,29 +800,29 @@ int next_lowest_factor(int n, int m) {
  * within the implementation (and is far from an exact science...).
  *
  * @param trip_count - how many elements to process
- * @param cu_func - the actual CUDA function / kernel.
+ * @param desc - the launch descriptor of the kernel.
  * @param threads_per_blk - computed threads per block for launch
  * @param blks_per_grid - computed blocks per grid for launch
  */
-void __kitcuda_get_occ_launch_params(size_t trip_count, CUfunction cu_func,
+void __kitcuda_get_occ_launch_params(size_t trip_count, KitCudaLaunchDesc *desc,
                                      int &threads_per_blk, int &blks_per_grid,
                                      const KitRTInstMix *inst_mix) {
   assert(_kitcuda_use_occupancy_calc && "called when occupancy mode is false!");
   KIT_NVTX_PUSH("kitcuda:get_occupancy_launch_params", KIT_NVTX_LAUNCH);
 
   // As a default starting point, use CUDA's occupancy heuristic to get
-  // an initial occupancy.
-  int min_grid_size;
-  CU_SAFE_CALL(cuOccupancyMaxPotentialBlockSize_p(
-      &min_grid_size, &threads_per_blk, cu_func, 0, 0, 0));
+  // an initial occupancy.  This only depends upon the kernel so it is
+  // computed once and saved in the descriptor.
+  threads_per_blk = desc->occ_threads_per_blk;
+  if (threads_per_blk == 0) {
+    int min_grid_size;
+    CU_SAFE_CALL(cuOccupancyMaxPotentialBlockSize_p(
+        &min_grid_size, &threads_per_blk, desc->funcs[0], 0, 0, 0));
+    desc->occ_threads_per_blk = threads_per_blk;
+  }
 
   if (_kitcuda_refine_occupancy_calc) {
-    extern int _kitcuda_device_id;
-
-    int num_multiprocs = 0;
-    CU_SAFE_CALL(cuDeviceGetAttribute_p(
-        &num_multiprocs, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
-        _kitcuda_device_id));
+    int num_multiprocs = desc->num_multiprocs;
 
     // The occupancy measure isn't the only aspect of launch performance
     // to consider.  Specifically, the heuristic ignores trip counts that
@@ -228,17 +851,18 @@ void __kitcuda_get_occ_launch_params(size_t trip_count, CUfunction cu_func,
     // must be adjusted such that the resulting block count does not exceed
     // the number of SMs available.
     //
-    // As a starting point we will adjust launch parameters if we are utilizing
-    // less than 75% of the GPU's SMs.  TODO: Make this a tweak-able parameter?
-    if (sm_load < 75) {
+    // We adjust launch parameters if we are utilizing less than the
+    // load that saturates the device (see `min_sm_load()`), adding
+    // blocks until every SM has one (or that load is reached).
+    float min_load = min_sm_load();
+    if (sm_load < min_load) {
       if (__kitrt_verbose_mode())
         fprintf(stderr,
                 "  ***-GPU is underutilized -- adjusting block size...\n");
 
-      int warp_size = 0;
-      CU_SAFE_CALL(cuDeviceGetAttribute_p(
-          &warp_size, CU_DEVICE_ATTRIBUTE_WARP_SIZE, _kitcuda_device_id));
-      while (block_count < num_multiprocs && threads_per_blk > warp_size) {
+      int warp_size = desc->warp_size;
+      float target_load = std::max(100.0f, min_load);
+      while (sm_load < target_load && threads_per_blk > warp_size) {
         threads_per_blk = next_lowest_factor(threads_per_blk, warp_size);
         block_count = (trip_count + threads_per_blk - 1) / threads_per_blk;
         sm_load = ((float)block_count / num_multiprocs) * 100.0;
@@ -269,130 +893,1160 @@ void __kitcuda_get_occ_launch_params(size_t trip_count, CUfunction cu_func,
  * the code in kitcuda-launch.cpp for more details.
  *
  * @param trip_count - how many elements to process
- * @param cu_func - the actual CUDA function / kernel.
+ * @param desc - the launch descriptor of the kernel.
  * @param threads_per_blk - computed threads per block for launch
  * @param blks_per_grid - computed blocks per grid for launch
  */
-void __kitcuda_get_launch_params(size_t trip_count, CUfunction cu_func,
+void __kitcuda_get_launch_params(size_t trip_count, KitCudaLaunchDesc *desc,
                                  int &threads_per_blk, int &blks_per_grid,
                                  const KitRTInstMix *inst_mix) {
-  KIT_NVTX_PUSH("kitcuda:get_launch_params", KIT_NVTX_LAUNCH);
-
-  // EXPERIMENTAL: Our 'forall' kernels have zero shared memory usage so
-  // tweak the kernel's cache configuration to prefer L1 usage vs. shared
-  // or 'split' usage of the local memory.
-  CU_SAFE_CALL(cuFuncSetCacheConfig_p(cu_func, CU_FUNC_CACHE_PREFER_L1));
+  // A block size configured for the kernel takes precedence over
+  // everything else, followed by autotuned parameters.
+  if (desc->fixed_threads_per_blk != 0) {
+    threads_per_blk = desc->fixed_threads_per_blk;
+    blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
+    return;
+  }
+  if (_kitcuda_autotune) {
+    unsigned bucket = KitRTLaunchParamCache::bucket_index(trip_count);
+    threads_per_blk =
+        desc->tuned_threads_per_blk[bucket].load(std::memory_order_relaxed);
+    if (threads_per_blk != 0) {
+      blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
+      return;
+    }
+  }
 
   // EXPERIMENTAL: To reduce some overheads the runtime caches launch
   // parameters for each kernel.  Check to see if we have already set
   // the launch parameters for this kernel and trip count.
-  const char *cu_func_name;
-  CU_SAFE_CALL(cuFuncGetName_p(&cu_func_name, cu_func));
-  std::string map_entry_name(cu_func_name);
-  map_entry_name += std::to_string(trip_count);
-
-  KitCudaLaunchParamMap::iterator lpit =
-      _kitcuda_launch_param_map.find(map_entry_name);
-
-  if (lpit != _kitcuda_launch_param_map.end())
-    // use previously determined parameters.
-    threads_per_blk = lpit->second;
-  else {
+  threads_per_blk = desc->launch_params.lookup(trip_count);
+  if (threads_per_blk == 0) {
+    KIT_NVTX_PUSH("kitcuda:get_launch_params", KIT_NVTX_LAUNCH);
     if (_kitcuda_use_occupancy_calc)
       // EXPERIMENTAL: use an occupancy-based path to setting the launch
       // parameters.
-      __kitcuda_get_occ_launch_params(trip_count, cu_func, threads_per_blk,
+      __kitcuda_get_occ_launch_params(trip_count, desc, threads_per_blk,
                                       blks_per_grid, inst_mix);
     else
       threads_per_blk = _kitcuda_default_threads_per_blk;
-    _kitcuda_launch_param_map[map_entry_name] = threads_per_blk;
+    desc->launch_params.insert(trip_count, threads_per_blk);
+    KIT_NVTX_POP();
   }
 
   blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
-  KIT_NVTX_POP();
 }
 
-void *__kitcuda_launch_kernel(const void *fat_bin, const char *kernel_name,
-                              void **kern_args, uint64_t trip_count,
-                              int threads_per_blk,
+} // extern "C"
+
+// The tuning state of a single (kernel, trip count bucket) pair.
+static const int KITCUDA_TUNE_MAX_CANDIDATES = 16;
+struct KitCudaTuneState {
+  std::mutex mutex;
+  int candidates[KITCUDA_TUNE_MAX_CANDIDATES]; // block sizes to try.
+  float best_time[KITCUDA_TUNE_MAX_CANDIDATES]; // msecs per iteration.
+  int num_candidates;
+  int next;      // the candidate being timed.
+  int trial;     // completed trials of the current candidate.
+  bool pending;  // a timed launch has not yet been measured.
+  uint64_t pending_trips;
+  CUevent start, stop;
+};
+
+static KitCudaTuneState *_kitcuda_new_tune_state(KitCudaLaunchDesc *desc,
+                                                 uint64_t trip_count,
+                                                 const KitRTInstMix *inst_mix) {
+  KitCudaTuneState *state = new KitCudaTuneState;
+  state->num_candidates = 0;
+  state->next = 0;
+  state->trial = 0;
+  state->pending = false;
+  state->pending_trips = 0;
+
+  // The runtime's heuristic choice is always a candidate and is timed
+  // first.  The rest are the power-of-two multiples of the warp size
+  // that the kernel can be launched with.  Memory-bound kernels behave
+  // like the copy kernel of the machine profile, so for them only the
+  // sizes within a factor of two of the copy's fastest block size are
+  // tried.
+  int heuristic_tpb, blks_per_grid;
+  if (_kitcuda_use_occupancy_calc)
+    __kitcuda_get_occ_launch_params(trip_count, desc, heuristic_tpb,
+                                    blks_per_grid, inst_mix);
+  else
+    heuristic_tpb = _kitcuda_default_threads_per_blk;
+  state->candidates[state->num_candidates++] = heuristic_tpb;
+  int min_tpb = desc->warp_size;
+  int max_tpb = std::min(desc->max_threads_per_blk,
+                         _kitcuda_default_max_threads_per_blk);
+  const KitRTMachineProfile *profile = __kitrt_get_machine_profile();
+  if (profile != nullptr && profile->device_stream_threads_per_blk > 0 &&
+      inst_mix != nullptr && is_memory_bound(desc, inst_mix)) {
+    int seed_tpb = profile->device_stream_threads_per_blk;
+    min_tpb = std::max(min_tpb, seed_tpb / 2);
+    max_tpb = std::min(max_tpb, seed_tpb * 2);
+  }
+  for (int tpb = desc->warp_size;
+       tpb <= max_tpb && state->num_candidates < KITCUDA_TUNE_MAX_CANDIDATES;
+       tpb *= 2) {
+    if (tpb >= min_tpb && tpb != heuristic_tpb)
+      state->candidates[state->num_candidates++] = tpb;
+  }
+  for (int i = 0; i < state->num_candidates; i++)
+    state->best_time[i] = -1.0f;
+
+  CU_SAFE_CALL(cuEventCreate_p(&state->start, CU_EVENT_DEFAULT));
+  CU_SAFE_CALL(cuEventCreate_p(&state->stop, CU_EVENT_DEFAULT));
+  return state;
+}
+
+// Pick the threads-per-block value for a launch that is still being
+// tuned.  Returns the (locked) tuning state if the launch should be
+// timed or null if the launch should use the regular launch parameters
+// (e.g., tuning has finished or another thread is tuning the kernel).
+// A locked state must be released with _kitcuda_autotune_end().
+static KitCudaTuneState *_kitcuda_autotune_begin(KitCudaLaunchDesc *desc,
+                                                 uint64_t trip_count,
+                                                 const KitRTInstMix *inst_mix,
+                                                 int &threads_per_blk) {
+  unsigned bucket = KitRTLaunchParamCache::bucket_index(trip_count);
+  if (desc->tuned_threads_per_blk[bucket].load(std::memory_order_relaxed))
+    return nullptr;
+
+  KitCudaTuneState *state = desc->tune_states[bucket].load();
+  if (state == nullptr) {
+    KitCudaTuneState *new_state =
+        _kitcuda_new_tune_state(desc, trip_count, inst_mix);
+    if (desc->tune_states[bucket].compare_exchange_strong(state, new_state))
+      state = new_state;
+    else {
+      CU_SAFE_CALL(cuEventDestroy_v2_p(new_state->start));
+      CU_SAFE_CALL(cuEventDestroy_v2_p(new_state->stop));
+      delete new_state;
+    }
+  }
+
+  if (not state->mutex.try_lock())
+    return nullptr;
+
+  if (state->pending) {
+    CUresult result = cuEventQuery_p(state->stop);
+    if (result == CUDA_ERROR_NOT_READY) {
+      state->mutex.unlock();
+      return nullptr;
+    }
+    CU_SAFE_CALL(result);
+    float msecs;
+    CU_SAFE_CALL(cuEventElapsedTime_p(&msecs, state->start, state->stop));
+    float per_trip = msecs / state->pending_trips;
+    float &best = state->best_time[state->next];
+    if (best < 0.0f || per_trip < best)
+      best = per_trip;
+    state->pending = false;
+    if (++state->trial >= _kitcuda_autotune_trials) {
+      state->trial = 0;
+      state->next++;
+    }
+  }
+
+  if (state->next == state->num_candidates) {
+    int best = 0;
+    for (int i = 1; i < state->num_candidates; i++)
+      if (state->best_time[i] < state->best_time[best])
+        best = i;
+    if (__kitrt_verbose_mode()) {
+      fprintf(stderr, "kitcuda: autotuned '%s' (trip count bucket 2^%u):\n",
+              desc->kernel_name.c_str(), bucket);
+      for (int i = 0; i < state->num_candidates; i++)
+        fprintf(stderr, "  threads-per-block: %4d, %g usecs/iteration%s\n",
+                state->candidates[i], state->best_time[i] * 1000,
+                i == best ? " (selected)" : "");
+    }
+    desc->tuned_threads_per_blk[bucket].store(state->candidates[best],
+                                              std::memory_order_relaxed);
+    // The timing events are no longer needed.  A launch that raced the
+    // store above can reach this point again once they are gone.
+    if (state->start != nullptr) {
+      CU_SAFE_CALL(cuEventDestroy_v2_p(state->start));
+      CU_SAFE_CALL(cuEventDestroy_v2_p(state->stop));
+      state->start = state->stop = nullptr;
+    }
+    state->mutex.unlock();
+    return nullptr;
+  }
+
+  threads_per_blk = state->candidates[state->next];
+  state->pending_trips = trip_count;
+  return state;
+}
+
+// Record the launch that was issued on the given stream as the timed
+// launch of the tuning state and release it.
+static void _kitcuda_autotune_end(KitCudaTuneState *state, CUstream stream) {
+  CU_SAFE_CALL(cuEventRecord_p(state->stop, stream));
+  state->pending = true;
+  state->mutex.unlock();
+}
+
+extern "C" {
+
+void __kitcuda_load_autotune_table(const char *path) {
+  assert(path && "unexpected null path!");
+  const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+  _kitcuda_tune_arch =
+      "sm_" + std::to_string(props->major * 10 + props->minor);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == nullptr) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: no autotuning table found at '%s'.\n", path);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_kitcuda_module_map_mutex);
+  char line[1024], arch[64], kernel_name[896];
+  unsigned bucket;
+  int threads_per_blk;
+  unsigned num_entries = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%63s %895s %u %d", arch, kernel_name, &bucket,
+               &threads_per_blk) != 4 ||
+        bucket >= KitRTLaunchParamCache::NUM_BUCKETS || threads_per_blk <= 0) {
+      if (line[0] != '\n')
+        fprintf(stderr, "kitcuda: warning, ignoring malformed autotuning "
+                        "entry in '%s': %s", path, line);
+      continue;
+    }
+    std::string key = std::string(arch) + " " + kernel_name;
+    _kitcuda_tune_table[std::make_pair(key, bucket)] = threads_per_blk;
+    num_entries++;
+  }
+  fclose(fp);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: read %u autotuning entries from '%s'.\n",
+            num_entries, path);
+}
+
+void __kitcuda_save_autotune_table(const char *path) {
+  assert(path && "unexpected null path!");
+  std::lock_guard<std::mutex> lock(_kitcuda_module_map_mutex);
+  for (auto &entry : _kitcuda_launch_descs) {
+    KitCudaLaunchDesc *desc = entry.second;
+    std::string key = _kitcuda_tune_arch + " " + desc->kernel_name;
+    for (unsigned b = 0; b < KitRTLaunchParamCache::NUM_BUCKETS; b++) {
+      int tpb = desc->tuned_threads_per_blk[b].load(std::memory_order_relaxed);
+      if (tpb != 0)
+        _kitcuda_tune_table[std::make_pair(key, b)] = tpb;
+    }
+  }
+
+  FILE *fp = fopen(path, "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "kitcuda: warning, unable to write autotuning table "
+                    "'%s'.\n", path);
+    return;
+  }
+  fprintf(fp, "# kitcuda autotuning table\n");
+  fprintf(fp, "# <arch> <kernel> <log2(trip count)> <threads-per-block>\n");
+  for (auto &entry : _kitcuda_tune_table)
+    fprintf(fp, "%s %u %d\n", entry.first.first.c_str(), entry.first.second,
+            entry.second);
+  fclose(fp);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: wrote %zu autotuning entries to '%s'.\n",
+            _kitcuda_tune_table.size(), path);
+}
+
+// *** EXPERIMENTAL: A simple roofline model of the primary device is
+// used to classify kernels as memory- or compute-bound based on the
+// instruction mix provided by the compiler.  The classification sets
+// how many iterations each thread of a (grid-stride) kernel executes:
+// memory-bound kernels keep more waves of threads in flight to hide
+// memory latency while compute-bound kernels only need enough to
+// balance the load across the multi-processors.  Coarsening threads
+// amortizes the per-thread costs (index calculations, block scheduling,
+// etc.) over several iterations.
+static bool _kitcuda_coarsen_launch = true;
+static int _kitcuda_max_iters_per_thread = 8;
+static int _kitcuda_max_launch_waves = 32;
+
+void __kitcuda_use_coarsened_launch(bool enable) {
+  _kitcuda_coarsen_launch = enable;
+}
+
+void __kitcuda_set_max_iters_per_thread(int num_iters) {
+  _kitcuda_max_iters_per_thread = num_iters > 0 ? num_iters : 1;
+}
+
+void __kitcuda_set_max_launch_waves(int num_waves) {
+  _kitcuda_max_launch_waves = num_waves > 0 ? num_waves : 0;
+}
+
+} // extern "C"
+
+namespace {
+
+// Peak rates of the primary device (zero if unknown).
+double _kitcuda_peak_ops_per_sec = 0.0;
+double _kitcuda_peak_bytes_per_sec = 0.0;
+std::once_flag _kitcuda_roofline_once;
+
+// The number of (32-bit) arithmetic units per multi-processor.  This
+// isn't provided by the driver so we keep a small table by compute
+// capability.
+int cores_per_multiproc(int major, int minor) {
+  switch (major) {
+  case 3:
+    return 192;
+  case 6:
+    return minor == 0 ? 64 : 128;
+  case 7:
+    return 64;
+  case 8:
+    return minor == 0 ? 64 : 128;
+  default:
+    return 128;
+  }
+}
+
+void init_roofline() {
+  // Some of these attributes are not supported by all drivers -- if
+  // they are missing the model is not used.
+  const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+  if (props->clock_khz == 0)
+    return;
+
+  // The bandwidth measured for the machine profile is the achievable
+  // roof; otherwise it is computed from the memory clock (memory
+  // transfers occur on both clock edges).
+  const KitRTMachineProfile *profile = __kitrt_get_machine_profile();
+  double bytes_per_sec = 0.0;
+  if (profile != nullptr && profile->device_bytes_per_sec > 0.0)
+    bytes_per_sec = profile->device_bytes_per_sec;
+  else if (props->mem_clock_khz != 0 && props->mem_bus_width != 0)
+    bytes_per_sec =
+        2.0 * props->mem_clock_khz * 1000.0 * (props->mem_bus_width / 8.0);
+  else
+    return;
+
+  // Fused multiply-adds count as two operations.
+  _kitcuda_peak_ops_per_sec =
+      2.0 * cores_per_multiproc(props->major, props->minor) *
+      props->num_multiprocs * props->clock_khz * 1000.0;
+  _kitcuda_peak_bytes_per_sec = bytes_per_sec;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: device roofline -- peak %.1f Gop/s, "
+            "%.1f GB/s.\n", _kitcuda_peak_ops_per_sec * 1e-9,
+            _kitcuda_peak_bytes_per_sec * 1e-9);
+}
+
+// Is the kernel memory bound?  Kernels that do not access memory are
+// compute bound and, without a device model, all others are assumed
+// to be memory bound.
+bool is_memory_bound(KitCudaLaunchDesc *desc, const KitRTInstMix *inst_mix) {
+  int memory_bound = desc->memory_bound.load(std::memory_order_relaxed);
+  if (memory_bound < 0) {
+    std::call_once(_kitcuda_roofline_once, init_roofline);
+    double ops = inst_mix->num_flops + inst_mix->num_iops;
+    double bytes = inst_mix->num_memory_bytes;
+    double intensity = bytes > 0 ? ops / bytes : 0.0;
+    if (bytes == 0)
+      memory_bound = 0;
+    else if (_kitcuda_peak_bytes_per_sec == 0.0)
+      memory_bound = 1;
+    else
+      // Below the ridge point of the roofline the kernel's throughput
+      // is limited by memory bandwidth.
+      memory_bound =
+          intensity < _kitcuda_peak_ops_per_sec / _kitcuda_peak_bytes_per_sec;
+    desc->memory_bound.store(memory_bound, std::memory_order_relaxed);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: kernel '%s' is %s bound "
+              "(%.2f ops/byte).\n", desc->kernel_name.c_str(),
+              memory_bound ? "memory" : "compute", intensity);
+  }
+  return memory_bound != 0;
+}
+
+// Return the dynamic shared memory needed by a launch of the kernel
+// with the given block size for its shared memory tiles (see the
+// compiler's '-cuabi-tile-loads').  The block size is reduced if the
+// tiles would not fit in the device's shared memory.  The first launch
+// that uses shared memory switches the kernel's cache configuration to
+// prefer shared memory.
+unsigned get_shared_mem_bytes(KitCudaLaunchDesc *desc,
                               const KitRTInstMix *inst_mix,
-                              void *opaque_stream) {
+                              int &threads_per_blk) {
+  if (inst_mix == nullptr)
+    return 0;
+  // The launch attribute can ask for more than the tiles need.
+  uint64_t min_bytes = std::min(inst_mix->launch_shared_bytes,
+                                (uint64_t)desc->max_shared_per_blk);
+  if (inst_mix->shared_bytes_per_thread == 0)
+    return (unsigned)min_bytes;
+
+  uint64_t bytes;
+  while ((bytes = inst_mix->shared_bytes_per_thread * threads_per_blk +
+                  inst_mix->shared_bytes) >
+             (uint64_t)desc->max_shared_per_blk &&
+         threads_per_blk > desc->warp_size)
+    threads_per_blk /= 2;
+
+  if (not desc->prefers_shared.exchange(true)) {
+    for (int i = 0; i < __kitcuda_get_num_devices(); i++) {
+      CUcontext ctx;
+      CU_SAFE_CALL(cuCtxPushCurrent_v2_p(__kitcuda_get_context_at(i)));
+      CU_SAFE_CALL(
+          cuFuncSetCacheConfig_p(desc->funcs[i], CU_FUNC_CACHE_PREFER_SHARED));
+      CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+    }
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: kernel '%s' uses %ld bytes of shared memory "
+              "per block (%d threads).\n", desc->kernel_name.c_str(), bytes,
+              threads_per_blk);
+  }
+  return (unsigned)std::max(bytes, min_bytes);
+}
+
+// Return the number of iterations each thread should execute for a
+// launch of the given size.
+int get_iters_per_thread(KitCudaLaunchDesc *desc, const KitRTInstMix *inst_mix,
+                         uint64_t trip_count) {
+  if (inst_mix == nullptr || (inst_mix->flags & KITRT_KERNEL_GRID_STRIDE) == 0)
+    return 1;
+  // The launch attribute pins the coarsening of the kernel.
+  if (inst_mix->iters_per_thread > 0)
+    return (int)std::min(inst_mix->iters_per_thread, (uint64_t)INT_MAX);
+  if (not _kitcuda_coarsen_launch)
+    return 1;
+
+  // The number of waves of threads needed to cover the launch if every
+  // multi-processor is fully occupied.
+  uint64_t resident_threads =
+      (uint64_t)desc->num_multiprocs * desc->max_threads_per_multiproc;
+  if (resident_threads == 0)
+    return 1;
+  uint64_t waves = trip_count / resident_threads;
+  uint64_t min_waves = is_memory_bound(desc, inst_mix) ? 4 : 2;
+  uint64_t iters_per_thread =
+      std::min(waves / min_waves, (uint64_t)_kitcuda_max_iters_per_thread);
+  // Very large launches keep a fixed number of waves; the grid no longer
+  // grows with the trip count.
+  if (_kitcuda_max_launch_waves > 0 &&
+      waves > (uint64_t)_kitcuda_max_launch_waves * iters_per_thread)
+    iters_per_thread =
+        std::min((waves + _kitcuda_max_launch_waves - 1) /
+                     _kitcuda_max_launch_waves,
+                 (uint64_t)INT_MAX);
+  return iters_per_thread > 1 ? (int)iters_per_thread : 1;
+}
+
+} // namespace
+
+extern "C" {
+
+// Kernel launches are only spread across multiple devices when each
+// device receives at least this many iterations.
+static uint64_t _kitcuda_multi_device_min_trips = 1 << 20;
+
+void __kitcuda_set_multi_device_min_trip_count(uint64_t trip_count) {
+  _kitcuda_multi_device_min_trips = trip_count > 0 ? trip_count : 1;
+}
+
+namespace {
+
+// Launch the kernel with its iteration space, [start, end), split
+// evenly across the first 'num_slices' devices.  The first slice runs
+// on the launch stream.  The other devices don't start until the prior
+// work on the launch stream is complete and the launch stream waits on
+// their completion -- this keeps the caller's view of the launch the
+// same as for a single device.
+void launch_slices(KitCudaLaunchDesc *desc, void **kern_args, uint64_t start,
+                   uint64_t end, int num_slices, int threads_per_blk,
+                   int iters_per_thread, unsigned shared_mem,
+                   CUstream cu_stream) {
+  KIT_NVTX_PUSH("kitcuda:launch_slices", KIT_NVTX_LAUNCH);
+  uint64_t bounds[KITCUDA_MAX_DEVICES + 1];
+  void *streams[KITCUDA_MAX_DEVICES];
+
+  // Keep slice boundaries on block boundaries so only the last block of
+  // the last slice is partially filled.
+  uint64_t chunk = (end - start + num_slices - 1) / num_slices;
+  chunk = (chunk + threads_per_blk - 1) / threads_per_blk * threads_per_blk;
+  for (int i = 0; i < num_slices; i++)
+    bounds[i] = std::min(start + i * chunk, end);
+  bounds[num_slices] = end;
+
+  CUevent ready;
+  CU_SAFE_CALL(cuEventCreate_p(&ready, CU_EVENT_DISABLE_TIMING));
+  CU_SAFE_CALL(cuEventRecord_p(ready, cu_stream));
+
+  streams[0] = (void *)cu_stream;
+  for (int i = 1; i < num_slices; i++) {
+    streams[i] = __kitcuda_get_device_stream(i);
+    CU_SAFE_CALL(cuStreamWaitEvent_p((CUstream)streams[i], ready, 0));
+  }
+
+  __kitcuda_mem_gpu_prefetch_slices(cu_stream, num_slices, bounds, streams);
+
+  // The first two kernel arguments are the end and start of the
+  // iteration space.  The launch copies the argument values so we can
+  // temporarily point them at each slice's bounds.  NOTE: We assume a
+  // little-endian host so narrower values are at the start of the
+  // 64-bit storage.
+  void *end_arg = kern_args[0];
+  void *start_arg = kern_args[1];
+  for (int i = 0; i < num_slices; i++) {
+    uint64_t slice_start = bounds[i];
+    uint64_t slice_end = bounds[i + 1];
+    if (slice_start == slice_end)
+      continue;
+    kern_args[0] = &slice_end;
+    kern_args[1] = &slice_start;
+    uint64_t iters_per_blk = (uint64_t)threads_per_blk * iters_per_thread;
+    int blks_per_grid =
+        (slice_end - slice_start + iters_per_blk - 1) / iters_per_blk;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: launch slice %d of '%s' [%ld, %ld) "
+              "blocks: %d, threads: %d\n", i, desc->kernel_name.c_str(), slice_start,
+              slice_end, blks_per_grid, threads_per_blk);
+
+    if (i == 0) {
+      CU_SAFE_CALL(cuLaunchKernel_p(desc->funcs[i], blks_per_grid, 1, 1,
+                                    threads_per_blk, 1, 1, shared_mem,
+                                    (CUstream)streams[i], kern_args, NULL));
+      continue;
+    }
+
+    CUcontext ctx;
+    CUevent done;
+    CU_SAFE_CALL(cuCtxPushCurrent_v2_p(__kitcuda_get_context_at(i)));
+    CU_SAFE_CALL(cuLaunchKernel_p(desc->funcs[i], blks_per_grid, 1, 1,
+                                  threads_per_blk, 1, 1, shared_mem,
+                                  (CUstream)streams[i], kern_args, NULL));
+    CU_SAFE_CALL(cuEventCreate_p(&done, CU_EVENT_DISABLE_TIMING));
+    CU_SAFE_CALL(cuEventRecord_p(done, (CUstream)streams[i]));
+    CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+    CU_SAFE_CALL(cuStreamWaitEvent_p(cu_stream, done, 0));
+    // Resources are released once the event completes.
+    CU_SAFE_CALL(cuEventDestroy_v2_p(done));
+  }
+  kern_args[0] = end_arg;
+  kern_args[1] = start_arg;
+  CU_SAFE_CALL(cuEventDestroy_v2_p(ready));
+  KIT_NVTX_POP();
+}
+
+// The streams out-of-core launches move their chunks of data on.
+CUstream _kitcuda_out_of_core_streams[KITCUDA_MAX_OUT_OF_CORE_BUFFERS];
+std::mutex _kitcuda_out_of_core_mutex;
+
+// Launch the kernel with its iteration space, [start, end), split into
+// chunks that each use a share of the launch's 'data_bytes' of managed
+// data that fits in the out-of-core budget (see
+// __kitcuda_set_out_of_core()).  The chunks take turns on the
+// out-of-core streams: a chunk's data is prefetched to the device once
+// the eviction of the chunk that last used its stream was issued, its
+// kernel runs on the launch stream once the data has arrived, and its
+// data is then evicted.  The launch stream waits on the last evictions
+// so the caller's view of the launch is unchanged.
+void launch_out_of_core(KitCudaLaunchDesc *desc, void **kern_args,
+                        uint64_t start, uint64_t end, uint64_t data_bytes,
+                        int threads_per_blk, int iters_per_thread,
+                        unsigned shared_mem, CUstream cu_stream) {
+  KIT_NVTX_PUSH("kitcuda:launch_out_of_core", KIT_NVTX_LAUNCH);
+  int num_buffers = __kitcuda_get_out_of_core_buffers();
+  uint64_t chunk_bytes = __kitcuda_get_out_of_core_budget() / num_buffers;
+  uint64_t num_chunks = (data_bytes + chunk_bytes - 1) / chunk_bytes;
+  uint64_t iters_per_blk = (uint64_t)threads_per_blk * iters_per_thread;
+  uint64_t chunk = (end - start + num_chunks - 1) / num_chunks;
+  chunk = (chunk + iters_per_blk - 1) / iters_per_blk * iters_per_blk;
+
+  // Out-of-core launches from different threads share the streams.
+  std::lock_guard<std::mutex> lock(_kitcuda_out_of_core_mutex);
+  CUevent ready;
+  CU_SAFE_CALL(cuEventCreate_p(&ready, CU_EVENT_DISABLE_TIMING));
+  CU_SAFE_CALL(cuEventRecord_p(ready, cu_stream));
+  for (int i = 0; i < num_buffers; i++) {
+    CUstream &stream = _kitcuda_out_of_core_streams[i];
+    if (stream == nullptr)
+      CU_SAFE_CALL(cuStreamCreate_p(&stream, CU_STREAM_NON_BLOCKING));
+    CU_SAFE_CALL(cuStreamWaitEvent_p(stream, ready, 0));
+  }
+  CU_SAFE_CALL(cuEventDestroy_v2_p(ready));
+
+  // See launch_slices() for the handling of the bounds arguments.
+  void *end_arg = kern_args[0];
+  void *start_arg = kern_args[1];
+  uint64_t n = 0;
+  for (uint64_t lo = start; lo < end; lo += chunk, n++) {
+    uint64_t hi = std::min(lo + chunk, end);
+    CUstream stream = _kitcuda_out_of_core_streams[n % num_buffers];
+    CUevent arrived, done;
+    CU_SAFE_CALL(cuEventCreate_p(&arrived, CU_EVENT_DISABLE_TIMING));
+    CU_SAFE_CALL(cuEventCreate_p(&done, CU_EVENT_DISABLE_TIMING));
+
+    __kitcuda_mem_prefetch_chunk(cu_stream, start, end, lo, hi, chunk_bytes,
+                                 false, stream);
+    CU_SAFE_CALL(cuEventRecord_p(arrived, stream));
+    CU_SAFE_CALL(cuStreamWaitEvent_p(cu_stream, arrived, 0));
+
+    kern_args[0] = &hi;
+    kern_args[1] = &lo;
+    int blks_per_grid = (hi - lo + iters_per_blk - 1) / iters_per_blk;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: launch out-of-core chunk %ld of '%s' "
+              "[%ld, %ld) blocks: %d, threads: %d\n", n,
+              desc->kernel_name.c_str(), lo, hi, blks_per_grid,
+              threads_per_blk);
+    CU_SAFE_CALL(cuLaunchKernel_p(desc->funcs[0], blks_per_grid, 1, 1,
+                                  threads_per_blk, 1, 1, shared_mem,
+                                  cu_stream, kern_args, NULL));
+    CU_SAFE_CALL(cuEventRecord_p(done, cu_stream));
+    CU_SAFE_CALL(cuStreamWaitEvent_p(stream, done, 0));
+    __kitcuda_mem_prefetch_chunk(cu_stream, start, end, lo, hi, chunk_bytes,
+                                 true, stream);
+    // Resources are released once the events complete.
+    CU_SAFE_CALL(cuEventDestroy_v2_p(arrived));
+    CU_SAFE_CALL(cuEventDestroy_v2_p(done));
+  }
+  kern_args[0] = end_arg;
+  kern_args[1] = start_arg;
+
+  for (int i = 0; i < num_buffers; i++) {
+    CUevent evicted;
+    CU_SAFE_CALL(cuEventCreate_p(&evicted, CU_EVENT_DISABLE_TIMING));
+    CU_SAFE_CALL(cuEventRecord_p(evicted, _kitcuda_out_of_core_streams[i]));
+    CU_SAFE_CALL(cuStreamWaitEvent_p(cu_stream, evicted, 0));
+    CU_SAFE_CALL(cuEventDestroy_v2_p(evicted));
+  }
+  __kitcuda_mem_release_pending(cu_stream);
+  KIT_NVTX_POP();
+}
+
+// Multiple threads can launch kernels in our current design.  If a
+// thread enters without having previously set the context the CUDA
+// runtime becomes unhappy with us.  Make sure we're following the
+// rules.  This only needs to be checked once per thread and runtime
+// initialization: the context is gone once the runtime is destroyed.
+void set_thread_context() {
+  static thread_local unsigned thread_context_generation = 0;
+  if (thread_context_generation !=
+      __atomic_load_n(&_kitcuda_context_generation, __ATOMIC_ACQUIRE)) {
+    // The first launch of the thread may race an initialization that is
+    // still running in the background.
+    __kitcuda_ensure_initialized();
+    CUcontext ctx;
+    CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+    // A context we made current before a re-initialization is stale.
+    if (ctx == NULL || thread_context_generation != 0)
+      CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+    thread_context_generation =
+        __atomic_load_n(&_kitcuda_context_generation, __ATOMIC_ACQUIRE);
+  }
+}
+
+// Launches that take none of the optional paths of a launch (multiple
+// devices, persistent workers, autotuning, out-of-core, dataflow and
+// graph launches, profiling or verbose output) can use the geometry of
+// the thread's previous launch (see KitCudaFastLaunch).
+bool is_plain_launch(const KitCudaLaunchDesc *desc) {
+  return __kitcuda_get_num_devices() == 1 && not _kitcuda_autotune &&
+         not __kitrt_profile_enabled() && not __kitrt_verbose_mode() &&
+         __kitcuda_get_out_of_core_budget() == 0 &&
+         not __kitcuda_dataflow_launch_enabled() &&
+         not __kitcuda_graph_launch_enabled() &&
+         (desc->pk_index < 0 || not __kitcuda_persistent_kernels_enabled());
+}
+
+// Return the stream for a launch, the calling thread's stream is used
+// when the given stream is null.
+CUstream get_launch_stream(void *opaque_stream) {
+  if (opaque_stream == nullptr) {
+    // create a stream for this launch...
+    if (__kitrt_verbose_mode())
+      fprintf(stderr,
+              "kitcuda: launch stream is null, requested a new stream.\n");
+    return (CUstream)__kitcuda_get_thread_stream();
+  }
+  // use the provided stream for this launch...
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: launch stream is non-null.\n");
+  return (CUstream)opaque_stream;
+}
+
+} // namespace
+
+__thread KitCudaFastLaunch
+    __kitcuda_fast_launches[KITCUDA_FAST_LAUNCH_ENTRIES];
+
+uint64_t __kitcuda_launch_epoch = 1;
+
+void *__kitcuda_launch_kernel_slow(const void *fat_bin,
+                                   const char *kernel_name, void **kern_args,
+                                   uint64_t trip_count, int threads_per_blk,
+                                   const KitRTInstMix *inst_mix,
+                                   void *opaque_stream, uint32_t iv_size,
+                                   void **launch_handle) {
   assert(fat_bin && "kitcuda: launch with null fat binary!");
   assert(kernel_name && "kitcuda: launch with null name!");
   assert(kern_args && "kitcuda: launch with null args!");
   assert(trip_count != 0 && "kitcuda: launch with zero trips!");
 
   KIT_NVTX_PUSH("kitcuda:launch_kernel", KIT_NVTX_LAUNCH);
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, kernel_name);
+  if (inst_mix)
+    profile.set_source_loc(inst_mix->source_loc);
+  set_thread_context();
 
-  // Multiple threads can launch kernels in our current design.  If a
-  // thread enters without having previously set the context the CUDA
-  // runtime becomes unhappy with us.  Make sure we're following the
-  // rules.
-  CUcontext ctx;
-  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
-  if (ctx == NULL)
-    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+  KitCudaLaunchDesc *desc =
+      _kitcuda_get_launch_desc(launch_handle, fat_bin, kernel_name);
 
-  CUfunction cu_func;
-  _kitcuda_module_map_mutex.lock();
-  KitCudaKernelMap::iterator kernit = _kitcuda_kernel_map.find(kernel_name);
-  if (kernit == _kitcuda_kernel_map.end()) {
-    // We have not yet encountered this kernel function...  Check to see
-    // if we already have a supporting module for the fat binary.
-    CUmodule cu_module;
-    KitCudaModuleMap::iterator modit = _kitcuda_module_map.find(fat_bin);
-    if (modit == _kitcuda_module_map.end()) {
-      // Create a supporting CUDA module and "register" the fat binary
-      // image in the map...
-      CU_SAFE_CALL(cuModuleLoadData_p(&cu_module, fat_bin));
-      _kitcuda_module_map[fat_bin] = cu_module;
-    } else
-      cu_module = modit->second;
+  // The trip count is the end of the iteration space.  When the kernel
+  // arguments describe the start we only launch the threads needed to
+  // cover [start, end) and can split that range across devices.
+  uint64_t start = 0;
+  if (iv_size != 0)
+    start = std::min(__kitcuda_read_iv_arg(kern_args[1], iv_size), trip_count);
+  uint64_t work = trip_count - start;
 
-    // Look up the kernel function.
-    CU_SAFE_CALL(cuModuleGetFunction_p(&cu_func, cu_module, kernel_name));
-    _kitcuda_kernel_map[kernel_name] = cu_func;
-  } else
-    cu_func = kernit->second;
+  // The epoch is read before the settings that make a launch plain, so
+  // an entry recorded below is discarded if they change meanwhile.
+  uint64_t epoch = __atomic_load_n(&__kitcuda_launch_epoch, __ATOMIC_ACQUIRE);
+  bool plain = is_plain_launch(desc);
+  int requested_threads_per_blk = threads_per_blk;
 
-  _kitcuda_module_map_mutex.unlock();
+  int num_slices = 1;
+  int num_devices = __kitcuda_get_num_devices();
+  // Kernels that reduce into their arguments combine per-block results
+  // with device-scope atomics and must stay on a single device.  So do
+  // kernels that have their trip count folded in.
+  bool reduces = inst_mix && (inst_mix->flags & KITRT_KERNEL_REDUCTION);
+  bool fixed = inst_mix && (inst_mix->flags & KITRT_KERNEL_FIXED_TRIP_COUNT);
+  if (iv_size != 0 && num_devices > 1 && not reduces && not fixed) {
+    uint64_t max_slices = work / _kitcuda_multi_device_min_trips;
+    num_slices = max_slices < (uint64_t)num_devices ? (int)max_slices
+                                                    : num_devices;
+    if (num_slices < 1)
+      num_slices = 1;
+  }
+  uint64_t slice_work = (work + num_slices - 1) / num_slices;
+
+  if (work == 0) {
+    __kitcuda_dataflow_discard();
+    profile.cancel();
+    KIT_NVTX_POP();
+    return opaque_stream;
+  }
+
+  // Small launches of the kernels a persistent worker can run become
+  // pushes onto the worker's queue (see persistent.cpp).  Everything
+  // else must follow the pushed launches.
+  if (desc->pk_index >= 0 && __kitcuda_persistent_kernels_enabled() &&
+      work <= __kitcuda_get_persistent_max_trips() && threads_per_blk == 0 &&
+      not _kitcuda_autotune && not reduces && not __kitrt_profile_enabled() &&
+      __kitcuda_get_out_of_core_budget() == 0) {
+    CUstream cu_stream = get_launch_stream(opaque_stream);
+    if (__kitcuda_persistent_launch(cu_stream, fat_bin, desc->pk_index,
+                                    kern_args)) {
+      profile.cancel();
+      KIT_NVTX_POP();
+      return (void *)cu_stream;
+    }
+  }
+  __kitcuda_persistent_join();
 
   int blks_per_grid;
+  KitCudaTuneState *tune_state = nullptr;
+  if (threads_per_blk == 0 && _kitcuda_autotune && num_slices == 1)
+    tune_state =
+        _kitcuda_autotune_begin(desc, slice_work, inst_mix, threads_per_blk);
+
   if (threads_per_blk == 0)
-    __kitcuda_get_launch_params(trip_count, cu_func, threads_per_blk,
+    __kitcuda_get_launch_params(slice_work, desc, threads_per_blk,
                                 blks_per_grid, inst_mix);
-  else
-    blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
+  // The kernel's launch bounds (maxntid) can be tighter than the
+  // runtime's defaults or a previously saved tuning table.
+  if (threads_per_blk > desc->max_threads_per_blk)
+    threads_per_blk = desc->max_threads_per_blk;
+
+  unsigned shared_mem = get_shared_mem_bytes(desc, inst_mix, threads_per_blk);
+
+  // Grid-stride kernels can have each thread execute multiple
+  // iterations; the grid shrinks to match.
+  int iters_per_thread = get_iters_per_thread(desc, inst_mix, slice_work);
+  uint64_t iters_per_blk = (uint64_t)threads_per_blk * iters_per_thread;
+  blks_per_grid = (slice_work + iters_per_blk - 1) / iters_per_blk;
+  // A grid-stride kernel covers the iterations beyond a capped grid.
+  if (inst_mix && (inst_mix->flags & KITRT_KERNEL_GRID_STRIDE) &&
+      inst_mix->max_blocks_per_grid > 0 &&
+      (uint64_t)blks_per_grid > inst_mix->max_blocks_per_grid)
+    blks_per_grid = (int)inst_mix->max_blocks_per_grid;
 
   if (__kitrt_verbose_mode()) {
     fprintf(stderr, "kitcuda: kernel '%s' launch parameters:\n", kernel_name);
     fprintf(stderr, "  blocks: %d, 1, 1\n", blks_per_grid);
     fprintf(stderr, "  threads: %d, 1, 1\n", threads_per_blk);
-    fprintf(stderr, "  trip count: %ld\n\n", trip_count);
+    fprintf(stderr, "  iterations/thread: %d\n", iters_per_thread);
+    fprintf(stderr, "  shared memory: %u bytes\n", shared_mem);
+    fprintf(stderr, "  trip count: %ld\n", trip_count);
+    fprintf(stderr, "  devices: %d\n\n", num_slices);
   }
+  profile.set_geometry(blks_per_grid, 1, 1, threads_per_blk, 1, 1);
 
-  CUstream cu_stream = nullptr;
-  if (opaque_stream == nullptr) {
-    // create a stream for this launch...
-    cu_stream = (CUstream)__kitcuda_get_thread_stream();
-    if (__kitrt_verbose_mode())
-      fprintf(stderr,
-              "kitcuda: launch stream is null, requested a new stream.\n");
-  } else {
-    // use the provided stream for this launch...
-    cu_stream = (CUstream)opaque_stream;
-    if (__kitrt_verbose_mode())
-      fprintf(stderr, "kitcuda: launch stream is non-null.\n");
+  CUstream cu_stream = get_launch_stream(opaque_stream);
+
+  if (num_slices > 1) {
+    launch_slices(desc, kern_args, start, trip_count, num_slices,
+                  threads_per_blk, iters_per_thread, shared_mem, cu_stream);
+    KIT_NVTX_POP();
+    return (void *)cu_stream;
+  }
+
+  // Stream the data of a launch that does not fit on the device (the
+  // same launches that can be split across devices can be chunked).
+  bool out_of_core = __kitcuda_get_out_of_core_budget() > 0;
+  if (out_of_core && iv_size != 0 && not reduces && not fixed &&
+      tune_state == nullptr) {
+    uint64_t data_bytes = __kitcuda_mem_pending_bytes(cu_stream);
+    if (data_bytes > __kitcuda_get_out_of_core_budget()) {
+      launch_out_of_core(desc, kern_args, start, trip_count, data_bytes,
+                         threads_per_blk, iters_per_thread, shared_mem,
+                         cu_stream);
+      KIT_NVTX_POP();
+      return (void *)cu_stream;
+    }
   }
 
-  CU_SAFE_CALL(cuLaunchKernel_p(cu_func, blks_per_grid, 1, 1,
+  if (num_devices > 1 || out_of_core) {
+    // Issue any prefetches deferred for a multi-device launch.
+    uint64_t bounds[2] = {start, trip_count};
+    void *streams[1] = {(void *)cu_stream};
+    __kitcuda_mem_gpu_prefetch_slices(cu_stream, 1, bounds, streams);
+  }
+
+  // Dataflow launches run on a worker stream of the region's stream
+  // and only wait on the launches they depend on (see dataflow.cpp).
+  // Timed launches are ordered after all prior launches.
+  CUstream launch_stream = cu_stream;
+  if (__kitcuda_dataflow_launch_enabled())
+    launch_stream = (CUstream)__kitcuda_dataflow_begin(cu_stream,
+                                                       tune_state != nullptr);
+  // Graph launches defer the kernel until the stream is synchronized
+  // (see graphs.cpp).  Timed launches must run eagerly.
+  else if (tune_state == nullptr && num_devices == 1 &&
+           __kitcuda_graph_launch(cu_stream, desc->funcs[0], blks_per_grid,
+                                  threads_per_blk, shared_mem, kern_args)) {
+    KIT_NVTX_POP();
+    return (void *)cu_stream;
+  }
+
+  if (plain && tune_state == nullptr)
+    *__kitcuda_get_fast_launch(desc) = {desc, desc->funcs[0], inst_mix, work,
+                                        epoch, requested_threads_per_blk,
+                                        blks_per_grid, threads_per_blk,
+                                        shared_mem};
+
+  if (tune_state)
+    CU_SAFE_CALL(cuEventRecord_p(tune_state->start, launch_stream));
+  profile.record_start(&_kitcuda_profile_ops, launch_stream);
+  CU_SAFE_CALL(cuLaunchKernel_p(desc->funcs[0], blks_per_grid, 1, 1,
 				threads_per_blk, 1, 1,
+                                shared_mem, // dynamic shared mem size
+                                launch_stream, kern_args, NULL));
+  profile.record_end(launch_stream);
+  if (tune_state)
+    _kitcuda_autotune_end(tune_state, launch_stream);
+  __kitcuda_dataflow_end(cu_stream, launch_stream);
+  KIT_NVTX_POP();
+  return (void *)cu_stream;
+}
+
+namespace {
+
+// The largest grid extent in the y and z dimensions.
+const uint64_t KITCUDA_MAX_GRID_YZ = 65535;
+
+// Pick the block shape for a multi-dimensional launch with (up to) the
+// given number of threads.  Each block is a tile of the iteration
+// space: x spans (up to) a warp of consecutive iterations, so accesses
+// along a row stay coalesced, and the rest of the block is spread over
+// the outer dimensions for locality between neighboring rows (and
+// planes).  Any remaining threads widen the rows.
+void get_block_shape(int threads_per_blk, int warp_size, unsigned num_dims,
+                     const uint64_t *extents, unsigned *shape) {
+  unsigned max_threads = 1;
+  while (max_threads * 2 <= (unsigned)threads_per_blk)
+    max_threads *= 2;
+
+  shape[0] = shape[1] = shape[2] = 1;
+  while (shape[0] < (unsigned)warp_size && shape[0] < max_threads &&
+         shape[0] < extents[0])
+    shape[0] *= 2;
+
+  unsigned threads = shape[0];
+  bool grew = true;
+  while (grew) {
+    grew = false;
+    for (unsigned d = 1; d < num_dims; d++) {
+      // Blocks are limited to 64 threads in z.
+      unsigned max_dim = d == 2 ? 64 : 1024;
+      if (threads * 2 <= max_threads && shape[d] < extents[d] &&
+          shape[d] < max_dim) {
+        shape[d] *= 2;
+        threads *= 2;
+        grew = true;
+      }
+    }
+  }
+  while (threads * 2 <= max_threads && shape[0] < extents[0]) {
+    shape[0] *= 2;
+    threads *= 2;
+  }
+}
+
+} // namespace
+
+void *__kitcuda_launch_kernel_nd(const void *fat_bin, const char *kernel_name,
+                                 void **kern_args, uint64_t trip_count,
+                                 int threads_per_blk,
+                                 const KitRTInstMix *inst_mix,
+                                 void *opaque_stream, uint32_t iv_size,
+                                 void **launch_handle, uint32_t num_dims,
+                                 const uint64_t *inner_extents) {
+  assert(fat_bin && "kitcuda: launch with null fat binary!");
+  assert(kernel_name && "kitcuda: launch with null name!");
+  assert(kern_args && "kitcuda: launch with null args!");
+  assert(trip_count != 0 && "kitcuda: launch with zero trips!");
+  assert(num_dims >= 2 && num_dims <= 3 &&
+         "kitcuda: unsupported launch dimensions!");
+
+  KIT_NVTX_PUSH("kitcuda:launch_kernel_nd", KIT_NVTX_LAUNCH);
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, kernel_name);
+  if (inst_mix)
+    profile.set_source_loc(inst_mix->source_loc);
+  set_thread_context();
+
+  KitCudaLaunchDesc *desc =
+      _kitcuda_get_launch_desc(launch_handle, fat_bin, kernel_name);
+  __kitcuda_persistent_join();
+
+  // The outermost dimension covers the rest of the iteration space.
+  uint64_t extents[3] = {1, 1, 1};
+  uint64_t inner_size = 1;
+  for (unsigned d = 0; d < num_dims - 1; d++) {
+    extents[d] = inner_extents[d];
+    inner_size *= extents[d];
+  }
+  uint64_t start = 0;
+  if (iv_size != 0)
+    start = __kitcuda_read_iv_arg(kern_args[1], iv_size);
+  if (inner_size == 0 || start >= trip_count) {
+    __kitcuda_dataflow_discard();
+    profile.cancel();
+    KIT_NVTX_POP();
+    return opaque_stream;
+  }
+  extents[num_dims - 1] = (trip_count + inner_size - 1) / inner_size;
+
+  if (threads_per_blk == 0) {
+    int blks_per_grid;
+    __kitcuda_get_launch_params(trip_count, desc, threads_per_blk,
+                                blks_per_grid, inst_mix);
+  }
+  if (threads_per_blk > desc->max_threads_per_blk)
+    threads_per_blk = desc->max_threads_per_blk;
+
+  unsigned blk[3];
+  get_block_shape(threads_per_blk, desc->warp_size, num_dims, extents, blk);
+  uint64_t grid[3] = {1, 1, 1};
+  for (unsigned d = 0; d < num_dims; d++)
+    grid[d] = (extents[d] + blk[d] - 1) / blk[d];
+  // The rows of a 2D launch that do not fit in the grid's y dimension
+  // are placed in z (the kernel folds z into its row).
+  if (num_dims == 2 && grid[1] > KITCUDA_MAX_GRID_YZ) {
+    grid[2] = (grid[1] + KITCUDA_MAX_GRID_YZ - 1) / KITCUDA_MAX_GRID_YZ;
+    grid[1] = (grid[1] + grid[2] - 1) / grid[2];
+  }
+  if (grid[0] > INT_MAX || grid[1] > KITCUDA_MAX_GRID_YZ ||
+      grid[2] > KITCUDA_MAX_GRID_YZ) {
+    fprintf(stderr,
+            "kitcuda: launch of kernel '%s' exceeds the grid limits "
+            "(extents: %ld, %ld, %ld).\n",
+            kernel_name, extents[0], extents[1], extents[2]);
+    abort();
+  }
+
+  if (__kitrt_verbose_mode()) {
+    fprintf(stderr, "kitcuda: kernel '%s' launch parameters:\n", kernel_name);
+    fprintf(stderr, "  blocks: %ld, %ld, %ld\n", grid[0], grid[1], grid[2]);
+    fprintf(stderr, "  threads: %d, %d, %d\n", blk[0], blk[1], blk[2]);
+    fprintf(stderr, "  extents: %ld, %ld, %ld\n", extents[0], extents[1],
+            extents[2]);
+    fprintf(stderr, "  trip count: %ld\n\n", trip_count);
+  }
+  profile.set_geometry(grid[0], grid[1], grid[2], blk[0], blk[1], blk[2]);
+
+  CUstream cu_stream = get_launch_stream(opaque_stream);
+  if (__kitcuda_get_num_devices() > 1 ||
+      __kitcuda_get_out_of_core_budget() > 0) {
+    // Issue any prefetches deferred for a multi-device launch.
+    uint64_t bounds[2] = {start, trip_count};
+    void *streams[1] = {(void *)cu_stream};
+    __kitcuda_mem_gpu_prefetch_slices(cu_stream, 1, bounds, streams);
+  }
+
+  CUstream launch_stream =
+      (CUstream)__kitcuda_dataflow_begin(cu_stream, false);
+  profile.record_start(&_kitcuda_profile_ops, launch_stream);
+  CU_SAFE_CALL(cuLaunchKernel_p(desc->funcs[0], grid[0], grid[1], grid[2],
+                                blk[0], blk[1], blk[2],
                                 0, // shared mem size
-                                cu_stream, kern_args, NULL));
+                                launch_stream, kern_args, NULL));
+  profile.record_end(launch_stream);
+  __kitcuda_dataflow_end(cu_stream, launch_stream);
+  KIT_NVTX_POP();
+  return (void *)cu_stream;
+}
+
+namespace {
+
+// Order a memcpy or memset that replaces a kernel launch like the
+// launch itself: it follows the launches pushed to a persistent worker
+// or deferred to a graph and issues any prefetches deferred for a
+// multi-device launch.  Returns the stream to issue the operation on.
+CUstream begin_copy_launch(CUstream cu_stream, uint64_t start,
+                           uint64_t end) {
+  __kitcuda_persistent_join();
+  __kitcuda_graph_flush(cu_stream);
+  if (__kitcuda_get_num_devices() > 1 ||
+      __kitcuda_get_out_of_core_budget() > 0) {
+    uint64_t bounds[2] = {start, end};
+    void *streams[1] = {(void *)cu_stream};
+    __kitcuda_mem_gpu_prefetch_slices(cu_stream, 1, bounds, streams);
+  }
+  return (CUstream)__kitcuda_dataflow_begin(cu_stream, false);
+}
+
+} // namespace
+
+void *__kitcuda_launch_memcpy(void *dst, const void *src, uint64_t start,
+                              uint64_t end, uint32_t elt_size,
+                              void *opaque_stream) {
+  assert(dst && src && "kitcuda: memcpy with null pointer!");
+  start = std::min(start, end);
+  if (start == end || dst == src) {
+    __kitcuda_dataflow_discard();
+    return opaque_stream;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:launch_memcpy", KIT_NVTX_LAUNCH);
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, "memcpy");
+  set_thread_context();
+  size_t nbytes = (end - start) * elt_size;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: memcpy of %ld bytes (%p -> %p).\n", nbytes,
+            src, dst);
+  CUstream cu_stream = get_launch_stream(opaque_stream);
+  CUstream launch_stream = begin_copy_launch(cu_stream, start, end);
+  profile.record_start(&_kitcuda_profile_ops, launch_stream);
+  CU_SAFE_CALL(cuMemcpyAsync_p((CUdeviceptr)dst + start * elt_size,
+                               (CUdeviceptr)src + start * elt_size, nbytes,
+                               launch_stream));
+  profile.record_end(launch_stream);
+  __kitcuda_dataflow_end(cu_stream, launch_stream);
   KIT_NVTX_POP();
   return (void *)cu_stream;
 }
 
+void *__kitcuda_launch_memset(void *dst, uint32_t value, uint64_t start,
+                              uint64_t end, uint32_t elt_size,
+                              void *opaque_stream) {
+  assert(dst && "kitcuda: memset with null pointer!");
+  start = std::min(start, end);
+  if (start == end) {
+    __kitcuda_dataflow_discard();
+    return opaque_stream;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:launch_memset", KIT_NVTX_LAUNCH);
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, "memset");
+  set_thread_context();
+  size_t count = end - start;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: memset of %ld %d-byte elements at %p.\n",
+            count, elt_size, dst);
+  CUstream cu_stream = get_launch_stream(opaque_stream);
+  CUstream launch_stream = begin_copy_launch(cu_stream, start, end);
+  profile.record_start(&_kitcuda_profile_ops, launch_stream);
+  CUdeviceptr ptr = (CUdeviceptr)dst + start * elt_size;
+  switch (elt_size) {
+  case 1:
+    CU_SAFE_CALL(cuMemsetD8Async_p(ptr, (unsigned char)value, count,
+                                   launch_stream));
+    break;
+  case 2:
+    CU_SAFE_CALL(cuMemsetD16Async_p(ptr, (unsigned short)value, count,
+                                    launch_stream));
+    break;
+  case 4:
+    CU_SAFE_CALL(cuMemsetD32Async_p(ptr, value, count, launch_stream));
+    break;
+  default:
+    fprintf(stderr, "kitcuda: unsupported memset element size %d!\n",
+            elt_size);
+    abort();
+  }
+  profile.record_end(launch_stream);
+  __kitcuda_dataflow_end(cu_stream, launch_stream);
+  KIT_NVTX_POP();
+  return (void *)cu_stream;
+}
+
+void *__kitcuda_launch_gemm(void *c, const void *a, const void *b,
+                            uint64_t start, uint64_t end, uint64_t n,
+                            uint64_t k, uint32_t elt_size,
+                            void *opaque_stream) {
+  assert(c && a && b && "kitcuda: gemm with null pointer!");
+  if (start >= end) {
+    __kitcuda_dataflow_discard();
+    return opaque_stream;
+  }
+  // cuBLAS takes int dimensions.  The kernel handles everything else,
+  // including an empty sum (k == 0).
+  void *handle = nullptr;
+  if (start == 0 && n > 0 && k > 0 && end % n == 0 && end / n <= INT_MAX &&
+      n <= INT_MAX && k <= INT_MAX) {
+    set_thread_context();
+    handle = _kitcuda_blas_handle();
+  }
+  if (handle == nullptr) {
+    __kitcuda_dataflow_discard();
+    return nullptr;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:launch_gemm", KIT_NVTX_LAUNCH);
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, "gemm");
+  uint64_t m = end / n;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: gemm of %ld x %ld x %ld %d-byte elements.\n",
+            m, n, k, elt_size);
+  CUstream cu_stream = get_launch_stream(opaque_stream);
+  CUstream launch_stream = begin_copy_launch(cu_stream, start, end);
+  profile.record_start(&_kitcuda_profile_ops, launch_stream);
+  _kitcuda_blas_gemm_nt(handle, launch_stream, elt_size, m, n, k, a, b, c);
+  profile.record_end(launch_stream);
+  __kitcuda_dataflow_end(cu_stream, launch_stream);
+  KIT_NVTX_POP();
+  return (void *)cu_stream;
+}
+
+CUfunction __kitcuda_get_kernel(const void *fat_bin, const char *kernel_name) {
+  return _kitcuda_get_launch_desc(nullptr, fat_bin, kernel_name)->funcs[0];
+}
+
 uint64_t __kitcuda_get_global_symbol(void *fat_bin, const char *sym_name) {
   assert(fat_bin && "null fat binary!");
   assert(sym_name && "null symbol name!");
@@ -412,14 +2066,8 @@ uint64_t __kitcuda_get_global_symbol(void *fat_bin, const char *sym_name) {
     CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
   CUmodule cu_module;
   _kitcuda_module_map_mutex.lock();
-  KitCudaModuleMap::iterator modit = _kitcuda_module_map.find(fat_bin);
-  if (modit == _kitcuda_module_map.end()) {
-    // Create a supporting CUDA module and "register" the fat binary
-    // image in the map...
-    CU_SAFE_CALL(cuModuleLoadData_p(&cu_module, fat_bin));
-    _kitcuda_module_map[fat_bin] = cu_module;
-  } else
-    cu_module = modit->second;
+  cu_module = _kitcuda_get_module(0, fat_bin);
+  _kitcuda_module_map_mutex.unlock();
 
   // NOTE: The device pointer and size ('bytes') parameters for the
   // call to cuModuleGetGlobal are optional.  To simplify the compiler's
@@ -52,6 +52,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm-cuda.h"
+#include "../kitcuda.h"
 #include "llvm/ADT/APInt.h"
 #include <cstdio>
 #include <cstdlib>
@@ -83,8 +84,11 @@
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <nvPTXCompiler.h>
 
+#include <algorithm>
+#include <mutex>
 #include <sstream>
 #include <stdbool.h>
+#include <unordered_map>
 
 
 using namespace llvm;
@@ -102,6 +106,11 @@ static std::string cudafeatures = "+ptx64";
   } while (0)
 
 void *__kitrt_cuPTXtoELF(const char* ptx) {
+  size_t elfSize;
+  return __kitrt_cuPTXtoELFImage(ptx, &elfSize);
+}
+
+void *__kitrt_cuPTXtoELFImage(const char* ptx, size_t *imageSize) {
   nvPTXCompilerHandle compiler = NULL;
   nvPTXCompileResult status;
 
@@ -165,9 +174,57 @@ void *__kitrt_cuPTXtoELF(const char* ptx) {
   }
 
   NVPTXCOMPILER_SAFE_CALL(nvPTXCompilerDestroy(&compiler));
+  *imageSize = elfSize;
   return elf;
 }
 
+void *__kitrt_cuLaunchELFKernel(const void *elfImg, void **kernelArgs,
+                                size_t numElements) {
+  // The images come from the runtime's (never freed) JIT cache, so the
+  // kernel of each image is loaded once and found by its address.
+  static std::mutex kernelMutex;
+  static std::unordered_map<const void *, CUfunction> kernels;
+  CUfunction kernel;
+  {
+    std::lock_guard<std::mutex> lock(kernelMutex);
+    auto it = kernels.find(elfImg);
+    if (it == kernels.end()) {
+      CUmodule module;
+      if (cuModuleLoadData_p(&module, elfImg) != CUDA_SUCCESS ||
+          cuModuleGetFunction_p(&kernel, module, "kitsune_kernel") !=
+              CUDA_SUCCESS) {
+        fprintf(stderr, "kitrt: unable to load the kernel's ELF image.\n");
+        return nullptr;
+      }
+      kernels[elfImg] = kernel;
+    } else
+      kernel = it->second;
+  }
+
+  CUdevice device;
+  int threadsPerBlock;
+  cuDeviceGet_p(&device, 0);
+  cuDeviceGetAttribute_p(&threadsPerBlock,
+                         CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK, device);
+  threadsPerBlock = std::min(threadsPerBlock, 256);
+  unsigned blocksPerGrid =
+      (numElements + threadsPerBlock - 1) / threadsPerBlock;
+
+  // Launches use the runtime's recycled streams; the stream goes back
+  // to the pool when it is synchronized (see __kitrt_cuStreamSynchronize).
+  CUstream stream = (CUstream)__kitcuda_get_thread_stream();
+  if (cuLaunchKernel_p(kernel, blocksPerGrid, 1, 1, threadsPerBlock, 1, 1, 0,
+                       stream, kernelArgs, nullptr) != CUDA_SUCCESS) {
+    __kitcuda_recycle_thread_stream((void *)stream);
+    return nullptr;
+  }
+  return (void *)stream;
+}
+
+void __kitrt_cuStreamSynchronize(void *cu_stream) {
+  __kitcuda_sync_thread_stream(cu_stream);
+}
+
 std::string __kitrt_cuLLVMtoPTX(Module& m, CUdevice device) {
   //std::cout << "input module: " << std::endl;
   //m.print(llvm::errs(), nullptr);
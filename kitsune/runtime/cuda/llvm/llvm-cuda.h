@@ -131,7 +131,8 @@ extern "C" {
 
   /// Synchronize execution with the given CUDA stream
   /// object (typically a stream returned by one of the launch
-  /// calls above).
+  /// calls above).  Streams of ELF kernel launches come from
+  /// the runtime's stream pool and are returned to it here.
   void __kitrt_cuStreamSynchronize(void *cu_stream);
 
   /// Convert the given PTX source, pointed to by 'PTXBuffer'
@@ -140,6 +141,11 @@ extern "C" {
   /// success, otherwise null will be returned.
   void *__kitrt_cuPTXtoELF(const char *PTXBuffer);
 
+  /// Same as __kitrt_cuPTXtoELF() but also returns the size of
+  /// the ELF image (in bytes) in 'imageSize'.  The image is
+  /// allocated with malloc() and owned by the caller.
+  void *__kitrt_cuPTXtoELFImage(const char *PTXBuffer, size_t *imageSize);
+
   /// Create a CUDA module for the given fat binary.  This
   /// path is best used when global variables have to be
   /// tracked and copied between host and device.  Returns
@@ -0,0 +1,308 @@
+//===- logging.cpp - Kitsune runtime CUDA device-side logging  -----------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Calls to printf() within kernels are lowered by the compiler (see
+// -cuabi-device-log) to appending a record to a log buffer in pinned
+// host memory.  Each record holds a sequence number, the format
+// string's identifier, and the (up to KITCUDA_LOG_MAX_ARGS) arguments
+// of the call widened to 64 bits.  The format and string arguments are
+// not copied: each module registers a table of its constant strings
+// and the records refer to them by identifier.  The host formats the
+// records when a stream (or the context) is synchronized.
+//
+// The layout of the buffer must match the code the compiler generates
+// (see CudaLoop::lowerDevicePrintf()).  Kernels reserve a record by
+// atomically incrementing 'head' and only write it if the buffer has
+// room (with respect to 'tail') -- otherwise the record is dropped and
+// counted.  The sequence number is written last so the host can tell
+// that a record is complete.
+struct KitCudaLogRecord {
+  uint64_t seq;    // one plus the index of the record.
+  uint64_t format; // number of args (high 32 bits), format id (low 32 bits).
+  uint64_t args[KITCUDA_LOG_MAX_ARGS];
+};
+
+struct KitCudaLogBuffer {
+  uint64_t head;    // records reserved by kernels.
+  uint64_t tail;    // records consumed by the host.
+  uint64_t dropped; // records dropped because the buffer was full.
+  uint64_t mask;    // number of records (a power of two) minus one.
+  KitCudaLogRecord records[];
+};
+
+// Each module with logging has a device-side global that holds the
+// buffer's address and the identifier of its first string.
+struct KitCudaLogModuleInfo {
+  KitCudaLogBuffer *buffer;
+  uint64_t base;
+};
+
+struct KitCudaLogRegistration {
+  std::string sym_name;
+  uint64_t base;
+};
+
+static bool _kitcuda_log_enabled = true;
+static uint64_t _kitcuda_log_records = 1 << 16;
+static KitCudaLogBuffer *_kitcuda_log_buffer = nullptr;
+static std::vector<const char *> _kitcuda_log_strings;
+static std::unordered_map<const void *, KitCudaLogRegistration>
+    _kitcuda_log_modules;
+static std::mutex _kitcuda_log_mutex;
+
+// Append the given record, formatted, to the output.
+static void _kitcuda_log_format(std::string &out,
+                                const KitCudaLogRecord &rec) {
+  uint64_t fmt_id = rec.format & 0xffffffff;
+  unsigned num_args = rec.format >> 32;
+  if (fmt_id >= _kitcuda_log_strings.size()) {
+    out += "kitcuda: invalid device log record.\n";
+    return;
+  }
+  const char *fmt = _kitcuda_log_strings[fmt_id];
+  unsigned arg = 0;
+  auto next_arg = [&]() -> uint64_t {
+    return arg < num_args ? rec.args[arg++] : 0;
+  };
+
+  char buf[512];
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    }
+    if (p[1] == '%') {
+      out += '%';
+      p++;
+      continue;
+    }
+    // Collect the flags, width and precision of the conversion (with
+    // '*' replaced by the argument), then its length and conversion.
+    std::string spec = "%";
+    for (p++; *p && strchr("-+ #0123456789.*", *p); p++) {
+      if (*p == '*')
+        spec += std::to_string((int)next_arg());
+      else
+        spec += *p;
+    }
+    std::string length;
+    for (; *p && strchr("hljztL", *p); p++)
+      length += *p;
+    if (*p == '\0')
+      break;
+    bool is_64bit = length == "l" || length == "ll" || length == "j" ||
+                    length == "z" || length == "t";
+    uint64_t value = next_arg();
+    switch (*p) {
+    case 'd':
+    case 'i': {
+      int64_t v = is_64bit ? (int64_t)value : (int64_t)(int32_t)value;
+      if (length == "h")
+        v = (short)v;
+      else if (length == "hh")
+        v = (signed char)v;
+      snprintf(buf, sizeof(buf), (spec + "ll" + *p).c_str(), (long long)v);
+      break;
+    }
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X': {
+      uint64_t v = is_64bit ? value : (uint32_t)value;
+      if (length == "h")
+        v = (unsigned short)v;
+      else if (length == "hh")
+        v = (unsigned char)v;
+      snprintf(buf, sizeof(buf), (spec + "ll" + *p).c_str(),
+               (unsigned long long)v);
+      break;
+    }
+    case 'c':
+      snprintf(buf, sizeof(buf), (spec + 'c').c_str(), (int)value);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+      double v;
+      memcpy(&v, &value, sizeof(v));
+      snprintf(buf, sizeof(buf), (spec + *p).c_str(), v);
+      break;
+    }
+    case 's':
+      // Only constant strings are available to the host.
+      snprintf(buf, sizeof(buf), (spec + 's').c_str(),
+               value < _kitcuda_log_strings.size() ? _kitcuda_log_strings[value]
+                                                   : "(device string)");
+      break;
+    case 'p':
+      snprintf(buf, sizeof(buf), (spec + 'p').c_str(), (void *)value);
+      break;
+    default:
+      // Unsupported conversions (e.g., %n) are dropped.
+      buf[0] = '\0';
+      break;
+    }
+    out += buf;
+  }
+}
+
+extern "C" {
+
+void __kitcuda_enable_device_log(bool enable) {
+  _kitcuda_log_enabled = enable;
+}
+
+void __kitcuda_set_log_records(uint64_t num_records) {
+  // The record index is masked so the size must be a power of two.
+  uint64_t n = 1;
+  while (n < num_records)
+    n <<= 1;
+  _kitcuda_log_records = n;
+}
+
+void __kitcuda_register_log_strings(const void *fat_bin, const char *sym_name,
+                                    const char **strings, int count) {
+  assert(fat_bin && sym_name && "unexpected null log registration!");
+  std::lock_guard<std::mutex> lock(_kitcuda_log_mutex);
+  KitCudaLogRegistration &reg = _kitcuda_log_modules[fat_bin];
+  reg.sym_name = sym_name;
+  reg.base = _kitcuda_log_strings.size();
+  _kitcuda_log_strings.insert(_kitcuda_log_strings.end(), strings,
+                              strings + count);
+}
+
+void __kitcuda_log_attach_module(const void *fat_bin, CUmodule cu_module) {
+  std::lock_guard<std::mutex> lock(_kitcuda_log_mutex);
+  auto it = _kitcuda_log_modules.find(fat_bin);
+  if (it == _kitcuda_log_modules.end())
+    return;
+  // With logging disabled the module's buffer address stays null and
+  // its kernels skip the (lowered) printf calls.
+  if (!_kitcuda_log_enabled)
+    return;
+  if (_kitcuda_log_buffer == nullptr) {
+    // Portable and mapped so the kernels of every device (context) can
+    // write the buffer through its host address.
+    size_t size = sizeof(KitCudaLogBuffer) +
+                  _kitcuda_log_records * sizeof(KitCudaLogRecord);
+    void *vp;
+    CU_SAFE_CALL(cuMemHostAlloc_p(&vp, size,
+                                  CU_MEMHOSTALLOC_PORTABLE |
+                                      CU_MEMHOSTALLOC_DEVICEMAP));
+    memset(vp, 0, size);
+    _kitcuda_log_buffer = (KitCudaLogBuffer *)vp;
+    _kitcuda_log_buffer->mask = _kitcuda_log_records - 1;
+  }
+  CUdeviceptr sym_ptr;
+  size_t bytes;
+  if (cuModuleGetGlobal_v2_p(&sym_ptr, &bytes, cu_module,
+                             it->second.sym_name.c_str()) != CUDA_SUCCESS)
+    return;
+  KitCudaLogModuleInfo info = {_kitcuda_log_buffer, it->second.base};
+  assert(bytes == sizeof(info) && "unexpected device log global size!");
+  CU_SAFE_CALL(cuMemcpyHtoD_v2_p(sym_ptr, &info, sizeof(info)));
+}
+
+void __kitcuda_log_drain(bool quiescent) {
+  KitCudaLogBuffer *log = _kitcuda_log_buffer;
+  if (log == nullptr)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_log_mutex);
+  KIT_NVTX_PUSH("kitcuda:log_drain", KIT_NVTX_STREAM);
+  uint64_t head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = log->tail;
+  std::string out;
+  for (; tail < head; tail++) {
+    const KitCudaLogRecord &rec = log->records[tail & log->mask];
+    if (__atomic_load_n(&rec.seq, __ATOMIC_ACQUIRE) != tail + 1) {
+      // The record is either still being written by a kernel on
+      // another stream or it was dropped (by a kernel that saw an
+      // earlier tail).  Only the latter is possible when all work is
+      // complete.
+      if (!quiescent)
+        break;
+      continue;
+    }
+    _kitcuda_log_format(out, rec);
+  }
+  __atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+  if (!out.empty()) {
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+  }
+  uint64_t dropped = __atomic_exchange_n(&log->dropped, 0, __ATOMIC_ACQ_REL);
+  if (dropped)
+    fprintf(stderr, "kitcuda: %llu device log record(s) dropped "
+            "(see KITCUDA_LOG_RECORDS).\n", (unsigned long long)dropped);
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_destroy_log() {
+  if (_kitcuda_log_buffer == nullptr)
+    return;
+  __kitcuda_log_drain(true);
+  CU_SAFE_CALL(cuMemFreeHost_p(_kitcuda_log_buffer));
+  _kitcuda_log_buffer = nullptr;
+}
+
+} // extern "C"
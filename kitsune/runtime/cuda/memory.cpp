@@ -50,25 +50,26 @@
 
 #include "kitcuda.h"
 #include "kitcuda_dylib.h"
+#include "mem_pool.h"
 #include "memory_map.h"
+#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
-static std::mutex _kitcuda_mem_alloc_mutex;
-
-extern "C" {
-
-__attribute__((malloc)) void *__kitcuda_mem_alloc_managed(size_t size) {
-  KIT_NVTX_PUSH("kitcuda:mem_alloc_managed",KIT_NVTX_MEM);
-
-  extern bool _kitcuda_initialized;
-  if (not _kitcuda_initialized)
-    __kitcuda_initialize();
-
-  CUcontext curctx;
-  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
-  if (curctx == NULL)
-    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+// Allocations are served from a size-class caching pool (see
+// mem_pool.h) when enabled.  This avoids the driver allocation, advice
+// and attribute calls below for each allocation and instead makes them
+// once per slab of managed memory.
+static KitRTMemPool *_kitcuda_mem_pool = nullptr;
 
+static void *_kitcuda_mem_alloc_slab(size_t size) {
   CUdeviceptr devp;
   CU_SAFE_CALL(cuMemAllocManaged_p(&devp, size, CU_MEM_ATTACH_GLOBAL));
 
@@ -79,104 +80,876 @@ __attribute__((malloc)) void *__kitcuda_mem_alloc_managed(size_t size) {
   // misleading (technically we are not prefetched to either host nor device).
   CU_SAFE_CALL(cuMemAdvise_p(devp, size, CU_MEM_ADVISE_SET_ACCESSED_BY,
                              _kitcuda_device));
-  CU_SAFE_CALL(cuMemAdvise_p(devp, size, CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
-                             _kitcuda_device));
+  // Slabs beyond the device memory budget prefer the host, so that
+  // only the pages launches touch migrate to the device (and can be
+  // evicted again) rather than the whole slab staying resident.
+  if (__kitcuda_mem_budget_place((void *)devp, size))
+    CU_SAFE_CALL(cuMemAdvise_p(devp, size,
+                               CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                               _kitcuda_device));
+  else
+    CU_SAFE_CALL(cuMemAdvise_p(devp, size,
+                               CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                               CU_DEVICE_CPU));
 
   int enable = 1;
   CU_SAFE_CALL(
       cuPointerSetAttribute_p(&enable, CU_POINTER_ATTRIBUTE_SYNC_MEMOPS, devp));
+  return (void *)devp;
+}
+
+// Blocks freed to the managed memory pool may still be in use by
+// kernels in flight on any stream.  The pool reuses them only once the
+// work in flight at the time of the free has completed (see
+// __kitrt_mem_pool_set_fence()).  The fence holds an event recorded
+// on each of the streams that were busy at the time (null if none
+// were) and the count of context synchronizations so far; a later
+// synchronization completes the fence without querying its events.
+struct KitCudaMemFence {
+  uint64_t context_syncs;
+  std::vector<CUevent> events;
+};
+static std::atomic<uint64_t> _kitcuda_context_syncs(0);
+
+static void *_kitcuda_mem_record_fence() {
+  // Items pushed to the persistent worker never complete its stream.
+  __kitcuda_persistent_join();
+  KitCudaMemFence *fence = new KitCudaMemFence;
+  fence->context_syncs =
+      _kitcuda_context_syncs.load(std::memory_order_acquire);
+  _kitcuda_record_busy_stream_events(fence->events);
+  if (fence->events.empty()) {
+    delete fence;
+    return nullptr;
+  }
+  return fence;
+}
+
+static bool _kitcuda_mem_fence_done(void *opaque_fence, bool wait) {
+  KitCudaMemFence *fence = (KitCudaMemFence *)opaque_fence;
+  if (fence == nullptr)
+    return true;
+  if (_kitcuda_context_syncs.load(std::memory_order_acquire) <=
+      fence->context_syncs) {
+    for (CUevent event : fence->events) {
+      if (wait) {
+        CU_SAFE_CALL(cuEventSynchronize_p(event));
+        continue;
+      }
+      CUresult status = cuEventQuery_p(event);
+      if (status == CUDA_ERROR_NOT_READY)
+        return false;
+      CU_SAFE_CALL(status);
+    }
+  }
+  for (CUevent event : fence->events)
+    CU_SAFE_CALL(cuEventDestroy_v2_p(event));
+  delete fence;
+  return true;
+}
+
+static void _kitcuda_mem_free_slab(void *vp) {
+  __kitcuda_mem_budget_release(vp);
+  CU_SAFE_CALL(cuMemFree_v2_p((CUdeviceptr)vp));
+}
+
+// Page-locked host buffers for explicit transfers (see
+// __kitcuda_mem_alloc_pinned()) come from a second pool.  They are
+// portable and mapped so the kernels of every device can also access
+// them directly.  Pinned buffers are not registered in the memory map
+// -- kernels that use them read and write host memory in place.
+static KitRTMemPool *_kitcuda_pinned_pool = nullptr;
+
+static void *_kitcuda_mem_alloc_pinned_slab(size_t size) {
+  void *vp;
+  CU_SAFE_CALL(cuMemHostAlloc_p(&vp, size,
+                                CU_MEMHOSTALLOC_PORTABLE |
+                                    CU_MEMHOSTALLOC_DEVICEMAP));
+  return vp;
+}
+
+static void _kitcuda_mem_free_pinned_slab(void *vp) {
+  CU_SAFE_CALL(cuMemFreeHost_p(vp));
+}
+
+// Pinned buffers freed behind work on a stream are returned for reuse
+// once the event recorded at the time of the free has completed.
+// Events are recycled.
+struct KitCudaPinnedFree {
+  void *ptr;
+  CUevent event;
+};
+static std::mutex _kitcuda_pinned_mutex;
+static std::vector<KitCudaPinnedFree> _kitcuda_pinned_frees;
+static std::vector<CUevent> _kitcuda_pinned_events;
+
+static void _kitcuda_mem_release_pinned(void *vp) {
+  if (not __kitrt_mem_pool_free(_kitcuda_pinned_pool, vp))
+    CU_SAFE_CALL(cuMemFreeHost_p(vp));
+}
+
+// Release the buffers whose deferred frees have completed; all of them
+// when 'wait' is set.  The caller must hold the pinned mutex.
+static void _kitcuda_mem_reclaim_pinned(bool wait) {
+  size_t kept = 0;
+  for (KitCudaPinnedFree &pending : _kitcuda_pinned_frees) {
+    if (wait)
+      CU_SAFE_CALL(cuEventSynchronize_p(pending.event));
+    else {
+      CUresult status = cuEventQuery_p(pending.event);
+      if (status == CUDA_ERROR_NOT_READY) {
+        _kitcuda_pinned_frees[kept++] = pending;
+        continue;
+      }
+      CU_SAFE_CALL(status);
+    }
+    _kitcuda_mem_release_pinned(pending.ptr);
+    _kitcuda_pinned_events.push_back(pending.event);
+  }
+  _kitcuda_pinned_frees.resize(kept);
+}
+
+// When enabled, allocations are made as a pinned host-side buffer with
+// a separate device-side mirror (vs. managed memory).  The mirror is
+// tracked in the runtime's memory map and the 'prefetched' status of
+// the allocation flags that the device copy is current.
+static bool _kitcuda_device_resident = false;
+
+// When enabled, host prefetch requests leave managed data on the
+// device (see __kitcuda_use_lazy_host_prefetch()).
+static bool _kitcuda_lazy_host_prefetch = false;
+
+// When enabled, the program reports its host writes to device-resident
+// data (see __kitcuda_use_explicit_host_writes()).
+static bool _kitcuda_explicit_host_writes = false;
+
+// The migration policy of managed allocations that were not given one
+// (see __kitcuda_set_migrate_policy()) and the number of times the data
+// of an allocation may move back to the host before the automatic
+// policy stops prefetching it.
+static int _kitcuda_migrate_policy = KITRT_MIGRATE_AUTO;
+static unsigned _kitcuda_migrate_round_trips = 4;
+
+// The device-resident allocations referenced by kernel launches on
+// each stream.  The flag notes if the allocation was written by a
+// kernel (and must be copied back to the host) when the stream is
+// synchronized.
+typedef std::unordered_map<void *, bool> KitCudaMirrorRefs;
+static std::unordered_map<CUstream, KitCudaMirrorRefs> _kitcuda_mirror_refs;
+static std::mutex _kitcuda_mirror_mutex;
+
+// Host writes to device-resident data are observed by write-protecting
+// the host-side buffers once their streams have been synchronized.
+// The first write to a buffer faults, marks it dirty and lifts the
+// protection.  Until then the device-side copy remains current and a
+// launch that uses the buffer has nothing to copy.  The fault handler
+// can only use async-signal-safe operations, so the protected buffers
+// are kept in a fixed-size table (beyond which buffers are simply
+// assumed to be dirty).  Tracking is opt-in (see
+// __kitcuda_track_host_writes()): the handler replaces the program's
+// and system calls that write to a protected buffer fail rather than
+// fault.  The host-side buffers own whole pages (see
+// __kitcuda_mem_alloc_managed()) so the protection never reaches
+// another buffer.
+struct KitCudaTrackedMirror {
+  std::atomic<char *> base;
+  size_t size;
+  std::atomic<bool> dirty;
+};
+static const unsigned KITCUDA_MAX_TRACKED_MIRRORS = 1024;
+static KitCudaTrackedMirror _kitcuda_tracked[KITCUDA_MAX_TRACKED_MIRRORS];
+static bool _kitcuda_track_host_writes = false;
+static bool _kitcuda_host_write_handler_installed = false;
+static struct sigaction _kitcuda_prev_segv_action;
+
+static void _kitcuda_host_write_handler(int sig, siginfo_t *info,
+                                        void *context) {
+  char *addr = (char *)info->si_addr;
+  for (KitCudaTrackedMirror &t : _kitcuda_tracked) {
+    char *base = t.base.load(std::memory_order_acquire);
+    if (base != nullptr && addr >= base && addr < base + t.size) {
+      t.dirty.store(true, std::memory_order_release);
+      if (mprotect(base, t.size, PROT_READ | PROT_WRITE) == 0)
+        return; // the write is retried.
+      break;
+    }
+  }
+
+  // Not a tracked buffer -- pass the fault on.  Restoring a default
+  // (or ignored) disposition and returning re-raises the fault.
+  const struct sigaction &prev = _kitcuda_prev_segv_action;
+  if ((prev.sa_flags & SA_SIGINFO) && prev.sa_sigaction != nullptr)
+    prev.sa_sigaction(sig, info, context);
+  else if (not(prev.sa_flags & SA_SIGINFO) && prev.sa_handler != SIG_DFL &&
+           prev.sa_handler != SIG_IGN)
+    prev.sa_handler(sig);
+  else {
+    struct sigaction dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    sigaction(SIGSEGV, &dfl, nullptr);
+  }
+}
+
+// Write-protect the host-side buffer of the device-resident allocation
+// at 'base'.  Returns false if the buffer can't be tracked, in which
+// case its device copy must be assumed to be out of date.  The caller
+// must hold the mirror mutex.
+static bool _kitcuda_mem_track_host_writes(void *base, size_t size) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  if (not _kitcuda_track_host_writes || size == 0 ||
+      ((uintptr_t)base & (page_size - 1)) != 0)
+    return false;
+  if (not _kitcuda_host_write_handler_installed) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = _kitcuda_host_write_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &_kitcuda_prev_segv_action) != 0)
+      return false;
+    _kitcuda_host_write_handler_installed = true;
+  }
+
+  KitCudaTrackedMirror *slot = nullptr;
+  for (KitCudaTrackedMirror &t : _kitcuda_tracked) {
+    char *tbase = t.base.load(std::memory_order_relaxed);
+    if (tbase == (char *)base)
+      return true; // already protected (and still clean).
+    if (tbase == nullptr && slot == nullptr)
+      slot = &t;
+  }
+  if (slot == nullptr)
+    return false;
+
+  // The protection covers whole pages; the allocation owns the tail of
+  // its last page (see __kitcuda_mem_alloc_managed()).
+  size_t nbytes = (size + page_size - 1) & ~(page_size - 1);
+  slot->size = nbytes;
+  slot->dirty.store(false, std::memory_order_relaxed);
+  slot->base.store((char *)base, std::memory_order_release);
+  if (mprotect(base, nbytes, PROT_READ) != 0) {
+    slot->base.store(nullptr, std::memory_order_release);
+    return false;
+  }
+  return true;
+}
+
+// Stop tracking host writes to the buffer at 'base' (if it is tracked)
+// and make it writable again.  Returns true if the host wrote to the
+// buffer while it was tracked.  The caller must hold the mirror mutex.
+static bool _kitcuda_mem_untrack_host_writes(void *base) {
+  for (KitCudaTrackedMirror &t : _kitcuda_tracked) {
+    if (t.base.load(std::memory_order_relaxed) != (char *)base)
+      continue;
+    // Lift the protection before releasing the slot so a write racing
+    // with us never faults on an untracked buffer.
+    if (not t.dirty.load(std::memory_order_acquire))
+      (void)mprotect(base, t.size, PROT_READ | PROT_WRITE);
+    t.base.store(nullptr, std::memory_order_release);
+    return t.dirty.load(std::memory_order_acquire);
+  }
+  return false;
+}
+
+static void _kitcuda_mem_flush_refs(CUstream stream,
+                                    const KitCudaMirrorRefs &refs) {
+  for (auto &ref : refs) {
+    if (not ref.second)
+      continue;
+    size_t size = 0;
+    void *mirror = __kitrt_get_mem_mirror(ref.first, nullptr, &size);
+    if (mirror == nullptr || size == 0)
+      continue; // freed while in flight...
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: copy device-resident data to host "
+              "[address=%p, size=%ld, stream=%p].\n", ref.first, size,
+              (void *)stream);
+    KitRTProfileScope profile(KITRT_PROFILE_TO_HOST, "copy");
+    profile.set_bytes(size);
+    profile.record_start(&_kitcuda_profile_ops, stream);
+    CU_SAFE_CALL(cuMemcpyDtoHAsync_v2_p(ref.first, (CUdeviceptr)mirror,
+                                        size, stream));
+    profile.record_end(stream);
+  }
+}
+
+// The managed allocations mapped for a pending kernel launch on each
+// stream when multiple devices are in use.  The prefetch requests are
+// deferred until the launch has partitioned its iteration space (see
+// __kitcuda_mem_gpu_prefetch_slices()).  Each allocation records the
+// access mode of the launch's argument(s).
+typedef std::unordered_map<void *, int> KitCudaPendingMaps;
+static std::unordered_map<CUstream, KitCudaPendingMaps> _kitcuda_pending_maps;
+static std::mutex _kitcuda_pending_mutex;
+
+// Out-of-core execution (see __kitcuda_set_out_of_core()).  Launches
+// whose managed data exceeds the budget stream it through the device
+// a chunk at a time with this many chunks in flight.  The mapped data
+// of every launch is recorded (as for multiple devices) when enabled.
+static uint64_t _kitcuda_out_of_core_budget = 0;
+static int _kitcuda_out_of_core_buffers = 3;
+
+// Device-side copies of host globals are packed by the compiler into a
+// block per module.  The runtime keeps a shadow of the values most
+// recently copied to the device so updates only copy what changed.
+struct KitCudaGlobalBlock {
+  CUdeviceptr dev_ptr;
+  char *shadow;
+  uint64_t size;
+};
+static std::mutex _kitcuda_globals_mutex;
+
+// Kernels that reduce into an argument (see the compiler's lowering of
+// reductions) combine their values in a small device-side cell rather
+// than the (typically stack allocated) host variable.  The cells on
+// each stream are copied back to their host variables when the stream
+// is synchronized.  Cells are carved out of device allocations and
+// recycled.
+struct KitCudaReduceRef {
+  CUdeviceptr cell;
+  void *host_ptr;
+  uint64_t size;
+};
+typedef std::vector<KitCudaReduceRef> KitCudaReduceRefs;
+static std::unordered_map<CUstream, KitCudaReduceRefs> _kitcuda_reduce_refs;
+static std::vector<CUdeviceptr> _kitcuda_reduce_cells;
+static std::vector<CUdeviceptr> _kitcuda_reduce_slabs;
+static std::mutex _kitcuda_reduce_mutex;
+// The number of outstanding cells across all streams.  Every stream
+// sync checks for reductions; the count keeps host threads that sync
+// their own streams concurrently off the mutex when there are none.
+static std::atomic<unsigned> _kitcuda_num_reduce_refs(0);
+static const uint64_t KITCUDA_REDUCE_CELL_SIZE = 16;
+static const unsigned KITCUDA_REDUCE_CELLS_PER_SLAB = 64;
+
+// Prefetch requests the compiler issues ahead of a launch (see
+// __kitcuda_mem_gpu_prefetch_async()) run on a small set of dedicated
+// streams so data migration overlaps with the host code leading up to
+// the launch.  An event is recorded behind each request; the launch's
+// stream waits on the events of its own arguments only.
+static const unsigned KITCUDA_MAX_PREFETCH_STREAMS = 8;
+static CUstream _kitcuda_prefetch_streams[KITCUDA_MAX_PREFETCH_STREAMS];
+static unsigned _kitcuda_next_prefetch_stream = 0;
+static std::unordered_map<void *, CUevent> _kitcuda_prefetch_events;
+static std::atomic<unsigned> _kitcuda_num_prefetch_events(0);
+static std::mutex _kitcuda_prefetch_mutex;
+
+// Make the given stream wait on an in-flight (early) prefetch of the
+// allocation that contains 'vp', if any.  A null stream is replaced
+// by a thread stream when there is something to wait on.
+static void _kitcuda_mem_wait_prefetch(void *vp, void **opaque_stream) {
+  if (_kitcuda_num_prefetch_events.load(std::memory_order_relaxed) == 0)
+    return;
+  size_t size = 0;
+  void *base = vp;
+  (void)__kitrt_get_mem_residency(vp, &size, &base);
+  if (size == 0)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_prefetch_mutex);
+  auto it = _kitcuda_prefetch_events.find(base);
+  if (it == _kitcuda_prefetch_events.end())
+    return;
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_thread_stream();
+  CU_SAFE_CALL(cuStreamWaitEvent_p((CUstream)*opaque_stream, it->second, 0));
+  // The event's resources are released once the prefetch completes.
+  CU_SAFE_CALL(cuEventDestroy_v2_p(it->second));
+  _kitcuda_prefetch_events.erase(it);
+  _kitcuda_num_prefetch_events.fetch_sub(1, std::memory_order_relaxed);
+  __kitrt_advance_mem_epoch();
+}
+
+// Move the ranges of a prefetched allocation that have since moved to
+// the host (see __kitrt_mark_mem_host_range()) back to the device on
+// the given stream.  A null stream is replaced by a thread stream when
+// there is something to move.
+static void _kitcuda_mem_prefetch_host_ranges(void *vp, void **opaque_stream) {
+  KitRTMemRanges ranges;
+  void *base = vp;
+  if (not __kitrt_take_mem_host_ranges(vp, ranges, &base))
+    return;
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_thread_stream();
+  CUstream stream = (CUstream)*opaque_stream;
+  for (auto &range : ranges) {
+    size_t nbytes = range.second - range.first;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: prefetch host range [address=%p, "
+              "size=%ld].\n", (char *)base + range.first, nbytes);
+    KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "prefetch");
+    profile.set_bytes(nbytes);
+    profile.record_start(&_kitcuda_profile_ops, stream);
+    CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base + range.first,
+                                      nbytes, _kitcuda_device, stream));
+    profile.record_end(stream);
+    __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, nbytes);
+  }
+}
+
+// Record an event behind the work just issued on the given stream for
+// the allocation at 'base'.  Kernel launches on other streams that use
+// the allocation wait on it (see _kitcuda_mem_wait_prefetch()).
+static void _kitcuda_mem_record_event(void *base, CUstream stream) {
+  // Launches that use the allocation now have an event to wait on.
+  __kitrt_advance_mem_epoch();
+  std::lock_guard<std::mutex> lock(_kitcuda_prefetch_mutex);
+  CUevent &event = _kitcuda_prefetch_events[base];
+  if (event == nullptr) {
+    CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DISABLE_TIMING));
+    _kitcuda_num_prefetch_events.fetch_add(1, std::memory_order_relaxed);
+  }
+  CU_SAFE_CALL(cuEventRecord_p(event, stream));
+}
+
+// Files mapped as read-only arrays (see __kitcuda_mem_map_file()).  The
+// host-side view is the file mapping itself.  A loader thread streams
+// the file to a device-side mirror in chunks through a pair of pinned
+// staging buffers, so reading the file overlaps both the copies and the
+// host code that runs until the first kernel uses the array.
+struct KitCudaFileMap {
+  size_t size;         // size of the file in bytes.
+  CUdeviceptr mirror;  // device-side copy of the file.
+  CUstream stream;     // stream the loader's copies are issued on.
+  std::thread loader;  // joined before the mirror is first used.
+};
+static std::unordered_map<void *, KitCudaFileMap *> _kitcuda_file_maps;
+static std::atomic<unsigned> _kitcuda_num_file_maps(0);
+static std::mutex _kitcuda_file_map_mutex;
+static const size_t KITCUDA_FILE_CHUNK_SIZE = 64ul << 20;
+
+static void _kitcuda_load_file(const char *host, KitCudaFileMap *map) {
+  CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+  size_t chunk = std::min(map->size, KITCUDA_FILE_CHUNK_SIZE);
+  void *staging[2];
+  CUevent copied[2];
+  for (unsigned i = 0; i < 2; i++) {
+    CU_SAFE_CALL(cuMemAllocHost_p(&staging[i], chunk));
+    CU_SAFE_CALL(cuEventCreate_p(&copied[i], CU_EVENT_DISABLE_TIMING));
+  }
+  unsigned i = 0;
+  for (size_t offset = 0; offset < map->size; offset += chunk, i ^= 1) {
+    size_t nbytes = std::min(chunk, map->size - offset);
+    // Reuse a staging buffer once its previous copy is done.
+    if (offset >= 2 * chunk)
+      CU_SAFE_CALL(cuEventSynchronize_p(copied[i]));
+    memcpy(staging[i], host + offset, nbytes);
+    CU_SAFE_CALL(cuMemcpyHtoDAsync_v2_p(map->mirror + offset, staging[i],
+                                        nbytes, map->stream));
+    CU_SAFE_CALL(cuEventRecord_p(copied[i], map->stream));
+  }
+  CU_SAFE_CALL(cuStreamSynchronize_p(map->stream));
+  for (unsigned i = 0; i < 2; i++) {
+    CU_SAFE_CALL(cuMemFreeHost_p(staging[i]));
+    CU_SAFE_CALL(cuEventDestroy_v2_p(copied[i]));
+  }
+}
+
+// Wait for the mirror of the file mapped at 'base' (if it is one) to
+// be loaded.
+static void _kitcuda_mem_wait_file(void *base) {
+  std::lock_guard<std::mutex> lock(_kitcuda_file_map_mutex);
+  auto it = _kitcuda_file_maps.find(base);
+  if (it != _kitcuda_file_maps.end() && it->second->loader.joinable())
+    it->second->loader.join();
+}
+
+extern "C" {
+
+void __kitcuda_create_mem_pool() {
+  assert(_kitcuda_mem_pool == nullptr && "memory pool already created!");
+  _kitcuda_mem_pool = __kitrt_create_mem_pool("kitcuda",
+                                              _kitcuda_mem_alloc_slab,
+                                              _kitcuda_mem_free_slab);
+  __kitrt_mem_pool_set_fence(_kitcuda_mem_pool, _kitcuda_mem_record_fence,
+                             _kitcuda_mem_fence_done);
+  _kitcuda_pinned_pool =
+      __kitrt_create_mem_pool("kitcuda-pinned", _kitcuda_mem_alloc_pinned_slab,
+                              _kitcuda_mem_free_pinned_slab);
+}
+
+void __kitcuda_mem_context_synced() {
+  _kitcuda_context_syncs.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void __kitcuda_destroy_mem_pool() {
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_pinned_mutex);
+    _kitcuda_mem_reclaim_pinned(true);
+    for (CUevent event : _kitcuda_pinned_events)
+      CU_SAFE_CALL(cuEventDestroy_v2_p(event));
+    _kitcuda_pinned_events.clear();
+  }
+  __kitrt_destroy_mem_pool(_kitcuda_pinned_pool);
+  _kitcuda_pinned_pool = nullptr;
+  __kitrt_destroy_mem_pool(_kitcuda_mem_pool);
+  _kitcuda_mem_pool = nullptr;
+}
+
+__attribute__((malloc)) void *__kitcuda_mem_alloc_pinned(size_t size) {
+  assert(size != 0 && "zero-valued size!");
+  KIT_NVTX_PUSH("kitcuda:mem_alloc_pinned", KIT_NVTX_MEM);
+  __kitcuda_ensure_initialized();
+
+  CUcontext curctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
+  if (curctx == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  // Give buffers whose deferred frees have completed back to the pool
+  // before asking it for more.
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_pinned_mutex);
+    if (not _kitcuda_pinned_frees.empty())
+      _kitcuda_mem_reclaim_pinned(false);
+  }
+  void *vp = __kitrt_mem_pool_alloc(_kitcuda_pinned_pool, size);
+  if (vp == nullptr)
+    vp = _kitcuda_mem_alloc_pinned_slab(size);
+  KIT_NVTX_POP();
+  return vp;
+}
+
+void __kitcuda_mem_free_pinned(void *vp, void *opaque_stream) {
+  if (vp == nullptr)
+    return;
+  KIT_NVTX_PUSH("kitcuda:mem_free_pinned", KIT_NVTX_MEM);
+  if (opaque_stream == nullptr) {
+    _kitcuda_mem_release_pinned(vp);
+    KIT_NVTX_POP();
+    return;
+  }
+
+  // Copies (or kernels) on the stream may still use the buffer.  Hold
+  // it back until the work issued so far has completed.
+  std::lock_guard<std::mutex> lock(_kitcuda_pinned_mutex);
+  CUevent event;
+  if (_kitcuda_pinned_events.empty())
+    CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DISABLE_TIMING));
+  else {
+    event = _kitcuda_pinned_events.back();
+    _kitcuda_pinned_events.pop_back();
+  }
+  CU_SAFE_CALL(cuEventRecord_p(event, (CUstream)opaque_stream));
+  _kitcuda_pinned_frees.push_back({vp, event});
+  KIT_NVTX_POP();
+}
+
+__attribute__((malloc)) void *__kitcuda_mem_alloc_device(size_t size) {
+  assert(size != 0 && "zero-valued size!");
+  KIT_NVTX_PUSH("kitcuda:mem_alloc_device", KIT_NVTX_MEM);
+  __kitcuda_ensure_initialized();
+
+  CUcontext curctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
+  if (curctx == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  CUdeviceptr devp;
+  CU_SAFE_CALL(cuMemAlloc_v2_p(&devp, size));
+  KIT_NVTX_POP();
+  return (void *)devp;
+}
+
+void __kitcuda_mem_free_device(void *vp) {
+  if (vp == nullptr)
+    return;
+  KIT_NVTX_PUSH("kitcuda:mem_free_device", KIT_NVTX_MEM);
+  __kitcuda_persistent_stop();
+  CU_SAFE_CALL(cuMemFree_v2_p((CUdeviceptr)vp));
+  KIT_NVTX_POP();
+}
+
+bool __kitcuda_mem_on_device(void *vp) {
+  // Memory that is not in the map (e.g., pinned buffers) lives on the
+  // host.  So does the pinned host-side buffer of a device-resident
+  // allocation once its stream has been synchronized.
+  size_t size = 0;
+  void *base = vp;
+  bool prefetched = __kitrt_is_mem_prefetched(vp, &size, &base);
+  if (size == 0 || __kitrt_get_mem_mirror(base) != nullptr)
+    return false;
+  return prefetched;
+}
+
+__attribute__((malloc)) void *__kitcuda_mem_alloc_managed(size_t size) {
+  KIT_NVTX_PUSH("kitcuda:mem_alloc_managed",KIT_NVTX_MEM);
+
+  __kitcuda_ensure_initialized();
+
+  CUcontext curctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
+  if (curctx == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  if (_kitcuda_device_resident) {
+    // Device-resident allocations are not pooled.  The host-side
+    // buffer is pinned so transfers run at full copy engine bandwidth.
+    // It owns whole pages (the driver packs small pinned allocations
+    // into shared pages) so that write-protecting it never covers
+    // another buffer.
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t host_size = (size + page_size - 1) & ~(page_size - 1);
+    void *vp;
+    CUdeviceptr devp;
+    if (posix_memalign(&vp, page_size, host_size) != 0) {
+      fprintf(stderr, "kitcuda: unable to allocate %ld bytes.\n",
+              (long)size);
+      abort();
+    }
+    CU_SAFE_CALL(cuMemHostRegister_v2_p(vp, host_size, 0));
+    CU_SAFE_CALL(cuMemAlloc_v2_p(&devp, size));
+    __kitrt_register_mem_alloc(vp, size, (void *)devp);
+    KIT_NVTX_POP();
+    return vp;
+  }
+
+  void *vp = __kitrt_mem_pool_alloc(_kitcuda_mem_pool, size);
+  if (vp == nullptr)
+    vp = _kitcuda_mem_alloc_slab(size);
 
   // Register this allocation so the runtime can help track the
   // locality (and affinity) of data.
-  _kitcuda_mem_alloc_mutex.lock();
-  __kitrt_register_mem_alloc((void *)devp, size);
-  _kitcuda_mem_alloc_mutex.unlock();
+  __kitrt_register_mem_alloc(vp, size);
 
   // NOTE: We can no longer do this in a thread-safe manner... 
   //CU_SAFE_CALL(cuMemPrefetchAsync_p(devp, size, _kitcuda_device,
   //                                  __kitcuda_get_thread_stream()));
   KIT_NVTX_POP();
-  return (void *)devp;
+  return vp;
 }
 
 __attribute__((malloc)) void *
-__kitcuda_mem_calloc_managed(size_t count, size_t element_size) {
+__kitcuda_mem_calloc_managed_async(size_t count, size_t element_size,
+                                   void **opaque_stream) {
   assert(count != 0 && "zero-valued item count!");
   assert(element_size != 0 && "zero-valued element size!");
+  assert(opaque_stream && "unexpected null stream pointer!");
 
-  KIT_NVTX_PUSH("kitcuda:calloc_managed", KIT_NVTX_MEM);
-
+  KIT_NVTX_PUSH("kitcuda:calloc_managed_async", KIT_NVTX_MEM);
   size_t nbytes = count * element_size;
-  CUdeviceptr memp = (CUdeviceptr)__kitcuda_mem_alloc_managed(nbytes);
+  void *vp = __kitcuda_mem_alloc_managed(nbytes);
+  if (__kitrt_get_mem_mirror(vp) != nullptr) {
+    // The host-side buffer of a device-resident allocation is copied
+    // to the device when it is first mapped.
+    memset(vp, 0, nbytes);
+    KIT_NVTX_POP();
+    return vp;
+  }
 
-  // TODO: Is there a risk of a race here?  From the driver API docs:
-  //
-  //   The cudaMemset functions are asynchronous with respect to the host
-  //   except when the target memory is pinned host memory. The Async
-  //   versions are always asynchronous with respect to the host.
-  //
-  // Given our use of UVM we might also be able to use a straight memset()
-  // call... which would, of course, place all pages on the host...
-  //
-  // TODO: We're not set to run on anything but the default stream...
-  CU_SAFE_CALL(cuMemsetD8Async_p(memp, 0, nbytes, NULL));
+  // The memset is ordered on the caller's stream (a non-blocking
+  // stream) rather than the legacy default stream, which would
+  // serialize it with the work of every blocking stream.  Launches on
+  // other streams wait for it via the allocation's event.
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_thread_stream();
+  CUstream stream = (CUstream)*opaque_stream;
+  CU_SAFE_CALL(cuMemsetD8Async_p((CUdeviceptr)vp, 0, nbytes, stream));
+  _kitcuda_mem_record_event(vp, stream);
   KIT_NVTX_POP();
-  return (void *)memp;
+  return vp;
 }
 
-__attribute__((malloc)) void *__kitcuda__mem_realloc_managed(void *ptr,
-                                                             size_t size) {
-  assert(size != 0 && "zero-valued size!");
+__attribute__((malloc)) void *
+__kitcuda_mem_calloc_managed(size_t count, size_t element_size) {
+  KIT_NVTX_PUSH("kitcuda:calloc_managed", KIT_NVTX_MEM);
+  // The host may access the memory as soon as calloc() returns so the
+  // memset must be complete -- but only its own stream is synchronized.
+  void *stream = nullptr;
+  void *vp = __kitcuda_mem_calloc_managed_async(count, element_size, &stream);
+  __kitcuda_sync_thread_stream(stream);
+  KIT_NVTX_POP();
+  return vp;
+}
 
-  KIT_NVTX_PUSH("kitcuda:realloc_managed", KIT_NVTX_MEM);
-  void *memptr = nullptr;
+__attribute__((malloc)) void *__kitcuda_mem_realloc_managed(void *ptr,
+                                                            size_t size) {
   if (ptr == nullptr)
-    memptr = __kitcuda_mem_alloc_managed(size);
-  else {
-    // Check to make sure this is a pointer we're actually managing.
-    bool read_only, write_only;
-    size_t nbytes = __kitrt_get_mem_alloc_size(ptr, &read_only, &write_only);
-    if (nbytes == 0) {
-      fprintf(stderr, "kitcuda: warning, realloc() on untracked allocation!\n");
-      KIT_NVTX_POP();
-      return nullptr;
-    }
+    return __kitcuda_mem_alloc_managed(size);
+  if (size == 0) {
+    __kitcuda_mem_free(ptr);
+    return nullptr;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:realloc_managed", KIT_NVTX_MEM);
+  // Check to make sure this is a pointer we're actually managing.
+  bool read_only, write_only;
+  size_t nbytes = __kitrt_get_mem_alloc_size(ptr, &read_only, &write_only);
+  if (nbytes == 0) {
+    fprintf(stderr, "kitcuda: warning, realloc() on untracked allocation!\n");
+    KIT_NVTX_POP();
+    return nullptr;
+  }
+  if (size == nbytes) {
+    KIT_NVTX_POP();
+    return ptr; // same size, just return it...
+  }
 
-    if (size > nbytes) {
-      // Requested size is larger than currently tracked allocation.
-      // Replace it.
-      memptr = __kitcuda_mem_alloc_managed(size);
-      cuMemcpy_p(/* dest */ (CUdeviceptr)memptr,
-                 /* source */ (CUdeviceptr)ptr, nbytes);
-
-      // NOTE: realloc does not guarantee initialized memory outside
-      // of existing data...
-      __kitcuda_mem_free(ptr);
-    } else if (size < nbytes) {
-      memptr = __kitcuda_mem_alloc_managed(size);
-      cuMemcpy_p(/* dest */ (CUdeviceptr)memptr,
-                 /* source */ (CUdeviceptr)ptr, size);
-      __kitcuda_mem_free(ptr);
-    } else
-      memptr = ptr; // same size, just return it...
+  // Managed allocations change size in place when they shrink or, for
+  // blocks from the memory pool, grow within their size class.  Only
+  // the runtime's record of the allocation changes.
+  if (__kitrt_get_mem_mirror(ptr) == nullptr &&
+      (size < nbytes ||
+       size <= __kitrt_mem_pool_block_size(_kitcuda_mem_pool, ptr))) {
+    __kitrt_resize_mem_alloc(ptr, size);
+    KIT_NVTX_POP();
+    return ptr;
   }
+
+  // Otherwise the contents move to a new allocation.  The copy is
+  // ordered on the calling thread's stream, which (only) must complete
+  // before the old allocation can be reused.
+  //
+  // NOTE: realloc does not guarantee initialized memory outside
+  // of existing data...
+  void *memptr = __kitcuda_mem_alloc_managed(size);
+  CUstream stream = (CUstream)__kitcuda_get_thread_stream();
+  CU_SAFE_CALL(cuMemcpyAsync_p(/* dest */ (CUdeviceptr)memptr,
+                               /* source */ (CUdeviceptr)ptr,
+                               std::min(size, nbytes), stream));
+  __kitcuda_sync_thread_stream(stream);
+  __kitcuda_mem_free(ptr);
   KIT_NVTX_POP();
   return memptr;
 }
 
+__attribute__((malloc)) void *__kitcuda_mem_reserve_managed(size_t max_bytes) {
+  KIT_NVTX_PUSH("kitcuda:mem_reserve_managed", KIT_NVTX_MEM);
+
+  __kitcuda_ensure_initialized();
+
+  CUcontext curctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
+  if (curctx == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  // The reservation is always managed memory (even when allocations
+  // are device-resident) as a mirror could not grow in place.  Its
+  // pages are populated on first touch so only the committed portion
+  // of the array is ever backed.
+  void *vp = _kitcuda_mem_alloc_slab(max_bytes);
+  KIT_NVTX_POP();
+  return vp;
+}
+
+void __kitcuda_mem_commit_managed(void *base, size_t nbytes) {
+  assert(base && "unexpected null pointer!");
+  // Only the runtime's record of the allocation (which sizes its
+  // prefetches) changes; the pages are already mapped.
+  __kitrt_resize_mem_alloc(base, nbytes);
+}
+
+void __kitcuda_mem_release_managed(void *base, size_t max_bytes) {
+  assert(base && "unexpected null pointer!");
+  (void)max_bytes;
+  KIT_NVTX_PUSH("kitcuda:mem_release_managed", KIT_NVTX_MEM);
+  __kitrt_unregister_mem_alloc(base);
+  _kitcuda_mem_free_slab(base);
+  KIT_NVTX_POP();
+}
+
+void *__kitcuda_mem_map_file(const char *path, size_t *nbytes) {
+  KIT_NVTX_PUSH("kitcuda:mem_map_file", KIT_NVTX_MEM);
+
+  __kitcuda_ensure_initialized();
+
+  CUcontext curctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&curctx));
+  if (curctx == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  size_t size = 0;
+  void *vp = __kitrt_map_file(path, &size);
+  if (nbytes)
+    *nbytes = size;
+  if (vp == nullptr) {
+    KIT_NVTX_POP();
+    return nullptr;
+  }
+
+  // The mirror is registered as current (and the file as read-only) so
+  // kernel launches use it without copying; they wait for the loader
+  // instead (see __kitcuda_mem_gpu_map()).
+  KitCudaFileMap *map = new KitCudaFileMap;
+  map->size = size;
+  CU_SAFE_CALL(cuMemAlloc_v2_p(&map->mirror, size));
+  CU_SAFE_CALL(cuStreamCreate_p(&map->stream, CU_STREAM_NON_BLOCKING));
+  __kitrt_register_mem_alloc(vp, size, (void *)map->mirror);
+  __kitrt_mark_mem_read_only(vp);
+  __kitrt_mark_mem_prefetched(vp);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: mapped file '%s' [address=%p, size=%ld].\n",
+            path, vp, size);
+
+  std::lock_guard<std::mutex> lock(_kitcuda_file_map_mutex);
+  _kitcuda_file_maps[vp] = map;
+  _kitcuda_num_file_maps.fetch_add(1, std::memory_order_relaxed);
+  map->loader = std::thread(_kitcuda_load_file, (const char *)vp, map);
+  KIT_NVTX_POP();
+  return vp;
+}
+
+void __kitcuda_mem_unmap_file(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  KitCudaFileMap *map;
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_file_map_mutex);
+    auto it = _kitcuda_file_maps.find(vp);
+    if (it == _kitcuda_file_maps.end()) {
+      fprintf(stderr, "kitcuda: warning, unmap of unknown file mapping %p.\n",
+              vp);
+      return;
+    }
+    map = it->second;
+    _kitcuda_file_maps.erase(it);
+    _kitcuda_num_file_maps.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  KIT_NVTX_PUSH("kitcuda:mem_unmap_file", KIT_NVTX_MEM);
+  if (map->loader.joinable())
+    map->loader.join();
+  __kitrt_unregister_mem_alloc(vp);
+  __kitcuda_persistent_stop();
+  CU_SAFE_CALL(cuMemFree_v2_p(map->mirror));
+  CU_SAFE_CALL(cuStreamDestroy_v2_p(map->stream));
+  munmap(vp, map->size);
+  delete map;
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_destroy_file_maps() {
+  std::vector<void *> maps;
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_file_map_mutex);
+    for (auto &entry : _kitcuda_file_maps)
+      maps.push_back(entry.first);
+  }
+  for (void *vp : maps)
+    __kitcuda_mem_unmap_file(vp);
+}
+
 void __kitcuda_mem_free(void *vp) {
   assert(vp && "unexpected null pointer!");
 
   KIT_NVTX_PUSH("kitcuda:mem_free", KIT_NVTX_MEM);
   // We first remove the allocation from the runtime's
-  // map, and then actually release it via CUDA...
+  // map, and then either return it to the pool or actually
+  // release it via CUDA...
   // Note that the versioned free calls are important
   // here -- a non-v2 version will actually result in
   // crashes...
-  _kitcuda_mem_alloc_mutex.lock();
+  void *mirror = __kitrt_get_mem_mirror(vp);
+  __kitcuda_mem_persist_forget(vp);
   __kitrt_unregister_mem_alloc(vp);
-  _kitcuda_mem_alloc_mutex.unlock();
-  CU_SAFE_CALL(cuMemFree_v2_p((CUdeviceptr)vp));
+  if (mirror != nullptr) {
+    // Freeing device memory can wait on the whole device, which the
+    // persistent worker never lets go idle.
+    __kitcuda_persistent_stop();
+    __kitcuda_mem_destroy_mirror(vp, mirror);
+  } else if (not __kitrt_mem_pool_free(_kitcuda_mem_pool, vp)) {
+    __kitcuda_persistent_stop();
+    CU_SAFE_CALL(cuMemFree_v2_p((CUdeviceptr)vp));
+  }
   KIT_NVTX_POP();
 }
 
@@ -189,6 +962,17 @@ void __kitcuda_mem_destroy(void *vp) {
   KIT_NVTX_POP();
 }
 
+void __kitcuda_mem_destroy_mirror(void *vp, void *mirror) {
+  KIT_NVTX_PUSH("kitcuda: mem_destroy_mirror", KIT_NVTX_MEM);
+  _kitcuda_mirror_mutex.lock();
+  (void)_kitcuda_mem_untrack_host_writes(vp);
+  _kitcuda_mirror_mutex.unlock();
+  CU_SAFE_CALL(cuMemFree_v2_p((CUdeviceptr)mirror));
+  CU_SAFE_CALL(cuMemHostUnregister_p(vp));
+  free(vp);
+  KIT_NVTX_POP();
+}
+
 bool __kitcuda_is_mem_managed(void *vp) {
   assert(vp && "unexpected null pointer!");
   assert(__kitcuda_is_initialized() && "kitrt: runtime not initialized!");
@@ -213,6 +997,10 @@ void* __kitcuda_mem_gpu_prefetch(void *vp, void *opaque_stream) {
   KIT_NVTX_PUSH("kitcuda:mem_gpu_prefetch", KIT_NVTX_MEM);
 
   size_t size = 0;
+  // The pointer may reference the interior of an allocation (e.g., a
+  // sub-array passed as a kernel argument).  Advice and prefetching
+  // are applied to the entire allocation that contains it.
+  void *base = vp;
   // TODO: Prefetching details and approaches need to be further
   // explored.  In particular, in concert with compiler analysis
   // and code generation.
@@ -225,7 +1013,7 @@ void* __kitcuda_mem_gpu_prefetch(void *vp, void *opaque_stream) {
   // lead to page faults and evictions of pages...  At present this
   // has lead to the best general performance and reduced complexity,
   // while also maintaining correctness.
-  if (not __kitrt_is_mem_prefetched(vp, &size)) {
+  if (not __kitrt_is_mem_prefetched(vp, &size, &base)) {
     if (size > 0) {
       CUcontext cu_context;
       CU_SAFE_CALL(cuCtxGetCurrent_p(&cu_context));
@@ -262,7 +1050,7 @@ void* __kitcuda_mem_gpu_prefetch(void *vp, void *opaque_stream) {
       // accesses from the device will not result in a read-only copy
       // being created on that device. See the CUDA docs on the
       // CU_MEM_ADVISE_SET_READ_MOSTLY advice flag.
-      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)vp, size,
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
                                  CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
                                  _kitcuda_device));
 
@@ -279,9 +1067,14 @@ void* __kitcuda_mem_gpu_prefetch(void *vp, void *opaque_stream) {
       else 
         cu_stream = (CUstream)__kitcuda_get_thread_stream();
 
-      CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)vp, size, _kitcuda_device,
+      KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "prefetch");
+      profile.set_bytes(size);
+      profile.record_start(&_kitcuda_profile_ops, cu_stream);
+      CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base, size, _kitcuda_device,
                                         cu_stream));
-      __kitrt_mark_mem_prefetched(vp);
+      profile.record_end(cu_stream);
+      __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, size);
+      __kitrt_mark_mem_prefetched(base);
       return (void*)cu_stream;
     }
   }
@@ -308,8 +1101,33 @@ void* __kitcuda_mem_host_prefetch(void *vp, void *opaque_stream) {
   // faults and evictions.  Little work has been done with host-side
   // prefetch requests.
   size_t size;
-  if (__kitrt_is_mem_prefetched(vp, &size)) {
-    if (size > 0) {
+  void *base = vp;
+  if (__kitrt_is_mem_prefetched(vp, &size, &base)) {
+    // Data the host uses between launches is a round trip that the
+    // automatic migration policy counts.
+    if (size > 0 && not __kitrt_is_mem_read_only(base) &&
+        __kitrt_count_mem_round_trip(base) == _kitcuda_migrate_round_trips &&
+        __kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: stop prefetching data shared with the host "
+              "[address=%p, size=%ld].\n", base, size);
+    if (size > 0 && __kitrt_is_mem_read_only(base)) {
+      // Read-mostly data was duplicated (not migrated) to the device
+      // and the host-side copy is still valid.  There is nothing to
+      // write back.
+      __kitrt_set_mem_prefetch(base, false);
+    } else if (size > 0 && _kitcuda_device_resident &&
+               __kitrt_get_mem_mirror(base) != nullptr) {
+      // Device-resident data is copied back when the stream is
+      // synchronized (see __kitcuda_mem_flush_mirrors()).
+    } else if (size > 0 && _kitcuda_lazy_host_prefetch) {
+      // Leave the data on the device.  The pages the host touches
+      // fault over on demand, and those it reports writing (see
+      // __kitrt_mem_host_write()) are the only ones moved back before
+      // the next kernel.
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: skip host prefetch [address=%p, "
+                "size=%ld].\n", base, size);
+    } else if (size > 0) {
       // The logic here resets the memory advice from being
       // GPU-centric to host-side preferred.  The general logic here
       // is to assume that host-side access suggests pending
@@ -318,7 +1136,7 @@ void* __kitcuda_mem_host_prefetch(void *vp, void *opaque_stream) {
       //
       // TODO: A lot of work needs to go into seeing if we can be
       // smarter about device- and host-side prefetching.
-      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)vp, size,
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
                                  CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
                                  CU_DEVICE_CPU));
       // Issue a prefetch request on the stream associated with the
@@ -327,14 +1145,24 @@ void* __kitcuda_mem_host_prefetch(void *vp, void *opaque_stream) {
       // not guarantee prefetching is complete it simply flags that
       // the "instruction" has been issued by the runtime.
       CUstream cu_stream;
-      if (opaque_stream) 
+      if (opaque_stream) {
+        // The compiler issues these right behind a launch on its
+        // stream.  The kernel may still be deferred in the stream's
+        // graph or running on a dataflow worker stream.
         cu_stream = (CUstream)opaque_stream;
-      else 
+        __kitcuda_graph_flush(opaque_stream);
+        __kitcuda_dataflow_join(opaque_stream);
+      } else 
         cu_stream = (CUstream)__kitcuda_get_thread_stream();
 
-      CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)vp, size, CU_DEVICE_CPU,
+      KitRTProfileScope profile(KITRT_PROFILE_TO_HOST, "prefetch");
+      profile.set_bytes(size);
+      profile.record_start(&_kitcuda_profile_ops, cu_stream);
+      CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base, size, CU_DEVICE_CPU,
                                         cu_stream));
-      __kitrt_set_mem_prefetch(vp, false);
+      profile.record_end(cu_stream);
+      __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_HOST, size);
+      __kitrt_set_mem_prefetch(base, false);
       return cu_stream;
     }
   }
@@ -342,6 +1170,817 @@ void* __kitcuda_mem_host_prefetch(void *vp, void *opaque_stream) {
   return nullptr;
 }
 
+void __kitcuda_mem_mark_cold(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  size_t size = 0;
+  void *base = vp;
+  (void)__kitrt_get_mem_residency(vp, &size, &base);
+  // Device-resident and mapped-file mirrors are explicit device
+  // buffers that are released with the allocation, not managed pages.
+  if (size == 0 || __kitrt_is_mem_cold(base) ||
+      __kitrt_get_mem_mirror(base) != nullptr)
+    return;
+
+  KIT_NVTX_PUSH("kitcuda:mem_mark_cold", KIT_NVTX_MEM);
+  CUcontext cu_context;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&cu_context));
+  if (cu_context == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  // Read-mostly data has copies on the device that the prefetch below
+  // would leave in place.
+  if (__kitrt_is_mem_read_only(base)) {
+    CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                               CU_MEM_ADVISE_UNSET_READ_MOSTLY,
+                               _kitcuda_device));
+    __kitrt_clear_mem_advice(base);
+  }
+
+  // Move the pages to the host and keep them there, even if a kernel
+  // touches them, until the allocation is next prefetched to the
+  // device (which restores the device as the preferred location).
+  // Unlike the host prefetches issued behind a launch, the move is
+  // not deferred by lazy host prefetching.
+  CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                             CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                             CU_DEVICE_CPU));
+  void *opaque_stream = nullptr;
+  _kitcuda_mem_wait_prefetch(base, &opaque_stream);
+  if (opaque_stream == nullptr)
+    opaque_stream = __kitcuda_get_thread_stream();
+  // Deferred kernels that use the data are issued ahead of the move.
+  __kitcuda_graph_flush(opaque_stream);
+  __kitcuda_dataflow_join(opaque_stream);
+  CUstream cu_stream = (CUstream)opaque_stream;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: evict cold data to host [address=%p, "
+            "size=%ld, stream=%p].\n", base, size, (void *)cu_stream);
+  KitRTProfileScope profile(KITRT_PROFILE_TO_HOST, "evict");
+  profile.set_bytes(size);
+  profile.record_start(&_kitcuda_profile_ops, cu_stream);
+  CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base, size, CU_DEVICE_CPU,
+                                    cu_stream));
+  profile.record_end(cu_stream);
+  __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_HOST, size);
+  __kitrt_mark_mem_needs_prefetch(base);
+  __kitrt_set_mem_cold(base, true);
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_set_migrate_policy(int policy) {
+  assert(policy >= KITRT_MIGRATE_AUTO && policy <= KITRT_MIGRATE_HOST &&
+         "unknown migration policy!");
+  _kitcuda_migrate_policy = policy;
+}
+
+void __kitcuda_set_migrate_round_trips(unsigned round_trips) {
+  _kitcuda_migrate_round_trips = round_trips;
+}
+
+void __kitcuda_mem_set_migrate_policy(void *vp, int policy) {
+  assert(vp && "unexpected null pointer!");
+  assert(policy >= KITRT_MIGRATE_AUTO && policy <= KITRT_MIGRATE_HOST &&
+         "unknown migration policy!");
+  __kitrt_set_mem_migrate_policy(vp, policy);
+}
+
+void __kitcuda_use_lazy_host_prefetch(bool enable) {
+  _kitcuda_lazy_host_prefetch = enable;
+}
+
+void __kitcuda_track_host_writes(bool enable) {
+  _kitcuda_track_host_writes = enable;
+}
+
+void __kitcuda_use_explicit_host_writes(bool enable) {
+  _kitcuda_explicit_host_writes = enable;
+}
+
+void __kitcuda_use_device_resident_memory(bool enable) {
+  _kitcuda_device_resident = enable;
+  // Graph launches would reorder kernels with respect to the copies
+  // of device-resident data.
+  if (enable)
+    __kitcuda_use_graph_launch(false);
+}
+
+// Return the migration policy of the managed allocation at 'base'.
+// The automatic policy prefetches data until its round trips between
+// the host and the device show that the host and the kernels share it.
+// The kernels then access the data where it is: coherent systems (e.g.,
+// Grace-Hopper) migrate the pages the kernels use often by the access
+// counters, others keep the pages in host memory rather than moving
+// them back and forth on every launch.
+static int _kitcuda_mem_migrate_policy(void *base) {
+  unsigned round_trips = 0;
+  int policy = __kitrt_get_mem_migrate_policy(base, &round_trips);
+  if (policy == KITRT_MIGRATE_AUTO)
+    policy = _kitcuda_migrate_policy;
+  if (policy != KITRT_MIGRATE_AUTO)
+    return policy;
+  if (round_trips < _kitcuda_migrate_round_trips)
+    return KITRT_MIGRATE_PREFETCH;
+  return __kitcuda_get_device_props()->host_page_tables
+             ? KITRT_MIGRATE_COUNTERS
+             : KITRT_MIGRATE_HOST;
+}
+
+// Apply the memory advice of the migration policy of a managed
+// allocation.  Returns false if the data should not be prefetched to
+// the device prior to the launch.
+static bool _kitcuda_mem_advise_migrate(void *vp) {
+  size_t size = 0;
+  void *base = vp;
+  (void)__kitrt_get_mem_residency(vp, &size, &base);
+  if (size == 0)
+    return true;
+  int policy = _kitcuda_mem_migrate_policy(base);
+  if (policy == KITRT_MIGRATE_PREFETCH)
+    return true;
+
+  // The advice is only given when the policy changes: the driver call
+  // is costly and the pages stay where the policy places them.
+  int location = policy == KITRT_MIGRATE_HOST ? KITRT_MEM_ADVISED_HOST
+                                              : KITRT_MEM_ADVISED_ANY;
+  if (__kitrt_exchange_mem_advice(base, location) != location) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: %s migration of [address=%p, size=%ld].\n",
+              policy == KITRT_MIGRATE_HOST ? "host-access" : "counter-driven",
+              base, size);
+    if (policy == KITRT_MIGRATE_HOST)
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                                 CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                                 CU_DEVICE_CPU));
+    else
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                                 CU_MEM_ADVISE_UNSET_PREFERRED_LOCATION,
+                                 _kitcuda_device));
+    // The device maps the pages wherever they are rather than faulting
+    // them over.
+    CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                               CU_MEM_ADVISE_SET_ACCESSED_BY,
+                               _kitcuda_device));
+  }
+  return false;
+}
+
+// Apply memory advice to a managed allocation based on how the next
+// kernel will access it.  Read-only data is flagged as "read mostly"
+// so the driver creates read-only copies on the device instead of
+// migrating pages away from the host (the host copy remains valid
+// after the kernel completes).  Any other use of the data removes the
+// advice as writes to "read mostly" pages are expensive (all copies
+// are invalidated).  Returns false if the data should not be migrated
+// to the device prior to the launch.
+static bool _kitcuda_mem_advise_access(void *vp, int access) {
+  size_t size = 0;
+  void *base = vp;
+  bool prefetched = __kitrt_is_mem_prefetched(vp, &size, &base);
+  if (size == 0)
+    return true; // not a tracked allocation -- nothing to advise.
+
+  bool read_only = __kitrt_is_mem_read_only(base);
+  if (access == KITRT_MEM_ACCESS_READ_ONLY) {
+    if (not read_only) {
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: advise read-mostly "
+                "[address=%p, size=%ld].\n", base, size);
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                                 CU_MEM_ADVISE_SET_READ_MOSTLY,
+                                 _kitcuda_device));
+      __kitrt_clear_mem_advice(base);
+      __kitrt_mark_mem_read_only(base);
+    }
+    return true;
+  }
+
+  if (read_only) {
+    CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                               CU_MEM_ADVISE_UNSET_READ_MOSTLY,
+                               _kitcuda_device));
+    __kitrt_clear_mem_advice(base);
+  }
+
+  if (access == KITRT_MEM_ACCESS_WRITE_ONLY) {
+    __kitrt_mark_mem_write_only(base);
+    if (not prefetched) {
+      // The kernel will overwrite the data so there is no reason to
+      // migrate the (stale) host-side pages.  Only set the preferred
+      // location so pages touched by the kernel are placed (and stay)
+      // on the device.
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: skip migration of write-only data "
+                "[address=%p, size=%ld].\n", base, size);
+      CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                                 CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                                 _kitcuda_device));
+      return false;
+    }
+  } else if (__kitrt_is_mem_write_only(base))
+    __kitrt_clear_mem_advice(base);
+  return true;
+}
+
+void *__kitcuda_mem_gpu_map(void *vp, int access, void **opaque_stream) {
+  assert(vp && "unexpected null pointer!");
+  assert(opaque_stream && "unexpected null stream pointer!");
+
+  // The kernel never dereferences the pointer (it may still compare it
+  // against null) so its data can stay where it is.
+  if (access == KITRT_MEM_ACCESS_NONE)
+    return vp;
+
+  __kitcuda_dataflow_record(vp, access);
+  void *base = nullptr;
+  size_t size = 0;
+  void *mirror =
+      _kitcuda_device_resident ||
+              _kitcuda_num_file_maps.load(std::memory_order_relaxed) > 0
+          ? __kitrt_get_mem_mirror(vp, &base, &size)
+          : nullptr;
+  if (mirror == nullptr && (__kitcuda_get_num_devices() > 1 ||
+                            _kitcuda_out_of_core_budget > 0)) {
+    // Record the allocation for the upcoming launch.  The launch will
+    // decide how to spread the data across devices (or chunks).
+    size_t size = 0;
+    void *base = vp;
+    __kitrt_get_mem_residency(vp, &size, &base);
+    if (*opaque_stream == nullptr)
+      *opaque_stream = __kitcuda_get_thread_stream();
+    _kitcuda_mem_wait_prefetch(base, opaque_stream);
+    if (size > 0) {
+      std::lock_guard<std::mutex> lock(_kitcuda_pending_mutex);
+      KitCudaPendingMaps &maps = _kitcuda_pending_maps[(CUstream)*opaque_stream];
+      auto it = maps.find(base);
+      if (it == maps.end())
+        maps[base] = access;
+      else if (it->second != access)
+        it->second = KITRT_MEM_ACCESS_READ_WRITE;
+    }
+    return vp;
+  }
+
+  if (mirror == nullptr) {
+    // Managed (or unknown) memory -- apply any access advice, fall
+    // back to a prefetch request and pass the pointer through
+    // unchanged.  Data already requested by an early prefetch only
+    // needs the launch to wait for it.
+    _kitcuda_mem_wait_prefetch(vp, opaque_stream);
+    _kitcuda_mem_prefetch_host_ranges(vp, opaque_stream);
+    if (_kitcuda_mem_advise_access(vp, access) &&
+        _kitcuda_mem_advise_migrate(vp)) {
+      void *stream = __kitcuda_mem_gpu_prefetch(vp, *opaque_stream);
+      if (*opaque_stream == nullptr)
+        *opaque_stream = stream;
+    }
+    return vp;
+  }
+
+  KIT_NVTX_PUSH("kitcuda:mem_gpu_map", KIT_NVTX_MEM);
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_thread_stream();
+  CUstream cu_stream = (CUstream)*opaque_stream;
+
+  // The mirror of a mapped file is never out of date (the host can't
+  // write the file) once it has been loaded.
+  if (__kitrt_is_mem_read_only(base)) {
+    _kitcuda_mem_wait_file(base);
+    KIT_NVTX_POP();
+    return mirror;
+  }
+
+  // Only move data that is out of date on the device: data never
+  // copied there or written by the host since it was last copied back.
+  // This includes write-only data -- the kernel may write only part of
+  // it and the whole buffer is copied back to the host.
+  _kitcuda_mirror_mutex.lock();
+  if (_kitcuda_mem_untrack_host_writes(base))
+    __kitrt_mark_mem_needs_prefetch(base);
+  _kitcuda_mirror_mutex.unlock();
+  if (not __kitrt_is_mem_prefetched(base)) {
+    CUdeviceptr mirror_base = (CUdeviceptr)mirror - ((char *)vp - (char *)base);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: copy device-resident data to device "
+              "[address=%p, size=%ld, stream=%p].\n", base, size,
+              (void *)cu_stream);
+    KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "copy");
+    profile.set_bytes(size);
+    profile.record_start(&_kitcuda_profile_ops, cu_stream);
+    CU_SAFE_CALL(cuMemcpyHtoDAsync_v2_p(mirror_base, base, size, cu_stream));
+    profile.record_end(cu_stream);
+  } else {
+    // Only the ranges the host reported writing (see
+    // __kitrt_mem_host_write()) are out of date.
+    KitRTMemRanges ranges;
+    if (__kitrt_take_mem_host_ranges(base, ranges)) {
+      CUdeviceptr mirror_base =
+          (CUdeviceptr)mirror - ((char *)vp - (char *)base);
+      for (auto &range : ranges) {
+        size_t nbytes = range.second - range.first;
+        if (__kitrt_verbose_mode())
+          fprintf(stderr, "kitcuda: copy host range to device [address=%p, "
+                  "size=%ld].\n", (char *)base + range.first, nbytes);
+        KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "copy");
+        profile.set_bytes(nbytes);
+        profile.record_start(&_kitcuda_profile_ops, cu_stream);
+        CU_SAFE_CALL(cuMemcpyHtoDAsync_v2_p(mirror_base + range.first,
+                                            (char *)base + range.first,
+                                            nbytes, cu_stream));
+        profile.record_end(cu_stream);
+      }
+    }
+  }
+  __kitrt_mark_mem_prefetched(base);
+
+  _kitcuda_mirror_mutex.lock();
+  bool &written = _kitcuda_mirror_refs[cu_stream][base];
+  written = written || access != KITRT_MEM_ACCESS_READ_ONLY;
+  _kitcuda_mirror_mutex.unlock();
+  KIT_NVTX_POP();
+  return mirror;
+}
+
+void __kitcuda_mem_gpu_map_batch(void **ptrs, const int *access,
+                                 int num_ptrs, void **opaque_stream,
+                                 void **cache) {
+  assert(ptrs && access && "unexpected null argument list!");
+  assert(opaque_stream && "unexpected null stream pointer!");
+
+  // Only managed memory launched on a single device can be found in
+  // place -- the other modes do work for every launch.
+  bool cacheable =
+      cache != nullptr && not _kitcuda_device_resident &&
+      _kitcuda_num_file_maps.load(std::memory_order_relaxed) == 0 &&
+      __kitcuda_get_num_devices() == 1 && _kitcuda_out_of_core_budget == 0 &&
+      not __kitcuda_dataflow_launch_enabled();
+  uint64_t epoch = __kitrt_mem_epoch.load(std::memory_order_acquire);
+
+  // Group the arguments by the allocation they reference.  Kernels
+  // rarely take more than a handful of pointers so a linear search is
+  // cheaper than a map.
+  struct KitCudaMapGroup {
+    void *base;
+    void *ptr;  // the first argument in the allocation.
+    int access; // the union of the arguments' access modes.
+  };
+  std::vector<KitCudaMapGroup> groups;
+  std::vector<int> group_of(num_ptrs);
+  groups.reserve(num_ptrs);
+  for (int i = 0; i < num_ptrs; i++) {
+    // Arguments the kernel never dereferences are passed through.
+    if (access[i] == KITRT_MEM_ACCESS_NONE) {
+      group_of[i] = -1;
+      continue;
+    }
+    void *base = ptrs[i];
+    size_t size = 0;
+    __kitrt_get_mem_residency(ptrs[i], &size, &base);
+    size_t g = 0;
+    while (g < groups.size() && groups[g].base != base)
+      g++;
+    if (g == groups.size())
+      groups.push_back({base, ptrs[i], access[i]});
+    else if (groups[g].access != access[i])
+      groups[g].access = KITRT_MEM_ACCESS_READ_WRITE;
+    group_of[i] = (int)g;
+  }
+
+  // Map each allocation once and translate the other pointers into it
+  // by their offset from the first.
+  std::vector<void *> mapped(groups.size());
+  for (size_t g = 0; g < groups.size(); g++)
+    mapped[g] = __kitcuda_mem_gpu_map(groups[g].ptr, groups[g].access,
+                                      opaque_stream);
+
+  // Read-only data that many launches map is a candidate to persist in
+  // the L2 (e.g., a coefficient table read by every kernel of a
+  // timestep).  A new selection is set on the launch's stream.
+  if (__kitcuda_get_device_props()->max_persisting_l2_bytes > 0) {
+    bool noted = false;
+    for (size_t g = 0; g < groups.size(); g++) {
+      if (groups[g].access != KITRT_MEM_ACCESS_READ_ONLY)
+        continue;
+      size_t size = 0;
+      void *base = groups[g].base;
+      __kitrt_get_mem_residency(base, &size, &base);
+      char *dev_base =
+          (char *)mapped[g] - ((char *)groups[g].ptr - (char *)base);
+      __kitcuda_mem_persist_note(base, dev_base, size);
+      noted = true;
+    }
+    if (noted && *opaque_stream != nullptr)
+      __kitcuda_mem_persist_apply(*opaque_stream, false);
+  }
+  for (int i = 0; i < num_ptrs; i++) {
+    int g = group_of[i];
+    if (g < 0)
+      continue;
+    ptrs[i] = (char *)mapped[g] + ((char *)ptrs[i] - (char *)groups[g].ptr);
+  }
+
+  // A change to any allocation while the arguments were mapped (a
+  // prefetch, new advice, a wait on an early prefetch, ...) advances
+  // the epoch.  The site's cache is cleared
+  // while the pointers are updated so a concurrent launch from the site
+  // does not match a partial update.
+  if (cacheable &&
+      __kitrt_mem_epoch.load(std::memory_order_acquire) == epoch) {
+    __atomic_store_n(&cache[0], nullptr, __ATOMIC_RELAXED);
+    for (int i = 0; i < num_ptrs; i++)
+      __atomic_store_n(&cache[i + 1], ptrs[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&cache[0], (void *)(uintptr_t)epoch, __ATOMIC_RELEASE);
+  }
+}
+
+void __kitcuda_mem_gpu_prefetch_async(void *vp, int access) {
+  assert(vp && "unexpected null pointer!");
+  if (access == KITRT_MEM_ACCESS_NONE)
+    return;
+  // Device-resident and multi-device launches manage their own data
+  // movement when the launch is issued.
+  if (not __kitrt_prefetchStreamsEnabled() || _kitcuda_device_resident ||
+      __kitcuda_get_num_devices() > 1)
+    return;
+
+  size_t size = 0;
+  void *base = vp;
+  if (__kitrt_is_mem_prefetched(vp, &size, &base) || size == 0)
+    return;
+  // Data too large to be resident is moved by an out-of-core launch.
+  if (_kitcuda_out_of_core_budget > 0 &&
+      size > _kitcuda_out_of_core_budget / _kitcuda_out_of_core_buffers)
+    return;
+
+  KIT_NVTX_PUSH("kitcuda:mem_gpu_prefetch_async", KIT_NVTX_MEM);
+  CUcontext cu_context;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&cu_context));
+  if (cu_context == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+
+  if (_kitcuda_mem_advise_access(vp, access) &&
+      _kitcuda_mem_advise_migrate(vp)) {
+    CU_SAFE_CALL(cuMemAdvise_p((CUdeviceptr)base, size,
+                               CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                               _kitcuda_device));
+    std::lock_guard<std::mutex> lock(_kitcuda_prefetch_mutex);
+    unsigned num_streams = std::min(__kitrt_getNumPrefetchStreams(),
+                                    KITCUDA_MAX_PREFETCH_STREAMS);
+    unsigned index = _kitcuda_next_prefetch_stream++ % num_streams;
+    CUstream &stream = _kitcuda_prefetch_streams[index];
+    if (stream == nullptr)
+      CU_SAFE_CALL(cuStreamCreate_p(&stream, CU_STREAM_NON_BLOCKING));
+
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: early prefetch [address=%p, size=%ld, "
+              "stream=%p].\n", base, size, (void *)stream);
+    KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "prefetch");
+    profile.set_bytes(size);
+    profile.record_start(&_kitcuda_profile_ops, stream);
+    CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base, size,
+                                      _kitcuda_device, stream));
+    profile.record_end(stream);
+    __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, size);
+    CUevent &event = _kitcuda_prefetch_events[base];
+    if (event == nullptr) {
+      CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DISABLE_TIMING));
+      _kitcuda_num_prefetch_events.fetch_add(1, std::memory_order_relaxed);
+    }
+    CU_SAFE_CALL(cuEventRecord_p(event, stream));
+    __kitrt_mark_mem_prefetched(base);
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_destroy_prefetch_streams() {
+  std::lock_guard<std::mutex> lock(_kitcuda_prefetch_mutex);
+  for (auto &entry : _kitcuda_prefetch_events)
+    CU_SAFE_CALL(cuEventDestroy_v2_p(entry.second));
+  _kitcuda_prefetch_events.clear();
+  _kitcuda_num_prefetch_events = 0;
+  for (CUstream &stream : _kitcuda_prefetch_streams) {
+    if (stream != nullptr)
+      CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
+    stream = nullptr;
+  }
+}
+
+void __kitcuda_mem_gpu_prefetch_slices(void *opaque_stream, int num_slices,
+                                       const uint64_t *bounds,
+                                       void **slice_streams) {
+  assert(opaque_stream && "unexpected null stream pointer!");
+  assert(num_slices > 0 && num_slices <= __kitcuda_get_num_devices() &&
+         "invalid number of slices!");
+  KitCudaPendingMaps maps;
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_pending_mutex);
+    auto it = _kitcuda_pending_maps.find((CUstream)opaque_stream);
+    if (it == _kitcuda_pending_maps.end())
+      return;
+    maps.swap(it->second);
+  }
+
+  KIT_NVTX_PUSH("kitcuda:mem_gpu_prefetch_slices", KIT_NVTX_MEM);
+  const size_t page_size = 4096;
+  uint64_t trip_count = bounds[num_slices] - bounds[0];
+  unsigned all_devices = (1u << num_slices) - 1;
+  for (auto &map : maps) {
+    void *base = map.first;
+    int access = map.second;
+    if (num_slices == 1) {
+      // Nothing to split -- use the single device path.
+      if (_kitcuda_mem_advise_access(base, access))
+        __kitcuda_mem_gpu_prefetch(base, slice_streams[0]);
+      continue;
+    }
+
+    size_t size = 0;
+    unsigned resident = __kitrt_get_mem_residency(base, &size);
+    if (size == 0)
+      continue; // freed before the launch...
+    // Any read-mostly advice is (re)set here.  We handle the placement
+    // of the data below so the result is ignored.
+    (void)_kitcuda_mem_advise_access(base, access);
+    if (resident == all_devices)
+      continue; // same split as a prior launch.
+
+    for (int i = 0; i < num_slices; i++) {
+      // Read-only data is duplicated (all of it) on each device.  The
+      // remaining data is split in proportion to the iteration space.
+      size_t lo = 0, hi = size;
+      if (access != KITRT_MEM_ACCESS_READ_ONLY) {
+        lo = (size_t)(size * ((double)(bounds[i] - bounds[0]) / trip_count));
+        hi = (size_t)(size *
+                      ((double)(bounds[i + 1] - bounds[0]) / trip_count));
+        lo &= ~(page_size - 1);
+        if (i == num_slices - 1)
+          hi = size;
+        else
+          hi &= ~(page_size - 1);
+        if (hi <= lo)
+          continue;
+      }
+
+      CUcontext ctx;
+      CUdevice device = __kitcuda_get_device_at(i);
+      CUdeviceptr slice = (CUdeviceptr)base + lo;
+      CU_SAFE_CALL(cuCtxPushCurrent_v2_p(__kitcuda_get_context_at(i)));
+      if (access != KITRT_MEM_ACCESS_READ_ONLY)
+        CU_SAFE_CALL(cuMemAdvise_p(slice, hi - lo,
+                                   CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                                   device));
+      // Write-only data will be overwritten by the kernel so we only
+      // need to set the preferred location.
+      if (access != KITRT_MEM_ACCESS_WRITE_ONLY) {
+        CU_SAFE_CALL(cuMemPrefetchAsync_p(slice, hi - lo, device,
+                                          (CUstream)slice_streams[i]));
+        __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, hi - lo);
+      }
+      CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: prefetch slice %d [address=%p, "
+                "size=%ld] to device %d.\n", i, (void *)slice, hi - lo,
+                (int)device);
+    }
+    __kitrt_set_mem_residency(base, all_devices);
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_set_out_of_core(uint64_t budget_bytes, int num_buffers) {
+  _kitcuda_out_of_core_budget = budget_bytes;
+  __kitcuda_advance_launch_epoch();
+  _kitcuda_out_of_core_buffers =
+      std::max(2, std::min(num_buffers, KITCUDA_MAX_OUT_OF_CORE_BUFFERS));
+}
+
+uint64_t __kitcuda_get_out_of_core_budget() {
+  return _kitcuda_out_of_core_budget;
+}
+
+int __kitcuda_get_out_of_core_buffers() {
+  return _kitcuda_out_of_core_buffers;
+}
+
+uint64_t __kitcuda_mem_pending_bytes(void *opaque_stream) {
+  uint64_t total = 0;
+  std::lock_guard<std::mutex> lock(_kitcuda_pending_mutex);
+  auto it = _kitcuda_pending_maps.find((CUstream)opaque_stream);
+  if (it == _kitcuda_pending_maps.end())
+    return 0;
+  for (auto &map : it->second) {
+    size_t size = 0;
+    (void)__kitrt_get_mem_residency(map.first, &size);
+    total += size;
+  }
+  return total;
+}
+
+void __kitcuda_mem_prefetch_chunk(void *opaque_stream, uint64_t start,
+                                  uint64_t end, uint64_t lo, uint64_t hi,
+                                  uint64_t split_bytes, bool to_host,
+                                  void *prefetch_stream) {
+  const size_t page_size = 4096;
+  std::lock_guard<std::mutex> lock(_kitcuda_pending_mutex);
+  auto it = _kitcuda_pending_maps.find((CUstream)opaque_stream);
+  if (it == _kitcuda_pending_maps.end())
+    return;
+  double trip_count = end - start;
+  for (auto &map : it->second) {
+    void *base = map.first;
+    int access = map.second;
+    size_t size = 0;
+    (void)__kitrt_get_mem_residency(base, &size);
+    if (size == 0)
+      continue; // freed before the launch...
+
+    // Allocations larger than a chunk are assumed to be accessed in
+    // proportion to the iteration space.  Smaller ones are moved in
+    // whole with the first chunk and stay on the device.
+    size_t blo = 0, bhi = size;
+    if (size > split_bytes) {
+      blo = (size_t)(size * ((lo - start) / trip_count)) & ~(page_size - 1);
+      bhi = hi == end ? size
+                      : (size_t)(size * ((hi - start) / trip_count)) &
+                            ~(page_size - 1);
+      if (bhi <= blo)
+        continue;
+    } else if (to_host || lo != start)
+      continue;
+    // Write-only data will be overwritten by the kernel.
+    if (not to_host && access == KITRT_MEM_ACCESS_WRITE_ONLY)
+      continue;
+
+    CUstream stream = (CUstream)prefetch_stream;
+    KitRTProfileScope profile(to_host ? KITRT_PROFILE_TO_HOST
+                                      : KITRT_PROFILE_TO_DEVICE,
+                              "prefetch");
+    profile.set_bytes(bhi - blo);
+    profile.record_start(&_kitcuda_profile_ops, stream);
+    CU_SAFE_CALL(cuMemPrefetchAsync_p((CUdeviceptr)base + blo, bhi - blo,
+                                      to_host ? CU_DEVICE_CPU
+                                              : _kitcuda_device,
+                                      stream));
+    profile.record_end(stream);
+    __kitrt_count_mem_site(base,
+                           to_host ? KITRT_SITE_PREFETCH_TO_HOST
+                                   : KITRT_SITE_PREFETCH_TO_DEVICE,
+                           bhi - blo);
+  }
+}
+
+void __kitcuda_mem_release_pending(void *opaque_stream) {
+  std::lock_guard<std::mutex> lock(_kitcuda_pending_mutex);
+  auto it = _kitcuda_pending_maps.find((CUstream)opaque_stream);
+  if (it == _kitcuda_pending_maps.end())
+    return;
+  // The data has been (at least partly) moved back to the host.
+  for (auto &map : it->second)
+    __kitrt_set_mem_prefetch(map.first, false);
+  it->second.clear();
+}
+
+void __kitcuda_mem_flush_mirrors(void *opaque_stream) {
+  if (not _kitcuda_device_resident)
+    return;
+  KIT_NVTX_PUSH("kitcuda:mem_flush_mirrors", KIT_NVTX_MEM);
+  std::lock_guard<std::mutex> lock(_kitcuda_mirror_mutex);
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kitcuda_mirror_refs)
+      _kitcuda_mem_flush_refs(entry.first, entry.second);
+  } else {
+    auto it = _kitcuda_mirror_refs.find((CUstream)opaque_stream);
+    if (it != _kitcuda_mirror_refs.end())
+      _kitcuda_mem_flush_refs(it->first, it->second);
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_mem_release_mirrors(void *opaque_stream) {
+  if (not _kitcuda_device_resident)
+    return;
+  // The host may freely modify the data once it has been returned.
+  // The device copies stay current until it does: either the program
+  // reports its writes (see __kitcuda_use_explicit_host_writes()) or
+  // they are tracked (see _kitcuda_mem_track_host_writes()).  Otherwise
+  // allocations are copied to the device again before their next use
+  // by a kernel.
+  KIT_NVTX_PUSH("kitcuda:mem_release_mirrors", KIT_NVTX_MEM);
+  std::lock_guard<std::mutex> lock(_kitcuda_mirror_mutex);
+  auto release = [](KitCudaMirrorRefs &refs) {
+    for (auto &ref : refs) {
+      size_t size = 0;
+      if (__kitrt_get_mem_mirror(ref.first, nullptr, &size) == nullptr)
+        continue; // freed while in flight...
+      if (_kitcuda_explicit_host_writes)
+        continue;
+      if (not _kitcuda_mem_track_host_writes(ref.first, size))
+        __kitrt_mark_mem_needs_prefetch(ref.first);
+    }
+    refs.clear();
+  };
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kitcuda_mirror_refs)
+      release(entry.second);
+  } else {
+    auto it = _kitcuda_mirror_refs.find((CUstream)opaque_stream);
+    if (it != _kitcuda_mirror_refs.end())
+      release(it->second);
+  }
+  KIT_NVTX_POP();
+}
+
+void *__kitcuda_mem_reduce_map(void *vp, uint64_t size,
+                               void **opaque_stream) {
+  assert(vp && "unexpected null pointer!");
+  assert(opaque_stream && "unexpected null stream pointer!");
+  if (size > KITCUDA_REDUCE_CELL_SIZE) {
+    fprintf(stderr, "kitcuda: unsupported reduction size (%ld bytes).\n",
+            (long)size);
+    exit(EXIT_FAILURE);
+  }
+
+  KIT_NVTX_PUSH("kitcuda:mem_reduce_map", KIT_NVTX_MEM);
+  CUcontext cu_context;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&cu_context));
+  if (cu_context == NULL)
+    CU_SAFE_CALL(cuCtxSetCurrent_p(_kitcuda_context));
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_thread_stream();
+  CUstream cu_stream = (CUstream)*opaque_stream;
+
+  std::lock_guard<std::mutex> lock(_kitcuda_reduce_mutex);
+  if (_kitcuda_reduce_cells.empty()) {
+    CUdeviceptr slab;
+    CU_SAFE_CALL(cuMemAlloc_v2_p(
+        &slab, KITCUDA_REDUCE_CELL_SIZE * KITCUDA_REDUCE_CELLS_PER_SLAB));
+    _kitcuda_reduce_slabs.push_back(slab);
+    for (unsigned i = 0; i < KITCUDA_REDUCE_CELLS_PER_SLAB; i++)
+      _kitcuda_reduce_cells.push_back(slab + i * KITCUDA_REDUCE_CELL_SIZE);
+  }
+  CUdeviceptr cell = _kitcuda_reduce_cells.back();
+  _kitcuda_reduce_cells.pop_back();
+
+  // The kernel combines its result with the host variable's current
+  // value (e.g., the reduction's identity).
+  CU_SAFE_CALL(cuMemcpyHtoDAsync_v2_p(cell, vp, size, cu_stream));
+  _kitcuda_reduce_refs[cu_stream].push_back({cell, vp, size});
+  _kitcuda_num_reduce_refs.fetch_add(1, std::memory_order_relaxed);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: mapped reduction result [address=%p, "
+            "size=%ld, stream=%p].\n", vp, (long)size, (void *)cu_stream);
+  KIT_NVTX_POP();
+  return (void *)cell;
+}
+
+void __kitcuda_mem_flush_reductions(void *opaque_stream) {
+  if (_kitcuda_num_reduce_refs.load(std::memory_order_relaxed) == 0)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_reduce_mutex);
+  auto flush = [](CUstream stream, const KitCudaReduceRefs &refs) {
+    for (const KitCudaReduceRef &ref : refs)
+      CU_SAFE_CALL(cuMemcpyDtoHAsync_v2_p(ref.host_ptr, ref.cell, ref.size,
+                                          stream));
+  };
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kitcuda_reduce_refs)
+      flush(entry.first, entry.second);
+  } else {
+    auto it = _kitcuda_reduce_refs.find((CUstream)opaque_stream);
+    if (it != _kitcuda_reduce_refs.end())
+      flush(it->first, it->second);
+  }
+}
+
+void __kitcuda_mem_release_reductions(void *opaque_stream) {
+  if (_kitcuda_num_reduce_refs.load(std::memory_order_relaxed) == 0)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_reduce_mutex);
+  auto release = [](KitCudaReduceRefs &refs) {
+    for (const KitCudaReduceRef &ref : refs)
+      _kitcuda_reduce_cells.push_back(ref.cell);
+    _kitcuda_num_reduce_refs.fetch_sub(refs.size(),
+                                       std::memory_order_relaxed);
+    refs.clear();
+  };
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kitcuda_reduce_refs)
+      release(entry.second);
+  } else {
+    auto it = _kitcuda_reduce_refs.find((CUstream)opaque_stream);
+    if (it != _kitcuda_reduce_refs.end())
+      release(it->second);
+  }
+}
+
+void __kitcuda_destroy_reductions() {
+  std::lock_guard<std::mutex> lock(_kitcuda_reduce_mutex);
+  for (CUdeviceptr slab : _kitcuda_reduce_slabs)
+    CU_SAFE_CALL(cuMemFree_v2_p(slab));
+  _kitcuda_reduce_slabs.clear();
+  _kitcuda_reduce_cells.clear();
+  _kitcuda_reduce_refs.clear();
+}
+
 void __kitcuda_memcpy_sym_to_device(void *hostPtr, uint64_t devPtr,
                                     size_t size) {
   assert(devPtr != 0 && "unexpected null device pointer!");
@@ -349,7 +1988,79 @@ void __kitcuda_memcpy_sym_to_device(void *hostPtr, uint64_t devPtr,
   assert(size != 0 && "requested a 0 byte copy!");
 
   KIT_NVTX_PUSH("kitcuda:memcpy_sym_to_device", KIT_NVTX_MEM);
+  // Kernels already launched in program order must see the previous
+  // value of the symbol.
+  __kitcuda_graph_flush(nullptr);
   CU_SAFE_CALL(cuMemcpyHtoD_v2_p(devPtr, hostPtr, size));
   KIT_NVTX_POP();
 }
+
+void __kitcuda_update_globals(void *fat_bin, const char *block_name,
+                              const KitCudaGlobalEntry *entries,
+                              int num_entries, uint64_t block_size,
+                              void **handle, void **opaque_stream) {
+  assert(fat_bin && "unexpected null fat binary!");
+  assert(entries && num_entries > 0 && "no globals to update!");
+  assert(handle && "unexpected null handle!");
+
+  KIT_NVTX_PUSH("kitcuda:update_globals", KIT_NVTX_MEM);
+  std::lock_guard<std::mutex> lock(_kitcuda_globals_mutex);
+  KitCudaGlobalBlock *block = (KitCudaGlobalBlock *)*handle;
+  bool first_update = block == nullptr;
+  if (first_update) {
+    // Resolve the device-side block once; the shadow holds the values
+    // most recently sent to the device.
+    block = new KitCudaGlobalBlock;
+    block->dev_ptr = __kitcuda_get_global_symbol(fat_bin, block_name);
+    block->shadow = (char *)calloc(block_size, 1);
+    block->size = block_size;
+    *handle = block;
+  }
+
+  // Find the range of the block whose host values have changed since
+  // the last update.  It is most often empty.
+  uint64_t lo = block->size, hi = 0;
+  for (int i = 0; i < num_entries; i++) {
+    const KitCudaGlobalEntry &entry = entries[i];
+    char *shadow = block->shadow + entry.offset;
+    if (first_update || memcmp(shadow, entry.host_ptr, entry.size) != 0) {
+      memcpy(shadow, entry.host_ptr, entry.size);
+      lo = std::min(lo, entry.offset);
+      hi = std::max(hi, entry.offset + entry.size);
+    }
+  }
+
+  if (lo < hi) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: updating device globals '%s' "
+              "[bytes %lu-%lu of %lu].\n", block_name, (unsigned long)lo,
+              (unsigned long)hi, (unsigned long)block->size);
+    if (opaque_stream != nullptr) {
+      // The copy is ordered on the launch's stream (commands queued
+      // earlier on it still see the previous values).  The source is
+      // pageable memory, so it is staged before the call returns and
+      // the shadow may be updated again right away.
+      if (*opaque_stream == nullptr)
+        *opaque_stream = __kitcuda_get_thread_stream();
+      __kitcuda_graph_flush(*opaque_stream);
+      CU_SAFE_CALL(cuMemcpyHtoDAsync_v2_p(block->dev_ptr + lo,
+                                          block->shadow + lo, hi - lo,
+                                          (CUstream)*opaque_stream));
+    } else {
+      __kitcuda_graph_flush(nullptr);
+      CU_SAFE_CALL(cuMemcpyHtoD_v2_p(block->dev_ptr + lo, block->shadow + lo,
+                                     hi - lo));
+    }
+  }
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_destroy_globals(void *handle) {
+  std::lock_guard<std::mutex> lock(_kitcuda_globals_mutex);
+  KitCudaGlobalBlock *block = (KitCudaGlobalBlock *)handle;
+  if (block != nullptr) {
+    free(block->shadow);
+    delete block;
+  }
+}
 }
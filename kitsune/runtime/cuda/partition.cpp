@@ -0,0 +1,286 @@
+//===- partition.cpp - Kitsune runtime CUDA GPU partitions  --------------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <ctype.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+// Ensembles of small jobs often share a device, either as clients of
+// the MPS server (with an active thread percentage and a pinned memory
+// limit per client) or as green contexts that each own a subset of the
+// device's multiprocessors.  The runtime sizes its launches to the
+// partition it has been given rather than to the whole device, and it
+// keeps its managed memory within a per-process budget so co-scheduled
+// jobs do not evict each other's pages.
+//
+// A partition is found in one of two ways:
+//
+//  - It is created by the runtime when KITCUDA_PARTITION_SMS is set.
+//    Under MPS this is a context with an SM count execution affinity,
+//    otherwise (CUDA 12.4 and later) a green context built from a
+//    split of the device's SM resource.
+//  - It is imposed from outside, by the MPS server.  The SM count of
+//    the context is then read back from its execution affinity or, for
+//    older servers, derived from CUDA_MPS_ACTIVE_THREAD_PERCENTAGE.
+static CUcontext _kitcuda_partition_ctx = nullptr;
+#if CUDA_VERSION >= 12040
+static CUgreenCtx _kitcuda_green_ctx = nullptr;
+#endif
+
+// The device memory budget, and the managed slabs of the memory pool
+// that have been placed on the device within it (by base address).
+static uint64_t _kitcuda_mem_budget = 0;
+static uint64_t _kitcuda_mem_budget_used = 0;
+static std::unordered_map<void *, size_t> _kitcuda_budget_slabs;
+static std::mutex _kitcuda_budget_mutex;
+
+// Create a context limited to num_sms multiprocessors with an MPS
+// execution affinity.  This fails unless the process is an MPS client.
+static CUcontext _kitcuda_create_affinity_context(CUdevice device,
+                                                  int num_sms) {
+  int supported = 0;
+  if (cuDeviceGetExecAffinitySupport_p(&supported,
+                                       CU_EXEC_AFFINITY_TYPE_SM_COUNT,
+                                       device) != CUDA_SUCCESS ||
+      !supported)
+    return nullptr;
+  CUexecAffinityParam param;
+  param.type = CU_EXEC_AFFINITY_TYPE_SM_COUNT;
+  param.param.smCount.val = num_sms;
+  CUcontext ctx;
+  if (cuCtxCreate_v3_p(&ctx, &param, 1, CU_CTX_SCHED_AUTO, device) !=
+      CUDA_SUCCESS)
+    return nullptr;
+  return ctx;
+}
+
+// Create a green context that owns (at least) num_sms of the device's
+// multiprocessors.  The driver rounds the count up to its SM group
+// granularity.
+static CUcontext _kitcuda_create_green_context(CUdevice device, int num_sms) {
+#if CUDA_VERSION >= 12040
+  if (!cuDeviceGetDevResource_p || !cuDevSmResourceSplitByCount_p ||
+      !cuDevResourceGenerateDesc_p || !cuGreenCtxCreate_p ||
+      !cuCtxFromGreenCtx_p)
+    return nullptr;
+  CUdevResource sms, part, rest;
+  if (cuDeviceGetDevResource_p(device, &sms, CU_DEV_RESOURCE_TYPE_SM) !=
+      CUDA_SUCCESS)
+    return nullptr;
+  unsigned groups = 1;
+  if (cuDevSmResourceSplitByCount_p(&part, &groups, &sms, &rest, 0,
+                                    num_sms) != CUDA_SUCCESS ||
+      groups == 0)
+    return nullptr;
+  CUdevResourceDesc desc;
+  if (cuDevResourceGenerateDesc_p(&desc, &part, 1) != CUDA_SUCCESS)
+    return nullptr;
+  CUgreenCtx green;
+  if (cuGreenCtxCreate_p(&green, desc, device,
+                         CU_GREEN_CTX_DEFAULT_STREAM) != CUDA_SUCCESS)
+    return nullptr;
+  CUcontext ctx;
+  if (cuCtxFromGreenCtx_p(&ctx, green) != CUDA_SUCCESS) {
+    CU_SAFE_CALL(cuGreenCtxDestroy_p(green));
+    return nullptr;
+  }
+  _kitcuda_green_ctx = green;
+  return ctx;
+#else
+  (void)device;
+  (void)num_sms;
+  return nullptr;
+#endif
+}
+
+// Parse a byte count with an optional K, M, G or T suffix.
+static uint64_t _kitcuda_parse_bytes(const char *text) {
+  char *end;
+  uint64_t bytes = strtoull(text, &end, 10);
+  switch (toupper(*end)) {
+  case 'T':
+    bytes <<= 10;
+    [[fallthrough]];
+  case 'G':
+    bytes <<= 10;
+    [[fallthrough]];
+  case 'M':
+    bytes <<= 10;
+    [[fallthrough]];
+  case 'K':
+    bytes <<= 10;
+    break;
+  }
+  return bytes;
+}
+
+// Return the device memory limit the MPS server imposes on the given
+// device, or zero.  CUDA_MPS_PINNED_DEVICE_MEM_LIMIT is a list of
+// "<device>=<bytes>" entries, e.g. "0=2G,1=512M".
+static uint64_t _kitcuda_mps_mem_limit(int device_id) {
+  const char *limits = __kitrt_get_config("CUDA_MPS_PINNED_DEVICE_MEM_LIMIT");
+  if (limits == nullptr)
+    return 0;
+  const char *entry = limits;
+  while (*entry) {
+    char *eq;
+    long id = strtol(entry, &eq, 10);
+    if (*eq != '=')
+      break;
+    if (id == device_id)
+      return _kitcuda_parse_bytes(eq + 1);
+    entry = strchr(eq, ',');
+    if (entry == nullptr)
+      break;
+    entry++;
+  }
+  return 0;
+}
+
+extern "C" {
+
+CUcontext __kitcuda_create_partition(CUdevice device, int num_sms) {
+  assert(_kitcuda_partition_ctx == nullptr && "partition already created!");
+  assert(num_sms > 0 && "partition requires a positive SM count!");
+  CUcontext ctx = _kitcuda_create_affinity_context(device, num_sms);
+  const char *kind = "MPS";
+  if (ctx == nullptr) {
+    ctx = _kitcuda_create_green_context(device, num_sms);
+    kind = "green context";
+  }
+  if (ctx == nullptr) {
+    fprintf(stderr, "kitcuda: warning, unable to create a %d SM partition "
+                    "(requires an MPS client or CUDA 12.4); using the whole "
+                    "device.\n", num_sms);
+    return nullptr;
+  }
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "  kitcuda: created a %d SM partition (%s).\n", num_sms,
+            kind);
+  _kitcuda_partition_ctx = ctx;
+  return ctx;
+}
+
+int __kitcuda_query_partition_sms(int device_sms) {
+  // The execution affinity of the current context reflects both the
+  // partitions the runtime creates and the limit of an MPS server.
+  CUexecAffinityParam param;
+  if (cuCtxGetExecAffinity_p(&param, CU_EXEC_AFFINITY_TYPE_SM_COUNT) ==
+          CUDA_SUCCESS &&
+      param.param.smCount.val > 0 &&
+      (int)param.param.smCount.val < device_sms)
+    return param.param.smCount.val;
+#if CUDA_VERSION >= 12040
+  if (_kitcuda_green_ctx) {
+    CUdevResource sms;
+    if (cuGreenCtxGetDevResource_p &&
+        cuGreenCtxGetDevResource_p(_kitcuda_green_ctx, &sms,
+                                   CU_DEV_RESOURCE_TYPE_SM) == CUDA_SUCCESS &&
+        sms.sm.smCount > 0)
+      return sms.sm.smCount;
+  }
+#endif
+  unsigned percent = 100;
+  if (__kitrt_get_env_value("CUDA_MPS_ACTIVE_THREAD_PERCENTAGE", percent) &&
+      percent > 0 && percent < 100)
+    return (device_sms * percent + 99) / 100;
+  return device_sms;
+}
+
+void __kitcuda_destroy_partition() {
+  if (_kitcuda_partition_ctx == nullptr)
+    return;
+#if CUDA_VERSION >= 12040
+  if (_kitcuda_green_ctx) {
+    CU_SAFE_CALL(cuGreenCtxDestroy_p(_kitcuda_green_ctx));
+    _kitcuda_green_ctx = nullptr;
+  } else
+#endif
+    CU_SAFE_CALL(cuCtxDestroy_v2_p(_kitcuda_partition_ctx));
+  _kitcuda_partition_ctx = nullptr;
+}
+
+void __kitcuda_set_mem_budget(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(_kitcuda_budget_mutex);
+  _kitcuda_mem_budget = bytes;
+}
+
+uint64_t __kitcuda_get_mem_budget() {
+  return _kitcuda_mem_budget;
+}
+
+uint64_t __kitcuda_default_mem_budget(int device_id) {
+  return _kitcuda_mps_mem_limit(device_id);
+}
+
+bool __kitcuda_mem_budget_place(void *slab, size_t size) {
+  std::lock_guard<std::mutex> lock(_kitcuda_budget_mutex);
+  if (_kitcuda_mem_budget != 0 &&
+      _kitcuda_mem_budget_used + size > _kitcuda_mem_budget)
+    return false;
+  _kitcuda_mem_budget_used += size;
+  _kitcuda_budget_slabs[slab] = size;
+  return true;
+}
+
+void __kitcuda_mem_budget_release(void *slab) {
+  std::lock_guard<std::mutex> lock(_kitcuda_budget_mutex);
+  auto it = _kitcuda_budget_slabs.find(slab);
+  if (it == _kitcuda_budget_slabs.end())
+    return;
+  _kitcuda_mem_budget_used -= it->second;
+  _kitcuda_budget_slabs.erase(it);
+}
+
+} // extern "C"
@@ -0,0 +1,221 @@
+//===- persist.cpp - Kitsune runtime CUDA L2 persistence windows ---------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include "memory_map.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+
+// On devices with a persisting L2 region (Ampere and later) a part of
+// the L2 can be set aside for the data of an access policy window, so
+// that a hot array (a coefficient table, a connectivity array, ...)
+// that every kernel of a timestep reads stays resident across the
+// launches rather than being evicted by the data streamed through.
+//
+// The runtime keeps a single window: the allocation given by
+// __kitcuda_mem_persist() or, without a hint, the read-only allocation
+// that the most launches have mapped in the current phase.  Windows are
+// stream attributes, so the window is set on each stream as it is
+// handed out for a launch (see __kitcuda_get_thread_stream()); a
+// generation count tells the streams that are out of date apart.  The
+// window is dropped (and the persisting lines released) at a phase
+// boundary, see __kitcuda_mem_persist_reset().
+struct KitCudaPersistWindow {
+  void *host_base;       // the allocation in the runtime's memory map.
+  CUdeviceptr dev_base;  // where kernels access it.
+  size_t bytes;          // the size of the window.
+  bool hinted;           // set by __kitcuda_mem_persist().
+};
+
+static bool _kitcuda_auto_persist = true;
+static unsigned _kitcuda_persist_launches = 4;
+static KitCudaPersistWindow _kitcuda_persist_window = {nullptr, 0, 0, false};
+static size_t _kitcuda_persist_set_aside = 0;
+// Zero until a window is first selected, so launches before that (and
+// programs that never persist data) skip the stream updates.
+static std::atomic<unsigned> _kitcuda_persist_generation(0);
+// The generation of the window last set on each stream.
+static std::unordered_map<CUstream, unsigned> _kitcuda_persist_streams;
+// The number of launches that read each candidate allocation.
+static std::unordered_map<void *, unsigned> _kitcuda_persist_uses;
+static std::mutex _kitcuda_persist_mutex;
+
+// Select the window; the mutex must be held.
+static void _kitcuda_persist_select(void *host_base, CUdeviceptr dev_base,
+                                    size_t size, bool hinted) {
+  const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+  size_t bytes = std::min(size, (size_t)props->max_access_window_bytes);
+  size_t set_aside = std::min(bytes, (size_t)props->max_persisting_l2_bytes);
+  if (set_aside != _kitcuda_persist_set_aside) {
+    CU_SAFE_CALL(cuCtxSetLimit_p(CU_LIMIT_PERSISTING_L2_CACHE_SIZE,
+                                 set_aside));
+    _kitcuda_persist_set_aside = set_aside;
+  }
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: persist %s data in L2 [address=%p, "
+            "size=%ld, window=%ld, set-aside=%ld].\n",
+            hinted ? "hinted" : "hot", host_base, size, bytes, set_aside);
+  _kitcuda_persist_window = {host_base, dev_base, bytes, hinted};
+  _kitcuda_persist_generation.fetch_add(1, std::memory_order_release);
+}
+
+// Drop the window; the mutex must be held.
+static void _kitcuda_persist_clear() {
+  if (_kitcuda_persist_window.bytes == 0)
+    return;
+  _kitcuda_persist_window = {nullptr, 0, 0, false};
+  _kitcuda_persist_generation.fetch_add(1, std::memory_order_release);
+  // Release the lines of the old window for normal use.
+  CU_SAFE_CALL(cuCtxResetPersistingL2Cache_p());
+}
+
+extern "C" {
+
+void __kitcuda_use_auto_persist(bool enable, unsigned num_launches) {
+  _kitcuda_auto_persist = enable;
+  if (num_launches > 0)
+    _kitcuda_persist_launches = num_launches;
+}
+
+void __kitcuda_mem_persist(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  if (__kitcuda_get_device_props()->max_persisting_l2_bytes == 0)
+    return;
+  size_t size = 0;
+  void *base = vp;
+  (void)__kitrt_get_mem_residency(vp, &size, &base);
+  if (size == 0)
+    return;
+  void *mirror = __kitrt_get_mem_mirror(base);
+  CUdeviceptr dev_base = (CUdeviceptr)(mirror ? mirror : base);
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  _kitcuda_persist_select(base, dev_base, size, true);
+}
+
+void __kitcuda_mem_persist_note(void *base, void *dev_base, size_t size) {
+  if (not _kitcuda_auto_persist || size == 0)
+    return;
+  const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+  // Larger arrays would only churn the set-aside lines.
+  if (size > (size_t)props->max_persisting_l2_bytes)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  KitCudaPersistWindow &window = _kitcuda_persist_window;
+  if (window.hinted || window.host_base == base)
+    return;
+  unsigned uses = ++_kitcuda_persist_uses[base];
+  if (uses < _kitcuda_persist_launches)
+    return;
+  // Only take over from another hot allocation that is clearly hotter,
+  // so two tables used as often do not trade the window back and forth.
+  if (window.bytes > 0 && uses <= 2 * _kitcuda_persist_uses[window.host_base])
+    return;
+  _kitcuda_persist_select(base, (CUdeviceptr)dev_base, size, false);
+}
+
+void __kitcuda_mem_persist_apply(void *opaque_stream, bool new_stream) {
+  unsigned generation =
+      _kitcuda_persist_generation.load(std::memory_order_acquire);
+  if (generation == 0)
+    return;
+  CUstream cu_stream = (CUstream)opaque_stream;
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  // A new stream may reuse the handle of one that was destroyed.
+  unsigned &applied = _kitcuda_persist_streams[cu_stream];
+  if (new_stream)
+    applied = 0;
+  generation = _kitcuda_persist_generation.load(std::memory_order_relaxed);
+  if (applied == generation)
+    return;
+  const KitCudaPersistWindow &window = _kitcuda_persist_window;
+  CUstreamAttrValue value = {};
+  value.accessPolicyWindow.base_ptr = (void *)window.dev_base;
+  value.accessPolicyWindow.num_bytes = window.bytes;
+  if (window.bytes > 0) {
+    value.accessPolicyWindow.hitRatio =
+        std::min(1.0f, (float)_kitcuda_persist_set_aside / window.bytes);
+    value.accessPolicyWindow.hitProp = CU_ACCESS_PROPERTY_PERSISTING;
+    value.accessPolicyWindow.missProp = CU_ACCESS_PROPERTY_STREAMING;
+  } else {
+    value.accessPolicyWindow.hitProp = CU_ACCESS_PROPERTY_NORMAL;
+    value.accessPolicyWindow.missProp = CU_ACCESS_PROPERTY_NORMAL;
+  }
+  CU_SAFE_CALL(cuStreamSetAttribute_p(
+      cu_stream, CU_STREAM_ATTRIBUTE_ACCESS_POLICY_WINDOW, &value));
+  applied = generation;
+}
+
+void __kitcuda_mem_persist_reset() {
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  _kitcuda_persist_uses.clear();
+  _kitcuda_persist_clear();
+}
+
+void __kitcuda_mem_persist_forget(void *base) {
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  _kitcuda_persist_uses.erase(base);
+  if (_kitcuda_persist_window.host_base == base)
+    _kitcuda_persist_clear();
+}
+
+void __kitcuda_destroy_persist() {
+  std::lock_guard<std::mutex> lock(_kitcuda_persist_mutex);
+  _kitcuda_persist_streams.clear();
+  _kitcuda_persist_uses.clear();
+  _kitcuda_persist_window = {nullptr, 0, 0, false};
+  _kitcuda_persist_set_aside = 0;
+  _kitcuda_persist_generation.store(0, std::memory_order_relaxed);
+}
+
+} // extern "C"
@@ -0,0 +1,381 @@
+//===- persistent.cpp - Kitsune runtime CUDA persistent kernel support ----===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Small kernels spend most of their time in the launch itself: the
+// driver's launch path costs several microseconds and a timestep loop
+// that issues dozens of short foralls can be dominated by it.  When
+// persistent kernels are enabled (and the compiler generated a worker
+// kernel, see -cuabi-persistent-kernels) the runtime keeps the
+// module's worker resident on the device and turns small launches of
+// its (grid-stride) kernels into pushes onto a work queue in
+// host-mapped memory.  A push is a handful of host stores; the worker
+// polls the queue, runs each item's kernel body with its whole grid
+// and publishes the sequence number of the last completed item.
+//
+// Items run in the order they are pushed and one at a time.  Ordering
+// with the rest of the runtime is kept by joining the queue (waiting
+// for every pushed item to complete) before any other launch and
+// before a stream is synchronized.  A kernel is only pushed when its
+// stream is idle so that the copies and prefetches issued for its
+// arguments are complete.
+//
+// The worker never exits on its own, so it has to be stopped before
+// anything that waits on the whole device: a context synchronization,
+// a free that goes back to the driver or a push for the kernels of
+// another module (only one worker runs at a time).  Its grid has a
+// single block per multiprocessor and leaves room for other kernels.
+// The worker is launched cooperatively: the driver then guarantees
+// that all of its blocks are resident at once (or fails the launch)
+// rather than leaving some of them queued behind other kernels.
+
+namespace {
+
+// The layout of the work queue; this must match the persistent worker
+// generated by the compiler (see CudaABI.cpp).
+const unsigned KITCUDA_PK_QUEUE_DEPTH = 64;
+const unsigned KITCUDA_PK_ARG_BYTES = 256;
+const int KITCUDA_PK_THREADS_PER_BLK = 256;
+
+struct KitCudaPKItem {
+  uint64_t seq;   // the item's sequence number once it is ready.
+  uint64_t index; // the index of the kernel within its module.
+  uint64_t args[KITCUDA_PK_ARG_BYTES / 8];
+};
+
+struct KitCudaPKQueue {
+  uint64_t stop;      // set to have the worker exit.
+  uint64_t completed; // the sequence number of the last completed item.
+  uint64_t header_pad[6];
+  KitCudaPKItem items[KITCUDA_PK_QUEUE_DEPTH];
+};
+
+static_assert(offsetof(KitCudaPKQueue, items) == 64,
+              "persistent queue header does not match the worker!");
+static_assert(sizeof(KitCudaPKItem) == 16 + KITCUDA_PK_ARG_BYTES,
+              "persistent work item does not match the worker!");
+
+// The kernels of a module that its worker can run and the layout of
+// their arguments: the number of arguments followed by the offset
+// and size of each within an item.
+struct KitCudaPKModule {
+  std::string worker_name;
+  std::unordered_map<std::string, int> kernels;
+  std::vector<const uint32_t *> layouts;
+  bool disabled = false; // the worker can not be made resident.
+};
+
+// The default limit on the iterations of a pushed launch; larger
+// launches amortize their launch overheads.
+const uint64_t KITCUDA_PK_DEFAULT_MAX_TRIPS = 1 << 18;
+
+static bool _kitcuda_use_persistent = false;
+static uint64_t _kitcuda_pk_max_trips = KITCUDA_PK_DEFAULT_MAX_TRIPS;
+
+// Registered modules (by fat binary); the registry mutex is only held
+// for lookups so it can be taken while creating launch descriptors.
+static std::map<const void *, KitCudaPKModule> _kitcuda_pk_modules;
+static std::mutex _kitcuda_pk_registry_mutex;
+
+// The queue and the running worker.  The queue is allocated on first
+// use and reused by every worker; sequence numbers keep increasing
+// across workers so stale items never look ready.
+static KitCudaPKQueue *_kitcuda_pk_queue = nullptr;
+static CUdeviceptr _kitcuda_pk_device_queue = 0;
+static CUdeviceptr _kitcuda_pk_arrivals = 0;
+static CUstream _kitcuda_pk_stream = nullptr;
+static const void *_kitcuda_pk_running = nullptr; // the worker's module.
+static uint64_t _kitcuda_pk_next_seq = 1;
+static std::atomic<uint64_t> _kitcuda_pk_pushed{0};
+static std::mutex _kitcuda_pk_mutex;
+
+uint64_t load_completed() {
+  return __atomic_load_n(&_kitcuda_pk_queue->completed, __ATOMIC_ACQUIRE);
+}
+
+// Abort if the worker has exited while items are outstanding (i.e.,
+// a kernel body faulted).
+void check_worker() {
+  CUresult status = cuStreamQuery_p(_kitcuda_pk_stream);
+  if (status == CUDA_ERROR_NOT_READY)
+    return;
+  CU_SAFE_CALL(status);
+  fprintf(stderr, "kitcuda: persistent worker exited unexpectedly!\n");
+  abort();
+}
+
+// Wait until the item with the given sequence number has completed.
+void wait_completed(uint64_t seq) {
+  for (unsigned polls = 1; load_completed() < seq; polls++)
+    if (polls % 4096 == 0)
+      check_worker();
+}
+
+// Stop the running worker once it has completed all pushed items.
+// Must be called with the persistent mutex held.
+void stop_worker() {
+  if (_kitcuda_pk_running == nullptr)
+    return;
+  KIT_NVTX_PUSH("kitcuda:persistent_stop", KIT_NVTX_LAUNCH);
+  wait_completed(_kitcuda_pk_pushed.load(std::memory_order_acquire));
+  __atomic_store_n(&_kitcuda_pk_queue->stop, 1, __ATOMIC_RELEASE);
+  CU_SAFE_CALL(cuStreamSynchronize_p(_kitcuda_pk_stream));
+  _kitcuda_pk_running = nullptr;
+  KIT_NVTX_POP();
+}
+
+// Start the worker of the given module with its first item at the
+// given sequence number.  Returns false if the worker can not be
+// resident.  Must be called with the persistent mutex held.
+bool start_worker(const void *fat_bin, KitCudaPKModule &module,
+                  uint64_t first_seq) {
+  KIT_NVTX_PUSH("kitcuda:persistent_start", KIT_NVTX_LAUNCH);
+  if (_kitcuda_pk_queue == nullptr) {
+    void *vp;
+    CU_SAFE_CALL(cuMemHostAlloc_p(&vp, sizeof(KitCudaPKQueue),
+                                  CU_MEMHOSTALLOC_PORTABLE |
+                                      CU_MEMHOSTALLOC_DEVICEMAP));
+    memset(vp, 0, sizeof(KitCudaPKQueue));
+    _kitcuda_pk_queue = (KitCudaPKQueue *)vp;
+    CU_SAFE_CALL(
+        cuMemHostGetDevicePointer_v2_p(&_kitcuda_pk_device_queue, vp, 0));
+    CU_SAFE_CALL(cuMemAlloc_v2_p(&_kitcuda_pk_arrivals, sizeof(uint64_t)));
+    CU_SAFE_CALL(cuStreamCreate_p(&_kitcuda_pk_stream,
+                                  CU_STREAM_NON_BLOCKING));
+  }
+
+  // Every block of the grid must be resident at once: items complete
+  // only when all blocks have arrived.
+  CUfunction worker =
+      __kitcuda_get_kernel(fat_bin, module.worker_name.c_str());
+  const KitCudaDeviceProps *props = __kitcuda_get_device_props();
+  int blks_per_multiproc = 0;
+  CU_SAFE_CALL(cuOccupancyMaxActiveBlocksPerMultiprocessor_p(
+      &blks_per_multiproc, worker, KITCUDA_PK_THREADS_PER_BLK, 0));
+  if (blks_per_multiproc == 0 || not props->supports_coop_launch) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: persistent worker '%s' can not be "
+              "resident, using regular launches.\n",
+              module.worker_name.c_str());
+    module.disabled = true;
+    KIT_NVTX_POP();
+    return false;
+  }
+  int num_multiprocs = props->num_multiprocs;
+
+  __atomic_store_n(&_kitcuda_pk_queue->stop, 0, __ATOMIC_RELEASE);
+  // The arrival count restarts with the worker's item count.
+  CU_SAFE_CALL(cuMemsetD8Async_p(_kitcuda_pk_arrivals, 0, sizeof(uint64_t),
+                                 _kitcuda_pk_stream));
+  void *args[] = {&_kitcuda_pk_device_queue, &_kitcuda_pk_arrivals,
+                  &first_seq};
+  CUresult result = cuLaunchCooperativeKernel_p(
+      worker, num_multiprocs, 1, 1, KITCUDA_PK_THREADS_PER_BLK, 1, 1, 0,
+      _kitcuda_pk_stream, args);
+  if (result == CUDA_ERROR_COOPERATIVE_LAUNCH_TOO_LARGE) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitcuda: persistent worker '%s' can not be "
+              "resident, using regular launches.\n",
+              module.worker_name.c_str());
+    module.disabled = true;
+    KIT_NVTX_POP();
+    return false;
+  }
+  CU_SAFE_CALL(result);
+  _kitcuda_pk_running = fat_bin;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: started persistent worker '%s' "
+            "[blocks: %d].\n", module.worker_name.c_str(), num_multiprocs);
+  KIT_NVTX_POP();
+  return true;
+}
+
+} // namespace
+
+extern "C" {
+
+void __kitcuda_register_persistent_kernels(const void *fat_bin,
+                                           const char *worker_name,
+                                           const char **kernel_names,
+                                           const uint32_t **layouts,
+                                           int num_kernels) {
+  assert(fat_bin && "kitcuda: register with null fat binary!");
+  std::lock_guard<std::mutex> lock(_kitcuda_pk_registry_mutex);
+  KitCudaPKModule &module = _kitcuda_pk_modules[fat_bin];
+  module.worker_name = worker_name;
+  for (int k = 0; k < num_kernels; k++) {
+    module.kernels[kernel_names[k]] = k;
+    module.layouts.push_back(layouts[k]);
+  }
+}
+
+void __kitcuda_use_persistent_kernels(bool enable, uint64_t max_trips) {
+  _kitcuda_use_persistent = enable;
+  __kitcuda_advance_launch_epoch();
+  if (max_trips != 0)
+    _kitcuda_pk_max_trips = max_trips;
+  if (__kitrt_verbose_mode() && enable)
+    fprintf(stderr, "kitcuda: persistent kernels enabled "
+            "[max trips: %lu].\n", _kitcuda_pk_max_trips);
+}
+
+bool __kitcuda_persistent_kernels_enabled() {
+  return _kitcuda_use_persistent;
+}
+
+uint64_t __kitcuda_get_persistent_max_trips() {
+  return _kitcuda_pk_max_trips;
+}
+
+int __kitcuda_persistent_kernel_index(const void *fat_bin,
+                                      const char *kernel_name) {
+  std::lock_guard<std::mutex> lock(_kitcuda_pk_registry_mutex);
+  auto it = _kitcuda_pk_modules.find(fat_bin);
+  if (it == _kitcuda_pk_modules.end())
+    return -1;
+  auto kit = it->second.kernels.find(kernel_name);
+  return kit == it->second.kernels.end() ? -1 : kit->second;
+}
+
+bool __kitcuda_persistent_launch(void *opaque_stream, const void *fat_bin,
+                                 int index, void **kern_args) {
+  assert(index >= 0 && "kitcuda: push of a non-persistent kernel!");
+  // The kernel must not start before the work already queued on its
+  // stream (e.g., the copies of its arguments).
+  CUresult status = cuStreamQuery_p((CUstream)opaque_stream);
+  if (status == CUDA_ERROR_NOT_READY)
+    return false;
+  CU_SAFE_CALL(status);
+
+  KIT_NVTX_PUSH("kitcuda:persistent_launch", KIT_NVTX_LAUNCH);
+  std::lock_guard<std::mutex> lock(_kitcuda_pk_mutex);
+  KitCudaPKModule *module;
+  {
+    std::lock_guard<std::mutex> registry_lock(_kitcuda_pk_registry_mutex);
+    module = &_kitcuda_pk_modules[fat_bin];
+  }
+  if (module->disabled) {
+    KIT_NVTX_POP();
+    return false;
+  }
+  uint64_t seq = _kitcuda_pk_next_seq;
+  if (_kitcuda_pk_running != fat_bin) {
+    stop_worker();
+    if (not start_worker(fat_bin, *module, seq)) {
+      KIT_NVTX_POP();
+      return false;
+    }
+  }
+  _kitcuda_pk_next_seq++;
+
+  // Wait for the item's slot to be free.
+  if (seq > KITCUDA_PK_QUEUE_DEPTH)
+    wait_completed(seq - KITCUDA_PK_QUEUE_DEPTH);
+  KitCudaPKItem &item =
+      _kitcuda_pk_queue->items[(seq - 1) % KITCUDA_PK_QUEUE_DEPTH];
+  item.index = index;
+  const uint32_t *layout = module->layouts[index];
+  for (uint32_t a = 0; a < layout[0]; a++)
+    memcpy((char *)item.args + layout[1 + 2 * a], kern_args[a],
+           layout[2 + 2 * a]);
+  // The item (and its arguments) must be visible before its sequence
+  // number.
+  __atomic_store_n(&item.seq, seq, __ATOMIC_RELEASE);
+  _kitcuda_pk_pushed.store(seq, std::memory_order_release);
+  KIT_NVTX_POP();
+  return true;
+}
+
+void __kitcuda_persistent_join() {
+  uint64_t pushed = _kitcuda_pk_pushed.load(std::memory_order_acquire);
+  if (pushed == 0 || load_completed() >= pushed)
+    return;
+  KIT_NVTX_PUSH("kitcuda:persistent_join", KIT_NVTX_LAUNCH);
+  wait_completed(pushed);
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_persistent_stop() {
+  if (not _kitcuda_use_persistent)
+    return;
+  std::lock_guard<std::mutex> lock(_kitcuda_pk_mutex);
+  stop_worker();
+}
+
+void __kitcuda_destroy_persistent() {
+  KIT_NVTX_PUSH("kitcuda:destroy_persistent", KIT_NVTX_CLEANUP);
+  std::lock_guard<std::mutex> lock(_kitcuda_pk_mutex);
+  stop_worker();
+  if (_kitcuda_pk_queue != nullptr) {
+    CU_SAFE_CALL(cuStreamDestroy_v2_p(_kitcuda_pk_stream));
+    CU_SAFE_CALL(cuMemFree_v2_p(_kitcuda_pk_arrivals));
+    CU_SAFE_CALL(cuMemFreeHost_p(_kitcuda_pk_queue));
+    _kitcuda_pk_queue = nullptr;
+  }
+  KIT_NVTX_POP();
+}
+
+} // extern "C"
@@ -0,0 +1,248 @@
+//===- shmem.cpp - Kitsune runtime CUDA symmetric memory ------------------===//
+// Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+//
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+
+#include "kitcuda.h"
+#include "kitcuda_dylib.h"
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// Symmetric memory for device-initiated communication (NVSHMEM).  An
+// allocation from the symmetric heap exists at the same offset on every
+// processing element (PE, one MPI rank and its GPU), so kernels can put
+// and get the data of other PEs directly (see kitsune_shmem.h).  The
+// compiler links NVSHMEM's device library into kernel modules that call
+// it (see -cuabi-shmem-bc).  Each such module holds the device state of
+// the library, which must be initialized once the module is loaded and
+// NVSHMEM is.  NVSHMEM is loaded on first use so the runtime does not
+// depend on it otherwise.
+//
+// NVSHMEM runs on the runtime's primary context: each PE uses a single
+// device.  It is bootstrapped as configured in the environment (e.g.,
+// NVSHMEM_BOOTSTRAP=MPI when the program uses MPI).
+//
+// The few NVSHMEM entry points used are declared here rather than taken
+// from its headers, which are not needed to build the runtime.
+
+extern "C" {
+void nvshmem_init(void);
+void nvshmem_finalize(void);
+void *nvshmem_malloc(size_t size);
+void nvshmem_free(void *ptr);
+int nvshmem_my_pe(void);
+int nvshmem_n_pes(void);
+void nvshmem_barrier_all(void);
+int nvshmemx_cumodule_init(CUmodule module);
+}
+
+namespace {
+
+decltype(nvshmem_init) *nvshmem_init_p;
+decltype(nvshmem_finalize) *nvshmem_finalize_p;
+decltype(nvshmem_malloc) *nvshmem_malloc_p;
+decltype(nvshmem_free) *nvshmem_free_p;
+decltype(nvshmem_my_pe) *nvshmem_my_pe_p;
+decltype(nvshmem_n_pes) *nvshmem_n_pes_p;
+decltype(nvshmem_barrier_all) *nvshmem_barrier_all_p;
+decltype(nvshmemx_cumodule_init) *nvshmemx_cumodule_init_p;
+
+const char *NVSHMEM_DSO_LIBNAME = "libnvshmem_host.so";
+
+// The global that holds the device state of NVSHMEM in a module linked
+// with its device library.
+const char *NVSHMEM_DEVICE_STATE = "nvshmemi_device_state_d";
+
+std::recursive_mutex _kitcuda_shmem_mutex;
+bool _kitcuda_shmem_initialized = false;
+// The modules (of the primary context) that use NVSHMEM, which are
+// initialized along with NVSHMEM if they are loaded before it is.
+std::vector<CUmodule> _kitcuda_shmem_modules;
+
+bool load_nvshmem_symbols() {
+  // A program linked with NVSHMEM already has it loaded.
+  void *kitrt_dl_handle = dlopen(NVSHMEM_DSO_LIBNAME, RTLD_LAZY | RTLD_GLOBAL);
+  if (kitrt_dl_handle == NULL) {
+    fprintf(stderr, "kitcuda: unable to open '%s' for symmetric memory: "
+                    "%s\n", NVSHMEM_DSO_LIBNAME, dlerror());
+    return false;
+  }
+  DLSYM_LOAD(nvshmem_init);
+  DLSYM_LOAD(nvshmem_finalize);
+  DLSYM_LOAD(nvshmem_malloc);
+  DLSYM_LOAD(nvshmem_free);
+  DLSYM_LOAD(nvshmem_my_pe);
+  DLSYM_LOAD(nvshmem_n_pes);
+  DLSYM_LOAD(nvshmem_barrier_all);
+  DLSYM_LOAD(nvshmemx_cumodule_init);
+  return true;
+}
+
+void init_shmem_module(CUmodule cu_module) {
+  if (nvshmemx_cumodule_init_p(cu_module) != 0) {
+    fprintf(stderr, "kitcuda: unable to initialize NVSHMEM for a "
+                    "kernel module.\n");
+    abort();
+  }
+}
+
+} // namespace
+
+extern "C" {
+
+void __kitcuda_shmem_init() {
+  std::lock_guard<std::recursive_mutex> lock(_kitcuda_shmem_mutex);
+  if (_kitcuda_shmem_initialized)
+    return;
+  __kitcuda_ensure_initialized();
+  if (not load_nvshmem_symbols())
+    abort();
+  CU_SAFE_CALL(cuCtxPushCurrent_v2_p(_kitcuda_context));
+  nvshmem_init_p();
+  for (CUmodule cu_module : _kitcuda_shmem_modules)
+    init_shmem_module(cu_module);
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+  _kitcuda_shmem_initialized = true;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitcuda: NVSHMEM initialized (PE %d of %d).\n",
+            nvshmem_my_pe_p(), nvshmem_n_pes_p());
+}
+
+void __kitcuda_shmem_finalize() {
+  std::lock_guard<std::recursive_mutex> lock(_kitcuda_shmem_mutex);
+  if (not _kitcuda_shmem_initialized)
+    return;
+  CU_SAFE_CALL(cuCtxPushCurrent_v2_p(_kitcuda_context));
+  // The kernels may still be using the symmetric heap.
+  CU_SAFE_CALL(cuCtxSynchronize_p());
+  nvshmem_finalize_p();
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+  _kitcuda_shmem_initialized = false;
+}
+
+int __kitcuda_shmem_my_pe() {
+  __kitcuda_shmem_init();
+  return nvshmem_my_pe_p();
+}
+
+int __kitcuda_shmem_n_pes() {
+  __kitcuda_shmem_init();
+  return nvshmem_n_pes_p();
+}
+
+void __kitcuda_shmem_barrier_all() {
+  __kitcuda_shmem_init();
+  CU_SAFE_CALL(cuCtxPushCurrent_v2_p(_kitcuda_context));
+  nvshmem_barrier_all_p();
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+}
+
+void *__kitcuda_mem_alloc_symmetric(size_t size) {
+  assert(size != 0 && "zero-valued size!");
+  KIT_NVTX_PUSH("kitcuda:mem_alloc_symmetric", KIT_NVTX_MEM);
+  __kitcuda_shmem_init();
+  CU_SAFE_CALL(cuCtxPushCurrent_v2_p(_kitcuda_context));
+  // nvshmem_malloc() is collective: every PE allocates the same size.
+  void *ptr = nvshmem_malloc_p(size);
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+  if (ptr == nullptr) {
+    fprintf(stderr, "kitcuda: unable to allocate %zu bytes of symmetric "
+                    "memory (see NVSHMEM_SYMMETRIC_SIZE).\n", size);
+    abort();
+  }
+  KIT_NVTX_POP();
+  return ptr;
+}
+
+void __kitcuda_mem_free_symmetric(void *ptr) {
+  if (ptr == nullptr)
+    return;
+  KIT_NVTX_PUSH("kitcuda:mem_free_symmetric", KIT_NVTX_MEM);
+  __kitcuda_persistent_stop();
+  CU_SAFE_CALL(cuCtxPushCurrent_v2_p(_kitcuda_context));
+  CU_SAFE_CALL(cuCtxSynchronize_p());
+  nvshmem_free_p(ptr);
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_shmem_attach_module(const void *fat_bin, CUmodule cu_module) {
+  (void)fat_bin;
+  CUdeviceptr sym_ptr;
+  size_t bytes;
+  if (cuModuleGetGlobal_v2_p(&sym_ptr, &bytes, cu_module,
+                             NVSHMEM_DEVICE_STATE) != CUDA_SUCCESS)
+    return;
+  CUcontext ctx;
+  CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
+  if (ctx != _kitcuda_context) {
+    fprintf(stderr, "kitcuda: kernels that use symmetric memory only run "
+                    "on the primary device.\n");
+    abort();
+  }
+  std::lock_guard<std::recursive_mutex> lock(_kitcuda_shmem_mutex);
+  _kitcuda_shmem_modules.push_back(cu_module);
+  if (_kitcuda_shmem_initialized)
+    init_shmem_module(cu_module);
+}
+
+void __kitcuda_destroy_shmem() {
+  // NVSHMEM must be finalized (collectively) before the context is
+  // reset; programs that also use MPI should finalize it themselves
+  // before MPI_Finalize() (see kitsune::shmem::finalize()).
+  __kitcuda_shmem_finalize();
+  _kitcuda_shmem_modules.clear();
+}
+
+} // extern "C"
@@ -50,12 +50,15 @@
 
 #include "kitcuda.h"
 #include "kitcuda_dylib.h"
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <stdio.h>
 #include <sys/syscall.h>
 #include <unistd.h>
-#include <deque>
-#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 
 // On older systems gettid() is not exposed and the syscall()
@@ -64,11 +67,180 @@
 // system libraries that are missing the call...
 #define gettid() syscall(SYS_gettid)
 
-// Stream creation can be expensive.  We "recycle" them when possible. 
-typedef std::deque<CUstream> KitCudaStreamList;
-static KitCudaStreamList _kitcuda_streams;
+// Stream creation can be expensive.  We "recycle" them when possible.
+// Each host thread keeps a small cache of idle streams so getting and
+// returning a stream normally touches no shared state.  Streams that
+// do not fit in a thread's cache (or that are left behind when a
+// thread exits) go to a shared overflow list that any thread can take
+// from.  The overflow list is a fixed set of slots updated with atomic
+// exchanges -- a stream is owned by whichever thread takes it out of a
+// slot so no locking is required.
+static const unsigned KITCUDA_THREAD_STREAM_CACHE_SIZE = 8;
+static const unsigned KITCUDA_STREAM_OVERFLOW_SLOTS = 256;
+static std::atomic<CUstream>
+    _kitcuda_stream_overflow[KITCUDA_STREAM_OVERFLOW_SLOTS];
+static std::atomic<unsigned> _kitcuda_stream_overflow_count(0);
+
+// Guards the registry of thread caches, the device streams and the
+// priority streams below.
 static std::mutex _kitcuda_stream_mutex;
 
+// Streams of a priority other than the default (see
+// `__kitcuda_use_priority_stream()`) are recycled through pools of
+// their own, indexed by KitRTPriority, so they are never handed to
+// launches at the default priority.  Few launches ask for a priority,
+// so the pools are shared and guarded by the mutex above.
+static std::vector<CUstream> _kitcuda_priority_pools[3];
+static std::unordered_map<CUstream, int> _kitcuda_priority_streams;
+static std::atomic<unsigned> _kitcuda_num_priority_streams(0);
+
+// Every stream of the primary context the runtime has created, idle or
+// not, so that freed memory can be fenced behind the work in flight
+// (see _kitcuda_record_busy_stream_events()).  Guarded by the mutex
+// above.  The streams of the other devices are not included: their
+// work is joined back into a stream of the primary context.
+static std::vector<CUstream> _kitcuda_all_streams;
+
+namespace {
+
+// Place the stream in the overflow list.  Returns false if the list
+// is full.
+bool push_overflow_stream(CUstream stream) {
+  for (auto &slot : _kitcuda_stream_overflow) {
+    CUstream expected = nullptr;
+    if (slot.load(std::memory_order_relaxed) == nullptr &&
+        slot.compare_exchange_strong(expected, stream,
+                                     std::memory_order_release)) {
+      _kitcuda_stream_overflow_count.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Take a stream from the overflow list (null if it is empty).
+CUstream pop_overflow_stream() {
+  if (_kitcuda_stream_overflow_count.load(std::memory_order_relaxed) == 0)
+    return nullptr;
+  for (auto &slot : _kitcuda_stream_overflow) {
+    if (slot.load(std::memory_order_relaxed) == nullptr)
+      continue;
+    CUstream stream = slot.exchange(nullptr, std::memory_order_acquire);
+    if (stream != nullptr) {
+      _kitcuda_stream_overflow_count.fetch_sub(1, std::memory_order_relaxed);
+      return stream;
+    }
+  }
+  return nullptr;
+}
+
+struct KitCudaThreadStreams;
+std::unordered_set<KitCudaThreadStreams *> _kitcuda_thread_caches;
+
+// The idle streams cached by a host thread.  Caches are registered so
+// the runtime can release their streams when it is destroyed.  When a
+// thread exits its streams are handed to the overflow list.
+struct KitCudaThreadStreams {
+  CUstream streams[KITCUDA_THREAD_STREAM_CACHE_SIZE];
+  unsigned count = 0;
+  bool registered = false;
+
+  ~KitCudaThreadStreams() {
+    if (not registered)
+      return;
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    _kitcuda_thread_caches.erase(this);
+    for (unsigned i = 0; i < count; i++)
+      if (not push_overflow_stream(streams[i]))
+        CU_SAFE_CALL(cuStreamDestroy_v2_p(streams[i]));
+    count = 0;
+  }
+};
+
+thread_local KitCudaThreadStreams _kitcuda_thread_streams;
+
+// Return a synchronized stream to its priority's pool.  Returns false
+// if the stream has the default priority.
+bool release_priority_stream(CUstream stream) {
+  if (_kitcuda_num_priority_streams.load(std::memory_order_relaxed) == 0)
+    return false;
+  std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+  auto it = _kitcuda_priority_streams.find(stream);
+  if (it == _kitcuda_priority_streams.end())
+    return false;
+  _kitcuda_priority_pools[it->second].push_back(stream);
+  return true;
+}
+
+// Return a synchronized stream for later reuse.
+void release_stream(CUstream stream) {
+  if (release_priority_stream(stream))
+    return;
+  KitCudaThreadStreams &cache = _kitcuda_thread_streams;
+  if (not cache.registered) {
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    _kitcuda_thread_caches.insert(&cache);
+    cache.registered = true;
+  }
+  if (cache.count < KITCUDA_THREAD_STREAM_CACHE_SIZE)
+    cache.streams[cache.count++] = stream;
+  else if (not push_overflow_stream(stream))
+    CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
+}
+
+// Returns true if all the work queued on the stream has completed.
+bool stream_done(CUstream stream) {
+  CUresult status = cuStreamQuery_p(stream);
+  if (status == CUDA_ERROR_NOT_READY)
+    return false;
+  CU_SAFE_CALL(status);
+  return true;
+}
+
+// Wait for the work queued on the stream to complete.  Unless the
+// runtime's wait policy is to block in the driver the stream is polled
+// (see `__kitrt_wait_backoff()`) so that the cores of the threads
+// waiting on the GPU are left to the other threads of the process.
+void wait_stream(CUstream stream) {
+  if (__kitrt_get_wait_policy() == KITRT_WAIT_BLOCK) {
+    CU_SAFE_CALL(cuStreamSynchronize_p(stream));
+    return;
+  }
+  KitRTWait wait = {0, 0};
+  while (not stream_done(stream))
+    __kitrt_wait_backoff(&wait);
+}
+
+// Issue the work that must be on the stream before it is waited on.
+// Launches on dataflow workers and any deferred (graph) launches must
+// be issued ahead of the copies of device-resident data and pushed
+// (persistent) launches must have completed.
+void prepare_stream_sync(void *opaque_stream) {
+  __kitcuda_persistent_join();
+  __kitcuda_dataflow_join(opaque_stream);
+  __kitcuda_graph_sync(opaque_stream);
+  __kitcuda_mem_flush_mirrors(opaque_stream);
+  __kitcuda_mem_flush_reductions(opaque_stream);
+}
+
+// Release the resources held for the (completed) work of the stream
+// and recycle it.
+void finish_stream_sync(void *opaque_stream) {
+  __kitcuda_mem_release_mirrors(opaque_stream);
+  __kitcuda_mem_release_reductions(opaque_stream);
+  __kitcuda_dataflow_release(opaque_stream);
+  __kitcuda_log_drain(false);
+  // In our current use case a synchronized stream is done doing
+  // any useful work.  Recycle it for later use...
+  release_stream((CUstream)opaque_stream);
+}
+
+} // namespace
+
+// Streams owned by the runtime for the non-primary devices used by
+// multi-device launches.  These are shared by all threads.
+static CUstream _kitcuda_device_streams[KITCUDA_MAX_DEVICES];
+
 #ifdef __cplusplus
 extern "C" {
 #else
@@ -78,35 +250,158 @@ extern "C" {
 void *__kitcuda_get_thread_stream() {
   KIT_NVTX_PUSH("kitcuda:get_thread_stream", KIT_NVTX_STREAM);
 
-  CUstream cu_stream;
-  if (not _kitcuda_streams.empty()) {
-    _kitcuda_stream_mutex.lock();
-    cu_stream = _kitcuda_streams.front();
-    _kitcuda_streams.pop_front();
-    _kitcuda_stream_mutex.unlock();
-    if (__kitrt_verbose_mode())
-       fprintf(stderr, "reusing thread stream.\n");
+  KitCudaThreadStreams &cache = _kitcuda_thread_streams;
+  CUstream cu_stream = nullptr;
+  if (cache.count > 0)
+    cu_stream = cache.streams[--cache.count];
+  else
+    cu_stream = pop_overflow_stream();
+
+  bool new_stream = cu_stream == nullptr;
+  if (not new_stream) {
+    KITRT_TRACE("reusing thread stream.\n");
   } else {
-    if (__kitrt_verbose_mode())
-       fprintf(stderr, "creating new thread stream.\n");
-    CU_SAFE_CALL(cuStreamCreate(&cu_stream, CU_STREAM_NON_BLOCKING));
+    KITRT_TRACE("creating new thread stream.\n");
+    CU_SAFE_CALL(cuStreamCreate_p(&cu_stream, CU_STREAM_NON_BLOCKING));
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    _kitcuda_all_streams.push_back(cu_stream);
   }
+  // Launches on the stream use the current L2 persistence window.
+  __kitcuda_mem_persist_apply((void *)cu_stream, new_stream);
   KIT_NVTX_POP();
-  if (__kitrt_verbose_mode())
-    fprintf(stderr, "returning thread stream: %p\n", cu_stream);
+  KITRT_TRACE("returning thread stream: %p\n", cu_stream);
   return (void *)cu_stream;
 }
 
-void __kitcuda_sync_thread_stream(void *opaque_stream) {
+void *__kitcuda_get_priority_stream(int priority) {
+  if (priority == KITRT_PRIORITY_NORMAL)
+    return __kitcuda_get_thread_stream();
+  assert(priority <= KITRT_PRIORITY_LOW && "unknown stream priority!");
+  KIT_NVTX_PUSH("kitcuda:get_priority_stream", KIT_NVTX_STREAM);
+  CUstream cu_stream = nullptr;
+  bool new_stream = false;
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    std::vector<CUstream> &pool = _kitcuda_priority_pools[priority];
+    if (not pool.empty()) {
+      cu_stream = pool.back();
+      pool.pop_back();
+    } else {
+      // Numerically lower values are higher priorities.
+      int least, greatest;
+      CU_SAFE_CALL(cuCtxGetStreamPriorityRange_p(&least, &greatest));
+      int value = priority == KITRT_PRIORITY_HIGH ? greatest : least;
+      CU_SAFE_CALL(cuStreamCreateWithPriority_p(
+          &cu_stream, CU_STREAM_NON_BLOCKING, value));
+      _kitcuda_priority_streams[cu_stream] = priority;
+      _kitcuda_all_streams.push_back(cu_stream);
+      _kitcuda_num_priority_streams.fetch_add(1, std::memory_order_relaxed);
+      new_stream = true;
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kitcuda: created %s priority stream %p "
+                "(priority %d).\n",
+                priority == KITRT_PRIORITY_HIGH ? "high" : "low",
+                (void *)cu_stream, value);
+    }
+  }
+  __kitcuda_mem_persist_apply((void *)cu_stream, new_stream);
+  KIT_NVTX_POP();
+  return (void *)cu_stream;
+}
+
+void __kitcuda_use_priority_stream(void **opaque_stream, int priority) {
+  assert(opaque_stream && "unexpected null stream pointer!");
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kitcuda_get_priority_stream(priority);
+}
+
+void *__kitcuda_get_device_stream(int index) {
+  assert(index < __kitcuda_get_num_devices() && "device index out of range!");
+  if (index == 0)
+    return __kitcuda_get_thread_stream();
+
+  std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+  if (_kitcuda_device_streams[index] == nullptr) {
+    CUcontext ctx;
+    CU_SAFE_CALL(cuCtxPushCurrent_v2_p(__kitcuda_get_context_at(index)));
+    CU_SAFE_CALL(cuStreamCreate_p(&_kitcuda_device_streams[index],
+                                  CU_STREAM_NON_BLOCKING));
+    CU_SAFE_CALL(cuCtxPopCurrent_v2_p(&ctx));
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "created stream for device index %d: %p\n", index,
+              _kitcuda_device_streams[index]);
+  }
+  return (void *)_kitcuda_device_streams[index];
+}
+
+void __kitcuda_sync_thread_stream_slow(void *opaque_stream) {
   assert(opaque_stream != nullptr && "unexpected null stream pointer!");
   KIT_NVTX_PUSH("kitcuda:sync_thread_stream", KIT_NVTX_STREAM);
-  CUstream stream = (CUstream)opaque_stream;
-  CU_SAFE_CALL(cuStreamSynchronize_p(stream));
-  // In our current use case a synchronized stream is done doing
-  // any useful work.  Recycle it for later use... 
-  _kitcuda_stream_mutex.lock();
-  _kitcuda_streams.push_back(stream);
-  _kitcuda_stream_mutex.unlock();
+  prepare_stream_sync(opaque_stream);
+  wait_stream((CUstream)opaque_stream);
+  finish_stream_sync(opaque_stream);
+  KIT_NVTX_POP();
+}
+
+void __kitcuda_recycle_thread_stream(void *opaque_stream) {
+  release_stream((CUstream)opaque_stream);
+}
+
+// The streams handed to a sync region by its spawned tasks.  Tasks that
+// finish concurrently push onto the list with a compare-and-swap on its
+// head (the compiler-allocated region slot); the region's sync takes
+// the whole list.
+struct KitCudaRegionStream {
+  void *stream;
+  KitCudaRegionStream *next;
+};
+
+void __kitcuda_sync_region_defer(void **region, void *opaque_stream) {
+  if (opaque_stream == nullptr)
+    return;
+  auto *node = new KitCudaRegionStream{opaque_stream, nullptr};
+  node->next = (KitCudaRegionStream *)__atomic_load_n(region, __ATOMIC_RELAXED);
+  while (not __atomic_compare_exchange_n(region, (void **)&node->next,
+                                         (void *)node, true, __ATOMIC_RELEASE,
+                                         __ATOMIC_RELAXED))
+    ;
+}
+
+void __kitcuda_sync_region_wait(void **region) {
+  auto *node = (KitCudaRegionStream *)__atomic_exchange_n(region, nullptr,
+                                                          __ATOMIC_ACQUIRE);
+  if (node == nullptr)
+    return;
+  KIT_NVTX_PUSH("kitcuda:sync_region_wait", KIT_NVTX_STREAM);
+  // Issue the remaining work of every stream before waiting on any of
+  // them and then finish the streams in the order they complete.
+  std::vector<void *> streams;
+  while (node != nullptr) {
+    KitCudaRegionStream *next = node->next;
+    prepare_stream_sync(node->stream);
+    streams.push_back(node->stream);
+    delete node;
+    node = next;
+  }
+  bool block = __kitrt_get_wait_policy() == KITRT_WAIT_BLOCK;
+  KitRTWait wait = {0, 0};
+  while (not streams.empty()) {
+    bool progress = false;
+    for (size_t i = 0; i < streams.size();) {
+      if (streams.size() == 1 || block)
+        wait_stream((CUstream)streams[i]);
+      else if (not stream_done((CUstream)streams[i])) {
+        i++;
+        continue;
+      }
+      finish_stream_sync(streams[i]);
+      streams[i] = streams.back();
+      streams.pop_back();
+      progress = true;
+    }
+    if (not progress)
+      __kitrt_wait_backoff(&wait);
+  }
   KIT_NVTX_POP();
 }
 
@@ -118,36 +413,109 @@ void __kitcuda_sync_context() {
   CU_SAFE_CALL(cuCtxGetCurrent_p(&ctx));
   if (ctx == NULL)
     CU_SAFE_CALL(cuCtxSetCurrent_p(__kitcuda_get_context()));
+  // A null stream completes the graph recordings (and issues deferred
+  // launches) and flushes (and releases) device-resident data for all
+  // streams.  The persistent worker would keep the context from ever
+  // synchronizing.
+  __kitcuda_persistent_stop();
+  __kitcuda_graph_sync(nullptr);
+  __kitcuda_mem_flush_mirrors(nullptr);
+  __kitcuda_mem_flush_reductions(nullptr);
   CU_SAFE_CALL(cuCtxSynchronize_p());
+  __kitcuda_mem_context_synced();
+  __kitcuda_mem_release_mirrors(nullptr);
+  __kitcuda_mem_release_reductions(nullptr);
+  __kitcuda_dataflow_release(nullptr);
+  __kitcuda_log_drain(true);
+  __kitcuda_heap_sync_context();
   KIT_NVTX_POP();
 }
 
 void __kitcuda_delete_thread_stream(void *opaque_stream) {
   KIT_NVTX_PUSH("kitrt:delete_thread_stream", KIT_NVTX_STREAM);
   CUstream stream = (CUstream)opaque_stream;
-  // Do a quick check to make sure we don't need to clean up the deque.
-  // We are a bit lazy with the scope of the lock here but we don't expect
-  // this to happen often (if ever).  Streams will be aggressively reused 
-  // vs. explicitly destroyed in the current implementation... 
-  _kitcuda_stream_mutex.lock();
-  auto sit = std::find(_kitcuda_streams.begin(), _kitcuda_streams.end(), stream);
-  if (sit != _kitcuda_streams.end()) {
-    _kitcuda_streams.erase(sit);
+  // Make sure the stream is not left behind in the calling thread's
+  // cache or the overflow list.  Streams will be aggressively reused
+  // vs. explicitly destroyed in the current implementation so we
+  // don't expect this to happen often (if ever).
+  KitCudaThreadStreams &cache = _kitcuda_thread_streams;
+  for (unsigned i = 0; i < cache.count; i++) {
+    if (cache.streams[i] == stream) {
+      cache.streams[i] = cache.streams[--cache.count];
+      break;
+    }
+  }
+  for (auto &slot : _kitcuda_stream_overflow) {
+    CUstream expected = stream;
+    if (slot.compare_exchange_strong(expected, nullptr)) {
+      _kitcuda_stream_overflow_count.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    _kitcuda_all_streams.erase(std::remove(_kitcuda_all_streams.begin(),
+                                           _kitcuda_all_streams.end(),
+                                           stream),
+                               _kitcuda_all_streams.end());
+  }
+  if (_kitcuda_num_priority_streams.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+    auto it = _kitcuda_priority_streams.find(stream);
+    if (it != _kitcuda_priority_streams.end()) {
+      std::vector<CUstream> &pool = _kitcuda_priority_pools[it->second];
+      pool.erase(std::remove(pool.begin(), pool.end(), stream), pool.end());
+      _kitcuda_priority_streams.erase(it);
+      _kitcuda_num_priority_streams.fetch_sub(1, std::memory_order_relaxed);
+    }
   }
   CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
-  _kitcuda_stream_mutex.unlock();
   KIT_NVTX_POP();
 }
 
 void __kitcuda_destroy_thread_streams() {
   KIT_NVTX_PUSH("kitrt:delete_thread_streams", KIT_NVTX_STREAM);
   _kitcuda_stream_mutex.lock();
- 
-  for (auto &entry : _kitcuda_streams)
-    CU_SAFE_CALL(cuStreamDestroy_v2_p(entry));
-  _kitcuda_streams.clear();
+
+  // NOTE: This assumes no other threads are actively using the
+  // runtime (e.g., at program exit).
+  for (KitCudaThreadStreams *cache : _kitcuda_thread_caches) {
+    for (unsigned i = 0; i < cache->count; i++)
+      CU_SAFE_CALL(cuStreamDestroy_v2_p(cache->streams[i]));
+    cache->count = 0;
+  }
+  while (CUstream stream = pop_overflow_stream())
+    CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
+  for (auto &pool : _kitcuda_priority_pools) {
+    for (CUstream stream : pool)
+      CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
+    pool.clear();
+  }
+  _kitcuda_priority_streams.clear();
+  _kitcuda_num_priority_streams.store(0, std::memory_order_relaxed);
+  for (auto &stream : _kitcuda_device_streams) {
+    if (stream != nullptr)
+      CU_SAFE_CALL(cuStreamDestroy_v2_p(stream));
+    stream = nullptr;
+  }
+  _kitcuda_all_streams.clear();
   _kitcuda_stream_mutex.unlock();
   KIT_NVTX_POP();
 }
 
 } // extern "C"
+
+void _kitcuda_record_busy_stream_events(std::vector<CUevent> &events) {
+  std::lock_guard<std::mutex> lock(_kitcuda_stream_mutex);
+  for (CUstream stream : _kitcuda_all_streams) {
+    CUresult status = cuStreamQuery_p(stream);
+    if (status == CUDA_SUCCESS)
+      continue;
+    if (status != CUDA_ERROR_NOT_READY)
+      CU_SAFE_CALL(status);
+    CUevent event;
+    CU_SAFE_CALL(cuEventCreate_p(&event, CU_EVENT_DISABLE_TIMING));
+    CU_SAFE_CALL(cuEventRecord_p(event, stream));
+    events.push_back(event);
+  }
+}
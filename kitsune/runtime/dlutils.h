@@ -68,4 +68,9 @@
     return false;                                                          \
   }
 
+// Load an entry point that is not present in all versions of the
+// library.  The pointer is left null when the symbol is missing.
+#define DLSYM_LOAD_OPTIONAL(fName)                                         \
+  fName##_p = (decltype(fName) *)dlsym(kitrt_dl_handle, #fName)
+
 #endif
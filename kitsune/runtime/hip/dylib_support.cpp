@@ -92,32 +92,50 @@ bool __kithip_load_symbols() {
   DLSYM_LOAD(hipGetDeviceProperties);
   DLSYM_LOAD(hipDeviceReset);
   DLSYM_LOAD(hipDeviceSynchronize);
+  DLSYM_LOAD(hipDeviceGetStreamPriorityRange);
 
   /* Context management */
 
   /* Stream management */
   DLSYM_LOAD(hipStreamCreate);
   DLSYM_LOAD(hipStreamCreateWithFlags);
+  DLSYM_LOAD(hipStreamCreateWithPriority);
   DLSYM_LOAD(hipStreamDestroy);
   DLSYM_LOAD(hipStreamSynchronize);
+  DLSYM_LOAD(hipStreamQuery);
+  DLSYM_LOAD(hipStreamWaitEvent);
+
+  /* Event management */
+  DLSYM_LOAD(hipEventCreateWithFlags);
+  DLSYM_LOAD(hipEventRecord);
+  DLSYM_LOAD(hipEventDestroy);
+  DLSYM_LOAD(hipEventQuery);
+  DLSYM_LOAD(hipEventSynchronize);
+  DLSYM_LOAD(hipEventElapsedTime);
 
   /* Kernel launching, fat binary, module related */
   DLSYM_LOAD(hipModuleLoadData);
   DLSYM_LOAD(hipModuleGetGlobal);
   DLSYM_LOAD(hipModuleGetFunction);
+  DLSYM_LOAD(hipFuncGetAttribute);
   DLSYM_LOAD(hipLaunchKernel);
   DLSYM_LOAD(hipModuleLaunchKernel);
   DLSYM_LOAD(hipModuleOccupancyMaxPotentialBlockSize);
 
   /* Memory management and movement */
   DLSYM_LOAD(hipMallocManaged);
+  DLSYM_LOAD(hipMalloc);
   DLSYM_LOAD(hipFree);
+  DLSYM_LOAD(hipHostMalloc);
+  DLSYM_LOAD(hipHostFree);
   DLSYM_LOAD(hipMemAdvise);
   DLSYM_LOAD(hipMemRangeGetAttribute);
   DLSYM_LOAD(hipPointerGetAttribute);
   DLSYM_LOAD(hipPointerGetAttributes);
   DLSYM_LOAD(hipMemcpy);
   DLSYM_LOAD(hipMemcpyHtoD);
+  DLSYM_LOAD(hipMemcpyHtoDAsync);
+  DLSYM_LOAD(hipMemcpyDtoHAsync);
   DLSYM_LOAD(hipMemsetD8Async);
   DLSYM_LOAD(hipMemPrefetchAsync);
 
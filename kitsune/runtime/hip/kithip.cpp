@@ -81,9 +81,14 @@
 // via the helper functions.
 bool _kithip_initialized = false;
 int _kithip_device_id = -1;
-static hipDeviceProp_t _kithip_device_props;
+hipDeviceProp_t _kithip_device_props;
 static int _kithip_max_threads_per_blk;
 static bool _kithip_use_xnack = false;
+// Set when the device shares coherent memory with the host (e.g., an
+// MI300A APU).  Allocations then come from host memory and prefetching
+// is skipped entirely -- see memory.cpp.
+bool _kithip_unified_memory = false;
+bool _kithip_pageable_memory_access = false;
 
 // TODO: These don't need to be global -- we're not using them elsewhere beyond
 // the initialization code for verbose feedback durring runtime...
@@ -94,6 +99,49 @@ static int _kithip_can_map_host_mem;
 static int _kithip_concurrent_kernels;
 static int _kithip_uses_host_page_table;
 
+namespace {
+
+void *_kithip_profile_event_create() {
+  hipEvent_t event;
+  HIP_SAFE_CALL(hipEventCreateWithFlags_p(&event, hipEventDefault));
+  return (void *)event;
+}
+
+void _kithip_profile_event_record(void *event, void *stream) {
+  HIP_SAFE_CALL(hipEventRecord_p((hipEvent_t)event, (hipStream_t)stream));
+}
+
+bool _kithip_profile_event_query(void *event) {
+  hipError_t result = hipEventQuery_p((hipEvent_t)event);
+  if (result == hipErrorNotReady)
+    return false;
+  HIP_SAFE_CALL(result);
+  return true;
+}
+
+float _kithip_profile_event_elapsed(void *start, void *end) {
+  float msecs;
+  HIP_SAFE_CALL(hipEventElapsedTime_p(&msecs, (hipEvent_t)start,
+                                      (hipEvent_t)end));
+  return msecs;
+}
+
+void _kithip_profile_event_destroy(void *event) {
+  HIP_SAFE_CALL(hipEventDestroy_p((hipEvent_t)event));
+}
+
+} // namespace
+
+const KitRTProfileEventOps _kithip_profile_ops = {
+    "hip",
+    _kithip_profile_event_create,
+    _kithip_profile_event_record,
+    _kithip_profile_event_query,
+    _kithip_profile_event_elapsed,
+    _kithip_profile_event_destroy,
+    nullptr, // no kernel metrics (see profile.h).
+};
+
 extern "C" {
 
 bool __kithip_initialize() {
@@ -150,8 +198,17 @@ bool __kithip_initialize() {
   // devices from different vendors are available on a single
   // system.
 
-  if (!__kitrt_get_env_value("KITHIP_DEVICE_ID", _kithip_device_id))
+  // Without an explicit device ID, the ranks started on a node by an
+  // MPI launcher are spread round-robin across its devices.
+  int local_rank = 0;
+  bool rank_bound = false;
+  if (!__kitrt_get_env_value("KITHIP_DEVICE_ID", _kithip_device_id)) {
     _kithip_device_id = 0;
+    if (__kitrt_get_local_rank(&local_rank)) {
+      _kithip_device_id = local_rank % device_count;
+      rank_bound = true;
+    }
+  }
 
   assert(_kithip_device_id < device_count &&
          "kithip: KITHIP_DEVICE_ID value exceeds available number"
@@ -161,6 +218,18 @@ bool __kithip_initialize() {
   HIP_SAFE_CALL(
       hipGetDeviceProperties_p(&_kithip_device_props, _kithip_device_id));
 
+  // Keep the host threads of a rank on the socket its device hangs
+  // off of.  KITRT_BIND_CPUS can be used to disable (or force) this.
+  bool bind_cpus = rank_bound;
+  (void)__kitrt_get_env_value("KITRT_BIND_CPUS", bind_cpus);
+  if (rank_bound && __kitrt_verbose_mode())
+    fprintf(stderr, "kithip: local rank %d bound to device %d.\n",
+            local_rank, _kithip_device_id);
+  if (bind_cpus)
+    (void)__kitrt_bind_to_pci_device(_kithip_device_props.pciDomainID,
+                                     _kithip_device_props.pciBusID,
+                                     _kithip_device_props.pciDeviceID);
+
   // For ease of code generation on part of the compiler and humans
   // (mostly writing the runtime and compiler support) we currently
   // require managed memory support.  While this can introduce
@@ -217,6 +286,25 @@ bool __kithip_initialize() {
     abort();
   }
 
+  // APUs (e.g., the MI300A) have a single pool of HBM shared by the
+  // host and the GPU.  There is nothing to migrate on these systems
+  // and managed allocations and prefetches only add overhead, so we
+  // hand out host memory instead.  When the device can also access
+  // pageable memory coherently (requires XNACK) plain system
+  // allocations are used; otherwise we fall back to (coarse-grained)
+  // pinned host allocations.  KITHIP_UNIFIED_MEMORY can be used to
+  // disable (or force) this mode.
+  int pageable_access = 0;
+  HIP_SAFE_CALL(hipDeviceGetAttribute_p(&pageable_access,
+                                        hipDeviceAttributePageableMemoryAccess,
+                                        _kithip_device_id));
+  _kithip_pageable_memory_access = pageable_access != 0;
+  _kithip_unified_memory = _kithip_device_props.integrated != 0;
+  (void)__kitrt_get_env_value("KITHIP_UNIFIED_MEMORY", _kithip_unified_memory);
+  if (__kitrt_verbose_mode() && _kithip_unified_memory)
+    fprintf(stderr, "kithip: unified memory enabled (%s allocations).\n",
+            _kithip_pageable_memory_access ? "system" : "host");
+
   // At this point we're ready to go as far as the basic HIP
   // initialization requirements go.  Let's consider this a success.
   _kithip_initialized = true;
@@ -225,9 +313,7 @@ bool __kithip_initialize() {
   // runtime or to provide some verbose feedback during execution to
   // help provide platform-/target-specific details for performance,
   // debugging, etc.
-  HIP_SAFE_CALL(hipDeviceGetAttribute_p(&_kithip_max_threads_per_blk,
-                                        hipDeviceAttributeMaxThreadsPerBlock,
-                                        _kithip_device_id));
+  _kithip_max_threads_per_blk = _kithip_device_props.maxThreadsPerBlock;
   HIP_SAFE_CALL(hipDeviceGetAttribute_p(
       &_kithip_ecc_enabled, hipDeviceAttributeEccEnabled, _kithip_device_id));
   //HIP_SAFE_CALL(hipDeviceGetAttribute_p(&_kithip_num_async_engines,
@@ -277,6 +363,19 @@ bool __kithip_initialize() {
     if (__kitrt_verbose_mode())
       fprintf(stderr, "  kithip: occupancy-based launches enabled.\n");  
 
+  bool enable_refine_occ_launch;
+  if (__kitrt_get_env_value("KITHIP_REFINE_OCCUPANCY_LAUNCH",
+                            enable_refine_occ_launch))
+    __kithip_refine_occupancy_launches(enable_refine_occ_launch);
+
+  // Load modules (and resolve kernels) in the background as they are
+  // registered rather than on first launch.
+  bool enable_preload = false;
+  __kitrt_get_env_value("KITHIP_PRELOAD_MODULES", enable_preload);
+  __kithip_enable_module_preload(enable_preload);
+
+  __kithip_create_mem_pool();
+
   return _kithip_initialized;
 }
 
@@ -288,9 +387,22 @@ void __kithip_destroy() {
   if (not _kithip_initialized)
     return;
 
-  __kithip_destroy_thread_streams();
+  // The events of the profiler (and of timing spans, which use them when
+  // the profiler is disabled) must be resolved before the device is reset.
+  __kitrt_profile_flush(&_kithip_profile_ops);
+  __kithip_stop_module_preload();
+  // Outside of the full exit mode the resources that the device owns
+  // are not released one by one (see KitRTExitMode).
+  KitRTExitMode exit_mode = __kitrt_get_exit_mode();
+  if (exit_mode == KITRT_EXIT_FULL) {
+    __kithip_destroy_prefetch_streams();
+    __kithip_destroy_reductions();
+    __kithip_destroy_thread_streams();
+    __kithip_destroy_mem_pool();
+  }
   __kitrt_destroy_memory_map(__kithip_mem_destroy);
-  HIP_SAFE_CALL(hipDeviceReset_p());
+  if (exit_mode != KITRT_EXIT_LEAK)
+    HIP_SAFE_CALL(hipDeviceReset_p());
   _kithip_initialized = false;
 }
 
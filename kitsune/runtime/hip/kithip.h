@@ -96,6 +96,11 @@ extern "C" {
  *      supports a single GPU and this will default to the first GPU
  *      in the system if left unset.
  *
+ *    - **KITHIP_UNIFIED_MEMORY**: Enable or disable serving
+ *      allocations from host memory and skipping all prefetching.
+ *      This defaults to enabled on devices that share memory with
+ *      the host (e.g., an MI300A APU) and disabled otherwise.
+ *
  * Applications should call `__kithip_destroy()` at program exit.
  *
  **/
@@ -148,7 +153,9 @@ extern bool __kithip_is_mem_managed(void *vp);
  * It is important that this call be used in place of HIP's managed
  * memory allocation function as the Kitsune runtime will track this
  * allocation to enable the automatic prefetching of data when it is
- * part of the managed allocation.
+ * part of the managed allocation.  No data moves at allocation time:
+ * the pages are placed on first touch and the allocation is first
+ * prefetched to the device when a kernel uses it.
  *
  * @param num_bytes: The number of bytes to allocate as part of this
  * request.
@@ -206,6 +213,55 @@ __kithip_mem_calloc_managed(size_t count, size_t elemsize);
 extern __attribute__((malloc)) void *__kithip_mem_realloc_managed(void *ptr,
                                                                   size_t size);
 
+/**
+ * Reserve `max_bytes` of managed memory for an array that grows in
+ * place (see `kitsune::vector`).  Managed pages are only populated
+ * when first touched, so the reservation costs address space rather
+ * than memory and the array never moves as it grows.  Reservations
+ * are not served from the memory pool.
+ *
+ * @param max_bytes - The largest size, in bytes, the array can reach.
+ */
+extern __attribute__((malloc)) void *
+__kithip_mem_reserve_managed(size_t max_bytes);
+
+/**
+ * Commit the leading `nbytes` of a reservation, which then behaves
+ * like an allocation of that size (e.g., for prefetching) until it is
+ * committed again.  Committing less than before keeps the memory.
+ *
+ * @param base - The pointer returned by the reservation.
+ * @param nbytes - The size, in bytes, of the array.
+ */
+extern void __kithip_mem_commit_managed(void *base, size_t nbytes);
+
+/**
+ * Release a reservation and all the memory committed within it.
+ *
+ * @param base - The pointer returned by the reservation.
+ * @param max_bytes - The size, in bytes, the range was reserved with.
+ */
+extern void __kithip_mem_release_managed(void *base, size_t max_bytes);
+
+/**
+ * Map the file at `path` as a read-only array (see `kitsune::map_file`).
+ * Devices that can access pageable memory use the file mapping in
+ * place.  Otherwise the file is copied to managed memory in chunks,
+ * each prefetched to the device while the next is read.  Returns null
+ * if the file cannot be mapped.
+ *
+ * @param path - The path of the file.
+ * @param nbytes - If not null, set to the size of the file in bytes.
+ */
+extern void *__kithip_mem_map_file(const char *path, size_t *nbytes);
+
+/**
+ * Release a file mapped by `__kithip_mem_map_file()`.
+ *
+ * @param ptr - The pointer returned by the mapping.
+ */
+extern void __kithip_mem_unmap_file(void *ptr);
+
 /**
  * Free the given managed memory allocation.  The allocation
  * referred to by `ptr` must have been previously allocated with one
@@ -236,6 +292,70 @@ extern void __kithip_mem_free(void *ptr);
  */
 extern void __kithip_mem_destroy(void *ptr);
 
+/**
+ * Create the runtime's managed memory pool.  When enabled (see
+ * `mem_pool.h` for the controlling environment variables) managed
+ * memory allocations are carved out of larger slabs and freed blocks
+ * are cached for reuse instead of being returned to the driver.  This
+ * is called as part of runtime initialization.
+ */
+extern void __kithip_create_mem_pool();
+
+/**
+ * Release the managed memory pool and all of its slabs back to the
+ * driver.  This is called as part of the runtime's cleanup at exit
+ * and must occur before the memory map is destroyed.
+ */
+extern void __kithip_destroy_mem_pool();
+
+/**
+ * Note that the device has been synchronized.  Blocks freed to the
+ * managed memory pool before the synchronization may then be reused
+ * (kernels still in flight when they were freed have completed).
+ */
+extern void __kithip_mem_device_synced();
+
+/**
+ * Allocate a page-locked (pinned) host buffer for explicit,
+ * asynchronous transfers.  Buffers are served from a pool of size
+ * classes and are not tracked by the runtime's memory map.
+ *
+ * @param size - The size of the buffer in bytes.
+ */
+extern __attribute__((malloc)) void *__kithip_mem_alloc_pinned(size_t size);
+
+/**
+ * Return a pinned buffer to the pool.  If a stream is given the buffer
+ * is only reused once all the work issued on the stream so far has
+ * completed.
+ *
+ * @param ptr - A buffer from `__kithip_mem_alloc_pinned()`.
+ * @param opaque_stream - The stream that last uses the buffer (or null).
+ */
+extern void __kithip_mem_free_pinned(void *ptr, void *opaque_stream);
+
+/**
+ * Allocate a buffer in device memory.  Device buffers are not tracked
+ * by the runtime's memory map and are never migrated; they are meant
+ * for data the host only hands to device-aware libraries (e.g., packed
+ * halos for ROCm-aware MPI).
+ *
+ * @param size - The size of the buffer in bytes.
+ */
+extern __attribute__((malloc)) void *__kithip_mem_alloc_device(size_t size);
+
+/**
+ * Release a buffer from `__kithip_mem_alloc_device()`.
+ */
+extern void __kithip_mem_free_device(void *ptr);
+
+/**
+ * Return `true` if the data of the allocation that holds the given
+ * pointer is on the device (i.e., kernels access it without moving
+ * it) and `false` if it is in host memory or unknown to the runtime.
+ */
+extern bool __kithip_mem_on_device(void *ptr);
+
 /**
  * Request that the memory allocation associated with the given
  * pointer be prefetched to GPU memory.  The memory must have been
@@ -251,27 +371,171 @@ extern void __kithip_mem_destroy(void *ptr);
  */
 extern void* __kithip_mem_gpu_prefetch(void *ptr, void *opaque_stream);
 
+/**
+ * Request GPU prefetches of the memory referenced by a kernel's pointer
+ * arguments with a single call (see `__kithip_mem_gpu_prefetch()`).
+ * Pointers into the same allocation are prefetched once.
+ *
+ * @param ptrs - The pointers to prefetch.
+ * @param num_ptrs - The number of pointers.
+ * @param opaque_stream - The stream for the prefetches (if null the
+ *                        first prefetch picks one).
+ * @return The stream of the prefetches or null if none were issued.
+ */
+extern void *__kithip_mem_gpu_prefetch_batch(void **ptrs, int num_ptrs,
+                                             void *opaque_stream);
+
+/**
+ * Request an early prefetch of the managed memory allocation that
+ * contains the given pointer.  The compiler issues this call at the
+ * earliest point ahead of a kernel launch where the host no longer
+ * writes the data.  The request is made on one of the runtime's
+ * dedicated prefetch streams (see `__kitrt_prefetchStreamsEnabled()`)
+ * and the launch's stream waits only on the prefetches for its own
+ * arguments (see `__kithip_mem_gpu_prefetch()`).  This call is a
+ * no-op when prefetch streams are disabled or the data has already
+ * been prefetched.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
+ */
+extern void __kithip_mem_gpu_prefetch_async(void *ptr);
+
+/**
+ * Release the runtime's prefetch streams and any pending prefetch
+ * events.
+ */
+extern void __kithip_destroy_prefetch_streams();
+
+/**
+ * Provide the device-side location a kernel reduces into for the given
+ * host variable.  The compiler replaces the kernel argument for each
+ * reduction result with the returned pointer.  The location starts out
+ * with the host variable's current value and is copied back to the
+ * host variable when the stream is synchronized.
+ *
+ * @param ptr - The host-side pointer to the reduction result.
+ * @param size - The size of the result in bytes (at most 16).
+ * @param opaque_stream - The stream for the upcoming kernel launch.
+ *                        If it points to null a stream is assigned
+ *                        and returned.
+ */
+extern void *__kithip_mem_reduce_map(void *ptr, uint64_t size,
+                                     void **opaque_stream);
+
+/**
+ * Enqueue the copies of the reduction results of kernels on the given
+ * stream (or all streams if null) back to the host.  This is used as
+ * part of stream synchronization.
+ */
+extern void __kithip_mem_flush_reductions(void *opaque_stream);
+
+/**
+ * Recycle the device-side reduction locations used on the given stream
+ * (or all streams if null).  This must be called after the stream has
+ * been synchronized.
+ */
+extern void __kithip_mem_release_reductions(void *opaque_stream);
+
+/**
+ * Release the device memory used for reduction results.
+ */
+extern void __kithip_destroy_reductions();
+
 /**
  * Request that the memory allocation associated with the given
  * pointer be prefetched to the host (CPU) memory.  The memory must
  * have been allocated as managed memory using the Kitsune runtime
  * interface.  If the provided pointer is not recognized by the
- * runtime this call is a silent no-op.
+ * runtime, or the allocation is not on the GPU, this call is a
+ * silent no-op.
+ *
+ * The prefetch is ordered on the given stream (the calling thread's
+ * stream if null) so it can be issued right behind the last kernel
+ * that uses the data and overlap with later GPU work.  Its completion
+ * can be checked with `__kithip_mem_host_prefetch_done()` and waited
+ * for with `__kithip_mem_host_prefetch_wait()`.
  *
  * @param ptr - The pointer to the allocated region to
  *              prefetch.
+ * @param opaque_stream - The stream to order the prefetch on.
+ * @return the stream the prefetch was issued on (null if none).
  *
  * **NOTE**: See `__kithip_mem_gpu_prefetch()` for GPU prefetch
  * requests.
  */
-extern void __kithip_mem_host_prefetch(void *ptr);
+extern void *__kithip_mem_host_prefetch(void *ptr, void *opaque_stream);
+
+/**
+ * Return true if the most recent host prefetch of the allocation
+ * that contains the given pointer has completed (or there is none).
+ * This call does not block.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
+ */
+extern bool __kithip_mem_host_prefetch_done(void *ptr);
+
+/**
+ * Wait for the most recent host prefetch of the allocation that
+ * contains the given pointer to complete.  Only the prefetch (and
+ * the work ahead of it on its stream) is waited on.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
+ */
+extern void __kithip_mem_host_prefetch_wait(void *ptr);
+
+/**
+ * Mark the managed memory allocation that contains the given pointer
+ * as cold, i.e., not used by kernels for a while.  Its pages are moved
+ * to host memory and kept there, freeing device memory for the data
+ * that is in use, until the prefetch of the next kernel launch that
+ * uses it.  This call is a no-op with unified memory and for pointers
+ * that are not recognized by the runtime.
+ *
+ * @param ptr - The pointer to (or into) the managed allocation.
+ */
+extern void __kithip_mem_mark_cold(void *ptr);
 
 /**
  * Find the named symbol in the given module represented by the
- * provided fat binary.
+ * provided fat binary.  Identical code objects embedded in different
+ * images (e.g., by several translation units) share a single module,
+ * and so share their device globals.
  */
 void *__kithip_get_global_symbol(void *fat_bin, const char *sym_name);
 
+/**
+ * Enable/disable the background preloading of modules (see
+ * `__kithip_preload_module()`).  This is disabled by default and
+ * may be enabled by setting the `KITHIP_PRELOAD_MODULES` environment
+ * variable.
+ */
+extern void __kithip_enable_module_preload(bool enable);
+
+/**
+ * Queue the given code object to be loaded in the background, along
+ * with the launch details of each of its kernels.  The compiler calls
+ * this from each module's constructor so that module loading (and the
+ * decompression of compressed bundles) overlaps with program startup
+ * rather than occurring within the first launch.  Launches only block
+ * if the kernel they need has not been loaded yet.  This is a no-op
+ * unless preloading is enabled.
+ *
+ * @param fat_bin - The code object (bundle) image.
+ * @param kernel_names - The names of the kernels in the image.
+ * @param handles - The launch handle of each kernel.
+ * @param num_kernels - The number of kernels.
+ */
+extern void __kithip_preload_module(const void *fat_bin,
+                                    const char **kernel_names,
+                                    void ***handles, int num_kernels);
+
+/**
+ * Stop any background preloading and wait for the worker thread to
+ * exit.  Modules that have not yet been loaded are loaded on first
+ * use.
+ */
+extern void __kithip_stop_module_preload();
+
 /**
  * Copy the given symbol from host memory to device memory.  This is
  * most often used when doing code generation for global values that
@@ -298,6 +562,14 @@ extern void __kithip_memcpy_sym_to_device(void *host_sym, void *dev_sym,
  * on its assigned stream.  This implementation path deprecates
  * previous APIs that exposed streams as part of the API.
  *
+ * Resolving the kernel (and its launch attributes) from the fat binary
+ * and name requires a lookup keyed on the kernel's name.  To avoid this
+ * on every launch the compiler passes a pointer to a per-kernel handle
+ * (`launch_handle`) that starts out null.  The first launch stores the
+ * runtime's cached kernel descriptor in the handle and later launches
+ * use it directly.  A null `launch_handle` is also accepted and always
+ * takes the lookup path.
+ *
  * @param fat_bin - The fat binary image containing the compiled kernel.
  * @param kern_name - The name of the kernel to launch.
  * @param kern_args - The argument buffer for the kernel.
@@ -305,13 +577,59 @@ extern void __kithip_memcpy_sym_to_device(void *host_sym, void *dev_sym,
  * @param threads_per_blk - Use given thread count for launch (== 0 to compute).
  * @param inst_mix - external static code analysis details.
  * @param opaque_stream - externally created stream for execution. 
+ * @param launch_handle - pointer to the kernel's cached launch handle
+ *                        (may be null).
  */
 extern void* __kithip_launch_kernel(const void *fat_bin,
                                     const char *kern_name,
                                     void **kern_args, size_t trip_count,
                                     int threads_per_blk,
                                     const KitRTInstMix *inst_mix,
-                                    void *opaque_stream);
+                                    void *opaque_stream,
+                                    void **launch_handle);
+
+/**
+ * Read an iteration space value (of `iv_size` bytes) from the kernel
+ * argument buffer.
+ */
+static inline uint64_t __kithip_read_iv_arg(void *arg, uint32_t iv_size) {
+  if (iv_size == sizeof(uint32_t))
+    return *(uint32_t *)arg;
+  else if (iv_size == sizeof(uint64_t))
+    return *(uint64_t *)arg;
+  return 0;
+}
+
+/**
+ * Launch the named kernel over a two or three dimensional iteration
+ * space.  The compiler uses this for kernels that split a flattened
+ * iteration space into coordinates (e.g., 'i = tid / N, j = tid % N'
+ * or a Kokkos MDRangePolicy) and take their coordinates from the
+ * work-group and work-item indices in x, y (and z).  The arguments
+ * match `__kithip_launch_kernel()` with the addition of the geometry.
+ *
+ * The iteration space is row-major with x varying the fastest;
+ * `inner_extents` holds the `num_dims - 1` extents of the inner
+ * dimensions and the outermost extent follows from the trip count.
+ * Each block covers a tile of the iteration space: x spans (up to) a
+ * wavefront and the rest of the block is spread over the outer
+ * dimensions.  The kernel skips the part of its tiles that falls
+ * outside the iteration space.
+ *
+ * @param iv_size - size in bytes of the start and trip count arguments
+ * (the launch is skipped when the start is at or past the trip count).
+ * @param num_dims - the number of dimensions (2 or 3).
+ * @param inner_extents - the extents of the inner dimensions (x first).
+ */
+extern void *__kithip_launch_kernel_nd(const void *fat_bin,
+                                       const char *kern_name,
+                                       void **kern_args, uint64_t trip_count,
+                                       int threads_per_blk,
+                                       const KitRTInstMix *inst_mix,
+                                       void *opaque_stream, uint32_t iv_size,
+                                       void **launch_handle,
+                                       uint32_t num_dims,
+                                       const uint64_t *inner_extents);
 
 /**
  * Enable/Disable the use of occupancy calculations for the
@@ -325,6 +643,27 @@ extern void* __kithip_launch_kernel(const void *fat_bin,
  */
 extern void __kithip_use_occupancy_launch(bool enable);
 
+/**
+ * Enable/Disable the refinement of occupancy-based launch parameters
+ * for the trip count of each launch.  The refinement reduces the
+ * threads-per-block so that small trip counts still use all the
+ * multi-processors and medium trip counts split their blocks evenly
+ * across them.  Enabling the refinement also enables occupancy-based
+ * launches.  The refinement is enabled by default.
+ *
+ * @param enable - enable/disable the refinement
+ */
+extern void __kithip_refine_occupancy_launches(bool enable);
+
+/**
+ * Set the wavefront size the compiler generated the kernels for.  The
+ * launch parameters are sized in whole wavefronts, which can differ
+ * from the device's native wavefront size (see `-hipabi-wavefront64`).
+ *
+ * @param wavefront_size - the kernels' wavefront size (32 or 64)
+ */
+extern void __kithip_set_wavefront_size(int wavefront_size);
+
 /**
  * Set the runtime's value for the number of threads-per-block used
  * in simple launch parameter calculations.
@@ -376,6 +715,23 @@ extern void __kithip_set_custom_launch_params(unsigned blks_per_grid,
  */
 extern void *__kithip_get_thread_stream();
 
+/**
+ * Return a stream of the given priority (see `KitRTPriority`); the
+ * default priority returns `__kithip_get_thread_stream()`.  Streams of
+ * the other priorities are recycled through pools of their own when
+ * they are synchronized.
+ */
+extern void *__kithip_get_priority_stream(int priority);
+
+/**
+ * Set the stream of an upcoming kernel launch to a stream of the given
+ * priority, unless the launch already has one.  The compiler issues
+ * this call ahead of the launch of a forall with a
+ * `[[kitsune::priority]]` attribute.
+ */
+extern void __kithip_use_priority_stream(void **opaque_stream,
+                                         int priority);
+
 /**
  * Synchronize the calling thread with its assocaited stream.
  */
@@ -434,6 +790,38 @@ inline int __kithip_get_device_id() {
   return _kithip_device_id;
 }
 
+/**
+ * Get the properties of the current HIP device.  These are queried
+ * once when the runtime is initialized so the launch path never has
+ * to go back to the driver for them.
+ */
+inline const hipDeviceProp_t *__kithip_get_device_props() {
+  extern hipDeviceProp_t _kithip_device_props;
+  assert(__kithip_is_initialized() && "kitrt: runtime not initialized!");
+  return &_kithip_device_props;
+}
+
+/**
+ * Does the device share coherent memory with the host (e.g., an
+ * MI300A APU)?  When true, allocations are served from host memory
+ * and all prefetch requests are ignored.  This is detected at
+ * initialization and can be overridden via the KITHIP_UNIFIED_MEMORY
+ * environment variable.
+ */
+inline bool __kithip_has_unified_memory() {
+  extern bool _kithip_unified_memory;
+  return _kithip_unified_memory;
+}
+
+/**
+ * Can the device coherently access pageable (system allocated) host
+ * memory?  This typically requires XNACK to be enabled.
+ */
+inline bool __kithip_has_pageable_memory_access() {
+  extern bool _kithip_pageable_memory_access;
+  return _kithip_pageable_memory_access;
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -452,4 +840,11 @@ inline int __kithip_get_device_id() {
     }                                                                          \
   }
 
+#ifdef __cplusplus
+#include "profile.h"
+
+/// The HIP event operations used by the launch and transfer profiler.
+extern const KitRTProfileEventOps _kithip_profile_ops;
+#endif
+
 #endif
@@ -70,32 +70,50 @@ DECLARE_DLSYM(hipDeviceGetAttribute);
 DECLARE_DLSYM(hipGetDeviceProperties);
 DECLARE_DLSYM(hipDeviceReset);
 DECLARE_DLSYM(hipDeviceSynchronize);
+DECLARE_DLSYM(hipDeviceGetStreamPriorityRange);
 
 /* Context management */
 
 /* Stream management */
 DECLARE_DLSYM(hipStreamCreate);
 DECLARE_DLSYM(hipStreamCreateWithFlags);
+DECLARE_DLSYM(hipStreamCreateWithPriority);
 DECLARE_DLSYM(hipStreamDestroy);
 DECLARE_DLSYM(hipStreamSynchronize);
+DECLARE_DLSYM(hipStreamQuery);
+DECLARE_DLSYM(hipStreamWaitEvent);
+
+/* Event management */
+DECLARE_DLSYM(hipEventCreateWithFlags);
+DECLARE_DLSYM(hipEventRecord);
+DECLARE_DLSYM(hipEventDestroy);
+DECLARE_DLSYM(hipEventQuery);
+DECLARE_DLSYM(hipEventSynchronize);
+DECLARE_DLSYM(hipEventElapsedTime);
 
 /* Kernel launching, fat binary, module related */
 DECLARE_DLSYM(hipModuleLoadData);
 DECLARE_DLSYM(hipModuleGetGlobal);
 DECLARE_DLSYM(hipModuleGetFunction);
+DECLARE_DLSYM(hipFuncGetAttribute);
 DECLARE_DLSYM(hipLaunchKernel);
 DECLARE_DLSYM(hipModuleLaunchKernel);
 DECLARE_DLSYM(hipModuleOccupancyMaxPotentialBlockSize);
 
 /* Memory management and movement */
 DECLARE_DLSYM(hipMallocManaged);
+DECLARE_DLSYM(hipMalloc);
 DECLARE_DLSYM(hipFree);
+DECLARE_DLSYM(hipHostMalloc);
+DECLARE_DLSYM(hipHostFree);
 DECLARE_DLSYM(hipMemAdvise);
 DECLARE_DLSYM(hipMemRangeGetAttribute);
 DECLARE_DLSYM(hipPointerGetAttribute);
 DECLARE_DLSYM(hipPointerGetAttributes);
 DECLARE_DLSYM(hipMemcpy);
 DECLARE_DLSYM(hipMemcpyHtoD);
+DECLARE_DLSYM(hipMemcpyHtoDAsync);
+DECLARE_DLSYM(hipMemcpyDtoHAsync);
 DECLARE_DLSYM(hipMemsetD8Async);
 DECLARE_DLSYM(hipMemPrefetchAsync);
 
@@ -50,10 +50,19 @@
  *===----------------------------------------------------------------------===
  */
 #include "kithip.h"
+#include "launch_cache.h"
+#include "machine.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <thread>
 #include <unordered_map> // IWYU pragma: keep (clang-tidy+tempaltes == bad???)
 
 // TODO: The hip runtime shares common implementation details 
@@ -74,26 +83,267 @@ typedef std::unordered_map<const void *, hipModule_t> KitHipModuleMap;
 static KitHipModuleMap _kithip_module_map;
 static std::mutex _kithip_module_map_mutex;
 
-// *** EXPERIMENTAL: The runtime maintains a map from kernel names to
-// kernel functions.  This avoids searching a module repeatedly at
-// kernel launch time and is primarily focused on reducing runtime
-// overheads.
-//
-// TODO: Finish exploration of map vs. CUDA call overheads.
-typedef std::unordered_map<const char *, hipFunction_t> KitHipKernelMap;
-static KitHipKernelMap _kithip_kernel_map;
+// Everything the runtime needs to know about a kernel to launch it.
+// Descriptors are created on a kernel's first launch and live for the
+// duration of the program.  The compiler hands each launch a pointer
+// to a per-kernel handle that caches the descriptor so subsequent
+// launches skip the (name-keyed) lookup below entirely.
+struct KitHipLaunchDesc {
+  const void *fat_bin;
+  std::string kernel_name;
+  hipFunction_t func;
+  int num_multiprocs;                   // device multi-processor count.
+  int warp_size;                        // kernel wavefront size.
+  int max_shared_per_blk;               // device LDS (bytes) per block.
+  int max_threads_per_blk;              // kernel block size limit.
+  int fixed_threads_per_blk;            // configured block size (0 if none).
+  std::atomic<int> occ_threads_per_blk; // occupancy calc result (0 if unset).
+  KitRTLaunchParamCache launch_params;  // per-trip count launch parameters.
+};
+
+// The wavefront size the compiler generated kernels for (see
+// '-hipabi-wavefront64'), or zero to use the device's native size.
+static int _kithip_wavefront_size = 0;
+
+typedef std::map<std::pair<const void *, std::string>, KitHipLaunchDesc *>
+    KitHipLaunchDescMap;
+static KitHipLaunchDescMap _kithip_launch_descs;
+
+// Identical code objects are embedded by every translation unit (or
+// shared library) that generates the same kernels -- e.g., from a
+// header.  Loaded modules are also kept by the hash of their code
+// object so each distinct code object is loaded only once per process,
+// however many images of it there are.
+struct KitHipLoadedModule {
+  const void *image; // the first image loaded.
+  size_t size;       // its size (0 for compressed bundles).
+  hipModule_t module;
+};
+static std::unordered_multimap<uint64_t, KitHipLoadedModule>
+    _kithip_module_cache;
+
+static uint64_t _kithip_fnv1a(const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Return the hash of the code object at 'image' and the extent of the
+// image, or false if the format of the image is not recognized.  The
+// images the compiler embeds are a compressed offload bundle (see
+// '-hipabi-compress-bundle'), whose header holds the (truncated) MD5
+// hash of its contents; an (uncompressed) offload bundle; or an ELF
+// code object.
+static bool _kithip_code_object_hash(const void *image, uint64_t &hash,
+                                     size_t &size) {
+  const char *bytes = (const char *)image;
+  if (memcmp(bytes, "CCOB", 4) == 0) {
+    uint32_t uncompressed_size;
+    memcpy(&uncompressed_size, bytes + 8, sizeof(uncompressed_size));
+    memcpy(&hash, bytes + 12, sizeof(hash));
+    hash ^= uncompressed_size;
+    size = 0;
+    return true;
+  }
+
+  const char bundle_magic[] = "__CLANG_OFFLOAD_BUNDLE__";
+  if (memcmp(bytes, bundle_magic, sizeof(bundle_magic) - 1) == 0) {
+    // The bundle ends with the last of its entries.
+    const char *p = bytes + sizeof(bundle_magic) - 1;
+    uint64_t num_entries;
+    memcpy(&num_entries, p, sizeof(num_entries));
+    p += sizeof(num_entries);
+    size = p - bytes;
+    for (uint64_t i = 0; i < num_entries; i++) {
+      uint64_t offset, entry_size, id_size;
+      memcpy(&offset, p, sizeof(offset));
+      memcpy(&entry_size, p + 8, sizeof(entry_size));
+      memcpy(&id_size, p + 16, sizeof(id_size));
+      p += 24 + id_size;
+      size = std::max(size, (size_t)std::max(offset + entry_size,
+                                             (uint64_t)(p - bytes)));
+    }
+  } else if (memcmp(bytes, "\x7f" "ELF", 4) == 0 && bytes[4] == 2) {
+    // A (64-bit) ELF image ends with its section header table.
+    uint64_t shoff;
+    uint16_t shentsize, shnum;
+    memcpy(&shoff, bytes + 0x28, sizeof(shoff));
+    memcpy(&shentsize, bytes + 0x3a, sizeof(shentsize));
+    memcpy(&shnum, bytes + 0x3c, sizeof(shnum));
+    size = shoff + (size_t)shentsize * shnum;
+  } else
+    return false;
+  hash = _kithip_fnv1a(image, size);
+  return true;
+}
+
+// NOTE: The caller must hold the module map lock.
+static hipModule_t _kithip_get_module(const void *fat_bin) {
+  KitHipModuleMap::iterator modit = _kithip_module_map.find(fat_bin);
+  if (modit != _kithip_module_map.end())
+    return modit->second;
+
+  // Reuse the module of an identical code object if one was loaded
+  // (the whole image is compared to rule out hash collisions).
+  uint64_t hash;
+  size_t size;
+  bool hashed = _kithip_code_object_hash(fat_bin, hash, size);
+  if (hashed) {
+    auto range = _kithip_module_cache.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const KitHipLoadedModule &loaded = it->second;
+      if (loaded.size == size &&
+          (size == 0 || memcmp(loaded.image, fat_bin, size) == 0)) {
+        if (__kitrt_verbose_mode())
+          fprintf(stderr, "kithip: reusing module of identical code "
+                  "object %p for %p.\n", loaded.image, fat_bin);
+        _kithip_module_map[fat_bin] = loaded.module;
+        return loaded.module;
+      }
+    }
+  }
+
+  // Create a supporting module and "register" the fat binary
+  // image in the map...
+  hipModule_t hip_module;
+  HIP_SAFE_CALL(hipModuleLoadData_p(&hip_module, fat_bin));
+  _kithip_module_map[fat_bin] = hip_module;
+  if (hashed)
+    _kithip_module_cache.insert({hash, {fat_bin, size, hip_module}});
+  return hip_module;
+}
+
+static KitHipLaunchDesc *_kithip_get_launch_desc(void **handle,
+                                                 const void *fat_bin,
+                                                 const char *kernel_name) {
+  if (handle != nullptr) {
+    void *desc = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+    if (desc != nullptr)
+      return (KitHipLaunchDesc *)desc;
+  }
+
+  std::lock_guard<std::mutex> lock(_kithip_module_map_mutex);
+  KitHipLaunchDesc *&desc =
+      _kithip_launch_descs[std::make_pair(fat_bin, std::string(kernel_name))];
+  if (desc == nullptr) {
+    desc = new KitHipLaunchDesc;
+    desc->fat_bin = fat_bin;
+    desc->kernel_name = kernel_name;
+    desc->occ_threads_per_blk = 0;
+    hipModule_t hip_module = _kithip_get_module(fat_bin);
+    HIP_SAFE_CALL(hipModuleGetFunction_p(&desc->func, hip_module, kernel_name));
+    HIP_SAFE_CALL(hipFuncGetAttribute_p(&desc->max_threads_per_blk,
+                                        HIP_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK,
+                                        desc->func));
+    const hipDeviceProp_t *props = __kithip_get_device_props();
+    desc->num_multiprocs = props->multiProcessorCount;
+    if (_kithip_wavefront_size != 0)
+      desc->warp_size = _kithip_wavefront_size;
+    else
+      desc->warp_size = props->warpSize;
+    desc->max_shared_per_blk = (int)props->sharedMemPerBlock;
+    // A block size can be set for the kernel in the runtime's
+    // configuration (see __kitrt_get_config()).
+    std::string setting = "KITHIP_THREADS_PER_BLOCK:" + desc->kernel_name;
+    desc->fixed_threads_per_blk = 0;
+    if (__kitrt_get_env_value(setting.c_str(), desc->fixed_threads_per_blk))
+      desc->fixed_threads_per_blk =
+          std::max(0, std::min(desc->fixed_threads_per_blk,
+                               desc->max_threads_per_blk));
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kithip: created launch descriptor for '%s'.\n",
+              kernel_name);
+  }
+  if (handle != nullptr)
+    __atomic_store_n(handle, (void *)desc, __ATOMIC_RELEASE);
+  return desc;
+}
+
+// Modules can be preloaded in the background at program startup (see
+// __kithip_preload_module()).  A single worker thread loads each
+// registered code object and creates the launch descriptors for its
+// kernels, filling in their handles.  The module map mutex is only
+// held per kernel so launches wait only if their own kernel (or its
+// module) is still being loaded.
+struct KitHipPreloadRequest {
+  const void *fat_bin;
+  const char **kernel_names;
+  void ***handles;
+  int num_kernels;
+};
+static bool _kithip_preload_enabled = false;
+static std::deque<KitHipPreloadRequest> _kithip_preload_queue;
+static std::mutex _kithip_preload_mutex;
+static std::condition_variable _kithip_preload_cv;
+static std::thread _kithip_preload_thread;
+static bool _kithip_preload_done = false;
+
+static void _kithip_preload_worker() {
+  HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));
+  while (true) {
+    KitHipPreloadRequest request;
+    {
+      std::unique_lock<std::mutex> lock(_kithip_preload_mutex);
+      _kithip_preload_cv.wait(lock, [] {
+        return _kithip_preload_done || not _kithip_preload_queue.empty();
+      });
+      if (_kithip_preload_done)
+        return;
+      request = _kithip_preload_queue.front();
+      _kithip_preload_queue.pop_front();
+    }
+    for (int i = 0; i < request.num_kernels; i++)
+      (void)_kithip_get_launch_desc(request.handles[i], request.fat_bin,
+                                    request.kernel_names[i]);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kithip: preloaded module %p (%d kernels).\n",
+              request.fat_bin, request.num_kernels);
+  }
+}
 
 extern "C" {
 
+void __kithip_enable_module_preload(bool enable) {
+  _kithip_preload_enabled = enable;
+}
+
+void __kithip_preload_module(const void *fat_bin, const char **kernel_names,
+                             void ***handles, int num_kernels) {
+  assert(fat_bin && "unexpected null fat binary!");
+  if (not _kithip_preload_enabled || not __kithip_is_initialized() ||
+      num_kernels <= 0)
+    return;
+  std::lock_guard<std::mutex> lock(_kithip_preload_mutex);
+  _kithip_preload_queue.push_back(
+      {fat_bin, kernel_names, handles, num_kernels});
+  if (not _kithip_preload_thread.joinable()) {
+    _kithip_preload_done = false;
+    _kithip_preload_thread = std::thread(_kithip_preload_worker);
+  }
+  _kithip_preload_cv.notify_one();
+}
+
+void __kithip_stop_module_preload() {
+  {
+    std::lock_guard<std::mutex> lock(_kithip_preload_mutex);
+    _kithip_preload_done = true;
+    _kithip_preload_queue.clear();
+  }
+  _kithip_preload_cv.notify_one();
+  if (_kithip_preload_thread.joinable())
+    _kithip_preload_thread.join();
+}
+
 // *** EXPERIMENTAL: The details of picking launch parameters can be a
 // challenge and occupancy is often one of the driving factors.  Occupancy
 // is defined, in "CUDA-ese", as the ratio of the number of active warps
 // per multiprocessor to the maximum number of active warps. Importantly,
 // having a higher occupancy does not guarantee better performance. It is
 // simply a metric of the latency hiding ability of a particular kernel.
-//
-// TODO: Would it behoove us to keep a record of launch parameters
-// for each kernel based on `trip_count`?
 
 // Without any tweaks from the environment or other runtime calls,
 // this is the default number of threads we'll launch per block (in
@@ -107,6 +357,21 @@ void __kithip_use_occupancy_launch(bool enable) {
   _kithip_use_occupancy_calc = enable;
 }
 
+void __kithip_refine_occupancy_launches(bool enable) {
+  if (enable) {
+    __kithip_use_occupancy_launch(true);
+    _kithip_refine_occupancy_calc = true;
+  } else
+    _kithip_refine_occupancy_calc = false;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kithip: %s occupancy launch refinement.\n",
+            enable ? "enabling" : "disabling");
+}
+
+void __kithip_set_wavefront_size(int wavefront_size) {
+  _kithip_wavefront_size = wavefront_size;
+}
+
 void __kithip_set_default_max_threads_per_blk(int num_threads) {
   _kithip_default_max_threads_per_blk = num_threads;
 }
@@ -117,13 +382,46 @@ void __kithip_set_default_threads_per_blk(int threads_per_blk) {
   _kithip_default_threads_per_blk = threads_per_blk;
 }
 
-typedef std::unordered_map<std::string, int> KitHipLaunchParamMap;
-static KitHipLaunchParamMap _kithip_launch_param_map;
-
 namespace {
 
-// we "borrow" this from cuda... 
-extern int next_lowest_factor(int n, int m);
+// Return the largest multiple of m that is less than n (or m).
+int next_lowest_factor(int n, int m) {
+  if (n > m) {
+    for (int i = n - 1; i != 0; i--) {
+      int r = i % m;
+      if (r == 0)
+        return i;
+    }
+  }
+  return m;
+}
+
+// The multi-processor load (blocks per multi-processor, in percent)
+// below which occupancy launches are refined: the saturating load of
+// the machine profile or, without a profile, 75%.
+float min_multiproc_load() {
+  static const float load = []() {
+    const KitRTMachineProfile *profile = __kitrt_get_machine_profile();
+    if (profile != nullptr && profile->device_saturating_load > 0.0)
+      return (float)profile->device_saturating_load;
+    return 75.0f;
+  }();
+  return load;
+}
+
+// Medium trip counts give each multi-processor only a few blocks and
+// the multi-processors that run one more block than the others set the
+// kernel's execution time.  Below this many blocks per multi-processor
+// the refinement looks for a smaller block size that splits the work
+// more evenly.
+const int KITHIP_REFINE_MAX_BLKS_PER_MULTIPROC = 8;
+
+// Return the fraction of the multi-processor time used by a launch of
+// the given number of blocks, assuming each block takes the same time.
+float multiproc_balance(int block_count, int num_multiprocs) {
+  int rounds = (block_count + num_multiprocs - 1) / num_multiprocs;
+  return (float)block_count / ((float)rounds * num_multiprocs);
+}
 
 /**
  * Get the launch parameters for a given kernel and trip count based
@@ -136,20 +434,26 @@ extern int next_lowest_factor(int n, int m);
  * within the implementation (and is far from an exact science...).
  *
  * @param trip_count - how many elements to process
- * @param kfunc - the actual CUDA function / kernel.
+ * @param desc - the launch descriptor of the kernel.
  * @param threads_per_blk - computed threads per block for launch
  * @param blks_per_grid - computed blocks per grid for launch
  */
-void __kithip_get_occ_launch_params(size_t trip_count, hipFunction_t kfunc,
+void __kithip_get_occ_launch_params(size_t trip_count, KitHipLaunchDesc *desc,
                                     int &threads_per_blk, int &blks_per_grid,
                                     const KitRTInstMix *inst_mix) {
   assert(_kithip_use_occupancy_calc && "called when occupancy mode is false!");
 
   // As a default starting point, the hip occupancy heuristic to get
-  // an initial occupancy-driven threads-per-block figure.
-  int min_grid_size;
-  HIP_SAFE_CALL(hipModuleOccupancyMaxPotentialBlockSize_p(
-      &min_grid_size, &threads_per_blk, kfunc, 0, 0));
+  // an initial occupancy-driven threads-per-block figure.  The result
+  // only depends on the kernel so it is computed once per descriptor.
+  threads_per_blk = desc->occ_threads_per_blk.load(std::memory_order_relaxed);
+  if (threads_per_blk == 0) {
+    int min_grid_size;
+    HIP_SAFE_CALL(hipModuleOccupancyMaxPotentialBlockSize_p(
+        &min_grid_size, &threads_per_blk, desc->func, 0, 0));
+    desc->occ_threads_per_blk.store(threads_per_blk,
+                                    std::memory_order_relaxed);
+  }
 
   if (_kithip_refine_occupancy_calc) {
     // Assume that the occupancy heuristic is flawed and look to refine 
@@ -157,12 +461,7 @@ void __kithip_get_occ_launch_params(size_t trip_count, hipFunction_t kfunc,
     // (i.e., it is not uncommon for the heuristic to return values 
     // that only use a limited number of available resources -- most 
     // often under-utilizing the number of available multi-processors).
-    extern int _kithip_device_id;
-
-    int num_multiprocs = 0;
-    HIP_SAFE_CALL(hipDeviceGetAttribute_p(
-        &num_multiprocs, hipDeviceAttributeMultiprocessorCount,
-        _kithip_device_id));
+    int num_multiprocs = desc->num_multiprocs;
 
     // Estimate how many multi-processors we are using with the provided 
     // threads-per-block value.. 
@@ -178,29 +477,26 @@ void __kithip_get_occ_launch_params(size_t trip_count, hipFunction_t kfunc,
     }
 
     // If the multi-proc load is low, reduce the threads-per-block until 
-    // we reach a point of better utilization (which we loosely define
-    // as >= 75% load).
+    // we reach a point of better utilization (see min_multiproc_load()).
     // 
     // TODO: There is a lot of work to do here:
     //
-    //   * 75% could be a parameter (runtime or build time). 
     //   * The compiler is handing us details on the instruction 
     //     mix but it doesn't accurately account for code structure 
     //     (e.g. inner loops).
     //   * A more comprehensive model of performance/hardware costs 
     //     could help but we'd have to balance runtime costs vs. accuracy. 
-    if (sm_load < 75) {
+    float min_load = min_multiproc_load();
+    if (sm_load < min_load) {
 
       if (__kitrt_verbose_mode())
         fprintf(stderr,
                 "  ***-GPU multi-processors are underutilized "
                 "-- adjusting threads-per-block.\n");
 
-      int warp_size = 0;
-      HIP_SAFE_CALL(hipDeviceGetAttribute_p(
-                    &warp_size, hipDeviceAttributeWarpSize, 
-                    _kithip_device_id));
-      while (block_count < num_multiprocs && threads_per_blk > warp_size) {
+      int warp_size = desc->warp_size;
+      float target_load = std::max(100.0f, min_load);
+      while (sm_load < target_load && threads_per_blk > warp_size) {
         threads_per_blk = next_lowest_factor(threads_per_blk, warp_size);
         block_count = (trip_count + threads_per_blk - 1) / threads_per_blk;
         sm_load = ((float)block_count / num_multiprocs) * 100.0;
@@ -212,6 +508,40 @@ void __kithip_get_occ_launch_params(size_t trip_count, hipFunction_t kfunc,
         fprintf(stderr, "\tmulti-proc load:   %3.2f%%\n", sm_load);
         fprintf(stderr, "---------------------------------------\n\n");
       }
+    } else if (block_count <
+               KITHIP_REFINE_MAX_BLKS_PER_MULTIPROC * num_multiprocs) {
+      // Every multi-processor has work but the last round of blocks
+      // can leave many of them idle (e.g., 1.5 blocks per
+      // multi-processor takes as long as 2).  Halve the block size, in
+      // whole wavefronts, while that balances the rounds better.
+      int warp_size = desc->warp_size;
+      float balance = multiproc_balance(block_count, num_multiprocs);
+      int best_threads_per_blk = threads_per_blk;
+      float best_balance = balance;
+      for (int tpb = threads_per_blk / 2;
+           tpb >= warp_size && tpb % warp_size == 0 && best_balance < 0.95f;
+           tpb /= 2) {
+        int blocks = (trip_count + tpb - 1) / tpb;
+        float b = multiproc_balance(blocks, num_multiprocs);
+        // Smaller blocks have their own costs so only take a clear
+        // improvement.
+        if (b > best_balance + 0.05f) {
+          best_threads_per_blk = tpb;
+          best_balance = b;
+        }
+      }
+      if (best_threads_per_blk != threads_per_blk) {
+        threads_per_blk = best_threads_per_blk;
+        if (__kitrt_verbose_mode()) {
+          fprintf(stderr, "  ***-multi-proc rounds are unbalanced "
+                          "(%3.2f%%) -- adjusting threads-per-block.\n",
+                  balance * 100.0);
+          fprintf(stderr, "\tthreads-per-block: %d\n", threads_per_blk);
+          fprintf(stderr, "\tround balance:     %3.2f%%\n",
+                  best_balance * 100.0);
+          fprintf(stderr, "---------------------------------------\n\n");
+        }
+      }
     }
   }
 
@@ -220,81 +550,91 @@ void __kithip_get_occ_launch_params(size_t trip_count, hipFunction_t kfunc,
 
 } // namespace
 
-void __kithip_get_launch_params(size_t trip_count, hipFunction_t kfunc,
-				const char *kfunc_name, 
+void __kithip_get_launch_params(size_t trip_count, KitHipLaunchDesc *desc,
                                 int &threads_per_blk, int &blks_per_grid,
 				const KitRTInstMix *inst_mix) {
-  std::string map_entry_name(kfunc_name);
-  map_entry_name += std::to_string(trip_count);
-
-  KitHipLaunchParamMap::iterator lpit = _kithip_launch_param_map.find(map_entry_name);
-  if (lpit != _kithip_launch_param_map.end())
-    // use previously determined parameters.
-    threads_per_blk = lpit->second;
-  else {
+  if (desc->fixed_threads_per_blk != 0) {
+    threads_per_blk = desc->fixed_threads_per_blk;
+    blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
+    return;
+  }
+  threads_per_blk = desc->launch_params.lookup(trip_count);
+  if (threads_per_blk == 0) {
     if (_kithip_use_occupancy_calc)
-      __kithip_get_occ_launch_params(trip_count, kfunc, threads_per_blk,
+      __kithip_get_occ_launch_params(trip_count, desc, threads_per_blk,
                                      blks_per_grid, inst_mix);
     else 
       threads_per_blk = _kithip_default_threads_per_blk;
-    _kithip_launch_param_map[map_entry_name] = threads_per_blk;
+    desc->launch_params.insert(trip_count, threads_per_blk);
   }
   blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
 }
 
+namespace {
+
+// Return the dynamic (LDS) shared memory needed by a launch of the
+// kernel with the given block size for its shared memory tiles (see the
+// compiler's '-hipabi-tile-loads').  The block size is reduced if the
+// tiles would not fit in the device's LDS.
+unsigned get_shared_mem_bytes(KitHipLaunchDesc *desc,
+                              const KitRTInstMix *inst_mix,
+                              int &threads_per_blk) {
+  if (inst_mix == nullptr)
+    return 0;
+  // The launch attribute can ask for more than the tiles need.
+  uint64_t min_bytes = std::min(inst_mix->launch_shared_bytes,
+                                (uint64_t)desc->max_shared_per_blk);
+  if (inst_mix->shared_bytes_per_thread == 0)
+    return (unsigned)min_bytes;
+  uint64_t bytes;
+  while ((bytes = inst_mix->shared_bytes_per_thread * threads_per_blk +
+                  inst_mix->shared_bytes) >
+             (uint64_t)desc->max_shared_per_blk &&
+         threads_per_blk > desc->warp_size)
+    threads_per_blk /= 2;
+  return (unsigned)std::max(bytes, min_bytes);
+}
+
+} // namespace
+
 void* __kithip_launch_kernel(const void *fat_bin, const char *kernel_name,
                              void **kern_args, uint64_t trip_count,
                              int threads_per_blk,
                              const KitRTInstMix *inst_mix,
-                             void *opaque_stream) {
+                             void *opaque_stream,
+                             void **launch_handle) {
 
   assert(fat_bin && "kithip: launch with null fat binary!");
   assert(kernel_name && "kithip: launch with null name!");
   assert(kern_args && "kithip: launch with null args!");
   assert(trip_count != 0 && "kithip: launch with zero trips!");
 
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, kernel_name);
+  if (inst_mix)
+    profile.set_source_loc(inst_mix->source_loc);
   HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));
 
   // Multiple threads can launch kernels in our current design.  If a
   // thread enters without having previously set the device the runtime
   // becomes unhappy with us.  Make sure we're following the rules.
-  hipFunction_t kern_func;
-  _kithip_module_map_mutex.lock();
-  KitHipKernelMap::iterator kernit = _kithip_kernel_map.find(kernel_name);
-  if (kernit == _kithip_kernel_map.end()) {
-    // We have not yet encountered this kernel function...  Check to see
-    // if we already have a supporting module for the fat binary.
-    hipModule_t hip_module;
-    KitHipModuleMap::iterator modit = _kithip_module_map.find(fat_bin);
-    if (modit == _kithip_module_map.end()) {
-      // Create a supporting module and "register" the fat binary
-      // image in the map...
-      HIP_SAFE_CALL(hipModuleLoadData_p(&hip_module, fat_bin));
-      _kithip_module_map[fat_bin] = hip_module;
-    } else
-      hip_module = modit->second;
-
-    // Look up the kernel function in the module.
-    HIP_SAFE_CALL(hipModuleGetFunction_p(&kern_func, hip_module, kernel_name));
-    _kithip_kernel_map[kernel_name] = kern_func;
-  } else
-    kern_func = kernit->second;
-
-  _kithip_module_map_mutex.unlock();
+  KitHipLaunchDesc *desc =
+      _kithip_get_launch_desc(launch_handle, fat_bin, kernel_name);
 
   int blks_per_grid;
   if (threads_per_blk == 0) 
-    __kithip_get_launch_params(trip_count, kern_func, kernel_name,
-			       threads_per_blk, blks_per_grid, inst_mix);
-  else
-    blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
+    __kithip_get_launch_params(trip_count, desc, threads_per_blk,
+                               blks_per_grid, inst_mix);
+  unsigned shared_mem = get_shared_mem_bytes(desc, inst_mix, threads_per_blk);
+  blks_per_grid = (trip_count + threads_per_blk - 1) / threads_per_blk;
 
   if (__kitrt_verbose_mode()) {
     fprintf(stderr, "kithip: '%s' launch parameters:\n", kernel_name);
     fprintf(stderr, "  blocks:     %d, 1, 1\n", blks_per_grid);
     fprintf(stderr, "  threads:    %d, 1, 1\n", threads_per_blk);
+    fprintf(stderr, "  shared mem: %u bytes\n", shared_mem);
     fprintf(stderr, "  trip count: %ld\n", trip_count);
   }
+  profile.set_geometry(blks_per_grid, 1, 1, threads_per_blk, 1, 1);
 
   hipStream_t hip_stream = nullptr;
   if (opaque_stream == nullptr) {
@@ -309,26 +649,146 @@ void* __kithip_launch_kernel(const void *fat_bin, const char *kernel_name,
               "kithip: launch stream is non-null.\n");
   }
 
-  HIP_SAFE_CALL(hipModuleLaunchKernel_p(kern_func, blks_per_grid, 1, 1,
+  profile.record_start(&_kithip_profile_ops, hip_stream);
+  HIP_SAFE_CALL(hipModuleLaunchKernel_p(desc->func, blks_per_grid, 1, 1,
                                         threads_per_blk, 1, 1,
+                                        shared_mem, // dynamic shared mem size
+                                        hip_stream, kern_args, NULL));
+  profile.record_end(hip_stream);
+  return (void *)hip_stream;
+}
+
+namespace {
+
+// Pick the shape of a block of (at most) threads_per_blk threads for a
+// multi-dimensional launch.  Each block covers a tile of the iteration
+// space: x spans (up to) a wavefront so that neighboring threads touch
+// neighboring memory and the remaining threads are spread over the
+// outer dimensions.  Dimensions are powers of two and not larger than
+// needed for the given extents.
+void get_block_shape(int threads_per_blk, int warp_size, unsigned num_dims,
+                     const uint64_t *extents, unsigned *shape) {
+  unsigned max_threads = 1;
+  while (max_threads * 2 <= (unsigned)threads_per_blk)
+    max_threads *= 2;
+
+  shape[0] = shape[1] = shape[2] = 1;
+  while (shape[0] < (unsigned)warp_size && shape[0] < max_threads &&
+         shape[0] < extents[0])
+    shape[0] *= 2;
+
+  unsigned threads = shape[0];
+  bool grew = true;
+  while (grew) {
+    grew = false;
+    for (unsigned d = 1; d < num_dims; d++) {
+      if (threads * 2 <= max_threads && shape[d] < extents[d]) {
+        shape[d] *= 2;
+        threads *= 2;
+        grew = true;
+      }
+    }
+  }
+  while (threads * 2 <= max_threads && shape[0] < extents[0]) {
+    shape[0] *= 2;
+    threads *= 2;
+  }
+}
+
+} // namespace
+
+void *__kithip_launch_kernel_nd(const void *fat_bin, const char *kernel_name,
+                                void **kern_args, uint64_t trip_count,
+                                int threads_per_blk,
+                                const KitRTInstMix *inst_mix,
+                                void *opaque_stream, uint32_t iv_size,
+                                void **launch_handle, uint32_t num_dims,
+                                const uint64_t *inner_extents) {
+  assert(fat_bin && "kithip: launch with null fat binary!");
+  assert(kernel_name && "kithip: launch with null name!");
+  assert(kern_args && "kithip: launch with null args!");
+  assert(trip_count != 0 && "kithip: launch with zero trips!");
+  assert(num_dims >= 2 && num_dims <= 3 &&
+         "kithip: unsupported launch dimensions!");
+
+  KitRTProfileScope profile(KITRT_PROFILE_LAUNCH, kernel_name);
+  if (inst_mix)
+    profile.set_source_loc(inst_mix->source_loc);
+  HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));
+  KitHipLaunchDesc *desc =
+      _kithip_get_launch_desc(launch_handle, fat_bin, kernel_name);
+
+  // The outermost dimension covers the rest of the iteration space.
+  uint64_t extents[3] = {1, 1, 1};
+  uint64_t inner_size = 1;
+  for (unsigned d = 0; d < num_dims - 1; d++) {
+    extents[d] = inner_extents[d];
+    inner_size *= extents[d];
+  }
+  uint64_t start = 0;
+  if (iv_size != 0)
+    start = __kithip_read_iv_arg(kern_args[1], iv_size);
+  if (inner_size == 0 || start >= trip_count) {
+    profile.cancel();
+    return opaque_stream;
+  }
+  extents[num_dims - 1] = (trip_count + inner_size - 1) / inner_size;
+
+  if (threads_per_blk == 0) {
+    int blks_per_grid;
+    __kithip_get_launch_params(trip_count, desc, threads_per_blk,
+                               blks_per_grid, inst_mix);
+  }
+  if (threads_per_blk > desc->max_threads_per_blk)
+    threads_per_blk = desc->max_threads_per_blk;
+
+  unsigned blk[3];
+  get_block_shape(threads_per_blk, desc->warp_size, num_dims, extents, blk);
+  uint64_t grid[3] = {1, 1, 1};
+  for (unsigned d = 0; d < num_dims; d++) {
+    grid[d] = (extents[d] + blk[d] - 1) / blk[d];
+    // The total number of work items in each dimension is limited to
+    // 32 bits.
+    if (grid[d] * blk[d] > UINT32_MAX) {
+      fprintf(stderr,
+              "kithip: launch of kernel '%s' exceeds the grid limits "
+              "(extents: %ld, %ld, %ld).\n",
+              kernel_name, extents[0], extents[1], extents[2]);
+      abort();
+    }
+  }
+
+  if (__kitrt_verbose_mode()) {
+    fprintf(stderr, "kithip: '%s' launch parameters:\n", kernel_name);
+    fprintf(stderr, "  blocks:     %ld, %ld, %ld\n", grid[0], grid[1],
+            grid[2]);
+    fprintf(stderr, "  threads:    %d, %d, %d\n", blk[0], blk[1], blk[2]);
+    fprintf(stderr, "  extents:    %ld, %ld, %ld\n", extents[0], extents[1],
+            extents[2]);
+    fprintf(stderr, "  trip count: %ld\n", trip_count);
+  }
+  profile.set_geometry(grid[0], grid[1], grid[2], blk[0], blk[1], blk[2]);
+
+  hipStream_t hip_stream = (hipStream_t)opaque_stream;
+  if (hip_stream == nullptr)
+    hip_stream = (hipStream_t)__kithip_get_thread_stream();
+
+  profile.record_start(&_kithip_profile_ops, hip_stream);
+  HIP_SAFE_CALL(hipModuleLaunchKernel_p(desc->func, grid[0], grid[1], grid[2],
+                                        blk[0], blk[1], blk[2],
                                         0, // shared mem size
                                         hip_stream, kern_args, NULL));
+  profile.record_end(hip_stream);
   return (void *)hip_stream;
 }
 
-  
 void *__kithip_get_global_symbol(void *fat_bin, const char *sym_name) {
   assert(fat_bin && "null fat binary!");
   assert(sym_name && "null symbol name!");
 
-  hipModule_t hip_module;
   _kithip_module_map_mutex.lock();
-  KitHipModuleMap::iterator modit = _kithip_module_map.find(fat_bin);
-  if (modit == _kithip_module_map.end()) {
-    HIP_SAFE_CALL(hipModuleLoadData_p(&hip_module, fat_bin));
-    _kithip_module_map[fat_bin] = hip_module;
-  } else
-    hip_module = modit->second;
+  hipModule_t hip_module = _kithip_get_module(fat_bin);
+  _kithip_module_map_mutex.unlock();
 
   // NOTE: The device pointer and size ('bytes') parameters for the
   // call to cuModuleGetGlobal are optional.  To simplify the compiler's
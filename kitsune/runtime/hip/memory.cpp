@@ -51,29 +51,307 @@
  */
 #include "kithip.h"
 #include "kithip_dylib.h"
+#include "mem_pool.h"
 #include "memory_map.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <mutex>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <vector>
 
-static std::mutex _kithip_mem_alloc_mutex;
+// Allocations are served from a size-class caching pool (see
+// mem_pool.h) when enabled.  This avoids a driver allocation for
+// each request and instead makes one per slab of managed memory.
+static KitRTMemPool *_kithip_mem_pool = nullptr;
+
+//
+// On devices that share coherent memory with the host (see
+// __kithip_has_unified_memory()) slabs come from host memory instead:
+// system allocations when the device can access pageable memory and
+// coarse-grained pinned allocations otherwise.
+static const size_t KITHIP_HOST_ALLOC_ALIGNMENT = 4096;
+
+static void *_kithip_mem_alloc_slab(size_t size) {
+  void *alloced_ptr;
+  if (__kithip_has_unified_memory()) {
+    if (__kithip_has_pageable_memory_access()) {
+      if (posix_memalign(&alloced_ptr, KITHIP_HOST_ALLOC_ALIGNMENT, size)) {
+        fprintf(stderr, "kithip: FATAL ERROR - "
+                        "unable to allocate %zu bytes of host memory.\n",
+                size);
+        abort();
+      }
+    } else
+      HIP_SAFE_CALL(hipHostMalloc_p(&alloced_ptr, size,
+                                    hipHostMallocNonCoherent));
+  } else
+    HIP_SAFE_CALL(hipMallocManaged_p(&alloced_ptr, size, hipMemAttachGlobal));
+  return alloced_ptr;
+}
+
+// Blocks freed to the managed memory pool may still be in use by
+// kernels in flight on any stream.  The pool reuses them only after the
+// device has been synchronized since they were freed (see
+// __kitrt_mem_pool_set_fence()); the fence is the count of device
+// synchronizations at the time of the free.
+static std::atomic<uint64_t> _kithip_device_syncs(0);
+
+static void *_kithip_mem_record_fence() {
+  return (void *)(uintptr_t)_kithip_device_syncs.load(
+      std::memory_order_acquire);
+}
+
+static bool _kithip_mem_fence_done(void *fence, bool wait) {
+  if (_kithip_device_syncs.load(std::memory_order_acquire) >
+      (uint64_t)(uintptr_t)fence)
+    return true;
+  if (not wait)
+    return false;
+  HIP_SAFE_CALL(hipDeviceSynchronize_p());
+  __kithip_mem_device_synced();
+  return true;
+}
+
+static void _kithip_mem_free_slab(void *vp) {
+  if (__kithip_has_unified_memory()) {
+    if (__kithip_has_pageable_memory_access())
+      free(vp);
+    else
+      HIP_SAFE_CALL(hipHostFree_p(vp));
+  } else
+    HIP_SAFE_CALL(hipFree_p(vp));
+}
+
+// Page-locked host buffers for explicit transfers (see
+// __kithip_mem_alloc_pinned()) come from a second pool.  They are
+// mapped (and portable) so kernels can also access them directly.
+// Pinned buffers are not registered in the memory map.
+static KitRTMemPool *_kithip_pinned_pool = nullptr;
+
+static void *_kithip_mem_alloc_pinned_slab(size_t size) {
+  void *vp;
+  HIP_SAFE_CALL(hipHostMalloc_p(&vp, size,
+                                hipHostMallocPortable | hipHostMallocMapped));
+  return vp;
+}
+
+static void _kithip_mem_free_pinned_slab(void *vp) {
+  HIP_SAFE_CALL(hipHostFree_p(vp));
+}
+
+// Pinned buffers freed behind work on a stream are returned for reuse
+// once the event recorded at the time of the free has completed.
+// Events are recycled.
+struct KitHipPinnedFree {
+  void *ptr;
+  hipEvent_t event;
+};
+static std::mutex _kithip_pinned_mutex;
+static std::vector<KitHipPinnedFree> _kithip_pinned_frees;
+static std::vector<hipEvent_t> _kithip_pinned_events;
+
+static void _kithip_mem_release_pinned(void *vp) {
+  if (not __kitrt_mem_pool_free(_kithip_pinned_pool, vp))
+    HIP_SAFE_CALL(hipHostFree_p(vp));
+}
+
+// Release the buffers whose deferred frees have completed; all of them
+// when 'wait' is set.  The caller must hold the pinned mutex.
+static void _kithip_mem_reclaim_pinned(bool wait) {
+  size_t kept = 0;
+  for (KitHipPinnedFree &pending : _kithip_pinned_frees) {
+    if (wait)
+      HIP_SAFE_CALL(hipEventSynchronize_p(pending.event));
+    else {
+      hipError_t status = hipEventQuery_p(pending.event);
+      if (status == hipErrorNotReady) {
+        _kithip_pinned_frees[kept++] = pending;
+        continue;
+      }
+      HIP_SAFE_CALL(status);
+    }
+    _kithip_mem_release_pinned(pending.ptr);
+    _kithip_pinned_events.push_back(pending.event);
+  }
+  _kithip_pinned_frees.resize(kept);
+}
+
+// Prefetch requests the compiler issues ahead of a launch (see
+// __kithip_mem_gpu_prefetch_async()) run on a small set of dedicated
+// streams so data migration overlaps with the host code leading up to
+// the launch.  An event is recorded behind each request; the launch's
+// stream waits on the events of its own arguments only.
+static const unsigned KITHIP_MAX_PREFETCH_STREAMS = 8;
+static hipStream_t _kithip_prefetch_streams[KITHIP_MAX_PREFETCH_STREAMS];
+static unsigned _kithip_next_prefetch_stream = 0;
+static std::unordered_map<void *, hipEvent_t> _kithip_prefetch_events;
+static std::atomic<unsigned> _kithip_num_prefetch_events(0);
+static std::mutex _kithip_prefetch_mutex;
+
+// The completion of the most recent host prefetch of each allocation
+// (see __kithip_mem_host_prefetch()).  Guarded by the prefetch mutex.
+static std::unordered_map<void *, hipEvent_t> _kithip_host_prefetch_events;
+
+// Kernels that reduce into an argument (see the compiler's lowering of
+// reductions) combine their values in a small device-side cell rather
+// than the (typically stack allocated) host variable.  The cells on
+// each stream are copied back to their host variables when the stream
+// is synchronized.  Cells are carved out of device allocations and
+// recycled.
+struct KitHipReduceRef {
+  void *cell;
+  void *host_ptr;
+  uint64_t size;
+};
+typedef std::vector<KitHipReduceRef> KitHipReduceRefs;
+static std::unordered_map<hipStream_t, KitHipReduceRefs> _kithip_reduce_refs;
+static std::vector<void *> _kithip_reduce_cells;
+static std::vector<void *> _kithip_reduce_slabs;
+static std::mutex _kithip_reduce_mutex;
+static const uint64_t KITHIP_REDUCE_CELL_SIZE = 16;
+static const unsigned KITHIP_REDUCE_CELLS_PER_SLAB = 64;
+
+// Make the given stream wait on an in-flight (early) prefetch of the
+// allocation starting at 'base', if any.  A null stream is replaced
+// by a thread stream when there is something to wait on.  Returns
+// true if a wait was issued.
+static bool _kithip_mem_wait_prefetch(void *base, hipStream_t *hip_stream) {
+  if (_kithip_num_prefetch_events.load(std::memory_order_relaxed) == 0)
+    return false;
+  std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+  auto it = _kithip_prefetch_events.find(base);
+  if (it == _kithip_prefetch_events.end())
+    return false;
+  if (*hip_stream == nullptr)
+    *hip_stream = (hipStream_t)__kithip_get_thread_stream();
+  HIP_SAFE_CALL(hipStreamWaitEvent_p(*hip_stream, it->second, 0));
+  // The event's resources are released once the prefetch completes.
+  HIP_SAFE_CALL(hipEventDestroy_p(it->second));
+  _kithip_prefetch_events.erase(it);
+  _kithip_num_prefetch_events.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
 
 extern "C" {
 
+void __kithip_create_mem_pool() {
+  assert(_kithip_mem_pool == nullptr && "memory pool already created!");
+  _kithip_mem_pool = __kitrt_create_mem_pool("kithip",
+                                             _kithip_mem_alloc_slab,
+                                             _kithip_mem_free_slab);
+  __kitrt_mem_pool_set_fence(_kithip_mem_pool, _kithip_mem_record_fence,
+                             _kithip_mem_fence_done);
+  _kithip_pinned_pool =
+      __kitrt_create_mem_pool("kithip-pinned", _kithip_mem_alloc_pinned_slab,
+                              _kithip_mem_free_pinned_slab);
+}
+
+void __kithip_mem_device_synced() {
+  _kithip_device_syncs.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void __kithip_destroy_mem_pool() {
+  {
+    std::lock_guard<std::mutex> lock(_kithip_pinned_mutex);
+    _kithip_mem_reclaim_pinned(true);
+    for (hipEvent_t event : _kithip_pinned_events)
+      HIP_SAFE_CALL(hipEventDestroy_p(event));
+    _kithip_pinned_events.clear();
+  }
+  __kitrt_destroy_mem_pool(_kithip_pinned_pool);
+  _kithip_pinned_pool = nullptr;
+  __kitrt_destroy_mem_pool(_kithip_mem_pool);
+  _kithip_mem_pool = nullptr;
+}
+
+__attribute__((malloc)) void *__kithip_mem_alloc_pinned(size_t size) {
+  assert(size != 0 && "zero-valued size!");
+  extern bool _kithip_initialized;
+  if (not _kithip_initialized)
+    __kithip_initialize();
+
+  // Give buffers whose deferred frees have completed back to the pool
+  // before asking it for more.
+  {
+    std::lock_guard<std::mutex> lock(_kithip_pinned_mutex);
+    if (not _kithip_pinned_frees.empty())
+      _kithip_mem_reclaim_pinned(false);
+  }
+  void *vp = __kitrt_mem_pool_alloc(_kithip_pinned_pool, size);
+  if (vp == nullptr)
+    vp = _kithip_mem_alloc_pinned_slab(size);
+  return vp;
+}
+
+void __kithip_mem_free_pinned(void *vp, void *opaque_stream) {
+  if (vp == nullptr)
+    return;
+  if (opaque_stream == nullptr) {
+    _kithip_mem_release_pinned(vp);
+    return;
+  }
+
+  // Copies (or kernels) on the stream may still use the buffer.  Hold
+  // it back until the work issued so far has completed.
+  std::lock_guard<std::mutex> lock(_kithip_pinned_mutex);
+  hipEvent_t event;
+  if (_kithip_pinned_events.empty())
+    HIP_SAFE_CALL(hipEventCreateWithFlags_p(&event, hipEventDisableTiming));
+  else {
+    event = _kithip_pinned_events.back();
+    _kithip_pinned_events.pop_back();
+  }
+  HIP_SAFE_CALL(hipEventRecord_p(event, (hipStream_t)opaque_stream));
+  _kithip_pinned_frees.push_back({vp, event});
+}
+
+__attribute__((malloc)) void *__kithip_mem_alloc_device(size_t size) {
+  assert(size != 0 && "zero-valued size!");
+  extern bool _kithip_initialized;
+  if (not _kithip_initialized)
+    __kithip_initialize();
+
+  HIP_SAFE_CALL(hipSetDevice(__kithip_get_device_id()));
+  void *vp;
+  HIP_SAFE_CALL(hipMalloc_p(&vp, size));
+  return vp;
+}
+
+void __kithip_mem_free_device(void *vp) {
+  if (vp != nullptr)
+    HIP_SAFE_CALL(hipFree_p(vp));
+}
+
+bool __kithip_mem_on_device(void *vp) {
+  // With unified memory the device can access all data in place.
+  // Otherwise memory that is not in the map (e.g., pinned buffers)
+  // lives on the host.
+  if (__kithip_has_unified_memory())
+    return true;
+  size_t size = 0;
+  void *base = vp;
+  bool prefetched = __kitrt_is_mem_prefetched(vp, &size, &base);
+  return size != 0 && prefetched;
+}
+
 __attribute__((malloc)) void *__kithip_mem_alloc_managed(size_t size) {
   extern bool _kithip_initialized;
   if (not _kithip_initialized)
     __kithip_initialize();
   
-  void *alloced_ptr;
   HIP_SAFE_CALL(hipSetDevice(__kithip_get_device_id()));
-  HIP_SAFE_CALL(hipMallocManaged_p(&alloced_ptr, size, hipMemAttachGlobal));
-  _kithip_mem_alloc_mutex.lock();
+  void *alloced_ptr = __kitrt_mem_pool_alloc(_kithip_mem_pool, size);
+  if (alloced_ptr == nullptr)
+    alloced_ptr = _kithip_mem_alloc_slab(size);
+  // Nothing is prefetched (or advised) until the allocation's first use
+  // by a kernel (see __kithip_mem_gpu_prefetch()).  The pages are placed
+  // on first touch, so the host writes that usually initialize the data
+  // stay local to the host rather than faulting back pages that were
+  // moved to the device ahead of them.
   __kitrt_register_mem_alloc(alloced_ptr, size);
-  _kithip_mem_alloc_mutex.unlock();
-  // Cheat a tad and just go ahead and issue a prefetch at allocation
-  // time.  Could bite us but what the heck...
-  HIP_SAFE_CALL(hipMemPrefetchAsync_p(alloced_ptr, size,
-                     __kithip_get_device_id(),
-                     (hipStream_t)__kithip_get_thread_stream()));
   return alloced_ptr;
 }
 
@@ -84,6 +362,10 @@ __attribute__((malloc)) void *__kithip_mem_calloc_managed(size_t count,
 
   size_t nbytes = count * element_size;
   void *memp = __kithip_mem_alloc_managed(nbytes);
+  if (__kithip_has_unified_memory()) {
+    memset(memp, 0, nbytes);
+    return memp;
+  }
 
   // TODO: Is there a risk of a race here?
   HIP_SAFE_CALL(
@@ -92,8 +374,8 @@ __attribute__((malloc)) void *__kithip_mem_calloc_managed(size_t count,
   return (void *)memp;
 }
 
-__attribute__((malloc)) void *__kithip__mem_realloc_managed(void *ptr,
-                                                            size_t size) {
+__attribute__((malloc)) void *__kithip_mem_realloc_managed(void *ptr,
+                                                           size_t size) {
   assert(size != 0 && "zero-valued size!");
   void *memptr = nullptr;
   size_t alloced_nbytes = 0;
@@ -128,19 +410,94 @@ __attribute__((malloc)) void *__kithip__mem_realloc_managed(void *ptr,
   return memptr;
 }
 
+__attribute__((malloc)) void *__kithip_mem_reserve_managed(size_t max_bytes) {
+  extern bool _kithip_initialized;
+  if (not _kithip_initialized)
+    __kithip_initialize();
+
+  // Devices that access pageable memory use a host reservation as is.
+  // Otherwise the reservation is managed memory, whose pages are only
+  // populated on first touch.
+  if (__kithip_has_pageable_memory_access())
+    return __kitrt_default_mem_reserve(max_bytes);
+  HIP_SAFE_CALL(hipSetDevice(__kithip_get_device_id()));
+  void *alloced_ptr;
+  HIP_SAFE_CALL(hipMallocManaged_p(&alloced_ptr, max_bytes,
+                                   hipMemAttachGlobal));
+  return alloced_ptr;
+}
+
+void __kithip_mem_commit_managed(void *base, size_t nbytes) {
+  assert(base && "unexpected null pointer!");
+  if (__kithip_has_pageable_memory_access())
+    __kitrt_default_mem_commit(base, nbytes);
+  else
+    __kitrt_resize_mem_alloc(base, nbytes);
+}
+
+void __kithip_mem_release_managed(void *base, size_t max_bytes) {
+  assert(base && "unexpected null pointer!");
+  if (__kithip_has_pageable_memory_access()) {
+    __kitrt_default_mem_release(base, max_bytes);
+    return;
+  }
+  __kitrt_unregister_mem_alloc(base);
+  HIP_SAFE_CALL(hipFree_p(base));
+}
+
+void *__kithip_mem_map_file(const char *path, size_t *nbytes) {
+  extern bool _kithip_initialized;
+  if (not _kithip_initialized)
+    __kithip_initialize();
+
+  // Devices that access pageable memory use the file mapping in place.
+  if (__kithip_has_pageable_memory_access())
+    return __kitrt_default_mem_map_file(path, nbytes);
+
+  size_t size = 0;
+  void *file = __kitrt_map_file(path, &size);
+  if (nbytes)
+    *nbytes = size;
+  if (file == nullptr)
+    return nullptr;
+
+  // Otherwise the file is copied to managed memory a chunk at a time,
+  // and each chunk is prefetched to the device while the next is read.
+  const size_t chunk = 64ul << 20;
+  void *vp = __kithip_mem_alloc_managed(size);
+  hipStream_t stream = (hipStream_t)__kithip_get_thread_stream();
+  for (size_t offset = 0; offset < size; offset += chunk) {
+    size_t n = std::min(chunk, size - offset);
+    memcpy((char *)vp + offset, (char *)file + offset, n);
+    if (not __kithip_has_unified_memory())
+      HIP_SAFE_CALL(hipMemPrefetchAsync_p((char *)vp + offset, n,
+                                          __kithip_get_device_id(), stream));
+  }
+  munmap(file, size);
+  __kitrt_mark_mem_read_only(vp);
+  return vp;
+}
+
+void __kithip_mem_unmap_file(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  if (__kithip_has_pageable_memory_access())
+    __kitrt_default_mem_unmap_file(vp);
+  else
+    __kithip_mem_free(vp);
+}
+
 void __kithip_mem_free(void *vp) {
   assert(vp && "unexpected null pointer!");
-  _kithip_mem_alloc_mutex.lock();
   __kitrt_unregister_mem_alloc(vp);
-  _kithip_mem_alloc_mutex.unlock();
-  HIP_SAFE_CALL(hipFree_p(vp));
+  if (not __kitrt_mem_pool_free(_kithip_mem_pool, vp))
+    _kithip_mem_free_slab(vp);
 }
 
 void __kithip_mem_destroy(void *vp) {
   // This entry point is used to clean up only the
   // HIP portions of an allocation -- it is used
   // by the runtime at program exit.
-  HIP_SAFE_CALL(hipFree_p(vp));
+  _kithip_mem_free_slab(vp);
 }
 
 bool __kithip_is_mem_managed(void *vp) {
@@ -155,11 +512,47 @@ bool __kithip_is_mem_managed(void *vp) {
   return (r == hipSuccess) && is_managed;
 }
 
+// Advise the driver that the allocation at base is used by the current
+// device ahead of moving it there.  Each advise call is expensive (e.g.,
+// on MI250X), so the advice is tracked in the allocation's entry: the
+// access advice is given once per allocation and the preferred location
+// only when it last pointed elsewhere (at the host after a host prefetch
+// or an eviction).
+static void _kithip_mem_advise_device(void *base, size_t size) {
+  int device = __kithip_get_device_id();
+  if (__kitrt_exchange_mem_advice(base, device) != device)
+    HIP_SAFE_CALL(hipMemAdvise_p(base, size, hipMemAdviseSetPreferredLocation,
+                                 device));
+  if (not __kitrt_test_and_set_mem_device_advice(base)) {
+    HIP_SAFE_CALL(hipMemAdvise_p(base, size, hipMemAdviseSetAccessedBy,
+                                 device));
+    HIP_SAFE_CALL(hipMemAdvise_p(base, size, hipMemAdviseSetCoarseGrain,
+                                 device));
+  }
+}
+
+// Advise the driver that the allocation at base is preferably kept in
+// host memory (unless it already is).
+static void _kithip_mem_advise_host(void *base, size_t size) {
+  if (__kitrt_exchange_mem_advice(base, KITRT_MEM_ADVISED_HOST) !=
+      KITRT_MEM_ADVISED_HOST)
+    HIP_SAFE_CALL(hipMemAdvise_p(base, size, hipMemAdviseSetPreferredLocation,
+                                 hipCpuDeviceId));
+}
+
 // NOTE: See within the code below for notes about the prefetching
 // semantics.
 void* __kithip_mem_gpu_prefetch(void *vp, void *opaque_stream) {
   assert(vp && "unexpected null pointer!");
+  // Keep the memory map off the launch path when there is no data to
+  // move.
+  if (__kithip_has_unified_memory())
+    return nullptr;
   size_t size = 0;
+  // The pointer may reference the interior of an allocation (e.g., a
+  // sub-array passed as a kernel argument).  Advice and prefetching
+  // are applied to the entire allocation that contains it.
+  void *base = vp;
 
   // TODO: Prefetching details and approaches need to be further
   // explored.  In particular, in concert with compiler analysis
@@ -173,18 +566,12 @@ void* __kithip_mem_gpu_prefetch(void *vp, void *opaque_stream) {
   // lead to page faults and evictions of pages...  At present this
   // has lead to the best general performance and reduced complexity,
   // while also maintaining correctness.
-  if (not __kitrt_is_mem_prefetched(vp, &size)) {
+  if (not __kitrt_is_mem_prefetched(vp, &size, &base)) {
     if (size > 0) {
-      HIP_SAFE_CALL(hipMemAdvise_p(vp, size, hipMemAdviseSetPreferredLocation,
-                                   __kithip_get_device_id()));
-      HIP_SAFE_CALL(hipMemAdvise_p(vp, size, hipMemAdviseSetAccessedBy,
-                                   __kithip_get_device_id()));
-      HIP_SAFE_CALL(hipMemAdvise_p(vp, size, hipMemAdviseSetCoarseGrain,
-                                   __kithip_get_device_id()));
+      _kithip_mem_advise_device(base, size);
 
       hipStream_t hip_stream;
       if (opaque_stream) {
-        if (__kitrt_verbose_mode())
         hip_stream = (hipStream_t)opaque_stream;
       } else {
         hip_stream = (hipStream_t)__kithip_get_thread_stream();
@@ -195,13 +582,23 @@ void* __kithip_mem_gpu_prefetch(void *vp, void *opaque_stream) {
 
       if (__kitrt_verbose_mode()) 
         fprintf(stderr, "\tkithip: issue prefetch [address=%p, size=%ld, stream=%p].\n", 
-                vp, size, (void*)hip_stream);	
-      HIP_SAFE_CALL(hipMemPrefetchAsync_p(vp, size, __kithip_get_device_id(),
+                base, size, (void*)hip_stream);	
+      KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "prefetch");
+      profile.set_bytes(size);
+      profile.record_start(&_kithip_profile_ops, hip_stream);
+      HIP_SAFE_CALL(hipMemPrefetchAsync_p(base, size, __kithip_get_device_id(),
                                           hip_stream));
-      __kitrt_mark_mem_prefetched(vp);
+      profile.record_end(hip_stream);
+      __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, size);
+      __kitrt_mark_mem_prefetched(base);
       return (void*)hip_stream;
     }
   } else {
+    // Data requested by an early prefetch only needs the launch's
+    // stream to wait for it.
+    hipStream_t hip_stream = (hipStream_t)opaque_stream;
+    if (size > 0 && _kithip_mem_wait_prefetch(base, &hip_stream))
+      return (void*)hip_stream;
     if (__kitrt_verbose_mode()) 
       fprintf(stderr, 
               "\tkithip: skipping previously prefetched data [address=%p, size=%ld].\n", 
@@ -211,8 +608,90 @@ void* __kithip_mem_gpu_prefetch(void *vp, void *opaque_stream) {
   return nullptr;
 }
 
-void __kithip_mem_host_prefetch(void *vp) {
+void *__kithip_mem_gpu_prefetch_batch(void **ptrs, int num_ptrs,
+                                      void *opaque_stream) {
+  assert(ptrs && "unexpected null argument list!");
+  if (__kithip_has_unified_memory())
+    return nullptr;
+
+  // Kernels rarely take more than a handful of pointers so a linear
+  // search for allocations already seen is cheaper than a map.
+  std::vector<void *> bases;
+  bases.reserve(num_ptrs);
+  void *stream = opaque_stream;
+  for (int i = 0; i < num_ptrs; i++) {
+    size_t size = 0;
+    void *base = ptrs[i];
+    __kitrt_get_mem_residency(ptrs[i], &size, &base);
+    if (std::find(bases.begin(), bases.end(), base) != bases.end())
+      continue;
+    bases.push_back(base);
+    void *new_stream = __kithip_mem_gpu_prefetch(ptrs[i], stream);
+    if (stream == nullptr)
+      stream = new_stream;
+  }
+  return stream;
+}
+
+void __kithip_mem_gpu_prefetch_async(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  if (not __kitrt_prefetchStreamsEnabled() || __kithip_has_unified_memory())
+    return;
+
+  size_t size = 0;
+  void *base = vp;
+  if (__kitrt_is_mem_prefetched(vp, &size, &base) || size == 0)
+    return;
+
+  _kithip_mem_advise_device(base, size);
+
+  std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+  unsigned num_streams = std::min(__kitrt_getNumPrefetchStreams(),
+                                  KITHIP_MAX_PREFETCH_STREAMS);
+  unsigned index = _kithip_next_prefetch_stream++ % num_streams;
+  hipStream_t &stream = _kithip_prefetch_streams[index];
+  if (stream == nullptr)
+    HIP_SAFE_CALL(hipStreamCreateWithFlags_p(&stream, hipStreamNonBlocking));
+
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kithip: early prefetch [address=%p, size=%zu, "
+            "stream=%p].\n", base, size, (void *)stream);
+  KitRTProfileScope profile(KITRT_PROFILE_TO_DEVICE, "prefetch");
+  profile.set_bytes(size);
+  profile.record_start(&_kithip_profile_ops, stream);
+  HIP_SAFE_CALL(hipMemPrefetchAsync_p(base, size, __kithip_get_device_id(),
+                                      stream));
+  profile.record_end(stream);
+  __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_DEVICE, size);
+  hipEvent_t &event = _kithip_prefetch_events[base];
+  if (event == nullptr) {
+    HIP_SAFE_CALL(hipEventCreateWithFlags_p(&event, hipEventDisableTiming));
+    _kithip_num_prefetch_events.fetch_add(1, std::memory_order_relaxed);
+  }
+  HIP_SAFE_CALL(hipEventRecord_p(event, stream));
+  __kitrt_mark_mem_prefetched(base);
+}
+
+void __kithip_destroy_prefetch_streams() {
+  std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+  for (auto &entry : _kithip_prefetch_events)
+    HIP_SAFE_CALL(hipEventDestroy_p(entry.second));
+  _kithip_prefetch_events.clear();
+  _kithip_num_prefetch_events = 0;
+  for (auto &entry : _kithip_host_prefetch_events)
+    HIP_SAFE_CALL(hipEventDestroy_p(entry.second));
+  _kithip_host_prefetch_events.clear();
+  for (hipStream_t &stream : _kithip_prefetch_streams) {
+    if (stream != nullptr)
+      HIP_SAFE_CALL(hipStreamDestroy_p(stream));
+    stream = nullptr;
+  }
+}
+
+void *__kithip_mem_host_prefetch(void *vp, void *opaque_stream) {
   assert(vp && "unexpected null pointer!");
+  if (__kithip_has_unified_memory())
+    return nullptr;
   // TODO: Prefetching details and approaches need to be further
   // explored.  In particular, in concert with compiler analysis and
   // code generation.
@@ -226,8 +705,14 @@ void __kithip_mem_host_prefetch(void *vp) {
   // faults and evictions.  Little work has been done with host-side
   // prefetch requests.
   size_t size;
-  if (__kitrt_is_mem_prefetched(vp, &size)) {
-    if (size > 0) {
+  void *base = vp;
+  if (__kitrt_is_mem_prefetched(vp, &size, &base)) {
+    if (size > 0 && __kitrt_is_mem_read_only(base)) {
+      // Read-mostly data was duplicated (not migrated) to the device
+      // and the host-side copy is still valid.  There is nothing to
+      // write back.
+      __kitrt_set_mem_prefetch(base, false);
+    } else if (size > 0) {
       // The logic here resets the memory advice from being
       // GPU-centric to host-side preferred.  The logic is
       // to assume that host-side access suggests pending
@@ -236,18 +721,187 @@ void __kithip_mem_host_prefetch(void *vp) {
       //
       // TODO: A lot of work needs to go into seeing if we can be
       // smarter about device- and host-side prefetching.
-      HIP_SAFE_CALL(hipMemAdvise_p(vp, size, hipMemAdviseSetPreferredLocation,
-                                   __kithip_get_device_id()));
-      // Issue a prefetch request on the stream associated with the
-      // calling thread. Once issued go ahead and mark the memory as
+      _kithip_mem_advise_host(base, size);
+      // Issue the prefetch on the given stream (or the stream of the
+      // calling thread) so that it is ordered after the kernels that
+      // produce the data.  Once issued go ahead and mark the memory as
       // no long being prefetched to the device/GPU.  This "mark" does
-      // not guarantee prefetching is complete it simply flags that
-      // the "instruction" has been issued by the runtime.
-      HIP_SAFE_CALL(hipMemPrefetchAsync_p(vp, size, __kithip_get_device_id(),
-                                 (hipStream_t)__kithip_get_thread_stream()));
-      __kitrt_set_mem_prefetch(vp, false);
+      // not guarantee prefetching is complete -- an event recorded
+      // behind the request tracks its completion (see
+      // __kithip_mem_host_prefetch_wait()).
+      hipStream_t hip_stream = (hipStream_t)opaque_stream;
+      if (hip_stream == nullptr)
+        hip_stream = (hipStream_t)__kithip_get_thread_stream();
+      if (__kitrt_verbose_mode())
+        fprintf(stderr, "kithip: host prefetch [address=%p, size=%zu, "
+                "stream=%p].\n", base, size, (void *)hip_stream);
+      KitRTProfileScope profile(KITRT_PROFILE_TO_HOST, "prefetch");
+      profile.set_bytes(size);
+      profile.record_start(&_kithip_profile_ops, hip_stream);
+      HIP_SAFE_CALL(hipMemPrefetchAsync_p(base, size, hipCpuDeviceId,
+                                          hip_stream));
+      profile.record_end(hip_stream);
+      __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_HOST, size);
+      std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+      hipEvent_t &event = _kithip_host_prefetch_events[base];
+      if (event == nullptr)
+        HIP_SAFE_CALL(hipEventCreateWithFlags_p(&event, hipEventDisableTiming));
+      HIP_SAFE_CALL(hipEventRecord_p(event, hip_stream));
+      __kitrt_set_mem_prefetch(base, false);
+      return (void *)hip_stream;
     }
   }
+  return nullptr;
+}
+
+bool __kithip_mem_host_prefetch_done(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  if (__kithip_has_unified_memory())
+    return true;
+  // Prefetches are tracked by the base of the allocation.
+  void *base = vp;
+  __kitrt_is_mem_prefetched(vp, nullptr, &base);
+  std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+  auto it = _kithip_host_prefetch_events.find(base);
+  if (it == _kithip_host_prefetch_events.end())
+    return true;
+  hipError_t result = hipEventQuery_p(it->second);
+  if (result == hipErrorNotReady)
+    return false;
+  HIP_SAFE_CALL(result);
+  HIP_SAFE_CALL(hipEventDestroy_p(it->second));
+  _kithip_host_prefetch_events.erase(it);
+  return true;
+}
+
+void __kithip_mem_host_prefetch_wait(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  if (__kithip_has_unified_memory())
+    return;
+  // Prefetches are tracked by the base of the allocation.
+  void *base = vp;
+  __kitrt_is_mem_prefetched(vp, nullptr, &base);
+  hipEvent_t event = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_kithip_prefetch_mutex);
+    auto it = _kithip_host_prefetch_events.find(base);
+    if (it == _kithip_host_prefetch_events.end())
+      return;
+    event = it->second;
+    _kithip_host_prefetch_events.erase(it);
+  }
+  HIP_SAFE_CALL(hipEventSynchronize_p(event));
+  HIP_SAFE_CALL(hipEventDestroy_p(event));
+}
+
+void __kithip_mem_mark_cold(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  // Unified memory is shared by the host and the device; there is no
+  // device memory to free.
+  if (__kithip_has_unified_memory())
+    return;
+  size_t size = 0;
+  void *base = vp;
+  (void)__kitrt_get_mem_residency(vp, &size, &base);
+  if (size == 0 || __kitrt_is_mem_cold(base))
+    return;
+
+  // Move the pages to the host and keep them there until the
+  // allocation is next prefetched to the device (which restores the
+  // device as the preferred location).
+  _kithip_mem_advise_host(base, size);
+  hipStream_t hip_stream = (hipStream_t)__kithip_get_thread_stream();
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kithip: evict cold data to host [address=%p, "
+            "size=%zu, stream=%p].\n", base, size, (void *)hip_stream);
+  KitRTProfileScope profile(KITRT_PROFILE_TO_HOST, "evict");
+  profile.set_bytes(size);
+  profile.record_start(&_kithip_profile_ops, hip_stream);
+  HIP_SAFE_CALL(hipMemPrefetchAsync_p(base, size, hipCpuDeviceId,
+                                      hip_stream));
+  profile.record_end(hip_stream);
+  __kitrt_count_mem_site(base, KITRT_SITE_PREFETCH_TO_HOST, size);
+  __kitrt_mark_mem_needs_prefetch(base);
+  __kitrt_set_mem_cold(base, true);
+}
+
+void *__kithip_mem_reduce_map(void *vp, uint64_t size, void **opaque_stream) {
+  assert(vp && "unexpected null pointer!");
+  assert(opaque_stream && "unexpected null stream pointer!");
+  if (size > KITHIP_REDUCE_CELL_SIZE) {
+    fprintf(stderr, "kithip: unsupported reduction size (%ld bytes).\n",
+            (long)size);
+    exit(EXIT_FAILURE);
+  }
+
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kithip_get_thread_stream();
+  hipStream_t hip_stream = (hipStream_t)*opaque_stream;
+
+  std::lock_guard<std::mutex> lock(_kithip_reduce_mutex);
+  if (_kithip_reduce_cells.empty()) {
+    void *slab;
+    HIP_SAFE_CALL(hipMalloc_p(
+        &slab, KITHIP_REDUCE_CELL_SIZE * KITHIP_REDUCE_CELLS_PER_SLAB));
+    _kithip_reduce_slabs.push_back(slab);
+    for (unsigned i = 0; i < KITHIP_REDUCE_CELLS_PER_SLAB; i++)
+      _kithip_reduce_cells.push_back((char *)slab +
+                                     i * KITHIP_REDUCE_CELL_SIZE);
+  }
+  void *cell = _kithip_reduce_cells.back();
+  _kithip_reduce_cells.pop_back();
+
+  // The kernel combines its result with the host variable's current
+  // value (e.g., the reduction's identity).
+  HIP_SAFE_CALL(hipMemcpyHtoDAsync_p(cell, vp, size, hip_stream));
+  _kithip_reduce_refs[hip_stream].push_back({cell, vp, size});
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kithip: mapped reduction result [address=%p, "
+            "size=%ld, stream=%p].\n", vp, (long)size, (void *)hip_stream);
+  return cell;
+}
+
+void __kithip_mem_flush_reductions(void *opaque_stream) {
+  std::lock_guard<std::mutex> lock(_kithip_reduce_mutex);
+  auto flush = [](hipStream_t stream, const KitHipReduceRefs &refs) {
+    for (const KitHipReduceRef &ref : refs)
+      HIP_SAFE_CALL(hipMemcpyDtoHAsync_p(ref.host_ptr, ref.cell, ref.size,
+                                         stream));
+  };
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kithip_reduce_refs)
+      flush(entry.first, entry.second);
+  } else {
+    auto it = _kithip_reduce_refs.find((hipStream_t)opaque_stream);
+    if (it != _kithip_reduce_refs.end())
+      flush(it->first, it->second);
+  }
+}
+
+void __kithip_mem_release_reductions(void *opaque_stream) {
+  std::lock_guard<std::mutex> lock(_kithip_reduce_mutex);
+  auto release = [](KitHipReduceRefs &refs) {
+    for (const KitHipReduceRef &ref : refs)
+      _kithip_reduce_cells.push_back(ref.cell);
+    refs.clear();
+  };
+  if (opaque_stream == nullptr) {
+    for (auto &entry : _kithip_reduce_refs)
+      release(entry.second);
+  } else {
+    auto it = _kithip_reduce_refs.find((hipStream_t)opaque_stream);
+    if (it != _kithip_reduce_refs.end())
+      release(it->second);
+  }
+}
+
+void __kithip_destroy_reductions() {
+  std::lock_guard<std::mutex> lock(_kithip_reduce_mutex);
+  for (void *slab : _kithip_reduce_slabs)
+    HIP_SAFE_CALL(hipFree_p(slab));
+  _kithip_reduce_slabs.clear();
+  _kithip_reduce_cells.clear();
+  _kithip_reduce_refs.clear();
 }
 
 void __kithip_memcpy_sym_to_device(void *hostPtr, void *devPtr,
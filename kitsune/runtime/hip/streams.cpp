@@ -54,6 +54,7 @@
 #include <mutex>
 #include <deque>
 #include <algorithm>
+#include <unordered_map>
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -95,6 +96,13 @@ typedef std::deque<hipStream_t> KitHipStreamList;
 static KitHipStreamList _kithip_streams;
 static std::mutex _kithip_stream_mutex;
 
+// Streams of a priority other than the default (see
+// __kithip_use_priority_stream()) are recycled through pools of their
+// own, indexed by KitRTPriority, so they are never handed to launches
+// at the default priority.
+static KitHipStreamList _kithip_priority_pools[3];
+static std::unordered_map<hipStream_t, int> _kithip_priority_streams;
+
 #ifdef __cplusplus
 extern "C" {
 #else
@@ -120,16 +128,70 @@ void *__kithip_get_thread_stream() {
   return (void*)hip_stream;
 }
 
+void *__kithip_get_priority_stream(int priority) {
+  if (priority == KITRT_PRIORITY_NORMAL)
+    return __kithip_get_thread_stream();
+  assert(priority <= KITRT_PRIORITY_LOW && "unknown stream priority!");
+  std::lock_guard<std::mutex> lock(_kithip_stream_mutex);
+  KitHipStreamList &pool = _kithip_priority_pools[priority];
+  hipStream_t hip_stream;
+  if (not pool.empty()) {
+    hip_stream = pool.front();
+    pool.pop_front();
+  } else {
+    // Numerically lower values are higher priorities.
+    HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));
+    int least, greatest;
+    HIP_SAFE_CALL(hipDeviceGetStreamPriorityRange_p(&least, &greatest));
+    int value = priority == KITRT_PRIORITY_HIGH ? greatest : least;
+    HIP_SAFE_CALL(hipStreamCreateWithPriority_p(&hip_stream,
+                                                hipStreamNonBlocking, value));
+    _kithip_priority_streams[hip_stream] = priority;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kithip: created %s priority stream %p "
+              "(priority %d).\n",
+              priority == KITRT_PRIORITY_HIGH ? "high" : "low",
+              (void *)hip_stream, value);
+  }
+  return (void *)hip_stream;
+}
+
+void __kithip_use_priority_stream(void **opaque_stream, int priority) {
+  assert(opaque_stream && "unexpected null stream pointer!");
+  if (*opaque_stream == nullptr)
+    *opaque_stream = __kithip_get_priority_stream(priority);
+}
+
  void __kithip_sync_thread_stream(void *opaque_stream) {
+   // The runtime is not initialized when the code of another target
+   // was selected (see __kitrt_select_target()).
+   if (not __kithip_is_initialized())
+     return;
    assert(opaque_stream != nullptr && "unexpected null stream pointer!");
 
    HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));               
    hipStream_t hip_stream = (hipStream_t)opaque_stream;
-   HIP_SAFE_CALL(hipStreamSynchronize_p(hip_stream));
+   __kithip_mem_flush_reductions(opaque_stream);
+   if (__kitrt_get_wait_policy() == KITRT_WAIT_BLOCK)
+     HIP_SAFE_CALL(hipStreamSynchronize_p(hip_stream));
+   else {
+     // Poll the stream so the core is left to the process's other
+     // threads while the kernel runs.
+     KitRTWait wait = {0, 0};
+     hipError_t status;
+     while ((status = hipStreamQuery_p(hip_stream)) == hipErrorNotReady)
+       __kitrt_wait_backoff(&wait);
+     HIP_SAFE_CALL(status);
+   }
+   __kithip_mem_release_reductions(opaque_stream);
    // In our current model a synchronized stream is done doing useful
    // work.  Recycle it for later use.
   _kithip_stream_mutex.lock();
-  _kithip_streams.push_back(hip_stream);
+  auto pit = _kithip_priority_streams.find(hip_stream);
+  if (pit != _kithip_priority_streams.end())
+    _kithip_priority_pools[pit->second].push_back(hip_stream);
+  else
+    _kithip_streams.push_back(hip_stream);
   _kithip_stream_mutex.unlock();   
   if (__kitrt_verbose_mode()) 
     fprintf(stderr, "kithip: recycling execution stream at sync point [stream=%p, poolsize=%zu].\n",
@@ -138,7 +200,10 @@ void *__kithip_get_thread_stream() {
 
 void __kithip_sync_context() {
   HIP_SAFE_CALL(hipSetDevice_p(__kithip_get_device_id()));            
+  __kithip_mem_flush_reductions(nullptr);
   HIP_SAFE_CALL(hipDeviceSynchronize_p());
+  __kithip_mem_device_synced();
+  __kithip_mem_release_reductions(nullptr);
 }
 
 void __kithip_delete_thread_stream(void *opaque_stream) {
@@ -149,6 +214,12 @@ void __kithip_delete_thread_stream(void *opaque_stream) {
    if (sit != _kithip_streams.end()) {
      _kithip_streams.erase(sit);
    }
+   auto pit = _kithip_priority_streams.find(hip_stream);
+   if (pit != _kithip_priority_streams.end()) {
+     KitHipStreamList &pool = _kithip_priority_pools[pit->second];
+     pool.erase(std::remove(pool.begin(), pool.end(), hip_stream), pool.end());
+     _kithip_priority_streams.erase(pit);
+   }
    HIP_SAFE_CALL(hipStreamDestroy_p(hip_stream));
    _kithip_stream_mutex.unlock();
 }
@@ -158,6 +229,12 @@ void __kithip_destroy_thread_streams() {
   for(auto &entry : _kithip_streams)
     HIP_SAFE_CALL(hipStreamDestroy_p(entry));
   _kithip_streams.clear();
+  for (auto &pool : _kithip_priority_pools) {
+    for (hipStream_t stream : pool)
+      HIP_SAFE_CALL(hipStreamDestroy_p(stream));
+    pool.clear();
+  }
+  _kithip_priority_streams.clear();
   _kithip_stream_mutex.unlock();
 }
   
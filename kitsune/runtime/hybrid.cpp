@@ -0,0 +1,344 @@
+//===- hybrid.cpp - Kitsune runtime hybrid host/GPU loop execution -------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "kitrt.h"
+#include "machine.h"
+#include "memory_map.h"
+
+// The share of a hybrid loop's iterations that run on the GPU is
+// learned from the time the host and the kernel take for their parts
+// of earlier executions of the loop.  The new share balances the two
+// measured throughputs; it is smoothed to tolerate noisy measurements.
+// The host part of an execution is timed exactly (it is complete at
+// __kitrt_hybrid_host_done()) but the kernel's time is only known if it
+// completes after the host.  Otherwise the kernel was idle at the end
+// and its share is increased by a fixed step.  With a machine profile
+// the first share balances the memory bandwidths of the device and the
+// host, and the host tasks are kept large enough to amortize a steal.
+
+// Initial share of the iterations run on the GPU (KITRT_HYBRID_SHARE).
+static float _kitrt_hybrid_initial_share = 0.9f;
+// A fixed share set in the environment disables learning.
+static bool _kitrt_hybrid_fixed_share = false;
+// Host parts smaller than this run on the GPU (KITRT_HYBRID_MIN_ITERS).
+static unsigned long _kitrt_hybrid_min_host_iters = 4096;
+// Host tasks per host thread for the host part of a loop.
+static const unsigned KITRT_HYBRID_TASKS_PER_THREAD = 8;
+// The smallest host task, in steals (of the machine profile's cost).
+static const double KITRT_HYBRID_MIN_TASK_STEALS = 10.0;
+static double _kitrt_hybrid_steal_ns = 0.0;
+// The smoothing factor and step used to update the share.
+static const double KITRT_HYBRID_SMOOTHING = 0.5;
+static const double KITRT_HYBRID_STEP = 0.25;
+static const double KITRT_HYBRID_MIN_SHARE = 0.01;
+// The kernel is considered to complete after the host part when the
+// wait for it takes longer than this fraction of the host's time.
+static const double KITRT_HYBRID_WAIT_SLACK = 0.02;
+
+struct KitRTHybridState {
+  const char *name;
+  std::mutex lock;
+  double device_share;
+  double host_ns_per_iter; // zero until the host part is measured.
+  unsigned long executions;
+};
+
+static std::once_flag _kitrt_hybrid_init_flag;
+static std::mutex _kitrt_hybrid_state_mutex;
+static unsigned _kitrt_hybrid_host_threads = 1;
+
+static void _kitrt_hybrid_init() {
+  if (const KitRTMachineProfile *profile = __kitrt_get_machine_profile()) {
+    if (profile->device_bytes_per_sec > 0.0 &&
+        profile->host_bytes_per_sec > 0.0)
+      _kitrt_hybrid_initial_share =
+          profile->device_bytes_per_sec /
+          (profile->device_bytes_per_sec + profile->host_bytes_per_sec);
+    _kitrt_hybrid_steal_ns = profile->steal_ns;
+  }
+  float share;
+  if (__kitrt_get_env_value("KITRT_HYBRID_SHARE", share)) {
+    _kitrt_hybrid_initial_share = std::clamp(share, 0.0f, 1.0f);
+    _kitrt_hybrid_fixed_share = true;
+  }
+  (void)__kitrt_get_env_value("KITRT_HYBRID_MIN_ITERS",
+                              _kitrt_hybrid_min_host_iters);
+  _kitrt_hybrid_host_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+}
+
+static uint64_t _kitrt_hybrid_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static KitRTHybridState *_kitrt_hybrid_get_state(void **handle,
+                                                 const char *name) {
+  void *state = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+  if (state != nullptr)
+    return (KitRTHybridState *)state;
+
+  std::call_once(_kitrt_hybrid_init_flag, _kitrt_hybrid_init);
+  std::lock_guard<std::mutex> guard(_kitrt_hybrid_state_mutex);
+  state = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+  if (state == nullptr) {
+    KitRTHybridState *new_state = new KitRTHybridState;
+    new_state->name = name;
+    new_state->device_share = _kitrt_hybrid_initial_share;
+    new_state->host_ns_per_iter = 0.0;
+    new_state->executions = 0;
+    __atomic_store_n(handle, (void *)new_state, __ATOMIC_RELEASE);
+    state = new_state;
+  }
+  return (KitRTHybridState *)state;
+}
+
+// The host fallback of a small GPU loop runs it when the host can
+// complete the iterations in the time a kernel launch takes.  The
+// host's time per iteration is measured by each host run and smoothed
+// like the share of a hybrid loop.
+
+// The estimated cost of a kernel launch (KITRT_HOST_FALLBACK_NS, or
+// the launch latency of the machine profile).
+static unsigned long _kitrt_fallback_launch_ns = 20000;
+// The threshold of a loop that has not been measured
+// (KITRT_HOST_FALLBACK_TRIPS).
+static unsigned long _kitrt_fallback_initial_trips = 256;
+static bool _kitrt_fallback_enabled = true;
+
+struct KitRTFallbackState {
+  const char *name;
+  std::atomic<uint64_t> max_trips;
+  std::mutex lock;
+  double ns_per_iter;
+};
+
+static std::once_flag _kitrt_fallback_init_flag;
+
+static void _kitrt_fallback_init() {
+  const KitRTMachineProfile *profile = __kitrt_get_machine_profile();
+  if (profile != nullptr && profile->device_launch_ns > 0.0)
+    _kitrt_fallback_launch_ns = (unsigned long)profile->device_launch_ns;
+  (void)__kitrt_get_env_value("KITRT_HOST_FALLBACK",
+                              _kitrt_fallback_enabled);
+  (void)__kitrt_get_env_value("KITRT_HOST_FALLBACK_NS",
+                              _kitrt_fallback_launch_ns);
+  (void)__kitrt_get_env_value("KITRT_HOST_FALLBACK_TRIPS",
+                              _kitrt_fallback_initial_trips);
+}
+
+static KitRTFallbackState *_kitrt_fallback_get_state(void **handle,
+                                                     const char *name) {
+  void *state = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+  if (state != nullptr)
+    return (KitRTFallbackState *)state;
+
+  std::call_once(_kitrt_fallback_init_flag, _kitrt_fallback_init);
+  std::lock_guard<std::mutex> guard(_kitrt_hybrid_state_mutex);
+  state = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+  if (state == nullptr) {
+    KitRTFallbackState *new_state = new KitRTFallbackState;
+    new_state->name = name;
+    new_state->max_trips =
+        _kitrt_fallback_enabled ? _kitrt_fallback_initial_trips : 0;
+    new_state->ns_per_iter = 0.0;
+    __atomic_store_n(handle, (void *)new_state, __ATOMIC_RELEASE);
+    state = new_state;
+  }
+  return (KitRTFallbackState *)state;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t __kitrt_hybrid_begin(void **handle, const char *name, uint64_t start,
+                              uint64_t end, KitRTHybridLaunch *launch) {
+  KitRTHybridState *state = _kitrt_hybrid_get_state(handle, name);
+  double share, host_ns_per_iter;
+  {
+    std::lock_guard<std::mutex> guard(state->lock);
+    share = state->device_share;
+    host_ns_per_iter = state->host_ns_per_iter;
+  }
+
+  uint64_t count = end > start ? end - start : 0;
+  uint64_t host_iters = (uint64_t)((1.0 - share) * (double)count);
+  if (host_iters < _kitrt_hybrid_min_host_iters)
+    host_iters = 0;
+  uint64_t split = end - host_iters;
+
+  launch->state = state;
+  launch->device_iters = count - host_iters;
+  launch->host_iters = host_iters;
+  launch->host_grain = std::max<uint64_t>(
+      1, host_iters /
+             (KITRT_HYBRID_TASKS_PER_THREAD * _kitrt_hybrid_host_threads));
+  if (_kitrt_hybrid_steal_ns > 0.0 && host_ns_per_iter > 0.0)
+    launch->host_grain = std::max<uint64_t>(
+        launch->host_grain,
+        (uint64_t)(KITRT_HYBRID_MIN_TASK_STEALS * _kitrt_hybrid_steal_ns /
+                   host_ns_per_iter));
+  launch->host_ns = 0;
+  launch->start_ns = _kitrt_hybrid_now();
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "kitrt: hybrid loop '%s': %lu iterations on the gpu, "
+            "%lu on the host.\n",
+            name, (unsigned long)launch->device_iters,
+            (unsigned long)host_iters);
+  return split;
+}
+
+void __kitrt_hybrid_host_done(KitRTHybridLaunch *launch) {
+  if (launch->state != nullptr)
+    launch->host_ns = std::max<uint64_t>(
+        1, _kitrt_hybrid_now() - launch->start_ns);
+}
+
+void __kitrt_hybrid_end(KitRTHybridLaunch *launch) {
+  KitRTHybridState *state = (KitRTHybridState *)launch->state;
+  launch->state = nullptr;
+  if (state == nullptr || launch->host_ns == 0)
+    return;
+  uint64_t total_ns =
+      std::max<uint64_t>(1, _kitrt_hybrid_now() - launch->start_ns);
+
+  std::lock_guard<std::mutex> guard(state->lock);
+  state->executions++;
+  // Nothing to compare the kernel with when the host had no part.
+  if (launch->host_iters == 0)
+    return;
+
+  double per_iter = (double)launch->host_ns / launch->host_iters;
+  state->host_ns_per_iter =
+      state->host_ns_per_iter == 0.0
+          ? per_iter
+          : KITRT_HYBRID_SMOOTHING * per_iter +
+                (1.0 - KITRT_HYBRID_SMOOTHING) * state->host_ns_per_iter;
+  if (_kitrt_hybrid_fixed_share)
+    return;
+
+  double share = state->device_share;
+  if (total_ns >
+             launch->host_ns * (1.0 + KITRT_HYBRID_WAIT_SLACK)) {
+    // The kernel completed after the host: both times are known.
+    double host_rate = (double)launch->host_iters / launch->host_ns;
+    double device_rate = (double)launch->device_iters / total_ns;
+    double balanced = device_rate / (device_rate + host_rate);
+    share = KITRT_HYBRID_SMOOTHING * balanced +
+            (1.0 - KITRT_HYBRID_SMOOTHING) * share;
+  } else {
+    // The host was the bottleneck.
+    share += KITRT_HYBRID_STEP * (1.0 - share);
+  }
+  // Both sides keep a part so that they continue to be measured.
+  state->device_share =
+      std::clamp(share, KITRT_HYBRID_MIN_SHARE, 1.0 - KITRT_HYBRID_MIN_SHARE);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "kitrt: hybrid loop '%s': host %.3f ms, total %.3f ms, "
+            "gpu share now %.3f.\n",
+            state->name, launch->host_ns * 1e-6, total_ns * 1e-6,
+            state->device_share);
+}
+
+bool __kitrt_host_fallback_begin(void **handle, const char *name,
+                                 uint64_t trip_count, void **ptrs,
+                                 uint32_t num_ptrs, KitRTHostFallback *run) {
+  KitRTFallbackState *state = _kitrt_fallback_get_state(handle, name);
+  run->state = nullptr;
+  if (trip_count > state->max_trips.load(std::memory_order_relaxed))
+    return false;
+  // The data must not be needed (or in use) by a device.
+  for (uint32_t i = 0; i < num_ptrs; i++)
+    if (ptrs[i] != nullptr && not __kitrt_is_mem_host_resident(ptrs[i]))
+      return false;
+
+  run->state = state;
+  run->iters = trip_count;
+  run->start_ns = _kitrt_hybrid_now();
+  return true;
+}
+
+void __kitrt_host_fallback_end(KitRTHostFallback *run) {
+  KitRTFallbackState *state = (KitRTFallbackState *)run->state;
+  if (state == nullptr || run->iters == 0)
+    return;
+  uint64_t host_ns =
+      std::max<uint64_t>(1, _kitrt_hybrid_now() - run->start_ns);
+  double per_iter = (double)host_ns / run->iters;
+
+  std::lock_guard<std::mutex> guard(state->lock);
+  state->ns_per_iter =
+      state->ns_per_iter == 0.0
+          ? per_iter
+          : KITRT_HYBRID_SMOOTHING * per_iter +
+                (1.0 - KITRT_HYBRID_SMOOTHING) * state->ns_per_iter;
+  uint64_t max_trips =
+      (uint64_t)(_kitrt_fallback_launch_ns / state->ns_per_iter);
+  if (__kitrt_verbose_mode() &&
+      max_trips != state->max_trips.load(std::memory_order_relaxed))
+    fprintf(stderr,
+            "kitrt: loop '%s': %.1f ns/iteration on the host, runs up to "
+            "%lu iterations on the host.\n",
+            state->name, state->ns_per_iter, (unsigned long)max_trips);
+  state->max_trips.store(max_trips, std::memory_order_relaxed);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -51,21 +51,280 @@
 //===----------------------------------------------------------------------===//
 
 #include "kitrt.h"
+#include "machine.h"
+#include "memory_map.h"
+#include "profile.h"
+#include <algorithm>
 #include <cassert>
+#include <mutex>
+#include <sched.h>
+#include <string>
+#include <strings.h>
+#include <time.h>
+#include <unordered_map>
+
+extern char **environ;
 
 bool _kitrt_verbose_mode = false;
+static bool _kitrt_prefetch_enabled = true;
+static bool _kitrt_prefetch_streams_enabled = false;
+static unsigned _kitrt_num_prefetch_streams = 2;
+static KitRTExitMode _kitrt_exit_mode = KITRT_EXIT_FULL;
+static KitRTWaitPolicy _kitrt_wait_policy = KITRT_WAIT_SLEEP;
+static unsigned _kitrt_wait_spins = 64;
+static uint64_t _kitrt_wait_max_sleep_ns = 50000;
+// The number of yields before a sleeping wait starts to sleep.
+static const unsigned KITRT_WAIT_YIELDS = 256;
+
+namespace {
+
+// The runtime's settings, read once from the environment and the
+// (optional) configuration file.  The map is never modified after it
+// is loaded so lookups need no locking.
+std::unordered_map<std::string, std::string> *_kitrt_config = nullptr;
+std::once_flag _kitrt_config_once;
+
+std::string trim(const std::string &str) {
+  size_t first = str.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos)
+    return std::string();
+  size_t last = str.find_last_not_of(" \t\r\n");
+  return str.substr(first, last - first + 1);
+}
+
+void load_config_file(const char *path,
+                      std::unordered_map<std::string, std::string> &config) {
+  FILE *fp = fopen(path, "r");
+  if (fp == nullptr) {
+    fprintf(stderr, "kitrt: warning, unable to read configuration file "
+                    "'%s'.\n", path);
+    return;
+  }
+  char buffer[1024];
+  unsigned line = 0;
+  while (fgets(buffer, sizeof(buffer), fp)) {
+    line++;
+    std::string text(buffer);
+    text = trim(text.substr(0, text.find('#')));
+    if (text.empty())
+      continue;
+    size_t eq = text.find('=');
+    if (eq == std::string::npos || eq == 0) {
+      fprintf(stderr, "kitrt: warning, ignoring malformed setting at "
+                      "%s:%u.\n", path, line);
+      continue;
+    }
+    // Settings from the environment take precedence.
+    config.emplace(trim(text.substr(0, eq)), trim(text.substr(eq + 1)));
+  }
+  fclose(fp);
+}
+
+void load_config() {
+  _kitrt_config = new std::unordered_map<std::string, std::string>;
+  for (char **env = environ; env && *env; env++) {
+    const char *eq = strchr(*env, '=');
+    if (eq != nullptr)
+      _kitrt_config->emplace(std::string(*env, eq - *env), eq + 1);
+  }
+  auto it = _kitrt_config->find("KITRT_CONFIG_FILE");
+  if (it != _kitrt_config->end() && !it->second.empty())
+    load_config_file(it->second.c_str(), *_kitrt_config);
+}
+
+} // namespace
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+const char *__kitrt_get_config(const char *name) {
+  assert(name && "unexpected null setting name!");
+  std::call_once(_kitrt_config_once, load_config);
+  auto it = _kitrt_config->find(name);
+  return it != _kitrt_config->end() ? it->second.c_str() : nullptr;
+}
+
 void __kitrt_initialize() {
   // Call will auto-set the verbose state.
   (void)__kitrt_get_env_value("KITRT_VERBOSE", _kitrt_verbose_mode);
+#ifdef KITRT_DISABLE_TRACING
+  if (_kitrt_verbose_mode)
+    fprintf(stderr, "kitrt: warning, verbose mode is not available in this "
+                    "build of the runtime (use KITRT_PROFILE instead).\n");
+#endif
   if (__kitrt_verbose_mode()) {
     fprintf(stderr, "kitrt: verbose mode enabled by environment.\n");
     fprintf(stderr, "  kitsune runtime built-in feature set:\n");
   }
+
+  (void)__kitrt_get_env_value("KITRT_PREFETCH", _kitrt_prefetch_enabled);
+  if (__kitrt_get_env_value("KITRT_PREFETCH_STREAMS",
+                            _kitrt_num_prefetch_streams))
+    _kitrt_prefetch_streams_enabled = _kitrt_num_prefetch_streams > 0;
+  if (__kitrt_verbose_mode() && _kitrt_prefetch_streams_enabled)
+    fprintf(stderr, "    prefetch streams: %u\n",
+            _kitrt_num_prefetch_streams);
+
+  bool profile = false;
+  (void)__kitrt_get_env_value("KITRT_PROFILE", profile);
+  __kitrt_profile_enable(profile);
+  if (__kitrt_verbose_mode() && profile)
+    fprintf(stderr, "    launch/transfer profiling enabled.\n");
+
+  bool metrics = false;
+  (void)__kitrt_get_env_value("KITRT_PROFILE_METRICS", metrics);
+  if (metrics) {
+    __kitrt_profile_enable_metrics(true);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "    kernel metrics profiling enabled.\n");
+  }
+
+  if (const char *value = __kitrt_get_config("KITRT_EXIT_MODE")) {
+    if (!strcasecmp(value, "fast"))
+      _kitrt_exit_mode = KITRT_EXIT_FAST;
+    else if (!strcasecmp(value, "leak"))
+      _kitrt_exit_mode = KITRT_EXIT_LEAK;
+    else if (strcasecmp(value, "full"))
+      fprintf(stderr, "kitrt: warning, unknown KITRT_EXIT_MODE value "
+                      "'%s' (expected full, fast or leak).\n", value);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "    exit mode: %s\n", value);
+  }
+
+  if (const char *value = __kitrt_get_config("KITRT_WAIT_POLICY")) {
+    if (!strcasecmp(value, "block"))
+      _kitrt_wait_policy = KITRT_WAIT_BLOCK;
+    else if (!strcasecmp(value, "spin"))
+      _kitrt_wait_policy = KITRT_WAIT_SPIN;
+    else if (!strcasecmp(value, "yield"))
+      _kitrt_wait_policy = KITRT_WAIT_YIELD;
+    else if (!strcasecmp(value, "sleep"))
+      _kitrt_wait_policy = KITRT_WAIT_SLEEP;
+    else
+      fprintf(stderr, "kitrt: warning, unknown KITRT_WAIT_POLICY value "
+                      "'%s' (expected block, spin, yield or sleep).\n",
+              value);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "    wait policy: %s\n", value);
+  }
+  (void)__kitrt_get_env_value("KITRT_WAIT_SPINS", _kitrt_wait_spins);
+  uint64_t max_sleep_ns = 0;
+  if (__kitrt_get_env_value("KITRT_WAIT_MAX_SLEEP_NS", max_sleep_ns) &&
+      max_sleep_ns > 0)
+    _kitrt_wait_max_sleep_ns = max_sleep_ns;
+
+  __kitrt_machine_profile_initialize();
+  __kitrt_memory_stats_initialize();
+}
+
+void __kitrt_set_exit_mode(KitRTExitMode mode) { _kitrt_exit_mode = mode; }
+
+KitRTExitMode __kitrt_get_exit_mode() { return _kitrt_exit_mode; }
+
+void __kitrt_set_wait_policy(KitRTWaitPolicy policy, unsigned spins,
+                             uint64_t max_sleep_ns) {
+  _kitrt_wait_policy = policy;
+  _kitrt_wait_spins = spins;
+  if (max_sleep_ns != 0)
+    _kitrt_wait_max_sleep_ns = max_sleep_ns;
+}
+
+KitRTWaitPolicy __kitrt_get_wait_policy() { return _kitrt_wait_policy; }
+
+void __kitrt_wait_backoff(KitRTWait *wait) {
+  wait->polls++;
+  if (_kitrt_wait_policy == KITRT_WAIT_SPIN ||
+      wait->polls <= _kitrt_wait_spins)
+    return;
+  if (_kitrt_wait_policy != KITRT_WAIT_SLEEP ||
+      wait->polls <= _kitrt_wait_spins + KITRT_WAIT_YIELDS) {
+    sched_yield();
+    return;
+  }
+  if (wait->sleep_ns == 0)
+    wait->sleep_ns = 1000;
+  struct timespec ts = {0, (long)wait->sleep_ns};
+  nanosleep(&ts, nullptr);
+  if (wait->sleep_ns < _kitrt_wait_max_sleep_ns)
+    wait->sleep_ns = std::min(2 * wait->sleep_ns, _kitrt_wait_max_sleep_ns);
+}
+
+unsigned __kitrt_getNumPrefetchStreams() {
+  return _kitrt_num_prefetch_streams;
+}
+
+bool __kitrt_prefetchEnabled() { return _kitrt_prefetch_enabled; }
+
+void __kitrt_enablePrefetching() { _kitrt_prefetch_enabled = true; }
+
+bool __kitrt_prefetchStreamsEnabled() {
+  return _kitrt_prefetch_enabled && _kitrt_prefetch_streams_enabled &&
+         _kitrt_num_prefetch_streams > 0;
+}
+
+void __kitrt_enablePrefetchStreams() {
+  _kitrt_prefetch_streams_enabled = true;
+  if (_kitrt_num_prefetch_streams == 0)
+    _kitrt_num_prefetch_streams = 1;
+}
+
+bool __kitrt_get_local_rank(int *rank) {
+  assert(rank && "unexpected null rank!");
+  static const char *rank_vars[] = {
+      "OMPI_COMM_WORLD_LOCAL_RANK", "MV2_COMM_WORLD_LOCAL_RANK",
+      "MPI_LOCALRANKID",            "PMI_LOCAL_RANK",
+      "PALS_LOCAL_RANKID",          "SLURM_LOCALID",
+  };
+  for (const char *var : rank_vars)
+    if (__kitrt_get_env_value(var, *rank) && *rank >= 0)
+      return true;
+  return false;
+}
+
+bool __kitrt_bind_to_pci_device(int domain, int bus, int device) {
+  char path[96];
+  snprintf(path, sizeof(path),
+           "/sys/bus/pci/devices/%04x:%02x:%02x.0/local_cpulist", domain,
+           bus, device);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  cpu_set_t allowed, local;
+  CPU_ZERO(&local);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    fclose(f);
+    return false;
+  }
+  // The list has the form "0-15,32-47".
+  int lo, hi, num_cpus = 0;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    int c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &hi) != 1)
+        break;
+      c = fgetc(f);
+    }
+    for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed)) {
+        CPU_SET(cpu, &local);
+        num_cpus++;
+      }
+    if (c != ',')
+      break;
+  }
+  fclose(f);
+
+  if (num_cpus == 0 || CPU_EQUAL(&local, &allowed))
+    return false;
+  if (sched_setaffinity(0, sizeof(local), &local) != 0)
+    return false;
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitrt: bound host threads to the %d cpus local to "
+            "%04x:%02x:%02x.0.\n", num_cpus, domain, bus, device);
+  return true;
 }
 
 void __kitrt_print_stack_trace(void) {
@@ -59,6 +59,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <cstring>
+#include <strings.h>
 #include <execinfo.h>
 #include <type_traits>
 #include <ctype.h>
@@ -77,6 +78,17 @@ extern "C" {
    * multiple times as it is guarded to avoid repeated initialization.
    */
   extern void __kitrt_initialize();
+
+  /**
+   * Get the value of a runtime setting, or null if it is not set.  The
+   * settings are read once, on first use, from the environment and
+   * from the optional configuration file named by KITRT_CONFIG_FILE;
+   * the environment takes precedence.  The file holds one 'NAME=value'
+   * setting per line ('#' starts a comment) and may also hold
+   * per-kernel settings, e.g., 'KITCUDA_THREADS_PER_BLOCK:kernel=128'.
+   * The returned string remains valid for the life of the program.
+   */
+  extern const char *__kitrt_get_config(const char *name);
   
   /**
    * Set the runtime system to operate in verbose mode.
@@ -109,24 +121,141 @@ extern "C" {
   /**
    * Return the runtime's verbose operating mode.  If `true` the
    * runtime should provide status details on stderr during execution,
-   * otherwise it is quiet.
+   * otherwise it is quiet.  In runtime builds without tracing
+   * (KITRT_ENABLE_TRACING=OFF) this is always `false` and all of the
+   * verbose-mode code folds away.
    */
   inline bool __kitrt_verbose_mode() {
+#ifdef KITRT_DISABLE_TRACING
+    return false;
+#else
     extern bool _kitrt_verbose_mode;
     return _kitrt_verbose_mode;
+#endif
   }
 
+  /**
+   * Print a message to stderr when in verbose mode.  This compiles to
+   * nothing in runtime builds without tracing.
+   */
+#define KITRT_TRACE(...)                                                       \
+  do {                                                                         \
+    if (__kitrt_verbose_mode())                                                \
+      fprintf(stderr, __VA_ARGS__);                                            \
+  } while (0)
+
   /**
    * Provide a backtrace to stderr to help track down runtime crashes.
    */
   extern void __kitrt_print_stack_trace();
 
+  /**
+   * Return the number of dedicated streams the GPU runtimes use to
+   * issue prefetch requests ahead of kernel launches.  Set via the
+   * KITRT_PREFETCH_STREAMS environment variable (default 2).
+   */
   extern unsigned __kitrt_getNumPrefetchStreams();
+
+  /**
+   * Is prefetching of managed memory ahead of kernel launches enabled?
+   * Enabled by default; the KITRT_PREFETCH environment variable can
+   * be used to disable it.
+   */
   extern bool __kitrt_prefetchEnabled();
   extern void __kitrt_enablePrefetching();
+
+  /**
+   * Are prefetch requests issued on dedicated prefetch streams (vs.
+   * the stream of the kernel launch)?  When enabled, the compiler's
+   * early prefetch requests overlap data migration with the host code
+   * that precedes a launch and the launch only waits on the prefetches
+   * of its own arguments.  Disabled by default; set
+   * KITRT_PREFETCH_STREAMS to a non-zero value to enable.
+   */
   extern bool __kitrt_prefetchStreamsEnabled();
   extern void __kitrt_enablePrefetchStreams();
 
+  /**
+   * How the runtimes release their resources when they are destroyed
+   * at program exit.  Set via the KITRT_EXIT_MODE environment variable
+   * ("full", "fast" or "leak"; default "full").
+   *
+   *   - KITRT_EXIT_FULL: Free every allocation and runtime resource.
+   *   - KITRT_EXIT_FAST: Skip the individual frees of allocations,
+   *     streams, events and pools; they are all released at once with
+   *     the device's context.
+   *   - KITRT_EXIT_LEAK: Release nothing (the process exit does) and
+   *     print the memory statistics instead.
+   *
+   * Output that must survive the exit (e.g., device logs, mapped
+   * files, profiles) is still written in all modes.
+   */
+  typedef enum {
+    KITRT_EXIT_FULL = 0,
+    KITRT_EXIT_FAST = 1,
+    KITRT_EXIT_LEAK = 2,
+  } KitRTExitMode;
+
+  extern void __kitrt_set_exit_mode(KitRTExitMode mode);
+  extern KitRTExitMode __kitrt_get_exit_mode();
+
+  /**
+   * How the runtimes' threads wait on device work (a stream or context
+   * synchronization, a profiling event).  In runs dominated by GPU
+   * work the waiting threads should leave their cores to the threads
+   * that still have work (e.g., OpenCilk workers or MPI progress
+   * threads).  Set via the KITRT_WAIT_POLICY environment variable
+   * ("block", "spin", "yield" or "sleep"; default "sleep").
+   *
+   *   - KITRT_WAIT_BLOCK: Block in the device driver (its own policy).
+   *   - KITRT_WAIT_SPIN: Poll the device without pause.
+   *   - KITRT_WAIT_YIELD: Poll KITRT_WAIT_SPINS (default 64) times and
+   *     then yield the core between polls.
+   *   - KITRT_WAIT_SLEEP: As KITRT_WAIT_YIELD but, after yielding for
+   *     a while, sleep between polls.  The sleep starts at a microsecond
+   *     and doubles up to KITRT_WAIT_MAX_SLEEP_NS (default 50000).
+   *
+   * The policy may be changed at any time, e.g., around phases of a
+   * program that are dominated by GPU work.  A thread waits on the
+   * device by polling it and calling __kitrt_wait_backoff() with a
+   * (zero initialized) wait record between polls.
+   */
+  typedef enum {
+    KITRT_WAIT_BLOCK = 0,
+    KITRT_WAIT_SPIN = 1,
+    KITRT_WAIT_YIELD = 2,
+    KITRT_WAIT_SLEEP = 3,
+  } KitRTWaitPolicy;
+
+  typedef struct _kitrt_wait {
+    unsigned     polls;
+    uint64_t     sleep_ns;
+  } KitRTWait;
+
+  extern void __kitrt_set_wait_policy(KitRTWaitPolicy policy, unsigned spins,
+                                      uint64_t max_sleep_ns);
+  extern KitRTWaitPolicy __kitrt_get_wait_policy();
+  extern void __kitrt_wait_backoff(KitRTWait *wait);
+
+  /**
+   * Get the node-local rank of the process when it was started by an
+   * MPI launcher (or srun).  The rank is read from the first of
+   * OMPI_COMM_WORLD_LOCAL_RANK, MV2_COMM_WORLD_LOCAL_RANK,
+   * MPI_LOCALRANKID, PMI_LOCAL_RANK, PALS_LOCAL_RANKID and SLURM_LOCALID
+   * that is set.  Returns `false` if none of them are.  The GPU runtimes
+   * use the rank to pick a device when no device ID is given.
+   */
+  extern bool __kitrt_get_local_rank(int *rank);
+
+  /**
+   * Bind the calling thread (and the threads it creates afterwards) to
+   * the CPUs that are local to the given PCI device -- e.g., the socket
+   * a GPU is attached to.  The CPUs are read from sysfs and intersected
+   * with the current affinity mask; nothing is changed if the result is
+   * empty.  Returns `true` if the binding was changed.
+   */
+  extern bool __kitrt_bind_to_pci_device(int domain, int bus, int device);
+
 
   /**
    * *** EXPERIMENTAL: This is a new interface between the compiler and
@@ -143,25 +272,392 @@ extern "C" {
     uint64_t     num_memory_ops;
     uint64_t     num_flops;
     uint64_t     num_iops;
+    uint64_t     num_memory_bytes; // bytes loaded and stored.
+    uint64_t     flags;            // KITRT_KERNEL_* flags.
+    // Dynamic shared memory used by the kernel's shared memory tiles:
+    // 'shared_bytes_per_thread' for each thread of a block plus
+    // 'shared_bytes' for the block as a whole (both zero if unused).
+    uint64_t     shared_bytes_per_thread;
+    uint64_t     shared_bytes;
+    // The source location of the kernel's forall ("file:line:col"), or
+    // null if the compiler had no debug location for it.
+    const char  *source_loc;
+    // The launch configuration given by the forall's launch attribute
+    // (zero if left to the runtime): a cap on the blocks of the grid,
+    // the minimum dynamic shared memory of a block and the iterations
+    // executed by each thread.  The block cap and the iterations per
+    // thread only apply to grid-stride kernels (see
+    // KITRT_KERNEL_GRID_STRIDE).
+    uint64_t     max_blocks_per_grid;
+    uint64_t     launch_shared_bytes;
+    uint64_t     iters_per_thread;
   } KitRTInstMix;
 
+  /**
+   * Properties of a generated kernel passed in the `flags` field of its
+   * instruction mix.  NOTE: These values are also used by code
+   * generation within the compiler -- both must be kept up-to-date.
+   *
+   *   - KITRT_KERNEL_GRID_STRIDE: each thread steps through the
+   *     iteration space by the total number of threads in the grid.
+   *     The kernel is correct for any number of blocks, which allows
+   *     the runtime to assign several iterations to each thread.
+   *
+   *   - KITRT_KERNEL_REDUCTION: the kernel reduces into one or more of
+   *     its arguments.  Its threads must all run on the same device.
+   *
+   *   - KITRT_KERNEL_FIXED_TRIP_COUNT: the trip count is folded into
+   *     the kernel.  Its iteration space must not be split.
+   */
+  #define KITRT_KERNEL_GRID_STRIDE      0x1
+  #define KITRT_KERNEL_REDUCTION        0x2
+  #define KITRT_KERNEL_FIXED_TRIP_COUNT 0x4
+
+  /**
+   * The access mode of a kernel argument as provided by kitsune's
+   * memory access attributes (e.g., `_readonly`).  It is passed from
+   * the compiler to the runtime to reduce the amount of data that has
+   * to be moved to (and from) the GPU for a kernel launch.  The
+   * compiler passes KITRT_MEM_ACCESS_NONE for an argument the
+   * (optimized) kernel never dereferences; its data is left in place.
+   * NOTE: These values are also used by code generation within the
+   * CudaABI component of the compiler -- both must be kept up-to-date.
+   */
+  typedef enum _kitrt_mem_access {
+    KITRT_MEM_ACCESS_READ_WRITE = 0,
+    KITRT_MEM_ACCESS_READ_ONLY  = 1,
+    KITRT_MEM_ACCESS_WRITE_ONLY = 2,
+    KITRT_MEM_ACCESS_NONE       = 3
+  } KitRTMemAccess;
+
+  /**
+   * The priority of the stream a kernel is launched on, as provided by
+   * kitsune's `[[kitsune::priority(...)]]` attribute.  The blocks of
+   * kernels on high priority streams are scheduled ahead of those of
+   * kernels queued on lower priority streams (e.g., to keep the halo
+   * packing kernels MPI waits on from queuing behind large interior
+   * kernels).  NOTE: These values are also used by code generation
+   * within the CudaABI and HipABI components of the compiler.
+   */
+  typedef enum _kitrt_priority {
+    KITRT_PRIORITY_NORMAL = 0,
+    KITRT_PRIORITY_HIGH   = 1,
+    KITRT_PRIORITY_LOW    = 2
+  } KitRTPriority;
+
+  /**
+   * How the data of a managed allocation moves to the GPU for the
+   * kernels that use it.  KITRT_MIGRATE_PREFETCH prefetches the whole
+   * allocation ahead of each launch.  KITRT_MIGRATE_COUNTERS leaves the
+   * pages without a preferred location so the driver migrates the ones
+   * the kernels use often (by the hardware's access counters on
+   * Hopper/Grace and other coherent systems, otherwise on fault).
+   * KITRT_MIGRATE_HOST keeps the pages in host memory and the kernels
+   * access them remotely.  KITRT_MIGRATE_AUTO prefetches until the
+   * data has moved back and forth between the host and the device too
+   * often, then uses the access counters on coherent systems and host
+   * memory on the others.
+   * NOTE: These values are also used by code generation within the
+   * CudaABI component of the compiler -- both must be kept up-to-date.
+   */
+  typedef enum _kitrt_migrate_policy {
+    KITRT_MIGRATE_AUTO     = 0,
+    KITRT_MIGRATE_PREFETCH = 1,
+    KITRT_MIGRATE_COUNTERS = 2,
+    KITRT_MIGRATE_HOST     = 3
+  } KitRTMigratePolicy;
+
+  /**
+   * Hybrid (host + GPU) execution of a forall.  A loop with a
+   * `[[tapir::target("cuda+opencilk")]]` (or "hip+opencilk") attribute
+   * is compiled for both the GPU and the host.  Each execution splits
+   * the iteration range in two: the kernel runs the lower part while
+   * the host runs the upper part (via its parallel runtime).  The split
+   * is learned from the throughput measured in earlier executions.
+   *
+   * The compiler keeps a (null initialized) handle for each loop and a
+   * launch record for each execution of it on the stack.  For each
+   * execution it calls:
+   *
+   *   - __kitrt_hybrid_begin() ahead of the kernel launch: returns the
+   *     end of the kernel's iterations [start, split) -- the host runs
+   *     [split, end) -- and sets the record's `host_grain`.
+   *   - __kitrt_hybrid_host_done() once the host part is complete.
+   *   - __kitrt_hybrid_end() after the sync that waits for the kernel.
+   *
+   * NOTE: The layout of the launch record is also used by code
+   * generation within the compiler -- both must be kept up-to-date.
+   */
+  typedef struct _kitrt_hybrid_launch {
+    void        *state;      // per-loop state (null when not started).
+    uint64_t     start_ns;
+    uint64_t     host_ns;
+    uint64_t     device_iters;
+    uint64_t     host_iters;
+    uint64_t     host_grain; // iterations per host task.
+  } KitRTHybridLaunch;
+
+  extern uint64_t __kitrt_hybrid_begin(void **handle, const char *name,
+                                       uint64_t start, uint64_t end,
+                                       KitRTHybridLaunch *launch);
+  extern void __kitrt_hybrid_host_done(KitRTHybridLaunch *launch);
+  extern void __kitrt_hybrid_end(KitRTHybridLaunch *launch);
+
+  /**
+   * Host fallback of GPU foralls with small trip counts.  A kernel
+   * launch costs tens of microseconds (prefetches, launch and sync)
+   * that a loop of a few iterations does not recover, so the compiler
+   * keeps a serial host copy of each forall it compiles for a GPU and
+   * calls __kitrt_host_fallback_begin() ahead of launches of at most
+   * `-tapir-host-fallback-max-trips` iterations.  When it returns true
+   * the host copy runs the iterations on the calling thread, followed
+   * by a call to __kitrt_host_fallback_end(); otherwise the kernel is
+   * launched.
+   *
+   * The host runs a loop when the iterations fit under the loop's
+   * threshold and all of the loop's pointer arguments are managed
+   * allocations that are resident in host memory, i.e., are not in
+   * use by, or prefetched to, a device.  The threshold of a loop is
+   * learned from the time of its host runs: it is the number of
+   * iterations the host completes in the time of a kernel launch
+   * (KITRT_HOST_FALLBACK_NS; by default the launch latency of the
+   * machine profile, see machine.h, or 20 microseconds).  Until a
+   * loop is measured KITRT_HOST_FALLBACK_TRIPS (default 256) is used.
+   * The fallback is disabled by setting KITRT_HOST_FALLBACK to zero.
+   *
+   * NOTE: The layout of the record is also used by code generation
+   * within the compiler -- both must be kept up-to-date.
+   */
+  typedef struct _kitrt_host_fallback {
+    void        *state;      // per-loop state (null if not on the host).
+    uint64_t     start_ns;
+    uint64_t     iters;
+  } KitRTHostFallback;
+
+  extern bool __kitrt_host_fallback_begin(void **handle, const char *name,
+                                          uint64_t trip_count, void **ptrs,
+                                          uint32_t num_ptrs,
+                                          KitRTHostFallback *run);
+  extern void __kitrt_host_fallback_end(KitRTHostFallback *run);
+
+  /**
+   * The targets of code compiled for the "multi" Tapir target.  Each
+   * parallel loop is compiled for all of them and the runtime picks
+   * the one to use once, the first time it is asked, from the devices
+   * found on the system (CUDA, then HIP, then the host).  The choice
+   * can be forced with the KITRT_TARGET environment variable ("cuda",
+   * "hip" or "host").
+   * NOTE: These values are also used by code generation within the
+   * compiler -- both must be kept up-to-date.
+   */
+  typedef enum _kitrt_target {
+    KITRT_TARGET_HOST = 0,
+    KITRT_TARGET_CUDA = 1,
+    KITRT_TARGET_HIP  = 2
+  } KitRTTarget;
+
+  extern KitRTTarget __kitrt_select_target();
+
+  /**
+   * Allocate (free) managed memory with the runtime of the selected
+   * target.
+   */
+  extern __attribute__((malloc))
+  void *__kitrt_multi_mem_alloc_managed(size_t size);
+  extern void __kitrt_multi_mem_free(void *ptr);
+
+  /**
+   * Reserve address space for an array that grows in place, commit
+   * the leading bytes of the reservation as the array grows, and
+   * release it (see __kitcuda_mem_reserve_managed()).  The default
+   * (host) versions map the reservation inaccessible and make pages
+   * accessible as they are committed; the multi versions use the
+   * runtime of the selected target.
+   */
+  extern void *__kitrt_default_mem_reserve(size_t max_bytes);
+  extern void __kitrt_default_mem_commit(void *base, size_t nbytes);
+  extern void __kitrt_default_mem_release(void *base, size_t max_bytes);
+  extern void *__kitrt_multi_mem_reserve(size_t max_bytes);
+  extern void __kitrt_multi_mem_commit(void *base, size_t nbytes);
+  extern void __kitrt_multi_mem_release(void *base, size_t max_bytes);
+
+  /**
+   * Map the file at 'path' read-only into memory, setting 'nbytes' to
+   * its size.  Returns null (after reporting the reason) if the file
+   * cannot be mapped.  The mapping is not registered with the runtime;
+   * the target versions below (and __kitcuda_mem_map_file(), etc.)
+   * build on this call.
+   */
+  extern void *__kitrt_map_file(const char *path, size_t *nbytes);
+
+  /**
+   * Note that the host wrote 'nbytes' at 'addr' within a managed
+   * allocation whose data is on the device.  Only the written pages
+   * (rather than the entire allocation) are then moved back to the
+   * device ahead of the next kernel that uses the allocation.  This
+   * also covers device-resident data (see KITCUDA_EXPLICIT_HOST_WRITES).
+   * Calls for unregistered or host-resident memory are ignored.
+   */
+  extern void __kitrt_mem_host_write(void *addr, size_t nbytes);
+
+  /**
+   * Map a file as a read-only array (see kitsune::map_file()) for the
+   * host or the selected target, and release such a mapping.
+   */
+  extern void *__kitrt_default_mem_map_file(const char *path,
+                                            size_t *nbytes);
+  extern void __kitrt_default_mem_unmap_file(void *ptr);
+  extern void *__kitrt_multi_mem_map_file(const char *path, size_t *nbytes);
+  extern void __kitrt_multi_mem_unmap_file(void *ptr);
+
+  /**
+   * Allocate and free page-locked host buffers for explicit transfers
+   * (see __kitcuda_mem_alloc_pinned()).  A buffer freed with a stream
+   * is reused only after the work issued on the stream completes.
+   * The default (host) versions use page-aligned host memory.
+   */
+  extern void *__kitrt_default_mem_alloc_pinned(size_t size);
+  extern void __kitrt_default_mem_free_pinned(void *ptr, void *opaque_stream);
+  extern void *__kitrt_multi_mem_alloc_pinned(size_t size);
+  extern void __kitrt_multi_mem_free_pinned(void *ptr, void *opaque_stream);
+
+  /**
+   * Allocate and free device buffers (see __kitcuda_mem_alloc_device())
+   * and query if an allocation's data is on the device.  The default
+   * (host) versions use host memory and report all data on the host.
+   */
+  extern void *__kitrt_default_mem_alloc_device(size_t size);
+  extern void __kitrt_default_mem_free_device(void *ptr);
+  extern bool __kitrt_default_mem_on_device(void *ptr);
+  extern void *__kitrt_multi_mem_alloc_device(size_t size);
+  extern void __kitrt_multi_mem_free_device(void *ptr);
+  extern bool __kitrt_multi_mem_on_device(void *ptr);
+
+  /**
+   * Mark an allocation as cold: it is not used by kernels for a while
+   * and its data is moved out of device memory until the next kernel
+   * launch that uses it (see __kitcuda_mem_mark_cold()).  The default
+   * (host) version does nothing.
+   */
+  extern void __kitrt_default_mem_mark_cold(void *ptr);
+  extern void __kitrt_multi_mem_mark_cold(void *ptr);
+
+  /**
+   * Statistics for the (managed) memory allocations registered with
+   * the runtime.  Allocations are binned into size classes by their
+   * size in bytes: class 0 holds allocations of less than 1 KiB and
+   * each following class covers a factor of four (class 'i' holds
+   * sizes in [2^(8+2i), 2^(10+2i))); the last class holds everything
+   * of 1 GiB or more.  Prefetch hits count the checks of a registered
+   * allocation's prefetch status (e.g., ahead of a launch) that found
+   * it already on the device -- no migration was needed -- and misses
+   * those that did not.
+   */
+  #define KITRT_MEM_STATS_NUM_SIZE_CLASSES 12
+
+  typedef struct _kitrt_mem_stats {
+    uint64_t     live_bytes;      // bytes currently allocated.
+    uint64_t     peak_bytes;      // high-water mark of live_bytes.
+    uint64_t     live_allocs;     // number of current allocations.
+    uint64_t     total_allocs;    // number of allocations so far.
+    uint64_t     total_frees;     // number of frees so far.
+    uint64_t     resident_bytes;  // live bytes (marked) on a device.
+    uint64_t     prefetch_hits;
+    uint64_t     prefetch_misses;
+    // Current (live) and total allocations in each size class.
+    uint64_t     live_size_classes[KITRT_MEM_STATS_NUM_SIZE_CLASSES];
+    uint64_t     total_size_classes[KITRT_MEM_STATS_NUM_SIZE_CLASSES];
+  } KitRTMemStats;
+
+  /**
+   * Get a snapshot of the runtime's memory statistics.  The counters
+   * are updated independently; a snapshot taken while other threads
+   * allocate may be (slightly) inconsistent.
+   */
+  extern void __kitrt_get_memory_stats(KitRTMemStats *stats);
+
+  /**
+   * Print the runtime's memory statistics to stderr.
+   */
+  extern void __kitrt_print_memory_stats();
+
+  /**
+   * Sample the memory statistics periodically.  A thread in the
+   * runtime calls 'hook' with a snapshot (and 'data') every
+   * 'period_ms' milliseconds.  The hook is also called a final time
+   * when the runtime is destroyed.  A zero period only makes the final
+   * call and a null hook stops sampling.  The KITRT_MEM_STATS
+   * environment variable sets a period for a hook that prints the
+   * statistics to stderr.
+   */
+  typedef void (*KitRTMemStatsHook)(const KitRTMemStats *stats, void *data);
+  extern void __kitrt_set_memory_stats_hook(KitRTMemStatsHook hook,
+                                            void *data, unsigned period_ms);
+
+  /**
+   * Allocation sites.  alloc<T>() in kitsune.h tags each allocation
+   * with the place that made it: the file and line of the call, or a
+   * label the caller passes in place of the file.  When the
+   * KITRT_MEM_SITES environment variable is set to N the runtime
+   * charges the data movement of each allocation to its site and, at
+   * exit, reports the N sites that moved the most data.  The moves
+   * charged are the prefetches the runtime issues to and from the
+   * devices and, on CUDA when CUPTI is available, the bytes the driver
+   * migrated and the page faults it took on the GPU and the host.
+   * Sites aggregate all the allocations made from them.  Tags are
+   * ignored when KITRT_MEM_SITES is not set.
+   */
+  extern void __kitrt_set_mem_alloc_site(void *addr, const char *site,
+                                         unsigned line);
+
+  /**
+   * Print the 'count' allocation sites that moved the most data (all
+   * of them for a zero count) to stderr.
+   */
+  extern void __kitrt_print_memory_sites(unsigned count);
+
+  /**
+   * Timing spans measure the device work that the calling thread
+   * issues through the runtime without synchronizing its streams.
+   * While a span is open the launches and transfers of the thread are
+   * timed with events on their streams, as they are by the profiler
+   * (see profile.h).  A query waits for the operations issued since the
+   * span began and returns:
+   *
+   *   - device_secs: the time the devices spent on the operations;
+   *     operations that overlap (e.g., on different streams) are only
+   *     counted once.
+   *   - host_secs: the time the thread spent in the runtime calls that
+   *     issued them (launch and transfer overhead).
+   *   - ops: the number of operations.
+   *
+   * Spans nest and can be queried more than once; each span must be
+   * used by the thread that began it and ended once.  kitsune::timer
+   * (kitsune_timer.h) wraps these calls.
+   */
+  extern int __kitrt_timer_begin();
+  extern void __kitrt_timer_query(int span, double *device_secs,
+                                  double *host_secs, uint64_t *ops);
+  extern void __kitrt_timer_end(int span);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
   
 /**
- * Return the value of the given environment variable. If the
- * variable does not exist in the environment return `false`.
- * Otherwise, `true` is returned and the value is returned in
- * the caller provided parameter.
+ * Return the value of the given runtime setting (see
+ * `__kitrt_get_config()`). If the setting does not exist return
+ * `false`.  Otherwise, `true` is returned and the value is returned
+ * in the caller provided parameter.  This does not read the
+ * environment: the settings are cached on first use.
  */
 template <typename ValueType>
 bool __kitrt_get_env_value(const char *var_name,
 			   ValueType &value) {
   assert(var_name && "unexpected null variable name!");
   bool found = false;
-  char *value_string;
-  if ((value_string = getenv(var_name))) {
+  const char *value_string;
+  if ((value_string = __kitrt_get_config(var_name))) {
 
     if constexpr (std::is_same_v<ValueType, int>) {
       value = atoi(value_string);
@@ -171,11 +667,9 @@ bool __kitrt_get_env_value(const char *var_name,
       found = true;
     } else if constexpr (std::is_same_v<ValueType, bool>) {
       found = true;
-      for(int i = 0; value_string[i]; i++) 
-        value_string[i] = tolower(value_string[i]);
-      if (!strcmp(value_string, "true") || !strcmp(value_string, "1"))
+      if (!strcasecmp(value_string, "true") || !strcmp(value_string, "1"))
         value = true;
-      else if (!strcmp(value_string, "false") || !strcmp(value_string, "0"))
+      else if (!strcasecmp(value_string, "false") || !strcmp(value_string, "0"))
         value = false;
       else {
         fprintf(stderr, "kitsune_rt: warning, boolean environment variable "
@@ -0,0 +1,108 @@
+//===- launch_cache.h - Kitsune runtime kernel launch parameter cache -----===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __KITRT_LAUNCH_CACHE_H__
+#define __KITRT_LAUNCH_CACHE_H__
+
+#include <atomic>
+#include <stdint.h>
+
+/// The CUDA and HIP runtimes keep a launch descriptor for each kernel
+/// that caches the details needed to launch it (the kernel function,
+/// its attributes, etc.).  Part of each descriptor is a small table of
+/// previously computed threads-per-block values for the trip counts
+/// the kernel has been launched with.  Trip counts are bucketed by
+/// their (floor of) log base 2 and each bucket remembers the most
+/// recent trip count that landed in it.  This keeps the table to a
+/// fixed size while loops that are repeatedly launched with the same
+/// trip count always hit.
+///
+/// Lookups and updates are lock free; each bucket packs the trip count
+/// and threads-per-block value into a single atomic word.  Trip counts
+/// that do not fit in a bucket are simply never cached.
+struct KitRTLaunchParamCache {
+  static const unsigned NUM_BUCKETS = 64;
+  static const unsigned TPB_BITS = 16;
+  static const uint64_t MAX_TRIP_COUNT = (uint64_t(1) << (64 - TPB_BITS)) - 1;
+
+  std::atomic<uint64_t> buckets[NUM_BUCKETS];
+
+  KitRTLaunchParamCache() {
+    for (auto &bucket : buckets)
+      bucket.store(0, std::memory_order_relaxed);
+  }
+
+  static unsigned bucket_index(uint64_t trip_count) {
+    return 63 - __builtin_clzll(trip_count);
+  }
+
+  /// Return the cached threads-per-block value for the given trip
+  /// count or zero if there is no such entry.
+  int lookup(uint64_t trip_count) const {
+    if (trip_count == 0 || trip_count > MAX_TRIP_COUNT)
+      return 0;
+    uint64_t entry =
+        buckets[bucket_index(trip_count)].load(std::memory_order_relaxed);
+    if ((entry >> TPB_BITS) != trip_count)
+      return 0;
+    return (int)(entry & ((uint64_t(1) << TPB_BITS) - 1));
+  }
+
+  /// Record the threads-per-block value used for the given trip count.
+  void insert(uint64_t trip_count, int threads_per_blk) {
+    if (trip_count == 0 || trip_count > MAX_TRIP_COUNT ||
+        threads_per_blk <= 0 || threads_per_blk >= (1 << TPB_BITS))
+      return;
+    uint64_t entry = (trip_count << TPB_BITS) | (uint64_t)threads_per_blk;
+    buckets[bucket_index(trip_count)].store(entry, std::memory_order_relaxed);
+  }
+};
+
+#endif
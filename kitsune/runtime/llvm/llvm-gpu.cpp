@@ -2,13 +2,26 @@
 #include"llvm-cuda.h"
 #include"llvm-hip.h"
 #include"llvm-spirv.h"
+#include<llvm/ADT/SmallString.h>
+#include<llvm/ADT/StringExtras.h>
+#include<llvm/Config/llvm-config.h>
 #include<llvm/IR/Module.h>
 #include<llvm/IRReader/IRReader.h>
+#include<llvm/Support/FileSystem.h>
+#include<llvm/Support/MemoryBuffer.h>
+#include<llvm/Support/Path.h>
+#include<llvm/Support/Process.h>
 #include<llvm/Support/SourceMgr.h>
+#include<llvm/Support/raw_ostream.h>
+#include<llvm/Support/xxhash.h>
 #include<fstream>
+#include<memory>
 #include<cassert>
 #include<error.h>
+#include<mutex>
+#include<optional>
 #include<stdbool.h>
+#include<unordered_map>
 
 void err(const char* msg){
   return error(1, 1, "%s", msg);
@@ -60,9 +73,8 @@ void initRuntime() {
   err("No suitable gpu hardware found, failed to initialize kitsune GPU runtime.\n");
 }
 
-extern "C"
-void* launchBCKernel(const char* bc, uint64_t bcsize, void** args, uint64_t n) {
-  llvm::LLVMContext C;
+static std::unique_ptr<llvm::Module>
+parseKernel(const char* bc, uint64_t bcsize, llvm::LLVMContext& C) {
   llvm::SMDiagnostic SMD;
   //std::string strbuf(bc, bcsize);
   //std::ofstream out("runtime.bc");
@@ -76,7 +88,149 @@ void* launchBCKernel(const char* bc, uint64_t bcsize, void** args, uint64_t n) {
     SMD.print("Failed to parse kernel IR: ", llvm::errs());
     exit(1);
   }
+  return mod;
+}
+
+// Lowering kernel bitcode is expensive, so the final device binaries
+// are cached -- in memory and on disk -- keyed by a hash of the
+// bitcode, the target device and the version of the lowering.
+// Repeated launches become a lookup and later runs of a program reuse
+// the binaries of earlier runs.  The on-disk cache lives in
+// KITRT_JIT_CACHE_DIR (by default the user's cache directory, e.g.
+// ~/.cache/kitsune/jit) and is disabled by setting KITRT_JIT_CACHE_DIR
+// to an empty string.
+struct JITCacheEntry {
+  std::once_flag once;
+  std::string bin;
+};
+static std::mutex jitCacheMutex;
+static std::unordered_map<uint64_t, std::unique_ptr<JITCacheEntry>> jitCache;
+
+// Binaries on disk may outlive the toolchain that produced them, so the
+// key includes the LLVM version and the version of the runtime's own
+// lowering.  Bump the latter whenever a change to the lowering changes
+// the binaries it produces.
+static const unsigned jitLoweringVersion = 1;
+
+static CUdevice cudaDevice() {
+  CUdevice device;
+  cuDeviceGet_p(&device, 0);
+  return device;
+}
+
+static std::string jitDeviceName() {
+  switch(globalRuntime){
+    case cuda: {
+      int maj, min;
+      CUdevice device = cudaDevice();
+      cuDeviceGetAttribute_p(&maj, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR,
+                             device);
+      cuDeviceGetAttribute_p(&min, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR,
+                             device);
+      return "cuda-sm_" + std::to_string(maj) + std::to_string(min);
+    }
+    default:
+      err("no jit cache support for the current runtime.");
+  }
+  return "";
+}
+
+static bool jitCachePath(uint64_t key, llvm::SmallVectorImpl<char>& path) {
+  std::optional<std::string> dir =
+      llvm::sys::Process::GetEnv("KITRT_JIT_CACHE_DIR");
+  if (dir) {
+    if (dir->empty())
+      return false;
+    path.assign(dir->begin(), dir->end());
+  } else {
+    if (!llvm::sys::path::cache_directory(path))
+      return false;
+    llvm::sys::path::append(path, "kitsune", "jit");
+  }
+  llvm::sys::path::append(path, llvm::utohexstr(key, true) + ".bin");
+  return true;
+}
+
+// The CUDA lowering keeps the target architecture in a global, so
+// compiles are serialized (by a lock of their own; see getKernelBinary()).
+static std::mutex jitCompileMutex;
 
+static std::string compileKernel(const char* bc, uint64_t bcsize) {
+  std::lock_guard<std::mutex> lock(jitCompileMutex);
+  llvm::LLVMContext C;
+  std::unique_ptr<llvm::Module> mod = parseKernel(bc, bcsize, C);
+  switch(globalRuntime){
+    case cuda: {
+      std::string ptx = __kitrt_cuLLVMtoPTX(*mod, cudaDevice());
+      size_t size;
+      char* elf = (char*)__kitrt_cuPTXtoELFImage(ptx.c_str(), &size);
+      std::string bin(elf, size);
+      free(elf);
+      return bin;
+    }
+    default:
+      err("no jit cache support for the current runtime.");
+  }
+  return "";
+}
+
+// Return the device binary for the given kernel bitcode, compiling it
+// only if it is found in neither the in-memory nor the on-disk cache.
+// Each kernel is loaded or compiled exactly once: the first thread to
+// miss does the work while concurrent launches of the same kernel wait
+// on its entry.  The cache lock is only held to find the entry so that
+// launches of other kernels are not held up by a compile.
+static const std::string& getKernelBinary(const char* bc, uint64_t bcsize) {
+  llvm::StringRef sr(bc, bcsize);
+  std::string target = jitDeviceName() + ";llvm-" LLVM_VERSION_STRING
+                       ";kitrt-" + std::to_string(jitLoweringVersion);
+  uint64_t key = llvm::xxh3_64bits(sr) ^
+                 (llvm::xxh3_64bits(target) * 0x9e3779b97f4a7c15ULL);
+
+  JITCacheEntry* entry;
+  {
+    std::lock_guard<std::mutex> lock(jitCacheMutex);
+    std::unique_ptr<JITCacheEntry>& slot = jitCache[key];
+    if (!slot)
+      slot = std::make_unique<JITCacheEntry>();
+    entry = slot.get();
+  }
+
+  std::call_once(entry->once, [&]() {
+    llvm::SmallString<256> path;
+    bool useDisk = jitCachePath(key, path);
+    if (useDisk) {
+      if (auto mb = llvm::MemoryBuffer::getFile(path)) {
+        entry->bin = (*mb)->getBuffer().str();
+        return;
+      }
+    }
+    entry->bin = compileKernel(bc, bcsize);
+    if (useDisk) {
+      // The write goes through a temporary file that is renamed into
+      // place so concurrent processes never see a partial binary.
+      // Failing to populate the cache is not an error.
+      (void)llvm::sys::fs::create_directories(
+          llvm::sys::path::parent_path(path));
+      if (llvm::Error E =
+              llvm::writeToOutput(path, [&](llvm::raw_ostream& OS) {
+                OS << entry->bin;
+                return llvm::Error::success();
+              }))
+        llvm::consumeError(std::move(E));
+    }
+  });
+  return entry->bin;
+}
+
+extern "C"
+void* launchBCKernel(const char* bc, uint64_t bcsize, void** args, uint64_t n) {
+  if (globalRuntime == cuda)
+    return __kitrt_cuLaunchELFKernel(getKernelBinary(bc, bcsize).data(),
+                                     args, n);
+
+  llvm::LLVMContext C;
+  std::unique_ptr<llvm::Module> mod = parseKernel(bc, bcsize, C);
   return launchKernel(*mod, args, n);
 }
 
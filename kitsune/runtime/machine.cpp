@@ -0,0 +1,246 @@
+//===- machine.cpp - Kitsune runtime machine profile ----------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "machine.h"
+#include "kitrt.h"
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+
+namespace {
+
+KitRTMachineProfile _kitrt_machine_profile;
+bool _kitrt_machine_profile_loaded = false;
+std::once_flag _kitrt_machine_profile_once;
+
+// The numeric entries of a profile.
+enum FieldKind { FIELD_DOUBLE, FIELD_INT, FIELD_UNSIGNED, FIELD_UINT64 };
+
+struct ProfileField {
+  const char *name;
+  FieldKind kind;
+  size_t offset;
+};
+
+#define KITRT_PROFILE_FIELD(kind, name)                                        \
+  { #name, kind, offsetof(KitRTMachineProfile, name) }
+
+const ProfileField _kitrt_profile_fields[] = {
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, device_bytes_per_sec),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, device_launch_ns),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, device_saturating_load),
+    KITRT_PROFILE_FIELD(FIELD_INT, device_stream_threads_per_blk),
+    KITRT_PROFILE_FIELD(FIELD_UINT64, device_l2_bytes),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, to_device_bytes_per_sec),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, to_host_bytes_per_sec),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, host_bytes_per_sec),
+    KITRT_PROFILE_FIELD(FIELD_UINT64, host_l1_bytes),
+    KITRT_PROFILE_FIELD(FIELD_UINT64, host_l2_bytes),
+    KITRT_PROFILE_FIELD(FIELD_UINT64, host_l3_bytes),
+    KITRT_PROFILE_FIELD(FIELD_UNSIGNED, host_workers),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, spawn_ns),
+    KITRT_PROFILE_FIELD(FIELD_DOUBLE, steal_ns),
+};
+
+#undef KITRT_PROFILE_FIELD
+
+std::string trim(const std::string &str) {
+  size_t first = str.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos)
+    return std::string();
+  size_t last = str.find_last_not_of(" \t\r\n");
+  return str.substr(first, last - first + 1);
+}
+
+// Set the named entry of the profile.  Returns false if the name is
+// unknown or the value malformed.
+bool set_field(KitRTMachineProfile *profile, const std::string &name,
+               const std::string &value) {
+  if (name == "device") {
+    snprintf(profile->device, sizeof(profile->device), "%s", value.c_str());
+    return true;
+  }
+  for (const ProfileField &field : _kitrt_profile_fields) {
+    if (name != field.name)
+      continue;
+    char *field_ptr = (char *)profile + field.offset;
+    const char *str = value.c_str();
+    char *end;
+    errno = 0;
+    switch (field.kind) {
+    case FIELD_DOUBLE:
+      *(double *)field_ptr = strtod(str, &end);
+      break;
+    case FIELD_INT:
+      *(int *)field_ptr = (int)strtol(str, &end, 10);
+      break;
+    case FIELD_UNSIGNED:
+      *(unsigned *)field_ptr = (unsigned)strtoul(str, &end, 10);
+      break;
+    case FIELD_UINT64:
+      *(uint64_t *)field_ptr = strtoull(str, &end, 10);
+      break;
+    }
+    return errno == 0 && end != str && *end == '\0';
+  }
+  return false;
+}
+
+} // namespace
+
+const KitRTMachineProfile *__kitrt_get_machine_profile() {
+  return _kitrt_machine_profile_loaded ? &_kitrt_machine_profile : nullptr;
+}
+
+bool __kitrt_read_machine_profile(const char *path,
+                                  KitRTMachineProfile *profile) {
+  assert(path && profile && "unexpected null argument!");
+  FILE *fp = fopen(path, "r");
+  if (fp == nullptr) {
+    fprintf(stderr, "kitrt: warning, unable to read machine profile '%s'.\n",
+            path);
+    return false;
+  }
+  memset(profile, 0, sizeof(*profile));
+  char buffer[1024];
+  unsigned line = 0;
+  while (fgets(buffer, sizeof(buffer), fp)) {
+    line++;
+    std::string text(buffer);
+    text = trim(text.substr(0, text.find('#')));
+    if (text.empty())
+      continue;
+    size_t eq = text.find('=');
+    if (eq == std::string::npos ||
+        !set_field(profile, trim(text.substr(0, eq)),
+                   trim(text.substr(eq + 1))))
+      fprintf(stderr, "kitrt: warning, ignoring malformed profile entry at "
+                      "%s:%u.\n", path, line);
+  }
+  fclose(fp);
+  return true;
+}
+
+bool __kitrt_write_machine_profile(const char *path,
+                                   const KitRTMachineProfile *profile) {
+  assert(path && profile && "unexpected null argument!");
+  FILE *fp = fopen(path, "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "kitrt: warning, unable to write machine profile "
+                    "'%s'.\n", path);
+    return false;
+  }
+  fprintf(fp, "# Kitsune machine profile (written by kitsune-probe).\n");
+  if (profile->device[0] != '\0')
+    fprintf(fp, "device=%s\n", profile->device);
+  // Unknown (zero) entries are left out.
+  for (const ProfileField &field : _kitrt_profile_fields) {
+    const char *field_ptr = (const char *)profile + field.offset;
+    switch (field.kind) {
+    case FIELD_DOUBLE:
+      if (*(const double *)field_ptr != 0.0)
+        fprintf(fp, "%s=%.6g\n", field.name, *(const double *)field_ptr);
+      break;
+    case FIELD_INT:
+      if (*(const int *)field_ptr != 0)
+        fprintf(fp, "%s=%d\n", field.name, *(const int *)field_ptr);
+      break;
+    case FIELD_UNSIGNED:
+      if (*(const unsigned *)field_ptr != 0)
+        fprintf(fp, "%s=%u\n", field.name, *(const unsigned *)field_ptr);
+      break;
+    case FIELD_UINT64:
+      if (*(const uint64_t *)field_ptr != 0)
+        fprintf(fp, "%s=%llu\n", field.name,
+                (unsigned long long)*(const uint64_t *)field_ptr);
+      break;
+    }
+  }
+  bool ok = ferror(fp) == 0;
+  ok = fclose(fp) == 0 && ok;
+  if (!ok)
+    fprintf(stderr, "kitrt: warning, unable to write machine profile "
+                    "'%s'.\n", path);
+  return ok;
+}
+
+void __kitrt_machine_profile_initialize() {
+  std::call_once(_kitrt_machine_profile_once, []() {
+    std::string path;
+    if (const char *value = __kitrt_get_config("KITRT_MACHINE_PROFILE")) {
+      // An empty setting disables the profile.
+      if (*value == '\0')
+        return;
+      path = value;
+    } else {
+      // The default profile is only read if it exists.
+      const char *home = getenv("HOME");
+      if (home == nullptr)
+        return;
+      path = std::string(home) + "/.kitsune/machine-profile";
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0)
+        return;
+    }
+    _kitrt_machine_profile_loaded =
+        __kitrt_read_machine_profile(path.c_str(), &_kitrt_machine_profile);
+    if (_kitrt_machine_profile_loaded && __kitrt_verbose_mode())
+      fprintf(stderr, "    machine profile: %s (%s)\n", path.c_str(),
+              _kitrt_machine_profile.device[0] != '\0'
+                  ? _kitrt_machine_profile.device
+                  : "no device");
+  });
+}
@@ -0,0 +1,116 @@
+//===- machine.h - Kitsune runtime machine profile ------------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __KITRT_MACHINE_H__
+#define __KITRT_MACHINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// The launch and placement heuristics of the runtime (the refinement
+/// of occupancy launches, the roofline model of coarsened launches, the
+/// autotuner, host fallbacks and hybrid loops) start from measured
+/// properties of the machine when a machine profile is available.  The
+/// kitsune-probe tool measures them and writes the profile; the runtime
+/// reads it in __kitrt_initialize() from the file named by
+/// KITRT_MACHINE_PROFILE or, when that is not set, from
+/// $HOME/.kitsune/machine-profile if it exists.  A profile describes the
+/// machine (and the primary device) it was measured on and should be
+/// regenerated when either changes.
+///
+/// The profile uses the format of the configuration file (see
+/// __kitrt_get_config()): one 'name=value' entry per line, with '#'
+/// starting a comment.  Missing entries (and zero values) are unknown
+/// and leave the runtime's built-in defaults in place; settings in the
+/// environment still take precedence over the profile.
+struct KitRTMachineProfile {
+  char device[256]; // name of the primary device.
+
+  // The primary device.
+  double device_bytes_per_sec;  // achievable memory bandwidth.
+  double device_launch_ns;      // launch and completion of a kernel.
+  double device_saturating_load; // blocks per multi-processor (percent)
+                                 // that reach 90% of the bandwidth.
+  int device_stream_threads_per_blk; // fastest block size of a copy.
+  uint64_t device_l2_bytes;          // L2 cache size.
+
+  // Migration of managed memory between the host and the device.
+  double to_device_bytes_per_sec;
+  double to_host_bytes_per_sec;
+
+  // The host.
+  double host_bytes_per_sec; // memory bandwidth of all cores.
+  uint64_t host_l1_bytes;    // (per core) L1 data cache size.
+  uint64_t host_l2_bytes;
+  uint64_t host_l3_bytes;
+  unsigned host_workers; // OpenCilk workers.
+  double spawn_ns;       // cost of a spawn (and its sync) on one worker.
+  double steal_ns;       // cost of a steal by an idle worker.
+};
+
+/// Return the machine profile the runtime loaded, or null if there is
+/// none.
+extern const KitRTMachineProfile *__kitrt_get_machine_profile();
+
+/// Read a machine profile from the given file into 'profile'.  Returns
+/// false (with a warning) if the file can not be read.
+extern bool __kitrt_read_machine_profile(const char *path,
+                                         KitRTMachineProfile *profile);
+
+/// Write a machine profile to the given file.  Returns false (with a
+/// warning) if the file can not be written.
+extern bool __kitrt_write_machine_profile(const char *path,
+                                          const KitRTMachineProfile *profile);
+
+/// Load the machine profile (see above).  This is called by
+/// __kitrt_initialize() and only has an effect on its first call.
+extern void __kitrt_machine_profile_initialize();
+
+#endif // __KITRT_MACHINE_H__
@@ -0,0 +1,393 @@
+//===- mem_pool.cpp - Kitsune runtime managed memory pool -----------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdio>
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "kitrt.h"
+#include "mem_pool.h"
+#include "memory_map.h"
+
+namespace {
+
+const unsigned KITRT_MEM_POOL_MIN_CLASS_SHIFT = 10;  // 1 KB
+const unsigned KITRT_MEM_POOL_STEP_SHIFT = 2;        // 4 classes per 2x
+const unsigned KITRT_MEM_POOL_MAX_CLASSES = 128;
+
+/// A slab is a single allocation from the driver that is carved up
+/// into blocks of a single size class.
+struct KitRTMemSlab {
+  size_t size;          // size of the slab in bytes.
+  unsigned size_class;  // size class of the blocks within the slab.
+  unsigned num_blocks;  // number of blocks carved from the slab.
+  unsigned num_free;    // number of blocks currently in the free bin.
+};
+
+typedef std::map<char *, KitRTMemSlab> KitRTMemSlabMap;
+
+/// A freed block waiting for its fence before it is reused.
+struct KitRTMemPendingFree {
+  void *block;
+  void *fence;
+  unsigned size_class;
+};
+
+} // namespace
+
+struct KitRTMemPool {
+  std::string name;
+  KitRTMemPoolAllocFn alloc_fn;
+  KitRTMemPoolFreeFn free_fn;
+  KitRTMemPoolRecordFenceFn record_fence_fn = nullptr;
+  KitRTMemPoolFenceDoneFn fence_done_fn = nullptr;
+  size_t max_block_size;
+  size_t slab_size;
+  size_t high_water;
+
+  std::mutex mutex;
+  KitRTMemSlabMap slabs;
+  std::vector<void *> bins[KITRT_MEM_POOL_MAX_CLASSES];
+  std::unordered_set<void *> live_blocks;
+  std::vector<KitRTMemPendingFree> pending_frees;
+  size_t cached_bytes = 0;
+  size_t slab_bytes = 0;
+};
+
+namespace {
+
+inline size_t class_size(unsigned size_class) {
+  // (4 + step) / 4 times a power of two.
+  const unsigned num_steps = 1u << KITRT_MEM_POOL_STEP_SHIFT;
+  unsigned shift = size_class / num_steps + KITRT_MEM_POOL_MIN_CLASS_SHIFT -
+                   KITRT_MEM_POOL_STEP_SHIFT;
+  return size_t(num_steps + size_class % num_steps) << shift;
+}
+
+unsigned size_to_class(size_t size) {
+  unsigned size_class = 0;
+  while (class_size(size_class) < size)
+    size_class++;
+  return size_class;
+}
+
+/// Return the slab containing the given block.  The caller must hold
+/// the pool's lock.
+KitRTMemSlabMap::iterator find_slab(KitRTMemPool *pool, void *addr) {
+  KitRTMemSlabMap::iterator sit = pool->slabs.upper_bound((char *)addr);
+  assert(sit != pool->slabs.begin() && "block not within a pool slab!");
+  return --sit;
+}
+
+/// Allocate a new slab for the given size class and fill its bin.  The
+/// caller must hold the pool's lock.
+bool grow_pool(KitRTMemPool *pool, unsigned size_class) {
+  size_t block_size = class_size(size_class);
+  size_t slab_size = block_size < pool->slab_size ? pool->slab_size
+                                                  : block_size;
+  char *slab = (char *)pool->alloc_fn(slab_size);
+  if (slab == nullptr)
+    return false;
+
+  KitRTMemSlab &entry = pool->slabs[slab];
+  entry.size = slab_size;
+  entry.size_class = size_class;
+  entry.num_blocks = slab_size / block_size;
+  entry.num_free = entry.num_blocks;
+  pool->slab_bytes += slab_size;
+  pool->cached_bytes += entry.num_blocks * block_size;
+
+  // Push the blocks in reverse so they are handed out in address order.
+  std::vector<void *> &bin = pool->bins[size_class];
+  for (unsigned i = entry.num_blocks; i > 0; i--)
+    bin.push_back(slab + (i - 1) * block_size);
+
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "%s: new pool slab (%p) of %ld bytes, "
+            "%d blocks of %ld bytes.\n", pool->name.c_str(),
+            (void *)slab, slab_size, entry.num_blocks, block_size);
+  return true;
+}
+
+/// Return a freed block to its bin.  The caller must hold the pool's
+/// lock.
+void release_block(KitRTMemPool *pool, void *block) {
+  KitRTMemSlab &slab = find_slab(pool, block)->second;
+  slab.num_free++;
+  pool->bins[slab.size_class].push_back(block);
+  pool->cached_bytes += class_size(slab.size_class);
+}
+
+/// Return the freed blocks whose fences have completed to their bins;
+/// all of them (after waiting) when 'wait' is set.  The caller must
+/// hold the pool's lock.
+void reclaim_pending(KitRTMemPool *pool, bool wait) {
+  size_t kept = 0;
+  for (KitRTMemPendingFree &pending : pool->pending_frees) {
+    if (pool->fence_done_fn(pending.fence, wait))
+      release_block(pool, pending.block);
+    else
+      pool->pending_frees[kept++] = pending;
+  }
+  pool->pending_frees.resize(kept);
+}
+
+/// Release completely free slabs, largest size class first, until the
+/// cached byte count drops to the given limit.  The caller must hold
+/// the pool's lock.
+void trim_pool(KitRTMemPool *pool, size_t max_cached_bytes) {
+  for (unsigned size_class = KITRT_MEM_POOL_MAX_CLASSES; size_class > 0 &&
+         pool->cached_bytes > max_cached_bytes; size_class--) {
+    std::vector<void *> &bin = pool->bins[size_class - 1];
+    if (bin.empty())
+      continue;
+
+    std::map<char *, size_t> released;
+    KitRTMemSlabMap::iterator sit = pool->slabs.begin();
+    while (sit != pool->slabs.end() &&
+           pool->cached_bytes > max_cached_bytes) {
+      KitRTMemSlab &slab = sit->second;
+      if (slab.size_class == size_class - 1 &&
+          slab.num_free == slab.num_blocks) {
+        if (__kitrt_verbose_mode())
+          fprintf(stderr, "%s: releasing pool slab (%p) of %ld bytes.\n",
+                  pool->name.c_str(), (void *)sit->first, slab.size);
+        pool->cached_bytes -= slab.num_blocks * class_size(slab.size_class);
+        pool->slab_bytes -= slab.size;
+        pool->free_fn(sit->first);
+        released[sit->first] = slab.size;
+        sit = pool->slabs.erase(sit);
+      } else
+        ++sit;
+    }
+
+    if (released.empty())
+      continue;
+
+    // Drop the blocks of the released slabs from the bin.
+    std::vector<void *> kept;
+    for (void *block : bin) {
+      std::map<char *, size_t>::iterator rit =
+          released.upper_bound((char *)block);
+      if (rit == released.begin() ||
+          (char *)block >= (--rit)->first + rit->second)
+        kept.push_back(block);
+    }
+    bin.swap(kept);
+  }
+}
+
+} // namespace
+
+KitRTMemPool *__kitrt_create_mem_pool(const char *name,
+                                      KitRTMemPoolAllocFn alloc_fn,
+                                      KitRTMemPoolFreeFn free_fn) {
+  assert(name != nullptr && "unexpected null name!");
+  assert(alloc_fn != nullptr && "unexpected null alloc function!");
+  assert(free_fn != nullptr && "unexpected null free function!");
+
+  bool enable_pool = true;
+  __kitrt_get_env_value("KITRT_MEM_POOL", enable_pool);
+  if (not enable_pool) {
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "%s: memory pool disabled.\n", name);
+    return nullptr;
+  }
+
+  KitRTMemPool *pool = new KitRTMemPool;
+  pool->name = name;
+  pool->alloc_fn = alloc_fn;
+  pool->free_fn = free_fn;
+  pool->max_block_size = 256 * 1024 * 1024;
+  pool->slab_size = 2 * 1024 * 1024;
+  pool->high_water = 1024 * 1024 * 1024;
+
+  unsigned long value;
+  if (__kitrt_get_env_value("KITRT_MEM_POOL_MAX_BLOCK_SIZE", value))
+    pool->max_block_size = value;
+  if (__kitrt_get_env_value("KITRT_MEM_POOL_SLAB_SIZE", value) && value > 0)
+    pool->slab_size = value;
+  if (__kitrt_get_env_value("KITRT_MEM_POOL_HIGH_WATER", value))
+    pool->high_water = value;
+
+  size_t max_class_size = class_size(KITRT_MEM_POOL_MAX_CLASSES - 1);
+  if (pool->max_block_size > max_class_size)
+    pool->max_block_size = max_class_size;
+
+  if (__kitrt_verbose_mode()) {
+    fprintf(stderr, "%s: memory pool enabled.\n", name);
+    fprintf(stderr, "    max block size: %ld bytes\n", pool->max_block_size);
+    fprintf(stderr, "    slab size:      %ld bytes\n", pool->slab_size);
+    fprintf(stderr, "    high water:     %ld bytes\n", pool->high_water);
+  }
+  return pool;
+}
+
+void __kitrt_mem_pool_set_fence(KitRTMemPool *pool,
+                                KitRTMemPoolRecordFenceFn record_fn,
+                                KitRTMemPoolFenceDoneFn done_fn) {
+  if (pool == nullptr)
+    return;
+  assert((record_fn == nullptr) == (done_fn == nullptr) &&
+         "incomplete pool fence!");
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  pool->record_fence_fn = record_fn;
+  pool->fence_done_fn = done_fn;
+}
+
+void *__kitrt_mem_pool_alloc(KitRTMemPool *pool, size_t size) {
+  if (pool == nullptr || size == 0 || size > pool->max_block_size)
+    return nullptr;
+
+  unsigned size_class = size_to_class(size);
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  std::vector<void *> &bin = pool->bins[size_class];
+  // Blocks freed behind work that has since completed can be reused.
+  // Otherwise the pool waits for the work before it reuses a block of
+  // the size class rather than growing.  The wait can be long (e.g., a
+  // device synchronization), so the blocks are taken out of the
+  // pending list and waited for without the lock held.
+  if (bin.empty() && not pool->pending_frees.empty()) {
+    reclaim_pending(pool, false);
+    std::vector<KitRTMemPendingFree> waiting;
+    if (bin.empty()) {
+      size_t kept = 0;
+      for (KitRTMemPendingFree &pending : pool->pending_frees) {
+        if (pending.size_class == size_class)
+          waiting.push_back(pending);
+        else
+          pool->pending_frees[kept++] = pending;
+      }
+      pool->pending_frees.resize(kept);
+    }
+    if (not waiting.empty()) {
+      lock.unlock();
+      for (KitRTMemPendingFree &pending : waiting)
+        (void)pool->fence_done_fn(pending.fence, true);
+      lock.lock();
+      for (KitRTMemPendingFree &pending : waiting)
+        release_block(pool, pending.block);
+    }
+  }
+  if (bin.empty() && not grow_pool(pool, size_class))
+    return nullptr;
+
+  void *block = bin.back();
+  bin.pop_back();
+  find_slab(pool, block)->second.num_free--;
+  pool->cached_bytes -= class_size(size_class);
+  pool->live_blocks.insert(block);
+  return block;
+}
+
+bool __kitrt_mem_pool_free(KitRTMemPool *pool, void *addr) {
+  if (pool == nullptr)
+    return false;
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  if (pool->live_blocks.erase(addr) == 0)
+    return false;
+
+  // Kernels still in flight may use the block.  It waits for a fence
+  // behind them before going back to its bin.  The fence is recorded
+  // without the lock held; the block is in neither the live set nor a
+  // bin meanwhile, so no other thread can see it.
+  if (pool->record_fence_fn != nullptr) {
+    unsigned size_class = find_slab(pool, addr)->second.size_class;
+    lock.unlock();
+    void *fence = pool->record_fence_fn();
+    lock.lock();
+    pool->pending_frees.push_back({addr, fence, size_class});
+    reclaim_pending(pool, false);
+  } else
+    release_block(pool, addr);
+
+  if (pool->cached_bytes > pool->high_water)
+    trim_pool(pool, pool->high_water);
+  return true;
+}
+
+size_t __kitrt_mem_pool_block_size(KitRTMemPool *pool, void *addr) {
+  if (pool == nullptr)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  if (pool->live_blocks.count(addr) == 0)
+    return 0;
+  return class_size(find_slab(pool, addr)->second.size_class);
+}
+
+void __kitrt_mem_pool_trim(KitRTMemPool *pool, size_t max_cached_bytes) {
+  if (pool == nullptr)
+    return;
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  if (not pool->pending_frees.empty())
+    reclaim_pending(pool, false);
+  trim_pool(pool, max_cached_bytes);
+}
+
+void __kitrt_destroy_mem_pool(KitRTMemPool *pool) {
+  if (pool == nullptr)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    reclaim_pending(pool, true);
+    for (void *block : pool->live_blocks)
+      __kitrt_unregister_mem_alloc(block);
+    for (auto &slab : pool->slabs)
+      pool->free_fn(slab.first);
+  }
+  delete pool;
+}
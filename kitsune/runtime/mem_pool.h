@@ -0,0 +1,150 @@
+//===- mem_pool.h - Kitsune runtime managed memory pool -------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __KITRT_MEM_POOL_H__
+#define __KITRT_MEM_POOL_H__
+
+#include <stddef.h>
+
+/// The CUDA and HIP runtimes share a caching sub-allocator for managed
+/// memory.  Requests are rounded up to a size class and served from
+/// per-class bins of free blocks.  There are four size classes for each
+/// power of two (1 KB, 1.25 KB, 1.5 KB, 1.75 KB, 2 KB, ...) so a block
+/// is at most 25% larger than the request (beyond the 1 KB minimum),
+/// and every block is 256-byte aligned.  Blocks for the smaller
+/// size classes are carved out of larger slabs so that the (expensive)
+/// driver allocation and memory advice calls are made once per slab
+/// rather than once per allocation.  Freed blocks are returned to their
+/// bin instead of the driver.  Pools given a fence (see
+/// __kitrt_mem_pool_set_fence()) only return a freed block to its bin
+/// once the device work in flight at the time of the free has
+/// completed, so a new allocation never reuses memory that a kernel may
+/// still be using.  When the amount of cached (free) memory
+/// exceeds a high-water mark, completely free slabs are handed back to
+/// the driver.
+///
+/// The pool's behavior can be tuned via the following environment
+/// variables:
+///
+///    * KITRT_MEM_POOL: enable (default) or disable pooling.
+///    * KITRT_MEM_POOL_MAX_BLOCK_SIZE: the largest request (in bytes)
+///      served from the pool; larger requests go directly to the
+///      driver (default 256 MB).
+///    * KITRT_MEM_POOL_SLAB_SIZE: the minimum size (in bytes) of each
+///      slab requested from the driver (default 2 MB).
+///    * KITRT_MEM_POOL_HIGH_WATER: the amount (in bytes) of free memory
+///      held by the pool before slabs are released (default 1 GB).
+///
+/// The pool does not interact with the memory allocation map; callers
+/// are responsible for registering and unregistering the blocks they
+/// hand out.
+struct KitRTMemPool;
+
+/// Function used by the pool to allocate a new slab of the given size
+/// in bytes.  It is expected to apply any memory advice (or attributes)
+/// that should be shared by all the blocks within the slab.
+typedef void *(*KitRTMemPoolAllocFn)(size_t size);
+
+/// Function used by the pool to release a slab.
+typedef void (*KitRTMemPoolFreeFn)(void *addr);
+
+/// Create a new memory pool.  The name is used for verbose mode output.
+/// If pooling has been disabled via the environment a null pointer is
+/// returned; all the calls below accept a null pool and fall back to
+/// the caller's unpooled path.
+extern KitRTMemPool *__kitrt_create_mem_pool(const char *name,
+                                             KitRTMemPoolAllocFn alloc_fn,
+                                             KitRTMemPoolFreeFn free_fn);
+
+/// Functions used by the pool to order the reuse of freed blocks after
+/// the device work in flight when they were freed.  The record function
+/// returns a fence (e.g., the count of device synchronizations so far).
+/// The done function returns true once the fence has completed, waiting
+/// for it (e.g., synchronizing the device) if 'wait' is set; a fence is
+/// no longer used once it has returned true.  The pool waits before it
+/// would reuse a block rather than growing.  Fences are recorded, and
+/// waited for, without the pool's lock held.
+typedef void *(*KitRTMemPoolRecordFenceFn)();
+typedef bool (*KitRTMemPoolFenceDoneFn)(void *fence, bool wait);
+
+/// Give the pool the functions used to fence the reuse of freed blocks.
+/// Without them, freed blocks are reused immediately.
+extern void __kitrt_mem_pool_set_fence(KitRTMemPool *pool,
+                                       KitRTMemPoolRecordFenceFn record_fn,
+                                       KitRTMemPoolFenceDoneFn done_fn);
+
+/// Allocate a block of at least 'size' bytes from the pool.  Returns a
+/// null pointer if the request can not be served by the pool (e.g., it
+/// is larger than the maximum block size), in which case the caller
+/// should allocate directly from the driver.
+extern void *__kitrt_mem_pool_alloc(KitRTMemPool *pool, size_t size);
+
+/// Return a block to the pool.  The block is reused once the pool's
+/// fence (if any) recorded by the call has completed.  Returns false if
+/// the given pointer was not allocated by the pool, in which case the
+/// caller is responsible for releasing it.
+extern bool __kitrt_mem_pool_free(KitRTMemPool *pool, void *addr);
+
+/// Return the size of the pool's block at the given address (i.e., its
+/// size class, which may be larger than the size it was allocated
+/// with) or zero if the address is not a block allocated by the pool.
+extern size_t __kitrt_mem_pool_block_size(KitRTMemPool *pool, void *addr);
+
+/// Release completely free slabs back to the driver until no more than
+/// 'max_cached_bytes' of free memory remains in the pool.
+extern void __kitrt_mem_pool_trim(KitRTMemPool *pool, size_t max_cached_bytes);
+
+/// Destroy the pool (after waiting for the fences of freed blocks) and
+/// release all of its slabs.  Any blocks that are still in use are
+/// unregistered from the memory allocation map so the map does not
+/// later try to free them individually.
+extern void __kitrt_destroy_mem_pool(KitRTMemPool *pool);
+
+#endif
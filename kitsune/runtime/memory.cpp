@@ -51,12 +51,365 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <cerrno>
+#include <condition_variable>
 #include <cstdlib>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "kitrt.h"
 #include "memory_map.h"
 
+// The placement of host allocations is controlled by a few policies,
+// set from the environment when the first allocation is made (and
+// reported then in verbose mode):
+//
+//   - NUMA placement (KITRT_NUMA_POLICY).  With 'first-touch' (the
+//     default) large allocations are first-touched in parallel so
+//     their pages are spread over the nodes instead of all landing on
+//     the node of the thread that initializes them.  One thread per
+//     worker (CILK_NWORKERS, or one per available CPU) touches a
+//     contiguous block of the allocation -- the same block partition a
+//     parallel loop over the allocation starts from -- while pinned to
+//     a CPU.  The threads are started by the first placed allocation
+//     and reused by the later ones.  The CPUs are taken in the order
+//     of their nodes, so consecutive blocks stay on the same node.
+//     With 'interleave' the pages of large allocations are interleaved
+//     over the nodes instead (for data without a fixed owner), and
+//     'none' leaves placement to the OS.  KITRT_FIRST_TOUCH=0 is the
+//     same as 'none' and KITRT_FIRST_TOUCH_MIN_BYTES sets the smallest
+//     allocation that is placed (16 MiB by default).
+//
+//   - Page size (KITRT_HUGE_PAGES).  'thp' maps large allocations
+//     aligned to 2 MiB and asks for transparent huge pages, while '2m'
+//     and '1g' map them from the hugetlb pool of that page size
+//     (falling back to 'thp' when the pool is exhausted).  The default,
+//     'none', uses the base page size.  KITRT_HUGE_PAGES_MIN_BYTES sets
+//     the smallest allocation that is mapped this way (2 MiB).
+//
+//   - Alignment (KITRT_MEM_ALIGNMENT).  Allocations that are not
+//     mapped are aligned to this many bytes, 64 (a cache line, and the
+//     width of the widest vectors) by default.
+
+namespace {
+
+const unsigned long DefaultFirstTouchMinBytes = 16ul << 20;
+const unsigned long DefaultHugePagesMinBytes = 2ul << 20;
+const unsigned long DefaultMemAlignment = 64;
+const size_t TransparentHugePageSize = 2ul << 20;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+// The interleave mode of mbind(2); see <numaif.h> (libnuma is not
+// required).
+const int KITRT_MPOL_INTERLEAVE = 3;
+
+enum class HugePages { None, Transparent, Huge2M, Huge1G };
+enum class NumaPolicy { None, FirstTouch, Interleave };
+
+HugePages huge_pages = HugePages::None;
+NumaPolicy numa_policy = NumaPolicy::FirstTouch;
+unsigned long huge_pages_min_bytes = DefaultHugePagesMinBytes;
+unsigned long mem_alignment = DefaultMemAlignment;
+unsigned long first_touch_min_bytes = DefaultFirstTouchMinBytes;
+// The CPUs available to the process, grouped by NUMA node, and the
+// mask of the nodes they belong to.
+std::vector<int> first_touch_cpus;
+std::vector<unsigned long> numa_node_mask;
+std::once_flag mem_policy_once;
+
+// The allocations made with mmap() and their mapped sizes.
+std::unordered_map<void *, size_t> mapped_allocs;
+std::mutex mapped_allocs_mutex;
+
+// Read the CPUs of the given NUMA node that are in the given set.
+// Returns false if the node does not exist.
+bool read_node_cpus(unsigned node, const cpu_set_t &allowed,
+                    std::vector<int> &cpus) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+           node);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  // The list has the form "0-15,32-47".
+  int lo, hi;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    int c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &hi) != 1)
+        break;
+      c = fgetc(f);
+    }
+    for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+    if (c != ',')
+      break;
+  }
+  fclose(f);
+  return true;
+}
+
+const char *huge_pages_name(HugePages pages) {
+  switch (pages) {
+  case HugePages::Transparent:
+    return "thp";
+  case HugePages::Huge2M:
+    return "2m";
+  case HugePages::Huge1G:
+    return "1g";
+  default:
+    return "base";
+  }
+}
+
+const char *numa_policy_name(NumaPolicy policy) {
+  switch (policy) {
+  case NumaPolicy::FirstTouch:
+    return "first-touch";
+  case NumaPolicy::Interleave:
+    return "interleave";
+  default:
+    return "none";
+  }
+}
+
+void init_mem_policy() {
+  if (const char *value = __kitrt_get_config("KITRT_HUGE_PAGES")) {
+    if (!strcasecmp(value, "thp"))
+      huge_pages = HugePages::Transparent;
+    else if (!strcasecmp(value, "2m"))
+      huge_pages = HugePages::Huge2M;
+    else if (!strcasecmp(value, "1g"))
+      huge_pages = HugePages::Huge1G;
+    else if (strcasecmp(value, "none"))
+      fprintf(stderr, "kitrt: warning, unknown KITRT_HUGE_PAGES value "
+                      "'%s' (expected none, thp, 2m or 1g).\n", value);
+  }
+  __kitrt_get_env_value("KITRT_HUGE_PAGES_MIN_BYTES", huge_pages_min_bytes);
+  __kitrt_get_env_value("KITRT_MEM_ALIGNMENT", mem_alignment);
+  if (mem_alignment < sizeof(void *) ||
+      (mem_alignment & (mem_alignment - 1)) != 0) {
+    fprintf(stderr, "kitrt: warning, KITRT_MEM_ALIGNMENT must be a power "
+                    "of two of at least %zu -- using %lu.\n",
+            sizeof(void *), DefaultMemAlignment);
+    mem_alignment = DefaultMemAlignment;
+  }
+
+  if (const char *value = __kitrt_get_config("KITRT_NUMA_POLICY")) {
+    if (!strcasecmp(value, "interleave"))
+      numa_policy = NumaPolicy::Interleave;
+    else if (!strcasecmp(value, "none"))
+      numa_policy = NumaPolicy::None;
+    else if (strcasecmp(value, "first-touch"))
+      fprintf(stderr, "kitrt: warning, unknown KITRT_NUMA_POLICY value "
+                      "'%s' (expected first-touch, interleave or none).\n",
+              value);
+  }
+  bool first_touch = true;
+  __kitrt_get_env_value("KITRT_FIRST_TOUCH", first_touch);
+  if (!first_touch && numa_policy == NumaPolicy::FirstTouch)
+    numa_policy = NumaPolicy::None;
+  __kitrt_get_env_value("KITRT_FIRST_TOUCH_MIN_BYTES", first_touch_min_bytes);
+
+  unsigned nodes = 0;
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (numa_policy != NumaPolicy::None &&
+      sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    const unsigned bits = 8 * sizeof(unsigned long);
+    for (;; nodes++) {
+      size_t ncpus = first_touch_cpus.size();
+      if (!read_node_cpus(nodes, allowed, first_touch_cpus))
+        break;
+      if (first_touch_cpus.size() == ncpus)
+        continue;
+      numa_node_mask.resize(nodes / bits + 1, 0);
+      numa_node_mask[nodes / bits] |= 1ul << (nodes % bits);
+    }
+  }
+  // Placement only matters with more than one node (and CPU).
+  if (nodes < 2 || first_touch_cpus.size() < 2)
+    numa_policy = NumaPolicy::None;
+
+  if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitrt: host allocations use %s pages (from %lu bytes), "
+                    "%s NUMA placement (from %lu bytes, %u nodes) and "
+                    "%lu byte alignment.\n",
+            huge_pages_name(huge_pages), huge_pages_min_bytes,
+            numa_policy_name(numa_policy), first_touch_min_bytes, nodes,
+            mem_alignment);
+}
+
+// The threads that first-touch allocations.  They are started, and
+// pinned, by the first allocation that is placed and then wait for the
+// next one; concurrent allocations take turns.  The pool lives as long
+// as the process.
+struct FirstTouchPool {
+  std::mutex run_mutex; // Held by the allocation being touched.
+  std::mutex mutex;
+  std::condition_variable start, done;
+  volatile char *base = nullptr;
+  size_t page = 0;
+  size_t npages = 0;
+  size_t nthreads = 0;
+  size_t pending = 0;
+  unsigned long generation = 0;
+};
+
+FirstTouchPool *first_touch_pool = nullptr;
+std::once_flag first_touch_pool_once;
+
+void first_touch_worker(FirstTouchPool *pool, size_t t) {
+  // Spread the threads over the CPUs (and so over the nodes) evenly.
+  size_t ncpus = first_touch_cpus.size();
+  cpu_set_t cpu;
+  CPU_ZERO(&cpu);
+  CPU_SET(first_touch_cpus[t * ncpus / pool->nthreads], &cpu);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  for (;;) {
+    pool->start.wait(lock, [&]() { return pool->generation != seen; });
+    seen = pool->generation;
+    volatile char *base = pool->base;
+    size_t page = pool->page;
+    size_t first = t * pool->npages / pool->nthreads;
+    size_t last = (t + 1) * pool->npages / pool->nthreads;
+    lock.unlock();
+    for (size_t pg = first; pg < last; pg++)
+      base[pg * page] = 0;
+    lock.lock();
+    if (--pool->pending == 0)
+      pool->done.notify_one();
+  }
+}
+
+void init_first_touch_pool() {
+  size_t nthreads = first_touch_cpus.size();
+  unsigned nworkers = 0;
+  if (__kitrt_get_env_value("CILK_NWORKERS", nworkers) && nworkers > 0 &&
+      nworkers < nthreads)
+    nthreads = nworkers;
+
+  first_touch_pool = new FirstTouchPool;
+  first_touch_pool->page = sysconf(_SC_PAGESIZE);
+  first_touch_pool->nthreads = nthreads;
+  for (size_t t = 0; t < nthreads; t++)
+    std::thread(first_touch_worker, first_touch_pool, t).detach();
+}
+
+void first_touch(void *ptr, size_t bytes) {
+  std::call_once(mem_policy_once, init_mem_policy);
+  if (!ptr || numa_policy != NumaPolicy::FirstTouch ||
+      bytes < first_touch_min_bytes)
+    return;
+
+  std::call_once(first_touch_pool_once, init_first_touch_pool);
+  FirstTouchPool &pool = *first_touch_pool;
+  std::lock_guard<std::mutex> run(pool.run_mutex);
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  pool.base = (volatile char *)ptr;
+  pool.npages = (bytes + pool.page - 1) / pool.page;
+  pool.pending = pool.nthreads;
+  pool.generation++;
+  pool.start.notify_all();
+  pool.done.wait(lock, [&]() { return pool.pending == 0; });
+}
+
+// Map an allocation with the page size policy.  Returns null if the
+// allocation should come from malloc instead.
+void *map_alloc(size_t bytes) {
+  std::call_once(mem_policy_once, init_mem_policy);
+  bool interleave = numa_policy == NumaPolicy::Interleave &&
+                    bytes >= first_touch_min_bytes;
+  bool huge = huge_pages != HugePages::None && bytes >= huge_pages_min_bytes;
+  if (!interleave && !huge)
+    return nullptr;
+
+  void *ptr = MAP_FAILED;
+  size_t mapped = 0;
+  if (huge && huge_pages != HugePages::Transparent) {
+    bool is_1g = huge_pages == HugePages::Huge1G;
+    size_t page = is_1g ? 1ul << 30 : 2ul << 20;
+    mapped = (bytes + page - 1) / page * page;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                ((is_1g ? 30 : 21) << MAP_HUGE_SHIFT);
+    ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED && __kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: no %s huge pages for %zu bytes, using "
+                      "transparent huge pages.\n",
+              huge_pages_name(huge_pages), bytes);
+  }
+  if (ptr == MAP_FAILED) {
+    // Over-map so the allocation can start on a huge page boundary
+    // and trim the excess.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t align = huge ? TransparentHugePageSize : page;
+    mapped = (bytes + page - 1) / page * page;
+    char *base = (char *)mmap(nullptr, mapped + align - page,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      return nullptr;
+    char *start = (char *)(((uintptr_t)base + align - 1) & ~(align - 1));
+    if (start > base)
+      munmap(base, start - base);
+    if (start + mapped < base + mapped + align - page)
+      munmap(start + mapped, (base + mapped + align - page) - (start + mapped));
+    ptr = start;
+    if (huge)
+      madvise(ptr, mapped, MADV_HUGEPAGE);
+  }
+
+  // The nodes are set before any page is touched.
+  if (interleave)
+    syscall(SYS_mbind, ptr, mapped, KITRT_MPOL_INTERLEAVE,
+            numa_node_mask.data(), 8 * sizeof(unsigned long) *
+            numa_node_mask.size() + 1, 0);
+
+  std::lock_guard<std::mutex> lock(mapped_allocs_mutex);
+  mapped_allocs[ptr] = mapped;
+  return ptr;
+}
+
+// Unmap an allocation made by map_alloc().  Returns false if it was
+// not mapped.
+bool unmap_alloc(void *ptr) {
+  size_t mapped;
+  {
+    std::lock_guard<std::mutex> lock(mapped_allocs_mutex);
+    auto it = mapped_allocs.find(ptr);
+    if (it == mapped_allocs.end())
+      return false;
+    mapped = it->second;
+    mapped_allocs.erase(it);
+  }
+  munmap(ptr, mapped);
+  return true;
+}
+
+} // namespace
+
 extern "C" __attribute__((malloc))
 void *__kitrt_default_mem_alloc(size_t bytes) {
-  void *ptr = malloc(bytes); 
+  void *ptr = map_alloc(bytes);
+  if (ptr == nullptr && posix_memalign(&ptr, mem_alignment, bytes) != 0)
+    ptr = nullptr;
+  first_touch(ptr, bytes);
   __kitrt_register_mem_alloc(ptr, bytes);
   return ptr;
 }
@@ -66,6 +419,139 @@ void __kitrt_default_mem_free(void *ptr) {
   bool ro, wo;
   if (__kitrt_get_mem_alloc_size(ptr, &ro, &wo) > 0)
     __kitrt_unregister_mem_alloc(ptr); 
-  free(ptr);  
+  if (!unmap_alloc(ptr))
+    free(ptr);
 }
 
+extern "C"
+void *__kitrt_default_mem_reserve(size_t max_bytes) {
+  // Only address space is reserved: pages become accessible as they
+  // are committed and are backed by memory when first touched.
+  void *ptr = mmap(nullptr, max_bytes, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    fprintf(stderr, "kitrt: unable to reserve %zu bytes of address space.\n",
+            max_bytes);
+    abort();
+  }
+  return ptr;
+}
+
+extern "C"
+void __kitrt_default_mem_commit(void *base, size_t nbytes) {
+  bool ro, wo;
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t committed = __kitrt_get_mem_alloc_size(base, &ro, &wo);
+  committed = (committed + page - 1) / page * page;
+  if (nbytes > committed) {
+    size_t bytes = (nbytes - committed + page - 1) / page * page;
+    char *ptr = (char *)base + committed;
+    if (mprotect(ptr, bytes, PROT_READ | PROT_WRITE) != 0) {
+      fprintf(stderr, "kitrt: unable to commit %zu bytes at %p.\n",
+              bytes, (void *)ptr);
+      abort();
+    }
+    first_touch(ptr, bytes);
+  }
+  __kitrt_resize_mem_alloc(base, nbytes);
+}
+
+extern "C"
+void __kitrt_default_mem_release(void *base, size_t max_bytes) {
+  __kitrt_unregister_mem_alloc(base);
+  munmap(base, max_bytes);
+}
+
+extern "C"
+void *__kitrt_map_file(const char *path, size_t *nbytes) {
+  assert(path && "unexpected null path!");
+  assert(nbytes && "unexpected null size pointer!");
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "kitrt: unable to open '%s' (%s).\n", path,
+            strerror(errno));
+    return nullptr;
+  }
+  void *ptr = nullptr;
+  struct stat st;
+  st.st_size = 0;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED)
+      ptr = nullptr;
+    else {
+      // Start reading the file in the background.
+      madvise(ptr, st.st_size, MADV_WILLNEED);
+      *nbytes = st.st_size;
+    }
+  }
+  if (ptr == nullptr)
+    fprintf(stderr, "kitrt: unable to map '%s' (%s).\n", path,
+            st.st_size > 0 ? strerror(errno) : "empty file");
+  close(fd);
+  return ptr;
+}
+
+extern "C"
+void *__kitrt_default_mem_map_file(const char *path, size_t *nbytes) {
+  size_t size = 0;
+  void *ptr = __kitrt_map_file(path, &size);
+  if (ptr != nullptr) {
+    __kitrt_register_mem_alloc(ptr, size);
+    __kitrt_mark_mem_read_only(ptr);
+  }
+  if (nbytes)
+    *nbytes = size;
+  return ptr;
+}
+
+extern "C"
+void __kitrt_default_mem_unmap_file(void *ptr) {
+  bool ro, wo;
+  size_t size = __kitrt_get_mem_alloc_size(ptr, &ro, &wo);
+  if (size == 0) {
+    fprintf(stderr, "kitrt: warning, unmap of unknown file mapping %p.\n",
+            ptr);
+    return;
+  }
+  __kitrt_unregister_mem_alloc(ptr);
+  munmap(ptr, size);
+}
+
+extern "C"
+void *__kitrt_default_mem_alloc_pinned(size_t size) {
+  // There is no device to transfer to; page-aligned host memory keeps
+  // the same alignment guarantees as the target versions.
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, sysconf(_SC_PAGESIZE), size)) {
+    fprintf(stderr, "kitrt: unable to allocate %zu bytes of host memory.\n",
+            size);
+    abort();
+  }
+  return ptr;
+}
+
+extern "C"
+void __kitrt_default_mem_free_pinned(void *ptr, void *) {
+  free(ptr);
+}
+
+extern "C"
+void *__kitrt_default_mem_alloc_device(size_t size) {
+  return __kitrt_default_mem_alloc_pinned(size);
+}
+
+extern "C"
+void __kitrt_default_mem_free_device(void *ptr) {
+  free(ptr);
+}
+
+extern "C"
+bool __kitrt_default_mem_on_device(void *) {
+  return false;
+}
+
+extern "C"
+void __kitrt_default_mem_mark_cold(void *) {
+  // Host memory is never evicted.
+}
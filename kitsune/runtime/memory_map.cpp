@@ -48,39 +48,337 @@
 //
 //===----------------------------------------------------------------------===//
 
+
 #include <cstdio>
 #include <cassert>
-#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include "kitrt.h"
 #include "memory_map.h"
 
-typedef std::unordered_map<void *, KitRTAllocMapEntry> KitRTAllocMap;
-static KitRTAllocMap _kitrt_alloc_map;
+// The allocation map is ordered by the base address of each allocation.
+// This allows us to resolve any address that falls within a registered
+// allocation (e.g., `&a[offset]` passed as a kernel argument) to its
+// entry in O(log n) time vs. only matching the exact base address.
+// Allocations never overlap so the entry with the greatest base address
+// less than or equal to a given address is the only possible match.
+typedef std::map<void *, KitRTAllocMapEntry *> KitRTAllocMap;
+
+// To avoid serializing host threads that allocate and launch kernels
+// concurrently the map is split into shards.  The address space is
+// divided into fixed-size granules that are assigned to shards in a
+// round-robin fashion and an allocation is entered into the map of
+// every shard that owns one of the granules it spans.  A lookup
+// therefore only has to search (and lock) the single shard that owns
+// the granule containing the address.  Each shard is guarded by a
+// reader-writer lock so lookups only contend with registration and
+// unregistration of allocations within the same shard; the per-entry
+// flags are atomic so they can be updated while holding a shared lock.
+//
+// The granule size matches the large page size used by the CUDA and HIP
+// managed memory allocators.  Allocations that span more granules than
+// there are shards are entered into every shard.
+static const unsigned KITRT_ALLOC_MAP_SHARDS = 16;
+static const unsigned KITRT_ALLOC_MAP_GRANULE_SHIFT = 21;
+
+struct alignas(64) KitRTAllocMapShard {
+  std::shared_mutex mutex;
+  KitRTAllocMap map;
+};
+
+static KitRTAllocMapShard _kitrt_alloc_map[KITRT_ALLOC_MAP_SHARDS];
+
+// The memory statistics are kept as independent counters so they can
+// be updated without taking any of the shard locks.
+struct KitRTMemStatsCounters {
+  std::atomic<uint64_t> live_bytes;
+  std::atomic<uint64_t> peak_bytes;
+  std::atomic<uint64_t> live_allocs;
+  std::atomic<uint64_t> total_allocs;
+  std::atomic<uint64_t> total_frees;
+  std::atomic<uint64_t> resident_bytes;
+  std::atomic<uint64_t> prefetch_hits;
+  std::atomic<uint64_t> prefetch_misses;
+  std::atomic<uint64_t> live_size_classes[KITRT_MEM_STATS_NUM_SIZE_CLASSES];
+  std::atomic<uint64_t> total_size_classes[KITRT_MEM_STATS_NUM_SIZE_CLASSES];
+};
+
+static KitRTMemStatsCounters _kitrt_mem_stats;
+
+// Periodic sampling of the memory statistics.  The sampling thread
+// waits on the condition variable so it can be stopped without waiting
+// for the remainder of a period.
+static std::mutex _kitrt_mem_stats_mutex;
+static std::condition_variable _kitrt_mem_stats_cv;
+static std::thread *_kitrt_mem_stats_thread = nullptr;
+static bool _kitrt_mem_stats_stop = false;
+static KitRTMemStatsHook _kitrt_mem_stats_hook = nullptr;
+static void *_kitrt_mem_stats_data = nullptr;
+
+// The allocation sites (KITRT_MEM_SITES).  A site is created when an
+// allocation is first tagged with it and lives until exit, so entries
+// of the allocation map can point to it and its counters can be
+// updated without a lock.  Movement of memory that has no site is
+// charged to the untagged site.
+struct KitRTMemSite {
+  std::string file; // file name (or label) of the site.
+  unsigned line;
+  std::atomic<uint64_t> allocs;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> counters[KITRT_SITE_NUM_COUNTERS];
+};
+
+typedef std::map<std::pair<std::string, unsigned>, KitRTMemSite *>
+    KitRTMemSiteMap;
+
+static std::atomic<bool> _kitrt_mem_sites_on(false);
+static std::atomic<bool> _kitrt_mem_sites_reported(false);
+static unsigned _kitrt_mem_sites_report = 0;
+static std::mutex _kitrt_mem_sites_mutex;
+static KitRTMemSiteMap _kitrt_mem_sites;
+static KitRTMemSite _kitrt_mem_untagged_site;
+static std::atomic<void (*)()> _kitrt_mem_sites_flush(nullptr);
+
+namespace {
+
+unsigned mem_size_class(size_t size) {
+  if (size < 1024)
+    return 0;
+  unsigned log2 = 63 - __builtin_clzll((unsigned long long)size);
+  unsigned size_class = (log2 - 8) / 2;
+  return size_class < KITRT_MEM_STATS_NUM_SIZE_CLASSES
+             ? size_class
+             : KITRT_MEM_STATS_NUM_SIZE_CLASSES - 1;
+}
+
+void mem_stats_add_alloc(size_t size) {
+  uint64_t live = _kitrt_mem_stats.live_bytes += size;
+  uint64_t peak = _kitrt_mem_stats.peak_bytes.load();
+  while (live > peak &&
+         not _kitrt_mem_stats.peak_bytes.compare_exchange_weak(peak, live))
+    ;
+  _kitrt_mem_stats.live_allocs++;
+  _kitrt_mem_stats.total_allocs++;
+  unsigned size_class = mem_size_class(size);
+  _kitrt_mem_stats.live_size_classes[size_class]++;
+  _kitrt_mem_stats.total_size_classes[size_class]++;
+}
+
+/// Update the device-resident byte count for a change of the given
+/// entry's device mask.  Returns the previous mask.
+unsigned mem_stats_set_devices(KitRTAllocMapEntry &entry, unsigned devices) {
+  unsigned old_devices = entry.devices.exchange(devices);
+  if (old_devices == 0 && devices != 0)
+    _kitrt_mem_stats.resident_bytes += entry.size;
+  else if (old_devices != 0 && devices == 0)
+    _kitrt_mem_stats.resident_bytes -= entry.size;
+  return old_devices;
+}
+
+/// Account for the removal of the given entry and release it.
+void release_alloc_entry(KitRTAllocMapEntry *entry) {
+  if (entry == nullptr)
+    return;
+  (void)mem_stats_set_devices(*entry, 0);
+  _kitrt_mem_stats.live_bytes -= entry->size;
+  _kitrt_mem_stats.live_allocs--;
+  _kitrt_mem_stats.total_frees++;
+  _kitrt_mem_stats.live_size_classes[mem_size_class(entry->size)]--;
+  delete entry;
+}
+
+void mem_stats_sampler(KitRTMemStatsHook hook, void *data,
+                       unsigned period_ms) {
+  std::unique_lock<std::mutex> lock(_kitrt_mem_stats_mutex);
+  while (not _kitrt_mem_stats_cv.wait_for(
+      lock, std::chrono::milliseconds(period_ms),
+      [] { return _kitrt_mem_stats_stop; })) {
+    // Don't hold the lock while in the hook; it may call back into
+    // the runtime.
+    lock.unlock();
+    KitRTMemStats stats;
+    __kitrt_get_memory_stats(&stats);
+    hook(&stats, data);
+    lock.lock();
+  }
+}
+
+/// Stop the sampling thread (if any).
+void stop_mem_stats_sampler() {
+  std::thread *sampler;
+  {
+    std::lock_guard<std::mutex> lock(_kitrt_mem_stats_mutex);
+    sampler = _kitrt_mem_stats_thread;
+    _kitrt_mem_stats_thread = nullptr;
+    _kitrt_mem_stats_stop = true;
+  }
+  _kitrt_mem_stats_cv.notify_all();
+  if (sampler != nullptr) {
+    sampler->join();
+    delete sampler;
+  }
+}
+
+inline uintptr_t alloc_granule(const void *addr) {
+  return reinterpret_cast<uintptr_t>(addr) >> KITRT_ALLOC_MAP_GRANULE_SHIFT;
+}
+
+inline KitRTAllocMapShard &alloc_shard(uintptr_t granule) {
+  return _kitrt_alloc_map[granule % KITRT_ALLOC_MAP_SHARDS];
+}
+
+inline KitRTAllocMapShard &alloc_shard(const void *addr) {
+  return alloc_shard(alloc_granule(addr));
+}
+
+/// Return the number of shards spanned by the given allocation.  The
+/// spanned shards are consecutive (modulo the shard count) starting
+/// with the shard of the allocation's base address.
+unsigned alloc_shard_span(const void *addr, size_t size) {
+  uintptr_t first = alloc_granule(addr);
+  uintptr_t last = alloc_granule((const char *)addr + (size > 0 ? size - 1 : 0));
+  uintptr_t count = last - first + 1;
+  return count < KITRT_ALLOC_MAP_SHARDS ? count : KITRT_ALLOC_MAP_SHARDS;
+}
+
+/// Find the entry in the given shard for the allocation that contains
+/// the given address.  The caller must hold the shard's lock.
+KitRTAllocMap::const_iterator find_alloc_entry(const KitRTAllocMapShard &shard,
+                                               void *addr) {
+  KitRTAllocMap::const_iterator cit = shard.map.upper_bound(addr);
+  if (cit == shard.map.begin())
+    return shard.map.end();
+  --cit;
+  // Zero-byte allocations still cover their base address.
+  size_t span = cit->second->size > 0 ? cit->second->size : 1;
+  size_t offset = (char *)addr - (char *)cit->first;
+  if (offset < span)
+    return cit;
+  return shard.map.end();
+}
+
+/// Invoke 'fn' with the base address and entry of the allocation that
+/// contains the given address while holding a shared lock on the shard
+/// that owns it.  Returns false if no registered allocation contains
+/// the address.
+template <typename Fn>
+bool with_alloc_entry(void *addr, Fn fn) {
+  KitRTAllocMapShard &shard = alloc_shard(addr);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  KitRTAllocMap::const_iterator cit = find_alloc_entry(shard, addr);
+  if (cit == shard.map.end())
+    return false;
+  fn(cit->first, *cit->second);
+  return true;
+}
+
+/// Remove the allocation with the given base address from the map and
+/// return its entry (or nullptr if the address was not registered).
+/// The caller assumes ownership of the returned entry.
+KitRTAllocMapEntry *remove_alloc_entry(void *addr) {
+  KitRTAllocMapEntry *entry = nullptr;
+  uintptr_t granule = alloc_granule(addr);
+  {
+    // Claiming the entry from the base shard makes concurrent removals
+    // of the same address safe -- only one of them will find it.
+    KitRTAllocMapShard &shard = alloc_shard(granule);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    KitRTAllocMap::iterator ait = shard.map.find(addr);
+    if (ait == shard.map.end())
+      return nullptr;
+    entry = ait->second;
+    shard.map.erase(ait);
+  }
+  unsigned span = alloc_shard_span(addr, entry->size);
+  for (unsigned i = 1; i < span; i++) {
+    KitRTAllocMapShard &shard = alloc_shard(granule + i);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.map.erase(addr);
+  }
+  // Readers only access an entry while holding a lock on a shard that
+  // contains it.  Once it has been removed from all shards it is no
+  // longer reachable and can be safely released by the caller.
+  return entry;
+}
+
+} // namespace
 
-void __kitrt_register_mem_alloc(void *addr, size_t size) {
+std::atomic<uint64_t> __kitrt_mem_epoch(1);
+
+void __kitrt_register_mem_alloc(void *addr, size_t size, void *mirror) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMapEntry entry;
-  entry.size = size;
-  entry.prefetched = false;
-  entry.read_only = false;
-  entry.write_only = false;
-  _kitrt_alloc_map[addr] = entry;
+  // Replace any stale entry at the same address.
+  release_alloc_entry(remove_alloc_entry(addr));
+
+  KitRTAllocMapEntry *entry = new KitRTAllocMapEntry;
+  entry->size = size;
+  entry->prefetched = false;
+  entry->devices = 0;
+  entry->read_only = false;
+  entry->write_only = false;
+  entry->cold = false;
+  entry->advised_location = KITRT_MEM_ADVISED_NONE;
+  entry->device_advised = false;
+  entry->migrate_policy = 0; // KITRT_MIGRATE_AUTO
+  entry->round_trips = 0;
+  entry->mirror = mirror;
+  entry->site = nullptr;
+  mem_stats_add_alloc(size);
+
+  uintptr_t granule = alloc_granule(addr);
+  unsigned span = alloc_shard_span(addr, size);
+  for (unsigned i = 0; i < span; i++) {
+    KitRTAllocMapShard &shard = alloc_shard(granule + i);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.map[addr] = entry;
+  }
+  __kitrt_advance_mem_epoch();
   if (__kitrt_verbose_mode())
     fprintf(stderr, "kitrt: registered memory allocation (%p) "
 	    "of %ld bytes.\n", addr, size);
 }
 
+void *__kitrt_get_mem_mirror(void *addr, void **base, size_t *size) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  void *mirror = nullptr;
+  with_alloc_entry(addr, [&](void *ebase, KitRTAllocMapEntry &entry) {
+    if (entry.mirror == nullptr)
+      return;
+    mirror = (char *)entry.mirror + ((char *)addr - (char *)ebase);
+    if (base != nullptr)
+      *base = ebase;
+    if (size != nullptr)
+      *size = entry.size;
+  });
+  return mirror;
+}
+
 void __kitrt_set_mem_prefetch(void *addr, bool prefetched) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end()) {
-    ait->second.prefetched = prefetched;
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    bool changed = entry.prefetched.exchange(prefetched) != prefetched;
+    unsigned devices = prefetched ? 1 : 0;
+    changed |= mem_stats_set_devices(entry, devices) != devices;
+    if (prefetched)
+      changed |= entry.cold.exchange(false);
+    // The allocation now lives on one side in whole.
+    std::lock_guard<std::mutex> lock(entry.ranges_mutex);
+    if (changed || not entry.host_ranges.empty())
+      __kitrt_advance_mem_epoch();
+    entry.host_ranges.clear();
     if (__kitrt_verbose_mode())
       fprintf(stderr, "kitrt: marked memory at %p, size %ld, as '%s'.\n",
-	      addr, ait->second.size,
+	      base, entry.size,
 	      prefetched ? "prefetched" : "not prefetched");
-  }
+  });
   // We could consider a diagnostic here reporting use of an unregistered
   // pointer.  However, this is tricky with the compiler generating calls
   // as it currently has no way to distinguish managed pointer types.  At
@@ -92,58 +390,157 @@ void __kitrt_set_mem_prefetch(void *addr, bool prefetched) {
 
 void __kitrt_mark_mem_read_only(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end()) {
-    ait->second.read_only = true;
-  }
+  with_alloc_entry(addr, [](void *, KitRTAllocMapEntry &entry) {
+    if (not entry.read_only.exchange(true))
+      __kitrt_advance_mem_epoch();
+  });
 }
 
 bool __kitrt_is_mem_read_only(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end())
-    return ait->second.read_only;
-  else 
-    return false;
+  bool read_only = false;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    read_only = entry.read_only;
+  });
+  return read_only;
 }
 
 /// @brief Flag the given memory allocation as write only.
 /// @param addr: the pointer to the managed memory allocation. 
 extern void __kitrt_mark_mem_write_only(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end()) {
-    ait->second.write_only = true;
-  }
+  with_alloc_entry(addr, [](void *, KitRTAllocMapEntry &entry) {
+    if (not entry.write_only.exchange(true))
+      __kitrt_advance_mem_epoch();
+  });
 }
 
 
 bool __kitrt_is_mem_write_only(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end())
-    return ait->second.write_only;
-  else 
-    return false;
+  bool write_only = false;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    write_only = entry.write_only;
+  });
+  return write_only;
+}
+
+void __kitrt_set_mem_cold(void *addr, bool cold) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    if (entry.cold.exchange(cold) == cold)
+      return;
+    __kitrt_advance_mem_epoch();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: marked memory at %p, size %ld, as '%s'.\n",
+              base, entry.size, cold ? "cold" : "not cold");
+  });
+}
+
+bool __kitrt_is_mem_cold(void *addr) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  bool cold = false;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    cold = entry.cold;
+  });
+  return cold;
+}
+
+int __kitrt_exchange_mem_advice(void *addr, int location) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  int advised = location;
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    advised = entry.advised_location.exchange(location);
+    if (advised != location && __kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: advised memory at %p, size %ld, to prefer "
+              "location %d.\n", base, entry.size, location);
+  });
+  return advised;
+}
+
+bool __kitrt_test_and_set_mem_device_advice(void *addr) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  bool advised = true;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    advised = entry.device_advised.exchange(true);
+  });
+  return advised;
+}
+
+void __kitrt_set_mem_migrate_policy(void *addr, int policy) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    if (entry.migrate_policy.exchange(policy) == policy)
+      return;
+    entry.advised_location = KITRT_MEM_ADVISED_NONE;
+    __kitrt_advance_mem_epoch();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: set migration policy of memory at %p, "
+              "size %ld, to %d.\n", base, entry.size, policy);
+  });
+}
+
+int __kitrt_get_mem_migrate_policy(void *addr, unsigned *round_trips) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  int policy = 0; // KITRT_MIGRATE_AUTO
+  unsigned trips = 0;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    policy = entry.migrate_policy;
+    trips = entry.round_trips;
+  });
+  if (round_trips)
+    *round_trips = trips;
+  return policy;
+}
+
+unsigned __kitrt_count_mem_round_trip(void *addr) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  unsigned trips = 0;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    trips = entry.round_trips.fetch_add(1) + 1;
+  });
+  return trips;
 }
 
 void __kitrt_clear_mem_advice(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end()) {
-    ait->second.read_only = false;
-    ait->second.write_only = false;
-  }
+  with_alloc_entry(addr, [](void *, KitRTAllocMapEntry &entry) {
+    bool was_read_only = entry.read_only.exchange(false);
+    if (entry.write_only.exchange(false) || was_read_only)
+      __kitrt_advance_mem_epoch();
+  });
 }
 
-bool __kitrt_is_mem_prefetched(void *addr, size_t *size) {
+bool __kitrt_is_mem_host_resident(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::const_iterator cit = _kitrt_alloc_map.find(addr);
-  if (cit != _kitrt_alloc_map.end()) {
+  // Unmanaged pointers may be device memory.
+  bool prefetched = true;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    prefetched = entry.prefetched;
+  });
+  return not prefetched;
+}
+
+bool __kitrt_is_mem_prefetched(void *addr, size_t *size, void **base) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  bool prefetched = false;
+  bool found = with_alloc_entry(addr, [&](void *ebase,
+                                          KitRTAllocMapEntry &entry) {
     if (size != nullptr)
-      *size = cit->second.size;
-    return cit->second.prefetched;
-  } else {
+      *size = entry.size;
+    if (base != nullptr)
+      *base = ebase;
+    prefetched = entry.prefetched;
+  });
+
+  if (found) {
+    if (prefetched)
+      _kitrt_mem_stats.prefetch_hits++;
+    else
+      _kitrt_mem_stats.prefetch_misses++;
+    return prefetched;
+  }
+  else {
     // NOTE: This is a bit strange but we have to deal with the
     // compiler's code generation mechanisms here.  Specifically it is
     // only able to identify pointers but not pointers allocated in
@@ -163,11 +560,16 @@ size_t __kitrt_get_mem_alloc_size(void *addr,
   assert(read_only != nullptr && "unexpected null read_only pointer!");
   assert(write_only != nullptr && "unexpected null write_only pointer!");
   size_t size = 0;
-  KitRTAllocMap::const_iterator cit = _kitrt_alloc_map.find(addr);
-  if (cit != _kitrt_alloc_map.end()) {
-    *read_only = cit->second.read_only;
-    *write_only = cit->second.write_only;
-    size = cit->second.size;
+  // NOTE: Unlike the prefetch-centric queries above this call backs
+  // free() and realloc() and therefore only matches the base address
+  // of an allocation.
+  KitRTAllocMapShard &shard = alloc_shard(addr);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  KitRTAllocMap::const_iterator cit = shard.map.find(addr);
+  if (cit != shard.map.end()) {
+    *read_only = cit->second->read_only;
+    *write_only = cit->second->write_only;
+    size = cit->second->size;
   } else {
     // NOTE: This is a bit strange but we have to deal with the
     // compiler's code generation mechanisms here.  Specifically it is
@@ -184,11 +586,45 @@ size_t __kitrt_get_mem_alloc_size(void *addr,
   return size;
 }
 
+void __kitrt_set_mem_residency(void *addr, unsigned devices) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    bool changed = mem_stats_set_devices(entry, devices) != devices;
+    changed |= entry.prefetched.exchange(devices == 1) != (devices == 1);
+    if (devices != 0)
+      changed |= entry.cold.exchange(false);
+    std::lock_guard<std::mutex> lock(entry.ranges_mutex);
+    if (changed || not entry.host_ranges.empty())
+      __kitrt_advance_mem_epoch();
+    entry.host_ranges.clear();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: marked memory at %p, size %ld, as resident "
+              "on device mask 0x%x.\n", base, entry.size, devices);
+  });
+}
+
+unsigned __kitrt_get_mem_residency(void *addr, size_t *size, void **base) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  unsigned devices = 0;
+  with_alloc_entry(addr, [&](void *ebase, KitRTAllocMapEntry &entry) {
+    if (size != nullptr)
+      *size = entry.size;
+    if (base != nullptr)
+      *base = ebase;
+    devices = entry.devices;
+  });
+  return devices;
+}
+
 void __kitrt_unregister_mem_alloc(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator ait = _kitrt_alloc_map.find(addr);
-  if (ait != _kitrt_alloc_map.end())
-    _kitrt_alloc_map.erase(ait);
+  // Movement that the target has yet to deliver can only be charged
+  // to the site while the allocation is still in the map.
+  void (*flush)() = _kitrt_mem_sites_flush.load();
+  if (flush != nullptr && __kitrt_mem_sites_enabled())
+    flush();
+  release_alloc_entry(remove_alloc_entry(addr));
+  __kitrt_advance_mem_epoch();
 
   // NOTE: We currently silently ignore requests to unregister
   // an pointer that was not found in the map.  This mostly has
@@ -197,35 +633,124 @@ void __kitrt_unregister_mem_alloc(void *addr) {
   // types.
 }
 
+void __kitrt_resize_mem_alloc(void *addr, size_t nbytes) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  bool read_only, write_only;
+  (void)__kitrt_get_mem_alloc_size(addr, &read_only, &write_only);
+  KitRTMemSite *site = nullptr;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    site = entry.site;
+  });
+  __kitrt_register_mem_alloc(addr, nbytes);
+  if (read_only)
+    __kitrt_mark_mem_read_only(addr);
+  if (write_only)
+    __kitrt_mark_mem_write_only(addr);
+  if (site != nullptr)
+    with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+      entry.site = site;
+    });
+}
+
 void __kitrt_mem_needs_prefetch(void *addr) {
   assert(addr != nullptr && "unexpected null pointer!");
-  KitRTAllocMap::iterator it = _kitrt_alloc_map.find(addr);
-  if (it != _kitrt_alloc_map.end()) {
-    it->second.prefetched = false;
-  }
+  with_alloc_entry(addr, [](void *, KitRTAllocMapEntry &entry) {
+    entry.prefetched = false;
+    (void)mem_stats_set_devices(entry, 0);
+    std::lock_guard<std::mutex> lock(entry.ranges_mutex);
+    entry.host_ranges.clear();
+  });
+  __kitrt_advance_mem_epoch();
+}
+
+// The granularity of the ranges and the number of ranges that are
+// tracked per allocation (see __kitrt_mark_mem_host_range()).
+static const size_t KITRT_HOST_RANGE_GRANULE = 4096;
+static const size_t KITRT_MAX_HOST_RANGES = 32;
+
+void __kitrt_mark_mem_host_range(void *addr, size_t nbytes) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  void *whole = nullptr;
+  with_alloc_entry(addr, [&](void *base, KitRTAllocMapEntry &entry) {
+    if (not entry.prefetched || nbytes == 0)
+      return;
+    size_t offset = (char *)addr - (char *)base;
+    size_t lo = offset & ~(KITRT_HOST_RANGE_GRANULE - 1);
+    size_t hi = std::min(entry.size, (offset + nbytes +
+                                      KITRT_HOST_RANGE_GRANULE - 1) &
+                                         ~(KITRT_HOST_RANGE_GRANULE - 1));
+    std::lock_guard<std::mutex> lock(entry.ranges_mutex);
+    KitRTMemRanges &ranges = entry.host_ranges;
+    // Keep the ranges sorted and merge any that overlap or touch.
+    auto it = std::lower_bound(ranges.begin(), ranges.end(),
+                               std::make_pair(lo, hi));
+    it = ranges.insert(it, std::make_pair(lo, hi));
+    if (it != ranges.begin() && std::prev(it)->second >= it->first)
+      --it;
+    while (std::next(it) != ranges.end() &&
+           std::next(it)->first <= it->second) {
+      it->second = std::max(it->second, std::next(it)->second);
+      ranges.erase(std::next(it));
+    }
+    if (ranges.size() > KITRT_MAX_HOST_RANGES)
+      whole = base;
+    __kitrt_advance_mem_epoch();
+  });
+  if (whole != nullptr)
+    __kitrt_mark_mem_needs_prefetch(whole);
+}
+
+bool __kitrt_take_mem_host_ranges(void *addr, KitRTMemRanges &ranges,
+                                  void **base) {
+  assert(addr != nullptr && "unexpected null pointer!");
+  ranges.clear();
+  with_alloc_entry(addr, [&](void *ebase, KitRTAllocMapEntry &entry) {
+    if (base != nullptr)
+      *base = ebase;
+    std::lock_guard<std::mutex> lock(entry.ranges_mutex);
+    ranges.swap(entry.host_ranges);
+  });
+  return not ranges.empty();
+}
+
+extern "C" void __kitrt_mem_host_write(void *addr, size_t nbytes) {
+  if (addr != nullptr)
+    __kitrt_mark_mem_host_range(addr, nbytes);
 }
 
 extern "C" void __kitrt_print_memory_map() {
   fprintf(stdout, "kitsune runtime memory allocation map:\n");
-  if (_kitrt_alloc_map.empty()) 
-    fprintf(stdout, "\t[... empty ...]\n");
-  else {
-    const size_t MBYTE = 1024 * 1024;
-    size_t total_allocated = 0;
-    unsigned int num_allocations = 0;
-    for(auto &entry : _kitrt_alloc_map) {
+  const size_t MBYTE = 1024 * 1024;
+  size_t total_allocated = 0;
+  unsigned int num_allocations = 0;
+  for (unsigned si = 0; si < KITRT_ALLOC_MAP_SHARDS; si++) {
+    KitRTAllocMapShard &shard = _kitrt_alloc_map[si];
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    for(auto &entry : shard.map) {
+      // Allocations spanning multiple shards are only reported by
+      // the shard that owns their base address.
+      if (&alloc_shard(entry.first) != &shard)
+        continue;
       void *addr = entry.first;
-      const KitRTAllocMapEntry *alloc_entry = &entry.second;
+      const KitRTAllocMapEntry *alloc_entry = entry.second;
       total_allocated += alloc_entry->size;
       num_allocations++;
       fprintf(stderr, "\tAddress: %p --> [size: %6.2f Mbytes, prefetched: %8s, "
-              "read-only: %8s, write-only: %8s]\n",
+              "devices: 0x%02x, read-only: %8s, write-only: %8s, "
+              "cold: %8s]\n",
               addr,
 	      alloc_entry->size / (double)MBYTE,
 	      alloc_entry->prefetched ? "true" : "false", 
+              alloc_entry->devices.load(),
               alloc_entry->read_only ? "true" : "false", 
-              alloc_entry->write_only ? "true": "false");
+              alloc_entry->write_only ? "true": "false",
+              alloc_entry->cold ? "true" : "false");
     }
+  }
+
+  if (num_allocations == 0)
+    fprintf(stdout, "\t[... empty ...]\n");
+  else {
     fprintf(stderr, "\n");
     fprintf(stdout, "\ttotal memory allocation: %6.2f Mbytes\n",
 	    total_allocated / (double)MBYTE);
@@ -234,10 +759,266 @@ extern "C" void __kitrt_print_memory_map() {
   }
 }
 
-extern "C" void __kitrt_destroy_memory_map(void (*free_mem_call)(void *)) {
-  assert(free_mem_call != nullptr && "unexpected null function pointer!");
-  for (auto &entry : _kitrt_alloc_map)
-    free_mem_call(entry.first);
-  _kitrt_alloc_map.clear();
+extern "C" void __kitrt_get_memory_stats(KitRTMemStats *stats) {
+  assert(stats != nullptr && "unexpected null stats pointer!");
+  stats->live_bytes = _kitrt_mem_stats.live_bytes;
+  stats->peak_bytes = _kitrt_mem_stats.peak_bytes;
+  stats->live_allocs = _kitrt_mem_stats.live_allocs;
+  stats->total_allocs = _kitrt_mem_stats.total_allocs;
+  stats->total_frees = _kitrt_mem_stats.total_frees;
+  stats->resident_bytes = _kitrt_mem_stats.resident_bytes;
+  stats->prefetch_hits = _kitrt_mem_stats.prefetch_hits;
+  stats->prefetch_misses = _kitrt_mem_stats.prefetch_misses;
+  for (unsigned i = 0; i < KITRT_MEM_STATS_NUM_SIZE_CLASSES; i++) {
+    stats->live_size_classes[i] = _kitrt_mem_stats.live_size_classes[i];
+    stats->total_size_classes[i] = _kitrt_mem_stats.total_size_classes[i];
+  }
+}
+
+static void print_memory_stats(const KitRTMemStats *stats, void *) {
+  const double MBYTE = 1024.0 * 1024.0;
+  uint64_t checks = stats->prefetch_hits + stats->prefetch_misses;
+  fprintf(stderr, "kitsune runtime memory statistics:\n");
+  fprintf(stderr, "\tlive: %6.2f Mbytes in %lu allocations "
+          "(peak: %6.2f Mbytes)\n", stats->live_bytes / MBYTE,
+          (unsigned long)stats->live_allocs, stats->peak_bytes / MBYTE);
+  fprintf(stderr, "\tdevice resident: %6.2f Mbytes\n",
+          stats->resident_bytes / MBYTE);
+  fprintf(stderr, "\tallocations: %lu, frees: %lu\n",
+          (unsigned long)stats->total_allocs,
+          (unsigned long)stats->total_frees);
+  fprintf(stderr, "\tprefetch checks: %lu hits, %lu misses (%5.1f%% hits)\n",
+          (unsigned long)stats->prefetch_hits,
+          (unsigned long)stats->prefetch_misses,
+          checks > 0 ? 100.0 * stats->prefetch_hits / checks : 0.0);
+  fprintf(stderr, "\tsize classes (live/total):\n");
+  for (unsigned i = 0; i < KITRT_MEM_STATS_NUM_SIZE_CLASSES; i++) {
+    if (stats->total_size_classes[i] == 0)
+      continue;
+    if (i == 0)
+      fprintf(stderr, "\t  [     0,   1Ki): ");
+    else {
+      static const char *units[] = {"", "Ki", "Mi", "Gi"};
+      unsigned lo = 8 + 2 * i, hi = 10 + 2 * i;
+      fprintf(stderr, "\t  [%4u%s, ", 1u << (lo % 10), units[lo / 10]);
+      if (i == KITRT_MEM_STATS_NUM_SIZE_CLASSES - 1)
+        fprintf(stderr, "  ...): ");
+      else
+        fprintf(stderr, "%4u%s): ", 1u << (hi % 10), units[hi / 10]);
+    }
+    fprintf(stderr, "%lu/%lu\n",
+            (unsigned long)stats->live_size_classes[i],
+            (unsigned long)stats->total_size_classes[i]);
+  }
+}
+
+extern "C" void __kitrt_print_memory_stats() {
+  KitRTMemStats stats;
+  __kitrt_get_memory_stats(&stats);
+  print_memory_stats(&stats, nullptr);
 }
 
+extern "C" void __kitrt_set_memory_stats_hook(KitRTMemStatsHook hook,
+                                              void *data,
+                                              unsigned period_ms) {
+  stop_mem_stats_sampler();
+  std::lock_guard<std::mutex> lock(_kitrt_mem_stats_mutex);
+  _kitrt_mem_stats_hook = hook;
+  _kitrt_mem_stats_data = data;
+  _kitrt_mem_stats_stop = false;
+  if (hook != nullptr && period_ms > 0)
+    _kitrt_mem_stats_thread =
+        new std::thread(mem_stats_sampler, hook, data, period_ms);
+}
+
+bool __kitrt_mem_sites_enabled() {
+  return _kitrt_mem_sites_on.load(std::memory_order_relaxed);
+}
+
+extern "C" void __kitrt_set_mem_alloc_site(void *addr, const char *site,
+                                           unsigned line) {
+  if (not __kitrt_mem_sites_enabled() || addr == nullptr || site == nullptr)
+    return;
+  KitRTMemSite *msite;
+  {
+    std::lock_guard<std::mutex> lock(_kitrt_mem_sites_mutex);
+    KitRTMemSite *&slot = _kitrt_mem_sites[std::make_pair(site, line)];
+    if (slot == nullptr) {
+      slot = new KitRTMemSite();
+      slot->file = site;
+      slot->line = line;
+    }
+    msite = slot;
+  }
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    entry.site = msite;
+    msite->allocs++;
+    msite->bytes += entry.size;
+  });
+}
+
+void __kitrt_count_mem_site(void *addr, KitRTMemSiteCounter counter,
+                            uint64_t value) {
+  if (not __kitrt_mem_sites_enabled() || addr == nullptr)
+    return;
+  KitRTMemSite *site = nullptr;
+  with_alloc_entry(addr, [&](void *, KitRTAllocMapEntry &entry) {
+    site = entry.site;
+  });
+  if (site == nullptr)
+    site = &_kitrt_mem_untagged_site;
+  site->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void __kitrt_set_mem_sites_flush(void (*flush)()) {
+  _kitrt_mem_sites_flush = flush;
+}
+
+namespace {
+
+/// Return the bytes a site moved in one direction: the larger of what
+/// the runtime prefetched and what the driver migrated, as prefetches
+/// are migrations too.
+uint64_t mem_site_moved(const KitRTMemSite &site, KitRTMemSiteCounter prefetch,
+                        KitRTMemSiteCounter migrate) {
+  return std::max(site.counters[prefetch].load(),
+                  site.counters[migrate].load());
+}
+
+uint64_t mem_site_moved(const KitRTMemSite &site) {
+  return mem_site_moved(site, KITRT_SITE_PREFETCH_TO_DEVICE,
+                        KITRT_SITE_MIGRATE_TO_DEVICE) +
+         mem_site_moved(site, KITRT_SITE_PREFETCH_TO_HOST,
+                        KITRT_SITE_MIGRATE_TO_HOST);
+}
+
+uint64_t mem_site_faults(const KitRTMemSite &site) {
+  return site.counters[KITRT_SITE_DEVICE_FAULTS] +
+         site.counters[KITRT_SITE_HOST_FAULTS];
+}
+
+} // namespace
+
+extern "C" void __kitrt_print_memory_sites(unsigned count) {
+  void (*flush)() = _kitrt_mem_sites_flush.load();
+  if (flush != nullptr)
+    flush();
+
+  std::vector<const KitRTMemSite *> sites;
+  {
+    std::lock_guard<std::mutex> lock(_kitrt_mem_sites_mutex);
+    for (auto &site : _kitrt_mem_sites)
+      sites.push_back(site.second);
+  }
+  sites.push_back(&_kitrt_mem_untagged_site);
+  sites.erase(std::remove_if(sites.begin(), sites.end(),
+                             [](const KitRTMemSite *site) {
+                               return mem_site_moved(*site) == 0 &&
+                                      mem_site_faults(*site) == 0;
+                             }),
+              sites.end());
+  std::stable_sort(sites.begin(), sites.end(),
+                   [](const KitRTMemSite *a, const KitRTMemSite *b) {
+                     uint64_t am = mem_site_moved(*a), bm = mem_site_moved(*b);
+                     if (am != bm)
+                       return am > bm;
+                     return mem_site_faults(*a) > mem_site_faults(*b);
+                   });
+  if (count > 0 && sites.size() > count)
+    sites.resize(count);
+
+  const double MBYTE = 1024.0 * 1024.0;
+  fprintf(stderr, "kitsune runtime allocation sites (by data moved):\n");
+  if (sites.empty())
+    fprintf(stderr, "\t[... no data moved ...]\n");
+  for (const KitRTMemSite *site : sites) {
+    if (site == &_kitrt_mem_untagged_site)
+      fprintf(stderr, "\t(untagged allocations):\n");
+    else
+      fprintf(stderr, "\t%s:%u: %lu allocations, %6.2f Mbytes\n",
+              site->file.c_str(), site->line,
+              (unsigned long)site->allocs.load(), site->bytes / MBYTE);
+    fprintf(stderr, "\t    to device: %8.2f Mbytes prefetched, %8.2f Mbytes "
+            "migrated\n",
+            site->counters[KITRT_SITE_PREFETCH_TO_DEVICE] / MBYTE,
+            site->counters[KITRT_SITE_MIGRATE_TO_DEVICE] / MBYTE);
+    fprintf(stderr, "\t    to host:   %8.2f Mbytes prefetched, %8.2f Mbytes "
+            "migrated\n",
+            site->counters[KITRT_SITE_PREFETCH_TO_HOST] / MBYTE,
+            site->counters[KITRT_SITE_MIGRATE_TO_HOST] / MBYTE);
+    if (mem_site_faults(*site) > 0)
+      fprintf(stderr, "\t    page faults: %lu on the device, %lu on the "
+              "host\n",
+              (unsigned long)site->counters[KITRT_SITE_DEVICE_FAULTS].load(),
+              (unsigned long)site->counters[KITRT_SITE_HOST_FAULTS].load());
+  }
+}
+
+void __kitrt_memory_stats_initialize() {
+  unsigned period_ms;
+  if (__kitrt_get_env_value("KITRT_MEM_STATS", period_ms)) {
+    __kitrt_set_memory_stats_hook(print_memory_stats, nullptr, period_ms);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "    memory statistics every %u ms.\n", period_ms);
+  }
+  if (__kitrt_get_env_value("KITRT_MEM_SITES", _kitrt_mem_sites_report)) {
+    _kitrt_mem_sites_on = true;
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "    charging data movement to allocation sites.\n");
+  }
+}
+
+extern "C" void __kitrt_destroy_memory_map(void (*free_mem_call)(void *),
+                                           void (*free_mirror_call)(void *,
+                                                                    void *)) {
+  assert(free_mem_call != nullptr && "unexpected null function pointer!");
+  // Give the sampling hook a final look at the map before it is
+  // released.  The hook is cleared so the final call is only made once
+  // (more than one runtime may share the map).
+  stop_mem_stats_sampler();
+  KitRTMemStatsHook hook;
+  void *hook_data;
+  {
+    std::lock_guard<std::mutex> lock(_kitrt_mem_stats_mutex);
+    hook = _kitrt_mem_stats_hook;
+    hook_data = _kitrt_mem_stats_data;
+    _kitrt_mem_stats_hook = nullptr;
+  }
+  if (hook != nullptr) {
+    KitRTMemStats stats;
+    __kitrt_get_memory_stats(&stats);
+    hook(&stats, hook_data);
+  }
+
+  if (__kitrt_mem_sites_enabled() &&
+      not _kitrt_mem_sites_reported.exchange(true))
+    __kitrt_print_memory_sites(_kitrt_mem_sites_report);
+
+  // Freeing millions of allocations one at a time can take seconds.
+  // Outside of the full exit mode they are left to the release of the
+  // context (or the process).
+  KitRTExitMode exit_mode = __kitrt_get_exit_mode();
+  if (exit_mode == KITRT_EXIT_LEAK && hook == nullptr)
+    __kitrt_print_memory_stats();
+  if (exit_mode != KITRT_EXIT_FULL)
+    return;
+
+  std::vector<std::pair<void *, KitRTAllocMapEntry *>> allocs;
+  for (unsigned si = 0; si < KITRT_ALLOC_MAP_SHARDS; si++) {
+    KitRTAllocMapShard &shard = _kitrt_alloc_map[si];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    for (auto &entry : shard.map)
+      if (&alloc_shard(entry.first) == &shard)
+        allocs.push_back(entry);
+    shard.map.clear();
+  }
+  // Release the allocations without holding any shard locks in case
+  // the free call re-enters the runtime.
+  for (auto &alloc : allocs) {
+    if (alloc.second->mirror != nullptr && free_mirror_call != nullptr)
+      free_mirror_call(alloc.first, alloc.second->mirror);
+    else
+      free_mem_call(alloc.first);
+    release_alloc_entry(alloc.second);
+  }
+}
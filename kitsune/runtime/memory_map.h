@@ -52,6 +52,11 @@
 #define __KITRT_MEMORY_MAP_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 /// Both the CUDA and HIP versions of the runtime track managed memory
 /// allocations.  This is done by providing a map from the allocated
@@ -63,21 +68,82 @@
 /// 
 /// Prefetching suggests a hint to the runtime/driver/OS to migrate
 /// all pages to the corresponding device's memory.
+///
+/// Unless noted otherwise, the calls below accept any address that
+/// falls within a registered allocation (e.g., a pointer to a sub-array
+/// passed as a kernel argument) and operate on the entire allocation
+/// that contains it.
+///
+/// All calls are thread safe.  The map is split into shards that are
+/// each guarded by a reader-writer lock so lookups from concurrent
+/// launch threads do not serialize with one another, and registering
+/// or unregistering an allocation only blocks the shards it spans.
+/// Callers do not need to provide any additional locking.
+
+/// When a runtime spreads work across multiple devices the residency
+/// of an allocation is tracked as a mask of the devices that hold (a
+/// portion of) it.  Bit 'i' corresponds to the runtime's i-th device,
+/// with bit 0 being the primary device.  Being 'prefetched' is the same
+/// as being resident (only) on the primary device.
+///
+/// A prefetched allocation can also have a few ranges of pages that
+/// have since moved to the host (see __kitrt_mark_mem_host_range()).
+/// Only those ranges need to move when the data returns to the device.
+typedef std::vector<std::pair<size_t, size_t>> KitRTMemRanges;
+
+struct KitRTMemSite;
 
-/// TODO: Is prefetch better tracked as a location vs. a boolean? 
-/// (Adding support for multiple devices will force this change but
-/// for now it is likely more complex than necessary.)
 struct KitRTAllocMapEntry {
-  bool    prefetched;   // has the data been prefetched?
-  bool    read_only;    // upcoming data usage is ("mostly") read only.
-  bool    write_only;   // upcoming data usage is ("mostly") write only.
-  size_t size;          // size of the allocated buffer in bytes.
+  std::atomic<bool> prefetched; // has the data been prefetched?
+  std::atomic<unsigned> devices;// mask of devices holding the data.
+  std::atomic<bool> read_only;  // upcoming data usage is ("mostly") read only.
+  std::atomic<bool> write_only; // upcoming data usage is ("mostly") write only.
+  std::atomic<bool> cold;       // evicted to the host until its next use.
+  std::atomic<int> advised_location; // the preferred location advised.
+  std::atomic<bool> device_advised;  // device access advice applied?
+  std::atomic<int> migrate_policy;   // a KitRTMigratePolicy (see kitrt.h).
+  std::atomic<unsigned> round_trips; // device to host moves of the data.
+  size_t size;                  // size of the allocated buffer in bytes.
+  void *mirror;                 // device-side mirror of the buffer (if any).
+  std::atomic<KitRTMemSite *> site; // allocation site (KITRT_MEM_SITES).
+  KitRTMemRanges host_ranges;   // [lo, hi) offsets moved to the host.
+  std::mutex ranges_mutex;      // guards 'host_ranges'.
 };
 
+/// The epoch of the allocation map.  It advances whenever the state of
+/// an allocation changes in a way that could make the next launch that
+/// uses it move, advise or wait on its data: an allocation is
+/// (un)registered or resized, its prefetch status, residency, access
+/// advice or cold status changes, or ranges of it move to the host.  A
+/// launch site that found all of its arguments in place can skip
+/// mapping them again for as long as the epoch is unchanged (see the
+/// CUDA runtime's __kitcuda_mem_gpu_map_batch()).  The epoch starts at
+/// one so that zero can denote an unset epoch.
+extern "C" std::atomic<uint64_t> __kitrt_mem_epoch;
+
+/// Advance the epoch of the allocation map.
+inline void __kitrt_advance_mem_epoch() {
+  __kitrt_mem_epoch.fetch_add(1, std::memory_order_release);
+}
+
 /// Register a memory allocation with the runtime.  The allocation
 /// is assumed be successful at this point and pointed to by the
-/// supplied pointer (addr) and be 'numBytes' in size.
-extern void __kitrt_register_mem_alloc(void *addr, size_t nbytes);
+/// supplied pointer (addr) and be 'numBytes' in size.  When the
+/// allocation is a host-side buffer with a separate (non-managed)
+/// device-side copy, 'mirror' points to the device buffer.  For such
+/// allocations the prefetch status tracks if the device copy is
+/// current with respect to the host.
+extern void __kitrt_register_mem_alloc(void *addr, size_t nbytes,
+                                       void *mirror = nullptr);
+
+/// @brief Return the device-side mirror of the given address.
+/// @param addr: The pointer to (or into) the host-side allocation.
+/// @param base: If non-null, set to the base address of the allocation.
+/// @param size: If non-null, set to the size in bytes of the allocation.
+/// @return The address within the mirror that corresponds to 'addr' or
+/// null if the allocation is not registered or has no mirror.
+extern void *__kitrt_get_mem_mirror(void *addr, void **base = nullptr,
+                                    size_t *size = nullptr);
 
 /// Set the prefetch status of the given memory allocation entry.
 extern void __kitrt_set_mem_prefetch(void *addr, bool prefetched);
@@ -93,6 +159,21 @@ inline void __kitrt_mark_mem_needs_prefetch(void *addr) {
   __kitrt_set_mem_prefetch(addr, false);
 }
 
+/// @brief Set the device residency of the given memory allocation.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param devices: The mask of devices that now hold (a portion of)
+/// the allocation.  A zero mask denotes a host-resident allocation.
+extern void __kitrt_set_mem_residency(void *addr, unsigned devices);
+
+/// @brief Return the device residency mask of the given allocation.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param size: If non-null, set to the size in bytes of the allocation.
+/// @param base: If non-null, set to the base address of the allocation.
+/// @return The mask of devices holding the allocation; zero if it is
+/// resident in host memory or not registered.
+extern unsigned __kitrt_get_mem_residency(void *addr, size_t *size = nullptr,
+                                          void **base = nullptr);
+
 /// @brief Flag the given memory allocation as read only. 
 /// @param addr: the pointer to the managed allocation. 
 extern void __kitrt_mark_mem_read_only(void *addr);
@@ -106,22 +187,94 @@ extern void __kitrt_mark_mem_write_only(void *addr);
 extern void __kitrt_mem_neds_prefetch(void *addr);
 
 /// @brief Return the prefetch status of the given allocation.
-/// @param addr: The pointer to the managed allocation.
-bool __kitrt_is_mem_prefetched(void *addr, size_t *size = nullptr);
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param size: If non-null, set to the size in bytes of the allocation.
+/// @param base: If non-null, set to the base address of the allocation.
+bool __kitrt_is_mem_prefetched(void *addr, size_t *size = nullptr,
+                               void **base = nullptr);
+
+/// @brief Return true if the given address is in a managed allocation
+/// that is resident in host memory -- it is not prefetched to (or in
+/// use by) a device.  Unlike __kitrt_is_mem_prefetched() this does not
+/// count towards the prefetch statistics.
+/// @param addr: The pointer to (or into) the managed allocation.
+extern bool __kitrt_is_mem_host_resident(void *addr);
 
 /// @brief Is the given managed allocation marked as ready-only?
 /// @param addr: The pointer to the managed allocation. 
-bool __kitrt_is_mem_ready_only(void *addr);
+bool __kitrt_is_mem_read_only(void *addr);
 
 /// @brief Is the given managed allocation marked as write-only?
 /// @param addr: The pointer to the managed allocation. 
 bool __kitrt_is_mem_write_only(void *addr);
 
+/// @brief Set the cold status of the given memory allocation.  Cold
+/// allocations have been evicted to host memory because they will not
+/// be used for a while; the status is cleared when the allocation is
+/// next prefetched to (or made resident on) a device.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param cold: The new cold status.
+extern void __kitrt_set_mem_cold(void *addr, bool cold);
+
+/// @brief Is the given managed allocation marked as cold?
+/// @param addr: The pointer to (or into) the managed allocation.
+bool __kitrt_is_mem_cold(void *addr);
+
+/// The preferred locations of allocations tracked by
+/// __kitrt_exchange_mem_advice(): a device id or one of these.  The host
+/// matches the CPU device id of both CUDA and HIP.
+const int KITRT_MEM_ADVISED_NONE = -2;
+const int KITRT_MEM_ADVISED_HOST = -1;
+
+/// @brief Record the preferred location advised to the driver for the
+/// given allocation.  Memory advice is costly on some systems, so the
+/// runtimes only advise a location that differs from the recorded one.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param location: The new location (a device id or
+/// KITRT_MEM_ADVISED_HOST).
+/// @return The location recorded before (KITRT_MEM_ADVISED_NONE if none
+/// was), or 'location' if the allocation is not registered.
+extern int __kitrt_exchange_mem_advice(void *addr, int location);
+
+/// @brief Record that the advice for device access that is applied once
+/// per allocation (e.g., accessed-by) has been given.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @return True if it had already been given (or the allocation is not
+/// registered).
+extern bool __kitrt_test_and_set_mem_device_advice(void *addr);
+
+/// The preferred location recorded for allocations whose pages have no
+/// preferred location, so that the driver migrates them on access (see
+/// KITRT_MIGRATE_COUNTERS).
+const int KITRT_MEM_ADVISED_ANY = -3;
+
+/// @brief Set the migration policy of the given allocation (see
+/// KitRTMigratePolicy in kitrt.h).  The recorded preferred location is
+/// cleared so the runtime advises the location of the new policy.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param policy: The new policy.
+extern void __kitrt_set_mem_migrate_policy(void *addr, int policy);
+
+/// @brief Return the migration policy of the given allocation
+/// (KITRT_MIGRATE_AUTO if none was set or it is not registered).
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @param round_trips: If non-null, set to the number of times the
+/// data has moved from a device back to the host.
+extern int __kitrt_get_mem_migrate_policy(void *addr,
+                                          unsigned *round_trips = nullptr);
+
+/// @brief Count a move of the given allocation's data from a device
+/// back to the host.
+/// @param addr: The pointer to (or into) the managed allocation.
+/// @return The number of moves so far (zero if not registered).
+extern unsigned __kitrt_count_mem_round_trip(void *addr);
+
 /// @brief Clean memory allocation "advice" (e.g., read-only, write-only).
 /// @param addr: The pointer to the managed allocation.
 void __kitrt_clear_mem_advice(void *addr);
 
-/// Get the size of the allocation for a given pointer address.
+/// Get the size of the allocation for a given pointer address.  Only
+/// the base address of an allocation is matched.
 size_t __kitrt_get_mem_alloc_size(void *addr,
 				  bool *read_only,
 				  bool *write_only);
@@ -132,13 +285,82 @@ size_t __kitrt_get_mem_alloc_size(void *addr,
 /// that management is assumed to be managed elsewhere.
 extern void __kitrt_unregister_mem_alloc(void *addr);
 
+/// Change the recorded size of the allocation at 'addr' (registering
+/// it if it is not yet in the map).  The read/write only advice of the
+/// allocation is kept but its prefetch status is reset, as the new
+/// portion of the allocation has not been prefetched.
+extern void __kitrt_resize_mem_alloc(void *addr, size_t nbytes);
+
+/// @brief Record that a range of a prefetched allocation has moved to
+/// (e.g., was written on) the host.  Ranges are widened to pages and
+/// merged; an allocation with too many of them is instead marked as
+/// not prefetched, so it moves back to the device in whole.  Nothing
+/// is recorded for allocations that are not prefetched.
+/// @param addr: The pointer to (or into) the allocation.
+/// @param nbytes: The size of the range in bytes.
+extern void __kitrt_mark_mem_host_range(void *addr, size_t nbytes);
+
+/// @brief Remove and return the ranges of a prefetched allocation that
+/// have moved to the host.
+/// @param addr: The pointer to (or into) the allocation.
+/// @param ranges: Set to the [lo, hi) byte offsets of the ranges.
+/// @param base: If non-null, set to the base address of the allocation.
+/// @return True if there were any ranges.
+extern bool __kitrt_take_mem_host_ranges(void *addr, KitRTMemRanges &ranges,
+                                         void **base = nullptr);
+
+/// The data movement charged to allocation sites (see
+/// __kitrt_set_mem_alloc_site() in kitrt.h).  The prefetches are the
+/// bytes the runtime asked to move; the migrations and page faults are
+/// what the driver reports (e.g., through CUPTI) it did.
+enum KitRTMemSiteCounter {
+  KITRT_SITE_PREFETCH_TO_DEVICE, // bytes prefetched to a device.
+  KITRT_SITE_PREFETCH_TO_HOST,   // bytes prefetched to the host.
+  KITRT_SITE_MIGRATE_TO_DEVICE,  // bytes migrated to a device.
+  KITRT_SITE_MIGRATE_TO_HOST,    // bytes migrated to the host.
+  KITRT_SITE_DEVICE_FAULTS,      // page faults taken on a device.
+  KITRT_SITE_HOST_FAULTS,        // page faults taken on the host.
+  KITRT_SITE_NUM_COUNTERS
+};
+
+/// @brief Return true if data movement is charged to allocation sites
+/// (KITRT_MEM_SITES is set).
+extern bool __kitrt_mem_sites_enabled();
+
+/// @brief Charge data movement to the site of the allocation that
+/// contains the given address.  This does nothing when sites are not
+/// enabled; movement of memory that is not registered (or was freed)
+/// is charged to an unknown site.
+/// @param addr: The pointer to (or into) the allocation.
+/// @param counter: The kind of movement.
+/// @param value: The bytes (or faults) to charge.
+extern void __kitrt_count_mem_site(void *addr, KitRTMemSiteCounter counter,
+                                   uint64_t value);
+
+/// @brief Set a function that delivers the movement that a target has
+/// observed but not yet charged (e.g., buffered CUPTI records).  It is
+/// called before an allocation with a site is unregistered, so the
+/// movement is charged while the address still resolves to the site,
+/// and before the sites are reported.
+extern void __kitrt_set_mem_sites_flush(void (*flush)());
+
 /// Print details about the memory allocation map to standard out.
 extern "C" void __kitrt_print_memory_map();
 
+/// Start the periodic sampling of the memory statistics requested by
+/// the KITRT_MEM_STATS environment variable (if any).  See kitrt.h for
+/// the statistics API.
+extern void __kitrt_memory_stats_initialize();
+
 /// Destroy the memory map and call the function pointed to by
 /// 'freeFP' to free the actual memory allocation (runtime target
-/// dependent).  Note we keep this as a C function to simplify
+/// dependent).  Allocations with a device-side mirror are instead
+/// released by calling 'free_mirror_func' with both the host and
+/// mirror addresses.  Note we keep this as a C function to simplify
 /// things when dealing with existing APIs (e.g., CUDA).
-extern "C" void __kitrt_destroy_memory_map(void (*free_func)(void *));
+extern "C" void __kitrt_destroy_memory_map(void (*free_func)(void *),
+                                           void (*free_mirror_func)(void *,
+                                                                    void *) =
+                                               nullptr);
 
 #endif
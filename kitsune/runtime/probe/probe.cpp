@@ -0,0 +1,289 @@
+//===- probe.cpp - Kitsune machine characterization probe -----------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+// kitsune-probe [-o profile] [--bytes=N] [--reps=N] [-v]
+//
+// Measure the machine and write its profile (by default to
+// $HOME/.kitsune/machine-profile, where the runtime looks for it).
+
+#include "probe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+uint64_t probe_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+namespace {
+
+// Return the size in bytes of the given level of data (or unified)
+// cache of the host, or zero if it is unknown.
+uint64_t host_cache_bytes(int level) {
+  long bytes = 0;
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+  switch (level) {
+  case 1:
+    bytes = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    break;
+  case 2:
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    break;
+  case 3:
+    bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    break;
+  }
+#endif
+  if (bytes > 0)
+    return bytes;
+
+  // Not all C libraries know the cache sizes; sysfs does.
+  for (int index = 0; index < 8; index++) {
+    std::string dir =
+        "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index);
+    FILE *fp = fopen((dir + "/level").c_str(), "r");
+    if (fp == nullptr)
+      break;
+    int cache_level = 0;
+    bool found = fscanf(fp, "%d", &cache_level) == 1 && cache_level == level;
+    fclose(fp);
+    if (!found)
+      continue;
+    if ((fp = fopen((dir + "/type").c_str(), "r")) == nullptr)
+      continue;
+    char type[32] = "";
+    found = fscanf(fp, "%31s", type) == 1 && strcmp(type, "Instruction");
+    fclose(fp);
+    if (!found || (fp = fopen((dir + "/size").c_str(), "r")) == nullptr)
+      continue;
+    char unit = '\0';
+    if (fscanf(fp, "%ld%c", &bytes, &unit) >= 1)
+      bytes *= unit == 'K' ? 1024 : unit == 'M' ? 1024 * 1024 : 1;
+    fclose(fp);
+    return bytes > 0 ? bytes : 0;
+  }
+  return 0;
+}
+
+#if defined(KITPROBE_OPENCILK)
+// Return the path of this executable.
+std::string self_path() {
+  char path[4096];
+  ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (len <= 0)
+    return std::string();
+  path[len] = '\0';
+  return path;
+}
+#endif
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-o profile] [--bytes=N] [--reps=N] [-v] "
+          "[--spawn-cost]\n"
+          "  Measure the machine and write the profile the kitsune "
+          "runtime reads\n"
+          "  (by default $HOME/.kitsune/machine-profile).\n"
+          "  --spawn-cost only prints the cost (ns) of an OpenCilk spawn; "
+          "run it\n"
+          "  with CILK_NWORKERS=1.\n",
+          prog);
+}
+
+} // namespace
+
+void probe_host(const ProbeOptions &opts, KitRTMachineProfile *profile) {
+  profile->host_l1_bytes = host_cache_bytes(1);
+  profile->host_l2_bytes = host_cache_bytes(2);
+  profile->host_l3_bytes = host_cache_bytes(3);
+
+  // The memory bandwidth of all cores: each thread copies its part of
+  // the buffers (after touching its pages so that they are placed near
+  // it).
+  unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t chunk = opts.bytes / num_threads;
+  std::vector<char> src(chunk * num_threads), dst(chunk * num_threads);
+  auto run = [&](bool touch) {
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; t++)
+      threads.emplace_back([&, t]() {
+        if (touch) {
+          memset(&src[t * chunk], t + 1, chunk);
+          memset(&dst[t * chunk], 0, chunk);
+        } else
+          memcpy(&dst[t * chunk], &src[t * chunk], chunk);
+      });
+    for (std::thread &thread : threads)
+      thread.join();
+  };
+  run(true);
+  uint64_t best_ns = UINT64_MAX;
+  for (int rep = 0; rep < opts.reps; rep++) {
+    uint64_t start = probe_now_ns();
+    run(false);
+    best_ns = std::min(best_ns, probe_now_ns() - start);
+  }
+  // A copy reads and writes each byte.
+  profile->host_bytes_per_sec = 2.0 * chunk * num_threads / (best_ns * 1e-9);
+  if (opts.verbose)
+    fprintf(stderr,
+            "kitsune-probe: host: %.1f GB/s (%u threads), caches "
+            "%llu/%llu/%llu KB.\n",
+            profile->host_bytes_per_sec * 1e-9, num_threads,
+            (unsigned long long)profile->host_l1_bytes / 1024,
+            (unsigned long long)profile->host_l2_bytes / 1024,
+            (unsigned long long)profile->host_l3_bytes / 1024);
+}
+
+bool probe_cilk(const ProbeOptions &opts, KitRTMachineProfile *profile) {
+#if defined(KITPROBE_OPENCILK)
+  profile->steal_ns = probe_cilk_steal_ns(opts, &profile->host_workers);
+
+  // The workers of this process would steal the spawns of the
+  // measurement, so a child process measures them on a single worker.
+  std::string command = "CILK_NWORKERS=1 '" + self_path() + "' --spawn-cost";
+  command += " --reps=" + std::to_string(opts.reps);
+  if (FILE *fp = popen(command.c_str(), "r")) {
+    double spawn_ns;
+    if (fscanf(fp, "%lf", &spawn_ns) == 1 && spawn_ns > 0.0)
+      profile->spawn_ns = spawn_ns;
+    pclose(fp);
+  }
+  if (opts.verbose)
+    fprintf(stderr,
+            "kitsune-probe: opencilk: %u workers, spawn %.1f ns, steal "
+            "%.1f ns.\n",
+            profile->host_workers, profile->spawn_ns, profile->steal_ns);
+  return true;
+#else
+  (void)opts;
+  (void)profile;
+  return false;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+  ProbeOptions opts;
+  opts.bytes = size_t(256) << 20;
+  opts.reps = 5;
+  opts.verbose = false;
+  std::string output;
+  bool spawn_cost = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "-o") && i + 1 < argc)
+      output = argv[++i];
+    else if (!strncmp(arg, "--bytes=", 8))
+      opts.bytes = strtoull(arg + 8, nullptr, 10);
+    else if (!strncmp(arg, "--reps=", 7))
+      opts.reps = std::max(1, atoi(arg + 7));
+    else if (!strcmp(arg, "-v"))
+      opts.verbose = true;
+    else if (!strcmp(arg, "--spawn-cost"))
+      spawn_cost = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  opts.bytes = std::max<size_t>(opts.bytes, size_t(1) << 20);
+
+#if defined(KITPROBE_OPENCILK)
+  if (spawn_cost) {
+    printf("%.3f\n", probe_cilk_spawn_ns(opts));
+    return 0;
+  }
+#else
+  if (spawn_cost)
+    return 1;
+#endif
+
+  if (output.empty()) {
+    const char *home = getenv("HOME");
+    if (home == nullptr) {
+      fprintf(stderr, "kitsune-probe: HOME is not set, use -o.\n");
+      return 1;
+    }
+    std::string dir = std::string(home) + "/.kitsune";
+    mkdir(dir.c_str(), 0755);
+    output = dir + "/machine-profile";
+  }
+
+  KitRTMachineProfile profile;
+  memset(&profile, 0, sizeof(profile));
+  probe_host(opts, &profile);
+  (void)probe_cilk(opts, &profile);
+  bool has_device = false;
+#if defined(KITRT_CUDA_ENABLED)
+  has_device = probe_cuda(opts, &profile);
+#endif
+#if defined(KITRT_HIP_ENABLED)
+  if (!has_device)
+    has_device = probe_hip(opts, &profile);
+#endif
+  if (!has_device)
+    fprintf(stderr, "kitsune-probe: warning, no GPU was measured.\n");
+
+  if (!__kitrt_write_machine_profile(output.c_str(), &profile))
+    return 1;
+  fprintf(stderr, "kitsune-probe: wrote the machine profile to '%s'.\n",
+          output.c_str());
+  return 0;
+}
@@ -0,0 +1,99 @@
+//===- probe.h - Kitsune machine characterization probe -------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __KITRT_PROBE_H__
+#define __KITRT_PROBE_H__
+
+#include "machine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// kitsune-probe measures the properties of the machine that the
+/// runtime's launch and placement heuristics depend on (see machine.h)
+/// and writes them to a machine profile.  Each part of the machine is
+/// measured by its own probe; a probe leaves the entries it can not
+/// measure at zero (unknown).
+
+struct ProbeOptions {
+  size_t bytes;  // size of the buffers of the bandwidth measurements.
+  int reps;      // timed repetitions of each measurement (best is kept).
+  bool verbose;  // report each measurement on stderr.
+};
+
+/// Return a monotonic time stamp in nanoseconds.
+extern uint64_t probe_now_ns();
+
+/// Measure the host's memory bandwidth and cache sizes.
+extern void probe_host(const ProbeOptions &opts,
+                       KitRTMachineProfile *profile);
+
+/// Measure the cost of spawns and steals of the OpenCilk runtime (in
+/// a build with OpenCilk support).  The spawn cost is measured with a
+/// single worker, in a child process that runs 'kitsune-probe
+/// --spawn-cost'.
+extern bool probe_cilk(const ProbeOptions &opts,
+                       KitRTMachineProfile *profile);
+
+/// Return the cost of a spawn (and its sync) in nanoseconds, measured
+/// on the workers of the calling process.
+extern double probe_cilk_spawn_ns(const ProbeOptions &opts);
+
+/// Return the cost of a steal in nanoseconds and the number of
+/// workers.
+extern double probe_cilk_steal_ns(const ProbeOptions &opts,
+                                  unsigned *num_workers);
+
+/// Measure the primary CUDA (or HIP) device.  Returns false if there
+/// is no device (or no support for it in this build).
+extern bool probe_cuda(const ProbeOptions &opts,
+                       KitRTMachineProfile *profile);
+extern bool probe_hip(const ProbeOptions &opts, KitRTMachineProfile *profile);
+
+#endif // __KITRT_PROBE_H__
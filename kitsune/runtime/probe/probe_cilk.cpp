@@ -0,0 +1,144 @@
+//===- probe_cilk.cpp - OpenCilk spawn and steal costs --------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+// This file is compiled with -ftapir=opencilk.
+
+#include "probe.h"
+#include <algorithm>
+#include <cmath>
+#include <kitsune.h>
+
+extern "C" unsigned __cilkrts_get_nworkers(void);
+
+namespace {
+
+// The spawn measurements run fib(PROBE_FIB_N) with and without spawns.
+const unsigned PROBE_FIB_N = 30;
+// The busy time of each iteration of the steal measurement and the
+// number of parallel loops it times.
+const uint64_t PROBE_STEAL_BUSY_NS = 20000;
+const int PROBE_STEAL_LOOPS = 200;
+
+volatile unsigned probe_fib_n = PROBE_FIB_N;
+
+__attribute__((noinline)) uint64_t fib_serial(unsigned n) {
+  if (n < 2)
+    return n;
+  return fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+__attribute__((noinline)) uint64_t fib_spawn(unsigned n) {
+  if (n < 2)
+    return n;
+  uint64_t x, y;
+  spawn f { x = fib_spawn(n - 1); }
+  y = fib_spawn(n - 2);
+  sync f;
+  return x + y;
+}
+
+// The number of calls of fib(n) that spawn.
+uint64_t fib_spawns(unsigned n) {
+  uint64_t a = 1, b = 1; // calls of fib(0) and fib(1).
+  for (unsigned i = 2; i <= n; i++) {
+    uint64_t c = a + b + 1;
+    a = b;
+    b = c;
+  }
+  return (b - 1) / 2;
+}
+
+void busy(uint64_t ns) {
+  uint64_t end = probe_now_ns() + ns;
+  while (probe_now_ns() < end)
+    ;
+}
+
+} // namespace
+
+double probe_cilk_spawn_ns(const ProbeOptions &opts) {
+  uint64_t serial_ns = UINT64_MAX, spawn_ns = UINT64_MAX;
+  volatile uint64_t sink = 0;
+  for (int rep = 0; rep < opts.reps; rep++) {
+    uint64_t start = probe_now_ns();
+    sink = fib_serial(probe_fib_n);
+    serial_ns = std::min(serial_ns, probe_now_ns() - start);
+    start = probe_now_ns();
+    sink = fib_spawn(probe_fib_n);
+    spawn_ns = std::min(spawn_ns, probe_now_ns() - start);
+  }
+  (void)sink;
+  double extra_ns = spawn_ns > serial_ns ? double(spawn_ns - serial_ns) : 0.0;
+  return extra_ns / fib_spawns(PROBE_FIB_N);
+}
+
+double probe_cilk_steal_ns(const ProbeOptions &opts, unsigned *num_workers) {
+  unsigned workers = __cilkrts_get_nworkers();
+  *num_workers = workers;
+  if (workers < 2)
+    return 0.0;
+
+  // A parallel loop with an iteration per worker: each iteration is
+  // stolen, along a chain of about log2(workers) steals, so the loop
+  // takes the busy time of one iteration and the time of the steals.
+  uint64_t best_ns = UINT64_MAX;
+  for (int rep = 0; rep < opts.reps; rep++) {
+    uint64_t start = probe_now_ns();
+    for (int loop = 0; loop < PROBE_STEAL_LOOPS; loop++) {
+      forall(unsigned w = 0; w < workers; w++)
+        busy(PROBE_STEAL_BUSY_NS);
+    }
+    best_ns = std::min(best_ns, (probe_now_ns() - start) / PROBE_STEAL_LOOPS);
+  }
+  double steals = std::max(1.0, std::ceil(std::log2((double)workers)));
+  return best_ns > PROBE_STEAL_BUSY_NS
+             ? (best_ns - PROBE_STEAL_BUSY_NS) / steals
+             : 0.0;
+}
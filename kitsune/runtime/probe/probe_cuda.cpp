@@ -0,0 +1,336 @@
+//===- probe_cuda.cpp - CUDA device characterization ----------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "probe.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cuda.h>
+#include <vector>
+
+namespace {
+
+// The kernels of the measurements (in PTX, JIT compiled by the driver
+// for the device): a grid-stride copy of 16-byte vectors and an empty
+// kernel.
+const char *probe_ptx = R"(
+.version 7.0
+.target sm_50
+.address_size 64
+
+.visible .entry kitprobe_copy(
+  .param .u64 kitprobe_copy_dst,
+  .param .u64 kitprobe_copy_src,
+  .param .u64 kitprobe_copy_n)
+{
+  .reg .pred %p<2>;
+  .reg .b32 %r<9>;
+  .reg .b64 %rd<10>;
+
+  ld.param.u64 %rd1, [kitprobe_copy_dst];
+  ld.param.u64 %rd2, [kitprobe_copy_src];
+  ld.param.u64 %rd3, [kitprobe_copy_n];
+  cvta.to.global.u64 %rd1, %rd1;
+  cvta.to.global.u64 %rd2, %rd2;
+  mov.u32 %r1, %ctaid.x;
+  mov.u32 %r2, %ntid.x;
+  mov.u32 %r3, %tid.x;
+  mov.u32 %r4, %nctaid.x;
+  mul.wide.u32 %rd4, %r1, %r2;
+  cvt.u64.u32 %rd5, %r3;
+  add.u64 %rd4, %rd4, %rd5;
+  mul.wide.u32 %rd6, %r4, %r2;
+$L_loop:
+  setp.ge.u64 %p1, %rd4, %rd3;
+  @%p1 bra $L_done;
+  shl.b64 %rd7, %rd4, 4;
+  add.u64 %rd8, %rd2, %rd7;
+  ld.global.nc.v4.u32 {%r5, %r6, %r7, %r8}, [%rd8];
+  add.u64 %rd9, %rd1, %rd7;
+  st.global.v4.u32 [%rd9], {%r5, %r6, %r7, %r8};
+  add.u64 %rd4, %rd4, %rd6;
+  bra.uni $L_loop;
+$L_done:
+  ret;
+}
+
+.visible .entry kitprobe_empty()
+{
+  ret;
+}
+)";
+
+// The launches timed for the launch latency.
+const int PROBE_LAUNCHES = 1000;
+// The fraction of the full bandwidth that saturates the device.
+const double PROBE_SATURATION = 0.9;
+
+#define PROBE_CU(call)                                                         \
+  do {                                                                         \
+    CUresult result = call;                                                    \
+    if (result != CUDA_SUCCESS) {                                              \
+      const char *msg = "unknown error";                                       \
+      cuGetErrorString(result, &msg);                                          \
+      fprintf(stderr, "kitsune-probe: cuda: %s: %s\n", #call, msg);            \
+      return false;                                                            \
+    }                                                                          \
+  } while (0)
+
+struct CudaProbe {
+  const ProbeOptions &opts;
+  CUdevice device;
+  CUfunction copy, empty;
+  CUevent start, stop;
+  CUdeviceptr src = 0, dst = 0;
+  uint64_t num_vecs = 0; // 16-byte vectors in each buffer.
+  int num_multiprocs = 0;
+
+  CudaProbe(const ProbeOptions &opts) : opts(opts) {}
+
+  // Time the best of the repetitions of a copy launched with the given
+  // geometry, in seconds.
+  bool time_copy(int blocks, int threads_per_blk, double &secs) {
+    void *args[] = {&dst, &src, &num_vecs};
+    float best_ms = -1.0f;
+    for (int rep = 0; rep < opts.reps; rep++) {
+      PROBE_CU(cuEventRecord(start, 0));
+      PROBE_CU(cuLaunchKernel(copy, blocks, 1, 1, threads_per_blk, 1, 1, 0,
+                              0, args, nullptr));
+      PROBE_CU(cuEventRecord(stop, 0));
+      PROBE_CU(cuEventSynchronize(stop));
+      float ms;
+      PROBE_CU(cuEventElapsedTime(&ms, start, stop));
+      if (best_ms < 0.0f || ms < best_ms)
+        best_ms = ms;
+    }
+    secs = best_ms * 1e-3;
+    return true;
+  }
+
+  // The achievable bandwidth and the fastest block size of the copy
+  // with a full device.
+  bool bandwidth(KitRTMachineProfile *profile) {
+    int max_tpb;
+    PROBE_CU(cuFuncGetAttribute(
+        &max_tpb, CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK, copy));
+    // A warm up launch (page mapping, clocks).
+    double secs;
+    if (!time_copy(num_multiprocs, 128, secs))
+      return false;
+    for (int tpb = 128; tpb <= max_tpb; tpb *= 2) {
+      int blks_per_multiproc;
+      PROBE_CU(cuOccupancyMaxActiveBlocksPerMultiprocessor(
+          &blks_per_multiproc, copy, tpb, 0));
+      if (!time_copy(blks_per_multiproc * num_multiprocs, tpb, secs))
+        return false;
+      double bytes_per_sec = 2.0 * num_vecs * 16 / secs;
+      if (opts.verbose)
+        fprintf(stderr, "kitsune-probe: cuda: copy with %4d threads per "
+                        "block: %.1f GB/s.\n", tpb, bytes_per_sec * 1e-9);
+      if (bytes_per_sec > profile->device_bytes_per_sec) {
+        profile->device_bytes_per_sec = bytes_per_sec;
+        profile->device_stream_threads_per_blk = tpb;
+      }
+    }
+    return true;
+  }
+
+  // The multi-processor load (blocks per multi-processor, in percent,
+  // see __kitcuda_get_occ_launch_params()) at which the copy reaches
+  // PROBE_SATURATION of the bandwidth.
+  bool saturating_load(KitRTMachineProfile *profile) {
+    int tpb = profile->device_stream_threads_per_blk;
+    int blks_per_multiproc;
+    PROBE_CU(cuOccupancyMaxActiveBlocksPerMultiprocessor(&blks_per_multiproc,
+                                                         copy, tpb, 0));
+    int max_load = 100 * blks_per_multiproc;
+    for (int load = 25; load <= max_load; load += load < 100 ? 25 : 50) {
+      int blocks = std::max(1, load * num_multiprocs / 100);
+      double secs;
+      if (!time_copy(blocks, tpb, secs))
+        return false;
+      if (2.0 * num_vecs * 16 / secs >=
+          PROBE_SATURATION * profile->device_bytes_per_sec) {
+        profile->device_saturating_load = load;
+        return true;
+      }
+    }
+    profile->device_saturating_load = max_load;
+    return true;
+  }
+
+  // The time of a launch of an empty kernel and its completion.
+  bool launch_latency(KitRTMachineProfile *profile) {
+    double best_ns = -1.0;
+    for (int rep = 0; rep < opts.reps; rep++) {
+      uint64_t begin = probe_now_ns();
+      for (int i = 0; i < PROBE_LAUNCHES; i++) {
+        PROBE_CU(cuLaunchKernel(empty, 1, 1, 1, 1, 1, 1, 0, 0, nullptr,
+                                nullptr));
+        PROBE_CU(cuCtxSynchronize());
+      }
+      double ns = double(probe_now_ns() - begin) / PROBE_LAUNCHES;
+      if (best_ns < 0.0 || ns < best_ns)
+        best_ns = ns;
+    }
+    profile->device_launch_ns = best_ns;
+    return true;
+  }
+
+  // The bandwidth of the migration of managed memory in both
+  // directions.  Without concurrent managed access (or prefetching)
+  // pages are copied explicitly.
+  bool migration(KitRTMachineProfile *profile) {
+    int managed;
+    PROBE_CU(cuDeviceGetAttribute(
+        &managed, CU_DEVICE_ATTRIBUTE_CONCURRENT_MANAGED_ACCESS, device));
+    size_t bytes = num_vecs * 16;
+    double to_device = -1.0, to_host = -1.0;
+    if (managed) {
+      CUdeviceptr buf;
+      PROBE_CU(cuMemAllocManaged(&buf, bytes, CU_MEM_ATTACH_GLOBAL));
+      for (int rep = 0; rep < opts.reps; rep++) {
+        memset((void *)buf, rep, bytes);
+        uint64_t begin = probe_now_ns();
+        PROBE_CU(cuMemPrefetchAsync(buf, bytes, device, 0));
+        PROBE_CU(cuCtxSynchronize());
+        uint64_t middle = probe_now_ns();
+        PROBE_CU(cuMemPrefetchAsync(buf, bytes, CU_DEVICE_CPU, 0));
+        PROBE_CU(cuCtxSynchronize());
+        uint64_t end = probe_now_ns();
+        to_device = std::max(to_device, bytes / ((middle - begin) * 1e-9));
+        to_host = std::max(to_host, bytes / ((end - middle) * 1e-9));
+      }
+      PROBE_CU(cuMemFree(buf));
+    } else {
+      std::vector<char> host(bytes, 1);
+      for (int rep = 0; rep < opts.reps; rep++) {
+        uint64_t begin = probe_now_ns();
+        PROBE_CU(cuMemcpyHtoD(dst, host.data(), bytes));
+        uint64_t middle = probe_now_ns();
+        PROBE_CU(cuMemcpyDtoH(host.data(), dst, bytes));
+        uint64_t end = probe_now_ns();
+        to_device = std::max(to_device, bytes / ((middle - begin) * 1e-9));
+        to_host = std::max(to_host, bytes / ((end - middle) * 1e-9));
+      }
+    }
+    profile->to_device_bytes_per_sec = to_device;
+    profile->to_host_bytes_per_sec = to_host;
+    return true;
+  }
+
+  bool run(KitRTMachineProfile *profile) {
+    PROBE_CU(cuInit(0));
+    int count;
+    PROBE_CU(cuDeviceGetCount(&count));
+    if (count == 0)
+      return false;
+    // The runtime's primary device (see KITCUDA_DEVICE_ID).
+    int ordinal = 0;
+    if (const char *id = getenv("KITCUDA_DEVICE_ID"))
+      ordinal = std::min(std::max(0, atoi(id)), count - 1);
+    PROBE_CU(cuDeviceGet(&device, ordinal));
+    PROBE_CU(cuDeviceGetName(profile->device, sizeof(profile->device),
+                             device));
+    CUcontext context;
+    PROBE_CU(cuDevicePrimaryCtxRetain(&context, device));
+    PROBE_CU(cuCtxSetCurrent(context));
+    PROBE_CU(cuDeviceGetAttribute(
+        &num_multiprocs, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT, device));
+    int l2_bytes;
+    PROBE_CU(cuDeviceGetAttribute(&l2_bytes,
+                                  CU_DEVICE_ATTRIBUTE_L2_CACHE_SIZE, device));
+    profile->device_l2_bytes = l2_bytes;
+
+    CUmodule module;
+    PROBE_CU(cuModuleLoadData(&module, probe_ptx));
+    PROBE_CU(cuModuleGetFunction(&copy, module, "kitprobe_copy"));
+    PROBE_CU(cuModuleGetFunction(&empty, module, "kitprobe_empty"));
+    PROBE_CU(cuEventCreate(&start, CU_EVENT_DEFAULT));
+    PROBE_CU(cuEventCreate(&stop, CU_EVENT_DEFAULT));
+
+    // Leave room for the managed buffer of the migration measurement.
+    size_t free_bytes, total_bytes;
+    PROBE_CU(cuMemGetInfo(&free_bytes, &total_bytes));
+    size_t bytes = std::min(opts.bytes, free_bytes / 4) & ~size_t(15);
+    num_vecs = bytes / 16;
+    PROBE_CU(cuMemAlloc(&src, bytes));
+    PROBE_CU(cuMemAlloc(&dst, bytes));
+    PROBE_CU(cuMemsetD8(src, 1, bytes));
+    PROBE_CU(cuMemsetD8(dst, 0, bytes));
+
+    if (!bandwidth(profile) || !saturating_load(profile) ||
+        !launch_latency(profile) || !migration(profile))
+      return false;
+
+    PROBE_CU(cuMemFree(src));
+    PROBE_CU(cuMemFree(dst));
+    PROBE_CU(cuModuleUnload(module));
+    PROBE_CU(cuDevicePrimaryCtxRelease(device));
+    if (opts.verbose)
+      fprintf(stderr,
+              "kitsune-probe: cuda: %s: %.1f GB/s (saturated at %.0f%% "
+              "load), launch %.1f us, migration %.1f/%.1f GB/s.\n",
+              profile->device, profile->device_bytes_per_sec * 1e-9,
+              profile->device_saturating_load,
+              profile->device_launch_ns * 1e-3,
+              profile->to_device_bytes_per_sec * 1e-9,
+              profile->to_host_bytes_per_sec * 1e-9);
+    return true;
+  }
+};
+
+} // namespace
+
+bool probe_cuda(const ProbeOptions &opts, KitRTMachineProfile *profile) {
+  CudaProbe probe(opts);
+  return probe.run(profile);
+}
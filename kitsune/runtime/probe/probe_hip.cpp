@@ -0,0 +1,191 @@
+//===- probe_hip.cpp - HIP device characterization ------------------------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "probe.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <hip/hip_runtime.h>
+#include <vector>
+
+// The HIP probe has no kernels of its own (a code object would have to
+// be built for each architecture), so it measures the device with the
+// operations of the runtime library: the bandwidth of device to device
+// copies and the latency of a small memset, which the library runs as
+// a kernel.  The entries that need a kernel of the probe (the
+// saturating load and the block size of a copy) are left unknown.
+
+namespace {
+
+// The operations timed for the launch latency.
+const int PROBE_LAUNCHES = 1000;
+
+#define PROBE_HIP(call)                                                        \
+  do {                                                                         \
+    hipError_t result = call;                                                  \
+    if (result != hipSuccess) {                                                \
+      fprintf(stderr, "kitsune-probe: hip: %s: %s\n", #call,                  \
+              hipGetErrorString(result));                                      \
+      return false;                                                            \
+    }                                                                          \
+  } while (0)
+
+} // namespace
+
+bool probe_hip(const ProbeOptions &opts, KitRTMachineProfile *profile) {
+  int count;
+  PROBE_HIP(hipGetDeviceCount(&count));
+  if (count == 0)
+    return false;
+  // The runtime's primary device (see KITHIP_DEVICE_ID).
+  int device = 0;
+  if (const char *id = getenv("KITHIP_DEVICE_ID"))
+    device = std::min(std::max(0, atoi(id)), count - 1);
+  PROBE_HIP(hipSetDevice(device));
+  PROBE_HIP(hipDeviceGetName(profile->device, sizeof(profile->device),
+                             device));
+  int l2_bytes;
+  PROBE_HIP(hipDeviceGetAttribute(&l2_bytes, hipDeviceAttributeL2CacheSize,
+                                  device));
+  profile->device_l2_bytes = l2_bytes;
+
+  size_t free_bytes, total_bytes;
+  PROBE_HIP(hipMemGetInfo(&free_bytes, &total_bytes));
+  size_t bytes = std::min(opts.bytes, free_bytes / 4);
+  void *src, *dst;
+  PROBE_HIP(hipMalloc(&src, bytes));
+  PROBE_HIP(hipMalloc(&dst, bytes));
+  PROBE_HIP(hipMemset(src, 1, bytes));
+  PROBE_HIP(hipMemset(dst, 0, bytes));
+
+  // The device bandwidth.  The first copy is a warm up.
+  hipEvent_t start, stop;
+  PROBE_HIP(hipEventCreate(&start));
+  PROBE_HIP(hipEventCreate(&stop));
+  float best_ms = -1.0f;
+  for (int rep = 0; rep <= opts.reps; rep++) {
+    PROBE_HIP(hipEventRecord(start, 0));
+    PROBE_HIP(hipMemcpyAsync(dst, src, bytes, hipMemcpyDeviceToDevice, 0));
+    PROBE_HIP(hipEventRecord(stop, 0));
+    PROBE_HIP(hipEventSynchronize(stop));
+    float ms;
+    PROBE_HIP(hipEventElapsedTime(&ms, start, stop));
+    if (rep > 0 && (best_ms < 0.0f || ms < best_ms))
+      best_ms = ms;
+  }
+  profile->device_bytes_per_sec = 2.0 * bytes / (best_ms * 1e-3);
+
+  // The launch latency.
+  double best_ns = -1.0;
+  for (int rep = 0; rep < opts.reps; rep++) {
+    uint64_t begin = probe_now_ns();
+    for (int i = 0; i < PROBE_LAUNCHES; i++) {
+      PROBE_HIP(hipMemsetD32Async((hipDeviceptr_t)dst, 0, 1, 0));
+      PROBE_HIP(hipStreamSynchronize(0));
+    }
+    double ns = double(probe_now_ns() - begin) / PROBE_LAUNCHES;
+    if (best_ns < 0.0 || ns < best_ns)
+      best_ns = ns;
+  }
+  profile->device_launch_ns = best_ns;
+
+  // The migration of managed memory (or explicit copies when pages can
+  // not be prefetched).
+  int managed;
+  PROBE_HIP(hipDeviceGetAttribute(
+      &managed, hipDeviceAttributeConcurrentManagedAccess, device));
+  double to_device = -1.0, to_host = -1.0;
+  void *buf = nullptr;
+  std::vector<char> host;
+  if (managed)
+    PROBE_HIP(hipMallocManaged(&buf, bytes));
+  else
+    host.assign(bytes, 1);
+  for (int rep = 0; rep < opts.reps; rep++) {
+    if (managed)
+      memset(buf, rep, bytes);
+    uint64_t begin = probe_now_ns();
+    if (managed)
+      PROBE_HIP(hipMemPrefetchAsync(buf, bytes, device, 0));
+    else
+      PROBE_HIP(hipMemcpyAsync(dst, host.data(), bytes,
+                               hipMemcpyHostToDevice, 0));
+    PROBE_HIP(hipStreamSynchronize(0));
+    uint64_t middle = probe_now_ns();
+    if (managed)
+      PROBE_HIP(hipMemPrefetchAsync(buf, bytes, hipCpuDeviceId, 0));
+    else
+      PROBE_HIP(hipMemcpyAsync(host.data(), dst, bytes,
+                               hipMemcpyDeviceToHost, 0));
+    PROBE_HIP(hipStreamSynchronize(0));
+    uint64_t end = probe_now_ns();
+    to_device = std::max(to_device, bytes / ((middle - begin) * 1e-9));
+    to_host = std::max(to_host, bytes / ((end - middle) * 1e-9));
+  }
+  profile->to_device_bytes_per_sec = to_device;
+  profile->to_host_bytes_per_sec = to_host;
+
+  if (buf != nullptr)
+    PROBE_HIP(hipFree(buf));
+  PROBE_HIP(hipFree(src));
+  PROBE_HIP(hipFree(dst));
+  PROBE_HIP(hipEventDestroy(start));
+  PROBE_HIP(hipEventDestroy(stop));
+  if (opts.verbose)
+    fprintf(stderr,
+            "kitsune-probe: hip: %s: %.1f GB/s, launch %.1f us, migration "
+            "%.1f/%.1f GB/s.\n",
+            profile->device, profile->device_bytes_per_sec * 1e-9,
+            profile->device_launch_ns * 1e-3,
+            profile->to_device_bytes_per_sec * 1e-9,
+            profile->to_host_bytes_per_sec * 1e-9);
+  return true;
+}
@@ -0,0 +1,697 @@
+//===- profile.cpp - Kitsune runtime kernel launch and transfer profiler --===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include "profile.h"
+#include "kitrt.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sched.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+bool _kitrt_profile_enabled = false;
+bool _kitrt_profile_metrics_enabled = false;
+int _kitrt_timer_spans = 0;
+
+namespace {
+
+// The number of pending (unresolved) records a thread keeps before it
+// checks for completed events.
+const size_t KITRT_PROFILE_MAX_PENDING = 256;
+
+uint64_t profile_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A committed profile record.  The GPU time (and start) are only known
+// once the record's events have been resolved.
+struct KitRTProfileRecord {
+  KitRTProfileKind kind;
+  const char *name;
+  const char *source_loc;
+  uint64_t host_start_ns, host_end_ns;
+  uint64_t bytes;
+  uint64_t seq; // the record's position in its thread's records.
+  unsigned blocks[3], threads[3];
+  const KitRTProfileEventOps *ops;
+  void *start_event, *end_event;
+  double gpu_start_ns; // -1 when there are no events.
+  double gpu_ms;       // -1 when there are no events.
+  bool has_metrics;
+  double metrics[KITRT_PROFILE_NUM_METRICS]; // negative if unavailable.
+};
+
+// The per-kernel (and per-transfer) summary statistics.
+struct KitRTProfileStats {
+  uint64_t count = 0;
+  uint64_t timed = 0; // the number of operations with a gpu time.
+  double gpu_total_ms = 0.0;
+  double gpu_min_ms = 0.0;
+  double gpu_max_ms = 0.0;
+  uint64_t host_total_ns = 0;
+  uint64_t bytes = 0;
+  unsigned blocks[3] = {0, 0, 0}, threads[3] = {0, 0, 0};
+  const char *source_loc = nullptr;
+  // The metrics are summed over the launches that report them; the
+  // DRAM throughput also needs the gpu time of those launches.
+  uint64_t metric_count[KITRT_PROFILE_NUM_METRICS] = {};
+  double metric_total[KITRT_PROFILE_NUM_METRICS] = {};
+  double dram_gpu_ms = 0.0;
+
+  void add(const KitRTProfileRecord &rec) {
+    count++;
+    host_total_ns += rec.host_end_ns - rec.host_start_ns;
+    bytes += rec.bytes;
+    if (rec.kind == KITRT_PROFILE_LAUNCH) {
+      std::copy(rec.blocks, rec.blocks + 3, blocks);
+      std::copy(rec.threads, rec.threads + 3, threads);
+      if (rec.source_loc)
+        source_loc = rec.source_loc;
+    }
+    if (rec.has_metrics) {
+      for (int m = 0; m < KITRT_PROFILE_NUM_METRICS; m++) {
+        if (rec.metrics[m] < 0.0)
+          continue;
+        metric_count[m]++;
+        metric_total[m] += rec.metrics[m];
+      }
+      if (rec.metrics[KITRT_METRIC_DRAM_BYTES] >= 0.0 && rec.gpu_ms > 0.0)
+        dram_gpu_ms += rec.gpu_ms;
+    }
+    if (rec.gpu_ms >= 0.0) {
+      if (timed == 0 || rec.gpu_ms < gpu_min_ms)
+        gpu_min_ms = rec.gpu_ms;
+      if (timed == 0 || rec.gpu_ms > gpu_max_ms)
+        gpu_max_ms = rec.gpu_ms;
+      gpu_total_ms += rec.gpu_ms;
+      timed++;
+    }
+  }
+
+  void merge(const KitRTProfileStats &other) {
+    if (other.timed != 0) {
+      if (timed == 0 || other.gpu_min_ms < gpu_min_ms)
+        gpu_min_ms = other.gpu_min_ms;
+      if (timed == 0 || other.gpu_max_ms > gpu_max_ms)
+        gpu_max_ms = other.gpu_max_ms;
+    }
+    if (other.count != 0) {
+      std::copy(other.blocks, other.blocks + 3, blocks);
+      std::copy(other.threads, other.threads + 3, threads);
+    }
+    if (other.source_loc)
+      source_loc = other.source_loc;
+    for (int m = 0; m < KITRT_PROFILE_NUM_METRICS; m++) {
+      metric_count[m] += other.metric_count[m];
+      metric_total[m] += other.metric_total[m];
+    }
+    dram_gpu_ms += other.dram_gpu_ms;
+    count += other.count;
+    timed += other.timed;
+    gpu_total_ms += other.gpu_total_ms;
+    host_total_ns += other.host_total_ns;
+    bytes += other.bytes;
+  }
+};
+
+typedef std::pair<int, const char *> KitRTProfileKey;
+
+// An operation issued by a thread while it had a timing span open.
+struct KitRTTimerRecord {
+  uint64_t seq;
+  uint64_t host_ns;
+  double gpu_start_ns, gpu_ms; // -1 when there are no events.
+};
+
+// The records of a single thread.  Buffers are only used by their
+// thread; the mutex is only contended when the runtime flushes (or
+// reports) the profile.
+struct KitRTProfileBuffer {
+  std::mutex mutex;
+  unsigned thread_index;
+  std::deque<KitRTProfileRecord> pending;
+  std::vector<KitRTProfileRecord> trace;
+  std::map<KitRTProfileKey, KitRTProfileStats> stats;
+  // Resolved events are reused by later records.
+  std::vector<std::pair<const KitRTProfileEventOps *, void *>> free_events;
+  // The first event each runtime recorded on this thread; the GPU
+  // start times (for the trace) are relative to it.
+  std::vector<std::pair<const KitRTProfileEventOps *, KitRTProfileRecord>>
+      references;
+  uint64_t next_seq = 0;
+  // The first record of each of the thread's timing spans (or -1 when
+  // the span has ended), and the operations of the spans that are open.
+  std::vector<uint64_t> spans;
+  std::vector<KitRTTimerRecord> span_records;
+};
+
+std::mutex _kitrt_profile_mutex;
+std::vector<KitRTProfileBuffer *> _kitrt_profile_buffers;
+const char *_kitrt_profile_trace_file = nullptr;
+uint64_t _kitrt_profile_start_ns = 0;
+
+thread_local KitRTProfileBuffer *_kitrt_profile_buffer = nullptr;
+
+KitRTProfileBuffer *get_profile_buffer() {
+  if (_kitrt_profile_buffer == nullptr) {
+    KitRTProfileBuffer *buffer = new KitRTProfileBuffer;
+    std::lock_guard<std::mutex> lock(_kitrt_profile_mutex);
+    buffer->thread_index = _kitrt_profile_buffers.size();
+    _kitrt_profile_buffers.push_back(buffer);
+    _kitrt_profile_buffer = buffer;
+  }
+  return _kitrt_profile_buffer;
+}
+
+void *get_event(KitRTProfileBuffer *buffer, const KitRTProfileEventOps *ops) {
+  auto &events = buffer->free_events;
+  for (auto it = events.rbegin(); it != events.rend(); ++it) {
+    if (it->first == ops) {
+      void *event = it->second;
+      events.erase(std::next(it).base());
+      return event;
+    }
+  }
+  return ops->create();
+}
+
+// Return the reference event of the given runtime, recording it on
+// the stream the first time the runtime is seen by the thread.
+const KitRTProfileRecord &get_reference(KitRTProfileBuffer *buffer,
+                                        const KitRTProfileEventOps *ops,
+                                        void *stream) {
+  for (auto &ref : buffer->references)
+    if (ref.first == ops)
+      return ref.second;
+
+  KitRTProfileRecord ref = {};
+  ref.ops = ops;
+  ref.start_event = ops->create();
+  ref.host_start_ns = profile_now_ns();
+  ops->record(ref.start_event, stream);
+  buffer->references.push_back(std::make_pair(ops, ref));
+  return buffer->references.back().second;
+}
+
+// Compute the GPU time of a record whose events have completed and
+// account for it.  The events are recycled (or destroyed when the
+// runtime is being flushed).
+void resolve_record(KitRTProfileBuffer *buffer, KitRTProfileRecord &rec,
+                    bool release) {
+  const KitRTProfileEventOps *ops = rec.ops;
+  rec.gpu_ms = ops->elapsed_ms(rec.start_event, rec.end_event);
+  for (auto &ref : buffer->references) {
+    if (ref.first == ops) {
+      rec.gpu_start_ns =
+          ref.second.host_start_ns +
+          1.0e6 * ops->elapsed_ms(ref.second.start_event, rec.start_event);
+      break;
+    }
+  }
+  if (release) {
+    ops->destroy(rec.start_event);
+    ops->destroy(rec.end_event);
+  } else {
+    buffer->free_events.push_back(std::make_pair(ops, rec.start_event));
+    buffer->free_events.push_back(std::make_pair(ops, rec.end_event));
+  }
+  rec.start_event = rec.end_event = nullptr;
+}
+
+void account_record(KitRTProfileBuffer *buffer,
+                    const KitRTProfileRecord &rec) {
+  if (not buffer->spans.empty()) {
+    uint64_t first = *std::min_element(buffer->spans.begin(),
+                                       buffer->spans.end());
+    if (rec.seq >= first)
+      buffer->span_records.push_back({rec.seq,
+                                      rec.host_end_ns - rec.host_start_ns,
+                                      rec.gpu_start_ns, rec.gpu_ms});
+  }
+  if (not _kitrt_profile_enabled)
+    return;
+  buffer->stats[KitRTProfileKey(rec.kind, rec.name)].add(rec);
+  if (_kitrt_profile_trace_file)
+    buffer->trace.push_back(rec);
+}
+
+// Resolve the pending records of the buffer.  Records are resolved in
+// order until the first one that has not completed unless 'wait' is
+// set.  When 'ops' is non-null only the records (and events) of that
+// runtime are resolved and their events are released.
+void resolve_pending(KitRTProfileBuffer *buffer,
+                     const KitRTProfileEventOps *ops, bool wait) {
+  std::deque<KitRTProfileRecord> remaining;
+  while (not buffer->pending.empty()) {
+    KitRTProfileRecord &rec = buffer->pending.front();
+    if (ops && rec.ops != ops) {
+      remaining.push_back(rec);
+      buffer->pending.pop_front();
+      continue;
+    }
+    if (not rec.ops->query(rec.end_event)) {
+      if (not wait)
+        break;
+      KitRTWait poll = {0, 0};
+      while (not rec.ops->query(rec.end_event))
+        __kitrt_wait_backoff(&poll);
+    }
+    resolve_record(buffer, rec, ops != nullptr);
+    account_record(buffer, rec);
+    buffer->pending.pop_front();
+  }
+  remaining.insert(remaining.end(), buffer->pending.begin(),
+                   buffer->pending.end());
+  buffer->pending.swap(remaining);
+}
+
+// Release all the events of the given runtime held by the buffer.
+void release_events(KitRTProfileBuffer *buffer,
+                    const KitRTProfileEventOps *ops) {
+  auto &events = buffer->free_events;
+  for (auto &event : events)
+    if (event.first == ops)
+      ops->destroy(event.second);
+  events.erase(std::remove_if(events.begin(), events.end(),
+                              [ops](const auto &event) {
+                                return event.first == ops;
+                              }),
+               events.end());
+
+  auto &refs = buffer->references;
+  for (auto &ref : refs)
+    if (ref.first == ops)
+      ops->destroy(ref.second.start_event);
+  refs.erase(std::remove_if(refs.begin(), refs.end(),
+                            [ops](const auto &ref) {
+                              return ref.first == ops;
+                            }),
+             refs.end());
+}
+
+const char *kind_name(int kind) {
+  switch (kind) {
+  case KITRT_PROFILE_LAUNCH:
+    return "launch";
+  case KITRT_PROFILE_TO_DEVICE:
+    return "htod";
+  case KITRT_PROFILE_TO_HOST:
+    return "dtoh";
+  }
+  return "unknown";
+}
+
+void write_json_string(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for (const char *c = str; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fputc('\\', fp);
+    if ((unsigned char)*c >= 0x20)
+      fputc(*c, fp);
+  }
+  fputc('"', fp);
+}
+
+void write_trace_event(FILE *fp, bool &first, const KitRTProfileRecord &rec,
+                       const char *name, int pid, unsigned tid,
+                       double start_ns, double dur_ns) {
+  fprintf(fp, "%s\n  {\"name\": ", first ? "" : ",");
+  first = false;
+  write_json_string(fp, name);
+  fprintf(fp,
+          ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, "
+          "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+          kind_name(rec.kind), pid, tid,
+          (start_ns - (double)_kitrt_profile_start_ns) / 1.0e3,
+          dur_ns / 1.0e3);
+  if (rec.kind == KITRT_PROFILE_LAUNCH)
+    fprintf(fp, "\"blocks\": \"%u,%u,%u\", \"threads\": \"%u,%u,%u\"",
+            rec.blocks[0], rec.blocks[1], rec.blocks[2], rec.threads[0],
+            rec.threads[1], rec.threads[2]);
+  else
+    fprintf(fp, "\"bytes\": %lu", (unsigned long)rec.bytes);
+  if (rec.source_loc) {
+    fprintf(fp, ", \"location\": ");
+    write_json_string(fp, rec.source_loc);
+  }
+  fprintf(fp, "}}");
+}
+
+// Write all the profiled operations to the trace file.  Host-side
+// calls are shown under one process and the GPU operations under
+// another, with a track per launching thread.
+void write_trace(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "kitrt: warning, unable to open profile trace "
+                    "file '%s'.\n", path);
+    return;
+  }
+
+  fprintf(fp, "{\"traceEvents\": [");
+  fprintf(fp, "\n  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+              "\"args\": {\"name\": \"host\"}},");
+  fprintf(fp, "\n  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+              "\"args\": {\"name\": \"gpu\"}}");
+  bool first = false;
+  for (KitRTProfileBuffer *buffer : _kitrt_profile_buffers) {
+    for (const KitRTProfileRecord &rec : buffer->trace) {
+      std::string name(rec.name);
+      if (rec.kind != KITRT_PROFILE_LAUNCH)
+        name += std::string(" (") + kind_name(rec.kind) + ")";
+      write_trace_event(fp, first, rec, name.c_str(), 0,
+                        buffer->thread_index, rec.host_start_ns,
+                        rec.host_end_ns - rec.host_start_ns);
+      if (rec.gpu_ms >= 0.0)
+        write_trace_event(fp, first, rec, name.c_str(), 1,
+                          buffer->thread_index, rec.gpu_start_ns,
+                          rec.gpu_ms * 1.0e6);
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+}
+
+// Print the hardware metrics of the kernels that have them, in the
+// order of the summary.
+template <typename Entries> void write_metrics(const Entries &sorted) {
+  bool any = false;
+  for (auto &entry : sorted)
+    for (int m = 0; m < KITRT_PROFILE_NUM_METRICS; m++)
+      any |= entry.second.metric_count[m] != 0;
+  if (not any) {
+    fprintf(stderr, "kitrt: no kernel metrics were collected "
+                    "(see KITRT_PROFILE_METRICS).\n\n");
+    return;
+  }
+
+  fprintf(stderr, "kitrt: kernel metrics (sorted by total gpu time).\n");
+  fprintf(stderr, "  %8s %11s %9s %8s %9s  %-32s %s\n", "count",
+          "dram(GB/s)", "occup(%)", "l2hit(%)", "warpeff(%)", "name",
+          "location");
+  for (auto &entry : sorted) {
+    const KitRTProfileStats &s = entry.second;
+    if (entry.first.first != KITRT_PROFILE_LAUNCH)
+      continue;
+    char values[KITRT_PROFILE_NUM_METRICS][32];
+    uint64_t count = 0;
+    for (int m = 0; m < KITRT_PROFILE_NUM_METRICS; m++) {
+      double value = -1.0;
+      if (s.metric_count[m] != 0) {
+        if (m != KITRT_METRIC_DRAM_BYTES)
+          value = s.metric_total[m] / s.metric_count[m];
+        else if (s.dram_gpu_ms > 0.0)
+          value = s.metric_total[m] / (s.dram_gpu_ms * 1.0e6);
+      }
+      count = std::max(count, s.metric_count[m]);
+      if (value < 0.0)
+        snprintf(values[m], sizeof(values[m]), "-");
+      else
+        snprintf(values[m], sizeof(values[m]), "%.2f", value);
+    }
+    fprintf(stderr, "  %8lu %11s %9s %8s %9s  %-32s %s\n",
+            (unsigned long)count,
+            values[KITRT_METRIC_DRAM_BYTES], values[KITRT_METRIC_OCCUPANCY],
+            values[KITRT_METRIC_L2_HIT_RATE],
+            values[KITRT_METRIC_WARP_EFFICIENCY], entry.first.second.c_str(),
+            s.source_loc ? s.source_loc : "-");
+  }
+  fprintf(stderr, "  (averages over the launches with metrics; dram: "
+                  "bytes read and written per second of gpu time)\n\n");
+}
+
+// Print the summary of the profile (and write the trace) at exit.
+void profile_report() {
+  std::lock_guard<std::mutex> lock(_kitrt_profile_mutex);
+  std::map<std::pair<int, std::string>, KitRTProfileStats> stats;
+  for (KitRTProfileBuffer *buffer : _kitrt_profile_buffers) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    // Any runtime that has not been flushed still has its contexts.
+    resolve_pending(buffer, nullptr, true);
+    for (auto &entry : buffer->stats)
+      stats[std::make_pair(entry.first.first,
+                           std::string(entry.first.second))]
+          .merge(entry.second);
+  }
+  if (stats.empty())
+    return;
+
+  std::vector<std::pair<std::pair<int, std::string>, KitRTProfileStats>>
+      sorted(stats.begin(), stats.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    if (a.second.gpu_total_ms != b.second.gpu_total_ms)
+      return a.second.gpu_total_ms > b.second.gpu_total_ms;
+    return a.second.host_total_ns > b.second.host_total_ns;
+  });
+
+  double gpu_total_ms = 0.0;
+  for (auto &entry : sorted)
+    gpu_total_ms += entry.second.gpu_total_ms;
+
+  fprintf(stderr, "\nkitrt: profile summary (sorted by total gpu time).\n");
+  fprintf(stderr, "  %-6s %8s %12s %6s %10s %10s %10s %11s %12s %-22s %s\n",
+          "kind", "count", "gpu(ms)", "gpu%", "avg(ms)", "min(ms)",
+          "max(ms)", "host(us)", "bytes", "geometry", "name");
+  for (auto &entry : sorted) {
+    const KitRTProfileStats &s = entry.second;
+    double avg_ms = s.timed ? s.gpu_total_ms / s.timed : 0.0;
+    double percent =
+        gpu_total_ms > 0.0 ? 100.0 * s.gpu_total_ms / gpu_total_ms : 0.0;
+    char geometry[64] = "-";
+    if (entry.first.first == KITRT_PROFILE_LAUNCH)
+      snprintf(geometry, sizeof(geometry), "%u,%u,%u/%u,%u,%u", s.blocks[0],
+               s.blocks[1], s.blocks[2], s.threads[0], s.threads[1],
+               s.threads[2]);
+    fprintf(stderr,
+            "  %-6s %8lu %12.3f %6.1f %10.3f %10.3f %10.3f %11.2f %12lu "
+            "%-22s %s\n",
+            kind_name(entry.first.first), (unsigned long)s.count,
+            s.gpu_total_ms, percent, avg_ms, s.gpu_min_ms, s.gpu_max_ms,
+            s.host_total_ns / (1.0e3 * s.count), (unsigned long)s.bytes,
+            geometry, entry.first.second.c_str());
+  }
+  fprintf(stderr, "  (host: average host-side time of each call; "
+                  "geometry: blocks/threads of the last launch)\n\n");
+  if (_kitrt_profile_metrics_enabled)
+    write_metrics(sorted);
+
+  if (_kitrt_profile_trace_file) {
+    write_trace(_kitrt_profile_trace_file);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: profile trace written to '%s'.\n",
+              _kitrt_profile_trace_file);
+  }
+}
+
+} // namespace
+
+void __kitrt_profile_enable(bool enable) {
+  static bool registered = false;
+  _kitrt_profile_enabled = enable;
+  if (not enable || registered)
+    return;
+
+  registered = true;
+  _kitrt_profile_start_ns = profile_now_ns();
+  _kitrt_profile_trace_file = __kitrt_get_config("KITRT_PROFILE_TRACE");
+  // The runtimes register their clean up (which flushes the profile)
+  // after the runtime is initialized, so the report runs after them.
+  atexit(profile_report);
+}
+
+void __kitrt_profile_enable_metrics(bool enable) {
+  _kitrt_profile_metrics_enabled = enable;
+  if (enable)
+    __kitrt_profile_enable(true);
+}
+
+void __kitrt_profile_flush(const KitRTProfileEventOps *ops) {
+  assert(ops && "kitrt: profile flush with null event ops!");
+  std::lock_guard<std::mutex> lock(_kitrt_profile_mutex);
+  for (KitRTProfileBuffer *buffer : _kitrt_profile_buffers) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    resolve_pending(buffer, ops, true);
+    release_events(buffer, ops);
+  }
+}
+
+void KitRTProfileScope::begin(KitRTProfileKind op_kind, const char *op_name) {
+  kind = op_kind;
+  name = op_name;
+  source_loc = nullptr;
+  has_metrics = false;
+  bytes = 0;
+  set_geometry(0, 0, 0, 0, 0, 0);
+  ops = nullptr;
+  start_event = end_event = nullptr;
+  host_start_ns = profile_now_ns();
+}
+
+void KitRTProfileScope::start(const KitRTProfileEventOps *event_ops,
+                              void *stream) {
+  KitRTProfileBuffer *buffer = get_profile_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  ops = event_ops;
+  (void)get_reference(buffer, ops, stream);
+  start_event = get_event(buffer, ops);
+  end_event = get_event(buffer, ops);
+  ops->record(start_event, stream);
+  if (kind == KITRT_PROFILE_LAUNCH && _kitrt_profile_metrics_enabled &&
+      ops->metrics)
+    has_metrics = ops->metrics->begin(stream);
+}
+
+void KitRTProfileScope::end(void *stream) {
+  ops->record(end_event, stream);
+  if (has_metrics)
+    has_metrics = ops->metrics->end(stream, metrics);
+}
+
+void KitRTProfileScope::commit() {
+  KitRTProfileRecord rec;
+  rec.kind = kind;
+  rec.name = name;
+  rec.source_loc = source_loc;
+  rec.host_start_ns = host_start_ns;
+  rec.host_end_ns = profile_now_ns();
+  rec.bytes = bytes;
+  std::copy(blocks, blocks + 3, rec.blocks);
+  std::copy(threads, threads + 3, rec.threads);
+  rec.ops = ops;
+  rec.start_event = start_event;
+  rec.end_event = end_event;
+  rec.gpu_start_ns = -1.0;
+  rec.gpu_ms = -1.0;
+  rec.has_metrics = has_metrics;
+  if (has_metrics)
+    std::copy(metrics, metrics + KITRT_PROFILE_NUM_METRICS, rec.metrics);
+  active = false;
+
+  KitRTProfileBuffer *buffer = get_profile_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  rec.seq = buffer->next_seq++;
+  if (rec.start_event == nullptr) {
+    account_record(buffer, rec);
+    return;
+  }
+  buffer->pending.push_back(rec);
+  if (buffer->pending.size() > KITRT_PROFILE_MAX_PENDING)
+    resolve_pending(buffer, nullptr, false);
+}
+
+int __kitrt_timer_begin() {
+  KitRTProfileBuffer *buffer = get_profile_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  __atomic_fetch_add(&_kitrt_timer_spans, 1, __ATOMIC_RELAXED);
+  buffer->spans.push_back(buffer->next_seq);
+  return buffer->spans.size() - 1;
+}
+
+void __kitrt_timer_query(int span, double *device_secs, double *host_secs,
+                         uint64_t *ops) {
+  KitRTProfileBuffer *buffer = get_profile_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  assert(span >= 0 && (size_t)span < buffer->spans.size() &&
+         "kitrt: query of an unknown timing span!");
+  uint64_t first = buffer->spans[span];
+  resolve_pending(buffer, nullptr, true);
+
+  // The device time is the length of the union of the operations'
+  // intervals on the device.
+  std::vector<std::pair<double, double>> intervals;
+  uint64_t host_ns = 0, count = 0;
+  for (const KitRTTimerRecord &rec : buffer->span_records) {
+    if (rec.seq < first)
+      continue;
+    count++;
+    host_ns += rec.host_ns;
+    if (rec.gpu_ms >= 0.0 && rec.gpu_start_ns >= 0.0)
+      intervals.push_back(std::make_pair(
+          rec.gpu_start_ns, rec.gpu_start_ns + 1.0e6 * rec.gpu_ms));
+  }
+  std::sort(intervals.begin(), intervals.end());
+  double device_ns = 0.0, end_ns = 0.0;
+  for (auto &interval : intervals) {
+    double begin_ns = std::max(interval.first, end_ns);
+    if (interval.second > begin_ns)
+      device_ns += interval.second - begin_ns;
+    end_ns = std::max(end_ns, interval.second);
+  }
+
+  if (device_secs)
+    *device_secs = device_ns / 1.0e9;
+  if (host_secs)
+    *host_secs = host_ns / 1.0e9;
+  if (ops)
+    *ops = count;
+}
+
+void __kitrt_timer_end(int span) {
+  KitRTProfileBuffer *buffer = get_profile_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  assert(span >= 0 && (size_t)span < buffer->spans.size() &&
+         "kitrt: end of an unknown timing span!");
+  buffer->spans[span] = UINT64_MAX;
+  __atomic_fetch_sub(&_kitrt_timer_spans, 1, __ATOMIC_RELAXED);
+  // Forget the spans (and their operations) once none is open.
+  while (not buffer->spans.empty() && buffer->spans.back() == UINT64_MAX)
+    buffer->spans.pop_back();
+  if (buffer->spans.empty())
+    buffer->span_records.clear();
+}
@@ -0,0 +1,224 @@
+//===- profile.h - Kitsune runtime kernel launch and transfer profiler ----===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __KITRT_PROFILE_H__
+#define __KITRT_PROFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// The runtime has a built-in profiler for kernel launches and data
+/// transfers (prefetches and copies) that is enabled by setting the
+/// KITRT_PROFILE environment variable.  At exit it prints a summary
+/// that lists, for each kernel (and transfer direction), the number of
+/// launches, the time spent on the GPU, the host-side launch overhead,
+/// the last launch geometry, and the bytes that were moved.  Setting
+/// KITRT_PROFILE_TRACE to a file name also writes a timeline of every
+/// profiled operation to that file in the Chrome trace (JSON) format.
+///
+/// GPU time is measured with a pair of events recorded around each
+/// operation on its stream; the events are only resolved once enough
+/// of them are pending (or at exit), so profiling does not synchronize
+/// the stream.  Records are kept in per-thread buffers and launch
+/// threads never contend with each other.  When profiling is disabled
+/// each profiled call only costs a (predictable) branch.
+///
+/// Note that the profiler does not count page faults (this would
+/// require the vendor tools interfaces, e.g., CUPTI).
+///
+/// Setting KITRT_PROFILE_METRICS (which implies KITRT_PROFILE) also
+/// collects hardware metrics of each kernel launch through the
+/// vendor's profiling interface (see KitRTProfileMetricOps) and adds
+/// a per-kernel metrics table to the summary.  The compiler passes the
+/// source location of each forall with its kernel (see KitRTInstMix)
+/// so the table points back at the loops that need tuning.  Metric
+/// collection may replay each kernel and waits for it to complete, so
+/// it perturbs the timings of the other columns.  Only the CUDA runtime
+/// collects metrics (through CUPTI); HIP launches are only timed since
+/// the rocprofiler interfaces differ between ROCm releases.
+
+/// The kinds of profiled operations.
+enum KitRTProfileKind {
+  KITRT_PROFILE_LAUNCH = 0,    // kernel launch.
+  KITRT_PROFILE_TO_DEVICE = 1, // host to device transfer (or prefetch).
+  KITRT_PROFILE_TO_HOST = 2,   // device to host transfer (or prefetch).
+};
+
+/// The hardware metrics collected for kernel launches.
+enum KitRTProfileMetric {
+  KITRT_METRIC_DRAM_BYTES = 0,      // bytes read and written in DRAM.
+  KITRT_METRIC_OCCUPANCY = 1,       // achieved occupancy (percent).
+  KITRT_METRIC_L2_HIT_RATE = 2,     // L2 cache hit rate (percent).
+  KITRT_METRIC_WARP_EFFICIENCY = 3, // active threads per warp (percent).
+  KITRT_PROFILE_NUM_METRICS
+};
+
+/// A GPU runtime that can read hardware metrics supplies these
+/// operations.  begin() is called right before a kernel is launched
+/// on the stream and end() right after; end() waits for the kernel
+/// and stores its metrics in 'values', with a negative value for the
+/// metrics that are not available.  Both return false if the metrics
+/// can not be collected (the launch is then only timed).
+struct KitRTProfileMetricOps {
+  const char *name; // name of the profiling interface.
+  bool (*begin)(void *stream);
+  bool (*end)(void *stream, double values[KITRT_PROFILE_NUM_METRICS]);
+};
+
+/// Each GPU runtime supplies the operations on its events that are
+/// needed to time operations on its streams.  The events must stay
+/// valid until the runtime calls __kitrt_profile_flush().
+struct KitRTProfileEventOps {
+  const char *name;                          // name of the runtime.
+  void *(*create)();                         // create a timing event.
+  void (*record)(void *event, void *stream); // record event on stream.
+  bool (*query)(void *event);                // has the event completed?
+  float (*elapsed_ms)(void *start, void *end);
+  void (*destroy)(void *event);
+  const KitRTProfileMetricOps *metrics; // null if metrics are unsupported.
+};
+
+extern bool _kitrt_profile_enabled;
+extern bool _kitrt_profile_metrics_enabled;
+extern int _kitrt_timer_spans;
+
+/// Is the profiler recording operations?  It records when it is
+/// enabled and while any thread has a timing span open (see
+/// __kitrt_timer_begin()).
+inline bool __kitrt_profile_enabled() {
+  return _kitrt_profile_enabled ||
+         __atomic_load_n(&_kitrt_timer_spans, __ATOMIC_RELAXED) != 0;
+}
+
+/// Is the collection of hardware metrics enabled?
+inline bool __kitrt_profile_metrics_enabled() {
+  return _kitrt_profile_metrics_enabled;
+}
+
+/// Enable (or disable) the profiler.  This is called by the runtime
+/// initialization when KITRT_PROFILE is set.
+extern void __kitrt_profile_enable(bool enable);
+
+/// Enable (or disable) the collection of hardware metrics, which also
+/// enables the profiler.  This is called by the runtime initialization
+/// when KITRT_PROFILE_METRICS is set.
+extern void __kitrt_profile_enable_metrics(bool enable);
+
+/// Resolve the pending records of the given runtime and release their
+/// events.  Runtimes must call this before their contexts are
+/// destroyed.
+extern void __kitrt_profile_flush(const KitRTProfileEventOps *ops);
+
+/// A profiled operation.  Constructing a scope at the start of a
+/// launch (or transfer) call starts the host-side timer; the GPU work
+/// of the operation is bracketed by record_start() and record_end().
+/// The record is committed when the scope is destroyed unless it was
+/// cancelled (e.g., nothing was launched).  Operations that are not
+/// issued eagerly (e.g., graph launches) can skip the events; they
+/// still count toward the launch count and the host overhead.
+struct KitRTProfileScope {
+  bool active;
+  bool has_metrics;
+  KitRTProfileKind kind;
+  const char *name;
+  const char *source_loc;
+  uint64_t host_start_ns;
+  uint64_t bytes;
+  unsigned blocks[3], threads[3];
+  const KitRTProfileEventOps *ops;
+  void *start_event, *end_event;
+  double metrics[KITRT_PROFILE_NUM_METRICS];
+
+  KitRTProfileScope(KitRTProfileKind kind, const char *name)
+      : active(__kitrt_profile_enabled()) {
+    if (__builtin_expect(active, false))
+      begin(kind, name);
+  }
+
+  ~KitRTProfileScope() {
+    if (__builtin_expect(active, false))
+      commit();
+  }
+
+  void cancel() { active = false; }
+
+  void set_bytes(uint64_t nbytes) { bytes = nbytes; }
+
+  /// Set the source location of the launched kernel (may be null).
+  void set_source_loc(const char *loc) { source_loc = loc; }
+
+  void set_geometry(uint64_t bx, uint64_t by, uint64_t bz, unsigned tx,
+                    unsigned ty, unsigned tz) {
+    blocks[0] = bx;
+    blocks[1] = by;
+    blocks[2] = bz;
+    threads[0] = tx;
+    threads[1] = ty;
+    threads[2] = tz;
+  }
+
+  void record_start(const KitRTProfileEventOps *event_ops, void *stream) {
+    if (__builtin_expect(active, false))
+      start(event_ops, stream);
+  }
+
+  void record_end(void *stream) {
+    if (__builtin_expect(active, false) && start_event)
+      end(stream);
+  }
+
+private:
+  void begin(KitRTProfileKind kind, const char *name);
+  void start(const KitRTProfileEventOps *event_ops, void *stream);
+  void end(void *stream);
+  void commit();
+};
+
+#endif
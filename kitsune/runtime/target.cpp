@@ -0,0 +1,384 @@
+//===- target.cpp - Kitsune runtime selection of the execution target ------===//
+//
+// Copyright (c) 2021, Los Alamos National Security, LLC.
+// All rights reserved.
+//
+//  Copyright 2021. Los Alamos National Security, LLC. This software was
+//  produced under U.S. Government contract DE-AC52-06NA25396 for Los
+//  Alamos National Laboratory (LANL), which is operated by Los Alamos
+//  National Security, LLC for the U.S. Department of Energy. The
+//  U.S. Government has rights to use, reproduce, and distribute this
+//  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+//  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+//  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+//  derivative works, such modified software should be clearly marked,
+//  so as not to confuse it with the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+//  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+//  SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include "kitrt.h"
+
+#ifdef KITRT_CUDA_ENABLED
+#include "cuda/kitcuda.h"
+#endif
+#ifdef KITRT_HIP_ENABLED
+#include "hip/kithip.h"
+#endif
+
+// See memory.cpp.
+extern "C" void *__kitrt_default_mem_alloc(size_t bytes);
+extern "C" void __kitrt_default_mem_free(void *ptr);
+
+// Code compiled for the "multi" Tapir target carries a version of each
+// loop for each of the targets below.  The target is picked once, the
+// first time it is requested (typically by the global constructors of
+// the GPU targets), from the devices found on the system.  The probes
+// below only load the vendor's driver library and count the devices;
+// they do not initialize the (abort-on-error) GPU runtimes, so the
+// same binary runs on systems without a GPU or its driver.
+
+#if defined(KITRT_CUDA_ENABLED) || defined(KITRT_HIP_ENABLED)
+typedef int (*KitRTDeviceInitFn)(unsigned);
+typedef int (*KitRTDeviceCountFn)(int *);
+
+// Is there at least one device behind the given driver library?
+static bool __kitrt_probe_devices(const char *libname, const char *init_sym,
+                                  const char *count_sym) {
+  void *handle = dlopen(libname, RTLD_LAZY | RTLD_LOCAL);
+  if (handle == nullptr)
+    return false;
+  auto init_fn = (KitRTDeviceInitFn)dlsym(handle, init_sym);
+  auto count_fn = (KitRTDeviceCountFn)dlsym(handle, count_sym);
+  int count = 0;
+  // Both drivers return zero on success.
+  bool found = init_fn && count_fn && init_fn(0) == 0 &&
+               count_fn(&count) == 0 && count > 0;
+  if (not found)
+    dlclose(handle);
+  // Otherwise the library stays loaded for the target's runtime.
+  return found;
+}
+#endif
+
+static bool __kitrt_target_available(KitRTTarget target) {
+  switch (target) {
+  case KITRT_TARGET_CUDA:
+#ifdef KITRT_CUDA_ENABLED
+    return __kitrt_probe_devices("libcuda.so", "cuInit", "cuDeviceGetCount");
+#else
+    return false;
+#endif
+  case KITRT_TARGET_HIP:
+#ifdef KITRT_HIP_ENABLED
+    return __kitrt_probe_devices("libamdhip64.so", "hipInit",
+                                 "hipGetDeviceCount");
+#else
+    return false;
+#endif
+  case KITRT_TARGET_HOST:
+    return true;
+  }
+  return false;
+}
+
+static const char *__kitrt_target_name(KitRTTarget target) {
+  switch (target) {
+  case KITRT_TARGET_CUDA:
+    return "cuda";
+  case KITRT_TARGET_HIP:
+    return "hip";
+  case KITRT_TARGET_HOST:
+    return "host";
+  }
+  return "unknown";
+}
+
+static KitRTTarget __kitrt_pick_target() {
+  // The target can be forced via the environment (e.g., to compare
+  // targets on a system with a GPU).
+  if (const char *name = __kitrt_get_config("KITRT_TARGET")) {
+    for (KitRTTarget target :
+         {KITRT_TARGET_CUDA, KITRT_TARGET_HIP, KITRT_TARGET_HOST}) {
+      if (strcasecmp(name, __kitrt_target_name(target)) != 0)
+        continue;
+      if (__kitrt_target_available(target))
+        return target;
+      fprintf(stderr, "kitrt: warning, KITRT_TARGET '%s' is not available "
+                      "on this system -- ignored.\n", name);
+      break;
+    }
+  }
+
+  // Otherwise prefer the GPUs.
+  for (KitRTTarget target : {KITRT_TARGET_CUDA, KITRT_TARGET_HIP})
+    if (__kitrt_target_available(target))
+      return target;
+  return KITRT_TARGET_HOST;
+}
+
+extern "C" {
+
+KitRTTarget __kitrt_select_target() {
+  static const KitRTTarget selected = [] {
+    KitRTTarget target = __kitrt_pick_target();
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitrt: selected target '%s'.\n",
+              __kitrt_target_name(target));
+    return target;
+  }();
+  return selected;
+}
+
+__attribute__((malloc)) void *__kitrt_multi_mem_alloc_managed(size_t size) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_alloc_managed(size);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_alloc_managed(size);
+#endif
+  default:
+    return __kitrt_default_mem_alloc(size);
+  }
+}
+
+void __kitrt_multi_mem_free(void *ptr) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_free(ptr);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_free(ptr);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_free(ptr);
+    return;
+  }
+}
+
+void *__kitrt_multi_mem_reserve(size_t max_bytes) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_reserve_managed(max_bytes);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_reserve_managed(max_bytes);
+#endif
+  default:
+    return __kitrt_default_mem_reserve(max_bytes);
+  }
+}
+
+void __kitrt_multi_mem_commit(void *base, size_t nbytes) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_commit_managed(base, nbytes);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_commit_managed(base, nbytes);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_commit(base, nbytes);
+    return;
+  }
+}
+
+void __kitrt_multi_mem_release(void *base, size_t max_bytes) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_release_managed(base, max_bytes);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_release_managed(base, max_bytes);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_release(base, max_bytes);
+    return;
+  }
+}
+
+void *__kitrt_multi_mem_map_file(const char *path, size_t *nbytes) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_map_file(path, nbytes);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_map_file(path, nbytes);
+#endif
+  default:
+    return __kitrt_default_mem_map_file(path, nbytes);
+  }
+}
+
+void __kitrt_multi_mem_unmap_file(void *ptr) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_unmap_file(ptr);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_unmap_file(ptr);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_unmap_file(ptr);
+    return;
+  }
+}
+
+void *__kitrt_multi_mem_alloc_pinned(size_t size) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_alloc_pinned(size);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_alloc_pinned(size);
+#endif
+  default:
+    return __kitrt_default_mem_alloc_pinned(size);
+  }
+}
+
+void __kitrt_multi_mem_free_pinned(void *ptr, void *opaque_stream) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_free_pinned(ptr, opaque_stream);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_free_pinned(ptr, opaque_stream);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_free_pinned(ptr, opaque_stream);
+    return;
+  }
+}
+
+void *__kitrt_multi_mem_alloc_device(size_t size) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_alloc_device(size);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_alloc_device(size);
+#endif
+  default:
+    return __kitrt_default_mem_alloc_device(size);
+  }
+}
+
+void __kitrt_multi_mem_free_device(void *ptr) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_free_device(ptr);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_free_device(ptr);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_free_device(ptr);
+    return;
+  }
+}
+
+bool __kitrt_multi_mem_on_device(void *ptr) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    return __kitcuda_mem_on_device(ptr);
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    return __kithip_mem_on_device(ptr);
+#endif
+  default:
+    return __kitrt_default_mem_on_device(ptr);
+  }
+}
+
+void __kitrt_multi_mem_mark_cold(void *ptr) {
+  switch (__kitrt_select_target()) {
+#ifdef KITRT_CUDA_ENABLED
+  case KITRT_TARGET_CUDA:
+    __kitcuda_mem_mark_cold(ptr);
+    return;
+#endif
+#ifdef KITRT_HIP_ENABLED
+  case KITRT_TARGET_HIP:
+    __kithip_mem_mark_cold(ptr);
+    return;
+#endif
+  default:
+    __kitrt_default_mem_mark_cold(ptr);
+    return;
+  }
+}
+
+} // extern "C"
@@ -0,0 +1,118 @@
+/*
+ *===- dylib_support.cpp - Level Zero dynamic symbol loading -------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+#include <cstdio>
+#define __KITRT_DISABLE_EXTERN_DECLS__
+#include "kitze.h"
+#include "kitze_dylib.h"
+
+static const char *ZE_DSO_LIBNAME = "libze_loader.so.1";
+
+bool __kitze_load_symbols() {
+
+  // NOTE: The handle variable below is named to support use of
+  // macros for each load call below -- changing the name will
+  // break things...
+  static void *kitrt_dl_handle = nullptr;
+  if (kitrt_dl_handle) {
+    fprintf(stderr, "kitze: warning - avoiding reloading of symbols...\n");
+    return true;
+  }
+
+  kitrt_dl_handle = dlopen(ZE_DSO_LIBNAME, RTLD_LAZY);
+  if (kitrt_dl_handle == NULL) {
+    fprintf(stderr, "kitze: unable to open '%s'!\n", ZE_DSO_LIBNAME);
+    fprintf(stderr, "  -- Make sure it can be found in your "
+                    "shared library path.\n");
+    return false; // this will force an abort() during runtime intialization
+  }
+
+  // NOTE: Try to keep the ordering and grouping here sync'ed
+  // with kitze_dylib.h.
+
+  /* Initialization and query related entry points */
+  DLSYM_LOAD(zeInit);
+  DLSYM_LOAD(zeDriverGet);
+  DLSYM_LOAD(zeDeviceGet);
+  DLSYM_LOAD(zeDeviceGetProperties);
+  DLSYM_LOAD(zeDeviceGetComputeProperties);
+  DLSYM_LOAD(zeDeviceGetCommandQueueGroupProperties);
+
+  /* Context management */
+  DLSYM_LOAD(zeContextCreate);
+  DLSYM_LOAD(zeContextDestroy);
+
+  /* Command list management */
+  DLSYM_LOAD(zeCommandListCreateImmediate);
+  DLSYM_LOAD(zeCommandListDestroy);
+  DLSYM_LOAD(zeCommandListHostSynchronize);
+  DLSYM_LOAD(zeCommandListAppendLaunchKernel);
+  DLSYM_LOAD(zeCommandListAppendMemoryPrefetch);
+  DLSYM_LOAD(zeCommandListAppendMemAdvise);
+
+  /* Module and kernel management */
+  DLSYM_LOAD(zeModuleCreate);
+  DLSYM_LOAD(zeModuleDestroy);
+  DLSYM_LOAD(zeModuleBuildLogGetString);
+  DLSYM_LOAD(zeModuleBuildLogDestroy);
+  DLSYM_LOAD(zeKernelCreate);
+  DLSYM_LOAD(zeKernelDestroy);
+  DLSYM_LOAD(zeKernelSetGroupSize);
+  DLSYM_LOAD(zeKernelSuggestGroupSize);
+  DLSYM_LOAD(zeKernelSetArgumentValue);
+  DLSYM_LOAD(zeKernelSetIndirectAccess);
+
+  /* Memory management */
+  DLSYM_LOAD(zeMemAllocShared);
+  DLSYM_LOAD(zeMemFree);
+
+  return true;
+}
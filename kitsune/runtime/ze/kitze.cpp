@@ -0,0 +1,217 @@
+/*
+ *===- kitze.cpp - Kitsune runtime Level Zero support --------------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "kitrt.h"
+#include "kitze.h"
+#include "kitze_dylib.h"
+#include "memory_map.h"
+
+// Some global state -- code outside this file should use the accesses
+// via the helper functions.
+bool _kitze_initialized = false;
+ze_driver_handle_t _kitze_driver = nullptr;
+ze_device_handle_t _kitze_device = nullptr;
+ze_context_handle_t _kitze_context = nullptr;
+uint32_t _kitze_compute_ordinal = 0;
+static ze_device_properties_t _kitze_device_props;
+static ze_device_compute_properties_t _kitze_compute_props;
+
+extern "C" {
+
+bool __kitze_initialize() {
+
+  if (_kitze_initialized) {
+    fprintf(stderr, "kitze: warning, multiple initialization calls!\n");
+    return true;
+  }
+
+  __kitrt_initialize();
+
+  if (not __kitze_load_symbols()) {
+    fprintf(stderr, "kitze: FATAL ERROR - "
+                    "unable to resolve dynamic symbols for Level Zero.\n");
+    fprintf(stderr, "kitze: aborting...\n");
+    __kitrt_print_stack_trace();
+    abort();
+  }
+
+  ZE_SAFE_CALL(zeInit_p(ZE_INIT_FLAG_GPU_ONLY));
+
+  // Use the first driver that exposes a GPU; the device id then
+  // selects among that driver's GPUs.
+  uint32_t driver_count = 0;
+  ZE_SAFE_CALL(zeDriverGet_p(&driver_count, nullptr));
+  std::vector<ze_driver_handle_t> drivers(driver_count);
+  if (driver_count > 0)
+    ZE_SAFE_CALL(zeDriverGet_p(&driver_count, drivers.data()));
+
+  std::vector<ze_device_handle_t> devices;
+  for (ze_driver_handle_t driver : drivers) {
+    uint32_t device_count = 0;
+    ZE_SAFE_CALL(zeDeviceGet_p(driver, &device_count, nullptr));
+    std::vector<ze_device_handle_t> all_devices(device_count);
+    ZE_SAFE_CALL(zeDeviceGet_p(driver, &device_count, all_devices.data()));
+    for (ze_device_handle_t device : all_devices) {
+      ze_device_properties_t props = {};
+      props.stype = ZE_STRUCTURE_TYPE_DEVICE_PROPERTIES;
+      ZE_SAFE_CALL(zeDeviceGetProperties_p(device, &props));
+      if (props.type == ZE_DEVICE_TYPE_GPU)
+        devices.push_back(device);
+    }
+    if (not devices.empty()) {
+      _kitze_driver = driver;
+      break;
+    }
+  }
+
+  if (devices.empty()) {
+    fprintf(stderr, "kitze: FATAL ERROR -- "
+                    "no suitable Level Zero devices found!\n");
+    fprintf(stderr, "kitze: aborting...\n");
+    __kitrt_print_stack_trace();
+    abort();
+  }
+
+  int device_id = 0;
+  (void)__kitrt_get_env_value("KITZE_DEVICE_ID", device_id);
+  assert(device_id >= 0 && (size_t)device_id < devices.size() &&
+         "kitze: KITZE_DEVICE_ID value exceeds available number"
+         " of devices.");
+  _kitze_device = devices[device_id];
+
+  _kitze_device_props = {};
+  _kitze_device_props.stype = ZE_STRUCTURE_TYPE_DEVICE_PROPERTIES;
+  ZE_SAFE_CALL(zeDeviceGetProperties_p(_kitze_device, &_kitze_device_props));
+  _kitze_compute_props = {};
+  _kitze_compute_props.stype = ZE_STRUCTURE_TYPE_DEVICE_COMPUTE_PROPERTIES;
+  ZE_SAFE_CALL(
+      zeDeviceGetComputeProperties_p(_kitze_device, &_kitze_compute_props));
+
+  // Command lists are created for the device's compute queue group.
+  uint32_t group_count = 0;
+  ZE_SAFE_CALL(zeDeviceGetCommandQueueGroupProperties_p(_kitze_device,
+                                                        &group_count, nullptr));
+  std::vector<ze_command_queue_group_properties_t> groups(group_count);
+  for (auto &group : groups) {
+    group = {};
+    group.stype = ZE_STRUCTURE_TYPE_COMMAND_QUEUE_GROUP_PROPERTIES;
+  }
+  ZE_SAFE_CALL(zeDeviceGetCommandQueueGroupProperties_p(
+      _kitze_device, &group_count, groups.data()));
+  bool found_compute = false;
+  for (uint32_t i = 0; i < group_count; i++) {
+    if (groups[i].flags & ZE_COMMAND_QUEUE_GROUP_PROPERTY_FLAG_COMPUTE) {
+      _kitze_compute_ordinal = i;
+      found_compute = true;
+      break;
+    }
+  }
+  if (not found_compute) {
+    fprintf(stderr, "kitze: FATAL ERROR -- "
+                    "device has no compute command queues!\n");
+    fprintf(stderr, "kitze: aborting...\n");
+    __kitrt_print_stack_trace();
+    abort();
+  }
+
+  ze_context_desc_t context_desc = {};
+  context_desc.stype = ZE_STRUCTURE_TYPE_CONTEXT_DESC;
+  ZE_SAFE_CALL(zeContextCreate_p(_kitze_driver, &context_desc, &_kitze_context));
+
+  _kitze_initialized = true;
+
+  if (__kitrt_verbose_mode()) {
+    fprintf(stderr, "kitze: found %zu devices.\n", devices.size());
+    fprintf(stderr, "       using device:         %d (%s)\n", device_id,
+            _kitze_device_props.name);
+    fprintf(stderr, "       max work-group size:  %u\n",
+            _kitze_compute_props.maxTotalGroupSize);
+    fprintf(stderr, "       max shared local mem: %u\n",
+            _kitze_compute_props.maxSharedLocalMemory);
+    fprintf(stderr, "       compute ordinal:      %u\n",
+            _kitze_compute_ordinal);
+  }
+
+  int threads_per_block = 0;
+  if (__kitrt_get_env_value("KITZE_THREADS_PER_BLOCK", threads_per_block)) {
+    if ((uint32_t)threads_per_block > _kitze_compute_props.maxTotalGroupSize)
+      threads_per_block = _kitze_compute_props.maxTotalGroupSize;
+    __kitze_set_default_threads_per_blk(threads_per_block);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitze: threads/block: %d\n", threads_per_block);
+  }
+
+  __kitze_create_mem_pool();
+
+  return _kitze_initialized;
+}
+
+void __kitze_destroy() {
+  if (not _kitze_initialized)
+    return;
+
+  __kitze_sync_context();
+  __kitze_destroy_thread_streams();
+  __kitze_destroy_modules();
+  __kitze_destroy_mem_pool();
+  __kitrt_destroy_memory_map(__kitze_mem_destroy);
+  ZE_SAFE_CALL(zeContextDestroy_p(_kitze_context));
+  _kitze_context = nullptr;
+  _kitze_initialized = false;
+}
+
+} // extern "C"
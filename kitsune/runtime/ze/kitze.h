@@ -0,0 +1,285 @@
+/*
+ *===- kitze.h - Level Zero runtime interface ----------------------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+#ifndef __KITZE_H_
+#define __KITZE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "kitrt.h"
+
+#include <level_zero/ze_api.h>
+
+#include "kitze_dylib.h" // IWYU pragma: keep
+
+#ifdef __cplusplus
+extern "C" {
+#else
+#include <stdbool.h>
+#endif
+
+/**
+ * Initialize the Level Zero portion of the Kitsune runtime library.
+ * Level Zero is the low-level interface to Intel GPUs (and other
+ * devices that consume SPIR-V kernels).  The initialization process
+ * will load the dynamic entry points of the Level Zero loader, select
+ * a GPU device and create the context used for all allocations and
+ * launches.  If initialization fails the call will return `false`;
+ * otherwise initialization was successful and `true` will be returned.
+ *
+ * - Multiple calls to the function will guard against
+ *   re-initialization if it was previously successful.
+ * - This call is not thread safe.
+ *
+ * There are a number of environment variables that can tweak the
+ * behavior of the runtime:
+ *
+ *    - **KITZE_THREADS_PER_BLOCK**: Number of work items per work
+ *      group of a kernel launch.  When unset the size suggested by
+ *      the driver for each kernel is used.  This is a global setting
+ *      and will apply to all kernel launches.
+ *
+ *    - **KITZE_DEVICE_ID**: Select a specific GPU device (of the
+ *      first driver that has one) to use.  The runtime currently only
+ *      supports a single GPU and this will default to the first GPU
+ *      in the system if left unset.
+ *
+ * Applications should call `__kitze_destroy()` at program exit.
+ **/
+extern bool __kitze_initialize();
+
+/**
+ * Free and release any resources used by the Kitsune Level Zero
+ * runtime component. This call should be made at program termination
+ * to clean up and release the device.
+ *
+ * This call is not thread safe.
+ */
+extern void __kitze_destroy();
+
+/**
+ * Allocate the given number of bytes of shared (unified shared memory)
+ * memory.  Shared allocations are accessible from both the host and
+ * the device and migrate between them on demand.  The allocation is
+ * tracked by the runtime so it can be prefetched ahead of the kernel
+ * launches that use it.
+ *
+ * @param num_bytes: The number of bytes to allocate.
+ *
+ * This call will return a pointer to the allocated memory on success
+ * (failures are fatal).
+ */
+extern __attribute__((malloc)) void *
+__kitze_mem_alloc_managed(size_t num_bytes);
+
+/**
+ * Allocate shared memory for `count` elements of `elemsize` bytes each
+ * and set it to zero (a la `calloc()`).  The memory is zeroed by the
+ * host and will be host resident upon return.
+ */
+extern __attribute__((malloc)) void *
+__kitze_mem_calloc_managed(size_t count, size_t elemsize);
+
+/**
+ * Free the given shared memory allocation.  The allocation must have
+ * been made with one of the runtime's allocation calls.
+ *
+ * @param ptr - A pointer to a previous Kitsune managed allocation.
+ */
+extern void __kitze_mem_free(void *ptr);
+
+/**
+ * Free only the Level Zero portion of the given allocation; the
+ * runtime's data structures will not be updated.  This is used by the
+ * runtime during cleanup at application exit.
+ *
+ * @param ptr - A pointer to a Level Zero memory allocation.
+ */
+extern void __kitze_mem_destroy(void *ptr);
+
+/**
+ * Create (and release) the runtime's shared memory pool.  When enabled
+ * (see `mem_pool.h` for the controlling environment variables) shared
+ * allocations are carved out of larger slabs and freed blocks are
+ * cached for reuse.  The pool is created as part of runtime
+ * initialization and must be released before the memory map is
+ * destroyed.
+ */
+extern void __kitze_create_mem_pool();
+extern void __kitze_destroy_mem_pool();
+
+/**
+ * Request that the shared allocation containing the given pointer be
+ * prefetched to device memory ahead of a kernel launch.  The prefetch
+ * is appended to the given command list (or to the calling thread's
+ * command list if null) and the list it was issued on is returned.
+ * Allocations that have already been prefetched, or that are not
+ * known to the runtime, are skipped and null is returned.
+ *
+ * @param ptr - The pointer to (or into) the allocated region.
+ * @param opaque_stream - The command list of the upcoming launch.
+ */
+extern void *__kitze_mem_gpu_prefetch(void *ptr, void *opaque_stream);
+
+/**
+ * Request that the shared allocation containing the given pointer be
+ * migrated back to the host.  The request is ordered behind the work
+ * previously appended to the given command list (or the calling
+ * thread's command list if null).
+ */
+extern void *__kitze_mem_host_prefetch(void *ptr, void *opaque_stream);
+
+/**
+ * Return the calling thread's execution "stream" -- an (in-order)
+ * immediate command list.  Command lists are created on demand and
+ * recycled once they have been synchronized.  Repeated calls return
+ * the same list until the thread synchronizes.
+ */
+extern void *__kitze_get_thread_stream();
+
+/**
+ * Wait for all work appended to the given command list (or the calling
+ * thread's current command list if null) to complete.  In our current
+ * model a synchronized list is done doing useful work and it is
+ * recycled for later use.
+ */
+extern void __kitze_sync_thread_stream(void *opaque_stream);
+
+/**
+ * Wait for the work on all of the command lists to complete.
+ */
+extern void __kitze_sync_context();
+
+/**
+ * Release all of the command lists created by the runtime.
+ */
+extern void __kitze_destroy_thread_streams();
+
+/**
+ * Launch the named kernel of the given SPIR-V image.  The modules
+ * created from images and the kernels created from them are cached by
+ * the runtime; `launch_handle` points to a per-kernel location the
+ * runtime uses to skip the lookups on subsequent launches.  Each of the
+ * `num_args` arguments is given by a pointer to its value and its size
+ * in bytes.  The kernel is appended to the given command list (or the
+ * calling thread's command list if it is null) and the list used is
+ * returned.  A `threads_per_blk` value of zero leaves the work-group
+ * size to the runtime.
+ */
+extern void *__kitze_launch_kernel(const void *image, uint64_t image_size,
+                                   const char *kernel_name, void **args,
+                                   const uint64_t *arg_sizes,
+                                   uint32_t num_args, uint64_t trip_count,
+                                   int threads_per_blk, void *opaque_stream,
+                                   void **launch_handle);
+
+/**
+ * Set the default number of work items per work group used for kernel
+ * launches.  A value of zero uses the size suggested by the driver.
+ */
+extern void __kitze_set_default_threads_per_blk(int threads_per_blk);
+
+/**
+ * Release the modules and kernels created for kernel launches.
+ */
+extern void __kitze_destroy_modules();
+
+/**
+ * Has the Level Zero portion of the Kitsune runtime been successfully
+ * initialized?
+ */
+inline bool __kitze_is_initialized() {
+  extern bool _kitze_initialized;
+  return _kitze_initialized;
+}
+
+/**
+ * Get the Level Zero context and device used by the runtime.  Note
+ * these calls will assert if the runtime is not initialized.
+ */
+inline ze_context_handle_t __kitze_get_context() {
+  extern ze_context_handle_t _kitze_context;
+  assert(__kitze_is_initialized() && "kitze: runtime not initialized!");
+  return _kitze_context;
+}
+
+inline ze_device_handle_t __kitze_get_device() {
+  extern ze_device_handle_t _kitze_device;
+  assert(__kitze_is_initialized() && "kitze: runtime not initialized!");
+  return _kitze_device;
+}
+
+/**
+ * Get the ordinal of the device's compute command queue group.
+ */
+inline uint32_t __kitze_get_compute_ordinal() {
+  extern uint32_t _kitze_compute_ordinal;
+  return _kitze_compute_ordinal;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#define ZE_SAFE_CALL(x)                                                        \
+  {                                                                            \
+    ze_result_t ze_result = x;                                                 \
+    if (ze_result != ZE_RESULT_SUCCESS) {                                      \
+      fprintf(stderr, "kitrt: %s:%d:\n", __FILE__, __LINE__);                  \
+      fprintf(stderr, "  %s failed (error: 0x%x)\n", #x,                       \
+              (unsigned)ze_result);                                            \
+      abort();                                                                 \
+    }                                                                          \
+  }
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ *===- launching.cpp - Level Zero kernel launch support ------------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+#include "kitze.h"
+#include "kitze_dylib.h"
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// The compiler embeds a SPIR-V image per module.  The runtime builds a
+// Level Zero module for each image the first time one of its kernels is
+// launched (JIT compiling the SPIR-V for the device) and keeps it for
+// the duration of the program.
+typedef std::unordered_map<const void *, ze_module_handle_t> KitZeModuleMap;
+static KitZeModuleMap _kitze_module_map;
+static std::mutex _kitze_module_map_mutex;
+
+// Everything the runtime needs to know about a kernel to launch it.
+// Descriptors are created on a kernel's first launch and live for the
+// duration of the program.  The compiler hands each launch a pointer to
+// a per-kernel handle that caches the descriptor so subsequent launches
+// skip the (name-keyed) lookup below entirely.  The arguments of a
+// Level Zero kernel are part of its state so launches of a kernel are
+// serialized by the descriptor's mutex.
+struct KitZeLaunchDesc {
+  const void *image;
+  std::string kernel_name;
+  ze_kernel_handle_t kernel;
+  std::mutex launch_mutex;
+  uint32_t group_size;          // work-group size of the last launch.
+  uint64_t group_size_trips;    // trip count the group size was picked for.
+};
+
+typedef std::map<std::pair<const void *, std::string>, KitZeLaunchDesc *>
+    KitZeLaunchDescMap;
+static KitZeLaunchDescMap _kitze_launch_descs;
+
+static int _kitze_default_threads_per_blk = 0;
+
+// NOTE: The caller must hold the module map lock.
+static ze_module_handle_t _kitze_get_module(const void *image,
+                                            uint64_t image_size) {
+  KitZeModuleMap::iterator modit = _kitze_module_map.find(image);
+  if (modit != _kitze_module_map.end())
+    return modit->second;
+
+  ze_module_desc_t module_desc = {};
+  module_desc.stype = ZE_STRUCTURE_TYPE_MODULE_DESC;
+  module_desc.format = ZE_MODULE_FORMAT_IL_SPIRV;
+  module_desc.inputSize = image_size;
+  module_desc.pInputModule = (const uint8_t *)image;
+  module_desc.pBuildFlags = "";
+  ze_module_handle_t module = nullptr;
+  ze_module_build_log_handle_t build_log = nullptr;
+  ze_result_t result = zeModuleCreate_p(__kitze_get_context(),
+                                        __kitze_get_device(), &module_desc,
+                                        &module, &build_log);
+  if (result != ZE_RESULT_SUCCESS) {
+    size_t log_size = 0;
+    ZE_SAFE_CALL(zeModuleBuildLogGetString_p(build_log, &log_size, nullptr));
+    std::string log(log_size, '\0');
+    ZE_SAFE_CALL(zeModuleBuildLogGetString_p(build_log, &log_size, &log[0]));
+    fprintf(stderr, "kitze: FATAL ERROR - unable to build module "
+                    "(error: 0x%x).\n", (unsigned)result);
+    fprintf(stderr, "%s\n", log.c_str());
+    abort();
+  }
+  ZE_SAFE_CALL(zeModuleBuildLogDestroy_p(build_log));
+  _kitze_module_map[image] = module;
+  return module;
+}
+
+static KitZeLaunchDesc *_kitze_get_launch_desc(void **handle,
+                                               const void *image,
+                                               uint64_t image_size,
+                                               const char *kernel_name) {
+  if (handle != nullptr) {
+    void *desc = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+    if (desc != nullptr)
+      return (KitZeLaunchDesc *)desc;
+  }
+
+  std::lock_guard<std::mutex> lock(_kitze_module_map_mutex);
+  KitZeLaunchDesc *&desc =
+      _kitze_launch_descs[std::make_pair(image, std::string(kernel_name))];
+  if (desc == nullptr) {
+    ze_module_handle_t module = _kitze_get_module(image, image_size);
+    desc = new KitZeLaunchDesc;
+    desc->image = image;
+    desc->kernel_name = kernel_name;
+    desc->group_size = 0;
+    desc->group_size_trips = 0;
+    ze_kernel_desc_t kernel_desc = {};
+    kernel_desc.stype = ZE_STRUCTURE_TYPE_KERNEL_DESC;
+    kernel_desc.pKernelName = kernel_name;
+    ZE_SAFE_CALL(zeKernelCreate_p(module, &kernel_desc, &desc->kernel));
+    // Kernel arguments may point to data structures that in turn hold
+    // pointers to shared allocations.
+    ZE_SAFE_CALL(zeKernelSetIndirectAccess_p(
+        desc->kernel, ZE_KERNEL_INDIRECT_ACCESS_FLAG_SHARED));
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitze: created launch descriptor for '%s'.\n",
+              kernel_name);
+  }
+  if (handle != nullptr)
+    __atomic_store_n(handle, (void *)desc, __ATOMIC_RELEASE);
+  return desc;
+}
+
+extern "C" {
+
+void __kitze_set_default_threads_per_blk(int threads_per_blk) {
+  _kitze_default_threads_per_blk = threads_per_blk;
+}
+
+void *__kitze_launch_kernel(const void *image, uint64_t image_size,
+                            const char *kernel_name, void **args,
+                            const uint64_t *arg_sizes, uint32_t num_args,
+                            uint64_t trip_count, int threads_per_blk,
+                            void *opaque_stream, void **launch_handle) {
+  assert(image && "kitze: launch with null image!");
+  assert(kernel_name && "kitze: launch with null name!");
+  assert((num_args == 0 || args) && "kitze: launch with null args!");
+  assert(trip_count != 0 && "kitze: launch with zero trips!");
+
+  KitZeLaunchDesc *desc =
+      _kitze_get_launch_desc(launch_handle, image, image_size, kernel_name);
+
+  ze_command_list_handle_t list = (ze_command_list_handle_t)opaque_stream;
+  if (list == nullptr)
+    list = (ze_command_list_handle_t)__kitze_get_thread_stream();
+
+  std::lock_guard<std::mutex> lock(desc->launch_mutex);
+
+  if (threads_per_blk == 0)
+    threads_per_blk = _kitze_default_threads_per_blk;
+  uint32_t group_size = threads_per_blk;
+  if (group_size == 0) {
+    // Ask the driver for a work-group size suited to the kernel.  The
+    // suggestion only depends on the trip count so it is reused while
+    // the trip count stays the same.
+    if (desc->group_size_trips == trip_count && desc->group_size != 0)
+      group_size = desc->group_size;
+    else {
+      uint32_t global_size =
+          trip_count > UINT32_MAX ? UINT32_MAX : (uint32_t)trip_count;
+      uint32_t group_y, group_z;
+      ZE_SAFE_CALL(zeKernelSuggestGroupSize_p(desc->kernel, global_size, 1, 1,
+                                              &group_size, &group_y,
+                                              &group_z));
+    }
+  }
+  if (group_size != desc->group_size) {
+    ZE_SAFE_CALL(zeKernelSetGroupSize_p(desc->kernel, group_size, 1, 1));
+    desc->group_size = group_size;
+  }
+  desc->group_size_trips = trip_count;
+
+  uint64_t group_count = (trip_count + group_size - 1) / group_size;
+  if (group_count > UINT32_MAX) {
+    fprintf(stderr,
+            "kitze: launch of kernel '%s' exceeds the group count limits "
+            "(trip count: %ld).\n",
+            kernel_name, trip_count);
+    abort();
+  }
+
+  for (uint32_t i = 0; i < num_args; i++)
+    ZE_SAFE_CALL(
+        zeKernelSetArgumentValue_p(desc->kernel, i, arg_sizes[i], args[i]));
+
+  if (__kitrt_verbose_mode()) {
+    fprintf(stderr, "kitze: '%s' launch parameters:\n", kernel_name);
+    fprintf(stderr, "  groups:     %ld, 1, 1\n", group_count);
+    fprintf(stderr, "  group size: %u, 1, 1\n", group_size);
+    fprintf(stderr, "  trip count: %ld\n", trip_count);
+  }
+
+  ze_group_count_t dispatch = {(uint32_t)group_count, 1, 1};
+  ZE_SAFE_CALL(zeCommandListAppendLaunchKernel_p(list, desc->kernel, &dispatch,
+                                                 nullptr, 0, nullptr));
+  return (void *)list;
+}
+
+void __kitze_destroy_modules() {
+  std::lock_guard<std::mutex> lock(_kitze_module_map_mutex);
+  for (auto &entry : _kitze_launch_descs) {
+    ZE_SAFE_CALL(zeKernelDestroy_p(entry.second->kernel));
+    delete entry.second;
+  }
+  _kitze_launch_descs.clear();
+  for (auto &entry : _kitze_module_map)
+    ZE_SAFE_CALL(zeModuleDestroy_p(entry.second));
+  _kitze_module_map.clear();
+}
+
+} // extern "C"
@@ -0,0 +1,192 @@
+/*
+ *===- memory.cpp - Level Zero memory management support -----------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+#include "kitze.h"
+#include "kitze_dylib.h"
+#include "mem_pool.h"
+#include "memory_map.h"
+#include <cstdio>
+#include <cstring>
+
+// Allocations are served from a size-class caching pool (see
+// mem_pool.h) when enabled.  This avoids a driver allocation for each
+// request and instead makes one per slab of shared memory.
+static KitRTMemPool *_kitze_mem_pool = nullptr;
+
+// Shared allocations are aligned to a (host) page so prefetches and
+// advice apply to whole pages.
+static const size_t KITZE_SHARED_ALLOC_ALIGNMENT = 4096;
+
+static void *_kitze_mem_alloc_slab(size_t size) {
+  ze_device_mem_alloc_desc_t device_desc = {};
+  device_desc.stype = ZE_STRUCTURE_TYPE_DEVICE_MEM_ALLOC_DESC;
+  ze_host_mem_alloc_desc_t host_desc = {};
+  host_desc.stype = ZE_STRUCTURE_TYPE_HOST_MEM_ALLOC_DESC;
+  void *alloced_ptr = nullptr;
+  ZE_SAFE_CALL(zeMemAllocShared_p(__kitze_get_context(), &device_desc,
+                                  &host_desc, size,
+                                  KITZE_SHARED_ALLOC_ALIGNMENT,
+                                  __kitze_get_device(), &alloced_ptr));
+  return alloced_ptr;
+}
+
+static void _kitze_mem_free_slab(void *vp) {
+  ZE_SAFE_CALL(zeMemFree_p(__kitze_get_context(), vp));
+}
+
+extern "C" {
+
+void __kitze_create_mem_pool() {
+  assert(_kitze_mem_pool == nullptr && "memory pool already created!");
+  _kitze_mem_pool = __kitrt_create_mem_pool("kitze", _kitze_mem_alloc_slab,
+                                            _kitze_mem_free_slab);
+}
+
+void __kitze_destroy_mem_pool() {
+  __kitrt_destroy_mem_pool(_kitze_mem_pool);
+  _kitze_mem_pool = nullptr;
+}
+
+__attribute__((malloc)) void *__kitze_mem_alloc_managed(size_t size) {
+  if (not __kitze_is_initialized())
+    __kitze_initialize();
+
+  void *alloced_ptr = __kitrt_mem_pool_alloc(_kitze_mem_pool, size);
+  if (alloced_ptr == nullptr)
+    alloced_ptr = _kitze_mem_alloc_slab(size);
+  __kitrt_register_mem_alloc(alloced_ptr, size);
+  return alloced_ptr;
+}
+
+__attribute__((malloc)) void *__kitze_mem_calloc_managed(size_t count,
+                                                         size_t element_size) {
+  assert(count != 0 && "zero-valued item count!");
+  assert(element_size != 0 && "zero-valued element size!");
+  size_t nbytes = count * element_size;
+  void *memp = __kitze_mem_alloc_managed(nbytes);
+  memset(memp, 0, nbytes);
+  return memp;
+}
+
+void __kitze_mem_free(void *vp) {
+  assert(vp && "unexpected null pointer!");
+  __kitrt_unregister_mem_alloc(vp);
+  if (not __kitrt_mem_pool_free(_kitze_mem_pool, vp))
+    _kitze_mem_free_slab(vp);
+}
+
+void __kitze_mem_destroy(void *vp) {
+  // This entry point is used to clean up only the Level Zero portions
+  // of an allocation -- it is used by the runtime at program exit.
+  _kitze_mem_free_slab(vp);
+}
+
+void *__kitze_mem_gpu_prefetch(void *vp, void *opaque_stream) {
+  assert(vp && "unexpected null pointer!");
+  size_t size = 0;
+  // The pointer may reference the interior of an allocation (e.g., a
+  // sub-array passed as a kernel argument).  Advice and prefetching
+  // are applied to the entire allocation that contains it.
+  void *base = vp;
+
+  // As with the other targets, an allocation is only prefetched the
+  // first time it is used by a kernel (or after it has been migrated
+  // back to the host).
+  if (__kitrt_is_mem_prefetched(vp, &size, &base) || size == 0) {
+    if (__kitrt_verbose_mode() && size > 0)
+      fprintf(stderr,
+              "\tkitze: skipping previously prefetched data "
+              "[address=%p, size=%ld].\n",
+              vp, size);
+    return nullptr;
+  }
+
+  ze_command_list_handle_t list = (ze_command_list_handle_t)opaque_stream;
+  if (list == nullptr)
+    list = (ze_command_list_handle_t)__kitze_get_thread_stream();
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "\tkitze: issue prefetch [address=%p, size=%ld, list=%p].\n", base,
+            size, (void *)list);
+  ZE_SAFE_CALL(zeCommandListAppendMemAdvise_p(
+      list, __kitze_get_device(), base, size,
+      ZE_MEMORY_ADVICE_SET_PREFERRED_LOCATION));
+  ZE_SAFE_CALL(zeCommandListAppendMemoryPrefetch_p(list, base, size));
+  __kitrt_mark_mem_prefetched(base);
+  return (void *)list;
+}
+
+void *__kitze_mem_host_prefetch(void *vp, void *opaque_stream) {
+  assert(vp && "unexpected null pointer!");
+  size_t size = 0;
+  void *base = vp;
+  if (not __kitrt_is_mem_prefetched(vp, &size, &base) || size == 0)
+    return nullptr;
+
+  // Level Zero prefetches only target the device.  Instead, move the
+  // allocation's preferred location to system memory so pages migrate
+  // back as the host touches them and a later launch prefetches the
+  // allocation again.
+  ze_command_list_handle_t list = (ze_command_list_handle_t)opaque_stream;
+  if (list == nullptr)
+    list = (ze_command_list_handle_t)__kitze_get_thread_stream();
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "\tkitze: issue host prefetch [address=%p, size=%ld, list=%p].\n",
+            base, size, (void *)list);
+  ZE_SAFE_CALL(zeCommandListAppendMemAdvise_p(
+      list, __kitze_get_device(), base, size,
+      ZE_MEMORY_ADVICE_SET_SYSTEM_MEMORY_PREFERRED_LOCATION));
+  __kitrt_mark_mem_needs_prefetch(base);
+  return (void *)list;
+}
+
+} // extern "C"
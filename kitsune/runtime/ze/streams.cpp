@@ -0,0 +1,166 @@
+/*
+ *===- streams.cpp - Level Zero command list support ---------------------===
+ *
+ * Copyright (c) 2021, 2023 Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ * Copyright 2021, 2023. Los Alamos National Security, LLC. This
+ * software was produced under U.S. Government contract DE-AC52-06NA25396
+ * for Los Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *===----------------------------------------------------------------------===
+ */
+#include "kitze.h"
+#include "kitze_dylib.h"
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Streams in the Level Zero runtime are immediate command lists: work
+// appended to them is submitted to the device right away (without a
+// separate command queue and list close/execute steps) and executes in
+// order.  Creating a command list is expensive so, like the other
+// targets, we "recycle" them.  Each thread holds on to a list from the
+// pool until it synchronizes it, so back-to-back launches from a thread
+// are ordered on a single list, and a thread's list is returned to the
+// pool when the thread exits.
+typedef std::deque<ze_command_list_handle_t> KitZeCommandListPool;
+static KitZeCommandListPool _kitze_free_lists;
+static std::vector<ze_command_list_handle_t> _kitze_all_lists;
+static std::mutex _kitze_list_mutex;
+
+namespace {
+
+struct KitZeThreadList {
+  ze_command_list_handle_t list = nullptr;
+  ~KitZeThreadList();
+};
+
+thread_local KitZeThreadList _kitze_thread_list;
+
+void _kitze_recycle_list(ze_command_list_handle_t list) {
+  std::lock_guard<std::mutex> lock(_kitze_list_mutex);
+  _kitze_free_lists.push_back(list);
+  if (__kitrt_verbose_mode())
+    fprintf(stderr,
+            "kitze: recycling command list [list=%p, poolsize=%zu].\n",
+            (void *)list, _kitze_free_lists.size());
+}
+
+KitZeThreadList::~KitZeThreadList() {
+  if (list != nullptr && __kitze_is_initialized()) {
+    ZE_SAFE_CALL(zeCommandListHostSynchronize_p(list, UINT64_MAX));
+    _kitze_recycle_list(list);
+  }
+}
+
+} // namespace
+
+extern "C" {
+
+void *__kitze_get_thread_stream() {
+  if (_kitze_thread_list.list != nullptr)
+    return (void *)_kitze_thread_list.list;
+
+  ze_command_list_handle_t list = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_kitze_list_mutex);
+    if (not _kitze_free_lists.empty()) {
+      list = _kitze_free_lists.front();
+      _kitze_free_lists.pop_front();
+    }
+  }
+
+  if (list == nullptr) {
+    ze_command_queue_desc_t queue_desc = {};
+    queue_desc.stype = ZE_STRUCTURE_TYPE_COMMAND_QUEUE_DESC;
+    queue_desc.ordinal = __kitze_get_compute_ordinal();
+    queue_desc.index = 0;
+    queue_desc.mode = ZE_COMMAND_QUEUE_MODE_ASYNCHRONOUS;
+    queue_desc.priority = ZE_COMMAND_QUEUE_PRIORITY_NORMAL;
+    ZE_SAFE_CALL(zeCommandListCreateImmediate_p(
+        __kitze_get_context(), __kitze_get_device(), &queue_desc, &list));
+    std::lock_guard<std::mutex> lock(_kitze_list_mutex);
+    _kitze_all_lists.push_back(list);
+    if (__kitrt_verbose_mode())
+      fprintf(stderr, "kitze: created command list [list=%p, total=%zu].\n",
+              (void *)list, _kitze_all_lists.size());
+  } else if (__kitrt_verbose_mode())
+    fprintf(stderr, "kitze: using recycled command list [list=%p].\n",
+            (void *)list);
+
+  _kitze_thread_list.list = list;
+  return (void *)list;
+}
+
+void __kitze_sync_thread_stream(void *opaque_stream) {
+  ze_command_list_handle_t list = (ze_command_list_handle_t)opaque_stream;
+  if (list == nullptr)
+    list = _kitze_thread_list.list;
+  // Nothing has been issued by this thread since its last sync.
+  if (list == nullptr)
+    return;
+
+  ZE_SAFE_CALL(zeCommandListHostSynchronize_p(list, UINT64_MAX));
+  if (list == _kitze_thread_list.list) {
+    _kitze_thread_list.list = nullptr;
+    _kitze_recycle_list(list);
+  }
+}
+
+void __kitze_sync_context() {
+  std::lock_guard<std::mutex> lock(_kitze_list_mutex);
+  for (ze_command_list_handle_t list : _kitze_all_lists)
+    ZE_SAFE_CALL(zeCommandListHostSynchronize_p(list, UINT64_MAX));
+}
+
+void __kitze_destroy_thread_streams() {
+  std::lock_guard<std::mutex> lock(_kitze_list_mutex);
+  for (ze_command_list_handle_t list : _kitze_all_lists)
+    ZE_SAFE_CALL(zeCommandListDestroy_p(list));
+  _kitze_all_lists.clear();
+  _kitze_free_lists.clear();
+  _kitze_thread_list.list = nullptr;
+}
+
+} // extern "C"
@@ -0,0 +1,25 @@
+// RUN: %kitxx -Xclang -verify -fsyntax-only %s
+
+#include <kitsune.h>
+
+int main(int argc, char *argv[]) {
+  [[kitsune::async]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{'async' attribute takes no arguments}}
+  [[kitsune::async(1)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{'async' attribute only applies to 'forall' statement}}
+  [[kitsune::async]]
+  spawn s {}
+
+  // expected-error@+1 {{'async' attribute only applies to 'forall' statement}}
+  [[kitsune::async]]
+  if (argc == 1) {
+    forall(int i = 0; i < 1024; ++i) { }
+  }
+
+  sync s;
+  return 0;
+}
@@ -10,14 +10,28 @@ int main(int argc, char *argv[]) {
   [[kitsune::launch(-1)]]
   forall(int i = 0; i < 1024; ++i) { }
 
-  // expected-error@+1 {{'launch' attribute takes one argument}}
+  // expected-error@+1 {{'launch' attribute takes at least 1 argument}}
   [[kitsune::launch()]]
   forall(int i = 0; i < 1024; ++i) { }
 
-  // expected-error@+1 {{'launch' attribute takes one argument}}
   [[kitsune::launch(32, 64)]]
   forall(int i = 0; i < 1024; ++i) { }
 
+  [[kitsune::launch(256, 0, 2, 4096, 4)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{'launch' attribute takes no more than 5 arguments}}
+  [[kitsune::launch(256, 0, 2, 4096, 4, 1)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{launch attribute: min-blocks-per-multiprocessor must be a non-negative integer value}}
+  [[kitsune::launch(256, 0, -2)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{launch attribute: iterations-per-thread must be a built-in integer type}}
+  [[kitsune::launch(256, 0, 0, 0, 1.5)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
   // expected-error@+1 {{launch attribute: threads-per-block must be a built-in integer type}}
   [[kitsune::launch(1 + 2.3)]]
   forall(int i = 0; i < 1024; ++i) { }
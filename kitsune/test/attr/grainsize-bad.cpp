@@ -0,0 +1,39 @@
+// RUN: %kitxx -Xclang -verify -fsyntax-only %s
+
+#include <kitsune.h>
+
+long fib([[tapir::grainsize(20)]] int n) {
+  if (n < 2)
+    return n;
+  long x, y;
+  spawn f { x = fib(n - 1); }
+  y = fib(n - 2);
+  sync f;
+  return x + y;
+}
+
+void scale(float *a, [[tapir::grainsize(4096)]] unsigned long n) {
+  if (n <= 1) {
+    if (n)
+      a[0] *= 2.0f;
+    return;
+  }
+  spawn lo { scale(a, n / 2); }
+  scale(a + n / 2, n - n / 2);
+  sync lo;
+}
+
+// expected-error@+1 {{grainsize attribute: parameter of type 'float *' is not an integer}}
+void clear([[tapir::grainsize(64)]] float *a, int n);
+
+// expected-error@+1 {{grainsize attribute requires a positive value}}
+void zero(float *a, [[tapir::grainsize(0)]] int n);
+
+// expected-error@+1 {{'grainsize' attribute only applies to parameters}}
+[[tapir::grainsize(8)]] int depth;
+
+int main(int argc, char *argv[]) {
+  float *a = new float[1 << 20];
+  scale(a, 1 << 20);
+  return fib(30) > 0 ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+// RUN: %kitxx -Xclang -verify -fsyntax-only %s
+
+#include <kitsune.h>
+
+int main(int argc, char *argv[]) {
+  [[kitsune::priority(high)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[kitsune::priority(low)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[kitsune::priority("normal")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{unknown priority 'urgent'; expected 'high', 'normal' or 'low'}}
+  [[kitsune::priority(urgent)]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{'priority' attribute takes one argument}}
+  [[kitsune::priority]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  // expected-error@+1 {{'priority' attribute only applies to 'forall' statement}}
+  [[kitsune::priority(high)]]
+  spawn s {}
+
+  sync s;
+  return 0;
+}
@@ -0,0 +1,26 @@
+// RUN: %kitxx -Xclang -verify -fsyntax-only %s
+
+#include <kitsune.h>
+
+struct [[kitsune::soa]] Particle {
+  float x, y, z;
+  float mass;
+};
+
+// expected-error@+1 {{'soa' attribute takes no arguments}}
+struct [[kitsune::soa(1)]] Cell {
+  double rho;
+  double e;
+};
+
+// expected-error@+1 {{'soa' attribute only applies to structs, unions, and classes}}
+[[kitsune::soa]] int count;
+
+int main(int argc, char *argv[]) {
+  Particle *p = alloc<Particle>(1024);
+  forall(int i = 0; i < 1024; ++i) {
+    p[i].x += p[i].mass;
+  }
+  dealloc(p);
+  return 0;
+}
@@ -0,0 +1,53 @@
+// FIXME: This requires the cuda tapir target to be enabled. This test should
+// have a guard that will check for that
+
+// RUN: %kitxx -Xclang -verify -fsyntax-only -ftapir=cuda %s
+
+#include <kitsune.h>
+
+enum class Mode { Fast, Exact };
+
+template <typename T>
+void scale(T *a, int n, T k) {
+  [[kitsune::specialize(n, k)]]
+  forall(int i = 0; i < n; ++i)
+    a[i] *= k;
+}
+
+template <typename T>
+void fill(int *a, int n, T v) {
+  // expected-error@+1 {{specialize attribute: argument of type 'int *' is not an integer, enumeration or floating-point scalar}}
+  [[kitsune::specialize(v)]]
+  forall(int i = 0; i < n; ++i)
+    a[i] = 0;
+}
+
+int main(int argc, char *argv[]) {
+  int n = 1024;
+  float k = 0.5f;
+  Mode mode = Mode::Fast;
+  float *a = new float[n];
+  int *b = new int[n];
+
+  [[kitsune::specialize(n, k, mode)]]
+  forall(int i = 0; i < n; ++i)
+    a[i] = mode == Mode::Fast ? k * i : k / (i + 1);
+
+  scale(a, n, 2.0f);
+  fill(b, n, 0);
+  fill(b, n, b); // expected-note {{in instantiation of function template specialization 'fill<int *>' requested here}}
+
+  // expected-error@+1 {{specialize attribute requires at least one argument}}
+  [[kitsune::specialize()]]
+  forall(int i = 0; i < n; ++i) { }
+
+  // expected-error@+1 {{specialize attribute: argument of type 'float *' is not an integer, enumeration or floating-point scalar}}
+  [[kitsune::specialize(n, a)]]
+  forall(int i = 0; i < n; ++i) { }
+
+  // expected-error@+1 {{'specialize' attribute only applies to 'forall' statement}}
+  [[kitsune::specialize(n)]]
+  for (int i = 0; i < n; ++i) { }
+
+  return 0;
+}
@@ -6,6 +6,15 @@ int main(int argc, char *argv[]) {
   [[tapir::strategy("greedy")]] // expected-error {{unknown strategy}}
   forall(int i = 0; i < 1024; ++i) { }
 
+  [[tapir::strategy("static(4)")]] // expected-error {{strategy chunk size must be a positive integer}}
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("dynamic(0)")]] // expected-error {{strategy chunk size must be a positive integer}}
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("guided(n)")]] // expected-error {{strategy chunk size must be a positive integer}}
+  forall(int i = 0; i < 1024; ++i) { }
+
   [[tapir::strategy(seq)]] // expected-error {{'strategy' attribute requires a string}}
   forall(int i = 0; i < 1024; ++i) { }
 
@@ -16,6 +16,21 @@ int main(int argc, char *argv[]) {
   [[tapir::strategy("dac")]]
   forall(int i = 0; i < 1024; ++i) { }
 
+  [[tapir::strategy("static")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("dynamic")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("dynamic(64)")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("guided")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
+  [[tapir::strategy("guided(8)")]]
+  forall(int i = 0; i < 1024; ++i) { }
+
   return 0;
 }
 
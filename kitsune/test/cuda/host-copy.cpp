@@ -0,0 +1,37 @@
+// The host copies of GPU loops (hybrid loops and the host fallback of
+// loops with small trip counts) must use the host's globals and math
+// functions, not the kernel's _devvar globals and libdevice functions.
+//
+// RUN: %kitxx -ftapir=cuda -O1 -S -emit-llvm -o - %s | FileCheck %s
+
+#include <kitsune.h>
+#include <math.h>
+
+const double scale[4] = {1.0, 2.0, 3.0, 4.0};
+
+void fallback(double *a, int n) {
+  forall(int i = 0; i < n; ++i)
+    a[i] = scale[i & 3] * sin(a[i]);
+}
+
+void hybrid(double *a, int n) {
+  [[tapir::target("cuda+opencilk")]]
+  forall(int i = 0; i < n; ++i)
+    a[i] = scale[i & 3] * sin(a[i]);
+}
+
+// CHECK-LABEL: define internal fastcc void @_Z8fallbackPdi{{.*}}.serial(
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: @_ZL5scale
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: call {{.*}}double @sin(
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: {{^}}}
+
+// CHECK-LABEL: define internal fastcc void @_Z6hybridPdi{{.*}}.serial(
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: @_ZL5scale
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: call {{.*}}double @sin(
+// CHECK-NOT: {{_devvar|@__nv_}}
+// CHECK: {{^}}}
@@ -0,0 +1,30 @@
+// RUN: %kitxx -ftapir=none -S -emit-llvm -o - %s | FileCheck %s
+
+#include <kitsune.h>
+
+long sum(const long* a, int n) {
+  long s = 0;
+  // Reductions are relaxed atomic updates of the reduction variable.
+  forall(int i = 0; i < n; i++) {
+    kitsune_reduce_add(s, a[i]);
+  }
+  return s;
+}
+
+int maximum(const int* a, int n) {
+  int m = 0;
+  forall(int i = 0; i < n; i++) {
+    kitsune_reduce_max(m, a[i]);
+  }
+  return m;
+}
+
+// CHECK-LABEL: define {{.*}}sum
+// CHECK: detach within %[[SYNCREG:.+]], label {{.+}}, label {{.+}}
+// CHECK: atomicrmw add ptr %{{.+}}, i64 %{{.+}} monotonic
+// CHECK: reattach within %[[SYNCREG]]
+
+// CHECK-LABEL: define {{.*}}maximum
+// CHECK: detach within %[[SYNCREG:.+]], label {{.+}}, label {{.+}}
+// CHECK: atomicrmw max ptr %{{.+}}, i32 %{{.+}} monotonic
+// CHECK: reattach within %[[SYNCREG]]
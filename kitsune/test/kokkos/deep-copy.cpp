@@ -0,0 +1,61 @@
+// REQUIRES: kitsune-kokkos
+// RUN: %kitxx -fkokkos -fkokkos-no-init -ftapir=none -fno-discard-value-names -S -emit-llvm -o - %s | FileCheck %s
+
+// Simple test of deep_copy and fence, which are emitted as parallel
+// copy and fill loops and a sync of the function (falling back to the
+// library's deep_copy for Views that are not contiguous).
+#include <cstdio>
+#include <Kokkos_Core.hpp>
+
+const unsigned int N = 1024;
+
+int main (int argc, char* argv[]) {
+
+  Kokkos::initialize (argc, argv);
+
+  {
+    Kokkos::View<float*> a("a", N);
+    Kokkos::View<float*> b("b", N);
+    Kokkos::View<float**> m("m", N, 4);
+    auto column = Kokkos::subview(m, Kokkos::ALL(), 1);
+
+    Kokkos::deep_copy(a, 2.0f);
+    Kokkos::parallel_for(N, KOKKOS_LAMBDA(const int i) {
+	a(i) += (float)i;
+      });
+    Kokkos::fence();
+    Kokkos::deep_copy(b, a);
+    Kokkos::deep_copy(column, b);
+
+    size_t errors = 0;
+    for (unsigned int i = 0; i < N; i++)
+      if (b(i) != 2.0f + i || m(i, 1) != b(i))
+	errors++;
+    printf("%zu errors\n", errors);
+  }
+
+  Kokkos::finalize ();
+  return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @main(
+// A fill of a contiguous View is a parallel loop; the library copies the
+// others.
+// CHECK: br i1 %{{.+}}, label %kokkos.deep_copy.loop, label %kokkos.deep_copy.library
+// CHECK: kokkos.deep_copy.library:
+// CHECK: {{call|invoke}} {{.*}}@_ZN6Kokkos9deep_copy
+// CHECK: kokkos.deep_copy.loop:
+// CHECK: detach within %[[SR:.+]], label %kokkos.deep_copy.body,
+// CHECK: kokkos.deep_copy.body:
+// CHECK: store float 2.000000e+00, ptr %{{.+}}
+// CHECK: sync within %[[SR]]
+// The fence is a sync of the function.
+// CHECK: detach within %{{.+}}, label %kokkos.body,
+// CHECK: sync within %{{.+}}, label %kokkos.fence.continue
+// A copy between contiguous Views is a parallel loop too.
+// CHECK: detach within %{{.+}}, label %kokkos.deep_copy.body{{[0-9]+}},
+// CHECK: kokkos.deep_copy.body{{[0-9]+}}:
+// CHECK: load float
+// CHECK: store float
+// The copy into the (strided) column of m is left to the library.
+// CHECK: {{call|invoke}} {{.*}}@_ZN6Kokkos9deep_copy
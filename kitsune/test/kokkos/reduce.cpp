@@ -0,0 +1,50 @@
+// REQUIRES: kitsune-kokkos
+// RUN: %kitxx -fkokkos -fkokkos-no-init -ftapir=none -fno-discard-value-names -S -emit-llvm -o - %s | FileCheck %s
+
+// Simple test of the parallel_reduce forms that are transformed
+// into loops (with plain values and the built-in reducers).
+#include <cstdio>
+#include <Kokkos_Core.hpp>
+
+const unsigned int NTIMES = 1024;
+
+int main (int argc, char* argv[]) {
+
+  Kokkos::initialize (argc, argv);
+
+  {
+    long sum = 0;
+    Kokkos::parallel_reduce(NTIMES, KOKKOS_LAMBDA(const int i, long &s) {
+	s += i;
+      }, sum);
+    printf("sum = %ld\n", sum);
+
+    double maxval = 0.0;
+    Kokkos::parallel_reduce("max", NTIMES,
+      KOKKOS_LAMBDA(const int i, double &m) {
+	double v = (double)(i % 37);
+	if (v > m)
+	  m = v;
+      }, Kokkos::Max<double>(maxval));
+    printf("max = %f\n", maxval);
+  }
+
+  Kokkos::finalize ();
+  return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @main(
+// Each iteration atomically combines its private value with the result,
+// which starts at the identity of the reduction.
+// CHECK: store i64 0, ptr %sum
+// CHECK: detach within %[[SR:.+]], label %kokkos.body, label %kokkos.forall.inc
+// CHECK: kokkos.body:
+// CHECK: %kokkos.reduce.priv = alloca i64
+// CHECK: atomicrmw add ptr %sum, i64 %{{.+}} monotonic
+// CHECK: reattach within %[[SR]]
+// CHECK: sync within %[[SR]]
+// CHECK: store double 0xFFEFFFFFFFFFFFFF, ptr %maxval
+// CHECK: detach within %{{.+}}, label %kokkos.body{{[0-9]+}},
+// CHECK: %kokkos.reduce.priv{{[0-9]+}} = alloca double
+// CHECK: atomicrmw fmax ptr %maxval, double %{{.+}} monotonic
+// CHECK: sync within
@@ -0,0 +1,55 @@
+// REQUIRES: kitsune-kokkos
+// RUN: %kitxx -fkokkos -fkokkos-no-init -ftapir=none -fno-discard-value-names -S -emit-llvm -o - %s | FileCheck %s
+
+// Simple test of the parallel_scan forms that are transformed into a
+// blocked two-pass parallel prefix sum.
+#include <cstdio>
+#include <Kokkos_Core.hpp>
+
+const unsigned int N = 1 << 20;
+
+int main (int argc, char* argv[]) {
+
+  Kokkos::initialize (argc, argv);
+
+  {
+    Kokkos::View<long*> in("in", N), out("out", N);
+    Kokkos::parallel_for(N, KOKKOS_LAMBDA(const int i) {
+	in(i) = i % 7;
+      });
+
+    long total = 0;
+    Kokkos::parallel_scan("prefix", N,
+      KOKKOS_LAMBDA(const int i, long &update, const bool final) {
+	if (final)
+	  out(i) = update;
+	update += in(i);
+      }, total);
+
+    long check = 0;
+    for (unsigned int i = 0; i < N; i++) {
+      if (out(i) != check) {
+	printf("error at %u: %ld != %ld\n", i, out(i), check);
+	return 1;
+      }
+      check += in(i);
+    }
+    printf("total = %ld (expected %ld)\n", total, check);
+  }
+
+  Kokkos::finalize ();
+  return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @main(
+// CHECK: %kokkos.scan.partials = call {{.*}}ptr @malloc(
+// The first pass sums each block...
+// CHECK: detach within %[[SR:.+]], label %kokkos.scan.body,
+// CHECK: sync within %[[SR]]
+// ...the offsets of the blocks are a serial scan of their sums...
+// CHECK: kokkos.scan.offsets.body:
+// ...and the final pass scans each block again from its offset.
+// CHECK: detach within %[[SR2:.+]], label %kokkos.scan.body{{[0-9]+}},
+// CHECK: sync within %[[SR2]]
+// CHECK: store i64 %{{.+}}, ptr %total
+// CHECK: call void @free(ptr {{.*}}%kokkos.scan.partials)
@@ -0,0 +1,59 @@
+// REQUIRES: kitsune-kokkos
+// RUN: %kitxx -fkokkos -fkokkos-no-init -ftapir=none -fno-discard-value-names -S -emit-llvm -o - %s | FileCheck %s
+
+// Simple test of the TeamPolicy forms that are transformed into
+// nested loops: a parallel loop over the league with thread and
+// vector ranges in the body of each team.
+#include <cstdio>
+#include <Kokkos_Core.hpp>
+
+const unsigned int NTEAMS = 64;
+const unsigned int NROWS = 32;
+const unsigned int NCOLS = 16;
+
+typedef Kokkos::TeamPolicy<>::member_type member_type;
+
+int main (int argc, char* argv[]) {
+
+  Kokkos::initialize (argc, argv);
+
+  {
+    Kokkos::View<float***> a("a", NTEAMS, NROWS, NCOLS);
+    Kokkos::parallel_for(Kokkos::TeamPolicy<>(NTEAMS, Kokkos::AUTO),
+      KOKKOS_LAMBDA(const member_type &team) {
+	const int t = team.league_rank();
+	Kokkos::parallel_for(Kokkos::TeamThreadRange(team, NROWS),
+	  [&](const int i) {
+	    Kokkos::parallel_for(Kokkos::ThreadVectorRange(team, NCOLS),
+	      [&](const int j) {
+		a(t, i, j) = t + i + j;
+	      });
+	  });
+	team.team_barrier();
+      });
+
+    long sum = 0;
+    Kokkos::parallel_reduce(Kokkos::TeamPolicy<>(NTEAMS, Kokkos::AUTO),
+      KOKKOS_LAMBDA(const member_type &team, long &s) {
+	s += team.league_rank();
+      }, sum);
+    printf("sum = %ld\n", sum);
+  }
+
+  Kokkos::finalize ();
+  return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @main(
+// The league is a parallel loop with the thread and vector ranges of
+// each team nested in its body.  The barrier is dropped, as the nested
+// loops sync before they return.
+// CHECK: %kokkos.league.rank = alloca i64
+// CHECK: detach within %[[SR:.+]], label %kokkos.body,
+// CHECK: detach within %{{.+}}, label %kokkos.body{{[0-9]+}},
+// CHECK: detach within %{{.+}}, label %kokkos.body{{[0-9]+}},
+// CHECK-NOT: team_barrier
+// CHECK: sync within %[[SR]]
+// CHECK: detach within %{{.+}}, label %kokkos.body{{[0-9]+}},
+// CHECK: atomicrmw add ptr %sum, i64 %{{.+}} monotonic
+// CHECK: sync within
@@ -0,0 +1,54 @@
+// REQUIRES: kitsune-kokkos
+// RUN: %kitxx -fkokkos -fkokkos-no-init -ftapir=none -fno-discard-value-names -S -emit-llvm -o - %s | FileCheck %s
+
+// Simple test of View accesses in parallel_for bodies, which are
+// emitted as arithmetic on the data pointer and strides of the View
+// (for both LayoutRight and LayoutLeft views).
+#include <cstdio>
+#include <Kokkos_Core.hpp>
+
+const unsigned int N = 64;
+const unsigned int M = 32;
+
+int main (int argc, char* argv[]) {
+
+  Kokkos::initialize (argc, argv);
+
+  {
+    Kokkos::View<float*> a("a", N);
+    Kokkos::View<float**, Kokkos::LayoutRight> r("r", N, M);
+    Kokkos::View<float**, Kokkos::LayoutLeft> l("l", N, M);
+
+    Kokkos::parallel_for(N, KOKKOS_LAMBDA(const int i) {
+	a(i) = (float)i;
+	for (unsigned int j = 0; j < M; j++) {
+	  r(i, j) = a(i) + j;
+	  l(i, j) = r(i, j);
+	}
+      });
+
+    size_t errors = 0;
+    for (unsigned int i = 0; i < N; i++)
+      for (unsigned int j = 0; j < M; j++)
+	if (l(i, j) != (float)(i + j))
+	  errors++;
+    printf("%zu errors\n", errors);
+  }
+
+  Kokkos::finalize ();
+  return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @main(
+// The strides of the LayoutRight and LayoutLeft Views that are not one
+// are computed before the loop...
+// CHECK: %kokkos.view.stride = sdiv exact i64
+// CHECK: %kokkos.view.stride{{[0-9]+}} = sdiv exact i64
+// CHECK: detach within %[[SR:.+]], label %kokkos.body,
+// ...and the body's accesses do not call the View's operator().
+// CHECK: kokkos.body:
+// CHECK-NOT: {{call|invoke}} {{.*}}@_ZNK6Kokkos4View
+// CHECK: %kokkos.view.elt = getelementptr inbounds float, ptr %{{.+}}, i64 %{{.+}}
+// CHECK-NOT: {{call|invoke}} {{.*}}@_ZNK6Kokkos4View
+// CHECK: reattach within %[[SR]]
+// CHECK: sync within %[[SR]]
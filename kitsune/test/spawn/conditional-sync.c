@@ -0,0 +1,38 @@
+// RUN: %kitcc -ftapir=none -O1 -S -emit-llvm -o - %s | FileCheck %s
+
+#include <kitsune.h>
+
+void bar(int);
+void foo(int);
+
+void conditional(int c) {
+  if (c) {
+    spawn s { bar(1); }
+    foo(2);
+    sync s;
+    foo(3);
+    return;
+  }
+  foo(4);
+  sync s;
+  foo(5);
+}
+
+// The sync after the spawn must stay. No task of its sync region reaches the
+// sync on the path where the spawn is not taken, so TaskSimplify removes it.
+//
+// CHECK-LABEL: define {{.*}}void @conditional(
+// CHECK:   %[[s:.+]] = {{.*}}call token @llvm.syncregion.start()
+// CHECK:   detach within %[[s]], label %[[DETACH:.+]], label %[[CONT:.+]]
+//
+// CHECK: [[DETACH]]:
+// CHECK:   call void @bar({{.+}} 1)
+// CHECK:   reattach within %[[s]], label %[[CONT]]
+//
+// CHECK: [[CONT]]:
+// CHECK:   call void @foo({{.+}} 2)
+// CHECK-NEXT:   sync within %[[s]]
+//
+// CHECK:   call void @foo({{.+}} 4)
+// CHECK-NOT:   sync within
+// CHECK:   call void @foo({{.+}} 5)
@@ -0,0 +1,253 @@
+// -*- C++ -*-
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _LIBCPP___ALGORITHM_PSTL_BACKENDS_CPU_BACKENDS_TAPIR_H
+#define _LIBCPP___ALGORITHM_PSTL_BACKENDS_CPU_BACKENDS_TAPIR_H
+
+#include <__algorithm/inplace_merge.h>
+#include <__algorithm/lower_bound.h>
+#include <__algorithm/min.h>
+#include <__algorithm/upper_bound.h>
+#include <__config>
+#include <__iterator/iterator_traits.h>
+#include <__memory/allocator.h>
+#include <__memory/construct_at.h>
+#include <__utility/empty.h>
+#include <__utility/move.h>
+#include <cstddef>
+#include <optional>
+
+#if !defined(_LIBCPP_HAS_NO_PRAGMA_SYSTEM_HEADER)
+#  pragma GCC system_header
+#endif
+
+_LIBCPP_PUSH_MACROS
+#include <__undef_macros>
+
+#if !defined(_LIBCPP_HAS_NO_INCOMPLETE_PSTL) && _LIBCPP_STD_VER >= 17
+
+// The Tapir backend expresses the parallel primitives with Kitsune's forall
+// loops and spawns, so the Tapir lowering chosen with -ftapir decides how they
+// run: on the OpenCilk (or another CPU) runtime, or -- for the loops -- as
+// GPU kernels with -ftapir=cuda/hip.  Loops over single elements leave the
+// grain size to the lowering.  Without -ftapir the keywords do not exist and
+// the primitives run serially.
+#  if __has_keyword(_kitsune_forall)
+#    define _LIBCPP_TAPIR_FORALL _kitsune_forall
+#    define _LIBCPP_TAPIR_SPAWN(__label) _kitsune_spawn __label
+#    define _LIBCPP_TAPIR_SYNC(__label) _kitsune_sync __label
+#  else
+#    define _LIBCPP_TAPIR_FORALL for
+#    define _LIBCPP_TAPIR_SPAWN(__label)
+#    define _LIBCPP_TAPIR_SYNC(__label) ((void)0)
+#  endif
+
+// Scratch memory touched inside a forall must be reachable by the GPU kernels
+// it becomes; it comes from the Kitsune runtime's managed allocations.
+#  if defined(_tapir_cuda_target)
+extern "C" void* __kitcuda_mem_alloc_managed(__SIZE_TYPE__);
+extern "C" void __kitcuda_mem_free(void*);
+#    define _LIBCPP_TAPIR_ALLOC_MANAGED __kitcuda_mem_alloc_managed
+#    define _LIBCPP_TAPIR_FREE_MANAGED __kitcuda_mem_free
+#  elif defined(_tapir_hip_target)
+extern "C" void* __kithip_mem_alloc_managed(__SIZE_TYPE__);
+extern "C" void __kithip_mem_free(void*);
+#    define _LIBCPP_TAPIR_ALLOC_MANAGED __kithip_mem_alloc_managed
+#    define _LIBCPP_TAPIR_FREE_MANAGED __kithip_mem_free
+#  elif defined(_tapir_multi_target)
+extern "C" void* __kitrt_multi_mem_alloc_managed(__SIZE_TYPE__);
+extern "C" void __kitrt_multi_mem_free(void*);
+#    define _LIBCPP_TAPIR_ALLOC_MANAGED __kitrt_multi_mem_alloc_managed
+#    define _LIBCPP_TAPIR_FREE_MANAGED __kitrt_multi_mem_free
+#  endif
+
+_LIBCPP_BEGIN_NAMESPACE_STD
+
+namespace __par_backend {
+inline namespace __tapir {
+
+// Ranges shorter than this are not worth splitting.
+inline constexpr ptrdiff_t __tapir_min_parallel_size = 1024;
+// The number of elements each partial result of a reduction covers, and the
+// largest number of partial results.
+inline constexpr ptrdiff_t __tapir_reduce_chunk_size = 1024;
+inline constexpr ptrdiff_t __tapir_max_reduce_chunks = ptrdiff_t(1) << 16;
+
+template <class _Tp>
+_LIBCPP_HIDE_FROM_ABI _Tp* __tapir_allocate(size_t __n) {
+#  if defined(_LIBCPP_TAPIR_ALLOC_MANAGED)
+  return static_cast<_Tp*>(_LIBCPP_TAPIR_ALLOC_MANAGED(__n * sizeof(_Tp)));
+#  else
+#    ifndef _LIBCPP_HAS_NO_EXCEPTIONS
+  try {
+#    endif
+    return allocator<_Tp>().allocate(__n);
+#    ifndef _LIBCPP_HAS_NO_EXCEPTIONS
+  } catch (...) {
+    return nullptr;
+  }
+#    endif
+#  endif
+}
+
+template <class _Tp>
+_LIBCPP_HIDE_FROM_ABI void __tapir_deallocate(_Tp* __p, size_t __n) {
+#  if defined(_LIBCPP_TAPIR_FREE_MANAGED)
+  (void)__n;
+  _LIBCPP_TAPIR_FREE_MANAGED(__p);
+#  else
+  allocator<_Tp>().deallocate(__p, __n);
+#  endif
+}
+
+template <class _RandomAccessIterator, class _Functor>
+_LIBCPP_HIDE_FROM_ABI optional<__empty>
+__parallel_for(_RandomAccessIterator __first, _RandomAccessIterator __last, _Functor __func) {
+  using _DiffT = typename iterator_traits<_RandomAccessIterator>::difference_type;
+  _DiffT __size = __last - __first;
+  if (__size < __tapir_min_parallel_size) {
+    __func(std::move(__first), std::move(__last));
+    return __empty{};
+  }
+  _LIBCPP_TAPIR_FORALL (_DiffT __i = 0; __i < __size; ++__i) {
+    _RandomAccessIterator __iter = __first + __i;
+    __func(__iter, __iter + 1);
+  }
+  return __empty{};
+}
+
+template <class _RandomAccessIterator, class _Transform, class _Value, class _Combiner, class _Reduction>
+_LIBCPP_HIDE_FROM_ABI optional<_Value> __parallel_transform_reduce(
+    _RandomAccessIterator __first,
+    _RandomAccessIterator __last,
+    _Transform __transform,
+    _Value __init,
+    _Combiner __combiner,
+    _Reduction __reduction) {
+  ptrdiff_t __size = __last - __first;
+  if (__size < __tapir_min_parallel_size)
+    return __reduction(std::move(__first), std::move(__last), std::move(__init));
+
+  // Each chunk reduces its elements into a partial result, seeded with its
+  // first (transformed) element; the partial results are combined in order.
+  ptrdiff_t __chunks = std::min(__size / __tapir_reduce_chunk_size, __tapir_max_reduce_chunks);
+  _Value* __partials = __par_backend::__tapir_allocate<_Value>(__chunks);
+  if (__partials == nullptr)
+    return nullopt;
+  _LIBCPP_TAPIR_FORALL (ptrdiff_t __i = 0; __i < __chunks; ++__i) {
+    _RandomAccessIterator __chunk_first = __first + __i * __size / __chunks;
+    _RandomAccessIterator __chunk_last  = __first + (__i + 1) * __size / __chunks;
+    std::__construct_at(__partials + __i, __reduction(__chunk_first + 1, __chunk_last, __transform(__chunk_first)));
+  }
+  for (ptrdiff_t __i = 0; __i < __chunks; ++__i) {
+    __init = __combiner(std::move(__init), std::move(__partials[__i]));
+    std::__destroy_at(__partials + __i);
+  }
+  __par_backend::__tapir_deallocate(__partials, __chunks);
+  return __init;
+}
+
+template <class _RandomAccessIterator1,
+          class _RandomAccessIterator2,
+          class _RandomAccessIterator3,
+          class _Compare,
+          class _LeafMerge>
+_LIBCPP_HIDE_FROM_ABI void __tapir_merge(
+    _RandomAccessIterator1 __first1,
+    _RandomAccessIterator1 __last1,
+    _RandomAccessIterator2 __first2,
+    _RandomAccessIterator2 __last2,
+    _RandomAccessIterator3 __result,
+    _Compare __comp,
+    _LeafMerge __leaf_merge) {
+  auto __size1 = __last1 - __first1;
+  auto __size2 = __last2 - __first2;
+  if (__size1 + __size2 < __tapir_min_parallel_size) {
+    __leaf_merge(__first1, __last1, __first2, __last2, __result, __comp);
+    return;
+  }
+
+  // Split the larger range in half and the other range where the middle
+  // element belongs; elements of the first range that compare equal stay
+  // ahead of those of the second, as in a sequential merge.
+  _RandomAccessIterator1 __mid1;
+  _RandomAccessIterator2 __mid2;
+  if (__size1 >= __size2) {
+    __mid1 = __first1 + __size1 / 2;
+    __mid2 = std::lower_bound(__first2, __last2, *__mid1, __comp);
+  } else {
+    __mid2 = __first2 + __size2 / 2;
+    __mid1 = std::upper_bound(__first1, __last1, *__mid2, __comp);
+  }
+  _RandomAccessIterator3 __mid_result = __result + (__mid1 - __first1) + (__mid2 - __first2);
+  _LIBCPP_TAPIR_SPAWN(__tapir_merge_halves)
+  __par_backend::__tapir_merge(__first1, __mid1, __first2, __mid2, __result, __comp, __leaf_merge);
+  __par_backend::__tapir_merge(__mid1, __last1, __mid2, __last2, __mid_result, __comp, __leaf_merge);
+  _LIBCPP_TAPIR_SYNC(__tapir_merge_halves);
+}
+
+template <class _RandomAccessIterator1,
+          class _RandomAccessIterator2,
+          class _RandomAccessIterator3,
+          class _Compare,
+          class _LeafMerge>
+_LIBCPP_HIDE_FROM_ABI optional<__empty> __parallel_merge(
+    _RandomAccessIterator1 __first1,
+    _RandomAccessIterator1 __last1,
+    _RandomAccessIterator2 __first2,
+    _RandomAccessIterator2 __last2,
+    _RandomAccessIterator3 __result,
+    _Compare __comp,
+    _LeafMerge __leaf_merge) {
+  __par_backend::__tapir_merge(
+      std::move(__first1),
+      std::move(__last1),
+      std::move(__first2),
+      std::move(__last2),
+      std::move(__result),
+      std::move(__comp),
+      std::move(__leaf_merge));
+  return __empty{};
+}
+
+template <class _RandomAccessIterator, class _Comp, class _LeafSort>
+_LIBCPP_HIDE_FROM_ABI void
+__tapir_stable_sort(_RandomAccessIterator __first, _RandomAccessIterator __last, _Comp __comp, _LeafSort __leaf_sort) {
+  auto __size = __last - __first;
+  if (__size < __tapir_min_parallel_size) {
+    __leaf_sort(__first, __last, __comp);
+    return;
+  }
+  _RandomAccessIterator __mid = __first + __size / 2;
+  _LIBCPP_TAPIR_SPAWN(__tapir_sort_halves)
+  __par_backend::__tapir_stable_sort(__first, __mid, __comp, __leaf_sort);
+  __par_backend::__tapir_stable_sort(__mid, __last, __comp, __leaf_sort);
+  _LIBCPP_TAPIR_SYNC(__tapir_sort_halves);
+  std::inplace_merge(__first, __mid, __last, __comp);
+}
+
+template <class _RandomAccessIterator, class _Comp, class _LeafSort>
+_LIBCPP_HIDE_FROM_ABI optional<__empty>
+__parallel_stable_sort(_RandomAccessIterator __first, _RandomAccessIterator __last, _Comp __comp, _LeafSort __leaf_sort) {
+  __par_backend::__tapir_stable_sort(std::move(__first), std::move(__last), std::move(__comp), std::move(__leaf_sort));
+  return __empty{};
+}
+
+_LIBCPP_HIDE_FROM_ABI inline void __cancel_execution() {}
+
+} // namespace __tapir
+} // namespace __par_backend
+
+_LIBCPP_END_NAMESPACE_STD
+
+#endif // !defined(_LIBCPP_HAS_NO_INCOMPLETE_PSTL) && _LIBCPP_STD_VER >= 17
+
+_LIBCPP_POP_MACROS
+
+#endif // _LIBCPP___ALGORITHM_PSTL_BACKENDS_CPU_BACKENDS_TAPIR_H
@@ -98,12 +98,14 @@ TapirTargetID lld::args::parseTapirTarget(StringRef tapirTarget) {
       .Case("serial", TapirTargetID::Serial)
       .Case("cuda", TapirTargetID::Cuda)
       .Case("hip", TapirTargetID::Hip)
+      .Case("levelzero", TapirTargetID::LevelZero)
       .Case("lambda", TapirTargetID::Lambda)
       .Case("omptask", TapirTargetID::OMPTask)
       .Case("opencilk", TapirTargetID::OpenCilk)
       .Case("openmp", TapirTargetID::OpenMP)
       .Case("qthreads", TapirTargetID::Qthreads)
       .Case("realm", TapirTargetID::Realm)
+      .Case("multi", TapirTargetID::Multi)
       .Default(TapirTargetID::Last_TapirTargetID);
 }
 
@@ -15,7 +15,9 @@
 #define LLVM_ANALYSIS_WORKSPANANALYSIS_H_
 
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Analysis/CodeMetrics.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/Support/InstructionCost.h"
 
 // TODO: Build a CGSCC pass based on these analyses to efficiently estimate the
@@ -30,11 +32,16 @@
 // Tapir.
 
 namespace llvm {
+class AssumptionCache;
+class Function;
 class Loop;
 class LoopInfo;
 class ScalarEvolution;
+class Task;
+class TaskInfo;
 class TargetLibraryInfo;
 class TargetTransformInfo;
+class raw_ostream;
 
 struct WSCost {
   InstructionCost Work = 0;
@@ -52,6 +59,64 @@ void estimateLoopCost(WSCost &LoopCost, const Loop *L, LoopInfo *LI,
                       ScalarEvolution *SE, const TargetTransformInfo &TTI,
                       TargetLibraryInfo *TLI,
                       const SmallPtrSetImpl<const Value *> &EphValues);
+
+/// Static estimate of the work, span and parallelism of a parallel region of a
+/// function: a Tapir loop or a task spawned outside of a Tapir loop.  Costs are
+/// in units of the target's size-and-latency cost.  Loops without a constant
+/// trip count are assumed to run a fixed number of iterations, in which case
+/// the estimate is marked as unknown.
+///
+/// The span of a Tapir loop assumes its iterations are spawned by recursive
+/// division, i.e., it is the span of one iteration plus the cost of a spawn for
+/// each of the log2(trip count) levels of division.  Tasks spawned within the
+/// same task outside of Tapir loops are assumed to run in parallel with one
+/// another and with the continuation.
+struct WSRegionEstimate {
+  const Loop *L = nullptr;         // Tapir loop, or null for a spawned task.
+  const Task *T = nullptr;         // Spawned task (the body of a Tapir loop).
+  unsigned TripCount = 0;          // Constant trip count, or 0 if unknown.
+  InstructionCost BodyWork = 0;    // Work of one iteration (or the task).
+  InstructionCost BodySpan = 0;    // Span of one iteration (or the task).
+  InstructionCost SpawnCost = 0;   // Cost of one spawn (detach).
+  InstructionCost Work = 0;        // Total work, including spawn overhead.
+  InstructionCost Span = 0;        // Total span, including spawn overhead.
+  bool UnknownCost = false;        // Estimate assumes unknown trip counts.
+
+  bool isTapirLoop() const { return L != nullptr; }
+
+  /// Return the estimated parallelism (work / span).
+  float getParallelism() const;
+
+  /// Return the ratio of the spawn overhead to the work of the spawned body.
+  /// A ratio close to (or above) one denotes an under-grained region.
+  float getSpawnOverheadRatio() const;
+};
+
+/// Compute work/span estimates of all Tapir loops and all tasks spawned outside
+/// of Tapir loops in the given function.  Regions are listed in the order of a
+/// preorder traversal of the task tree.
+void estimateWorkSpan(Function &F, LoopInfo &LI, TaskInfo &TI,
+                      ScalarEvolution &SE, const TargetTransformInfo &TTI,
+                      TargetLibraryInfo *TLI, AssumptionCache &AC,
+                      SmallVectorImpl<WSRegionEstimate> &Regions);
+
+/// Pass to emit the work/span estimates of each parallel region as optimization
+/// analysis remarks (-Rpass-analysis=work-span), which are also serialized by
+/// -fsave-optimization-record.  The pass does nothing unless the remarks are
+/// enabled.
+class WorkSpanRemarksPass : public PassInfoMixin<WorkSpanRemarksPass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+/// Printer pass for the work/span estimates of a function.
+class WorkSpanPrinterPass : public PassInfoMixin<WorkSpanPrinterPass> {
+  raw_ostream &OS;
+
+public:
+  explicit WorkSpanPrinterPass(raw_ostream &OS) : OS(OS) {}
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
 }
 
 #endif // LLVM_ANALYSIS_WORKSPANANALYSIS_H_
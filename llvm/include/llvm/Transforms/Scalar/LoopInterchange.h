@@ -18,8 +18,16 @@ class LPMUpdater;
 class LoopNest;
 
 struct LoopInterchangePass : public PassInfoMixin<LoopInterchangePass> {
+  /// If TapirLoopsOnly is set, only loop nests that contain Tapir loops
+  /// lowered for the CPU are interchanged.
+  LoopInterchangePass(bool TapirLoopsOnly = false)
+      : TapirLoopsOnly(TapirLoopsOnly) {}
+
   PreservedAnalyses run(LoopNest &L, LoopAnalysisManager &AM,
                         LoopStandardAnalysisResults &AR, LPMUpdater &U);
+
+private:
+  bool TapirLoopsOnly;
 };
 
 } // end namespace llvm
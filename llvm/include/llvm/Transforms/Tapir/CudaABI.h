@@ -56,7 +56,15 @@
 #define TapirCuda_ABI_H_
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Support/ToolOutputFile.h"
 
@@ -67,6 +75,9 @@ class TargetMachine;
 class CudaLoop;
 
 typedef std::unique_ptr<ToolOutputFile> CudaABIOutputFile;
+// Assembled (SASS) output files paired with their target architecture.
+typedef std::vector<std::pair<std::string, CudaABIOutputFile>>
+    CudaABIArchOutputFiles;
 
 class CudaABI : public TapirTarget {
 
@@ -104,6 +115,9 @@ public:
                           DominatorTree &DT) override final;
 
   void postProcessModule() override final;
+  /// Modules without kernels still provide relocatable device code for
+  /// the kernels of other modules (see -cuabi-rdc).
+  bool requiresModulePostProcessing() const override final;
 
   LoopOutlineProcessor *getLoopOutlineProcessor(const TapirLoopInfo *TL)
                           override final;
@@ -119,34 +133,108 @@ public:
   int globalVarCount() const {
     return GlobalVars.size();
   }
-  void pushSR(Value *SR) {
-    SyncRegList.insert(SR);
+  /// Record that the kernel launches that use the stream held in the
+  /// given alloca are part of the given (host-side) sync region.  Each
+  /// sync of the region will synchronize (only) these streams.
+  void registerLaunchStream(Value *SR, AllocaInst *AI) {
+    SyncRegStreams[SR].insert(AI);
   }
-
-  void registerLaunchStream(CallInst *CI, AllocaInst *AI) {
-    KernelLaunchToStreamMap.insert(std::pair<CallInst*,AllocaInst*>(CI,AI));
+  /// Record that the kernel launches that use the stream held in the
+  /// given alloca belong to an asynchronous loop with the given sync
+  /// region.  The stream is synchronized by the other syncs of the task
+  /// it belongs to, and when the task finishes, rather than by the
+  /// loop's own sync.
+  void registerAsyncLaunchStream(Value *SR, AllocaInst *AI) {
+    AsyncSyncRegions.insert(SR);
+    AsyncStreams.insert(AI);
   }
-
-  AllocaInst* getLaunchStream(CallInst *CI) {
-    LaunchToStreamMapTy::iterator it;
-    it = KernelLaunchToStreamMap.find(CI);
-    if (it != KernelLaunchToStreamMap.end())
-      return it->second;
-    else 
-      return nullptr;
+  /// Record the host-side pointer arguments of a kernel launch, those the
+  /// kernel may write, and the alloca that holds the launch's stream.
+  void registerLaunchPointers(CallInst *CI, AllocaInst *StreamAI,
+                              ArrayRef<Value *> Ptrs,
+                              ArrayRef<Value *> Outputs) {
+    LaunchPointers.push_back({CI, StreamAI, SmallVector<Value *, 4>(Ptrs),
+                              SmallVector<Value *, 4>(Outputs)});
+  }
+  /// Record that operand 1 of the given map or prefetch call is the
+  /// access mode of parameter ArgNo of the named kernel.  The mode is
+  /// refined once the kernel module is optimized (see
+  /// refineKernelArgAccesses()).
+  void registerKernelArgAccess(StringRef KernelName, unsigned ArgNo,
+                               CallInst *CI) {
+    KernelArgAccesses.push_back({KernelName.str(), ArgNo, CI, 0});
+  }
+  /// Record that element Index of the given table of access modes (of a
+  /// batched map) is the access mode of parameter ArgNo of the named
+  /// kernel.
+  void registerKernelArgAccess(StringRef KernelName, unsigned ArgNo,
+                               GlobalVariable *Table, unsigned Index) {
+    KernelArgAccesses.push_back({KernelName.str(), ArgNo, Table, Index});
+  }
+  /// Record the name and launch handle of a kernel in this module so
+  /// the module's constructor can request that it is preloaded.
+  void registerKernelLaunch(Constant *KernelName, GlobalVariable *Handle) {
+    KernelLaunches.push_back({KernelName, Handle});
+  }
+  /// Record that a launch in this module is specialized at runtime on
+  /// the values of some of its kernel's parameters (see the
+  /// kitsune::specialize attribute).  The module then embeds its PTX.
+  void registerSpecializedLaunch() { HasSpecializedLaunches = true; }
+  /// Return the identifier of the given constant string within the
+  /// module's table of device log strings (see -cuabi-device-log).
+  unsigned getLogStringID(StringRef Str);
+  /// Return the kernel module's global that holds the location of the
+  /// runtime's device log buffer and the module's first string id.
+  GlobalVariable *getDeviceLogGlobal();
+  /// Return the kernel module's global that holds the location of the
+  /// runtime's device heap (see -cuabi-device-heap).
+  GlobalVariable *getDeviceHeapGlobal();
+  /// Record that the launch bounds of the given kernel are set by its
+  /// launch attribute and must not be relaxed when the kernel spills.
+  /// Record that the given kernel can run within the module's persistent
+  /// worker kernel (see -cuabi-persistent-kernels).
+  void registerPersistentKernel(Constant *KernelName, StringRef Name) {
+    PersistentKernels.push_back({KernelName, Name.str()});
+  }
+  void pinLaunchBounds(StringRef KernelName) {
+    PinnedLaunchBounds.insert(KernelName);
+  }
+  bool hasPinnedLaunchBounds(StringRef KernelName) const {
+    return PinnedLaunchBounds.contains(KernelName);
   }
-
 
   private:
+    std::string getFatbinaryCacheKey();
     CudaABIOutputFile generatePTX();
-    CudaABIOutputFile assemblePTXFile(CudaABIOutputFile &PTXFile);
-    CudaABIOutputFile createFatbinaryFile(CudaABIOutputFile &AsmFile);
-    GlobalVariable *embedFatbinary(CudaABIOutputFile &FatbinaryFile);
+    CudaABIOutputFile emitPTX(Module &KM);
+    CudaABIArchOutputFiles assemblePTXFile(CudaABIOutputFile &PTXFile,
+                                           StringMap<unsigned> &SpillBytes);
+    bool relaxLaunchBounds(Module &KM, const StringMap<unsigned> &SpillBytes);
+    CudaABIOutputFile createFatbinaryFile(CudaABIArchOutputFiles &AsmFiles);
+    GlobalVariable *embedFatbinary(StringRef FatbinaryFileName);
     void registerFatbinary(GlobalVariable *RawFatbinary);
-    void finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin);
-    void bindGlobalVariables(Value *CM, IRBuilder<> &B);
+    void finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin,
+                             GlobalVariable *PTX);
+    bool canSpecializeKernels();
+    GlobalVariable *embedPTX(StringRef PTXFileName);
+    void packGlobalVariables();
+    void mergeIdenticalKernels();
     Function *createCtor(GlobalVariable *Fatbinary, GlobalVariable *Wrapper);
     Function *createDtor(GlobalVariable *FBHandle);
+    const std::string &getRDCSuffix();
+    std::string getGlobalsBlockName();
+    std::string getDeviceLogName();
+    std::string getDeviceHeapName();
+    void addRelocatableDeviceFunctions();
+    void addDeviceLinkStubs();
+    std::string getPersistentWorkerName();
+    void createPersistentWorker();
+    void emitAsyncStreamSyncs(Function &F, ArrayRef<AllocaInst *> Streams);
+    void findKernelArgAccesses(StringMap<unsigned> &Accesses);
+    void refineKernelArgAccesses(const StringMap<unsigned> &Accesses);
+    void emitHostPrefetches(Function &F);
+    void linkRuntimeBitcode();
+    void linkShmemDeviceLibrary();
 
     std::unique_ptr<Module> LibDeviceModule;
 
@@ -154,12 +242,60 @@ public:
     StringListTy ModulePTXFileList;
     typedef std::list<GlobalVariable *> GlobalVarListTy;
     GlobalVarListTy GlobalVars;
-
-    typedef std::set<Value*> SyncRegionListTy;
-    SyncRegionListTy SyncRegList;
-
-    typedef llvm::DenseMap<CallInst*,AllocaInst*>  LaunchToStreamMapTy;
-    LaunchToStreamMapTy   KernelLaunchToStreamMap;
+    // The offset of each host global within the device-side block of
+    // globals, the block's size and the host-side runtime handle for it.
+    SmallVector<std::pair<GlobalVariable *, uint64_t>, 16> GlobalBlockLayout;
+    uint64_t GlobalBlockSize = 0;
+    GlobalVariable *GlobalBlockHandle = nullptr;
+
+    typedef llvm::SmallSetVector<AllocaInst *, 4> StreamListTy;
+    typedef llvm::MapVector<Value *, StreamListTy> SyncRegStreamMapTy;
+    SyncRegStreamMapTy SyncRegStreams;
+    SmallPtrSet<Value *, 4> AsyncSyncRegions;
+    StreamListTy AsyncStreams;
+
+    struct LaunchPointerInfo {
+      CallInst *Launch;
+      AllocaInst *StreamAI;
+      SmallVector<Value *, 4> Ptrs;    // all pointer arguments.
+      SmallVector<Value *, 4> Outputs; // those the kernel may write.
+    };
+    SmallVector<LaunchPointerInfo, 8> LaunchPointers;
+    // The launch-site access modes of kernel arguments: operand 1 of a
+    // map or prefetch call, or an element of a batched map's table.
+    struct KernelArgAccessInfo {
+      std::string KernelName;
+      unsigned ArgNo;
+      WeakVH Site;
+      unsigned Index;
+    };
+    SmallVector<KernelArgAccessInfo, 16> KernelArgAccesses;
+    SmallVector<std::pair<Constant *, GlobalVariable *>, 8> KernelLaunches;
+    // The kernels that run within the persistent worker kernel, by the
+    // index the worker dispatches on, and the layout of each kernel's
+    // arguments within a work item ([offset, size] of each argument).
+    SmallVector<std::pair<Constant *, std::string>, 8> PersistentKernels;
+    SmallVector<SmallVector<uint32_t, 16>, 8> PersistentArgLayouts;
+    // The format strings and constant string arguments of the printf()
+    // calls in the module's kernels, by identifier.
+    std::vector<std::string> LogStrings;
+    StringMap<unsigned> LogStringIDs;
+    GlobalVariable *DeviceLog = nullptr;
+    GlobalVariable *DeviceHeap = nullptr;
+    // Set once a kernel is generated for the module.
+    bool HasKernels = false;
+    // Set once a launch is specialized at runtime (see
+    // registerSpecializedLaunch()).
+    bool HasSpecializedLaunches = false;
+    // Makes the device-side names of the module unique for the device
+    // link of relocatable device code.
+    std::string RDCSuffix;
+    // Kernels whose launch bounds come from their launch attribute, and
+    // a copy of the optimized kernel module that is used to generate
+    // the kernels again when their launch bounds cause spills (see
+    // -cuabi-spill-threshold).
+    StringSet<> PinnedLaunchBounds;
+    std::unique_ptr<Module> SpillRetryModule;
 
     Module   KernelModule;
     TargetMachine *PTXTargetMachine;
@@ -187,6 +323,24 @@ private:
   unsigned KernelID;               // Unique ID for this transformed loop.
   std::string KernelName;          // A unique name for the kernel.
   Module  &KernelModule;           // PTX module holds the generated kernel(s).
+  Value *SyncRegion = nullptr;     // Host-side sync region of the loop.
+  bool Async = false;              // Launch is waited on at the next sync.
+  bool GridStride = false;         // Kernel threads stride over the grid.
+  // Kernel arguments the kernel reduces into.
+  SmallVector<tapir::GPUReductionArg, 4> ReductionArgs;
+  // The dimensions of the kernel's launch geometry and the extents of
+  // the inner dimensions (kernel arguments or constants) when the
+  // kernel indexes a flattened 2D/3D iteration space.
+  unsigned NumLaunchDims = 1;
+  Value *LaunchExtents[2] = {nullptr, nullptr};
+  // The dynamic shared memory used by the kernel's tiles.
+  tapir::GPUSharedMemSize SharedMem;
+  // The loop only copies or fills an array and runs as a memcpy or
+  // memset instead of a kernel launch.
+  tapir::GPUMemIdiom MemIdiom;
+  // The loop computes a matrix product and runs with cuBLAS when the
+  // runtime can load it.
+  tapir::GPUBlasIdiom BlasIdiom;
 
   // Cuda/PTX thread index access.
   Function *CUThreadIdxX  = nullptr,
@@ -206,14 +360,27 @@ private:
 
   // Cuda thread synchronize
   Function *CUSyncThreads = nullptr;
+  // Cuda warp shuffle (down).
+  Function *CUShflDownSync = nullptr;
+  // Cuda warp match (any).
+  Function *CUMatchAnySync = nullptr;
 
   StructType *KernelInstMixTy;
 
   FunctionCallee KitCudaLaunchFn = nullptr;
+  FunctionCallee KitCudaLaunchNDFn = nullptr;
+  FunctionCallee KitCudaLaunchMemcpyFn = nullptr;
+  FunctionCallee KitCudaLaunchMemsetFn = nullptr;
+  FunctionCallee KitCudaLaunchGemmFn = nullptr;
+  FunctionCallee KitCudaSpecializeLaunchFn = nullptr;
   FunctionCallee KitCudaSyncFn = nullptr;
+  FunctionCallee KitCudaPriorityStreamFn = nullptr;
 
   // Runtime prefetch support entry points.
-  FunctionCallee KitCudaMemPrefetchFn = nullptr;
+  FunctionCallee KitCudaMemMapFn = nullptr;
+  FunctionCallee KitCudaMemMapBatchFn = nullptr;
+  FunctionCallee KitCudaMemReduceMapFn = nullptr;
+  FunctionCallee KitCudaMemPrefetchAsyncFn = nullptr;
   FunctionCallee KitCudaMemPrefetchOnStreamFn = nullptr;
   FunctionCallee KitCudaStreamMemPrefetchFn = nullptr;
   FunctionCallee KitCudaStreamSetMemPrefetchFn = nullptr;
@@ -222,6 +389,30 @@ private:
   FunctionCallee KitCudaGetGlobalSymbolFn = nullptr;
   FunctionCallee KitCudaMemcpySymbolToDeviceFn = nullptr;
   SmallVector<Value *, 5> OrderedInputs;
+  // The number of loop-control inputs (end, start and, if it is not
+  // constant, the grain size) at the front of OrderedInputs.
+  unsigned NumLoopControlArgs = 2;
+  // The inputs (indices into OrderedInputs) passed to the kernel in a
+  // single by-value struct of type PackedArgsTy, in field order.
+  SmallVector<unsigned, 8> PackedArgNos;
+  StructType *PackedArgsTy = nullptr;
+
+  // The clones of the kernel that are specialized for a trip count
+  // (the trip count and the name of the clone).
+  SmallVector<std::pair<uint64_t, std::string>, 4> TripCountKernels;
+  // The trip count of the kernel is a compile-time constant.
+  bool FixedTripCount = false;
+
+  void lowerDevicePrintf(CallInst *CI);
+  void lowerDeviceHeapCall(CallInst *CI);
+  Function *packKernelArgs(Function &F, TaskOutlineInfo &TOI);
+  Argument *getKernelArg(Function &F, unsigned ArgNo) const;
+  Value *getKernelInput(Function &F, unsigned ArgNo) const;
+  void specializeTripCounts(Function &F);
+  SmallVector<unsigned, 4> getSpecializedParams(TapirLoopInfo &TL,
+                                                TaskOutlineInfo &TOI);
+  bool emitMemIdiom(IRBuilder<> &B, Value *CudaStream);
+  Value *emitBlasIdiom(IRBuilder<> &B, Value *CudaStream);
 
 public:
   CudaLoop(Module &M,   // Input module (host side)
@@ -246,6 +437,10 @@ public:
 
   std::string getKernelName() const { return KernelName; }
 
+  /// Return the reduction details of the given kernel argument (or
+  /// nullptr if the kernel does not reduce into it).
+  const tapir::GPUReductionArg *isReductionArg(unsigned ArgNo) const;
+
   unsigned getKernelID() const {
     return KernelID;
   }
@@ -256,9 +451,14 @@ public:
                           ValueToValueMapTy &VMap) override final;
   void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo & TOI,
                                DominatorTree &DT) override final;
+  bool setOutlinedLoopLimit(Value *Limit) override {
+    // The first input is the limit (the extent of the index space).
+    OrderedInputs[0] = Limit;
+    return true;
+  }
   void transformForPTX(Function &F);
 
-  Function *resolveLibDeviceFunction(Function *F, bool enableFastMode);
+  Function *resolveLibDeviceFunction(Function *F, tapir::GPUMathAccuracy Acc);
 };
 
 }
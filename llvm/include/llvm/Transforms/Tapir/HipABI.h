@@ -55,6 +55,7 @@
 #define TapirHip_ABI_H_
 
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Support/ToolOutputFile.h"
 
@@ -150,6 +151,24 @@ public:
       return nullptr;
   }
 
+  /// @brief Record the host-side pointer arguments of a kernel launch.
+  /// @param CI - the kernel launch call.
+  /// @param Ptrs - the (host-side) pointer arguments of the launch.
+  /// @param Outputs - the pointer arguments the kernel may write.
+  void registerLaunchPointers(CallInst *CI, ArrayRef<Value *> Ptrs,
+                              ArrayRef<Value *> Outputs) {
+    LaunchPointers.push_back({CI, SmallVector<Value *, 4>(Ptrs),
+                              SmallVector<Value *, 4>(Outputs)});
+  }
+
+  /// @brief Record the name and launch handle of a kernel in this module
+  /// so the module's constructor can request that it is preloaded.
+  /// @param KernelName - the kernel's name (a constant string).
+  /// @param Handle - the kernel's launch handle.
+  void registerKernelLaunch(Constant *KernelName, GlobalVariable *Handle) {
+    KernelLaunches.push_back({KernelName, Handle});
+  }
+
   /// @brief Save a kernel for post-processing.
   /// @param KF - the kernel function to save.
   /// @return void
@@ -177,6 +196,11 @@ public:
   private:
   // ----- Hip-centric transformation support.
 
+  /// @brief Prefetch data written by the kernels launched from F back to
+  /// the host where the host reads it before another launch uses it.
+  /// @param F - the host-side function containing the launches.
+  void emitHostPrefetches(Function &F);
+
   /// @brief Generate a AMDGPU (GCN) object file for the kernel module.
   /// @return The created object file.
   HipABIOutputFile createTargetObj(const StringRef &ObjFileName);
@@ -192,10 +216,22 @@ public:
   /// @return The file containing the GCN for the kernel.
   HipABIOutputFile createBundleFile();
 
+  /// @brief Wrap the linked code object in a compressed offload bundle.
+  /// @param CodeObjFile - the linked code object (see linkTargetObj()).
+  /// @param BundleFileName - output file name of the compressed bundle.
+  /// @return The compressed bundle file.
+  HipABIOutputFile compressBundle(const HipABIOutputFile &CodeObjFile,
+                                  const StringRef &BundleFileName);
+
+  /// @brief Return the key of the kernel module's bundle in the bundle
+  /// cache: a hash of the module and everything else that feeds device
+  /// code generation.
+  std::string getBundleCacheKey();
+
   /// @brief  Embed the given bundle file in the generated code.
-  /// @param BundleFile: The bundle file.
+  /// @param BundleFileName: The name of the bundle file.
   /// @return A global variable containing the fat binary.
-  GlobalVariable *embedBundle(HipABIOutputFile &BundleFile);
+  GlobalVariable *embedBundle(StringRef BundleFileName);
 
   /// @brief Load the given ROCM-centric bitcode file and return a module.
   /// @param BCFileName: The file name for the bitcode file (not a full path)
@@ -253,6 +289,15 @@ public:
 
   typedef llvm::DenseMap<CallInst*,AllocaInst*>  LaunchToStreamMapTy;
   LaunchToStreamMapTy   KernelLaunchToStreamMap;
+
+  struct LaunchPointerInfo {
+    CallInst *Launch;
+    SmallVector<Value *, 4> Ptrs;    // all pointer arguments.
+    SmallVector<Value *, 4> Outputs; // those the kernel may write.
+  };
+  typedef SmallVector<LaunchPointerInfo, 8> LaunchPointerListTy;
+  LaunchPointerListTy   LaunchPointers;
+  SmallVector<std::pair<Constant *, GlobalVariable *>, 8> KernelLaunches;
   
 
   Module KernelModule;
@@ -262,6 +307,7 @@ public:
   FunctionCallee   KitHipGetGlobalSymbolFn = nullptr;
   FunctionCallee   KitHipMemcpySymbolToDevFn = nullptr;
   FunctionCallee   KitHipSyncFn = nullptr;
+  FunctionCallee   KitHipMemHostPrefetchFn = nullptr;
 };
 
 /// The loop outline process for transforming a Tapir parallel loop
@@ -329,10 +375,19 @@ public:
   /// Processes a call to an outlined Function Helper for a Tapir loop.
   void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
                                DominatorTree &DT) override;
+  bool setOutlinedLoopLimit(Value *Limit) override {
+    // The first input is the limit (the extent of the index space).
+    OrderedInputs[0] = Limit;
+    return true;
+  }
 
   std::string getKernelName() const { return KernelName; }
   unsigned getKernelID() const { return KernelID; }
 
+  /// Return the reduction details of the given kernel argument (or
+  /// nullptr if the kernel does not reduce into it).
+  const tapir::GPUReductionArg *isReductionArg(unsigned ArgNo) const;
+
 private:
   // ----- Hip-centric loop code generation support.
 
@@ -382,12 +437,17 @@ private:
   
   // Kitsune runtime entry points.
   FunctionCallee   KitHipLaunchFn = nullptr;
+  FunctionCallee   KitHipLaunchNDFn = nullptr;
   FunctionCallee   KitHipModuleLoadDataFn = nullptr;
   FunctionCallee   KitHipModuleLaunchFn = nullptr;
+  FunctionCallee   KitHipPriorityStreamFn = nullptr;
 
   // Runtime prefetch support entry points.
   FunctionCallee   KitHipStreamSetMemPrefetchFn =  nullptr;
   FunctionCallee   KitHipMemPrefetchFn =  nullptr;
+  FunctionCallee   KitHipMemPrefetchBatchFn = nullptr;
+  FunctionCallee   KitHipMemPrefetchAsyncFn = nullptr;
+  FunctionCallee   KitHipMemReduceMapFn = nullptr;
   FunctionCallee   KitHipMemPrefetchOnStreamFn = nullptr;
   FunctionCallee   KitHipStreamMemPrefetchFn = nullptr;
 
@@ -395,6 +455,15 @@ private:
 
 
   SmallVector<Value *, 5> OrderedInputs;
+  // Kernel arguments the kernel reduces into.
+  SmallVector<tapir::GPUReductionArg, 4> ReductionArgs;
+  // The dimensions of the kernel's launch geometry and the extents of
+  // the inner dimensions (kernel arguments or constants) when the
+  // kernel indexes a flattened 2D/3D iteration space.
+  unsigned NumLaunchDims = 1;
+  Value *LaunchExtents[2] = {nullptr, nullptr};
+  // The dynamic (LDS) shared memory used by the kernel's tiles.
+  tapir::GPUSharedMemSize SharedMem;
 };
 
 }
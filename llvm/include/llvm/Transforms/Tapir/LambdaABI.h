@@ -17,15 +17,20 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
+#include <optional>
 
 namespace llvm {
 class Value;
 class TapirLoopInfo;
 
 class LambdaABI final : public TapirTarget {
+  friend class LambdaLoop;
+
   ValueToValueMapTy DetachCtxToStackFrame;
 
   StringRef RuntimeBCPath = "";
+  // Whether the runtime bitcode defines the __rts_loop entry point.
+  std::optional<bool> RuntimeHasLoop;
 
   // Runtime stack structure
   StructType *StackFrameTy = nullptr;
@@ -50,6 +55,8 @@ class LambdaABI final : public TapirTarget {
   FunctionCallee RTSGetNumWorkers = nullptr;
   FunctionCallee RTSGetWorkerID = nullptr;
 
+  FunctionCallee RTSLoop = nullptr;
+
   Align StackFrameAlign{8};
 
   Value *CreateStackFrame(Function &F);
@@ -61,6 +68,11 @@ class LambdaABI final : public TapirTarget {
   void InsertStackFramePop(Function &F, bool PromoteCallsToInvokes,
                            bool InsertPauseFrame, bool Helper);
 
+  StringRef getRuntimeBCPath() const;
+  bool runtimeDefinesLoop();
+  void inlineAnnotatedFunctions();
+  FunctionCallee getRTSLoop();
+
 public:
   LambdaABI(Module &M) : TapirTarget(M) {}
   ~LambdaABI() { DetachCtxToStackFrame.clear(); }
@@ -93,6 +105,31 @@ public:
   void postProcessRootSpawner(Function &F, BasicBlock *TFEntry) override final;
   void processSubTaskCall(TaskOutlineInfo &TOI,
                           DominatorTree &DT) override final;
+
+  LoopOutlineProcessor *
+  getLoopOutlineProcessor(const TapirLoopInfo *TL) override final;
+};
+
+/// The LambdaLoop loop-outline processor hands a Tapir loop to the __rts_loop
+/// entry point of the runtime, which runs a callback on chunks of the
+/// iterations:
+///
+///   void __rts_loop(void (*body)(void *args, uint64_t lo, uint64_t hi),
+///                   void *args, uint64_t start, uint64_t end,
+///                   uint64_t grainsize);
+///
+/// and returns once all of the iterations have run.
+class LambdaLoop : public LoopOutlineProcessor {
+  LambdaABI *TTarget;
+
+public:
+  LambdaLoop(Module &M, LambdaABI *Target)
+      : LoopOutlineProcessor(M), TTarget(Target) {}
+
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
 };
 } // namespace llvm
 
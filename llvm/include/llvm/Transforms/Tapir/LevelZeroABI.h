@@ -0,0 +1,257 @@
+//===- LevelZeroABI.h - Tapir to Kitsune Level Zero target ------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// Copyright (c) 2021, 2024 Los Alamos National Security, LLC.
+//  All rights reserved.
+//
+// Copyright 2021, 2024. Los Alamos National Security, LLC. This
+//  software was produced under U.S. Government contract
+//  DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+//  is operated by Los Alamos National Security, LLC for the
+//  U.S. Department of Energy. The U.S. Government has rights to use,
+//  reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+//  NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+//  OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+//  If software is modified to produce derivative works, such modified
+//  software should be clearly marked, so as not to confuse it with
+//  the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+//  AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+//  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+//  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//===---------------------------------------------------------------------===//
+//
+#ifndef TapirLevelZero_ABI_H_
+#define TapirLevelZero_ABI_H_
+
+#include "llvm/Transforms/Tapir/LoweringUtils.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
+
+namespace llvm {
+
+class TargetMachine;
+class ZeLoop;
+
+/// The Level Zero target transforms Tapir parallel loops into SPIR-V
+/// kernels that are launched via the Level Zero portion of the Kitsune
+/// runtime (e.g., on Intel GPUs).  All kernels from an input module are
+/// placed in a single kernel module that is compiled to a SPIR-V binary
+/// (via LLVM's SPIR-V backend) and embedded in the host-side module.
+/// The runtime creates the Level Zero module from the embedded image
+/// the first time one of its kernels is launched.
+class LevelZeroABI : public TapirTarget {
+
+public:
+  LevelZeroABI(Module &InputModule);
+  ~LevelZeroABI();
+
+  // ----- Core Tapir code transform callbacks.
+
+  /// Lower a call to the tapir.loop.grainsize intrinsic into a grain size
+  /// (coarsening) value.  For GPU codes we currently limit this to a
+  /// value of 1.
+  Value *lowerGrainsizeCall(CallInst *GrainsizeCall) override final;
+
+  /// Lower the given Tapir sync instruction (SI).
+  void lowerSync(SyncInst &SI) override final;
+
+  /// Process Function F before any function outlining is performed.  This
+  /// routine should not modify the CFG structure.
+  bool preProcessFunction(Function &F, TaskInfo &TI,
+                          bool ProcessingTapirLoops) override;
+
+  // Add attributes to the Function Helper produced from outlining a task.
+  void addHelperAttributes(Function &F) override;
+
+  void preProcessOutlinedTask(Function &F, Instruction *DetachPt,
+                              Instruction *TaskFrameCreate, bool isSpawner,
+                              BasicBlock *BB) override
+  { /* no-op */ }
+
+  void postProcessOutlinedTask(Function &F, Instruction *DetachPtr,
+                               Instruction *TaskFrameCreate, bool IsSpawner,
+                               BasicBlock *TFEntry) override
+  { /* no-op */ }
+
+  void preProcessRootSpawner(Function &F, BasicBlock *TFEntry) override
+  { /* no-op */ }
+
+  void postProcessRootSpawner(Function &F, BasicBlock *TFEntry) override
+  { /* no-op */ }
+
+  void processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) override
+  { /* no-op */ }
+
+  // Process Function F at the end of the lowering process.
+  void postProcessFunction(Function &F, bool OutliningTapirLoops) override;
+
+  void pushSR(Value *SR) { SyncRegList.insert(SR); }
+
+  /// @brief Save a kernel for post-processing.
+  /// @param KF - the kernel function to save.
+  void saveKernel(Function *KF) { KernelFunctions.push_back(KF); }
+
+  // Process the host-side module at the end of lowering all functions
+  // within the module.
+  void postProcessModule() override final;
+
+  void postProcessHelper(Function &F) override
+  { /* no-op */ }
+
+  // Return the Level Zero outline processor associated with this target.
+  LoopOutlineProcessor *getLoopOutlineProcessor(const TapirLoopInfo *TL)
+                                                override final;
+
+private:
+  // ----- Level Zero (SPIR-V) centric transformation support.
+
+  /// @brief Rewrite the kernel module for the SPIR-V backend.  Pointers
+  /// in the default address space are moved to the generic address
+  /// space, global variables to the cross work-group address space, and
+  /// each kernel gets a 'spir_kernel' entry point.
+  void transformKernelModule();
+
+  /// @brief Generate a SPIR-V binary for the kernel module.
+  /// @param Image - the buffer that receives the binary.
+  void createSPIRVImage(SmallVectorImpl<char> &Image);
+
+  /// @brief Embed the given SPIR-V image in the host-side module.
+  /// @param Image - the SPIR-V binary.
+  /// @return A global variable containing the image.
+  GlobalVariable *embedImage(StringRef Image);
+
+  /// @brief Make a final pass and 'bind' launch calls to the SPIR-V image.
+  /// @param Image - the global variable holding the image.
+  /// @param ImageSize - the size (in bytes) of the image.
+  void finalizeLaunchCalls(GlobalVariable *Image, uint64_t ImageSize);
+
+  /// @brief Add a global constructor (and an 'atexit()' destructor) to
+  /// initialize (and clean up) the runtime.
+  void registerImage();
+
+  typedef std::set<Value *> SyncRegionListTy;
+  SyncRegionListTy SyncRegList;
+
+  typedef std::list<Function *> KernelListTy;
+  KernelListTy KernelFunctions;
+
+  Module KernelModule;
+  TargetMachine *SPIRVTargetMachine;
+
+  FunctionCallee KitZeSyncFn = nullptr;
+};
+
+/// The loop outline processor for transforming a Tapir parallel loop
+/// into a SPIR-V kernel that is launched via the Level Zero runtime.
+class ZeLoop : public LoopOutlineProcessor {
+  friend class LevelZeroABI;
+
+public:
+  /// @brief Build the ZeLoop outline processor.
+  /// @param M: Module containing the input code.
+  /// @param KM: The module that will contain the generated kernel.
+  /// @param KernelName: The name of the kernel function that is generated.
+  /// @param Target: The "parent" tapir target.
+  ZeLoop(Module &M, Module &KM, const std::string &KernelName,
+         LevelZeroABI *Target);
+  ~ZeLoop();
+
+  /// Prepares the set HelperArgs of function arguments for the outlined helper
+  /// function Helper for a Tapir loop.  Also prepares the list HelperInputs of
+  /// input values passed to a call to Helper.  HelperArgs and HelperInputs are
+  /// derived from the loop-control arguments LCArgs and loop-control inputs
+  /// LCInputs for the Tapir loop, as well the set TLInputsFixed of arguments to
+  /// the task underlying the Tapir loop.
+  void setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                            SmallVectorImpl<Value *> &HelperInputs,
+                            ValueSet &InputSet,
+                            const SmallVectorImpl<Value *> &LCArgs,
+                            const SmallVectorImpl<Value *> &LCInputs,
+                            const ValueSet &TLInputsFixed) override;
+
+  /// Returns an integer identifying the index of the helper-function argument
+  /// in Args that specifies the starting iteration number.  This return value
+  /// must complement the behavior of setupLoopOutlineArgs().
+  unsigned getIVArgIndex(const Function &F,
+                         const ValueSet &Args) const override;
+
+  /// Returns an integer identifying the index of the helper-function argument
+  /// in Args that specifies the ending iteration number.  This return value
+  /// must complement the behavior of setupLoopOutlineArgs().
+  unsigned getLimitArgIndex(const Function &F,
+                            const ValueSet &Args) const override;
+
+  /// Process the TapirLoop before it is outlined -- just prior to the
+  /// outlining occurs.  This allows the VMap and related details to be
+  /// customized prior to outlining related operations (e.g. cloning of
+  /// LLVM constructs).
+  void preProcessTapirLoop(TapirLoopInfo &TL,
+                           ValueToValueMapTy &VMap) override;
+
+  /// Processes an outlined Function Helper for a Tapir loop, just after the
+  /// function has been outlined.
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+
+  /// Processes a call to an outlined Function Helper for a Tapir loop.
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
+  bool setOutlinedLoopLimit(Value *Limit) override {
+    // The first input is the limit (the extent of the index space).
+    OrderedInputs[0] = Limit;
+    return true;
+  }
+
+  std::string getKernelName() const { return KernelName; }
+
+private:
+  LevelZeroABI *TTarget = nullptr;
+  static unsigned NextKernelID; // Give the generated kernel a unique ID.
+  unsigned KernelID;            // Unique ID for this transformed loop.
+  std::string KernelName;       // A unique name for the kernel.
+  Module &KernelModule;         // SPIR-V module holds the generated kernel(s).
+
+  // OpenCL work-item builtin (lowered by the SPIR-V backend).
+  FunctionCallee KitZeGlobalIdFn = nullptr;
+
+  // Kitsune runtime entry points.
+  FunctionCallee KitZeLaunchFn = nullptr;
+  FunctionCallee KitZeMemPrefetchFn = nullptr;
+
+  SmallVector<Value *, 5> OrderedInputs;
+};
+
+} // namespace llvm
+
+#endif
@@ -37,6 +37,12 @@ TargetTransformInfo::StripMiningPreferences gatherStripMiningPreferences(
     Loop *L, ScalarEvolution &SE, const TargetTransformInfo &TTI,
     std::optional<unsigned> UserCount);
 
+/// Return the number of iterations of L covered by one vectorized and
+/// interleaved iteration on the target, or 1 if L does not appear vectorizable
+/// or vectorization-aware stripmining is disabled.
+unsigned getStripMineVectorFactor(const Loop *L,
+                                  const TargetTransformInfo &TTI);
+
 bool computeStripMineCount(Loop *L, const TargetTransformInfo &TTI,
                            InstructionCost LoopCost,
                            TargetTransformInfo::StripMiningPreferences &UP);
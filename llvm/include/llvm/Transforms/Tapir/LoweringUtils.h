@@ -29,6 +29,7 @@ class AssumptionCache;
 class BasicBlock;
 class DominatorTree;
 class Function;
+class IRBuilderBase;
 class Loop;
 class LoopOutlineProcessor;
 class Spindle;
@@ -224,9 +225,11 @@ protected:
 public:
   // Enumeration of ways arguments can be passed to outlined functions.
   enum class ArgStructMode {
-    None,   // Pass arguments directly.
-    Static, // Statically allocate a structure to store arguments.
-    Dynamic // Dynamically allocate a structure to store arguments.
+    None,    // Pass arguments directly.
+    Static,  // Statically allocate a structure to store arguments.
+    Dynamic, // Dynamically allocate a structure to store arguments.
+    Arena    // Allocate a structure for each spawn from a stack arena that is
+             // released when the sync region of the spawn syncs.
   };
 
   TapirTarget(Module &M) : M(M), DestM(M) {}
@@ -241,6 +244,12 @@ public:
   /// (coarsening) value.
   virtual Value *lowerGrainsizeCall(CallInst *GrainsizeCall) = 0;
 
+  /// Emit code at the insertion point of \p B that gets the number of workers
+  /// of the parallel runtime, which Tapir loops with a static or guided
+  /// schedule divide their iterations among.  Returns nullptr if the target
+  /// has no notion of workers.
+  virtual Value *emitNumWorkers(IRBuilderBase &B) { return nullptr; }
+
   /// Lower a call to the task.frameaddress intrinsic to get the frame pointer
   /// for the containing function, i.e., after the task has been outlined.
   virtual void lowerTaskFrameAddrCall(CallInst *TaskFrameAddrCall);
@@ -326,6 +335,10 @@ public:
   // module.
   virtual void postProcessModule() { return; };
 
+  // Returns true if postProcessModule() must also be run on modules without
+  // parallelism.
+  virtual bool requiresModulePostProcessing() const { return false; }
+
   // Process a generated helper Function F produced via outlining, at the end of
   // the lowering process.
   virtual void postProcessHelper(Function &F) = 0;
@@ -447,7 +460,8 @@ public:
   void addSyncToOutlineReturns(TapirLoopInfo &TL, TaskOutlineInfo &Out,
                                ValueToValueMapTy &VMap);
 
-  /// Move Cilksan instrumentation out of cloned loop.
+  /// Move Cilksan instrumentation, and the CSI task hooks if
+  /// -tapir-loop-hoist-csi-task-hooks is set, out of cloned loop.
   void moveCilksanInstrumentation(TapirLoopInfo &TL, TaskOutlineInfo &Out,
                                   ValueToValueMapTy &VMap);
 
@@ -458,6 +472,13 @@ public:
   /// Processes a call to an outlined Function Helper for a Tapir loop.
   virtual void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
                                        DominatorTree &DT) {}
+
+  /// Lower the call to the outlined loop (see processOutlinedLoopCall()) to
+  /// run the iterations up to \p Limit rather than the loop's own limit,
+  /// e.g., to run part of a loop on another target.  \p Limit must dominate
+  /// the call.  Returns false if the outline processor does not support
+  /// changing the limit.
+  virtual bool setOutlinedLoopLimit(Value *Limit) { return false; }
 };
 
 /// Generate a TapirTarget object for the specified TapirTargetID.
@@ -488,6 +509,17 @@ createTaskArgsStruct(const ValueSet &Inputs, Task *T, Instruction *StorePt,
                      ValueToValueMapTy &InputsMap,
                      Loop *TapirL = nullptr);
 
+/// Returns true if \p Closure is an argument structure allocated from the
+/// arena of its sync region (ArgStructMode::Arena).  Such a structure lives
+/// until the sync region syncs, so the target can pass it to the spawned task
+/// without copying it.
+bool isTaskArgsArena(const AllocaInst *Closure);
+
+/// Release the argument structures allocated from the arena of \p SyncRegion,
+/// if any, at the insertion point of \p B.  Targets using ArgStructMode::Arena
+/// call this once a sync of \p SyncRegion has waited for its tasks.
+void resetTaskArgsArena(Value *SyncRegion, IRBuilderBase &B);
+
 /// Organize the set \p Inputs of values in \p F into a set \p Fixed of values
 /// that can be used as inputs to a helper function.
 void fixupInputSet(Function &F, const ValueSet &Inputs, ValueSet &Fixed);
@@ -13,6 +13,7 @@
 #ifndef OMPTASK_ABI_H_
 #define OMPTASK_ABI_H_
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -49,8 +50,26 @@ class OMPTaskABI final : public TapirTarget {
   FunctionCallee RTSGetNumWorkers = nullptr;
   FunctionCallee RTSGetWorkerID = nullptr;
 
+  // Spawn with task dependences, if the runtime bitcode provides it.
+  FunctionCallee RTSSpawnDeps = nullptr;
+  // Spawn an untied task, if the runtime bitcode provides it.
+  FunctionCallee RTSSpawnUntied = nullptr;
+  // The layout of libomp's kmp_depend_info.
+  StructType *DependInfoTy = nullptr;
+
+  // The spawns of each function whose tasks do not have a complete set of
+  // dependences.  The syncs of a function without any can be elided when
+  // the dependences order the tasks on either side of them.
+  DenseMap<const Function *, unsigned> NumUndescribedSpawns;
+
   Align StackFrameAlign{8};
 
+  bool collectTaskDeps(CallBase *ReplCall, Function *Helper,
+                       SmallVectorImpl<Value *> &Deps,
+                       SmallVectorImpl<unsigned> &Flags);
+  bool isSpawnFrameAlloca(const Value *V) const;
+  bool isElidableSync(SyncInst &SI) const;
+
   Value *CreateStackFrame(Function &F);
   Value *GetOrCreateStackFrame(Function &F);
 
@@ -68,6 +87,7 @@ public:
 
   void prepareModule() override final;
   Value *lowerGrainsizeCall(CallInst *GrainsizeCall) override final;
+  Value *emitNumWorkers(IRBuilderBase &B) override final;
   void lowerSync(SyncInst &SI) override final;
   // void lowerReducerOperation(CallBase *CI) override;
 
@@ -93,6 +113,30 @@ public:
   void processSubTaskCall(TaskOutlineInfo &TOI,
                           DominatorTree &DT) override final;
 
+  LoopOutlineProcessor *
+  getLoopOutlineProcessor(const TapirLoopInfo *TL) override final;
+};
+
+/// The OMPTaskLoop loop-outline processor runs a Tapir loop as an OpenMP
+/// worksharing loop: the outlined helper runs its range of iterations
+/// serially, and the call to the helper forks a parallel region in which the
+/// iterations are divided among the threads of the team by
+/// __kmpc_for_static_init or __kmpc_dispatch_next.
+class OMPTaskLoop : public LoopOutlineProcessor {
+  // The schedule of the worksharing loop, as a kmp sched_type.
+  unsigned Schedule;
+
+  // Get the default ident_t location passed to the kmpc routines.
+  Constant *getOrCreateIdent();
+
+public:
+  OMPTaskLoop(Module &M, unsigned Schedule)
+      : LoopOutlineProcessor(M), Schedule(Schedule) {}
+
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
 };
 } // namespace llvm
 
@@ -160,6 +160,7 @@ public:
 
   void prepareModule() override final;
   Value *lowerGrainsizeCall(CallInst *GrainsizeCall) override final;
+  Value *emitNumWorkers(IRBuilderBase &B) override final;
   void lowerSync(SyncInst &SI) override final;
   void lowerReducerOperation(CallBase *CI) override;
 
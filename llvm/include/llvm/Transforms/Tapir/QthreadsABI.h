@@ -17,14 +17,20 @@
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
 
 namespace llvm {
+class QthreadsLoop;
 
 class QthreadsABI : public TapirTarget {
+  friend class QthreadsLoop;
+
   ValueToValueMapTy SyncRegionToSinc;
+  // Sync regions that share the sinc of another sync region.
+  DenseMap<Value *, Value *> SyncRegionToSincLeader;
 
   Type *QthreadFTy = nullptr;
 
   // Opaque Qthreads RTS functions
   FunctionCallee QthreadNumWorkers = nullptr;
+  FunctionCallee QthreadFork = nullptr;
   FunctionCallee QthreadForkCopyargs = nullptr;
   FunctionCallee QthreadInitialize = nullptr;
   FunctionCallee QtSincCreate = nullptr;
@@ -35,6 +41,7 @@ class QthreadsABI : public TapirTarget {
 
   // Accessors for opaque Qthreads RTS functions
   FunctionCallee get_qthread_num_workers();
+  FunctionCallee get_qthread_fork();
   FunctionCallee get_qthread_fork_copyargs();
   FunctionCallee get_qthread_initialize();
   FunctionCallee get_qt_sinc_create();
@@ -44,18 +51,18 @@ class QthreadsABI : public TapirTarget {
   FunctionCallee get_qt_sinc_destroy();
 
   Value *getOrCreateSinc(Value *SyncRegion, Function *F);
+  void poolSincs(Function &F, TaskInfo &TI);
 public:
   QthreadsABI(Module &M);
   ~QthreadsABI() { SyncRegionToSinc.clear(); }
 
-  ArgStructMode getArgStructMode() const override final {
-    return ArgStructMode::Static;
-  }
+  ArgStructMode getArgStructMode() const override final;
   Type *getReturnType() const override final {
     return Type::getInt32Ty(M.getContext());
   }
 
   Value *lowerGrainsizeCall(CallInst *GrainsizeCall) override final;
+  Value *emitNumWorkers(IRBuilderBase &B) override final;
   void lowerSync(SyncInst &SI) override final;
 
   bool preProcessFunction(Function &F, TaskInfo &TI,
@@ -75,6 +82,26 @@ public:
   }
   void processSubTaskCall(TaskOutlineInfo &TOI,
                           DominatorTree &DT) override final;
+
+  LoopOutlineProcessor *
+  getLoopOutlineProcessor(const TapirLoopInfo *TL) override final;
+};
+
+/// The QthreadsLoop loop-outline processor runs a Tapir loop as one qthread
+/// per worker-sized chunk of iterations.  The qthreads share the arguments of
+/// the outlined helper through a frame in the parent, and signal the sinc of
+/// the parent when they finish.
+class QthreadsLoop : public LoopOutlineProcessor {
+  QthreadsABI *TTarget;
+
+public:
+  QthreadsLoop(Module &M, QthreadsABI *Target)
+      : LoopOutlineProcessor(M), TTarget(Target) {}
+
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
 };
 
 }  // end of llvm namespace
@@ -17,14 +17,23 @@
 #define REALM_ENABLE_C_BINDINGS TRUE
 
 // #include "llvm/Transforms/Tapir/LoopSpawning.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
 
 namespace llvm {
 
+class RealmLoop;
+
 class RealmABI : public TapirTarget {
+  friend class RealmLoop;
 
   ValueToValueMapTy SyncRegionToBarrier;
 
+  // Sync regions of the Tapir loops lowered to index-space launches
+  // and the (per function) event that the launches are chained on.
+  SmallPtrSet<Value *, 8> LoopSyncRegions;
+  DenseMap<Function *, AllocaInst *> LoopEvents;
+
   Type *RealmFTy = nullptr;
   Type *TaskFuncPtrTy = nullptr;
 
@@ -36,6 +45,9 @@ class RealmABI : public TapirTarget {
   FunctionCallee RealmFinalize = nullptr;
   FunctionCallee CreateBar = nullptr;
   FunctionCallee DestroyBar = nullptr;
+  FunctionCallee RealmSpawnLoop = nullptr;
+  FunctionCallee RealmWaitEvent = nullptr;
+  FunctionCallee RealmSpawnLoopDistributed = nullptr;
 
   // Accessors for opaque Realm RTS functions
   FunctionCallee get_realmGetNumProcs();
@@ -45,6 +57,13 @@ class RealmABI : public TapirTarget {
   FunctionCallee get_realmFinalize();
   FunctionCallee get_createRealmBarrier();
   FunctionCallee get_destroyRealmBarrier();
+  FunctionCallee get_realmSpawnLoop();
+  FunctionCallee get_realmWaitEvent();
+  FunctionCallee get_realmSpawnLoopDistributed();
+
+  Value *getOrCreateLoopEvent(Function *F);
+  void lowerLoopSyncs(Function &F);
+  void initRuntime(Function &F);
 
 public:
   RealmABI(Module &M);
@@ -63,6 +82,13 @@ public:
   void postProcessHelper(Function &F) override final;
   Function *formatFunctionToRealmF(Function *extracted, Instruction *ical);
 
+  void pushLoopSR(Value *SR) { LoopSyncRegions.insert(SR); }
+
+  // Return the Realm outline processor: Tapir loops become a single
+  // index-space launch rather than a task per iteration.
+  LoopOutlineProcessor *
+  getLoopOutlineProcessor(const TapirLoopInfo *TL) override final;
+
   // not used
   // void processOutlinedTask(Function &F) override final {}
   // void processSpawner(Function &F) override final {}
@@ -86,6 +112,48 @@ public:
   void preProcessRootSpawner(Function &F, BasicBlock *TFEntry) override final;
   void postProcessRootSpawner(Function &F, BasicBlock *TFEntry) override final;
 };
+
+/// The loop outline processor for the Realm target.  The outlined loop
+/// helper runs a contiguous range of iterations and the call to it is
+/// replaced by a single launch (realmSpawnLoop) that splits the
+/// iteration space into one chunk per Realm processor.  Launches within
+/// a function are chained on Realm events: each launch is preconditioned
+/// on the completion of the previous one so the wait at the end of a
+/// loop can be dropped when the next launch follows it directly.
+///
+/// In distributed mode (-realmabi-distributed) the launch also describes
+/// the arrays the loop accesses so the runtime can partition them into
+/// Realm instances across nodes, run each chunk on the node that owns
+/// its partition and copy the halos of stencil accesses between nodes.
+class RealmLoop : public LoopOutlineProcessor {
+  RealmABI *TTarget;
+  // The induction variable of the outlined helper.
+  PHINode *HelperIV = nullptr;
+
+  // Return the descriptors of the arrays accessed by the outlined loop
+  // (called by ReplCall) for a distributed launch.
+  Constant *getRegionDescs(CallBase *ReplCall, StructType *ArgsTy,
+                           unsigned &NumDescs);
+
+public:
+  RealmLoop(Module &M, RealmABI *Target)
+      : LoopOutlineProcessor(M), TTarget(Target) {}
+
+  void setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                            SmallVectorImpl<Value *> &HelperInputs,
+                            ValueSet &InputSet,
+                            const SmallVectorImpl<Value *> &LCArgs,
+                            const SmallVectorImpl<Value *> &LCInputs,
+                            const ValueSet &TLInputsFixed) override;
+  unsigned getIVArgIndex(const Function &F,
+                         const ValueSet &Args) const override;
+  unsigned getLimitArgIndex(const Function &F,
+                            const ValueSet &Args) const override;
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
+};
 } // namespace llvm
 
 #endif
@@ -0,0 +1,32 @@
+//===- TapirCoarsenRecursion.h - Serialize small recursion ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRCOARSENRECURSION_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRCOARSENRECURSION_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Module;
+
+/// Pass to clone recursive functions that spawn into a parallel and a serial
+/// version, and to run the serial version for the calls whose problem size
+/// is at most a grainsize, so that divide-and-conquer recursion stops
+/// spawning near its leaves.
+class TapirCoarsenRecursionPass
+    : public PassInfoMixin<TapirCoarsenRecursionPass> {
+public:
+  explicit TapirCoarsenRecursionPass() {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRCOARSENRECURSION_H_
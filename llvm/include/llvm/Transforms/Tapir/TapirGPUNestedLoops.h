@@ -0,0 +1,30 @@
+//===- TapirGPUNestedLoops.h - Nested GPU Tapir loops -----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRGPUNESTEDLOOPS_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRGPUNESTEDLOOPS_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to map a Tapir loop nested in a GPU-targeted Tapir loop onto the
+/// lanes of a warp: each group of lanes runs one iteration of the outer loop
+/// and the lanes share the iterations of the inner loop.
+class TapirGPUNestedLoopsPass : public PassInfoMixin<TapirGPUNestedLoopsPass> {
+public:
+  explicit TapirGPUNestedLoopsPass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRGPUNESTEDLOOPS_H_
@@ -13,8 +13,19 @@
 #ifndef TapirGPUUtils_H_
 #define TapirGPUUtils_H_
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Constant.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
+#include <functional>
+
+namespace llvm {
+class DominatorTree;
+class Loop;
+class LoopInfo;
+class OptimizationRemarkEmitter;
+class TapirLoopInfo;
+}
 
 namespace tapir {
 using namespace llvm;
@@ -29,14 +40,479 @@ Constant *createConstantStr(const std::string &Str, Module &M,
 extern void appendToGlobalCtors(llvm::Module &M, llvm::Constant *C,
                                 int Priority, llvm::Constant *Data);
 
+/// Find the functions among Fns that are identical to an earlier one of
+/// Fns (e.g., the kernels of the same loop in different instantiations
+/// of a template).  Returns each such function paired with the earliest
+/// function it is identical to.
+extern SmallVector<std::pair<Function *, Function *>, 8>
+findIdenticalFunctions(ArrayRef<Function *> Fns);
+
+/// Make the (private, constant) strings of host module M that name the
+/// kernel From name the kernel To instead.  The strings naming From are
+/// erased; returns the string naming To, or nullptr if M has no string
+/// naming From.
+extern GlobalVariable *renameKernelReferences(Module &M, StringRef From,
+                                              StringRef To);
+
 struct KernelInstMixData {
   uint64_t num_memory_ops;
   uint64_t num_flops;
   uint64_t num_iops;
+  uint64_t num_memory_bytes;
+};
+
+// Flags describing properties of a generated kernel that are passed to
+// the runtime along with the kernel's instruction mix.  NOTE: These
+// values must match the KITRT_KERNEL_* flags in the kitsune runtime
+// (kitrt.h).
+enum KernelFlags {
+  // Each thread executes iterations strided by the total number of
+  // threads in the grid, so the kernel covers its iteration space with
+  // any number of blocks.
+  KernelGridStride = 0x1,
+  // The kernel reduces into one or more of its arguments (see
+  // lowerGPUReductions()).  All threads must be launched on the same
+  // device.
+  KernelReduction = 0x2,
+  // The trip count is folded into the kernel, which must be launched over
+  // its full iteration space (i.e., not split across devices).
+  KernelFixedTripCount = 0x4
 };
 
 extern void getKernelInstructionMix(const llvm::Function *F,
                                     KernelInstMixData &InstMix);
+
+/// Return a (private) constant string with the source location of the
+/// given loop as "file:line:col", or a null pointer if the loop has no
+/// debug location.  The runtime profiler uses it to map the metrics of
+/// a kernel back to its forall.
+extern Constant *getKernelSourceLocation(const llvm::Loop *L, Module &M,
+                                         const std::string &Name);
+
+// Access modes for kernel arguments derived from kitsune's memory
+// access attributes.  NOTE: These values must match KitRTMemAccess in
+// the kitsune runtime (kitrt.h).
+enum KernelArgAccess {
+  KernelArgReadWrite = 0,
+  KernelArgReadOnly = 1,
+  KernelArgWriteOnly = 2,
+  KernelArgNone = 3
+};
+
+/// Return the access mode of the given (pointer) kernel argument.  The
+/// mode is taken from the "kitsune.readonly", "kitsune.writeonly" and
+/// "kitsune.readwrite" attributes placed on the parameters (or function)
+/// the argument is derived from.  If no attribute is present and the
+/// corresponding parameter of the kernel (KernelArg) is never written
+/// through, the argument is treated as read-only.  All other arguments
+/// are conservatively treated as read-write.
+extern KernelArgAccess
+getKernelArgAccess(const llvm::Value *V,
+                   const llvm::Argument *KernelArg = nullptr);
+
+/// Return true if the given pointer argument is only ever used to read
+/// memory within its function (i.e., it is never stored to, stored, or
+/// passed to a call that might write through it).
+extern bool isReadOnlyKernelArg(const llvm::Argument *A);
+
+/// Mark the kernel parameter KernelArg, whose launch-site argument is V,
+/// noalias and readonly if V is declared read-only by a kitsune memory
+/// access attribute (_readonly) and the kernel does not write through
+/// it.  The attribute promises that nothing writes the data while the
+/// kernel runs, which lets the GPU back ends load it through their
+/// read-only data paths (e.g., ld.global.nc on NVPTX, scalar loads on
+/// AMDGPU).  Returns true if the parameter was marked.
+extern bool addReadOnlyKernelArgAttrs(llvm::Argument *KernelArg,
+                                      const llvm::Value *V);
+
+/// Return the access mode of a pointer argument at a launch site,
+/// Access, refined by what the (optimized) kernel does with the
+/// corresponding parameter A: KernelArgNone if the kernel never accesses
+/// the memory A points to (A is dead, or only compared against
+/// constants), and KernelArgReadOnly (for a read-write Access) if the
+/// kernel only reads it.  A write-only mode is never inferred -- a kernel
+/// that does not write all of the memory needs its current contents.
+extern KernelArgAccess refineKernelArgAccess(KernelArgAccess Access,
+                                             const llvm::Argument *A);
+
+/// Return the earliest point ahead of the given kernel launch (or launch
+/// setup) instruction where a prefetch of the memory referenced by Ptr
+/// may be issued.  The search walks backwards through straight-line code
+/// -- the launch's block and any chain of unique predecessors that
+/// branch unconditionally into it -- and stops at the definition of
+/// Ptr, at any instruction that may write the memory Ptr references
+/// (including calls that may write memory), or after MaxInsts
+/// instructions.  The returned instruction is the insertion point for
+/// the prefetch; nullptr is returned if the prefetch cannot be hoisted
+/// above the launch.
+extern llvm::Instruction *
+getEarliestPrefetchPoint(llvm::Value *Ptr, llvm::Instruction *Launch,
+                         unsigned MaxInsts = 256);
+
+/// Return the point ahead of the given kernel launch (or launch setup)
+/// instruction where the host can store the kernel argument V once for
+/// every launch of the surrounding host loops: the end of the preheader
+/// of the outermost loop around the launch that V is invariant in.
+/// nullptr is returned if the launch is not within such a loop (or the
+/// loop has no preheader) and V must be stored ahead of each launch.
+extern llvm::Instruction *
+getInvariantLaunchArgPoint(llvm::Value *V, llvm::Instruction *Launch,
+                           const llvm::DominatorTree &DT,
+                           const llvm::LoopInfo &LI);
+
+/// Return true if the host reads the memory referenced by Ptr after the
+/// given kernel launch and before any of the other launches in
+/// OtherLaunches that use it, i.e., if the data the kernel writes
+/// should be prefetched back to the host.  Reads are loads through
+/// pointers derived from Ptr's underlying object and calls (other than
+/// to the kitsune runtime) that take such a pointer; reads by the
+/// callers of the launch's function are not considered.  When the
+/// launch is within loops that the reads are all outside of, ExitLoop
+/// is set to the outermost such loop: prefetching after each launch
+/// would move the data back and forth on every iteration, and the
+/// prefetch belongs at the exits of the loop instead.  Otherwise
+/// ExitLoop is set to null and the prefetch follows the launch.
+extern bool isReadOnHostAfterLaunch(llvm::Value *Ptr, llvm::Instruction *Launch,
+                                    llvm::ArrayRef<llvm::Instruction *>
+                                        OtherLaunches,
+                                    const llvm::DominatorTree &DT,
+                                    const llvm::LoopInfo &LI,
+                                    llvm::Loop *&ExitLoop);
+
+/// Target-specific pieces used to generate block-wide reductions (and shared
+/// memory tiles, see stageGPUTileLoads()) within a kernel.  When WarpSize is
+/// non-zero, ShuffleDown must return the (i32) value held by the thread Offset
+/// lanes above the calling thread within its warp; Mask is the set of lanes
+/// that are present in the warp.  When WarpSize is zero reductions are done
+/// entirely in shared memory.  Barrier synchronizes (and orders the shared
+/// memory accesses) of all threads in a block.  When provided, ActiveMask
+/// returns the set of lanes of the warp that are executing and MatchAny returns
+/// the set of lanes among Mask whose (i64) Key equals the calling lane's.  When
+/// provided, AsyncCopy issues an asynchronous copy of Size bytes from global
+/// memory at Src to shared memory at Dst -- returning false if it can't copy
+/// Size bytes -- and AsyncCopyWait waits for the calling thread's asynchronous
+/// copies to complete.  ShuffleXor returns the (i32) value held by the lane
+/// whose index differs from the calling lane's in the bits of Offset, within
+/// aligned groups of Width lanes, and LaneSync synchronizes (and orders the
+/// memory accesses of) such a group; Mask is the set of lanes of the caller's
+/// group when WarpSize is non-zero (see lowerGPULaneCalls()).
+struct GPUReductionHooks {
+  unsigned WarpSize = 0;
+  unsigned MaxThreadsPerBlock = 1024;
+  unsigned SharedAddrSpace = 3;
+  std::function<llvm::Value *(llvm::IRBuilder<> &)> ThreadIdx;
+  std::function<llvm::Value *(llvm::IRBuilder<> &)> BlockDim;
+  std::function<llvm::Value *(llvm::IRBuilder<> &, llvm::Value *Val,
+                              llvm::Value *Offset, llvm::Value *Mask)>
+      ShuffleDown;
+  std::function<void(llvm::IRBuilder<> &)> Barrier;
+  std::function<llvm::Value *(llvm::IRBuilder<> &)> ActiveMask;
+  std::function<llvm::Value *(llvm::IRBuilder<> &, llvm::Value *Mask,
+                              llvm::Value *Key)>
+      MatchAny;
+  std::function<bool(llvm::IRBuilder<> &, llvm::Value *Dst, llvm::Value *Src,
+                     unsigned Size)>
+      AsyncCopy;
+  std::function<void(llvm::IRBuilder<> &)> AsyncCopyWait;
+  std::function<llvm::Value *(llvm::IRBuilder<> &, llvm::Value *Val,
+                              llvm::Value *Offset, unsigned Width,
+                              llvm::Value *Mask)>
+      ShuffleXor;
+  std::function<void(llvm::IRBuilder<> &, llvm::Value *Mask)> LaneSync;
+};
+
+/// A kernel argument that the kernel reduces into and the size (in
+/// bytes) of the reduced value.
+struct GPUReductionArg {
+  unsigned ArgNo;
+  uint64_t Size;
+};
+
+/// Replace reductions in the given kernel with block-wide (tree)
+/// reductions.  A reduction is recognized as a set of atomic
+/// read-modify-write operations (add, min, max, and, or, xor) whose
+/// results are unused and that are the only uses of a kernel argument.
+/// Each thread accumulates its updates privately; the threads of a block
+/// then combine their values -- via warp shuffles and shared memory --
+/// and a single thread per block atomically updates the argument.  The
+/// kernel must have a single return that is reached by all threads of
+/// a block.  The arguments that were transformed are returned.
+extern llvm::SmallVector<GPUReductionArg, 4>
+lowerGPUReductions(llvm::Function &F, const GPUReductionHooks &Hooks);
+
+/// Reduce the contention of histogram-like atomic updates in the given
+/// kernel -- atomic read-modify-write operations (see
+/// lowerGPUReductions()) of an element of a kernel argument at a
+/// computed index.  When every access through the argument is such an
+/// update and the index is known to be less than a small bound, each
+/// block accumulates into a private copy of the elements in shared memory
+/// (at most MaxPrivateBytes) that is merged into the argument when the
+/// block is done; the kernel must have a single return that is reached by
+/// all threads of a block.  Otherwise, updates by a constant are
+/// aggregated across the lanes of a warp that update the same element
+/// (if the target provides MatchAny), so that a single lane performs the
+/// update.  The number of updates that were transformed is returned.
+extern unsigned lowerGPUHistograms(llvm::Function &F,
+                                   const GPUReductionHooks &Hooks,
+                                   uint64_t MaxPrivateBytes = 16384);
+
+/// The placeholder functions that the lane groups of nested GPU Tapir loops
+/// (see TapirGPUNestedLoops) call ahead of outlining:
+///
+///   void __kitrt_gpu_lane_sync(i32 Width)
+///   i32 __kitrt_gpu_lane_shfl_xor(i32 Val, i32 Offset, i32 Width)
+///
+/// with constant Offset and Width.
+const char *const GPULaneSyncName = "__kitrt_gpu_lane_sync";
+const char *const GPULaneShuffleXorName = "__kitrt_gpu_lane_shfl_xor";
+
+/// Replace the calls of the lane group placeholders in kernel F with the
+/// target's shuffles and synchronization (the ShuffleXor and LaneSync
+/// hooks).  The groups are aligned, consecutive lanes of a warp, so a
+/// kernel's blocks must be a multiple of the group size.  Returns the
+/// number of calls replaced.
+extern unsigned lowerGPULaneCalls(llvm::Function &F,
+                                  const GPUReductionHooks &Hooks);
+
+/// A two or three dimensional iteration space recovered from the index
+/// arithmetic of a loop over a flattened (row-major) space -- e.g.,
+/// 'i = tid / N; j = tid % N' or the lowering of a Kokkos MDRangePolicy.
+/// Dimension 0 (x) varies the fastest.  The extents of the inner
+/// dimensions are the divisors of the index arithmetic (kernel
+/// arguments or constants); the outermost extent follows from the trip
+/// count of the loop.
+struct GPUFlattenedIndex {
+  unsigned NumDims = 1;
+  llvm::Value *Extents[2] = {nullptr, nullptr};
+  // The (unsigned) division and remainder of each inner dimension.  A
+  // remainder may take the expanded 'X - (X / D) * D' form.
+  llvm::Instruction *Quot[2] = {nullptr, nullptr};
+  llvm::Instruction *Rem[2] = {nullptr, nullptr};
+};
+
+/// Return true if the given induction variable of a kernel is split
+/// into multi-dimensional coordinates by an unsigned division and
+/// remainder by the same extent (details are returned in FI).  Other
+/// uses of the induction variable are allowed.
+extern bool findFlattenedIndex(llvm::Function &F, llvm::PHINode *IV,
+                               GPUFlattenedIndex &FI);
+
+/// Replace the index arithmetic described by FI with the given
+/// per-dimension coordinates (x first, of the induction variable's
+/// type) and return the flattened index that corresponds to them.  The
+/// code is inserted at the builder's insertion point, which must
+/// dominate the induction variable's uses.  The extents in FI remain
+/// valid.
+extern llvm::Value *rewriteFlattenedIndex(llvm::IRBuilder<> &B,
+                                          GPUFlattenedIndex &FI,
+                                          llvm::ArrayRef<llvm::Value *> Coords);
+
+/// Return true if every access through the given pointer argument is a
+/// simple load or store of a single element at 'A[IV + C]' for constant
+/// offsets C.  The range of offsets (inclusive) and the type of the
+/// elements are returned.
+extern bool getStencilAccessRange(llvm::Argument *A, llvm::PHINode *IV,
+                                  int64_t &MinOffset, int64_t &MaxOffset,
+                                  llvm::Type *&ElemTy);
+
+/// A Tapir loop whose body only copies or fills a single element per
+/// iteration -- 'A[IV + C] = B[IV + D]' or 'A[IV + C] = V' for constant
+/// offsets C and D and a loop-invariant value V.  The loop as a whole is
+/// a memcpy (or memset) of the elements [Start + C, End + C) of A, which
+/// a GPU can hand to its copy engines instead of launching a kernel.
+struct GPUMemIdiom {
+  enum IdiomKind { None = 0, Copy = 1, Set = 2 };
+  IdiomKind Kind = None;
+  llvm::Value *Dst = nullptr;  // the base of the stored array (A).
+  llvm::Value *Src = nullptr;  // the base of the copied array (B).
+  llvm::Value *Fill = nullptr; // the stored value (V).
+  llvm::Type *ElemTy = nullptr;
+  int64_t DstOffset = 0;       // C
+  int64_t SrcOffset = 0;       // D
+};
+
+/// Return true if the given Tapir loop (prior to outlining) is a memcpy
+/// or memset idiom; details are returned in MI.  The primary induction
+/// variable must step by one, the loop's task must be a single block
+/// whose only side effect is the store, and the array bases (and a
+/// non-constant fill value) must be defined outside of the loop.
+extern bool findGPUMemIdiom(llvm::TapirLoopInfo &TL, GPUMemIdiom &MI);
+
+/// A Tapir loop whose iterations each compute an element of a matrix
+/// product with rows of K elements,
+///
+///   C[IV] = sum(A[(IV / N) * K + k] * B[(IV % N) * K + k], 0 <= k < K)
+///
+/// -- the product of a row-major M x K matrix A and the transpose of
+/// a row-major N x K matrix B -- or a matrix-vector product,
+///
+///   C[IV] = sum(A[IV * K + k] * B[k], 0 <= k < K)
+///
+/// for which N is null (one).  A vendor BLAS library computes these
+/// far faster than the loop's kernel.
+struct GPUBlasIdiom {
+  enum IdiomKind { None = 0, Gemm = 1 };
+  IdiomKind Kind = None;
+  llvm::Value *A = nullptr;
+  llvm::Value *B = nullptr;
+  llvm::Value *C = nullptr;
+  llvm::Value *N = nullptr;
+  llvm::Value *K = nullptr;
+  llvm::Type *ElemTy = nullptr; // float or double.
+};
+
+/// Return true if the given Tapir loop (prior to outlining) is a matrix
+/// product idiom; details are returned in BI.  The primary induction
+/// variable must step by one, the sum must be an inner loop over k
+/// whose additions allow reassociation (e.g., -ffast-math), the store
+/// of the sum must be the task's only side effect, and the matrices
+/// and extents must be defined outside of the loop.
+extern bool findGPUBlasIdiom(llvm::TapirLoopInfo &TL, GPUBlasIdiom &BI);
+
+/// The dynamic shared memory used by a kernel: BytesPerThread for each
+/// thread of a block plus Bytes for the block as a whole.
+struct GPUSharedMemSize {
+  uint64_t BytesPerThread = 0;
+  uint64_t Bytes = 0;
+};
+
+/// Stage the neighborhoods of stencil-like loads of a one-dimensional
+/// kernel into (dynamic) shared memory.  A candidate is a set of loads
+/// of a read-only kernel argument at 'A[IV + C]' for constant offsets C
+/// that spans at most MaxHalo elements beyond the block and that are
+/// executed by every iteration.  The threads of a block cooperatively
+/// load the block's tile of A (including its halo), within the range
+/// touched by the iterations [Start, End), ahead of InsertPt -- which
+/// every thread of the block must reach -- and the loads are replaced
+/// by reads of the tile.  Each thread must execute (at most) a single
+/// iteration of the loop with the given induction variable, starting at
+/// ThreadIV.  The tiles are loaded with asynchronous copies when the
+/// target provides them (see GPUReductionHooks), so the elements go
+/// straight to shared memory and all of a thread's copies are in flight
+/// at once.  The shared memory required by the tiles is returned (zero
+/// if no loads were staged).
+extern GPUSharedMemSize
+stageGPUTileLoads(llvm::Function &F, llvm::PHINode *IV, llvm::Value *ThreadIV,
+                  llvm::Value *Start, llvm::Value *End,
+                  llvm::Instruction *InsertPt, const GPUReductionHooks &Hooks,
+                  unsigned MaxHalo = 32);
+
+/// Give the loop of a one-dimensional kernel a copy that runs with a
+/// 32-bit induction variable.  IV is the (wider) induction variable of
+/// the loop, which must step by a loop invariant amount, and Exit is the
+/// block the loop exits to.  The loop's latch must exit when the IV's
+/// increment reaches one of Limits, none of which may exceed End.  The
+/// copy runs when End plus the step fits in 32 bits, which every thread
+/// of a launch decides the same way.  The exit tests of the copy are
+/// done in 32 bits and other uses of its IV see the IV's zero extension,
+/// so address computations remain correct.  Returns false (leaving the
+/// loop unchanged) if the IV is not wider than 32 bits or values of the
+/// loop are used outside of it.
+extern bool narrowGPULoopIV(llvm::PHINode *IV, llvm::BasicBlock *Exit,
+                            llvm::Value *End,
+                            llvm::ArrayRef<llvm::Value *> Limits);
+
+/// Replace the unsigned divisions (and remainders) of kernel F by values
+/// that are the same for every thread of a launch (the kernel's
+/// parameters and values computed from them in its entry block) with a
+/// multiplication by a precomputed inverse.  The inverse of a divisor is
+/// computed once per thread at the start of the kernel, so only the
+/// divisions that a thread repeats are replaced: those in the loops of
+/// the kernel, other than its outermost loop unless Strided is set
+/// (i.e., each thread runs many iterations of it), and divisors used by
+/// several divisions.  64-bit divisions are replaced when their dividend
+/// is known to fit in 32 bits.  Returns the number of divisions replaced.
+extern unsigned reduceGPUDivisions(llvm::Function &F, bool Strided);
+
+/// Mark the loops of kernel F that index a private array -- a static
+/// alloca of at most MaxBytes -- with an index that varies in the loop
+/// for full unrolling.  Once unrolled (when their trip counts are small
+/// constants) the accesses have constant indices and SROA promotes the
+/// array to registers; otherwise the array lives in the thread's local
+/// memory, which is as slow as global memory.  Loops with unroll hints
+/// are left alone.  Returns the number of loops marked.
+extern unsigned markGPUPrivateArrayLoops(llvm::Function &F,
+                                         uint64_t MaxBytes);
+
+/// Move the private arrays (the allocas) left in the entry block of
+/// kernel F into per-thread slices of shared memory arrays sized for
+/// blocks of MaxThreads threads -- which the kernel's launches must not
+/// exceed -- for as long as the total fits in MaxSharedBytes.  The
+/// arrays that remain in local memory are reported with missed-
+/// optimization remarks of pass PassName.  Returns the (static) shared
+/// memory used.
+extern uint64_t promoteGPUPrivateArrays(llvm::Function &F,
+                                        const GPUReductionHooks &Hooks,
+                                        unsigned MaxThreads,
+                                        uint64_t MaxSharedBytes,
+                                        llvm::OptimizationRemarkEmitter &ORE,
+                                        const char *PassName);
+
+/// The accuracy of the device math functions that replace calls of libm
+/// functions (and math intrinsics) in kernels.
+enum GPUMathAccuracy {
+  // The (IEEE conforming) accuracy of the host functions.
+  GPUMathIEEE = 0,
+  // The fast variants of the single precision transcendental functions
+  // (i.e., what -ffast-math selects in CUDA and HIP).
+  GPUMathFast = 1,
+  // The fast variants plus the hardware approximations of square roots.
+  GPUMathApprox = 2
+};
+
+/// The device math libraries: CUDA's libdevice (__nv_*) and ROCm's ocml
+/// (__ocml_*).
+enum GPUMathLibrary { GPUMathLibDevice = 0, GPUMathOCML = 1 };
+
+/// Return the accuracy of the math functions used by function F.  This is
+/// the -tapir-gpu-math accuracy of the translation unit, or GPUMathFast if
+/// F was compiled with approximate functions allowed (e.g., -ffast-math).
+extern GPUMathAccuracy getGPUMathAccuracy(const llvm::Function &F);
+
+/// Return the accuracy of the math function used by the given call: the
+/// accuracy of its function, or GPUMathFast if the call itself allows an
+/// approximate function.
+extern GPUMathAccuracy getGPUMathAccuracy(const llvm::CallBase &CB);
+
+/// Return the name of the function of device library Lib that replaces
+/// the libm function (or math intrinsic) Name at accuracy Acc, or an
+/// empty string if there is none.  The name may be that of an NVVM or
+/// AMDGCN intrinsic.  Lookups take constant time.
+extern StringRef getGPUMathFunction(StringRef Name, GPUMathLibrary Lib,
+                                    GPUMathAccuracy Acc);
+
+/// A slot in the process-wide pool of device code generation jobs.  The
+/// GPU ABIs hold one while they generate a kernel module's binary (the
+/// device optimization pipeline and the external tools), so that parallel
+/// (e.g., ThinLTO backend) threads do not each run device code generation
+/// at once and oversubscribe the machine.  The constructor blocks until
+/// one of -tapir-gpu-codegen-jobs slots is free; the destructor releases
+/// it.
+class GPUCodegenJob {
+public:
+  GPUCodegenJob();
+  ~GPUCodegenJob();
+  GPUCodegenJob(const GPUCodegenJob &) = delete;
+  GPUCodegenJob &operator=(const GPUCodegenJob &) = delete;
+};
+
+/// Place a copy of the device binary in BinaryFileName into a GPU ABI's
+/// cache of binaries as CacheFileName.  Failures only cost a future cache
+/// hit and are reported as warnings prefixed with ABIName.
+extern void cacheGPUBinary(StringRef BinaryFileName, StringRef CacheFileName,
+                           StringRef ABIName);
+
+/// Clean up the host side of module M after a GPU ABI has replaced its
+/// parallel loops with kernel launches.  The functions that call the GPU
+/// runtime (functions whose names start with RuntimePrefix) are run
+/// through a short pipeline of scalar cleanups (CSE of the launch setup,
+/// dead store and load elimination, CFG simplification) at OptLevel
+/// (1-3), built with a target machine for M's own (host) target rather
+/// than the device's.  Calls to runtime functions that M has
+/// available_externally definitions of -- fast paths linked in from the
+/// runtime's bitcode -- are inlined first.
+extern void optimizeGPUHostCode(Module &M, unsigned OptLevel,
+                                StringRef RuntimePrefix);
 } // namespace tapir
 
 #endif
@@ -0,0 +1,121 @@
+//===- TapirHybridLoop.h - Run Tapir loops on the host and GPU --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRHYBRIDLOOP_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRHYBRIDLOOP_H_
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Tapir/LoweringUtils.h"
+#include <memory>
+
+namespace llvm {
+
+extern cl::opt<bool> EnableTapirHostFallback;
+
+/// The loop outline processor for hybrid (host + GPU) execution of Tapir
+/// loops with the "tapir.loop.hybrid" hint.  It wraps the outline processor
+/// of the loop's GPU target: the kernel is created and launched by that
+/// processor, but only for the iterations [start, split).  A serial copy of
+/// the outlined loop runs the remaining iterations [split, end) on the host,
+/// as tasks lowered by the module's Tapir target (e.g., OpenCilk), while the
+/// kernel runs.  The split is chosen by the kitsune runtime from the
+/// throughput measured in earlier executions of the loop.
+class HybridLoop : public LoopOutlineProcessor {
+  std::unique_ptr<LoopOutlineProcessor> Device;
+  // The serial copy of the outlined loop and the host part of the loop.
+  Function *SerialHelper = nullptr;
+  Function *HostHelper = nullptr;
+  unsigned IVArgIndex = 0;
+  unsigned LimitArgIndex = 0;
+
+  Function *createHostHelper(Function *Serial);
+
+public:
+  HybridLoop(Module &M, LoopOutlineProcessor *Device);
+
+  ArgStructMode getArgStructMode() const override {
+    return Device->getArgStructMode();
+  }
+  void setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                            SmallVectorImpl<Value *> &HelperInputs,
+                            ValueSet &InputSet,
+                            const SmallVectorImpl<Value *> &LCArgs,
+                            const SmallVectorImpl<Value *> &LCInputs,
+                            const ValueSet &TLInputsFixed) override;
+  unsigned getIVArgIndex(const Function &F,
+                         const ValueSet &Args) const override {
+    return Device->getIVArgIndex(F, Args);
+  }
+  unsigned getLimitArgIndex(const Function &F,
+                            const ValueSet &Args) const override {
+    return Device->getLimitArgIndex(F, Args);
+  }
+  void preProcessTapirLoop(TapirLoopInfo &TL,
+                           ValueToValueMapTy &VMap) override {
+    Device->preProcessTapirLoop(TL, VMap);
+  }
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void remapData(ValueToValueMapTy &VMap) override {
+    Device->remapData(VMap);
+  }
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
+};
+
+/// The loop outline processor that runs GPU loops with small trip counts on
+/// the host.  It wraps the outline processor of the loop's GPU target and
+/// keeps a serial copy of the outlined loop: launches of at most
+/// -tapir-host-fallback-max-trips iterations ask the kitsune runtime whether
+/// the serial copy should run them on the calling thread instead, which it
+/// does if the loop's data is in host memory and the host is expected to
+/// finish the iterations before a kernel launch would.
+class HostFallbackLoop : public LoopOutlineProcessor {
+  std::unique_ptr<LoopOutlineProcessor> Device;
+  // The serial copy of the outlined loop (null if the loop always runs on
+  // the GPU).
+  Function *SerialHelper = nullptr;
+  unsigned IVArgIndex = 0;
+  unsigned LimitArgIndex = 0;
+
+public:
+  HostFallbackLoop(Module &M, LoopOutlineProcessor *Device);
+
+  ArgStructMode getArgStructMode() const override {
+    return Device->getArgStructMode();
+  }
+  void setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                            SmallVectorImpl<Value *> &HelperInputs,
+                            ValueSet &InputSet,
+                            const SmallVectorImpl<Value *> &LCArgs,
+                            const SmallVectorImpl<Value *> &LCInputs,
+                            const ValueSet &TLInputsFixed) override;
+  unsigned getIVArgIndex(const Function &F,
+                         const ValueSet &Args) const override {
+    return Device->getIVArgIndex(F, Args);
+  }
+  unsigned getLimitArgIndex(const Function &F,
+                            const ValueSet &Args) const override {
+    return Device->getLimitArgIndex(F, Args);
+  }
+  void preProcessTapirLoop(TapirLoopInfo &TL,
+                           ValueToValueMapTy &VMap) override {
+    Device->preProcessTapirLoop(TL, VMap);
+  }
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override;
+  void remapData(ValueToValueMapTy &VMap) override {
+    Device->remapData(VMap);
+  }
+  void processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                               DominatorTree &DT) override;
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRHYBRIDLOOP_H_
@@ -0,0 +1,31 @@
+//===- TapirIndirectPrefetch.h - Prefetch indirect accesses -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRINDIRECTPREFETCH_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRINDIRECTPREFETCH_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to prefetch the indirect accesses, a[idx[i]], of the serial loops in
+/// the bodies of CPU-targeted Tapir loops (e.g., the strips of a stripmined
+/// loop), some iterations ahead of their use.
+class TapirIndirectPrefetchPass
+    : public PassInfoMixin<TapirIndirectPrefetchPass> {
+public:
+  explicit TapirIndirectPrefetchPass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRINDIRECTPREFETCH_H_
@@ -0,0 +1,30 @@
+//===- TapirLICM.h - Hoist invariant code out of Tapir loops ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRLICM_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRLICM_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to hoist loop-invariant loads, and the computation that depends on
+/// them, out of the bodies of Tapir loops into the spawning code, relying on
+/// the bodies being free of races.
+class TapirLICMPass : public PassInfoMixin<TapirLICMPass> {
+public:
+  explicit TapirLICMPass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRLICM_H_
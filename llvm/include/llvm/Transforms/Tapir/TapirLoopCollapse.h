@@ -0,0 +1,30 @@
+//===- TapirLoopCollapse.h - Collapse nested Tapir loops --------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRLOOPCOLLAPSE_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRLOOPCOLLAPSE_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to collapse perfectly nested Tapir loops into a single Tapir loop
+/// over the linearized iteration space, so that the nest is spawned with one
+/// divide-and-conquer tree (or launched as one kernel).
+class TapirLoopCollapsePass : public PassInfoMixin<TapirLoopCollapsePass> {
+public:
+  explicit TapirLoopCollapsePass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRLOOPCOLLAPSE_H_
@@ -0,0 +1,29 @@
+//===- TapirLoopFusion.h - Fuse adjacent Tapir loops ------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRLOOPFUSION_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRLOOPFUSION_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to fuse adjacent GPU-targeted Tapir loops that share an iteration
+/// space, so that they are outlined as a single kernel with one launch.
+class TapirLoopFusionPass : public PassInfoMixin<TapirLoopFusionPass> {
+public:
+  explicit TapirLoopFusionPass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRLOOPFUSION_H_
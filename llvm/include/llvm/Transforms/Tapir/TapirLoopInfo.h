@@ -97,9 +97,16 @@ public:
   /// stronger forms.
   void replaceNonPrimaryIVs(PredicatedScalarEvolution &PSE);
 
+  /// Create a canonical induction variable, which starts at zero and steps by
+  /// one, for a countable loop without one, and make it the primary
+  /// induction.
+  bool createCanonicalInduction(PredicatedScalarEvolution &PSE);
+
   /// Identify the loop condition instruction, and determine if the loop uses an
-  /// inclusive or exclusive range.
-  bool getLoopCondition(const char *PassName, OptimizationRemarkEmitter *ORE);
+  /// inclusive or exclusive range.  A relational (rather than equality)
+  /// condition is only accepted if \p AllowRelational is set.
+  bool getLoopCondition(const char *PassName, OptimizationRemarkEmitter *ORE,
+                        bool AllowRelational = false);
 
   /// Fix up external users of the induction variable.
   void fixupIVUsers(PHINode *OrigPhi, const InductionDescriptor &II,
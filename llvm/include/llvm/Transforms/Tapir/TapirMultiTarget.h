@@ -0,0 +1,56 @@
+//===- TapirMultiTarget.h - Tapir loops for several targets -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Support for the "multi" Tapir target.  Each Tapir loop of a multi-target
+// module is versioned for each of the GPU targets (-tapir-multi-targets)
+// and for the host (OpenCilk) before the loops are outlined.  Each version
+// is then lowered by the loop's target as usual.  The version to run is
+// picked by the kitsune runtime (__kitrt_select_target()) from the devices
+// found on the system the first time it is asked, so it is fixed for the
+// whole execution; each execution of a loop only switches on the (cached)
+// selection.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRMULTITARGET_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRMULTITARGET_H_
+
+#include "llvm/IR/IRBuilder.h"
+
+namespace llvm {
+
+class DominatorTree;
+class Function;
+class LoopInfo;
+class Module;
+class ScalarEvolution;
+class TaskInfo;
+
+/// The targets selected by the runtime.
+/// NOTE: This must match the kitsune runtime (KitRTTarget in kitrt.h).
+enum class MultiTargetKind { Host = 0, Cuda = 1, Hip = 2 };
+
+/// Returns true if the Tapir loops of module \p M were versioned for
+/// several targets.
+bool isMultiTargetModule(const Module &M);
+
+/// Create a version of each multi-target Tapir loop in \p F for each of its
+/// targets, selected at runtime.  (Nested multi-target loops are versioned
+/// along with the outermost one.)  \p DT, \p LI and \p TI are updated for
+/// the new loops.  Returns true if \p F was changed.
+bool versionMultiTargetLoops(Function &F, DominatorTree &DT, LoopInfo &LI,
+                             TaskInfo &TI, ScalarEvolution &SE);
+
+/// If the module is a multi-target module, only run the remainder of the
+/// global constructor built by \p B if the runtime selected \p Kind.  \p B
+/// is left at the start of the guarded code.
+void guardMultiTargetCtor(IRBuilder<> &B, MultiTargetKind Kind);
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRMULTITARGET_H_
@@ -0,0 +1,30 @@
+//===- TapirSoA.h - Store arrays of structs as SoA --------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_TAPIR_TAPIRSOA_H_
+#define LLVM_TRANSFORMS_TAPIR_TAPIRSOA_H_
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+
+class Function;
+
+/// Pass to store the runtime-allocated arrays of structs marked with
+/// [[kitsune::soa]] as structures of arrays, so that the Tapir loops over
+/// them access each field contiguously.
+class TapirSoAPass : public PassInfoMixin<TapirSoAPass> {
+public:
+  explicit TapirSoAPass() {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_TAPIR_TAPIRSOA_H_
@@ -20,16 +20,18 @@
 namespace llvm {
 
 enum class TapirTargetID {
-  None,     // Perform no lowering
-  Serial,   // Lower to serial projection
-  Cuda,     // Lower to Cuda ABI
-  Hip,      // Lower to the Hip (AMD GPU) ABI
-  Lambda,   // Lower to generic Lambda ABI
-  OMPTask,  // Lower to OpenMP task ABI
-  OpenCilk, // Lower to OpenCilk ABI
-  OpenMP,   // Lower to OpenMP (TODO: Needs to be updated)
-  Qthreads, // Lower to Qthreads (TODO: Needs to be updated)
-  Realm,    // Lower to Realm (TODO: Needs to be updated)
+  None,      // Perform no lowering
+  Serial,    // Lower to serial projection
+  Cuda,      // Lower to Cuda ABI
+  Hip,       // Lower to the Hip (AMD GPU) ABI
+  LevelZero, // Lower to the Level Zero (SPIR-V GPU) ABI
+  Lambda,    // Lower to generic Lambda ABI
+  OMPTask,   // Lower to OpenMP task ABI
+  OpenCilk,  // Lower to OpenCilk ABI
+  OpenMP,    // Lower to OpenMP (TODO: Needs to be updated)
+  Qthreads,  // Lower to Qthreads (TODO: Needs to be updated)
+  Realm,     // Lower to Realm (TODO: Needs to be updated)
+  Multi,     // Lower loops for Cuda, Hip and OpenCilk, picked at runtime
   Last_TapirTargetID
 };
 
@@ -24,6 +24,7 @@ namespace llvm {
 class BasicBlock;
 class DominatorTree;
 class DomTreeUpdater;
+class IRBuilderBase;
 class Loop;
 class LoopInfo;
 class MemorySSAUpdater;
@@ -248,6 +249,9 @@ public:
   enum SpawningStrategy {
     ST_SEQ,
     ST_DAC,
+    ST_STATIC,
+    ST_DYNAMIC,
+    ST_GUIDED,
     ST_END,
   };
 
@@ -256,7 +260,10 @@ private:
                   HK_GRAINSIZE,
                   HK_LOOPTARGET,
                   HK_THREADS_PER_BLOCK,
-                  HK_AUTO_TUNE };
+                  HK_AUTO_TUNE,
+                  HK_HYBRID,
+                  HK_ASYNC,
+                  HK_LAUNCH_PARAM };
 
   /// Hint - associates name and validation with the hint value.
   struct Hint {
@@ -280,6 +287,11 @@ private:
 	return Val;
       case HK_AUTO_TUNE:
 	return Val;
+      case HK_HYBRID:
+      case HK_ASYNC:
+        return Val <= 1;
+      case HK_LAUNCH_PARAM:
+        return true;
       }
       return false;
     }
@@ -293,6 +305,25 @@ private:
   Hint LoopTarget;
   Hint ThreadsPerBlock;
   Hint AutoTune;
+  /// Run the loop on both the host and its (GPU) loop target.
+  Hint Hybrid;
+  /// Wait for the loop at the enclosing sync rather than at its end.
+  Hint Async;
+  /// GPU launch configuration from kitsune's launch attribute (zero if
+  /// left to the runtime).
+  Hint MaxBlocksPerGrid;
+  Hint MinBlocksPerMultiproc;
+  Hint SharedMemBytes;
+  Hint ItersPerThread;
+  /// The priority of the GPU stream the loop's kernel is launched on: 0
+  /// for the default, 1 for high and 2 for low.
+  Hint Priority;
+  /// The ID of the values the loop's kernel is specialized on (zero if
+  /// none).
+  Hint Specialize;
+  /// The number of consecutive iterations (GPU lanes) that cooperate on an
+  /// iteration of a nested loop (zero if the loop has no lane groups).
+  Hint GPULanes;
 
   /// Return the loop metadata prefix.
   static StringRef Prefix() { return "tapir.loop."; }
@@ -304,6 +335,12 @@ public:
       return "Spawn iterations sequentially";
     case TapirLoopHints::ST_DAC:
       return "Use divide-and-conquer";
+    case TapirLoopHints::ST_STATIC:
+      return "Spawn one chunk of iterations per worker";
+    case TapirLoopHints::ST_DYNAMIC:
+      return "Spawn chunks of grainsize iterations";
+    case TapirLoopHints::ST_GUIDED:
+      return "Spawn chunks of decreasing size";
     case TapirLoopHints::ST_END:
       return "Unknown";
     }
@@ -319,6 +356,16 @@ public:
 	ThreadsPerBlock("kitsune.launch.threads.per.block", 0,
 			HK_THREADS_PER_BLOCK),
 	AutoTune("kitsune.launch.auto.tune", 0, HK_AUTO_TUNE),
+        Hybrid("hybrid", 0, HK_HYBRID),
+        Async("async", 0, HK_ASYNC),
+        MaxBlocksPerGrid("kitsune.launch.max.blocks", 0, HK_LAUNCH_PARAM),
+        MinBlocksPerMultiproc("kitsune.launch.min.blocks.per.multiproc", 0,
+                              HK_LAUNCH_PARAM),
+        SharedMemBytes("kitsune.launch.shared.bytes", 0, HK_LAUNCH_PARAM),
+        ItersPerThread("kitsune.launch.iters.per.thread", 0, HK_LAUNCH_PARAM),
+        Priority("kitsune.priority", 0, HK_LAUNCH_PARAM),
+        Specialize("kitsune.specialize", 0, HK_LAUNCH_PARAM),
+        GPULanes("kitsune.gpu.lanes", 0, HK_LAUNCH_PARAM),
         TheLoop(L) {
     // Populate values with existing loop metadata.
     getHintsFromMetadata();
@@ -354,6 +401,42 @@ public:
     return AutoTune.Value;
   }
 
+  bool getHybrid() const {
+    return Hybrid.Value;
+  }
+
+  bool getAsync() const {
+    return Async.Value;
+  }
+
+  unsigned getMaxBlocksPerGrid() const {
+    return MaxBlocksPerGrid.Value;
+  }
+
+  unsigned getMinBlocksPerMultiproc() const {
+    return MinBlocksPerMultiproc.Value;
+  }
+
+  unsigned getSharedMemBytes() const {
+    return SharedMemBytes.Value;
+  }
+
+  unsigned getItersPerThread() const {
+    return ItersPerThread.Value;
+  }
+
+  unsigned getPriority() const {
+    return Priority.Value;
+  }
+
+  unsigned getSpecializeID() const {
+    return Specialize.Value;
+  }
+
+  unsigned getGPULanes() const {
+    return GPULanes.Value;
+  }
+
   /// Clear Tapir Hints metadata.
   void clearHintsMetadata();
 
@@ -371,6 +454,13 @@ public:
     writeHintsToClonedMetadata(Hints, VMap);
   }
 
+  /// Set the Tapir target of the loop L.
+  void setLoopTarget(TapirTargetID Target) {
+    LoopTarget.Value = static_cast<unsigned>(Target);
+    Hint Hints[] = {LoopTarget};
+    writeHintsToMetadata(Hints);
+  }
+
   void setAlreadyStripMined() {
     Grainsize.Value = 1;
     Hint Hints[] = {Grainsize};
@@ -412,6 +502,24 @@ MDNode *CopyNonTapirLoopMetadata(MDNode *LoopID, MDNode *OrigLoopID);
 /// if not.
 Task *getTaskIfTapirLoop(const Loop *L, TaskInfo *TI);
 
+/// Returns true if the atomic update RMW can carry (part of) a reduction: its
+/// result is unused and its operation is associative and commutative.
+bool isAtomicReductionUpdate(const AtomicRMWInst *RMW);
+
+/// Returns true if the memory operation I of a logically parallel loop cannot
+/// carry a dependence between iterations, by the data-race-free assumption:
+/// it is a plain load or store, or a call that does not synchronize.  Such
+/// operations can be placed in the access group of the loop's
+/// llvm.loop.parallel_accesses.
+bool isDRFParallelAccess(const Instruction &I);
+
+/// Returns the identity of the reduction operation Op on values of type Ty.
+Constant *getAtomicReductionIdentity(AtomicRMWInst::BinOp Op, Type *Ty);
+
+/// Emit the non-atomic form of the reduction operation Op on L and R.
+Value *emitAtomicReductionOp(IRBuilderBase &B, AtomicRMWInst::BinOp Op,
+                             Value *L, Value *R);
+
 } // End llvm namespace
 
 #endif
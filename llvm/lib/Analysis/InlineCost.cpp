@@ -43,6 +43,7 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
 #include <climits>
 #include <limits>
 #include <optional>
@@ -147,6 +148,11 @@ static cl::opt<int> CallPenalty(
     "inline-call-penalty", cl::Hidden, cl::init(25),
     cl::desc("Call penalty that is applied per callsite when inlining"));
 
+static cl::opt<int> GPULaunchCost(
+    "inline-gpu-launch-cost", cl::Hidden, cl::init(50),
+    cl::desc("Cost of launching a GPU-targeted Tapir loop when inlining, "
+             "which replaces the cost of the loop's body"));
+
 static cl::opt<size_t>
     StackSizeThreshold("inline-max-stacksize", cl::Hidden,
                        cl::init(std::numeric_limits<size_t>::max()),
@@ -588,6 +594,13 @@ class InlineCostCallAnalyzer final : public CallAnalyzer {
   // the size of that basic block.
   int CostAtBBStart = 0;
 
+  /// The blocks of the tasks of GPU-targeted Tapir loops.  These are
+  /// outlined into kernels and leave no code in the caller, so they cost
+  /// nothing here; the detaching block is charged GPULaunchCost instead.
+  SmallPtrSet<const BasicBlock *, 16> GPUTaskBlocks;
+  SmallPtrSet<const BasicBlock *, 4> GPULaunchBlocks;
+  bool InGPUTask = false;
+
   // The static size of live but cold basic blocks.  This is "static" in the
   // sense that it's not weighted by profile counts at all.
   int ColdSize = 0;
@@ -625,6 +638,8 @@ class InlineCostCallAnalyzer final : public CallAnalyzer {
 
   /// Handle a capped 'int' increment for Cost.
   void addCost(int64_t Inc) {
+    if (InGPUTask)
+      return;
     Inc = std::clamp<int64_t>(Inc, INT_MIN, INT_MAX);
     Cost = std::clamp<int64_t>(Inc + Cost, INT_MIN, INT_MAX);
   }
@@ -744,7 +759,16 @@ class InlineCostCallAnalyzer final : public CallAnalyzer {
     SROACostSavings += InstrCost;
   }
 
-  void onBlockStart(const BasicBlock *BB) override { CostAtBBStart = Cost; }
+  void onBlockStart(const BasicBlock *BB) override {
+    InGPUTask = false;
+    if (GPULaunchBlocks.count(BB))
+      addCost(GPULaunchCost);
+    InGPUTask = GPUTaskBlocks.count(BB);
+    CostAtBBStart = Cost;
+  }
+
+  /// Collect the tasks of the GPU-targeted Tapir loops in the callee.
+  void findGPUTasks();
 
   void onBlockAnalyzed(const BasicBlock *BB) override {
     if (CostBenefitAnalysisEnabled) {
@@ -976,6 +1000,8 @@ class InlineCostCallAnalyzer final : public CallAnalyzer {
   }
 
   InlineResult finalizeAnalysis() override {
+    InGPUTask = false;
+
     // Loops generally act a lot like calls in that they act like barriers to
     // movement, require a certain amount of setup, etc. So when optimising for
     // size, we penalise any call sites that perform loops. We do this after all
@@ -1081,6 +1107,8 @@ class InlineCostCallAnalyzer final : public CallAnalyzer {
     // will be gone after inlining.
     addCost(-getCallsiteCost(TTI, this->CandidateCall, DL));
 
+    findGPUTasks();
+
     // If this function uses the coldcc calling convention, prefer not to inline
     // it.
     if (F.getCallingConv() == CallingConv::Cold)
@@ -1848,6 +1876,42 @@ bool CallAnalyzer::allowSizeGrowth(CallBase &Call) {
   return true;
 }
 
+/// Returns true if the Tapir loop L is outlined into a GPU kernel.  Loops
+/// for the multi-target also keep a copy on the host and are not counted.
+static bool isGPUTapirLoop(const Loop *L) {
+  std::optional<int> Target =
+      getOptionalIntLoopAttribute(L, "tapir.loop.target");
+  if (!Target)
+    return false;
+  TapirTargetID TargetID = static_cast<TapirTargetID>(*Target);
+  return TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip ||
+         TargetID == TapirTargetID::LevelZero;
+}
+
+void InlineCostCallAnalyzer::findGPUTasks() {
+  if (none_of(F, [](const BasicBlock &BB) {
+        return isa<DetachInst>(BB.getTerminator());
+      }))
+    return;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    // Loops nested in a kernel are part of it.
+    if (GPUTaskBlocks.count(L->getHeader()) || !isGPUTapirLoop(L))
+      continue;
+    for (BasicBlock *BB : L->blocks()) {
+      auto *DI = dyn_cast<DetachInst>(BB->getTerminator());
+      if (!DI || LI.getLoopFor(BB) != L)
+        continue;
+      SmallVector<BasicBlock *, 16> Task;
+      DT.getDescendants(DI->getDetached(), Task);
+      GPUTaskBlocks.insert(Task.begin(), Task.end());
+      GPULaunchBlocks.insert(BB);
+    }
+  }
+}
+
 bool InlineCostCallAnalyzer::isColdCallSite(CallBase &Call,
                                             BlockFrequencyInfo *CallerBFI) {
   // If global profile summary is available, then callsite's coldness is
@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Analysis/TapirRaceDetect.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/EquivalenceClasses.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Statistic.h"
@@ -362,6 +363,14 @@ private:
   mutable DenseMap<std::pair<const Value *, const Instruction *>, bool>
   MayBeCapturedCache;
 
+  // Pairs of accesses that have already been checked for a race.  A spindle
+  // reaches the same access in a maybe-parallel task once for every enclosing
+  // task that is also maybe-parallel with it, and the alias and dependence
+  // queries for that pair need not be repeated.
+  using AccessPairTy = std::tuple<const Instruction *, const Value *, unsigned,
+                                  const Instruction *, const Value *, unsigned>;
+  DenseSet<AccessPairTy> EvaluatedPairs;
+
   // /// We need to check that all of the pointers in this list are disjoint
   // /// at runtime. Using std::unique_ptr to make using move ctor simpler.
   // DenseMap<const Loop *, RuntimePointerChecking *> AllPtrRtChecking;
@@ -1366,6 +1375,13 @@ void AccessPtrAnalysis::evaluateMaybeParallelAccesses(
   if (!GA1.isMod() && !GA2.isMod())
     return;
 
+  // Skip pairs that have already been evaluated.
+  if (!EvaluatedPairs
+           .insert({GA1.I, GA1.getPtr(), GA1.OperandNum, GA2.I, GA2.getPtr(),
+                    GA2.OperandNum})
+           .second)
+    return;
+
   bool LocalRace = false;
   if (!GA1.getPtr() || !GA2.getPtr()) {
     LLVM_DEBUG({
@@ -51,6 +51,8 @@ static cl::opt<TapirTargetID> ClTapirTarget(
                           "cuda", "Cuda (NVPTX)"),
                clEnumValN(TapirTargetID::Hip,
                           "hip", "Hip (AMDGPU)"),
+               clEnumValN(TapirTargetID::LevelZero,
+                          "levelzero", "Level Zero (SPIR-V)"),
                clEnumValN(TapirTargetID::Lambda,
                           "lambda", "Lambda"),
                clEnumValN(TapirTargetID::OMPTask,
@@ -62,7 +64,9 @@ static cl::opt<TapirTargetID> ClTapirTarget(
                clEnumValN(TapirTargetID::Qthreads,
                           "qthreads", "Qthreads"),
                clEnumValN(TapirTargetID::Realm,
-                          "realm", "Realm")));
+                          "realm", "Realm"),
+               clEnumValN(TapirTargetID::Multi,
+                          "multi", "Cuda, Hip and OpenCilk (at runtime)")));
 
 StringLiteral const TargetLibraryInfoImpl::StandardNames[LibFunc::NumLibFuncs] =
     {
@@ -1330,7 +1334,8 @@ void TargetLibraryInfoImpl::addVectorizableFunctionsFromVecLib(
 void TargetLibraryInfoImpl::addTapirTargetLibraryFunctions(
     TapirTargetID TargetID) {
   switch (TargetID) {
-  case TapirTargetID::OpenCilk: {
+  case TapirTargetID::OpenCilk:
+  case TapirTargetID::Multi: {
     const StringLiteral TTFuncs[] = {
     #define TLI_DEFINE_CILK_LIBS
     #include "llvm/Analysis/TapirTargetFuncs.def"
@@ -1343,6 +1348,7 @@ void TargetLibraryInfoImpl::addTapirTargetLibraryFunctions(
   case TapirTargetID::Serial:
   case TapirTargetID::Cuda:
   case TapirTargetID::Hip:
+  case TapirTargetID::LevelZero:
   case TapirTargetID::Lambda:
   case TapirTargetID::OMPTask:
   case TapirTargetID::OpenMP:
@@ -17,21 +17,37 @@
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/Analysis/CodeMetrics.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/Support/BranchProbability.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "work-span"
 
+static cl::opt<unsigned> UnknownTripCount(
+    "work-span-unknown-trip-count", cl::init(128), cl::Hidden,
+    cl::desc("The trip count assumed by the work/span estimates for loops "
+             "without a constant trip count."));
+
+static cl::opt<unsigned> MinGrainRatio(
+    "work-span-min-grain-ratio", cl::init(16), cl::Hidden,
+    cl::desc("Report a parallel region as under-grained when the work of its "
+             "spawned body is less than this many times the spawn overhead."));
+
 // Get a constant trip count for the given loop.
 unsigned llvm::getConstTripCount(const Loop *L, ScalarEvolution &SE) {
   int64_t ConstTripCount = 0;
@@ -116,3 +132,242 @@ void llvm::estimateLoopCost(WSCost &LoopCost, const Loop *L, LoopInfo *LI,
 
   estimateLoopCostHelper(L, LoopCost.Metrics, LoopCost, LI, SE);
 }
+
+float WSRegionEstimate::getParallelism() const {
+  if (!Work.isValid() || !Span.isValid() || *Span.getValue() <= 0)
+    return 1.0f;
+  return (float)*Work.getValue() / (float)*Span.getValue();
+}
+
+float WSRegionEstimate::getSpawnOverheadRatio() const {
+  if (!SpawnCost.isValid() || !BodyWork.isValid())
+    return 0.0f;
+  if (*BodyWork.getValue() <= 0)
+    return (float)*SpawnCost.getValue();
+  return (float)*SpawnCost.getValue() / (float)*BodyWork.getValue();
+}
+
+namespace {
+/// Helper to compute the work/span estimates of the tasks of a function,
+/// bottom-up over the task tree.
+class WorkSpanEstimator {
+  LoopInfo &LI;
+  TaskInfo &TI;
+  ScalarEvolution &SE;
+  const TargetTransformInfo &TTI;
+  CodeMetrics Metrics;
+  SmallVectorImpl<WSRegionEstimate> &Regions;
+
+  struct Weights {
+    InstructionCost Work = 1; // number of executions.
+    InstructionCost Span = 1; // number of executions on the critical path.
+    bool Unknown = false;
+  };
+
+  /// The number of levels of recursive division of a Tapir loop with the
+  /// given trip count.
+  static unsigned divisionLevels(unsigned TripCount) {
+    return Log2_32_Ceil(std::max(TripCount, 1u)) + 1;
+  }
+
+  /// Return the execution weights, within task T, of a block contained in
+  /// loop L.  Only the loops of T itself are considered; the loops of its
+  /// parent tasks are accounted for by the estimates of those tasks.
+  Weights getWeights(const Loop *L, const Task *T) {
+    Weights W;
+    for (; L && TI.getTaskFor(L->getHeader()) == T; L = L->getParentLoop()) {
+      unsigned TripCount = getConstTripCount(L, SE);
+      if (!TripCount) {
+        W.Unknown = true;
+        TripCount = UnknownTripCount;
+      }
+      W.Work *= TripCount;
+      if (getTaskIfTapirLoopStructure(L, &TI))
+        W.Span *= divisionLevels(TripCount);
+      else
+        W.Span *= TripCount;
+    }
+    return W;
+  }
+
+public:
+  WorkSpanEstimator(Function &F, LoopInfo &LI, TaskInfo &TI,
+                    ScalarEvolution &SE, const TargetTransformInfo &TTI,
+                    TargetLibraryInfo *TLI, AssumptionCache &AC,
+                    SmallVectorImpl<WSRegionEstimate> &Regions)
+      : LI(LI), TI(TI), SE(SE), TTI(TTI), Regions(Regions) {
+    SmallPtrSet<const Value *, 32> EphValues;
+    CodeMetrics::collectEphemeralValues(&F, &AC, EphValues);
+    for (BasicBlock &BB : F)
+      Metrics.analyzeBasicBlock(&BB, TTI, EphValues, /*PrepareForLTO*/ false,
+                                TLI);
+  }
+
+  /// Estimate the work and span of task T, including its subtasks.
+  WSCost estimateTask(const Task *T);
+};
+} // end anonymous namespace
+
+WSCost WorkSpanEstimator::estimateTask(const Task *T) {
+  WSCost Cost;
+  // The blocks of the task itself (excluding subtasks).
+  InstructionCost OwnSpan = 0;
+  for (const Spindle *S : T->spindles())
+    for (const BasicBlock *BB : S->blocks()) {
+      Weights W = getWeights(LI.getLoopFor(BB), T);
+      Cost.UnknownCost |= W.Unknown;
+      Cost.Work += Metrics.NumBBInsts[BB] * W.Work;
+      OwnSpan += Metrics.NumBBInsts[BB] * W.Span;
+    }
+
+  // Tapir loops are synced before the code that follows them, so their spans
+  // add to the span of this task.  Other spawned tasks may run in parallel with
+  // one another and with the continuation.
+  InstructionCost LoopSpan = 0, SpawnSpan = 0;
+  for (const Task *SubT : T->subtasks()) {
+    // Reserve the region for the subtask, so the regions are listed in
+    // preorder.
+    size_t Index = Regions.size();
+    Regions.emplace_back();
+    WSCost SubCost = estimateTask(SubT);
+
+    const DetachInst *DI = SubT->getDetach();
+    WSRegionEstimate &R = Regions[Index];
+    R.T = SubT;
+    R.BodyWork = SubCost.Work;
+    R.BodySpan = SubCost.Span;
+    R.SpawnCost =
+        TTI.getInstructionCost(DI, TargetTransformInfo::TCK_SizeAndLatency);
+    R.UnknownCost = SubCost.UnknownCost;
+
+    const Loop *L = LI.getLoopFor(DI->getParent());
+    if (L && getTaskIfTapirLoopStructure(L, &TI) == SubT) {
+      Weights Outer = getWeights(L->getParentLoop(), T);
+      R.L = L;
+      R.TripCount = getConstTripCount(L, SE);
+      unsigned TripCount = R.TripCount ? R.TripCount : UnknownTripCount;
+      R.UnknownCost |= !R.TripCount;
+      R.Work = (R.BodyWork + R.SpawnCost) * TripCount;
+      R.Span = R.BodySpan + R.SpawnCost * divisionLevels(TripCount);
+      Cost.Work += R.Work * Outer.Work;
+      LoopSpan += R.Span * Outer.Span;
+    } else {
+      Weights W = getWeights(L, T);
+      R.Work = R.BodyWork + R.SpawnCost;
+      R.Span = R.BodySpan + R.SpawnCost;
+      Cost.Work += R.Work * W.Work;
+      SpawnSpan = std::max(SpawnSpan, R.BodySpan + R.SpawnCost * W.Span);
+    }
+    Cost.UnknownCost |= R.UnknownCost;
+  }
+  Cost.Span = std::max(OwnSpan, SpawnSpan) + LoopSpan;
+  return Cost;
+}
+
+void llvm::estimateWorkSpan(Function &F, LoopInfo &LI, TaskInfo &TI,
+                            ScalarEvolution &SE,
+                            const TargetTransformInfo &TTI,
+                            TargetLibraryInfo *TLI, AssumptionCache &AC,
+                            SmallVectorImpl<WSRegionEstimate> &Regions) {
+  if (TI.isSerial())
+    return;
+  WorkSpanEstimator(F, LI, TI, SE, TTI, TLI, AC, Regions)
+      .estimateTask(TI.getRootTask());
+}
+
+static void computeWorkSpan(Function &F, FunctionAnalysisManager &AM,
+                            SmallVectorImpl<WSRegionEstimate> &Regions) {
+  TaskInfo &TI = AM.getResult<TaskAnalysis>(F);
+  if (TI.isSerial())
+    return;
+  estimateWorkSpan(F, AM.getResult<LoopAnalysis>(F), TI,
+                   AM.getResult<ScalarEvolutionAnalysis>(F),
+                   AM.getResult<TargetIRAnalysis>(F),
+                   &AM.getResult<TargetLibraryAnalysis>(F),
+                   AM.getResult<AssumptionAnalysis>(F), Regions);
+}
+
+PreservedAnalyses WorkSpanRemarksPass::run(Function &F,
+                                           FunctionAnalysisManager &AM) {
+  if (F.empty())
+    return PreservedAnalyses::all();
+
+  auto &ORE = AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  if (!ORE.allowExtraAnalysis(DEBUG_TYPE))
+    return PreservedAnalyses::all();
+
+  SmallVector<WSRegionEstimate, 8> Regions;
+  computeWorkSpan(F, AM, Regions);
+  for (const WSRegionEstimate &R : Regions) {
+    const DetachInst *DI = R.T->getDetach();
+    DebugLoc Loc = R.isTapirLoop() ? R.L->getStartLoc() : DI->getDebugLoc();
+    const BasicBlock *CodeRegion =
+        R.isTapirLoop() ? R.L->getHeader() : DI->getParent();
+
+    ORE.emit([&]() {
+      OptimizationRemarkAnalysis Remark(
+          DEBUG_TYPE, R.isTapirLoop() ? "TapirLoopWorkSpan" : "SpawnWorkSpan",
+          Loc, CodeRegion);
+      Remark << (R.isTapirLoop() ? "parallel loop" : "spawned task")
+             << ": work " << ore::NV("Work", R.Work) << ", span "
+             << ore::NV("Span", R.Span) << ", parallelism "
+             << ore::NV("Parallelism", R.getParallelism());
+      if (R.isTapirLoop()) {
+        Remark << ", iterations ";
+        if (R.TripCount)
+          Remark << ore::NV("TripCount", R.TripCount);
+        else
+          Remark << "unknown (assumed "
+                 << ore::NV("AssumedTripCount", (unsigned)UnknownTripCount)
+                 << ")";
+      }
+      Remark << "; body work " << ore::NV("BodyWork", R.BodyWork)
+             << ", span " << ore::NV("BodySpan", R.BodySpan)
+             << ", spawn overhead " << ore::NV("SpawnCost", R.SpawnCost)
+             << "; exact trip counts " << ore::NV("Exact", !R.UnknownCost);
+      return Remark;
+    });
+
+    // Flag regions whose spawned bodies do too little work to amortize the
+    // spawn overhead.
+    if (R.getSpawnOverheadRatio() * MinGrainRatio > 1.0f)
+      ORE.emit([&]() {
+        return OptimizationRemarkAnalysis(DEBUG_TYPE, "UnderGrained", Loc,
+                                          CodeRegion)
+               << (R.isTapirLoop() ? "parallel loop" : "spawned task")
+               << " may be under-grained: body work "
+               << ore::NV("BodyWork", R.BodyWork) << " is less than "
+               << ore::NV("MinGrainRatio", (unsigned)MinGrainRatio)
+               << " times the spawn overhead "
+               << ore::NV("SpawnCost", R.SpawnCost)
+               << (R.isTapirLoop()
+                       ? "; consider coarsening the loop (e.g., with a "
+                         "grainsize pragma)"
+                       : "; consider serializing the spawn");
+      });
+  }
+  return PreservedAnalyses::all();
+}
+
+PreservedAnalyses WorkSpanPrinterPass::run(Function &F,
+                                           FunctionAnalysisManager &AM) {
+  OS << "Work/span estimates for function '" << F.getName() << "':\n";
+  if (F.empty())
+    return PreservedAnalyses::all();
+
+  SmallVector<WSRegionEstimate, 8> Regions;
+  computeWorkSpan(F, AM, Regions);
+  for (const WSRegionEstimate &R : Regions) {
+    OS.indent(2 * R.T->getTaskDepth());
+    if (R.isTapirLoop())
+      OS << "loop " << R.L->getHeader()->getName() << ": trip count "
+         << R.TripCount << ", ";
+    else
+      OS << "spawn " << R.T->getEntry()->getName() << ": ";
+    OS << "work " << R.Work << ", span " << R.Span << ", parallelism "
+       << format("%.2f", R.getParallelism()) << ", body work " << R.BodyWork
+       << ", body span " << R.BodySpan << ", spawn " << R.SpawnCost
+       << (R.UnknownCost ? " (unknown)" : "") << "\n";
+  }
+  return PreservedAnalyses::all();
+}
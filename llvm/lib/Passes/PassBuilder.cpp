@@ -75,6 +75,7 @@
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Analysis/TypeBasedAliasAnalysis.h"
 #include "llvm/Analysis/UniformityAnalysis.h"
+#include "llvm/Analysis/WorkSpanAnalysis.h"
 #include "llvm/CodeGen/AssignmentTrackingAnalysis.h"
 #include "llvm/CodeGen/BasicBlockSectionsProfileReader.h"
 #include "llvm/CodeGen/CallBrPrepare.h"
@@ -260,6 +261,13 @@
 #include "llvm/Transforms/Tapir/LoopSpawningTI.h"
 #include "llvm/Transforms/Tapir/LoopStripMinePass.h"
 #include "llvm/Transforms/Tapir/SerializeSmallTasks.h"
+#include "llvm/Transforms/Tapir/TapirCoarsenRecursion.h"
+#include "llvm/Transforms/Tapir/TapirGPUNestedLoops.h"
+#include "llvm/Transforms/Tapir/TapirIndirectPrefetch.h"
+#include "llvm/Transforms/Tapir/TapirLICM.h"
+#include "llvm/Transforms/Tapir/TapirLoopCollapse.h"
+#include "llvm/Transforms/Tapir/TapirLoopFusion.h"
+#include "llvm/Transforms/Tapir/TapirSoA.h"
 #include "llvm/Transforms/Tapir/TapirToTarget.h"
 #include "llvm/Transforms/Tapir/DRFScopedNoAliasAA.h"
 #include "llvm/Transforms/Utils/AddDiscriminators.h"
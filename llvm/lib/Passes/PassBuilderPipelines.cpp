@@ -24,6 +24,7 @@
 #include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/Analysis/ScopedNoAliasAA.h"
 #include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/Analysis/WorkSpanAnalysis.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Passes/OptimizationLevel.h"
@@ -126,6 +127,13 @@
 #include "llvm/Transforms/Tapir/LoopSpawningTI.h"
 #include "llvm/Transforms/Tapir/LoopStripMinePass.h"
 #include "llvm/Transforms/Tapir/SerializeSmallTasks.h"
+#include "llvm/Transforms/Tapir/TapirCoarsenRecursion.h"
+#include "llvm/Transforms/Tapir/TapirLICM.h"
+#include "llvm/Transforms/Tapir/TapirGPUNestedLoops.h"
+#include "llvm/Transforms/Tapir/TapirIndirectPrefetch.h"
+#include "llvm/Transforms/Tapir/TapirLoopCollapse.h"
+#include "llvm/Transforms/Tapir/TapirLoopFusion.h"
+#include "llvm/Transforms/Tapir/TapirSoA.h"
 #include "llvm/Transforms/Tapir/TapirToTarget.h"
 #include "llvm/Transforms/Tapir/DRFScopedNoAliasAA.h"
 #include "llvm/Transforms/Utils/AddDiscriminators.h"
@@ -299,6 +307,47 @@ static cl::opt<bool>
                         cl::Hidden,
                         cl::desc("Verify IR after Tapir lowering steps"));
 
+static cl::opt<bool> EnableTapirSoA(
+    "enable-tapir-soa", cl::init(true), cl::Hidden,
+    cl::desc("Store arrays of [[kitsune::soa]] structs as structures of "
+             "arrays before Tapir loops are outlined"));
+
+static cl::opt<bool> EnableTapirCoarsenRecursion(
+    "enable-tapir-coarsen-recursion", cl::init(true), cl::Hidden,
+    cl::desc("Give recursive functions that spawn a serial version for the "
+             "calls below a grainsize"));
+
+static cl::opt<bool> EnableTapirLICM(
+    "enable-tapir-licm", cl::init(true), cl::Hidden,
+    cl::desc("Hoist invariant loads and computation out of Tapir loop bodies "
+             "before they are outlined"));
+
+static cl::opt<bool> EnableTapirLoopCollapse(
+    "enable-tapir-loop-collapse", cl::init(true), cl::Hidden,
+    cl::desc("Collapse perfectly nested Tapir loops into a single Tapir loop "
+             "before they are outlined"));
+
+static cl::opt<bool> EnableTapirLoopInterchange(
+    "enable-tapir-loop-interchange", cl::init(true), cl::Hidden,
+    cl::desc("Interchange the serial loops nested in CPU-targeted Tapir "
+             "loops before they are outlined"));
+
+static cl::opt<bool>
+    EnableTapirLoopFusion("enable-tapir-loop-fusion", cl::init(true),
+                          cl::Hidden,
+                          cl::desc("Fuse adjacent GPU-targeted Tapir loops "
+                                   "before they are outlined"));
+
+static cl::opt<bool> EnableTapirGPUNestedLoops(
+    "enable-tapir-gpu-nested-loops", cl::init(true), cl::Hidden,
+    cl::desc("Map Tapir loops nested in GPU-targeted Tapir loops onto groups "
+             "of lanes before they are outlined"));
+
+static cl::opt<bool> EnableTapirIndirectPrefetch(
+    "enable-tapir-indirect-prefetch", cl::init(true), cl::Hidden,
+    cl::desc("Prefetch the indirect accesses of the serial loops in "
+             "CPU-targeted Tapir loop bodies before they are outlined"));
+
 PipelineTuningOptions::PipelineTuningOptions() {
   LoopInterleaving = true;
   LoopVectorization = true;
@@ -1437,6 +1486,10 @@ PassBuilder::buildModuleOptimizationPipeline(OptimizationLevel Level,
   // rather than on each loop in an inside-out manner, and so they are actually
   // function passes.
 
+  // Report the work/span estimates of the Tapir loops and spawns ahead of
+  // stripmining (only when the remarks are enabled).
+  OptimizePM.addPass(WorkSpanRemarksPass());
+
   // Stripmine Tapir loops, if pass is enabled.
   if (PTO.LoopStripmine && Level != OptimizationLevel::O1 &&
       !Level.isOptimizingForSize()) {
@@ -1588,6 +1641,34 @@ PassBuilder::buildTapirLoopLoweringPipeline(OptimizationLevel Level,
   FPM.addPass(createFunctionToLoopPassAdaptor(std::move(LPM2),
                                               /*UseMemorySSA=*/false,
                                               /*UseBlockFrequencyInfo=*/false));
+  // Give the loops over arrays of [[kitsune::soa]] structs contiguous
+  // accesses to each field.
+  if (EnableTapirSoA && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirSoAPass());
+  // Compute invariant values once in the spawner rather than in every
+  // iteration (or GPU thread).
+  if (EnableTapirLICM && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirLICMPass());
+  // Spawn nested Tapir loops over one linearized iteration space.
+  if (EnableTapirLoopCollapse && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirLoopCollapsePass());
+  // Reorder the serial loops inside CPU Tapir loop bodies for locality, so
+  // that each spawned iteration (or stripmined chunk) walks memory in order.
+  if (EnableTapirLoopInterchange && Level != OptimizationLevel::O0)
+    FPM.addPass(createFunctionToLoopPassAdaptor(
+        LoopInterchangePass(/*TapirLoopsOnly=*/true), /*UseMemorySSA=*/false,
+        /*UseBlockFrequencyInfo=*/false));
+  // Fuse adjacent GPU loops so they are outlined as a single kernel.
+  if (EnableTapirLoopFusion && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirLoopFusionPass());
+  // Run the Tapir loops nested in GPU loops on the lanes of a warp, since
+  // the inner loop can't be launched as a kernel of its own.
+  if (EnableTapirGPUNestedLoops && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirGPUNestedLoopsPass());
+  // Prefetch the a[idx[i]] accesses of the strips (and of the loops nested
+  // in them) of CPU loops, which the hardware prefetchers can't follow.
+  if (EnableTapirIndirectPrefetch && Level != OptimizationLevel::O0)
+    FPM.addPass(TapirIndirectPrefetchPass());
   MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
 
   // Outline Tapir loops as needed.
@@ -1629,6 +1710,10 @@ PassBuilder::buildTapirLoweringPipeline(OptimizationLevel Level,
     return MPM;
   }
 
+  // Stop divide-and-conquer recursion from spawning near its leaves.
+  if (EnableTapirCoarsenRecursion)
+    MPM.addPass(TapirCoarsenRecursionPass());
+
   // Lower Tapir loops
   MPM.addPass(buildTapirLoopLoweringPipeline(Level, Phase));
 
@@ -25,6 +25,7 @@
 #include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DiagnosticInfo.h"
@@ -43,6 +44,7 @@
 #include "llvm/Transforms/Scalar/LoopPassManager.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
 #include <cassert>
 #include <utility>
 #include <vector>
@@ -84,7 +86,8 @@ static void printDepMatrix(CharMatrix &DepMatrix) {
 
 static bool populateDependencyMatrix(CharMatrix &DepMatrix, unsigned Level,
                                      Loop *L, DependenceInfo *DI,
-                                     ScalarEvolution *SE) {
+                                     ScalarEvolution *SE,
+                                     ArrayRef<Task *> TapirTasks) {
   using ValueVector = SmallVector<Value *, 16>;
 
   ValueVector MemInstr;
@@ -138,6 +141,13 @@ static bool populateDependencyMatrix(CharMatrix &DepMatrix, unsigned Level,
           if (D->isScalar(II)) {
             Direction = 'S';
             Dep.push_back(Direction);
+          } else if (Task *T = TapirTasks[II - 1];
+                     T && T->encloses(Src->getParent()) &&
+                     T->encloses(Dst->getParent())) {
+            // The iterations of a Tapir loop commute, so a race-free body
+            // carries no dependence from one iteration to another.
+            Direction = '=';
+            Dep.push_back(Direction);
           } else {
             unsigned Dir = D->getDirection(II);
             if (Dir == Dependence::DVEntry::LT ||
@@ -364,15 +374,17 @@ struct LoopInterchange {
   LoopInfo *LI = nullptr;
   DependenceInfo *DI = nullptr;
   DominatorTree *DT = nullptr;
+  TaskInfo *TI = nullptr;
   std::unique_ptr<CacheCost> CC = nullptr;
 
   /// Interface to emit optimization remarks.
   OptimizationRemarkEmitter *ORE;
 
   LoopInterchange(ScalarEvolution *SE, LoopInfo *LI, DependenceInfo *DI,
-                  DominatorTree *DT, std::unique_ptr<CacheCost> &CC,
+                  DominatorTree *DT, TaskInfo *TI,
+                  std::unique_ptr<CacheCost> &CC,
                   OptimizationRemarkEmitter *ORE)
-      : SE(SE), LI(LI), DI(DI), DT(DT), CC(std::move(CC)), ORE(ORE) {}
+      : SE(SE), LI(LI), DI(DI), DT(DT), TI(TI), CC(std::move(CC)), ORE(ORE) {}
 
   bool run(Loop *L) {
     if (L->getParentLoop())
@@ -435,10 +447,16 @@ struct LoopInterchange {
     LLVM_DEBUG(dbgs() << "Processing LoopList of size = " << LoopNestDepth
                       << "\n");
 
+    // Tapir loops stay where they are, but their iterations are independent,
+    // which frees the serial loops they contain to be interchanged.
+    SmallVector<Task *, 8> TapirTasks;
+    for (Loop *L : LoopList)
+      TapirTasks.push_back(TI ? getTaskIfTapirLoopStructure(L, TI) : nullptr);
+
     CharMatrix DependencyMatrix;
     Loop *OuterMostLoop = *(LoopList.begin());
     if (!populateDependencyMatrix(DependencyMatrix, LoopNestDepth,
-                                  OuterMostLoop, DI, SE)) {
+                                  OuterMostLoop, DI, SE, TapirTasks)) {
       LLVM_DEBUG(dbgs() << "Populating dependency matrix failed\n");
       return false;
     }
@@ -477,12 +495,15 @@ struct LoopInterchange {
     for (unsigned j = SelecLoopId; j > 0; j--) {
       bool ChangedPerIter = false;
       for (unsigned i = SelecLoopId; i > SelecLoopId - j; i--) {
+        if (TapirTasks[i] || TapirTasks[i - 1])
+          continue;
         bool Interchanged = processLoop(LoopList[i], LoopList[i - 1], i, i - 1,
                                         DependencyMatrix, CostMap);
         if (!Interchanged)
           continue;
         // Loops interchanged, update LoopList accordingly.
         std::swap(LoopList[i - 1], LoopList[i]);
+        std::swap(TapirTasks[i - 1], TapirTasks[i]);
         // Update the DependencyMatrix
         interChangeDependencies(DependencyMatrix, i, i - 1);
 #ifdef DUMP_DEP_MATRICIES
@@ -1708,18 +1729,41 @@ bool LoopInterchangeTransform::adjustLoopLinks() {
   return Changed;
 }
 
+/// Returns true if the loop nest LN contains a Tapir loop and every Tapir loop
+/// in it is lowered for the CPU.  Interchange orders the serial loops of a
+/// body for the cache; on a GPU the order that matters is across threads.
+static bool isCPUTapirLoopNest(LoopNest &LN, TaskInfo &TI) {
+  bool HasTapirLoop = false;
+  for (Loop *L : LN.getLoops()) {
+    if (!getTaskIfTapirLoopStructure(L, &TI))
+      continue;
+    TapirTargetID TargetID = (TapirTargetID)TapirLoopHints(L).getLoopTarget();
+    if (TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip ||
+        TargetID == TapirTargetID::LevelZero ||
+        TargetID == TapirTargetID::Multi)
+      return false;
+    HasTapirLoop = true;
+  }
+  return HasTapirLoop;
+}
+
 PreservedAnalyses LoopInterchangePass::run(LoopNest &LN,
                                            LoopAnalysisManager &AM,
                                            LoopStandardAnalysisResults &AR,
                                            LPMUpdater &U) {
   Function &F = *LN.getParent();
 
+  if (TapirLoopsOnly && !isCPUTapirLoopNest(LN, AR.TI))
+    return PreservedAnalyses::all();
+
   DependenceInfo DI(&F, &AR.AA, &AR.SE, &AR.LI);
   std::unique_ptr<CacheCost> CC =
       CacheCost::getCacheCost(LN.getOutermostLoop(), AR, DI);
   OptimizationRemarkEmitter ORE(&F);
-  if (!LoopInterchange(&AR.SE, &AR.LI, &DI, &AR.DT, CC, &ORE).run(LN))
+  if (!LoopInterchange(&AR.SE, &AR.LI, &DI, &AR.DT, &AR.TI, CC, &ORE).run(LN))
     return PreservedAnalyses::all();
+  // Interchange rewires blocks inside the Tapir loop bodies.
+  AR.TI.recalculate(F, AR.DT);
   U.markLoopNestChanged(true);
   return getLoopPassPreservedAnalyses();
 }
@@ -52,7 +52,6 @@
 //
 //===----------------------------------------------------------------------===
 //
-// TODO: add printf() support.
 // TODO: double precision device-side entry points.
 // TODO: bring high-level design a bit closer to HipABI (as needed).
 // TODO: expose enviornment variable target settings???
@@ -60,13 +59,26 @@
 
 #include "llvm/Transforms/Tapir/CudaABI.h"
 #include "kitsune/Config/config.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/FMF.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
@@ -79,30 +91,48 @@
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Option/ArgList.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/Inliner.h"
+#include "llvm/Transforms/IPO/Internalize.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Tapir/Outline.h"
 #include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirHybridLoop.h"
+#include "llvm/Transforms/Tapir/TapirMultiTarget.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
+#include <mutex>
+#include <optional>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "cuabi" // support for -debug-only=cuabi
 
+// The stages of device code generation are timed for -ftime-report
+// (-time-passes) and traced for -ftime-trace.
+static const char TimerGroupName[] = DEBUG_TYPE;
+static const char TimerGroupDescription[] = "CUDA ABI device code generation";
+
 // NOTES: From the NVPTX target documentation.
 //  (See: https://llvm.org/docs/NVPTXUsage.html)
 //
@@ -126,10 +156,55 @@ using namespace llvm;
 /// transform options have `-cuabi-` as the leading
 /// string.  A summary of the options is provided below.
 ///
-///   * `-cuabi-arch=target`: The target CUDA architecture
-///     to generate code for.  This directly matches the
-///     [NVPTX backend targets]
-///     (https://llvm.org/docs/NVPTXUsage.html).
+///   * `-cuabi-arch=target[,target...]`: The target CUDA
+///     architecture(s) to generate code for.  These directly
+///     match the [NVPTX backend targets]
+///     (https://llvm.org/docs/NVPTXUsage.html).  When a list
+///     is given PTX is generated for the oldest target and
+///     assembled for each of them; all the images are packed
+///     into a single fat binary and the CUDA driver loads the
+///     best match for the device at run time.
+///
+///   * `-cuabi-extra-archs=target[,target...]`: Additional CUDA
+///     architectures to assemble the generated PTX for.  Each
+///     must be the same as or newer than the `-cuabi-arch`
+///     target.  The resulting images are placed in the same
+///     fat binary and assembled in parallel.
+///
+///   * `-cuabi-cache-dir=path`: Cache fat binaries in the given
+///     directory, keyed on a hash of the kernel module, target
+///     architectures, options and CUDA tools.  Translation units
+///     whose kernels have not changed skip device code generation
+///     entirely.  The `CUDAABI_CACHE_DIR` environment variable may
+///     also be used.  Caching is disabled by default.
+///
+///   * `-tapir-gpu-codegen-jobs=N`: Run the device code generation
+///     (PTX, ptxas and fatbinary) of at most N modules at once when
+///     several threads of the compiler (e.g., ThinLTO backends) lower
+///     Tapir to CUDA.  Others wait for a slot; cached fat binaries
+///     need none.  The `TAPIR_GPU_CODEGEN_JOBS` environment variable
+///     may also be used.  Defaults to half the hardware threads.
+///
+///   * `-cuabi-async-init`: Start the initialization of the
+///     runtime on a background thread from the module
+///     constructor (see `__kitcuda_initialize_async()`), so it
+///     overlaps with the program's startup.  Enabled by default.
+///
+///   * `-cuabi-rdc`: Generate relocatable device code.  Kernels
+///     may then call functions defined in other translation
+///     units: each module's device code is assembled into a
+///     relocatable image that also holds a device-side version of
+///     each of the module's externally visible functions that can
+///     run on the device.  The runtime links the images of all the
+///     modules into a single CUDA module when one is first used.
+///     Calls of functions without a device-side version trap.
+///     This is disabled by default (`-fgpu-rdc` enables it).
+///
+///   * `-cuabi-shmem-bc=path`: The bitcode of NVSHMEM's device
+///     library (`libnvshmem_device.bc`), which is linked into the
+///     kernel modules whose kernels access symmetric memory (see
+///     `kitsune_shmem.h`) the way libdevice is.  Defaults to the
+///     library under `$NVSHMEM_HOME`.
 ///
 ///   * `-cuabi-opt-level=[0,1,2,3]`: Set the optimization
 ///     level for transformation.  This corresponds directly
@@ -144,20 +219,47 @@ using namespace llvm;
 ///     distribution.
 ///
 ///   * `-cuabi-host-opt-level=[0,1,2,3]`: Set the optimization
-///     level to use for the final host-side module after the CUDA
-///     transformation has completed.  Even though the host code
-///     has already been through a series of optimizations this
-///     option enables a second series of passes over the code
-///     after the transformation has completed.  At present there
-///     are unlikely to be significant gains from this.  As a
-///     result this defaults to level 0, which disables the
-///     extra pass entirely.
+///     level of the cleanup of the host-side code that launches
+///     kernels after the CUDA transformation has completed: launch
+///     setup that repeats that of an earlier launch is removed and
+///     the functions with launches are run through a short
+///     pipeline built for the host target (see
+///     tapir::optimizeGPUHostCode()).  The driver passes the host
+///     optimization level at -O2 and above; the default of 0
+///     disables the cleanup.
 ///
 ///   * `-cuabi-prefetch`: Enable/Disable the generation of
 ///     data prefetch calls prior to the kernel launch. This
 ///     is enabled by default and typically will enable better
 ///     performance given the current use of managed memory
-///     allocations.
+///     allocations.  When the runtime is using device-resident
+///     allocations these calls also perform the explicit copies
+///     to the device, using the kitsune readonly/writeonly
+///     attributes to avoid unneeded transfers.
+///
+///   * `-cuabi-prefetch-early`: Enable/Disable hoisting an
+///     additional asynchronous prefetch of each kernel argument
+///     that is read by the kernel to the earliest point ahead of
+///     the launch where the host no longer writes the data.  The
+///     runtime issues these on dedicated prefetch streams when
+///     enabled (KITRT_PREFETCH_STREAMS) and ignores them
+///     otherwise.  This is enabled by default.
+///
+///   * `-cuabi-host-prefetch`: Enable/Disable issuing an
+///     asynchronous prefetch of the data a kernel may write back
+///     to the host, ordered on the kernel's stream, when the host
+///     reads it (within the function) before another launch uses
+///     it.  The prefetch follows the launch or, when the reads
+///     are all outside of the loops around the launch, is placed
+///     at the exits of those loops.  This is enabled by default.
+///
+///   * `-cuabi-migrate=[auto,prefetch,counters,host]`: Set the
+///     runtime's migration policy for managed memory (see
+///     KitRTMigratePolicy).  With 'counters' (let the hardware's
+///     access counters migrate pages, e.g., on Grace-Hopper) or
+///     'host' (kernels access host memory in place) the runtime
+///     never prefetches data, so the early and host prefetch calls
+///     are not generated.  By default the runtime's policy is used.
 ///
 ///   * `-cuabi-max-threads-per-blk`: Set the maximum number
 ///     of threads that can run within a block.  This limit
@@ -166,6 +268,63 @@ using namespace llvm;
 ///     The default behavior is to match the hardware limits
 ///     within CUDA.
 ///
+///   * `-cuabi-autotune-file`: A table of block sizes recorded by
+///     the runtime's autotuning (KITCUDA_AUTOTUNE_FILE).  Kernels
+///     without a launch attribute are annotated with the largest
+///     block size the table holds for them (maxntid), which lets
+///     ptxas budget their registers for the blocks they actually
+///     run with.
+///
+///   * `-cuabi-spill-threshold`: Generate the kernels whose
+///     register spills (as reported by ptxas) exceed this many
+///     bytes a second time with relaxed launch bounds.  The
+///     minimum number of resident blocks requested by a launch
+///     attribute is dropped and a tuned block size limit above
+///     256 threads is lowered to 256, which leaves ptxas the
+///     full register file of a thread.  A value of zero disables
+///     the second pass; the default is 128 bytes.
+///
+///   * `-cuabi-reductions`: Enable/Disable turning atomic
+///     updates of a kernel argument (add, min, max, and, or,
+///     xor) into block-wide tree reductions that use warp
+///     shuffles and shared memory, leaving a single atomic
+///     update per block.  This is how Kokkos parallel_reduce
+///     constructs and forall loops that accumulate with atomics
+///     are lowered.  This is enabled by default.
+///
+///   * `-cuabi-nd-launches`: Enable/Disable 2D and 3D launch
+///     geometries for kernels that split a flattened iteration
+///     space into coordinates with division and remainder (e.g.,
+///     'i = tid / N, j = tid % N' or a Kokkos MDRangePolicy).
+///     Each thread then takes its coordinates from its block and
+///     thread indices and each block covers a tile of the
+///     iteration space.  This is enabled by default.
+///
+///   * `-cuabi-tile-loads`: Enable/Disable staging the
+///     neighborhoods of stencil-like loads of read-only arrays
+///     (e.g., 'a[i-1] + a[i] + a[i+1]') in shared memory.  The
+///     threads of each block cooperatively load the block's tile
+///     of the array (plus a small halo) once and the kernel
+///     reads neighboring elements from shared memory.  The
+///     launch reports the size of the tiles to the runtime as
+///     dynamic shared memory.  This applies to one dimensional
+///     kernels and is disabled by default.
+///
+///   * `-cuabi-async-copy`: Enable/Disable loading the shared
+///     memory tiles (see `-cuabi-tile-loads`) with asynchronous
+///     global to shared memory copies (cp.async) on sm_80 and
+///     newer targets.  The copies bypass the registers and each
+///     thread waits for all of its copies once, at the tile's
+///     barrier.  This is enabled by default.
+///
+///   * `-cuabi-persistent-kernels`: Generate a persistent worker
+///     kernel for each module that runs the module's (grid-stride)
+///     kernels on request.  The runtime keeps the worker resident
+///     and turns small launches into pushes onto a work queue in
+///     host-mapped memory, which avoids the driver's launch
+///     overheads for short, frequent loops.  This is disabled by
+///     default (see KITCUDA_PERSISTENT_KERNELS).
+///
 ///   * `-cuabi-default-grainsize`: EXPERIMENTAL -- control the
 ///     transform's grain size.  By default this is set to 1 and
 ///     it is not recommended to change this unless you are
@@ -183,6 +342,9 @@ namespace {
 
 const std::string CUABI_PREFIX = "_cuabi";
 const std::string CUABI_KERNEL_NAME_PREFIX = CUABI_PREFIX + "_kern_";
+const std::string CUABI_GLOBALS_BLOCK_NAME = CUABI_PREFIX + "_globals_devvar";
+const std::string CUABI_DEVICE_LOG_NAME = CUABI_PREFIX + "_device_log";
+const std::string CUABI_DEVICE_HEAP_NAME = CUABI_PREFIX + "_device_heap";
 
 // NOTE: At this point in time we do not provide support for the older range
 // of GPU architectures. We favor 64-bit and SM_60 or newer, which
@@ -202,14 +364,52 @@ cl::opt<unsigned>
 
 cl::opt<unsigned> HostOptLevel(
     "cuabi-host-opt-level", cl::init(0), cl::NotHidden,
-    cl::desc(
-        "The optimization level for an experimental pass over the transformed "
-        "host-side code."));
+    cl::desc("The optimization level of the cleanup of the transformed "
+             "host-side code."));
 
 cl::opt<bool> CodeGenPrefetch("cuabi-prefetch", cl::init(true), cl::NotHidden,
                               cl::desc("Enable generation of calls to do data "
                                        "prefetching for managed memory."));
 
+cl::opt<bool> CodeGenEarlyPrefetch(
+    "cuabi-prefetch-early", cl::init(true), cl::NotHidden,
+    cl::desc("Hoist asynchronous data prefetch calls for kernel arguments "
+             "to the earliest point after the last host-side write."));
+
+cl::opt<bool> CodeGenHostPrefetch(
+    "cuabi-host-prefetch", cl::init(true), cl::NotHidden,
+    cl::desc("Prefetch data written by a kernel back to the host when "
+             "the host reads it before the next launch that uses it."));
+
+cl::opt<std::string> MigratePolicy(
+    "cuabi-migrate", cl::init(""), cl::NotHidden,
+    cl::desc("The migration policy of managed memory: auto, prefetch, "
+             "counters or host. (default: the runtime's)"));
+
+// Return the KitRTMigratePolicy (see kitrt.h) given by -cuabi-migrate,
+// or -1 if none was given.
+int getMigratePolicy() {
+  if (MigratePolicy.empty())
+    return -1;
+  int Policy = StringSwitch<int>(MigratePolicy)
+                   .Case("auto", 0)
+                   .Case("prefetch", 1)
+                   .Case("counters", 2)
+                   .Case("host", 3)
+                   .Default(-1);
+  if (Policy < 0)
+    report_fatal_error("cuabi: unknown migration policy '" +
+                       Twine(MigratePolicy) + "'.");
+  return Policy;
+}
+
+// Return true if the runtime may prefetch managed data, i.e., the
+// early and host prefetch calls are of use.
+bool mayPrefetchData() {
+  int Policy = getMigratePolicy();
+  return CodeGenPrefetch && Policy != 2 && Policy != 3;
+}
+
 cl::opt<bool>
     UseOccupancyLaunches("cuabi-occupancy-launches", cl::init(true),
                          cl::NotHidden,
@@ -225,6 +425,157 @@ cl::opt<unsigned int> MaxThreadsPerBlock(
     cl::desc("Set the maximum number of threads per block generated code "
              "can support at execution.\n"));
 
+cl::opt<std::string> LaunchBoundsTuneFile(
+    "cuabi-autotune-file", cl::init(""), cl::NotHidden,
+    cl::desc("A runtime autotuning table whose block sizes set the launch "
+             "bounds of the matching kernels. (default: none)"));
+
+// Blocks of (at most) this many threads leave ptxas the full register
+// file of a thread (255 registers).
+const unsigned CUDAABI_FULL_REGISTER_THREADS_PER_BLOCK = 256;
+cl::opt<unsigned> SpillThreshold(
+    "cuabi-spill-threshold", cl::init(128), cl::Hidden,
+    cl::desc("Generate kernels that spill more than this many bytes "
+             "again with relaxed launch bounds; 0 disables it "
+             "(default=128)"));
+
+cl::opt<bool> CodeGenGridStride(
+    "cuabi-grid-stride", cl::init(true), cl::Hidden,
+    cl::desc("Generate kernels where each thread strides over the "
+             "iteration space by the size of the grid.  This allows the "
+             "runtime to assign multiple iterations to each thread "
+             "(default=true)"));
+
+cl::opt<unsigned> CoarsenUnrollCount(
+    "cuabi-coarsen-unroll", cl::init(4), cl::Hidden,
+    cl::desc("Unroll the loop over each thread's iterations of a "
+             "grid-stride kernel by this factor; 0 or 1 disables it "
+             "(default=4)"));
+
+cl::opt<bool> CodeGenReductions(
+    "cuabi-reductions", cl::init(true), cl::Hidden,
+    cl::desc("Turn atomic updates of a kernel argument into block-wide "
+             "tree reductions (default=true)"));
+
+cl::opt<bool> CodeGenDeviceLog(
+    "cuabi-device-log", cl::init(true), cl::Hidden,
+    cl::desc("Lower printf() calls in kernels to records in the runtime's "
+             "device log buffer (default=true)"));
+
+cl::opt<bool> CodeGenDeviceHeap(
+    "cuabi-device-heap", cl::init(true), cl::Hidden,
+    cl::desc("Allocate the memory of malloc() and new calls in kernels "
+             "from the runtime's device heap (a bump allocator) rather "
+             "than from CUDA's (default=true)"));
+
+// The maximum number of arguments of a printf() call in a kernel; this
+// must match KITCUDA_LOG_MAX_ARGS in the runtime.
+const unsigned CUABI_LOG_MAX_ARGS = 6;
+
+cl::opt<bool> CodeGenHistograms(
+    "cuabi-histograms", cl::init(true), cl::Hidden,
+    cl::desc("Accumulate histogram-like atomic updates in per-block "
+             "shared memory copies, or aggregate them across the lanes of "
+             "a warp (sm_70+) (default=true)"));
+
+cl::opt<bool> CodeGenNDLaunches(
+    "cuabi-nd-launches", cl::init(true), cl::Hidden,
+    cl::desc("Launch kernels that index a flattened 2D/3D iteration "
+             "space with a matching multi-dimensional geometry "
+             "(default=true)"));
+
+cl::opt<bool> CodeGenTileLoads(
+    "cuabi-tile-loads", cl::init(false), cl::Hidden,
+    cl::desc("Stage the neighborhoods of stencil-like loads of read-only "
+             "arrays in shared memory (default=false)"));
+
+cl::opt<bool> CodeGenReduceDivisions(
+    "cuabi-reduce-divisions", cl::init(true), cl::Hidden,
+    cl::desc("Replace the divisions of kernels by launch invariant values "
+             "(e.g., the extents of a flattened iteration space) with "
+             "multiplications by their inverses (default=true)"));
+
+cl::opt<bool> CodeGenNarrowIV(
+    "cuabi-narrow-iv", cl::init(true), cl::Hidden,
+    cl::desc("Give kernels with 64-bit induction variables a copy of their "
+             "loop with a 32-bit induction variable for launches whose "
+             "iterations fit in 32 bits (default=true)"));
+
+cl::opt<bool> CodeGenPrivateArrays(
+    "cuabi-private-arrays", cl::init(true), cl::Hidden,
+    cl::desc("Unroll the loops that index small private arrays of kernels "
+             "so the arrays can live in registers, and move the arrays "
+             "that remain into per-thread slices of shared memory "
+             "(default=true)"));
+
+cl::opt<unsigned> PrivateArrayMaxBytes(
+    "cuabi-private-array-bytes", cl::init(256), cl::Hidden,
+    cl::desc("The largest private array (in bytes) whose indexing loops "
+             "are fully unrolled (default=256)"));
+
+cl::opt<unsigned> PrivateArraySharedBytes(
+    "cuabi-private-shared-bytes", cl::init(16384), cl::Hidden,
+    cl::desc("The shared memory per block that the private arrays left in "
+             "a kernel may use; 0 leaves them in local memory "
+             "(default=16384)"));
+
+cl::opt<bool> CodeGenAsyncCopy(
+    "cuabi-async-copy", cl::init(true), cl::Hidden,
+    cl::desc("Load shared memory tiles with asynchronous global to shared "
+             "memory copies (cp.async, sm_80+) (default=true)"));
+
+cl::opt<bool> CodeGenPackArgs(
+    "cuabi-pack-args", cl::init(true), cl::Hidden,
+    cl::desc("Pass the scalar arguments of a kernel in a single by-value "
+             "struct parameter (default=true)"));
+
+cl::opt<bool> CodeGenSpecializeTripCounts(
+    "cuabi-specialize-trip-counts", cl::init(true), cl::Hidden,
+    cl::desc("Fold compile-time constant trip counts into their kernels "
+             "and generate kernel clones for the sizes given by "
+             "-cuabi-trip-count-sizes (default=true)"));
+
+cl::list<unsigned>
+    TripCountSizes("cuabi-trip-count-sizes", cl::CommaSeparated, cl::Hidden,
+                   cl::desc("Trip counts to generate specialized kernel "
+                            "clones for; the launch selects a clone when "
+                            "the trip count matches."));
+
+cl::opt<bool> CodeGenMemIdioms(
+    "cuabi-mem-idioms", cl::init(true), cl::Hidden,
+    cl::desc("Run loops that only copy or fill arrays as asynchronous "
+             "memcpy/memset operations instead of kernels "
+             "(default=true)"));
+
+cl::opt<bool> CodeGenBlasIdioms(
+    "cuabi-blas-idioms", cl::init(true), cl::Hidden,
+    cl::desc("Run loops that compute a matrix product with cuBLAS "
+             "(when the runtime can load it) instead of their kernels "
+             "(default=true)"));
+
+cl::opt<bool> MergeIdenticalKernels(
+    "cuabi-merge-kernels", cl::init(true), cl::Hidden,
+    cl::desc("Generate code for only one of the kernels of the module "
+             "that are identical (e.g., those of the same loop in "
+             "different template instantiations) (default=true)"));
+
+cl::opt<bool> CodeGenPersistentKernels(
+    "cuabi-persistent-kernels", cl::init(false), cl::NotHidden,
+    cl::desc("Generate a persistent worker kernel that runs small "
+             "launches of the module's kernels from a work queue "
+             "(default=false)"));
+
+// The layout of the persistent worker's work queue; this must match
+// KitCudaPKQueue in the runtime.  The queue holds a header (a stop
+// flag and the sequence number of the last completed work item)
+// followed by a ring of work items.  Each item has a sequence number,
+// the index of the kernel to run and the kernel's packed arguments.
+const unsigned CUABI_PK_QUEUE_DEPTH = 64;
+const unsigned CUABI_PK_QUEUE_HEADER_BYTES = 64;
+const unsigned CUABI_PK_ARG_BYTES = 256;
+const unsigned CUABI_PK_ITEM_BYTES = 16 + CUABI_PK_ARG_BYTES;
+const unsigned CUABI_PK_THREADS_PER_BLOCK = 256;
+
 cl::opt<unsigned> DefaultGrainSize(
     "cuabi-default-grainsize", cl::init(1), cl::Hidden,
     cl::desc("The default grain size used by the transform "
@@ -246,6 +597,43 @@ cl::opt<bool>
                                    "fatbinaries used by the CUDA ABI "
                                    "transformation."));
 
+cl::list<std::string>
+    ExtraGPUArchs("cuabi-extra-archs", cl::CommaSeparated, cl::NotHidden,
+                  cl::desc("Additional target GPU architectures to assemble "
+                           "kernels for (same as or newer than -cuabi-arch)."));
+
+cl::opt<std::string> FatbinaryCacheDir(
+    "cuabi-cache-dir", cl::init(""), cl::NotHidden,
+    cl::desc("Directory used to cache fat binaries keyed on the kernel "
+             "module, target and options. (default: disabled)"));
+
+cl::opt<bool> RelocatableDeviceCode(
+    "cuabi-rdc", cl::init(false), cl::NotHidden,
+    cl::desc("Generate relocatable device code that is linked with the "
+             "device code of other modules at runtime. (default=false)"));
+
+cl::opt<std::string> RuntimeBCPath(
+    "cuabi-runtime-bc-path", cl::init(""), cl::Hidden,
+    cl::desc("Path to the bitcode of the runtime's launch and sync fast "
+             "paths, which are linked into the host module for inlining. "
+             "(default: none)"));
+
+cl::opt<std::string> ShmemBCPath(
+    "cuabi-shmem-bc", cl::init(""), cl::Hidden,
+    cl::desc("Path to NVSHMEM's device library bitcode, which is linked "
+             "into kernel modules that call NVSHMEM functions. (default: "
+             "$NVSHMEM_HOME/lib/libnvshmem_device.bc)"));
+
+cl::opt<bool> PreloadModules(
+    "cuabi-preload-modules", cl::init(true), cl::Hidden,
+    cl::desc("Generate calls that allow the runtime to load modules and "
+             "resolve kernels in the background at startup. (default=true)"));
+
+cl::opt<bool> AsyncInit(
+    "cuabi-async-init", cl::init(true), cl::Hidden,
+    cl::desc("Start the initialization of the runtime in the background "
+             "from the module constructor. (default=true)"));
+
 cl::opt<unsigned>
     DefaultThreadsPerBlock("cuabi-threads-per-block", cl::init(0), cl::Hidden,
                            cl::desc("Set the runtime system's value for "
@@ -285,6 +673,53 @@ std::string virtualArchForCudaArch(StringRef Arch) {
   return VirtArch;
 }
 
+// Return the numeric portion of the given architecture's name (e.g., 80
+// for 'sm_80'), or zero if it is not an 'sm_XX' architecture.
+unsigned getSMVersion(StringRef Arch) {
+  unsigned SM = 0;
+  if (!Arch.consume_front("sm_") || Arch.consumeInteger(10, SM))
+    return 0;
+  return SM;
+}
+
+// Return the largest block size the autotuning table given by
+// -cuabi-autotune-file holds for the kernel on the target architecture,
+// or zero if there is none.  The table uses the runtime's format of
+// '<arch> <kernel> <log2(trip count)> <threads-per-block>' lines.
+unsigned getTunedMaxThreadsPerBlock(StringRef KernelName) {
+  static const StringMap<unsigned> TunedMaxThreads = [] {
+    StringMap<unsigned> Table;
+    if (LaunchBoundsTuneFile.empty())
+      return Table;
+    ErrorOr<std::unique_ptr<MemoryBuffer>> TableBuf =
+        MemoryBuffer::getFile(LaunchBoundsTuneFile);
+    if (!TableBuf) {
+      errs() << "cuabi: warning -- unable to read autotuning table '"
+             << LaunchBoundsTuneFile
+             << "': " << TableBuf.getError().message() << "\n";
+      return Table;
+    }
+    SmallVector<StringRef, 32> Lines;
+    (*TableBuf)->getBuffer().split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines) {
+      if (Line.starts_with("#"))
+        continue;
+      SmallVector<StringRef, 4> Fields;
+      Line.split(Fields, ' ', -1, false);
+      unsigned Bucket, Threads;
+      if (Fields.size() != 4 || Fields[0] != GPUArch ||
+          Fields[2].getAsInteger(10, Bucket) ||
+          Fields[3].trim().getAsInteger(10, Threads) || Threads == 0 ||
+          Threads > CUDAABI_MAX_THREADS_PER_BLOCK)
+        continue;
+      unsigned &MaxThreads = Table[Fields[1]];
+      MaxThreads = std::max(MaxThreads, Threads);
+    }
+    return Table;
+  }();
+  return TunedMaxThreads.lookup(KernelName);
+}
+
 std::string PTXVersionFromCudaVersion() {
 #ifdef CUDATOOLKIT_VERSION
   std::string CudaVersion;
@@ -386,7 +821,7 @@ CudaLoop::CudaLoop(Module &M, Module &KernelModule, const std::string &KN,
   CUBlockDimY = Intrinsic::getDeclaration(&KernelModule,
                                           Intrinsic::nvvm_read_ptx_sreg_ntid_y);
   CUBlockDimZ = Intrinsic::getDeclaration(&KernelModule,
-                                          Intrinsic::nvvm_read_ptx_sreg_ntid_x);
+                                          Intrinsic::nvvm_read_ptx_sreg_ntid_z);
 
   // Grid dimensions -- equivalent to Cuda's builtins: gridDim.[x,y,z].
   CUGridDimX = Intrinsic::getDeclaration(
@@ -399,11 +834,25 @@ CudaLoop::CudaLoop(Module &M, Module &KernelModule, const std::string &KN,
   // NVVM-centric barrier -- equivalent to Cuda's __sync_threads().
   CUSyncThreads =
       Intrinsic::getDeclaration(&KernelModule, Intrinsic::nvvm_barrier0);
+  // Warp-level shuffle used by block-wide reductions.
+  CUShflDownSync = Intrinsic::getDeclaration(
+      &KernelModule, Intrinsic::nvvm_shfl_sync_down_i32);
+  // Warp-level match used to aggregate histogram updates (sm_70+).
+  CUMatchAnySync = Intrinsic::getDeclaration(
+      &KernelModule, Intrinsic::nvvm_match_any_sync_i64);
 
   // Get entry points into the Cuda-centric portion of the Kitsune GPU runtime.
   KernelInstMixTy = StructType::get(Int64Ty,  // number of memory ops.
                                     Int64Ty,  // number of floating point ops.
-                                    Int64Ty); // number of integer ops.
+                                    Int64Ty,  // number of integer ops.
+                                    Int64Ty,  // number of bytes accessed.
+                                    Int64Ty,  // kernel flags.
+                                    Int64Ty,  // shared memory per thread.
+                                    Int64Ty,  // shared memory per block.
+                                    VoidPtrTy, // forall source location.
+                                    Int64Ty,  // max blocks per grid.
+                                    Int64Ty,  // launch shared memory.
+                                    Int64Ty); // iterations per thread.
   KitCudaLaunchFn = M.getOrInsertFunction(
       "__kitcuda_launch_kernel",
       VoidPtrTy,                       // return an opaque stream
@@ -413,13 +862,94 @@ CudaLoop::CudaLoop(Module &M, Module &KernelModule, const std::string &KN,
       Int64Ty,                         // trip count
       Int32Ty,                         // threads-per-block
       KernelInstMixTy->getPointerTo(), // instruction mix info
+      VoidPtrTy,                       // opaque cuda stream
+      Int32Ty,                         // iteration space value size
+      VoidPtrTy);                      // kernel launch handle
+  KitCudaLaunchNDFn = M.getOrInsertFunction(
+      "__kitcuda_launch_kernel_nd",
+      VoidPtrTy,                       // return an opaque stream
+      VoidPtrTy,                       // fat-binary
+      VoidPtrTy,                       // kernel name
+      VoidPtrPtrTy,                    // arguments
+      Int64Ty,                         // trip count
+      Int32Ty,                         // threads-per-block
+      KernelInstMixTy->getPointerTo(), // instruction mix info
+      VoidPtrTy,                       // opaque cuda stream
+      Int32Ty,                         // iteration space value size
+      VoidPtrTy,                       // kernel launch handle
+      Int32Ty,                         // number of dimensions
+      Int64Ty->getPointerTo());        // extents of the inner dimensions
+  KitCudaLaunchMemcpyFn = M.getOrInsertFunction(
+      "__kitcuda_launch_memcpy",
+      VoidPtrTy,                       // return an opaque stream
+      VoidPtrTy,                       // destination
+      VoidPtrTy,                       // source
+      Int64Ty,                         // start of the iteration space
+      Int64Ty,                         // end of the iteration space
+      Int32Ty,                         // element size
+      VoidPtrTy);                      // opaque cuda stream
+  KitCudaLaunchMemsetFn = M.getOrInsertFunction(
+      "__kitcuda_launch_memset",
+      VoidPtrTy,                       // return an opaque stream
+      VoidPtrTy,                       // destination
+      Int32Ty,                         // fill value
+      Int64Ty,                         // start of the iteration space
+      Int64Ty,                         // end of the iteration space
+      Int32Ty,                         // element size (1, 2 or 4)
       VoidPtrTy);                      // opaque cuda stream
-      
-  KitCudaMemPrefetchFn =
-      M.getOrInsertFunction("__kitcuda_mem_gpu_prefetch",
-                            VoidPtrTy,  // return an opaque stream
+  KitCudaLaunchGemmFn = M.getOrInsertFunction(
+      "__kitcuda_launch_gemm",
+      VoidPtrTy,                       // return an opaque stream (or null)
+      VoidPtrTy,                       // product
+      VoidPtrTy,                       // left matrix
+      VoidPtrTy,                       // right (transposed) matrix
+      Int64Ty,                         // start of the iteration space
+      Int64Ty,                         // end of the iteration space
+      Int64Ty,                         // columns of the product
+      Int64Ty,                         // length of the sums
+      Int32Ty,                         // element size
+      VoidPtrTy);                      // opaque cuda stream
+  KitCudaSpecializeLaunchFn = M.getOrInsertFunction(
+      "__kitcuda_specialize_launch",
+      VoidPtrTy,                       // return the launch handle to use
+      VoidPtrTy,                       // the module's PTX
+      VoidPtrTy,                       // kernel name
+      VoidPtrPtrTy,                    // arguments
+      VoidPtrTy,                       // specialized parameters
+      Int32Ty,                         // number of specialized parameters
+      VoidPtrTy,                       // launch site handle
+      VoidPtrTy);                      // the kernel's launch handle
+
+  KitCudaMemPrefetchAsyncFn =
+      M.getOrInsertFunction("__kitcuda_mem_gpu_prefetch_async",
+                            VoidTy,     // no return
                             VoidPtrTy,  // pointer to prefetch
-                            VoidPtrTy); // opaque stream
+                            Int32Ty);   // access mode (read/write/both)
+  KitCudaMemMapFn =
+      M.getOrInsertFunction("__kitcuda_mem_gpu_map",
+                            VoidPtrTy,  // return the kernel-side pointer
+                            VoidPtrTy,  // pointer to map
+                            Int32Ty,    // access mode (read/write/both)
+                            VoidPtrTy); // pointer to opaque stream
+  KitCudaMemMapBatchFn =
+      M.getOrInsertFunction("__kitcuda_mem_gpu_map_batch",
+                            VoidTy,     // no return
+                            VoidPtrTy,  // pointers to map (updated in place)
+                            VoidPtrTy,  // access mode of each pointer
+                            Int32Ty,    // number of pointers
+                            VoidPtrTy,  // pointer to opaque stream
+                            VoidPtrTy); // launch site cache
+  KitCudaPriorityStreamFn =
+      M.getOrInsertFunction("__kitcuda_use_priority_stream",
+                            VoidTy,     // no return
+                            VoidPtrTy,  // pointer to opaque stream
+                            Int32Ty);   // priority (see KitRTPriority)
+  KitCudaMemReduceMapFn =
+      M.getOrInsertFunction("__kitcuda_mem_reduce_map",
+                            VoidPtrTy,  // return the kernel-side pointer
+                            VoidPtrTy,  // pointer to the reduction result
+                            Int64Ty,    // size of the result
+                            VoidPtrTy); // pointer to opaque stream
   KitCudaGetGlobalSymbolFn =
       M.getOrInsertFunction("__kitcuda_get_global_symbol",
                             Int64Ty,    // return the device pointer for symbol.
@@ -471,7 +1001,9 @@ void CudaLoop::setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
 
   // The third parameter defines the grain size, if it is
   // not constant.
+  NumLoopControlArgs = 2;
   if (!isa<ConstantInt>(LCInputs[2])) {
+    NumLoopControlArgs = 3;
     Argument *GrainsizeArg = cast<Argument>(LCArgs[2]);
     GrainsizeArg->setName("grainSize");
     HelperArgs.insert(GrainsizeArg);
@@ -494,6 +1026,415 @@ void CudaLoop::setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
   }
 }
 
+const tapir::GPUReductionArg *CudaLoop::isReductionArg(unsigned ArgNo) const {
+  for (const tapir::GPUReductionArg &RA : ReductionArgs)
+    if (RA.ArgNo == ArgNo)
+      return &RA;
+  return nullptr;
+}
+
+/// Pack the scalar parameters of kernel \p F that follow the loop-control
+/// parameters into a single struct passed by value after the remaining
+/// parameters.  The launch then marshals one buffer instead of a pointer
+/// per scalar, and the kernel reads the fields straight from the parameter
+/// space.  Returns the packed kernel (which replaces \p F), or \p F if there
+/// is nothing worth packing.
+Function *CudaLoop::packKernelArgs(Function &F, TaskOutlineInfo &TOI) {
+  if (!CodeGenPackArgs || F.arg_size() != OrderedInputs.size())
+    return &F;
+
+  LLVMContext &Ctx = F.getContext();
+  const DataLayout &DL = KernelModule.getDataLayout();
+  SmallVector<unsigned, 8> ArgNos;
+  for (unsigned i = NumLoopControlArgs; i < F.arg_size(); ++i) {
+    Type *Ty = F.getArg(i)->getType();
+    if ((Ty->isIntegerTy() || Ty->isFloatingPointTy()) &&
+        DL.getTypeSizeInBits(Ty) == DL.getTypeStoreSizeInBits(Ty))
+      ArgNos.push_back(i);
+  }
+  if (ArgNos.size() < 2)
+    return &F;
+
+  // Order the fields by decreasing alignment to avoid padding.
+  llvm::stable_sort(ArgNos, [&](unsigned A, unsigned B) {
+    return DL.getABITypeAlign(F.getArg(A)->getType()) >
+           DL.getABITypeAlign(F.getArg(B)->getType());
+  });
+  SmallVector<Type *, 8> FieldTys;
+  for (unsigned ArgNo : ArgNos)
+    FieldTys.push_back(F.getArg(ArgNo)->getType());
+  StructType *PackTy = StructType::get(Ctx, FieldTys);
+  LLVM_DEBUG(dbgs() << "\t*- packing " << ArgNos.size()
+                    << " scalar kernel args into " << *PackTy << "\n");
+
+  // The packed kernel takes the remaining parameters, in order, followed by
+  // the struct.
+  AttributeList FAttrs = F.getAttributes();
+  SmallVector<Type *, 8> ParamTys;
+  SmallVector<AttributeSet, 8> ParamAttrs;
+  for (unsigned i = 0; i < F.arg_size(); ++i)
+    if (!is_contained(ArgNos, i)) {
+      ParamTys.push_back(F.getArg(i)->getType());
+      ParamAttrs.push_back(FAttrs.getParamAttrs(i));
+    }
+  ParamTys.push_back(PointerType::getUnqual(Ctx));
+  AttrBuilder PackAttrs(Ctx);
+  PackAttrs.addByValAttr(PackTy);
+  PackAttrs.addAlignmentAttr(DL.getABITypeAlign(PackTy));
+  ParamAttrs.push_back(AttributeSet::get(Ctx, PackAttrs));
+
+  Function *NewF = Function::Create(
+      FunctionType::get(F.getReturnType(), ParamTys, false), F.getLinkage(),
+      F.getAddressSpace(), "", &KernelModule);
+  NewF->copyAttributesFrom(&F);
+  NewF->setAttributes(AttributeList::get(Ctx, FAttrs.getFnAttrs(),
+                                         FAttrs.getRetAttrs(), ParamAttrs));
+  NewF->copyMetadata(&F, 0);
+  NewF->splice(NewF->begin(), &F);
+
+  Argument *Packed = NewF->getArg(ParamTys.size() - 1);
+  Packed->setName("kernel.args");
+  IRBuilder<> B(&*NewF->getEntryBlock().getFirstInsertionPt());
+  unsigned NewArgNo = 0;
+  for (unsigned i = 0; i < F.arg_size(); ++i) {
+    Argument *A = F.getArg(i);
+    auto Field = find(ArgNos, i);
+    if (Field == ArgNos.end()) {
+      Argument *NewA = NewF->getArg(NewArgNo++);
+      A->replaceAllUsesWith(NewA);
+      NewA->takeName(A);
+      continue;
+    }
+    Value *V = B.CreateLoad(
+        A->getType(),
+        B.CreateStructGEP(PackTy, Packed, Field - ArgNos.begin()));
+    A->replaceAllUsesWith(V);
+    V->takeName(A);
+  }
+
+  // The kernel annotations refer to the new kernel from here on.
+  NewF->takeName(&F);
+  F.replaceAllUsesWith(NewF);
+  F.eraseFromParent();
+  TOI.Outline = NewF;
+
+  PackedArgNos = ArgNos;
+  PackedArgsTy = PackTy;
+  return NewF;
+}
+
+/// Get the parameter of kernel \p F for input \p ArgNo, or null if the
+/// input is packed.
+Argument *CudaLoop::getKernelArg(Function &F, unsigned ArgNo) const {
+  if (is_contained(PackedArgNos, ArgNo))
+    return nullptr;
+  unsigned NumPackedBefore =
+      count_if(PackedArgNos, [&](unsigned P) { return P < ArgNo; });
+  unsigned NumArgs = OrderedInputs.size() - PackedArgNos.size() +
+                     (PackedArgsTy ? 1 : 0);
+  if (F.arg_size() != NumArgs)
+    return nullptr;
+  return F.getArg(ArgNo - NumPackedBefore);
+}
+
+/// Get the value of input \p ArgNo within kernel \p F: its parameter or,
+/// if the input is packed, the load of its field.  Returns null if there
+/// is no such value.
+Value *CudaLoop::getKernelInput(Function &F, unsigned ArgNo) const {
+  if (Argument *A = getKernelArg(F, ArgNo))
+    return A;
+  auto Field = find(PackedArgNos, ArgNo);
+  if (Field == PackedArgNos.end())
+    return nullptr;
+  unsigned FieldNo = Field - PackedArgNos.begin();
+  for (User *U : F.getArg(F.arg_size() - 1)->users())
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(U))
+      if (GEP->getSourceElementType() == PackedArgsTy &&
+          GEP->getNumIndices() == 2 && GEP->hasOneUse()) {
+        auto *Idx = dyn_cast<ConstantInt>(GEP->getOperand(2));
+        if (Idx && Idx->getZExtValue() == FieldNo)
+          return dyn_cast<LoadInst>(GEP->user_back());
+      }
+  return nullptr;
+}
+
+/// Return the parameters of the kernel that its launch is specialized on
+/// at run time (see the kitsune::specialize attribute): clang passes the
+/// values named by the attribute to a placeholder call ahead of the loop,
+/// paired with the loop by the ID in its metadata.  The scalar inputs
+/// among those values (or casts of them) are specialized, except for the
+/// bounds of the iteration space that the runtime rewrites when it
+/// splits a launch.
+SmallVector<unsigned, 4>
+CudaLoop::getSpecializedParams(TapirLoopInfo &TL, TaskOutlineInfo &TOI) {
+  SmallVector<unsigned, 4> Params;
+  unsigned ID = TapirLoopHints(TL.getLoop()).getSpecializeID();
+  Function *SpecFn = M.getFunction("__kitrt_dummy_specialize");
+  Function *KF = KernelModule.getFunction(KernelName);
+  if (ID == 0 || !SpecFn || !KF || RelocatableDeviceCode)
+    return Params;
+
+  // Inlining can bring in more than one placeholder with the same ID;
+  // the closest one that dominates the launch belongs to this loop.
+  Function *HostFn = TOI.ReplCall->getFunction();
+  DominatorTree HostDT(*HostFn);
+  CallInst *Spec = nullptr;
+  for (User *U : SpecFn->users()) {
+    auto *CI = dyn_cast<CallInst>(U);
+    if (!CI || CI->getFunction() != HostFn)
+      continue;
+    auto *CID = dyn_cast<ConstantInt>(CI->getArgOperand(0));
+    if (!CID || CID->getZExtValue() != ID ||
+        !HostDT.dominates(CI, TOI.ReplCall))
+      continue;
+    if (!Spec || HostDT.dominates(Spec, CI))
+      Spec = CI;
+  }
+  if (!Spec)
+    return Params;
+
+  auto IsValue = [&](Value *V) {
+    return any_of(drop_begin(Spec->args()),
+                  [&](const Use &A) { return A.get() == V; });
+  };
+  auto IsSpecialized = [&](Value *V) {
+    if (auto *Cast = dyn_cast<CastInst>(V))
+      if (IsValue(Cast->getOperand(0)))
+        return true;
+    return IsValue(V);
+  };
+  for (unsigned ArgNo = NumLoopControlArgs; ArgNo < OrderedInputs.size();
+       ArgNo++) {
+    Value *V = OrderedInputs[ArgNo];
+    if (V->getType()->isPointerTy() || isa<Constant>(V) ||
+        isReductionArg(ArgNo) || !IsSpecialized(V))
+      continue;
+    Argument *A = getKernelArg(*KF, ArgNo);
+    if (A && !A->use_empty()) {
+      LLVM_DEBUG(dbgs() << "\t\t- specializing on kernel arg #" << ArgNo
+                        << " (parameter " << A->getArgNo() << ").\n");
+      Params.push_back(A->getArgNo());
+    }
+  }
+  return Params;
+}
+
+/// Specialize kernel \p F for trip counts known at compile time.  A
+/// constant trip count is folded into the kernel itself.  Otherwise each
+/// of the -cuabi-trip-count-sizes gets a clone of the kernel with the
+/// trip count, and any other input that passes the same value, folded
+/// in; the launch selects a clone at run time.  Folding the trip count
+/// lets the optimization of the kernel module simplify the bounds
+/// checks and unroll the loops of the body that depend on it.
+void CudaLoop::specializeTripCounts(Function &F) {
+  TripCountKernels.clear();
+  FixedTripCount = false;
+  // The runtime only splits 1D launches across devices and those
+  // launches can be told not to (see KernelFixedTripCount).
+  if (!CodeGenSpecializeTripCounts || NumLaunchDims != 1)
+    return;
+  Argument *End = getKernelArg(F, 0);
+  if (!End || !End->getType()->isIntegerTy())
+    return;
+
+  if (auto *TC = dyn_cast<ConstantInt>(OrderedInputs[0])) {
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName
+                      << "' has a constant trip count of " << *TC << ".\n");
+    End->replaceAllUsesWith(TC);
+    FixedTripCount = true;
+    return;
+  }
+  if (TripCountSizes.empty())
+    return;
+
+  SmallVector<Value *, 4> TCInputs;
+  TCInputs.push_back(End);
+  for (unsigned i = NumLoopControlArgs; i < OrderedInputs.size(); ++i)
+    if (OrderedInputs[i] == OrderedInputs[0])
+      if (Value *V = getKernelInput(F, i))
+        TCInputs.push_back(V);
+
+  LLVMContext &Ctx = F.getContext();
+  NamedMDNode *Annotations =
+      KernelModule.getOrInsertNamedMetadata("nvvm.annotations");
+  // The clones share the kernel's launch bounds (see postProcessOutline()).
+  SmallVector<MDNode *, 1> LaunchBounds;
+  for (MDNode *Node : Annotations->operands()) {
+    auto *FnMD = dyn_cast<ValueAsMetadata>(Node->getOperand(0));
+    auto *Name = dyn_cast<MDString>(Node->getOperand(1));
+    if (FnMD && FnMD->getValue() == &F && Name &&
+        Name->getString() == "maxntidx")
+      LaunchBounds.push_back(Node);
+  }
+  unsigned Bits = End->getType()->getIntegerBitWidth();
+  for (unsigned Size : TripCountSizes) {
+    if (Size == 0 || !isUIntN(Bits, Size) ||
+        any_of(TripCountKernels,
+               [Size](const auto &TK) { return TK.first == Size; }))
+      continue;
+    ValueToValueMapTy VMap;
+    Function *Clone = CloneFunction(&F, VMap);
+    std::string Name = KernelName + "_tc" + std::to_string(Size);
+    Clone->setName(Name);
+    Constant *TC = ConstantInt::get(End->getType(), Size);
+    for (Value *V : TCInputs)
+      VMap[V]->replaceAllUsesWith(TC);
+    Annotations->addOperand(MDNode::get(
+        Ctx, {ValueAsMetadata::get(Clone), MDString::get(Ctx, "kernel"),
+              ValueAsMetadata::get(
+                  ConstantInt::get(Type::getInt32Ty(Ctx), 1))}));
+    for (MDNode *Bounds : LaunchBounds) {
+      SmallVector<Metadata *, 5> Ops(Bounds->op_begin(), Bounds->op_end());
+      Ops[0] = ValueAsMetadata::get(Clone);
+      Annotations->addOperand(MDNode::get(Ctx, Ops));
+    }
+    if (TTarget->hasPinnedLaunchBounds(KernelName))
+      TTarget->pinLaunchBounds(Name);
+    TripCountKernels.push_back({Size, Name});
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << Name
+                      << "' specializes a trip count of " << Size << ".\n");
+  }
+}
+
+/// Emit the memcpy (or memset) that replaces the launch of a kernel that
+/// only copies (or fills) an array, see tapir::findGPUMemIdiom().  The
+/// runtime hands it to the copy engines, which run at full bandwidth
+/// without occupying any SMs.  Returns false, without emitting any code,
+/// if the fill value can not be expressed as a memset.
+bool CudaLoop::emitMemIdiom(IRBuilder<> &B, Value *CudaStream) {
+  LLVMContext &Ctx = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  Type *ElemTy = MemIdiom.ElemTy;
+  uint64_t EltSize = DL.getTypeStoreSize(ElemTy);
+
+  // A memset fills elements of 1, 2 or 4 bytes.  Wider elements whose
+  // bits repeat every 4 bytes (e.g., zeros) are filled as a run of 4-byte
+  // elements.
+  uint64_t Scale = 1;
+  Value *Fill = MemIdiom.Fill;
+  Constant *FillBits = nullptr;
+  if (MemIdiom.Kind == tapir::GPUMemIdiom::Set) {
+    if (auto *C = dyn_cast<Constant>(Fill)) {
+      APInt Bits;
+      if (auto *CI = dyn_cast<ConstantInt>(C))
+        Bits = CI->getValue();
+      else if (auto *CF = dyn_cast<ConstantFP>(C))
+        Bits = CF->getValueAPF().bitcastToAPInt();
+      else if (C->isNullValue())
+        Bits = APInt::getZero(EltSize * 8);
+      else
+        return false;
+      if (Bits.getBitWidth() > EltSize * 8)
+        return false;
+      Bits = Bits.zext(EltSize * 8);
+      if (EltSize > 4 && EltSize % 4 == 0 &&
+          APInt::getSplat(EltSize * 8, Bits.trunc(32)) == Bits) {
+        Scale = EltSize / 4;
+        EltSize = 4;
+        Bits = Bits.trunc(32);
+      }
+      if (EltSize != 1 && EltSize != 2 && EltSize != 4)
+        return false;
+      FillBits = ConstantInt::get(Int32Ty, Bits.zext(32));
+    } else if (!(ElemTy->isIntegerTy() || ElemTy->isFloatingPointTy()) ||
+               (EltSize != 1 && EltSize != 2 && EltSize != 4) ||
+               ElemTy->getPrimitiveSizeInBits() != EltSize * 8)
+      return false;
+  }
+
+  LLVM_DEBUG(dbgs() << "\t*- code gen "
+                    << (MemIdiom.Kind == tapir::GPUMemIdiom::Copy ? "memcpy"
+                                                                   : "memset")
+                    << " for kernel '" << KernelName << "'.\n");
+
+  // Map the arrays as a launch would.  The copy only reads the source;
+  // the destination keeps its access mode since a partial write must
+  // preserve the remaining elements.
+  auto MapArray = [&](Value *Base, int64_t Offset,
+                      tapir::KernelArgAccess Access) {
+    Value *Ptr = B.CreateBitCast(Base, VoidPtrTy);
+    if (CodeGenPrefetch)
+      Ptr = B.CreateCall(KitCudaMemMapFn,
+                         {Ptr, ConstantInt::get(Int32Ty, Access), CudaStream});
+    return B.CreateGEP(ElemTy, Ptr, ConstantInt::get(Int64Ty, Offset));
+  };
+  Value *Dst = MapArray(MemIdiom.Dst, MemIdiom.DstOffset,
+                        tapir::getKernelArgAccess(MemIdiom.Dst, nullptr));
+
+  // The iteration space is [start, end) -- see postProcessOutline().
+  Value *Start = B.CreateZExtOrTrunc(OrderedInputs[1], Int64Ty);
+  Value *End = B.CreateZExtOrTrunc(OrderedInputs[0], Int64Ty);
+  if (Scale > 1) {
+    Start = B.CreateMul(Start, ConstantInt::get(Int64Ty, Scale));
+    End = B.CreateMul(End, ConstantInt::get(Int64Ty, Scale));
+  }
+  Value *Size = ConstantInt::get(Int32Ty, EltSize);
+
+  CallInst *Stream;
+  if (MemIdiom.Kind == tapir::GPUMemIdiom::Copy) {
+    Value *Src = MapArray(MemIdiom.Src, MemIdiom.SrcOffset,
+                          tapir::KernelArgReadOnly);
+    Stream = B.CreateCall(KitCudaLaunchMemcpyFn,
+                          {Dst, Src, Start, End, Size,
+                           B.CreateLoad(VoidPtrTy, CudaStream)});
+  } else {
+    Value *Bits =
+        FillBits ? FillBits
+                 : B.CreateZExt(B.CreateBitCast(Fill, IntegerType::get(
+                                                          Ctx, EltSize * 8)),
+                                Int32Ty);
+    Stream = B.CreateCall(KitCudaLaunchMemsetFn,
+                          {Dst, Bits, Start, End, Size,
+                           B.CreateLoad(VoidPtrTy, CudaStream)});
+  }
+  B.CreateStore(Stream, CudaStream);
+  return true;
+}
+
+/// Emit the call that runs a loop that computes a matrix product with
+/// cuBLAS, see tapir::findGPUBlasIdiom().  The runtime returns null when
+/// it can not run the product, e.g., if cuBLAS is not available, and
+/// the caller then launches the kernel instead.
+Value *CudaLoop::emitBlasIdiom(IRBuilder<> &B, Value *CudaStream) {
+  LLVMContext &Ctx = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+
+  LLVM_DEBUG(dbgs() << "\t*- code gen cuBLAS "
+                    << (BlasIdiom.N ? "gemm" : "gemv") << " for kernel '"
+                    << KernelName << "'.\n");
+
+  // Map the matrices as a launch would.
+  auto MapArray = [&](Value *Base, tapir::KernelArgAccess Access) {
+    Value *Ptr = B.CreateBitCast(Base, VoidPtrTy);
+    if (CodeGenPrefetch)
+      Ptr = B.CreateCall(KitCudaMemMapFn,
+                         {Ptr, ConstantInt::get(Int32Ty, Access), CudaStream});
+    return Ptr;
+  };
+  Value *C = MapArray(BlasIdiom.C,
+                      tapir::getKernelArgAccess(BlasIdiom.C, nullptr));
+  Value *A = MapArray(BlasIdiom.A, tapir::KernelArgReadOnly);
+  Value *Bt = MapArray(BlasIdiom.B, tapir::KernelArgReadOnly);
+
+  // The iteration space is [start, end) -- see postProcessOutline().
+  Value *Start = B.CreateZExtOrTrunc(OrderedInputs[1], Int64Ty);
+  Value *End = B.CreateZExtOrTrunc(OrderedInputs[0], Int64Ty);
+  Value *N = BlasIdiom.N ? B.CreateZExtOrTrunc(BlasIdiom.N, Int64Ty)
+                         : ConstantInt::get(Int64Ty, 1);
+  Value *K = B.CreateZExtOrTrunc(BlasIdiom.K, Int64Ty);
+  Value *Size =
+      ConstantInt::get(Int32Ty, DL.getTypeStoreSize(BlasIdiom.ElemTy));
+  return B.CreateCall(KitCudaLaunchGemmFn,
+                      {C, A, Bt, Start, End, N, K, Size,
+                       B.CreateLoad(VoidPtrTy, CudaStream)});
+}
+
 unsigned CudaLoop::getIVArgIndex(const Function &F,
                                  const ValueSet &Args) const {
   // The argument for the primary induction variable is the second input.
@@ -592,6 +1533,17 @@ void CudaLoop::preProcessTapirLoop(TapirLoopInfo &TL, ValueToValueMapTy &VMap) {
   // need to be cloned into the KernelModule and then register with CUDA
   // in the CUDA-centric ctor.
   LLVM_DEBUG(dbgs() << "\t\t- gathering and analyzing global values...\n");
+  // Loops that only copy or fill an array become a memcpy or memset when
+  // the call to the outlined loop is processed.
+  if (CodeGenMemIdioms && tapir::findGPUMemIdiom(TL, MemIdiom))
+    LLVM_DEBUG(dbgs() << "\t\t- loop is a "
+                      << (MemIdiom.Kind == tapir::GPUMemIdiom::Copy
+                              ? "memcpy"
+                              : "memset")
+                      << " idiom.\n");
+  else if (CodeGenBlasIdioms && tapir::findGPUBlasIdiom(TL, BlasIdiom))
+    LLVM_DEBUG(dbgs() << "\t\t- loop is a matrix product idiom.\n");
+
   std::set<GlobalValue *> UsedGlobalValues;
   Loop &L = *TL.getLoop();
 
@@ -651,7 +1603,13 @@ void CudaLoop::preProcessTapirLoop(TapirLoopInfo &TL, ValueToValueMapTy &VMap) {
       if (not DeviceF) {
         // LLVM_DEBUG(dbgs() << "\tanalyzing missing (device-side) function '"
         //                   << F->getName() << "'.\n");
-        Function *LF = resolveLibDeviceFunction(F, false);
+        // Math functions are resolved for each call (see
+        // transformForPTX()) to match the accuracy of the call.
+        Function *LF = nullptr;
+        if (tapir::getGPUMathFunction(F->getName(), tapir::GPUMathLibDevice,
+                                      tapir::GPUMathIEEE)
+                .empty())
+          LF = resolveLibDeviceFunction(F, tapir::GPUMathIEEE);
         if (LF && not KernelModule.getFunction(LF->getName())) {
           // LLVM_DEBUG(dbgs() << "\ttransformed to libdevice function '"
           //                   << LF->getName() << "'.\n");
@@ -732,7 +1690,8 @@ void CudaLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
   PHINode *PrimaryIV = cast<PHINode>(VMap[TLI.getPrimaryInduction().first]);
   Value *PrimaryIVInput = PrimaryIV->getIncomingValueForBlock(Entry);
 
-  TTarget->pushSR(T->getDetach()->getSyncRegion());
+  SyncRegion = T->getDetach()->getSyncRegion();
+  Async = Hints.getAsync();
 
   // We no longer need the cloned sync region.
   Instruction *ClonedSyncReg =
@@ -759,14 +1718,43 @@ void CudaLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
   AV.push_back(MDString::get(Ctx, "kernel"));
   AV.push_back(
       ValueAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx), 1)));
-  // AV.push_back(MDString::get(Ctx, "maxntidx"));
-  // AV.push_back(ValueAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx),
-  // 160)));
   // AV.push_back(MDString::get(Ctx, "maxnreg"));
   // AV.push_back(ValueAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx),
   // 63)));
   Annotations->addOperand(MDNode::get(Ctx, AV));
 
+  // Launch bounds are the equivalent of CUDA's __launch_bounds__:
+  // ptxas budgets the registers of each thread for blocks of (at most)
+  // the maximum number of threads (maxntid) and, given a minimum number
+  // of resident blocks (minctasm), so that many blocks fit on a
+  // multiprocessor.  The launch attribute's threads-per-block is the
+  // bound of its kernel; other kernels take the largest block size a
+  // tuning table recorded for them.  The runtime never launches more
+  // threads per block than the bound.
+  unsigned MaxThreads = Hints.getThreadsPerBlock();
+  unsigned MinBlocks = Hints.getMinBlocksPerMultiproc();
+  if (MaxThreads != 0)
+    TTarget->pinLaunchBounds(KernelName);
+  else
+    MaxThreads = getTunedMaxThreadsPerBlock(KernelName);
+  if (MaxThreads == 0 && MinBlocks != 0)
+    MaxThreads = CUDAABI_MAX_THREADS_PER_BLOCK;
+  if (MaxThreads != 0) {
+    SmallVector<Metadata *, 5> Bounds;
+    Bounds.push_back(ValueAsMetadata::get(KernelF));
+    Bounds.push_back(MDString::get(Ctx, "maxntidx"));
+    Bounds.push_back(ValueAsMetadata::get(
+        ConstantInt::get(Type::getInt32Ty(Ctx), MaxThreads)));
+    if (MinBlocks != 0) {
+      Bounds.push_back(MDString::get(Ctx, "minctasm"));
+      Bounds.push_back(ValueAsMetadata::get(
+          ConstantInt::get(Type::getInt32Ty(Ctx), MinBlocks)));
+    }
+    Annotations->addOperand(MDNode::get(Ctx, Bounds));
+    LLVM_DEBUG(dbgs() << "\tlaunch bounds: " << MaxThreads << " threads, "
+                      << MinBlocks << " blocks per multiprocessor.\n");
+  }
+
   // Verify that the Thread ID corresponds to a valid iteration.  Because
   // Tapir loops use canonical induction variables, valid iterations range
   // from 0 to the loop limit with stride 1.  The End argument encodes the
@@ -790,39 +1778,326 @@ void CudaLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
 
   IRBuilder<> B(Entry->getTerminator());
 
-  // Get the thread ID for this invocation of Helper.
-  //
-  // This is the classic CUDA thread ID calculation:
-  //      i = blockDim.x * blockIdx.x + threadIdx.x;
-  // For now we only generate 1-D thread IDs.
-  Value *ThreadIdx = B.CreateCall(CUThreadIdxX);
-  Value *BlockIdx = B.CreateCall(CUBlockIdxX);
+  // Kernels that split a flattened 2D/3D iteration space into
+  // coordinates with division and remainder (e.g., 'i = tid / N,
+  // j = tid % N', or the lowering of a Kokkos MDRangePolicy) are
+  // launched with a matching multi-dimensional geometry.  Each thread
+  // takes its coordinates directly from its block and thread indices
+  // (no per-thread division) and each block covers a tile of the
+  // iteration space.  The host side of the launch needs the extents,
+  // so the kernel's parameters must match the packed arguments.
+  tapir::GPUFlattenedIndex FlatIndex;
+  NumLaunchDims = 1;
+  // Hybrid loops launch a (runtime chosen) part of the iteration space
+  // that need not cover whole rows.
+  if (CodeGenNDLaunches && KernelF->arg_size() == OrderedInputs.size() &&
+      !TapirLoopHints(TLI.getLoop()).getHybrid() &&
+      tapir::findFlattenedIndex(*KernelF, PrimaryIV, FlatIndex)) {
+    NumLaunchDims = FlatIndex.NumDims;
+    LaunchExtents[0] = FlatIndex.Extents[0];
+    LaunchExtents[1] = FlatIndex.Extents[1];
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName << "' uses a "
+                      << NumLaunchDims << "D launch geometry.\n");
+  }
+
   Value *BlockDim = B.CreateCall(CUBlockDimX);
-  Value *ThreadIV = B.CreateIntCast(
-      B.CreateAdd(ThreadIdx, B.CreateMul(BlockIdx, BlockDim, "blk_offset"),
-                  "cuthread_id"),
-      PrimaryIV->getType(), false, "thread_iv");
+  Value *ThreadIV;
+  Instruction *StartCond = nullptr;
+  Value *Cond;
+  if (NumLaunchDims > 1) {
+    // The coordinates of the thread:
+    //      x = blockDim.x * blockIdx.x + threadIdx.x;  (and so on)
+    // 2D launches may have more rows than fit in the grid's y
+    // dimension; the runtime places the extra rows in z.
+    Type *IVTy = PrimaryIV->getType();
+    auto Coord = [&](Value *BlockIdx, Value *Dim, Value *ThreadIdx,
+                     const Twine &Name) {
+      return B.CreateIntCast(
+          B.CreateAdd(ThreadIdx, B.CreateMul(BlockIdx, Dim)), IVTy, false,
+          Name);
+    };
+    Value *BlockIdxY = B.CreateCall(CUBlockIdxY);
+    if (NumLaunchDims == 2)
+      BlockIdxY = B.CreateAdd(
+          B.CreateMul(B.CreateCall(CUBlockIdxZ), B.CreateCall(CUGridDimY)),
+          BlockIdxY);
+    SmallVector<Value *, 3> Coords;
+    Coords.push_back(Coord(B.CreateCall(CUBlockIdxX), BlockDim,
+                           B.CreateCall(CUThreadIdxX), "thread_x"));
+    Coords.push_back(Coord(BlockIdxY, B.CreateCall(CUBlockDimY),
+                           B.CreateCall(CUThreadIdxY), "thread_y"));
+    if (NumLaunchDims == 3)
+      Coords.push_back(Coord(B.CreateCall(CUBlockIdxZ),
+                             B.CreateCall(CUBlockDimZ),
+                             B.CreateCall(CUThreadIdxZ), "thread_z"));
+    ThreadIV = tapir::rewriteFlattenedIndex(B, FlatIndex, Coords);
+
+    // Threads of partial tiles that fall outside the inner extents, or
+    // outside [start, end), have no work.
+    Value *Outside =
+        B.CreateICmpUGE(Coords[0], FlatIndex.Extents[0], "cond_thread_x");
+    if (NumLaunchDims == 3)
+      Outside = B.CreateOr(Outside, B.CreateICmpUGE(Coords[1],
+                                                    FlatIndex.Extents[1],
+                                                    "cond_thread_y"));
+    StartCond = cast<Instruction>(
+        B.CreateICmpULT(ThreadIV, PrimaryIVInput, "cond_thread_start"));
+    Cond = B.CreateOr(B.CreateOr(Outside, StartCond),
+                      B.CreateICmpUGE(ThreadIV, End, "cond_thread_end"));
+  } else {
+    // Get the thread ID for this invocation of Helper.
+    //
+    // This is the classic CUDA thread ID calculation:
+    //      i = blockDim.x * blockIdx.x + threadIdx.x;
+    Value *ThreadIdx = B.CreateCall(CUThreadIdxX);
+    Value *BlockIdx = B.CreateCall(CUBlockIdxX);
+    Value *ThreadID = B.CreateIntCast(
+        B.CreateAdd(ThreadIdx, B.CreateMul(BlockIdx, BlockDim, "blk_offset"),
+                    "cuthread_id"),
+        PrimaryIV->getType(), false, "thread_id");
+    // Offset the thread ID by the start of the iteration space.  This
+    // allows the runtime to launch a subset of the iterations (e.g., to
+    // split a launch across multiple GPUs) by adjusting the start and
+    // end arguments.
+    ThreadIV = B.CreateAdd(PrimaryIVInput, ThreadID, "thread_iv");
+    Cond = B.CreateICmpUGE(ThreadIV, End, "cond_thread_end");
+  }
 
   // NOTE/TODO: Assuming that the grainsize is fixed at 1 for the
   // current codegen...
   // ThreadID = B.CreateMul(ThreadID, Grainsize);
   Value *ThreadEnd = B.CreateAdd(ThreadIV, Grainsize, "thread_end");
-  Value *Cond = B.CreateICmpUGE(ThreadIV, End, "cond_thread_end");
   ReplaceInstWithInst(Entry->getTerminator(),
                       BranchInst::Create(Exit, Header, Cond));
+  B.SetInsertPoint(Entry->getTerminator());
 
-  // Use the thread ID as the start iteration number for the primary IV.
-  PrimaryIVInput->replaceAllUsesWith(ThreadIV);
+  // Use the thread's iteration as the start iteration number for the
+  // primary IV.
+  PrimaryIVInput->replaceUsesWithIf(ThreadIV, [ThreadIV, StartCond](Use &U) {
+    return U.getUser() != ThreadIV && U.getUser() != StartCond;
+  });
   // TODO: ???? PrimaryIVInput->eraseFromParent();
 
-  // Update cloned loop condition to use the thread-end value.
+  tapir::GPUReductionHooks Hooks;
+  Hooks.WarpSize = 32;
+  Hooks.MaxThreadsPerBlock = CUDAABI_MAX_THREADS_PER_BLOCK;
+  Hooks.SharedAddrSpace = 3;
+  // Multi-dimensional blocks are reduced in the (linear) order that
+  // threads are grouped into warps -- x varies the fastest.
+  Hooks.ThreadIdx = [this](IRBuilder<> &B) -> Value * {
+    Value *Tid = B.CreateCall(CUThreadIdxX);
+    if (NumLaunchDims > 1) {
+      Value *TidYZ = B.CreateAdd(
+          B.CreateCall(CUThreadIdxY),
+          B.CreateMul(B.CreateCall(CUBlockDimY), B.CreateCall(CUThreadIdxZ)));
+      Tid = B.CreateAdd(Tid, B.CreateMul(B.CreateCall(CUBlockDimX), TidYZ));
+    }
+    return Tid;
+  };
+  Hooks.BlockDim = [this](IRBuilder<> &B) -> Value * {
+    Value *Dim = B.CreateCall(CUBlockDimX);
+    if (NumLaunchDims > 1)
+      Dim = B.CreateMul(Dim, B.CreateMul(B.CreateCall(CUBlockDimY),
+                                         B.CreateCall(CUBlockDimZ)));
+    return Dim;
+  };
+  Hooks.ShuffleDown = [this](IRBuilder<> &B, Value *V, Value *Offset,
+                             Value *Mask) {
+    // The clamp value (0x1f) keeps the shuffle within the warp.
+    return B.CreateCall(CUShflDownSync, {Mask, V, Offset, B.getInt32(0x1f)});
+  };
+  Hooks.Barrier = [this](IRBuilder<> &B) { B.CreateCall(CUSyncThreads); };
+  if (CodeGenAsyncCopy && getSMVersion(GPUArch) >= 80) {
+    // cp.async copies 4, 8 or 16 bytes without staging them in
+    // registers.
+    Hooks.AsyncCopy = [](IRBuilder<> &B, Value *Dst, Value *Src,
+                         unsigned Size) {
+      Intrinsic::ID ID;
+      switch (Size) {
+      case 4:
+        ID = Intrinsic::nvvm_cp_async_ca_shared_global_4;
+        break;
+      case 8:
+        ID = Intrinsic::nvvm_cp_async_ca_shared_global_8;
+        break;
+      case 16:
+        ID = Intrinsic::nvvm_cp_async_cg_shared_global_16;
+        break;
+      default:
+        return false;
+      }
+      Module *KM = B.GetInsertBlock()->getModule();
+      Value *GlobalSrc = B.CreateAddrSpaceCast(
+          Src, PointerType::get(B.getContext(), 1));
+      B.CreateCall(Intrinsic::getDeclaration(KM, ID), {Dst, GlobalSrc});
+      return true;
+    };
+    Hooks.AsyncCopyWait = [](IRBuilder<> &B) {
+      B.CreateCall(Intrinsic::getDeclaration(
+          B.GetInsertBlock()->getModule(), Intrinsic::nvvm_cp_async_wait_all));
+    };
+  }
+  if (getSMVersion(GPUArch) >= 70) {
+    // There is no intrinsic for the active mask (__activemask()).
+    Hooks.ActiveMask = [](IRBuilder<> &B) -> Value * {
+      InlineAsm *ActiveMask =
+          InlineAsm::get(FunctionType::get(B.getInt32Ty(), false),
+                         "activemask.b32 $0;", "=r", /*hasSideEffects=*/true);
+      return B.CreateCall(ActiveMask);
+    };
+    Hooks.MatchAny = [this](IRBuilder<> &B, Value *Mask, Value *Key) {
+      return B.CreateCall(CUMatchAnySync, {Mask, Key});
+    };
+  }
+  Hooks.ShuffleXor = [](IRBuilder<> &B, Value *V, Value *Offset,
+                        unsigned Width, Value *Mask) {
+    // The clamp value splits the warp into segments of Width lanes.
+    Function *ShflBfly = Intrinsic::getDeclaration(
+        B.GetInsertBlock()->getModule(), Intrinsic::nvvm_shfl_sync_bfly_i32);
+    Value *Clamp = B.getInt32(((32 - Width) << 8) | 0x1f);
+    return B.CreateCall(ShflBfly, {Mask, V, Offset, Clamp});
+  };
+  Hooks.LaneSync = [](IRBuilder<> &B, Value *Mask) {
+    B.CreateCall(Intrinsic::getDeclaration(B.GetInsertBlock()->getModule(),
+                                           Intrinsic::nvvm_bar_warp_sync),
+                 {Mask});
+  };
+
+  // The lane groups of a nested loop (see TapirGPUNestedLoops) are
+  // groups of lanes of a warp.
+  if (tapir::lowerGPULaneCalls(*KernelF, Hooks))
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName
+                      << "' runs nested loops on groups of lanes.\n");
+
+  // Stencil-like loads of read-only arrays are staged in shared memory
+  // tiles (loaded ahead of the branch that skips inactive threads so
+  // that the whole block reaches the barrier).  The tiles cover a
+  // single iteration per thread.
+  SharedMem = tapir::GPUSharedMemSize();
+  if (CodeGenTileLoads && NumLaunchDims == 1) {
+    Instruction *EntryBr = Entry->getTerminator();
+    SharedMem = tapir::stageGPUTileLoads(*KernelF, PrimaryIV, ThreadIV,
+                                         PrimaryIVInput, End, EntryBr, Hooks);
+    if (SharedMem.BytesPerThread != 0) {
+      B.SetInsertPoint(EntryBr);
+      LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName
+                        << "' stages its loads in shared memory tiles ("
+                        << SharedMem.BytesPerThread << " bytes/thread + "
+                        << SharedMem.Bytes << " bytes).\n");
+    }
+  }
+
   unsigned TripCountIdx = 0;
   ICmpInst *ClonedCond = cast<ICmpInst>(VMap[TLI.getCondition()]);
   if (ClonedCond->getOperand(0) != End)
     ++TripCountIdx;
   assert(ClonedCond->getOperand(TripCountIdx) == End &&
          "End argument not used in condition!");
-  ClonedCond->setOperand(TripCountIdx, ThreadEnd);
+
+  // When possible, turn the loop into a grid-stride loop: each thread
+  // starts at its thread IV and steps by the total number of threads in
+  // the grid until it reaches the end of the iteration space.  With one
+  // iteration per thread (i.e., a full grid) this executes exactly as
+  // the single iteration form below but it allows the runtime to launch
+  // fewer threads that each do more work.  This requires the loop to
+  // test the incremented IV against the end of the iteration space.
+  BasicBlock *Latch = cast<BasicBlock>(VMap[TL->getLoopLatch()]);
+  auto *IVInc =
+      dyn_cast<BinaryOperator>(PrimaryIV->getIncomingValueForBlock(Latch));
+  GridStride = false;
+  if (CodeGenGridStride && NumLaunchDims == 1 &&
+      SharedMem.BytesPerThread == 0 && IVInc &&
+      IVInc->getOpcode() == Instruction::Add &&
+      IVInc->getOperand(0) == PrimaryIV &&
+      isa<ConstantInt>(IVInc->getOperand(1)) &&
+      cast<ConstantInt>(IVInc->getOperand(1))->isOne() &&
+      ClonedCond->getOperand(1 - TripCountIdx) == IVInc &&
+      ClonedCond->hasOneUse()) {
+    auto *LatchBr = cast<BranchInst>(Latch->getTerminator());
+    bool ExitOnTrue = LatchBr->getSuccessor(0) != Header;
+    Value *GridDim = B.CreateCall(CUGridDimX);
+    Value *Stride = B.CreateIntCast(B.CreateMul(GridDim, BlockDim),
+                                    PrimaryIV->getType(), false,
+                                    "grid_stride");
+    IVInc->setOperand(1, Stride);
+    IVInc->setHasNoUnsignedWrap(false);
+    IVInc->setHasNoSignedWrap(false);
+    ICmpInst *StrideCond = new ICmpInst(
+        ExitOnTrue ? ICmpInst::ICMP_UGE : ICmpInst::ICMP_ULT, IVInc, End,
+        "cond_grid_end");
+    ReplaceInstWithInst(ClonedCond, StrideCond);
+    GridStride = true;
+
+    // The runtime assigns many iterations to each thread of large
+    // launches (see KITRT_KERNEL_GRID_STRIDE).  Unrolling the thread's
+    // loop amortizes the index update and bounds check over several
+    // iterations.  Explicit unroll hints on the loop take precedence.
+    MDNode *LoopID = LatchBr->getMetadata(LLVMContext::MD_loop);
+    bool HasUnrollHint = false;
+    SmallVector<Metadata *, 4> MDs;
+    MDs.push_back(nullptr);
+    if (LoopID)
+      for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i) {
+        const MDOperand &Op = LoopID->getOperand(i);
+        if (auto *MD = dyn_cast<MDNode>(Op))
+          if (auto *S = dyn_cast_or_null<MDString>(
+                  MD->getNumOperands() ? MD->getOperand(0).get() : nullptr))
+            HasUnrollHint |= S->getString().starts_with("llvm.loop.unroll.");
+        MDs.push_back(Op);
+      }
+    if (CoarsenUnrollCount > 1 && !HasUnrollHint) {
+      MDs.push_back(MDNode::get(
+          Ctx, {MDString::get(Ctx, "llvm.loop.unroll.count"),
+                ConstantAsMetadata::get(ConstantInt::get(
+                    Type::getInt32Ty(Ctx), CoarsenUnrollCount))}));
+      MDNode *NewLoopID = MDNode::getDistinct(Ctx, MDs);
+      NewLoopID->replaceOperandWith(0, NewLoopID);
+      LatchBr->setMetadata(LLVMContext::MD_loop, NewLoopID);
+    }
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName
+                      << "' uses a grid-stride loop.\n");
+  } else
+    // Update cloned loop condition to use the thread-end value.
+    ClonedCond->setOperand(TripCountIdx, ThreadEnd);
+
+  // Atomic updates of an argument (e.g., the lowering of a Kokkos
+  // parallel_reduce or a forall that accumulates with atomics) become
+  // block-wide tree reductions with a single atomic update per block.
+  // The host side of the launch needs to know which arguments these
+  // are, so the kernel's parameters must match the packed arguments.
+  ReductionArgs.clear();
+  if (CodeGenReductions && KernelF->arg_size() == OrderedInputs.size()) {
+    ReductionArgs = tapir::lowerGPUReductions(*KernelF, Hooks);
+    LLVM_DEBUG(if (!ReductionArgs.empty()) dbgs()
+               << "\tcuabi: kernel '" << KernelName << "' has "
+               << ReductionArgs.size() << " reduction(s).\n");
+  }
+  if (CodeGenHistograms) {
+    unsigned NumUpdates = tapir::lowerGPUHistograms(*KernelF, Hooks);
+    (void)NumUpdates;
+    LLVM_DEBUG(if (NumUpdates) dbgs()
+               << "\tcuabi: kernel '" << KernelName << "' has "
+               << NumUpdates << " histogram update(s).\n");
+  }
+
+  // Loops with 64-bit indices (e.g., size_t) do their index arithmetic
+  // in 64 bits, which takes twice the instructions.  Launches whose
+  // iterations fit in 32 bits run a copy of the loop with a 32-bit IV.
+  if (CodeGenNarrowIV && NumLaunchDims == 1 &&
+      tapir::narrowGPULoopIV(PrimaryIV, Exit, End, {End, ThreadEnd}))
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << KernelName
+                      << "' has a 32-bit IV copy of its loop.\n");
+
+  // The remaining divisions by launch invariant values (e.g., of
+  // flattened iteration spaces without a multi-dimensional launch) use
+  // inverses computed once at the start of the kernel.
+  if (CodeGenReduceDivisions) {
+    unsigned NumReduced = tapir::reduceGPUDivisions(*KernelF, GridStride);
+    (void)NumReduced;
+    LLVM_DEBUG(if (NumReduced) dbgs()
+               << "\tcuabi: kernel '" << KernelName << "' has "
+               << NumReduced << " division(s) by inverses.\n");
+  }
 
   if (KeepIntermediateFiles) {
     std::error_code EC;
@@ -835,82 +2110,73 @@ void CudaLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
   }
 }
 
-Function *CudaLoop::resolveLibDeviceFunction(Function *Fn, bool enableFast) {
+Function *CudaLoop::resolveLibDeviceFunction(Function *Fn,
+                                             tapir::GPUMathAccuracy Acc) {
+  NamedRegionTimer NRT("resolveLibDeviceFunction",
+                       "Resolve libdevice functions", TimerGroupName,
+                       TimerGroupDescription, TimePassesIsEnabled);
+  TimeTraceScope TTS("CudaABI::resolveLibDeviceFunction", Fn->getName());
   std::unique_ptr<Module> &LDM = TTarget->getLibDeviceModule();
   const std::string NVPrefix = "__nv_";
 
   // Handle special cases where code generation can be a bit more
   // complex; e.g., printf().
+  if (Fn->getName() == "printf" && CodeGenDeviceLog)
+    return nullptr; // lowered to the device log (see transformForPTX()).
   if (Fn->getName() == "printf" || Fn->getName() == "fprintf") {
-    report_fatal_error("cuabi: printf is currently unsupported "
-                       "in parallel loops... :-(\n");
-  }
-
-  std::string FnName = "";
-  if (Fn->isIntrinsic()) {
-
-    if (enableFast)
-      FnName = "fast_";
-
-    if (Fn->getName().str().compare(0, 9, "llvm.nvvm") == 0)
-      return nullptr; // backend can handle these...
-    else if (Fn->getName() == "llvm.cos.f32")
-      FnName += "cosf";
-    else if (Fn->getName() == "llvm.cos.f64")
-      FnName += "cos";
-    else if (Fn->getName() == "llvm.sin.f32")
-      FnName += "sinf";
-    else if (Fn->getName() == "llvm.sin.f64")
-      FnName += "sin";
-    else if (Fn->getName() == "llvm.tan.f32")
-      FnName += "tanf";
-    else if (Fn->getName() == "llvm.tan.f64")
-      FnName += "tan";
-    else if (Fn->getName() == "llvm.exp.f64")
-      FnName += "exp";
-    else if (Fn->getName() == "llvm.expf.f32")
-      FnName += "expf";
-    else {
-      // errs() << "cuabi: transforming intrinsic call " << Fn->getName() <<
-      // "()\n"; report_fatal_error("cuabi: no transform for llvm intrinsic!");
-      return nullptr;
-    }
-  } else {
-    if (Fn->getName() == "__sqrtf_finite") {
-      FnName = "llvm.nvvm.sqrt.approx.ftz.f";
-      // errs() << "\t mapping to " << FnName << "\n";
-    } else if (Fn->getName() == "__powf_finite")
-      FnName = "fast_powf";
-    else if (Fn->getName() == "__fmodf_finite")
-      FnName = "modff";
-    else if (Fn->getName() == "expf") {
-      if (enableFast)
-        FnName = "__nv_fast_expf";
-      else
-        FnName = "__nv_expf";
-      errs() << "call for exp: " << FnName << "().\n";
-    }
+    report_fatal_error("cuabi: " + Fn->getName() +
+                       " is currently unsupported in parallel loops... :-(\n");
   }
 
-  FnName = Fn->getName().str();
+  if (Fn->getName().starts_with("llvm.nvvm"))
+    return nullptr; // backend can handle these...
+
+  // Math functions and intrinsics are replaced by the libdevice function
+  // (or NVVM intrinsic) for the accuracy of the call.
+  StringRef MathFnName =
+      tapir::getGPUMathFunction(Fn->getName(), tapir::GPUMathLibDevice, Acc);
+  if (!MathFnName.empty()) {
+    if (MathFnName.starts_with("llvm."))
+      return cast<Function>(
+          KernelModule.getOrInsertFunction(MathFnName, Fn->getFunctionType())
+              .getCallee());
+    return LDM->getFunction(MathFnName);
+  }
+  if (Fn->isIntrinsic())
+    return nullptr;
+
+  std::string FnName = Fn->getName().str();
   if (Function *KF = KernelModule.getFunction(NVPrefix + FnName)) {
     LLVM_DEBUG(dbgs() << "\t\tfound existing device function '" << KF->getName()
                       << "'.\n");
     return KF;
   }
 
-  for (auto &DF : *LDM) {
-    std::string DFName = DF.getName().str();
-    auto Match =
-        std::mismatch(NVPrefix.begin(), NVPrefix.end(), DFName.begin());
-    auto BaseName = DFName.substr(Match.second - DFName.begin());
-    if (BaseName == FnName) {
-      LLVM_DEBUG(dbgs() << "Found libdevice function: '" << DF.getName()
-                        << "' to resolve function '" << FnName << "'.\n");
-      return &DF;
-    }
-  }
-  return nullptr;
+  // Look the function up by name rather than walking the (lazily
+  // loaded) module.
+  Function *DF = LDM->getFunction(NVPrefix + FnName);
+  if (!DF)
+    DF = LDM->getFunction(FnName);
+  if (DF)
+    LLVM_DEBUG(dbgs() << "Found libdevice function: '" << DF->getName()
+                      << "' to resolve function '" << FnName << "'.\n");
+  return DF;
+}
+
+// The allocation functions whose calls in kernels are lowered to the
+// device heap (see -cuabi-device-heap), and whether each allocates or
+// frees.
+static bool isDeviceHeapFunction(StringRef Name, bool *Allocates = nullptr) {
+  bool IsAlloc = StringSwitch<bool>(Name)
+                     .Cases("malloc", "_Znwm", "_Znam", true)
+                     .Default(false);
+  bool IsFree = StringSwitch<bool>(Name)
+                    .Cases("free", "_ZdlPv", "_ZdaPv", "_ZdlPvm", "_ZdaPvm",
+                           true)
+                    .Default(false);
+  if (Allocates)
+    *Allocates = IsAlloc;
+  return IsAlloc || IsFree;
 }
 
 void CudaLoop::transformForPTX(Function &F) {
@@ -932,27 +2198,33 @@ void CudaLoop::transformForPTX(Function &F) {
   // LLVM_DEBUG(
   //    dbgs() << "cuabi: search for unresolved calls in outlined kernel...\n");
   std::list<CallInst *> Replaced;
-  bool enableFast;
+  SmallPtrSet<Function *, 8> ReplacedFns;
+  SmallVector<CallInst *, 4> PrintfCalls;
+  SmallVector<CallInst *, 4> HeapCalls;
   for (auto I = inst_begin(&F); I != inst_end(&F); I++) {
     if (auto CI = dyn_cast<CallInst>(&*I)) {
-      if (FPMathOperator *FPO = dyn_cast<FPMathOperator>(CI)) {
-        if (FPO->isFast()) {
-          enableFast = true;
-        } else {
-          // LLVM_DEBUG(dbgs() << " [std/full precision]\n");
-          enableFast = false;
-        }
-      }
-
       Function *CF = CI->getCalledFunction();
-      if (CF->size() == 0) {
-        Function *DF = resolveLibDeviceFunction(CF, enableFast);
+      if (CF && CF->getName() == "printf" && CodeGenDeviceLog) {
+        PrintfCalls.push_back(CI);
+        ReplacedFns.insert(CF);
+      } else if (CF && CodeGenDeviceHeap && CF->isDeclaration() &&
+                 isDeviceHeapFunction(CF->getName())) {
+        HeapCalls.push_back(CI);
+        ReplacedFns.insert(CF);
+      } else if (CF && CF->size() == 0) {
+        Function *DF =
+            resolveLibDeviceFunction(CF, tapir::getGPUMathAccuracy(*CI));
         if (DF != nullptr) {
+          // Call a declaration in the kernel module; the definition is
+          // materialized when libdevice is linked in.
           CallInst *NCI = dyn_cast<CallInst>(CI->clone());
           NCI->insertBefore(CI);
-          NCI->setCalledFunction(DF);
+          NCI->setCalledFunction(KernelModule.getOrInsertFunction(
+              DF->getName(), DF->getFunctionType()));
           CI->replaceAllUsesWith(NCI);
           Replaced.push_back(CI);
+          if (NCI->getCalledFunction() != CF)
+            ReplacedFns.insert(CF);
         }
       }
     }
@@ -960,6 +2232,14 @@ void CudaLoop::transformForPTX(Function &F) {
 
   for (auto CI : Replaced)
     CI->eraseFromParent();
+  for (CallInst *CI : PrintfCalls)
+    lowerDevicePrintf(CI);
+  for (CallInst *CI : HeapCalls)
+    lowerDeviceHeapCall(CI);
+  // Drop the (host) declarations that are no longer called.
+  for (Function *RF : ReplacedFns)
+    if (RF->use_empty())
+      RF->eraseFromParent();
 
   if (KeepIntermediateFiles) {
     std::error_code EC;
@@ -973,6 +2253,225 @@ void CudaLoop::transformForPTX(Function &F) {
   }
 }
 
+// Lower a call to printf() within a kernel to the append of a record to
+// the runtime's device log buffer:
+//
+//   if (Log.Buffer) {
+//     Idx = atomicAdd(&Log.Buffer->Head, 1);
+//     if (Idx - Log.Buffer->Tail <= Log.Buffer->Mask) {
+//       Rec = &Log.Buffer->Records[Idx & Log.Buffer->Mask];
+//       Rec->Format = NumArgs << 32 | (Log.Base + FormatID);
+//       Rec->Args[...] = ...;
+//       __threadfence_system();
+//       Rec->Seq = Idx + 1;
+//     } else
+//       atomicAdd(&Log.Buffer->Dropped, 1);
+//   }
+//
+// The layout must match the runtime's (see kitsune/runtime/cuda/
+// logging.cpp).  The format and constant string arguments are passed by
+// their identifier in the module's table of log strings; the other
+// arguments are widened to 64 bits (floating point values by their
+// bits).
+void CudaLoop::lowerDevicePrintf(CallInst *CI) {
+  LLVMContext &Ctx = KernelModule.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  PointerType *PtrTy = PointerType::getUnqual(Ctx);
+
+  // Return the identifier of V if it is a constant string.
+  auto GetStringID = [this](Value *V) -> std::optional<unsigned> {
+    StringRef Str;
+    if (!getConstantStringInfo(V, Str))
+      return std::nullopt;
+    return TTarget->getLogStringID(Str);
+  };
+  std::optional<unsigned> FormatID = GetStringID(CI->getArgOperand(0));
+  if (!FormatID)
+    report_fatal_error("cuabi: printf in a parallel loop requires a "
+                       "constant format string.");
+  unsigned NumArgs = CI->arg_size() - 1;
+  if (NumArgs > CUABI_LOG_MAX_ARGS)
+    report_fatal_error("cuabi: printf in a parallel loop supports at most " +
+                       Twine(CUABI_LOG_MAX_ARGS) + " arguments.");
+
+  StructType *RecordTy = StructType::get(
+      Int64Ty, Int64Ty, ArrayType::get(Int64Ty, CUABI_LOG_MAX_ARGS));
+  StructType *BufferTy = StructType::get(Int64Ty, Int64Ty, Int64Ty, Int64Ty,
+                                         ArrayType::get(RecordTy, 0));
+  GlobalVariable *Log = TTarget->getDeviceLogGlobal();
+  Type *LogTy = Log->getValueType();
+
+  IRBuilder<> B(CI);
+  Value *Buffer = B.CreateLoad(PtrTy, B.CreateStructGEP(LogTy, Log, 0));
+  Instruction *ThenTerm = SplitBlockAndInsertIfThen(
+      B.CreateIsNotNull(Buffer), CI, /*Unreachable=*/false);
+  B.SetInsertPoint(ThenTerm);
+  Value *Idx = B.CreateAtomicRMW(
+      AtomicRMWInst::Add, B.CreateStructGEP(BufferTy, Buffer, 0),
+      ConstantInt::get(Int64Ty, 1), Align(8), AtomicOrdering::Monotonic);
+  LoadInst *Tail = B.CreateLoad(Int64Ty, B.CreateStructGEP(BufferTy, Buffer, 1));
+  Tail->setVolatile(true);
+  Value *Mask = B.CreateLoad(Int64Ty, B.CreateStructGEP(BufferTy, Buffer, 3));
+  Instruction *WriteTerm, *DropTerm;
+  SplitBlockAndInsertIfThenElse(B.CreateICmpULE(B.CreateSub(Idx, Tail), Mask),
+                                ThenTerm, &WriteTerm, &DropTerm);
+
+  B.SetInsertPoint(DropTerm);
+  B.CreateAtomicRMW(AtomicRMWInst::Add, B.CreateStructGEP(BufferTy, Buffer, 2),
+                    ConstantInt::get(Int64Ty, 1), Align(8),
+                    AtomicOrdering::Monotonic);
+
+  B.SetInsertPoint(WriteTerm);
+  Value *Record = B.CreateInBoundsGEP(
+      BufferTy, Buffer, {B.getInt32(0), B.getInt32(4), B.CreateAnd(Idx, Mask)});
+  Value *Base = B.CreateLoad(Int64Ty, B.CreateStructGEP(LogTy, Log, 1));
+  Value *Format = B.CreateOr(B.CreateAdd(Base, B.getInt64(*FormatID)),
+                             B.getInt64(uint64_t(NumArgs) << 32));
+  B.CreateStore(Format, B.CreateStructGEP(RecordTy, Record, 1));
+  for (unsigned I = 0; I < NumArgs; ++I) {
+    Value *Arg = CI->getArgOperand(I + 1);
+    Value *Word;
+    if (Arg->getType()->isPointerTy()) {
+      // Strings other than constants are not available to the host.
+      if (std::optional<unsigned> ID = GetStringID(Arg))
+        Word = B.CreateAdd(Base, B.getInt64(*ID));
+      else
+        Word = B.CreatePtrToInt(Arg, Int64Ty);
+    } else if (Arg->getType()->isFloatingPointTy()) {
+      Word = B.CreateBitCast(B.CreateFPExt(Arg, B.getDoubleTy()), Int64Ty);
+    } else {
+      Word = B.CreateSExtOrTrunc(Arg, Int64Ty);
+    }
+    B.CreateStore(Word, B.CreateInBoundsGEP(RecordTy, Record,
+                                            {B.getInt32(0), B.getInt32(2),
+                                             B.getInt32(I)}));
+  }
+  // The record must be visible to the host before its sequence number.
+  B.CreateFence(AtomicOrdering::SequentiallyConsistent);
+  B.CreateStore(B.CreateAdd(Idx, B.getInt64(1)),
+                B.CreateStructGEP(RecordTy, Record, 0))
+      ->setVolatile(true);
+
+  // The result of printf() (the number of characters written) is not
+  // known on the device.
+  if (!CI->use_empty())
+    CI->replaceAllUsesWith(ConstantInt::get(CI->getType(), 0));
+  CI->eraseFromParent();
+}
+
+// Lower a call to malloc() (or operator new) within a kernel to an
+// allocation from the runtime's device heap, and a call to free() (or
+// operator delete) to a no-op for the heap's memory.  The heap is a
+// bump allocator in an arena the runtime reserves on each device:
+//
+//   void *__cuabi_heap_malloc(size_t n) {
+//     if (Heap) {
+//       Size = (n + 15) & ~15;
+//       Top = atomicAdd(&Heap->Top, Size);
+//       if (Top + Size <= Heap->Size && Top + Size >= Top)
+//         return Heap->Base + Top;
+//     }
+//     return malloc(n);
+//   }
+//
+//   void __cuabi_heap_free(void *p) {
+//     if (!Heap || (char *)p - Heap->Base >= Heap->Size)
+//       free(p);
+//   }
+//
+// Allocations the heap cannot satisfy (and all of them if the runtime
+// provides no heap) fall back to CUDA's device heap.  The heap's memory
+// is released in bulk when the runtime resets the heap.  The layout of
+// the heap must match the runtime's (see kitsune/runtime/cuda/heap.cpp).
+void CudaLoop::lowerDeviceHeapCall(CallInst *CI) {
+  LLVMContext &Ctx = KernelModule.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  PointerType *PtrTy = PointerType::getUnqual(Ctx);
+  StructType *HeapTy = StructType::get(PtrTy, Int64Ty, Int64Ty);
+  GlobalVariable *HeapGV = TTarget->getDeviceHeapGlobal();
+
+  bool Allocates = false;
+  isDeviceHeapFunction(CI->getCalledFunction()->getName(), &Allocates);
+  StringRef Name = Allocates ? "__cuabi_heap_malloc" : "__cuabi_heap_free";
+  Function *HeapFn = KernelModule.getFunction(Name);
+  if (!HeapFn) {
+    FunctionType *FnTy = Allocates ? FunctionType::get(PtrTy, Int64Ty, false)
+                                   : FunctionType::get(VoidTy, PtrTy, false);
+    HeapFn = Function::Create(FnTy, GlobalValue::InternalLinkage, Name,
+                              KernelModule);
+    HeapFn->addFnAttr(Attribute::AlwaysInline);
+    Argument *Arg = HeapFn->getArg(0);
+    BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", HeapFn);
+    BasicBlock *Bump = BasicBlock::Create(Ctx, "heap", HeapFn);
+    BasicBlock *Fallback = BasicBlock::Create(Ctx, "fallback", HeapFn);
+    IRBuilder<> B(Entry);
+    Value *Heap = B.CreateLoad(PtrTy, HeapGV, "heap");
+    B.CreateCondBr(B.CreateIsNotNull(Heap), Bump, Fallback);
+
+    B.SetInsertPoint(Bump);
+    Value *Base = B.CreateLoad(PtrTy, B.CreateStructGEP(HeapTy, Heap, 0));
+    Value *Size = B.CreateLoad(Int64Ty, B.CreateStructGEP(HeapTy, Heap, 1));
+    if (Allocates) {
+      BasicBlock *Found = BasicBlock::Create(Ctx, "found", HeapFn);
+      Value *Bytes =
+          B.CreateAnd(B.CreateAdd(Arg, B.getInt64(15)), B.getInt64(~15ULL));
+      Value *Top = B.CreateAtomicRMW(
+          AtomicRMWInst::Add, B.CreateStructGEP(HeapTy, Heap, 2), Bytes,
+          Align(8), AtomicOrdering::Monotonic);
+      Value *End = B.CreateAdd(Top, Bytes);
+      Value *Fits = B.CreateAnd(B.CreateICmpULE(End, Size),
+                                B.CreateICmpUGE(End, Top));
+      B.CreateCondBr(Fits, Found, Fallback);
+      B.SetInsertPoint(Found);
+      B.CreateRet(B.CreateInBoundsGEP(B.getInt8Ty(), Base, Top));
+    } else {
+      BasicBlock *Done = BasicBlock::Create(Ctx, "done", HeapFn);
+      Value *Offset = B.CreateSub(B.CreatePtrToInt(Arg, Int64Ty),
+                                  B.CreatePtrToInt(Base, Int64Ty));
+      B.CreateCondBr(B.CreateICmpULT(Offset, Size), Done, Fallback);
+      B.SetInsertPoint(Done);
+      B.CreateRetVoid();
+    }
+
+    B.SetInsertPoint(Fallback);
+    if (Allocates) {
+      FunctionCallee Malloc =
+          KernelModule.getOrInsertFunction("malloc", PtrTy, Int64Ty);
+      B.CreateRet(B.CreateCall(Malloc, {Arg}));
+    } else {
+      FunctionCallee Free =
+          KernelModule.getOrInsertFunction("free", VoidTy, PtrTy);
+      B.CreateCall(Free, {Arg});
+      B.CreateRetVoid();
+    }
+  }
+
+  // Sized deletes pass the size as a second argument.
+  IRBuilder<> B(CI);
+  Value *Arg = CI->getArgOperand(0);
+  if (Allocates)
+    Arg = B.CreateZExtOrTrunc(Arg, Int64Ty);
+  CallInst *NCI = B.CreateCall(HeapFn, {Arg});
+  NCI->setDebugLoc(CI->getDebugLoc());
+  if (!CI->use_empty())
+    CI->replaceAllUsesWith(NCI);
+  CI->eraseFromParent();
+}
+
+/// Returns the detach that spawns the innermost task containing BB, or
+/// null if BB is not in a task spawned within its function.
+static DetachInst *getEnclosingDetach(BasicBlock *BB, const DominatorTree &DT) {
+  for (DomTreeNode *N = DT.getNode(BB); N; N = N->getIDom()) {
+    BasicBlock *Dom = N->getBlock();
+    if (BasicBlock *Pred = Dom->getSinglePredecessor())
+      if (auto *DI = dyn_cast<DetachInst>(Pred->getTerminator()))
+        if (DI->getDetached() == Dom)
+          return DI;
+  }
+  return nullptr;
+}
+
 void CudaLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
                                        DominatorTree &DT) {
 
@@ -1011,11 +2510,71 @@ void CudaLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   for (auto I : RemoveList)
     I->eraseFromParent();
 
+  // The parameters the launch is specialized on are found before any
+  // launch code is added to the host function.
+  SmallVector<unsigned, 4> SpecializedParams =
+      getSpecializedParams(TL, TOI);
+
+  // Hoist an asynchronous prefetch of each argument the kernel reads to
+  // the earliest point after the host's last write to it so that the
+  // migration overlaps with the host code leading up to the launch.
+  // The insertion points are found before any launch code is added.
+  struct EarlyPrefetch {
+    Instruction *InsertPt;
+    Value *Ptr;
+    tapir::KernelArgAccess Access;
+    Argument *KernelArg;
+  };
+  SmallVector<EarlyPrefetch, 8> EarlyPrefetches;
+  if (mayPrefetchData() && CodeGenEarlyPrefetch) {
+    Function &KF = *KernelModule.getFunction(KernelName.c_str());
+    bool HasArgs = KF.arg_size() == OrderedInputs.size();
+    unsigned int ArgNo = 0;
+    for (Value *V : OrderedInputs) {
+      if (V->getType()->isPointerTy() && !isReductionArg(ArgNo)) {
+        Argument *KernelArg = HasArgs ? KF.getArg(ArgNo) : nullptr;
+        tapir::KernelArgAccess Access =
+            tapir::getKernelArgAccess(V, KernelArg);
+        if (Access != tapir::KernelArgWriteOnly)
+          if (Instruction *IP =
+                  tapir::getEarliestPrefetchPoint(V, TOI.ReplCall))
+            EarlyPrefetches.push_back({IP, V, Access, KernelArg});
+      }
+      ArgNo++;
+    }
+  }
+
+  for (EarlyPrefetch &EP : EarlyPrefetches) {
+    LLVM_DEBUG(dbgs() << "\t*- hoisting early prefetch of '"
+                      << EP.Ptr->getName() << "'.\n");
+    IRBuilder<> EPBuilder(EP.InsertPt);
+    CallInst *Prefetch = EPBuilder.CreateCall(
+        KitCudaMemPrefetchAsyncFn,
+        {EPBuilder.CreateBitCast(EP.Ptr, PointerType::getUnqual(Ctx)),
+         ConstantInt::get(Type::getInt32Ty(Ctx), EP.Access)});
+    if (EP.KernelArg)
+      TTarget->registerKernelArgAccess(KernelName, EP.KernelArg->getArgNo(),
+                                       Prefetch);
+  }
+
+  // The extents of a multi-dimensional launch may be kernel parameters;
+  // resolve them to the host-side inputs before the parameters change.
+  for (Value *&Extent : LaunchExtents)
+    if (auto *A = dyn_cast_or_null<Argument>(Extent))
+      Extent = OrderedInputs[A->getArgNo()];
+
   // Make a pass to prep for PTX code generation...
   LLVM_DEBUG(dbgs() << "\t*- transform kernel for PTX code gen.\n");
-  Function &F = *KernelModule.getFunction(KernelName.c_str());
-  transformForPTX(F);
+  Function *KF = KernelModule.getFunction(KernelName.c_str());
+  transformForPTX(*KF);
   LLVM_DEBUG(dbgs() << "\t*- transform kernel for PTX code gen.\n");
+  Function &F = *packKernelArgs(*KF, TOI);
+  specializeTripCounts(F);
+  for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+    if (Argument *A = getKernelArg(F, ArgNo))
+      if (tapir::addReadOnlyKernelArgAttrs(A, OrderedInputs[ArgNo]))
+        LLVM_DEBUG(dbgs() << "\t*- kernel arg #" << ArgNo
+                          << " is noalias readonly.\n");
 
   // Create two builders -- one inserts code into the entry block
   // (e.g. new "up-front" allocas) and the other is for generating
@@ -1024,43 +2583,260 @@ void CudaLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   BasicBlock &EntryBB = Parent->getEntryBlock();
   IRBuilder<> EntryBuilder(&EntryBB.front());
 
+  // Arguments that do not change within the host loops around the
+  // launch are stored once ahead of the loops rather than on every
+  // launch.  The points are found before the launch's block is split.
+  DenseMap<unsigned, Instruction *> InvariantArgPts;
+  DetachInst *LaunchTaskDI = nullptr;
+  {
+    DominatorTree HostDT(*Parent);
+    LaunchTaskDI = getEnclosingDetach(TOI.ReplCall->getParent(), HostDT);
+    LoopInfo HostLI(HostDT);
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+      if (Instruction *IP = tapir::getInvariantLaunchArgPoint(
+              OrderedInputs[ArgNo], TOI.ReplCall, HostDT, HostLI))
+        InvariantArgPts[ArgNo] = IP;
+  }
+
   BasicBlock *RCBB = TOI.ReplCall->getParent();
   BasicBlock *NewBB = RCBB->splitBasicBlock(TOI.ReplCall);
   IRBuilder<> NewBuilder(&NewBB->front());
 
   // TODO: There is some potential here to share this code across both
   // the hip and cuda transforms... 
+  //
+  // The argument array only ever points at the argument slots, which
+  // are allocated in the entry block, so it is filled in there once.
+  // The runtime restores any entries it swaps out during a launch.
   LLVM_DEBUG(dbgs() << "\t*- code gen packing of " << OrderedInputs.size()
                     << " kernel args.\n");
   PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
-  ArrayType *ArrayTy = ArrayType::get(VoidPtrTy, OrderedInputs.size());
+  ArrayType *ArrayTy =
+      ArrayType::get(VoidPtrTy, OrderedInputs.size() - PackedArgNos.size() +
+                                    (PackedArgsTy ? 1 : 0));
   Value *ArgArray = EntryBuilder.CreateAlloca(ArrayTy);
-  AllocaInst *CudaStream = EntryBuilder.CreateAlloca(VoidPtrTy);
-  EntryBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), CudaStream);
-  bool StreamAssigned = false;
-  unsigned int i = 0;
-  for (Value *V : OrderedInputs) {
-    Value *VP = EntryBuilder.CreateAlloca(V->getType());
-    NewBuilder.CreateStore(V, VP);
-    Value *VoidVPtr = NewBuilder.CreateBitCast(VP, VoidPtrTy);
-    Value *ArgPtr =
-        NewBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, i);
-    NewBuilder.CreateStore(VoidVPtr, ArgPtr);
-    i++;
+  AllocaInst *PackedArgs =
+      PackedArgsTy
+          ? EntryBuilder.CreateAlloca(PackedArgsTy, nullptr, "kern.args.packed")
+          : nullptr;
+  // The stream is private to the task that owns the launch's sync
+  // region.  When that is a spawned task (e.g., the body of a host-side
+  // forall that launches a kernel) the stream lives in the task's entry
+  // block so each concurrently running instance of the task -- and so
+  // each host worker -- launches on, and syncs, its own stream once the
+  // task is outlined.  The stream of an asynchronous loop is private
+  // to the spawned task the launch is in, if any, for the same reason;
+  // the task hands it to its parent's sync region when it finishes
+  // (see CudaABI::postProcessFunction()).
+  AllocaInst *CudaStream = nullptr;
+  auto *SyncRegInst = dyn_cast_or_null<Instruction>(SyncRegion);
+  BasicBlock *SyncRegBB = SyncRegInst ? SyncRegInst->getParent() : nullptr;
+  BasicBlock *SyncRegPred =
+      SyncRegBB ? SyncRegBB->getSinglePredecessor() : nullptr;
+  auto *TaskDI =
+      SyncRegPred ? dyn_cast<DetachInst>(SyncRegPred->getTerminator())
+                  : nullptr;
+  if (not Async && TaskDI && TaskDI->getDetached() == SyncRegBB &&
+      SyncRegInst->getFunction() == Parent) {
+    IRBuilder<> TaskBuilder(&*SyncRegBB->getFirstInsertionPt());
+    CudaStream = TaskBuilder.CreateAlloca(VoidPtrTy);
+    TaskBuilder.SetInsertPoint(SyncRegInst->getNextNode());
+    TaskBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), CudaStream);
+  } else if (Async && LaunchTaskDI) {
+    IRBuilder<> TaskBuilder(
+        &*LaunchTaskDI->getDetached()->getFirstInsertionPt());
+    CudaStream = TaskBuilder.CreateAlloca(VoidPtrTy);
+    TaskBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), CudaStream);
+  } else {
+    CudaStream = EntryBuilder.CreateAlloca(VoidPtrTy);
+    EntryBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), CudaStream);
+  }
+  // A loop with a priority attribute launches on a stream of that
+  // priority, unless it shares the stream of an earlier launch.
+  if (unsigned Priority = TapirLoopHints(TL.getLoop()).getPriority())
+    NewBuilder.CreateCall(KitCudaPriorityStreamFn,
+                          {CudaStream, NewBuilder.getInt32(Priority)});
+  if (MemIdiom.Kind != tapir::GPUMemIdiom::None &&
+      emitMemIdiom(NewBuilder, CudaStream)) {
+    assert(SyncRegion && "memcpy stream without a sync region!");
+    if (Async)
+      TTarget->registerAsyncLaunchStream(SyncRegion, CudaStream);
+    else
+      TTarget->registerLaunchStream(SyncRegion, CudaStream);
+    TOI.ReplCall->eraseFromParent();
+    LLVM_DEBUG(dbgs() << "*** finished processing outlined call.\n");
+    return;
+  }
+
+  // A matrix product runs with cuBLAS if the runtime can load it, and
+  // launches the kernel otherwise.
+  if (BlasIdiom.Kind != tapir::GPUBlasIdiom::None) {
+    Value *Stream = emitBlasIdiom(NewBuilder, CudaStream);
+    Instruction *LaunchTerm, *BlasTerm;
+    SplitBlockAndInsertIfThenElse(NewBuilder.CreateIsNull(Stream),
+                                  TOI.ReplCall, &LaunchTerm, &BlasTerm);
+    new StoreInst(Stream, CudaStream, BlasTerm);
+    TOI.ReplCall->moveBefore(LaunchTerm);
+    NewBuilder.SetInsertPoint(TOI.ReplCall);
+  }
+
+  // The kernel's parameters follow the order of the packed arguments.
+  // They are used to refine the access mode of arguments that do not
+  // carry any kitsune memory access attributes.
+  //
+  // When more than one pointer argument is mapped the runtime maps them
+  // all with a single call, which also maps arguments that reference the
+  // same allocation only once.  The call is skipped when the site's
+  // cache shows the same pointers were found in place at the current
+  // epoch of the runtime's allocation map.
+  DenseMap<unsigned, Value *> MappedArgs;
+  if (CodeGenPrefetch) {
+    SmallVector<unsigned, 8> MapArgNos;
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+      if (!is_contained(PackedArgNos, ArgNo) && !isReductionArg(ArgNo) &&
+          OrderedInputs[ArgNo]->getType()->isPointerTy())
+        MapArgNos.push_back(ArgNo);
+    if (MapArgNos.size() > 1) {
+      Type *Int32Ty = Type::getInt32Ty(Ctx);
+      ArrayType *PtrsTy = ArrayType::get(VoidPtrTy, MapArgNos.size());
+      Value *Ptrs = EntryBuilder.CreateAlloca(PtrsTy, nullptr, "kern.map");
+      SmallVector<Constant *, 8> Accesses;
+      for (unsigned N = 0; N < MapArgNos.size(); N++) {
+        unsigned ArgNo = MapArgNos[N];
+        Value *V = OrderedInputs[ArgNo];
+        tapir::KernelArgAccess Access =
+            tapir::getKernelArgAccess(V, getKernelArg(F, ArgNo));
+        LLVM_DEBUG(dbgs() << "\t\t- code gen batched data mapping for "
+                          << "kernel arg #" << ArgNo
+                          << " (access mode: " << Access << ")
+");
+        Accesses.push_back(ConstantInt::get(Int32Ty, Access));
+        NewBuilder.CreateStore(
+            NewBuilder.CreateBitCast(V, VoidPtrTy),
+            NewBuilder.CreateConstInBoundsGEP2_32(PtrsTy, Ptrs, 0, N));
+      }
+      Constant *AccessCA = ConstantArray::get(
+          ArrayType::get(Int32Ty, Accesses.size()), Accesses);
+      auto *AccessGV = new GlobalVariable(M, AccessCA->getType(), true,
+                                          GlobalValue::PrivateLinkage,
+                                          AccessCA, "kern.map.access");
+      AccessGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      for (unsigned N = 0; N < MapArgNos.size(); N++)
+        if (Argument *A = getKernelArg(F, MapArgNos[N]))
+          TTarget->registerKernelArgAccess(KernelName, A->getArgNo(),
+                                           AccessGV, N);
+
+      Type *Int64Ty = Type::getInt64Ty(Ctx);
+      ArrayType *CacheTy = ArrayType::get(VoidPtrTy, MapArgNos.size() + 1);
+      auto *CacheGV = new GlobalVariable(M, CacheTy, false,
+                                         GlobalValue::PrivateLinkage,
+                                         Constant::getNullValue(CacheTy),
+                                         "kern.map.cache");
+      Constant *EpochGV = M.getOrInsertGlobal("__kitrt_mem_epoch", Int64Ty);
+      LoadInst *Epoch = NewBuilder.CreateLoad(Int64Ty, EpochGV, "map.epoch");
+      Epoch->setAtomic(AtomicOrdering::Acquire);
+      Epoch->setAlignment(Align(8));
+      LoadInst *CachedEpoch = NewBuilder.CreateLoad(Int64Ty, CacheGV);
+      CachedEpoch->setAtomic(AtomicOrdering::Acquire);
+      CachedEpoch->setAlignment(Align(8));
+      Value *InPlace = NewBuilder.CreateICmpEQ(Epoch, CachedEpoch);
+      for (unsigned N = 0; N < MapArgNos.size(); N++) {
+        LoadInst *CachedPtr = NewBuilder.CreateLoad(
+            VoidPtrTy,
+            NewBuilder.CreateConstInBoundsGEP2_32(CacheTy, CacheGV, 0, N + 1));
+        CachedPtr->setAtomic(AtomicOrdering::Monotonic);
+        CachedPtr->setAlignment(Align(8));
+        InPlace = NewBuilder.CreateAnd(
+            InPlace,
+            NewBuilder.CreateICmpEQ(
+                CachedPtr,
+                NewBuilder.CreateBitCast(OrderedInputs[MapArgNos[N]],
+                                         VoidPtrTy)));
+      }
+      Instruction *MapPt = &*NewBuilder.GetInsertPoint();
+      Instruction *MapTerm = SplitBlockAndInsertIfThen(
+          NewBuilder.CreateNot(InPlace, "map.needed"), MapPt, false);
+      IRBuilder<> MapBuilder(MapTerm);
+      MapBuilder.CreateCall(
+          KitCudaMemMapBatchFn,
+          {Ptrs, AccessGV, ConstantInt::get(Int32Ty, MapArgNos.size()),
+           CudaStream, CacheGV});
+      NewBuilder.SetInsertPoint(MapPt);
+      for (unsigned N = 0; N < MapArgNos.size(); N++) {
+        Value *V = OrderedInputs[MapArgNos[N]];
+        Value *DevPP = NewBuilder.CreateLoad(
+            VoidPtrTy,
+            NewBuilder.CreateConstInBoundsGEP2_32(PtrsTy, Ptrs, 0, N));
+        MappedArgs[MapArgNos[N]] =
+            NewBuilder.CreatePointerBitCastOrAddrSpaceCast(DevPP,
+                                                           V->getType());
+      }
+    }
+  }
 
-    if (CodeGenPrefetch && V->getType()->isPointerTy()) {
-      LLVM_DEBUG(dbgs() << "\t\t- code gen prefetch for kernel arg #" 
+  unsigned int i = 0, Slot = 0;
+  for (Value *V : OrderedInputs) {
+    auto Field = find(PackedArgNos, i);
+    if (Field != PackedArgNos.end()) {
+      IRBuilder<> FieldBuilder(InvariantArgPts.count(i)
+                                   ? InvariantArgPts[i]
+                                   : &*NewBuilder.GetInsertPoint());
+      FieldBuilder.CreateStore(
+          V, FieldBuilder.CreateStructGEP(PackedArgsTy, PackedArgs,
+                                          Field - PackedArgNos.begin()));
+      i++;
+      continue;
+    }
+    Value *ArgV = V;
+    if (const tapir::GPUReductionArg *RA = isReductionArg(i)) {
+      // The kernel reduces into this argument.  The runtime provides a
+      // device-side copy of the (initial) value and copies the result
+      // back when the launch's stream is synchronized.  It also assigns
+      // a stream on the first call.
+      LLVM_DEBUG(dbgs() << "\t\t- code gen reduction mapping for kernel arg #"
                         << i << "\n");
+      Value *DevPP = NewBuilder.CreateCall(
+          KitCudaMemReduceMapFn,
+          {NewBuilder.CreateBitCast(V, VoidPtrTy),
+           ConstantInt::get(Type::getInt64Ty(Ctx), RA->Size), CudaStream});
+      ArgV = NewBuilder.CreatePointerBitCastOrAddrSpaceCast(DevPP,
+                                                            V->getType());
+    } else if (MappedArgs.count(i)) {
+      ArgV = MappedArgs[i];
+    } else if (CodeGenPrefetch && V->getType()->isPointerTy()) {
+      // The runtime decides how to make the data available to the
+      // kernel (prefetch of managed memory or an explicit copy to a
+      // device-resident buffer) and returns the pointer the kernel
+      // should use.  The access mode lets it skip transfers that are
+      // not needed.  It also assigns a stream on the first call.
+      tapir::KernelArgAccess Access =
+          tapir::getKernelArgAccess(V, getKernelArg(F, i));
+      LLVM_DEBUG(dbgs() << "\t\t- code gen data mapping for kernel arg #"
+                        << i << " (access mode: " << Access << ")\n");
       Value *VoidPP = NewBuilder.CreateBitCast(V, VoidPtrTy);
-      Value *SPtr = NewBuilder.CreateLoad(VoidPtrTy, CudaStream);
-      Value *NewSPtr =
-          NewBuilder.CreateCall(KitCudaMemPrefetchFn, {VoidPP, SPtr});
-      if (not StreamAssigned) {
-        NewBuilder.CreateStore(NewSPtr, CudaStream);
-        StreamAssigned = true;
-      }
+      CallInst *DevPP = NewBuilder.CreateCall(
+          KitCudaMemMapFn,
+          {VoidPP, ConstantInt::get(Type::getInt32Ty(Ctx), Access),
+           CudaStream});
+      if (Argument *A = getKernelArg(F, i))
+        TTarget->registerKernelArgAccess(KernelName, A->getArgNo(), DevPP);
+      ArgV = NewBuilder.CreatePointerBitCastOrAddrSpaceCast(DevPP,
+                                                            V->getType());
     }
+    Value *VP = EntryBuilder.CreateAlloca(V->getType());
+    if (ArgV == V && InvariantArgPts.count(i))
+      new StoreInst(V, VP, InvariantArgPts[i]);
+    else
+      NewBuilder.CreateStore(ArgV, VP);
+    EntryBuilder.CreateStore(
+        VP, EntryBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0,
+                                                    Slot++));
+    i++;
   }
+  if (PackedArgs)
+    EntryBuilder.CreateStore(
+        PackedArgs,
+        EntryBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, Slot++));
 
   // The next step is prep for the actual kernel launch call via
   // the kitsune runtime.  We have to add some extra levels of
@@ -1131,30 +2907,202 @@ void CudaLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
              << "      flop count      : " << InstMix.num_flops << "\n"
              << "      integer op count: " << InstMix.num_iops << "\n\n");
 
-  Constant *InstructionMix = ConstantStruct::get(
-      KernelInstMixTy, ConstantInt::get(Int64Ty, InstMix.num_memory_ops),
-      ConstantInt::get(Int64Ty, InstMix.num_flops),
-      ConstantInt::get(Int64Ty, InstMix.num_iops));
+  uint64_t KernelFlags = GridStride ? tapir::KernelGridStride : 0;
+  if (!ReductionArgs.empty())
+    KernelFlags |= tapir::KernelReduction;
+  Constant *SourceLoc = tapir::getKernelSourceLocation(
+      TL.getLoop(), M, CUABI_PREFIX + ".loc." + KernelName);
+  auto GetInstructionMix = [&](uint64_t Flags) {
+    return ConstantStruct::get(
+        KernelInstMixTy, ConstantInt::get(Int64Ty, InstMix.num_memory_ops),
+        ConstantInt::get(Int64Ty, InstMix.num_flops),
+        ConstantInt::get(Int64Ty, InstMix.num_iops),
+        ConstantInt::get(Int64Ty, InstMix.num_memory_bytes),
+        ConstantInt::get(Int64Ty, Flags),
+        ConstantInt::get(Int64Ty, SharedMem.BytesPerThread),
+        ConstantInt::get(Int64Ty, SharedMem.Bytes), SourceLoc,
+        ConstantInt::get(Int64Ty, Hints.getMaxBlocksPerGrid()),
+        ConstantInt::get(Int64Ty, Hints.getSharedMemBytes()),
+        ConstantInt::get(Int64Ty, Hints.getItersPerThread()));
+  };
+  if (FixedTripCount)
+    KernelFlags |= tapir::KernelFixedTripCount;
+  Value *InstructionMix = GetInstructionMix(KernelFlags);
+
+  // The runtime can split the iteration space of the launch (e.g., to
+  // use multiple GPUs) by rewriting the start and end arguments.  It
+  // needs to know their size to do so.
+  Constant *IVSize = ConstantInt::get(
+      Type::getInt32Ty(Ctx), DL.getTypeStoreSize(TripCount->getType()));
+
+  // Each kernel gets a (null initialized) handle that the runtime
+  // uses to cache the kernel's launch details after the first launch.
+  // This avoids looking up the kernel by name on every launch.
+  auto CreateLaunchHandle = [&](Constant *Name, const std::string &KName) {
+    GlobalVariable *Handle = new GlobalVariable(
+        M, VoidPtrTy, false, GlobalValue::InternalLinkage,
+        ConstantPointerNull::get(VoidPtrTy), CUABI_PREFIX + ".launch." + KName);
+    Handle->setAlignment(Align(DL.getPointerABIAlignment(0)));
+    TTarget->registerKernelLaunch(Name, Handle);
+    return Handle;
+  };
+  Value *KNameArg = KNameParam;
+  Value *LaunchHandle = CreateLaunchHandle(KNameParam, KernelName);
+
+  // Grid-stride kernels run correctly with any grid and so can also run
+  // within the module's persistent worker kernel.
+  if (CodeGenPersistentKernels && GridStride && SharedMem.Bytes == 0)
+    TTarget->registerPersistentKernel(KNameParam, KernelName);
+
+  // Launch the clone of the kernel that is specialized for the trip
+  // count, if there is one.  The runtime must launch it over its full
+  // iteration space.
+  if (!TripCountKernels.empty()) {
+    Value *FixedMix =
+        GetInstructionMix(KernelFlags | tapir::KernelFixedTripCount);
+    for (auto &[Size, Name] : TripCountKernels) {
+      Constant *NameCS = ConstantDataArray::getString(Ctx, Name);
+      auto *NameGV =
+          new GlobalVariable(M, NameCS->getType(), true,
+                             GlobalValue::PrivateLinkage, NameCS, "kern.name");
+      NameGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      Constant *NameParam = ConstantExpr::getGetElementPtr(
+          NameGV->getValueType(), NameGV, Zeros);
+      Value *IsSize = NewBuilder.CreateICmpEQ(
+          CastTripCount, ConstantInt::get(Int64Ty, Size), "tc.specialized");
+      KNameArg = NewBuilder.CreateSelect(IsSize, NameParam, KNameArg);
+      LaunchHandle = NewBuilder.CreateSelect(
+          IsSize, CreateLaunchHandle(NameParam, Name), LaunchHandle);
+      InstructionMix =
+          NewBuilder.CreateSelect(IsSize, FixedMix, InstructionMix);
+    }
+  }
+
+  // Launch a variant of the kernel that the runtime compiles with the
+  // values of the specialized parameters as constants.  The variants are
+  // compiled from the module's PTX, which is not available until all of
+  // the loops are processed: like the fat binary it is loaded from a
+  // placeholder global here (see finalizeLaunchCalls()).  The runtime
+  // returns the launch handle of the variant for the arguments, or the
+  // kernel's own handle.
+  if (!SpecializedParams.empty() && TripCountKernels.empty()) {
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    SmallVector<Constant *, 4> ParamCs;
+    for (unsigned P : SpecializedParams)
+      ParamCs.push_back(ConstantInt::get(Int32Ty, P));
+    Constant *ParamsCA = ConstantArray::get(
+        ArrayType::get(Int32Ty, ParamCs.size()), ParamCs);
+    auto *ParamsGV = new GlobalVariable(M, ParamsCA->getType(), true,
+                                        GlobalValue::PrivateLinkage, ParamsCA,
+                                        "kern.spec.params");
+    ParamsGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    GlobalVariable *SiteHandle = new GlobalVariable(
+        M, VoidPtrTy, false, GlobalValue::InternalLinkage,
+        ConstantPointerNull::get(VoidPtrTy),
+        CUABI_PREFIX + ".spec." + KernelName);
+    SiteHandle->setAlignment(Align(DL.getPointerABIAlignment(0)));
+    Constant *DummyPTXGV =
+        tapir::getOrInsertFBGlobal(M, "_cuabi.dummy_ptx", VoidPtrTy);
+    Value *DummyPTXPtr = NewBuilder.CreateLoad(VoidPtrTy, DummyPTXGV);
+    LaunchHandle = NewBuilder.CreateCall(
+        KitCudaSpecializeLaunchFn,
+        {DummyPTXPtr, KNameArg, argsPtr, ParamsGV,
+         ConstantInt::get(Int32Ty, ParamCs.size()), SiteHandle, LaunchHandle},
+        "spec.handle");
+    TTarget->registerSpecializedLaunch();
+  }
 
-  AllocaInst *AI = NewBuilder.CreateAlloca(KernelInstMixTy);
-  NewBuilder.CreateStore(InstructionMix, AI);
+  // The runtime's launch cache is keyed on the address of the mix, so a
+  // constant mix is placed in a global rather than rebuilt on the stack
+  // ahead of every launch.
+  Value *AI;
+  if (auto *MixC = dyn_cast<Constant>(InstructionMix)) {
+    auto *MixGV = new GlobalVariable(M, KernelInstMixTy, true,
+                                     GlobalValue::PrivateLinkage, MixC,
+                                     CUABI_PREFIX + ".instmix." + KernelName);
+    MixGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    AI = MixGV;
+  } else {
+    AI = EntryBuilder.CreateAlloca(KernelInstMixTy);
+    NewBuilder.CreateStore(InstructionMix, AI);
+  }
 
   LLVM_DEBUG(dbgs() << "\t*- code gen kernel launch....\n");
   Value *KSPtr = NewBuilder.CreateLoad(VoidPtrTy, CudaStream);
-  CallInst *LaunchStream = NewBuilder.CreateCall(
-      KitCudaLaunchFn, {DummyFBPtr, KNameParam, argsPtr, CastTripCount,
-                        TPBlockValue, AI, KSPtr});
+  CallInst *LaunchStream;
+  if (NumLaunchDims > 1) {
+    // Multi-dimensional launches pass the extents of the inner
+    // dimensions; the runtime derives the outermost extent from the
+    // trip count.
+    ArrayType *ExtentsTy = ArrayType::get(Int64Ty, NumLaunchDims - 1);
+    Value *Extents = EntryBuilder.CreateAlloca(ExtentsTy);
+    for (unsigned D = 0; D < NumLaunchDims - 1; D++) {
+      Value *Extent = LaunchExtents[D];
+      NewBuilder.CreateStore(
+          NewBuilder.CreateZExtOrTrunc(Extent, Int64Ty),
+          NewBuilder.CreateConstInBoundsGEP2_32(ExtentsTy, Extents, 0, D));
+    }
+    LaunchStream = NewBuilder.CreateCall(
+        KitCudaLaunchNDFn,
+        {DummyFBPtr, KNameArg, argsPtr, CastTripCount, TPBlockValue, AI,
+         KSPtr, IVSize, LaunchHandle,
+         ConstantInt::get(Type::getInt32Ty(Ctx), NumLaunchDims),
+         NewBuilder.CreateConstInBoundsGEP2_32(ExtentsTy, Extents, 0, 0)});
+  } else
+    LaunchStream = NewBuilder.CreateCall(
+        KitCudaLaunchFn, {DummyFBPtr, KNameArg, argsPtr, CastTripCount,
+                          TPBlockValue, AI, KSPtr, IVSize, LaunchHandle});
   // if (not StreamAssigned)
   NewBuilder.CreateStore(LaunchStream, CudaStream);
   LLVM_DEBUG(dbgs() << "\t\t+- registering launch stream:\n"
                     << "\t\t\tcall: " << *LaunchStream << "\n"
                     << "\t\t\tstream: " << *CudaStream << "\n");
-  TTarget->registerLaunchStream(LaunchStream, CudaStream);
+  assert(SyncRegion && "launch stream without a sync region!");
+  if (Async)
+    TTarget->registerAsyncLaunchStream(SyncRegion, CudaStream);
+  else
+    TTarget->registerLaunchStream(SyncRegion, CudaStream);
+
+  if (mayPrefetchData() && CodeGenHostPrefetch) {
+    SmallVector<Value *, 4> Ptrs, OutputPtrs;
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++) {
+      Value *V = OrderedInputs[ArgNo];
+      if (!V->getType()->isPointerTy() || isReductionArg(ArgNo))
+        continue;
+      Ptrs.push_back(V);
+      if (tapir::getKernelArgAccess(V, getKernelArg(F, ArgNo)) !=
+          tapir::KernelArgReadOnly)
+        OutputPtrs.push_back(V);
+    }
+    TTarget->registerLaunchPointers(LaunchStream, CudaStream, Ptrs,
+                                    OutputPtrs);
+  }
 
   TOI.ReplCall->eraseFromParent();
   LLVM_DEBUG(dbgs() << "*** finished processing outlined call.\n");
 }
 
+// Split a list-valued -cuabi-arch (e.g., 'sm_80,sm_90') into the primary
+// target, the oldest architecture in the list that PTX is generated for,
+// and additional targets that the PTX is also assembled for.
+static void splitGPUArchList() {
+  if (!StringRef(GPUArch).contains(','))
+    return;
+  SmallVector<StringRef, 4> ArchRefs;
+  StringRef(GPUArch).split(ArchRefs, ',', -1, false);
+  SmallVector<std::string, 4> Archs(ArchRefs.begin(), ArchRefs.end());
+  if (Archs.empty())
+    report_fatal_error("cuabi: empty target architecture list!");
+  llvm::stable_sort(Archs, [](const std::string &A, const std::string &B) {
+    return getSMVersion(A) < getSMVersion(B);
+  });
+  GPUArch.setValue(Archs.front());
+  for (const std::string &Arch : llvm::drop_begin(Archs))
+    ExtraGPUArchs.push_back(Arch);
+  LLVM_DEBUG(dbgs() << "cuabi: primary target '" << GPUArch << "' with "
+                    << ExtraGPUArchs.size() << " additional target(s).\n");
+}
+
 CudaABI::CudaABI(Module &M)
     : TapirTarget(M),
       KernelModule(Twine(CUABI_PREFIX + sys::path::filename(M.getName())).str(),
@@ -1168,6 +3116,15 @@ CudaABI::CudaABI(Module &M)
                       << envTarget.value() << "'.\n");
     GPUArch.setInitialValue(envTarget.value());
   }
+  splitGPUArchList();
+
+  std::optional<std::string> envCacheDir =
+      sys::Process::GetEnv("CUDAABI_CACHE_DIR");
+  if (envCacheDir && FatbinaryCacheDir.empty()) {
+    LLVM_DEBUG(dbgs() << "cuabi: fatbinary cache set via environment '"
+                      << envCacheDir.value() << "'.\n");
+    FatbinaryCacheDir.setValue(envCacheDir.value());
+  }
 
   std::optional<std::string> ThreadsPBVar =
       sys::Process::GetEnv("CUDABI_DEFAULT_THREADS_PER_BLOCK");
@@ -1223,14 +3180,97 @@ void CudaABI::pushPTXFilename(const std::string &FN) {
 }
 
 void CudaABI::pushGlobalVariable(GlobalVariable *GV) {
-  GlobalVars.push_back(GV);
+  // A global used by several kernels is only copied once.
+  if (!llvm::is_contained(GlobalVars, GV))
+    GlobalVars.push_back(GV);
+}
+
+// The device-side copies of the host's (non-constant) global variables
+// are packed into a single block so that the runtime can resolve it
+// once and bring it up to date with a single copy before a launch (see
+// __kitcuda_update_globals()).  Each variable keeps its alignment within
+// the block; the layout is recorded for the host-side update calls.
+void CudaABI::packGlobalVariables() {
+  if (GlobalVars.empty())
+    return;
+
+  LLVM_DEBUG(dbgs() << "\t- packing " << GlobalVars.size()
+                    << " device-side global variable(s).\n");
+  LLVMContext &Ctx = KernelModule.getContext();
+  const DataLayout &DevDL = KernelModule.getDataLayout();
+  const DataLayout &HostDL = M.getDataLayout();
+  Type *Int8Ty = Type::getInt8Ty(Ctx);
+  SmallVector<Type *, 16> FieldTys;
+  SmallVector<std::pair<GlobalVariable *, unsigned>, 16> DevFields;
+  uint64_t Offset = 0;
+  Align BlockAlign(1);
+  for (GlobalVariable *HostGV : GlobalVars) {
+    GlobalVariable *DevGV =
+        KernelModule.getNamedGlobal(HostGV->getName().str() + "_devvar");
+    assert(DevGV && "missing device-side global variable!");
+    Type *Ty = DevGV->getValueType();
+    Align A = std::max(DevGV->getAlign().valueOrOne(), DevDL.getABITypeAlign(Ty));
+    uint64_t FieldOffset = alignTo(Offset, A);
+    if (FieldOffset > Offset)
+      FieldTys.push_back(ArrayType::get(Int8Ty, FieldOffset - Offset));
+    DevFields.push_back({DevGV, FieldTys.size()});
+    FieldTys.push_back(Ty);
+    GlobalBlockLayout.push_back({HostGV, FieldOffset});
+    Offset = FieldOffset + HostDL.getTypeAllocSize(HostGV->getValueType());
+    assert(DevDL.getTypeAllocSize(Ty) ==
+               HostDL.getTypeAllocSize(HostGV->getValueType()) &&
+           "host and device global variable sizes differ!");
+    BlockAlign = std::max(BlockAlign, A);
+  }
+  GlobalBlockSize = alignTo(Offset, BlockAlign);
+
+  StructType *BlockTy = StructType::create(Ctx, FieldTys,
+                                           CUABI_PREFIX + ".globals", true);
+  GlobalVariable *BlockGV = new GlobalVariable(
+      KernelModule, BlockTy, /* isConstant */ false,
+      GlobalValue::ExternalLinkage, Constant::getNullValue(BlockTy),
+      getGlobalsBlockName(), (GlobalVariable *)nullptr,
+      GlobalValue::NotThreadLocal);
+  BlockGV->setAlignment(BlockAlign);
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  for (auto &DF : DevFields) {
+    Constant *Idx[] = {ConstantInt::get(Int32Ty, 0),
+                       ConstantInt::get(Int32Ty, DF.second)};
+    DF.first->replaceAllUsesWith(
+        ConstantExpr::getInBoundsGetElementPtr(BlockTy, BlockGV, Idx));
+    DF.first->eraseFromParent();
+  }
+}
+
+// The libdevice bitcode is read once per process and shared by all the
+// CudaABI instances of the compilation (e.g., one per module in an LTO or
+// multi-module build).  Each instance creates its own lazy module from it,
+// as the module is consumed when it is linked into the kernel module.
+static MemoryBufferRef getLibDeviceBitcode(StringRef BCFile) {
+  static std::mutex CacheMutex;
+  static StringMap<std::unique_ptr<MemoryBuffer>> Cache;
+  std::lock_guard<std::mutex> Lock(CacheMutex);
+  std::unique_ptr<MemoryBuffer> &Buffer = Cache[BCFile];
+  if (!Buffer) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+        MemoryBuffer::getFile(BCFile);
+    if (std::error_code EC = BufferOrErr.getError())
+      report_fatal_error(llvm::StringRef("Failed to read: ") + BCFile +
+                         ": " + EC.message());
+    Buffer = std::move(*BufferOrErr);
+  }
+  return Buffer->getMemBufferRef();
 }
 
 std::unique_ptr<Module> &CudaABI::getLibDeviceModule() {
   if (not LibDeviceModule) {
+    NamedRegionTimer NRT("getLibDeviceModule", "Load libdevice",
+                         TimerGroupName, TimerGroupDescription,
+                         TimePassesIsEnabled);
+    TimeTraceScope TTS("CudaABI::getLibDeviceModule");
     LLVMContext &Ctx = KernelModule.getContext();
-    llvm::SMDiagnostic SMD;
-    llvm::errs() << "libdevice: " << KITSUNE_CUDA_LIBDEVICE_BC << "\n";
+    LLVM_DEBUG(dbgs() << "\t- libdevice: " << KITSUNE_CUDA_LIBDEVICE_BC
+                      << "\n");
     // KITSUNE FIXME: It might be useful during development to override the
     // libdevice.10.bc function. We could do this with a command-line argument
     // that gets passed to this transform.
@@ -1243,11 +3283,17 @@ std::unique_ptr<Module> &CudaABI::getLibDeviceModule() {
     //     report_fatal_error("Unable to load cuda libdevice.10.bc!");
     // }
 
+    // The module is loaded lazily: only the functions the kernels call
+    // (and the ones they call in turn) are materialized when it is
+    // linked into the kernel module.
     llvm::StringRef LibDeviceBCFile = KITSUNE_CUDA_LIBDEVICE_BC;
-    LibDeviceModule = parseIRFile(LibDeviceBCFile, SMD, Ctx);
-    if (not LibDeviceModule)
+    Expected<std::unique_ptr<Module>> LDM =
+        getLazyBitcodeModule(getLibDeviceBitcode(LibDeviceBCFile), Ctx);
+    if (!LDM)
       report_fatal_error(llvm::StringRef("Failed to parse: ") +
-                         LibDeviceBCFile);
+                         LibDeviceBCFile + ": " +
+                         toString(LDM.takeError()));
+    LibDeviceModule = std::move(*LDM);
   }
 
   return LibDeviceModule;
@@ -1286,19 +3332,232 @@ void CudaABI::postProcessFunction(Function &F, bool OutliningTapirLoops) {
     LLVMContext &Ctx = M.getContext();
     Type *VoidTy = Type::getVoidTy(Ctx);
     PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
-    Value *CudaStream = ConstantPointerNull::get(VoidPtrTy);
     FunctionCallee KitCudaSyncFn = M.getOrInsertFunction(
         "__kitcuda_sync_thread_stream", VoidTy, VoidPtrTy);
 
-    for (Value *SR : SyncRegList) {
-      for (Use &U : SR->uses()) {
-        if (auto *SyncI = dyn_cast<SyncInst>(U.getUser()))
-          CallInst::Create(KitCudaSyncFn, {CudaStream}, "",
-                           &*SyncI->getSuccessor(0)->begin());
+    // Each sync only waits on the streams of the kernels launched within
+    // its sync region -- kernels launched in other (e.g., concurrently
+    // spawned) regions keep running.  A synchronized stream is handed
+    // back to the runtime so the next launch from the same site picks
+    // up a fresh stream.  Launches that did not execute leave a null
+    // stream that the runtime ignores.
+    for (auto &Entry : SyncRegStreams) {
+      for (Use &U : Entry.first->uses()) {
+        auto *SyncI = dyn_cast<SyncInst>(U.getUser());
+        if (!SyncI)
+          continue;
+        IRBuilder<> SyncBuilder(
+            &*SyncI->getSuccessor(0)->getFirstInsertionPt());
+        for (AllocaInst *StreamAI : Entry.second) {
+          Value *CudaStream =
+              SyncBuilder.CreateLoad(VoidPtrTy, StreamAI, "custreamh");
+          SyncBuilder.CreateCall(KitCudaSyncFn, {CudaStream});
+          SyncBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy),
+                                  StreamAI);
+        }
+      }
+    }
+
+    // The streams of asynchronous loops are left running past the
+    // loop's own sync (see emitAsyncStreamSyncs()).
+    MapVector<Function *, SmallVector<AllocaInst *, 4>> FnAsyncStreams;
+    for (AllocaInst *StreamAI : AsyncStreams)
+      FnAsyncStreams[StreamAI->getFunction()].push_back(StreamAI);
+    for (auto &Entry : FnAsyncStreams)
+      emitAsyncStreamSyncs(*Entry.first, Entry.second);
+    SyncRegStreams.clear();
+    AsyncSyncRegions.clear();
+    AsyncStreams.clear();
+    emitHostPrefetches(F);
+  }
+}
+
+// The streams of asynchronous loops launched from F are left running
+// past the loop's own sync.  A stream belongs to the task whose frame
+// holds it: F itself, or a task F spawns.  The task's syncs of other
+// regions (i.e., the enclosing sync statements) wait for it.  F waits
+// for its own streams before it returns.  A spawned task instead hands
+// its streams to the sync region of its spawn when it finishes, and each
+// sync of that region waits for the streams handed to it by all of its
+// tasks -- which, in turn, waited for those of their own tasks.  So the
+// tasks' launches run concurrently on their own streams and a sync only
+// waits on the GPU work of the tasks it joins.  Loads of a stream that
+// has not been launched on yet, or was already synchronized, see a null
+// stream that the runtime ignores.
+void CudaABI::emitAsyncStreamSyncs(Function &F,
+                                   ArrayRef<AllocaInst *> Streams) {
+  LLVMContext &Ctx = M.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  Constant *NullStream = ConstantPointerNull::get(VoidPtrTy);
+  FunctionCallee KitCudaSyncFn = M.getOrInsertFunction(
+      "__kitcuda_sync_thread_stream", VoidTy, VoidPtrTy);
+  FunctionCallee KitCudaDeferFn = M.getOrInsertFunction(
+      "__kitcuda_sync_region_defer", VoidTy, VoidPtrTy, VoidPtrTy);
+  FunctionCallee KitCudaWaitFn = M.getOrInsertFunction(
+      "__kitcuda_sync_region_wait", VoidTy, VoidPtrTy);
+
+  // The exits of each task, by the detach that spawns it: its reattaches,
+  // or the returns of F for F itself (a null detach).
+  DominatorTree DT(F);
+  DenseMap<DetachInst *, SmallVector<Instruction *, 4>> TaskExits;
+  SmallVector<SyncInst *, 8> Syncs;
+  for (BasicBlock &BB : F) {
+    Instruction *Term = BB.getTerminator();
+    if (isa<ReattachInst>(Term) || isa<ReturnInst>(Term))
+      TaskExits[getEnclosingDetach(&BB, DT)].push_back(Term);
+    else if (auto *SyncI = dyn_cast<SyncInst>(Term))
+      Syncs.push_back(SyncI);
+  }
+
+  // The streams handed to the sync region of a spawn are kept (by the
+  // runtime) in a list held in the spawning task's frame.  The list is
+  // waited for by the region's syncs and when the spawning task exits.
+  DenseMap<Value *, AllocaInst *> RegionStreams;
+  auto getRegionStreams = [&](DetachInst *DI) {
+    AllocaInst *&List = RegionStreams[DI->getSyncRegion()];
+    if (List)
+      return List;
+    DetachInst *SpawnerDI = getEnclosingDetach(DI->getParent(), DT);
+    BasicBlock *Frame =
+        SpawnerDI ? SpawnerDI->getDetached() : &F.getEntryBlock();
+    IRBuilder<> B(&*Frame->getFirstInsertionPt());
+    List = B.CreateAlloca(VoidPtrTy, nullptr, "custreams");
+    B.CreateStore(NullStream, List);
+    for (User *U : DI->getSyncRegion()->users())
+      if (auto *SyncI = dyn_cast<SyncInst>(U)) {
+        B.SetInsertPoint(&*SyncI->getSuccessor(0)->getFirstInsertionPt());
+        B.CreateCall(KitCudaWaitFn, {List});
+      }
+    for (Instruction *Exit : TaskExits[SpawnerDI]) {
+      B.SetInsertPoint(Exit);
+      B.CreateCall(KitCudaWaitFn, {List});
+    }
+    return List;
+  };
+
+  for (AllocaInst *StreamAI : Streams) {
+    DetachInst *DI = getEnclosingDetach(StreamAI->getParent(), DT);
+    SmallVector<Instruction *, 8> WaitPts;
+    for (SyncInst *SyncI : Syncs) {
+      Value *SR = SyncI->getSyncRegion();
+      if (!AsyncSyncRegions.count(SR) && !SyncRegStreams.count(SR) &&
+          getEnclosingDetach(SyncI->getParent(), DT) == DI)
+        WaitPts.push_back(&*SyncI->getSuccessor(0)->getFirstInsertionPt());
+    }
+    if (!DI)
+      WaitPts.append(TaskExits[nullptr]);
+    for (Instruction *WaitPt : WaitPts) {
+      IRBuilder<> B(WaitPt);
+      Value *CudaStream = B.CreateLoad(VoidPtrTy, StreamAI, "custreamh");
+      B.CreateCall(KitCudaSyncFn, {CudaStream});
+      B.CreateStore(NullStream, StreamAI);
+    }
+    if (!DI)
+      continue;
+
+    AllocaInst *List = getRegionStreams(DI);
+    for (Instruction *Exit : TaskExits[DI]) {
+      IRBuilder<> B(Exit);
+      Value *CudaStream = B.CreateLoad(VoidPtrTy, StreamAI, "custreamh");
+      B.CreateCall(KitCudaDeferFn, {List, CudaStream});
+      B.CreateStore(NullStream, StreamAI);
+    }
+  }
+}
+
+// Prefetch the data written by the kernels launched from F back to the
+// host, but only the data the host reads (see
+// tapir::isReadOnHostAfterLaunch()).  Without the prefetch the first
+// host reads after a kernel take a page fault per page.  The prefetch is
+// ordered on the stream of the launch, so it starts as soon as the
+// kernel completes and overlaps with any remaining device work and host
+// code.  A launch within loops whose iterations do not read the data
+// prefetches at the exits of the loops instead, rather than moving the
+// data back and forth on every iteration.  The pointer must reference a
+// stable allocation.
+void CudaABI::emitHostPrefetches(Function &F) {
+  if (LaunchPointers.empty())
+    return;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  DenseMap<const Value *, SmallVector<Instruction *, 4>> ObjLaunches;
+  for (auto &LP : LaunchPointers) {
+    if (LP.Launch->getFunction() != &F)
+      continue;
+    for (Value *Ptr : LP.Ptrs) {
+      SmallVector<Instruction *, 4> &Launches =
+          ObjLaunches[getUnderlyingObject(Ptr)];
+      if (!is_contained(Launches, LP.Launch))
+        Launches.push_back(LP.Launch);
+    }
+  }
+
+  LLVMContext &Ctx = M.getContext();
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  FunctionCallee KitCudaMemHostPrefetchFn = M.getOrInsertFunction(
+      "__kitcuda_mem_host_prefetch", VoidPtrTy, VoidPtrTy, VoidPtrTy);
+  DenseSet<std::pair<const Value *, Loop *>> LoopExitsDone;
+  for (auto &LP : LaunchPointers) {
+    CallInst *LaunchCI = LP.Launch;
+    if (LaunchCI->getFunction() != &F)
+      continue;
+    // The launch's stream is stored right after the call; the prefetch
+    // follows it.
+    Instruction *IP = LaunchCI->getNextNonDebugInstruction();
+    if (!IP || !IP->getNextNonDebugInstruction())
+      continue;
+    IP = IP->getNextNonDebugInstruction();
+    SmallPtrSet<const Value *, 4> Done;
+    for (Value *Ptr : LP.Outputs) {
+      const Value *Obj = getUnderlyingObject(Ptr);
+      if (!isa<Argument>(Obj) && !isa<GlobalVariable>(Obj) &&
+          !isa<AllocaInst>(Obj) && !isa<CallBase>(Obj))
+        continue;
+      if (!Done.insert(Obj).second)
+        continue;
+      SmallVector<Instruction *, 4> Others;
+      for (Instruction *Other : ObjLaunches.lookup(Obj))
+        if (Other != LaunchCI)
+          Others.push_back(Other);
+      Loop *ExitLoop = nullptr;
+      if (!tapir::isReadOnHostAfterLaunch(Ptr, LaunchCI, Others, DT, LI,
+                                          ExitLoop))
+        continue;
+
+      if (!ExitLoop) {
+        LLVM_DEBUG(dbgs() << "\t*- host prefetch of '" << Ptr->getName()
+                          << "' after launch: " << *LaunchCI << "\n");
+        IRBuilder<> B(IP);
+        B.CreateCall(KitCudaMemHostPrefetchFn,
+                     {B.CreateBitCast(Ptr, VoidPtrTy), LaunchCI});
+        continue;
+      }
+      // The pointer must be available at the exits of the loop.  The
+      // stream may have been synchronized (and reset to null) by then,
+      // in which case the runtime uses the thread's stream.
+      auto *PtrI = dyn_cast<Instruction>(Ptr);
+      if ((PtrI && ExitLoop->contains(PtrI->getParent())) ||
+          !LoopExitsDone.insert({Obj, ExitLoop}).second)
+        continue;
+      SmallVector<BasicBlock *, 4> Exits;
+      ExitLoop->getUniqueExitBlocks(Exits);
+      for (BasicBlock *Exit : Exits) {
+        LLVM_DEBUG(dbgs() << "\t*- host prefetch of '" << Ptr->getName()
+                          << "' at loop exit: " << Exit->getName() << "\n");
+        IRBuilder<> B(&*Exit->getFirstInsertionPt());
+        B.CreateCall(KitCudaMemHostPrefetchFn,
+                     {B.CreateBitCast(Ptr, VoidPtrTy),
+                      B.CreateLoad(VoidPtrTy, LP.StreamAI)});
       }
     }
-    SyncRegList.clear();
   }
+
+  LaunchPointers.erase(
+      std::remove_if(LaunchPointers.begin(), LaunchPointers.end(),
+                     [&F](auto &LP) { return LP.Launch->getFunction() == &F; }),
+      LaunchPointers.end());
 }
 
 void CudaABI::postProcessHelper(Function &F) { /* no-op */ }
@@ -1326,101 +3585,191 @@ void CudaABI::preProcessRootSpawner(llvm::Function &, BasicBlock *TFEntry) {
   /* no-op */
 }
 
-CudaABIOutputFile CudaABI::assemblePTXFile(CudaABIOutputFile &PTXFile) {
+// Return the architectures to assemble code for -- the primary target
+// (-cuabi-arch) followed by any additional targets.  The PTX is generated
+// for the primary target so every additional target must be the same or
+// a newer architecture.
+static SmallVector<std::string, 4> getTargetGPUArchs() {
+  SmallVector<std::string, 4> Archs;
+  Archs.push_back(GPUArch);
+  unsigned PrimarySM = getSMVersion(GPUArch);
+  for (const std::string &Arch : ExtraGPUArchs) {
+    if (llvm::is_contained(Archs, Arch))
+      continue;
+    unsigned SM = getSMVersion(Arch);
+    if (SM == 0 || SM < PrimarySM)
+      report_fatal_error("cuabi: extra target '" + StringRef(Arch) +
+                         "' must be an sm_XX architecture no older than '" +
+                         StringRef(GPUArch) + "'!");
+    Archs.push_back(Arch);
+  }
+  return Archs;
+}
 
-  LLVM_DEBUG(dbgs() << "\t- assembling PTX file '" << PTXFile->getFilename()
-                    << "'.\n");
-
-  std::error_code EC;
-  llvm::StringRef PTXASExe = KITSUNE_CUDA_PTXAS;
-  SmallString<255> AsmFileName(PTXFile->getFilename());
-  sys::path::replace_extension(AsmFileName, ".s");
-  std::unique_ptr<ToolOutputFile> AsmFile;
-  AsmFile = std::make_unique<ToolOutputFile>(AsmFileName, EC,
-                                             sys::fs::OpenFlags::OF_None);
-
-  // Build the command line for ptxas...  There are some target specific options
-  // that we support to configure some specifics here.  See the 'opt' entries
-  // near the top of this file.
-  // These can be passed to the transform via '-mllvm <cuabi-option>'.
-  opt::ArgStringList PTXASArgList;
-  PTXASArgList.push_back(PTXASExe.data());
-
-  // TODO: Do we need/want to add support for generating relocatable code?
-
-  // --gpu-name <gpu name>: Specify name of GPU to generate code for.
-  // (e.g., 'sm_70','sm_72','sm_75','sm_80','sm_86', 'sm_87')
-  PTXASArgList.push_back("--gpu-name"); // target gpu architecture.
-  PTXASArgList.push_back(GPUArch.c_str());
-
-  // For now let's always warn if we spill registers...
-  PTXASArgList.push_back("--warn-on-spills");
-  PTXASArgList.push_back("--verbose");
-
-  if (OptLevel > 3) {
-    errs() << "cuabi: warning -- unknown optimization level.  Using level-3.\n";
-    OptLevel = 3;
-  }
-
-  PTXASArgList.push_back("--opt-level");
-  switch (OptLevel) {
-  case 0:
-    PTXASArgList.push_back("0");
-    break;
-  case 1:
-    PTXASArgList.push_back("1");
-    break;
-  case 2:
-    PTXASArgList.push_back("2");
-    break;
-  case 3:
-    PTXASArgList.push_back("3");
-    // PTXASArgList.push_back("--extensible-whole-program");
-    break;
-  default:
-    llvm_unreachable_internal("unhandled/unexpected optimization level",
-                              __FILE__, __LINE__);
-    break;
-  }
-
-  PTXASArgList.push_back("--output-file");
-  std::string SCodeFilename = AsmFile->getFilename().str();
-  PTXASArgList.push_back(SCodeFilename.c_str());
-  std::string ptxfile(PTXFile->getFilename().str());
-  PTXASArgList.push_back(ptxfile.c_str());
-
-  // Build argv for exec'ing ptxas...
-  SmallVector<const char *, 128> PTXASArgv;
-  PTXASArgv.append(PTXASArgList.begin(), PTXASArgList.end());
-  PTXASArgv.push_back(nullptr);
-
-  auto PTXASArgs = toStringRefArray(PTXASArgv.data());
-  LLVM_DEBUG(dbgs() << "\t- ptxas command line:\n";
+// Run the given tool and wait for its completion.  Returns the tool's
+// exit status or -1 if it could not be executed.  The tool's output is
+// written to the given log file, if any.
+static int runCudaTool(StringRef Exe, const std::vector<std::string> &Args,
+                       std::string &ErrMsg,
+                       std::optional<StringRef> LogFile = std::nullopt) {
+  SmallVector<StringRef, 32> ArgRefs(Args.begin(), Args.end());
+  LLVM_DEBUG(dbgs() << "\t- " << sys::path::filename(Exe)
+                    << " command line:\n";
              unsigned c = 0; for (auto dbg_arg
-                                  : PTXASArgs) {
+                                  : ArgRefs) {
                dbgs() << "\t\t" << c << ": " << dbg_arg << "\n";
                c++;
              } dbgs() << "\n\n";);
-
-  // Finally we are ready to run ptxas...
-  std::string ErrMsg;
   bool ExecFailed;
-  int ExecStat = sys::ExecuteAndWait(PTXASExe, PTXASArgs, std::nullopt, {},
+  std::optional<StringRef> Redirects[] = {std::nullopt, LogFile, LogFile};
+  int ExecStat = sys::ExecuteAndWait(Exe, ArgRefs, std::nullopt, Redirects,
                                      0, /* secs to wait -- 0 --> unlimited */
                                      0, /* memory limit -- 0 --> unlimited */
                                      &ErrMsg, &ExecFailed);
-  if (ExecFailed)
-    report_fatal_error("fatal error: 'ptxas' execution failed!");
+  return ExecFailed ? -1 : ExecStat;
+}
 
-  if (ExecStat != 0)
-    // 'ptxas' ran but returned an error state.
-    report_fatal_error("fatal error: 'ptxas' failure: " + StringRef(ErrMsg));
+// Record the bytes of register spills (stores and loads) of each function in
+// the given ptxas '--verbose' output in SpillBytes, keeping the largest value
+// seen for a function (e.g., across architectures).  The output has the form:
+//
+//   ptxas info    : Function properties for <function>
+//       0 bytes stack frame, 8 bytes spill stores, 8 bytes spill loads
+//
+static void parsePTXASSpills(StringRef Output,
+                             StringMap<unsigned> &SpillBytes) {
+  SmallVector<StringRef, 64> Lines;
+  Output.split(Lines, '\n', -1, false);
+  const StringRef Marker = "Function properties for ";
+  StringRef FnName;
+  for (StringRef Line : Lines) {
+    size_t Pos = Line.find(Marker);
+    if (Pos != StringRef::npos) {
+      FnName = Line.drop_front(Pos + Marker.size()).trim().trim("'");
+      continue;
+    }
+    if (FnName.empty() || !Line.contains("bytes spill"))
+      continue;
+    unsigned Bytes = 0;
+    SmallVector<StringRef, 4> Fields;
+    Line.split(Fields, ',');
+    for (StringRef Field : Fields) {
+      Field = Field.trim();
+      unsigned N;
+      if (Field.contains("bytes spill") && !Field.consumeInteger(10, N))
+        Bytes += N;
+    }
+    unsigned &MaxBytes = SpillBytes[FnName];
+    MaxBytes = std::max(MaxBytes, Bytes);
+    FnName = StringRef();
+  }
+}
+
+CudaABIArchOutputFiles
+CudaABI::assemblePTXFile(CudaABIOutputFile &PTXFile,
+                         StringMap<unsigned> &SpillBytes) {
+  NamedRegionTimer NRT("assemblePTXFile", "Assemble PTX (ptxas)",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope TTS("CudaABI::assemblePTXFile", KernelModule.getName());
+
+  LLVM_DEBUG(dbgs() << "\t- assembling PTX file '" << PTXFile->getFilename()
+                    << "'.\n");
+
+  llvm::StringRef PTXASExe = KITSUNE_CUDA_PTXAS;
+  if (OptLevel > 3) {
+    errs() << "cuabi: warning -- unknown optimization level.  Using level-3.\n";
+    OptLevel = 3;
+  }
+
+  // Build the command line for ptxas for each target architecture...
+  // There are some target specific options that we support to configure
+  // some specifics here.  See the 'opt' entries near the top of this
+  // file.  These can be passed to the transform via '-mllvm <cuabi-option>'.
+  CudaABIArchOutputFiles AsmFiles;
+  std::vector<std::vector<std::string>> PTXASArgLists;
+  SmallVector<std::string, 4> LogFileNames;
+  for (const std::string &Arch : getTargetGPUArchs()) {
+    std::error_code EC;
+    SmallString<255> AsmFileName(PTXFile->getFilename());
+    sys::path::replace_extension(AsmFileName, "." + Arch + ".s");
+    CudaABIOutputFile AsmFile = std::make_unique<ToolOutputFile>(
+        AsmFileName, EC, sys::fs::OpenFlags::OF_None);
+
+    std::vector<std::string> PTXASArgList;
+    PTXASArgList.push_back(PTXASExe.str());
+
+    // Relocatable code is linked with the code of other modules by the
+    // runtime (see -cuabi-rdc).
+    if (RelocatableDeviceCode)
+      PTXASArgList.push_back("--compile-only");
+
+    // --gpu-name <gpu name>: Specify name of GPU to generate code for.
+    // (e.g., 'sm_70','sm_72','sm_75','sm_80','sm_86', 'sm_87')
+    PTXASArgList.push_back("--gpu-name"); // target gpu architecture.
+    PTXASArgList.push_back(Arch);
+
+    // For now let's always warn if we spill registers...
+    PTXASArgList.push_back("--warn-on-spills");
+    PTXASArgList.push_back("--verbose");
+
+    // TODO: Consider "--extensible-whole-program" at level 3.
+    PTXASArgList.push_back("--opt-level");
+    PTXASArgList.push_back(utostr(OptLevel));
+
+    PTXASArgList.push_back("--output-file");
+    PTXASArgList.push_back(AsmFile->getFilename().str());
+    PTXASArgList.push_back(PTXFile->getFilename().str());
+
+    PTXASArgLists.push_back(std::move(PTXASArgList));
+    AsmFiles.emplace_back(Arch, std::move(AsmFile));
+    // The verbose output reports the register spills of each kernel.
+    sys::path::replace_extension(AsmFileName, ".log");
+    LogFileNames.push_back(std::string(AsmFileName));
+  }
 
-  // TODO: Not sure we need to force 'keep' here as we return
-  // the output file but will keep it here for now just to play it
-  // safe.
-  AsmFile->keep();
-  return AsmFile;
+  // Finally we are ready to run ptxas...  Each architecture is an
+  // independent invocation so they are run concurrently.
+  unsigned NumArchs = AsmFiles.size();
+  std::vector<int> ExecStats(NumArchs);
+  std::vector<std::string> ErrMsgs(NumArchs);
+  if (NumArchs > 1) {
+    ThreadPool Pool(hardware_concurrency(NumArchs));
+    for (unsigned i = 0; i < NumArchs; ++i)
+      Pool.async([&, i] {
+        ExecStats[i] = runCudaTool(PTXASExe, PTXASArgLists[i], ErrMsgs[i],
+                                   StringRef(LogFileNames[i]));
+      });
+    Pool.wait();
+  } else
+    ExecStats[0] = runCudaTool(PTXASExe, PTXASArgLists[0], ErrMsgs[0],
+                               StringRef(LogFileNames[0]));
+
+  SpillBytes.clear();
+  for (unsigned i = 0; i < NumArchs; ++i) {
+    // Pass the output along as if ptxas had written it directly.
+    if (ErrorOr<std::unique_ptr<MemoryBuffer>> LogBuf =
+            MemoryBuffer::getFile(LogFileNames[i])) {
+      StringRef Output = (*LogBuf)->getBuffer();
+      errs() << Output;
+      parsePTXASSpills(Output, SpillBytes);
+    }
+    if (!KeepIntermediateFiles)
+      sys::fs::remove(LogFileNames[i]);
+
+    if (ExecStats[i] < 0)
+      report_fatal_error("fatal error: 'ptxas' execution failed!");
+    if (ExecStats[i] != 0)
+      // 'ptxas' ran but returned an error state.
+      report_fatal_error("fatal error: 'ptxas' failure (" +
+                         StringRef(AsmFiles[i].first) +
+                         "): " + StringRef(ErrMsgs[i]));
+    // TODO: Not sure we need to force 'keep' here as we return
+    // the output file but will keep it here for now just to play it
+    // safe.
+    AsmFiles[i].second->keep();
+  }
+  return AsmFiles;
 }
 
 // We can't create a correct launch sequence until all the kernels within a
@@ -1431,7 +3780,8 @@ CudaABIOutputFile CudaABI::assemblePTXFile(CudaABIOutputFile &PTXFile) {
 // In addition, we must copy data for global variables from the host to the
 // device prior to kernel launches.  This requires digging some additonal
 // details out of the fat binary (CUDA module).
-void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
+void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin,
+                                  GlobalVariable *PTX) {
 
   LLVM_DEBUG(dbgs() << "\t- finalizing kernel launch calls...\n");
 
@@ -1442,23 +3792,45 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
   PointerType *CharPtrTy = PointerType::getUnqual(Ctx);
   Type *Int64Ty = Type::getInt64Ty(Ctx);
 
-  // Look up a global (device-side) symbol via a module
-  // created from the fat binary.
-  // TODO: Move these callees to the constructor -- no need
-  // to build and destory each time... Perhaps speed us up a
-  // tidbit...
-  FunctionCallee KitCudaGetGlobalSymbolFn =
-      M.getOrInsertFunction("__kitcuda_get_global_symbol",
-                            Int64Ty,    // device pointer
-                            VoidPtrTy,  // fat binary
-                            CharPtrTy); // symbol name
-
-  FunctionCallee KitCudaMemcpyToDeviceFn =
-      M.getOrInsertFunction("__kitcuda_memcpy_sym_to_device",
-                            VoidTy,    // returns
-                            VoidPtrTy, // host ptr
-                            Int64Ty,   // device ptr
-                            Int64Ty);  // num bytes
+  // The host globals packed into the device-side block (see
+  // packGlobalVariables()) are described by a table of host address,
+  // block offset and size entries that is shared by all launches.
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  FunctionCallee KitCudaUpdateGlobalsFn = nullptr;
+  Constant *GlobalsTable = nullptr;
+  Constant *GlobalsBlockName = nullptr;
+  if (!GlobalBlockLayout.empty()) {
+    StructType *EntryTy = StructType::get(VoidPtrTy, Int64Ty, Int64Ty);
+    SmallVector<Constant *, 16> Entries;
+    for (auto &Field : GlobalBlockLayout)
+      Entries.push_back(ConstantStruct::get(
+          EntryTy, ConstantExpr::getPointerCast(Field.first, VoidPtrTy),
+          ConstantInt::get(Int64Ty, Field.second),
+          ConstantInt::get(Int64Ty,
+                           DL.getTypeAllocSize(Field.first->getValueType()))));
+    ArrayType *TableTy = ArrayType::get(EntryTy, Entries.size());
+    GlobalsTable = new GlobalVariable(M, TableTy, true,
+                                      GlobalValue::PrivateLinkage,
+                                      ConstantArray::get(TableTy, Entries),
+                                      CUABI_PREFIX + ".globals.table");
+    GlobalsBlockName = tapir::createConstantStr(getGlobalsBlockName(), M,
+                                                CUABI_GLOBALS_BLOCK_NAME);
+    GlobalBlockHandle = new GlobalVariable(
+        M, VoidPtrTy, false, GlobalValue::InternalLinkage,
+        ConstantPointerNull::get(VoidPtrTy), CUABI_PREFIX + ".globals.handle");
+    GlobalBlockHandle->setAlignment(Align(DL.getPointerABIAlignment(0)));
+    KitCudaUpdateGlobalsFn =
+        M.getOrInsertFunction("__kitcuda_update_globals",
+                              VoidTy,    // returns
+                              VoidPtrTy, // fat binary
+                              CharPtrTy, // block name
+                              VoidPtrTy, // global entries
+                              Int32Ty,   // number of entries
+                              Int64Ty,   // block size
+                              VoidPtrTy, // block handle
+                              VoidPtrTy  // pointer to the launch stream
+        );
+  }
 
   // Search for kernel launch calls that we built prior to the creation
   // of the fat binary -- which we now have.  Replace the first parameter
@@ -1479,7 +3851,7 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
   // launch finalization.
   CallInst *ThreadsPerBlockCI = nullptr;
   std::list<CallInst *> DummyCIList;
-  CallInst *SavedLaunchCI = nullptr;
+  SmallVector<CallInst *, 4> SpecializeCIList;
 
   for (auto &Fn : FnList) {
     for (auto &BB : Fn) {
@@ -1492,30 +3864,10 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
                                    "placeholder call.\n");
               assert(ThreadsPerBlockCI == nullptr && "expected null pointer!");
               ThreadsPerBlockCI = CI;
-            } else if (CFn->getName().starts_with(
-                           "__kitcuda_sync_thread_stream")) {
-              LLVM_DEBUG(dbgs()
-                         << "\t\t\t* patching sync call: " << *CI << "\n");
-              if (SavedLaunchCI != nullptr) {
-                AllocaInst *StreamAI = getLaunchStream(SavedLaunchCI);
-                assert(StreamAI != nullptr && "unexpected null launch stream!");
-                LLVM_DEBUG(dbgs()
-                           << "\t\t\t\t* stream alloca: " << *StreamAI << "\n");
-                IRBuilder<> SyncBuilder(CI);
-                Value *CudaStream =
-                    SyncBuilder.CreateLoad(VoidPtrTy, StreamAI, "custreamh");
-                LLVM_DEBUG(dbgs()
-                           << "\t\t\t\t* cuda stream: " << *CudaStream << "\n");
-                CI->setArgOperand(0, CudaStream);
-                SavedLaunchCI = nullptr;
-                LLVM_DEBUG(dbgs() << "\t\t\t* patched call: " << *CI << "\n");
-              } else {
-                LLVM_DEBUG(dbgs()
-                           << "\t\t\t- note, matching launch not found!\n");
-              }
+            } else if (CFn->getName() == "__kitcuda_specialize_launch") {
+              SpecializeCIList.push_back(CI);
             } else if (CFn->getName().starts_with("__kitcuda_launch_kernel")) {
               LLVM_DEBUG(dbgs() << "\t\t\t* patching launch: " << *CI << "\n");
-              SavedLaunchCI = CI;
               Value *CFatbin;
               CFatbin = CastInst::CreateBitOrPointerCast(Fatbin, VoidPtrTy,
                                                          "_cubin.fatbin", CI);
@@ -1531,36 +3883,30 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
                 ThreadsPerBlockCI = nullptr;
               }
 
-              Instruction *NI = CI->getNextNonDebugInstruction();
-              // Unless someting else has monkeyed with our generated code
-              // NI should be the launch call.  We need the following code
-              // to go between the call instruction and the launch.
-              assert(NI && "unexpected null instruction!");
-
               // We need to explicitly add code to sync up host- and
               // device-side global values prior to launching kernels.
               // We only have a complete awareness of this now so insert
-              // the supporting runtime calls.
+              // the supporting runtime call.  The update is ordered on
+              // the launch's stream, so the stream is reloaded for the
+              // launch in case the update assigned it.
               //
-              // TODO: This is overdone -- we copy *all* globals and not
+              // TODO: This is overdone -- we update *all* globals and not
               // just those that the kernel we're launching is using.
               //
-              for (auto &HostGV : GlobalVars) {
-                std::string DevVarName = HostGV->getName().str() + "_devvar";
-                LLVM_DEBUG(dbgs() << "\t\t\t  processing global: '"
-                                  << HostGV->getName() << "'\n");
-                Value *SymName =
-                    tapir::createConstantStr(DevVarName, M, DevVarName);
-                Value *DevPtr =
-                    CallInst::Create(KitCudaGetGlobalSymbolFn,
-                                     {CFatbin, SymName}, ".cuabi_devptr", NI);
-                Value *VGVPtr =
-                    CastInst::CreatePointerCast(HostGV, VoidPtrTy, "", NI);
-                uint64_t NumBytes = DL.getTypeAllocSize(HostGV->getValueType());
-                CallInst::Create(
-                    KitCudaMemcpyToDeviceFn,
-                    {VGVPtr, DevPtr, ConstantInt::get(Int64Ty, NumBytes)}, "",
-                    NI);
+              if (KitCudaUpdateGlobalsFn) {
+                IRBuilder<> B(CI);
+                Value *StreamPtr = ConstantPointerNull::get(VoidPtrTy);
+                auto *StreamLoad = dyn_cast<LoadInst>(CI->getArgOperand(6));
+                if (StreamLoad && isa<AllocaInst>(StreamLoad->getPointerOperand()))
+                  StreamPtr = StreamLoad->getPointerOperand();
+                B.CreateCall(
+                    KitCudaUpdateGlobalsFn,
+                    {CFatbin, GlobalsBlockName, GlobalsTable,
+                     ConstantInt::get(Int32Ty, GlobalBlockLayout.size()),
+                     ConstantInt::get(Int64Ty, GlobalBlockSize),
+                     GlobalBlockHandle, StreamPtr});
+                if (!isa<ConstantPointerNull>(StreamPtr))
+                  CI->setArgOperand(6, B.CreateLoad(VoidPtrTy, StreamPtr));
               }
             }
           }
@@ -1574,6 +3920,28 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
     I->eraseFromParent();
   }
 
+  // Specialized launches compile their variants from the module's PTX.
+  // Without it (see canSpecializeKernels()) they use the kernel's own
+  // launch handle.
+  for (CallInst *CI : SpecializeCIList) {
+    if (PTX) {
+      CI->setArgOperand(0, ConstantExpr::getPointerCast(PTX, VoidPtrTy));
+      continue;
+    }
+    LLVM_DEBUG(dbgs() << "\t\t\t dropping launch specialization.\n");
+    CI->replaceAllUsesWith(CI->getArgOperand(CI->arg_size() - 1));
+    CI->eraseFromParent();
+  }
+  if (GlobalVariable *ProxyPTX =
+          M.getGlobalVariable("_cuabi.dummy_ptx", true)) {
+    for (User *U : make_early_inc_range(ProxyPTX->users()))
+      if (auto *LI = dyn_cast<LoadInst>(U); LI && LI->use_empty())
+        LI->eraseFromParent();
+    ProxyPTX->replaceAllUsesWith(
+        ConstantPointerNull::get(ProxyPTX->getType()));
+    ProxyPTX->eraseFromParent();
+  }
+
   GlobalVariable *ProxyFB = M.getGlobalVariable("_cuabi.dummy_fatbin", true);
   if (ProxyFB) {
     Constant *CFB =
@@ -1589,9 +3957,15 @@ void CudaABI::finalizeLaunchCalls(Module &M, GlobalVariable *Fatbin) {
   }
 }
 
-CudaABIOutputFile CudaABI::createFatbinaryFile(CudaABIOutputFile &AsmFile) {
+CudaABIOutputFile
+CudaABI::createFatbinaryFile(CudaABIArchOutputFiles &AsmFiles) {
+  NamedRegionTimer NRT("createFatbinaryFile", "Create fat binary",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope TTS("CudaABI::createFatbinaryFile", KernelModule.getName());
   std::error_code EC;
-  SmallString<255> FatbinFilename(AsmFile->getFilename());
+  SmallString<255> FatbinFilename(AsmFiles.front().second->getFilename());
+  sys::path::replace_extension(FatbinFilename, "");
   sys::path::replace_extension(FatbinFilename, ".cufatbin");
   CudaABIOutputFile FatbinFile;
   FatbinFile = std::make_unique<ToolOutputFile>(FatbinFilename, EC,
@@ -1607,17 +3981,19 @@ CudaABIOutputFile CudaABI::createFatbinaryFile(CudaABIOutputFile &AsmFile) {
   //                      "Is a CUDA installation in your path?");
 
   llvm::StringRef FatbinaryExe = KITSUNE_CUDA_FATBINARY;
-  opt::ArgStringList FatbinaryArgList;
-  FatbinaryArgList.push_back(FatbinaryExe.data());
+  std::vector<std::string> FatbinaryArgList;
+  FatbinaryArgList.push_back(FatbinaryExe.str());
   FatbinaryArgList.push_back("--64");
   FatbinaryArgList.push_back("--create");
-  FatbinaryArgList.push_back(FatbinFilename.c_str());
+  FatbinaryArgList.push_back(FatbinFilename.str().str());
+  if (RelocatableDeviceCode)
+    FatbinaryArgList.push_back("--device-c");
 
-  std::string FatbinaryImgArgs =
-      "--image=profile=" + GPUArch + ",file=" + AsmFile->getFilename().str();
-  FatbinaryArgList.push_back(FatbinaryImgArgs.c_str());
+  // One image per target architecture.
+  for (auto &AsmFile : AsmFiles)
+    FatbinaryArgList.push_back("--image=profile=" + AsmFile.first +
+                               ",file=" + AsmFile.second->getFilename().str());
 
-  std::list<std::string> PTXFilesArgList;
   if (EmbedPTXInFatbinaries) {
     std::string VArchStr = virtualArchForCudaArch(GPUArch);
     if (VArchStr == "unknown")
@@ -1625,35 +4001,13 @@ CudaABIOutputFile CudaABI::createFatbinaryFile(CudaABIOutputFile &AsmFile) {
                          StringRef(GPUArch) + "'!");
 
     std::string PTXFixedArgStr = "--image=profile=" + VArchStr + ",file=";
-    for (auto &PTXFile : ModulePTXFileList) {
-      std::string arg = PTXFixedArgStr + PTXFile;
-      std::list<std::string>::const_iterator it;
-      it = PTXFilesArgList.emplace(PTXFilesArgList.end(), std::move(arg));
-      FatbinaryArgList.push_back(it->c_str());
-    }
+    for (auto &PTXFile : ModulePTXFileList)
+      FatbinaryArgList.push_back(PTXFixedArgStr + PTXFile);
   }
 
-  FatbinaryArgList.push_back(nullptr);
-
-  SmallVector<const char *, 128> FatbinaryArgv;
-  FatbinaryArgv.append(FatbinaryArgList.begin(), FatbinaryArgList.end());
-  auto FatbinaryArgs = toStringRefArray(FatbinaryArgv.data());
-
-  LLVM_DEBUG(dbgs() << "\tfatbinary command line:\n";
-             unsigned c = 0; for (auto dbg_arg
-                                  : FatbinaryArgs) {
-               dbgs() << "\t\t" << c << ": " << dbg_arg << "\n";
-               c++;
-             } dbgs() << "\n\n";);
-
   std::string ErrMsg;
-  bool ExecFailed;
-  int ExecStat =
-      sys::ExecuteAndWait(FatbinaryExe, FatbinaryArgs, std::nullopt, {},
-                          0, /* secs to wait -- 0 --> unlimited */
-                          0, /* memory limit -- 0 --> unlimited */
-                          &ErrMsg, &ExecFailed);
-  if (ExecFailed)
+  int ExecStat = runCudaTool(FatbinaryExe, FatbinaryArgList, ErrMsg);
+  if (ExecStat < 0)
     report_fatal_error("unable to execute 'fatbinary'.");
 
   if (ExecStat != 0)
@@ -1662,20 +4016,13 @@ CudaABIOutputFile CudaABI::createFatbinaryFile(CudaABIOutputFile &AsmFile) {
     // environment -- currently assuming it matches standard practices...
     report_fatal_error("'fatbinary' error:" + StringRef(ErrMsg));
 
-  if (EmbedPTXInFatbinaries) {
-    std::list<std::string>::iterator it = PTXFilesArgList.begin();
-    while (it != PTXFilesArgList.end()) {
-      PTXFilesArgList.erase(it++);
-    }
-  }
-
   // TODO: Not sure we need to force 'keep' here as we return the output file
   // but will keep it here for now just to play it safe.
   FatbinFile->keep();
   return FatbinFile;
 }
 
-GlobalVariable *CudaABI::embedFatbinary(CudaABIOutputFile &FatbinaryFile) {
+GlobalVariable *CudaABI::embedFatbinary(StringRef FatbinaryFileName) {
 
   LLVM_DEBUG(dbgs() << "\t- code gen for embedded fat binary image...\n");
 
@@ -1683,7 +4030,7 @@ GlobalVariable *CudaABI::embedFatbinary(CudaABIOutputFile &FatbinaryFile) {
   // will then codegen it into the host-side module.
   std::unique_ptr<llvm::MemoryBuffer> Fatbinary = nullptr;
   ErrorOr<std::unique_ptr<MemoryBuffer>> FBBufferOrErr =
-      MemoryBuffer::getFile(FatbinaryFile->getFilename());
+      MemoryBuffer::getFile(FatbinaryFileName);
   if (std::error_code EC = FBBufferOrErr.getError()) {
     report_fatal_error("cuabi: failed to load fat binary image: " +
                        StringRef(EC.message()));
@@ -1708,39 +4055,43 @@ GlobalVariable *CudaABI::embedFatbinary(CudaABIOutputFile &FatbinaryFile) {
   return FatbinaryGV;
 }
 
-void CudaABI::bindGlobalVariables(Value *Handle, IRBuilder<> &B) {
-  LLVMContext &Ctx = M.getContext();
-  const DataLayout &DL = M.getDataLayout();
-  Type *IntTy = Type::getInt32Ty(Ctx);
-  Type *Int64Ty = Type::getInt64Ty(Ctx);
-  Type *VoidTy = Type::getVoidTy(Ctx);
-  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
-  PointerType *VoidPtrPtrTy = VoidPtrTy->getPointerTo();
-  Type *VarSizeTy = Int64Ty;
-  PointerType *CharPtrTy = PointerType::getUnqual(Ctx);
-
-  FunctionCallee RegisterVarFn = M.getOrInsertFunction(
-      "__cudaRegisterVar", VoidTy, VoidPtrPtrTy, CharPtrTy, CharPtrTy,
-      CharPtrTy, IntTy, VarSizeTy, IntTy, IntTy);
-  for (auto &HostGV : GlobalVars) {
-    uint64_t VarSize = DL.getTypeAllocSize(HostGV->getType());
-    Value *VarName = tapir::createConstantStr(HostGV->getName().str(), M);
-    std::string DevVarName = HostGV->getName().str() + "_devvar";
-    Value *DevName = tapir::createConstantStr(DevVarName, M, DevVarName);
-    llvm::Value *Args[] = {
-        Handle,
-        B.CreateBitCast(HostGV, VoidPtrTy),
-        VarName,
-        DevName,
-        ConstantInt::get(IntTy, 0), // HostGV->isExternalLinkage()),
-        ConstantInt::get(VarSizeTy, VarSize),
-        ConstantInt::get(IntTy, HostGV->isConstant()),
-        ConstantInt::get(IntTy, 0)};
-
-    LLVM_DEBUG(dbgs() << "\t\t\thost global '" << HostGV->getName().str()
-                      << "' to device '" << DevVarName << "'.\n");
-    B.CreateCall(RegisterVarFn, Args);
+/// Return true if launches can use variants of the module's kernels that
+/// the runtime compiles from its PTX (see the kitsune::specialize
+/// attribute).  A variant is loaded as a module of its own, with its own
+/// copies of the device-side globals, so the kernels of modules with
+/// mutable globals (host globals, the device log and the persistent
+/// worker's state) and of relocatable device code are not specialized.
+bool CudaABI::canSpecializeKernels() {
+  if (!HasSpecializedLaunches || RelocatableDeviceCode)
+    return false;
+  for (GlobalVariable &GV : KernelModule.globals()) {
+    // Shared memory (address space 3) is private to each block anyway.
+    if (GV.isConstant() || GV.getAddressSpace() == 3 ||
+        GV.getName().starts_with("llvm."))
+      continue;
+    LLVM_DEBUG(dbgs() << "\t- not specializing kernels (global '"
+                      << GV.getName() << "').\n");
+    return false;
   }
+  return true;
+}
+
+/// Embed the PTX of the kernel module in the host module as a null
+/// terminated string for the runtime to compile specialized kernels
+/// from.
+GlobalVariable *CudaABI::embedPTX(StringRef PTXFileName) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> PTXBufferOrErr =
+      MemoryBuffer::getFile(PTXFileName);
+  if (std::error_code EC = PTXBufferOrErr.getError())
+    report_fatal_error("cuabi: failed to load PTX file: " +
+                       StringRef(EC.message()));
+  Constant *PTXCS = ConstantDataArray::getString(
+      M.getContext(), (*PTXBufferOrErr)->getBuffer());
+  auto *PTXGV = new GlobalVariable(M, PTXCS->getType(), true,
+                                   GlobalValue::PrivateLinkage, PTXCS,
+                                   CUABI_PREFIX + ".ptx");
+  PTXGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return PTXGV;
 }
 
 Function *CudaABI::createCtor(GlobalVariable *Fatbinary,
@@ -1759,16 +4110,15 @@ Function *CudaABI::createCtor(GlobalVariable *Fatbinary,
   BasicBlock *CtorEntryBB = BasicBlock::Create(Ctx, "entry", CtorFn);
   IRBuilder<> CtorBuilder(CtorEntryBB);
   const DataLayout &DL = M.getDataLayout();
+  guardMultiTargetCtor(CtorBuilder, MultiTargetKind::Cuda);
 
   FunctionCallee KitRTSetDefaultMaxTheadsPerBlockFn = M.getOrInsertFunction(
       "__kitcuda_set_default_threads_per_blk", VoidTy, IntTy);
   CtorBuilder.CreateCall(KitRTSetDefaultMaxTheadsPerBlockFn,
                          {ConstantInt::get(IntTy, MaxThreadsPerBlock)});
 
-  FunctionCallee KitCudaInitFn =
-      M.getOrInsertFunction("__kitcuda_initialize", VoidTy);
-  CtorBuilder.CreateCall(KitCudaInitFn, {});
-
+  // The launch mode and policy are set ahead of initialization, which
+  // applies the environment's settings (if any) over them.
   FunctionCallee KitCudaOccLaunchFn =
       M.getOrInsertFunction("__kitcuda_use_occupancy_launch", VoidTy, BoolTy);
   Value *EnableOccLaunches;
@@ -1778,6 +4128,59 @@ Function *CudaABI::createCtor(GlobalVariable *Fatbinary,
     EnableOccLaunches = ConstantInt::get(BoolTy, 0);
   CtorBuilder.CreateCall(KitCudaOccLaunchFn, {EnableOccLaunches});
 
+  if (int Policy = getMigratePolicy(); Policy >= 0) {
+    FunctionCallee SetMigratePolicyFn = M.getOrInsertFunction(
+        "__kitcuda_set_migrate_policy", VoidTy, IntTy);
+    CtorBuilder.CreateCall(SetMigratePolicyFn,
+                           {ConstantInt::get(IntTy, Policy)});
+  }
+
+  // With asynchronous initialization the driver and context setup
+  // overlaps with the program's startup; the runtime waits for it on
+  // the first allocation or launch.
+  FunctionCallee KitCudaInitFn = M.getOrInsertFunction(
+      AsyncInit ? "__kitcuda_initialize_async" : "__kitcuda_initialize",
+      VoidTy);
+  CtorBuilder.CreateCall(KitCudaInitFn, {});
+
+  // The strings of the device log records must be registered before the
+  // module is loaded.
+  if (!LogStrings.empty()) {
+    SmallVector<Constant *, 8> Strings;
+    for (const std::string &Str : LogStrings)
+      Strings.push_back(tapir::createConstantStr(Str, M, CUABI_PREFIX + ".log"));
+    ArrayType *ListTy = ArrayType::get(VoidPtrTy, Strings.size());
+    GlobalVariable *StringList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Strings), CUABI_PREFIX + ".log_strings");
+    FunctionCallee RegisterLogFn = M.getOrInsertFunction(
+        "__kitcuda_register_log_strings", VoidTy,
+        VoidPtrTy,  // fat binary
+        VoidPtrTy,  // device log symbol name
+        VoidPtrTy,  // strings
+        IntTy);     // number of strings
+    CtorBuilder.CreateCall(
+        RegisterLogFn,
+        {CtorBuilder.CreateBitCast(Fatbinary, VoidPtrTy),
+         tapir::createConstantStr(getDeviceLogName(), M,
+                                  CUABI_PREFIX + ".log_name"),
+         StringList, ConstantInt::get(IntTy, Strings.size())});
+  }
+
+  // Likewise the device heap's global, which the runtime sets when it
+  // loads the module.
+  if (DeviceHeap) {
+    FunctionCallee RegisterHeapFn = M.getOrInsertFunction(
+        "__kitcuda_register_heap", VoidTy,
+        VoidPtrTy,  // fat binary
+        VoidPtrTy); // device heap symbol name
+    CtorBuilder.CreateCall(
+        RegisterHeapFn,
+        {CtorBuilder.CreateBitCast(Fatbinary, VoidPtrTy),
+         tapir::createConstantStr(getDeviceHeapName(), M,
+                                  CUABI_PREFIX + ".heap_name")});
+  }
+
   // TODO: The parameters to the CUDA registration calls can be opaque about
   // specifics (e.g., types).  Once we sort out some details we should clean
   // this up.
@@ -1798,41 +4201,114 @@ Function *CudaABI::createCtor(GlobalVariable *Fatbinary,
   //
   // void __cudaRegisterFatBinaryEnd(void **fatCubinHandle);
   //
-  FunctionCallee RegisterFatbinaryFn =
-      M.getOrInsertFunction("__cudaRegisterFatBinary",
-                            FunctionType::get(VoidPtrPtrTy, // cubin handle.
-                                              VoidPtrTy, // fat bin device txt.
-                                              false));
-  CallInst *RegFatbin = CtorBuilder.CreateCall(
-      RegisterFatbinaryFn, CtorBuilder.CreateBitCast(Wrapper, VoidPtrTy));
-
   GlobalVariable *Handle = new GlobalVariable(
       M, VoidPtrPtrTy, false, GlobalValue::InternalLinkage,
       ConstantPointerNull::get(VoidPtrPtrTy), CUABI_PREFIX + ".fbhand");
   Handle->setAlignment(Align(DL.getPointerABIAlignment(0)));
-  CtorBuilder.CreateAlignedStore(RegFatbin, Handle,
-                                 DL.getPointerABIAlignment(0));
-  Handle->setUnnamedAddr(GlobalValue::UnnamedAddr::None);
-
-  Value *HandlePtr = CtorBuilder.CreateLoad(VoidPtrPtrTy, Handle,
-                                            CUABI_PREFIX + ".fbhand.ptr");
-
-  // TODO: It is not 100% clear what calls we actually need to make here for
-  // kernel, variable, etc. registration with CUDA.  Clang makes these calls but
-  // we are targeting CUDA driver API entry points via the Kitsune runtime
-  // library so these calls are potentially unneeded...
-  if (!GlobalVars.empty()) {
-    LLVM_DEBUG(dbgs() << "\t\tbinding host and device global variables...\n");
-    bindGlobalVariables(HandlePtr, CtorBuilder);
-  }
-
-  // Wrap up fatbinary registration steps...
-  FunctionCallee EndFBRegistrationFn =
-      M.getOrInsertFunction("__cudaRegisterFatBinaryEnd",
-                            FunctionType::get(VoidTy,
-                                              VoidPtrPtrTy, // cubin handle.
-                                              false));
-  CtorBuilder.CreateCall(EndFBRegistrationFn, RegFatbin);
+  if (RelocatableDeviceCode) {
+    // Relocatable device code is not registered with the CUDA runtime
+    // (that requires the nvcc device link); the kitsune runtime links
+    // the images of all modules itself.
+    FunctionCallee RegisterRDCFn = M.getOrInsertFunction(
+        "__kitcuda_register_rdc_module", VoidTy, VoidPtrTy);
+    CtorBuilder.CreateCall(RegisterRDCFn,
+                           CtorBuilder.CreateBitCast(Fatbinary, VoidPtrTy));
+  } else {
+    FunctionCallee RegisterFatbinaryFn =
+        M.getOrInsertFunction("__cudaRegisterFatBinary",
+                              FunctionType::get(VoidPtrPtrTy, // cubin handle.
+                                                VoidPtrTy, // fat bin device txt.
+                                                false));
+    CallInst *RegFatbin = CtorBuilder.CreateCall(
+        RegisterFatbinaryFn, CtorBuilder.CreateBitCast(Wrapper, VoidPtrTy));
+
+    CtorBuilder.CreateAlignedStore(RegFatbin, Handle,
+                                   DL.getPointerABIAlignment(0));
+    Handle->setUnnamedAddr(GlobalValue::UnnamedAddr::None);
+
+    // NOTE: Unlike clang we do not register (__cudaRegisterVar) the
+    // device-side copies of host globals.  They are packed into a single
+    // block that the kitsune runtime updates via the CUDA driver API (see
+    // packGlobalVariables()).
+
+    // Wrap up fatbinary registration steps...
+    FunctionCallee EndFBRegistrationFn =
+        M.getOrInsertFunction("__cudaRegisterFatBinaryEnd",
+                              FunctionType::get(VoidTy,
+                                                VoidPtrPtrTy, // cubin handle.
+                                                false));
+    CtorBuilder.CreateCall(EndFBRegistrationFn, RegFatbin);
+  }
+
+  // Give the runtime the chance to load the module and resolve its
+  // kernels in the background (see __kitcuda_preload_module()) instead
+  // of within the first launch of each kernel.  Relocatable code is not
+  // preloaded: its device link must wait for the constructors of all
+  // modules.
+  if (PreloadModules && !RelocatableDeviceCode && !KernelLaunches.empty()) {
+    SmallVector<Constant *, 8> Names, Handles;
+    for (auto &KL : KernelLaunches) {
+      Names.push_back(ConstantExpr::getPointerCast(KL.first, VoidPtrTy));
+      Handles.push_back(KL.second);
+    }
+    ArrayType *ListTy = ArrayType::get(VoidPtrTy, KernelLaunches.size());
+    GlobalVariable *NameList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Names), CUABI_PREFIX + ".kernel_names");
+    GlobalVariable *HandleList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Handles), CUABI_PREFIX + ".kernel_handles");
+    FunctionCallee PreloadFn = M.getOrInsertFunction(
+        "__kitcuda_preload_module", VoidTy,
+        VoidPtrTy,  // fat binary
+        VoidPtrTy,  // kernel names
+        VoidPtrTy,  // kernel launch handles
+        IntTy);     // number of kernels
+    CtorBuilder.CreateCall(
+        PreloadFn,
+        {CtorBuilder.CreateBitCast(Fatbinary, VoidPtrTy), NameList, HandleList,
+         ConstantInt::get(IntTy, KernelLaunches.size())});
+  }
+
+  // Tell the runtime which kernels the module's persistent worker can
+  // run and how to pack their arguments into a work item: each layout
+  // is the number of arguments followed by the offset and size of each.
+  if (!PersistentKernels.empty()) {
+    SmallVector<Constant *, 8> Names, Layouts;
+    for (unsigned K = 0; K < PersistentKernels.size(); ++K) {
+      Names.push_back(
+          ConstantExpr::getPointerCast(PersistentKernels[K].first, VoidPtrTy));
+      SmallVector<uint32_t, 16> Layout;
+      Layout.push_back(PersistentArgLayouts[K].size() / 2);
+      Layout.append(PersistentArgLayouts[K].begin(),
+                    PersistentArgLayouts[K].end());
+      Constant *LayoutCA = ConstantDataArray::get(Ctx, Layout);
+      Layouts.push_back(new GlobalVariable(
+          M, LayoutCA->getType(), true, GlobalValue::PrivateLinkage, LayoutCA,
+          CUABI_PREFIX + ".pk_layout"));
+    }
+    ArrayType *ListTy = ArrayType::get(VoidPtrTy, PersistentKernels.size());
+    GlobalVariable *NameList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Names), CUABI_PREFIX + ".pk_names");
+    GlobalVariable *LayoutList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Layouts), CUABI_PREFIX + ".pk_layouts");
+    FunctionCallee RegisterPKFn = M.getOrInsertFunction(
+        "__kitcuda_register_persistent_kernels", VoidTy,
+        VoidPtrTy,  // fat binary
+        VoidPtrTy,  // worker kernel name
+        VoidPtrTy,  // kernel names
+        VoidPtrTy,  // argument layouts
+        IntTy);     // number of kernels
+    CtorBuilder.CreateCall(
+        RegisterPKFn,
+        {CtorBuilder.CreateBitCast(Fatbinary, VoidPtrTy),
+         tapir::createConstantStr(getPersistentWorkerName(), M,
+                                  CUABI_PREFIX + ".pk_worker"),
+         NameList, LayoutList,
+         ConstantInt::get(IntTy, PersistentKernels.size())});
+  }
 
   // Now add a Dtor to help us clean up at program exit...
   if (Function *CleanupFn = createDtor(Handle)) {
@@ -1866,9 +4342,20 @@ Function *CudaABI::createDtor(GlobalVariable *FBHandle) {
   // TODO: Do we call into this too many times???
   BasicBlock *DtorEntryBB = BasicBlock::Create(Ctx, "entry", DtorFn);
   IRBuilder<> DtorBuilder(DtorEntryBB);
-  Value *HandleValue = DtorBuilder.CreateAlignedLoad(
-      VoidPtrPtrTy, FBHandle, DL.getPointerABIAlignment(0));
-  DtorBuilder.CreateCall(UnregisterFatbinFn, HandleValue);
+  if (!RelocatableDeviceCode) {
+    Value *HandleValue = DtorBuilder.CreateAlignedLoad(
+        VoidPtrPtrTy, FBHandle, DL.getPointerABIAlignment(0));
+    DtorBuilder.CreateCall(UnregisterFatbinFn, HandleValue);
+  }
+
+  if (GlobalBlockHandle) {
+    FunctionCallee KitCudaDestroyGlobalsFn =
+        M.getOrInsertFunction("__kitcuda_destroy_globals", VoidTy, VoidPtrTy);
+    DtorBuilder.CreateCall(
+        KitCudaDestroyGlobalsFn,
+        DtorBuilder.CreateAlignedLoad(VoidPtrTy, GlobalBlockHandle,
+                                      DL.getPointerABIAlignment(0)));
+  }
 
   FunctionCallee KitRTDestroyFn =
       M.getOrInsertFunction("__kitcuda_destroy", VoidTy);
@@ -1959,28 +4446,199 @@ void CudaABI::registerFatbinary(GlobalVariable *Fatbinary) {
   }
 }
 
+// Return the key for the fat binary cache: a hash of the (linked) kernel
+// module along with everything else that feeds device code generation --
+// the target architectures, optimization level, PTX version, and the
+// versions of LLVM and the CUDA tools.
+std::string CudaABI::getFatbinaryCacheKey() {
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(KernelModule, OS);
+
+  MD5 Hash;
+  Hash.update(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(Bitcode.data()), Bitcode.size()));
+  for (const std::string &Arch : getTargetGPUArchs())
+    Hash.update(Arch + ";");
+  Hash.update("O" + utostr(OptLevel) + ";");
+  Hash.update(PTXVersionFromCudaVersion() + ";");
+  Hash.update(EmbedPTXInFatbinaries ? "ptx;" : "no-ptx;");
+  Hash.update(RelocatableDeviceCode ? "rdc;" : "no-rdc;");
+  Hash.update(LLVM_VERSION_STRING ";");
+  Hash.update(KITSUNE_CUDA_PTXAS ";");
+  Hash.update(KITSUNE_CUDA_FATBINARY);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  return Result.digest().str().str();
+}
+
+// Return the operands of the launch bounds annotation of the given
+// kernel, or null if it has none.
+static MDNode *getLaunchBounds(NamedMDNode *Annotations, const Function &F) {
+  for (MDNode *Node : Annotations->operands()) {
+    auto *FnMD = dyn_cast<ValueAsMetadata>(Node->getOperand(0));
+    auto *Name = dyn_cast<MDString>(Node->getOperand(1));
+    if (FnMD && FnMD->getValue() == &F && Name &&
+        Name->getString() == "maxntidx")
+      return Node;
+  }
+  return nullptr;
+}
+
+// Return true if the launch bounds of a kernel in the module limit the
+// registers of its threads in a way relaxLaunchBounds() can undo.
+static bool hasRelaxableLaunchBounds(Module &KM, const CudaABI *TT) {
+  NamedMDNode *Annotations = KM.getNamedMetadata("nvvm.annotations");
+  if (!Annotations)
+    return false;
+  for (Function &F : KM) {
+    MDNode *Bounds = getLaunchBounds(Annotations, F);
+    if (!Bounds)
+      continue;
+    if (Bounds->getNumOperands() > 3)
+      return true; // minctasm
+    auto *MaxThreads = mdconst::extract<ConstantInt>(Bounds->getOperand(2));
+    if (!TT->hasPinnedLaunchBounds(F.getName()) &&
+        MaxThreads->getZExtValue() > CUDAABI_FULL_REGISTER_THREADS_PER_BLOCK)
+      return true;
+  }
+  return false;
+}
+
+// Relax the launch bounds of the kernels in the module whose spills
+// exceed -cuabi-spill-threshold: the minimum number of resident blocks
+// is dropped and the maximum threads per block of a kernel without a
+// launch attribute is lowered so ptxas may use the full register file
+// of a thread.  Returns true if any launch bounds changed.
+bool CudaABI::relaxLaunchBounds(Module &KM,
+                                const StringMap<unsigned> &SpillBytes) {
+  NamedMDNode *Annotations = KM.getNamedMetadata("nvvm.annotations");
+  if (!Annotations)
+    return false;
+  LLVMContext &Ctx = KM.getContext();
+  bool Changed = false;
+  for (unsigned i = 0, e = Annotations->getNumOperands(); i < e; ++i) {
+    MDNode *Bounds = Annotations->getOperand(i);
+    auto *FnMD = dyn_cast<ValueAsMetadata>(Bounds->getOperand(0));
+    auto *Name = dyn_cast<MDString>(Bounds->getOperand(1));
+    if (!FnMD || !Name || Name->getString() != "maxntidx")
+      continue;
+    StringRef KernelName = FnMD->getValue()->getName();
+    unsigned Spills = SpillBytes.lookup(KernelName);
+    if (Spills <= SpillThreshold)
+      continue;
+    unsigned MaxThreads =
+        mdconst::extract<ConstantInt>(Bounds->getOperand(2))->getZExtValue();
+    unsigned RelaxedThreads = MaxThreads;
+    if (!hasPinnedLaunchBounds(KernelName))
+      RelaxedThreads =
+          std::min(MaxThreads, CUDAABI_FULL_REGISTER_THREADS_PER_BLOCK);
+    if (RelaxedThreads == MaxThreads && Bounds->getNumOperands() == 3)
+      continue;
+    Metadata *Relaxed[] = {
+        Bounds->getOperand(0), Bounds->getOperand(1),
+        ValueAsMetadata::get(
+            ConstantInt::get(Type::getInt32Ty(Ctx), RelaxedThreads))};
+    Annotations->setOperand(i, MDNode::get(Ctx, Relaxed));
+    if (Verbose)
+      errs() << "cuabi: kernel '" << KernelName << "' spills " << Spills
+             << " bytes; generating it again with relaxed launch bounds ("
+             << RelaxedThreads << " threads per block).\n";
+    Changed = true;
+  }
+  return Changed;
+}
+
+// Return the kernels (rather than device functions) of the module.
+static SmallVector<Function *, 8> getKernels(Module &KM) {
+  SmallVector<Function *, 8> Kernels;
+  NamedMDNode *Annotations = KM.getNamedMetadata("nvvm.annotations");
+  if (!Annotations)
+    return Kernels;
+  for (MDNode *Node : Annotations->operands()) {
+    auto *FnMD = dyn_cast<ValueAsMetadata>(Node->getOperand(0));
+    auto *Name = dyn_cast<MDString>(Node->getOperand(1));
+    if (FnMD && Name && Name->getString() == "kernel")
+      if (auto *F = dyn_cast<Function>(FnMD->getValue()))
+        if (!F->isDeclaration())
+          Kernels.push_back(F);
+  }
+  return Kernels;
+}
+
+// The private arrays of a kernel (e.g., a small array declared in the
+// body of a forall) are placed in the thread's local memory unless all
+// of their accesses end up with constant indices.  Before the kernels
+// are optimized, the loops that index them are marked for full
+// unrolling so that SROA can promote them to registers.
+static void markPrivateArrayLoops(Module &KM) {
+  for (Function *F : getKernels(KM)) {
+    unsigned NumMarked =
+        tapir::markGPUPrivateArrayLoops(*F, PrivateArrayMaxBytes);
+    if (NumMarked)
+      LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << F->getName()
+                        << "' unrolls " << NumMarked
+                        << " loops over private arrays.\n");
+  }
+}
+
+// Move the private arrays that remain in the optimized kernels into
+// per-thread slices of shared memory, sized for the kernel's launch
+// bounds.  A kernel without launch bounds is bounded by
+// -cuabi-max-threads-per-blk threads per block.  What is left in local
+// memory is reported with remarks (-Rpass-missed=cuabi).
+static void promotePrivateArrays(Module &KM) {
+  NamedMDNode *Annotations = KM.getNamedMetadata("nvvm.annotations");
+  if (!Annotations)
+    return;
+  tapir::GPUReductionHooks Hooks;
+  Hooks.ThreadIdx = [&KM](IRBuilder<> &B) -> Value * {
+    auto Read = [&](Intrinsic::ID ID) {
+      return B.CreateCall(Intrinsic::getDeclaration(&KM, ID));
+    };
+    // The linear index of the thread within its block.
+    Value *TidYZ = B.CreateAdd(
+        Read(Intrinsic::nvvm_read_ptx_sreg_tid_y),
+        B.CreateMul(Read(Intrinsic::nvvm_read_ptx_sreg_ntid_y),
+                    Read(Intrinsic::nvvm_read_ptx_sreg_tid_z)));
+    return B.CreateAdd(Read(Intrinsic::nvvm_read_ptx_sreg_tid_x),
+                       B.CreateMul(Read(Intrinsic::nvvm_read_ptx_sreg_ntid_x),
+                                   TidYZ));
+  };
+
+  LLVMContext &Ctx = KM.getContext();
+  for (Function *F : getKernels(KM)) {
+    if (none_of(F->getEntryBlock(),
+                [](Instruction &I) { return isa<AllocaInst>(I); }))
+      continue;
+    MDNode *Bounds = getLaunchBounds(Annotations, *F);
+    unsigned MaxThreads =
+        Bounds ? mdconst::extract<ConstantInt>(Bounds->getOperand(2))
+                     ->getZExtValue()
+               : unsigned(MaxThreadsPerBlock);
+    OptimizationRemarkEmitter ORE(F);
+    uint64_t SharedBytes = tapir::promoteGPUPrivateArrays(
+        *F, Hooks, MaxThreads, PrivateArraySharedBytes, ORE, DEBUG_TYPE);
+    if (SharedBytes == 0)
+      continue;
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << F->getName()
+                      << "' keeps its private arrays in shared memory ("
+                      << SharedBytes << " bytes).\n");
+    if (!Bounds)
+      Annotations->addOperand(MDNode::get(
+          Ctx, {ValueAsMetadata::get(F), MDString::get(Ctx, "maxntidx"),
+                ValueAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx),
+                                                      MaxThreads))}));
+  }
+}
+
 CudaABIOutputFile CudaABI::generatePTX() {
+  TimeTraceScope TTS("CudaABI::generatePTX", KernelModule.getName());
 
   LLVM_DEBUG(dbgs() << "\t- generating PTX...\n");
   LLVM_DEBUG(saveModuleToFile(&KernelModule, KernelModule.getName().str() +
                                                  ".post.preopt.ll"));
 
-  // Take the intermediate form code in the kernel module and
-  // generate a PTX file.  The PTX file will be named the same as
-  // the original input source module (M) with the extension changed
-  // to PTX.
-  std::string ModelPTXFileName =
-      std::string(CUABI_PREFIX) + "%%-%%-%%_" + KernelModule.getName().str();
-  SmallString<1024> PTXFileName;
-  sys::fs::createUniquePath(ModelPTXFileName.c_str(), PTXFileName, true);
-  sys::path::replace_extension(PTXFileName, ".ptx");
-
-  std::error_code EC;
-  std::unique_ptr<ToolOutputFile> PTXFile;
-  PTXFile = std::make_unique<ToolOutputFile>(PTXFileName, EC,
-                                             sys::fs::OpenFlags::OF_None);
-  PTXFile->keep();
-
   KernelModule.addModuleFlag(llvm::Module::Override, "nvvm-reflect-ftz", true);
 
   if (OptLevel > 0) {
@@ -2001,12 +4659,22 @@ CudaABIOutputFile CudaABI::generatePTX() {
     };
     OptimizationLevel optLevel = optLevels[OptLevel];
 
+    NamedRegionTimer NRT("optimizeKernelModule", "Optimize kernel module",
+                         TimerGroupName, TimerGroupDescription,
+                         TimePassesIsEnabled);
+    TimeTraceScope OptTTS("CudaABI::optimizeKernelModule",
+                       KernelModule.getName());
     LoopAnalysisManager lam;
     FunctionAnalysisManager fam;
     CGSCCAnalysisManager cgam;
     ModuleAnalysisManager mam;
-    
-    PassBuilder pb(PTXTargetMachine, pto);
+
+    // The standard instrumentation times (and traces) the passes run
+    // on each kernel.
+    PassInstrumentationCallbacks pic;
+    StandardInstrumentations si(KernelModule.getContext(), false);
+    si.registerCallbacks(pic, &mam);
+    PassBuilder pb(PTXTargetMachine, pto, std::nullopt, &pic);
     pb.registerModuleAnalyses(mam);
     pb.registerCGSCCAnalyses(cgam);
     pb.registerFunctionAnalyses(fam);
@@ -2014,29 +4682,944 @@ CudaABIOutputFile CudaABI::generatePTX() {
     PTXTargetMachine->registerPassBuilderCallbacks(pb, false);
     pb.crossRegisterProxies(lam, fam, cgam, mam);
     
+    if (CodeGenPrivateArrays)
+      markPrivateArrayLoops(KernelModule);
     ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(optLevel);
     mpm.addPass(VerifierPass());
     LLVM_DEBUG(dbgs() << "\t\t* module: " << KernelModule.getName() << "\n");
     mpm.run(KernelModule, mam);
+    if (CodeGenPrivateArrays)
+      promotePrivateArrays(KernelModule);
     LLVM_DEBUG(dbgs() << "\t\tpasses complete.\n");
     LLVM_DEBUG(saveModuleToFile(&KernelModule, KernelModule.getName().str() +
                                                    ".postopt.LTO.ll"));
   }
 
+  // Code generation changes the module, so kernels that may need to be
+  // generated again (see relaxLaunchBounds()) start from a copy.
+  if (SpillThreshold > 0 && hasRelaxableLaunchBounds(KernelModule, this))
+    SpillRetryModule = CloneModule(KernelModule);
+  return emitPTX(KernelModule);
+}
+
+// Return the key of a kernel's parameter in the refined access modes of
+// the kernel arguments.
+static std::string getKernelArgAccessKey(StringRef KernelName,
+                                         unsigned ArgNo) {
+  return (KernelName + " " + Twine(ArgNo)).str();
+}
+
+// The access modes passed to the runtime for the pointer arguments of
+// the launches are found before the kernels are optimized.  Refine them
+// with what the optimized kernels do with their parameters: the data of
+// an argument the kernel no longer accesses (e.g., an optional array
+// that is only tested for null, or whose uses were folded away) is not
+// mapped or prefetched at all, and data the kernel only reads is
+// treated (and advised) as read-only.
+//
+// The refinement of a read-write mode is recorded in Accesses for each
+// kernel parameter (see getKernelArgAccessKey()) so that it can be cached
+// with the kernels' fat binary and reused when the module is not
+// optimized again.
+void CudaABI::findKernelArgAccesses(StringMap<unsigned> &Accesses) {
+  for (KernelArgAccessInfo &Info : KernelArgAccesses) {
+    Function *KF = KernelModule.getFunction(Info.KernelName);
+    if (!KF || KF->isDeclaration() || Info.ArgNo >= KF->arg_size())
+      continue;
+    Accesses[getKernelArgAccessKey(Info.KernelName, Info.ArgNo)] =
+        tapir::refineKernelArgAccess(tapir::KernelArgReadWrite,
+                                     KF->getArg(Info.ArgNo));
+  }
+}
+
+// Return the access mode of a launch argument, Access, refined with the
+// refinement of a read-write mode for the kernel's parameter, RWAccess.
+static tapir::KernelArgAccess
+applyKernelArgAccess(tapir::KernelArgAccess Access, unsigned RWAccess) {
+  if (RWAccess == tapir::KernelArgNone)
+    return tapir::KernelArgNone;
+  if (Access == tapir::KernelArgReadWrite)
+    return (tapir::KernelArgAccess)RWAccess;
+  return Access;
+}
+
+void CudaABI::refineKernelArgAccesses(const StringMap<unsigned> &Accesses) {
+  Type *Int32Ty = Type::getInt32Ty(M.getContext());
+  for (KernelArgAccessInfo &Info : KernelArgAccesses) {
+    auto It =
+        Accesses.find(getKernelArgAccessKey(Info.KernelName, Info.ArgNo));
+    if (It == Accesses.end() || !Info.Site)
+      continue;
+
+    if (auto *CI = dyn_cast<CallInst>(Info.Site)) {
+      auto *Mode = dyn_cast<ConstantInt>(CI->getArgOperand(1));
+      if (!Mode)
+        continue;
+      auto Access = applyKernelArgAccess(
+          (tapir::KernelArgAccess)Mode->getZExtValue(), It->second);
+      CI->setArgOperand(1, ConstantInt::get(Int32Ty, Access));
+      continue;
+    }
+
+    auto *Table = cast<GlobalVariable>(Info.Site);
+    auto *Modes = cast<ConstantDataArray>(Table->getInitializer());
+    SmallVector<Constant *, 8> Elts;
+    for (unsigned N = 0; N < Modes->getNumElements(); N++)
+      Elts.push_back(Modes->getElementAsConstant(N));
+    auto Access = applyKernelArgAccess(
+        (tapir::KernelArgAccess)Modes->getElementAsInteger(Info.Index),
+        It->second);
+    Elts[Info.Index] = ConstantInt::get(Int32Ty, Access);
+    Table->setInitializer(ConstantArray::get(Modes->getType(), Elts));
+  }
+  KernelArgAccesses.clear();
+}
+
+// The refined access modes are cached as '<kernel> <param> <mode>' lines.
+static bool readKernelArgAccesses(StringRef FileName,
+                                  StringMap<unsigned> &Accesses) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(FileName);
+  if (!Buf)
+    return false;
+  SmallVector<StringRef, 32> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    auto [Key, ModeStr] = Line.rsplit(' ');
+    unsigned Mode;
+    if (ModeStr.trim().getAsInteger(10, Mode) || Mode > tapir::KernelArgNone)
+      return false;
+    Accesses[Key] = Mode;
+  }
+  return true;
+}
+
+static void cacheKernelArgAccesses(const StringMap<unsigned> &Accesses,
+                                   StringRef CacheFileName) {
+  SmallString<255> TmpFileName;
+  int FD;
+  if (sys::fs::createTemporaryFile("cuabi-access", "txt", FD, TmpFileName)) {
+    errs() << "cuabi: warning -- unable to cache kernel argument accesses.\n";
+    return;
+  }
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    for (const auto &Entry : Accesses)
+      OS << Entry.getKey() << " " << Entry.getValue() << "\n";
+  }
+  tapir::cacheGPUBinary(TmpFileName, CacheFileName, "cuabi");
+  sys::fs::remove(TmpFileName);
+}
+
+CudaABIOutputFile CudaABI::emitPTX(Module &KM) {
+  // Take the intermediate form code in the kernel module and
+  // generate a PTX file.  The PTX file will be named the same as
+  // the original input source module (M) with the extension changed
+  // to PTX.
+  std::string ModelPTXFileName =
+      std::string(CUABI_PREFIX) + "%%-%%-%%_" + KM.getName().str();
+  SmallString<1024> PTXFileName;
+  sys::fs::createUniquePath(ModelPTXFileName.c_str(), PTXFileName, true);
+  sys::path::replace_extension(PTXFileName, ".ptx");
+
+  std::error_code EC;
+  std::unique_ptr<ToolOutputFile> PTXFile;
+  PTXFile = std::make_unique<ToolOutputFile>(PTXFileName, EC,
+                                             sys::fs::OpenFlags::OF_None);
+  PTXFile->keep();
+
   // Setup the passes and request that the output goes to the
   // specified PTX file.
   LLVM_DEBUG(dbgs() << "\t- PTX file: '" << PTXFileName << "'.\n");
+  NamedRegionTimer NRT("emitPTX", "Generate PTX", TimerGroupName,
+                       TimerGroupDescription, TimePassesIsEnabled);
+  TimeTraceScope EmitTTS("CudaABI::emitPTX", KM.getName());
   legacy::PassManager PassMgr;
   if (PTXTargetMachine->addPassesToEmitFile(PassMgr, PTXFile->os(), nullptr,
                                             CodeGenFileType::AssemblyFile,
                                             false))
     report_fatal_error("Cuda ABI transform -- PTX generation failed!");
-  PassMgr.run(KernelModule);
+  PassMgr.run(KM);
+  // ptxas reads the file while it is still open here.
+  PTXFile->os().flush();
   LLVM_DEBUG(dbgs() << "\tkernel optimizations and code gen complete.\n\n");
   LLVM_DEBUG(dbgs() << "\t\tPTX file: " << PTXFile->getFilename() << "\n");
   return PTXFile;
 }
 
+const std::string &CudaABI::getRDCSuffix() {
+  // The suffix is computed once, as the module's symbols change as it is
+  // transformed.
+  if (RDCSuffix.empty()) {
+    RDCSuffix = getUniqueModuleId(&M);
+    if (RDCSuffix.empty()) {
+      MD5 Hash;
+      Hash.update(M.getSourceFileName());
+      MD5::MD5Result Result;
+      Hash.final(Result);
+      RDCSuffix = Result.digest().str().str();
+    } else
+      // Drop the leading '.' (see getUniqueModuleId()).
+      RDCSuffix = RDCSuffix.substr(1);
+  }
+  return RDCSuffix;
+}
+
+std::string CudaABI::getGlobalsBlockName() {
+  if (RelocatableDeviceCode)
+    return CUABI_GLOBALS_BLOCK_NAME + "_" + getRDCSuffix();
+  return CUABI_GLOBALS_BLOCK_NAME;
+}
+
+std::string CudaABI::getPersistentWorkerName() {
+  std::string Name = CUABI_PREFIX + "_pk_worker";
+  if (RelocatableDeviceCode)
+    return Name + "_" + getRDCSuffix();
+  return Name;
+}
+
+std::string CudaABI::getDeviceLogName() {
+  if (RelocatableDeviceCode)
+    return CUABI_DEVICE_LOG_NAME + "_" + getRDCSuffix();
+  return CUABI_DEVICE_LOG_NAME;
+}
+
+std::string CudaABI::getDeviceHeapName() {
+  if (RelocatableDeviceCode)
+    return CUABI_DEVICE_HEAP_NAME + "_" + getRDCSuffix();
+  return CUABI_DEVICE_HEAP_NAME;
+}
+
+GlobalVariable *CudaABI::getDeviceHeapGlobal() {
+  if (DeviceHeap)
+    return DeviceHeap;
+  // The runtime sets the global to the location of the device's heap
+  // when it loads the module (see __kitcuda_heap_attach_module()); it
+  // stays null if the heap is disabled.
+  PointerType *PtrTy = PointerType::getUnqual(KernelModule.getContext());
+  DeviceHeap = new GlobalVariable(
+      KernelModule, PtrTy, /* isConstant */ false,
+      GlobalValue::ExternalLinkage, ConstantPointerNull::get(PtrTy),
+      getDeviceHeapName(), (GlobalVariable *)nullptr,
+      GlobalValue::NotThreadLocal);
+  DeviceHeap->setAlignment(Align(8));
+  return DeviceHeap;
+}
+
+unsigned CudaABI::getLogStringID(StringRef Str) {
+  auto It = LogStringIDs.try_emplace(Str, LogStrings.size());
+  if (It.second)
+    LogStrings.push_back(Str.str());
+  return It.first->second;
+}
+
+GlobalVariable *CudaABI::getDeviceLogGlobal() {
+  if (DeviceLog)
+    return DeviceLog;
+  // The runtime sets the global when it loads the module (see
+  // __kitcuda_log_attach_module()); it stays null if logging is
+  // disabled.
+  LLVMContext &Ctx = KernelModule.getContext();
+  StructType *LogTy = StructType::get(PointerType::getUnqual(Ctx),
+                                      Type::getInt64Ty(Ctx));
+  DeviceLog = new GlobalVariable(
+      KernelModule, LogTy, /* isConstant */ false,
+      GlobalValue::ExternalLinkage, Constant::getNullValue(LogTy),
+      getDeviceLogName(), (GlobalVariable *)nullptr,
+      GlobalValue::NotThreadLocal);
+  DeviceLog->setAlignment(Align(8));
+  return DeviceLog;
+}
+
+// The device functions that are provided by the CUDA tools (and
+// libdevice's reflection calls, resolved when generating PTX).
+static bool isCudaDeviceRuntimeFunction(StringRef Name) {
+  return Name == "vprintf" || Name == "malloc" || Name == "free" ||
+         Name == "__assertfail" || Name.starts_with("__nvvm_");
+}
+
+// With relocatable device code the kernels of other modules may call the
+// functions defined in this one.  Add a device-side version of each of
+// the module's externally visible functions whose code (and the code it
+// calls) can run on the device to the kernel module.  Calls to functions
+// that are not defined in the module are left to the device link.
+void CudaABI::addRelocatableDeviceFunctions() {
+  TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+  TargetLibraryInfo TLI(TLII);
+  std::unique_ptr<Module> &LDM = getLibDeviceModule();
+  const std::string NVPrefix = "__nv_";
+
+  auto IsDeviceValue = [&](GlobalValue *GV) {
+    if (auto *GVar = dyn_cast<GlobalVariable>(GV))
+      return GVar->isConstant() && GVar->hasDefinitiveInitializer();
+    Function *F = dyn_cast<Function>(GV);
+    if (!F)
+      return false;
+    if (F->isIntrinsic())
+      return !F->isTargetIntrinsic();
+    if (F->isDeclaration()) {
+      // Library functions are only available through libdevice.
+      LibFunc LF;
+      return !TLI.getLibFunc(*F, LF) ||
+             LDM->getFunction(NVPrefix + F->getName().str());
+    }
+    if (F->isVarArg() || F->hasPersonalityFn())
+      return false;
+    for (Instruction &I : instructions(F)) {
+      if (isa<DetachInst>(I) || isa<ReattachInst>(I) || isa<SyncInst>(I))
+        return false;
+      if (auto *CB = dyn_cast<CallBase>(&I))
+        if (CB->isInlineAsm() || !CB->getCalledFunction())
+          return false;
+    }
+    return true;
+  };
+
+  std::set<GlobalValue *> UsedGlobalValues;
+  for (Function &F : M) {
+    if (F.isDeclaration() || !F.hasExternalLinkage() || F.getName() == "main")
+      continue;
+    if (Function *DeviceF = KernelModule.getFunction(F.getName()))
+      if (!DeviceF->isDeclaration())
+        continue;
+    std::set<GlobalValue *> FnGlobalValues;
+    collect(F, FnGlobalValues);
+    if (llvm::all_of(FnGlobalValues, IsDeviceValue))
+      UsedGlobalValues.insert(FnGlobalValues.begin(), FnGlobalValues.end());
+  }
+  if (UsedGlobalValues.empty())
+    return;
+
+  ValueToValueMapTy VMap;
+  for (GlobalValue *V : UsedGlobalValues)
+    if (auto *GV = dyn_cast<GlobalVariable>(V)) {
+      std::string Name = GV->getName().str() + "_devvar";
+      std::replace(Name.begin(), Name.end(), '.', '_');
+      GlobalVariable *NewGV = KernelModule.getNamedGlobal(Name);
+      if (!NewGV) {
+        NewGV = new GlobalVariable(
+            KernelModule, GV->getValueType(), /* isConstant*/ true,
+            GlobalValue::InternalLinkage, GV->getInitializer(), Name);
+        NewGV->setAlignment(GV->getAlign());
+      }
+      VMap[GV] = NewGV;
+    }
+
+  SmallVector<Function *, 16> NewFunctions;
+  for (GlobalValue *V : UsedGlobalValues) {
+    auto *F = dyn_cast<Function>(V);
+    if (!F)
+      continue;
+    Function *DeviceF = KernelModule.getFunction(F->getName());
+    if (DeviceF && !DeviceF->isDeclaration()) {
+      VMap[F] = DeviceF;
+      continue;
+    }
+    if (F->isDeclaration() && !F->isIntrinsic())
+      if (Function *LF = LDM->getFunction(NVPrefix + F->getName().str()))
+        if (LF->getFunctionType() == F->getFunctionType()) {
+          VMap[F] = KernelModule.getOrInsertFunction(LF->getName(),
+                                                     LF->getFunctionType())
+                        .getCallee();
+          continue;
+        }
+    if (!DeviceF)
+      DeviceF = Function::Create(F->getFunctionType(), F->getLinkage(),
+                                 F->getName(), KernelModule);
+    VMap[F] = DeviceF;
+    if (!F->isDeclaration())
+      NewFunctions.push_back(F);
+  }
+
+  for (Function *F : NewFunctions) {
+    Function *DeviceF = cast<Function>(VMap[F]);
+    for (size_t i = 0; i < F->arg_size(); i++)
+      VMap[F->getArg(i)] = DeviceF->getArg(i);
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(DeviceF, F, VMap, CloneFunctionChangeType::DifferentModule,
+                      Returns);
+    DeviceF->removeFnAttr("target-cpu");
+    DeviceF->removeFnAttr("target-features");
+    DeviceF->addFnAttr("target-cpu", GPUArch);
+    DeviceF->addFnAttr("target-features",
+                       PTXVersionFromCudaVersion() + "," + GPUArch);
+    LLVM_DEBUG(dbgs() << "cuabi: added relocatable device function '"
+                      << DeviceF->getName() << "'.\n");
+  }
+}
+
+// Give each function that the device code calls, but that has no
+// definition in the kernel module, a weak definition that traps.  The
+// device link resolves the calls to the definitions of other modules;
+// calls of functions without a device-side version only fail if made.
+void CudaABI::addDeviceLinkStubs() {
+  LLVMContext &Ctx = KernelModule.getContext();
+  for (Function &F : KernelModule) {
+    if (!F.isDeclaration() || F.isIntrinsic() || F.use_empty() ||
+        isCudaDeviceRuntimeFunction(F.getName()))
+      continue;
+    F.setLinkage(GlobalValue::WeakAnyLinkage);
+    IRBuilder<> B(BasicBlock::Create(Ctx, "entry", &F));
+    B.CreateCall(Intrinsic::getDeclaration(&KernelModule, Intrinsic::trap));
+    B.CreateUnreachable();
+  }
+}
+
+// Create the module's persistent worker kernel (see
+// -cuabi-persistent-kernels).  The worker runs the work items the
+// runtime pushes onto a queue in host-mapped memory, in order, until
+// the runtime asks it to stop:
+//
+//   for (seq = first_seq;; seq++) {
+//     wait until queue->items[slot(seq)].seq == seq or queue->stop;
+//     copy the item's kernel index and arguments to shared memory;
+//     call the (device function) body of the item's kernel;
+//     wait until every block has finished the item;
+//     the last block to finish sets queue->completed = seq;
+//   }
+//
+// Each kernel's body is a grid-stride loop, so it covers its iteration
+// space with the worker's grid.  The runtime only launches as many
+// blocks as can be resident at once, which the wait for every block
+// of the grid relies on.
+// Kernels outlined from the same source (e.g., the loop of a template
+// that is instantiated for types with the same representation, or a
+// loop in an inlined function) are often identical.  Keep only the
+// first of each set of identical kernels, and have the launches of the
+// others launch it instead, so that it is compiled, assembled, loaded
+// and cached only once.
+void CudaABI::mergeIdenticalKernels() {
+  NamedMDNode *Annotations = KernelModule.getNamedMetadata("nvvm.annotations");
+  if (!Annotations)
+    return;
+
+  // Kernels can only be merged if their annotations (launch bounds,
+  // etc.) are the same.
+  MapVector<Function *, std::string> Signatures;
+  for (MDNode *Node : Annotations->operands()) {
+    auto *FnMD = dyn_cast_or_null<ValueAsMetadata>(Node->getOperand(0));
+    auto *KF = FnMD ? dyn_cast<Function>(FnMD->getValue()) : nullptr;
+    if (!KF)
+      continue;
+    raw_string_ostream OS(Signatures[KF]);
+    for (unsigned Op = 1; Op < Node->getNumOperands(); ++Op) {
+      Node->getOperand(Op)->print(OS, &KernelModule);
+      OS << ";";
+    }
+    OS << "|";
+  }
+  MapVector<StringRef, SmallVector<Function *, 4>> Groups;
+  for (auto &[KF, Signature] : Signatures)
+    Groups[Signature].push_back(KF);
+
+  SmallVector<std::pair<Function *, Function *>, 8> Identical;
+  for (auto &[Signature, Kernels] : Groups)
+    if (Kernels.size() > 1)
+      Identical.append(tapir::findIdenticalFunctions(Kernels));
+  if (Identical.empty())
+    return;
+
+  SmallPtrSet<Function *, 8> Merged;
+  for (auto &[Dup, Keep] : Identical) {
+    StringRef DupName = Dup->getName(), KeepName = Keep->getName();
+    LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << DupName
+                      << "' is identical to '" << KeepName << "'.\n");
+
+    // The host refers to kernels by name; the recorded names are
+    // erased along with the strings naming the duplicate.
+    auto NamesDup = [&](Constant *Name) {
+      StringRef Str;
+      return getConstantStringInfo(Name, Str) && Str == DupName;
+    };
+    SmallVector<unsigned, 4> Launches, Persistent;
+    for (unsigned K = 0; K < KernelLaunches.size(); ++K)
+      if (NamesDup(KernelLaunches[K].first))
+        Launches.push_back(K);
+    for (unsigned K = 0; K < PersistentKernels.size(); ++K)
+      if (NamesDup(PersistentKernels[K].first))
+        Persistent.push_back(K);
+    GlobalVariable *KeepGV =
+        tapir::renameKernelReferences(M, DupName, KeepName);
+    if (KeepGV) {
+      for (unsigned K : Launches)
+        KernelLaunches[K].first = KeepGV;
+      for (unsigned K : Persistent)
+        PersistentKernels[K] = {KeepGV, KeepName.str()};
+    }
+    for (KernelArgAccessInfo &Info : KernelArgAccesses)
+      if (Info.KernelName == DupName)
+        Info.KernelName = KeepName.str();
+    if (hasPinnedLaunchBounds(DupName))
+      pinLaunchBounds(KeepName);
+
+    Merged.insert(Dup);
+  }
+
+  // The worker runs each kernel once.
+  StringSet<> PersistentNames;
+  llvm::erase_if(PersistentKernels, [&](auto &PK) {
+    return !PersistentNames.insert(PK.second).second;
+  });
+
+  SmallVector<MDNode *, 16> Kept;
+  for (MDNode *Node : Annotations->operands()) {
+    auto *FnMD = dyn_cast_or_null<ValueAsMetadata>(Node->getOperand(0));
+    if (!FnMD || !Merged.count(dyn_cast<Function>(FnMD->getValue())))
+      Kept.push_back(Node);
+  }
+  Annotations->clearOperands();
+  for (MDNode *Node : Kept)
+    Annotations->addOperand(Node);
+
+  for (auto &[Dup, Keep] : Identical) {
+    Dup->replaceAllUsesWith(Keep);
+    Dup->eraseFromParent();
+  }
+  LLVM_DEBUG(dbgs() << "\tcuabi: merged " << Identical.size()
+                    << " identical kernels.\n");
+}
+
+void CudaABI::createPersistentWorker() {
+  LLVMContext &Ctx = KernelModule.getContext();
+  const DataLayout &DL = KernelModule.getDataLayout();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  Type *Int8Ty = Type::getInt8Ty(Ctx);
+  PointerType *PtrTy = PointerType::getUnqual(Ctx);
+
+  // Each kernel's arguments are packed into a work item with their
+  // natural alignment.  Kernels with too many arguments keep using
+  // regular launches.
+  SmallVector<Function *, 8> Bodies;
+  SmallVector<std::pair<Constant *, std::string>, 8> Kernels;
+  for (auto &[NameCS, Name] : PersistentKernels) {
+    Function *KF = KernelModule.getFunction(Name);
+    if (!KF || KF->isDeclaration())
+      continue;
+    SmallVector<uint32_t, 16> Layout;
+    uint64_t Offset = 0;
+    for (Argument &A : KF->args()) {
+      Type *Ty = A.hasByValAttr() ? A.getParamByValType() : A.getType();
+      Align ArgAlign = DL.getABITypeAlign(Ty);
+      if (A.hasByValAttr())
+        ArgAlign = A.getParamAlign().value_or(ArgAlign);
+      Offset = alignTo(Offset, ArgAlign);
+      Layout.push_back(Offset);
+      Layout.push_back(DL.getTypeAllocSize(Ty));
+      Offset += DL.getTypeAllocSize(Ty);
+    }
+    if (Offset > CUABI_PK_ARG_BYTES) {
+      LLVM_DEBUG(dbgs() << "\tcuabi: kernel '" << Name << "' has too many "
+                        << "arguments for the persistent worker.\n");
+      continue;
+    }
+    ValueToValueMapTy VMap;
+    Function *Body = CloneFunction(KF, VMap);
+    Body->setName(Name + "_pk");
+    Body->setLinkage(GlobalValue::InternalLinkage);
+    Body->setCallingConv(CallingConv::C);
+    Body->addFnAttr(Attribute::NoInline);
+    Bodies.push_back(Body);
+    Kernels.push_back({NameCS, Name});
+    PersistentArgLayouts.push_back(std::move(Layout));
+  }
+  PersistentKernels = std::move(Kernels);
+  if (PersistentKernels.empty())
+    return;
+
+  Function *Worker = Function::Create(
+      FunctionType::get(VoidTy, {PtrTy, PtrTy, Int64Ty}, false),
+      GlobalValue::ExternalLinkage, getPersistentWorkerName(), KernelModule);
+  Worker->addFnAttr("target-cpu", GPUArch);
+  Worker->addFnAttr("target-features",
+                    PTXVersionFromCudaVersion() + "," + GPUArch);
+  Value *Queue = Worker->getArg(0);
+  Value *Arrivals = Worker->getArg(1);
+  Value *FirstSeq = Worker->getArg(2);
+  Queue->setName("queue");
+  Arrivals->setName("arrivals");
+  FirstSeq->setName("first_seq");
+  NamedMDNode *Annotations =
+      KernelModule.getOrInsertNamedMetadata("nvvm.annotations");
+  Annotations->addOperand(MDNode::get(
+      Ctx, {ValueAsMetadata::get(Worker), MDString::get(Ctx, "kernel"),
+            ValueAsMetadata::get(ConstantInt::get(Int32Ty, 1)),
+            MDString::get(Ctx, "maxntidx"),
+            ValueAsMetadata::get(
+                ConstantInt::get(Int32Ty, CUABI_PK_THREADS_PER_BLOCK))}));
+
+  // The state of the current item (1: ready, 2: stop), its kernel index
+  // and its arguments are staged in shared memory for the whole block.
+  auto CreateShared = [&](Type *Ty, StringRef Name, unsigned Alignment) {
+    auto *GV = new GlobalVariable(KernelModule, Ty, false,
+                                  GlobalValue::InternalLinkage,
+                                  UndefValue::get(Ty), Name, nullptr,
+                                  GlobalValue::NotThreadLocal, 3);
+    GV->setAlignment(Align(Alignment));
+    return GV;
+  };
+  GlobalVariable *SharedState =
+      CreateShared(Int32Ty, CUABI_PREFIX + "_pk_state", 4);
+  GlobalVariable *SharedIndex =
+      CreateShared(Int64Ty, CUABI_PREFIX + "_pk_index", 8);
+  ArrayType *ArgWordsTy = ArrayType::get(Int64Ty, CUABI_PK_ARG_BYTES / 8);
+  GlobalVariable *SharedArgs =
+      CreateShared(ArgWordsTy, CUABI_PREFIX + "_pk_args", 16);
+
+  Function *TidX = Intrinsic::getDeclaration(
+      &KernelModule, Intrinsic::nvvm_read_ptx_sreg_tid_x);
+  Function *NCtaIdX = Intrinsic::getDeclaration(
+      &KernelModule, Intrinsic::nvvm_read_ptx_sreg_nctaid_x);
+  Function *Barrier =
+      Intrinsic::getDeclaration(&KernelModule, Intrinsic::nvvm_barrier0);
+
+  BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Worker);
+  BasicBlock *Loop = BasicBlock::Create(Ctx, "loop", Worker);
+  BasicBlock *Poll = BasicBlock::Create(Ctx, "poll", Worker);
+  BasicBlock *PollStop = BasicBlock::Create(Ctx, "poll.stop", Worker);
+  BasicBlock *PollWait = BasicBlock::Create(Ctx, "poll.wait", Worker);
+  BasicBlock *PollReady = BasicBlock::Create(Ctx, "poll.ready", Worker);
+  BasicBlock *PollExit = BasicBlock::Create(Ctx, "poll.exit", Worker);
+  BasicBlock *Polled = BasicBlock::Create(Ctx, "polled", Worker);
+  BasicBlock *Fetch = BasicBlock::Create(Ctx, "fetch", Worker);
+  BasicBlock *FetchWord = BasicBlock::Create(Ctx, "fetch.word", Worker);
+  BasicBlock *Dispatch = BasicBlock::Create(Ctx, "dispatch", Worker);
+  BasicBlock *Done = BasicBlock::Create(Ctx, "done", Worker);
+  BasicBlock *Arrive = BasicBlock::Create(Ctx, "arrive", Worker);
+  BasicBlock *Last = BasicBlock::Create(Ctx, "last", Worker);
+  BasicBlock *Wait = BasicBlock::Create(Ctx, "wait", Worker);
+  BasicBlock *Next = BasicBlock::Create(Ctx, "next", Worker);
+  BasicBlock *Exit = BasicBlock::Create(Ctx, "exit", Worker);
+
+  IRBuilder<> B(Entry);
+  Value *Tid = B.CreateCall(TidX);
+  Value *IsLeader = B.CreateICmpEQ(Tid, B.getInt32(0), "leader");
+  Value *NumBlocks = B.CreateZExt(B.CreateCall(NCtaIdX), Int64Ty, "nblocks");
+  B.CreateBr(Loop);
+
+  // Sleeping between polls keeps the idle worker from competing with
+  // other kernels for issue slots (sm_70 and newer).
+  auto CreateSleep = [&](IRBuilder<> &B) {
+    if (getSMVersion(GPUArch) >= 70)
+      B.CreateCall(InlineAsm::get(FunctionType::get(VoidTy, {Int32Ty}, false),
+                                  "nanosleep.u32 $0;", "r",
+                                  /*hasSideEffects=*/true),
+                   {B.getInt32(100)});
+  };
+
+  B.SetInsertPoint(Loop);
+  PHINode *Count = B.CreatePHI(Int64Ty, 2, "count");
+  Count->addIncoming(B.getInt64(0), Entry);
+  Value *Seq = B.CreateAdd(FirstSeq, Count, "seq");
+  Value *Slot = B.CreateURem(B.CreateSub(Seq, B.getInt64(1)),
+                             B.getInt64(CUABI_PK_QUEUE_DEPTH), "slot");
+  Value *Item = B.CreateGEP(
+      Int8Ty, Queue,
+      B.CreateAdd(B.getInt64(CUABI_PK_QUEUE_HEADER_BYTES),
+                  B.CreateMul(Slot, B.getInt64(CUABI_PK_ITEM_BYTES))),
+      "item");
+  B.CreateCondBr(IsLeader, Poll, Polled);
+
+  B.SetInsertPoint(Poll);
+  LoadInst *ItemSeq = B.CreateAlignedLoad(Int64Ty, Item, Align(8), true);
+  B.CreateCondBr(B.CreateICmpEQ(ItemSeq, Seq), PollReady, PollStop);
+
+  B.SetInsertPoint(PollStop);
+  LoadInst *Stop = B.CreateAlignedLoad(Int64Ty, Queue, Align(8), true);
+  B.CreateCondBr(B.CreateICmpNE(Stop, B.getInt64(0)), PollExit, PollWait);
+
+  B.SetInsertPoint(PollWait);
+  CreateSleep(B);
+  B.CreateBr(Poll);
+
+  B.SetInsertPoint(PollReady);
+  B.CreateFence(AtomicOrdering::SequentiallyConsistent);
+  B.CreateStore(B.getInt32(1), SharedState);
+  B.CreateBr(Polled);
+
+  B.SetInsertPoint(PollExit);
+  B.CreateStore(B.getInt32(2), SharedState);
+  B.CreateBr(Polled);
+
+  B.SetInsertPoint(Polled);
+  B.CreateCall(Barrier);
+  Value *State = B.CreateLoad(Int32Ty, SharedState, "state");
+  B.CreateCondBr(B.CreateICmpEQ(State, B.getInt32(2)), Exit, Fetch);
+
+  // Thread 0 copies the kernel index and the remaining threads copy a
+  // word of the arguments each.
+  B.SetInsertPoint(Fetch);
+  unsigned NumWords = 1 + CUABI_PK_ARG_BYTES / 8;
+  B.CreateCondBr(B.CreateICmpULT(Tid, B.getInt32(NumWords)), FetchWord,
+                 Dispatch);
+
+  B.SetInsertPoint(FetchWord);
+  Value *Word = B.CreateAlignedLoad(
+      Int64Ty,
+      B.CreateGEP(Int64Ty, B.CreateGEP(Int8Ty, Item, B.getInt64(8)),
+                  B.CreateZExt(Tid, Int64Ty)),
+      Align(8), true, "word");
+  Value *ArgWord = B.CreateGEP(
+      Int64Ty, SharedArgs,
+      B.CreateZExt(B.CreateSub(Tid, B.getInt32(1)), Int64Ty));
+  B.CreateStore(Word, B.CreateSelect(IsLeader, SharedIndex, ArgWord));
+  B.CreateBr(Dispatch);
+
+  B.SetInsertPoint(Dispatch);
+  B.CreateCall(Barrier);
+  Value *Index = B.CreateLoad(Int64Ty, SharedIndex, "index");
+  SwitchInst *Switch = B.CreateSwitch(Index, Done, Bodies.size());
+  Value *Args = ConstantExpr::getAddrSpaceCast(SharedArgs, PtrTy);
+  for (unsigned K = 0; K < Bodies.size(); ++K) {
+    Function *Body = Bodies[K];
+    BasicBlock *Case = BasicBlock::Create(Ctx, "run." + Body->getName(),
+                                          Worker, Done);
+    Switch->addCase(B.getInt64(K), Case);
+    IRBuilder<> CB(Case);
+    SmallVector<Value *, 16> CallArgs;
+    for (Argument &A : Body->args()) {
+      Value *Ptr =
+          CB.CreateConstInBoundsGEP1_64(Int8Ty, Args,
+                                        PersistentArgLayouts[K][2 * A.getArgNo()]);
+      if (A.hasByValAttr())
+        CallArgs.push_back(Ptr);
+      else
+        CallArgs.push_back(CB.CreateLoad(A.getType(), Ptr));
+    }
+    CB.CreateCall(Body, CallArgs);
+    CB.CreateBr(Done);
+  }
+
+  // The item is done once every block has arrived; the arrival count
+  // is never reset while the worker runs.
+  B.SetInsertPoint(Done);
+  B.CreateCall(Barrier);
+  B.CreateCondBr(IsLeader, Arrive, Next);
+
+  B.SetInsertPoint(Arrive);
+  B.CreateFence(AtomicOrdering::SequentiallyConsistent);
+  Value *Arrived = B.CreateAtomicRMW(AtomicRMWInst::Add, Arrivals,
+                                     B.getInt64(1), MaybeAlign(8),
+                                     AtomicOrdering::SequentiallyConsistent);
+  Value *Target = B.CreateMul(B.CreateAdd(Count, B.getInt64(1)), NumBlocks,
+                              "target");
+  B.CreateCondBr(B.CreateICmpEQ(B.CreateAdd(Arrived, B.getInt64(1)), Target),
+                 Last, Wait);
+
+  B.SetInsertPoint(Last);
+  B.CreateAlignedStore(Seq, B.CreateConstInBoundsGEP1_64(Int8Ty, Queue, 8),
+                       Align(8), true);
+  B.CreateFence(AtomicOrdering::SequentiallyConsistent);
+  B.CreateBr(Next);
+
+  B.SetInsertPoint(Wait);
+  LoadInst *Arrivals64 = B.CreateAlignedLoad(Int64Ty, Arrivals, Align(8), true);
+  BasicBlock *WaitSleep = BasicBlock::Create(Ctx, "wait.sleep", Worker, Next);
+  B.CreateCondBr(B.CreateICmpUGE(Arrivals64, Target), Next, WaitSleep);
+  B.SetInsertPoint(WaitSleep);
+  CreateSleep(B);
+  B.CreateBr(Wait);
+
+  B.SetInsertPoint(Next);
+  B.CreateCall(Barrier);
+  Count->addIncoming(B.CreateAdd(Count, B.getInt64(1)), Next);
+  B.CreateBr(Loop);
+
+  B.SetInsertPoint(Exit);
+  B.CreateRetVoid();
+  LLVM_DEBUG(dbgs() << "\tcuabi: persistent worker runs "
+                    << PersistentKernels.size() << " kernels.\n");
+}
+
+bool CudaABI::requiresModulePostProcessing() const {
+  return RelocatableDeviceCode;
+}
+
+// Runtime calls of the launch setup (and the launches themselves) that do
+// not write host memory the program can see.  Writes to the launch's
+// stream and argument allocas are made through stack slots.
+static bool isLaunchSetupCall(const CallBase &CB) {
+  const Function *Callee = CB.getCalledFunction();
+  if (!Callee)
+    return false;
+  if (Callee->isIntrinsic())
+    return !CB.mayWriteToMemory() || isa<LifetimeIntrinsic>(CB);
+  return StringSwitch<bool>(Callee->getName())
+      .Cases("__kitcuda_launch_kernel", "__kitcuda_launch_kernel_nd", true)
+      .Cases("__kitcuda_mem_gpu_map", "__kitcuda_mem_gpu_map_batch", true)
+      .Cases("__kitcuda_mem_gpu_prefetch", "__kitcuda_mem_gpu_prefetch_async",
+             true)
+      .Cases("__kitcuda_mem_host_prefetch", "__kitcuda_mem_reduce_map", true)
+      .Case("__kitcuda_update_globals", true)
+      .Case("__kitcuda_specialize_launch", true)
+      .Default(false);
+}
+
+// Return true if, on every path from First to Second, no instruction
+// other than the launch setup writes host memory the program can see.
+// First must dominate Second.
+static bool onlyLaunchSetupBetween(Instruction *First, Instruction *Second) {
+  auto IsSetup = [](const Instruction &I) {
+    if (const auto *CB = dyn_cast<CallBase>(&I))
+      return isLaunchSetupCall(*CB);
+    if (const auto *SI = dyn_cast<StoreInst>(&I))
+      return !SI->isVolatile() &&
+             isa<AllocaInst>(getUnderlyingObject(SI->getPointerOperand()));
+    return !I.mayWriteToMemory();
+  };
+  auto RangeIsSetup = [&](BasicBlock::iterator Begin,
+                          BasicBlock::iterator End) {
+    return std::all_of(Begin, End, IsSetup);
+  };
+
+  BasicBlock *FirstBB = First->getParent(), *SecondBB = Second->getParent();
+  if (FirstBB == SecondBB && First->comesBefore(Second))
+    return RangeIsSetup(std::next(First->getIterator()), Second->getIterator());
+  if (!RangeIsSetup(std::next(First->getIterator()), FirstBB->end()) ||
+      !RangeIsSetup(SecondBB->begin(), Second->getIterator()))
+    return false;
+
+  // Walk back from Second to First, which dominates it.  Blocks on a
+  // cycle through either end are checked in full.  The walk is bounded
+  // as launch sequences span only a few blocks.
+  const unsigned MaxBlocks = 32;
+  SmallPtrSet<BasicBlock *, 8> Visited;
+  SmallVector<BasicBlock *, 8> Worklist(predecessors(SecondBB));
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (BB == FirstBB && FirstBB != SecondBB)
+      continue;
+    if (!Visited.insert(BB).second)
+      continue;
+    if (Visited.size() > MaxBlocks || !RangeIsSetup(BB->begin(), BB->end()))
+      return false;
+    append_range(Worklist, predecessors(BB));
+  }
+  return true;
+}
+
+// Remove kernel launch setup that repeats the setup of an earlier
+// launch.  Every launch is preceded by a call that updates the device
+// copies of the host globals the kernels use (see finalizeLaunchCalls()).
+// The runtime only copies the values that changed since the last update,
+// so an update that follows another with nothing but launch setup in
+// between has no effect.  The stream reload that follows the update is
+// then redundant as well and is left to the host cleanup pipeline.
+static bool eliminateRedundantLaunchSetup(Function &F) {
+  SmallVector<CallInst *, 8> Updates;
+  for (Instruction &I : instructions(F))
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      if (Function *Callee = CI->getCalledFunction())
+        if (Callee->getName() == "__kitcuda_update_globals")
+          Updates.push_back(CI);
+  if (Updates.size() < 2)
+    return false;
+
+  DominatorTree DT(F);
+  SmallVector<CallInst *, 8> Kept;
+  bool Changed = false;
+  for (CallInst *Update : Updates) {
+    // All updates of a module share the same table and handle; the last
+    // argument (the launch's stream) only orders the copy.
+    bool Redundant = llvm::any_of(Kept, [&](CallInst *Earlier) {
+      for (unsigned Arg = 0; Arg + 1 < Update->arg_size(); ++Arg)
+        if (Update->getArgOperand(Arg) != Earlier->getArgOperand(Arg))
+          return false;
+      return DT.dominates(Earlier, Update) &&
+             onlyLaunchSetupBetween(Earlier, Update);
+    });
+    if (!Redundant) {
+      Kept.push_back(Update);
+      continue;
+    }
+    LLVM_DEBUG(dbgs() << "\t\t- removing redundant globals update: "
+                      << *Update << "\n");
+    Update->eraseFromParent();
+    Changed = true;
+  }
+  return Changed;
+}
+
+/// Link the runtime's fast paths (-cuabi-runtime-bc-path) into the host
+/// module.  Only the entry points the module calls are linked, and they
+/// become available_externally: the host pipeline can inline them, and the
+/// calls that remain still resolve to the runtime library.
+void CudaABI::linkRuntimeBitcode() {
+  if (RuntimeBCPath.empty())
+    return;
+  LLVM_DEBUG(dbgs() << "\t- linking runtime bitcode '" << RuntimeBCPath
+                    << "' into the host module.\n");
+  LLVMContext &Ctx = M.getContext();
+  SMDiagnostic SMD;
+  std::unique_ptr<Module> RuntimeModule = parseIRFile(RuntimeBCPath, SMD, Ctx);
+  if (!RuntimeModule) {
+    Ctx.emitError("cuabi: failed to parse runtime bitcode file: " +
+                  Twine(RuntimeBCPath));
+    return;
+  }
+  // The fast paths only call into the runtime library; any of their
+  // definitions the host module does not use are left out.
+  bool Failed = Linker::linkModules(
+      M, std::move(RuntimeModule), Linker::LinkOnlyNeeded,
+      [](Module &M, const StringSet<> &GVS) {
+        for (StringRef Name : GVS.keys())
+          if (GlobalValue *GV = M.getNamedValue(Name))
+            if (!GV->isDeclaration())
+              GV->setLinkage(GlobalValue::AvailableExternallyLinkage);
+      });
+  if (Failed)
+    Ctx.emitError("cuabi: failed to link runtime bitcode file: " +
+                  Twine(RuntimeBCPath));
+}
+
+/// Link NVSHMEM's device library into the kernel module if its kernels
+/// call NVSHMEM functions (i.e., they put or get symmetric memory, see
+/// kitsune_shmem.h).  Like libdevice, only the functions the kernels
+/// call are linked.  The runtime initializes the library's device state
+/// in each module that has it once the module is loaded (see
+/// __kitcuda_shmem_attach_module()), so the state keeps its name.
+void CudaABI::linkShmemDeviceLibrary() {
+  if (none_of(KernelModule, [](const Function &F) {
+        return F.isDeclaration() && F.getName().starts_with("nvshmem");
+      }))
+    return;
+  LLVMContext &Ctx = KernelModule.getContext();
+  if (RelocatableDeviceCode) {
+    Ctx.emitError("cuabi: kernels that access symmetric memory are not "
+                  "supported with relocatable device code (-fgpu-rdc)");
+    return;
+  }
+  std::string BCFile = ShmemBCPath;
+  if (BCFile.empty()) {
+    std::optional<std::string> Path = sys::Process::FindInEnvPath(
+        "NVSHMEM_HOME", "lib/libnvshmem_device.bc");
+    if (!Path) {
+      Ctx.emitError("cuabi: kernels call NVSHMEM functions but its device "
+                    "library was not found (set NVSHMEM_HOME or "
+                    "-cuabi-shmem-bc)");
+      return;
+    }
+    BCFile = *Path;
+  }
+  LLVM_DEBUG(dbgs() << "\t- linking NVSHMEM device library '" << BCFile
+                    << "' into the kernel module.\n");
+  Expected<std::unique_ptr<Module>> SM =
+      getLazyBitcodeModule(getLibDeviceBitcode(BCFile), Ctx);
+  if (!SM) {
+    Ctx.emitError("cuabi: failed to parse: " + Twine(BCFile) + ": " +
+                  toString(SM.takeError()));
+    return;
+  }
+  if (Linker::linkModules(KernelModule, std::move(*SM),
+                          Linker::LinkOnlyNeeded)) {
+    Ctx.emitError("cuabi: failed to link: " + Twine(BCFile));
+    return;
+  }
+  if (GlobalVariable *State =
+          KernelModule.getNamedGlobal("nvshmemi_device_state_d"))
+    appendToUsed(KernelModule, {State});
+}
+
 void CudaABI::postProcessModule() {
   // At this point, all tapir constructs in the input module (M) have been
   // transformed (i.e., outlined) into the kernel module. We can now wrap up
@@ -2051,62 +5634,149 @@ void CudaABI::postProcessModule() {
                                                  ".post.unoptimized"));
   LLVM_DEBUG(saveModuleToFile(&M, M.getName().str() + ".outline-debug"));
 
+  if (RelocatableDeviceCode) {
+    addRelocatableDeviceFunctions();
+    // Modules without kernels or device functions have no device code.
+    if (llvm::all_of(KernelModule,
+                     [](const Function &F) { return F.isDeclaration(); }))
+      return;
+  }
+
   auto L = Linker(KernelModule);
   if (LibDeviceModule) {
+    NamedRegionTimer NRT("linkLibDevice", "Link libdevice", TimerGroupName,
+                         TimerGroupDescription, TimePassesIsEnabled);
+    TimeTraceScope TTS("CudaABI::linkLibDevice", KernelModule.getName());
     LLVM_DEBUG(dbgs() << "\t- linking in cuda libdevice into kernel module.\n");
-    L.linkInModule(std::move(LibDeviceModule), Linker::LinkOnlyNeeded);
+    if (RelocatableDeviceCode)
+      // The libdevice functions of each module must not clash in the
+      // device link.
+      L.linkInModule(std::move(LibDeviceModule), Linker::LinkOnlyNeeded,
+                     [](Module &M, const StringSet<> &GVS) {
+                       internalizeModule(M, [&GVS](const GlobalValue &GV) {
+                         return !GV.hasName() || GVS.count(GV.getName()) == 0;
+                       });
+                     });
+    else
+      L.linkInModule(std::move(LibDeviceModule), Linker::LinkOnlyNeeded);
+  }
+  linkShmemDeviceLibrary();
+  packGlobalVariables();
+  if (MergeIdenticalKernels)
+    mergeIdenticalKernels();
+  if (!PersistentKernels.empty())
+    createPersistentWorker();
+  if (RelocatableDeviceCode)
+    addDeviceLinkStubs();
+
+  // Launches specialized at run time compile their variants from the
+  // module's PTX, which is then embedded (and cached) along with the fat
+  // binary.
+  bool EmbedModulePTX = canSpecializeKernels();
+
+  // Unchanged kernel modules can reuse a cached fat binary and skip
+  // device code generation (PTX, ptxas and fatbinary) entirely.
+  // The refined access modes of the kernels' arguments (see
+  // refineKernelArgAccesses()) are cached along with it.
+  SmallString<255> CacheFileName, PTXCacheFileName, AccessCacheFileName;
+  if (!FatbinaryCacheDir.empty()) {
+    CacheFileName = FatbinaryCacheDir;
+    sys::path::append(CacheFileName, getFatbinaryCacheKey() + ".cufatbin");
+    AccessCacheFileName = CacheFileName;
+    sys::path::replace_extension(AccessCacheFileName, ".access");
+    if (EmbedModulePTX) {
+      PTXCacheFileName = CacheFileName;
+      sys::path::replace_extension(PTXCacheFileName, ".ptx");
+    }
   }
 
-  CudaABIOutputFile PTXFile = generatePTX();
-  CudaABIOutputFile AsmFile = assemblePTXFile(PTXFile);
-  CudaABIOutputFile FatbinFile = createFatbinaryFile(AsmFile);
-  GlobalVariable *Fatbinary = embedFatbinary(FatbinFile);
+  CudaABIOutputFile PTXFile;
+  CudaABIArchOutputFiles AsmFiles;
+  CudaABIOutputFile FatbinFile;
+  GlobalVariable *Fatbinary;
+  GlobalVariable *ModulePTX = nullptr;
+  StringMap<unsigned> Accesses;
+  // The cached fat binary already holds any kernels that were generated
+  // again to avoid spills (see relaxLaunchBounds()).
+  if (!CacheFileName.empty() && sys::fs::exists(CacheFileName) &&
+      (PTXCacheFileName.empty() || sys::fs::exists(PTXCacheFileName)) &&
+      readKernelArgAccesses(AccessCacheFileName, Accesses)) {
+    LLVM_DEBUG(dbgs() << "\t- using cached fat binary '" << CacheFileName
+                      << "'.\n");
+    refineKernelArgAccesses(Accesses);
+    Fatbinary = embedFatbinary(CacheFileName);
+    if (EmbedModulePTX)
+      ModulePTX = embedPTX(PTXCacheFileName);
+  } else {
+    // Device code generation competes with the other (ThinLTO backend)
+    // threads of the process for the machine; wait for a job slot.
+    tapir::GPUCodegenJob Job;
+    PTXFile = generatePTX();
+    findKernelArgAccesses(Accesses);
+    refineKernelArgAccesses(Accesses);
+    StringMap<unsigned> SpillBytes;
+    AsmFiles = assemblePTXFile(PTXFile, SpillBytes);
+    if (SpillRetryModule && relaxLaunchBounds(*SpillRetryModule, SpillBytes)) {
+      if (!KeepIntermediateFiles) {
+        sys::fs::remove(PTXFile->getFilename());
+        for (auto &AsmFile : AsmFiles)
+          sys::fs::remove(AsmFile.second->getFilename());
+      }
+      PTXFile = emitPTX(*SpillRetryModule);
+      AsmFiles = assemblePTXFile(PTXFile, SpillBytes);
+    }
+    SpillRetryModule.reset();
+    if (EmbedPTXInFatbinaries)
+      pushPTXFilename(PTXFile->getFilename().str());
+    FatbinFile = createFatbinaryFile(AsmFiles);
+    if (!CacheFileName.empty()) {
+      cacheKernelArgAccesses(Accesses, AccessCacheFileName);
+      tapir::cacheGPUBinary(FatbinFile->getFilename(), CacheFileName,
+                            "cuabi");
+    }
+    if (!PTXCacheFileName.empty())
+      tapir::cacheGPUBinary(PTXFile->getFilename(), PTXCacheFileName,
+                            "cuabi");
+    Fatbinary = embedFatbinary(FatbinFile->getFilename());
+    if (EmbedModulePTX)
+      ModulePTX = embedPTX(PTXFile->getFilename());
+  }
 
   LLVM_DEBUG(saveModuleToFile(&M, M.getName().str() + ".post-fatbin"));
 
-  finalizeLaunchCalls(M, Fatbinary);
+  if (HasKernels)
+    finalizeLaunchCalls(M, Fatbinary, ModulePTX);
+
+  // The placeholder calls that passed the specialized values of the
+  // loops (see getSpecializedParams()) are no longer needed.
+  if (Function *SpecFn = M.getFunction("__kitrt_dummy_specialize")) {
+    for (User *U : make_early_inc_range(SpecFn->users()))
+      if (auto *CI = dyn_cast<CallInst>(U))
+        CI->eraseFromParent();
+    if (SpecFn->use_empty())
+      SpecFn->eraseFromParent();
+  }
 
   LLVM_DEBUG(saveModuleToFile(&M, M.getName().str() + ".post-finalize-launch"));
 
   registerFatbinary(Fatbinary);
+  linkRuntimeBitcode();
   if (HostOptLevel > 0) {
-    if (HostOptLevel > 3)
-      HostOptLevel = 3;
-    PipelineTuningOptions pto;
-    pto.LoopVectorization = HostOptLevel > 2;
-    pto.SLPVectorization = HostOptLevel > 2;
-    pto.LoopUnrolling = true;
-    pto.LoopInterleaving = true;
-    pto.LoopStripmine = false;
-
-    LoopAnalysisManager lam;
-    FunctionAnalysisManager fam;
-    CGSCCAnalysisManager cgam;
-    ModuleAnalysisManager mam;
-    OptimizationLevel optLevels[] = {
-        OptimizationLevel::O0,
-        OptimizationLevel::O1,
-        OptimizationLevel::O2,
-        OptimizationLevel::O3,
-    };
-    OptimizationLevel optLevel = optLevels[HostOptLevel];
-    PassBuilder pb(PTXTargetMachine, pto);
-    pb.registerModuleAnalyses(mam);
-    pb.registerCGSCCAnalyses(cgam);
-    pb.registerFunctionAnalyses(fam);
-    pb.registerLoopAnalyses(lam);
-    PTXTargetMachine->registerPassBuilderCallbacks(pb, false);
-    pb.crossRegisterProxies(lam, fam, cgam, mam);
-
-    ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(optLevel);
-    mpm.addPass(VerifierPass());
-    mpm.run(M, mam);
-    LLVM_DEBUG(dbgs() << "\tpasses complete.\n");
+    NamedRegionTimer NRT("optimizeHostCode", "Optimize host code",
+                         TimerGroupName, TimerGroupDescription,
+                         TimePassesIsEnabled);
+    TimeTraceScope TTS("CudaABI::optimizeHostCode", M.getName());
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        eliminateRedundantLaunchSetup(F);
+    tapir::optimizeGPUHostCode(M, HostOptLevel, "__kitcuda_");
+    LLVM_DEBUG(dbgs() << "\thost cleanup complete.\n");
   }
 
-  if (not KeepIntermediateFiles) {
+  if (not KeepIntermediateFiles && PTXFile) {
     sys::fs::remove(PTXFile->getFilename());
-    sys::fs::remove(AsmFile->getFilename());
+    for (auto &AsmFile : AsmFiles)
+      sys::fs::remove(AsmFile.second->getFilename());
     sys::fs::remove(FatbinFile->getFilename());
   }
 }
@@ -2138,7 +5808,21 @@ CudaABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
     //  parameter).
     KernelName = CUABI_KERNEL_NAME_PREFIX + KernelName;
   }
+  // The kernels of all modules share a single (linked) device module.
+  if (RelocatableDeviceCode)
+    KernelName += "_" + getRDCSuffix();
+  HasKernels = true;
 
   CudaLoop *Outliner = new CudaLoop(M, KernelModule, KernelName, this);
+  // Loops whose iterations cooperate in lane groups only run on the GPU.
+  if (TapirLoopHints(TheLoop).getGPULanes())
+    return Outliner;
+  // Hybrid loops also run part of their iterations on the host.
+  if (TapirLoopHints(TheLoop).getHybrid())
+    return new HybridLoop(M, Outliner);
+  // Launches with small trip counts may run on the host.  The runtime
+  // only knows that the data is in host memory if launches map it.
+  if (EnableTapirHostFallback && CodeGenPrefetch)
+    return new HostFallbackLoop(M, Outliner);
   return Outliner;
 }
@@ -71,7 +71,11 @@
 //===----------------------------------------------------------------------===//
 #include "llvm/Transforms/Tapir/HipABI.h"
 #include "kitsune/Config/config.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/IR/Constants.h"
@@ -87,21 +91,28 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Linker/Linker.h"
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Option/ArgList.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/CodeGen.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/EndianStream.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/TargetParser/TargetParser.h"
 #include "llvm/Transforms/AggressiveInstCombine/AggressiveInstCombine.h"
@@ -112,6 +123,8 @@
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Tapir/Outline.h"
 #include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirHybridLoop.h"
+#include "llvm/Transforms/Tapir/TapirMultiTarget.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
@@ -123,6 +136,11 @@ using namespace llvm;
 
 #define DEBUG_TYPE "hipabi" // support for -debug-only=hipabi
 
+// The stages of device code generation are timed for -ftime-report
+// (-time-passes) and traced for -ftime-trace.
+static const char TimerGroupName[] = DEBUG_TYPE;
+static const char TimerGroupDescription[] = "HIP ABI device code generation";
+
 static const std::string HIPABI_PREFIX = "__hipabi";
 static const std::string HIPABI_KERNEL_NAME_PREFIX = HIPABI_PREFIX + ".kern.";
 
@@ -156,14 +174,11 @@ static const std::string HIPABI_KERNEL_NAME_PREFIX = HIPABI_PREFIX + ".kern.";
 ///     module.  This currently defaults to level 2.
 ///
 ///   * `-hipabi-host-opt-level=[0,1,2,3]`: Set the optimization
-///     level to use for the final host-side module after the HIP
-///     transformation has completed.  Even though the host code
-///     has already been through a series of optimizations this
-///     option enables a second series of passes over the code
-///     after the transformation has completed.  At present there
-///     are unlikely to be significant gains from this.  As a
-///     result this defaults to level 0, which disables the
-///     extra pass entirely.
+///     level of the cleanup of the host-side code that launches
+///     kernels after the HIP transformation has completed (see
+///     tapir::optimizeGPUHostCode()).  The driver passes the host
+///     optimization level at -O2 and above; the default of 0
+///     disables the cleanup.
 ///
 ///   * `-hipabi-prefetch`: Enable/Disable the generation of
 ///     data prefetch calls prior to the kernel launch. This
@@ -172,6 +187,48 @@ static const std::string HIPABI_KERNEL_NAME_PREFIX = HIPABI_PREFIX + ".kern.";
 ///     allocations (although HIP currently has some poor
 ///     performance with managed memory in general).
 ///
+///   * `-hipabi-prefetch-early`: Enable/Disable hoisting an
+///     additional asynchronous prefetch of each kernel argument
+///     that is read by the kernel to the earliest point ahead of
+///     the launch where the host no longer writes the data.  The
+///     runtime issues these on dedicated prefetch streams when
+///     enabled (KITRT_PREFETCH_STREAMS) and ignores them
+///     otherwise.  This is enabled by default.
+///
+///   * `-hipabi-host-prefetch`: Enable/Disable issuing an
+///     asynchronous prefetch of the data a kernel may write back
+///     to the host, ordered on the kernel's stream, when the host
+///     reads it (within the function) before another launch uses
+///     it.  The prefetch follows the launch or, when the reads
+///     are all outside of the loops around the launch, is placed
+///     at the exits of those loops.  This is enabled by default.
+///
+///   * `-hipabi-reductions`: Enable/Disable turning atomic
+///     updates of a kernel argument (add, min, max, and, or,
+///     xor) into block-wide tree reductions in shared (LDS)
+///     memory, leaving a single atomic update per block.  This
+///     is how Kokkos parallel_reduce constructs and forall loops
+///     that accumulate with atomics are lowered.  This is enabled
+///     by default.
+///
+///   * `-hipabi-nd-launches`: Enable/Disable 2D and 3D launch
+///     geometries for kernels that split a flattened iteration
+///     space into coordinates with division and remainder (e.g.,
+///     'i = tid / N, j = tid % N' or a Kokkos MDRangePolicy).
+///     Each thread then takes its coordinates from its work-group
+///     and work-item indices and each work-group covers a tile of
+///     the iteration space.  This is enabled by default.
+///
+///   * `-hipabi-tile-loads`: Enable/Disable staging the
+///     neighborhoods of stencil-like loads of read-only arrays
+///     (e.g., 'a[i-1] + a[i] + a[i+1]') in LDS memory.  The work
+///     items of each work-group cooperatively load the group's
+///     tile of the array (plus a small halo) once and the kernel
+///     reads neighboring elements from LDS.  The launch reports
+///     the size of the tiles to the runtime as dynamic shared
+///     memory.  This applies to one dimensional kernels and is
+///     disabled by default.
+///
 ///   * `-hipabi-max-threads-per-blk`: Set the maximum number
 ///     of threads that can run within a block (a la CUDA).
 ///     Note that this value has to be coordinated with the
@@ -188,6 +245,14 @@ static const std::string HIPABI_KERNEL_NAME_PREFIX = HIPABI_PREFIX + ".kern.";
 ///     it (but that might change as things mature w/ HIP and
 ///     ROCm). Default value is disabled/false.
 ///
+///   * `-hipabi-unified-memory`: Generate code for devices where
+///     the host and the GPU share (coherent) memory -- e.g., an
+///     MI300A APU.  Data never migrates on such systems so no
+///     prefetch calls are generated (regardless of the prefetch
+///     options above).  The runtime detects these devices and
+///     serves allocations from host memory.  Default value is
+///     disabled/false.
+///
 ///   * `-hipabi-use-sramecc`: Enable SRAMECC support in the
 ///     generated code.  Default value is disabled/false.
 ///
@@ -205,6 +270,26 @@ static const std::string HIPABI_KERNEL_NAME_PREFIX = HIPABI_PREFIX + ".kern.";
 ///     changed unless you are experimenting with details of
 ///     ROCm and HIP.
 ///
+///   * `-hipabi-cache-dir=<dir>`: Cache code object bundles in the
+///     given directory, keyed on a hash of the kernel module, target
+///     and options.  Translation units whose kernels have not changed
+///     (e.g., after an edit of host code only) skip device code
+///     generation entirely.  The `HIPABI_CACHE_DIR` environment
+///     variable may also be used.  Caching is disabled by default.
+///
+///   * `-hipabi-compress-bundle`: Embed the code object as a
+///     compressed (zstd, or zlib when zstd is not available) clang
+///     offload bundle rather than as a plain ELF image.  This cuts
+///     the size of large binaries and the time to read them but
+///     requires a ROCm runtime that accepts compressed bundles
+///     (6.2 or later).  Disabled by default.
+///
+///   * `-hipabi-preload-modules`: Enable/Disable generating a call
+///     in the module constructor that lets the runtime load the
+///     code object and resolve its kernels in the background at
+///     startup (see __kithip_preload_module()) rather than within
+///     the first launch of each kernel.  Enabled by default.
+///
 ///   * `hipabi-keep-files`: The transform has the ability to
 ///     save the various stages of the IR during execution.
 ///     In addition, some files are created and removed during
@@ -222,15 +307,58 @@ cl::opt<unsigned>
     OptLevel("hipabi-opt-level", cl::init(2), cl::NotHidden,
              cl::desc("The Tapir HIP target transform optimization level"));
 
-cl::opt<unsigned> HostOptLevel( // EXPERIMENTAL
+cl::opt<unsigned> HostOptLevel(
     "hipabi-host-opt-level", cl::init(0), cl::NotHidden,
-    cl::desc("The optimization level for a final pass over the transformed "
+    cl::desc("The optimization level of the cleanup of the transformed "
              "host-side code."));
 
 cl::opt<bool> CodeGenPrefetch("hipabi-prefetch", cl::init(true), cl::Hidden,
                               cl::desc("Enable generation of calls to do data "
                                        "prefetching for managed memory."));
 
+cl::opt<bool> CodeGenEarlyPrefetch(
+    "hipabi-prefetch-early", cl::init(true), cl::Hidden,
+    cl::desc("Hoist asynchronous data prefetch calls for kernel arguments "
+             "to the earliest point after the last host-side write."));
+
+cl::opt<bool> CodeGenHostPrefetch(
+    "hipabi-host-prefetch", cl::init(true), cl::Hidden,
+    cl::desc("Prefetch data written by a kernel back to the host when "
+             "the host reads it before the next launch that uses it."));
+
+cl::opt<bool> CodeGenReductions(
+    "hipabi-reductions", cl::init(true), cl::Hidden,
+    cl::desc("Turn atomic updates of a kernel argument into block-wide "
+             "tree reductions (default=true)"));
+
+cl::opt<bool> CodeGenHistograms(
+    "hipabi-histograms", cl::init(true), cl::Hidden,
+    cl::desc("Accumulate histogram-like atomic updates in per-work-group "
+             "LDS copies (default=true)"));
+
+cl::opt<bool> CodeGenNDLaunches(
+    "hipabi-nd-launches", cl::init(true), cl::Hidden,
+    cl::desc("Launch kernels that index a flattened 2D/3D iteration "
+             "space with a matching multi-dimensional geometry "
+             "(default=true)"));
+
+cl::opt<bool> CodeGenTileLoads(
+    "hipabi-tile-loads", cl::init(false), cl::Hidden,
+    cl::desc("Stage the neighborhoods of stencil-like loads of read-only "
+             "arrays in LDS memory (default=false)"));
+
+cl::opt<bool> CodeGenReduceDivisions(
+    "hipabi-reduce-divisions", cl::init(true), cl::Hidden,
+    cl::desc("Replace the divisions of kernels by launch invariant values "
+             "(e.g., the extents of a flattened iteration space) with "
+             "multiplications by their inverses (default=true)"));
+
+cl::opt<bool> CodeGenNarrowIV(
+    "hipabi-narrow-iv", cl::init(true), cl::Hidden,
+    cl::desc("Give kernels with 64-bit induction variables a copy of their "
+             "loop with a 32-bit induction variable for launches whose "
+             "iterations fit in 32 bits (default=true)"));
+
 const unsigned int AMDGPU_MAX_THREADS_PER_BLOCK = 1024;
 const unsigned int HIPABI_DEFAULT_MAX_THREADS_PER_BLOCK =
     AMDGPU_MAX_THREADS_PER_BLOCK;
@@ -259,6 +387,11 @@ cl::opt<bool> Use64ElementWavefront(
 cl::opt<bool> EnableXnack("hipabi-xnack", cl::init(false), cl::NotHidden,
                           cl::desc("Enable/disable xnack. (default: false)"));
 
+cl::opt<bool> UnifiedMemory(
+    "hipabi-unified-memory", cl::init(false), cl::NotHidden,
+    cl::desc("Target a device that shares coherent memory with the host "
+             "(no prefetching). (default: false)"));
+
 cl::opt<bool>
     EnableSRAMECC("hipabi-sramecc", cl::init(true), cl::NotHidden,
                   cl::desc("Enable/disable sramecc.(default: false)"));
@@ -273,6 +406,21 @@ cl::opt<bool>
                           cl::desc("Keep/create intermediate files during the "
                                    "various stages of the transform."));
 
+cl::opt<std::string> BundleCacheDir(
+    "hipabi-cache-dir", cl::init(""), cl::NotHidden,
+    cl::desc("Directory used to cache code object bundles keyed on the "
+             "kernel module, target and options. (default: disabled)"));
+
+cl::opt<bool> CompressBundle(
+    "hipabi-compress-bundle", cl::init(false), cl::NotHidden,
+    cl::desc("Embed the code object as a compressed offload bundle "
+             "(requires ROCm 6.2 or later). (default: false)"));
+
+cl::opt<bool> PreloadModules(
+    "hipabi-preload-modules", cl::init(true), cl::Hidden,
+    cl::desc("Generate calls that allow the runtime to load modules and "
+             "resolve kernels in the background at startup. (default=true)"));
+
 // LLVM variable name for the embedded fat binary image.
 const char *HIPAPI_DUMMY_FATBIN_NAME = "_hipabi.dummy_fatbin";
 
@@ -321,9 +469,11 @@ void transformCallingConv(Function &F) {
 /// @param Fn - the function to resolve.
 /// @param DevMod - Module containing the device-side routines (e.g. math).
 /// @param KernelModule - Module containing the transformed device-side code.
+/// @param Acc - The accuracy of the math functions to use.
 /// @return The resolved function -- nullptr if not unresolved.
 Function *resolveDeviceFunction(Function *Fn, Module &DevMod,
-                                Module &KernelModule) {
+                                Module &KernelModule,
+                                tapir::GPUMathAccuracy Acc) {
 
   // Check for known device-side replacement of frequently used calls
   // (e.g., libmath) or return null to signal that a declaration should
@@ -332,83 +482,16 @@ Function *resolveDeviceFunction(Function *Fn, Module &DevMod,
 
   // Note that hip provides this functionality via header file
   // mechanisms but since kitsune+tapir are agnostic of host
-  // vs. device calls we have some additional steps to take here.
-  // However, the entry points below come specifically from the hip/amd
-  // headers.
-  std::string DevFnName;
-  if (Fn->getName() == "sqrtf")
-    DevFnName = "__ocml_sqrt_f32";
-  else if (Fn->getName() == "acosf")
-    DevFnName = "__ocml_acos_f32";
-  else if (Fn->getName() == "acoshf")
-    DevFnName = "__ocml_acosh_f32";
-  else if (Fn->getName() == "asinf")
-    DevFnName = "__ocml_asin_f32";
-  else if (Fn->getName() == "asinhf")
-    DevFnName = "__ocml_asinh_f32";
-  else if (Fn->getName() == "atan2f")
-    DevFnName = "__ocml_atan2_f32";
-  else if (Fn->getName() == "atanf")
-    DevFnName = "__ocml_atan_f32";
-  else if (Fn->getName() == "atanhf")
-    DevFnName = "__ocml_atanh_f32";
-  else if (Fn->getName() == "cbrtf")
-    DevFnName = "__ocml_cbrt_f32";
-  else if (Fn->getName() == "ceilf")
-    DevFnName = "__ocml_ceil_f32";
-  else if (Fn->getName() == "copysignf")
-    DevFnName = "__ocml_copysign_f32";
-  else if (Fn->getName() == "cosf")
-    DevFnName = "__ocml_cos_f32";
-  else if (Fn->getName() == "coshf")
-    DevFnName = "__ocml_cosh_f32";
-  else if (Fn->getName() == "cospif")
-    DevFnName = "__ocml_cospi_f32";
-  else if (Fn->getName() == "cyl_bessel_i0f")
-    DevFnName = "__ocml_i0_f32";
-  else if (Fn->getName() == "cyl_bessel_i1f")
-    DevFnName = "__ocml_i1_f32";
-  else if (Fn->getName() == "erfcf")
-    DevFnName = "__ocml_erfc_f32";
-  else if (Fn->getName() == "erfcinvf")
-    DevFnName = "__ocml_erfcinv_f32";
-  else if (Fn->getName() == "erfcxf")
-    DevFnName = "__ocml_erfcx_f32";
-  else if (Fn->getName() == "erff")
-    DevFnName = "__ocml_erf_f32";
-  else if (Fn->getName() == "erfinvf")
-    DevFnName = "__ocml_erfinv_f32";
-  else if (Fn->getName() == "exp10f")
-    DevFnName = "__ocml_exp10_f32";
-  else if (Fn->getName() == "exp2f")
-    DevFnName = "__ocml_exp2_f32";
-  else if (Fn->getName() == "expf")
-    DevFnName = "__ocml_exp_f32";
-  else if (Fn->getName() == "expm1f")
-    DevFnName = "__ocml_expm1_f32";
-  else if (Fn->getName() == "fabsf")
-    DevFnName = "__ocml_fabs_f32";
-  else if (Fn->getName() == "fdimf")
-    DevFnName = "__ocml_fdim_f32";
-  else if (Fn->getName() == "fdividef")
+  // vs. device calls we have some additional steps to take here.  The
+  // math entry points are the ocml functions used by the hip/amd
+  // headers (see tapir::getGPUMathFunction()).
+  if (Fn->getName() == "fdividef")
     llvm_unreachable("fdividef() needs transformation -- unsupported.");
-  else if (Fn->getName() == "floorf")
-    DevFnName = "__ocml_floor_f32";
-  else if (Fn->getName() == "fmaf")
-    DevFnName = "__ocml_fma_f32";
-  else if (Fn->getName() == "fmaxf")
-    DevFnName = "__ocml_fmax_f32";
-  else if (Fn->getName() == "fminf")
-    DevFnName = "__ocml_fmin_f32";
-  else if (Fn->getName() == "fmodf")
-    DevFnName = "__ocml_fmod_f32";
-  else if (Fn->getName() == "powf")
-    DevFnName = "__ocml_pow_f32";
-  else if (Fn->getName() == "sinf")
-    DevFnName = "__ocml_native_sin_f32";
   else if (Fn->getName() == "sincosf")
     llvm_unreachable("sincosf() needs transformation -- unsupported.");
-  else
+  std::string DevFnName =
+      tapir::getGPUMathFunction(Fn->getName(), tapir::GPUMathOCML, Acc).str();
+  if (DevFnName.empty())
     DevFnName = Fn->getName().str();
 
   if (Function *DevFn = KernelModule.getFunction(DevFnName)) {
@@ -457,7 +540,8 @@ void transformForGCN(Function &F, Module &DevMod, Module &KernelModule) {
       Function *Fn = KernelModule.getFunction(CF->getName());
       if (not Fn) {
         LLVM_DEBUG(dbgs() << "\t\t\tcall: " << CF->getName() << "() ");
-        Function *DF = resolveDeviceFunction(CF, DevMod, KernelModule);
+        Function *DF = resolveDeviceFunction(CF, DevMod, KernelModule,
+                                             tapir::getGPUMathAccuracy(*CI));
         if (DF) {
           LLVM_DEBUG(dbgs() << "resolved as: " << DF->getName() << "()\n");
           CallInst *NCI = dyn_cast<CallInst>(CI->clone());
@@ -828,7 +912,15 @@ HipLoop::HipLoop(Module &M, Module &KModule, const std::string &Name,
   // Get entry points into the Hip-centric portion of the Kitsune runtime.
   KernelInstMixTy = StructType::get(Int64Ty,  // number of memory ops.
                                     Int64Ty,  // number of floating point ops.
-                                    Int64Ty); // number of integer ops.
+                                    Int64Ty,  // number of integer ops.
+                                    Int64Ty,  // number of bytes accessed.
+                                    Int64Ty,  // kernel flags.
+                                    Int64Ty,  // shared memory per thread.
+                                    Int64Ty,  // shared memory per block.
+                                    VoidPtrTy, // forall source location.
+                                    Int64Ty,  // max blocks per grid.
+                                    Int64Ty,  // launch shared memory.
+                                    Int64Ty); // iterations per thread.
 
   KitHipLaunchFn = M.getOrInsertFunction("__kithip_launch_kernel",
       VoidPtrTy,   // return an opaque stream
@@ -838,12 +930,54 @@ HipLoop::HipLoop(Module &M, Module &KModule, const std::string &Name,
       Int64Ty,     // trip count
       Int32Ty,     // threads-per-block
       KernelInstMixTy->getPointerTo(), // instruction mix info
-      VoidPtrTy);  // opaque cuda stream
+      VoidPtrTy,   // opaque cuda stream
+      VoidPtrTy);  // kernel launch handle
+  KitHipLaunchNDFn = M.getOrInsertFunction("__kithip_launch_kernel_nd",
+      VoidPtrTy,   // return an opaque stream
+      VoidPtrTy,   // fat-binary
+      VoidPtrTy,   // kernel name
+      VoidPtrTy,   // arguments
+      Int64Ty,     // trip count
+      Int32Ty,     // threads-per-block
+      KernelInstMixTy->getPointerTo(), // instruction mix info
+      VoidPtrTy,   // opaque cuda stream
+      Int32Ty,     // start/trip count size (bytes)
+      VoidPtrTy,   // kernel launch handle
+      Int32Ty,     // number of dimensions
+      VoidPtrTy);  // extents of the inner dimensions
 
   KitHipMemPrefetchFn = M.getOrInsertFunction("__kithip_mem_gpu_prefetch",
                                               VoidPtrTy,  // return an opaque stream
                                               VoidPtrTy,  // pointer to prefetch
                                               VoidPtrTy); // use opaque stream. 
+  KitHipMemPrefetchBatchFn = M.getOrInsertFunction(
+      "__kithip_mem_gpu_prefetch_batch",
+      VoidPtrTy,               // return an opaque stream
+      VoidPtrTy,               // pointers to prefetch
+      Type::getInt32Ty(Ctx),   // number of pointers
+      VoidPtrTy);              // use opaque stream
+  KitHipMemPrefetchAsyncFn = M.getOrInsertFunction(
+      "__kithip_mem_gpu_prefetch_async",
+      Type::getVoidTy(Ctx), // no return
+      VoidPtrTy);           // pointer to prefetch
+  KitHipMemReduceMapFn = M.getOrInsertFunction(
+      "__kithip_mem_reduce_map",
+      VoidPtrTy,            // return the kernel-side pointer
+      VoidPtrTy,            // pointer to the reduction result
+      Type::getInt64Ty(Ctx), // size of the result
+      VoidPtrTy);           // pointer to opaque stream
+  KitHipPriorityStreamFn = M.getOrInsertFunction(
+      "__kithip_use_priority_stream",
+      Type::getVoidTy(Ctx), // no return
+      VoidPtrTy,            // pointer to opaque stream
+      Type::getInt32Ty(Ctx)); // priority (see KitRTPriority)
+}
+
+const tapir::GPUReductionArg *HipLoop::isReductionArg(unsigned ArgNo) const {
+  for (const tapir::GPUReductionArg &RA : ReductionArgs)
+    if (RA.ArgNo == ArgNo)
+      return &RA;
+  return nullptr;
 }
 
 HipLoop::~HipLoop() { /* no-op */
@@ -1002,8 +1136,9 @@ void HipLoop::preProcessTapirLoop(TapirLoopInfo &TL, ValueToValueMapTy &VMap) {
   LLVM_DEBUG(dbgs() << "\t*- resolving functions for kernel module...\n");
   for (GlobalValue *G : UsedGlobalValues) {
     if (Function *F = dyn_cast<Function>(G)) {
-      Function *DF = resolveDeviceFunction(F, *TTarget->getLibDeviceModule(),
-                                           KernelModule);
+      Function *DF = resolveDeviceFunction(
+          F, *TTarget->getLibDeviceModule(), KernelModule,
+          tapir::getGPUMathAccuracy(*L.getHeader()->getParent()));
       if (not DF) {
         LLVM_DEBUG(dbgs() << "\t\t\t* adding declaration for function: '"
                           << demangle(F->getName().str()) << "'.\n");
@@ -1208,6 +1343,22 @@ void HipLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
                         llvm::utostr(MaxThreadsPerBlock);
   KernelF->addFnAttr("amdgpu-flat-work-group-size", AttrVal);
   KernelF->addFnAttr("amdgpu-waves-per-eu", AttrVal);
+  // The launch attribute's threads-per-block bounds the work group and
+  // its minimum number of resident blocks is the equivalent of HIP's
+  // __launch_bounds__: each of a compute unit's four SIMDs must hold
+  // that many blocks' worth of waves, which limits the registers of a
+  // thread.
+  TapirLoopHints Hints(TL);
+  if (unsigned LaunchThreads = Hints.getThreadsPerBlock()) {
+    KernelF->addFnAttr("amdgpu-flat-work-group-size",
+                       "1," + llvm::utostr(LaunchThreads));
+    if (unsigned MinBlocks = Hints.getMinBlocksPerMultiproc()) {
+      unsigned WaveSize = Use64ElementWavefront ? 64 : 32;
+      unsigned Waves = MinBlocks * divideCeil(LaunchThreads, WaveSize);
+      KernelF->addFnAttr("amdgpu-waves-per-eu",
+                         llvm::utostr(divideCeil(Waves, 4)));
+    }
+  }
   KernelF->addFnAttr("target-features", target_feature_str.c_str());
   KernelF->addFnAttr("no-trapping-math", "true");
   KernelF->setVisibility(GlobalValue::VisibilityTypes::ProtectedVisibility);
@@ -1235,33 +1386,152 @@ void HipLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
 
   IRBuilder<> Builder(Entry->getTerminator());
 
-  // Get the thread ID for this invocation of Helper.
-  //
-  // This is the classic thread ID calculation:
-  //      i = blockDim.x * blockIdx.x + threadIdx.x;
-  // For now we only generate 1-D thread IDs.
-  Value *ThreadIdx = emitWorkItemId(Builder, /* X */ 0, 0, 1024);
-  Value *BlockIdx = emitWorkGroupId(Builder, /* X */ 0);
-  Value *BlockDim = emitWorkGroupSize(Builder, /* X */ 0);
-
-  Value *ThreadID = Builder.CreateIntCast(
-      Builder.CreateAdd(
-          ThreadIdx,
-          Builder.CreateMul(BlockIdx, BlockDim, ".kern.blk_offset.x"),
-          ".kern.tid.x"),
-      PrimaryIV->getType(), false, ".kern.thread_id.x");
+  // Kernels that split a flattened 2D/3D iteration space into
+  // coordinates with division and remainder (e.g., 'i = tid / N,
+  // j = tid % N', or the lowering of a Kokkos MDRangePolicy) are
+  // launched with a matching multi-dimensional geometry.  Each thread
+  // takes its coordinates directly from its work-group and work-item
+  // indices (no per-thread division).  The host side of the launch
+  // needs the extents, so the kernel's parameters must match the
+  // packed arguments.
+  tapir::GPUFlattenedIndex FlatIndex;
+  NumLaunchDims = 1;
+  // Hybrid loops launch a (runtime chosen) part of the iteration space
+  // that need not cover whole rows.
+  if (CodeGenNDLaunches && KernelF->arg_size() == OrderedInputs.size() &&
+      !TapirLoopHints(TLI.getLoop()).getHybrid() &&
+      tapir::findFlattenedIndex(*KernelF, PrimaryIV, FlatIndex)) {
+    NumLaunchDims = FlatIndex.NumDims;
+    LaunchExtents[0] = FlatIndex.Extents[0];
+    LaunchExtents[1] = FlatIndex.Extents[1];
+    LLVM_DEBUG(dbgs() << "\thipabi: kernel '" << KernelName << "' uses a "
+                      << NumLaunchDims << "D launch geometry.\n");
+  }
+
+  Value *ThreadID;
+  Value *Cond;
+  if (NumLaunchDims > 1) {
+    // The coordinates of the thread in each dimension:
+    //      x = blockDim.x * blockIdx.x + threadIdx.x;  (and so on)
+    SmallVector<Value *, 3> Coords;
+    for (unsigned D = 0; D < NumLaunchDims; D++)
+      Coords.push_back(Builder.CreateIntCast(
+          Builder.CreateAdd(emitWorkItemId(Builder, D, 0, 1024),
+                            Builder.CreateMul(emitWorkGroupId(Builder, D),
+                                              emitWorkGroupSize(Builder, D))),
+          PrimaryIV->getType(), false, ".kern.coord"));
+    ThreadID = tapir::rewriteFlattenedIndex(Builder, FlatIndex, Coords);
+
+    // Threads of partial tiles that fall outside the inner extents, or
+    // outside the iteration space, have no work.
+    Value *Outside = Builder.CreateICmpUGE(Coords[0], FlatIndex.Extents[0]);
+    if (NumLaunchDims == 3)
+      Outside = Builder.CreateOr(
+          Outside, Builder.CreateICmpUGE(Coords[1], FlatIndex.Extents[1]));
+    Cond = Builder.CreateOr(
+        Outside, Builder.CreateICmpUGE(ThreadID, End), ".kern.at_end");
+  } else {
+    // Get the thread ID for this invocation of Helper.
+    //
+    // This is the classic thread ID calculation:
+    //      i = blockDim.x * blockIdx.x + threadIdx.x;
+    Value *ThreadIdx = emitWorkItemId(Builder, /* X */ 0, 0, 1024);
+    Value *BlockIdx = emitWorkGroupId(Builder, /* X */ 0);
+    Value *BlockDim = emitWorkGroupSize(Builder, /* X */ 0);
+
+    ThreadID = Builder.CreateIntCast(
+        Builder.CreateAdd(
+            ThreadIdx,
+            Builder.CreateMul(BlockIdx, BlockDim, ".kern.blk_offset.x"),
+            ".kern.tid.x"),
+        PrimaryIV->getType(), false, ".kern.thread_id.x");
+    Cond = Builder.CreateICmpUGE(ThreadID, End, ".kern.at_end");
+  }
 
   // NOTE/TODO: Assuming that the grainsize is fixed at 1 for the
   // current codegen...
   // ThreadID = Builder.CreateMul(ThreadID, Grainsize);
   Value *ThreadEnd = Builder.CreateAdd(ThreadID, Grainsize, ".kern.last_idx.x");
-  Value *Cond = Builder.CreateICmpUGE(ThreadID, End, ".kern.at_end");
   ReplaceInstWithInst(Entry->getTerminator(),
                       BranchInst::Create(Exit, Header, Cond));
 
   // Replace the loop's induction variable with the GPU thread id.
   PrimaryIVInput->replaceAllUsesWith(ThreadID);
 
+  tapir::GPUReductionHooks Hooks;
+  Hooks.WarpSize = 0;
+  Hooks.MaxThreadsPerBlock = AMDGPU_MAX_THREADS_PER_BLOCK;
+  Hooks.SharedAddrSpace = 3;
+  // Multi-dimensional work-groups are reduced in their linear work
+  // item order (x varies the fastest).
+  Hooks.ThreadIdx = [this](IRBuilder<> &B) {
+    Value *Tid = emitWorkItemId(B, /* X */ 0, 0, 1024);
+    if (NumLaunchDims > 1) {
+      Value *TidYZ = B.CreateAdd(
+          emitWorkItemId(B, /* Y */ 1, 0, 1024),
+          B.CreateMul(emitWorkGroupSize(B, /* Y */ 1),
+                      emitWorkItemId(B, /* Z */ 2, 0, 1024)));
+      Tid = B.CreateAdd(Tid,
+                        B.CreateMul(emitWorkGroupSize(B, /* X */ 0), TidYZ));
+    }
+    return B.CreateZExtOrTrunc(Tid, B.getInt32Ty());
+  };
+  Hooks.BlockDim = [this](IRBuilder<> &B) {
+    Value *Dim = emitWorkGroupSize(B, /* X */ 0);
+    if (NumLaunchDims > 1)
+      Dim = B.CreateMul(Dim, B.CreateMul(emitWorkGroupSize(B, /* Y */ 1),
+                                         emitWorkGroupSize(B, /* Z */ 2)));
+    return B.CreateZExtOrTrunc(Dim, B.getInt32Ty());
+  };
+  Hooks.Barrier = [](IRBuilder<> &B) {
+    // Matches HIP's __syncthreads(): the barrier is bracketed by
+    // work-group fences so LDS accesses are ordered across it.
+    SyncScope::ID WG = B.getContext().getOrInsertSyncScopeID("workgroup");
+    B.CreateFence(AtomicOrdering::Release, WG);
+    B.CreateIntrinsic(Intrinsic::amdgcn_s_barrier, {}, {});
+    B.CreateFence(AtomicOrdering::Acquire, WG);
+  };
+  Hooks.ShuffleXor = [](IRBuilder<> &B, Value *V, Value *Offset,
+                        unsigned Width, Value *Mask) -> Value * {
+    // The lane groups are aligned within the wavefront, so the lane whose
+    // index differs in the bits of Offset is in the caller's group.  A
+    // permute addresses the source lane in bytes.
+    Value *Lane = B.CreateIntrinsic(
+        Intrinsic::amdgcn_mbcnt_hi, {},
+        {B.getInt32(~0u), B.CreateIntrinsic(Intrinsic::amdgcn_mbcnt_lo, {},
+                                            {B.getInt32(~0u), B.getInt32(0)})});
+    Value *Addr = B.CreateShl(B.CreateXor(Lane, Offset), 2);
+    return B.CreateIntrinsic(Intrinsic::amdgcn_ds_bpermute, {}, {Addr, V});
+  };
+  Hooks.LaneSync = [](IRBuilder<> &B, Value *Mask) {
+    SyncScope::ID WF = B.getContext().getOrInsertSyncScopeID("wavefront");
+    B.CreateFence(AtomicOrdering::Release, WF);
+    B.CreateIntrinsic(Intrinsic::amdgcn_wave_barrier, {}, {});
+    B.CreateFence(AtomicOrdering::Acquire, WF);
+  };
+
+  // The lane groups of a nested loop (see TapirGPUNestedLoops) are
+  // groups of lanes of a wavefront.
+  if (tapir::lowerGPULaneCalls(*KernelF, Hooks))
+    LLVM_DEBUG(dbgs() << "\thipabi: kernel '" << KernelName
+                      << "' runs nested loops on groups of lanes.\n");
+
+  // Stencil-like loads of read-only arrays are staged in LDS tiles
+  // (loaded ahead of the branch that skips inactive work items so that
+  // the whole work-group reaches the barrier).  HIP kernels always
+  // start at iteration zero.
+  SharedMem = tapir::GPUSharedMemSize();
+  if (CodeGenTileLoads && NumLaunchDims == 1) {
+    SharedMem = tapir::stageGPUTileLoads(
+        *KernelF, PrimaryIV, ThreadID, ConstantInt::get(ThreadID->getType(), 0),
+        End, Entry->getTerminator(), Hooks);
+    LLVM_DEBUG(if (SharedMem.BytesPerThread != 0) dbgs()
+               << "\thipabi: kernel '" << KernelName
+               << "' stages its loads in LDS tiles ("
+               << SharedMem.BytesPerThread << " bytes/thread + "
+               << SharedMem.Bytes << " bytes).\n");
+  }
+
   // Update cloned loop condition to use the thread-end value.
   unsigned TripCountIdx = 0;
   ICmpInst *ClonedCond = cast<ICmpInst>(VMap[TLI.getCondition()]);
@@ -1270,6 +1540,47 @@ void HipLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
   assert(ClonedCond->getOperand(TripCountIdx) == End &&
          "End argument not used in condition!");
   ClonedCond->setOperand(TripCountIdx, ThreadEnd);
+
+  // Atomic updates of an argument (e.g., the lowering of a Kokkos
+  // parallel_reduce or a forall that accumulates with atomics) become
+  // block-wide tree reductions with a single atomic update per block.
+  // The wavefront size varies across AMDGPU targets so the combine is
+  // done entirely in LDS memory (vs. with cross-lane operations).
+  ReductionArgs.clear();
+  if (CodeGenReductions && KernelF->arg_size() == OrderedInputs.size()) {
+    ReductionArgs = tapir::lowerGPUReductions(*KernelF, Hooks);
+    LLVM_DEBUG(if (!ReductionArgs.empty()) dbgs()
+               << "\thipabi: kernel '" << KernelName << "' has "
+               << ReductionArgs.size() << " reduction(s).\n");
+  }
+  if (CodeGenHistograms) {
+    unsigned NumUpdates = tapir::lowerGPUHistograms(*KernelF, Hooks);
+    (void)NumUpdates;
+    LLVM_DEBUG(if (NumUpdates) dbgs()
+               << "\thipabi: kernel '" << KernelName << "' has "
+               << NumUpdates << " histogram update(s).\n");
+  }
+
+  // Loops with 64-bit indices (e.g., size_t) do their index arithmetic
+  // in 64 bits, which takes twice the instructions.  Launches whose
+  // iterations fit in 32 bits run a copy of the loop with a 32-bit IV.
+  if (CodeGenNarrowIV && NumLaunchDims == 1 &&
+      tapir::narrowGPULoopIV(PrimaryIV, Exit, End, {End, ThreadEnd}))
+    LLVM_DEBUG(dbgs() << "\thipabi: kernel '" << KernelName
+                      << "' has a 32-bit IV copy of its loop.\n");
+
+  // The remaining divisions by launch invariant values (e.g., of
+  // flattened iteration spaces without a multi-dimensional launch) use
+  // inverses computed once at the start of the kernel.
+  if (CodeGenReduceDivisions) {
+    // HIP kernels run a single iteration per work item.
+    unsigned NumReduced =
+        tapir::reduceGPUDivisions(*KernelF, /* Strided = */ false);
+    (void)NumReduced;
+    LLVM_DEBUG(if (NumReduced) dbgs()
+               << "\thipabi: kernel '" << KernelName << "' has "
+               << NumReduced << " division(s) by inverses.\n");
+  }
   TTarget->saveKernel(KernelF);
 }
 
@@ -1286,6 +1597,10 @@ std::unique_ptr<Module> HipABI::loadBCFile(const std::string &BCFile) {
 bool HipABI::linkInModule(std::unique_ptr<Module> &Mod) {
 
   assert(Mod != nullptr && "unexpected null module ptr!");
+  NamedRegionTimer NRT("linkInModule", "Link device libraries",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope TTS("HipABI::linkInModule", Mod->getName());
   // At this point we are ready to link in the device-side module
   // for the final steps of the target transformation.  This
   // basically completes resolution for device-side calls that
@@ -1340,10 +1655,41 @@ void HipLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   for (auto I : RemoveList)
     I->eraseFromParent();
 
+  // Hoist an asynchronous prefetch of each argument the kernel reads to
+  // the earliest point after the host's last write to it so that the
+  // migration overlaps with the host code leading up to the launch.
+  // The insertion points are found before any launch code is added.
+  SmallVector<std::pair<Instruction *, Value *>, 8> EarlyPrefetches;
+  if (CodeGenPrefetch && !UnifiedMemory && CodeGenEarlyPrefetch) {
+    unsigned ArgNo = 0;
+    for (Value *V : OrderedInputs) {
+      if (V->getType()->isPointerTy() && !isReductionArg(ArgNo) &&
+          tapir::getKernelArgAccess(V) != tapir::KernelArgWriteOnly)
+        if (Instruction *IP = tapir::getEarliestPrefetchPoint(V, TOI.ReplCall))
+          EarlyPrefetches.push_back({IP, V});
+      ArgNo++;
+    }
+  }
+
+  for (auto &EP : EarlyPrefetches) {
+    LLVM_DEBUG(dbgs() << "\t*- hoisting early prefetch of '"
+                      << EP.second->getName() << "'.\n");
+    IRBuilder<> EPBuilder(EP.first);
+    EPBuilder.CreateCall(
+        KitHipMemPrefetchAsyncFn,
+        {EPBuilder.CreateBitCast(EP.second, PointerType::getUnqual(Ctx))});
+  }
+
   // Make a pass to prep for GCN code generation...
   LLVM_DEBUG(dbgs() << "\t*- transform kernel for GCN code gen.\n");
   Function &F = *KernelModule.getFunction(KernelName.c_str());
   transformForGCN(F, *TTarget->getLibDeviceModule(), KernelModule);
+  if (F.arg_size() == OrderedInputs.size())
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+      if (tapir::addReadOnlyKernelArgAttrs(F.getArg(ArgNo),
+                                           OrderedInputs[ArgNo]))
+        LLVM_DEBUG(dbgs() << "\t*- kernel arg #" << ArgNo
+                          << " is noalias readonly.\n");
 
   // Create two builders -- one inserts code into the entry block
   // (e.g., new "up-front" allocas) and the other is for generating
@@ -1352,12 +1698,28 @@ void HipLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   BasicBlock &EntryBB = Parent->getEntryBlock();
   IRBuilder<> EntryBuilder(&EntryBB.front());
 
+  // Arguments that do not change within the host loops around the
+  // launch are stored once ahead of the loops rather than on every
+  // launch.  The points are found before the launch's block is split.
+  DenseMap<unsigned, Instruction *> InvariantArgPts;
+  {
+    DominatorTree HostDT(*Parent);
+    LoopInfo HostLI(HostDT);
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+      if (Instruction *IP = tapir::getInvariantLaunchArgPoint(
+              OrderedInputs[ArgNo], TOI.ReplCall, HostDT, HostLI))
+        InvariantArgPts[ArgNo] = IP;
+  }
+
   BasicBlock *RCBB = TOI.ReplCall->getParent();
   BasicBlock *NewBB = RCBB->splitBasicBlock(TOI.ReplCall);
   IRBuilder<> NewBuilder(&NewBB->front());
 
   // TODO: There is some potential here to share this code across both
   // the hip and cuda transforms... 
+  //
+  // The argument array only ever points at the argument slots, which
+  // are allocated in the entry block, so it is filled in there once.
   LLVM_DEBUG(dbgs() << "\t*- code gen packing of " << OrderedInputs.size()
                     << " kernel args.\n");
   PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
@@ -1365,31 +1727,87 @@ void HipLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   Value *ArgArray = EntryBuilder.CreateAlloca(ArrayTy);
   AllocaInst *HipStream = EntryBuilder.CreateAlloca(VoidPtrTy);
   EntryBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), HipStream);
-  bool StreamAssigned = false;
+  // A loop with a priority attribute launches on a stream of that
+  // priority.
+  if (unsigned Priority = TapirLoopHints(TL.getLoop()).getPriority())
+    NewBuilder.CreateCall(KitHipPriorityStreamFn,
+                          {HipStream, NewBuilder.getInt32(Priority)});
+  // When more than one pointer argument is prefetched the runtime
+  // prefetches them all with a single call, which also prefetches
+  // arguments that reference the same allocation only once.
+  SmallVector<Value *, 8> PrefetchArgs;
+  if (CodeGenPrefetch && !UnifiedMemory)
+    for (unsigned ArgNo = 0; ArgNo < OrderedInputs.size(); ArgNo++)
+      if (!isReductionArg(ArgNo) &&
+          OrderedInputs[ArgNo]->getType()->isPointerTy())
+        PrefetchArgs.push_back(OrderedInputs[ArgNo]);
+  bool BatchPrefetch = PrefetchArgs.size() > 1;
+
   unsigned int i = 0;
   for (Value *V : OrderedInputs) {
+    const tapir::GPUReductionArg *RA = isReductionArg(i);
+    Value *ArgV = V;
+    if (RA) {
+      // The kernel reduces into this argument.  The runtime provides a
+      // device-side copy of the (initial) value and copies the result
+      // back when the launch's stream is synchronized.  It also assigns
+      // a stream on the first call.
+      LLVM_DEBUG(dbgs() << "\t\t- code gen reduction mapping for kernel arg #"
+                        << i << "\n");
+      Value *DevPP = NewBuilder.CreateCall(
+          KitHipMemReduceMapFn,
+          {NewBuilder.CreateBitCast(V, VoidPtrTy),
+           ConstantInt::get(Type::getInt64Ty(Ctx), RA->Size), HipStream});
+      ArgV = NewBuilder.CreatePointerBitCastOrAddrSpaceCast(DevPP,
+                                                            V->getType());
+    }
     Value *VP = EntryBuilder.CreateAlloca(V->getType());
-    NewBuilder.CreateStore(V, VP);
-    Value *VoidVPtr = NewBuilder.CreateBitCast(VP, VoidPtrTy);
-    Value *ArgPtr =
-        NewBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, i);
-    NewBuilder.CreateStore(VoidVPtr, ArgPtr);
+    if (ArgV == V && InvariantArgPts.count(i))
+      new StoreInst(V, VP, InvariantArgPts[i]);
+    else
+      NewBuilder.CreateStore(ArgV, VP);
+    EntryBuilder.CreateStore(
+        VP, EntryBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, i));
     i++;
 
-    if (CodeGenPrefetch && V->getType()->isPointerTy()) {
+    if (!RA && !BatchPrefetch && CodeGenPrefetch && !UnifiedMemory &&
+        V->getType()->isPointerTy()) {
       LLVM_DEBUG(dbgs() << "\t\t- code gen prefetch for kernel arg #" 
                         << i << "\n");
       Value *VoidPP = NewBuilder.CreateBitCast(V, VoidPtrTy);
       Value *SPtr = NewBuilder.CreateLoad(VoidPtrTy, HipStream);
       Value *NewSPtr = 
         NewBuilder.CreateCall(KitHipMemPrefetchFn, {VoidPP, SPtr});
-      if (not StreamAssigned) {
-        NewBuilder.CreateStore(NewSPtr, HipStream);
-        StreamAssigned = true;
-      }
+      // Keep the first stream the runtime hands back.  A prefetch
+      // that only waits on an early prefetch also returns a stream,
+      // so a null result must not replace one already assigned.
+      Value *IsNewS = NewBuilder.CreateICmpEQ(
+          SPtr, ConstantPointerNull::get(VoidPtrTy));
+      NewBuilder.CreateStore(NewBuilder.CreateSelect(IsNewS, NewSPtr, SPtr),
+                             HipStream);
     }
   }
 
+  if (BatchPrefetch) {
+    LLVM_DEBUG(dbgs() << "\t\t- code gen batched prefetch of "
+                      << PrefetchArgs.size() << " kernel args\n");
+    ArrayType *PtrsTy = ArrayType::get(VoidPtrTy, PrefetchArgs.size());
+    Value *Ptrs = EntryBuilder.CreateAlloca(PtrsTy, nullptr, "kern.prefetch");
+    for (unsigned N = 0; N < PrefetchArgs.size(); N++)
+      NewBuilder.CreateStore(
+          NewBuilder.CreateBitCast(PrefetchArgs[N], VoidPtrTy),
+          NewBuilder.CreateConstInBoundsGEP2_32(PtrsTy, Ptrs, 0, N));
+    // The runtime keeps a stream that is already assigned and otherwise
+    // returns the first stream of a prefetch.
+    Value *SPtr = NewBuilder.CreateLoad(VoidPtrTy, HipStream);
+    Value *NewSPtr = NewBuilder.CreateCall(
+        KitHipMemPrefetchBatchFn,
+        {Ptrs,
+         ConstantInt::get(Type::getInt32Ty(Ctx), PrefetchArgs.size()),
+         SPtr});
+    NewBuilder.CreateStore(NewSPtr, HipStream);
+  }
+
   // The next step is prep for the actual kernel launch call via
   // the kitsune runtime.  We have to add some extra levels of
   // pointers to match API details, deal with some potential
@@ -1434,17 +1852,9 @@ void HipLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   // At this point we need a threads-per-block value for the launch
   // call.  The runtime will determine this value if ThreadsPerBlock
   // is zero but it can also be overridden via kitsune's forall launch
-  // attribute.  The catch here is the launch attribute's value for
-  // this is flexible and be a computed expression vs. a compile-time
-  // constant.  For this first step of creating the kernel launch, we
-  // take the path of a runtime configuration vs. an attributed
-  // launch.  This will get patched up as needed when we post-process
-  // the module and replace the DummyFBPtr (as we will also need to
-  // replace the kernel launch call parameter for threads-per-block if
-  // an attributed expression is present).  See postProcessModule()'s
-  // stage of finalizing the launch calls for details.
+  // attribute, which clang passes along as a (constant) loop hint.
   TapirLoopHints Hints(TL.getLoop());
-  unsigned ThreadsPerBlock = 0;
+  unsigned ThreadsPerBlock = Hints.getThreadsPerBlock();
   Constant *TPBlockValue =
       ConstantInt::get(Type::getInt32Ty(Ctx), ThreadsPerBlock);
 
@@ -1460,22 +1870,84 @@ void HipLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
   Constant *InstructionMix = ConstantStruct::get(
       KernelInstMixTy, ConstantInt::get(Int64Ty, InstMix.num_memory_ops),
       ConstantInt::get(Int64Ty, InstMix.num_flops),
-      ConstantInt::get(Int64Ty, InstMix.num_iops));
-
-  AllocaInst *AI = NewBuilder.CreateAlloca(KernelInstMixTy);
-  NewBuilder.CreateStore(InstructionMix, AI);      
+      ConstantInt::get(Int64Ty, InstMix.num_iops),
+      ConstantInt::get(Int64Ty, InstMix.num_memory_bytes),
+      ConstantInt::get(Int64Ty, ReductionArgs.empty()
+                                    ? 0
+                                    : (uint64_t)tapir::KernelReduction),
+      ConstantInt::get(Int64Ty, SharedMem.BytesPerThread),
+      ConstantInt::get(Int64Ty, SharedMem.Bytes),
+      tapir::getKernelSourceLocation(TL.getLoop(), M,
+                                     HIPABI_PREFIX + ".loc." + KernelName),
+      ConstantInt::get(Int64Ty, Hints.getMaxBlocksPerGrid()),
+      ConstantInt::get(Int64Ty, Hints.getSharedMemBytes()),
+      ConstantInt::get(Int64Ty, Hints.getItersPerThread()));
+
+  // The instruction mix is allocated up front; an alloca at the launch
+  // would grow the stack on every iteration of a host loop.
+  AllocaInst *AI = EntryBuilder.CreateAlloca(KernelInstMixTy);
+  NewBuilder.CreateStore(InstructionMix, AI);
+
+  // Each kernel gets a (null initialized) handle that the runtime
+  // uses to cache the kernel's launch details after the first launch.
+  // This avoids looking up the kernel by name on every launch.
+  GlobalVariable *LaunchHandle = new GlobalVariable(
+      M, VoidPtrTy, false, GlobalValue::InternalLinkage,
+      ConstantPointerNull::get(VoidPtrTy),
+      HIPABI_PREFIX + ".launch." + KernelName);
+  LaunchHandle->setAlignment(Align(DL.getPointerABIAlignment(0)));
+  TTarget->registerKernelLaunch(KNameParam, LaunchHandle);
 
   LLVM_DEBUG(dbgs() << "\t*- code gen kernel launch...\n");
   Value *KSPtr = NewBuilder.CreateLoad(VoidPtrTy, HipStream);
-  CallInst *LaunchStream = NewBuilder.CreateCall(KitHipLaunchFn,
+  CallInst *LaunchStream;
+  if (NumLaunchDims > 1) {
+    // Multi-dimensional launches pass the extents of the inner
+    // dimensions; the runtime derives the outermost extent from the
+    // trip count.
+    ArrayType *ExtentsTy = ArrayType::get(Int64Ty, NumLaunchDims - 1);
+    Value *Extents = EntryBuilder.CreateAlloca(ExtentsTy);
+    for (unsigned D = 0; D < NumLaunchDims - 1; D++) {
+      Value *Extent = LaunchExtents[D];
+      if (auto *A = dyn_cast<Argument>(Extent))
+        Extent = OrderedInputs[A->getArgNo()];
+      NewBuilder.CreateStore(
+          NewBuilder.CreateZExtOrTrunc(Extent, Int64Ty),
+          NewBuilder.CreateConstInBoundsGEP2_32(ExtentsTy, Extents, 0, D));
+    }
+    // The runtime reads the start argument to skip empty launches.
+    Constant *IVSize = ConstantInt::get(
+        Type::getInt32Ty(Ctx), DL.getTypeStoreSize(TripCount->getType()));
+    LaunchStream = NewBuilder.CreateCall(
+        KitHipLaunchNDFn,
+        {DummyFBPtr, KNameParam, argsPtr, CastTripCount, TPBlockValue, AI,
+         KSPtr, IVSize, LaunchHandle,
+         ConstantInt::get(Type::getInt32Ty(Ctx), NumLaunchDims),
+         NewBuilder.CreateConstInBoundsGEP2_32(ExtentsTy, Extents, 0, 0)});
+  } else
+    LaunchStream = NewBuilder.CreateCall(KitHipLaunchFn,
                         {DummyFBPtr, KNameParam, argsPtr, CastTripCount,
-                        TPBlockValue, AI, KSPtr});
+                        TPBlockValue, AI, KSPtr, LaunchHandle});
   NewBuilder.CreateStore(LaunchStream, HipStream);
   LLVM_DEBUG(dbgs() << "\t\t+- registering launch stream:\n"
                     << "\t\t\tcall: " << *LaunchStream << "\n"
                     << "\t\t\tstream: " << *HipStream << "\n");
   TTarget->registerLaunchStream(LaunchStream, HipStream);
 
+  if (CodeGenPrefetch && !UnifiedMemory && CodeGenHostPrefetch) {
+    SmallVector<Value *, 4> Ptrs, OutputPtrs;
+    unsigned ArgNo = 0;
+    for (Value *V : OrderedInputs) {
+      if (V->getType()->isPointerTy() && !isReductionArg(ArgNo)) {
+        Ptrs.push_back(V);
+        if (tapir::getKernelArgAccess(V) != tapir::KernelArgReadOnly)
+          OutputPtrs.push_back(V);
+      }
+      ArgNo++;
+    }
+    TTarget->registerLaunchPointers(LaunchStream, Ptrs, OutputPtrs);
+  }
+
   TOI.ReplCall->eraseFromParent();
   LLVM_DEBUG(dbgs() << "*** finished processing outlined call.\n");
 }
@@ -1497,6 +1969,14 @@ HipABI::HipABI(Module &InputModule)
   LLVM_DEBUG(dbgs() << "hipabi: creating target for module: '" << M.getName()
                     << "'\n");
 
+  std::optional<std::string> envCacheDir =
+      sys::Process::GetEnv("HIPABI_CACHE_DIR");
+  if (envCacheDir && BundleCacheDir.empty()) {
+    LLVM_DEBUG(dbgs() << "hipabi: bundle cache set via environment '"
+                      << envCacheDir.value() << "'.\n");
+    BundleCacheDir.setValue(envCacheDir.value());
+  }
+
   LLVMContext &Ctx = InputModule.getContext();
   Type *VoidTy = Type::getVoidTy(Ctx);
   PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
@@ -1517,6 +1997,11 @@ HipABI::HipABI(Module &InputModule)
   KitHipSyncFn = M.getOrInsertFunction("__kithip_sync_thread_stream",
                                        VoidTy, 
                                        VoidPtrTy); // no return, nor parameters
+  KitHipMemHostPrefetchFn =
+      M.getOrInsertFunction("__kithip_mem_host_prefetch",
+                            VoidPtrTy,  // returns the stream
+                            VoidPtrTy,  // managed pointer
+                            VoidPtrTy); // stream (null for thread stream)
   // Build the details we need for the AMDGPU/HIP target.
   std::string ArchString = "amdgcn";
   Triple TargetTriple(ArchString, "amd", "amdhsa");
@@ -1581,6 +2066,10 @@ HipABI::~HipABI() { /* no-op */
 std::unique_ptr<Module> &HipABI::getLibDeviceModule() {
 
   if (not LibDeviceModule) {
+    NamedRegionTimer NRT("getLibDeviceModule", "Load device libraries",
+                         TimerGroupName, TimerGroupDescription,
+                         TimePassesIsEnabled);
+    TimeTraceScope TTS("HipABI::getLibDeviceModule");
     LLVMContext &Ctx = KernelModule.getContext();
     llvm::SMDiagnostic SMD;
 
@@ -1709,7 +2198,97 @@ void HipABI::postProcessFunction(Function &F, bool OutliningTapirLoops) {
       }
     }
     SyncRegList.clear();
+    emitHostPrefetches(F);
+  }
+}
+
+// Prefetch the data written by the kernels launched from F back to the
+// host, but only the data the host reads (see
+// tapir::isReadOnHostAfterLaunch()).  The prefetch is ordered on the
+// stream of the launch, so it starts as soon as the kernel completes and
+// overlaps with any remaining device work and host code.  A launch
+// within loops whose iterations do not read the data prefetches at the
+// exits of the loops instead, rather than moving the data back and forth
+// on every iteration.  The pointer must reference a stable allocation.
+void HipABI::emitHostPrefetches(Function &F) {
+  if (LaunchPointers.empty())
+    return;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  DenseMap<const Value *, SmallVector<Instruction *, 4>> ObjLaunches;
+  for (auto &LP : LaunchPointers) {
+    if (LP.Launch->getFunction() != &F)
+      continue;
+    for (Value *Ptr : LP.Ptrs) {
+      SmallVector<Instruction *, 4> &Launches =
+          ObjLaunches[getUnderlyingObject(Ptr)];
+      if (!is_contained(Launches, LP.Launch))
+        Launches.push_back(LP.Launch);
+    }
+  }
+
+  LLVMContext &Ctx = M.getContext();
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  DenseSet<std::pair<const Value *, Loop *>> LoopExitsDone;
+  for (auto &LP : LaunchPointers) {
+    CallInst *LaunchCI = LP.Launch;
+    if (LaunchCI->getFunction() != &F)
+      continue;
+    // The launch's stream is stored right after the call; the prefetch
+    // follows it.
+    AllocaInst *StreamAI = getLaunchStream(LaunchCI);
+    Instruction *IP = LaunchCI->getNextNonDebugInstruction();
+    if (!StreamAI || !IP)
+      continue;
+    IP = IP->getNextNonDebugInstruction();
+    SmallPtrSet<const Value *, 4> Done;
+    for (Value *Ptr : LP.Outputs) {
+      const Value *Obj = getUnderlyingObject(Ptr);
+      if (!isa<Argument>(Obj) && !isa<GlobalVariable>(Obj) &&
+          !isa<AllocaInst>(Obj) && !isa<CallBase>(Obj))
+        continue;
+      if (!Done.insert(Obj).second)
+        continue;
+      SmallVector<Instruction *, 4> Others;
+      for (Instruction *Other : ObjLaunches.lookup(Obj))
+        if (Other != LaunchCI)
+          Others.push_back(Other);
+      Loop *ExitLoop = nullptr;
+      if (!tapir::isReadOnHostAfterLaunch(Ptr, LaunchCI, Others, DT, LI,
+                                          ExitLoop))
+        continue;
+
+      if (!ExitLoop) {
+        LLVM_DEBUG(dbgs() << "\t*- host prefetch of '" << Ptr->getName()
+                          << "' after launch: " << *LaunchCI << "\n");
+        IRBuilder<> B(IP);
+        B.CreateCall(KitHipMemHostPrefetchFn,
+                     {B.CreateBitCast(Ptr, VoidPtrTy), LaunchCI});
+        continue;
+      }
+      // The pointer must be available at the exits of the loop.
+      auto *PtrI = dyn_cast<Instruction>(Ptr);
+      if ((PtrI && ExitLoop->contains(PtrI->getParent())) ||
+          !LoopExitsDone.insert({Obj, ExitLoop}).second)
+        continue;
+      SmallVector<BasicBlock *, 4> Exits;
+      ExitLoop->getUniqueExitBlocks(Exits);
+      for (BasicBlock *Exit : Exits) {
+        LLVM_DEBUG(dbgs() << "\t*- host prefetch of '" << Ptr->getName()
+                          << "' at loop exit: " << Exit->getName() << "\n");
+        IRBuilder<> B(&*Exit->getFirstInsertionPt());
+        B.CreateCall(KitHipMemHostPrefetchFn,
+                     {B.CreateBitCast(Ptr, VoidPtrTy),
+                      B.CreateLoad(VoidPtrTy, StreamAI)});
+      }
+    }
   }
+
+  LaunchPointers.erase(
+      std::remove_if(LaunchPointers.begin(), LaunchPointers.end(),
+                     [&F](auto &LP) { return LP.Launch->getFunction() == &F; }),
+      LaunchPointers.end());
 }
 
 // We can't create a correct launch sequence until all the kernels
@@ -1803,6 +2382,7 @@ void HipABI::finalizeLaunchCalls(Module &M, GlobalVariable *BundleBin) {
 HipABIOutputFile HipABI::createTargetObj(const StringRef &ObjFileName) {
 
   LLVM_DEBUG(dbgs() << "\tgenerating amdgpu object file.\n");
+  TimeTraceScope TTS("HipABI::createTargetObj", KernelModule.getName());
 
   std::error_code EC;
   HipABIOutputFile ObjFile = std::make_unique<ToolOutputFile>(
@@ -1837,12 +2417,22 @@ HipABIOutputFile HipABI::createTargetObj(const StringRef &ObjFileName) {
     // These must be declared in this order so that they are destroyed in the
     // correct order due to inter-analysis-manager
     // references.
+    NamedRegionTimer NRT("optimizeKernelModule", "Optimize kernel module",
+                         TimerGroupName, TimerGroupDescription,
+                         TimePassesIsEnabled);
+    TimeTraceScope OptTTS("HipABI::optimizeKernelModule",
+                          KernelModule.getName());
     LoopAnalysisManager lam;
     FunctionAnalysisManager fam;
     CGSCCAnalysisManager cgam;
     ModuleAnalysisManager mam;
 
-    PassBuilder pb(AMDTargetMachine, pto);
+    // The standard instrumentation times (and traces) the passes run
+    // on each kernel.
+    PassInstrumentationCallbacks pic;
+    StandardInstrumentations si(KernelModule.getContext(), false);
+    si.registerCallbacks(pic, &mam);
+    PassBuilder pb(AMDTargetMachine, pto, std::nullopt, &pic);
     pb.registerModuleAnalyses(mam);
     pb.registerCGSCCAnalyses(cgam);
     pb.registerFunctionAnalyses(fam);
@@ -1858,6 +2448,10 @@ HipABIOutputFile HipABI::createTargetObj(const StringRef &ObjFileName) {
     LLVM_DEBUG(dbgs() << "\t\tpasses complete.\n");
   }
 
+  NamedRegionTimer NRT("emitObject", "Generate AMDGPU object",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope EmitTTS("HipABI::emitObject", KernelModule.getName());
   legacy::PassManager PassMgr;
   if (AMDTargetMachine->addPassesToEmitFile(PassMgr, ObjFile->os(), nullptr,
                                             CodeGenFileType::ObjectFile,
@@ -1874,6 +2468,10 @@ HipABIOutputFile HipABI::linkTargetObj(const HipABIOutputFile &ObjFile,
                                        const StringRef &LinkedObjFileName) {
   assert(ObjFile != nullptr && "null object file!");
   LLVM_DEBUG(dbgs() << "\tlinking amdgpu object file.\n");
+  NamedRegionTimer NRT("linkTargetObj", "Link AMDGPU object (lld)",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope TTS("HipABI::linkTargetObj", KernelModule.getName());
   std::error_code EC;
 
   HipABIOutputFile LinkedObjFile = std::make_unique<ToolOutputFile>(
@@ -1935,6 +2533,106 @@ HipABIOutputFile HipABI::linkTargetObj(const HipABIOutputFile &ObjFile,
   return LinkedObjFile;
 }
 
+// Wrap the linked code object in a clang offload bundle (see
+// clang/lib/Driver/OffloadBundler.cpp) and compress it in the same
+// "CCOB" format as 'clang-offload-bundler -compress', which the ROCm
+// runtime accepts in place of a plain code object.  The bundle holds an
+// empty host entry and the code object for the target, as the clang
+// HIP toolchain creates.
+HipABIOutputFile HipABI::compressBundle(const HipABIOutputFile &CodeObjFile,
+                                        const StringRef &BundleFileName) {
+  assert(CodeObjFile != nullptr && "null code object file!");
+  LLVM_DEBUG(dbgs() << "\tcreating compressed offload bundle.\n");
+  NamedRegionTimer NRT("compressBundle", "Compress code object bundle",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  TimeTraceScope TTS("HipABI::compressBundle", KernelModule.getName());
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> CodeObjOrErr =
+      MemoryBuffer::getFile(CodeObjFile->getFilename());
+  if (std::error_code EC = CodeObjOrErr.getError())
+    report_fatal_error("hipabi: failed to read code object: " +
+                       StringRef(EC.message()));
+  StringRef CodeObj = (*CodeObjOrErr)->getBuffer();
+
+  std::string TargetID = "hipv4-amdgcn-amd-amdhsa--" + GPUArch;
+  if (EnableSRAMECC)
+    TargetID += ":sramecc+";
+  if (EnableXnack)
+    TargetID += ":xnack+";
+  const std::string HostID = "host-" + M.getTargetTriple();
+
+  // The bundle: its magic string, the number of entries, the offset,
+  // size and (id) string of each entry and then the entries, each at a
+  // 4K aligned offset as the HIP toolchain lays them out.
+  const uint64_t BundleAlign = 4096;
+  uint64_t HeaderSize = strlen("__CLANG_OFFLOAD_BUNDLE__") + 8 +
+                        2 * 3 * 8 + HostID.size() + TargetID.size();
+  uint64_t CodeObjOffset = alignTo(HeaderSize, BundleAlign);
+  SmallVector<char, 0> Bundle;
+  raw_svector_ostream BOS(Bundle);
+  BOS << "__CLANG_OFFLOAD_BUNDLE__";
+  support::endian::write<uint64_t>(BOS, 2, llvm::endianness::little);
+  auto WriteEntry = [&BOS](StringRef ID, uint64_t Offset, uint64_t Size) {
+    support::endian::write<uint64_t>(BOS, Offset, llvm::endianness::little);
+    support::endian::write<uint64_t>(BOS, Size, llvm::endianness::little);
+    support::endian::write<uint64_t>(BOS, ID.size(), llvm::endianness::little);
+    BOS << ID;
+  };
+  WriteEntry(HostID, HeaderSize, 0);
+  WriteEntry(TargetID, CodeObjOffset, CodeObj.size());
+  BOS.write_zeros(CodeObjOffset - Bundle.size());
+  BOS << CodeObj;
+
+  compression::Format Format;
+  if (compression::zstd::isAvailable())
+    Format = compression::Format::Zstd;
+  else if (compression::zlib::isAvailable())
+    Format = compression::Format::Zlib;
+  else
+    report_fatal_error("hipabi: compressed bundles require zstd or zlib "
+                       "support (see -hipabi-compress-bundle)!");
+
+  SmallVector<uint8_t, 0> Compressed;
+  compression::compress(Format, arrayRefFromStringRef(StringRef(
+                                    Bundle.data(), Bundle.size())),
+                        Compressed);
+
+  // The compressed bundle header holds the (truncated) MD5 hash of the
+  // uncompressed bundle, which the runtime also uses to recognize a code
+  // object that it has already loaded.
+  MD5 Hash;
+  Hash.update(StringRef(Bundle.data(), Bundle.size()));
+  MD5::MD5Result Result;
+  Hash.final(Result);
+
+  std::error_code EC;
+  HipABIOutputFile BundleFile = std::make_unique<ToolOutputFile>(
+      BundleFileName, EC, sys::fs::OpenFlags::OF_None);
+  if (EC) {
+    errs() << "hipabi: failed to open file '" << BundleFileName
+           << "':" << EC.message();
+    report_fatal_error("hip code transformation failed!");
+  }
+  raw_ostream &OS = BundleFile->os();
+  OS << "CCOB";
+  support::endian::write<uint16_t>(OS, 1, llvm::endianness::little);
+  support::endian::write<uint16_t>(OS, static_cast<uint16_t>(Format),
+                                   llvm::endianness::little);
+  support::endian::write<uint32_t>(OS, Bundle.size(),
+                                   llvm::endianness::little);
+  support::endian::write<uint64_t>(OS, Result.low(), llvm::endianness::little);
+  OS.write(reinterpret_cast<const char *>(Compressed.data()),
+           Compressed.size());
+  BundleFile->keep();
+
+  LLVM_DEBUG(dbgs() << "\t\tbundle: " << Bundle.size() << " bytes, "
+                    << "compressed: " << Compressed.size() << " bytes ("
+                    << (Format == compression::Format::Zstd ? "zstd" : "zlib")
+                    << ").\n");
+  return BundleFile;
+}
+
 HipABIOutputFile HipABI::createBundleFile() {
   // At this point the kernel module should have all the necessary
   // pieces from the input module. Convert the kernel module into
@@ -1948,6 +2646,7 @@ HipABIOutputFile HipABI::createBundleFile() {
   // of tools (e.g., rocm-obj) don't appear to work correctly.
 
   LLVM_DEBUG(dbgs() << "hip-abi: creating binary bundle (fat binary).\n");
+  TimeTraceScope TTS("HipABI::createBundleFile", KernelModule.getName());
 
   std::error_code EC;
 
@@ -1969,6 +2668,16 @@ HipABIOutputFile HipABI::createBundleFile() {
   if (not KeepIntermediateFiles)
     sys::fs::remove(ObjFile->getFilename());
 
+  if (CompressBundle) {
+    SmallString<255> CompressedFileName(BundleFileName);
+    sys::path::replace_extension(CompressedFileName, ".hipfb.z");
+    HipABIOutputFile CompressedFile =
+        compressBundle(LinkedObjFile, CompressedFileName);
+    if (not KeepIntermediateFiles)
+      sys::fs::remove(LinkedObjFile->getFilename());
+    return CompressedFile;
+  }
+
   LLVM_DEBUG(dbgs() << "\tfat binary files:\n"
                     << "\t\tobject file: " << ObjFile->getFilename() << "\n"
                     << "\t\tlinked obj file: " << LinkedObjFile->getFilename()
@@ -1978,10 +2687,33 @@ HipABIOutputFile HipABI::createBundleFile() {
   return LinkedObjFile;
 }
 
-GlobalVariable *HipABI::embedBundle(HipABIOutputFile &BundleFile) {
+// Return the key for the bundle cache: a hash of the (linked) kernel
+// module along with everything else that feeds device code generation --
+// the target processor and features, optimization level, ROCm ABI, bundle
+// format and the version of LLVM.
+std::string HipABI::getBundleCacheKey() {
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(KernelModule, OS);
+
+  MD5 Hash;
+  Hash.update(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(Bitcode.data()), Bitcode.size()));
+  Hash.update(AMDTargetMachine->getTargetCPU().str() + ";");
+  Hash.update(AMDTargetMachine->getTargetFeatureString().str() + ";");
+  Hash.update("O" + utostr(OptLevel) + ";");
+  Hash.update(ROCmABITarget == ROCm_ABI_V5 ? "v5;" : "v4;");
+  Hash.update(CompressBundle ? "ccob;" : "elf;");
+  Hash.update(LLVM_VERSION_STRING);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  return Result.digest().str().str();
+}
+
+GlobalVariable *HipABI::embedBundle(StringRef BundleFileName) {
   std::unique_ptr<llvm::MemoryBuffer> Bundle = nullptr;
   ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
-      MemoryBuffer::getFile(BundleFile->getFilename());
+      MemoryBuffer::getFile(BundleFileName);
 
   if (std::error_code EC = BufferOrErr.getError()) {
     report_fatal_error("hipabi: failed to load bundle file: " +
@@ -2112,6 +2844,7 @@ Function *HipABI::createCtor(GlobalVariable *Bundle, GlobalVariable *Wrapper) {
   BasicBlock *CtorEntryBB = BasicBlock::Create(Ctx, "entry", CtorFn);
   IRBuilder<> CtorBuilder(CtorEntryBB);
   const DataLayout &DL = M.getDataLayout();
+  guardMultiTargetCtor(CtorBuilder, MultiTargetKind::Hip);
 
   LLVM_DEBUG(dbgs() << "\tadd runtime initialization...\n");
   if (EnableXnack) {
@@ -2125,6 +2858,14 @@ Function *HipABI::createCtor(GlobalVariable *Bundle, GlobalVariable *Wrapper) {
   CtorBuilder.CreateCall(KitRTSetDefaultMaxTheadsPerBlockFn,
                          {ConstantInt::get(IntTy, MaxThreadsPerBlock)});
 
+  // Launch parameters are sized in whole wavefronts of the generated
+  // kernels rather than the device's native wavefront size.
+  FunctionCallee KitRTSetWavefrontSizeFn = M.getOrInsertFunction(
+      "__kithip_set_wavefront_size", VoidTy, IntTy);
+  CtorBuilder.CreateCall(
+      KitRTSetWavefrontSizeFn,
+      {ConstantInt::get(IntTy, Use64ElementWavefront ? 64 : 32)});
+
   FunctionCallee KitRTInitFn =
       M.getOrInsertFunction("__kithip_initialize", VoidTy);
   CtorBuilder.CreateCall(KitRTInitFn, {});
@@ -2152,6 +2893,34 @@ Function *HipABI::createCtor(GlobalVariable *Bundle, GlobalVariable *Wrapper) {
                                                HIPABI_PREFIX + "__hip_fatbin");
   HandlePtr->setAlignment(DL.getPointerPrefAlignment());
 
+  // Give the runtime the chance to load the code object and resolve
+  // its kernels in the background (see __kithip_preload_module())
+  // instead of within the first launch of each kernel.
+  if (PreloadModules && !KernelLaunches.empty()) {
+    SmallVector<Constant *, 8> Names, Handles;
+    for (auto &KL : KernelLaunches) {
+      Names.push_back(ConstantExpr::getPointerCast(KL.first, VoidPtrTy));
+      Handles.push_back(KL.second);
+    }
+    ArrayType *ListTy = ArrayType::get(VoidPtrTy, KernelLaunches.size());
+    GlobalVariable *NameList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Names), HIPABI_PREFIX + ".kernel_names");
+    GlobalVariable *HandleList = new GlobalVariable(
+        M, ListTy, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(ListTy, Handles), HIPABI_PREFIX + ".kernel_handles");
+    FunctionCallee PreloadFn = M.getOrInsertFunction(
+        "__kithip_preload_module", VoidTy,
+        VoidPtrTy,  // code object (bundle)
+        VoidPtrTy,  // kernel names
+        VoidPtrTy,  // kernel launch handles
+        IntTy);     // number of kernels
+    CtorBuilder.CreateCall(
+        PreloadFn,
+        {CtorBuilder.CreateBitCast(Bundle, VoidPtrTy), NameList, HandleList,
+         ConstantInt::get(IntTy, KernelLaunches.size())});
+  }
+
   // TODO: It is not 100% clear what calls we actually need to make
   // here for kernel, variable, etc. registration with HIP/ROCm.  Clang
   // makes these calls but it is unclear when this is actually
@@ -2315,10 +3084,34 @@ void HipABI::postProcessModule() {
   // module.
   LLVM_DEBUG(dbgs() << "\n"
                     << "hipabi: CREATING MODULE FATBINARY...\n");
-  HipABIOutputFile BundleFile = createBundleFile();
-  LLVM_DEBUG(dbgs() << "\n"
-                    << "hipabi: EMBEDDING AND REGISTERING FATBINARY...\n");
-  GlobalVariable *Bundle = embedBundle(BundleFile);
+  // Unchanged kernel modules can reuse a cached bundle and skip device
+  // code generation (the AMDGPU backend and ld.lld) entirely.
+  SmallString<255> CacheFileName;
+  if (!BundleCacheDir.empty()) {
+    CacheFileName = BundleCacheDir;
+    sys::path::append(CacheFileName, getBundleCacheKey() + ".hipfatbin");
+  }
+
+  GlobalVariable *Bundle;
+  SmallString<255> BundleFileName;
+  if (!CacheFileName.empty() && sys::fs::exists(CacheFileName)) {
+    LLVM_DEBUG(dbgs() << "\t- using cached bundle '" << CacheFileName
+                      << "'.\n");
+    Bundle = embedBundle(CacheFileName);
+  } else {
+    HipABIOutputFile BundleFile;
+    {
+      tapir::GPUCodegenJob Job;
+      BundleFile = createBundleFile();
+    }
+    if (!CacheFileName.empty())
+      tapir::cacheGPUBinary(BundleFile->getFilename(), CacheFileName,
+                            "hipabi");
+    LLVM_DEBUG(dbgs() << "\n"
+                      << "hipabi: EMBEDDING AND REGISTERING FATBINARY...\n");
+    BundleFileName = BundleFile->getFilename();
+    Bundle = embedBundle(BundleFileName);
+  }
   registerBundle(Bundle);
 
   // Before we finish we now need to patch the launch calls that were
@@ -2330,52 +3123,17 @@ void HipABI::postProcessModule() {
   LLVM_DEBUG(saveModuleToFile(&KernelModule, KernelModule.getName().str(),
                               ".hipabi.final.ll"));
 
-  // EXPERIMENTAL: We have removed code from the host side and
-  // inserted some additional code.  Re-run a series of optimization
-  // passes -- in general the return on investment here is probably
-  // pretty low but we have yet to dig into any details.  For now
-  // we will only run this at the highest optimization levels.
+  // We have removed code from the host side and inserted launch setup in
+  // its place.  Clean up the functions with launches, with a pipeline
+  // built for the host target.
   if (HostOptLevel > 0) {
-    LLVM_DEBUG(dbgs() << "hipabi: Running experimental post-transform "
-                      << "host-side (re)optimization passes.\n");
-
-    PipelineTuningOptions pto;
-    pto.LoopVectorization = HostOptLevel > 2;
-    pto.SLPVectorization = HostOptLevel > 2;
-    pto.LoopUnrolling = HostOptLevel > 1;
-    pto.LoopInterleaving = HostOptLevel > 1;
-    pto.LoopStripmine = false;
-    LoopAnalysisManager lam;
-    FunctionAnalysisManager fam;
-    CGSCCAnalysisManager cgam;
-    ModuleAnalysisManager mam;
-    PassBuilder pb(AMDTargetMachine, pto);
-    pb.registerModuleAnalyses(mam);
-    pb.registerCGSCCAnalyses(cgam);
-    pb.registerFunctionAnalyses(fam);
-    pb.registerLoopAnalyses(lam);
-    AMDTargetMachine->registerPassBuilderCallbacks(pb, false);
-    pb.crossRegisterProxies(lam, fam, cgam, mam);
-
-    OptimizationLevel optLevels[] = {
-        OptimizationLevel::O0,
-        OptimizationLevel::O1,
-        OptimizationLevel::O2,
-        OptimizationLevel::O3,
-    };
-
-    if (HostOptLevel > 3)
-      HostOptLevel = 3;
-    OptimizationLevel optLevel = optLevels[HostOptLevel];
-    ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(optLevel);
-    mpm.addPass(VerifierPass());
-    pb.buildPerModuleDefaultPipeline(optLevel);
-    mpm.addPass(VerifierPass());
-    mpm.run(M, mam);
+    LLVM_DEBUG(dbgs() << "hipabi: Running post-transform host-side "
+                      << "cleanup passes.\n");
+    tapir::optimizeGPUHostCode(M, HostOptLevel, "__kithip_");
   }
 
-  if (not KeepIntermediateFiles)
-    sys::fs::remove(BundleFile->getFilename());
+  if (not KeepIntermediateFiles && !BundleFileName.empty())
+    sys::fs::remove(BundleFileName);
 }
 
 LoopOutlineProcessor *HipABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
@@ -2401,6 +3159,16 @@ LoopOutlineProcessor *HipABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
   }
 
   HipLoop *Outliner = new HipLoop(M, KernelModule, KernelName, this);
+  // Loops whose iterations cooperate in lane groups only run on the GPU.
+  if (TapirLoopHints(TheLoop).getGPULanes())
+    return Outliner;
+  // Hybrid loops also run part of their iterations on the host.
+  if (TapirLoopHints(TheLoop).getHybrid())
+    return new HybridLoop(M, Outliner);
+  // Launches with small trip counts may run on the host.  The runtime
+  // only knows that the data is in host memory if launches map it.
+  if (EnableTapirHostFallback && CodeGenPrefetch)
+    return new HostFallbackLoop(M, Outliner);
   return Outliner;
 }
 
@@ -32,6 +32,7 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ModRef.h"
 #include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/EscapeEnumerator.h"
 #include "llvm/Transforms/Utils/Local.h"
@@ -50,6 +51,9 @@ static cl::opt<std::string>
 
 static const StringRef StackFrameName = "__rts_sf";
 
+// Annotation that marks a function of the runtime bitcode for inlining.
+static const StringRef InlineAnnotation = "tapir_rts_inline";
+
 namespace {
 
 // Custom DiagnosticInfo for linking the Lambda ABI bitcode file.
@@ -117,9 +121,7 @@ void LambdaABI::prepareModule() {
   Type *Int32Ty = Type::getInt32Ty(C);
   Type *Int64Ty = Type::getInt64Ty(C);
 
-  // If a runtime bitcode path is given via the command line, use it.
-  if ("" != ClRuntimeBCPath)
-    RuntimeBCPath = ClRuntimeBCPath;
+  RuntimeBCPath = getRuntimeBCPath();
 
   if ("" == RuntimeBCPath) {
     C.emitError("LambdaABI: No bitcode ABI file given.");
@@ -171,6 +173,8 @@ void LambdaABI::prepareModule() {
     if (Fail)
       C.emitError("LambdaABI: Failed to link bitcode ABI file: " +
                   Twine(RuntimeBCPath));
+    else if (!DebugABICalls)
+      inlineAnnotatedFunctions();
 
     // Restore the original DiagnosticHandler for this context.
     C.setDiagnosticHandler(std::move(OrigDiagHandler));
@@ -203,6 +207,8 @@ void LambdaABI::prepareModule() {
   FunctionType *Grainsize32FnTy = FunctionType::get(Int32Ty, {Int32Ty}, false);
   FunctionType *Grainsize64FnTy = FunctionType::get(Int64Ty, {Int64Ty}, false);
   FunctionType *WorkerInfoTy = FunctionType::get(Int32Ty, {}, false);
+  FunctionType *LoopFnTy = FunctionType::get(
+      VoidTy, {VoidPtrTy, VoidPtrTy, Int64Ty, Int64Ty, Int64Ty}, false);
 
   // Create an array of RTS functions, with their associated types and
   // FunctionCallee member variables in the LambdaABI class.
@@ -218,6 +224,7 @@ void LambdaABI::prepareModule() {
       {"__rts_loop_grainsize_64", Grainsize64FnTy, RTSLoopGrainsize64},
       {"__rts_get_num_workers", WorkerInfoTy, RTSGetNumWorkers},
       {"__rts_get_worker_id", WorkerInfoTy, RTSGetWorkerID},
+      {"__rts_loop", LoopFnTy, RTSLoop},
   };
 
   // Add attributes to internalized functions.
@@ -268,6 +275,89 @@ void LambdaABI::prepareModule() {
   }
 }
 
+/// Get the path to the runtime bitcode file, preferring the one given on the
+/// command line.
+StringRef LambdaABI::getRuntimeBCPath() const {
+  if ("" != ClRuntimeBCPath)
+    return ClRuntimeBCPath;
+  return RuntimeBCPath;
+}
+
+/// Returns true if the runtime bitcode defines __rts_loop.  Tapir loops are
+/// outlined before prepareModule links the runtime, so this peeks at the
+/// bitcode file in a separate context.
+bool LambdaABI::runtimeDefinesLoop() {
+  if (RuntimeHasLoop)
+    return *RuntimeHasLoop;
+
+  RuntimeHasLoop = false;
+  StringRef Path = getRuntimeBCPath();
+  if ("" == Path)
+    return false;
+  LLVMContext ProbeC;
+  SMDiagnostic SMD;
+  if (std::unique_ptr<Module> RTSModule =
+          getLazyIRFileModule(Path, SMD, ProbeC))
+    if (Function *Fn = RTSModule->getFunction("__rts_loop"))
+      RuntimeHasLoop = !Fn->isDeclaration();
+  return *RuntimeHasLoop;
+}
+
+/// Force-inline the functions of the runtime bitcode annotated with
+/// __attribute__((annotate("tapir_rts_inline"))).  These are the fast paths
+/// behind the entry points of a custom runtime, which would otherwise remain
+/// calls once the entry points themselves are inlined.
+void LambdaABI::inlineAnnotatedFunctions() {
+  GlobalVariable *Annotations = M.getNamedGlobal("llvm.global.annotations");
+  if (!Annotations || !Annotations->hasInitializer())
+    return;
+  ConstantArray *Entries =
+      dyn_cast<ConstantArray>(Annotations->getInitializer());
+  if (!Entries)
+    return;
+
+  for (Value *Op : Entries->operands()) {
+    // Each entry is { ptr value, ptr annotation, ptr file, i32 line, ptr args }.
+    ConstantStruct *Entry = dyn_cast<ConstantStruct>(Op);
+    if (!Entry || Entry->getNumOperands() < 2)
+      continue;
+    Function *Fn = dyn_cast<Function>(Entry->getOperand(0)->stripPointerCasts());
+    GlobalVariable *Str =
+        dyn_cast<GlobalVariable>(Entry->getOperand(1)->stripPointerCasts());
+    if (!Fn || Fn->isDeclaration() || !Str || !Str->hasInitializer())
+      continue;
+    ConstantDataSequential *Data =
+        dyn_cast<ConstantDataSequential>(Str->getInitializer());
+    if (!Data || !Data->isCString() || Data->getAsCString() != InlineAnnotation)
+      continue;
+    // A runtime built without optimization marks everything optnone, which
+    // requires noinline.
+    if (Fn->hasFnAttribute(Attribute::OptimizeNone))
+      continue;
+    LLVM_DEBUG(dbgs() << "Inlining annotated runtime function "
+                      << Fn->getName() << "\n");
+    Fn->removeFnAttr(Attribute::NoInline);
+    Fn->addFnAttr(Attribute::AlwaysInline);
+  }
+}
+
+FunctionCallee LambdaABI::getRTSLoop() {
+  if (RTSLoop)
+    return RTSLoop;
+
+  // Tapir loops are processed before prepareModule declares the RTS
+  // functions.
+  LLVMContext &C = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  RTSLoop = M.getOrInsertFunction(
+      "__rts_loop",
+      FunctionType::get(Type::getVoidTy(C),
+                        {PtrTy, PtrTy, Int64Ty, Int64Ty, Int64Ty}, false));
+  cast<Function>(RTSLoop.getCallee())->setDoesNotThrow();
+  return RTSLoop;
+}
+
 void LambdaABI::addHelperAttributes(Function &Helper) {
   // Inlining the helper function is not legal.
   Helper.removeFnAttr(Attribute::AlwaysInline);
@@ -573,3 +663,98 @@ void LambdaABI::processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) {
 
   ReplCall->eraseFromParent();
 }
+
+LoopOutlineProcessor *
+LambdaABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
+  // Loops that may throw, run over an inclusive range or need more than 64
+  // bits of iterations keep the default lowering, as do all loops if the
+  // runtime has no loop entry point.
+  if (TL->getUnwindDest() || TL->isInclusiveRange() ||
+      TL->getTripCount()->getType()->getIntegerBitWidth() > 64)
+    return nullptr;
+  if (!runtimeDefinesLoop())
+    return nullptr;
+  return new LambdaLoop(M, this);
+}
+
+// --- Loop Outliner
+
+void LambdaLoop::postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                    ValueToValueMapTy &VMap) {
+  LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
+
+  // The cloned loop has been serialized; the runtime runs each chunk of
+  // iterations in order.
+  Value *SR = TL.getTask()->getDetach()->getSyncRegion();
+  if (auto *ClonedSR = dyn_cast_or_null<Instruction>(VMap.lookup(SR)))
+    if (ClonedSR->use_empty())
+      ClonedSR->eraseFromParent();
+}
+
+void LambdaLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                         TaskOutlineInfo &TOI,
+                                         DominatorTree &DT) {
+  Function *Helper = TOI.Outline;
+  CallBase *ReplCall = cast<CallBase>(TOI.ReplCall);
+  Function *Parent = ReplCall->getFunction();
+  LLVMContext &C = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+
+  // The start, end and grainsize of the helper follow its sret parameter, if
+  // it has one.
+  unsigned IVIdx = Helper->hasParamAttribute(0, Attribute::StructRet) ? 1 : 0;
+
+  // Marshal the helper's arguments into a structure that the chunk callback
+  // reads.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *V : ReplCall->args())
+    ArgTys.push_back(V->getType());
+  StructType *ArgsTy = StructType::get(C, ArgTys);
+
+  IRBuilder<> EntryBuilder(Parent->getEntryBlock().getFirstNonPHIOrDbg());
+  AllocaInst *Args =
+      EntryBuilder.CreateAlloca(ArgsTy, nullptr, "rts.loop.args");
+  IRBuilder<> B(ReplCall);
+  for (unsigned i = 0; i < ReplCall->arg_size(); ++i)
+    B.CreateStore(ReplCall->getArgOperand(i),
+                  B.CreateStructGEP(ArgsTy, Args, i));
+
+  // The callback runs the helper over a chunk of the iterations:
+  //
+  //     void body(args *A, uint64_t lo, uint64_t hi) {
+  //       helper(lo, hi, A->...);
+  //     }
+  Function *Body = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), {PtrTy, Int64Ty, Int64Ty}, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".rts_loop", &M);
+  Body->addFnAttr(Attribute::NoUnwind);
+  {
+    IRBuilder<> BB(BasicBlock::Create(C, "entry", Body));
+    Argument *BodyArgs = Body->getArg(0);
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0; i < ArgTys.size(); ++i) {
+      if (i == IVIdx || i == IVIdx + 1)
+        HelperArgs.push_back(
+            BB.CreateTrunc(Body->getArg(1 + i - IVIdx), ArgTys[i]));
+      else
+        HelperArgs.push_back(BB.CreateLoad(
+            ArgTys[i], BB.CreateStructGEP(ArgsTy, BodyArgs, i)));
+    }
+    CallInst *Call = BB.CreateCall(Helper, HelperArgs);
+    Call->setCallingConv(Helper->getCallingConv());
+    Call->setDoesNotThrow();
+    BB.CreateRetVoid();
+  }
+
+  Value *Start = B.CreateZExt(ReplCall->getArgOperand(IVIdx), Int64Ty);
+  Value *End = B.CreateZExt(ReplCall->getArgOperand(IVIdx + 1), Int64Ty);
+  Value *Grainsize =
+      B.CreateZExtOrTrunc(ReplCall->getArgOperand(IVIdx + 2), Int64Ty);
+  CallInst *Loop = B.CreateCall(TTarget->getRTSLoop(),
+                                {Body, Args, Start, End, Grainsize});
+  Loop->setDebugLoc(ReplCall->getDebugLoc());
+
+  TOI.replaceReplCall(Loop);
+  ReplCall->eraseFromParent();
+}
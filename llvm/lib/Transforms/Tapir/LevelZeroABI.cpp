@@ -0,0 +1,1194 @@
+//===- LevelZeroABI.cpp - Tapir to Kitsune runtime Level Zero target -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+//
+// Copyright (c) 2021, 2024 Los Alamos National Security, LLC.
+//  All rights reserved.
+//
+// Copyright 2021, 2024. Los Alamos National Security, LLC. This
+//  software was produced under U.S. Government contract
+//  DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+//  is operated by Los Alamos National Security, LLC for the
+//  U.S. Department of Energy. The U.S. Government has rights to use,
+//  reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+//  NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+//  OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+//  If software is modified to produce derivative works, such modified
+//  software should be clearly marked, so as not to confuse it with
+//  the version available from LANL.
+//
+//  Additionally, redistribution and use in source and binary forms,
+//  with or without modification, are permitted provided that the
+//  following conditions are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Neither the name of Los Alamos National Security, LLC, Los
+//      Alamos National Laboratory, LANL, the U.S. Government, nor the
+//      names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior
+//      written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+//  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+//  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+//  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+//  AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+//  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+//  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//===----------------------------------------------------------------------===
+//
+// This file implements the Kitsune+Tapir Level Zero ABI to convert Tapir
+// instructions to calls into the Level Zero portions of the Kitsune
+// runtime.  Parallel loops are outlined into a kernel module that is
+// compiled into a SPIR-V binary (via LLVM's SPIR-V backend) and embedded
+// in the input LLVM Module.
+//
+// TODO: non-constant global variables are not yet supported in kernels.
+// TODO: reductions, multi-dimensional launches and shared memory tiles
+//       (see the HIP and CUDA targets).
+// TODO: device-side math support beyond the OpenCL builtins.
+//
+//===----------------------------------------------------------------------===//
+#include "llvm/Transforms/Tapir/LevelZeroABI.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirHybridLoop.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "zeabi" // support for -debug-only=zeabi
+
+static const std::string ZEABI_PREFIX = "__zeabi";
+static const std::string ZEABI_KERNEL_NAME_PREFIX = ZEABI_PREFIX + ".kern.";
+
+/// ## ZEABI Transformation Command Line Options ##
+///
+/// All of the transformation's command line options must be
+/// passed using the the `-mllvm` as the leading flag.  All
+/// transform options should have `-zeabi-` as the leading
+/// string.  A summary of these options is provided below.
+///
+///   * `-zeabi-opt-level=[0,1,2,3]`: Set the optimization
+///     level for the kernel module.  This corresponds directly
+///     to standard optimization levels but will be applied
+///     to the SPIR-V code created by the transformation (the
+///     driver's compiler optimizes the code again when the
+///     module is created at runtime).  This currently defaults
+///     to level 2.
+///
+///   * `-zeabi-prefetch`: Enable/Disable the generation of
+///     data prefetch calls prior to the kernel launch.  This
+///     is enabled by default given the use of shared (managed)
+///     memory allocations.
+///
+///   * `-zeabi-threads-per-blk`: Set the number of work items
+///     per work group for kernel launches.  The default (0)
+///     leaves the choice to the runtime, which uses the value
+///     of KITZE_THREADS_PER_BLOCK when it is set and the size
+///     suggested by the driver otherwise.
+///
+///   * `-zeabi-keep-files`: Save the SPIR-V binary created for
+///     the kernel module (as a '.spv' file).  This is helpful
+///     when debugging the transform (e.g., with spirv-dis).
+///
+namespace {
+
+cl::opt<unsigned>
+    OptLevel("zeabi-opt-level", cl::init(2), cl::NotHidden,
+             cl::desc("The Tapir Level Zero target transform optimization "
+                      "level."));
+
+cl::opt<bool> CodeGenPrefetch("zeabi-prefetch", cl::init(true), cl::Hidden,
+                              cl::desc("Enable generation of calls to "
+                                       "prefetch data prior to kernel "
+                                       "launches."));
+
+cl::opt<unsigned>
+    ThreadsPerBlock("zeabi-threads-per-blk", cl::init(0), cl::NotHidden,
+                    cl::desc("Number of work items per work group for "
+                             "kernel launches (0 = runtime selected)."));
+
+cl::opt<bool>
+    KeepIntermediateFiles("zeabi-keep-files", cl::init(false), cl::Hidden,
+                          cl::desc("Keep the SPIR-V binary created for the "
+                                   "kernel module."));
+
+// LLVM variable name for the (yet to be created) SPIR-V image.
+const char *ZEABI_DUMMY_IMAGE_NAME = "_zeabi.dummy_image";
+
+// --- Address spaces.
+//
+// The SPIR-V backend maps the default address space to the 'Function'
+// (private) storage class.  Kernels access shared (managed) allocations
+// through 'CrossWorkgroup' pointers, and code that can not tell where a
+// pointer came from (everything but the kernel parameters) uses the
+// 'Generic' address space.
+//
+//   See: https://llvm.org/docs/SPIRVUsage.html#address-spaces
+//
+const unsigned ZEABI_PRIVATE_ADDR_SPACE = 0; // function (private) storage.
+const unsigned ZEABI_GLOBAL_ADDR_SPACE = 1;  // cross work-group storage.
+const unsigned ZEABI_GENERIC_ADDR_SPACE = 4; // generic storage.
+
+// --- Some utility functions for helping during the transformation.
+
+/// Remap pointers in the default address space (including those
+/// nested within aggregate and function types) to the generic address
+/// space.  Named structures that (transitively) contain such pointers
+/// are replaced by new types.
+class ZeGenericTypeRemapper : public ValueMapTypeRemapper {
+public:
+  Type *remapType(Type *Ty) override {
+    auto It = Remapped.find(Ty);
+    if (It != Remapped.end())
+      return It->second;
+
+    Type *NewTy = Ty;
+    LLVMContext &Ctx = Ty->getContext();
+    if (auto *PT = dyn_cast<PointerType>(Ty)) {
+      if (PT->getAddressSpace() == ZEABI_PRIVATE_ADDR_SPACE)
+        NewTy = PointerType::get(Ctx, ZEABI_GENERIC_ADDR_SPACE);
+    } else if (auto *VT = dyn_cast<VectorType>(Ty)) {
+      NewTy = VectorType::get(remapType(VT->getElementType()),
+                              VT->getElementCount());
+    } else if (auto *AT = dyn_cast<ArrayType>(Ty)) {
+      NewTy = ArrayType::get(remapType(AT->getElementType()),
+                             AT->getNumElements());
+    } else if (auto *FT = dyn_cast<FunctionType>(Ty)) {
+      SmallVector<Type *, 8> Params;
+      for (Type *PT : FT->params())
+        Params.push_back(remapType(PT));
+      NewTy = FunctionType::get(remapType(FT->getReturnType()), Params,
+                                FT->isVarArg());
+    } else if (auto *ST = dyn_cast<StructType>(Ty)) {
+      if (!ST->isOpaque()) {
+        SmallVector<Type *, 8> Elements;
+        bool Changed = false;
+        for (Type *ET : ST->elements()) {
+          Elements.push_back(remapType(ET));
+          Changed |= Elements.back() != ET;
+        }
+        if (Changed) {
+          if (ST->isLiteral())
+            NewTy = StructType::get(Ctx, Elements, ST->isPacked());
+          else
+            NewTy = StructType::create(Ctx, Elements,
+                                       ST->getName().str() + ".generic",
+                                       ST->isPacked());
+        }
+      }
+    }
+    Remapped[Ty] = NewTy;
+    return NewTy;
+  }
+
+private:
+  DenseMap<Type *, Type *> Remapped;
+};
+
+/// @brief Look for an OpenCL builtin that replaces the given (libm)
+/// function on the device side.
+/// @param Fn - the function to resolve.
+/// @param KernelModule - Module containing the transformed device-side code.
+/// @return The resolved function -- nullptr if unresolved.
+Function *resolveDeviceFunction(Function *Fn, Module &KernelModule) {
+  // The SPIR-V backend lowers calls to (Itanium mangled) OpenCL builtins
+  // into the corresponding OpenCL extended instructions.  The builtins
+  // are overloaded for float and double so the mangled name encodes
+  // the parameter types.
+  static const char *MathBuiltins[] = {
+      "acos",  "acosh", "asin",  "asinh", "atan",   "atan2",    "atanh",
+      "cbrt",  "ceil",  "copysign", "cos", "cosh",  "erf",      "erfc",
+      "exp",   "exp10", "exp2",  "expm1", "fabs",   "fdim",     "floor",
+      "fma",   "fmax",  "fmin",  "fmod",  "hypot",  "lgamma",   "log",
+      "log10", "log1p", "log2",  "pow",   "round",  "sin",      "sinh",
+      "sqrt",  "tan",   "tanh",  "tgamma", "trunc"};
+
+  FunctionType *FTy = Fn->getFunctionType();
+  Type *RetTy = FTy->getReturnType();
+  if ((RetTy->isFloatTy() || RetTy->isDoubleTy()) && !FTy->isVarArg() &&
+      FTy->getNumParams() > 0 &&
+      all_of(FTy->params(), [RetTy](Type *T) { return T == RetTy; })) {
+    StringRef Name = Fn->getName();
+    if (RetTy->isFloatTy())
+      Name.consume_back("f");
+    for (const char *Builtin : MathBuiltins) {
+      if (Name == Builtin) {
+        std::string DevFnName = "_Z" + std::to_string(Name.size()) +
+                                Name.str() +
+                                std::string(FTy->getNumParams(),
+                                            RetTy->isFloatTy() ? 'f' : 'd');
+        LLVM_DEBUG(dbgs() << "\tresolved function '" << Fn->getName()
+                          << "()' as OpenCL builtin '" << DevFnName
+                          << "()'.\n");
+        FunctionCallee FCE =
+            KernelModule.getOrInsertFunction(DevFnName, FTy);
+        Function *DevFn = cast<Function>(FCE.getCallee());
+        DevFn->setCallingConv(CallingConv::SPIR_FUNC);
+        return DevFn;
+      }
+    }
+  }
+
+  if (Function *DevFn = KernelModule.getFunction(Fn->getName())) {
+    // Fn is present in the kernel module, use it as-is.
+    LLVM_DEBUG(dbgs() << "\tresolved function '" << DevFn->getName()
+                      << "()' in kernel module.\n");
+    return DevFn;
+  }
+  return nullptr;
+}
+
+std::set<GlobalValue *> &collect(Constant &c, std::set<GlobalValue *> &seen);
+
+std::set<GlobalValue *> &collect(BasicBlock &bb,
+                                 std::set<GlobalValue *> &seen) {
+  for (auto &inst : bb)
+    for (auto &op : inst.operands())
+      if (auto *c = dyn_cast<Constant>(&op))
+        collect(*c, seen);
+  return seen;
+}
+
+std::set<GlobalValue *> &collect(Function &f, std::set<GlobalValue *> &seen) {
+  seen.insert(&f);
+
+  for (auto &bb : f)
+    collect(bb, seen);
+  return seen;
+}
+
+std::set<GlobalValue *> &collect(GlobalVariable &g,
+                                 std::set<GlobalValue *> &seen) {
+  seen.insert(&g);
+
+  if (g.hasInitializer())
+    collect(*g.getInitializer(), seen);
+  return seen;
+}
+
+std::set<GlobalValue *> &collect(BlockAddress &blkaddr,
+                                 std::set<GlobalValue *> &seen) {
+  if (Function *f = blkaddr.getFunction())
+    collect(*f, seen);
+  if (BasicBlock *bb = blkaddr.getBasicBlock())
+    collect(*bb, seen);
+  return seen;
+}
+
+std::set<GlobalValue *> &collect(Constant &c, std::set<GlobalValue *> &seen) {
+  if (GlobalValue *g = dyn_cast<GlobalValue>(&c))
+    if (seen.find(g) != seen.end())
+      return seen;
+
+  if (auto *f = dyn_cast<Function>(&c))
+    return collect(*f, seen);
+  else if (auto *g = dyn_cast<GlobalVariable>(&c))
+    return collect(*g, seen);
+  else if (isa<GlobalAlias>(&c) || isa<GlobalIFunc>(&c))
+    report_fatal_error("zeabi: global aliases and GNU IFUNCs are not "
+                       "supported in kernels!");
+  else if (auto *blkaddr = dyn_cast<BlockAddress>(&c))
+    return collect(*blkaddr, seen);
+  else
+    for (auto &op : c.operands())
+      if (auto *cop = dyn_cast<Constant>(op))
+        collect(*cop, seen);
+  return seen;
+}
+
+} // namespace
+
+// --- Loop Outliner
+
+unsigned ZeLoop::NextKernelID = 0;
+
+ZeLoop::ZeLoop(Module &M, Module &KModule, const std::string &Name,
+               LevelZeroABI *LoopTarget)
+    : LoopOutlineProcessor(M, KModule), TTarget(LoopTarget), KernelName(Name),
+      KernelModule(KModule) {
+
+  KernelID = NextKernelID++;
+  KernelName = KernelName + "." + Twine(KernelID).str();
+
+  LLVM_DEBUG(dbgs() << "zeabi: level zero loop outliner creation:\n"
+                    << "\ttransforming loop to kernel: " << KernelName
+                    << "(...)\n"
+                    << "\tdevice-side module name    : "
+                    << KernelModule.getName() << "\n\n");
+
+  LLVMContext &Ctx = KernelModule.getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+
+  // The global work-item ID (OpenCL's get_global_id()).  The SPIR-V
+  // backend recognizes the mangled builtin and lowers it to the
+  // GlobalInvocationId builtin variable.
+  KitZeGlobalIdFn = KernelModule.getOrInsertFunction(
+      "_Z13get_global_idj",
+      Int64Ty,  // return global work-item id (size_t).
+      Int32Ty); // axis/index select (x=0, y=1, z=2).
+  cast<Function>(KitZeGlobalIdFn.getCallee())
+      ->setCallingConv(CallingConv::SPIR_FUNC);
+
+  // Get entry points into the Level Zero portion of the Kitsune runtime.
+  KitZeLaunchFn = M.getOrInsertFunction("__kitze_launch_kernel",
+      VoidPtrTy,   // return an opaque stream (command list)
+      VoidPtrTy,   // SPIR-V image
+      Int64Ty,     // size of the image in bytes
+      VoidPtrTy,   // kernel name
+      VoidPtrTy,   // arguments
+      VoidPtrTy,   // argument sizes
+      Int32Ty,     // number of arguments
+      Int64Ty,     // trip count
+      Int32Ty,     // threads-per-block
+      VoidPtrTy,   // opaque stream
+      VoidPtrTy);  // kernel launch handle
+  KitZeMemPrefetchFn = M.getOrInsertFunction("__kitze_mem_gpu_prefetch",
+                                             VoidPtrTy,  // return an opaque stream
+                                             VoidPtrTy,  // pointer to prefetch
+                                             VoidPtrTy); // use opaque stream.
+}
+
+ZeLoop::~ZeLoop() { /* no-op */
+}
+
+void ZeLoop::setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                                  SmallVectorImpl<Value *> &HelperInputs,
+                                  ValueSet &InputSet,
+                                  const SmallVectorImpl<Value *> &LCArgs,
+                                  const SmallVectorImpl<Value *> &LCInputs,
+                                  const ValueSet &TLInputsFixed) {
+
+  LLVM_DEBUG(dbgs() << "\n\n"
+                    << "zeabi: SETTING UP LOOP OUTLINE ARGUMENTS FOR '"
+                    << F.getName() << "()'.\n");
+
+  // Add the loop control inputs -- the first parameter defines
+  // the extent of the index space.
+  {
+    Argument *EndArg = cast<Argument>(LCArgs[1]);
+    EndArg->setName(".kern.input_size");
+    HelperArgs.insert(EndArg);
+
+    Value *InputVal = LCInputs[1];
+    HelperInputs.push_back(InputVal);
+    InputSet.insert(InputVal);
+  }
+
+  // The second parameter defines the start of the
+  // index space.
+  {
+    Argument *StartArg = cast<Argument>(LCArgs[0]);
+    StartArg->setName(".kern.start_idx");
+    HelperArgs.insert(StartArg);
+
+    Value *InputVal = LCInputs[0];
+    HelperInputs.push_back(InputVal);
+    InputSet.insert(InputVal);
+  }
+
+  // The third parameter defines the grain size, if it is
+  // not constant.
+  if (!isa<ConstantInt>(LCInputs[2])) {
+    Argument *GrainsizeArg = cast<Argument>(LCArgs[2]);
+    GrainsizeArg->setName(".kern.grain_size");
+    HelperArgs.insert(GrainsizeArg);
+
+    Value *InputVal = LCInputs[2];
+    HelperInputs.push_back(InputVal);
+    InputSet.insert(InputVal);
+  }
+
+  // Add the loop-centric kernel parameters (i.e., variables/arrays
+  // used in the loop body).
+  for (Value *V : TLInputsFixed) {
+    HelperArgs.insert(V);
+    HelperInputs.push_back(V);
+  }
+
+  for (Value *V : HelperInputs)
+    OrderedInputs.push_back(V);
+}
+
+unsigned ZeLoop::getIVArgIndex(const Function &F, const ValueSet &Args) const {
+  // The argument for the primary induction variable is the second input.
+  return 1;
+}
+
+unsigned ZeLoop::getLimitArgIndex(const Function &F,
+                                  const ValueSet &Args) const {
+  // The argument for the loop limit is the first input.
+  return 0;
+}
+
+void ZeLoop::preProcessTapirLoop(TapirLoopInfo &TL, ValueToValueMapTy &VMap) {
+
+  LLVM_DEBUG(dbgs() << "zeloop: pre-processing tapir loop...\n");
+
+  // Collect the top-level entities (Function, GlobalVariable) that are
+  // used in the outlined loop.  Since the outlined loop will live in the
+  // KernelModule, any GlobalValues will need to be cloned into the
+  // KernelModule.  Address spaces are sorted out once all loops have
+  // been outlined (see LevelZeroABI::transformKernelModule()).
+  LLVM_DEBUG(dbgs() << "\t*- collecting and analyzing global values...\n");
+  std::set<GlobalValue *> UsedGlobalValues;
+  Loop &L = *TL.getLoop();
+  for (Loop *SL : L)
+    for (BasicBlock *BB : SL->blocks())
+      collect(*BB, UsedGlobalValues);
+
+  for (BasicBlock *BB : L.blocks())
+    collect(*BB, UsedGlobalValues);
+
+  LLVM_DEBUG(dbgs() << "\t*- cloning global variables into kernel module...\n");
+  for (GlobalValue *V : UsedGlobalValues) {
+    if (GlobalVariable *GV = dyn_cast<GlobalVariable>(V)) {
+      std::string DevName = GV->getName().str() + ".dev_gv";
+      if (GlobalVariable *NewGV = KernelModule.getGlobalVariable(DevName, true)) {
+        VMap[GV] = NewGV;
+        continue;
+      }
+
+      // Level Zero has no means to bind host and device symbols (a la
+      // the HIP and CUDA runtimes) so only read-only data can be used.
+      if (!GV->isConstant() || !GV->hasInitializer())
+        report_fatal_error("zeabi: kernels can not use the non-constant "
+                           "global variable '" + GV->getName() + "'!");
+
+      LLVM_DEBUG(dbgs() << "\t\t\t* '" << GV->getName()
+                        << "' cloned as constant value.\n");
+      GlobalVariable *NewGV = new GlobalVariable(
+          KernelModule, GV->getValueType(), true /*isConstant*/,
+          GlobalValue::InternalLinkage, GV->getInitializer(), DevName);
+      NewGV->setAlignment(GV->getAlign());
+      VMap[GV] = NewGV;
+    }
+  }
+
+  // Create declarations for all functions first. These may be needed in the
+  // global variables.
+  LLVM_DEBUG(dbgs() << "\t*- resolving functions for kernel module...\n");
+  for (GlobalValue *G : UsedGlobalValues) {
+    if (Function *F = dyn_cast<Function>(G)) {
+      Function *DF = resolveDeviceFunction(F, KernelModule);
+      if (not DF) {
+        LLVM_DEBUG(dbgs() << "\t\t\t* adding declaration for function: '"
+                          << demangle(F->getName().str()) << "'.\n");
+        DF = Function::Create(F->getFunctionType(),
+                              GlobalValue::LinkageTypes::ExternalLinkage, 0,
+                              F->getName(), &KernelModule);
+        auto NewFArgIt = DF->arg_begin();
+        for (auto &Arg : F->args()) {
+          NewFArgIt->setName(Arg.getName());
+          VMap[&Arg] = &(*NewFArgIt++);
+        }
+      }
+      VMap[F] = DF;
+    }
+  }
+
+  // Now clone any function bodies that need to be cloned. This should be
+  // done as late as possible so that the VMap is populated with any other
+  // global values that need to be remapped.
+  LLVM_DEBUG(dbgs() << "\t*- cloning/creating device-side functions...\n");
+  for (GlobalValue *V : UsedGlobalValues) {
+    if (Function *F = dyn_cast<Function>(V)) {
+      Function *DeviceF = cast<Function>(VMap[F]);
+      if (F->isDeclaration() || !DeviceF->isDeclaration())
+        continue;
+
+      LLVM_DEBUG(dbgs() << "\t\t* clone '" << DeviceF->getName() << "'.\n");
+      SmallVector<ReturnInst *, 8> Returns;
+      CloneFunctionInto(DeviceF, F, VMap,
+                        CloneFunctionChangeType::DifferentModule, Returns, "");
+      DeviceF->removeFnAttr("target-cpu");
+      DeviceF->removeFnAttr("target-features");
+
+      // Exceptions are not supported on the device side, so remove any
+      // related attributes...
+      DeviceF->removeFnAttr(Attribute::UWTable);
+      DeviceF->addFnAttr(Attribute::NoUnwind);
+
+      if (OptLevel > 1 && not DeviceF->hasFnAttribute(Attribute::NoInline))
+        // Try to encourage inlining at high optimization levels.
+        DeviceF->addFnAttr(Attribute::AlwaysInline);
+      DeviceF->setLinkage(GlobalValue::LinkageTypes::InternalLinkage);
+    }
+  }
+
+  LLVM_DEBUG(dbgs() << "\tfinished preprocessing tapir loop.\n\n");
+}
+
+void ZeLoop::postProcessOutline(TapirLoopInfo &TLI, TaskOutlineInfo &Out,
+                                ValueToValueMapTy &VMap) {
+  Task *T = TLI.getTask();
+  Loop *TL = TLI.getLoop();
+
+  BasicBlock *Entry = cast<BasicBlock>(VMap[TL->getLoopPreheader()]);
+  BasicBlock *Header = cast<BasicBlock>(VMap[TL->getHeader()]);
+  BasicBlock *Exit = cast<BasicBlock>(VMap[TLI.getExitBlock()]);
+  PHINode *PrimaryIV = cast<PHINode>(VMap[TLI.getPrimaryInduction().first]);
+  Value *PrimaryIVInput = PrimaryIV->getIncomingValueForBlock(Entry);
+
+  TTarget->pushSR(T->getDetach()->getSyncRegion());
+
+  // We no longer need the cloned sync region.
+  Instruction *ClonedSyncReg =
+      cast<Instruction>(VMap[T->getDetach()->getSyncRegion()]);
+  ClonedSyncReg->eraseFromParent();
+
+  // Get the kernel function for this loop and clean up any stray
+  // (target related) attributes that were attached as part of the
+  // host-side target that occurred before outlining.
+  Function *KernelF = Out.Outline;
+  KernelF->setName(KernelName);
+  KernelF->removeFnAttr("target-cpu");
+  KernelF->removeFnAttr("target-features");
+  KernelF->removeFnAttr(Attribute::UWTable);
+  KernelF->addFnAttr(Attribute::NoUnwind);
+
+  // Verify that the work-item ID corresponds to a valid iteration.
+  // Because Tapir loops use canonical induction variables, valid
+  // iterations range from 0 to the loop limit with stride 1.  The End
+  // argument (the first argument) encodes the loop limit.  The grain
+  // size is fixed at 1.
+  Argument *End = &*KernelF->arg_begin();
+  Value *Grainsize = ConstantInt::get(PrimaryIV->getType(), 1);
+
+  IRBuilder<> Builder(Entry->getTerminator());
+  CallInst *GlobalId = Builder.CreateCall(
+      KitZeGlobalIdFn, {ConstantInt::get(Builder.getInt32Ty(), /* X */ 0)},
+      ".kern.gid.x");
+  GlobalId->setCallingConv(CallingConv::SPIR_FUNC);
+  Value *ThreadID = Builder.CreateIntCast(GlobalId, PrimaryIV->getType(),
+                                          false, ".kern.thread_id.x");
+  Value *Cond = Builder.CreateICmpUGE(ThreadID, End, ".kern.at_end");
+  Value *ThreadEnd = Builder.CreateAdd(ThreadID, Grainsize, ".kern.last_idx.x");
+  ReplaceInstWithInst(Entry->getTerminator(),
+                      BranchInst::Create(Exit, Header, Cond));
+
+  // Replace the loop's induction variable with the work-item id.
+  PrimaryIVInput->replaceAllUsesWith(ThreadID);
+
+  // Update cloned loop condition to use the thread-end value.
+  unsigned TripCountIdx = 0;
+  ICmpInst *ClonedCond = cast<ICmpInst>(VMap[TLI.getCondition()]);
+  if (ClonedCond->getOperand(0) != End)
+    ++TripCountIdx;
+  assert(ClonedCond->getOperand(TripCountIdx) == End &&
+         "End argument not used in condition!");
+  ClonedCond->setOperand(TripCountIdx, ThreadEnd);
+
+  TTarget->saveKernel(KernelF);
+}
+
+void ZeLoop::processOutlinedLoopCall(TapirLoopInfo &TL, TaskOutlineInfo &TOI,
+                                     DominatorTree &DT) {
+
+  LLVM_DEBUG(dbgs() << "zeloop: processing outlined loop call...\n"
+                    << "\tkernel name: " << KernelName << "\n");
+
+  LLVMContext &Ctx = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+
+  // Remove any 'dangling' calls to the outlined loop (see the notes in
+  // HipLoop::processOutlinedLoopCall() for details).
+  Function *TargetKF = KernelModule.getFunction(KernelName);
+  std::list<Instruction *> RemoveList;
+  if (TargetKF) {
+    for (Use &U : TargetKF->uses())
+      if (auto *Inst = dyn_cast<Instruction>(U.getUser()))
+        if (Inst != TOI.ReplCall)
+          RemoveList.push_back(Inst);
+  }
+  for (auto I : RemoveList)
+    I->eraseFromParent();
+
+  // Create two builders -- one inserts code into the entry block
+  // (e.g., new "up-front" allocas) and the other is for generating
+  // new code into a split BB.
+  Function *Parent = TOI.ReplCall->getFunction();
+  BasicBlock &EntryBB = Parent->getEntryBlock();
+  IRBuilder<> EntryBuilder(&EntryBB.front());
+
+  BasicBlock *RCBB = TOI.ReplCall->getParent();
+  BasicBlock *NewBB = RCBB->splitBasicBlock(TOI.ReplCall);
+  IRBuilder<> NewBuilder(&NewBB->front());
+
+  // Level Zero sets kernel arguments one at a time so the runtime
+  // needs the size of each argument along with a pointer to its value.
+  LLVM_DEBUG(dbgs() << "\t*- code gen packing of " << OrderedInputs.size()
+                    << " kernel args.\n");
+  ArrayType *ArrayTy = ArrayType::get(VoidPtrTy, OrderedInputs.size());
+  Value *ArgArray = EntryBuilder.CreateAlloca(ArrayTy);
+  AllocaInst *ZeStream = EntryBuilder.CreateAlloca(VoidPtrTy);
+  EntryBuilder.CreateStore(ConstantPointerNull::get(VoidPtrTy), ZeStream);
+  SmallVector<uint64_t, 8> ArgSizes;
+  unsigned int i = 0;
+  for (Value *V : OrderedInputs) {
+    Value *VP = EntryBuilder.CreateAlloca(V->getType());
+    NewBuilder.CreateStore(V, VP);
+    Value *ArgPtr =
+        NewBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, i);
+    NewBuilder.CreateStore(VP, ArgPtr);
+    ArgSizes.push_back(DL.getTypeStoreSize(V->getType()));
+    i++;
+
+    if (CodeGenPrefetch && V->getType()->isPointerTy()) {
+      LLVM_DEBUG(dbgs() << "\t\t- code gen prefetch for kernel arg #" << i
+                        << "\n");
+      Value *SPtr = NewBuilder.CreateLoad(VoidPtrTy, ZeStream);
+      Value *NewSPtr = NewBuilder.CreateCall(KitZeMemPrefetchFn, {V, SPtr});
+      // Keep the first command list the runtime hands back (prefetches
+      // of data that is already resident return null).
+      Value *IsNewS =
+          NewBuilder.CreateICmpEQ(SPtr, ConstantPointerNull::get(VoidPtrTy));
+      NewBuilder.CreateStore(NewBuilder.CreateSelect(IsNewS, NewSPtr, SPtr),
+                             ZeStream);
+    }
+  }
+
+  Constant *ArgSizesCA = ConstantDataArray::get(Ctx, ArgSizes);
+  GlobalVariable *ArgSizesGV = new GlobalVariable(
+      M, ArgSizesCA->getType(), true, GlobalValue::PrivateLinkage, ArgSizesCA,
+      ".kern.arg_sizes");
+  ArgSizesGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  Value *ArgsPtr =
+      NewBuilder.CreateConstInBoundsGEP2_32(ArrayTy, ArgArray, 0, 0);
+  Constant *KNameCS = ConstantDataArray::getString(Ctx, KernelName);
+  GlobalVariable *KNameGV =
+      new GlobalVariable(M, KNameCS->getType(), true,
+                         GlobalValue::PrivateLinkage, KNameCS, ".kern.name");
+  KNameGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  // We place *all* transformed tapir loops from the input module into a
+  // single kernel module.  At this point we can not create the SPIR-V
+  // image so we use a 'dummy' (null) image for code gen -- the launch
+  // calls are patched once all tapir loops have been processed (see
+  // LevelZeroABI::finalizeLaunchCalls()).
+  Constant *DummyImageGV =
+      tapir::getOrInsertFBGlobal(M, ZEABI_DUMMY_IMAGE_NAME, VoidPtrTy);
+  Value *DummyImagePtr = NewBuilder.CreateLoad(VoidPtrTy, DummyImageGV);
+
+  // Deal with type mismatches for the trip count.
+  Value *TripCount = OrderedInputs[0];
+  Value *CastTripCount = TripCount;
+  if (TripCount->getType() != Int64Ty)
+    CastTripCount = NewBuilder.CreateIntCast(TripCount, Int64Ty, true);
+
+  // Each kernel gets a (null initialized) handle that the runtime
+  // uses to cache the kernel's launch details after the first launch.
+  GlobalVariable *LaunchHandle = new GlobalVariable(
+      M, VoidPtrTy, false, GlobalValue::InternalLinkage,
+      ConstantPointerNull::get(VoidPtrTy),
+      ZEABI_PREFIX + ".launch." + KernelName);
+  LaunchHandle->setAlignment(Align(DL.getPointerABIAlignment(0)));
+
+  LLVM_DEBUG(dbgs() << "\t*- code gen kernel launch...\n");
+  Value *KSPtr = NewBuilder.CreateLoad(VoidPtrTy, ZeStream);
+  CallInst *LaunchStream = NewBuilder.CreateCall(
+      KitZeLaunchFn,
+      {DummyImagePtr, ConstantInt::get(Int64Ty, 0), KNameGV, ArgsPtr,
+       ArgSizesGV, ConstantInt::get(Int32Ty, OrderedInputs.size()),
+       CastTripCount, ConstantInt::get(Int32Ty, ThreadsPerBlock), KSPtr,
+       LaunchHandle});
+  NewBuilder.CreateStore(LaunchStream, ZeStream);
+
+  TOI.ReplCall->eraseFromParent();
+  LLVM_DEBUG(dbgs() << "*** finished processing outlined call.\n");
+}
+
+// ----- Level Zero Target
+
+// As is the pattern with the GPU targets, the LevelZeroABI is setup to
+// process all Tapir constructs within a given input Module (M).  It then
+// creates a corresponding module that contains the transformed
+// device-side code.  This is the KernelModule that is created below in
+// the target constructor.
+LevelZeroABI::LevelZeroABI(Module &InputModule)
+    : TapirTarget(InputModule),
+      KernelModule(ZEABI_KERNEL_NAME_PREFIX + InputModule.getName().str(),
+                   InputModule.getContext()) {
+
+  LLVM_DEBUG(dbgs() << "zeabi: creating target for module: '" << M.getName()
+                    << "'\n");
+
+  LLVMContext &Ctx = InputModule.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  PointerType *VoidPtrTy = PointerType::getUnqual(Ctx);
+  KitZeSyncFn = M.getOrInsertFunction("__kitze_sync_thread_stream",
+                                      VoidTy,
+                                      VoidPtrTy); // opaque stream (or null)
+
+  Triple TargetTriple("spirv64", "unknown", "unknown");
+  std::string Error;
+  const Target *SPIRVTarget =
+      TargetRegistry::lookupTarget("", TargetTriple, Error);
+  if (not SPIRVTarget) {
+    errs() << "zeabi: target lookup failed! '" << Error << "'\n";
+    report_fatal_error("zeabi: unable to find registered SPIR-V target. "
+                       "Was LLVM built with the SPIRV target enabled?");
+  }
+
+  llvm::CodeGenOptLevel TMOptLevel = CodeGenOptLevel::None;
+  if (OptLevel == 1)
+    TMOptLevel = CodeGenOptLevel::Less;
+  else if (OptLevel == 2)
+    TMOptLevel = CodeGenOptLevel::Default;
+  else if (OptLevel >= 3)
+    TMOptLevel = CodeGenOptLevel::Aggressive;
+
+  SPIRVTargetMachine = SPIRVTarget->createTargetMachine(
+      TargetTriple.getTriple(), "", "", TargetOptions(), std::nullopt,
+      std::nullopt, TMOptLevel);
+  KernelModule.setTargetTriple(TargetTriple.str());
+  KernelModule.setDataLayout(SPIRVTargetMachine->createDataLayout());
+}
+
+LevelZeroABI::~LevelZeroABI() { /* no-op */
+}
+
+Value *LevelZeroABI::lowerGrainsizeCall(CallInst *GrainsizeCall) {
+  // As with the other GPU targets, each work item executes a single
+  // iteration.
+  Value *Grainsize = ConstantInt::get(GrainsizeCall->getType(), 1);
+  GrainsizeCall->replaceAllUsesWith(Grainsize);
+  GrainsizeCall->eraseFromParent();
+  return Grainsize;
+}
+
+void LevelZeroABI::lowerSync(SyncInst &SI) {
+  // no-op
+}
+
+void LevelZeroABI::addHelperAttributes(Function &F) {
+  // no-op
+}
+
+bool LevelZeroABI::preProcessFunction(Function &F, TaskInfo &TI,
+                                      bool OutliningTapirLoops) {
+  return false;
+}
+
+void LevelZeroABI::postProcessFunction(Function &F, bool OutliningTapirLoops) {
+  if (OutliningTapirLoops) {
+    PointerType *VoidPtrTy = PointerType::getUnqual(M.getContext());
+    Value *ZeStream = ConstantPointerNull::get(VoidPtrTy);
+    for (Value *SR : SyncRegList) {
+      for (Use &U : SR->uses()) {
+        if (auto *SyncI = dyn_cast<SyncInst>(U.getUser()))
+          CallInst::Create(KitZeSyncFn, {ZeStream}, "",
+                           &*SyncI->getSuccessor(0)->begin());
+      }
+    }
+    SyncRegList.clear();
+  }
+}
+
+void LevelZeroABI::transformKernelModule() {
+  LLVMContext &Ctx = KernelModule.getContext();
+  PointerType *GenericPtrTy = PointerType::get(Ctx, ZEABI_GENERIC_ADDR_SPACE);
+  PointerType *GlobalPtrTy = PointerType::get(Ctx, ZEABI_GLOBAL_ADDR_SPACE);
+
+  // The SPIR-V backend has limited support for debug information.
+  StripDebugInfo(KernelModule);
+
+  // Tapir outlines (and we clone) code with its pointers in the default
+  // address space.  The module is rebuilt with those pointers in the
+  // generic address space: every global value gets a remapped
+  // counterpart and the function bodies are cloned using a type
+  // remapper.
+  ZeGenericTypeRemapper TypeMapper;
+  ValueToValueMapTy VMap;
+
+  SmallVector<std::pair<GlobalVariable *, GlobalVariable *>, 8> Globals;
+  for (GlobalVariable &GV : KernelModule.globals()) {
+    if (GV.getAddressSpace() != ZEABI_PRIVATE_ADDR_SPACE)
+      continue;
+    GlobalVariable *NewGV = new GlobalVariable(
+        KernelModule, TypeMapper.remapType(GV.getValueType()), GV.isConstant(),
+        GV.getLinkage(), nullptr, GV.getName() + ".ze", nullptr,
+        GlobalValue::NotThreadLocal, ZEABI_GLOBAL_ADDR_SPACE);
+    NewGV->setAlignment(GV.getAlign());
+    VMap[&GV] = ConstantExpr::getAddrSpaceCast(NewGV, GenericPtrTy);
+    Globals.push_back({&GV, NewGV});
+  }
+
+  SmallVector<Function *, 16> OldFunctions;
+  for (Function &F : KernelModule)
+    OldFunctions.push_back(&F);
+
+  SmallVector<std::pair<Function *, Function *>, 8> Functions;
+  SmallVector<Function *, 8> Intrinsics;
+  for (Function *F : OldFunctions) {
+    if (F->isIntrinsic()) {
+      SmallVector<Type *, 4> OverloadTys;
+      if (Intrinsic::getIntrinsicSignature(F, OverloadTys)) {
+        for (Type *&Ty : OverloadTys)
+          Ty = TypeMapper.remapType(Ty);
+        Intrinsics.push_back(F);
+        VMap[F] = Intrinsic::getDeclaration(&KernelModule,
+                                            F->getIntrinsicID(), OverloadTys);
+      }
+      continue;
+    }
+
+    FunctionType *NewFTy =
+        cast<FunctionType>(TypeMapper.remapType(F->getFunctionType()));
+    Function *NF = Function::Create(NewFTy, F->getLinkage(),
+                                    F->getAddressSpace(), F->getName() + ".ze");
+    NF->copyAttributesFrom(F);
+    auto NewArgIt = NF->arg_begin();
+    for (Argument &A : F->args()) {
+      NewArgIt->setName(A.getName());
+      VMap[&A] = &*NewArgIt++;
+    }
+    VMap[F] = NF;
+    Functions.push_back({F, NF});
+  }
+
+  for (auto &GVs : Globals)
+    if (GVs.first->hasInitializer())
+      GVs.second->setInitializer(
+          MapValue(GVs.first->getInitializer(), VMap, RF_None, &TypeMapper));
+
+  for (auto &Fns : Functions) {
+    Function *F = Fns.first, *NF = Fns.second;
+    KernelModule.getFunctionList().push_back(NF);
+    if (!F->isDeclaration()) {
+      SmallVector<ReturnInst *, 8> Returns;
+      CloneFunctionInto(NF, F, VMap, CloneFunctionChangeType::GlobalChanges,
+                        Returns, "", nullptr, &TypeMapper);
+    }
+    NF->setCallingConv(CallingConv::SPIR_FUNC);
+  }
+
+  // Allocas must remain in the private address space (the type remapper
+  // moved them to the generic address space) and lifetime markers are
+  // only valid on allocas so they are dropped.
+  for (auto &Fns : Functions) {
+    Function *NF = Fns.second;
+    SmallVector<Instruction *, 8> ToErase;
+    for (Instruction &I : instructions(NF)) {
+      if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+        if (AI->getAddressSpace() == ZEABI_PRIVATE_ADDR_SPACE)
+          continue;
+        AllocaInst *NewAI = new AllocaInst(
+            AI->getAllocatedType(), ZEABI_PRIVATE_ADDR_SPACE,
+            AI->getArraySize(), AI->getAlign(), AI->getName(), AI);
+        AI->replaceAllUsesWith(
+            new AddrSpaceCastInst(NewAI, AI->getType(), "", AI));
+        ToErase.push_back(AI);
+      } else if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+        if (II->isLifetimeStartOrEnd())
+          ToErase.push_back(II);
+      } else if (auto *CI = dyn_cast<CallInst>(&I)) {
+        if (Function *CF = CI->getCalledFunction())
+          CI->setCallingConv(CF->getCallingConv());
+      }
+    }
+    for (Instruction *I : ToErase)
+      I->eraseFromParent();
+  }
+
+  // The kernels are tracked by their new functions (erasing the
+  // originals also removes them from the value map).
+  for (Function *&KF : KernelFunctions)
+    KF = cast<Function>(VMap[KF]);
+
+  // Remove the original globals and functions.
+  for (auto &Fns : Functions)
+    Fns.first->dropAllReferences();
+  for (auto &GVs : Globals)
+    GVs.first->dropAllReferences();
+  for (auto &Fns : Functions) {
+    std::string Name = Fns.first->getName().str();
+    Fns.first->eraseFromParent();
+    Fns.second->setName(Name);
+  }
+  for (auto &GVs : Globals) {
+    std::string Name = GVs.first->getName().str();
+    GVs.first->eraseFromParent();
+    GVs.second->setName(Name);
+  }
+  for (Function *F : Intrinsics)
+    if (F->use_empty())
+      F->eraseFromParent();
+
+  // Each kernel becomes an internal (inlined) function that is called
+  // by a 'spir_kernel' entry point.  The entry point takes pointers in
+  // the cross work-group address space (kernel arguments are shared
+  // allocations) and casts them to generic pointers.
+  for (Function *KF : KernelFunctions) {
+    std::string Name = KF->getName().str();
+    KF->setName(Name + ".impl");
+    KF->setLinkage(GlobalValue::InternalLinkage);
+    KF->removeFnAttr(Attribute::NoInline);
+    KF->addFnAttr(Attribute::AlwaysInline);
+
+    SmallVector<Type *, 8> ParamTys;
+    for (Argument &A : KF->args())
+      ParamTys.push_back(A.getType()->isPointerTy() ? GlobalPtrTy
+                                                    : A.getType());
+    Function *EntryF = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), ParamTys, false),
+        GlobalValue::ExternalLinkage, Name, &KernelModule);
+    EntryF->setCallingConv(CallingConv::SPIR_KERNEL);
+    EntryF->addFnAttr(Attribute::NoUnwind);
+
+    IRBuilder<> B(BasicBlock::Create(Ctx, "entry", EntryF));
+    SmallVector<Value *, 8> Args;
+    for (Argument &A : EntryF->args()) {
+      A.setName(KF->getArg(A.getArgNo())->getName());
+      Args.push_back(A.getType()->isPointerTy()
+                         ? B.CreateAddrSpaceCast(&A, GenericPtrTy)
+                         : static_cast<Value *>(&A));
+    }
+    B.CreateCall(KF, Args)->setCallingConv(CallingConv::SPIR_FUNC);
+    B.CreateRetVoid();
+  }
+}
+
+void LevelZeroABI::createSPIRVImage(SmallVectorImpl<char> &Image) {
+  LLVM_DEBUG(dbgs() << "\tgenerating SPIR-V image.\n");
+
+  if (verifyModule(KernelModule, &errs()))
+    report_fatal_error("zeabi: kernel module failed verification!");
+
+  if (OptLevel > 0) {
+    if (OptLevel > 3)
+      OptLevel = 3;
+    LLVM_DEBUG(dbgs() << "\t- running kernel module optimization passes...\n");
+    PipelineTuningOptions pto;
+    pto.LoopVectorization = OptLevel > 2;
+    pto.SLPVectorization = OptLevel > 2;
+    pto.LoopUnrolling = OptLevel >= 2;
+    pto.LoopInterleaving = OptLevel > 2;
+    pto.LoopStripmine = false;
+    OptimizationLevel optLevels[] = {
+        OptimizationLevel::O0,
+        OptimizationLevel::O1,
+        OptimizationLevel::O2,
+        OptimizationLevel::O3,
+    };
+    OptimizationLevel optLevel = optLevels[OptLevel];
+
+    LoopAnalysisManager lam;
+    FunctionAnalysisManager fam;
+    CGSCCAnalysisManager cgam;
+    ModuleAnalysisManager mam;
+
+    PassBuilder pb(SPIRVTargetMachine, pto);
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    SPIRVTargetMachine->registerPassBuilderCallbacks(pb, false);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+    ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(optLevel);
+    mpm.addPass(VerifierPass());
+    mpm.run(KernelModule, mam);
+  }
+
+  raw_svector_ostream OS(Image);
+  legacy::PassManager PassMgr;
+  if (SPIRVTargetMachine->addPassesToEmitFile(PassMgr, OS, nullptr,
+                                              CodeGenFileType::ObjectFile,
+                                              false))
+    report_fatal_error("zeabi: SPIR-V target failed!");
+  PassMgr.run(KernelModule);
+  LLVM_DEBUG(dbgs() << "\tSPIR-V image: " << Image.size() << " bytes.\n");
+
+  if (KeepIntermediateFiles) {
+    SmallString<255> FileName(sys::path::filename(M.getName()));
+    sys::path::replace_extension(FileName, ".spv");
+    std::error_code EC;
+    raw_fd_ostream SPVFile(FileName, EC, sys::fs::OpenFlags::OF_None);
+    if (EC)
+      errs() << "zeabi: could not open '" << FileName << "': " << EC.message()
+             << "\n";
+    else
+      SPVFile.write(Image.data(), Image.size());
+  }
+}
+
+GlobalVariable *LevelZeroABI::embedImage(StringRef Image) {
+  LLVMContext &Ctx = M.getContext();
+  Constant *ImageArray =
+      ConstantDataArray::getRaw(Image, Image.size(), Type::getInt8Ty(Ctx));
+  GlobalVariable *ImageGV = new GlobalVariable(
+      M, ImageArray->getType(), true, GlobalValue::PrivateLinkage, ImageArray,
+      ZEABI_PREFIX + ".spirv_image");
+  // SPIR-V is a stream of 32-bit words.
+  ImageGV->setAlignment(Align(8));
+  return ImageGV;
+}
+
+void LevelZeroABI::finalizeLaunchCalls(GlobalVariable *Image,
+                                       uint64_t ImageSize) {
+  Type *Int64Ty = Type::getInt64Ty(M.getContext());
+  for (Function &Fn : M) {
+    for (Instruction &I : instructions(Fn)) {
+      if (auto *CI = dyn_cast<CallInst>(&I)) {
+        Function *CFn = CI->getCalledFunction();
+        if (CFn && CFn->getName() == "__kitze_launch_kernel") {
+          LLVM_DEBUG(dbgs() << "\t\t\t* patching launch: " << *CI << "\n");
+          CI->setArgOperand(0, Image);
+          CI->setArgOperand(1, ConstantInt::get(Int64Ty, ImageSize));
+        }
+      }
+    }
+  }
+
+  GlobalVariable *ProxyImage = M.getGlobalVariable(ZEABI_DUMMY_IMAGE_NAME, true);
+  if (not ProxyImage)
+    report_fatal_error("unable to find the proxy SPIR-V image pointer! "
+                       "something has gone horribly wrong!");
+
+  // The loads of the proxy are no longer used by the launches.
+  SmallVector<LoadInst *, 8> DeadLoads;
+  for (User *U : ProxyImage->users())
+    if (auto *LI = dyn_cast<LoadInst>(U))
+      if (LI->use_empty())
+        DeadLoads.push_back(LI);
+  for (LoadInst *LI : DeadLoads)
+    LI->eraseFromParent();
+  ProxyImage->replaceAllUsesWith(Image);
+  ProxyImage->eraseFromParent();
+}
+
+void LevelZeroABI::registerImage() {
+  LLVM_DEBUG(dbgs() << "\tcreating global ctor entries...\n");
+
+  LLVMContext &Ctx = M.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Type *IntTy = Type::getInt32Ty(Ctx);
+  FunctionType *CtorFnTy = FunctionType::get(VoidTy, false);
+
+  Function *CtorFn = Function::Create(
+      CtorFnTy, GlobalValue::InternalLinkage,
+      ZEABI_PREFIX + ".ctor." + sys::path::filename(M.getName()).str(), &M);
+  IRBuilder<> CtorBuilder(BasicBlock::Create(Ctx, "entry", CtorFn));
+  FunctionCallee KitZeInitFn =
+      M.getOrInsertFunction("__kitze_initialize", VoidTy);
+  CtorBuilder.CreateCall(KitZeInitFn, {});
+
+  // The runtime is released (after waiting for any outstanding work) at
+  // program exit.
+  Function *DtorFn = Function::Create(CtorFnTy, GlobalValue::InternalLinkage,
+                                      ZEABI_PREFIX + ".dtor", &M);
+  IRBuilder<> DtorBuilder(BasicBlock::Create(Ctx, "entry", DtorFn));
+  FunctionCallee KitZeDestroyFn =
+      M.getOrInsertFunction("__kitze_destroy", VoidTy);
+  DtorBuilder.CreateCall(KitZeDestroyFn, {});
+  DtorBuilder.CreateRetVoid();
+
+  FunctionCallee AtExitFn = M.getOrInsertFunction(
+      "atexit", FunctionType::get(IntTy, DtorFn->getType(), false));
+  CtorBuilder.CreateCall(AtExitFn, DtorFn);
+  CtorBuilder.CreateRetVoid();
+
+  tapir::appendToGlobalCtors(M, CtorFn, 65536, nullptr);
+}
+
+void LevelZeroABI::postProcessModule() {
+  // At this point, all tapir constructs in the input module (M) have been
+  // transformed (i.e., outlined) into the kernel module.  We can now
+  // wrap up module-wide changes for both modules and generate the
+  // SPIR-V image.
+  LLVM_DEBUG(dbgs() << "\n\n"
+                    << "zeabi: postprocessing the kernel '"
+                    << KernelModule.getName() << "' and input '" << M.getName()
+                    << "' modules.\n");
+
+  transformKernelModule();
+  LLVM_DEBUG(saveModuleToFile(&KernelModule, KernelModule.getName().str(),
+                              ".zeabi.preopt.ll"));
+
+  SmallVector<char, 0> Image;
+  createSPIRVImage(Image);
+  LLVM_DEBUG(saveModuleToFile(&KernelModule, KernelModule.getName().str(),
+                              ".zeabi.final.ll"));
+
+  GlobalVariable *ImageGV = embedImage(StringRef(Image.data(), Image.size()));
+  finalizeLaunchCalls(ImageGV, Image.size());
+  registerImage();
+}
+
+LoopOutlineProcessor *
+LevelZeroABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
+  // Create a Level Zero loop outline processor for transforming parallel
+  // tapir loop constructs into suitable GPU device code.  We hand the
+  // outliner the kernel module (KM) as the destination for all generated
+  // (device-side) code.
+  std::string ModuleName = sys::path::filename(M.getName()).str();
+  std::string KernelName;
+
+  if (M.getNamedMetadata("llvm.dbg")) {
+    // If we have debug info in the module use a line number-based
+    // naming scheme for kernels.
+    unsigned LineNumber = TL->getLoop()->getStartLoc()->getLine();
+    KernelName =
+        ZEABI_KERNEL_NAME_PREFIX + ModuleName + "_" + Twine(LineNumber).str();
+  } else {
+    SmallString<255> ModName(Twine(ModuleName).str());
+    sys::path::replace_extension(ModName, "");
+    KernelName = ZEABI_KERNEL_NAME_PREFIX + ModName.c_str();
+  }
+
+  ZeLoop *Outliner = new ZeLoop(M, KernelModule, KernelName, this);
+  // Hybrid loops also run part of their iterations on the host.
+  if (TapirLoopHints(TL->getLoop()).getHybrid())
+    return new HybridLoop(M, Outliner);
+  return Outliner;
+}
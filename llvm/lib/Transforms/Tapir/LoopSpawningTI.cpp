@@ -21,6 +21,7 @@
 #include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
@@ -31,11 +32,13 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/PatternMatch.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/ValueMap.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Timer.h"
@@ -47,6 +50,7 @@
 #include "llvm/Transforms/Tapir/LoweringUtils.h"
 #include "llvm/Transforms/Tapir/Outline.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
+#include "llvm/Transforms/Tapir/TapirMultiTarget.h"
 #include "llvm/Transforms/Tapir/TapirTargetIDs.h"
 #include "llvm/Transforms/Utils.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
@@ -69,6 +73,33 @@ STATISTIC(TapirLoopsFound,
 STATISTIC(LoopsConvertedToDAC,
           "Number of Tapir loops converted to divide-and-conquer iteration "
           "spawning");
+STATISTIC(LoopsConvertedToLazyDAC,
+          "Number of Tapir loops converted to lazy divide-and-conquer "
+          "iteration spawning");
+STATISTIC(LoopsConvertedToScheduled,
+          "Number of Tapir loops converted to spawn chunks of iterations with "
+          "a static, dynamic, or guided schedule");
+
+static cl::opt<bool> HoistCSITaskHooks(
+    "tapir-loop-hoist-csi-task-hooks", cl::init(false), cl::Hidden,
+    cl::desc("Hoist the CSI task hooks of divide-and-conquer Tapir loops out "
+             "of the cloned loop, like the Cilksan hooks, so they run once per "
+             "leaf chunk of iterations rather than once per iteration."));
+
+static cl::opt<bool> LazyLoopSplitting(
+    "tapir-loop-lazy-split", cl::init(false), cl::Hidden,
+    cl::desc("Split divide-and-conquer Tapir loops lazily: run the iterations "
+             "serially and spawn half of the remaining iterations only once "
+             "every heartbeat."));
+
+static cl::opt<unsigned> LazyLoopSplittingHeartbeat(
+    "tapir-loop-lazy-split-heartbeat", cl::init(30000), cl::Hidden,
+    cl::desc("Cycles between the splits of a lazily split Tapir loop."));
+
+static cl::opt<bool> AnnotateParallelAccesses(
+    "tapir-loop-parallel-accesses", cl::init(true), cl::Hidden,
+    cl::desc("Mark the outlined copy of a Tapir loop as free of loop-carried "
+             "memory dependencies, based on the data-race-free assumption."));
 
 static const char TimerGroupName[] = DEBUG_TYPE;
 static const char TimerGroupDescription[] = "Loop spawning";
@@ -86,14 +117,70 @@ public:
 
 /// The DACSpawning loop-outline processor transforms an outlined Tapir loop to
 /// evaluate the iterations using parallel recursive divide-and-conquer.
+///
+/// With -tapir-loop-lazy-split, the recursion is lazy, in the style of
+/// heartbeat scheduling: the outlined loop runs its iterations serially and,
+/// once a heartbeat has elapsed since the last split, spawns the first half of
+/// the remaining iterations and continues with the second half, which thieves
+/// can steal.  Balanced loops then spawn rarely, while skewed loops keep
+/// splitting wherever the work is.
 class DACSpawning : public LoopOutlineProcessor {
 public:
   DACSpawning(Module &M) : LoopOutlineProcessor(M) {}
   void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
                           ValueToValueMapTy &VMap) override final {
     LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
-    implementDACIterSpawnOnHelper(TL, Out, VMap);
-    ++LoopsConvertedToDAC;
+    if (LazyLoopSplitting && canSplitLazily(TL, Out, VMap)) {
+      // Move Cilksan instrumentation before the loop gets the new control
+      // flow of the lazy splits.
+      moveCilksanInstrumentation(TL, Out, VMap);
+
+      implementLazyDACIterSpawnOnHelper(TL, Out, VMap);
+      ++LoopsConvertedToLazyDAC;
+    } else {
+      implementDACIterSpawnOnHelper(TL, Out, VMap);
+      ++LoopsConvertedToDAC;
+
+      // Move Cilksan instrumentation.
+      moveCilksanInstrumentation(TL, Out, VMap);
+    }
+
+    // Add syncs to all exits of the outline.
+    addSyncToOutlineReturns(TL, Out, VMap);
+  }
+
+private:
+  void implementDACIterSpawnOnHelper(
+      TapirLoopInfo &TL, TaskOutlineInfo &Out, ValueToValueMapTy &VMap);
+  bool canSplitLazily(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                      ValueToValueMapTy &VMap) const;
+  void implementLazyDACIterSpawnOnHelper(
+      TapirLoopInfo &TL, TaskOutlineInfo &Out, ValueToValueMapTy &VMap);
+};
+
+/// The ScheduledSpawning loop-outline processor transforms an outlined Tapir
+/// loop to spawn chunks of iterations from a serial loop, where the schedule
+/// of the loop determines the size of each chunk:
+///
+/// - static: ceil(n / workers) iterations, i.e., one chunk per worker.
+/// - dynamic: grainsize iterations, which idle workers pick up by stealing.
+/// - guided: ceil(remaining / workers) iterations, so the chunks get smaller
+///   as the loop proceeds.
+///
+/// No chunk is smaller than the grainsize, except the last.  Each chunk runs
+/// the helper recursively with the chunk size as its grainsize, such that the
+/// chunk runs serially.  On a target that cannot provide the number of
+/// workers, static and guided loops use the dynamic schedule.
+class ScheduledSpawning : public LoopOutlineProcessor {
+public:
+  ScheduledSpawning(Module &M, TapirTarget *Target,
+                    TapirLoopHints::SpawningStrategy Schedule)
+      : LoopOutlineProcessor(M), Target(Target), Schedule(Schedule) {}
+  void postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                          ValueToValueMapTy &VMap) override final {
+    LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
+    implementScheduledIterSpawnOnHelper(TL, Out, VMap);
+    ++LoopsConvertedToScheduled;
 
     // Move Cilksan instrumentation.
     moveCilksanInstrumentation(TL, Out, VMap);
@@ -103,8 +190,11 @@ public:
   }
 
 private:
-  void implementDACIterSpawnOnHelper(
+  void implementScheduledIterSpawnOnHelper(
       TapirLoopInfo &TL, TaskOutlineInfo &Out, ValueToValueMapTy &VMap);
+
+  TapirTarget *Target;
+  TapirLoopHints::SpawningStrategy Schedule;
 };
 
 static bool isSRetInput(const Value *V, const Function &F) {
@@ -255,79 +345,40 @@ static void moveInstrumentation(StringRef Name, BasicBlock &From,
   }
 }
 
-void LoopOutlineProcessor::moveCilksanInstrumentation(TapirLoopInfo &TL,
-                                                      TaskOutlineInfo &Out,
-                                                      ValueToValueMapTy &VMap) {
-  Task *T = TL.getTask();
-  Loop *L = TL.getLoop();
-
-  // Get the header of the cloned loop.
-  BasicBlock *Header = cast<BasicBlock>(VMap[L->getHeader()]);
-  assert(Header && "No cloned header block found");
-
-  // Get the task entry of the cloned loop.
-  BasicBlock *TaskEntry = cast<BasicBlock>(VMap[T->getEntry()]);
-  assert(TaskEntry && "No cloned task-entry block found");
-
-  // Get the latch of the cloned loop.
-  BasicBlock *Latch = cast<BasicBlock>(VMap[L->getLoopLatch()]);
-  assert(Latch && "No cloned loop latch found");
-
-  // Get the normal task exit of the cloned loop.
-  BasicBlock *TaskExit = Latch->getSinglePredecessor();
-
-  // Get the preheader of the cloned loop.
-  BasicBlock *Preheader = nullptr;
-  for (BasicBlock *Pred : predecessors(Header)) {
-    if (Latch == Pred)
-      continue;
-    Preheader = Pred;
-    break;
-  }
-  if (!Preheader) {
-    LLVM_DEBUG(dbgs() << "No preheader for hoisting Cilksan instrumentation\n");
-    return;
-  }
-
-  // Get the normal exit of the cloned loop.
-  BasicBlock *LatchExit = nullptr;
-  for (BasicBlock *Succ : successors(Latch)) {
-    if (Header == Succ)
-      continue;
-    LatchExit = Succ;
-    break;
-  }
-  if (!LatchExit) {
-    LLVM_DEBUG(
-        dbgs() << "No normal exit for hoisting Cilksan instrumentation\n");
-    return;
-  }
-
-  // Move __csan_detach and __csan_task to the Preheader.
-  moveInstrumentation("__csan_detach", *Header, *Preheader,
-                      Preheader->getTerminator());
-  moveInstrumentation("__csan_task", *TaskEntry, *Preheader,
-                      Preheader->getTerminator());
-
-  // Move __csan_detach_continue and __csan_task_exit on the normal exit path to
+/// Move the task instrumentation of the tool with the given hook prefix,
+/// e.g., "__csan" for Cilksan, out of a cloned Tapir loop.
+static void moveTaskInstrumentation(StringRef Prefix, BasicBlock &Header,
+                                    BasicBlock &TaskEntry,
+                                    BasicBlock &Preheader, BasicBlock &Latch,
+                                    BasicBlock *TaskExit,
+                                    BasicBlock &LatchExit) {
+  std::string TaskExitName = (Prefix + "_task_exit").str();
+
+  // Move the detach and task hooks to the Preheader.
+  moveInstrumentation((Prefix + "_detach").str(), Header, Preheader,
+                      Preheader.getTerminator());
+  moveInstrumentation((Prefix + "_task").str(), TaskEntry, Preheader,
+                      Preheader.getTerminator());
+
+  // Move the detach-continue and task-exit hooks on the normal exit path to
   // LatchExit.
-  moveInstrumentation("__csan_detach_continue", *Latch, *LatchExit);
+  moveInstrumentation((Prefix + "_detach_continue").str(), Latch, LatchExit);
   if (TaskExit)
-    // There's only one block with __csan_task_exit instrumentation to move, so
+    // There's only one block with task-exit instrumentation to move, so
     // move it from that block.
-    moveInstrumentation("__csan_task_exit", *TaskExit, *LatchExit);
+    moveInstrumentation(TaskExitName, *TaskExit, LatchExit);
   else {
     // We need to create PHI nodes for the arguments of a new instrumentation
     // call in LatchExit.
 
-    // Scan all predecessors of Latch for __csan_task_exit instrumentation.
+    // Scan all predecessors of Latch for task-exit instrumentation.
     DenseMap<BasicBlock *, CallBase *> Instrumentation;
     Function *InstrFunc = nullptr;
-    for (BasicBlock *Pred : predecessors(Latch))
+    for (BasicBlock *Pred : predecessors(&Latch))
       for (Instruction &I : *Pred)
         if (CallBase *CB = dyn_cast<CallBase>(&I))
           if (Function *Called = CB->getCalledFunction())
-            if (Called->getName() == "__csan_task_exit") {
+            if (Called->getName() == TaskExitName) {
               Instrumentation.insert(std::make_pair(Pred, CB));
               InstrFunc = Called;
             }
@@ -341,12 +392,12 @@ void LoopOutlineProcessor::moveCilksanInstrumentation(TapirLoopInfo &TL,
     // Create PHI nodes at the start of Latch for the arguments of the moved
     // instrumentation.
     SmallVector<Value *, 4> InstrArgs;
-    for (BasicBlock *Pred : predecessors(Latch)) {
+    for (BasicBlock *Pred : predecessors(&Latch)) {
       CallBase *Instr = Instrumentation[Pred];
       if (InstrArgs.empty()) {
         // Create PHI nodes at the start of Latch for the instrumentation
         // arguments.
-        IRBuilder<> IRB(&Latch->front());
+        IRBuilder<> IRB(&Latch.front());
         for (Value *Arg : Instr->args()) {
           PHINode *ArgPHI =
               IRB.CreatePHI(Arg->getType(), Instrumentation.size());
@@ -365,14 +416,69 @@ void LoopOutlineProcessor::moveCilksanInstrumentation(TapirLoopInfo &TL,
 
     // Insert new instrumentation call at the start of LatchExit.
     CallInst::Create(InstrFunc->getFunctionType(), InstrFunc, InstrArgs, "",
-                     &*LatchExit->getFirstInsertionPt());
+                     &*LatchExit.getFirstInsertionPt());
 
     // Remove old instrumentation calls from predecessors
-    for (BasicBlock *Pred : predecessors(Latch))
+    for (BasicBlock *Pred : predecessors(&Latch))
       Instrumentation[Pred]->eraseFromParent();
   }
 }
 
+void LoopOutlineProcessor::moveCilksanInstrumentation(TapirLoopInfo &TL,
+                                                      TaskOutlineInfo &Out,
+                                                      ValueToValueMapTy &VMap) {
+  Task *T = TL.getTask();
+  Loop *L = TL.getLoop();
+
+  // Get the header of the cloned loop.
+  BasicBlock *Header = cast<BasicBlock>(VMap[L->getHeader()]);
+  assert(Header && "No cloned header block found");
+
+  // Get the task entry of the cloned loop.
+  BasicBlock *TaskEntry = cast<BasicBlock>(VMap[T->getEntry()]);
+  assert(TaskEntry && "No cloned task-entry block found");
+
+  // Get the latch of the cloned loop.
+  BasicBlock *Latch = cast<BasicBlock>(VMap[L->getLoopLatch()]);
+  assert(Latch && "No cloned loop latch found");
+
+  // Get the normal task exit of the cloned loop.
+  BasicBlock *TaskExit = Latch->getSinglePredecessor();
+
+  // Get the preheader of the cloned loop.
+  BasicBlock *Preheader = nullptr;
+  for (BasicBlock *Pred : predecessors(Header)) {
+    if (Latch == Pred)
+      continue;
+    Preheader = Pred;
+    break;
+  }
+  if (!Preheader) {
+    LLVM_DEBUG(dbgs() << "No preheader for hoisting Cilksan instrumentation\n");
+    return;
+  }
+
+  // Get the normal exit of the cloned loop.
+  BasicBlock *LatchExit = nullptr;
+  for (BasicBlock *Succ : successors(Latch)) {
+    if (Header == Succ)
+      continue;
+    LatchExit = Succ;
+    break;
+  }
+  if (!LatchExit) {
+    LLVM_DEBUG(
+        dbgs() << "No normal exit for hoisting Cilksan instrumentation\n");
+    return;
+  }
+
+  moveTaskInstrumentation("__csan", *Header, *TaskEntry, *Preheader, *Latch,
+                          TaskExit, *LatchExit);
+  if (HoistCSITaskHooks)
+    moveTaskInstrumentation("__csi", *Header, *TaskEntry, *Preheader, *Latch,
+                            TaskExit, *LatchExit);
+}
+
 namespace {
 static void emitMissedWarning(const Loop *L, const TapirLoopHints &LH,
                               OptimizationRemarkEmitter *ORE) {
@@ -386,6 +492,18 @@ static void emitMissedWarning(const Loop *L, const TapirLoopHints &LH,
               << "  Compile with -Rpass-analysis=" << LS_NAME
               << " for more details.");
     break;
+  case TapirLoopHints::ST_STATIC:
+  case TapirLoopHints::ST_DYNAMIC:
+  case TapirLoopHints::ST_GUIDED:
+    ORE->emit(DiagnosticInfoOptimizationFailure(
+                  DEBUG_TYPE, "FailedRequestedSpawning",
+                  L->getStartLoc(), L->getHeader())
+              << "Tapir loop not transformed: "
+              << "failed to spawn chunks of iterations with the requested "
+              << "schedule."
+              << "  Compile with -Rpass-analysis=" << LS_NAME
+              << " for more details.");
+    break;
   case TapirLoopHints::ST_SEQ:
     ORE->emit(DiagnosticInfoOptimizationFailure(
                   DEBUG_TYPE, "SpawningDisabled",
@@ -569,6 +687,112 @@ static BasicBlock *createTaskUnwind(Function *F, BasicBlock *UnwindDest,
   return CallUnwind;
 }
 
+/// Insert a recursive call to \p Helper at the end of block \p Block, which
+/// runs the iterations from \p Start to \p End.  The arguments \p StartArg and
+/// \p EndArg of \p Helper are replaced with \p Start and \p End, the argument
+/// \p GrainsizeArg, if given, is replaced with \p Grainsize, and all other
+/// arguments are passed through.  If the call cannot throw, then Block
+/// becomes:
+///
+/// Block:
+///   call Helper(..., Start, End, ...)
+///   br label Cont
+///
+/// Otherwise a new unwind destination, CallUnwind, is created for the invoke,
+/// and Block becomes:
+///
+/// Block:
+///   invoke Helper(..., Start, End, ...)
+///     to label CallDest unwind label CallUnwind
+///
+/// CallDest:
+///   br label Cont
+///
+/// Returns the block that ends with the branch to Cont.
+static BasicBlock *createRecursiveHelperCall(
+    Function *Helper, BasicBlock *Block, Value *StartArg, Value *Start,
+    Value *EndArg, Value *End, BasicBlock *UnwindDest, Value *SyncRegion,
+    const DebugLoc &Loc, Value *GrainsizeArg = nullptr,
+    Value *Grainsize = nullptr) {
+  // Create input array for recursive call.
+  SmallVector<Value *, 8> RecurCallInputs;
+  for (Value &V : Helper->args()) {
+    // Only the inputs for the start and end iterations, and possibly the
+    // grainsize, need special care.  All other inputs should match the
+    // arguments of Helper.
+    if (&V == StartArg)
+      RecurCallInputs.push_back(Start);
+    else if (&V == EndArg)
+      RecurCallInputs.push_back(End);
+    else if (GrainsizeArg && &V == GrainsizeArg)
+      RecurCallInputs.push_back(Grainsize);
+    else
+      RecurCallInputs.push_back(&V);
+  }
+
+  if (!UnwindDest) {
+    // Common case.  Insert a call to the outline immediately before the
+    // terminator.
+    IRBuilder<> Builder(Block->getTerminator());
+    CallInst *RecurCall = Builder.CreateCall(Helper, RecurCallInputs);
+    // Use a fast calling convention for the outline.
+    RecurCall->setCallingConv(Helper->getCallingConv());
+    RecurCall->setDebugLoc(Loc);
+    if (Helper->doesNotThrow())
+      RecurCall->setDoesNotThrow();
+    return Block;
+  }
+
+  BasicBlock *CallDest = SplitBlock(Block, Block->getTerminator());
+  BasicBlock *CallUnwind = createTaskUnwind(Helper, UnwindDest, SyncRegion,
+                                            Block->getName() + ".unwind");
+  InvokeInst *RecurCall =
+      InvokeInst::Create(Helper, CallDest, CallUnwind, RecurCallInputs);
+  // Use a fast calling convention for the outline.
+  RecurCall->setCallingConv(Helper->getCallingConv());
+  RecurCall->setDebugLoc(Loc);
+  ReplaceInstWithInst(Block->getTerminator(), RecurCall);
+  return CallDest;
+}
+
+/// Prepare the preheader \p Preheader of the loop outlined in \p Helper for
+/// new parallel loop control, which branches back to the head of that control.
+/// If Preheader is the entry block of Helper, this splits it and keeps any
+/// syncregion_start's in the entry block.  Returns the head for the new loop
+/// control.
+static BasicBlock *splitLoopControlHead(Function *Helper,
+                                        BasicBlock *Preheader) {
+  if (&(Helper->getEntryBlock()) != Preheader)
+    return Preheader;
+
+  // Split the entry block.  We'll want to create a backedge into the split
+  // block later.
+  BasicBlock *Head = SplitBlock(Preheader, &Preheader->front());
+
+  // Move any syncregion_start's in Head into Preheader.
+  BasicBlock::iterator InsertPoint = Preheader->begin();
+  for (BasicBlock::iterator I = Head->begin(), E = Head->end(); I != E;) {
+    IntrinsicInst *II = dyn_cast<IntrinsicInst>(I++);
+    if (!II)
+      continue;
+    if (Intrinsic::syncregion_start != II->getIntrinsicID())
+      continue;
+
+    while (isa<IntrinsicInst>(I) &&
+           Intrinsic::syncregion_start ==
+               cast<IntrinsicInst>(I)->getIntrinsicID())
+      ++I;
+
+    Preheader->splice(InsertPoint, &*Head, II->getIterator(), I);
+  }
+
+  if (!Preheader->getTerminator()->getDebugLoc())
+    Preheader->getTerminator()->setDebugLoc(
+        Head->getTerminator()->getDebugLoc());
+
+  return Head;
+}
+
 /// Implement the parallel loop control for a given outlined Tapir loop to
 /// process loop iterations in a parallel recursive divide-and-conquer fashion.
 void DACSpawning::implementDACIterSpawnOnHelper(
@@ -609,34 +833,7 @@ void DACSpawning::implementDACIterSpawnOnHelper(
     Grainsize = &*++OutlineArgsIter;
   }
 
-  BasicBlock *DACHead = Preheader;
-  if (&(Helper->getEntryBlock()) == Preheader) {
-    // Split the entry block.  We'll want to create a backedge into
-    // the split block later.
-    DACHead = SplitBlock(Preheader, &Preheader->front());
-
-    // Move any syncregion_start's in DACHead into Preheader.
-    BasicBlock::iterator InsertPoint = Preheader->begin();
-    for (BasicBlock::iterator I = DACHead->begin(), E = DACHead->end();
-         I != E;) {
-      IntrinsicInst *II = dyn_cast<IntrinsicInst>(I++);
-      if (!II)
-        continue;
-      if (Intrinsic::syncregion_start != II->getIntrinsicID())
-        continue;
-
-      while (isa<IntrinsicInst>(I) &&
-             Intrinsic::syncregion_start ==
-                 cast<IntrinsicInst>(I)->getIntrinsicID())
-        ++I;
-
-      Preheader->splice(InsertPoint, &*DACHead, II->getIterator(), I);
-    }
-
-    if (!Preheader->getTerminator()->getDebugLoc())
-      Preheader->getTerminator()->setDebugLoc(
-          DACHead->getTerminator()->getDebugLoc());
-  }
+  BasicBlock *DACHead = splitLoopControlHead(Helper, Preheader);
 
   Value *PrimaryIVInput = PrimaryIV->getIncomingValueForBlock(DACHead);
   Value *PrimaryIVInc = PrimaryIV->getIncomingValueForBlock(
@@ -729,50 +926,13 @@ void DACSpawning::implementDACIterSpawnOnHelper(
   //
   // CallDest:
   //   br label RecurCont
-  BasicBlock *RecurCallDest = RecurDet;
   BasicBlock *UnwindDest = nullptr;
   if (TL.getUnwindDest())
     UnwindDest = cast<BasicBlock>(VMap[TL.getUnwindDest()]);
-  {
-    // Create input array for recursive call.
-    IRBuilder<> Builder(&(RecurDet->front()));
-    SmallVector<Value *, 8> RecurCallInputs;
-    for (Value &V : Helper->args()) {
-      // Only the inputs for the start and end iterations need special care.
-      // All other inputs should match the arguments of Helper.
-      if (&V == PrimaryIVInput)
-        RecurCallInputs.push_back(PrimaryIVStart);
-      else if (&V == End)
-        RecurCallInputs.push_back(MidIter);
-      else
-        RecurCallInputs.push_back(&V);
-    }
-
-    if (!UnwindDest) {
-      // Common case.  Insert a call to the outline immediately before the detach.
-      CallInst *RecurCall;
-      // Create call instruction.
-      RecurCall = Builder.CreateCall(Helper, RecurCallInputs);
-      // Use a fast calling convention for the outline.
-      RecurCall->setCallingConv(Helper->getCallingConv());
-      RecurCall->setDebugLoc(TLDebugLoc);
-      if (Helper->doesNotThrow())
-        RecurCall->setDoesNotThrow();
-    } else {
-      InvokeInst *RecurCall;
-      BasicBlock *CallDest = SplitBlock(RecurDet, RecurDet->getTerminator());
-      BasicBlock *CallUnwind =
-        createTaskUnwind(Helper, UnwindDest, SyncRegion,
-                         RecurDet->getName()+".unwind");
-      RecurCall = InvokeInst::Create(Helper, CallDest, CallUnwind,
-                                     RecurCallInputs);
-      // Use a fast calling convention for the outline.
-      RecurCall->setCallingConv(Helper->getCallingConv());
-      RecurCall->setDebugLoc(TLDebugLoc);
-      ReplaceInstWithInst(RecurDet->getTerminator(), RecurCall);
-      RecurCallDest = CallDest;
-    }
-  }
+  BasicBlock *RecurCallDest =
+      createRecursiveHelperCall(Helper, RecurDet, PrimaryIVInput,
+                                PrimaryIVStart, End, MidIter, UnwindDest,
+                                SyncRegion, TLDebugLoc);
 
   // Set up continuation of detached recursive call to compute the next loop
   // iteration to execute.  For inclusive ranges, this means adding one to
@@ -844,6 +1004,428 @@ void DACSpawning::implementDACIterSpawnOnHelper(
   }
 }
 
+/// Returns true if the loop control of the outlined Tapir loop can split the
+/// loop lazily.
+bool DACSpawning::canSplitLazily(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                 ValueToValueMapTy &VMap) const {
+  // The Cilksan hooks of the loop describe the iterations of the outlined loop
+  // as one task, which the splits inside the loop would break up.
+  if (Out.Outline->hasFnAttribute(Attribute::SanitizeCilk))
+    return false;
+
+  // The splits reenter the loop header with a new value of the primary
+  // induction variable, which must be the only PHI node there.
+  Loop *L = TL.getLoop();
+  BasicBlock *Header = cast<BasicBlock>(VMap[L->getHeader()]);
+  PHINode *PrimaryIV = cast<PHINode>(VMap[TL.getPrimaryInduction().first]);
+  for (PHINode &PN : Header->phis())
+    if (&PN != PrimaryIV)
+      return false;
+  return true;
+}
+
+/// Implement the parallel loop control for a given outlined Tapir loop to
+/// process loop iterations in a lazy, heartbeat-driven divide-and-conquer
+/// fashion.
+void DACSpawning::implementLazyDACIterSpawnOnHelper(
+    TapirLoopInfo &TL, TaskOutlineInfo &Out, ValueToValueMapTy &VMap) {
+  NamedRegionTimer NRT("implementLazyDACIterSpawnOnHelper",
+                       "Implement lazy D&C spawning of loop iterations",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  Task *T = TL.getTask();
+  Loop *L = TL.getLoop();
+
+  DebugLoc TLDebugLoc = cast<Instruction>(VMap[T->getDetach()])->getDebugLoc();
+  Value *SyncRegion = cast<Value>(VMap[T->getDetach()->getSyncRegion()]);
+  Function *Helper = Out.Outline;
+  LLVMContext &Ctx = Helper->getContext();
+  BasicBlock *Preheader = cast<BasicBlock>(VMap[L->getLoopPreheader()]);
+  BasicBlock *Header = cast<BasicBlock>(VMap[L->getHeader()]);
+  BasicBlock *Latch = cast<BasicBlock>(VMap[L->getLoopLatch()]);
+
+  PHINode *PrimaryIV = cast<PHINode>(VMap[TL.getPrimaryInduction().first]);
+  Value *PrimaryIVInput = PrimaryIV->getIncomingValueForBlock(Preheader);
+  Value *PrimaryIVInc = PrimaryIV->getIncomingValueForBlock(Latch);
+
+  // Remove the norecurse attribute from Helper.
+  if (Helper->doesNotRecurse())
+    Helper->removeFnAttr(Attribute::NoRecurse);
+
+  // Get end and grainsize arguments
+  Argument *End, *Grainsize;
+  {
+    auto OutlineArgsIter = Helper->arg_begin();
+    if (Helper->hasParamAttribute(0, Attribute::StructRet))
+      ++OutlineArgsIter;
+    // End argument is second LC input.
+    End = &*++OutlineArgsIter;
+    // Grainsize argument is third LC input.
+    Grainsize = &*++OutlineArgsIter;
+  }
+  // The heartbeat bounds the overhead of the splits, so only a grainsize the
+  // loop specifies limits how small the split ranges get.
+  Value *MinSplit = Grainsize;
+  if (!TL.getGrainsize())
+    MinSplit = ConstantInt::get(End->getType(), 1);
+
+  Function *ReadCycleCounter =
+      Intrinsic::getDeclaration(&M, Intrinsic::readcyclecounter);
+  Type *CyclesTy = ReadCycleCounter->getReturnType();
+
+  // Read the cycle counter on entry to the loop:
+  //
+  // Preheader:
+  //   EntryTime = call @llvm.readcyclecounter()
+  //   br label Header
+  Value *EntryTime;
+  {
+    IRBuilder<> Builder(Preheader->getTerminator());
+    EntryTime = Builder.CreateCall(ReadCycleCounter, {}, "ls.entrytime");
+  }
+
+  // Redirect the backedge of the loop through a new block, Poll, that checks
+  // for a heartbeat:
+  //
+  // Latch:
+  //   ...
+  //   br i1 %cmp, label Poll, label Exit
+  //
+  // Poll:
+  //   Now = call @llvm.readcyclecounter()
+  //   Elapsed = sub Now, LastSplit
+  //   Beat = icmp uge Elapsed, Heartbeat
+  //   NoCounter = icmp eq Now, 0
+  //   Next = PrimaryIVInc
+  //   Remaining = sub End, Next
+  //   CanSplit = icmp ugt Remaining, MinSplit
+  //   DoSplit = and (or Beat, NoCounter), CanSplit
+  //   br i1 DoSplit, label SplitHead, label Header
+  //
+  // A target without a cycle counter reads 0, and then every poll splits, as
+  // eager divide-and-conquer would.
+  BasicBlock *Poll = BasicBlock::Create(Ctx, "ls.poll", Helper, Header);
+  BasicBlock *SplitHead =
+      BasicBlock::Create(Ctx, "ls.split", Helper, Header);
+  Latch->getTerminator()->replaceSuccessorWith(Header, Poll);
+  Header->replacePhiUsesWith(Latch, Poll);
+
+  PHINode *LastSplit;
+  {
+    IRBuilder<> Builder(&Header->front());
+    LastSplit = Builder.CreatePHI(CyclesTy, 3, "ls.lastsplit");
+  }
+
+  Value *Next, *Remaining;
+  {
+    IRBuilder<> Builder(Poll);
+    Builder.SetCurrentDebugLocation(Latch->getTerminator()->getDebugLoc());
+    Value *Now = Builder.CreateCall(ReadCycleCounter, {}, "ls.now");
+    Value *Elapsed = Builder.CreateSub(Now, LastSplit, "ls.elapsed");
+    Value *Beat = Builder.CreateOr(
+        Builder.CreateICmpUGE(
+            Elapsed, ConstantInt::get(CyclesTy, LazyLoopSplittingHeartbeat)),
+        Builder.CreateICmpEQ(Now, ConstantInt::get(CyclesTy, 0)), "ls.beat");
+    Next = Builder.CreateZExtOrTrunc(PrimaryIVInc, End->getType());
+    Remaining = Builder.CreateSub(End, Next, "ls.remaining");
+    Value *CanSplit = Builder.CreateICmpUGT(Remaining, MinSplit);
+    MDBuilder MDB(Ctx);
+    Builder.CreateCondBr(Builder.CreateAnd(Beat, CanSplit, "ls.dosplit"),
+                         SplitHead, Header,
+                         MDB.createBranchWeights(1, 1 << 20));
+  }
+
+  // Split the remaining iterations in half:
+  //
+  // SplitHead:
+  //   HalfCount = lshr Remaining, 1
+  //   MidIter = add Next, HalfCount
+  //   detach within SyncRegion, label SplitDet, label SplitCont
+  //
+  // SplitDet:
+  //   call Helper(..., Next, MidIter, ...)
+  //   reattach within SyncRegion, label SplitCont
+  //
+  // SplitCont:
+  //   SplitTime = call @llvm.readcyclecounter()
+  //   br label Header
+  //
+  // The spawned call runs the first half and, lazily, splits it in turn.
+  // For inclusive ranges, the continuation starts at MidIter + 1.
+  BasicBlock *SplitDet =
+      BasicBlock::Create(Ctx, "ls.split.det", Helper, Header);
+  BasicBlock *SplitCont =
+      BasicBlock::Create(Ctx, "ls.split.cont", Helper, Header);
+  Instruction *MidIter;
+  {
+    IRBuilder<> Builder(SplitHead);
+    Builder.SetCurrentDebugLocation(TLDebugLoc);
+    Value *HalfCount = Builder.CreateLShr(Remaining, 1, "halfcount");
+    MidIter = cast<Instruction>(Builder.CreateAdd(Next, HalfCount, "miditer"));
+    // Copy flags from the increment operation on the primary IV.
+    MidIter->copyIRFlags(PrimaryIVInc);
+    BasicBlock *UnwindDest = nullptr;
+    if (TL.getUnwindDest())
+      UnwindDest = cast<BasicBlock>(VMap[TL.getUnwindDest()]);
+    if (!UnwindDest)
+      Builder.CreateDetach(SplitDet, SplitCont, SyncRegion);
+    else
+      Builder.CreateDetach(SplitDet, SplitCont, UnwindDest, SyncRegion);
+
+    Builder.SetInsertPoint(SplitDet);
+    Builder.CreateReattach(SplitCont, SyncRegion);
+    createRecursiveHelperCall(Helper, SplitDet, PrimaryIVInput, PrimaryIVInc,
+                              End, MidIter, UnwindDest, SyncRegion,
+                              TLDebugLoc);
+  }
+
+  Value *NextIter = MidIter;
+  Value *SplitTime;
+  {
+    IRBuilder<> Builder(SplitCont);
+    Builder.SetCurrentDebugLocation(TLDebugLoc);
+    if (TL.isInclusiveRange()) {
+      NextIter = Builder.CreateAdd(
+          MidIter, ConstantInt::get(End->getType(), 1), "miditerplusone");
+      cast<Instruction>(NextIter)->copyIRFlags(PrimaryIVInc);
+    }
+    NextIter = Builder.CreateZExtOrTrunc(NextIter, PrimaryIV->getType());
+    SplitTime = Builder.CreateCall(ReadCycleCounter, {}, "ls.splittime");
+    Builder.CreateBr(Header);
+  }
+
+  // Finish the PHI nodes in Header.
+  PrimaryIV->addIncoming(NextIter, SplitCont);
+  LastSplit->addIncoming(EntryTime, Preheader);
+  LastSplit->addIncoming(LastSplit, Poll);
+  LastSplit->addIncoming(SplitTime, SplitCont);
+}
+
+/// Return ceil(\p N / \p D) for unsigned integers, without overflowing for
+/// large \p N.
+static Value *createCeilUDiv(IRBuilderBase &B, Value *N, Value *D,
+                             const Twine &Name = "") {
+  Value *Quot = B.CreateUDiv(N, D);
+  Value *HasRem = B.CreateICmpNE(B.CreateURem(N, D),
+                                 ConstantInt::get(N->getType(), 0));
+  return B.CreateAdd(Quot, B.CreateZExt(HasRem, N->getType()), Name);
+}
+
+/// Implement the parallel loop control for a given outlined Tapir loop to
+/// spawn chunks of loop iterations from a serial loop, with chunk sizes given
+/// by the schedule of the loop.
+void ScheduledSpawning::implementScheduledIterSpawnOnHelper(
+    TapirLoopInfo &TL, TaskOutlineInfo &Out, ValueToValueMapTy &VMap) {
+  NamedRegionTimer NRT("implementScheduledIterSpawnOnHelper",
+                       "Implement scheduled spawning of loop iterations",
+                       TimerGroupName, TimerGroupDescription,
+                       TimePassesIsEnabled);
+  Task *T = TL.getTask();
+  Loop *L = TL.getLoop();
+
+  DebugLoc TLDebugLoc = cast<Instruction>(VMap[T->getDetach()])->getDebugLoc();
+  Value *SyncRegion = cast<Value>(VMap[T->getDetach()->getSyncRegion()]);
+  Function *Helper = Out.Outline;
+  BasicBlock *Preheader = cast<BasicBlock>(VMap[L->getLoopPreheader()]);
+
+  PHINode *PrimaryIV = cast<PHINode>(VMap[TL.getPrimaryInduction().first]);
+
+  // Remove the norecurse attribute from Helper.
+  if (Helper->doesNotRecurse())
+    Helper->removeFnAttr(Attribute::NoRecurse);
+
+  assert(Preheader->getParent() == Helper &&
+         "Preheader does not belong to helper function.");
+  assert(PrimaryIV->getParent()->getParent() == Helper &&
+         "PrimaryIV does not belong to header");
+
+  // Get end and grainsize arguments
+  Argument *End, *Grainsize;
+  {
+    auto OutlineArgsIter = Helper->arg_begin();
+    if (Helper->hasParamAttribute(0, Attribute::StructRet))
+      ++OutlineArgsIter;
+    // End argument is second LC input.
+    End = &*++OutlineArgsIter;
+    // Grainsize argument is third LC input.
+    Grainsize = &*++OutlineArgsIter;
+  }
+  Type *EndTy = End->getType();
+
+  BasicBlock *SchedHead = splitLoopControlHead(Helper, Preheader);
+
+  // Static and guided schedules divide the iterations among the workers.  Get
+  // the number of workers once, in the entry block.
+  TapirLoopHints::SpawningStrategy Sched = Schedule;
+  Value *NumWorkers = nullptr;
+  if (Sched != TapirLoopHints::ST_DYNAMIC) {
+    IRBuilder<> Builder(Helper->getEntryBlock().getTerminator());
+    if (Value *Workers = Target->emitNumWorkers(Builder)) {
+      Workers = Builder.CreateZExtOrTrunc(Workers, EndTy);
+      NumWorkers = Builder.CreateBinaryIntrinsic(
+          Intrinsic::umax, Workers, ConstantInt::get(EndTy, 1), nullptr,
+          "nworkers");
+    } else {
+      LLVM_DEBUG(dbgs() << "Target provides no number of workers.  Using a "
+                        << "dynamic schedule for " << *L);
+      Sched = TapirLoopHints::ST_DYNAMIC;
+    }
+  }
+
+  Value *PrimaryIVInput = PrimaryIV->getIncomingValueForBlock(SchedHead);
+  Value *PrimaryIVInc = PrimaryIV->getIncomingValueForBlock(
+      cast<BasicBlock>(VMap[L->getLoopLatch()]));
+
+  // SchedHead is the preheader to the loop.  From this block, we create the
+  // serial loop that spawns the chunks:
+  //
+  // SchedHead:
+  //   PrimaryIVStart = phi ???
+  //   IterCount = sub End, PrimaryIVStart
+  //   Chunk = ...
+  //   IterCountCmp = icmp ugt IterCount, Chunk
+  //   br i1 IterCountCmp, label SpawnHead, label Header
+  //
+  // SpawnHead:
+  //   ChunkEnd = add PrimaryIVStart, Chunk
+  //   br label SpawnDet
+  //
+  // SpawnDet:
+  //   br label SpawnCont
+  //
+  // SpawnCont:
+  //   br label SchedHead
+  //
+  // The last chunk runs in the loop itself.
+  BasicBlock *SpawnHead, *SpawnDet, *SpawnCont;
+  PHINode *PrimaryIVStart;
+  Value *Chunk;
+  Instruction *ChunkEnd;
+  {
+    Instruction *SchedHeadOrigFront = &(SchedHead->front());
+    IRBuilder<> Builder(SchedHeadOrigFront);
+    if (!Builder.getCurrentDebugLocation())
+      Builder.SetCurrentDebugLocation(
+          Preheader->getTerminator()->getDebugLoc());
+    PrimaryIVStart = Builder.CreatePHI(PrimaryIV->getType(), 2,
+                                       PrimaryIV->getName() + ".sched");
+    PrimaryIVStart->setDebugLoc(PrimaryIV->getDebugLoc());
+    PrimaryIVInput->replaceAllUsesWith(PrimaryIVStart);
+    Value *Start = PrimaryIVStart;
+    // Extend or truncate start, if necessary.
+    if (PrimaryIVStart->getType() != EndTy)
+      Start = Builder.CreateZExtOrTrunc(PrimaryIVStart, EndTy);
+    Value *IterCount = Builder.CreateSub(End, Start, "itercount");
+
+    // No chunk is smaller than the grainsize.
+    Value *MinChunk = Builder.CreateBinaryIntrinsic(
+        Intrinsic::umax, Grainsize, ConstantInt::get(EndTy, 1), nullptr,
+        "minchunk");
+    switch (Sched) {
+    case TapirLoopHints::ST_STATIC: {
+      // Divide all iterations of this call evenly among the workers.
+      Value *Start0 = PrimaryIVInput;
+      if (Start0->getType() != EndTy)
+        Start0 = Builder.CreateZExtOrTrunc(Start0, EndTy);
+      Value *Total = Builder.CreateSub(End, Start0, "totalcount");
+      Chunk = createCeilUDiv(Builder, Total, NumWorkers);
+      break;
+    }
+    case TapirLoopHints::ST_GUIDED:
+      // Divide the remaining iterations evenly among the workers.
+      Chunk = createCeilUDiv(Builder, IterCount, NumWorkers);
+      break;
+    default:
+      Chunk = MinChunk;
+      break;
+    }
+    if (Chunk != MinChunk)
+      Chunk = Builder.CreateBinaryIntrinsic(Intrinsic::umax, Chunk, MinChunk,
+                                            nullptr, "chunk");
+
+    Value *IterCountCmp = Builder.CreateICmpUGT(IterCount, Chunk);
+    Instruction *SpawnTerm =
+        SplitBlockAndInsertIfThen(IterCountCmp, SchedHeadOrigFront,
+                                  /*Unreachable=*/false,
+                                  /*BranchWeights=*/nullptr);
+    SpawnHead = SpawnTerm->getParent();
+    // Create SpawnHead, SpawnDet, and SpawnCont, with appropriate branches.
+    SpawnDet = SplitBlock(SpawnHead, SpawnHead->getTerminator());
+    SpawnCont = SplitBlock(SpawnDet, SpawnDet->getTerminator());
+    SpawnCont->getTerminator()->replaceUsesOfWith(SpawnTerm->getSuccessor(0),
+                                                  SchedHead);
+
+    Builder.SetInsertPoint(&(SpawnHead->front()));
+    ChunkEnd = cast<Instruction>(Builder.CreateAdd(Start, Chunk, "chunkend"));
+    // Copy flags from the increment operation on the primary IV.
+    ChunkEnd->copyIRFlags(PrimaryIVInc);
+  }
+
+  // Call the helper on the chunk in SpawnDet, with the chunk size as the
+  // grainsize, so the chunk runs serially.
+  BasicBlock *UnwindDest = nullptr;
+  if (TL.getUnwindDest())
+    UnwindDest = cast<BasicBlock>(VMap[TL.getUnwindDest()]);
+  BasicBlock *SpawnCallDest = createRecursiveHelperCall(
+      Helper, SpawnDet, PrimaryIVInput, PrimaryIVStart, End, ChunkEnd,
+      UnwindDest, SyncRegion, TLDebugLoc, Grainsize, Chunk);
+
+  // Set up the continuation of the spawned chunk to start the next chunk.  For
+  // inclusive ranges, this means adding one to ChunkEnd.
+  //
+  // SpawnCont:
+  //   NextIter = add ChunkEnd, 1
+  //   br label SchedHead
+  Instruction *NextIter = ChunkEnd;
+  {
+    IRBuilder<> Builder(&(SpawnCont->front()));
+    if (TL.isInclusiveRange()) {
+      NextIter = cast<Instruction>(Builder.CreateAdd(
+          ChunkEnd, ConstantInt::get(EndTy, 1), "chunkendplusone"));
+      // Copy flags from the increment operation on the primary IV.
+      NextIter->copyIRFlags(PrimaryIVInc);
+    }
+    // Extend or truncate NextIter, if necessary
+    if (PrimaryIVStart->getType() != NextIter->getType())
+      NextIter = cast<Instruction>(
+          Builder.CreateZExtOrTrunc(NextIter, PrimaryIVStart->getType()));
+  }
+
+  // Finish the phi node in SchedHead.
+  //
+  // SchedHead:
+  //   PrimaryIVStart = phi [ PrimaryIVInput, %entry ], [ NextIter, SpawnCont ]
+  //   ...
+  PrimaryIVStart->addIncoming(PrimaryIVInput, Preheader);
+  PrimaryIVStart->addIncoming(NextIter, SpawnCont);
+
+  // Spawn the chunk.
+  //
+  // SpawnHead:
+  //   detach within SyncRegion, label SpawnDet, label SpawnCont
+  //     (unwind label DetachUnwind)
+  //
+  // SpawnDet:
+  //   call Helper(...)
+  //   reattach label SpawnCont
+  {
+    IRBuilder<> Builder(SpawnHead->getTerminator());
+    DetachInst *NewDI;
+    if (!UnwindDest)
+      NewDI = Builder.CreateDetach(SpawnDet, SpawnCont, SyncRegion);
+    else
+      NewDI = Builder.CreateDetach(SpawnDet, SpawnCont, UnwindDest,
+                                   SyncRegion);
+    NewDI->setDebugLoc(TLDebugLoc);
+    SpawnHead->getTerminator()->eraseFromParent();
+
+    Builder.SetInsertPoint(SpawnCallDest->getTerminator());
+    ReattachInst *RI = Builder.CreateReattach(SpawnCont, SyncRegion);
+    RI->setDebugLoc(TLDebugLoc);
+    SpawnCallDest->getTerminator()->eraseFromParent();
+  }
+}
+
 /// Examine a given loop to determine if its a Tapir loop that can and should be
 /// processed.  Returns the Task that encodes the loop body if so, or nullptr if
 /// not.
@@ -924,6 +1506,10 @@ LoopOutlineProcessor *LoopSpawningImpl::getOutlineProcessor(TapirLoopInfo *TL) {
   switch (Hints.getStrategy()) {
   case TapirLoopHints::ST_DAC:
     return new DACSpawning(M);
+  case TapirLoopHints::ST_STATIC:
+  case TapirLoopHints::ST_DYNAMIC:
+  case TapirLoopHints::ST_GUIDED:
+    return new ScheduledSpawning(M, Targets[TLTID].get(), Hints.getStrategy());
   default:
     return new DefaultLoopOutlineProcessor(M);
   }
@@ -1440,6 +2026,54 @@ Function *LoopSpawningImpl::createHelperForTapirLoop(
   return Helper;
 }
 
+/// Record that the iterations of Tapir loop \p L are logically parallel on its
+/// serialized copy in an outlined helper, given by \p VMap.
+///
+/// Tapir programs are assumed to be data-race free, so two iterations of L
+/// never access the same location unless both only read it.  The copy of L is
+/// an ordinary serial loop, however, which the vectorizer and other loop passes
+/// analyze conservatively.  Put the plain loads and stores of the copy in an
+/// access group listed in its llvm.loop.parallel_accesses, along with the calls
+/// that do not synchronize (see isDRFParallelAccess()).  The copy is then
+/// annotated parallel, whatever the target, unless it contains other memory
+/// operations, such as atomics or calls, which may synchronize iterations.
+/// The vectorizer then needs no runtime alias checks for the copy.
+static void addParallelAccessMetadata(const Loop *L, ValueToValueMapTy &VMap) {
+  BasicBlock *Latch =
+      dyn_cast_or_null<BasicBlock>(VMap.lookup(L->getLoopLatch()));
+  if (!Latch)
+    return;
+
+  LLVMContext &C = Latch->getContext();
+  MDNode *AccessGroup = MDNode::getDistinct(C, {});
+  for (BasicBlock *BB : L->blocks()) {
+    BasicBlock *ClonedBB = dyn_cast_or_null<BasicBlock>(VMap.lookup(BB));
+    if (!ClonedBB)
+      continue;
+    for (Instruction &I : *ClonedBB) {
+      if (!I.mayReadOrWriteMemory() || !isDRFParallelAccess(I))
+        continue;
+      I.setMetadata(LLVMContext::MD_access_group,
+                    uniteAccessGroups(
+                        I.getMetadata(LLVMContext::MD_access_group),
+                        AccessGroup));
+    }
+  }
+
+  // Rebuild the loop ID of the copy with the parallel-accesses property.
+  Instruction *LatchTerm = Latch->getTerminator();
+  SmallVector<Metadata *, 4> MDs;
+  MDs.push_back(nullptr);
+  if (MDNode *LoopID = LatchTerm->getMetadata(LLVMContext::MD_loop))
+    for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i)
+      MDs.push_back(LoopID->getOperand(i));
+  MDs.push_back(MDNode::get(
+      C, {MDString::get(C, "llvm.loop.parallel_accesses"), AccessGroup}));
+  MDNode *NewLoopID = MDNode::getDistinct(C, MDs);
+  NewLoopID->replaceOperandWith(0, NewLoopID);
+  LatchTerm->setMetadata(LLVMContext::MD_loop, NewLoopID);
+}
+
 /// Outline all recorded Tapir loops in the function.
 TaskOutlineMapTy LoopSpawningImpl::outlineAllTapirLoops() {
   // Prepare Tapir loops for outlining.
@@ -1562,6 +2196,9 @@ TaskOutlineMapTy LoopSpawningImpl::outlineAllTapirLoops() {
         L->getLoopPreheader()->getTerminator(), T->getDetach()->getSyncRegion(),
         TL->getExitBlock(), TL->getUnwindDest());
 
+    if (AnnotateParallelAccesses)
+      addParallelAccessMetadata(L, VMap);
+
     // Do ABI-dependent processing of each outlined Tapir loop.
     {
     NamedRegionTimer NRT("postProcessOutline",
@@ -1612,6 +2249,10 @@ bool LoopSpawningImpl::run() {
   if (TI.isSerial())
     return false;
 
+  // Create a version of each multi-target loop for each of its targets (see
+  // TapirMultiTarget.h).  The versions are processed like any other loop.
+  versionMultiTargetLoops(F, DT, LI, TI, SE);
+
   // Discover all Tapir loops and record them.
   for (Loop *TopLevelLoop : LI)
     for (Loop *L : post_order(TopLevelLoop))
@@ -1745,6 +2386,19 @@ PreservedAnalyses LoopSpawningPass::run(Module &M, ModuleAnalysisManager &AM) {
             .run();
   }
 
+  // Some targets also process modules without parallelism (e.g., the
+  // relocatable device code of a module may be used by the kernels of
+  // other modules).
+  bool PostProcessed = false;
+  if (!HasParallelism && !WorkList.empty()) {
+    TapirTargetID TargetID = GetTLI(*WorkList.front()).getTapirTarget();
+    std::shared_ptr<TapirTarget> Target(getTapirTargetFromID(M, TargetID));
+    if (Target && Target->requiresModulePostProcessing()) {
+      Target->postProcessModule();
+      PostProcessed = true;
+    }
+  }
+
   if (HasParallelism)
     // FIXME: The order of target processing here possibly breaks a
     // "inside-out" contract (loosely speaking) for ordering.  In nested
@@ -1754,7 +2408,7 @@ PreservedAnalyses LoopSpawningPass::run(Module &M, ModuleAnalysisManager &AM) {
     for (const auto &[TID, ThisTarget] : Targets)
       ThisTarget->postProcessModule();
 
-  Changed |= HasParallelism;
+  Changed |= HasParallelism || PostProcessed;
   if (Changed)
     return PreservedAnalyses::none();
   return PreservedAnalyses::all();
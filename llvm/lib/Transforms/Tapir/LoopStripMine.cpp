@@ -11,7 +11,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/LoopStripMine.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/Analysis/DomTreeUpdater.h"
@@ -23,21 +25,28 @@
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/WithColor.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/LoopSimplify.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
 #include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/Transforms/Utils/SimplifyIndVar.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 #include "llvm/Transforms/Utils/UnrollLoop.h"
+#include <cmath>
 
 using namespace llvm;
 
@@ -56,6 +65,37 @@ static cl::opt<bool> StripMineUnrollRemainder(
   "stripmine-unroll-remainder", cl::Hidden,
   cl::desc("Allow the loop remainder after stripmining to be unrolled."));
 
+static cl::opt<bool> StripMineVectorize(
+  "stripmine-vectorize", cl::Hidden, cl::init(true),
+  cl::desc("Choose stripmine counts that are multiples of the target's vector "
+           "width times its interleave factor, and mark the serial strips of "
+           "stripmined loops for vectorization."));
+
+static cl::opt<bool> StripMinePrivatizeReductions(
+  "stripmine-privatize-reductions", cl::Hidden, cl::init(true),
+  cl::desc("Accumulate the relaxed atomic reductions of each strip of a "
+           "stripmined loop in a register, and apply them with one atomic "
+           "update per strip."));
+
+static cl::opt<std::string> StripMineProfile(
+    "stripmine-profile", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Choose the stripmine counts of Tapir loops from the iterations "
+             "and cycles of the loops in this Cilkscale perf report"));
+
+static cl::opt<unsigned> StripMineProfileSpawnCycles(
+    "stripmine-profile-spawn-cycles", cl::Hidden, cl::init(100),
+    cl::desc("Cycles to spawn a chunk of a profiled Tapir loop"));
+
+static cl::opt<unsigned> StripMineProfileOverhead(
+    "stripmine-profile-overhead", cl::Hidden, cl::init(1),
+    cl::desc("Percent of the work of a profiled Tapir loop that spawning its "
+             "chunks may add"));
+
+static cl::opt<unsigned> StripMineProfileMinChunks(
+    "stripmine-profile-min-chunks", cl::Hidden, cl::init(64),
+    cl::desc("Fewest chunks to split an average execution of a profiled "
+             "Tapir loop into"));
+
 /// Constants for stripmining cost analysis.
 namespace StripMineConstants {
 /// Default coarsening factor for strpimined Tapir loops.
@@ -175,6 +215,162 @@ static unsigned StripMineCountPragmaValue(const Loop *L) {
   return Hints.getGrainsize();
 }
 
+namespace {
+/// The measured cost of a Tapir loop in a Cilkscale perf report.
+struct LoopProfile {
+  uint64_t Count = 0;      // Executions of the loop.
+  uint64_t Iterations = 0; // Iterations of those executions.
+  uint64_t Cycles = 0;     // Cycles of those executions.
+};
+} // namespace
+
+/// Split a line of a CSV file into its fields.
+static SmallVector<std::string, 16> splitCSVLine(StringRef Line) {
+  SmallVector<std::string, 16> Fields(1);
+  bool Quoted = false;
+  for (size_t I = 0; I < Line.size(); ++I) {
+    char C = Line[I];
+    if (Quoted && C == '"' && I + 1 < Line.size() && Line[I + 1] == '"')
+      Fields.back() += Line[++I];
+    else if (C == '"')
+      Quoted = !Quoted;
+    else if (C == ',' && !Quoted)
+      Fields.emplace_back();
+    else
+      Fields.back() += C;
+  }
+  return Fields;
+}
+
+/// Load the Tapir loops of the Cilkscale perf report named by
+/// -stripmine-profile, keyed by the file name (without directories) and the
+/// line of the loop.
+static const StringMap<LoopProfile> &getStripMineProfile() {
+  static const StringMap<LoopProfile> Profile = [] {
+    StringMap<LoopProfile> Profile;
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+        MemoryBuffer::getFile(StripMineProfile);
+    if (std::error_code EC = BufferOrErr.getError()) {
+      WithColor::warning() << "cannot read stripmine profile '"
+                           << StripMineProfile << "': " << EC.message()
+                           << "\n";
+      return Profile;
+    }
+
+    line_iterator LineIt(**BufferOrErr, /*SkipBlanks*/ true);
+    if (LineIt.is_at_eof())
+      return Profile;
+    SmallVector<std::string, 16> Header = splitCSVLine(*LineIt);
+    auto Column = [&](StringRef Name) -> size_t {
+      return llvm::find(Header, Name) - Header.begin();
+    };
+    size_t KindCol = Column("kind"), LocCol = Column("location"),
+           CountCol = Column("count"), ItersCol = Column("iterations"),
+           CyclesCol = Column("cycles");
+    size_t NumCols = Header.size();
+    if (KindCol == NumCols || LocCol == NumCols || CountCol == NumCols ||
+        ItersCol == NumCols || CyclesCol == NumCols) {
+      WithColor::warning() << "stripmine profile '" << StripMineProfile
+                           << "' is not a Cilkscale perf report\n";
+      return Profile;
+    }
+
+    for (++LineIt; !LineIt.is_at_eof(); ++LineIt) {
+      SmallVector<std::string, 16> Fields = splitCSVLine(*LineIt);
+      if (Fields.size() < NumCols || Fields[KindCol] != "loop")
+        continue;
+      uint64_t Count, Iterations, Cycles;
+      if (StringRef(Fields[CountCol]).getAsInteger(10, Count) ||
+          StringRef(Fields[ItersCol]).getAsInteger(10, Iterations) ||
+          StringRef(Fields[CyclesCol]).getAsInteger(10, Cycles))
+        continue;
+      // Locations are "file:line:column (function)".
+      StringRef Loc = StringRef(Fields[LocCol]).split(" (").first;
+      StringRef File, Line;
+      std::tie(File, Line) = Loc.rsplit(':').first.rsplit(':');
+      unsigned LineNo;
+      if (Line.getAsInteger(10, LineNo))
+        continue;
+      LoopProfile &LP =
+          Profile[(sys::path::filename(File) + ":" + Twine(LineNo)).str()];
+      LP.Count += Count;
+      LP.Iterations += Iterations;
+      LP.Cycles += Cycles;
+    }
+    return Profile;
+  }();
+  return Profile;
+}
+
+/// Compute the stripmine count of loop \p L from the cost of the loop in the
+/// -stripmine-profile report.  Returns 0 if the loop was not profiled.
+static unsigned getProfiledStripMineCount(const Loop *L) {
+  if (StripMineProfile.empty())
+    return 0;
+  const DILocation *Loc = L->getStartLoc().get();
+  if (!Loc)
+    return 0;
+  const StringMap<LoopProfile> &Profile = getStripMineProfile();
+  auto It = Profile.find(
+      (sys::path::filename(Loc->getFilename()) + ":" + Twine(Loc->getLine()))
+          .str());
+  if (It == Profile.end())
+    return 0;
+  const LoopProfile &LP = It->second;
+  if (!LP.Count || !LP.Iterations || !LP.Cycles)
+    return 0;
+
+  // Choose the grainsize G such that spawning a chunk of G iterations, which
+  // costs d cycles, adds at most a fraction \eps of the work of the chunk:
+  // d <= \eps * G * S, where S is the measured cycles of an iteration.  But
+  // keep at least the given number of chunks in an average execution of the
+  // loop, so irregular iterations can still be balanced.
+  double IterCycles = (double)LP.Cycles / LP.Iterations;
+  double Eps = std::max(StripMineProfileOverhead.getValue(), 1u) / 100.0;
+  double Count = std::ceil(StripMineProfileSpawnCycles / (Eps * IterCycles));
+  double AvgTripCount = (double)LP.Iterations / LP.Count;
+  double MaxCount = std::floor(
+      AvgTripCount / std::max(StripMineProfileMinChunks.getValue(), 1u));
+  Count = std::max(std::min(Count, MaxCount), 1.0);
+  LLVM_DEBUG(dbgs() << "  Profiled loop: " << LP.Count << " executions, "
+                    << AvgTripCount << " iterations of " << IterCycles
+                    << " cycles on average; stripmine count " << Count
+                    << "\n");
+  return (unsigned)std::min(Count, (double)(1u << 30));
+}
+
+unsigned llvm::getStripMineVectorFactor(const Loop *L,
+                                        const TargetTransformInfo &TTI) {
+  if (!StripMineVectorize)
+    return 1;
+
+  // Find the widest scalar type the loop loads or stores, as the loop
+  // vectorizer does to pick its vectorization factor.
+  const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+  uint64_t WidestBits = 0;
+  for (const BasicBlock *BB : L->blocks())
+    for (const Instruction &I : *BB) {
+      if (!isa<LoadInst>(&I) && !isa<StoreInst>(&I))
+        continue;
+      Type *Ty = getLoadStoreType(&I);
+      if (!Ty->isIntOrPtrTy() && !Ty->isFloatingPointTy())
+        return 1;
+      WidestBits =
+          std::max(WidestBits, DL.getTypeSizeInBits(Ty).getFixedValue());
+    }
+  if (!WidestBits)
+    return 1;
+
+  uint64_t RegBits =
+      TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector)
+          .getFixedValue();
+  unsigned VF = llvm::bit_floor(RegBits / WidestBits);
+  if (VF < 2)
+    return 1;
+  unsigned IC = TTI.getMaxInterleaveFactor(ElementCount::getFixed(VF));
+  return VF * llvm::bit_floor(std::max(IC, 1u));
+}
+
 // Returns true if stripmine count was set explicitly.
 // Calculates stripmine count and writes it to SMP.Count.
 bool llvm::computeStripMineCount(
@@ -197,7 +393,14 @@ bool llvm::computeStripMineCount(
     return true;
   }
 
-  // 3rd priority is computed stripmine count.
+  // 3rd priority is stripmine count computed from a profile of the loop.
+  if (unsigned ProfileCount = getProfiledStripMineCount(L)) {
+    SMP.Count = ProfileCount;
+    SMP.AllowExpensiveTripCount = true;
+    return true;
+  }
+
+  // 4th priority is computed stripmine count.
   //
   // We want to coarsen the loop such that the work of detaching a loop
   // iteration is tiny compared to the work of the loop body.  Specifically, we
@@ -217,6 +420,13 @@ bool llvm::computeStripMineCount(
                  LoopCost)
                     .getValue());
 
+  // Round the count up to a multiple of the iterations covered by one vector
+  // iteration, so each serial strip vectorizes without a scalar remainder.
+  // Vectorized iterations cost less than the estimate above, so the larger
+  // count still amortizes the detach.
+  if (SMP.Count > 1)
+    SMP.Count = alignTo(SMP.Count, getStripMineVectorFactor(L, TTI));
+
   return false;
 }
 
@@ -742,6 +952,91 @@ static BasicBlock *NestDetachUnwindPredecessors(
   return OuterUD;
 }
 
+/// Privatize the atomic reductions in the serial loop L, which was derived from
+/// a Tapir loop.  The relaxed atomic updates of a loop-invariant location that
+/// are the only uses of that location in L are accumulated in a register, and
+/// the result is applied with one atomic update when L exits.  Other iterations
+/// of the Tapir loop update the location concurrently, so any plain access to
+/// the location in L would be a race; other synchronization or calls in L make
+/// this transformation bail out.
+static bool privatizeAtomicReductions(Loop *L, DominatorTree &DT,
+                                      LoopInfo &LI, ScalarEvolution *SE,
+                                      AssumptionCache *AC) {
+  if (!StripMinePrivatizeReductions)
+    return false;
+
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Exit = L->getUniqueExitBlock();
+  if (!Preheader || !Exit || Exit->isEHPad() || !L->hasDedicatedExits())
+    return false;
+
+  // Gather the updates, grouped by the location they update.
+  MapVector<Value *, SmallVector<AtomicRMWInst *, 2>> Reductions;
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB) {
+      if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+        if (RMW->getOrdering() != AtomicOrdering::Monotonic ||
+            !isAtomicReductionUpdate(RMW) ||
+            !L->isLoopInvariant(RMW->getPointerOperand()))
+          return false;
+        Reductions[RMW->getPointerOperand()].push_back(RMW);
+        continue;
+      }
+      if (I.isAtomic() || isa<FenceInst>(&I))
+        return false;
+      if (isa<CallBase>(&I) && !isa<IntrinsicInst>(&I) &&
+          I.mayReadOrWriteMemory())
+        return false;
+    }
+
+  SmallVector<AllocaInst *, 4> Accumulators;
+  Function *F = Preheader->getParent();
+  IRBuilder<> EntryB(&F->getEntryBlock(),
+                     F->getEntryBlock().getFirstInsertionPt());
+  for (auto &R : Reductions) {
+    Value *Ptr = R.first;
+    AtomicRMWInst *First = R.second.front();
+    AtomicRMWInst::BinOp Op = First->getOperation();
+    Type *Ty = First->getValOperand()->getType();
+    if (any_of(R.second, [&](AtomicRMWInst *RMW) {
+          return RMW->getOperation() != Op ||
+                 RMW->getValOperand()->getType() != Ty;
+        }))
+      continue;
+    if (any_of(Ptr->users(), [&](User *U) {
+          auto *I = dyn_cast<Instruction>(U);
+          return I && L->contains(I) && !is_contained(R.second, I);
+        }))
+      continue;
+
+    LLVM_DEBUG(dbgs() << "Privatizing atomic reduction into " << *Ptr
+                      << " in loop " << L->getHeader()->getName() << "\n");
+    AllocaInst *Acc = EntryB.CreateAlloca(Ty, nullptr, "reduce.acc");
+    IRBuilder<> PB(Preheader->getTerminator());
+    PB.CreateStore(getAtomicReductionIdentity(Op, Ty), Acc);
+    for (AtomicRMWInst *RMW : R.second) {
+      IRBuilder<> B(RMW);
+      B.CreateStore(emitAtomicReductionOp(B, Op, B.CreateLoad(Ty, Acc),
+                                          RMW->getValOperand()),
+                    Acc);
+    }
+    IRBuilder<> XB(&*Exit->getFirstInsertionPt());
+    AtomicRMWInst *Combined = XB.CreateAtomicRMW(
+        Op, Ptr, XB.CreateLoad(Ty, Acc), First->getAlign(),
+        AtomicOrdering::Monotonic, First->getSyncScopeID());
+    Combined->setDebugLoc(First->getDebugLoc());
+    for (AtomicRMWInst *RMW : R.second)
+      RMW->eraseFromParent();
+    Accumulators.push_back(Acc);
+  }
+  if (Accumulators.empty())
+    return false;
+
+  PromoteMemToReg(Accumulators, DT, AC);
+  formLCSSA(*L, DT, &LI, SE);
+  return true;
+}
+
 Loop *llvm::StripMineLoop(Loop *L, unsigned Count, bool AllowExpensiveTripCount,
                           bool UnrollRemainder, LoopInfo *LI,
                           ScalarEvolution *SE, DominatorTree *DT,
@@ -1515,6 +1810,10 @@ Loop *llvm::StripMineLoop(Loop *L, unsigned Count, bool AllowExpensiveTripCount,
                 LatchExit, Preheader, EpilogPreheader, VMap, DT, LI, SE, DL,
                 PreserveLCSSA);
 
+  // Accumulate the reductions of each strip, and of the epilog, in registers.
+  privatizeAtomicReductions(L, *DT, *LI, SE, AC);
+  privatizeAtomicReductions(*RemainderLoop, *DT, *LI, SE, AC);
+
   // If this loop is nested, then the loop stripminer changes the code in the
   // any of its parent loops, so the Scalar Evolution pass needs to be run
   // again.
@@ -280,11 +280,21 @@ static bool tryToStripMineLoop(
   // synchronized.
   bool NeedNestedSync = IncludeNestedSync;
   if (!NeedNestedSync && TLI)
-    NeedNestedSync = TLI->getTapirTarget() == TapirTargetID::OpenCilk;
+    NeedNestedSync = TLI->getTapirTarget() == TapirTargetID::OpenCilk ||
+                     TLI->getTapirTarget() == TapirTargetID::Multi;
 
   // Save loop properties before it is transformed.
   MDNode *OrigLoopID = L->getLoopID();
 
+  // Mark the serial strips for vectorization when each strip is a whole number
+  // of vector iterations and the user gave no vectorization hints.  The strips
+  // are derived from a Tapir loop, so their iterations are known to be
+  // independent.
+  unsigned VectorFactor = getStripMineVectorFactor(L, TTI);
+  bool VectorizeStrips = VectorFactor > 1 && NumCalls == 0 &&
+                         SMP.Count % VectorFactor == 0 &&
+                         TM_Unspecified == hasVectorizeTransformation(L);
+
   // Stripmine the loop
   Loop *RemainderLoop = nullptr;
   Loop *NewLoop = StripMineLoop(L, SMP.Count, SMP.AllowExpensiveTripCount,
@@ -303,6 +313,14 @@ static bool tryToStripMineLoop(
     RemainderLoop->setLoopID(NewRemainderLoopID);
   }
 
+  if (VectorizeStrips) {
+    LLVM_DEBUG(dbgs() << "  Marking stripmined loop for vectorization by "
+                      << VectorFactor << "\n");
+    addStringMetadataToLoop(L, "llvm.loop.vectorize.enable", 1);
+    if (RemainderLoop)
+      addStringMetadataToLoop(RemainderLoop, "llvm.loop.vectorize.enable", 1);
+  }
+
   // Mark the new loop as stripmined.
   TapirLoopHints NewHints(NewLoop);
   NewHints.setAlreadyStripMined();
@@ -23,6 +23,7 @@
 #include "llvm/Transforms/IPO/FunctionAttrs.h"
 #include "llvm/Transforms/Tapir/CudaABI.h"
 #include "llvm/Transforms/Tapir/HipABI.h"
+#include "llvm/Transforms/Tapir/LevelZeroABI.h"
 #include "llvm/Transforms/Tapir/LambdaABI.h"
 #include "llvm/Transforms/Tapir/OMPTaskABI.h"
 #include "llvm/Transforms/Tapir/OpenCilkABI.h"
@@ -53,6 +54,8 @@ TapirTarget *llvm::getTapirTargetFromID(Module &M, TapirTargetID ID) {
     return new CudaABI(M);
   case TapirTargetID::Hip:
     return new HipABI(M);
+  case TapirTargetID::LevelZero:
+    return new LevelZeroABI(M);
   case TapirTargetID::Lambda:
     return new LambdaABI(M);
   case TapirTargetID::OMPTask:
@@ -65,6 +68,11 @@ TapirTarget *llvm::getTapirTargetFromID(Module &M, TapirTargetID ID) {
     return new QthreadsABI(M);
   case TapirTargetID::Realm:
     return new RealmABI(M);
+  case TapirTargetID::Multi:
+    // The loops of multi-target modules are versioned for each of the
+    // targets before they are outlined (see TapirMultiTarget.h).  The
+    // remaining tasks run on the host.
+    return new OpenCilkABI(M);
   default:
     llvm_unreachable("Invalid TapirTargetID");
   }
@@ -520,6 +528,97 @@ void llvm::fixupInputSet(Function &F, const ValueSet &Inputs, ValueSet &Fixed) {
       Fixed.insert(V);
 }
 
+// Metadata that marks the argument structures allocated from the arena of a
+// sync region and the stacksave that records the start of the arena.
+static const char TaskArgsArenaMD[] = "tapir.args.arena";
+
+bool llvm::isTaskArgsArena(const AllocaInst *Closure) {
+  return Closure->hasMetadata(TaskArgsArenaMD);
+}
+
+// Returns the stacksave at the start of the arena of \p SyncRegion, or null if
+// no task of the sync region allocates its arguments from an arena.
+static IntrinsicInst *getTaskArgsArena(Instruction *SyncRegion) {
+  for (Instruction *I = SyncRegion->getNextNode(); I; I = I->getNextNode())
+    if (auto *II = dyn_cast<IntrinsicInst>(I))
+      if (II->getIntrinsicID() == Intrinsic::stacksave &&
+          II->hasMetadata(TaskArgsArenaMD))
+        return II;
+  return nullptr;
+}
+
+void llvm::resetTaskArgsArena(Value *SyncRegion, IRBuilderBase &B) {
+  if (auto *SR = dyn_cast<Instruction>(SyncRegion))
+    if (IntrinsicInst *Arena = getTaskArgsArena(SR))
+      B.CreateStackRestore(Arena);
+}
+
+// Returns true if the spawn of \p DI may execute \p AllocBB again, e.g.,
+// because it spawns in a serial loop, before its sync region syncs.
+static bool mayRespawnBeforeSync(DetachInst *DI, BasicBlock *AllocBB) {
+  Value *SR = DI->getSyncRegion();
+  SmallVector<BasicBlock *, 8> Worklist;
+  SmallPtrSet<BasicBlock *, 16> Visited;
+  Worklist.push_back(DI->getContinue());
+  if (DI->hasUnwindDest())
+    Worklist.push_back(DI->getUnwindDest());
+
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (BB == AllocBB)
+      return true;
+    if (!Visited.insert(BB).second)
+      continue;
+    Instruction *Term = BB->getTerminator();
+    if (SyncInst *SI = dyn_cast<SyncInst>(Term))
+      if (SI->getSyncRegion() == SR)
+        continue;
+    if (DetachInst *SubDI = dyn_cast<DetachInst>(Term)) {
+      // Stay in the spawning task.
+      Worklist.push_back(SubDI->getContinue());
+      if (SubDI->hasUnwindDest())
+        Worklist.push_back(SubDI->getUnwindDest());
+      continue;
+    }
+    for (BasicBlock *Succ : successors(BB))
+      Worklist.push_back(Succ);
+  }
+  return false;
+}
+
+// Returns true if the arguments of task \p T, stored at \p StorePt, can be
+// allocated from the arena of the sync region of T.
+//
+// The arena lives on the stack of the spawning function, between a stacksave
+// after the start of the sync region and the stackrestore that each sync of
+// the region executes once its tasks are done.  Every spawn gets a structure
+// of its own, so a spawn that can run again before the sync, which would grow
+// the stack with each iteration, keeps the static structure.  The reset
+// releases everything allocated on the stack since the start of the region,
+// so the spawning task must have no other sync region and the function must
+// not save and restore the stack otherwise (e.g., for variable-length arrays).
+static bool canUseTaskArgsArena(Task *T, Instruction *StorePt) {
+  DetachInst *DI = T->getDetach();
+  auto *SR = dyn_cast<Instruction>(DI->getSyncRegion());
+  if (!SR)
+    return false;
+  Task *Parent = T->getParentTask();
+  for (Instruction &I : instructions(DI->getFunction())) {
+    auto *II = dyn_cast<IntrinsicInst>(&I);
+    if (!II)
+      continue;
+    if (II->getIntrinsicID() == Intrinsic::stackrestore)
+      return false;
+    if (II->getIntrinsicID() == Intrinsic::syncregion_start && II != SR &&
+        Parent->simplyEncloses(II->getParent()) &&
+        none_of(Parent->subtasks(), [&](const Task *SubT) {
+          return SubT->encloses(II->getParent());
+        }))
+      return false;
+  }
+  return !mayRespawnBeforeSync(DI, StorePt->getParent());
+}
+
 /// Organize the inputs to task \p T, given in \p TaskInputs, to create an
 /// appropriate set of inputs, \p HelperInputs, to pass to the outlined
 /// function for \p T.
@@ -530,10 +629,26 @@ Instruction *llvm::fixupHelperInputs(Function &F, Task *T, ValueSet &TaskInputs,
                                      ValueToValueMapTy &InputsMap,
                                      Loop *TapirL) {
   if (TapirTarget::ArgStructMode::None != useArgStruct) {
+    // A task that cannot use the arena gets a static structure.
+    bool UseArena = TapirTarget::ArgStructMode::Arena == useArgStruct &&
+                    !TapirL && canUseTaskArgsArena(T, StorePt);
+    bool StaticStruct =
+        TapirTarget::ArgStructMode::Dynamic != useArgStruct && !UseArena;
     std::pair<AllocaInst *, Instruction *> ArgsStructInfo =
-        createTaskArgsStruct(TaskInputs, T, StorePt, LoadPt,
-                             TapirTarget::ArgStructMode::Static == useArgStruct,
+        createTaskArgsStruct(TaskInputs, T, StorePt, LoadPt, StaticStruct,
                              InputsMap, TapirL);
+    if (UseArena) {
+      // Allocate the structure from the arena of the sync region, starting
+      // the arena if this is the first such task of the region.
+      LLVMContext &C = F.getContext();
+      auto *SR = cast<Instruction>(T->getDetach()->getSyncRegion());
+      if (!getTaskArgsArena(SR)) {
+        IRBuilder<> B(SR->getNextNode());
+        B.CreateStackSave("args.arena")
+            ->setMetadata(TaskArgsArenaMD, MDNode::get(C, {}));
+      }
+      ArgsStructInfo.first->setMetadata(TaskArgsArenaMD, MDNode::get(C, {}));
+    }
     HelperArgs.insert(ArgsStructInfo.first);
     return ArgsStructInfo.second;
   }
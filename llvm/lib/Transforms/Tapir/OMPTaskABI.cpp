@@ -20,8 +20,10 @@
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DiagnosticInfo.h"
@@ -30,12 +32,14 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Linker/Linker.h"
 #include "llvm/Support/Alignment.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ModRef.h"
 #include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/EscapeEnumerator.h"
 #include "llvm/Transforms/Utils/Local.h"
@@ -45,6 +49,16 @@ using namespace llvm;
 
 #define DEBUG_TYPE "omptaskabi"
 
+STATISTIC(NumCoalescedLoops,
+          "Number of worksharing loops run in the parallel region of the "
+          "preceding loop");
+STATISTIC(NumElidedBarriers,
+          "Number of barriers elided between coalesced worksharing loops");
+STATISTIC(NumDepTasks, "Number of tasks spawned with task dependences");
+STATISTIC(NumUntiedTasks, "Number of tasks spawned as untied tasks");
+STATISTIC(NumElidedSyncs,
+          "Number of syncs elided in favor of task dependences");
+
 extern cl::opt<bool> DebugABICalls;
 
 static cl::opt<std::string> ClRuntimeBCPath(
@@ -52,8 +66,51 @@ static cl::opt<std::string> ClRuntimeBCPath(
     cl::desc("Path to the bitcode file for the runtime ABI"),
     cl::Hidden);
 
+static cl::opt<bool> ClWorksharingLoops(
+    "omp-worksharing-loops", cl::init(true),
+    cl::desc("Run top-level Tapir loops as OpenMP worksharing loops"),
+    cl::Hidden);
+
+static cl::opt<bool> ClCoalesceLoops(
+    "omp-coalesce-loops", cl::init(true),
+    cl::desc("Run consecutive worksharing loops in one parallel region, with "
+             "barriers only between loops that may depend on each other"),
+    cl::Hidden);
+
+static cl::opt<bool> ClTaskDeps(
+    "omp-task-deps", cl::init(true),
+    cl::desc("Spawn tasks with depend(in/out/inout) clauses derived from the "
+             "kitsune memory-access attributes of the functions they call"),
+    cl::Hidden);
+
+static cl::opt<bool> ClUntiedTasks(
+    "omp-untied-tasks", cl::init(true),
+    cl::desc("Spawn tasks without dependences as untied tasks, if the runtime "
+             "bitcode provides __rts_spawn_untied"),
+    cl::Hidden);
+
+static cl::opt<bool> ClElideSyncs(
+    "omp-elide-syncs", cl::init(true),
+    cl::desc("Elide the syncs between tasks that are ordered by their task "
+             "dependences"),
+    cl::Hidden);
+
 static const StringRef StackFrameName = "__rts_sf";
 
+// Flags of libomp's kmp_depend_info.
+enum {
+  KMP_DEP_IN = 0x1,
+  KMP_DEP_OUT = 0x2,
+  KMP_DEP_INOUT = 0x3,
+};
+
+// Values of the kmp sched_type enum of libomp.
+enum {
+  KMP_SCH_STATIC = 34,
+  KMP_SCH_DYNAMIC_CHUNKED = 35,
+  KMP_SCH_GUIDED_CHUNKED = 36,
+};
+
 namespace {
 
 // Custom DiagnosticInfo for linking the Lambda ABI bitcode file.
@@ -230,6 +287,39 @@ void OMPTaskABI::prepareModule() {
       {"__rts_get_worker_id", WorkerInfoTy, RTSGetWorkerID},
   };
 
+  // Spawning with task dependences is optional: a runtime bitcode file
+  // that provides it wraps __kmpc_omp_task_with_deps as __rts_spawn wraps
+  // __kmpc_omp_task, with the dependences as an array of kmp_depend_info.
+  Function *SpawnDepsFn = M.getFunction("__rts_spawn_deps");
+  if (ClTaskDeps && SpawnDepsFn && !SpawnDepsFn->isDeclaration()) {
+    DependInfoTy = StructType::get(C, {IntPtrTy, IntPtrTy, Int8Ty});
+    FunctionType *SpawnDepsFnTy = FunctionType::get(
+        VoidTy,
+        {StackFramePtrTy, PointerType::getUnqual(SpawnBodyFnTy),
+         SpawnBodyFnArgTy, SpawnBodyFnArgSizeTy, IntPtrTy, VoidPtrTy, Int32Ty},
+        false);
+    RTSSpawnDeps = M.getOrInsertFunction("__rts_spawn_deps", SpawnDepsFnTy);
+    Function *Fn = cast<Function>(RTSSpawnDeps.getCallee());
+    Fn->setDoesNotThrow();
+    if (!DebugABICalls)
+      Fn->addFnAttr(Attribute::AlwaysInline);
+  }
+
+  // Untied spawns are optional as well: a runtime bitcode file that
+  // provides __rts_spawn_untied allocates the task as __rts_spawn does but
+  // with the untied flag of __kmpc_omp_task_alloc set.  libomp lets a
+  // thread waiting in the taskwait of a tied task only run the descendants
+  // of that task, which serializes deeply recursive spawns; untied tasks
+  // lift that restriction, so any idle thread can steal them.
+  Function *SpawnUntiedFn = M.getFunction("__rts_spawn_untied");
+  if (ClUntiedTasks && SpawnUntiedFn && !SpawnUntiedFn->isDeclaration()) {
+    RTSSpawnUntied = M.getOrInsertFunction("__rts_spawn_untied", SpawnFnTy);
+    Function *Fn = cast<Function>(RTSSpawnUntied.getCallee());
+    Fn->setDoesNotThrow();
+    if (!DebugABICalls)
+      Fn->addFnAttr(Attribute::AlwaysInline);
+  }
+
   // Add attributes to internalized functions.
   for (RTSFnDesc FnDesc : RTSFunctions) {
     assert(!FnDesc.FnCallee && "Redefining RTS function");
@@ -440,6 +530,77 @@ Value *OMPTaskABI::lowerGrainsizeCall(CallInst *GrainsizeCall) {
   return Grainsize;
 }
 
+/// Get the number of workers of the runtime.
+Value *OMPTaskABI::emitNumWorkers(IRBuilderBase &B) {
+  // The RTS functions are only declared when the module is prepared for
+  // lowering, after loop spawning has run.
+  FunctionCallee GetNumWorkers =
+      M.getOrInsertFunction("__rts_get_num_workers", B.getInt32Ty());
+  return B.CreateCall(GetNumWorkers, {}, "nworkers");
+}
+
+// Return true if V is an alloca that only holds the arguments or the
+// dependences of spawned tasks.
+bool OMPTaskABI::isSpawnFrameAlloca(const Value *V) const {
+  if (!isa<AllocaInst>(V))
+    return false;
+  for (const User *U : V->users())
+    if (const auto *CB = dyn_cast<CallBase>(U))
+      if (CB->getCalledOperand() == RTSSpawn.getCallee() ||
+          (RTSSpawnDeps &&
+           CB->getCalledOperand() == RTSSpawnDeps.getCallee()) ||
+          (RTSSpawnUntied &&
+           CB->getCalledOperand() == RTSSpawnUntied.getCallee()))
+        return true;
+  return false;
+}
+
+// Return true if the sync SI need not wait for its tasks.  That holds when
+// every task of the function has a complete set of dependences, so that
+// libomp orders the tasks spawned before SI after the ones they conflict
+// with, and when the function only spawns more tasks before it reaches
+// another sync.  The taskwait of that sync then waits for all of them.
+bool OMPTaskABI::isElidableSync(SyncInst &SI) const {
+  if (!RTSSpawnDeps || !ClElideSyncs)
+    return false;
+  auto Undescribed = NumUndescribedSpawns.find(SI.getFunction());
+  if (Undescribed != NumUndescribedSpawns.end() && Undescribed->second)
+    return false;
+
+  SmallPtrSet<const BasicBlock *, 8> Visited;
+  const BasicBlock *BB = SI.getSuccessor(0);
+  while (Visited.insert(BB).second) {
+    for (const Instruction &I : *BB) {
+      if (isa<SyncInst>(I) && &I != &SI)
+        return true;
+      if (isa<DbgInfoIntrinsic>(I) || !I.mayReadOrWriteMemory())
+        continue;
+      if (const auto *CB = dyn_cast<CallBase>(&I)) {
+        const Value *Callee = CB->getCalledOperand();
+        // A sync that has been lowered already.
+        if (Callee == RTSSync.getCallee() ||
+            Callee == RTSSyncNoThrow.getCallee())
+          return true;
+        if (Callee == RTSSpawnDeps.getCallee() ||
+            (isa<IntrinsicInst>(CB) &&
+             cast<IntrinsicInst>(CB)->isLifetimeStartOrEnd()))
+          continue;
+        return false;
+      }
+      // The loads and stores of the argument structures and dependences of
+      // the spawned tasks.
+      const Value *Ptr = getLoadStorePointerOperand(&I);
+      if (!Ptr || !isSpawnFrameAlloca(getUnderlyingObject(Ptr)))
+        return false;
+    }
+    const auto *Br = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!Br || Br->isConditional())
+      return false;
+    BB = Br->getSuccessor(0);
+  }
+  return false;
+}
+
 // Lower a sync instruction SI.
 void OMPTaskABI::lowerSync(SyncInst &SI) {
   Function &Fn = *SI.getFunction();
@@ -465,6 +626,13 @@ void OMPTaskABI::lowerSync(SyncInst &SI) {
     }
   }
 
+  if (!SyncUnwind && isElidableSync(SI)) {
+    BranchInst::Create(SyncCont, &SI);
+    SI.eraseFromParent();
+    ++NumElidedSyncs;
+    return;
+  }
+
   CallBase *CB;
   if (!SyncUnwindDest) {
     if (Fn.doesNotThrow())
@@ -492,7 +660,284 @@ bool OMPTaskABI::preProcessFunction(Function &F, TaskInfo &TI,
                                    bool ProcessingTapirLoops) {
   return false;
 }
-void OMPTaskABI::postProcessFunction(Function &F, bool ProcessingTapirLoops) {}
+
+// Returns true if CI forks the parallel region of a single worksharing loop.
+static bool isLoopFork(const CallInst *CI) {
+  const Function *Callee = CI->getCalledFunction();
+  if (!Callee || Callee->getName() != "__kmpc_fork_call" ||
+      CI->arg_size() != 4)
+    return false;
+  const auto *Ident = dyn_cast<GlobalVariable>(CI->getArgOperand(0));
+  return Ident && Ident->getName() == "__omp_loop_ident" &&
+         isa<Function>(CI->getArgOperand(2)) &&
+         isa<AllocaInst>(CI->getArgOperand(3));
+}
+
+// Returns true if A only holds the arguments of the worksharing loop that
+// it is passed to: it is only stored to, directly or through GEPs, and
+// passed to a loop fork.
+static bool isLoopArgs(const AllocaInst *A) {
+  for (const User *U : A->users()) {
+    if (const auto *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getPointerOperand() != A)
+        return false;
+    } else if (const auto *GEP = dyn_cast<GetElementPtrInst>(U)) {
+      for (const User *GU : GEP->users())
+        if (!isa<StoreInst>(GU) ||
+            cast<StoreInst>(GU)->getPointerOperand() != GEP)
+          return false;
+    } else if (const auto *CI = dyn_cast<CallInst>(U)) {
+      if (!isLoopFork(CI) || CI->getArgOperand(3) != A)
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the fork of the next worksharing loop if it runs right after Fork,
+// whenever Fork runs, with nothing in between but the setup of its
+// arguments.  The instructions of that setup are added to ToMove.
+static CallInst *getNextLoopFork(CallInst *Fork,
+                                 SmallVectorImpl<Instruction *> &ToMove) {
+  SmallVector<Instruction *, 16> Setup;
+  BasicBlock *BB = Fork->getParent();
+  for (BasicBlock::iterator It = std::next(Fork->getIterator());;) {
+    Instruction *I = &*It++;
+    if (auto *CI = dyn_cast<CallInst>(I); CI && isLoopFork(CI)) {
+      ToMove.append(Setup.begin(), Setup.end());
+      return CI;
+    }
+    if (I->isTerminator()) {
+      // A sync left in the spawning function is a no-op, since the only
+      // parallelism it waits for, the loops, has been lowered.
+      auto *Br = dyn_cast<BranchInst>(I);
+      if (!(Br && Br->isUnconditional()) && !isa<SyncInst>(I))
+        return nullptr;
+      BasicBlock *Succ = I->getSuccessor(0);
+      if (Succ == Fork->getParent() || Succ->getSinglePredecessor() != BB ||
+          isa<PHINode>(Succ->front()))
+        return nullptr;
+      BB = Succ;
+      It = BB->begin();
+      continue;
+    }
+    if (isa<DbgInfoIntrinsic>(I))
+      continue;
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      auto *A =
+          dyn_cast<AllocaInst>(getUnderlyingObject(SI->getPointerOperand()));
+      if (!A || !SI->isSimple() || !isLoopArgs(A))
+        return nullptr;
+    } else if (!isTapirIntrinsic(Intrinsic::syncregion_start, I) &&
+               (isa<PHINode>(I) || I->mayReadOrWriteMemory() ||
+                !isSafeToSpeculativelyExecute(I))) {
+      return nullptr;
+    }
+    Setup.push_back(I);
+  }
+}
+
+namespace {
+// The memory accessed by a worksharing loop, as the underlying objects of
+// the arguments of its helper.
+struct LoopAccesses {
+  SmallDenseMap<const Value *, ModRefInfo, 8> Objects;
+  // Whether the loop may access memory not described by Objects.
+  bool Unknown = false;
+};
+} // namespace
+
+// Get the memory accessed by the worksharing loop forked by Fork.
+static LoopAccesses getLoopAccesses(const CallInst *Fork) {
+  LoopAccesses Acc;
+  const auto *Microtask = cast<Function>(Fork->getArgOperand(2));
+  const auto *Args = cast<AllocaInst>(Fork->getArgOperand(3));
+  const Function *Helper = nullptr;
+  for (const Instruction &I : instructions(Microtask))
+    if (const auto *CB = dyn_cast<CallBase>(&I))
+      if (const Function *Callee = CB->getCalledFunction())
+        if (!Callee->isDeclaration())
+          Helper = Callee;
+  if (!Helper) {
+    Acc.Unknown = true;
+    return Acc;
+  }
+
+  // Field i of the argument structure holds argument i of the helper.
+  SmallVector<const Value *, 8> Actuals(Helper->arg_size(), nullptr);
+  for (const User *U : Args->users()) {
+    unsigned Field = 0;
+    const Value *Ptr = Args;
+    if (const auto *GEP = dyn_cast<GetElementPtrInst>(U)) {
+      const auto *Idx = GEP->getNumIndices() == 2
+                            ? dyn_cast<ConstantInt>(GEP->getOperand(2))
+                            : nullptr;
+      if (!Idx)
+        continue;
+      Field = Idx->getZExtValue();
+      Ptr = GEP;
+    }
+    for (const User *PU : Ptr->users())
+      if (const auto *SI = dyn_cast<StoreInst>(PU))
+        if (SI->getPointerOperand() == Ptr && Field < Actuals.size())
+          Actuals[Field] = SI->getValueOperand();
+  }
+
+  auto Record = [&](const Value *Ptr, ModRefInfo MR) {
+    const Value *Obj = getUnderlyingObject(Ptr);
+    if (const auto *AI = dyn_cast<AllocaInst>(Obj);
+        AI && AI->getFunction() == Helper)
+      return;
+    if (const auto *GV = dyn_cast<GlobalVariable>(Obj)) {
+      if (!GV->isConstant() || isModSet(MR))
+        Acc.Objects[GV] |= MR;
+      return;
+    }
+    if (const auto *A = dyn_cast<Argument>(Obj);
+        A && A->getParent() == Helper && Actuals[A->getArgNo()]) {
+      Acc.Objects[getUnderlyingObject(Actuals[A->getArgNo()])] |= MR;
+      return;
+    }
+    Acc.Unknown = true;
+  };
+  for (const Instruction &I : instructions(Helper)) {
+    if (!I.mayReadOrWriteMemory() || isa<DbgInfoIntrinsic>(I) ||
+        I.isLifetimeStartOrEnd() || isa<SyncInst>(I))
+      continue;
+    if (const auto *LI = dyn_cast<LoadInst>(&I))
+      Record(LI->getPointerOperand(), ModRefInfo::Ref);
+    else if (const auto *SI = dyn_cast<StoreInst>(&I))
+      Record(SI->getPointerOperand(), ModRefInfo::Mod);
+    else if (const auto *RMW = dyn_cast<AtomicRMWInst>(&I))
+      Record(RMW->getPointerOperand(), ModRefInfo::ModRef);
+    else if (const auto *CX = dyn_cast<AtomicCmpXchgInst>(&I))
+      Record(CX->getPointerOperand(), ModRefInfo::ModRef);
+    else if (const auto *MT = dyn_cast<MemTransferInst>(&I)) {
+      Record(MT->getRawDest(), ModRefInfo::Mod);
+      Record(MT->getRawSource(), ModRefInfo::Ref);
+    } else if (const auto *MS = dyn_cast<MemSetInst>(&I))
+      Record(MS->getRawDest(), ModRefInfo::Mod);
+    else
+      Acc.Unknown = true;
+    if (Acc.Unknown)
+      break;
+  }
+  return Acc;
+}
+
+// Returns true if an iteration of one of the loops with accesses A and B may
+// depend on an iteration of the other.
+static bool mayDepend(const LoopAccesses &A, const LoopAccesses &B) {
+  if (A.Unknown || B.Unknown)
+    return true;
+  for (const auto &[ObjA, MRA] : A.Objects)
+    for (const auto &[ObjB, MRB] : B.Objects) {
+      if (!isModSet(MRA) && !isModSet(MRB))
+        continue;
+      if (ObjA != ObjB && isIdentifiedObject(ObjA) && isIdentifiedObject(ObjB))
+        continue;
+      return true;
+    }
+  return false;
+}
+
+// Run the consecutive worksharing loops of F in a single parallel region.
+// Where loops are forked one after the other, each fork pays for waking the
+// team and for the barrier that ends the region.  A single region instead
+// runs the loops' microtasks in turn, and separates two loops by a barrier
+// only if one may depend on the other (OpenMP's nowait otherwise).
+static void coalesceWorksharingLoops(Function &F) {
+  SmallVector<CallInst *, 8> Forks;
+  for (Instruction &I : instructions(F))
+    if (auto *CI = dyn_cast<CallInst>(&I); CI && isLoopFork(CI))
+      Forks.push_back(CI);
+
+  Module &M = *F.getParent();
+  LLVMContext &C = M.getContext();
+  Type *VoidTy = Type::getVoidTy(C);
+  Type *Int32Ty = Type::getInt32Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  SmallPtrSet<CallInst *, 8> Coalesced;
+  for (CallInst *First : Forks) {
+    if (Coalesced.count(First))
+      continue;
+    SmallVector<CallInst *, 4> Chain = {First};
+    SmallVector<Instruction *, 16> ToMove;
+    while (CallInst *Next = getNextLoopFork(Chain.back(), ToMove))
+      Chain.push_back(Next);
+    if (Chain.size() < 2)
+      continue;
+    Coalesced.insert(Chain.begin(), Chain.end());
+    for (Instruction *I : ToMove)
+      I->moveBefore(First);
+
+    // A loop needs a barrier before it if it may depend on a loop that has
+    // run since the last barrier.
+    SmallVector<LoopAccesses, 4> Accesses;
+    SmallVector<bool, 4> NeedsBarrier(Chain.size(), false);
+    unsigned SinceBarrier = 0;
+    for (unsigned i = 0; i < Chain.size(); ++i) {
+      Accesses.push_back(getLoopAccesses(Chain[i]));
+      for (unsigned j = SinceBarrier; j < i && !NeedsBarrier[i]; ++j)
+        NeedsBarrier[i] = mayDepend(Accesses[j], Accesses[i]);
+      if (NeedsBarrier[i])
+        SinceBarrier = i;
+      else if (i > 0)
+        ++NumElidedBarriers;
+    }
+
+    // The microtask of the region runs the loops' microtasks in turn:
+    //
+    //     void region(int32_t *gtid, int32_t *btid, args1 *A1, ...) {
+    //       microtask1(gtid, btid, A1);
+    //       __kmpc_barrier(loc, *gtid);  // only if loop 2 may depend on 1
+    //       microtask2(gtid, btid, A2);
+    //       ...
+    //     }
+    Value *Ident = First->getArgOperand(0);
+    SmallVector<Type *, 8> ParamTys(Chain.size() + 2, PtrTy);
+    Function *Region = Function::Create(
+        FunctionType::get(VoidTy, ParamTys, false),
+        GlobalValue::InternalLinkage, F.getName() + ".omp_outlined.region", &M);
+    Region->addFnAttr(Attribute::NoUnwind);
+    Region->addParamAttr(0, Attribute::NoAlias);
+    Region->addParamAttr(1, Attribute::NoAlias);
+    IRBuilder<> RB(BasicBlock::Create(C, "entry", Region));
+    FunctionCallee Barrier = M.getOrInsertFunction(
+        "__kmpc_barrier", FunctionType::get(VoidTy, {PtrTy, Int32Ty}, false));
+    SmallVector<Value *, 8> ForkArgs = {
+        Ident, ConstantInt::get(Int32Ty, Chain.size()), Region};
+    for (unsigned i = 0; i < Chain.size(); ++i) {
+      if (NeedsBarrier[i]) {
+        Value *GTid = RB.CreateLoad(Int32Ty, Region->getArg(0), "gtid");
+        RB.CreateCall(Barrier, {Ident, GTid});
+      }
+      CallInst *Call = RB.CreateCall(
+          cast<Function>(Chain[i]->getArgOperand(2)),
+          {Region->getArg(0), Region->getArg(1), Region->getArg(i + 2)});
+      Call->setDoesNotThrow();
+      ForkArgs.push_back(Chain[i]->getArgOperand(3));
+    }
+    RB.CreateRetVoid();
+
+    IRBuilder<> B(First);
+    CallInst *Fork = B.CreateCall(First->getFunctionType(),
+                                  First->getCalledOperand(), ForkArgs);
+    Fork->setDebugLoc(First->getDebugLoc());
+    for (CallInst *CI : Chain)
+      CI->eraseFromParent();
+    NumCoalescedLoops += Chain.size() - 1;
+  }
+}
+
+void OMPTaskABI::postProcessFunction(Function &F, bool ProcessingTapirLoops) {
+  // The worksharing loops of F have all been lowered once its Tapir loops
+  // have been processed.
+  if (ProcessingTapirLoops && ClWorksharingLoops && ClCoalesceLoops)
+    coalesceWorksharingLoops(F);
+}
 void OMPTaskABI::postProcessHelper(Function &F) {}
 
 void OMPTaskABI::preProcessOutlinedTask(Function &F, Instruction *DetachPt,
@@ -519,6 +964,106 @@ void OMPTaskABI::postProcessRootSpawner(Function &F, BasicBlock *TFEntry) {
                       /*InsertPauseFrame*/ false, /*Helper*/ false);
 }
 
+// Collect the dependences of the task that runs Helper on the argument
+// structure of ReplCall.  A dependence is a pointer that the task loads
+// from its argument structure and passes to a parameter with a kitsune
+// memory-access attribute; Deps gets its value at ReplCall and Flags the
+// kmp_depend_info flags of the access.  Return true if the dependences
+// cover all the memory that the task accesses.
+bool OMPTaskABI::collectTaskDeps(CallBase *ReplCall, Function *Helper,
+                                 SmallVectorImpl<Value *> &Deps,
+                                 SmallVectorImpl<unsigned> &Flags) {
+  const DataLayout &DL = DestM.getDataLayout();
+  auto *ArgAlloca = cast<AllocaInst>(ReplCall->getArgOperand(0));
+  auto *ArgsTy = dyn_cast<StructType>(ArgAlloca->getAllocatedType());
+  if (!ArgsTy || Helper->arg_size() != 1)
+    return false;
+  const Argument *Args = Helper->getArg(0);
+  const StructLayout *SL = DL.getStructLayout(ArgsTy);
+
+  // Return the pointer field of the argument structure that V is loaded
+  // from, or -1.
+  auto getArgsField = [&](const Value *V) -> int {
+    const auto *LI = dyn_cast<LoadInst>(V);
+    if (!LI)
+      return -1;
+    APInt Offset(DL.getIndexTypeSizeInBits(LI->getPointerOperandType()), 0);
+    const Value *Base =
+        LI->getPointerOperand()->stripAndAccumulateConstantOffsets(
+            DL, Offset, /*AllowNonInbounds*/ true);
+    if (Base != Args || Offset.isNegative() ||
+        Offset.getZExtValue() >= SL->getSizeInBytes())
+      return -1;
+    unsigned Field = SL->getElementContainingOffset(Offset.getZExtValue());
+    if (SL->getElementOffset(Field) != Offset.getZExtValue() ||
+        !ArgsTy->getElementType(Field)->isPointerTy())
+      return -1;
+    return Field;
+  };
+
+  auto getDepFlags = [](const AttributeSet &Attrs) -> unsigned {
+    if (Attrs.hasAttribute("kitsune.readonly"))
+      return KMP_DEP_IN;
+    if (Attrs.hasAttribute("kitsune.writeonly"))
+      return KMP_DEP_OUT;
+    if (Attrs.hasAttribute("kitsune.readwrite"))
+      return KMP_DEP_INOUT;
+    return 0;
+  };
+
+  bool Complete = true;
+  SmallVector<std::pair<unsigned, unsigned>, 4> FieldDeps;
+  for (Instruction &I : instructions(Helper)) {
+    if (isa<DbgInfoIntrinsic>(I) || !I.mayReadOrWriteMemory())
+      continue;
+    if (auto *LI = dyn_cast<LoadInst>(&I)) {
+      if (LI->isUnordered() &&
+          getUnderlyingObject(LI->getPointerOperand()) == Args)
+        continue;
+      Complete = false;
+      continue;
+    }
+    auto *CB = dyn_cast<CallBase>(&I);
+    Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+    if (!Callee) {
+      Complete = false;
+      continue;
+    }
+    if (auto *II = dyn_cast<IntrinsicInst>(CB))
+      if (II->isLifetimeStartOrEnd() || II->isAssumeLikeIntrinsic())
+        continue;
+
+    AttributeList Attrs = Callee->getAttributes();
+    unsigned FnFlags = getDepFlags(Attrs.getFnAttrs());
+    bool Described = Callee->onlyAccessesArgMemory();
+    for (unsigned ArgNo = 0; ArgNo < CB->arg_size(); ++ArgNo) {
+      const Value *V = CB->getArgOperand(ArgNo);
+      if (!V->getType()->isPointerTy())
+        continue;
+      unsigned DepFlags = getDepFlags(Attrs.getParamAttrs(ArgNo));
+      if (!DepFlags)
+        DepFlags = FnFlags;
+      int Field = getArgsField(getUnderlyingObject(V));
+      if (!DepFlags || Field < 0) {
+        Described = false;
+        continue;
+      }
+      FieldDeps.push_back({unsigned(Field), DepFlags});
+    }
+    Complete &= Described;
+  }
+
+  // The pointers are in the argument structure by the time of the spawn.
+  IRBuilder<> B(ReplCall);
+  for (auto [Field, DepFlags] : FieldDeps) {
+    Type *FieldTy = ArgsTy->getElementType(Field);
+    Deps.push_back(B.CreateLoad(FieldTy,
+                                B.CreateStructGEP(ArgsTy, ArgAlloca, Field)));
+    Flags.push_back(DepFlags);
+  }
+  return Complete;
+}
+
 void OMPTaskABI::processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) {
   const DataLayout &DL = DestM.getDataLayout();
   CallBase *ReplCall = cast<CallBase>(TOI.ReplCall);
@@ -582,13 +1127,298 @@ void OMPTaskABI::processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) {
          "Could not determine size of compiler-generated ArgStruct.");
   Value *ArgSizeVal = ConstantInt::get(SpawnBodyFnArgSizeTy, *ArgSize / 8);
 
+  SmallVector<Value *, 4> SpawnArgs = {SF, OMPTask, ArgCast, ArgSizeVal,
+                                       B.getInt64(Alignment)};
+  FunctionCallee Spawn = RTSSpawn;
+
+  // Spawn the task with the dependences of the accesses that its callees
+  // describe with kitsune memory-access attributes.
+  SmallVector<Value *, 4> Deps;
+  SmallVector<unsigned, 4> Flags;
+  bool Described =
+      RTSSpawnDeps && collectTaskDeps(ReplCall, Helper, Deps, Flags);
+  if (!Described)
+    ++NumUndescribedSpawns[&F];
+  if (!Deps.empty()) {
+    Type *IntPtrTy = DL.getIntPtrType(C);
+    ArrayType *DepsTy = ArrayType::get(DependInfoTy, Deps.size());
+    IRBuilder<> EntryB(&*F.getEntryBlock().getFirstInsertionPt());
+    AllocaInst *DepsAlloca = EntryB.CreateAlloca(DepsTy, nullptr, "omp.deps");
+    for (unsigned I = 0; I < Deps.size(); ++I) {
+      Value *Dep = B.CreateConstInBoundsGEP2_32(DepsTy, DepsAlloca, 0, I);
+      B.CreateStore(B.CreatePtrToInt(Deps[I], IntPtrTy),
+                    B.CreateStructGEP(DependInfoTy, Dep, 0));
+      B.CreateStore(ConstantInt::get(IntPtrTy, 1),
+                    B.CreateStructGEP(DependInfoTy, Dep, 1));
+      B.CreateStore(B.getInt8(Flags[I]),
+                    B.CreateStructGEP(DependInfoTy, Dep, 2));
+    }
+    SpawnArgs.push_back(DepsAlloca);
+    SpawnArgs.push_back(B.getInt32(Deps.size()));
+    Spawn = RTSSpawnDeps;
+    ++NumDepTasks;
+  } else if (RTSSpawnUntied) {
+    // Only the tasks without dependences are spawned untied.
+    Spawn = RTSSpawnUntied;
+    ++NumUntiedTasks;
+  }
+
   if (InvokeInst *II = dyn_cast<InvokeInst>(ReplCall)) {
-    B.CreateInvoke(RTSSpawn, II->getNormalDest(), II->getUnwindDest(),
-                   {SF, OMPTask, ArgCast, ArgSizeVal, B.getInt64(Alignment)});
+    B.CreateInvoke(Spawn, II->getNormalDest(), II->getUnwindDest(),
+                   SpawnArgs);
   } else {
-    B.CreateCall(RTSSpawn,
-                 {SF, OMPTask, ArgCast, ArgSizeVal, B.getInt64(Alignment)});
+    B.CreateCall(Spawn, SpawnArgs);
+  }
+
+  ReplCall->eraseFromParent();
+}
+
+LoopOutlineProcessor *
+OMPTaskABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
+  if (!ClWorksharingLoops)
+    return nullptr;
+
+  // A parallel region forked inside another one runs serially, so only
+  // Tapir loops at the top level of their function run as worksharing loops.
+  // Nested loops, and loops that may throw out of the parallel region, keep
+  // the task-based lowering.
+  if (!TL->getTask()->getParentTask()->isRootTask() || TL->getUnwindDest())
+    return nullptr;
+  if (TL->getTripCount()->getType()->getIntegerBitWidth() > 64)
+    return nullptr;
+
+  TapirLoopHints Hints(TL->getLoop());
+  switch (Hints.getStrategy()) {
+  case TapirLoopHints::ST_DYNAMIC:
+    return new OMPTaskLoop(M, KMP_SCH_DYNAMIC_CHUNKED);
+  case TapirLoopHints::ST_GUIDED:
+    return new OMPTaskLoop(M, KMP_SCH_GUIDED_CHUNKED);
+  default:
+    return new OMPTaskLoop(M, KMP_SCH_STATIC);
+  }
+}
+
+// --- Loop Outliner
+
+void OMPTaskLoop::postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                     ValueToValueMapTy &VMap) {
+  // The cloned loop has been serialized; each thread of the team runs its
+  // chunks of iterations in order.
+  LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
+  addSyncToOutlineReturns(TL, Out, VMap);
+}
+
+Constant *OMPTaskLoop::getOrCreateIdent() {
+  const StringRef IdentName = "__omp_loop_ident";
+  if (GlobalVariable *Ident = M.getNamedGlobal(IdentName))
+    return Ident;
+
+  // struct ident_t {
+  //   int32_t reserved_1, flags, reserved_2, reserved_3;
+  //   const char *psource;
+  // };
+  LLVMContext &C = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  StructType *IdentTy = StructType::get(Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+                                        PtrTy);
+  Constant *PSource = ConstantDataArray::getString(C, ";unknown;unknown;0;0;;");
+  GlobalVariable *PSourceGV = new GlobalVariable(
+      M, PSource->getType(), /*isConstant*/ true,
+      GlobalValue::PrivateLinkage, PSource, IdentName + ".psource");
+  PSourceGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  // KMP_IDENT_KMPC | KMP_IDENT_WORK_LOOP
+  Constant *Flags = ConstantInt::get(Int32Ty, 0x02 | 0x200);
+  Constant *Zero = ConstantInt::get(Int32Ty, 0);
+  Constant *Init = ConstantStruct::get(IdentTy,
+                                       {Zero, Flags, Zero, Zero, PSourceGV});
+  GlobalVariable *Ident = new GlobalVariable(
+      M, IdentTy, /*isConstant*/ true, GlobalValue::InternalLinkage, Init,
+      IdentName);
+  Ident->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return Ident;
+}
+
+void OMPTaskLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                          TaskOutlineInfo &TOI,
+                                          DominatorTree &DT) {
+  Function *Helper = TOI.Outline;
+  CallBase *ReplCall = cast<CallBase>(TOI.ReplCall);
+  BasicBlock *CallBlock = ReplCall->getParent();
+  Function *Parent = CallBlock->getParent();
+  LLVMContext &C = M.getContext();
+  Type *VoidTy = Type::getVoidTy(C);
+  Type *Int32Ty = Type::getInt32Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  Constant *Ident = getOrCreateIdent();
+
+  // The start, end and grainsize of the helper follow its sret parameter, if
+  // it has one.
+  unsigned IVIdx = Helper->hasParamAttribute(0, Attribute::StructRet) ? 1 : 0;
+  IntegerType *IVTy =
+      cast<IntegerType>(ReplCall->getArgOperand(IVIdx)->getType());
+  bool Is64 = IVTy->getBitWidth() > 32;
+  IntegerType *KmpTy = Is64 ? Type::getInt64Ty(C) : Int32Ty;
+  StringRef Suffix = Is64 ? "8u" : "4u";
+
+  // Marshal the helper's arguments into a structure that every thread of the
+  // team reads.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *V : ReplCall->args())
+    ArgTys.push_back(V->getType());
+  StructType *ArgsTy = StructType::get(C, ArgTys);
+
+  IRBuilder<> EntryBuilder(Parent->getEntryBlock().getFirstNonPHIOrDbg());
+  AllocaInst *Args =
+      EntryBuilder.CreateAlloca(ArgsTy, nullptr, "omp.loop.args");
+  IRBuilder<> B(ReplCall);
+  for (unsigned i = 0; i < ReplCall->arg_size(); ++i)
+    B.CreateStore(ReplCall->getArgOperand(i),
+                  B.CreateStructGEP(ArgsTy, Args, i));
+
+  // Each thread of the team runs the microtask, which claims chunks of the
+  // iterations from the runtime and runs the helper on each of them:
+  //
+  //     void microtask(int32_t *gtid, int32_t *btid, args *A) {
+  //       if (A->start < A->end) {
+  //         for each chunk [lb, ub] assigned to this thread:
+  //           helper(lb, ub + 1, A->...);
+  //       }
+  //     }
+  Function *Microtask = Function::Create(
+      FunctionType::get(VoidTy, {PtrTy, PtrTy, PtrTy}, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".omp_outlined", &M);
+  Microtask->addFnAttr(Attribute::NoUnwind);
+  Microtask->addParamAttr(0, Attribute::NoAlias);
+  Microtask->addParamAttr(1, Attribute::NoAlias);
+  {
+    BasicBlock *Entry = BasicBlock::Create(C, "entry", Microtask);
+    BasicBlock *Init = BasicBlock::Create(C, "omp.loop.init", Microtask);
+    BasicBlock *Exit = BasicBlock::Create(C, "omp.loop.exit", Microtask);
+    IRBuilder<> MB(Entry);
+    Value *MArgs = Microtask->getArg(2);
+    Value *GTid = MB.CreateLoad(Int32Ty, Microtask->getArg(0), "gtid");
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0; i < ArgTys.size(); ++i)
+      HelperArgs.push_back(
+          MB.CreateLoad(ArgTys[i], MB.CreateStructGEP(ArgsTy, MArgs, i)));
+    Value *Start = HelperArgs[IVIdx];
+    Value *End = HelperArgs[IVIdx + 1];
+
+    // The runtime divides the inclusive range [start, last].
+    MB.CreateCondBr(TL.isInclusiveRange() ? MB.CreateICmpULE(Start, End)
+                                          : MB.CreateICmpULT(Start, End),
+                    Init, Exit);
+    MB.SetInsertPoint(Init);
+    Value *Last = TL.isInclusiveRange()
+                      ? End
+                      : MB.CreateSub(End, ConstantInt::get(IVTy, 1));
+    Value *KStart = MB.CreateZExt(Start, KmpTy);
+    Value *KLast = MB.CreateZExt(Last, KmpTy);
+    Value *One = ConstantInt::get(KmpTy, 1);
+
+    IRBuilder<> AB(Entry, Entry->begin());
+    AllocaInst *PLast = AB.CreateAlloca(Int32Ty, nullptr, "omp.is_last");
+    AllocaInst *PLB = AB.CreateAlloca(KmpTy, nullptr, "omp.lb");
+    AllocaInst *PUB = AB.CreateAlloca(KmpTy, nullptr, "omp.ub");
+    AllocaInst *PStride = AB.CreateAlloca(KmpTy, nullptr, "omp.stride");
+    MB.CreateStore(ConstantInt::get(Int32Ty, 0), PLast);
+    MB.CreateStore(KStart, PLB);
+    MB.CreateStore(KLast, PUB);
+    MB.CreateStore(One, PStride);
+
+    // Run the helper on the chunk [lb, ub] claimed by this thread.
+    auto RunChunk = [&](IRBuilder<> &CB) {
+      Value *LB = CB.CreateTrunc(CB.CreateLoad(KmpTy, PLB), IVTy);
+      Value *UB = CB.CreateTrunc(CB.CreateLoad(KmpTy, PUB), IVTy);
+      SmallVector<Value *, 8> ChunkArgs(HelperArgs);
+      ChunkArgs[IVIdx] = LB;
+      ChunkArgs[IVIdx + 1] =
+          TL.isInclusiveRange() ? UB
+                                : CB.CreateAdd(UB, ConstantInt::get(IVTy, 1));
+      CallInst *Call = CB.CreateCall(Helper, ChunkArgs);
+      Call->setCallingConv(Helper->getCallingConv());
+      Call->setDoesNotThrow();
+    };
+
+    if (Schedule == KMP_SCH_STATIC) {
+      // One contiguous chunk of ceil(count / # threads) iterations per thread:
+      //
+      //     __kmpc_for_static_init(loc, gtid, static, &last, &lb, &ub,
+      //                            &stride, 1, 1);
+      //     if (lb <= ub) helper(lb, ub + 1, ...);
+      //     __kmpc_for_static_fini(loc, gtid);
+      FunctionCallee StaticInit = M.getOrInsertFunction(
+          ("__kmpc_for_static_init_" + Suffix).str(),
+          FunctionType::get(VoidTy,
+                            {PtrTy, Int32Ty, Int32Ty, PtrTy, PtrTy, PtrTy,
+                             PtrTy, KmpTy, KmpTy},
+                            false));
+      FunctionCallee StaticFini = M.getOrInsertFunction(
+          "__kmpc_for_static_fini",
+          FunctionType::get(VoidTy, {PtrTy, Int32Ty}, false));
+      MB.CreateCall(StaticInit,
+                    {Ident, GTid, ConstantInt::get(Int32Ty, Schedule), PLast,
+                     PLB, PUB, PStride, One, One});
+      BasicBlock *Body = BasicBlock::Create(C, "omp.loop.body", Microtask);
+      BasicBlock *Fini = BasicBlock::Create(C, "omp.loop.fini", Microtask);
+      MB.CreateCondBr(MB.CreateICmpULE(MB.CreateLoad(KmpTy, PLB),
+                                       MB.CreateLoad(KmpTy, PUB)),
+                      Body, Fini);
+      IRBuilder<> BB(Body);
+      RunChunk(BB);
+      BB.CreateBr(Fini);
+      IRBuilder<> FB(Fini);
+      FB.CreateCall(StaticFini, {Ident, GTid});
+      FB.CreateBr(Exit);
+    } else {
+      // Chunks of at least grainsize iterations, claimed on demand:
+      //
+      //     __kmpc_dispatch_init(loc, gtid, sched, start, last, 1, grainsize);
+      //     while (__kmpc_dispatch_next(loc, gtid, &last, &lb, &ub, &stride))
+      //       helper(lb, ub + 1, ...);
+      FunctionCallee DispatchInit = M.getOrInsertFunction(
+          ("__kmpc_dispatch_init_" + Suffix).str(),
+          FunctionType::get(VoidTy,
+                            {PtrTy, Int32Ty, Int32Ty, KmpTy, KmpTy, KmpTy,
+                             KmpTy},
+                            false));
+      FunctionCallee DispatchNext = M.getOrInsertFunction(
+          ("__kmpc_dispatch_next_" + Suffix).str(),
+          FunctionType::get(Int32Ty, {PtrTy, Int32Ty, PtrTy, PtrTy, PtrTy,
+                                      PtrTy},
+                            false));
+      Value *Grainsize = MB.CreateZExtOrTrunc(HelperArgs[IVIdx + 2], KmpTy);
+      Grainsize = MB.CreateSelect(
+          MB.CreateICmpEQ(Grainsize, ConstantInt::get(KmpTy, 0)), One,
+          Grainsize);
+      MB.CreateCall(DispatchInit,
+                    {Ident, GTid, ConstantInt::get(Int32Ty, Schedule), KStart,
+                     KLast, One, Grainsize});
+      BasicBlock *Next = BasicBlock::Create(C, "omp.dispatch.next", Microtask);
+      BasicBlock *Body = BasicBlock::Create(C, "omp.dispatch.body", Microtask);
+      MB.CreateBr(Next);
+      IRBuilder<> NB(Next);
+      Value *More =
+          NB.CreateCall(DispatchNext, {Ident, GTid, PLast, PLB, PUB, PStride});
+      NB.CreateCondBr(NB.CreateICmpNE(More, ConstantInt::get(Int32Ty, 0)),
+                      Body, Exit);
+      IRBuilder<> BB(Body);
+      RunChunk(BB);
+      BB.CreateBr(Next);
+    }
+    IRBuilder<> EB(Exit);
+    EB.CreateRetVoid();
   }
 
+  // The parallel region returns once the team has run all of the iterations.
+  FunctionCallee ForkCall = M.getOrInsertFunction(
+      "__kmpc_fork_call",
+      FunctionType::get(VoidTy, {PtrTy, Int32Ty, PtrTy}, /*isVarArg*/ true));
+  CallInst *Fork = B.CreateCall(
+      ForkCall, {Ident, ConstantInt::get(Int32Ty, 1), Microtask, Args});
+  Fork->setDebugLoc(ReplCall->getDebugLoc());
+
+  TOI.replaceReplCall(Fork);
   ReplCall->eraseFromParent();
 }
@@ -17,6 +17,7 @@
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
@@ -26,6 +27,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Linker/Linker.h"
 #include "llvm/Support/Casting.h"
@@ -40,6 +42,13 @@ using namespace llvm;
 
 #define DEBUG_TYPE "opencilk"
 
+STATISTIC(NumReducerLookupsHoisted,
+          "Number of reducer lookups hoisted out of loops");
+STATISTIC(NumReducerLookupsReused,
+          "Number of reducer lookups replaced by an earlier view");
+STATISTIC(NumNoUnwindLeafHelpers,
+          "Number of leaf spawn helpers lowered without exception handling");
+
 extern cl::opt<bool> DebugABICalls;
 
 static cl::opt<bool> UseOpenCilkRuntimeBC(
@@ -49,6 +58,11 @@ static cl::opt<std::string> ClOpenCilkRuntimeBCPath(
     "opencilk-runtime-bc-path", cl::init(""),
     cl::desc("Path to the bitcode file for the OpenCilk runtime ABI"),
     cl::Hidden);
+static cl::opt<bool> HoistReducerLookups(
+    "opencilk-hoist-reducer-lookups", cl::init(true),
+    cl::desc("Hoist reducer lookups out of loops that stay within one strand, "
+             "and reuse the view of an earlier lookup in the same strand"),
+    cl::Hidden);
 
 #define CILKRTS_FUNC(name) Get__cilkrts_##name()
 
@@ -637,6 +651,16 @@ Value *OpenCilkABI::lowerGrainsizeCall(CallInst *GrainsizeCall) {
   return Grainsize;
 }
 
+/// Get the number of Cilk workers, for Tapir loops that divide their iterations
+/// among the workers.
+Value *OpenCilkABI::emitNumWorkers(IRBuilderBase &B) {
+  FunctionCallee GetNWorkers =
+      M.getOrInsertFunction("__cilkrts_get_nworkers", B.getInt32Ty());
+  if (Function *Fn = dyn_cast<Function>(GetNWorkers.getCallee()))
+    Fn->setDoesNotThrow();
+  return B.CreateCall(GetNWorkers, {}, "nworkers");
+}
+
 BasicBlock *OpenCilkABI::GetDefaultSyncLandingpad(Function &F, Value *SF,
                                                   DebugLoc Loc) {
   // Return an existing default sync landingpad, if there is one.
@@ -754,9 +778,36 @@ void OpenCilkABI::preProcessOutlinedTask(Function &F, Instruction *DetachPt,
   InsertDetach(F, (DetachPt ? DetachPt : &*(++EnterFrame->getIterator())));
 }
 
+/// Returns true if no exception can propagate out of function F.
+static bool bodyMayUnwind(const Function &F) {
+  if (F.doesNotThrow())
+    return false;
+  for (const Instruction &I : instructions(F)) {
+    if (isa<ResumeInst>(&I) || isa<CleanupReturnInst>(&I))
+      return true;
+    if (const auto *CB = dyn_cast<CallBase>(&I))
+      if (!CB->doesNotThrow() && !isa<InvokeInst>(CB))
+        return true;
+  }
+  return false;
+}
+
 void OpenCilkABI::postProcessOutlinedTask(Function &F, Instruction *DetachPt,
                                           Instruction *TaskFrameCreate,
                                           bool IsSpawner, BasicBlock *TFEntry) {
+  // A leaf helper that cannot unwind needs no landingpads to pop its frame on
+  // an exception, so it only gets the epilogue at its returns.  Marking it
+  // nounwind lets its spawners call it without an unwind destination.
+  if (!IsSpawner && !bodyMayUnwind(F)) {
+    LLVM_DEBUG(dbgs() << "Lowering nounwind leaf helper " << F.getName()
+                      << "\n");
+    InsertStackFramePop(F, /*PromoteCallsToInvokes*/ false,
+                        /*InsertPauseFrame*/ false, /*Helper*/ true);
+    F.setDoesNotThrow();
+    ++NumNoUnwindLeafHelpers;
+    return;
+  }
+
   // Because F is a spawned task, we want to insert landingpads for all calls
   // that can throw, so we can pop the stackframe correctly if they do throw.
   // In particular, popping the stackframe of a spawned task may discover that
@@ -1029,12 +1080,120 @@ void OpenCilkABI::GetTapirRTCalls(Spindle *TaskFrame, bool IsRootTask,
   }
 }
 
+/// Returns true if the strand containing I may end at I, meaning that the code
+/// after I may run on a different worker than the code before it.  A reducer
+/// view looked up before such an instruction may be stale after it.
+static bool mayEndStrand(const Instruction &I, const Function *Lookup) {
+  if (isa<DetachInst>(&I) || isa<ReattachInst>(&I) || isa<SyncInst>(&I))
+    return true;
+  const auto *CB = dyn_cast<CallBase>(&I);
+  if (!CB || CB->getCalledFunction() == Lookup)
+    return false;
+  if (const auto *II = dyn_cast<IntrinsicInst>(CB)) {
+    switch (II->getIntrinsicID()) {
+    case Intrinsic::tapir_runtime_start:
+    case Intrinsic::tapir_runtime_end:
+    case Intrinsic::taskframe_create:
+    case Intrinsic::taskframe_use:
+    case Intrinsic::taskframe_end:
+    case Intrinsic::taskframe_resume:
+    case Intrinsic::detached_rethrow:
+    case Intrinsic::sync_unwind:
+      return true;
+    default:
+      return false;
+    }
+  }
+  // A called function that spawns may return on another worker after its
+  // sync.  Functions that do not synchronize, or do not touch memory, do not
+  // spawn.
+  return !CB->hasFnAttr(Attribute::NoSync) && !CB->doesNotAccessMemory();
+}
+
+/// Hoist reducer lookups out of loops that stay within one strand, and replace
+/// lookups by the view of an identical earlier lookup in the same strand.  The
+/// view of a reducer can only change when the strand ends, so within a strand
+/// one lookup suffices.
+static bool hoistReducerLookups(Function &F, Function *Lookup) {
+  if (!Lookup || none_of(Lookup->users(), [&](const User *U) {
+        const auto *I = dyn_cast<Instruction>(U);
+        return I && I->getFunction() == &F;
+      }))
+    return false;
+
+  bool Changed = false;
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  // Visit inner loops before outer loops, so lookups can move out of a loop
+  // nest one level at a time.
+  SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(Loops)) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Preheader)
+      continue;
+    SmallVector<CallInst *, 4> ToHoist;
+    bool SingleStrand = true;
+    for (BasicBlock *BB : L->blocks()) {
+      for (Instruction &I : *BB) {
+        if (mayEndStrand(I, Lookup)) {
+          SingleStrand = false;
+          break;
+        }
+        if (auto *CI = dyn_cast<CallInst>(&I))
+          if (CI->getCalledFunction() == Lookup &&
+              all_of(CI->args(),
+                     [&](const Use &U) { return L->isLoopInvariant(U); }))
+            ToHoist.push_back(CI);
+      }
+      if (!SingleStrand)
+        break;
+    }
+    if (!SingleStrand)
+      continue;
+    for (CallInst *CI : ToHoist) {
+      LLVM_DEBUG(dbgs() << "Hoisting reducer lookup " << *CI << " to "
+                        << Preheader->getName() << "\n");
+      CI->moveBefore(Preheader->getTerminator());
+      ++NumReducerLookupsHoisted;
+      Changed = true;
+    }
+  }
+
+  for (BasicBlock &BB : F) {
+    SmallVector<CallInst *, 4> Views;
+    for (Instruction &I : make_early_inc_range(BB)) {
+      auto *CI = dyn_cast<CallInst>(&I);
+      if (!CI || CI->getCalledFunction() != Lookup) {
+        if (mayEndStrand(I, Lookup))
+          Views.clear();
+        continue;
+      }
+      auto Prev = find_if(
+          Views, [&](const CallInst *View) { return CI->isIdenticalTo(View); });
+      if (Prev == Views.end()) {
+        Views.push_back(CI);
+        continue;
+      }
+      CI->replaceAllUsesWith(*Prev);
+      CI->eraseFromParent();
+      ++NumReducerLookupsReused;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
 bool OpenCilkABI::preProcessFunction(Function &F, TaskInfo &TI,
                                      bool ProcessingTapirLoops) {
   if (ProcessingTapirLoops)
     // Don't do any preprocessing when outlining Tapir loops.
     return false;
 
+  // Hoisting reducer lookups does not change the CFG.
+  if (HoistReducerLookups)
+    hoistReducerLookups(F,
+                        dyn_cast<Function>(CilkRTSReducerLookup.getCallee()));
+
   // Find all Tapir-runtime calls in this function that may be translated to
   // enter_frame/leave_frame calls.
   GetTapirRTCalls(TI.getRootTask()->getEntrySpindle(), true, TI);
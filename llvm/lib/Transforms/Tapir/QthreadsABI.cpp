@@ -14,10 +14,14 @@
 
 #include "llvm/Transforms/Tapir/QthreadsABI.h"
 #include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 
@@ -25,9 +29,14 @@ using namespace llvm;
 
 #define DEBUG_TYPE "qthreadsabi"
 
-static cl::opt<bool> UseCopyargs("qthreads-use-fork-copyargs", cl::init(false),
-                                 cl::Hidden,
-                                 cl::desc("Use copyargs variant of fork"));
+static cl::opt<bool> UseCopyargs(
+    "qthreads-use-fork-copyargs", cl::init(false), cl::Hidden,
+    cl::desc("Use copyargs variant of fork for every spawn, rather than "
+             "allocating task arguments from the arena of the sync region"));
+
+static cl::opt<bool> ChunkLoops(
+    "qthreads-chunk-loops", cl::init(true), cl::Hidden,
+    cl::desc("Run each Tapir loop as one qthread per worker-sized chunk"));
 
 // Accessors for opaque Qthreads RTS functions
 FunctionCallee QthreadsABI::get_qthread_num_workers() {
@@ -42,6 +51,28 @@ FunctionCallee QthreadsABI::get_qthread_num_workers() {
   return QthreadNumWorkers;
 }
 
+FunctionCallee QthreadsABI::get_qthread_fork() {
+  if (QthreadFork)
+    return QthreadFork;
+
+  LLVMContext &C = M.getContext();
+  AttributeList AL;
+  // The argument and return pointers are handed to the new qthread, so
+  // they are captured.
+  AL = AL.addFnAttribute(C, Attribute::NoUnwind);
+  FunctionType *FTy =
+      FunctionType::get(Type::getInt32Ty(C),
+                        {
+                            QthreadFTy,                // qthread_f f
+                            PointerType::getUnqual(C), // const void *arg
+                            PointerType::getUnqual(C)  // aligned_t *ret
+                        },
+                        false);
+
+  QthreadFork = M.getOrInsertFunction("qthread_fork", FTy, AL);
+  return QthreadFork;
+}
+
 FunctionCallee QthreadsABI::get_qthread_fork_copyargs() {
   if (QthreadForkCopyargs)
     return QthreadForkCopyargs;
@@ -182,6 +213,10 @@ QthreadsABI::QthreadsABI(Module &M) : TapirTarget(M) {
       Type::getInt64Ty(C), {PointerType::getUnqual(C)}, false));
 }
 
+TapirTarget::ArgStructMode QthreadsABI::getArgStructMode() const {
+  return UseCopyargs ? ArgStructMode::Static : ArgStructMode::Arena;
+}
+
 /// Lower a call to get the grainsize of this Tapir loop.
 ///
 /// The grainsize is computed by the following equation:
@@ -214,8 +249,15 @@ Value *QthreadsABI::lowerGrainsizeCall(CallInst *GrainsizeCall) {
   return Grainsize;
 }
 
+/// Get the number of Qthreads workers.
+Value *QthreadsABI::emitNumWorkers(IRBuilderBase &B) {
+  return B.CreateCall(get_qthread_num_workers(), {}, "nworkers");
+}
+
 Value *QthreadsABI::getOrCreateSinc(Value *SyncRegion, Function *F) {
   LLVMContext &C = M.getContext();
+  if (Value *Leader = SyncRegionToSincLeader.lookup(SyncRegion))
+    SyncRegion = Leader;
   Value *sinc;
   if ((sinc = SyncRegionToSinc[SyncRegion]))
     return sinc;
@@ -224,7 +266,7 @@ Value *QthreadsABI::getOrCreateSinc(Value *SyncRegion, Function *F) {
     Value *null = Constant::getNullValue(PointerType::getUnqual(C));
     std::vector<Value *> createArgs = {zero, null, null, zero};
     sinc = CallInst::Create(get_qt_sinc_create(), createArgs, "",
-                            F->getEntryBlock().getTerminator());
+                            &*F->getEntryBlock().getFirstInsertionPt());
     SyncRegionToSinc[SyncRegion] = sinc;
 
     // Make sure we destroy the sinc at all exit points to prevent memory leaks
@@ -248,6 +290,8 @@ void QthreadsABI::lowerSync(SyncInst &SI) {
   std::vector<Value *> args = {sinc, null};
   auto sincwait = get_qt_sinc_wait();
   builder.CreateCall(sincwait, args);
+  // The tasks of the sync region are done with their arguments.
+  resetTaskArgsArena(SR, builder);
   BranchInst *PostSync = BranchInst::Create(SI.getSuccessor(0));
   ReplaceInstWithInst(&SI, PostSync);
 }
@@ -276,6 +320,20 @@ void QthreadsABI::processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) {
   Value *ArgStructPtr =
       CallerIRBuilder.CreateBitCast(CallerArgStruct, PointerType::getUnqual(C));
   Constant *Null = Constant::getNullValue(PointerType::getUnqual(C));
+
+  // A structure from the arena of the sync region outlives the task, so the
+  // qthread can use it in place.
+  if (isTaskArgsArena(CallerArgStruct)) {
+    CallInst *Call = CallerIRBuilder.CreateCall(
+        get_qthread_fork(), {OutlinedFnPtr, ArgStructPtr, Null});
+    Call->setDebugLoc(ReplCall->getDebugLoc());
+    TOI.replaceReplCall(Call);
+    ReplCall->eraseFromParent();
+    if (TOI.ReplUnwind)
+      BranchInst::Create(TOI.ReplRet, CallBlock);
+    return;
+  }
+
   ConstantInt *ArgSize =
       ConstantInt::get(DL.getIntPtrType(C), DL.getTypeAllocSize(ArgsTy));
   CallInst *Call =
@@ -303,6 +361,70 @@ void QthreadsABI::processSubTaskCall(TaskOutlineInfo &TOI, DominatorTree &DT) {
   // function to manage the allocation of the argument structure.
 }
 
+// Returns true if a task spawned into sync region \p A may still be running
+// when the function spawns into or syncs sync region \p B.
+static bool mayBeOutstandingAt(Value *A, Value *B) {
+  SmallVector<BasicBlock *, 8> Worklist;
+  SmallPtrSet<BasicBlock *, 16> Visited;
+  for (User *U : A->users())
+    if (DetachInst *DI = dyn_cast<DetachInst>(U))
+      Worklist.push_back(DI->getContinue());
+
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (!Visited.insert(BB).second)
+      continue;
+    Instruction *Term = BB->getTerminator();
+    if (SyncInst *SI = dyn_cast<SyncInst>(Term)) {
+      if (SI->getSyncRegion() == B)
+        return true;
+      // The tasks of A are done after a sync of A.
+      if (SI->getSyncRegion() == A)
+        continue;
+    }
+    if (DetachInst *DI = dyn_cast<DetachInst>(Term)) {
+      if (DI->getSyncRegion() == B)
+        return true;
+      // Stay in the spawning task.
+      Worklist.push_back(DI->getContinue());
+      if (DI->hasUnwindDest())
+        Worklist.push_back(DI->getUnwindDest());
+      continue;
+    }
+    for (BasicBlock *Succ : successors(BB))
+      Worklist.push_back(Succ);
+  }
+  return false;
+}
+
+/// Let the sync regions started at the top level of \p F share sincs.  A sync
+/// region reuses the sinc of an earlier sync region when none of the tasks of
+/// either can be outstanding while the other is in use, so a function with
+/// consecutive sync regions creates and destroys a single sinc.
+void QthreadsABI::poolSincs(Function &F, TaskInfo &TI) {
+  SmallVector<SmallVector<Value *, 4>, 4> Pools;
+  for (Instruction &I : instructions(F)) {
+    if (!isa<IntrinsicInst>(I) ||
+        cast<IntrinsicInst>(I).getIntrinsicID() != Intrinsic::syncregion_start)
+      continue;
+    Task *T = TI.getTaskFor(I.getParent());
+    if (!T || !T->isRootTask())
+      continue;
+
+    auto Pool = find_if(Pools, [&](const SmallVector<Value *, 4> &Pool) {
+      return none_of(Pool, [&](Value *SR) {
+        return mayBeOutstandingAt(SR, &I) || mayBeOutstandingAt(&I, SR);
+      });
+    });
+    if (Pool == Pools.end()) {
+      Pools.push_back({&I});
+      continue;
+    }
+    SyncRegionToSincLeader[&I] = Pool->front();
+    Pool->push_back(&I);
+  }
+}
+
 bool QthreadsABI::preProcessFunction(Function &F, TaskInfo &TI,
                                      bool ProcessingTapirLoops) {
   if (ProcessingTapirLoops)
@@ -310,6 +432,7 @@ bool QthreadsABI::preProcessFunction(Function &F, TaskInfo &TI,
     return false;
 
   LLVMContext &C = M.getContext();
+  poolSincs(F, TI);
   for (Task *T : post_order(TI.getRootTask())) {
     if (T->isRootTask())
       continue;
@@ -350,3 +473,191 @@ void QthreadsABI::postProcessFunction(Function &F, bool ProcessingTapirLoops) {
 }
 
 void QthreadsABI::postProcessHelper(Function &F) {}
+
+LoopOutlineProcessor *
+QthreadsABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
+  // The qthreads of a loop cannot propagate exceptions to the parent.
+  if (!ChunkLoops || TL->getUnwindDest() || TL->isInclusiveRange())
+    return nullptr;
+  return new QthreadsLoop(M, this);
+}
+
+// --- Loop Outliner
+
+void QthreadsLoop::postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                      ValueToValueMapTy &VMap) {
+  LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
+
+  // The cloned loop has been serialized; each qthread runs its chunk of
+  // iterations in order, so the helper needs no sinc of its own.
+  Value *SR = TL.getTask()->getDetach()->getSyncRegion();
+  if (auto *ClonedSR = dyn_cast_or_null<Instruction>(VMap.lookup(SR)))
+    if (ClonedSR->use_empty())
+      ClonedSR->eraseFromParent();
+}
+
+void QthreadsLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                           TaskOutlineInfo &TOI,
+                                           DominatorTree &DT) {
+  Function *Helper = TOI.Outline;
+  CallBase *ReplCall = cast<CallBase>(TOI.ReplCall);
+  Function *Parent = ReplCall->getFunction();
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  Type *Int64Ty = Type::getInt64Ty(C);
+  Constant *Null = Constant::getNullValue(PtrTy);
+
+  // The start, end and grainsize of the helper follow its sret parameter, if
+  // it has one.
+  unsigned IVIdx = Helper->hasParamAttribute(0, Attribute::StructRet) ? 1 : 0;
+  IntegerType *IVTy =
+      cast<IntegerType>(ReplCall->getArgOperand(IVIdx)->getType());
+
+  // The frame shared by the qthreads of the loop holds the arguments of the
+  // helper followed by the sinc of the parent.
+  SmallVector<Type *, 8> FrameTys;
+  for (Value *V : ReplCall->args())
+    FrameTys.push_back(V->getType());
+  unsigned SincIdx = FrameTys.size();
+  FrameTys.push_back(PtrTy);
+  StructType *FrameTy = StructType::get(C, FrameTys);
+  // Each qthread gets a pointer to the frame and its range of iterations.
+  StructType *ChunkTy = StructType::get(PtrTy, IVTy, IVTy);
+
+  // The loops of a function run one after the other, so they all reuse one
+  // sinc.
+  Value *Sinc = TTarget->getOrCreateSinc(Parent, Parent);
+  IRBuilder<> EntryBuilder(Parent->getEntryBlock().getFirstNonPHIOrDbg());
+  AllocaInst *Frame =
+      EntryBuilder.CreateAlloca(FrameTy, nullptr, "qt.loop.frame");
+  IRBuilder<> B(ReplCall);
+  // Functions that only run loops are not processed as spawners, so make sure
+  // the runtime is up.
+  B.CreateCall(TTarget->get_qthread_initialize());
+  for (unsigned i = 0; i < ReplCall->arg_size(); ++i)
+    B.CreateStore(ReplCall->getArgOperand(i),
+                  B.CreateStructGEP(FrameTy, Frame, i));
+  B.CreateStore(Sinc, B.CreateStructGEP(FrameTy, Frame, SincIdx));
+
+  // Each qthread runs the helper on its chunk:
+  //
+  //     aligned_t chunk(chunk_t *Ch) {
+  //       helper(Ch->lo, Ch->hi, Ch->frame->...);
+  //       qt_sinc_submit(Ch->frame->sinc, NULL);
+  //       return 0;
+  //     }
+  Function *Chunk = Function::Create(
+      FunctionType::get(Int64Ty, {PtrTy}, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".qt_chunk", &M);
+  Chunk->addFnAttr(Attribute::NoUnwind);
+  {
+    IRBuilder<> CB(BasicBlock::Create(C, "entry", Chunk));
+    Value *Ch = Chunk->getArg(0);
+    Value *ChFrame = CB.CreateLoad(PtrTy, CB.CreateStructGEP(ChunkTy, Ch, 0));
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0; i < ReplCall->arg_size(); ++i) {
+      if (i == IVIdx || i == IVIdx + 1)
+        HelperArgs.push_back(CB.CreateLoad(
+            IVTy, CB.CreateStructGEP(ChunkTy, Ch, 1 + i - IVIdx)));
+      else
+        HelperArgs.push_back(CB.CreateLoad(
+            FrameTys[i], CB.CreateStructGEP(FrameTy, ChFrame, i)));
+    }
+    CallInst *Call = CB.CreateCall(Helper, HelperArgs);
+    Call->setCallingConv(Helper->getCallingConv());
+    Call->setDoesNotThrow();
+    Value *ChSinc =
+        CB.CreateLoad(PtrTy, CB.CreateStructGEP(FrameTy, ChFrame, SincIdx));
+    CB.CreateCall(TTarget->get_qt_sinc_submit(), {ChSinc, Null});
+    CB.CreateRet(ConstantInt::get(Int64Ty, 0));
+  }
+
+  // The spawner forks one qthread per chunk and waits for them:
+  //
+  //     void spawn(frame_t *F) {
+  //       count = F->end - F->start;
+  //       chunk = max(ceil(count / workers), F->grainsize, 1);
+  //       n = ceil(count / chunk);
+  //       qt_sinc_expect(F->sinc, n);
+  //       chunk_t Chs[n];
+  //       for (i = 0; i < n; ++i) {
+  //         Chs[i] = { F, F->start + i * chunk, min(lo + chunk, F->end) };
+  //         qthread_fork(chunk, &Chs[i], NULL);
+  //       }
+  //       qt_sinc_wait(F->sinc, NULL);
+  //     }
+  Function *Spawn = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), {PtrTy}, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".qt_spawn", &M);
+  Spawn->addFnAttr(Attribute::NoUnwind);
+  {
+    BasicBlock *Entry = BasicBlock::Create(C, "entry", Spawn);
+    BasicBlock *Fork = BasicBlock::Create(C, "qt.fork", Spawn);
+    BasicBlock *Wait = BasicBlock::Create(C, "qt.wait", Spawn);
+    BasicBlock *Exit = BasicBlock::Create(C, "qt.exit", Spawn);
+    IRBuilder<> SB(Entry);
+    Value *SFrame = Spawn->getArg(0);
+    Value *Start =
+        SB.CreateLoad(IVTy, SB.CreateStructGEP(FrameTy, SFrame, IVIdx));
+    Value *End =
+        SB.CreateLoad(IVTy, SB.CreateStructGEP(FrameTy, SFrame, IVIdx + 1));
+    Value *Grainsize = SB.CreateZExtOrTrunc(
+        SB.CreateLoad(FrameTys[IVIdx + 2],
+                      SB.CreateStructGEP(FrameTy, SFrame, IVIdx + 2)),
+        IVTy);
+    Value *SSinc =
+        SB.CreateLoad(PtrTy, SB.CreateStructGEP(FrameTy, SFrame, SincIdx));
+    Value *Zero = ConstantInt::get(IVTy, 0);
+    Value *One = ConstantInt::get(IVTy, 1);
+    Value *Count = SB.CreateSub(End, Start, "count");
+
+    Value *Workers = SB.CreateZExtOrTrunc(
+        SB.CreateCall(TTarget->get_qthread_num_workers()), IVTy);
+    Workers = SB.CreateSelect(SB.CreateICmpEQ(Workers, Zero), One, Workers);
+    auto CeilDiv = [&](Value *N, Value *D) {
+      return SB.CreateAdd(
+          SB.CreateUDiv(N, D),
+          SB.CreateZExt(SB.CreateICmpNE(SB.CreateURem(N, D), Zero), IVTy));
+    };
+    Value *ChunkSize = CeilDiv(Count, Workers);
+    ChunkSize = SB.CreateSelect(SB.CreateICmpULT(ChunkSize, Grainsize),
+                                Grainsize, ChunkSize);
+    ChunkSize = SB.CreateSelect(SB.CreateICmpEQ(ChunkSize, Zero), One,
+                                ChunkSize, "chunk");
+    Value *NumChunks = CeilDiv(Count, ChunkSize);
+    SB.CreateCall(
+        TTarget->get_qt_sinc_expect(),
+        {SSinc, SB.CreateZExtOrTrunc(NumChunks, DL.getIntPtrType(C))});
+    Value *Chs = SB.CreateAlloca(ChunkTy, NumChunks, "qt.chunks");
+    SB.CreateCondBr(SB.CreateICmpEQ(NumChunks, Zero), Exit, Fork);
+
+    SB.SetInsertPoint(Fork);
+    PHINode *Idx = SB.CreatePHI(IVTy, 2, "i");
+    Idx->addIncoming(Zero, Entry);
+    Value *Lo = SB.CreateAdd(Start, SB.CreateMul(Idx, ChunkSize), "lo");
+    Value *Hi = SB.CreateSelect(SB.CreateICmpULT(SB.CreateSub(End, Lo),
+                                                 ChunkSize),
+                                End, SB.CreateAdd(Lo, ChunkSize), "hi");
+    Value *Ch = SB.CreateGEP(ChunkTy, Chs, Idx);
+    SB.CreateStore(SFrame, SB.CreateStructGEP(ChunkTy, Ch, 0));
+    SB.CreateStore(Lo, SB.CreateStructGEP(ChunkTy, Ch, 1));
+    SB.CreateStore(Hi, SB.CreateStructGEP(ChunkTy, Ch, 2));
+    SB.CreateCall(TTarget->get_qthread_fork(), {Chunk, Ch, Null});
+    Value *Next = SB.CreateAdd(Idx, One);
+    Idx->addIncoming(Next, Fork);
+    SB.CreateCondBr(SB.CreateICmpULT(Next, NumChunks), Fork, Wait);
+
+    SB.SetInsertPoint(Wait);
+    SB.CreateCall(TTarget->get_qt_sinc_wait(), {SSinc, Null});
+    SB.CreateBr(Exit);
+
+    SB.SetInsertPoint(Exit);
+    SB.CreateRetVoid();
+  }
+
+  CallInst *Call = B.CreateCall(Spawn, {Frame});
+  Call->setDebugLoc(ReplCall->getDebugLoc());
+  TOI.replaceReplCall(Call);
+  ReplCall->eraseFromParent();
+}
@@ -15,10 +15,16 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/RealmABI.h"
+#include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 #include <iostream>
@@ -28,6 +34,11 @@ using namespace llvm;
 
 #define DEBUG_TYPE "realmabi"
 
+static cl::opt<bool> DistributedLoops(
+    "realmabi-distributed", cl::init(false), cl::Hidden,
+    cl::desc("Launch parallel loops across all nodes of the Realm machine, "
+             "partitioning the arrays they access by iteration."));
+
 void RealmABI::preProcessOutlinedTask(llvm::Function &, llvm::Instruction *,
                                       llvm::Instruction *, bool, BasicBlock *) {
 }
@@ -45,15 +56,31 @@ FunctionCallee RealmABI::get_realmGetNumProcs() {
   AttributeList AL;
   std::vector<Type *> TypeArray;
 
-  // TODO: Set appropriate function attributes.
+  // The number of processors does not change while the program runs.
+  AL = AL.addFnAttribute(C, Attribute::NoUnwind);
+  AL = AL.addFnAttribute(
+      C, Attribute::getWithMemoryEffects(C, MemoryEffects::none()));
   FunctionType *FTy = FunctionType::get(Type::getInt64Ty(C), {}, false);
   RealmGetNumProcs = M.getOrInsertFunction("realmGetNumProcs", FTy, AL);
   return RealmGetNumProcs;
 }
 
+static StructType *getEventType(LLVMContext &C) {
+  return StructType::get(Type::getInt64Ty(C));
+}
+
 static StructType *getBarrierType(LLVMContext &C) {
-  auto eventTy = StructType::get(Type::getInt64Ty(C));
-  return StructType::get(eventTy, Type::getInt64Ty(C));
+  return StructType::get(getEventType(C), Type::getInt64Ty(C));
+}
+
+// Type of the functions run by an index-space launch: each task of the
+// launch calls the function with the launch arguments and its (half
+// open) range of iterations.
+static PointerType *getLoopFuncPtrType(LLVMContext &C) {
+  return PointerType::getUnqual(FunctionType::get(
+      Type::getVoidTy(C),
+      {PointerType::getUnqual(C), Type::getInt64Ty(C), Type::getInt64Ty(C)},
+      false));
 }
 
 FunctionCallee RealmABI::get_createRealmBarrier() {
@@ -99,6 +126,96 @@ FunctionCallee RealmABI::get_realmSpawn() {
   return RealmSpawn;
 }
 
+FunctionCallee RealmABI::get_realmSpawnLoop() {
+  if (RealmSpawnLoop)
+    return RealmSpawnLoop;
+
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+
+  Type *TypeArray[] = {getEventType(C),        // event precondition
+                       getLoopFuncPtrType(C),  // loop body fxn
+                       PointerType::get(C, 0), // void *args
+                       DL.getIntPtrType(C),    // size_t argsize
+                       Type::getInt64Ty(C),    // first iteration
+                       Type::getInt64Ty(C),    // end of iterations
+                       Type::getInt64Ty(C)};   // iterations per task
+  // The arguments are copied by the runtime (as with realmSpawn).
+  AttributeList AL;
+  AL = AL.addParamAttribute(C, 2, Attribute::NoCapture);
+  FunctionType *FTy = FunctionType::get(getEventType(C), // completion event
+                                        TypeArray, false);
+  RealmSpawnLoop = M.getOrInsertFunction("realmSpawnLoop", FTy, AL);
+  return RealmSpawnLoop;
+}
+
+// Flags of the descriptor of an array accessed by a distributed launch.
+// NOTE: These values must match the kitsune Realm runtime (realm_abi.h).
+enum RealmRegionFlags {
+  // The loop only accesses A[i + lo, i + hi] in iteration i, so the
+  // array can be partitioned along with the iterations (plus halos).
+  RealmRegionPartitioned = 0x1
+};
+
+// Descriptor of an array accessed by a distributed launch:
+//
+//   struct {
+//     int64_t offset;     // of the pointer in the launch arguments
+//     int64_t elemsize;   // bytes per element
+//     int64_t halo_lo;    // lowest offset read/written relative to i
+//     int64_t halo_hi;    // highest offset read/written relative to i
+//     int32_t access;     // tapir::KernelArgAccess
+//     int32_t flags;      // RealmRegionFlags
+//   };
+//
+// Before running a chunk the runtime replaces the pointer in (its copy
+// of) the arguments with one into the node's instance of the array,
+// such that element i of the array is still addressed by ptr + i.
+static StructType *getRegionDescType(LLVMContext &C) {
+  Type *I64Ty = Type::getInt64Ty(C), *I32Ty = Type::getInt32Ty(C);
+  return StructType::get(I64Ty, I64Ty, I64Ty, I64Ty, I32Ty, I32Ty);
+}
+
+FunctionCallee RealmABI::get_realmSpawnLoopDistributed() {
+  if (RealmSpawnLoopDistributed)
+    return RealmSpawnLoopDistributed;
+
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+
+  Type *TypeArray[] = {getEventType(C),        // event precondition
+                       getLoopFuncPtrType(C),  // loop body fxn
+                       PointerType::get(C, 0), // void *args
+                       DL.getIntPtrType(C),    // size_t argsize
+                       Type::getInt64Ty(C),    // first iteration
+                       Type::getInt64Ty(C),    // end of iterations
+                       Type::getInt64Ty(C),    // iterations per task
+                       Type::getInt32Ty(C),    // number of arrays
+                       PointerType::get(C, 0)}; // array descriptors
+  AttributeList AL;
+  AL = AL.addParamAttribute(C, 2, Attribute::NoCapture);
+  AL = AL.addParamAttribute(C, 8, Attribute::NoCapture);
+  AL = AL.addParamAttribute(C, 8, Attribute::ReadOnly);
+  FunctionType *FTy = FunctionType::get(getEventType(C), // completion event
+                                        TypeArray, false);
+  RealmSpawnLoopDistributed =
+      M.getOrInsertFunction("realmSpawnLoopDistributed", FTy, AL);
+  return RealmSpawnLoopDistributed;
+}
+
+FunctionCallee RealmABI::get_realmWaitEvent() {
+  if (RealmWaitEvent)
+    return RealmWaitEvent;
+
+  LLVMContext &C = M.getContext();
+  AttributeList AL;
+
+  Type *TypeArray[] = {getEventType(C)};
+  FunctionType *FTy = FunctionType::get(Type::getInt8Ty(C), TypeArray, false);
+  RealmWaitEvent = M.getOrInsertFunction("realmWaitEvent", FTy, AL);
+  return RealmWaitEvent;
+}
+
 FunctionCallee RealmABI::get_realmSync() {
   if (RealmSync)
     return RealmSync;
@@ -272,10 +389,15 @@ bool RealmABI::preProcessFunction(Function &F, TaskInfo &TI,
 }
 
 void RealmABI::postProcessFunction(Function &F, bool OutliningTapirLoops) {
-  if (OutliningTapirLoops)
-    // Don't do any postprocessing when outlining Tapir loops.
+  if (OutliningTapirLoops) {
+    lowerLoopSyncs(F);
     return;
+  }
+
+  initRuntime(F);
+}
 
+void RealmABI::initRuntime(Function &F) {
   Module *M = F.getParent();
   LLVMContext &C = M->getContext();
   IRBuilder<> builder(F.getEntryBlock().getFirstNonPHIOrDbg());
@@ -290,8 +412,341 @@ void RealmABI::postProcessFunction(Function &F, bool OutliningTapirLoops) {
   initArgs[1] = null;
 
   builder.CreateCall(REALM_FUNC(realmInitRuntime), initArgs);
+}
 
-  return;
+Value *RealmABI::getOrCreateLoopEvent(Function *F) {
+  auto It = LoopEvents.find(F);
+  if (It != LoopEvents.end())
+    return It->second;
+
+  // The event starts out as Realm's NO_EVENT (an id of zero) so the
+  // first launch has no precondition.
+  LLVMContext &C = M.getContext();
+  IRBuilder<> builder(F->getEntryBlock().getFirstNonPHIOrDbg());
+  AllocaInst *Event = builder.CreateAlloca(getEventType(C), nullptr,
+                                           "realm.loop.event");
+  builder.CreateStore(Constant::getNullValue(getEventType(C)), Event);
+  LoopEvents[F] = Event;
+  return Event;
+}
+
+/// Return true if the wait for the launches chained on the loop event
+/// can be dropped because it is followed by another launch on the same
+/// chain (which is preconditioned on the same event) with nothing in
+/// between that could observe the data accessed by the launches.  Only
+/// straight-line code is considered: instructions that do not access
+/// memory and accesses to local (uncaptured) allocas -- e.g., the setup
+/// of the next launch's arguments.
+static bool isFollowedByChainedLaunch(CallInst *Wait, Value *LaunchFn) {
+  BasicBlock *BB = Wait->getParent();
+  BasicBlock::iterator It = std::next(Wait->getIterator());
+  SmallPtrSet<BasicBlock *, 8> Visited;
+  for (unsigned Budget = 256; Budget > 0; --Budget) {
+    Instruction &I = *It++;
+    if (auto *CB = dyn_cast<CallBase>(&I))
+      if (CB->getCalledOperand() == LaunchFn)
+        return true;
+
+    if (auto *BI = dyn_cast<BranchInst>(&I)) {
+      if (BI->isConditional())
+        return false;
+      BB = BI->getSuccessor(0);
+      if (!BB->getSinglePredecessor() || !Visited.insert(BB).second)
+        return false;
+      It = BB->begin();
+      continue;
+    }
+    if (I.isTerminator())
+      return false;
+    if (isa<DbgInfoIntrinsic>(I) || I.isLifetimeStartOrEnd())
+      continue;
+    if (!I.mayReadOrWriteMemory() && !I.mayThrow())
+      continue;
+
+    Value *Ptr = nullptr;
+    if (auto *LI = dyn_cast<LoadInst>(&I))
+      Ptr = LI->isSimple() ? LI->getPointerOperand() : nullptr;
+    else if (auto *SI = dyn_cast<StoreInst>(&I))
+      Ptr = SI->isSimple() ? SI->getPointerOperand() : nullptr;
+    if (!Ptr)
+      return false;
+    auto *AI = dyn_cast<AllocaInst>(getUnderlyingObject(Ptr));
+    if (!AI || PointerMayBeCaptured(AI, /*ReturnCaptures=*/true,
+                                    /*StoreCaptures=*/true))
+      return false;
+  }
+  return false;
+}
+
+void RealmABI::lowerLoopSyncs(Function &F) {
+  auto It = LoopEvents.find(&F);
+  if (It == LoopEvents.end())
+    return;
+  AllocaInst *Event = It->second;
+  LoopEvents.erase(It);
+  LLVMContext &C = M.getContext();
+
+  // Syncs of the loops' regions wait for the chained launches.  The
+  // loops have been outlined, so unless other tasks were spawned in the
+  // region the sync itself is no longer needed (and would otherwise be
+  // lowered to a wait on an empty barrier).
+  SmallVector<CallInst *, 8> Waits;
+  SmallVector<Value *, 8> Done;
+  for (Value *SR : LoopSyncRegions) {
+    auto *SRI = dyn_cast<Instruction>(SR);
+    if (!SRI || SRI->getFunction() != &F)
+      continue;
+    Done.push_back(SR);
+
+    bool HasDetaches = false;
+    SmallVector<SyncInst *, 4> Syncs;
+    SmallVector<CallBase *, 4> SyncUnwinds;
+    for (User *U : SR->users()) {
+      if (isa<DetachInst>(U))
+        HasDetaches = true;
+      else if (auto *SI = dyn_cast<SyncInst>(U))
+        Syncs.push_back(SI);
+      else if (auto *CB = dyn_cast<CallBase>(U))
+        if (CB->getIntrinsicID() == Intrinsic::sync_unwind)
+          SyncUnwinds.push_back(CB);
+    }
+
+    for (SyncInst *SI : Syncs) {
+      IRBuilder<> builder(SI);
+      Value *EventVal = builder.CreateLoad(getEventType(C), Event);
+      Waits.push_back(builder.CreateCall(get_realmWaitEvent(), {EventVal}));
+      if (!HasDetaches)
+        ReplaceInstWithInst(SI, BranchInst::Create(SI->getSuccessor(0)));
+    }
+    if (!HasDetaches) {
+      for (CallBase *CB : SyncUnwinds) {
+        if (auto *II = dyn_cast<InvokeInst>(CB)) {
+          II->getUnwindDest()->removePredecessor(II->getParent());
+          ReplaceInstWithInst(II, BranchInst::Create(II->getNormalDest()));
+        } else
+          CB->eraseFromParent();
+      }
+    }
+  }
+  for (Value *SR : Done)
+    LoopSyncRegions.erase(SR);
+
+  // Consecutive loops chain on the event rather than waiting in between.
+  Value *LaunchFn = DistributedLoops
+                       ? get_realmSpawnLoopDistributed().getCallee()
+                       : get_realmSpawnLoop().getCallee();
+  for (CallInst *Wait : Waits) {
+    if (isFollowedByChainedLaunch(Wait, LaunchFn)) {
+      LLVM_DEBUG(dbgs() << "realmabi: chaining launches across " << *Wait
+                        << "\n");
+      Instruction *EventVal = cast<Instruction>(Wait->getArgOperand(0));
+      Wait->eraseFromParent();
+      EventVal->eraseFromParent();
+    }
+  }
+
+  // Launches may happen in functions that are left without Tapir
+  // constructs once the loops have been outlined.
+  initRuntime(F);
+}
+
+LoopOutlineProcessor *
+RealmABI::getLoopOutlineProcessor(const TapirLoopInfo *TL) {
+  return new RealmLoop(M, this);
+}
+
+// --- Loop Outliner
+
+void RealmLoop::setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                                     SmallVectorImpl<Value *> &HelperInputs,
+                                     ValueSet &InputSet,
+                                     const SmallVectorImpl<Value *> &LCArgs,
+                                     const SmallVectorImpl<Value *> &LCInputs,
+                                     const ValueSet &TLInputsFixed) {
+  // The helper runs the iterations [start, end) of the loop: the first
+  // two parameters define the range, followed by the grain size (if it
+  // is not constant) and the inputs of the loop body.
+  for (unsigned i = 0; i < 3; ++i) {
+    if (i == 2 && isa<ConstantInt>(LCInputs[2]))
+      break;
+    HelperArgs.insert(LCArgs[i]);
+    HelperInputs.push_back(LCInputs[i]);
+    InputSet.insert(LCInputs[i]);
+  }
+
+  for (Value *V : TLInputsFixed) {
+    HelperArgs.insert(V);
+    HelperInputs.push_back(V);
+  }
+}
+
+unsigned RealmLoop::getIVArgIndex(const Function &F,
+                                  const ValueSet &Args) const {
+  return 0;
+}
+
+unsigned RealmLoop::getLimitArgIndex(const Function &F,
+                                     const ValueSet &Args) const {
+  return 1;
+}
+
+void RealmLoop::postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                   ValueToValueMapTy &VMap) {
+  LoopOutlineProcessor::postProcessOutline(TL, Out, VMap);
+
+  HelperIV = cast<PHINode>(VMap[TL.getPrimaryInduction().first]);
+
+  // The cloned loop has been serialized; each task of the launch runs
+  // its range of iterations in order.
+  Value *SR = TL.getTask()->getDetach()->getSyncRegion();
+  if (auto *ClonedSR = dyn_cast_or_null<Instruction>(VMap.lookup(SR)))
+    if (ClonedSR->use_empty())
+      ClonedSR->eraseFromParent();
+  TTarget->pushLoopSR(SR);
+}
+
+Constant *RealmLoop::getRegionDescs(CallBase *ReplCall, StructType *ArgsTy,
+                                    unsigned &NumDescs) {
+  Function *Helper = ReplCall->getCalledFunction();
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  const StructLayout *SL = DL.getStructLayout(ArgsTy);
+  StructType *DescTy = getRegionDescType(C);
+  Type *I64Ty = Type::getInt64Ty(C), *I32Ty = Type::getInt32Ty(C);
+
+  SmallVector<Constant *, 8> Descs;
+  for (Argument &A : Helper->args()) {
+    if (A.getArgNo() < 2 || !A.getType()->isPointerTy())
+      continue;
+    tapir::KernelArgAccess Access =
+        tapir::getKernelArgAccess(ReplCall->getArgOperand(A.getArgNo()), &A);
+    // Accesses of other iterations' elements can only be partitioned
+    // when they are reads (the halo is copied from the owning nodes).
+    int64_t Lo = 0, Hi = 0;
+    Type *ElemTy = nullptr;
+    unsigned Flags = 0;
+    if (HelperIV &&
+        tapir::getStencilAccessRange(&A, HelperIV, Lo, Hi, ElemTy) &&
+        (Access == tapir::KernelArgReadOnly || (Lo == 0 && Hi == 0)))
+      Flags |= RealmRegionPartitioned;
+    LLVM_DEBUG(dbgs() << "realmabi: " << Helper->getName() << " argument "
+                      << A.getArgNo()
+                      << ((Flags & RealmRegionPartitioned)
+                              ? " is partitioned"
+                              : " is not partitioned")
+                      << " (halo [" << Lo << ", " << Hi << "])\n");
+    Descs.push_back(ConstantStruct::get(
+        DescTy,
+        {ConstantInt::get(I64Ty, SL->getElementOffset(A.getArgNo())),
+         ConstantInt::get(I64Ty, ElemTy ? DL.getTypeAllocSize(ElemTy) : 0),
+         ConstantInt::get(I64Ty, Lo), ConstantInt::get(I64Ty, Hi),
+         ConstantInt::get(I32Ty, Access), ConstantInt::get(I32Ty, Flags)}));
+  }
+
+  NumDescs = Descs.size();
+  if (Descs.empty())
+    return Constant::getNullValue(PointerType::getUnqual(C));
+  ArrayType *DescsTy = ArrayType::get(DescTy, Descs.size());
+  return new GlobalVariable(M, DescsTy, /*isConstant=*/true,
+                            GlobalValue::PrivateLinkage,
+                            ConstantArray::get(DescsTy, Descs),
+                            Helper->getName() + ".realm_regions");
+}
+
+void RealmLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                        TaskOutlineInfo &TOI,
+                                        DominatorTree &DT) {
+  Function *Helper = TOI.Outline;
+  CallBase *ReplCall = cast<CallBase>(TOI.ReplCall);
+  BasicBlock *CallBlock = ReplCall->getParent();
+  Function *Parent = CallBlock->getParent();
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *Int64Ty = Type::getInt64Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+
+  // Marshal the helper's arguments into a structure that the runtime
+  // copies for each task of the launch.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *V : ReplCall->args())
+    ArgTys.push_back(V->getType());
+  StructType *ArgsTy = StructType::get(C, ArgTys);
+
+  IRBuilder<> EntryBuilder(Parent->getEntryBlock().getFirstNonPHIOrDbg());
+  AllocaInst *Args = EntryBuilder.CreateAlloca(ArgsTy, nullptr,
+                                               "realm.loop.args");
+  IRBuilder<> B(ReplCall);
+  for (unsigned i = 0; i < ReplCall->arg_size(); ++i)
+    B.CreateStore(ReplCall->getArgOperand(i),
+                  B.CreateStructGEP(ArgsTy, Args, i));
+
+  // Each task of the launch runs the helper over its chunk of the
+  // iterations:
+  //
+  //     void body(args *A, int64_t lo, int64_t hi) {
+  //       helper(lo, hi, A->...);
+  //     }
+  Function *Body = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), {PtrTy, Int64Ty, Int64Ty}, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".realm_loop", &M);
+  Body->addFnAttr(Attribute::NoUnwind);
+  {
+    IRBuilder<> BB(BasicBlock::Create(C, "entry", Body));
+    Argument *BodyArgs = Body->getArg(0);
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0; i < ArgTys.size(); ++i) {
+      if (i < 2)
+        HelperArgs.push_back(
+            BB.CreateIntCast(Body->getArg(1 + i), ArgTys[i], false));
+      else
+        HelperArgs.push_back(BB.CreateLoad(
+            ArgTys[i], BB.CreateStructGEP(ArgsTy, BodyArgs, i)));
+    }
+    CallInst *Call = BB.CreateCall(Helper, HelperArgs);
+    Call->setCallingConv(Helper->getCallingConv());
+    BB.CreateRetVoid();
+  }
+
+  // Split the iterations into one chunk per processor:
+  //
+  //     chunk = ceil((end - start) / # processors)
+  Value *Start = B.CreateIntCast(ReplCall->getArgOperand(0), Int64Ty, false);
+  Value *End = B.CreateIntCast(ReplCall->getArgOperand(1), Int64Ty, false);
+  Value *Procs = B.CreateCall(TTarget->get_realmGetNumProcs());
+  Value *Count = B.CreateSub(End, Start);
+  Value *Chunk = B.CreateUDiv(
+      B.CreateSub(B.CreateAdd(Count, Procs), ConstantInt::get(Int64Ty, 1)),
+      Procs);
+  Chunk = B.CreateSelect(B.CreateICmpEQ(Chunk, ConstantInt::get(Int64Ty, 0)),
+                         ConstantInt::get(Int64Ty, 1), Chunk);
+
+  // The launch waits on the event of the previous launch in this
+  // function and replaces it with its own completion event.
+  Value *Event = TTarget->getOrCreateLoopEvent(Parent);
+  Type *EventTy = getEventType(C);
+  Value *PreEvent = B.CreateLoad(EventTy, Event);
+  Value *ArgSize =
+      ConstantInt::get(DL.getIntPtrType(C), DL.getTypeAllocSize(ArgsTy));
+  CallInst *Launch;
+  if (DistributedLoops) {
+    unsigned NumDescs;
+    Constant *Descs = getRegionDescs(ReplCall, ArgsTy, NumDescs);
+    Launch = B.CreateCall(TTarget->get_realmSpawnLoopDistributed(),
+                          {PreEvent, Body, Args, ArgSize, Start, End, Chunk,
+                           ConstantInt::get(Type::getInt32Ty(C), NumDescs),
+                           Descs});
+  } else
+    Launch = B.CreateCall(TTarget->get_realmSpawnLoop(),
+                          {PreEvent, Body, Args, ArgSize, Start, End, Chunk});
+  Launch->setDebugLoc(ReplCall->getDebugLoc());
+  B.CreateStore(Launch, Event);
+
+  TOI.replaceReplCall(Launch);
+  ReplCall->eraseFromParent();
+  if (TOI.ReplUnwind)
+    // As with realmSpawn, the runtime deals with exceptions.  Restore
+    // the terminator removed along with the invoke of the helper.
+    BranchInst::Create(TOI.ReplRet, CallBlock);
 }
 
 void RealmABI::postProcessHelper(Function &F) {}
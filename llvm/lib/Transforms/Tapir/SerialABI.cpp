@@ -12,7 +12,12 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/SerialABI.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 
@@ -20,6 +25,97 @@ using namespace llvm;
 
 #define DEBUG_TYPE "serialabi"
 
+static cl::opt<bool> VectorizeTapirLoops(
+    "serialabi-vectorize", cl::init(true), cl::Hidden,
+    cl::desc("Mark the serialized Tapir loops as parallel-access loops and "
+             "request their vectorization (default=true)"));
+
+/// Returns true if \p I is a Tapir intrinsic that serialization removes.
+static bool isSerializedTapirIntrinsic(const Instruction &I) {
+  const auto *II = dyn_cast<IntrinsicInst>(&I);
+  if (!II)
+    return false;
+  switch (II->getIntrinsicID()) {
+  case Intrinsic::syncregion_start:
+  case Intrinsic::detached_rethrow:
+  case Intrinsic::taskframe_create:
+  case Intrinsic::taskframe_use:
+  case Intrinsic::taskframe_end:
+  case Intrinsic::taskframe_resume:
+  case Intrinsic::taskframe_load_guard:
+  case Intrinsic::sync_unwind:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Record that the iterations of Tapir loop \p L, with body \p T, are
+/// logically parallel before the loop is serialized.
+///
+/// Tapir programs are assumed to be data-race free, so two iterations of L
+/// never access the same location unless both only read it.  Put the plain
+/// loads and stores (and calls that do not synchronize) of the body in an
+/// access group listed in the loop's llvm.loop.parallel_accesses, as
+/// LoopSpawning does for outlined loops.  If
+/// that covers every memory operation of the loop, the loop is also marked
+/// llvm.loop.vectorize.enable: the serial projection of a forall is then
+/// vectorized, like the loops its parallel targets outline, rather than left
+/// to the vectorizer's conservative dependence analysis.
+static bool markParallelTapirLoop(Loop *L, Task *T) {
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!Latch)
+    return false;
+
+  LLVMContext &C = Latch->getContext();
+  MDNode *AccessGroup = MDNode::getDistinct(C, {});
+  bool AllParallel = true;
+  for (BasicBlock *BB : L->blocks()) {
+    bool InBody = T->encloses(BB);
+    for (Instruction &I : *BB) {
+      if (!I.mayReadOrWriteMemory() || isSerializedTapirIntrinsic(I) ||
+          isa<SyncInst>(I))
+        continue;
+      if (!InBody || !isDRFParallelAccess(I)) {
+        AllParallel = false;
+        continue;
+      }
+      I.setMetadata(LLVMContext::MD_access_group,
+                    uniteAccessGroups(
+                        I.getMetadata(LLVMContext::MD_access_group),
+                        AccessGroup));
+    }
+  }
+
+  // Rebuild the loop ID with the parallel-accesses property.
+  Instruction *LatchTerm = Latch->getTerminator();
+  SmallVector<Metadata *, 4> MDs;
+  MDs.push_back(nullptr);
+  if (MDNode *LoopID = LatchTerm->getMetadata(LLVMContext::MD_loop))
+    for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i) {
+      // Keep any vectorize.enable hint the user placed on the loop.
+      if (AllParallel)
+        if (auto *MD = dyn_cast<MDNode>(LoopID->getOperand(i)))
+          if (auto *S = dyn_cast<MDString>(MD->getOperand(0)))
+            if (S->getString() == "llvm.loop.vectorize.enable")
+              AllParallel = false;
+      MDs.push_back(LoopID->getOperand(i));
+    }
+  MDs.push_back(MDNode::get(
+      C, {MDString::get(C, "llvm.loop.parallel_accesses"), AccessGroup}));
+  if (AllParallel)
+    MDs.push_back(MDNode::get(
+        C, {MDString::get(C, "llvm.loop.vectorize.enable"),
+            ConstantAsMetadata::get(ConstantInt::getTrue(C))}));
+  MDNode *NewLoopID = MDNode::getDistinct(C, MDs);
+  NewLoopID->replaceOperandWith(0, NewLoopID);
+  LatchTerm->setMetadata(LLVMContext::MD_loop, NewLoopID);
+  LLVM_DEBUG(dbgs() << "serialabi: marked loop " << L->getHeader()->getName()
+                    << " as parallel"
+                    << (AllParallel ? " and vectorizable" : "") << ".\n");
+  return true;
+}
+
 Value *SerialABI::lowerGrainsizeCall(CallInst *GrainsizeCall) {
   Value *Grainsize = ConstantInt::get(GrainsizeCall->getType(), 1);
 
@@ -39,6 +135,15 @@ bool SerialABI::preProcessFunction(Function &F, TaskInfo &TI,
     return false;
 
   bool Changed = false;
+  // Annotate the Tapir loops while their tasks still mark the bodies.
+  if (VectorizeTapirLoops && !TI.isSerial()) {
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    for (Loop *L : LI.getLoopsInPreorder())
+      if (Task *T = getTaskIfTapirLoopStructure(L, &TI))
+        Changed |= markParallelTapirLoop(L, T);
+  }
+
   for (Task *T : post_order(TI.getRootTask())) {
     if (T->isRootTask())
       continue;
@@ -7,6 +7,12 @@
 //===----------------------------------------------------------------------===//
 //
 // This pass serializes Tapir tasks with too little work to justify spawning.
+// Tapir loops are serialized when their stripmining grainsize covers the whole
+// loop.  Other spawned tasks are serialized when their estimated work is below
+// the overhead of detaching the task and of a possible steal.  A task whose
+// work depends on the runtime trip count of a loop is instead guarded by a
+// check of that trip count, which runs a serial clone of the task when the
+// count is small.
 //
 //===----------------------------------------------------------------------===//
 
@@ -21,10 +27,15 @@
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Analysis/WorkSpanAnalysis.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Tapir/LoopStripMine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 
 using namespace llvm;
@@ -35,6 +46,27 @@ static cl::opt<bool> SerializeUnprofitableLoops(
   "serialize-unprofitable-loops", cl::Hidden, cl::init(true),
   cl::desc("Serialize any Tapir tasks found to be unprofitable."));
 
+static cl::opt<bool> SerializeUnprofitableTasks(
+  "serialize-unprofitable-tasks", cl::Hidden, cl::init(true),
+  cl::desc("Serialize spawned tasks whose estimated work does not amortize "
+           "the overhead of spawning them."));
+
+static cl::opt<unsigned> TaskSpawnCost(
+  "serialize-small-tasks-spawn-cost", cl::Hidden, cl::init(30),
+  cl::desc("Estimated cost of detaching a task, in units of the target's "
+           "size-and-latency cost."));
+
+static cl::opt<unsigned> TaskStealCost(
+  "serialize-small-tasks-steal-cost", cl::Hidden, cl::init(1000),
+  cl::desc("Estimated cost of stealing a spawned continuation, in units of "
+           "the target's size-and-latency cost."));
+
+static cl::opt<bool> GuardSmallTasks(
+  "serialize-small-tasks-runtime-guard", cl::Hidden, cl::init(true),
+  cl::desc("Guard spawned tasks whose work depends on a runtime trip count "
+           "with a check that runs a serial clone of the task when the trip "
+           "count is small."));
+
 static bool trySerializeSmallLoop(
     Loop *L, DominatorTree &DT, LoopInfo *LI, ScalarEvolution &SE,
     const TargetTransformInfo &TTI, AssumptionCache &AC, TaskInfo *TI,
@@ -94,6 +126,228 @@ static bool trySerializeSmallLoop(
   return true;
 }
 
+/// Return true if task T, or any of its descendants, contains a call whose
+/// cost the static estimate of the task cannot account for.
+static bool taskHasOpaqueCalls(const Task *T) {
+  SmallVector<BasicBlock *, 32> Blocks;
+  T->getDominatedBlocks(Blocks);
+  for (const BasicBlock *BB : Blocks)
+    for (const Instruction &I : *BB)
+      if (const auto *CB = dyn_cast<CallBase>(&I))
+        if (!isa<IntrinsicInst>(CB) || isa<MemIntrinsic>(CB))
+          return true;
+  return false;
+}
+
+/// Return the overhead of spawning a task that a serial execution avoids.
+static InstructionCost getTaskSpawnOverhead() {
+  return InstructionCost(TaskSpawnCost) + InstructionCost(TaskStealCost);
+}
+
+/// Check whether the work of the serial task T has the form Fixed + PerIter *
+/// N, where N is the trip count of a single loop in T that is known only at
+/// runtime.  Returns that loop, or nullptr if T does not have that form.
+static Loop *
+getRuntimeDependentCost(Task *T, LoopInfo &LI, ScalarEvolution &SE,
+                        const TargetTransformInfo &TTI, TargetLibraryInfo *TLI,
+                        const SmallPtrSetImpl<const Value *> &EphValues,
+                        InstructionCost &Fixed, InstructionCost &PerIter) {
+  CodeMetrics Metrics;
+  Loop *RuntimeL = nullptr;
+  Fixed = 0;
+  for (BasicBlock *BB : T->getEntrySpindle()->blocks()) {
+    // Find the outermost loop within T that contains BB.
+    Loop *L = LI.getLoopFor(BB);
+    if (L && !T->encloses(L->getHeader()))
+      L = nullptr;
+    while (L && L->getParentLoop() &&
+           T->encloses(L->getParentLoop()->getHeader()))
+      L = L->getParentLoop();
+
+    if (!L) {
+      Metrics.analyzeBasicBlock(BB, TTI, EphValues, /*PrepareForLTO*/ false,
+                                TLI);
+      Fixed += Metrics.NumBBInsts[BB];
+      continue;
+    }
+    // Account for each loop once, at its header.
+    if (BB != L->getHeader())
+      continue;
+
+    WSCost LoopCost;
+    estimateLoopCost(LoopCost, L, &LI, &SE, TTI, TLI, EphValues);
+    if (LoopCost.UnknownCost || !LoopCost.Work.isValid() ||
+        InstructionCost::getMax() == LoopCost.Work)
+      return nullptr;
+
+    if (unsigned ConstTripCount = getConstTripCount(L, SE)) {
+      Fixed += LoopCost.Work * ConstTripCount;
+      continue;
+    }
+    // Only one loop may depend on runtime values.
+    if (RuntimeL)
+      return nullptr;
+    RuntimeL = L;
+    PerIter = LoopCost.Work;
+  }
+  if (!Fixed.isValid() || !RuntimeL)
+    return nullptr;
+  return RuntimeL;
+}
+
+/// Guard the detach DI of the serial task T with a check that runs a serial
+/// clone of T when TripCount is at most MaxTripCount.
+static void emitSerialCloneForTask(DetachInst *DI, Task *T,
+                                   const SCEV *TripCount,
+                                   uint64_t MaxTripCount, ScalarEvolution &SE,
+                                   DominatorTree &DT, LoopInfo &LI) {
+  BasicBlock *Detacher = DI->getParent();
+  Function &F = *Detacher->getParent();
+  BasicBlock *Spawner = SplitBlock(Detacher, DI, &DT, &LI);
+  BasicBlock *Continue = DI->getContinue();
+
+  // Compute whether the task is small in the block before the detach.
+  SCEVExpander Expander(SE, F.getParent()->getDataLayout(),
+                        "serialize-small-tasks");
+  Value *TC = Expander.expandCodeFor(TripCount, TripCount->getType(),
+                                     Detacher->getTerminator());
+  IRBuilder<> B(Detacher->getTerminator());
+  Value *IsSmall = B.CreateICmpULE(
+      TC, ConstantInt::get(TC->getType(), MaxTripCount), "small.task");
+
+  // Clone the task, and replace the reattaches of the clone with branches to
+  // the continuation.
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 8> Clones;
+  for (BasicBlock *BB : T->getEntrySpindle()->blocks()) {
+    BasicBlock *Clone = CloneBasicBlock(BB, VMap, ".ser", &F);
+    VMap[BB] = Clone;
+    Clones.push_back(Clone);
+  }
+  remapInstructionsInBlocks(Clones, VMap);
+  for (BasicBlock *Clone : Clones)
+    if (isa<ReattachInst>(Clone->getTerminator())) {
+      for (PHINode &PN : Continue->phis())
+        PN.addIncoming(PN.getIncomingValueForBlock(Spawner), Clone);
+      ReplaceInstWithInst(Clone->getTerminator(),
+                          BranchInst::Create(Continue));
+    }
+
+  ReplaceInstWithInst(
+      Detacher->getTerminator(),
+      BranchInst::Create(cast<BasicBlock>(VMap[DI->getDetached()]), Spawner,
+                         IsSmall));
+  DT.recalculate(F);
+}
+
+/// Try to guard the detach DI of task T with a runtime check that runs a
+/// serial clone of T when its work does not amortize the spawn overhead.
+static bool tryGuardSmallTask(DetachInst *DI, Task *T, DominatorTree &DT,
+                              LoopInfo &LI, ScalarEvolution &SE,
+                              const TargetTransformInfo &TTI,
+                              AssumptionCache &AC,
+                              OptimizationRemarkEmitter &ORE,
+                              TargetLibraryInfo *TLI) {
+  // Only clone simple serial tasks.
+  if (!T->isSerial() || T->getNumSpindles() != 1 || DI->hasUnwindDest() ||
+      T->getTaskFrameUsed() || taskContainsSync(T))
+    return false;
+  for (BasicBlock *BB : T->getEntrySpindle()->blocks())
+    for (Instruction &I : *BB)
+      if (isa<AllocaInst>(&I))
+        return false;
+
+  SmallPtrSet<const Value *, 32> EphValues;
+  CodeMetrics::collectEphemeralValues(DI->getFunction(), &AC, EphValues);
+  InstructionCost Fixed, PerIter;
+  Loop *L = getRuntimeDependentCost(T, LI, SE, TTI, TLI, EphValues, Fixed,
+                                    PerIter);
+  if (!L)
+    return false;
+
+  // Find the largest trip count of L for which the task is still small.
+  InstructionCost Overhead = getTaskSpawnOverhead();
+  if (Fixed >= Overhead || !PerIter.isValid() || PerIter <= 0)
+    return false;
+  uint64_t MaxTripCount = *((Overhead - Fixed) / PerIter).getValue();
+  if (!MaxTripCount)
+    return false;
+
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC))
+    return false;
+  const SCEV *TripCount = SE.getTripCountFromExitCount(BTC);
+  SCEVExpander Expander(SE, DI->getModule()->getDataLayout(),
+                        "serialize-small-tasks");
+  if (!Expander.isSafeToExpandAt(TripCount, DI))
+    return false;
+
+  ORE.emit([&]() {
+             return OptimizationRemark("serialize-small-tasks",
+                                       "GuardingSmallTask",
+                                       DI->getDebugLoc(), DI->getParent())
+               << "Guarding spawned task with a serial clone for trip counts "
+               << "up to " << ore::NV("MaxTripCount", MaxTripCount) << ".";
+           });
+  emitSerialCloneForTask(DI, T, TripCount, MaxTripCount, SE, DT, LI);
+  return true;
+}
+
+/// Serialize the tasks spawned outside of Tapir loops whose estimated work
+/// does not amortize the overhead of spawning them.  Sets \p ClonedTasks if
+/// any task was guarded with a serial clone.
+static bool serializeSmallTasks(Function &F, DominatorTree &DT, LoopInfo &LI,
+                                ScalarEvolution &SE,
+                                const TargetTransformInfo &TTI,
+                                AssumptionCache &AC, TaskInfo &TI,
+                                OptimizationRemarkEmitter &ORE,
+                                TargetLibraryInfo *TLI, bool &ClonedTasks) {
+  SmallVector<WSRegionEstimate, 8> Regions;
+  estimateWorkSpan(F, LI, TI, SE, TTI, TLI, AC, Regions);
+
+  // The regions are in preorder, so visit them in reverse to handle subtasks
+  // before their parents.  The estimates of the ancestors of a transformed task
+  // are stale, so skip those ancestors.
+  SmallPtrSet<const Task *, 8> Stale;
+  bool Changed = false;
+  for (const WSRegionEstimate &R : reverse(Regions)) {
+    if (R.isTapirLoop() || Stale.count(R.T))
+      continue;
+    Task *T = const_cast<Task *>(R.T);
+    DetachInst *DI = T->getDetach();
+
+    bool Transformed = false;
+    if (taskHasOpaqueCalls(T)) {
+      LLVM_DEBUG(dbgs() << "Task " << T->getEntry()->getName()
+                        << " contains calls with unknown cost.\n");
+    } else if (!R.UnknownCost && R.BodyWork.isValid() &&
+               R.BodyWork + R.SpawnCost <= getTaskSpawnOverhead()) {
+      ORE.emit([&]() {
+                 return OptimizationRemark("serialize-small-tasks",
+                                           "SerializingSmallTask",
+                                           DI->getDebugLoc(), DI->getParent())
+                   << "Serializing spawned task that appears to be "
+                   << "unprofitable to spawn.";
+               });
+      SerializeDetach(DI, T, /* ReplaceWithTaskFrame = */ taskContainsSync(T),
+                      &DT);
+      Transformed = true;
+    } else if (GuardSmallTasks && R.UnknownCost &&
+               tryGuardSmallTask(DI, T, DT, LI, SE, TTI, AC, ORE, TLI)) {
+      ClonedTasks = true;
+      Transformed = true;
+    }
+
+    if (Transformed) {
+      for (const Task *Parent = T->getParentTask(); Parent;
+           Parent = Parent->getParentTask())
+        Stale.insert(Parent);
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
 namespace {
 struct SerializeSmallTasks : public FunctionPass {
   static char ID; // Pass identification, replacement for typeid
@@ -171,6 +425,15 @@ bool SerializeSmallTasks::runOnFunction(Function &F) {
     // Recalculate TaskInfo
     TI.recalculate(*DT.getRoot()->getParent(), DT);
 
+  if (SerializeUnprofitableTasks && !TI.isSerial()) {
+    bool ClonedTasks = false;
+    if (serializeSmallTasks(F, DT, *LI, SE, TTI, AC, TI, ORE, &TLI,
+                            ClonedTasks)) {
+      TI.recalculate(F, DT);
+      Changed = true;
+    }
+  }
+
   return Changed;
 }
 
@@ -200,16 +463,27 @@ PreservedAnalyses SerializeSmallTasksPass::run(Function &F,
     for (Loop *L : LI)
       Changed |= trySerializeSmallLoop(L, DT, &LI, SE, TTI, AC, &TI, ORE, &TLI);
 
+  if (Changed)
+    // Recalculate TaskInfo
+    TI.recalculate(*DT.getRoot()->getParent(), DT);
+
+  bool ClonedTasks = false;
+  if (SerializeUnprofitableTasks && !TI.isSerial() &&
+      serializeSmallTasks(F, DT, LI, SE, TTI, AC, TI, ORE, &TLI, ClonedTasks)) {
+    TI.recalculate(F, DT);
+    Changed = true;
+  }
+
   if (!Changed)
     return PreservedAnalyses::all();
 
-  // Recalculate TaskInfo
-  TI.recalculate(*DT.getRoot()->getParent(), DT);
-
   PreservedAnalyses PA;
   PA.preserve<DominatorTreeAnalysis>();
-  PA.preserve<LoopAnalysis>();
-  PA.preserve<ScalarEvolutionAnalysis>();
+  // Serial clones of tasks add loops that LoopInfo does not know about.
+  if (!ClonedTasks) {
+    PA.preserve<LoopAnalysis>();
+    PA.preserve<ScalarEvolutionAnalysis>();
+  }
   PA.preserve<TaskAnalysis>();
   // TODO: Add more preserved analyses here.
   return PA;
@@ -35,6 +35,8 @@ raw_ostream &operator<<(raw_ostream &os, const TapirTargetID &Target) {
     return os << "cuda";
   case TapirTargetID::Hip:
     return os << "hip";
+  case TapirTargetID::LevelZero:
+    return os << "levelzero";
   case TapirTargetID::Lambda:
     return os << "lambda";
   case TapirTargetID::OMPTask:
@@ -47,6 +49,8 @@ raw_ostream &operator<<(raw_ostream &os, const TapirTargetID &Target) {
     return os << "qthreads";
   case TapirTargetID::Realm:
     return os << "realm";
+  case TapirTargetID::Multi:
+    return os << "multi";
   case TapirTargetID::Last_TapirTargetID:
     return os << "<invalid>";
   }
@@ -0,0 +1,255 @@
+//===- TapirCoarsenRecursion.cpp - Serialize small recursive calls --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass coarsens the leaves of divide-and-conquer recursion.  A recursive
+// function that spawns, such as
+//
+//   void sort(int *a, size_t n) {
+//     if (n < 2) return;
+//     size_t p = partition(a, n);
+//     spawn left { sort(a, p); }
+//     sort(a + p + 1, n - p - 1);
+//     sync left;
+//   }
+//
+// spawns down to its base case, so most of its spawns are of tasks far too
+// small to amortize their cost.  The pass clones such a function F into a
+// serial version, F.serial, in which every spawn is serialized and the
+// recursive calls call F.serial, and has F call F.serial when the problem
+// size is at most a grainsize.
+//
+// The problem size is the integer parameter marked with [[tapir::grainsize]]
+// (the "tapir.grainsize" parameter attribute), whose value is the grainsize.
+// Without the attribute the pass looks for a parameter that every recursive
+// call passes either divided by a constant (a size, n / 2 or n - n / 2) or
+// decremented by a constant (a depth, n - 1), and uses the corresponding
+// default cutoff.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirCoarsenRecursion.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+#define DEBUG_TYPE "tapir-coarsen-recursion"
+
+STATISTIC(NumCoarsened, "Number of recursive functions given a serial "
+                        "base case");
+
+static cl::opt<unsigned> SizeCutoff(
+    "tapir-coarsen-size-cutoff", cl::Hidden, cl::init(1024),
+    cl::desc("Run the serial version of a recursive function that divides "
+             "its problem size when the size is at most this value"));
+
+static cl::opt<unsigned> DepthCutoff(
+    "tapir-coarsen-depth-cutoff", cl::Hidden, cl::init(16),
+    cl::desc("Run the serial version of a recursive function that decrements "
+             "its problem size when the size is at most this value"));
+
+namespace {
+/// How a recursive call derives a parameter from the caller's.
+enum class SizeStep { None, Divide, Subtract };
+} // end anonymous namespace
+
+/// Returns true if V is A divided by a constant of at least 2.
+static bool isFractionOf(Value *V, Argument *A) {
+  const APInt *C;
+  if (match(V, m_CombineOr(m_UDiv(m_Specific(A), m_APInt(C)),
+                           m_SDiv(m_Specific(A), m_APInt(C)))))
+    return C->ugt(1);
+  if (match(V, m_CombineOr(m_LShr(m_Specific(A), m_APInt(C)),
+                           m_AShr(m_Specific(A), m_APInt(C)))))
+    return !C->isZero();
+  return false;
+}
+
+/// Returns how V, the value a recursive call passes for parameter A, is
+/// derived from A.
+static SizeStep getSizeStep(Value *V, Argument *A) {
+  while (isa<ZExtInst>(V) || isa<SExtInst>(V) || isa<TruncInst>(V))
+    V = cast<CastInst>(V)->getOperand(0);
+
+  const APInt *C;
+  if (match(V, m_Sub(m_Specific(A), m_APInt(C))) && C->isStrictlyPositive())
+    return SizeStep::Subtract;
+  if (match(V, m_Add(m_Specific(A), m_APInt(C))) && C->isNegative())
+    return SizeStep::Subtract;
+  if (isFractionOf(V, A))
+    return SizeStep::Divide;
+  // The other half, A - A / C.
+  Value *Half;
+  if (match(V, m_Sub(m_Specific(A), m_Value(Half))) && isFractionOf(Half, A))
+    return SizeStep::Divide;
+  return SizeStep::None;
+}
+
+/// Find the parameter of F that measures the size of the problem, and the
+/// grainsize for it.  Returns nullptr if F has no such parameter.
+static Argument *getSizeArg(Function &F, ArrayRef<CallBase *> SelfCalls,
+                            uint64_t &Grainsize) {
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isIntegerTy())
+      continue;
+    Attribute Attr = F.getParamAttribute(A.getArgNo(), "tapir.grainsize");
+    if (!Attr.isValid() ||
+        Attr.getValueAsString().getAsInteger(10, Grainsize) || !Grainsize)
+      continue;
+    return &A;
+  }
+
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isIntegerTy())
+      continue;
+    // A parameter that some call decrements is a depth, and its cutoff is
+    // the depth cutoff even if other calls divide it.
+    SizeStep Step = SizeStep::None;
+    for (CallBase *CB : SelfCalls) {
+      SizeStep CallStep = getSizeStep(CB->getArgOperand(A.getArgNo()), &A);
+      if (CallStep == SizeStep::None) {
+        Step = SizeStep::None;
+        break;
+      }
+      if (Step != SizeStep::Subtract)
+        Step = CallStep;
+    }
+    if (Step == SizeStep::None)
+      continue;
+    Grainsize = Step == SizeStep::Subtract ? DepthCutoff : SizeCutoff;
+    return &A;
+  }
+  return nullptr;
+}
+
+/// Serialize every task in F and remove its syncs.
+static void serializeFunction(Function &F) {
+  DominatorTree DT(F);
+  TaskInfo TI;
+  TI.analyze(F, DT);
+  for (Task *T : post_order(TI.getRootTask())) {
+    if (T->isRootTask())
+      continue;
+    SerializeDetach(T->getDetach(), T,
+                    /* ReplaceWithTaskFrame = */ taskContainsSync(T), &DT);
+  }
+
+  SmallVector<SyncInst *, 8> Syncs;
+  for (BasicBlock &BB : F)
+    if (SyncInst *SI = dyn_cast<SyncInst>(BB.getTerminator()))
+      Syncs.push_back(SI);
+  for (SyncInst *SI : Syncs)
+    ReplaceInstWithInst(SI, BranchInst::Create(SI->getSuccessor(0)));
+
+  SmallVector<CallBase *, 8> SyncUnwinds;
+  for (Instruction &I : instructions(F))
+    if (isSyncUnwind(&I))
+      SyncUnwinds.push_back(cast<CallBase>(&I));
+  for (CallBase *SyncUnwind : SyncUnwinds)
+    removeDeadSyncUnwind(SyncUnwind);
+}
+
+/// Give the recursive function F a serial version for the calls whose size
+/// is at most the grainsize.  Returns true if F was changed.
+static bool coarsenRecursion(Function &F) {
+  if (F.isDeclaration() || F.isVarArg())
+    return false;
+  // Don't coarsen F twice.
+  std::string SerialName = (F.getName() + ".serial").str();
+  if (F.getParent()->getFunction(SerialName))
+    return false;
+
+  bool Spawns = false;
+  SmallVector<CallBase *, 4> SelfCalls;
+  for (Instruction &I : instructions(F)) {
+    if (isa<DetachInst>(I))
+      Spawns = true;
+    else if (CallBase *CB = dyn_cast<CallBase>(&I))
+      if (CB->getCalledFunction() == &F)
+        SelfCalls.push_back(CB);
+  }
+  if (!Spawns || SelfCalls.empty())
+    return false;
+
+  uint64_t Grainsize = 0;
+  Argument *Size = getSizeArg(F, SelfCalls, Grainsize);
+  if (!Size || !isUIntN(Size->getType()->getIntegerBitWidth(), Grainsize))
+    return false;
+
+  LLVM_DEBUG(dbgs() << "tapir-coarsen-recursion: " << F.getName()
+                    << " runs serially for " << Size->getName()
+                    << " <= " << Grainsize << "\n");
+
+  // Clone F into its serial version, whose recursive calls stay serial.
+  ValueToValueMapTy VMap;
+  Function *Serial = CloneFunction(&F, VMap);
+  Serial->setName(SerialName);
+  Serial->setLinkage(GlobalValue::InternalLinkage);
+  Serial->setVisibility(GlobalValue::DefaultVisibility);
+  Serial->setComdat(nullptr);
+  for (CallBase *CB : SelfCalls)
+    cast<CallBase>(VMap[CB])->setCalledFunction(Serial);
+  serializeFunction(*Serial);
+
+  // Branch to the serial version at the entry of F, after its static
+  // allocas.
+  BasicBlock *Entry = &F.getEntryBlock();
+  BasicBlock::iterator SplitPt = Entry->getFirstInsertionPt();
+  while (isa<AllocaInst>(SplitPt) &&
+         cast<AllocaInst>(SplitPt)->isStaticAlloca())
+    ++SplitPt;
+  BasicBlock *Parallel = Entry->splitBasicBlock(SplitPt, "coarsen.parallel");
+  BasicBlock *SerialBB = BasicBlock::Create(F.getContext(), "coarsen.serial",
+                                            &F, Parallel);
+
+  IRBuilder<> B(SerialBB);
+  SmallVector<Value *, 8> Args;
+  for (Argument &A : F.args())
+    Args.push_back(&A);
+  CallInst *Call = B.CreateCall(Serial, Args);
+  Call->setCallingConv(F.getCallingConv());
+  if (F.getReturnType()->isVoidTy())
+    B.CreateRetVoid();
+  else
+    B.CreateRet(Call);
+
+  Entry->getTerminator()->eraseFromParent();
+  B.SetInsertPoint(Entry);
+  Value *Small = B.CreateICmpULE(
+      Size, ConstantInt::get(Size->getType(), Grainsize), "coarsen.small");
+  B.CreateCondBr(Small, SerialBB, Parallel);
+
+  ++NumCoarsened;
+  return true;
+}
+
+PreservedAnalyses TapirCoarsenRecursionPass::run(Module &M,
+                                                 ModuleAnalysisManager &AM) {
+  SmallVector<Function *, 8> Functions;
+  for (Function &F : M)
+    Functions.push_back(&F);
+
+  bool Changed = false;
+  for (Function *F : Functions)
+    Changed |= coarsenRecursion(*F);
+
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
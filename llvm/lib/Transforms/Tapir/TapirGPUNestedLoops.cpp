@@ -0,0 +1,821 @@
+//===- TapirGPUNestedLoops.cpp - Map nested GPU Tapir loops to lanes ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass maps a Tapir loop nested in a GPU-targeted Tapir loop onto the
+// lanes of a warp, such as the loops of a sparse matrix-vector product
+//
+//   forall (i = 0; i < N; i++) {
+//     double sum = 0.0;
+//     forall (j = row[i]; j < row[i + 1]; j++)
+//       kitsune_reduce_add(sum, val[j] * x[col[j]]);
+//     y[i] = sum;
+//   }
+//
+// LoopSpawning outlines the inner loop first, as a kernel of its own that
+// the outer loop's kernel can't launch.  This pass rewrites the nest, ahead
+// of outlining, into a single Tapir loop that runs each outer iteration on a
+// group of W lanes (-tapir-gpu-nested-lanes):
+//
+//   forall (k = 0; k < N * W; k++) {
+//     i = k / W; lane = k % W;
+//     double sum = 0.0, acc = 0.0;
+//     for (j = row[i] + lane; j < row[i + 1]; j += W)
+//       acc += val[j] * x[col[j]];
+//     acc = the sum of acc over the lanes of the group;
+//     if (lane == 0) {
+//       sum += acc;
+//       y[i] = sum;
+//     }
+//   }
+//
+// Consecutive iterations run on consecutive GPU threads, so each group is W
+// lanes of a warp, and the lanes of a group walk the inner iterations side
+// by side.  Atomic reductions of the inner loop (e.g., kitsune_reduce_add)
+// into locations that do not vary with the inner iteration are accumulated
+// per lane and combined with lane shuffles.  The lane synchronization and
+// the shuffles are calls of placeholder functions that the GPU targets
+// replace when they outline the loop (see tapir::lowerGPULaneCalls()), and
+// the loop carries a kitsune.gpu.lanes hint that keeps it on the GPU.
+//
+// A nest is rewritten if every lane can run the outer body up to the inner
+// loop's sync: that code must be free of side effects other than stores to
+// the body's own variables.  The code after the sync runs on lane 0 only.
+// The inner loop may read the variables of the outer body but only update
+// them through reductions, and its bounds must be computable from values of
+// the outer body (or its induction variables).  Nests with inner bounds that
+// do not depend on the outer iteration and no other work are collapsed by
+// TapirLoopCollapse, which runs first.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirGPUNestedLoops.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-gpu-nested-loops"
+
+STATISTIC(NumMapped, "Number of nested GPU Tapir loops mapped to lanes");
+STATISTIC(NumLaneReductions, "Number of reductions combined across lanes");
+
+static cl::opt<unsigned> NestedLanes(
+    "tapir-gpu-nested-lanes", cl::Hidden, cl::init(32),
+    cl::desc("The number of lanes (a power of two, at most 32) that run each "
+             "iteration of a GPU Tapir loop with a nested Tapir loop."));
+
+namespace {
+
+/// The atomic reduction updates of the inner loop through one pointer,
+/// which are accumulated per lane.
+struct LaneReduction {
+  Value *Ptr = nullptr;
+  AtomicRMWInst::BinOp Op;
+  Type *Ty = nullptr;
+  /// Whether Ptr points to a variable of the outer body, which lane 0 of
+  /// the group updates without atomics.
+  bool Private = false;
+  SmallVector<AtomicRMWInst *, 4> Updates;
+};
+
+/// A GPU Tapir loop and the Tapir loop it contains.
+struct NestCandidate {
+  Loop *Outer = nullptr;
+  Loop *Inner = nullptr;
+  Task *OuterT = nullptr;
+  Task *InnerT = nullptr;
+  DetachInst *OuterDI = nullptr;
+  /// The sync of the inner loop, which ends the code that every lane runs.
+  SyncInst *Sync = nullptr;
+  /// The number of iterations of the outer loop so far, if an induction
+  /// variable gives it.
+  const SCEV *OuterIteration = nullptr;
+  /// The trip count of the inner loop and the starts and steps of its
+  /// induction variables, in terms of values of the outer body.
+  const SCEV *InnerTC = nullptr;
+  struct IVInfo {
+    PHINode *PN;
+    const SCEV *Start, *Step;
+  };
+  SmallVector<IVInfo, 2> InnerIVs;
+  SmallVector<LaneReduction, 2> Reductions;
+};
+
+class TapirGPUNestedLoops {
+public:
+  TapirGPUNestedLoops(Function &F, DominatorTree &DT, LoopInfo &LI,
+                      ScalarEvolution &SE, TaskInfo &TI, unsigned Lanes)
+      : F(F), DT(DT), LI(LI), SE(SE), TI(TI), Lanes(Lanes) {}
+
+  /// Map the first nest of GPU Tapir loops that can be mapped onto lanes.
+  /// Returns true if a nest was rewritten.
+  bool run();
+
+private:
+  bool analyzeLoopControl(Loop *L) const;
+  const SCEV *atOuterIteration(const SCEV *S, const NestCandidate &NC,
+                               SCEVExpander &Exp,
+                               Instruction *InsertPt) const;
+  bool analyzeInnerLoop(NestCandidate &NC, SCEVExpander &Exp) const;
+  bool analyzeOuterBody(NestCandidate &NC) const;
+  bool addReduction(NestCandidate &NC, AtomicRMWInst *RMW) const;
+  bool analyzeInnerBody(NestCandidate &NC) const;
+  bool analyzeNest(Loop *L, NestCandidate &NC) const;
+  void rewrite(NestCandidate &NC);
+
+  Function &F;
+  DominatorTree &DT;
+  LoopInfo &LI;
+  ScalarEvolution &SE;
+  TaskInfo &TI;
+  unsigned Lanes;
+};
+
+} // end anonymous namespace
+
+/// Returns true if the Tapir loop L is lowered by a GPU target that maps
+/// its iterations onto consecutive threads.
+static bool isLaneMappableTarget(const TapirLoopHints &Hints) {
+  TapirTargetID TargetID = (TapirTargetID)Hints.getLoopTarget();
+  return TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip;
+}
+
+/// Returns the affine recurrence of the induction variable PN of L, if any.
+static const SCEVAddRecExpr *getIVRecurrence(ScalarEvolution &SE,
+                                             PHINode &PN, const Loop *L) {
+  if (!PN.getType()->isIntegerTy())
+    return nullptr;
+  const auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+  if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+      SE.getTypeSizeInBits(AR->getType()) > 64)
+    return nullptr;
+  return AR;
+}
+
+/// Returns the instructions of the (single) sync region of Tapir loop L
+/// that reattach to its latch.
+static SmallVector<ReattachInst *, 4> getReattaches(const Loop *L) {
+  SmallVector<ReattachInst *, 4> Reattaches;
+  for (BasicBlock *Pred : predecessors(L->getLoopLatch()))
+    if (auto *RI = dyn_cast<ReattachInst>(Pred->getTerminator()))
+      Reattaches.push_back(RI);
+  return Reattaches;
+}
+
+/// Check the control of Tapir loop L, whose header and latch are replaced.
+/// They may only step the induction variables, which must be affine so that
+/// they can be recomputed from the new loop's index.
+bool TapirGPUNestedLoops::analyzeLoopControl(Loop *L) const {
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Exit = L->getExitBlock();
+  if (!L->getLoopPreheader() || !Latch || !Exit ||
+      L->getExitingBlock() != Latch || !Exit->phis().empty()) {
+    LLVM_DEBUG(dbgs() << "Loop is not in simplified form: " << *L);
+    return false;
+  }
+
+  auto *DI = cast<DetachInst>(Header->getTerminator());
+  if (DI->hasUnwindDest() || getTaskFrameUsed(DI->getDetached()))
+    return false;
+  for (Instruction &I : *Header)
+    if (!isa<PHINode>(I) && !isa<DbgInfoIntrinsic>(I) && !I.isTerminator())
+      return false;
+  for (PHINode &PN : Header->phis())
+    if (!getIVRecurrence(SE, PN, L))
+      return false;
+
+  for (Instruction &I : *Latch) {
+    if (I.isTerminator())
+      continue;
+    if (I.mayHaveSideEffects())
+      return false;
+    for (User *U : I.users()) {
+      BasicBlock *UseBB = cast<Instruction>(U)->getParent();
+      if (UseBB != Latch && UseBB != Header)
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Returns S with the recurrences of the outer loop evaluated at the
+/// current outer iteration, or nullptr if the result can't be computed at
+/// InsertPt (in the outer body).
+const SCEV *TapirGPUNestedLoops::atOuterIteration(const SCEV *S,
+                                                  const NestCandidate &NC,
+                                                  SCEVExpander &Exp,
+                                                  Instruction *InsertPt) const {
+  if (NC.OuterIteration) {
+    LoopToScevMapT Map;
+    Map[NC.Outer] = NC.OuterIteration;
+    S = SCEVLoopAddRecRewriter::rewrite(S, Map, SE);
+  }
+  if (SCEVExprContains(S, [](const SCEV *E) {
+        return isa<SCEVAddRecExpr>(E);
+      }) ||
+      !Exp.isSafeToExpandAt(S, InsertPt))
+    return nullptr;
+  return S;
+}
+
+/// Check that the inner loop's trip count and induction variables can be
+/// computed in its preheader, where the lanes start their share of its
+/// iterations.
+bool TapirGPUNestedLoops::analyzeInnerLoop(NestCandidate &NC,
+                                           SCEVExpander &Exp) const {
+  Loop *Inner = NC.Inner;
+  Instruction *InsertPt = Inner->getLoopPreheader()->getTerminator();
+  Type *Ty = Type::getInt64Ty(F.getContext());
+
+  const SCEV *BTC = SE.getBackedgeTakenCount(Inner);
+  if (isa<SCEVCouldNotCompute>(BTC) ||
+      SE.getTypeSizeInBits(BTC->getType()) > 64)
+    return false;
+  const SCEV *TC = SE.getAddExpr(SE.getZeroExtendExpr(BTC, Ty), SE.getOne(Ty),
+                                 SCEV::FlagNUW);
+  NC.InnerTC = atOuterIteration(TC, NC, Exp, InsertPt);
+  if (!NC.InnerTC) {
+    LLVM_DEBUG(dbgs() << "Inner trip count can't be computed in the outer "
+                         "body: "
+                      << *TC << "\n");
+    return false;
+  }
+
+  for (PHINode &PN : Inner->getHeader()->phis()) {
+    const SCEVAddRecExpr *AR = getIVRecurrence(SE, PN, Inner);
+    const SCEV *Start = atOuterIteration(AR->getStart(), NC, Exp, InsertPt);
+    const SCEV *Step =
+        atOuterIteration(AR->getStepRecurrence(SE), NC, Exp, InsertPt);
+    if (!Start || !Step) {
+      LLVM_DEBUG(dbgs() << "Inner induction variable can't be computed in "
+                           "the outer body: "
+                        << PN << "\n");
+      return false;
+    }
+    NC.InnerIVs.push_back({&PN, Start, Step});
+  }
+  return true;
+}
+
+/// Check that every lane can run the outer body up to the inner loop's sync
+/// and that the rest of the body can run on a single lane.
+bool TapirGPUNestedLoops::analyzeOuterBody(NestCandidate &NC) const {
+  Loop *Inner = NC.Inner;
+  Value *InnerSR =
+      cast<DetachInst>(Inner->getHeader()->getTerminator())->getSyncRegion();
+  SmallVector<ReattachInst *, 4> InnerRIs = getReattaches(Inner);
+
+  // The inner sync region goes away with the inner loop: it may only be
+  // synced once, by the outer body.
+  for (User *U : InnerSR->users()) {
+    auto *I = cast<Instruction>(U);
+    if (isa<DetachInst>(I) && I->getParent() == Inner->getHeader())
+      continue;
+    if (auto *RI = dyn_cast<ReattachInst>(I); RI && is_contained(InnerRIs, RI))
+      continue;
+    if (isa<CallInst>(I) && isSyncUnwind(I))
+      continue;
+    if (auto *SI = dyn_cast<SyncInst>(I); SI && !NC.Sync) {
+      NC.Sync = SI;
+      continue;
+    }
+    return false;
+  }
+  if (!NC.Sync || !NC.OuterT->encloses(NC.Sync->getParent()) ||
+      Inner->contains(NC.Sync->getParent()))
+    return false;
+  for (User *U : InnerSR->users())
+    if (isSyncUnwind(cast<Instruction>(U)) &&
+        !DT.dominates(NC.Sync, cast<Instruction>(U)))
+      return false;
+
+  BasicBlock *SyncBB = NC.Sync->getParent();
+  Value *OuterSR = NC.OuterDI->getSyncRegion();
+  Spindle *Entry = NC.OuterT->getEntrySpindle();
+  for (Spindle *S : depth_first<InTask<Spindle *>>(Entry))
+    for (BasicBlock *BB : S->blocks()) {
+      if (Inner->contains(BB))
+        continue;
+      // The code after the sync runs on lane 0 only.
+      if (DT.dominates(SyncBB, BB))
+        continue;
+      // The code before it is rerun by every lane, so it may only compute
+      // values and initialize the body's own variables.
+      for (Instruction &I : *BB) {
+        if (isa<DbgInfoIntrinsic>(I) || I.isLifetimeStartOrEnd() ||
+            &I == InnerSR)
+          continue;
+        if (isa<BranchInst>(I) || isa<SwitchInst>(I))
+          continue;
+        if (I.isTerminator()) {
+          LLVM_DEBUG(dbgs() << "Outer body ends ahead of the inner sync: " << I
+                            << "\n");
+          return false;
+        }
+        if (auto *SI = dyn_cast<StoreInst>(&I))
+          if (auto *AI = dyn_cast<AllocaInst>(
+                  getUnderlyingObject(SI->getPointerOperand()));
+              AI && NC.OuterT->encloses(AI->getParent()) && SI->isSimple())
+            continue;
+        if (I.mayHaveSideEffects()) {
+          LLVM_DEBUG(dbgs() << "Outer body has side effects ahead of the "
+                               "inner loop: "
+                            << I << "\n");
+          return false;
+        }
+      }
+    }
+
+  // Every path through the body reaches the sync.
+  for (BasicBlock *Pred : predecessors(NC.Outer->getLoopLatch()))
+    if (auto *RI = dyn_cast<ReattachInst>(Pred->getTerminator()))
+      if (RI->getSyncRegion() == OuterSR && !DT.dominates(SyncBB, Pred))
+        return false;
+  return true;
+}
+
+/// Record the atomic reduction update RMW to be accumulated per lane.
+/// Returns false if it must remain an atomic update of its location.
+bool TapirGPUNestedLoops::addReduction(NestCandidate &NC,
+                                       AtomicRMWInst *RMW) const {
+  Value *Ptr = RMW->getPointerOperand();
+  Type *Ty = RMW->getValOperand()->getType();
+  unsigned Bits = Ty->getPrimitiveSizeInBits();
+  if ((!Ty->isIntegerTy() && !Ty->isFloatingPointTy()) ||
+      (Bits != 32 && Bits != 64))
+    return false;
+  // The lanes combine their values where the inner loop is synced.
+  if (auto *PtrI = dyn_cast<Instruction>(Ptr))
+    if (NC.Inner->contains(PtrI) || !DT.dominates(PtrI, NC.Sync))
+      return false;
+
+  for (LaneReduction &R : NC.Reductions)
+    if (R.Ptr == Ptr) {
+      if (R.Op != RMW->getOperation() || R.Ty != Ty)
+        return false;
+      R.Updates.push_back(RMW);
+      return true;
+    }
+
+  LaneReduction R;
+  R.Ptr = Ptr;
+  R.Op = RMW->getOperation();
+  R.Ty = Ty;
+  auto *AI = dyn_cast<AllocaInst>(getUnderlyingObject(Ptr));
+  R.Private = AI && NC.OuterT->encloses(AI->getParent());
+  R.Updates.push_back(RMW);
+  NC.Reductions.push_back(R);
+  return true;
+}
+
+/// Check that the iterations of the inner loop only read the variables of
+/// the outer body (and the enclosing function), other than through
+/// reductions, so that the lanes can run them in any order.
+bool TapirGPUNestedLoops::analyzeInnerBody(NestCandidate &NC) const {
+  Task *InnerT = NC.InnerT;
+  // Returns the variable outside of the inner body that Ptr points to, if
+  // any.
+  auto GetOuterVariable = [&](const Value *Ptr) -> const AllocaInst * {
+    const auto *AI = dyn_cast<AllocaInst>(getUnderlyingObject(Ptr));
+    if (!AI || InnerT->encloses(AI->getParent()))
+      return nullptr;
+    return AI;
+  };
+
+  SmallPtrSet<const Value *, 8> ReadObjects, WrittenObjects;
+  for (Spindle *S : depth_first<InTask<Spindle *>>(InnerT->getEntrySpindle()))
+    for (BasicBlock *BB : S->blocks())
+      for (Instruction &I : *BB) {
+        if (auto *RMW = dyn_cast<AtomicRMWInst>(&I))
+          if (isAtomicReductionUpdate(RMW) && addReduction(NC, RMW))
+            continue;
+        if (!I.mayReadOrWriteMemory() || isa<DbgInfoIntrinsic>(I))
+          continue;
+        if (auto *Load = dyn_cast<LoadInst>(&I)) {
+          ReadObjects.insert(getUnderlyingObject(Load->getPointerOperand()));
+          continue;
+        }
+        if (const Value *Ptr = getLoadStorePointerOperand(&I)) {
+          if (GetOuterVariable(Ptr))
+            return false;
+          WrittenObjects.insert(getUnderlyingObject(Ptr));
+          continue;
+        }
+        if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+          if (GetOuterVariable(RMW->getPointerOperand()))
+            return false;
+          WrittenObjects.insert(getUnderlyingObject(RMW->getPointerOperand()));
+          continue;
+        }
+        if (auto *CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+          if (GetOuterVariable(CX->getPointerOperand()))
+            return false;
+          WrittenObjects.insert(getUnderlyingObject(CX->getPointerOperand()));
+          continue;
+        }
+        auto *CB = dyn_cast<CallBase>(&I);
+        if (!CB || I.isLifetimeStartOrEnd())
+          continue;
+        if (!CB->mayWriteToMemory()) {
+          for (Value *Arg : CB->args())
+            if (Arg->getType()->isPointerTy())
+              ReadObjects.insert(getUnderlyingObject(Arg));
+          continue;
+        }
+        // Calls may only write memory through their arguments.
+        if (!CB->onlyAccessesInaccessibleMemOrArgMem()) {
+          LLVM_DEBUG(dbgs() << "Inner body calls a function that may write "
+                               "any memory: "
+                            << I << "\n");
+          return false;
+        }
+        for (Value *Arg : CB->args())
+          if (Arg->getType()->isPointerTy()) {
+            if (GetOuterVariable(Arg))
+              return false;
+            WrittenObjects.insert(getUnderlyingObject(Arg));
+          }
+      }
+
+  // The accumulated locations may not be accessed otherwise.
+  for (const LaneReduction &R : NC.Reductions) {
+    const Value *Obj = getUnderlyingObject(R.Ptr);
+    if (ReadObjects.count(Obj) || WrittenObjects.count(Obj)) {
+      LLVM_DEBUG(dbgs() << "Reduction location is also accessed: " << *R.Ptr
+                        << "\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TapirGPUNestedLoops::analyzeNest(Loop *L, NestCandidate &NC) const {
+  Task *OuterT = getTaskIfTapirLoop(L, &TI);
+  if (!OuterT || L->getSubLoops().size() != 1)
+    return false;
+  Loop *Inner = L->getSubLoops()[0];
+  Task *InnerT = getTaskIfTapirLoop(Inner, &TI);
+  if (!InnerT)
+    return false;
+
+  // A hybrid loop also runs on the host, which has no lanes, and the
+  // lanes of a group must be in the same warp.
+  TapirLoopHints OuterHints(L), InnerHints(Inner);
+  if (!isLaneMappableTarget(OuterHints) || OuterHints.getHybrid() ||
+      OuterHints.getGPULanes() || OuterHints.getThreadsPerBlock() % Lanes ||
+      InnerHints.getLoopTarget() != OuterHints.getLoopTarget() ||
+      InnerHints.getGrainsize() != 0)
+    return false;
+
+  // The inner loop is the outer body's only subtask and spawns nothing.
+  if (InnerT->getParentTask() != OuterT || OuterT->getSubTasks().size() != 1 ||
+      !InnerT->getSubTasks().empty())
+    return false;
+  auto *OuterDI = cast<DetachInst>(L->getHeader()->getTerminator());
+  if (!analyzeLoopControl(L) || !analyzeLoopControl(Inner))
+    return false;
+
+  // Nothing computed by the nest may be used after it, and nothing computed
+  // by the inner loop may be used after the inner loop.
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      for (User *U : I.users()) {
+        BasicBlock *UseBB = cast<Instruction>(U)->getParent();
+        if (!L->contains(UseBB) ||
+            (Inner->contains(BB) && !Inner->contains(UseBB)))
+          return false;
+      }
+
+  NC.Outer = L;
+  NC.Inner = Inner;
+  NC.OuterT = OuterT;
+  NC.InnerT = InnerT;
+  NC.OuterDI = OuterDI;
+
+  // The outer loop's trip count and induction variables are computed ahead
+  // of the nest.
+  SCEVExpander Exp(SE, F.getParent()->getDataLayout(), "lanes");
+  Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC) ||
+      SE.getTypeSizeInBits(BTC->getType()) > 64 ||
+      !Exp.isSafeToExpandAt(BTC, InsertPt))
+    return false;
+  for (PHINode &PN : L->getHeader()->phis()) {
+    const SCEVAddRecExpr *AR = getIVRecurrence(SE, PN, L);
+    const SCEV *Step = AR->getStepRecurrence(SE);
+    if (!Exp.isSafeToExpandAt(AR->getStart(), InsertPt) ||
+        !Exp.isSafeToExpandAt(Step, InsertPt))
+      return false;
+    // An induction variable that steps by one counts the iterations, from
+    // which the inner bounds can be computed.
+    if (!NC.OuterIteration && Step->isOne())
+      NC.OuterIteration =
+          SE.getMinusSCEV(SE.getUnknown(&PN), AR->getStart());
+  }
+
+  return analyzeOuterBody(NC) && analyzeInnerLoop(NC, Exp) &&
+         analyzeInnerBody(NC);
+}
+
+/// Emit a shuffle of the 32- or 64-bit value V with the lane whose index
+/// differs from the calling lane's in the bits of Offset.
+static Value *emitLaneShuffleXor(IRBuilder<> &B, FunctionCallee ShuffleFn,
+                                 Value *V, unsigned Offset, unsigned Width) {
+  Type *Ty = V->getType();
+  Type *Int32Ty = B.getInt32Ty();
+  unsigned Bits = Ty->getPrimitiveSizeInBits();
+  Value *IV = B.CreateBitCast(V, B.getIntNTy(Bits));
+  auto Shuffle = [&](Value *X) {
+    return B.CreateCall(ShuffleFn, {X, B.getInt32(Offset), B.getInt32(Width)});
+  };
+  if (Bits == 32)
+    return B.CreateBitCast(Shuffle(IV), Ty);
+
+  Type *Int64Ty = B.getInt64Ty();
+  Value *Lo = Shuffle(B.CreateTrunc(IV, Int32Ty));
+  Value *Hi = Shuffle(B.CreateTrunc(B.CreateLShr(IV, 32), Int32Ty));
+  Value *R = B.CreateOr(B.CreateZExt(Lo, Int64Ty),
+                        B.CreateShl(B.CreateZExt(Hi, Int64Ty), 32));
+  return B.CreateBitCast(R, Ty);
+}
+
+void TapirGPUNestedLoops::rewrite(NestCandidate &NC) {
+  Loop *Outer = NC.Outer, *Inner = NC.Inner;
+  LLVM_DEBUG(dbgs() << "Mapping Tapir loop " << Inner->getHeader()->getName()
+                    << " onto the lanes of Tapir loop "
+                    << Outer->getHeader()->getName() << "\n");
+
+  LLVMContext &Ctx = F.getContext();
+  Module &M = *F.getParent();
+  BasicBlock *Preheader = Outer->getLoopPreheader();
+  BasicBlock *OldHeader = Outer->getHeader();
+  BasicBlock *OldLatch = Outer->getLoopLatch();
+  BasicBlock *Exit = Outer->getExitBlock();
+  BasicBlock *OuterEntry = NC.OuterDI->getDetached();
+  BasicBlock *InnerPreheader = Inner->getLoopPreheader();
+  BasicBlock *InnerHeader = Inner->getHeader();
+  BasicBlock *InnerLatch = Inner->getLoopLatch();
+  BasicBlock *InnerExit = Inner->getExitBlock();
+  auto *InnerDI = cast<DetachInst>(InnerHeader->getTerminator());
+  BasicBlock *InnerEntry = InnerDI->getDetached();
+  auto *InnerSR = cast<Instruction>(InnerDI->getSyncRegion());
+  Value *SyncReg = NC.OuterDI->getSyncRegion();
+  MDNode *LoopID = OldLatch->getTerminator()->getMetadata(LLVMContext::MD_loop);
+  Type *Ty = Type::getInt64Ty(Ctx);
+
+  // Compute the trip counts, and the starts and steps of the induction
+  // variables, ahead of each loop.
+  Instruction *InsertPt = Preheader->getTerminator();
+  Instruction *InnerInsertPt = InnerPreheader->getTerminator();
+  SCEVExpander Exp(SE, M.getDataLayout(), "lanes");
+  const SCEV *BTC = SE.getBackedgeTakenCount(Outer);
+  Value *OuterTC = Exp.expandCodeFor(
+      SE.getAddExpr(SE.getZeroExtendExpr(BTC, Ty), SE.getOne(Ty),
+                    SCEV::FlagNUW),
+      Ty, InsertPt);
+  struct IVInfo {
+    PHINode *PN;
+    Value *Start, *Step;
+  };
+  SmallVector<IVInfo, 2> OuterIVs, InnerIVs;
+  for (PHINode &PN : OldHeader->phis()) {
+    const SCEVAddRecExpr *AR = getIVRecurrence(SE, PN, Outer);
+    OuterIVs.push_back(
+        {&PN, Exp.expandCodeFor(AR->getStart(), PN.getType(), InsertPt),
+         Exp.expandCodeFor(AR->getStepRecurrence(SE), PN.getType(),
+                           InsertPt)});
+  }
+  Value *InnerTC = Exp.expandCodeFor(NC.InnerTC, Ty, InnerInsertPt);
+  for (const NestCandidate::IVInfo &Info : NC.InnerIVs)
+    InnerIVs.push_back(
+        {Info.PN,
+         Exp.expandCodeFor(Info.Start, Info.PN->getType(), InnerInsertPt),
+         Exp.expandCodeFor(Info.Step, Info.PN->getType(), InnerInsertPt)});
+  auto Recompute = [](IRBuilder<> &B, ArrayRef<IVInfo> IVs, Value *Idx,
+                      BasicBlock *Header, BasicBlock *Latch) {
+    for (const IVInfo &Info : IVs) {
+      Value *V = B.CreateZExtOrTrunc(Idx, Info.PN->getType());
+      V = B.CreateAdd(Info.Start, B.CreateMul(V, Info.Step));
+      Info.PN->replaceUsesWithIf(V, [&](Use &U) {
+        BasicBlock *UseBB = cast<Instruction>(U.getUser())->getParent();
+        return UseBB != Header && UseBB != Latch;
+      });
+    }
+  };
+
+  // Build the loop over the lanes of all outer iterations in front of the
+  // old outer header.
+  IRBuilder<> B(InsertPt);
+  Value *Zero = ConstantInt::get(Ty, 0);
+  Value *TC = B.CreateMul(OuterTC, ConstantInt::get(Ty, Lanes), "lanes.tc",
+                          /*HasNUW=*/true);
+  BasicBlock *Header = BasicBlock::Create(Ctx, "lanes.header", &F, OldHeader);
+  BasicBlock *Body = BasicBlock::Create(Ctx, "lanes.body", &F, OldHeader);
+  BasicBlock *Latch = BasicBlock::Create(Ctx, "lanes.latch", &F, OldHeader);
+  B.CreateCondBr(B.CreateICmpNE(TC, Zero), Header, Exit);
+  InsertPt->eraseFromParent();
+
+  B.SetInsertPoint(Header);
+  PHINode *IV = B.CreatePHI(Ty, 2, "lanes.iv");
+  IV->addIncoming(Zero, Preheader);
+  DetachInst::Create(Body, Latch, SyncReg, Header);
+
+  B.SetInsertPoint(Latch);
+  Value *IVNext = B.CreateAdd(IV, ConstantInt::get(Ty, 1), "lanes.iv.next",
+                              /*HasNUW=*/true, /*HasNSW=*/true);
+  IV->addIncoming(IVNext, Latch);
+  BranchInst *BackEdge =
+      B.CreateCondBr(B.CreateICmpEQ(IVNext, TC), Exit, Header);
+  StringRef HintName = "tapir.loop.kitsune.gpu.lanes";
+  Metadata *HintMDs[] = {MDString::get(Ctx, HintName),
+                         ConstantAsMetadata::get(B.getInt32(Lanes))};
+  BackEdge->setMetadata(
+      LLVMContext::MD_loop,
+      makePostTransformationMetadata(Ctx, LoopID, {HintName},
+                                     {MDNode::get(Ctx, HintMDs)}));
+
+  // Each iteration is one lane of an outer iteration.
+  B.SetInsertPoint(Body);
+  for (BasicBlock *BB : {OuterEntry, InnerEntry})
+    for (Instruction &I : make_early_inc_range(*BB))
+      if (auto *AI = dyn_cast<AllocaInst>(&I))
+        if (isa<Constant>(AI->getArraySize()))
+          AI->moveBefore(*Body, Body->end());
+  Value *OuterIdx =
+      B.CreateLShr(IV, ConstantInt::get(Ty, Log2_32(Lanes)), "lanes.outer");
+  Value *Lane =
+      B.CreateAnd(IV, ConstantInt::get(Ty, Lanes - 1), "lanes.lane");
+  Recompute(B, OuterIVs, OuterIdx, OldHeader, OldLatch);
+
+  // Each lane accumulates its share of the reductions privately.
+  SmallVector<AllocaInst *, 2> Accs;
+  for (LaneReduction &R : NC.Reductions) {
+    AllocaInst *Acc = B.CreateAlloca(R.Ty, nullptr, "lanes.acc");
+    B.CreateStore(getAtomicReductionIdentity(R.Op, R.Ty), Acc);
+    Accs.push_back(Acc);
+  }
+  B.CreateBr(OuterEntry);
+  for (unsigned I = 0, E = NC.Reductions.size(); I != E; ++I)
+    for (AtomicRMWInst *RMW : NC.Reductions[I].Updates) {
+      IRBuilder<> UB(RMW);
+      Value *Old = UB.CreateLoad(NC.Reductions[I].Ty, Accs[I]);
+      UB.CreateStore(emitAtomicReductionOp(UB, NC.Reductions[I].Op, Old,
+                                           RMW->getValOperand()),
+                     Accs[I]);
+    }
+
+  for (ReattachInst *RI : getReattaches(Outer))
+    RI->setSuccessor(0, Latch);
+
+  // The lanes of an outer iteration stride through the inner iterations.
+  BasicBlock *LaneHeader =
+      BasicBlock::Create(Ctx, "lanes.inner.header", &F, InnerEntry);
+  BasicBlock *LaneLatch =
+      BasicBlock::Create(Ctx, "lanes.inner.latch", &F, InnerEntry);
+  B.SetInsertPoint(InnerInsertPt);
+  B.CreateCondBr(B.CreateICmpULT(Lane, InnerTC), LaneHeader, InnerExit);
+  InnerInsertPt->eraseFromParent();
+
+  B.SetInsertPoint(LaneHeader);
+  PHINode *LaneIV = B.CreatePHI(Ty, 2, "lanes.inner.iv");
+  LaneIV->addIncoming(Lane, InnerPreheader);
+  Recompute(B, InnerIVs, LaneIV, InnerHeader, InnerLatch);
+  B.CreateBr(InnerEntry);
+
+  for (ReattachInst *RI : getReattaches(Inner)) {
+    BranchInst::Create(LaneLatch, RI);
+    RI->eraseFromParent();
+  }
+  B.SetInsertPoint(LaneLatch);
+  Value *LaneIVNext = B.CreateAdd(LaneIV, ConstantInt::get(Ty, Lanes),
+                                  "lanes.inner.iv.next", /*HasNUW=*/true);
+  LaneIV->addIncoming(LaneIVNext, LaneLatch);
+  B.CreateCondBr(B.CreateICmpULT(LaneIVNext, InnerTC), LaneHeader, InnerExit);
+
+  // At the inner sync the lanes combine their reductions and lane 0 goes on
+  // with the rest of the outer body.
+  FunctionCallee LaneSyncFn = M.getOrInsertFunction(
+      tapir::GPULaneSyncName,
+      AttributeList::get(Ctx, AttributeList::FunctionIndex,
+                         {Attribute::Convergent, Attribute::NoUnwind}),
+      B.getVoidTy(), B.getInt32Ty());
+  AttrBuilder ShuffleAttrs(Ctx);
+  ShuffleAttrs.addAttribute(Attribute::Convergent)
+      .addAttribute(Attribute::NoUnwind)
+      .addMemoryAttr(MemoryEffects::none());
+  FunctionCallee ShuffleFn = M.getOrInsertFunction(
+      tapir::GPULaneShuffleXorName,
+      AttributeList::get(Ctx, AttributeList::FunctionIndex, ShuffleAttrs),
+      B.getInt32Ty(), B.getInt32Ty(), B.getInt32Ty(), B.getInt32Ty());
+
+  SyncInst *Sync = NC.Sync;
+  BasicBlock *SyncBB = Sync->getParent();
+  BasicBlock *Cont = Sync->getSuccessor(0);
+  B.SetInsertPoint(Sync);
+  B.CreateCall(LaneSyncFn, {B.getInt32(Lanes)});
+  SmallVector<Value *, 2> Partials;
+  for (unsigned I = 0, E = NC.Reductions.size(); I != E; ++I) {
+    const LaneReduction &R = NC.Reductions[I];
+    Value *V = B.CreateLoad(R.Ty, Accs[I]);
+    for (unsigned Offset = Lanes / 2; Offset > 0; Offset /= 2)
+      V = emitAtomicReductionOp(
+          B, R.Op, V, emitLaneShuffleXor(B, ShuffleFn, V, Offset, Lanes));
+    Partials.push_back(V);
+  }
+  BasicBlock *Lead =
+      BasicBlock::Create(Ctx, "lanes.lead", &F, SyncBB->getNextNode());
+  BasicBlock *Skip =
+      BasicBlock::Create(Ctx, "lanes.skip", &F, Lead->getNextNode());
+  B.CreateCondBr(B.CreateICmpEQ(Lane, Zero), Lead, Skip);
+  Sync->eraseFromParent();
+
+  B.SetInsertPoint(Lead);
+  for (unsigned I = 0, E = NC.Reductions.size(); I != E; ++I) {
+    LaneReduction &R = NC.Reductions[I];
+    AtomicRMWInst *First = R.Updates.front();
+    if (R.Private) {
+      // Only this lane updates the outer body's own variable.
+      Value *Old = B.CreateLoad(R.Ty, R.Ptr);
+      B.CreateStore(emitAtomicReductionOp(B, R.Op, Old, Partials[I]), R.Ptr);
+    } else {
+      B.CreateAtomicRMW(R.Op, R.Ptr, Partials[I], First->getAlign(),
+                        First->getOrdering(), First->getSyncScopeID());
+    }
+    for (AtomicRMWInst *RMW : R.Updates)
+      RMW->eraseFromParent();
+    ++NumLaneReductions;
+  }
+  B.CreateBr(Cont);
+  Cont->replacePhiUsesWith(SyncBB, Lead);
+  ReattachInst::Create(Latch, SyncReg, Skip);
+
+  // Remove the control of the old loops, which is no longer reachable, and
+  // the inner sync region.
+  for (User *U : make_early_inc_range(InnerSR->users()))
+    if (isSyncUnwind(cast<Instruction>(U)))
+      cast<Instruction>(U)->eraseFromParent();
+  DeleteDeadBlocks({OldHeader, OldLatch, InnerHeader, InnerLatch});
+  InnerSR->eraseFromParent();
+  ++NumMapped;
+}
+
+bool TapirGPUNestedLoops::run() {
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    NestCandidate NC;
+    if (!analyzeNest(L, NC))
+      continue;
+    rewrite(NC);
+    return true;
+  }
+  return false;
+}
+
+PreservedAnalyses TapirGPUNestedLoopsPass::run(Function &F,
+                                               FunctionAnalysisManager &AM) {
+  unsigned Lanes = NestedLanes;
+  if (!isPowerOf2_32(Lanes) || Lanes < 2 || Lanes > 32)
+    return PreservedAnalyses::all();
+
+  bool Changed = false;
+  // Each rewrite removes a pair of loops; recompute the analyses and look
+  // for more.
+  while (true) {
+    auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    auto &LI = AM.getResult<LoopAnalysis>(F);
+    auto &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+    auto &TI = AM.getResult<TaskAnalysis>(F);
+    if (!TapirGPUNestedLoops(F, DT, LI, SE, TI, Lanes).run())
+      break;
+    Changed = true;
+    AM.invalidate(F, PreservedAnalyses::none());
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
@@ -18,15 +18,53 @@
 //
 //===----------------------------------------------------------------------===//
 #include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Constant.h"
+#include "llvm/IR/ConstantRange.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Argument.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/IR/StructuralHash.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+#include <condition_variable>
+#include <mutex>
 #include <set>
 
 using namespace llvm;
@@ -67,6 +105,61 @@ Constant *createConstantStr(const std::string &Str, Module &M,
   return CS;
 }
 
+SmallVector<std::pair<Function *, Function *>, 8>
+findIdenticalFunctions(ArrayRef<Function *> Fns) {
+  SmallVector<std::pair<Function *, Function *>, 8> Identical;
+  GlobalNumberState GlobalNumbers;
+  // Functions with different hashes are never identical.
+  MapVector<IRHash, SmallVector<Function *, 2>> Candidates;
+  for (Function *F : Fns)
+    if (!F->isDeclaration())
+      Candidates[StructuralHash(*F)].push_back(F);
+  for (auto &[Hash, Group] : Candidates) {
+    SmallVector<Function *, 2> Distinct;
+    for (Function *F : Group) {
+      auto It = find_if(Distinct, [&](Function *D) {
+        return FunctionComparator(D, F, &GlobalNumbers).compare() == 0;
+      });
+      if (It == Distinct.end())
+        Distinct.push_back(F);
+      else
+        Identical.push_back({F, *It});
+    }
+  }
+  return Identical;
+}
+
+GlobalVariable *renameKernelReferences(Module &M, StringRef From,
+                                      StringRef To) {
+  GlobalVariable *ToGV = nullptr;
+  SmallVector<GlobalVariable *, 4> FromGVs;
+  for (GlobalVariable &GV : M.globals()) {
+    auto *Str = GV.hasPrivateLinkage() && GV.isConstant() &&
+                        GV.hasInitializer()
+                    ? dyn_cast<ConstantDataArray>(GV.getInitializer())
+                    : nullptr;
+    if (!Str || !Str->isCString())
+      continue;
+    if (Str->getAsCString() == From)
+      FromGVs.push_back(&GV);
+    else if (!ToGV && Str->getAsCString() == To)
+      ToGV = &GV;
+  }
+  if (FromGVs.empty())
+    return nullptr;
+  if (!ToGV) {
+    Constant *ToCS = ConstantDataArray::getString(M.getContext(), To);
+    ToGV = new GlobalVariable(M, ToCS->getType(), true,
+                              GlobalValue::PrivateLinkage, ToCS, "kern.name");
+    ToGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  }
+  for (GlobalVariable *GV : FromGVs) {
+    GV->replaceAllUsesWith(ToGV);
+    GV->eraseFromParent();
+  }
+  return ToGV;
+}
+
 // Adapted from Transforms/Utils/ModuleUtils.cpp
 void appendToGlobalCtors(Module &M, Constant *C, int Priority, Constant *Data) {
   IRBuilder<> IRB(M.getContext());
@@ -110,15 +203,34 @@ void appendToGlobalCtors(Module &M, Constant *C, int Priority, Constant *Data) {
                            "llvm.global_ctors");
 }
 
+Constant *getKernelSourceLocation(const Loop *L, Module &M,
+                                  const std::string &Name) {
+  PointerType *PtrTy = PointerType::getUnqual(M.getContext());
+  DebugLoc Loc = L->getStartLoc();
+  if (!Loc)
+    return ConstantPointerNull::get(PtrTy);
+  std::string Str = (Loc->getFilename() + ":" + Twine(Loc.getLine()) + ":" +
+                     Twine(Loc.getCol()))
+                        .str();
+  return createConstantStr(Str, M, Name);
+}
+
 void getKernelInstructionMix(const Function *F, KernelInstMixData &InstMix) {
   InstMix.num_memory_ops = 0;
   InstMix.num_flops = 0;
   InstMix.num_iops = 0;
+  InstMix.num_memory_bytes = 0;
 
+  const DataLayout &DL = F->getParent()->getDataLayout();
   std::set<const Function *> CalledFuncs;
   for (auto I = inst_begin(F); I != inst_end(F); I++) {
     if (I->mayReadOrWriteMemory()) {
       InstMix.num_memory_ops++;
+      if (auto *LI = dyn_cast<LoadInst>(&*I))
+        InstMix.num_memory_bytes += DL.getTypeStoreSize(LI->getType());
+      else if (auto *SI = dyn_cast<StoreInst>(&*I))
+        InstMix.num_memory_bytes +=
+            DL.getTypeStoreSize(SI->getValueOperand()->getType());
     } else if (I->isBinaryOp()) {
       Type *Ty = I->getType();
       if (Ty->isHalfTy() || Ty->isFloatTy() || Ty->isDoubleTy() ||
@@ -135,7 +247,8 @@ void getKernelInstructionMix(const Function *F, KernelInstMixData &InstMix) {
         InstMix.num_iops++;
     } else {
       if (auto CI = dyn_cast<CallInst>(&*I)) {
-        CalledFuncs.insert(CI->getCalledFunction());
+        if (CI->getCalledFunction())
+          CalledFuncs.insert(CI->getCalledFunction());
       }
     }
   }
@@ -146,7 +259,2146 @@ void getKernelInstructionMix(const Function *F, KernelInstMixData &InstMix) {
     InstMix.num_memory_ops += localInstMix.num_memory_ops;
     InstMix.num_flops += localInstMix.num_flops;
     InstMix.num_iops += localInstMix.num_iops;
+    InstMix.num_memory_bytes += localInstMix.num_memory_bytes;
+  }
+}
+
+static KernelArgAccess getAccessFromAttrs(const AttributeSet &Attrs,
+                                          KernelArgAccess Default) {
+  if (Attrs.hasAttribute("kitsune.readonly"))
+    return KernelArgReadOnly;
+  if (Attrs.hasAttribute("kitsune.writeonly"))
+    return KernelArgWriteOnly;
+  if (Attrs.hasAttribute("kitsune.readwrite"))
+    return KernelArgReadWrite;
+  return Default;
+}
+
+bool isReadOnlyKernelArg(const Argument *A) {
+  if (!A->getType()->isPointerTy())
+    return false;
+  if (A->onlyReadsMemory())
+    return true;
+
+  // Walk the (transitive) uses of the pointer.  Anything we do not
+  // recognize is assumed to potentially write through it.
+  SmallVector<const Value *, 16> Worklist;
+  std::set<const Value *> Visited;
+  Worklist.push_back(A);
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    if (!Visited.insert(V).second)
+      continue;
+    for (const Use &U : V->uses()) {
+      const User *Usr = U.getUser();
+      if (isa<LoadInst>(Usr))
+        continue;
+      if (isa<GetElementPtrInst>(Usr) || isa<BitCastInst>(Usr) ||
+          isa<AddrSpaceCastInst>(Usr) || isa<PHINode>(Usr) ||
+          isa<SelectInst>(Usr)) {
+        Worklist.push_back(Usr);
+        continue;
+      }
+      if (const auto *CI = dyn_cast<CallBase>(Usr)) {
+        if (CI->isArgOperand(&U)) {
+          unsigned ArgNo = CI->getArgOperandNo(&U);
+          if (CI->onlyReadsMemory(ArgNo) && CI->doesNotCapture(ArgNo))
+            continue;
+        }
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+bool addReadOnlyKernelArgAttrs(Argument *KernelArg, const Value *V) {
+  if (!V->getType()->isPointerTy() || !KernelArg->getType()->isPointerTy() ||
+      getKernelArgAccess(V) != KernelArgReadOnly ||
+      !isReadOnlyKernelArg(KernelArg))
+    return false;
+  KernelArg->addAttr(Attribute::NoAlias);
+  KernelArg->addAttr(Attribute::ReadOnly);
+  return true;
+}
+
+// Return true if the memory that the given pointer argument points to
+// is never accessed within its function: the pointer (and the addresses
+// computed from it) is only compared against constants.
+static bool isUnaccessedKernelArg(const Argument *A) {
+  SmallVector<const Value *, 16> Worklist;
+  SmallPtrSet<const Value *, 16> Visited;
+  Worklist.push_back(A);
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    if (!Visited.insert(V).second)
+      continue;
+    for (const Use &U : V->uses()) {
+      const User *Usr = U.getUser();
+      if (isa<GetElementPtrInst>(Usr) || isa<BitCastInst>(Usr) ||
+          isa<AddrSpaceCastInst>(Usr) || isa<PHINode>(Usr) ||
+          isa<SelectInst>(Usr)) {
+        Worklist.push_back(Usr);
+        continue;
+      }
+      if (const auto *Cmp = dyn_cast<ICmpInst>(Usr))
+        if (isa<Constant>(Cmp->getOperand(1 - U.getOperandNo())))
+          continue;
+      return false;
+    }
+  }
+  return true;
+}
+
+KernelArgAccess refineKernelArgAccess(KernelArgAccess Access,
+                                      const Argument *A) {
+  if (!A->getType()->isPointerTy())
+    return Access;
+  if (isUnaccessedKernelArg(A))
+    return KernelArgNone;
+  if (Access == KernelArgReadWrite && isReadOnlyKernelArg(A))
+    return KernelArgReadOnly;
+  return Access;
+}
+
+KernelArgAccess getKernelArgAccess(const Value *V, const Argument *KernelArg) {
+  if (!V->getType()->isPointerTy())
+    return KernelArgReadWrite;
+
+  // Without any user-provided attributes, fall back to what we can
+  // tell from the kernel's use of the argument.
+  KernelArgAccess Access = KernelArgReadWrite;
+  if (KernelArg && isReadOnlyKernelArg(KernelArg))
+    Access = KernelArgReadOnly;
+
+  // The attributes are placed on the parameters of the function that
+  // contains the parallel loop.  Look through any address computations
+  // (e.g., `&a[offset]`) to find the parameter the argument refers to.
+  const Argument *A = dyn_cast<Argument>(getUnderlyingObject(V));
+  if (!A)
+    return Access;
+
+  const Function *F = A->getParent();
+  Access = getAccessFromAttrs(F->getAttributes().getFnAttrs(), Access);
+  return getAccessFromAttrs(F->getAttributes().getParamAttrs(A->getArgNo()),
+                            Access);
+}
+
+// Return true if the given instruction might write the memory of the
+// underlying object Obj.  Only stores between two distinct identified
+// objects are known not to conflict; every other write is assumed to.
+static bool mayWriteUnderlyingObject(const Instruction *I, const Value *Obj) {
+  if (!I->mayWriteToMemory() || isa<DbgInfoIntrinsic>(I))
+    return false;
+  if (const auto *SI = dyn_cast<StoreInst>(I)) {
+    const Value *StObj = getUnderlyingObject(SI->getPointerOperand());
+    if (StObj != Obj && isIdentifiedObject(Obj) && isIdentifiedObject(StObj))
+      return false;
+  }
+  return true;
+}
+
+Instruction *getEarliestPrefetchPoint(Value *Ptr, Instruction *Launch,
+                                      unsigned MaxInsts) {
+  const Value *Obj = getUnderlyingObject(Ptr);
+  const Instruction *Def = dyn_cast<Instruction>(Ptr);
+  Instruction *Point = Launch;
+  BasicBlock *BB = Launch->getParent();
+  BasicBlock::iterator It = Launch->getIterator();
+  SmallPtrSet<const BasicBlock *, 8> Visited;
+  Visited.insert(BB);
+  unsigned NumInsts = 0;
+
+  while (true) {
+    while (It != BB->begin()) {
+      Instruction *I = &*std::prev(It);
+      if (I == Def || isa<PHINode>(I) || I->isEHPad() ||
+          mayWriteUnderlyingObject(I, Obj) || ++NumInsts > MaxInsts)
+        return Point == Launch ? nullptr : Point;
+      --It;
+      Point = I;
+    }
+
+    // Continue into the predecessor only if it unconditionally branches
+    // to this block (and only this block reaches it).
+    BasicBlock *Pred = BB->getUniquePredecessor();
+    if (!Pred || !Visited.insert(Pred).second)
+      break;
+    auto *Br = dyn_cast<BranchInst>(Pred->getTerminator());
+    if (!Br || !Br->isUnconditional())
+      break;
+    BB = Pred;
+    It = Br->getIterator();
+    Point = Br;
+  }
+  return Point == Launch ? nullptr : Point;
+}
+
+// Collect the host-side reads of the memory of the underlying object
+// Obj into Reads.  Returns false if the object escapes (e.g., it is
+// stored to memory), in which case the reads can not all be found.
+static bool getHostReads(const Value *Obj,
+                         SmallVectorImpl<const Instruction *> &Reads) {
+  SmallVector<const Value *, 16> Worklist;
+  SmallPtrSet<const Value *, 16> Visited;
+  Worklist.push_back(Obj);
+  Visited.insert(Obj);
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      const auto *I = dyn_cast<Instruction>(U);
+      if (!I)
+        continue;
+      if (isa<GetElementPtrInst, CastInst, PHINode, SelectInst>(I)) {
+        if (Visited.insert(I).second)
+          Worklist.push_back(I);
+      } else if (isa<LoadInst>(I)) {
+        Reads.push_back(I);
+      } else if (const auto *SI = dyn_cast<StoreInst>(I)) {
+        if (SI->getValueOperand() == V)
+          return false;
+      } else if (const auto *CB = dyn_cast<CallBase>(I)) {
+        // The runtime's calls (kernel launches, prefetches, ...) do not
+        // read the data on the host.
+        const Function *Callee = CB->getCalledFunction();
+        if (Callee && Callee->getName().starts_with("__kit"))
+          continue;
+        if (Callee && Callee->isIntrinsic() && !isa<MemTransferInst>(CB))
+          continue;
+        Reads.push_back(I);
+      } else if (!isa<ICmpInst>(I)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Instruction *getInvariantLaunchArgPoint(Value *V, Instruction *Launch,
+                                        const DominatorTree &DT,
+                                        const LoopInfo &LI) {
+  Instruction *StorePt = nullptr;
+  for (Loop *L = LI.getLoopFor(Launch->getParent()); L;
+       L = L->getParentLoop()) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Preheader || !L->isLoopInvariant(V))
+      break;
+    Instruction *Term = Preheader->getTerminator();
+    if (auto *I = dyn_cast<Instruction>(V))
+      if (!DT.dominates(I, Term))
+        break;
+    StorePt = Term;
+  }
+  return StorePt;
+}
+
+bool isReadOnHostAfterLaunch(Value *Ptr, Instruction *Launch,
+                             ArrayRef<Instruction *> OtherLaunches,
+                             const DominatorTree &DT, const LoopInfo &LI,
+                             Loop *&ExitLoop) {
+  ExitLoop = nullptr;
+  const Value *Obj = getUnderlyingObject(Ptr);
+  SmallVector<const Instruction *, 16> Reads;
+  if (!getHostReads(Obj, Reads))
+    return false;
+
+  // Paths through another launch that uses the data move it back to the
+  // device before the host reads it.  A later launch in the same block
+  // leaves only the reads in between.
+  BasicBlock *LaunchBB = Launch->getParent();
+  Instruction *Next = nullptr;
+  SmallPtrSet<BasicBlock *, 8> Exclusion;
+  for (Instruction *Other : OtherLaunches) {
+    if (Other->getParent() != LaunchBB)
+      Exclusion.insert(Other->getParent());
+    else if (Launch->comesBefore(Other) &&
+             (!Next || Other->comesBefore(Next)))
+      Next = Other;
+  }
+
+  SmallVector<const Instruction *, 16> AfterReads;
+  for (const Instruction *Read : Reads) {
+    if (Read->getFunction() != Launch->getFunction())
+      continue;
+    bool After;
+    if (Next)
+      After = Read->getParent() == LaunchBB && Launch->comesBefore(Read) &&
+              Read->comesBefore(Next);
+    else
+      After = isPotentiallyReachable(Launch, Read, &Exclusion, &DT, &LI);
+    if (After)
+      AfterReads.push_back(Read);
+  }
+  if (AfterReads.empty())
+    return false;
+
+  for (Loop *L = LI.getLoopFor(Launch->getParent()); L;
+       L = L->getParentLoop()) {
+    if (any_of(AfterReads, [L](const Instruction *Read) {
+          return L->contains(Read->getParent());
+        }))
+      break;
+    if (!L->hasDedicatedExits())
+      break;
+    ExitLoop = L;
+  }
+  return true;
+}
+
+// Shuffle a 32- or 64-bit value down the warp.  The target's shuffle
+// moves 32-bit values so 64-bit values take two shuffles.
+static Value *emitShuffleDown(IRBuilder<> &B, const GPUReductionHooks &Hooks,
+                              Value *V, Value *Offset, Value *Mask) {
+  Type *Ty = V->getType();
+  Type *Int32Ty = B.getInt32Ty();
+  unsigned Bits = Ty->getPrimitiveSizeInBits();
+  Value *IV = B.CreateBitCast(V, B.getIntNTy(Bits));
+  if (Bits == 32)
+    return B.CreateBitCast(Hooks.ShuffleDown(B, IV, Offset, Mask), Ty);
+
+  Type *Int64Ty = B.getInt64Ty();
+  Value *Lo = Hooks.ShuffleDown(B, B.CreateTrunc(IV, Int32Ty), Offset, Mask);
+  Value *Hi = Hooks.ShuffleDown(
+      B, B.CreateTrunc(B.CreateLShr(IV, 32), Int32Ty), Offset, Mask);
+  Value *R = B.CreateOr(B.CreateZExt(Lo, Int64Ty),
+                        B.CreateShl(B.CreateZExt(Hi, Int64Ty), 32));
+  return B.CreateBitCast(R, Ty);
+}
+
+// Combine the values held by the Width lanes of a warp.  The result is
+// valid in lane 0.
+static Value *emitWarpReduction(IRBuilder<> &B, const GPUReductionHooks &Hooks,
+                                AtomicRMWInst::BinOp Op, Value *V, Value *Lane,
+                                Value *Width, Value *Mask) {
+  for (unsigned Offset = Hooks.WarpSize / 2; Offset > 0; Offset /= 2) {
+    Value *Off = B.getInt32(Offset);
+    Value *Other = emitShuffleDown(B, Hooks, V, Off, Mask);
+    Value *HasOther = B.CreateICmpULT(B.CreateAdd(Lane, Off), Width);
+    V = B.CreateSelect(HasOther, emitAtomicReductionOp(B, Op, V, Other), V);
+  }
+  return V;
+}
+
+static GlobalVariable *createReductionBuffer(Module &M, Type *Ty, unsigned N,
+                                             unsigned AddrSpace,
+                                             const Twine &Name) {
+  ArrayType *BufTy = ArrayType::get(Ty, N);
+  auto *Buf = new GlobalVariable(M, BufTy, false, GlobalValue::InternalLinkage,
+                                 UndefValue::get(BufTy), Name, nullptr,
+                                 GlobalValue::NotThreadLocal, AddrSpace);
+  Buf->setAlignment(M.getDataLayout().getABITypeAlign(Ty));
+  return Buf;
+}
+
+SmallVector<GPUReductionArg, 4>
+lowerGPUReductions(Function &F, const GPUReductionHooks &Hooks) {
+  SmallVector<GPUReductionArg, 4> Reductions;
+
+  // Find the arguments that are only used by matching atomic updates.
+  SmallVector<std::pair<Argument *, SmallVector<AtomicRMWInst *, 4>>, 4>
+      Candidates;
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isPointerTy() || A.use_empty())
+      continue;
+    SmallVector<AtomicRMWInst *, 4> Updates;
+    bool IsReduction = true;
+    for (User *U : A.users()) {
+      auto *RMW = dyn_cast<AtomicRMWInst>(U);
+      if (!RMW || RMW->getPointerOperand() != &A ||
+          !isAtomicReductionUpdate(RMW) ||
+          (!Updates.empty() &&
+           (RMW->getOperation() != Updates[0]->getOperation() ||
+            RMW->getType() != Updates[0]->getType()))) {
+        IsReduction = false;
+        break;
+      }
+      Updates.push_back(RMW);
+    }
+    if (IsReduction)
+      Candidates.push_back({&A, Updates});
+  }
+  if (Candidates.empty())
+    return Reductions;
+
+  // The block-wide combine uses barriers, so every thread has to reach
+  // it.  Only kernels with a single return are handled.
+  ReturnInst *Ret = nullptr;
+  for (BasicBlock &BB : F)
+    if (auto *RI = dyn_cast_or_null<ReturnInst>(BB.getTerminator())) {
+      if (Ret)
+        return Reductions;
+      Ret = RI;
+    }
+  if (!Ret)
+    return Reductions;
+
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  IRBuilder<> EntryB(&*F.getEntryBlock().getFirstInsertionPt());
+  for (auto &C : Candidates) {
+    Argument *A = C.first;
+    AtomicRMWInst *First = C.second.front();
+    AtomicRMWInst::BinOp Op = First->getOperation();
+    Type *Ty = First->getType();
+    Align UpdateAlign = First->getAlign();
+    AtomicOrdering Ordering = First->getOrdering();
+    SyncScope::ID SSID = First->getSyncScopeID();
+    Constant *Identity = getAtomicReductionIdentity(Op, Ty);
+
+    // Each thread accumulates its own updates...
+    AllocaInst *Acc = EntryB.CreateAlloca(Ty, DL.getAllocaAddrSpace(), nullptr,
+                                          A->getName() + ".red");
+    EntryB.CreateStore(Identity, Acc);
+    for (AtomicRMWInst *RMW : C.second) {
+      IRBuilder<> B(RMW);
+      B.CreateStore(emitAtomicReductionOp(B, Op, B.CreateLoad(Ty, Acc),
+                                          RMW->getValOperand()),
+                    Acc);
+      RMW->eraseFromParent();
+    }
+
+    // ...that are then combined across the block before the kernel
+    // returns.
+    IRBuilder<> B(Ret);
+    Value *V = B.CreateLoad(Ty, Acc);
+    Value *Tid = Hooks.ThreadIdx(B);
+    Value *BlockDim = Hooks.BlockDim(B);
+    Value *Zero = B.getInt32(0);
+    Instruction *Then;
+    if (Hooks.WarpSize) {
+      // Reduce within each warp, gather the per-warp values in shared
+      // memory and let the first warp reduce those.  The last warp of
+      // a block may be partially populated.
+      unsigned W = Hooks.WarpSize;
+      Value *Lane = B.CreateAnd(Tid, W - 1, "red.lane");
+      Value *Warp = B.CreateLShr(Tid, Log2_32(W), "red.warp");
+      Value *Width = B.CreateBinaryIntrinsic(
+          Intrinsic::umin,
+          B.CreateSub(BlockDim, B.CreateShl(Warp, Log2_32(W))),
+          B.getInt32(W));
+      Value *Mask = B.CreateSelect(
+          B.CreateICmpEQ(Width, B.getInt32(W)), B.getInt32(~0U),
+          B.CreateSub(B.CreateShl(B.getInt32(1), Width), B.getInt32(1)));
+      V = emitWarpReduction(B, Hooks, Op, V, Lane, Width, Mask);
+
+      GlobalVariable *Buf =
+          createReductionBuffer(M, Ty, Hooks.MaxThreadsPerBlock / W,
+                                Hooks.SharedAddrSpace, F.getName() + ".red");
+      Type *BufTy = Buf->getValueType();
+      Value *IsLane0 = B.CreateICmpEQ(Lane, Zero);
+      Then = SplitBlockAndInsertIfThen(IsLane0, Ret, false);
+      B.SetInsertPoint(Then);
+      B.CreateStore(V, B.CreateInBoundsGEP(BufTy, Buf, {Zero, Warp}));
+      B.SetInsertPoint(Ret);
+      Hooks.Barrier(B);
+
+      Then = SplitBlockAndInsertIfThen(B.CreateICmpEQ(Warp, Zero), Ret, false);
+      B.SetInsertPoint(Then);
+      Value *NumWarps =
+          B.CreateLShr(B.CreateAdd(BlockDim, B.getInt32(W - 1)), Log2_32(W));
+      Value *WV = B.CreateSelect(
+          B.CreateICmpULT(Lane, NumWarps),
+          B.CreateLoad(Ty, B.CreateInBoundsGEP(BufTy, Buf, {Zero, Lane})),
+          Identity);
+      V = emitWarpReduction(B, Hooks, Op, WV, Lane, Width, Mask);
+      Then = SplitBlockAndInsertIfThen(IsLane0, Then, false);
+    } else {
+      // Reduce through shared memory, halving the number of active
+      // threads at each step.
+      GlobalVariable *Buf =
+          createReductionBuffer(M, Ty, Hooks.MaxThreadsPerBlock,
+                                Hooks.SharedAddrSpace, F.getName() + ".red");
+      Type *BufTy = Buf->getValueType();
+      B.CreateStore(V, B.CreateInBoundsGEP(BufTy, Buf, {Zero, Tid}));
+      Hooks.Barrier(B);
+      for (unsigned S = Hooks.MaxThreadsPerBlock / 2; S > 0; S /= 2) {
+        Value *Other = B.CreateAdd(Tid, B.getInt32(S));
+        Value *HasOther = B.CreateAnd(B.CreateICmpULT(Tid, B.getInt32(S)),
+                                      B.CreateICmpULT(Other, BlockDim));
+        Then = SplitBlockAndInsertIfThen(HasOther, Ret, false);
+        IRBuilder<> TB(Then);
+        Value *Mine = TB.CreateInBoundsGEP(BufTy, Buf, {Zero, Tid});
+        Value *Theirs = TB.CreateInBoundsGEP(BufTy, Buf, {Zero, Other});
+        TB.CreateStore(emitAtomicReductionOp(TB, Op, TB.CreateLoad(Ty, Mine),
+                                             TB.CreateLoad(Ty, Theirs)),
+                       Mine);
+        B.SetInsertPoint(Ret);
+        Hooks.Barrier(B);
+      }
+      Then = SplitBlockAndInsertIfThen(B.CreateICmpEQ(Tid, Zero), Ret, false);
+      B.SetInsertPoint(Then);
+      V = B.CreateLoad(Ty, B.CreateInBoundsGEP(BufTy, Buf, {Zero, Zero}));
+    }
+
+    // A single thread of the block updates the result.
+    B.SetInsertPoint(Then);
+    B.CreateAtomicRMW(Op, A, V, UpdateAlign, Ordering, SSID);
+    Reductions.push_back({A->getArgNo(), DL.getTypeStoreSize(Ty)});
+  }
+  return Reductions;
+}
+
+// Emit 'for (I = Start; I < N; I += Step) Body(I)' before InsertPt.  The
+// body is emitted ahead of an instruction of the loop, that it may split.
+static void emitStridedLoop(Instruction *InsertPt, Value *Start, Value *Step,
+                            Value *N,
+                            function_ref<void(Instruction *, Value *)> Body,
+                            const Twine &Name) {
+  BasicBlock *Pre = InsertPt->getParent();
+  BasicBlock *Exit = SplitBlock(Pre, InsertPt);
+  BasicBlock *Header =
+      BasicBlock::Create(Pre->getContext(), Name, Pre->getParent(), Exit);
+  Pre->getTerminator()->eraseFromParent();
+  IRBuilder<> B(Pre);
+  B.CreateCondBr(B.CreateICmpULT(Start, N), Header, Exit);
+  B.SetInsertPoint(Header);
+  PHINode *I = B.CreatePHI(Start->getType(), 2, Name + ".idx");
+  auto *Next = cast<Instruction>(B.CreateAdd(I, Step));
+  B.CreateCondBr(B.CreateICmpULT(Next, N), Header, Exit);
+  Body(Next, I);
+  I->addIncoming(Start, Pre);
+  I->addIncoming(Next, Next->getParent());
+}
+
+unsigned lowerGPUHistograms(Function &F, const GPUReductionHooks &Hooks,
+                            uint64_t MaxPrivateBytes) {
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  unsigned NumUpdates = 0;
+
+  // The (unused) atomic updates of elements of each argument.
+  struct Histogram {
+    Argument *Arg;
+    SmallVector<std::pair<GetElementPtrInst *, AtomicRMWInst *>, 4> Updates;
+    bool Private = true;
+    uint64_t NumElts = 0;
+  };
+  SmallVector<Histogram, 4> Histograms;
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isPointerTy() || A.use_empty())
+      continue;
+    Histogram H;
+    H.Arg = &A;
+    for (User *U : A.users()) {
+      auto *GEP = dyn_cast<GetElementPtrInst>(U);
+      auto *RMW = GEP && GEP->getNumIndices() == 1 && GEP->hasOneUse()
+                      ? dyn_cast<AtomicRMWInst>(GEP->user_back())
+                      : nullptr;
+      if (!RMW || RMW->getPointerOperand() != GEP ||
+          !isAtomicReductionUpdate(RMW) ||
+          RMW->getValOperand()->getType() != GEP->getResultElementType() ||
+          (!H.Updates.empty() &&
+           (RMW->getOperation() != H.Updates[0].second->getOperation() ||
+            RMW->getType() != H.Updates[0].second->getType()))) {
+        // Other accesses of the argument would not see the private copy
+        // but can leave the updates to be aggregated.
+        H.Private = false;
+        continue;
+      }
+      H.Updates.push_back({GEP, RMW});
+    }
+    if (H.Updates.empty())
+      continue;
+    // The bound on the indices of the updates.
+    for (auto &U : H.Updates) {
+      ConstantRange R = computeConstantRangeIncludingKnownBits(
+          U.first->getOperand(1), /*ForSigned=*/false, SimplifyQuery(DL));
+      if (R.isFullSet() || R.isWrappedSet() ||
+          R.getUnsignedMax().uge(MaxPrivateBytes)) {
+        H.Private = false;
+        break;
+      }
+      H.NumElts = std::max(H.NumElts, R.getUnsignedMax().getZExtValue() + 1);
+    }
+    Type *Ty = H.Updates[0].second->getType();
+    if (H.NumElts * DL.getTypeAllocSize(Ty) > MaxPrivateBytes)
+      H.Private = false;
+    Histograms.push_back(std::move(H));
+  }
+  if (Histograms.empty())
+    return NumUpdates;
+
+  // Private copies are merged at the (single) return after a barrier.
+  ReturnInst *Ret = nullptr;
+  for (BasicBlock &BB : F)
+    if (auto *RI = dyn_cast_or_null<ReturnInst>(BB.getTerminator())) {
+      if (Ret) {
+        Ret = nullptr;
+        break;
+      }
+      Ret = RI;
+    }
+
+  for (Histogram &H : Histograms) {
+    AtomicRMWInst *First = H.Updates[0].second;
+    AtomicRMWInst::BinOp Op = First->getOperation();
+    Type *Ty = First->getType();
+    if (H.Private && Ret) {
+      GlobalVariable *Buf =
+          createReductionBuffer(M, Ty, H.NumElts, Hooks.SharedAddrSpace,
+                                F.getName() + ".hist");
+      Type *BufTy = Buf->getValueType();
+      Constant *Identity = getAtomicReductionIdentity(Op, Ty);
+      Value *Zero = ConstantInt::get(Type::getInt64Ty(F.getContext()), 0);
+
+      // The threads of a block clear the private copy on entry...
+      Instruction *EntryPt = F.getEntryBlock().getTerminator();
+      IRBuilder<> B(EntryPt);
+      Value *Tid = Hooks.ThreadIdx(B);
+      Value *N = ConstantInt::get(Tid->getType(), H.NumElts);
+      emitStridedLoop(
+          EntryPt, Tid, Hooks.BlockDim(B), N,
+          [&](Instruction *IP, Value *I) {
+            IRBuilder<> LB(IP);
+            Value *Idx = LB.CreateZExt(I, Zero->getType());
+            LB.CreateStore(Identity,
+                           LB.CreateInBoundsGEP(BufTy, Buf, {Zero, Idx}));
+          },
+          "hist.init");
+      B.SetInsertPoint(EntryPt);
+      Hooks.Barrier(B);
+
+      // ...update it with shared memory atomics...
+      for (auto &U : H.Updates) {
+        GetElementPtrInst *GEP = U.first;
+        AtomicRMWInst *RMW = U.second;
+        IRBuilder<> UB(RMW);
+        Value *Idx = UB.CreateZExtOrTrunc(GEP->getOperand(1), Zero->getType());
+        UB.CreateAtomicRMW(Op, UB.CreateInBoundsGEP(BufTy, Buf, {Zero, Idx}),
+                           RMW->getValOperand(), RMW->getAlign(),
+                           RMW->getOrdering(), RMW->getSyncScopeID());
+        RMW->eraseFromParent();
+        if (GEP->use_empty())
+          GEP->eraseFromParent();
+        ++NumUpdates;
+      }
+
+      // ...and merge it into the argument when the block is done.
+      // Only the elements that were updated by the block are merged.
+      B.SetInsertPoint(Ret);
+      Hooks.Barrier(B);
+      emitStridedLoop(
+          Ret, Hooks.ThreadIdx(B), Hooks.BlockDim(B), N,
+          [&](Instruction *IP, Value *I) {
+            IRBuilder<> LB(IP);
+            Value *Idx = LB.CreateZExt(I, Zero->getType());
+            Value *V = LB.CreateLoad(
+                Ty, LB.CreateInBoundsGEP(BufTy, Buf, {Zero, Idx}));
+            Value *Changed = Ty->isFloatingPointTy()
+                                 ? LB.CreateFCmpUNE(V, Identity)
+                                 : LB.CreateICmpNE(V, Identity);
+            LB.SetInsertPoint(SplitBlockAndInsertIfThen(Changed, IP, false));
+            LB.CreateAtomicRMW(Op, LB.CreateInBoundsGEP(Ty, H.Arg, Idx), V,
+                               First->getAlign(), First->getOrdering(),
+                               First->getSyncScopeID());
+          },
+          "hist.merge");
+      continue;
+    }
+
+    // Aggregate updates by a constant across the lanes of a warp that
+    // update the same element; the lowest of those lanes applies them.
+    if (!Hooks.MatchAny || !Hooks.ActiveMask || !Hooks.WarpSize)
+      continue;
+    for (auto &U : H.Updates) {
+      AtomicRMWInst *RMW = U.second;
+      auto *C = dyn_cast<Constant>(RMW->getValOperand());
+      if (!C || Op == AtomicRMWInst::FMax || Op == AtomicRMWInst::FMin)
+        continue;
+      IRBuilder<> B(RMW);
+      Value *Mask = Hooks.ActiveMask(B);
+      Value *Peers = Hooks.MatchAny(
+          B, Mask, B.CreatePtrToInt(RMW->getPointerOperand(), B.getInt64Ty()));
+      Value *Lane = B.CreateZExtOrTrunc(
+          B.CreateAnd(Hooks.ThreadIdx(B), Hooks.WarpSize - 1),
+          Peers->getType());
+      Value *Leader = B.CreateBinaryIntrinsic(Intrinsic::cttz, Peers,
+                                              B.getTrue());
+      Value *Count = B.CreateUnaryIntrinsic(Intrinsic::ctpop, Peers);
+      Value *V = C;
+      switch (Op) {
+      case AtomicRMWInst::Add:
+        V = B.CreateMul(C, B.CreateZExtOrTrunc(Count, Ty));
+        break;
+      case AtomicRMWInst::FAdd:
+        V = B.CreateFMul(C, B.CreateUIToFP(Count, Ty));
+        break;
+      case AtomicRMWInst::Xor:
+        V = B.CreateSelect(B.CreateTrunc(Count, B.getInt1Ty()), C,
+                           Constant::getNullValue(Ty));
+        break;
+      default:
+        // The remaining updates (min, max, and, or) are idempotent.
+        break;
+      }
+      Instruction *Then =
+          SplitBlockAndInsertIfThen(B.CreateICmpEQ(Lane, Leader), RMW, false);
+      RMW->moveBefore(Then);
+      RMW->setOperand(1, V);
+      ++NumUpdates;
+    }
+  }
+  return NumUpdates;
+}
+
+unsigned lowerGPULaneCalls(Function &F, const GPUReductionHooks &Hooks) {
+  SmallVector<CallInst *, 8> Calls;
+  for (Instruction &I : instructions(F))
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      if (Function *Callee = CI->getCalledFunction())
+        if (Callee->getName() == GPULaneSyncName ||
+            Callee->getName() == GPULaneShuffleXorName)
+          Calls.push_back(CI);
+
+  for (CallInst *CI : Calls) {
+    IRBuilder<> B(CI);
+    bool IsSync = CI->getCalledFunction()->getName() == GPULaneSyncName;
+    unsigned Width =
+        cast<ConstantInt>(CI->getArgOperand(IsSync ? 0 : 2))->getZExtValue();
+    // The lanes of the caller's group, for shuffles that name them.
+    Value *Mask = nullptr;
+    if (Hooks.WarpSize != 0) {
+      if (Width == Hooks.WarpSize) {
+        Mask = B.getInt32(~0u);
+      } else {
+        Value *Lane = B.CreateAnd(Hooks.ThreadIdx(B), Hooks.WarpSize - 1);
+        Mask = B.CreateShl(B.getInt32((1u << Width) - 1),
+                           B.CreateAnd(Lane, ~(Width - 1)));
+      }
+    }
+    if (IsSync)
+      Hooks.LaneSync(B, Mask);
+    else
+      CI->replaceAllUsesWith(Hooks.ShuffleXor(B, CI->getArgOperand(0),
+                                              CI->getArgOperand(1), Width,
+                                              Mask));
+    CI->eraseFromParent();
+  }
+  return Calls.size();
+}
+
+// Return true if V can serve as the extent of a dimension of a
+// flattened index -- a kernel argument or a constant greater than one.
+static bool isFlattenedExtent(Function &F, Value *V) {
+  if (auto *CI = dyn_cast<ConstantInt>(V))
+    return CI->getValue().ugt(1);
+  auto *A = dyn_cast<Argument>(V);
+  return A && A->getParent() == &F;
+}
+
+// Find the unsigned division of X by an extent and the matching
+// remainder, either as a urem or in the expanded 'X - (X / D) * D'
+// form.  All divisions and remainders of X must use the same divisor.
+static bool findDivRemPair(Function &F, Value *X, Value *&D,
+                           Instruction *&Quot, Instruction *&Rem) {
+  D = nullptr;
+  Quot = nullptr;
+  Rem = nullptr;
+  for (User *U : X->users()) {
+    auto *BO = dyn_cast<BinaryOperator>(U);
+    if (!BO || BO->getOperand(0) != X ||
+        (BO->getOpcode() != Instruction::UDiv &&
+         BO->getOpcode() != Instruction::URem))
+      continue;
+    if (D && BO->getOperand(1) != D)
+      return false;
+    D = BO->getOperand(1);
+    Instruction *&Slot = BO->getOpcode() == Instruction::UDiv ? Quot : Rem;
+    if (Slot)
+      return false;
+    Slot = BO;
+  }
+  if (!Quot || !isFlattenedExtent(F, D))
+    return false;
+
+  if (!Rem)
+    for (User *U : Quot->users()) {
+      auto *Mul = dyn_cast<BinaryOperator>(U);
+      if (!Mul || Mul->getOpcode() != Instruction::Mul ||
+          (Mul->getOperand(0) != D && Mul->getOperand(1) != D))
+        continue;
+      for (User *MU : Mul->users()) {
+        auto *Sub = dyn_cast<BinaryOperator>(MU);
+        if (Sub && Sub->getOpcode() == Instruction::Sub &&
+            Sub->getOperand(0) == X && Sub->getOperand(1) == Mul) {
+          Rem = Sub;
+          break;
+        }
+      }
+      if (Rem)
+        break;
+    }
+  return Rem != nullptr;
+}
+
+bool findFlattenedIndex(Function &F, PHINode *IV, GPUFlattenedIndex &FI) {
+  FI = GPUFlattenedIndex();
+  Value *D;
+  Instruction *Quot, *Rem;
+  if (!findDivRemPair(F, IV, D, Quot, Rem))
+    return false;
+  FI.NumDims = 2;
+  FI.Extents[0] = D;
+  FI.Quot[0] = Quot;
+  FI.Rem[0] = Rem;
+
+  // A further split of the quotient gives a third dimension.
+  if (findDivRemPair(F, FI.Quot[0], D, Quot, Rem)) {
+    FI.NumDims = 3;
+    FI.Extents[1] = D;
+    FI.Quot[1] = Quot;
+    FI.Rem[1] = Rem;
+  }
+  return true;
+}
+
+Value *rewriteFlattenedIndex(IRBuilder<> &B, GPUFlattenedIndex &FI,
+                             ArrayRef<Value *> Coords) {
+  assert(Coords.size() == FI.NumDims && "coordinate count mismatch!");
+  assert(FI.NumDims > 1 && FI.NumDims <= 3 && "unsupported dimensions!");
+  SmallVector<WeakTrackingVH, 4> Dead;
+  auto Replace = [&Dead](Instruction *I, Value *V) {
+    I->replaceAllUsesWith(V);
+    Dead.push_back(I);
+  };
+
+  // The row (for 3D, the plane and row) of the outer dimensions.
+  Value *Row = Coords[1];
+  if (FI.NumDims == 3) {
+    Row = B.CreateAdd(B.CreateMul(Coords[2], FI.Extents[1]), Coords[1],
+                      "flat_row");
+    Replace(FI.Rem[1], Coords[1]);
+    Replace(FI.Quot[1], Coords[2]);
+  }
+  Value *Flat =
+      B.CreateAdd(B.CreateMul(Row, FI.Extents[0]), Coords[0], "flat_iv");
+  Replace(FI.Rem[0], Coords[0]);
+  Replace(FI.Quot[0], Row);
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(Dead);
+  for (unsigned D = 0; D < 2; D++)
+    FI.Quot[D] = FI.Rem[D] = nullptr;
+  return Flat;
+}
+
+// Match the index of a stencil-like access to 'IV + Offset', possibly
+// extended to a wider type (ExtOp is the extension, or zero).  The
+// extension must not change the value of the offset access.
+static bool matchStencilIndex(Value *Idx, PHINode *IV, int64_t &Offset,
+                              unsigned &ExtOp) {
+  ExtOp = 0;
+  if (auto *Ext = dyn_cast<CastInst>(Idx)) {
+    if (Ext->getOpcode() != Instruction::SExt &&
+        Ext->getOpcode() != Instruction::ZExt)
+      return false;
+    ExtOp = Ext->getOpcode();
+    Idx = Ext->getOperand(0);
+  }
+  Offset = 0;
+  if (Idx == IV)
+    return true;
+  auto *BO = dyn_cast<BinaryOperator>(Idx);
+  if (!BO || BO->getOperand(0) != IV)
+    return false;
+  auto *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+  if (!C || C->getBitWidth() > 64)
+    return false;
+  if (BO->getOpcode() == Instruction::Add)
+    Offset = C->getSExtValue();
+  else if (BO->getOpcode() == Instruction::Sub)
+    Offset = -C->getSExtValue();
+  else
+    return false;
+  if (ExtOp == Instruction::SExt)
+    return BO->hasNoSignedWrap();
+  if (ExtOp == Instruction::ZExt)
+    return BO->hasNoUnsignedWrap() && Offset >= 0;
+  return true;
+}
+
+bool getStencilAccessRange(Argument *A, PHINode *IV, int64_t &MinOffset,
+                           int64_t &MaxOffset, Type *&ElemTy) {
+  ElemTy = nullptr;
+  for (User *U : A->users()) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(U);
+    if (!GEP || GEP->getPointerOperand() != A || GEP->getNumIndices() != 1)
+      return false;
+    int64_t Offset;
+    unsigned ExtOp;
+    if (!matchStencilIndex(GEP->getOperand(1), IV, Offset, ExtOp))
+      return false;
+    for (User *GU : GEP->users()) {
+      Type *Ty;
+      if (auto *LI = dyn_cast<LoadInst>(GU))
+        Ty = LI->isSimple() ? LI->getType() : nullptr;
+      else if (auto *SI = dyn_cast<StoreInst>(GU))
+        Ty = SI->isSimple() && SI->getPointerOperand() == GEP
+                 ? SI->getValueOperand()->getType()
+                 : nullptr;
+      else
+        Ty = nullptr;
+      if (!Ty || Ty != GEP->getSourceElementType() || (ElemTy && Ty != ElemTy))
+        return false;
+      if (!ElemTy)
+        MinOffset = MaxOffset = Offset;
+      ElemTy = Ty;
+      MinOffset = std::min(MinOffset, Offset);
+      MaxOffset = std::max(MaxOffset, Offset);
+    }
+  }
+  return ElemTy != nullptr;
+}
+
+bool findGPUMemIdiom(TapirLoopInfo &TL, GPUMemIdiom &MI) {
+  MI = GPUMemIdiom();
+  Loop *L = TL.getLoop();
+  Task *T = TL.getTask();
+  PHINode *IV = TL.getPrimaryInduction().first;
+  ConstantInt *Step = TL.getPrimaryInduction().second.getConstIntStepValue();
+  if (!Step || !Step->isOne() || TL.getUnwindDest() ||
+      !T->getSubTasks().empty() || T->getNumSpindles() != 1 ||
+      T->getEntrySpindle()->getNumBlocks() != 1)
+    return false;
+  BasicBlock *Body = T->getEntry();
+  if (!isa<ReattachInst>(Body->getTerminator()))
+    return false;
+
+  // Outside of the task the loop may only run its control.
+  for (BasicBlock *BB : L->blocks())
+    if (BB != Body)
+      for (Instruction &I : *BB)
+        if (!I.isTerminator() && I.mayHaveSideEffects())
+          return false;
+
+  StoreInst *Store = nullptr;
+  for (Instruction &I : *Body) {
+    if (I.isTerminator() || isa<DbgInfoIntrinsic>(I))
+      continue;
+    if (auto *SI = dyn_cast<StoreInst>(&I)) {
+      if (Store)
+        return false;
+      Store = SI;
+    } else if (I.mayHaveSideEffects())
+      return false;
+  }
+  if (!Store || !Store->isSimple())
+    return false;
+
+  Value *V = Store->getValueOperand();
+  Type *Ty = V->getType();
+  const DataLayout &DL = Body->getModule()->getDataLayout();
+  if (!Ty->isSized() || isa<ScalableVectorType>(Ty) ||
+      DL.getTypeStoreSize(Ty) != DL.getTypeAllocSize(Ty))
+    return false;
+
+  // Match an access of a loop-invariant array at 'Base[IV + Offset]'.
+  auto MatchAccess = [&](Value *Ptr, Value *&Base, int64_t &Offset) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(Ptr);
+    unsigned ExtOp;
+    if (!GEP || GEP->getNumIndices() != 1 || GEP->getSourceElementType() != Ty)
+      return false;
+    Base = GEP->getPointerOperand();
+    return (isa<Argument>(Base) || isa<Instruction>(Base)) &&
+           L->isLoopInvariant(Base) &&
+           matchStencilIndex(GEP->getOperand(1), IV, Offset, ExtOp);
+  };
+  if (!MatchAccess(Store->getPointerOperand(), MI.Dst, MI.DstOffset))
+    return false;
+
+  auto *LI = dyn_cast<LoadInst>(V);
+  if (LI && LI->getParent() == Body) {
+    if (!LI->isSimple() ||
+        !MatchAccess(LI->getPointerOperand(), MI.Src, MI.SrcOffset) ||
+        MI.Src == MI.Dst)
+      return false;
+    MI.Kind = GPUMemIdiom::Copy;
+  } else if (isa<Constant>(V) ||
+             ((isa<Argument>(V) || isa<Instruction>(V)) &&
+              L->isLoopInvariant(V))) {
+    MI.Fill = V;
+    MI.Kind = GPUMemIdiom::Set;
+  } else
+    return false;
+  MI.ElemTy = Ty;
+  return true;
+}
+
+// Strip the sign or zero extension of an index.  The extension of a
+// sum or product is only stripped if it does not wrap.
+static Value *stripIndexExt(Value *V) {
+  auto *Ext = dyn_cast<CastInst>(V);
+  if (!Ext || (!isa<SExtInst>(Ext) && !isa<ZExtInst>(Ext)))
+    return V;
+  Value *Op = Ext->getOperand(0);
+  if (auto *OBO = dyn_cast<OverflowingBinaryOperator>(Op))
+    if (isa<SExtInst>(Ext) ? !OBO->hasNoSignedWrap()
+                           : !OBO->hasNoUnsignedWrap())
+      return V;
+  return Op;
+}
+
+// Split the address of an element of an array defined outside of L,
+// '&Base[T0 + T1 + ...]', into the array and the terms of its index.
+// The index may be split over a chain of GEPs.
+static bool getIndexTerms(Value *Ptr, Type *Ty, Loop *L, Value *&Base,
+                          SmallVectorImpl<Value *> &Terms) {
+  SmallVector<Value *, 4> Work;
+  while (auto *GEP = dyn_cast<GetElementPtrInst>(Ptr)) {
+    if (GEP->getNumIndices() != 1 || GEP->getSourceElementType() != Ty)
+      return false;
+    Work.push_back(GEP->getOperand(1));
+    Ptr = GEP->getPointerOperand();
+  }
+  Base = Ptr;
+  if (!(isa<Argument>(Base) || isa<Instruction>(Base)) ||
+      !L->isLoopInvariant(Base))
+    return false;
+  while (!Work.empty()) {
+    Value *V = stripIndexExt(Work.pop_back_val());
+    auto *Add = dyn_cast<BinaryOperator>(V);
+    if (Add && Add->getOpcode() == Instruction::Add) {
+      Work.push_back(Add->getOperand(0));
+      Work.push_back(Add->getOperand(1));
+    } else
+      Terms.push_back(V);
+  }
+  return true;
+}
+
+// Match the index terms of the element KIV of a row of a row-major
+// matrix with rows of K elements, 'Row * K + KIV'.  Row is null if the
+// index is just KIV.
+static bool matchRowIndex(ArrayRef<Value *> Terms, PHINode *KIV, Value *K,
+                          Value *&Row) {
+  Row = nullptr;
+  bool HasKIV = false;
+  for (Value *T : Terms) {
+    if (T == KIV && !HasKIV) {
+      HasKIV = true;
+      continue;
+    }
+    auto *Mul = dyn_cast<BinaryOperator>(T);
+    if (Row || !Mul || Mul->getOpcode() != Instruction::Mul)
+      return false;
+    Value *X = stripIndexExt(Mul->getOperand(0));
+    Value *Y = stripIndexExt(Mul->getOperand(1));
+    if (Y == K)
+      Row = X;
+    else if (X == K)
+      Row = Y;
+    else
+      return false;
+  }
+  return HasKIV;
+}
+
+// Match the row 'IV / N' (or with Rem, the column 'IV % N') of the
+// flattened index IV of a matrix and return N.
+static Value *matchFlattenedRow(Value *Row, PHINode *IV, bool Rem) {
+  using namespace PatternMatch;
+  Value *X, *N;
+  if (!Rem) {
+    if (match(Row, m_CombineOr(m_UDiv(m_Value(X), m_Value(N)),
+                               m_SDiv(m_Value(X), m_Value(N)))) &&
+        stripIndexExt(X) == IV)
+      return stripIndexExt(N);
+    return nullptr;
+  }
+  if (match(Row, m_CombineOr(m_URem(m_Value(X), m_Value(N)),
+                             m_SRem(m_Value(X), m_Value(N)))) &&
+      stripIndexExt(X) == IV)
+    return stripIndexExt(N);
+  // The remainder may have been expanded to 'IV - (IV / N) * N'.
+  Value *Div;
+  if (match(Row, m_Sub(m_Value(X), m_c_Mul(m_Value(Div), m_Value(N)))) &&
+      stripIndexExt(X) == IV &&
+      matchFlattenedRow(Div, IV, false) == stripIndexExt(N))
+    return stripIndexExt(N);
+  return nullptr;
+}
+
+// Match the (rotated) loop SL as 'for (KIV = 0; KIV < K; ++KIV)' and
+// return K.
+static Value *matchInnerLoopBound(Loop *SL, PHINode *&KIV) {
+  BasicBlock *Latch = SL->getLoopLatch();
+  if (!Latch || SL->getExitingBlock() != Latch)
+    return nullptr;
+  auto *Br = dyn_cast<BranchInst>(Latch->getTerminator());
+  auto *Cmp = Br && Br->isConditional()
+                  ? dyn_cast<ICmpInst>(Br->getCondition())
+                  : nullptr;
+  if (!Cmp)
+    return nullptr;
+  // The loop continues while 'Next Pred K'.
+  ICmpInst::Predicate Pred = Br->getSuccessor(0) == SL->getHeader()
+                                 ? Cmp->getPredicate()
+                                 : Cmp->getInversePredicate();
+  Value *Next = Cmp->getOperand(0);
+  Value *K = Cmp->getOperand(1);
+  if (SL->isLoopInvariant(Next)) {
+    std::swap(Next, K);
+    Pred = ICmpInst::getSwappedPredicate(Pred);
+  }
+  if (Pred != ICmpInst::ICMP_NE && Pred != ICmpInst::ICMP_ULT &&
+      Pred != ICmpInst::ICMP_SLT)
+    return nullptr;
+
+  auto *Inc = dyn_cast<BinaryOperator>(Next);
+  if (!Inc || Inc->getOpcode() != Instruction::Add ||
+      !match(Inc->getOperand(1), PatternMatch::m_One()))
+    return nullptr;
+  KIV = dyn_cast<PHINode>(Inc->getOperand(0));
+  if (!KIV || KIV->getParent() != SL->getHeader() ||
+      KIV->getNumIncomingValues() != 2)
+    return nullptr;
+  for (unsigned i = 0; i < 2; i++) {
+    Value *In = KIV->getIncomingValue(i);
+    if (SL->contains(KIV->getIncomingBlock(i))
+            ? In != Inc
+            : !match(In, PatternMatch::m_Zero()))
+      return nullptr;
   }
+  return stripIndexExt(K);
+}
+
+bool findGPUBlasIdiom(TapirLoopInfo &TL, GPUBlasIdiom &BI) {
+  using namespace PatternMatch;
+  BI = GPUBlasIdiom();
+  Loop *L = TL.getLoop();
+  Task *T = TL.getTask();
+  PHINode *IV = TL.getPrimaryInduction().first;
+  ConstantInt *Step = TL.getPrimaryInduction().second.getConstIntStepValue();
+  if (!Step || !Step->isOne() || TL.getUnwindDest() ||
+      !T->getSubTasks().empty() || T->getNumSpindles() != 1)
+    return false;
+  Spindle *S = T->getEntrySpindle();
+
+  // Outside of the task the loop may only run its control.
+  for (BasicBlock *BB : L->blocks())
+    if (!S->contains(BB))
+      for (Instruction &I : *BB)
+        if (!I.isTerminator() && I.mayHaveSideEffects())
+          return false;
+
+  StoreInst *Store = nullptr;
+  for (BasicBlock *BB : S->blocks())
+    for (Instruction &I : *BB) {
+      if (I.isTerminator() || isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(&I)) {
+        if (Store)
+          return false;
+        Store = SI;
+      } else if (I.mayHaveSideEffects())
+        return false;
+    }
+  if (!Store || !Store->isSimple())
+    return false;
+  Value *V = Store->getValueOperand();
+  Type *Ty = V->getType();
+  if (!Ty->isFloatTy() && !Ty->isDoubleTy())
+    return false;
+
+  SmallVector<Value *, 4> Terms;
+  if (!getIndexTerms(Store->getPointerOperand(), Ty, L, BI.C, Terms) ||
+      Terms.size() != 1 || Terms[0] != IV)
+    return false;
+
+  // Find the sum past the phis that merge it with the empty sum of a
+  // skipped loop.
+  while (auto *PN = dyn_cast<PHINode>(V)) {
+    if (!S->contains(PN->getParent()))
+      return false;
+    Value *Sum = nullptr;
+    for (Value *In : PN->incoming_values()) {
+      if (match(In, m_AnyZeroFP()))
+        continue;
+      if (Sum && In != Sum)
+        return false;
+      Sum = In;
+    }
+    if (!Sum)
+      return false;
+    V = Sum;
+  }
+
+  // The sum accumulates the products of the inner loop, 'Sum + LA * LB'.
+  auto *Acc = dyn_cast<Instruction>(V);
+  Value *Sum, *LA, *LB;
+  if (!Acc || !isa<FPMathOperator>(Acc) || !Acc->hasAllowReassoc())
+    return false;
+  if (!match(Acc, m_c_FAdd(m_Value(Sum),
+                           m_OneUse(m_FMul(m_Value(LA), m_Value(LB))))) &&
+      !match(Acc, m_Intrinsic<Intrinsic::fmuladd>(m_Value(LA), m_Value(LB),
+                                                  m_Value(Sum))))
+    return false;
+  auto *SumPN = dyn_cast<PHINode>(Sum);
+  Loop *SL = nullptr;
+  for (Loop *Sub : *L)
+    if (SumPN && Sub->getHeader() == SumPN->getParent())
+      SL = Sub;
+  if (!SL || !SL->isInnermost() || !S->contains(SL->getHeader()) ||
+      !SL->contains(Acc) || SumPN->getNumIncomingValues() != 2)
+    return false;
+  for (unsigned i = 0; i < 2; i++) {
+    Value *In = SumPN->getIncomingValue(i);
+    if (SL->contains(SumPN->getIncomingBlock(i)) ? In != Acc
+                                                 : !match(In, m_AnyZeroFP()))
+      return false;
+  }
+  PHINode *KIV;
+  Value *K = matchInnerLoopBound(SL, KIV);
+  if (!K || !L->isLoopInvariant(K))
+    return false;
+
+  // The task may only branch around the inner loop when K is zero (the
+  // sum is empty).
+  for (BasicBlock *BB : S->blocks()) {
+    if (isa<ReattachInst>(BB->getTerminator()))
+      continue;
+    auto *Br = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!Br)
+      return false;
+    if (Br->isUnconditional() || BB == SL->getLoopLatch())
+      continue;
+    auto *Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+    const APInt *C;
+    if (!Cmp || stripIndexExt(Cmp->getOperand(0)) != K ||
+        !match(Cmp->getOperand(1), m_APInt(C)))
+      return false;
+    ICmpInst::Predicate Pred = Cmp->getPredicate();
+    if (!(C->isZero() && (Cmp->isEquality() || Pred == ICmpInst::ICMP_UGT ||
+                          Pred == ICmpInst::ICMP_SGT)) &&
+        !(C->isOne() &&
+          (Pred == ICmpInst::ICMP_ULT || Pred == ICmpInst::ICMP_SLT)))
+      return false;
+  }
+
+  // A GEMM reads the row IV / N of A and the row IV % N of B, a GEMV the
+  // row IV of A and all of B.
+  auto *LoadA = dyn_cast<LoadInst>(LA);
+  auto *LoadB = dyn_cast<LoadInst>(LB);
+  if (!LoadA || !LoadB || !LoadA->isSimple() || !LoadB->isSimple() ||
+      !SL->contains(LoadA) || !SL->contains(LoadB))
+    return false;
+  Value *BaseA, *BaseB, *RowA, *RowB;
+  SmallVector<Value *, 4> TermsA, TermsB;
+  if (!getIndexTerms(LoadA->getPointerOperand(), Ty, L, BaseA, TermsA) ||
+      !getIndexTerms(LoadB->getPointerOperand(), Ty, L, BaseB, TermsB) ||
+      !matchRowIndex(TermsA, KIV, K, RowA) ||
+      !matchRowIndex(TermsB, KIV, K, RowB))
+    return false;
+  auto MatchOperands = [&](Value *BaseA, Value *RowA, Value *BaseB,
+                           Value *RowB) {
+    if (!RowA)
+      return false;
+    if (!RowB) {
+      if (RowA != IV)
+        return false;
+      BI.N = nullptr;
+    } else {
+      Value *N = matchFlattenedRow(RowA, IV, false);
+      if (!N || N != matchFlattenedRow(RowB, IV, true) ||
+          !L->isLoopInvariant(N))
+        return false;
+      BI.N = N;
+    }
+    BI.A = BaseA;
+    BI.B = BaseB;
+    return true;
+  };
+  if (!MatchOperands(BaseA, RowA, BaseB, RowB) &&
+      !MatchOperands(BaseB, RowB, BaseA, RowA))
+    return false;
+  if (BI.C == BI.A || BI.C == BI.B)
+    return false;
+
+  BI.K = K;
+  BI.ElemTy = Ty;
+  BI.Kind = GPUBlasIdiom::Gemm;
+  return true;
+}
+
+// The loads of a kernel argument that are staged in a shared memory
+// tile.
+struct GPUTile {
+  Argument *Arg;
+  Type *Ty;
+  unsigned Size;
+  unsigned ExtOp;
+  int64_t MinOffset = 0;
+  int64_t MaxOffset = 0;
+  SmallVector<std::pair<LoadInst *, int64_t>, 8> Loads;
+};
+
+GPUSharedMemSize stageGPUTileLoads(Function &F, PHINode *IV, Value *ThreadIV,
+                                   Value *Start, Value *End,
+                                   Instruction *InsertPt,
+                                   const GPUReductionHooks &Hooks,
+                                   unsigned MaxHalo) {
+  GPUSharedMemSize SharedMem;
+  if (IV->getNumIncomingValues() != 2)
+    return SharedMem;
+  BasicBlock *Latch = IV->getIncomingBlock(0);
+  if (Latch == InsertPt->getParent())
+    Latch = IV->getIncomingBlock(1);
+
+  // Gather the loads of read-only arguments at constant offsets from
+  // the induction variable.  Every iteration has to execute the loads
+  // -- the tile is only loaded where the iterations access A.
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  DominatorTree DT(F);
+  SmallVector<GPUTile, 4> Tiles;
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isPointerTy() || !isReadOnlyKernelArg(&A))
+      continue;
+    GPUTile Tile;
+    Tile.Arg = &A;
+    Tile.Ty = nullptr;
+    bool IsTile = true;
+    for (User *U : A.users()) {
+      auto *GEP = dyn_cast<GetElementPtrInst>(U);
+      if (!GEP || GEP->getPointerOperand() != &A || GEP->getNumIndices() != 1) {
+        IsTile = false;
+        break;
+      }
+      int64_t Offset;
+      unsigned ExtOp;
+      if (!matchStencilIndex(GEP->getOperand(1), IV, Offset, ExtOp) ||
+          (Tile.Ty && ExtOp != Tile.ExtOp)) {
+        IsTile = false;
+        break;
+      }
+      for (User *GU : GEP->users()) {
+        auto *LI = dyn_cast<LoadInst>(GU);
+        if (!LI || !LI->isSimple() ||
+            LI->getType() != GEP->getSourceElementType() ||
+            (Tile.Ty && LI->getType() != Tile.Ty) ||
+            !DT.dominates(LI->getParent(), Latch)) {
+          IsTile = false;
+          break;
+        }
+        Tile.Ty = LI->getType();
+        Tile.ExtOp = ExtOp;
+        Tile.Loads.push_back({LI, Offset});
+      }
+      if (!IsTile)
+        break;
+    }
+    if (!IsTile || !Tile.Ty || !Tile.Ty->isSingleValueType() ||
+        Tile.Ty->isVectorTy())
+      continue;
+    // Only neighborhoods (more than one offset) have any reuse.
+    Tile.MinOffset = Tile.MaxOffset = Tile.Loads[0].second;
+    for (auto &L : Tile.Loads) {
+      Tile.MinOffset = std::min(Tile.MinOffset, L.second);
+      Tile.MaxOffset = std::max(Tile.MaxOffset, L.second);
+    }
+    if (Tile.MinOffset == Tile.MaxOffset ||
+        Tile.MaxOffset - Tile.MinOffset > MaxHalo)
+      continue;
+    Tile.Size = DL.getTypeAllocSize(Tile.Ty);
+    Tiles.push_back(Tile);
+  }
+  if (Tiles.empty())
+    return SharedMem;
+
+  // The tiles share the kernel's dynamic shared memory.  Placing them
+  // by decreasing element size keeps each of them aligned.
+  std::stable_sort(Tiles.begin(), Tiles.end(),
+                   [](const GPUTile &A, const GPUTile &B) {
+                     return A.Size > B.Size;
+                   });
+  ArrayType *BufTy = ArrayType::get(Type::getInt8Ty(M.getContext()), 0);
+  auto *Buf = new GlobalVariable(M, BufTy, false, GlobalValue::ExternalLinkage,
+                                 nullptr, F.getName() + ".tile", nullptr,
+                                 GlobalValue::NotThreadLocal,
+                                 Hooks.SharedAddrSpace);
+  Buf->setAlignment(Align(16));
+
+  // Each thread loads the elements [j, j + BlockDim, ...) of each tile
+  // where the tile starts at the block's first iteration plus the tile's
+  // smallest offset.  The loads that fall outside of the range accessed
+  // by the iterations [Start, End) are skipped.
+  LLVMContext &Ctx = F.getContext();
+  Type *IVTy = IV->getType();
+  BasicBlock *Cont = SplitBlock(InsertPt->getParent(), InsertPt);
+  BasicBlock *Pred = Cont->getSinglePredecessor();
+  Pred->getTerminator()->eraseFromParent();
+  IRBuilder<> B(Pred);
+  Value *Tid = Hooks.ThreadIdx(B);
+  Value *BlockDim = Hooks.BlockDim(B);
+  Value *BlockIV = B.CreateSub(ThreadIV, B.CreateZExtOrTrunc(Tid, IVTy),
+                               "tile.block_iv");
+  SmallVector<Value *, 4> TileOffsets;
+  Value *TileOffset = B.getInt32(0);
+  bool AsyncCopies = false;
+  for (GPUTile &Tile : Tiles) {
+    TileOffsets.push_back(TileOffset);
+    int64_t Halo = Tile.MaxOffset - Tile.MinOffset;
+    Value *TileLen = B.CreateAdd(BlockDim, B.getInt32(Halo), "tile.len");
+    Value *RangeEnd = B.CreateAdd(End, ConstantInt::get(IVTy, Halo));
+
+    BasicBlock *Loop = BasicBlock::Create(Ctx, "tile.loop", &F, Cont);
+    BasicBlock *Load = BasicBlock::Create(Ctx, "tile.load", &F, Cont);
+    BasicBlock *Next = BasicBlock::Create(Ctx, "tile.next", &F, Cont);
+    BasicBlock *Done = BasicBlock::Create(Ctx, "tile.done", &F, Cont);
+    BasicBlock *Entry = B.GetInsertBlock();
+    B.CreateBr(Loop);
+
+    B.SetInsertPoint(Loop);
+    PHINode *J = B.CreatePHI(B.getInt32Ty(), 2, "tile.j");
+    J->addIncoming(Tid, Entry);
+    Value *TileIV = B.CreateAdd(BlockIV, B.CreateZExtOrTrunc(J, IVTy));
+    B.CreateCondBr(B.CreateAnd(B.CreateICmpUGE(TileIV, Start),
+                               B.CreateICmpULT(TileIV, RangeEnd)),
+                   Load, Next);
+
+    B.SetInsertPoint(Load);
+    Value *Idx = TileIV;
+    if (Tile.ExtOp)
+      Idx = B.CreateCast((Instruction::CastOps)Tile.ExtOp, Idx, B.getInt64Ty());
+    Idx = B.CreateAdd(Idx, ConstantInt::get(Idx->getType(), Tile.MinOffset));
+    Value *Src = B.CreateInBoundsGEP(Tile.Ty, Tile.Arg, Idx);
+    Value *Dst = B.CreateInBoundsGEP(
+        B.getInt8Ty(), Buf,
+        B.CreateAdd(TileOffset, B.CreateMul(J, B.getInt32(Tile.Size))));
+    if (Hooks.AsyncCopy && Hooks.AsyncCopy(B, Dst, Src, Tile.Size))
+      AsyncCopies = true;
+    else
+      B.CreateAlignedStore(B.CreateLoad(Tile.Ty, Src), Dst, Align(Tile.Size));
+    B.CreateBr(Next);
+
+    B.SetInsertPoint(Next);
+    Value *NextJ = B.CreateAdd(J, BlockDim);
+    J->addIncoming(NextJ, Next);
+    B.CreateCondBr(B.CreateICmpULT(NextJ, TileLen), Loop, Done);
+
+    B.SetInsertPoint(Done);
+    TileOffset = B.CreateAdd(
+        TileOffset, B.CreateMul(TileLen, B.getInt32(Tile.Size)), "tile.offset");
+    SharedMem.BytesPerThread += Tile.Size;
+    SharedMem.Bytes += Halo * Tile.Size;
+  }
+  if (AsyncCopies)
+    Hooks.AsyncCopyWait(B);
+  Hooks.Barrier(B);
+  B.CreateBr(Cont);
+
+  // Each thread's iteration reads the tile relative to its position in
+  // the block.
+  SmallVector<WeakTrackingVH, 8> Dead;
+  for (unsigned T = 0; T < Tiles.size(); T++) {
+    GPUTile &Tile = Tiles[T];
+    for (auto &L : Tile.Loads) {
+      LoadInst *LI = L.first;
+      IRBuilder<> LB(LI);
+      Value *Elt = LB.CreateAdd(Hooks.ThreadIdx(LB),
+                                LB.getInt32(L.second - Tile.MinOffset));
+      Value *Src = LB.CreateAdd(TileOffsets[T],
+                                LB.CreateMul(Elt, LB.getInt32(Tile.Size)));
+      LoadInst *TileLI = LB.CreateAlignedLoad(
+          Tile.Ty, LB.CreateInBoundsGEP(LB.getInt8Ty(), Buf, Src),
+          Align(Tile.Size), LI->getName() + ".tile");
+      LI->replaceAllUsesWith(TileLI);
+      Dead.push_back(LI->getPointerOperand());
+      LI->eraseFromParent();
+    }
+  }
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(Dead);
+  return SharedMem;
+}
+
+// Returns true if Cmp compares V against one of Limits.
+static bool isLimitTest(ICmpInst *Cmp, Value *V, ArrayRef<Value *> Limits) {
+  if (!Cmp || (!Cmp->isUnsigned() && !Cmp->isEquality()))
+    return false;
+  Value *LHS = Cmp->getOperand(0), *RHS = Cmp->getOperand(1);
+  return (LHS == V && is_contained(Limits, RHS)) ||
+         (RHS == V && is_contained(Limits, LHS));
+}
+
+bool narrowGPULoopIV(PHINode *IV, BasicBlock *Exit, Value *End,
+                     ArrayRef<Value *> Limits) {
+  auto *IVTy = dyn_cast<IntegerType>(IV->getType());
+  if (!IVTy || IVTy->getBitWidth() <= 32 || IV->getNumIncomingValues() != 2 ||
+      isa<PHINode>(Exit->begin()))
+    return false;
+
+  // The blocks of the loop are those reachable from its header without
+  // leaving through the exit.
+  BasicBlock *Header = IV->getParent();
+  Function &F = *Header->getParent();
+  SmallSetVector<BasicBlock *, 16> Blocks;
+  Blocks.insert(Header);
+  for (unsigned i = 0; i < Blocks.size(); ++i)
+    for (BasicBlock *Succ : successors(Blocks[i]))
+      if (Succ != Exit)
+        Blocks.insert(Succ);
+  if (Blocks.contains(&F.getEntryBlock()))
+    return false;
+
+  BasicBlock *Preheader = nullptr;
+  for (BasicBlock *Pred : predecessors(Header))
+    if (!Blocks.contains(Pred)) {
+      if (Preheader && Preheader != Pred)
+        return false;
+      Preheader = Pred;
+    }
+  if (!Preheader)
+    return false;
+
+  BasicBlock *Latch = IV->getIncomingBlock(0) == Preheader
+                          ? IV->getIncomingBlock(1)
+                          : IV->getIncomingBlock(0);
+  auto *Inc = dyn_cast<BinaryOperator>(IV->getIncomingValueForBlock(Latch));
+  if (!Inc || Inc->getOpcode() != Instruction::Add ||
+      Inc->getOperand(0) != IV)
+    return false;
+  Value *Step = Inc->getOperand(1);
+  auto *StepI = dyn_cast<Instruction>(Step);
+  if (StepI && Blocks.contains(StepI->getParent()))
+    return false;
+  // The increment is bounded by End plus the step only if the loop exits
+  // once it reaches a limit.
+  auto *LatchBr = dyn_cast<BranchInst>(Latch->getTerminator());
+  if (!LatchBr || !LatchBr->isConditional() ||
+      !isLimitTest(dyn_cast<ICmpInst>(LatchBr->getCondition()), Inc, Limits))
+    return false;
+
+  for (BasicBlock *BB : Blocks)
+    for (Instruction &I : *BB)
+      for (User *U : I.users())
+        if (!Blocks.contains(cast<Instruction>(U)->getParent()))
+          return false;
+
+  // Branch to the copy of the loop when the iteration space (and so the
+  // IV and its increments) fits in 32 bits.
+  BasicBlock *Check = SplitEdge(Preheader, Header);
+  Check->setName(Header->getName() + ".iv32.check");
+  IRBuilder<> B(Check->getTerminator());
+  Constant *Max = ConstantInt::get(IVTy, UINT32_MAX);
+  Value *Fits = B.CreateAnd(B.CreateICmpULE(End, Max),
+                            B.CreateICmpULE(Step, B.CreateSub(Max, End)),
+                            "iv32.fits");
+
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 16> NewBlocks;
+  for (BasicBlock *BB : Blocks) {
+    BasicBlock *NewBB = CloneBasicBlock(BB, VMap, ".iv32", &F);
+    VMap[BB] = NewBB;
+    NewBlocks.push_back(NewBB);
+  }
+  remapInstructionsInBlocks(NewBlocks, VMap);
+  BasicBlock *NewHeader = cast<BasicBlock>(VMap[Header]);
+  ReplaceInstWithInst(Check->getTerminator(),
+                      BranchInst::Create(NewHeader, Header, Fits));
+
+  // Rewrite the IV of the copy and its increment in 32 bits.
+  auto *NewIV = cast<PHINode>(VMap[IV]);
+  auto *NewInc = cast<BinaryOperator>(VMap[Inc]);
+  Type *I32Ty = B.getInt32Ty();
+  B.SetInsertPoint(Check->getTerminator());
+  Value *Start32 = B.CreateTrunc(IV->getIncomingValueForBlock(Check), I32Ty);
+  Value *Step32 = B.CreateTrunc(Step, I32Ty);
+  PHINode *IV32 = PHINode::Create(I32Ty, 2, IV->getName() + ".iv32",
+                                  &NewHeader->front());
+  auto *Inc32 = BinaryOperator::CreateNUWAdd(
+      IV32, Step32, Inc->getName() + ".iv32", NewInc);
+  IV32->addIncoming(Start32, Check);
+  IV32->addIncoming(Inc32, cast<BasicBlock>(VMap[Latch]));
+
+  auto *WideInc = new ZExtInst(Inc32, IVTy, "", NewInc);
+  WideInc->setNonNeg();
+  for (Use &U : make_early_inc_range(NewInc->uses())) {
+    auto *Cmp = dyn_cast<ICmpInst>(U.getUser());
+    if (isLimitTest(Cmp, NewInc, Limits)) {
+      Value *Other = Cmp->getOperand(1 - U.getOperandNo());
+      B.SetInsertPoint(Check->getTerminator());
+      Cmp->setOperand(1 - U.getOperandNo(), B.CreateTrunc(Other, I32Ty));
+      U.set(Inc32);
+    } else
+      U.set(WideInc);
+  }
+  NewInc->eraseFromParent();
+  if (WideInc->use_empty())
+    WideInc->eraseFromParent();
+
+  auto *WideIV = new ZExtInst(IV32, IVTy, IV->getName() + ".wide",
+                              &*NewHeader->getFirstInsertionPt());
+  WideIV->setNonNeg();
+  NewIV->replaceAllUsesWith(WideIV);
+  NewIV->eraseFromParent();
+  return true;
+}
+
+/// Returns true if V has the same value in every thread of a launch: it
+/// is a kernel parameter, a load of a (byval) kernel parameter, or is
+/// computed from those in the kernel's entry block.
+static bool isLaunchInvariant(Value *V, BasicBlock *EntryBB,
+                              unsigned Depth = 0) {
+  if (isa<Argument>(V) || isa<Constant>(V))
+    return true;
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || I->getParent() != EntryBB || Depth > 4)
+    return false;
+  if (auto *LI = dyn_cast<LoadInst>(I)) {
+    auto *A = dyn_cast<Argument>(getUnderlyingObject(LI->getPointerOperand()));
+    return LI->isSimple() && A && A->hasByValAttr();
+  }
+  if (isa<PHINode>(I) || I->mayReadOrWriteMemory() || isa<CallBase>(I))
+    return false;
+  return all_of(I->operands(), [&](Value *Op) {
+    return isLaunchInvariant(Op, EntryBB, Depth + 1);
+  });
+}
+
+unsigned reduceGPUDivisions(Function &F, bool Strided) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  BasicBlock *EntryBB = &F.getEntryBlock();
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+
+  MapVector<Value *, SmallVector<BinaryOperator *, 4>> Divisions;
+  for (Instruction &I : instructions(F)) {
+    auto *BO = dyn_cast<BinaryOperator>(&I);
+    if (!BO || !BO->getType()->isIntegerTy())
+      continue;
+    Value *X = BO->getOperand(0), *D = BO->getOperand(1);
+    switch (BO->getOpcode()) {
+    case Instruction::UDiv:
+    case Instruction::URem:
+      break;
+    case Instruction::SDiv:
+    case Instruction::SRem: {
+      SimplifyQuery SQ(DL, &DT, nullptr, BO);
+      if (isKnownNonNegative(X, SQ) && isKnownNonNegative(D, SQ))
+        break;
+      continue;
+    }
+    default:
+      continue;
+    }
+    // Division by constants is left to the back-end.
+    if (isa<Constant>(D) || !isLaunchInvariant(D, EntryBB))
+      continue;
+    unsigned Bits = BO->getType()->getIntegerBitWidth();
+    if (Bits != 32 &&
+        (Bits != 64 || computeKnownBits(X, DL).countMinLeadingZeros() < 32))
+      continue;
+    Divisions[D].push_back(BO);
+  }
+
+  unsigned MinDepth = Strided ? 1 : 2;
+  unsigned NumReduced = 0;
+  for (auto &[D, Ops] : Divisions) {
+    if (Ops.size() == 1 && LI.getLoopDepth(Ops[0]->getParent()) < MinDepth)
+      continue;
+
+    // The inverse of d, by the round-up method of Granlund and Montgomery:
+    //   l = ceil(log2(d)), m = floor(2^32 * (2^l - d) / d) + 1,
+    //   x / d = (t + ((x - t) >> min(l, 1))) >> max(l - 1, 0),
+    // where t = mulhi(m, x).  The inverse is computed whether or not the
+    // divisions execute, so a zero divisor is computed as one.
+    auto *DI = dyn_cast<Instruction>(D);
+    IRBuilder<> B(DI ? &*std::next(DI->getIterator())
+                     : &*EntryBB->getFirstInsertionPt());
+    Type *I32Ty = B.getInt32Ty(), *I64Ty = B.getInt64Ty();
+    bool Wide = D->getType()->getIntegerBitWidth() == 64;
+    Value *Big = Wide ? B.CreateICmpUGT(D, B.getInt64(UINT32_MAX)) : nullptr;
+    Value *D32 = B.CreateBinaryIntrinsic(
+        Intrinsic::umax, B.CreateTrunc(D, I32Ty), B.getInt32(1), nullptr,
+        D->getName() + ".div32");
+    Value *L = B.CreateSub(
+        B.getInt32(32),
+        B.CreateIntrinsic(Intrinsic::ctlz, {I32Ty},
+                          {B.CreateSub(D32, B.getInt32(1)), B.getFalse()}));
+    Value *D64 = B.CreateZExt(D32, I64Ty);
+    Value *Num = B.CreateShl(
+        B.CreateSub(B.CreateShl(B.getInt64(1), B.CreateZExt(L, I64Ty)), D64),
+        32);
+    Value *M = B.CreateAdd(B.CreateTrunc(B.CreateUDiv(Num, D64), I32Ty),
+                           B.getInt32(1), D->getName() + ".magic");
+    Value *S1 = B.CreateBinaryIntrinsic(Intrinsic::umin, L, B.getInt32(1));
+    Value *S2 = B.CreateSub(L, S1);
+
+    for (BinaryOperator *BO : Ops) {
+      IRBuilder<> OB(BO);
+      Value *X = BO->getOperand(0);
+      Value *X32 = OB.CreateTrunc(X, I32Ty);
+      Value *T = OB.CreateTrunc(
+          OB.CreateLShr(OB.CreateMul(OB.CreateZExt(M, I64Ty),
+                                     OB.CreateZExt(X32, I64Ty)),
+                        32),
+          I32Ty);
+      Value *Q = OB.CreateLShr(
+          OB.CreateAdd(T, OB.CreateLShr(OB.CreateSub(X32, T), S1)), S2);
+      bool IsRem = BO->getOpcode() == Instruction::URem ||
+                   BO->getOpcode() == Instruction::SRem;
+      Value *R = IsRem ? OB.CreateSub(X32, OB.CreateMul(Q, D32)) : Q;
+      R = OB.CreateZExt(R, BO->getType());
+      // Divisors beyond 32 bits exceed the (32-bit) dividend.
+      if (Big)
+        R = OB.CreateSelect(Big, IsRem ? X : Constant::getNullValue(I64Ty), R);
+      R->takeName(BO);
+      BO->replaceAllUsesWith(R);
+      BO->eraseFromParent();
+      ++NumReduced;
+    }
+  }
+  return NumReduced;
+}
+
+/// Returns the small private array (a static alloca of at most MaxBytes)
+/// that Ptr points into, or null.
+static AllocaInst *getPrivateArray(Value *Ptr, const DataLayout &DL,
+                                   uint64_t MaxBytes) {
+  auto *AI = dyn_cast<AllocaInst>(getUnderlyingObject(Ptr));
+  if (!AI || !AI->isStaticAlloca())
+    return nullptr;
+  std::optional<TypeSize> Size = AI->getAllocationSize(DL);
+  if (!Size || Size->isScalable() || Size->getFixedValue() > MaxBytes)
+    return nullptr;
+  return AI;
+}
+
+/// Returns true if the loop metadata of L has an unroll hint.
+static bool hasUnrollHint(const Loop *L) {
+  MDNode *LoopID = L->getLoopID();
+  if (!LoopID)
+    return false;
+  for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i)
+    if (auto *MD = dyn_cast<MDNode>(LoopID->getOperand(i)))
+      if (auto *S = dyn_cast_or_null<MDString>(
+              MD->getNumOperands() ? MD->getOperand(0).get() : nullptr))
+        if (S->getString().starts_with("llvm.loop.unroll."))
+          return true;
+  return false;
+}
+
+unsigned markGPUPrivateArrayLoops(Function &F, uint64_t MaxBytes) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+
+  // The loops in which the index of an access to a private array varies.
+  SmallSetVector<Loop *, 4> Loops;
+  for (Instruction &I : instructions(F)) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(&I);
+    if (!GEP || GEP->hasAllConstantIndices() ||
+        !getPrivateArray(GEP->getPointerOperand(), DL, MaxBytes))
+      continue;
+    for (Loop *L = LI.getLoopFor(GEP->getParent()); L;
+         L = L->getParentLoop())
+      if (any_of(GEP->indices(),
+                 [&](Value *Idx) { return !L->isLoopInvariant(Idx); }))
+        Loops.insert(L);
+  }
+
+  // Explicit unroll hints (e.g., the coarsening of grid-stride loops)
+  // take precedence.  The hint only unrolls loops whose trip count turns
+  // out to be a (small) constant.
+  LLVMContext &Ctx = F.getContext();
+  unsigned NumMarked = 0;
+  for (Loop *L : Loops) {
+    if (hasUnrollHint(L))
+      continue;
+    SmallVector<Metadata *, 4> MDs;
+    MDs.push_back(nullptr);
+    if (MDNode *LoopID = L->getLoopID())
+      for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i)
+        MDs.push_back(LoopID->getOperand(i));
+    MDs.push_back(
+        MDNode::get(Ctx, MDString::get(Ctx, "llvm.loop.unroll.full")));
+    MDNode *NewLoopID = MDNode::getDistinct(Ctx, MDs);
+    NewLoopID->replaceOperandWith(0, NewLoopID);
+    L->setLoopID(NewLoopID);
+    ++NumMarked;
+  }
+  return NumMarked;
+}
+
+uint64_t promoteGPUPrivateArrays(Function &F, const GPUReductionHooks &Hooks,
+                                 unsigned MaxThreads, uint64_t MaxSharedBytes,
+                                 OptimizationRemarkEmitter &ORE,
+                                 const char *PassName) {
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  SmallVector<AllocaInst *, 4> Arrays;
+  for (Instruction &I : F.getEntryBlock())
+    if (auto *AI = dyn_cast<AllocaInst>(&I))
+      Arrays.push_back(AI);
+
+  uint64_t SharedBytes = 0;
+  Value *Tid = nullptr;
+  for (AllocaInst *AI : Arrays) {
+    std::optional<TypeSize> Size = AI->getAllocationSize(DL);
+    bool Static = AI->isStaticAlloca() && Size && !Size->isScalable();
+    uint64_t Bytes = Static ? Size->getFixedValue() : 0;
+
+    // Each thread gets a slice of the block's array.  A slice of an odd
+    // number of words puts the same element of neighboring threads in
+    // different banks, which the alignment of 4-byte elements allows.
+    uint64_t Align = AI->getAlign().value();
+    uint64_t Stride = alignTo(Bytes, std::max<uint64_t>(Align, 4));
+    if (Align <= 4 && (Stride / 4) % 2 == 0)
+      Stride += 4;
+    if (!Static || SharedBytes + Stride * MaxThreads > MaxSharedBytes) {
+      ORE.emit([&]() {
+        return OptimizationRemarkMissed(PassName, "LocalMemory", AI)
+               << "kernel '" << ore::NV("Kernel", F.getName())
+               << "' keeps a private array ("
+               << (Static ? ore::NV("Bytes", Bytes) : ore::NV("Bytes", "?"))
+               << " bytes per thread) in local memory";
+      });
+      continue;
+    }
+
+    if (!Tid) {
+      IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+      Tid = B.CreateZExtOrTrunc(Hooks.ThreadIdx(B), B.getInt64Ty(),
+                                "private.tid");
+    }
+    ArrayType *BufTy = ArrayType::get(Type::getInt8Ty(M.getContext()),
+                                      Stride * MaxThreads);
+    auto *Buf = new GlobalVariable(
+        M, BufTy, false, GlobalValue::InternalLinkage,
+        UndefValue::get(BufTy), F.getName() + "." + AI->getName() + ".shared",
+        nullptr, GlobalValue::NotThreadLocal, Hooks.SharedAddrSpace);
+    Buf->setAlignment(AI->getAlign());
+
+    IRBuilder<> B(AI);
+    Value *Slice = B.CreateInBoundsGEP(
+        B.getInt8Ty(), Buf, B.CreateMul(Tid, B.getInt64(Stride)),
+        AI->getName() + ".slice");
+    Slice = B.CreateAddrSpaceCast(Slice, AI->getType());
+    // Lifetime markers only apply to allocas.
+    for (User *U : make_early_inc_range(AI->users()))
+      if (auto *II = dyn_cast<IntrinsicInst>(U))
+        if (II->isLifetimeStartOrEnd())
+          II->eraseFromParent();
+    ORE.emit([&]() {
+      return OptimizationRemark(PassName, "SharedPrivateArray", AI)
+             << "kernel '" << ore::NV("Kernel", F.getName())
+             << "' keeps a private array (" << ore::NV("Bytes", Bytes)
+             << " bytes per thread) in shared memory";
+    });
+    Slice->takeName(AI);
+    AI->replaceAllUsesWith(Slice);
+    AI->eraseFromParent();
+    SharedBytes += Stride * MaxThreads;
+  }
+  return SharedBytes;
+}
+
+static cl::opt<GPUMathAccuracy> GPUMathAccuracyOpt(
+    "tapir-gpu-math", cl::init(GPUMathIEEE), cl::Hidden,
+    cl::desc("The accuracy of the device math functions used in kernels"),
+    cl::values(clEnumValN(GPUMathIEEE, "ieee",
+                          "The accuracy of the host functions (default)"),
+               clEnumValN(GPUMathFast, "fast",
+                          "Fast single precision transcendentals"),
+               clEnumValN(GPUMathApprox, "approx",
+                          "Fast transcendentals and approximate square "
+                          "roots")));
+
+GPUMathAccuracy getGPUMathAccuracy(const Function &F) {
+  if (GPUMathAccuracyOpt == GPUMathIEEE &&
+      (F.getFnAttribute("approx-func-fp-math").getValueAsBool() ||
+       F.getFnAttribute("unsafe-fp-math").getValueAsBool()))
+    return GPUMathFast;
+  return GPUMathAccuracyOpt;
+}
+
+GPUMathAccuracy getGPUMathAccuracy(const CallBase &CB) {
+  GPUMathAccuracy Acc = getGPUMathAccuracy(*CB.getFunction());
+  if (Acc == GPUMathIEEE && isa<FPMathOperator>(CB) && CB.hasApproxFunc())
+    return GPUMathFast;
+  return Acc;
+}
+
+namespace {
+
+// The libm functions with device replacements.  The single precision
+// form of each is the name with an 'f' suffix.
+enum GPUMathFlags {
+  // There is an llvm.<name> intrinsic that the back ends do not lower
+  // (to IEEE accuracy) themselves.
+  MathIntrinsic = 0x1,
+  // libdevice has a __nv_fast_<name>f variant.
+  MathFastNV = 0x2,
+  // ocml has an __ocml_native_<name>_f32 variant.
+  MathNativeOCML = 0x4,
+  // There is a hardware approximation of the single precision function.
+  MathApprox = 0x8,
+  // The function is only provided by libdevice.
+  MathNVOnly = 0x10
+};
+
+struct GPUMathDesc {
+  const char *Name;
+  // The base name of the ocml functions (if it differs from Name).
+  const char *OCMLName;
+  unsigned Flags;
+};
+
+const GPUMathDesc GPUMathTable[] = {
+    {"acos", nullptr, 0},
+    {"acosh", nullptr, 0},
+    {"asin", nullptr, 0},
+    {"asinh", nullptr, 0},
+    {"atan", nullptr, 0},
+    {"atan2", nullptr, 0},
+    {"atanh", nullptr, 0},
+    {"cbrt", nullptr, 0},
+    {"ceil", nullptr, 0},
+    {"copysign", nullptr, 0},
+    {"cos", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"cosh", nullptr, 0},
+    {"cospi", nullptr, 0},
+    {"cyl_bessel_i0", "i0", 0},
+    {"cyl_bessel_i1", "i1", 0},
+    {"erf", nullptr, 0},
+    {"erfc", nullptr, 0},
+    {"erfcinv", nullptr, 0},
+    {"erfcx", nullptr, 0},
+    {"erfinv", nullptr, 0},
+    {"exp", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"exp10", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"exp2", nullptr, MathIntrinsic | MathNativeOCML},
+    {"expm1", nullptr, 0},
+    {"fabs", nullptr, 0},
+    {"fdim", nullptr, 0},
+    {"floor", nullptr, 0},
+    {"fma", nullptr, 0},
+    {"fmax", nullptr, 0},
+    {"fmin", nullptr, 0},
+    {"fmod", nullptr, 0},
+    {"hypot", nullptr, 0},
+    {"ilogb", nullptr, 0},
+    {"j0", nullptr, 0},
+    {"j1", nullptr, 0},
+    {"ldexp", nullptr, 0},
+    {"lgamma", nullptr, 0},
+    {"log", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"log10", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"log1p", nullptr, 0},
+    {"log2", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"logb", nullptr, 0},
+    {"nearbyint", nullptr, 0},
+    {"nextafter", nullptr, 0},
+    {"pow", nullptr, MathIntrinsic | MathFastNV},
+    {"remainder", nullptr, 0},
+    {"rint", nullptr, 0},
+    {"round", nullptr, 0},
+    {"rsqrt", nullptr, MathApprox},
+    {"scalbn", nullptr, 0},
+    {"sin", nullptr, MathIntrinsic | MathFastNV | MathNativeOCML},
+    {"sincos", nullptr, MathFastNV | MathNVOnly},
+    {"sinh", nullptr, 0},
+    {"sinpi", nullptr, 0},
+    {"sqrt", nullptr, MathApprox},
+    {"tan", nullptr, MathIntrinsic | MathFastNV},
+    {"tanh", nullptr, 0},
+    {"tgamma", nullptr, 0},
+    {"trunc", nullptr, 0},
+    {"y0", nullptr, 0},
+    {"y1", nullptr, 0},
+};
+
+// The device functions for one libm function, by library and accuracy.
+struct GPUMathNames {
+  std::string Names[2][3];
+};
+
+// Build the map from the names of the libm functions (including their
+// glibc __<name>_finite aliases) and math intrinsics to their device
+// replacements.
+StringMap<GPUMathNames> buildGPUMathMap() {
+  StringMap<GPUMathNames> Map;
+  for (const GPUMathDesc &D : GPUMathTable) {
+    std::string Name = D.Name;
+    std::string OCMLName = D.OCMLName ? D.OCMLName : D.Name;
+    for (bool Single : {true, false}) {
+      std::string LibmName = Single ? Name + "f" : Name;
+      GPUMathNames N;
+      std::string &NV = N.Names[GPUMathLibDevice][GPUMathIEEE];
+      std::string &OCML = N.Names[GPUMathOCML][GPUMathIEEE];
+      NV = "__nv_" + LibmName;
+      if (!(D.Flags & MathNVOnly))
+        OCML = "__ocml_" + OCMLName + (Single ? "_f32" : "_f64");
+      for (GPUMathAccuracy Acc : {GPUMathFast, GPUMathApprox}) {
+        N.Names[GPUMathLibDevice][Acc] = NV;
+        N.Names[GPUMathOCML][Acc] = OCML;
+      }
+      if (Single) {
+        if (D.Flags & MathFastNV)
+          for (GPUMathAccuracy Acc : {GPUMathFast, GPUMathApprox})
+            N.Names[GPUMathLibDevice][Acc] = "__nv_fast_" + LibmName;
+        if (D.Flags & MathNativeOCML)
+          for (GPUMathAccuracy Acc : {GPUMathFast, GPUMathApprox})
+            N.Names[GPUMathOCML][Acc] = "__ocml_native_" + OCMLName + "_f32";
+        if (D.Flags & MathApprox) {
+          N.Names[GPUMathLibDevice][GPUMathApprox] =
+              "llvm.nvvm." + Name + ".approx.f";
+          N.Names[GPUMathOCML][GPUMathApprox] =
+              "__ocml_native_" + OCMLName + "_f32";
+        }
+      }
+      Map[LibmName] = N;
+      Map["__" + LibmName + "_finite"] = N;
+      if (D.Flags & MathIntrinsic)
+        Map["llvm." + Name + (Single ? ".f32" : ".f64")] = N;
+    }
+  }
+  return Map;
+}
+
+} // namespace
+
+StringRef getGPUMathFunction(StringRef Name, GPUMathLibrary Lib,
+                             GPUMathAccuracy Acc) {
+  static const StringMap<GPUMathNames> Map = buildGPUMathMap();
+  auto It = Map.find(Name);
+  if (It == Map.end())
+    return StringRef();
+  return It->second.Names[Lib][Acc];
+}
+
+static cl::opt<unsigned> GPUCodegenJobs(
+    "tapir-gpu-codegen-jobs", cl::init(0), cl::Hidden,
+    cl::desc("The maximum number of kernel modules whose device code is "
+             "generated at once (0 = half the hardware threads).  The "
+             "TAPIR_GPU_CODEGEN_JOBS environment variable may also be used"));
+
+/// Return the number of device code generation jobs that may run at once.
+static unsigned getGPUCodegenJobLimit() {
+  static const unsigned Limit = [] {
+    unsigned Jobs = GPUCodegenJobs;
+    if (Jobs == 0) {
+      std::optional<std::string> EnvJobs =
+          sys::Process::GetEnv("TAPIR_GPU_CODEGEN_JOBS");
+      if (EnvJobs)
+        StringRef(*EnvJobs).getAsInteger(10, Jobs);
+    }
+    // Each job runs the device pipeline and then external tools (ptxas,
+    // fatbinary, ld.lld) that are themselves multithreaded, so by default
+    // only half the hardware threads are given to device code generation.
+    if (Jobs == 0)
+      Jobs = std::max(1u, hardware_concurrency().compute_thread_count() / 2);
+    return Jobs;
+  }();
+  return Limit;
+}
+
+static std::mutex GPUCodegenMutex;
+static std::condition_variable GPUCodegenSlotFree;
+static unsigned GPUCodegenJobsRunning = 0;
+
+GPUCodegenJob::GPUCodegenJob() {
+  unsigned Limit = getGPUCodegenJobLimit();
+  std::unique_lock<std::mutex> Lock(GPUCodegenMutex);
+  GPUCodegenSlotFree.wait(Lock,
+                          [Limit] { return GPUCodegenJobsRunning < Limit; });
+  ++GPUCodegenJobsRunning;
+}
+
+GPUCodegenJob::~GPUCodegenJob() {
+  {
+    std::lock_guard<std::mutex> Lock(GPUCodegenMutex);
+    --GPUCodegenJobsRunning;
+  }
+  GPUCodegenSlotFree.notify_one();
+}
+
+void cacheGPUBinary(StringRef BinaryFileName, StringRef CacheFileName,
+                    StringRef ABIName) {
+  // The copy is written to a unique temporary file and renamed into place
+  // so that concurrent builds never see a partially written entry.
+  std::error_code EC =
+      sys::fs::create_directories(sys::path::parent_path(CacheFileName));
+  SmallString<255> TmpFileName;
+  if (!EC)
+    EC = sys::fs::createUniqueFile(CacheFileName + "-%%%%%%.tmp", TmpFileName);
+  if (!EC) {
+    EC = sys::fs::copy_file(BinaryFileName, TmpFileName);
+    if (!EC)
+      EC = sys::fs::rename(TmpFileName, CacheFileName);
+    if (EC)
+      sys::fs::remove(TmpFileName);
+  }
+  if (EC)
+    errs() << ABIName << ": warning -- unable to cache device binary '"
+           << CacheFileName << "': " << EC.message() << "\n";
+}
+
+void optimizeGPUHostCode(Module &M, unsigned OptLevel,
+                         StringRef RuntimePrefix) {
+  if (OptLevel == 0)
+    return;
+  if (OptLevel > 3)
+    OptLevel = 3;
+
+  // The functions with launches, and the calls of the runtime's fast
+  // paths within them.
+  SmallVector<Function *, 16> HostFns;
+  SmallVector<CallBase *, 16> FastPathCalls;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    bool CallsRuntime = false;
+    for (Instruction &I : instructions(F))
+      if (auto *CB = dyn_cast<CallBase>(&I))
+        if (Function *Callee = CB->getCalledFunction())
+          if (Callee->getName().starts_with(RuntimePrefix)) {
+            CallsRuntime = true;
+            if (Callee->hasAvailableExternallyLinkage())
+              FastPathCalls.push_back(CB);
+          }
+    if (CallsRuntime)
+      HostFns.push_back(&F);
+  }
+  for (CallBase *CB : FastPathCalls) {
+    InlineFunctionInfo IFI;
+    InlineFunction(*CB, IFI);
+  }
+
+  // The target machine provides the host's cost model to the passes.  A
+  // module without a registered target is still cleaned up, just with
+  // the default costs.
+  std::unique_ptr<TargetMachine> HostTM;
+  std::string LookupError;
+  Triple TT(M.getTargetTriple());
+  if (const Target *HostTarget =
+          TargetRegistry::lookupTarget("", TT, LookupError))
+    HostTM.reset(HostTarget->createTargetMachine(TT.str(), "", "",
+                                                 TargetOptions(), std::nullopt));
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(HostTM.get());
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // The launch setup reloads the launch streams, rebuilds argument
+  // arrays and repeats runtime checks from one launch to the next.
+  StringRef Pipeline =
+      OptLevel > 1 ? "sroa<modify-cfg>,early-cse<memssa>,instcombine,gvn,"
+                     "dse,adce,simplifycfg,instcombine"
+                   : "sroa<modify-cfg>,early-cse<memssa>,instcombine,"
+                     "simplifycfg";
+  FunctionPassManager FPM;
+  if (Error Err = PB.parsePassPipeline(FPM, Pipeline))
+    report_fatal_error(Twine("tapir: invalid host cleanup pipeline: ") +
+                       toString(std::move(Err)));
+  FPM.addPass(VerifierPass());
+  for (Function *F : HostFns)
+    FPM.run(*F, FAM);
 }
 
 } // namespace tapir
@@ -0,0 +1,414 @@
+//===- TapirHybridLoop.cpp - Run Tapir loops on the host and GPU ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements hybrid (host + GPU) execution of Tapir loops.  The
+// call to an outlined hybrid loop is lowered to:
+//
+//     split = __kitrt_hybrid_begin(&handle, name, start, end, &launch);
+//     <launch the kernel for [start, split)>     // asynchronous
+//     helper.host(split, end, ..., launch.host_grain);
+//     __kitrt_hybrid_host_done(&launch);
+//     ...
+//     sync                                        // waits for the kernel
+//     __kitrt_hybrid_end(&launch);
+//
+// where helper.host spawns tasks that each run a chunk of the host's
+// iterations with a serial copy of the outlined loop.  The runtime uses the
+// times recorded by the last two calls to pick the split of later
+// executions of the loop.
+//
+// It also implements the host fallback of GPU loops with small trip counts,
+// which lowers the call to an outlined loop to:
+//
+//     if (end - start <= max_trips &&
+//         __kitrt_host_fallback_begin(&handle, name, end - start,
+//                                     ptrs, num_ptrs, &run)) {
+//       helper.serial(start, end, ...);
+//       __kitrt_host_fallback_end(&run);
+//     } else
+//       <launch the kernel for [start, end)>
+//
+// where ptrs holds the loop's pointer arguments.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirHybridLoop.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Tapir/TapirGPUUtils.h"
+#include "llvm/Transforms/Tapir/TapirLoopInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-hybrid"
+
+cl::opt<bool> llvm::EnableTapirHostFallback(
+    "tapir-host-fallback", cl::init(true), cl::Hidden,
+    cl::desc("Keep a host copy of GPU loops and run launches with small "
+             "trip counts on the host when their data is in host memory "
+             "(default=true)"));
+
+static cl::opt<unsigned> HostFallbackMaxTrips(
+    "tapir-host-fallback-max-trips", cl::init(4096), cl::Hidden,
+    cl::desc("The largest trip count of a GPU loop that may run on the "
+             "host (default=4096)"));
+
+// Type of the runtime's record of a hybrid launch (KitRTHybridLaunch).
+// NOTE: This must match the kitsune runtime (kitrt.h).
+static StructType *getHybridLaunchType(LLVMContext &C) {
+  Type *I64Ty = Type::getInt64Ty(C);
+  return StructType::get(PointerType::getUnqual(C), I64Ty, I64Ty, I64Ty,
+                         I64Ty, I64Ty);
+}
+static const unsigned HybridLaunchGrainField = 5;
+
+HybridLoop::HybridLoop(Module &M, LoopOutlineProcessor *Device)
+    : LoopOutlineProcessor(M, Device->getDestinationModule()),
+      Device(Device) {}
+
+void HybridLoop::setupLoopOutlineArgs(Function &F, ValueSet &HelperArgs,
+                                      SmallVectorImpl<Value *> &HelperInputs,
+                                      ValueSet &InputSet,
+                                      const SmallVectorImpl<Value *> &LCArgs,
+                                      const SmallVectorImpl<Value *> &LCInputs,
+                                      const ValueSet &TLInputsFixed) {
+  Device->setupLoopOutlineArgs(F, HelperArgs, HelperInputs, InputSet, LCArgs,
+                               LCInputs, TLInputsFixed);
+  IVArgIndex = Device->getIVArgIndex(F, HelperArgs);
+  LimitArgIndex = Device->getLimitArgIndex(F, HelperArgs);
+}
+
+/// Copy the (serialized) outlined loop Helper into M for the host before it
+/// is transformed into a kernel.  The helper was created in the device
+/// module, where VMap (the map used to outline it) replaced the globals and
+/// functions of M by their device copies (e.g., the _devvar globals and the
+/// libdevice math functions).  These are mapped back to the values of M;
+/// the rest of the helper (e.g., its debug info) still refers to M, so it
+/// is cloned as if it were in M.
+static Function *cloneSerialLoop(Function *Helper, Module &M,
+                                 const ValueToValueMapTy &VMap) {
+  Function *Serial = Function::Create(Helper->getFunctionType(),
+                                      GlobalValue::InternalLinkage,
+                                      Helper->getName() + ".serial");
+  ValueToValueMapTy CloneMap;
+  for (const auto &Entry : VMap) {
+    auto *HostGV = dyn_cast<GlobalValue>(const_cast<Value *>(Entry.first));
+    Value *DeviceV = Entry.second;
+    auto *DeviceGV = dyn_cast_or_null<GlobalValue>(DeviceV);
+    if (HostGV && DeviceGV && HostGV->getParent() == &M &&
+        DeviceGV->getParent() != &M)
+      CloneMap[DeviceGV] = HostGV;
+  }
+  for (auto [Arg, NewArg] : zip(Helper->args(), Serial->args())) {
+    NewArg.setName(Arg.getName());
+    CloneMap[&Arg] = &NewArg;
+  }
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(Serial, Helper, CloneMap,
+                    CloneFunctionChangeType::GlobalChanges, Returns);
+  M.getFunctionList().push_back(Serial);
+  Serial->setLinkage(GlobalValue::InternalLinkage);
+  Serial->setCallingConv(CallingConv::Fast);
+  Serial->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return Serial;
+}
+
+void HybridLoop::postProcessOutline(TapirLoopInfo &TL, TaskOutlineInfo &Out,
+                                    ValueToValueMapTy &VMap) {
+  SerialHelper = cloneSerialLoop(Out.Outline, M, VMap);
+  HostHelper = createHostHelper(SerialHelper);
+
+  Device->postProcessOutline(TL, Out, VMap);
+}
+
+/// Create the function that runs the host's part of a hybrid loop: the
+/// iterations [start, end) are split into chunks of 'grain' iterations
+/// (the last parameter), each of which is spawned as a task that runs the
+/// serial copy of the outlined loop.
+Function *HybridLoop::createHostHelper(Function *Serial) {
+  LLVMContext &C = M.getContext();
+  Type *IVTy = Serial->getArg(IVArgIndex)->getType();
+  SmallVector<Type *, 8> Params(Serial->getFunctionType()->params());
+  Params.push_back(IVTy);
+  Function *Host = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), Params, false),
+      GlobalValue::InternalLinkage, Serial->getName() + ".host", M);
+  if (Serial->doesNotThrow())
+    Host->setDoesNotThrow();
+
+  BasicBlock *Entry = BasicBlock::Create(C, "entry", Host);
+  BasicBlock *Header = BasicBlock::Create(C, "chunk.header", Host);
+  BasicBlock *Body = BasicBlock::Create(C, "chunk.body", Host);
+  BasicBlock *Cont = BasicBlock::Create(C, "chunk.cont", Host);
+  BasicBlock *SyncBB = BasicBlock::Create(C, "chunk.sync", Host);
+  BasicBlock *Exit = BasicBlock::Create(C, "exit", Host);
+
+  IRBuilder<> B(Entry);
+  Value *SR = B.CreateCall(
+      Intrinsic::getDeclaration(&M, Intrinsic::syncregion_start), {},
+      "syncreg");
+  Value *Start = Host->getArg(IVArgIndex);
+  Value *End = Host->getArg(LimitArgIndex);
+  Value *Grain = Host->getArg(Params.size() - 1);
+  B.CreateCondBr(B.CreateICmpULT(Start, End), Header, Exit);
+
+  B.SetInsertPoint(Header);
+  PHINode *IV = B.CreatePHI(IVTy, 2, "chunk.start");
+  IV->addIncoming(Start, Entry);
+  DetachInst::Create(Body, Cont, SR, Header);
+
+  // The last chunk ends at the end of the iterations.
+  B.SetInsertPoint(Body);
+  Value *Remaining = B.CreateSub(End, IV);
+  Value *IsLast = B.CreateICmpULE(Remaining, Grain);
+  Value *ChunkEnd = B.CreateSelect(IsLast, End, B.CreateAdd(IV, Grain));
+  SmallVector<Value *, 8> Args;
+  for (Argument &A : Host->args())
+    if (A.getArgNo() < Serial->arg_size())
+      Args.push_back(&A);
+  Args[IVArgIndex] = IV;
+  Args[LimitArgIndex] = ChunkEnd;
+  CallInst *Call = B.CreateCall(Serial, Args);
+  Call->setCallingConv(Serial->getCallingConv());
+  ReattachInst::Create(Cont, SR, Body);
+
+  B.SetInsertPoint(Cont);
+  Value *Next = B.CreateAdd(IV, Grain, "chunk.next");
+  IV->addIncoming(Next, Cont);
+  B.CreateCondBr(B.CreateICmpUGT(Remaining, Grain), Header, SyncBB);
+
+  SyncInst::Create(Exit, SR, SyncBB);
+  ReturnInst::Create(C, Exit);
+  return Host;
+}
+
+void HybridLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                         TaskOutlineInfo &TOI,
+                                         DominatorTree &DT) {
+  // The call is replaced by the kernel launch, so the host part is added
+  // after it.  (The GPU targets only support calls to outlined loops.)
+  auto *Call = dyn_cast<CallInst>(TOI.ReplCall);
+  if (!Call) {
+    LLVM_DEBUG(dbgs() << "tapir-hybrid: running the outlined loop "
+                      << TOI.Outline->getName() << " on the gpu only.\n");
+    HostHelper->eraseFromParent();
+    SerialHelper->eraseFromParent();
+    Device->processOutlinedLoopCall(TL, TOI, DT);
+    return;
+  }
+
+  Function *Parent = Call->getFunction();
+  LLVMContext &C = M.getContext();
+  Type *I64Ty = Type::getInt64Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  StructType *LaunchTy = getHybridLaunchType(C);
+
+  // The launch record is reset in the entry block so that the runtime
+  // ignores syncs that are reached without executing the loop.
+  IRBuilder<> EntryBuilder(&*Parent->getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Launch =
+      EntryBuilder.CreateAlloca(LaunchTy, nullptr, "hybrid.launch");
+  EntryBuilder.CreateStore(ConstantPointerNull::get(PtrTy),
+                           EntryBuilder.CreateStructGEP(LaunchTy, Launch, 0));
+
+  // Each loop gets a (null initialized) handle for the runtime's record
+  // of the loop's earlier executions.
+  std::string Name = TOI.Outline->getName().str();
+  auto *Handle = new GlobalVariable(M, PtrTy, false,
+                                    GlobalValue::InternalLinkage,
+                                    ConstantPointerNull::get(PtrTy),
+                                    Name + ".hybrid");
+  Constant *NameStr = tapir::createConstantStr(Name, M, Name + ".hybrid.name");
+
+  FunctionCallee BeginFn = M.getOrInsertFunction(
+      "__kitrt_hybrid_begin", I64Ty, PtrTy, PtrTy, I64Ty, I64Ty, PtrTy);
+  FunctionCallee HostDoneFn = M.getOrInsertFunction(
+      "__kitrt_hybrid_host_done", Type::getVoidTy(C), PtrTy);
+  FunctionCallee EndFn = M.getOrInsertFunction(
+      "__kitrt_hybrid_end", Type::getVoidTy(C), PtrTy);
+
+  IRBuilder<> B(Call);
+  Value *Start = Call->getArgOperand(IVArgIndex);
+  Value *End = Call->getArgOperand(LimitArgIndex);
+  Type *IVTy = Start->getType();
+  Value *Split = B.CreateCall(
+      BeginFn, {Handle, NameStr, B.CreateIntCast(Start, I64Ty, false),
+                B.CreateIntCast(End, I64Ty, false), Launch});
+  Split = B.CreateIntCast(Split, IVTy, false, "hybrid.split");
+  Call->setArgOperand(LimitArgIndex, Split);
+  bool LimitSet = Device->setOutlinedLoopLimit(Split);
+  assert(LimitSet && "hybrid loops need a partial launch of the kernel");
+  (void)LimitSet;
+
+  // Run the host's part of the iterations while the kernel runs.
+  B.SetInsertPoint(Call->getNextNode());
+  SmallVector<Value *, 8> HostArgs(Call->args());
+  HostArgs[IVArgIndex] = Split;
+  HostArgs[LimitArgIndex] = End;
+  Value *Grain = B.CreateLoad(
+      I64Ty, B.CreateStructGEP(LaunchTy, Launch, HybridLaunchGrainField));
+  HostArgs.push_back(B.CreateIntCast(Grain, IVTy, false));
+  B.CreateCall(HostHelper, HostArgs);
+  B.CreateCall(HostDoneFn, {Launch});
+
+  Device->processOutlinedLoopCall(TL, TOI, DT);
+
+  // The syncs of the loop's region wait for the kernel.  (Targets insert
+  // their waits at the start of the sync's continuation.)
+  if (TOI.SR) {
+    for (User *U : TOI.SR->users())
+      if (auto *SI = dyn_cast<SyncInst>(U))
+        if (SI->getFunction() == Parent)
+          IRBuilder<>(&*SI->getSuccessor(0)->getFirstInsertionPt())
+              .CreateCall(EndFn, {Launch});
+  }
+}
+
+// Type of the runtime's record of a host run (KitRTHostFallback).
+// NOTE: This must match the kitsune runtime (kitrt.h).
+static StructType *getHostFallbackType(LLVMContext &C) {
+  Type *I64Ty = Type::getInt64Ty(C);
+  return StructType::get(PointerType::getUnqual(C), I64Ty, I64Ty);
+}
+
+HostFallbackLoop::HostFallbackLoop(Module &M, LoopOutlineProcessor *Device)
+    : LoopOutlineProcessor(M, Device->getDestinationModule()),
+      Device(Device) {}
+
+void HostFallbackLoop::setupLoopOutlineArgs(
+    Function &F, ValueSet &HelperArgs, SmallVectorImpl<Value *> &HelperInputs,
+    ValueSet &InputSet, const SmallVectorImpl<Value *> &LCArgs,
+    const SmallVectorImpl<Value *> &LCInputs, const ValueSet &TLInputsFixed) {
+  Device->setupLoopOutlineArgs(F, HelperArgs, HelperInputs, InputSet, LCArgs,
+                               LCInputs, TLInputsFixed);
+  IVArgIndex = Device->getIVArgIndex(F, HelperArgs);
+  LimitArgIndex = Device->getLimitArgIndex(F, HelperArgs);
+}
+
+void HostFallbackLoop::postProcessOutline(TapirLoopInfo &TL,
+                                          TaskOutlineInfo &Out,
+                                          ValueToValueMapTy &VMap) {
+  // The host and the GPU have their own copies of global variables, so
+  // loops that use (writable) globals stay on the GPU.  The loop's data
+  // is otherwise passed in its arguments.
+  bool UsesGlobals = false;
+  for (Instruction &I : instructions(Out.Outline))
+    for (Value *Op : I.operands())
+      if (auto *GV = dyn_cast<GlobalVariable>(Op->stripPointerCasts()))
+        UsesGlobals |= !GV->isConstant();
+  if (UsesGlobals)
+    LLVM_DEBUG(dbgs() << "tapir-host-fallback: " << Out.Outline->getName()
+                      << " uses global variables, no host copy.\n");
+  else
+    SerialHelper = cloneSerialLoop(Out.Outline, M, VMap);
+
+  Device->postProcessOutline(TL, Out, VMap);
+}
+
+void HostFallbackLoop::processOutlinedLoopCall(TapirLoopInfo &TL,
+                                               TaskOutlineInfo &TOI,
+                                               DominatorTree &DT) {
+  auto *Call = dyn_cast<CallInst>(TOI.ReplCall);
+  if (!Call || !SerialHelper) {
+    if (SerialHelper)
+      SerialHelper->eraseFromParent();
+    Device->processOutlinedLoopCall(TL, TOI, DT);
+    return;
+  }
+
+  Function *Parent = Call->getFunction();
+  LLVMContext &C = M.getContext();
+  Type *I32Ty = Type::getInt32Ty(C);
+  Type *I64Ty = Type::getInt64Ty(C);
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  StructType *RunTy = getHostFallbackType(C);
+
+  // The launch is split into:
+  //
+  //   Head:   br (trips <= max) ? Check : Launch
+  //   Check:  br __kitrt_host_fallback_begin(...) ? Host : Launch
+  //   Host:   <serial copy>; br Tail
+  //   Launch: <call to the outlined loop>; br Tail
+  BasicBlock *Head = Call->getParent();
+  BasicBlock *Tail = SplitBlock(Head, Call->getNextNode(), &DT);
+  BasicBlock *Launch = SplitBlock(Head, Call, &DT, nullptr, nullptr,
+                                  "fallback.launch");
+  BasicBlock *Check =
+      BasicBlock::Create(C, "fallback.check", Parent, Launch);
+  BasicBlock *Host = BasicBlock::Create(C, "fallback.host", Parent, Launch);
+
+  IRBuilder<> B(Head->getTerminator());
+  Value *Start = B.CreateIntCast(Call->getArgOperand(IVArgIndex), I64Ty, false);
+  Value *End = B.CreateIntCast(Call->getArgOperand(LimitArgIndex), I64Ty,
+                               false);
+  Value *Trips = B.CreateSelect(B.CreateICmpUGT(End, Start),
+                                B.CreateSub(End, Start),
+                                ConstantInt::get(I64Ty, 0), "fallback.trips");
+  Value *Small = B.CreateICmpULE(
+      Trips, ConstantInt::get(I64Ty, HostFallbackMaxTrips), "fallback.small");
+  B.CreateCondBr(Small, Check, Launch);
+  Head->getTerminator()->eraseFromParent();
+
+  // Each loop gets a (null initialized) handle for the runtime's record
+  // of the loop's earlier host runs.
+  std::string Name = TOI.Outline->getName().str();
+  auto *Handle = new GlobalVariable(M, PtrTy, false,
+                                    GlobalValue::InternalLinkage,
+                                    ConstantPointerNull::get(PtrTy),
+                                    Name + ".fallback");
+  Constant *NameStr =
+      tapir::createConstantStr(Name, M, Name + ".fallback.name");
+  FunctionCallee BeginFn = M.getOrInsertFunction(
+      "__kitrt_host_fallback_begin", Type::getInt1Ty(C), PtrTy, PtrTy, I64Ty,
+      PtrTy, I32Ty, PtrTy);
+  FunctionCallee EndFn = M.getOrInsertFunction(
+      "__kitrt_host_fallback_end", Type::getVoidTy(C), PtrTy);
+
+  // The runtime checks that the loop's data is in host memory.
+  SmallVector<Value *, 8> Ptrs;
+  for (Value *Arg : Call->args())
+    if (Arg->getType()->isPointerTy() && !isa<Constant>(Arg))
+      Ptrs.push_back(Arg);
+  IRBuilder<> EntryBuilder(&*Parent->getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Run = EntryBuilder.CreateAlloca(RunTy, nullptr, "fallback.run");
+  AllocaInst *PtrArray = EntryBuilder.CreateAlloca(
+      ArrayType::get(PtrTy, std::max<size_t>(1, Ptrs.size())), nullptr,
+      "fallback.ptrs");
+
+  B.SetInsertPoint(Check);
+  for (unsigned I = 0; I < Ptrs.size(); I++)
+    B.CreateStore(Ptrs[I], B.CreateConstInBoundsGEP2_32(
+                               PtrArray->getAllocatedType(), PtrArray, 0, I));
+  Value *OnHost = B.CreateCall(
+      BeginFn, {Handle, NameStr, Trips, PtrArray,
+                ConstantInt::get(I32Ty, Ptrs.size()), Run});
+  B.CreateCondBr(OnHost, Host, Launch);
+
+  B.SetInsertPoint(Host);
+  CallInst *SerialCall =
+      B.CreateCall(SerialHelper, SmallVector<Value *, 8>(Call->args()));
+  SerialCall->setCallingConv(SerialHelper->getCallingConv());
+  SerialCall->setDebugLoc(Call->getDebugLoc());
+  B.CreateCall(EndFn, {Run});
+  B.CreateBr(Tail);
+
+  DT.addNewBlock(Check, Head);
+  DT.addNewBlock(Host, Check);
+  DT.changeImmediateDominator(Tail, Head);
+
+  LLVM_DEBUG(dbgs() << "tapir-host-fallback: launches of " << Name
+                    << " with at most " << HostFallbackMaxTrips
+                    << " iterations may run on the host.\n");
+  Device->processOutlinedLoopCall(TL, TOI, DT);
+}
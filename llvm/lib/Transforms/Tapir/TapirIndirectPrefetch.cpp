@@ -0,0 +1,352 @@
+//===- TapirIndirectPrefetch.cpp - Prefetch indirect accesses -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass prefetches the indirect accesses of the serial loops in the
+// bodies of CPU-targeted Tapir loops: the strips that LoopStripMine carves
+// out of a Tapir loop, and the loops nested in them.  An access such as
+//
+//   for (size_t offset = start; offset < end; ++offset)
+//     xc += coords[2 * cell_nodes[offset]];
+//
+// misses in the cache on every iteration once coords is large, and the
+// hardware prefetchers can follow cell_nodes but not coords.  The pass loads
+// the index some iterations ahead, recomputes the address of the access from
+// it, and prefetches that address:
+//
+//   __builtin_prefetch(&coords[2 * cell_nodes[min(offset + d, end - 1)]]);
+//
+// The distance d is the number of iterations, estimated from the latencies
+// of the instructions of the loop, that cover the latency of a miss
+// (-tapir-prefetch-latency).  The index is only loaded at iterations the
+// loop executes, so that the extra load can not fault and the prefetches of
+// a strip stay within the strip.
+//
+// The pass runs after the loop vectorizer, which the prefetch calls would
+// get in the way of, and leaves the accesses it vectorized alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirIndirectPrefetch.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-indirect-prefetch"
+
+STATISTIC(NumPrefetches, "Number of indirect accesses prefetched");
+
+static cl::opt<unsigned> PrefetchLatency(
+    "tapir-prefetch-latency", cl::Hidden, cl::init(300),
+    cl::desc("Latency, in cycles, that the prefetches of indirect accesses "
+             "in Tapir loop bodies should cover."));
+
+static cl::opt<unsigned> MaxPrefetchDistance(
+    "tapir-prefetch-max-distance", cl::Hidden, cl::init(64),
+    cl::desc("Maximum number of iterations ahead that indirect accesses in "
+             "Tapir loop bodies are prefetched."));
+
+/// The maximum number of instructions between the load of an index and the
+/// address of the access through it.
+static const unsigned MaxChainLength = 8;
+
+namespace {
+
+/// An indirect access to prefetch: the load or store, the load of its index,
+/// and the instructions that compute its address from the index, in order.
+struct IndirectAccess {
+  Instruction *MemI = nullptr;
+  LoadInst *Index = nullptr;
+  SmallVector<Instruction *, 4> Chain;
+};
+
+/// How an address, or a value it is computed from, depends on the values
+/// loaded in a loop.
+enum class AddressDep { Invariant, Indexed, Other };
+
+class TapirIndirectPrefetch {
+public:
+  TapirIndirectPrefetch(DominatorTree &DT, LoopInfo &LI, TaskInfo &TI,
+                        ScalarEvolution &SE, const TargetTransformInfo &TTI,
+                        const DataLayout &DL)
+      : DT(DT), LI(LI), TI(TI), SE(SE), TTI(TTI), DL(DL) {}
+
+  /// Prefetch the indirect accesses of the loops in the bodies of CPU Tapir
+  /// loops in the function.  Returns true if any prefetches were inserted.
+  bool run();
+
+private:
+  bool processLoop(Loop *L);
+  bool isInCPUTapirLoopBody(const Loop *L) const;
+  bool findIndirectAccess(Instruction *MemI, Loop *L, IndirectAccess &A) const;
+  unsigned getPrefetchDistance(Loop *L) const;
+  LoadInst *loadIndexAhead(LoadInst *Index, Loop *L, unsigned Distance,
+                           SCEVExpander &Expander);
+
+  DominatorTree &DT;
+  LoopInfo &LI;
+  TaskInfo &TI;
+  ScalarEvolution &SE;
+  const TargetTransformInfo &TTI;
+  const DataLayout &DL;
+};
+
+} // end anonymous namespace
+
+static bool isGPULoop(const Loop *L) {
+  TapirLoopHints Hints(L);
+  TapirTargetID TargetID = (TapirTargetID)Hints.getLoopTarget();
+  return TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip ||
+         TargetID == TapirTargetID::LevelZero ||
+         TargetID == TapirTargetID::Multi;
+}
+
+/// Returns true if L runs within the body of its innermost enclosing Tapir
+/// loop and that loop is lowered for the CPU.
+bool TapirIndirectPrefetch::isInCPUTapirLoopBody(const Loop *L) const {
+  for (const Loop *P = L->getParentLoop(); P; P = P->getParentLoop())
+    if (Task *T = getTaskIfTapirLoop(P, &TI))
+      return !isGPULoop(P) && T->encloses(L->getHeader());
+  return false;
+}
+
+/// Classify the value V used in an address computed in the loop L.  V is
+/// invariant in L, computed from the single index load Index in L through
+/// the instructions appended to Chain, or computed in some other way.
+static AddressDep classifyAddress(Value *V, const Loop *L, LoadInst *&Index,
+                                  SmallVectorImpl<Instruction *> &Chain,
+                                  unsigned Depth) {
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || !L->contains(I))
+    return AddressDep::Invariant;
+  if (auto *Load = dyn_cast<LoadInst>(I)) {
+    if (!Load->isSimple() || (Index && Index != Load))
+      return AddressDep::Other;
+    Index = Load;
+    return AddressDep::Indexed;
+  }
+  // Only speculatable arithmetic is recomputed from the index ahead.
+  if (Depth >= MaxChainLength ||
+      !(isa<GetElementPtrInst>(I) || isa<CastInst>(I) ||
+        isa<BinaryOperator>(I)) ||
+      !isSafeToSpeculativelyExecute(I))
+    return AddressDep::Other;
+
+  bool Indexed = false;
+  for (Value *Op : I->operands()) {
+    switch (classifyAddress(Op, L, Index, Chain, Depth + 1)) {
+    case AddressDep::Other:
+      return AddressDep::Other;
+    case AddressDep::Indexed:
+      Indexed = true;
+      break;
+    case AddressDep::Invariant:
+      break;
+    }
+  }
+  if (!Indexed)
+    return AddressDep::Invariant;
+  if (!is_contained(Chain, I))
+    Chain.push_back(I);
+  return AddressDep::Indexed;
+}
+
+/// Returns true if MemI, in L, accesses memory at an address computed from
+/// an index that L loads on every iteration from a strided address, and
+/// fills in A.
+bool TapirIndirectPrefetch::findIndirectAccess(Instruction *MemI, Loop *L,
+                                               IndirectAccess &A) const {
+  Value *Ptr = getLoadStorePointerOperand(MemI);
+  // Skip the gathers and scatters of vectorized loops.
+  if (!Ptr || !Ptr->getType()->isPointerTy())
+    return false;
+  if (classifyAddress(Ptr, L, A.Index, A.Chain, 0) != AddressDep::Indexed)
+    return false;
+
+  LoadInst *Index = A.Index;
+  if (LI.getLoopFor(Index->getParent()) != L ||
+      !DT.dominates(Index->getParent(), L->getLoopLatch()))
+    return false;
+  auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Index->getPointerOperand()));
+  if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+      !isa<SCEVConstant>(AR->getStepRecurrence(SE)))
+    return false;
+
+  A.MemI = MemI;
+  return true;
+}
+
+/// Returns the number of iterations of L to prefetch ahead: enough to cover
+/// the latency of a miss with the estimated cycles of an iteration, but
+/// fewer than the iterations of a short loop.
+unsigned TapirIndirectPrefetch::getPrefetchDistance(Loop *L) const {
+  InstructionCost Cycles = 0;
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      Cycles += TTI.getInstructionCost(&I, TargetTransformInfo::TCK_Latency);
+
+  uint64_t Distance = MaxPrefetchDistance;
+  if (std::optional<InstructionCost::CostType> C = Cycles.getValue())
+    if (*C > 0)
+      Distance = std::min<uint64_t>(divideCeil(PrefetchLatency, *C), Distance);
+  if (unsigned TripCount = SE.getSmallConstantMaxTripCount(L))
+    if (Distance >= TripCount)
+      Distance = TripCount / 2;
+  return std::max<uint64_t>(Distance, 1);
+}
+
+/// Load the index that Index loads Distance iterations of L ahead, or at the
+/// last iteration of L when that comes sooner.  Returns null if the address
+/// can not be computed in L.
+LoadInst *TapirIndirectPrefetch::loadIndexAhead(LoadInst *Index, Loop *L,
+                                                unsigned Distance,
+                                                SCEVExpander &Expander) {
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  auto *AR = cast<SCEVAddRecExpr>(SE.getSCEV(Index->getPointerOperand()));
+  Type *CountTy = BTC->getType();
+  const SCEV *Iter = SE.getUMinExpr(
+      SE.getAddRecExpr(SE.getConstant(CountTy, Distance), SE.getOne(CountTy),
+                       L, SCEV::FlagAnyWrap),
+      BTC);
+  const SCEV *Step = AR->getStepRecurrence(SE);
+  const SCEV *Addr = SE.getAddExpr(
+      AR->getStart(),
+      SE.getMulExpr(SE.getTruncateOrZeroExtend(Iter, Step->getType()), Step));
+
+  Instruction *InsertPt = Index->getNextNode();
+  if (!Expander.isSafeToExpandAt(Addr, InsertPt))
+    return nullptr;
+  Value *Ptr =
+      Expander.expandCodeFor(Addr, Index->getPointerOperandType(), InsertPt);
+  auto *Ahead = cast<LoadInst>(Index->clone());
+  Ahead->setOperand(LoadInst::getPointerOperandIndex(), Ptr);
+  Ahead->setName(Index->getName() + ".ahead");
+  Ahead->insertBefore(InsertPt);
+  return Ahead;
+}
+
+bool TapirIndirectPrefetch::processLoop(Loop *L) {
+  // The bodies of Tapir loops run as tasks of their own.
+  if (getTaskIfTapirLoop(L, &TI) || !isInCPUTapirLoopBody(L) ||
+      !L->isLoopSimplifyForm() ||
+      isa<SCEVCouldNotCompute>(SE.getBackedgeTakenCount(L)))
+    return false;
+
+  SmallVector<IndirectAccess, 4> Accesses;
+  for (BasicBlock *BB : L->blocks()) {
+    if (LI.getLoopFor(BB) != L)
+      continue;
+    for (Instruction &I : *BB) {
+      if (!isa<LoadInst>(I) && !isa<StoreInst>(I))
+        continue;
+      IndirectAccess A;
+      if (findIndirectAccess(&I, L, A))
+        Accesses.push_back(std::move(A));
+    }
+  }
+  if (Accesses.empty())
+    return false;
+
+  unsigned Distance = getPrefetchDistance(L);
+  unsigned LineSize = TTI.getCacheLineSize() ? TTI.getCacheLineSize() : 64;
+  LLVM_DEBUG(dbgs() << "Prefetching " << Accesses.size()
+                    << " indirect accesses " << Distance
+                    << " iterations ahead in loop "
+                    << L->getHeader()->getName() << "\n");
+
+  SCEVExpander Expander(SE, DL, "prefetch");
+  DenseMap<LoadInst *, LoadInst *> IndicesAhead;
+  SmallVector<const SCEV *, 4> Prefetched;
+  bool Changed = false;
+  for (IndirectAccess &A : Accesses) {
+    // Accesses within a line of one already prefetched, such as the y
+    // coordinate next to the x, share its prefetch.
+    const SCEV *Addr = SE.getSCEV(getLoadStorePointerOperand(A.MemI));
+    if (any_of(Prefetched, [&](const SCEV *P) {
+          auto *Diff = dyn_cast<SCEVConstant>(SE.getMinusSCEV(Addr, P));
+          return Diff && Diff->getAPInt().abs().ult(LineSize);
+        }))
+      continue;
+
+    auto It = IndicesAhead.find(A.Index);
+    if (It == IndicesAhead.end()) {
+      LoadInst *Ahead = loadIndexAhead(A.Index, L, Distance, Expander);
+      It = IndicesAhead.insert({A.Index, Ahead}).first;
+    }
+    if (!It->second)
+      continue;
+
+    // Recompute the address from the index ahead.  The flags of the
+    // original computation need not hold for it.
+    ValueToValueMapTy VMap;
+    VMap[A.Index] = It->second;
+    for (Instruction *I : A.Chain) {
+      Instruction *Clone = I->clone();
+      Clone->setName(I->getName() + ".ahead");
+      Clone->dropPoisonGeneratingFlags();
+      RemapInstruction(Clone, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+      Clone->insertBefore(A.MemI);
+      VMap[I] = Clone;
+    }
+    Value *PrefetchPtr = VMap[getLoadStorePointerOperand(A.MemI)];
+
+    IRBuilder<> Builder(A.MemI);
+    Function *PrefetchFunc = Intrinsic::getDeclaration(
+        A.MemI->getModule(), Intrinsic::prefetch, PrefetchPtr->getType());
+    Builder.CreateCall(PrefetchFunc,
+                       {PrefetchPtr, Builder.getInt32(isa<StoreInst>(A.MemI)),
+                        Builder.getInt32(3), Builder.getInt32(1)});
+    LLVM_DEBUG(dbgs() << "  Prefetched " << *A.MemI << "\n");
+    Prefetched.push_back(Addr);
+    ++NumPrefetches;
+    Changed = true;
+  }
+  return Changed;
+}
+
+bool TapirIndirectPrefetch::run() {
+  bool Changed = false;
+  for (Loop *L : LI.getLoopsInPreorder())
+    Changed |= processLoop(L);
+  return Changed;
+}
+
+PreservedAnalyses TapirIndirectPrefetchPass::run(Function &F,
+                                                 FunctionAnalysisManager &AM) {
+  auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+  auto &LI = AM.getResult<LoopAnalysis>(F);
+  auto &TI = AM.getResult<TaskAnalysis>(F);
+  auto &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+  auto &TTI = AM.getResult<TargetIRAnalysis>(F);
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  if (!TapirIndirectPrefetch(DT, LI, TI, SE, TTI, DL).run())
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<TaskAnalysis>();
+  return PA;
+}
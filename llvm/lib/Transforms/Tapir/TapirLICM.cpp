@@ -0,0 +1,230 @@
+//===- TapirLICM.cpp - Hoist invariant code out of Tapir loops ------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass hoists loop-invariant loads out of the bodies of Tapir loops,
+// together with the computation that only depends on them (e.g., a pointer
+// base loaded from a struct, or sqrt(p->dt)).  LICM keeps such a load in the
+// body whenever the body also stores through a pointer it can not tell apart
+// from the load's, so every iteration -- on a GPU, every thread -- reloads
+// and recomputes the value.  Once hoisted, the value is computed by the
+// spawning code and becomes an argument of the outlined loop body (a scalar
+// kernel parameter on GPU targets).
+//
+// The iterations of a Tapir loop are logically parallel.  In a race-free
+// program, a location that one iteration reads is therefore not written by
+// any other iteration, and a load in the body sees the value the location
+// had before the loop unless its own iteration stored to the location
+// first.  A load with an invariant address can thus be hoisted to the
+// preheader if no store that may alias it can execute before it within an
+// iteration.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirLICM.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MustExecute.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-licm"
+
+STATISTIC(NumHoisted, "Number of instructions hoisted out of Tapir loops");
+STATISTIC(NumLoadsHoisted, "Number of loads hoisted out of Tapir loops");
+
+static cl::opt<unsigned> MaxLICMWrites(
+    "tapir-licm-max-writes", cl::Hidden, cl::init(256),
+    cl::desc("Maximum number of writes in a Tapir loop body for which loads "
+             "are considered for hoisting."));
+
+namespace {
+
+class TapirLICM {
+public:
+  TapirLICM(DominatorTree &DT, LoopInfo &LI, TaskInfo &TI, AAResults &AA)
+      : DT(DT), LI(LI), TI(TI), AA(AA) {}
+
+  /// Hoist invariant code out of all Tapir loops in the function.  Returns
+  /// true if anything was hoisted.
+  bool run();
+
+private:
+  bool processLoop(Loop *L);
+  bool canHoistLoad(LoadInst *Load, Loop *L, bool OnGPU,
+                    const LoopSafetyInfo &SafetyInfo,
+                    ArrayRef<Instruction *> Writes) const;
+
+  DominatorTree &DT;
+  LoopInfo &LI;
+  TaskInfo &TI;
+  AAResults &AA;
+};
+
+} // end anonymous namespace
+
+/// Returns true if the Tapir loop L targets a GPU.
+static bool isGPULoop(const Loop *L) {
+  TapirLoopHints Hints(L);
+  TapirTargetID TargetID = (TapirTargetID)Hints.getLoopTarget();
+  return TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip ||
+         TargetID == TapirTargetID::LevelZero ||
+         TargetID == TapirTargetID::Multi;
+}
+
+/// Returns true if the object Obj lives in host memory that no kernel
+/// writes: the stack of the spawning code or a constant global.  Loads from
+/// other memory are left to the GPU, where kernels launched earlier may
+/// still be writing it.
+static bool isHostOnlyObject(const Value *Obj) {
+  if (isa<AllocaInst>(Obj))
+    return true;
+  if (const auto *A = dyn_cast<Argument>(Obj))
+    return A->hasByValAttr();
+  if (const auto *GV = dyn_cast<GlobalVariable>(Obj))
+    return GV->isConstant();
+  return false;
+}
+
+bool TapirLICM::canHoistLoad(LoadInst *Load, Loop *L, bool OnGPU,
+                             const LoopSafetyInfo &SafetyInfo,
+                             ArrayRef<Instruction *> Writes) const {
+  if (!Load->isSimple())
+    return false;
+  if (OnGPU &&
+      !isHostOnlyObject(getUnderlyingObject(Load->getPointerOperand())))
+    return false;
+
+  // The load must not fault where it was not executed before: either it is
+  // safe to speculate or it runs in every iteration of a loop that is only
+  // entered when it has iterations.
+  if (!isSafeToSpeculativelyExecute(Load) &&
+      !(L->isRotatedForm() &&
+        SafetyInfo.isGuaranteedToExecute(*Load, &DT, &TI, L)))
+    return false;
+
+  // No store of the same iteration may write the location before the load.
+  // Reaching the load through the latch means going to another iteration,
+  // whose stores can not race with the load.
+  SmallPtrSet<BasicBlock *, 1> Latch;
+  Latch.insert(L->getLoopLatch());
+  MemoryLocation Loc = MemoryLocation::get(Load);
+  for (Instruction *W : Writes)
+    if (isModSet(AA.getModRefInfo(W, Loc)) &&
+        isPotentiallyReachable(W, Load, &Latch, &DT)) {
+      LLVM_DEBUG(dbgs() << "Load " << *Load << " may be clobbered by " << *W
+                        << "\n");
+      return false;
+    }
+  return true;
+}
+
+bool TapirLICM::processLoop(Loop *L) {
+  Task *T = getTaskIfTapirLoop(L, &TI);
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (!T || !Preheader || !L->getLoopLatch())
+    return false;
+
+  // The hoisted loads run ahead of the loop's own spawning code, which must
+  // not write memory.
+  for (BasicBlock *BB : L->blocks()) {
+    if (T->encloses(BB))
+      continue;
+    for (Instruction &I : *BB)
+      if (I.mayWriteToMemory() && !isa<DetachInst, ReattachInst, SyncInst>(I))
+        return false;
+  }
+
+  // Walk the body in dominance order, so that the operands of an
+  // instruction are hoisted before the instruction.
+  SmallVector<BasicBlock *, 16> Body;
+  SmallVector<Instruction *, 16> Writes;
+  for (DomTreeNode *N : depth_first(DT.getNode(T->getEntry()))) {
+    BasicBlock *BB = N->getBlock();
+    if (!T->encloses(BB))
+      continue;
+    Body.push_back(BB);
+    for (Instruction &I : *BB)
+      if (I.mayWriteToMemory() && !isa<DetachInst, ReattachInst, SyncInst>(I))
+        Writes.push_back(&I);
+  }
+  bool HoistLoads = Writes.size() <= MaxLICMWrites;
+  bool OnGPU = isGPULoop(L);
+
+  SimpleLoopSafetyInfo SafetyInfo;
+  SafetyInfo.computeLoopSafetyInfo(L);
+  Instruction *InsertPt = Preheader->getTerminator();
+  bool Changed = false;
+  for (BasicBlock *BB : Body) {
+    if (!L->contains(BB))
+      continue;
+    for (Instruction &I : make_early_inc_range(*BB)) {
+      if (!L->hasLoopInvariantOperands(&I))
+        continue;
+      if (auto *Load = dyn_cast<LoadInst>(&I)) {
+        if (!HoistLoads || !canHoistLoad(Load, L, OnGPU, SafetyInfo, Writes))
+          continue;
+        // Scoped alias metadata describes the load's place among the
+        // loop's tasks, which it is leaving.
+        Load->setMetadata(LLVMContext::MD_alias_scope, nullptr);
+        Load->setMetadata(LLVMContext::MD_noalias, nullptr);
+        ++NumLoadsHoisted;
+      } else if (isa<PHINode>(I) || isa<AllocaInst>(I) ||
+                 isa<DbgInfoIntrinsic>(I) || I.isTerminator() ||
+                 I.getType()->isTokenTy() || I.mayReadOrWriteMemory() ||
+                 !isSafeToSpeculativelyExecute(&I)) {
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "Hoisting " << I << " out of Tapir loop "
+                        << L->getHeader()->getName() << "\n");
+      I.moveBefore(InsertPt);
+      I.updateLocationAfterHoist();
+      ++NumHoisted;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+bool TapirLICM::run() {
+  bool Changed = false;
+  // Visit inner loops first, so that code hoisted out of an inner loop can
+  // continue out of the enclosing loops.
+  SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(Loops))
+    Changed |= processLoop(L);
+  return Changed;
+}
+
+PreservedAnalyses TapirLICMPass::run(Function &F,
+                                     FunctionAnalysisManager &AM) {
+  auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+  auto &LI = AM.getResult<LoopAnalysis>(F);
+  auto &TI = AM.getResult<TaskAnalysis>(F);
+  auto &AA = AM.getResult<AAManager>(F);
+  if (!TapirLICM(DT, LI, TI, AA).run())
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<TaskAnalysis>();
+  return PA;
+}
@@ -0,0 +1,484 @@
+//===- TapirLoopCollapse.cpp - Collapse nested Tapir loops ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass collapses perfectly nested Tapir loops, such as the loops of
+//
+//   forall (i = 0; i < N; i++)
+//     forall (j = 0; j < M; j++)
+//       body(i, j);
+//
+// into a single Tapir loop over the linearized iteration space:
+//
+//   forall (k = 0; k < N * M; k++)
+//     body(k / M, k % M);
+//
+// Spawned separately, every iteration of the outer loop builds its own
+// divide-and-conquer tree over the inner loop, which gives N small trees and,
+// for a short outer loop, too little parallelism at the top.  The collapsed
+// loop is spawned with one tree over N * M iterations.  On GPU targets the
+// division and remainder by M are recognized as a flattened index and the
+// loop is launched with a 2D (or, for three levels, 3D) grid.
+//
+// A pair of Tapir loops is collapsed if the inner loop is the only thing the
+// outer body does: the code before it must be free of side effects (it is
+// rerun for every collapsed iteration) and the inner loop's bounds must not
+// depend on the outer iteration.  A guard on the inner loop is allowed if
+// its condition does not depend on the outer iteration either.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirLoopCollapse.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+#define DEBUG_TYPE "tapir-loop-collapse"
+
+STATISTIC(NumCollapsed, "Number of nested Tapir loops collapsed");
+
+/// The maximum number of blocks between the outer detach and the inner loop.
+static const unsigned MaxPrologueBlocks = 8;
+
+namespace {
+
+/// A Tapir loop and the Tapir loop it immediately contains.
+struct CollapseCandidate {
+  Loop *Outer = nullptr;
+  Loop *Inner = nullptr;
+  Task *InnerT = nullptr;
+  DetachInst *OuterDI = nullptr;
+  /// The reattach at the end of the inner body.
+  ReattachInst *InnerRI = nullptr;
+  /// The instructions of the outer body before the inner loop, in order.
+  /// They are rerun in every collapsed iteration.
+  SmallVector<Instruction *, 16> Prologue;
+  /// The branch that guards the inner loop, if any, and whether its true
+  /// successor enters the loop.
+  BranchInst *Guard = nullptr;
+  bool GuardEntersOnTrue = true;
+};
+
+class TapirLoopCollapse {
+public:
+  TapirLoopCollapse(Function &F, DominatorTree &DT, LoopInfo &LI,
+                    ScalarEvolution &SE, TaskInfo &TI)
+      : F(F), DT(DT), LI(LI), SE(SE), TI(TI) {}
+
+  /// Collapse the first nest of Tapir loops that can be collapsed.  Returns
+  /// true if a pair of loops was collapsed.
+  bool run();
+
+private:
+  bool analyzeLoop(Loop *L, const Loop *Outer, SCEVExpander &Exp) const;
+  bool analyzeOuterBody(CollapseCandidate &CC, Task *OuterT) const;
+  bool analyzeNest(Loop *L, CollapseCandidate &CC) const;
+  void collapse(CollapseCandidate &CC);
+
+  Function &F;
+  DominatorTree &DT;
+  LoopInfo &LI;
+  ScalarEvolution &SE;
+  TaskInfo &TI;
+};
+
+} // end anonymous namespace
+
+/// Returns the affine recurrence of the induction variable PN of L, if any.
+static const SCEVAddRecExpr *getIVRecurrence(ScalarEvolution &SE,
+                                             PHINode &PN, const Loop *L) {
+  if (!PN.getType()->isIntegerTy())
+    return nullptr;
+  const auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+  if (!AR || AR->getLoop() != L || !AR->isAffine())
+    return nullptr;
+  return AR;
+}
+
+/// Check the control of Tapir loop L, which is either the outer loop of the
+/// nest or the inner loop of Outer.  Its header and latch are replaced by
+/// those of the collapsed loop, so they may only step the induction
+/// variables, which must be recomputable from the collapsed index.
+bool TapirLoopCollapse::analyzeLoop(Loop *L, const Loop *Outer,
+                                    SCEVExpander &Exp) const {
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Latch = L->getLoopLatch();
+  Instruction *InsertPt = Outer->getLoopPreheader()->getTerminator();
+  if (!L->getLoopPreheader() || !Latch || !L->getExitBlock() ||
+      L->getExitingBlock() != Latch) {
+    LLVM_DEBUG(dbgs() << "Loop is not in simplified form: " << *L);
+    return false;
+  }
+
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC) ||
+      SE.getTypeSizeInBits(BTC->getType()) > 64 ||
+      !SE.isLoopInvariant(BTC, Outer) || !Exp.isSafeToExpandAt(BTC, InsertPt)) {
+    LLVM_DEBUG(dbgs() << "Trip count is unknown or varies: " << *L);
+    return false;
+  }
+
+  auto *DI = cast<DetachInst>(Header->getTerminator());
+  if (DI->hasUnwindDest() || getTaskFrameUsed(DI->getDetached()))
+    return false;
+  for (Instruction &I : *Header)
+    if (!isa<PHINode>(I) && !isa<DbgInfoIntrinsic>(I) && !I.isTerminator())
+      return false;
+  for (PHINode &PN : Header->phis()) {
+    const SCEVAddRecExpr *AR = getIVRecurrence(SE, PN, L);
+    if (!AR || SE.getTypeSizeInBits(AR->getType()) > 64)
+      return false;
+    const SCEV *Step = AR->getStepRecurrence(SE);
+    if (!SE.isLoopInvariant(AR->getStart(), Outer) ||
+        !SE.isLoopInvariant(Step, Outer) ||
+        !Exp.isSafeToExpandAt(AR->getStart(), InsertPt) ||
+        !Exp.isSafeToExpandAt(Step, InsertPt)) {
+      LLVM_DEBUG(dbgs() << "Induction variable varies with the outer loop: "
+                        << PN << "\n");
+      return false;
+    }
+  }
+
+  for (Instruction &I : *Latch) {
+    if (I.isTerminator())
+      continue;
+    if (I.mayHaveSideEffects())
+      return false;
+    for (User *U : I.users()) {
+      BasicBlock *UseBB = cast<Instruction>(U)->getParent();
+      if (UseBB != Latch && UseBB != Header)
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Check that the body of the outer loop consists of the inner loop, a
+/// side-effect free prologue and an epilogue that only syncs the inner loop.
+bool TapirLoopCollapse::analyzeOuterBody(CollapseCandidate &CC,
+                                         Task *OuterT) const {
+  Loop *Outer = CC.Outer, *Inner = CC.Inner;
+  auto *InnerDI = cast<DetachInst>(Inner->getHeader()->getTerminator());
+  Value *InnerSR = InnerDI->getSyncRegion();
+
+  // The inner sync region goes away with the inner loop.
+  for (User *U : InnerSR->users())
+    if (U != CC.InnerRI &&
+        CC.InnerT->encloses(cast<Instruction>(U)->getParent()))
+      return false;
+
+  // Walk the prologue, from the start of the outer body to the inner loop.
+  SmallPtrSet<BasicBlock *, 8> PrologueBlocks;
+  BasicBlock *BB = CC.OuterDI->getDetached();
+  BasicBlock *InnerPreheader = Inner->getLoopPreheader();
+  for (unsigned NumBlocks = 0;; NumBlocks++) {
+    if (NumBlocks == MaxPrologueBlocks || !DT.dominates(BB, InnerPreheader))
+      return false;
+    PrologueBlocks.insert(BB);
+    for (Instruction &I : *BB) {
+      if (I.isTerminator() || isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (&I == InnerSR)
+        continue;
+      if (isa<PHINode>(I) || I.mayHaveSideEffects()) {
+        LLVM_DEBUG(dbgs() << "Outer body does more than run the inner loop: "
+                          << I << "\n");
+        return false;
+      }
+      CC.Prologue.push_back(&I);
+    }
+    if (BB == InnerPreheader)
+      break;
+
+    auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI)
+      return false;
+    if (BI->isUnconditional()) {
+      BB = BI->getSuccessor(0);
+      continue;
+    }
+    // A conditional branch must guard the inner loop.
+    if (CC.Guard)
+      return false;
+    CC.Guard = BI;
+    CC.GuardEntersOnTrue = DT.dominates(BI->getSuccessor(0), InnerPreheader);
+    BB = BI->getSuccessor(CC.GuardEntersOnTrue ? 0 : 1);
+    if (!DT.dominates(BasicBlockEdge(BI->getParent(), BB), InnerPreheader))
+      return false;
+  }
+
+  // The guard is evaluated once, ahead of the collapsed loop, so it must not
+  // depend on the outer iteration.
+  if (CC.Guard) {
+    auto *Cond = dyn_cast<Instruction>(CC.Guard->getCondition());
+    if (Cond && Outer->contains(Cond) &&
+        (!is_contained(CC.Prologue, Cond) || Cond->mayReadFromMemory() ||
+         !isSafeToSpeculativelyExecute(Cond) ||
+         !Outer->hasLoopInvariantOperands(Cond))) {
+      LLVM_DEBUG(dbgs() << "Inner loop guard varies with the outer loop: "
+                        << *Cond << "\n");
+      return false;
+    }
+  }
+
+  // The rest of the outer body, other than the inner loop, may only sync
+  // the inner loop and return to the outer latch.
+  for (Task *SubT : depth_first(OuterT))
+    for (Spindle *S : depth_first<InTask<Spindle *>>(SubT->getEntrySpindle()))
+      for (BasicBlock *Block : S->blocks()) {
+        if (!Outer->contains(Block))
+          return false;
+        if (CC.InnerT->encloses(Block)) {
+          if (!Inner->contains(Block))
+            return false;
+          continue;
+        }
+        if (Inner->contains(Block) || PrologueBlocks.count(Block))
+          continue;
+        for (Instruction &I : *Block) {
+          if (isa<DbgInfoIntrinsic>(I) || isSyncUnwind(&I))
+            continue;
+          if (auto *BI = dyn_cast<BranchInst>(&I))
+            if (BI->isUnconditional())
+              continue;
+          if (auto *SI = dyn_cast<SyncInst>(&I))
+            if (SI->getSyncRegion() == InnerSR)
+              continue;
+          if (auto *RI = dyn_cast<ReattachInst>(&I))
+            if (RI->getSyncRegion() == CC.OuterDI->getSyncRegion())
+              continue;
+          LLVM_DEBUG(dbgs() << "Unsupported instruction after inner loop: "
+                            << I << "\n");
+          return false;
+        }
+      }
+  return true;
+}
+
+bool TapirLoopCollapse::analyzeNest(Loop *L, CollapseCandidate &CC) const {
+  if (L->getSubLoops().size() != 1)
+    return false;
+  Loop *Inner = L->getSubLoops()[0];
+  Task *OuterT = getTaskIfTapirLoop(L, &TI);
+  Task *InnerT = getTaskIfTapirLoop(Inner, &TI);
+  if (!OuterT || !InnerT || !L->getLoopPreheader())
+    return false;
+
+  // The loops must be lowered alike.  An inner grainsize is a request to
+  // spawn the inner loop in chunks of that size, so it is honored.
+  TapirLoopHints OuterHints(L), InnerHints(Inner);
+  if (OuterHints.getLoopTarget() != InnerHints.getLoopTarget() ||
+      InnerHints.getGrainsize() != 0)
+    return false;
+
+  SCEVExpander Exp(SE, F.getParent()->getDataLayout(), "collapse");
+  if (!analyzeLoop(L, L, Exp) || !analyzeLoop(Inner, L, Exp))
+    return false;
+
+  // The inner body must end in a single reattach.
+  BasicBlock *InnerLatch = Inner->getLoopLatch();
+  for (BasicBlock *Pred : predecessors(InnerLatch)) {
+    if (Pred == Inner->getHeader())
+      continue;
+    auto *RI = dyn_cast<ReattachInst>(Pred->getTerminator());
+    if (!RI || CC.InnerRI)
+      return false;
+    CC.InnerRI = RI;
+  }
+  if (!CC.InnerRI)
+    return false;
+
+  // Nothing computed by the nest may be used after it.
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      for (User *U : I.users())
+        if (!L->contains(cast<Instruction>(U)->getParent()))
+          return false;
+
+  CC.Outer = L;
+  CC.Inner = Inner;
+  CC.InnerT = InnerT;
+  CC.OuterDI = cast<DetachInst>(L->getHeader()->getTerminator());
+  return analyzeOuterBody(CC, OuterT);
+}
+
+void TapirLoopCollapse::collapse(CollapseCandidate &CC) {
+  Loop *Outer = CC.Outer, *Inner = CC.Inner;
+  LLVM_DEBUG(dbgs() << "Collapsing Tapir loops "
+                    << Outer->getHeader()->getName() << " and "
+                    << Inner->getHeader()->getName() << "\n");
+
+  LLVMContext &Ctx = F.getContext();
+  BasicBlock *Preheader = Outer->getLoopPreheader();
+  BasicBlock *OldHeader = Outer->getHeader();
+  BasicBlock *Exit = Outer->getExitBlock();
+  BasicBlock *InnerEntry =
+      cast<DetachInst>(Inner->getHeader()->getTerminator())->getDetached();
+  Value *SyncReg = CC.OuterDI->getSyncRegion();
+  MDNode *LoopID =
+      Outer->getLoopLatch()->getTerminator()->getMetadata(LLVMContext::MD_loop);
+  Type *Ty = Type::getInt64Ty(Ctx);
+
+  // Compute the trip counts, and the starts and steps of the induction
+  // variables, ahead of the nest.
+  Instruction *InsertPt = Preheader->getTerminator();
+  SCEVExpander Exp(SE, F.getParent()->getDataLayout(), "collapse");
+  auto TripCount = [&](Loop *L) {
+    const SCEV *BTC = SE.getBackedgeTakenCount(L);
+    const SCEV *TC = SE.getAddExpr(SE.getZeroExtendExpr(BTC, Ty),
+                                   SE.getOne(Ty), SCEV::FlagNUW);
+    return Exp.expandCodeFor(TC, Ty, InsertPt);
+  };
+  struct IVInfo {
+    PHINode *PN;
+    Value *Start, *Step;
+  };
+  auto CollectIVs = [&](Loop *L, SmallVectorImpl<IVInfo> &IVs) {
+    for (PHINode &PN : L->getHeader()->phis()) {
+      const SCEVAddRecExpr *AR = getIVRecurrence(SE, PN, L);
+      IVs.push_back(
+          {&PN, Exp.expandCodeFor(AR->getStart(), PN.getType(), InsertPt),
+           Exp.expandCodeFor(AR->getStepRecurrence(SE), PN.getType(),
+                             InsertPt)});
+    }
+  };
+  Value *OuterTC = TripCount(Outer);
+  Value *InnerTC = TripCount(Inner);
+  SmallVector<IVInfo, 4> OuterIVs, InnerIVs;
+  CollectIVs(Outer, OuterIVs);
+  CollectIVs(Inner, InnerIVs);
+
+  IRBuilder<> B(InsertPt);
+  Value *Zero = ConstantInt::get(Ty, 0);
+  if (CC.Guard) {
+    // A skipped inner loop runs no iterations.
+    Value *Cond = CC.Guard->getCondition();
+    if (auto *CondI = dyn_cast<Instruction>(Cond);
+        CondI && Outer->contains(CondI)) {
+      Instruction *Clone = CondI->clone();
+      Clone->insertBefore(InsertPt);
+      Cond = Clone;
+    }
+    InnerTC = CC.GuardEntersOnTrue ? B.CreateSelect(Cond, InnerTC, Zero)
+                                   : B.CreateSelect(Cond, Zero, InnerTC);
+  }
+  Value *TC = B.CreateMul(OuterTC, InnerTC, "collapse.tc");
+
+  // Build the collapsed loop in front of the old outer header.
+  BasicBlock *Header =
+      BasicBlock::Create(Ctx, "collapse.header", &F, OldHeader);
+  BasicBlock *Body = BasicBlock::Create(Ctx, "collapse.body", &F, OldHeader);
+  BasicBlock *Latch = BasicBlock::Create(Ctx, "collapse.latch", &F, OldHeader);
+  B.CreateCondBr(B.CreateICmpNE(TC, Zero), Header, Exit);
+  InsertPt->eraseFromParent();
+
+  B.SetInsertPoint(Header);
+  PHINode *IV = B.CreatePHI(Ty, 2, "collapse.iv");
+  IV->addIncoming(Zero, Preheader);
+  DetachInst::Create(Body, Latch, SyncReg, Header);
+
+  B.SetInsertPoint(Latch);
+  Value *IVNext = B.CreateAdd(IV, ConstantInt::get(Ty, 1), "collapse.iv.next",
+                              /*HasNUW=*/true, /*HasNSW=*/true);
+  IV->addIncoming(IVNext, Latch);
+  BranchInst *BackEdge =
+      B.CreateCondBr(B.CreateICmpEQ(IVNext, TC), Exit, Header);
+  if (LoopID)
+    BackEdge->setMetadata(LLVMContext::MD_loop, LoopID);
+
+  // Recover the induction variables of both loops from the collapsed index.
+  B.SetInsertPoint(Body);
+  for (Instruction &I : make_early_inc_range(*InnerEntry))
+    if (auto *AI = dyn_cast<AllocaInst>(&I))
+      if (isa<Constant>(AI->getArraySize()))
+        AI->moveBefore(*Body, Body->end());
+  Value *OuterIdx = B.CreateUDiv(IV, InnerTC, "collapse.outer");
+  Value *InnerIdx = B.CreateURem(IV, InnerTC, "collapse.inner");
+  SmallPtrSet<Instruction *, 16> Prologue(CC.Prologue.begin(),
+                                          CC.Prologue.end());
+  auto Recompute = [&](ArrayRef<IVInfo> IVs, Value *Idx, bool InPrologue) {
+    for (const IVInfo &Info : IVs) {
+      Value *V = B.CreateZExtOrTrunc(Idx, Info.PN->getType());
+      if (!match(Info.Step, m_One()))
+        V = B.CreateMul(V, Info.Step);
+      if (!match(Info.Start, m_Zero()))
+        V = B.CreateAdd(Info.Start, V);
+      Info.PN->replaceUsesWithIf(V, [&](Use &U) {
+        auto *I = cast<Instruction>(U.getUser());
+        return CC.InnerT->encloses(I->getParent()) ||
+               (InPrologue && Prologue.count(I));
+      });
+    }
+  };
+  Recompute(OuterIVs, OuterIdx, /*InPrologue=*/true);
+  Recompute(InnerIVs, InnerIdx, /*InPrologue=*/false);
+  for (Instruction *I : CC.Prologue)
+    I->moveBefore(*Body, Body->end());
+  B.SetInsertPoint(Body);
+  B.CreateBr(InnerEntry);
+
+  // The inner body now ends each collapsed iteration.
+  ReattachInst::Create(Latch, SyncReg, CC.InnerRI);
+  CC.InnerRI->eraseFromParent();
+
+  // Remove the control of the old loops, which is no longer reachable.
+  SmallVector<BasicBlock *, 16> DeadBlocks;
+  for (BasicBlock *BB : Outer->blocks())
+    if (!CC.InnerT->encloses(BB))
+      DeadBlocks.push_back(BB);
+  DeleteDeadBlocks(DeadBlocks);
+  ++NumCollapsed;
+}
+
+bool TapirLoopCollapse::run() {
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    CollapseCandidate CC;
+    if (!analyzeNest(L, CC))
+      continue;
+    collapse(CC);
+    return true;
+  }
+  return false;
+}
+
+PreservedAnalyses TapirLoopCollapsePass::run(Function &F,
+                                             FunctionAnalysisManager &AM) {
+  bool Changed = false;
+  // Each collapse removes a loop; recompute the analyses and look for more
+  // (e.g., the third loop of a three-deep nest).
+  while (true) {
+    auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    auto &LI = AM.getResult<LoopAnalysis>(F);
+    auto &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+    auto &TI = AM.getResult<TaskAnalysis>(F);
+    if (!TapirLoopCollapse(F, DT, LI, SE, TI).run())
+      break;
+    Changed = true;
+    AM.invalidate(F, PreservedAnalyses::none());
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
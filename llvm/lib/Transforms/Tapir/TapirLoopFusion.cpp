@@ -0,0 +1,540 @@
+//===- TapirLoopFusion.cpp - Fuse adjacent Tapir loops --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass fuses adjacent Tapir loops that target a GPU and share the same
+// iteration space.  Each such loop would otherwise be outlined as its own
+// kernel, with every intermediate value round-tripping through device memory
+// between the launches.
+//
+// Two Tapir loops L1 and L2 are candidates for fusion if L1's sync is
+// followed, along straight-line control flow, by the preheader (or guard) of
+// L2 and both loops have the same trip count, induction variables, guard and
+// loop hints.  Fusion moves the body of L2 into the body of L1, after the
+// body of L1, so that iteration i of both loops runs in the same task.  This
+// is legal if iteration i of L2 only depends on iteration i of L1: every pair
+// of accesses from the two bodies, where one of them is a write, must either
+// not alias or access the same address in the same iteration.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirLoopFusion.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-loop-fusion"
+
+STATISTIC(NumFused, "Number of Tapir loops fused");
+
+static cl::opt<unsigned> MaxFusionAccesses(
+    "tapir-loop-fusion-max-accesses", cl::Hidden, cl::init(256),
+    cl::desc("Maximum number of memory accesses in a Tapir loop body that "
+             "is considered for fusion."));
+
+static cl::opt<unsigned> MaxFusionChainBlocks(
+    "tapir-loop-fusion-max-blocks", cl::Hidden, cl::init(8),
+    cl::desc("Maximum number of blocks between two Tapir loops that are "
+             "considered for fusion."));
+
+namespace {
+
+/// A Tapir loop that is considered for fusion.
+struct FusionCandidate {
+  Loop *L = nullptr;
+  Task *T = nullptr;
+  DetachInst *DI = nullptr;
+  /// The reattach at the end of the loop body.
+  ReattachInst *RI = nullptr;
+  /// The branch that guards the (rotated) loop, if any.
+  BranchInst *Guard = nullptr;
+  /// The guard block or, if the loop is not guarded, the preheader.
+  BasicBlock *Entry = nullptr;
+  /// The block that syncs the loop's sync region.
+  BasicBlock *SyncBlock = nullptr;
+  /// The memory accesses in the loop body.
+  SmallVector<Instruction *, 16> Reads;
+  SmallVector<Instruction *, 16> Writes;
+};
+
+class TapirLoopFusion {
+public:
+  TapirLoopFusion(Function &F, DominatorTree &DT, LoopInfo &LI,
+                  ScalarEvolution &SE, TaskInfo &TI, AAResults &AA)
+      : F(F), DT(DT), LI(LI), SE(SE), TI(TI), AA(AA) {}
+
+  /// Fuse the first pair of fusable loops found in the function.  Returns
+  /// true if a pair of loops was fused.
+  bool run();
+
+private:
+  bool analyzeCandidate(Loop *L, FusionCandidate &FC) const;
+  bool findNextCandidate(const FusionCandidate &FC1, FusionCandidate &FC2,
+                         SmallVectorImpl<Instruction *> &Hoist) const;
+  bool haveSameIterationSpace(const FusionCandidate &FC1,
+                              const FusionCandidate &FC2,
+                              DenseMap<PHINode *, PHINode *> &IVMap) const;
+  bool isSafeAccessPair(const FusionCandidate &FC1, Instruction *A,
+                        const FusionCandidate &FC2, Instruction *B) const;
+  bool isLegalToFuse(const FusionCandidate &FC1, const FusionCandidate &FC2,
+                     ArrayRef<Instruction *> Hoist) const;
+  void fuse(FusionCandidate &FC1, FusionCandidate &FC2,
+            const DenseMap<PHINode *, PHINode *> &IVMap,
+            ArrayRef<Instruction *> Hoist);
+
+  Function &F;
+  DominatorTree &DT;
+  LoopInfo &LI;
+  ScalarEvolution &SE;
+  TaskInfo &TI;
+  AAResults &AA;
+};
+
+} // end anonymous namespace
+
+/// Returns true if the Tapir loop L targets a GPU.
+static bool isGPULoop(const Loop *L) {
+  TapirLoopHints Hints(L);
+  TapirTargetID TargetID = (TapirTargetID)Hints.getLoopTarget();
+  return TargetID == TapirTargetID::Cuda || TargetID == TapirTargetID::Hip ||
+         TargetID == TapirTargetID::LevelZero;
+}
+
+bool TapirLoopFusion::analyzeCandidate(Loop *L, FusionCandidate &FC) const {
+  Task *T = getTaskIfTapirLoop(L, &TI);
+  if (!T || !isGPULoop(L))
+    return false;
+
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Exit = L->getExitBlock();
+  if (!Preheader || !Latch || !Exit) {
+    LLVM_DEBUG(dbgs() << "Loop is not in simplified form: " << *L);
+    return false;
+  }
+
+  DetachInst *DI = cast<DetachInst>(Header->getTerminator());
+  if (DI->hasUnwindDest() || getTaskFrameUsed(DI->getDetached())) {
+    LLVM_DEBUG(dbgs() << "Loop body may throw or uses a taskframe: " << *L);
+    return false;
+  }
+
+  // The body must end in a single reattach.
+  ReattachInst *RI = nullptr;
+  for (BasicBlock *Pred : predecessors(Latch)) {
+    if (Pred == Header)
+      continue;
+    auto *Reattach = dyn_cast<ReattachInst>(Pred->getTerminator());
+    if (!Reattach || RI)
+      return false;
+    RI = Reattach;
+  }
+  if (!RI)
+    return false;
+
+  // Only bodies that lie entirely within the loop are analyzed (e.g., no
+  // blocks that end in unreachable).
+  for (Task *SubT : depth_first(T))
+    for (Spindle *S : depth_first<InTask<Spindle *>>(SubT->getEntrySpindle()))
+      for (BasicBlock *BB : S->blocks())
+        if (!L->contains(BB))
+          return false;
+
+  // Collect the memory accesses of the body.  Anything other than simple
+  // loads and stores (e.g., calls that may access memory) is not analyzed.
+  for (BasicBlock *BB : L->blocks()) {
+    bool InBody = T->encloses(BB);
+    for (Instruction &I : *BB) {
+      if (!InBody) {
+        if (I.mayHaveSideEffects() || I.mayReadFromMemory())
+          return false;
+        continue;
+      }
+      if (!I.mayReadOrWriteMemory())
+        continue;
+      if (auto *II = dyn_cast<IntrinsicInst>(&I))
+        if (II->isLifetimeStartOrEnd() || II->isAssumeLikeIntrinsic())
+          continue;
+      if (auto *Load = dyn_cast<LoadInst>(&I)) {
+        if (!Load->isSimple())
+          return false;
+        FC.Reads.push_back(Load);
+      } else if (auto *Store = dyn_cast<StoreInst>(&I)) {
+        if (!Store->isSimple())
+          return false;
+        FC.Writes.push_back(Store);
+      } else {
+        LLVM_DEBUG(dbgs() << "Unsupported memory access in body: " << I
+                          << "\n");
+        return false;
+      }
+    }
+  }
+  if (FC.Reads.size() + FC.Writes.size() > MaxFusionAccesses)
+    return false;
+
+  // Find the sync of the loop's sync region.  The exit block is either the
+  // sync itself or an empty block that branches to it.
+  BasicBlock *SyncBlock = Exit;
+  if (!isa<SyncInst>(SyncBlock->getTerminator())) {
+    if (SyncBlock->getFirstNonPHIOrDbg() != SyncBlock->getTerminator())
+      return false;
+    SyncBlock = SyncBlock->getSingleSuccessor();
+    if (!SyncBlock)
+      return false;
+  }
+  auto *SI = dyn_cast<SyncInst>(SyncBlock->getTerminator());
+  if (!SI || SI->getSyncRegion() != DI->getSyncRegion() ||
+      SyncBlock->getFirstNonPHIOrDbg() != SI || !Exit->phis().empty() ||
+      !SyncBlock->phis().empty())
+    return false;
+
+  // The sync must only be reached by leaving the loop or, if the loop is
+  // guarded, by skipping it.
+  BranchInst *Guard = L->getLoopGuardBranch();
+  for (BasicBlock *Pred : predecessors(SyncBlock)) {
+    if (Pred == Exit || Pred == Latch)
+      continue;
+    if (Guard && Pred == Guard->getParent())
+      continue;
+    return false;
+  }
+  if (Guard && !is_contained(successors(Guard), SyncBlock))
+    return false;
+
+  FC.L = L;
+  FC.T = T;
+  FC.DI = DI;
+  FC.RI = RI;
+  FC.Guard = Guard;
+  FC.Entry = Guard ? Guard->getParent() : Preheader;
+  FC.SyncBlock = SyncBlock;
+  return true;
+}
+
+bool TapirLoopFusion::findNextCandidate(
+    const FusionCandidate &FC1, FusionCandidate &FC2,
+    SmallVectorImpl<Instruction *> &Hoist) const {
+  // Walk the straight-line code after the sync of FC1 up to the guard or
+  // preheader of the next loop.
+  SmallVector<Instruction *, 16> Chain;
+  BasicBlock *Prev = FC1.SyncBlock;
+  BasicBlock *BB = cast<SyncInst>(Prev->getTerminator())->getSuccessor(0);
+  Loop *Next = nullptr;
+  for (unsigned NumBlocks = 0; NumBlocks < MaxFusionChainBlocks;
+       NumBlocks++) {
+    if (BB->getUniquePredecessor() != Prev || !BB->phis().empty())
+      return false;
+    for (Instruction &I : *BB)
+      if (!I.isTerminator())
+        Chain.push_back(&I);
+
+    auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI)
+      return false;
+    for (BasicBlock *Succ : BI->successors()) {
+      // An unguarded loop is entered through its preheader (BB), a guarded
+      // loop through its guard (BI) and preheader (Succ).
+      BasicBlock *Preheader = BI->isUnconditional() ? BB : Succ;
+      BasicBlock *Header = BI->isUnconditional()
+                               ? Succ
+                               : Succ->getSingleSuccessor();
+      Loop *L = Header ? LI.getLoopFor(Header) : nullptr;
+      if (L && L->getHeader() == Header &&
+          L->getLoopPreheader() == Preheader) {
+        Next = L;
+        if (Preheader != BB)
+          for (Instruction &I : *Preheader)
+            if (!I.isTerminator())
+              Chain.push_back(&I);
+        break;
+      }
+    }
+    if (Next || BI->isConditional())
+      break;
+    Prev = BB;
+    BB = BI->getSuccessor(0);
+  }
+  if (!Next || Next->getParentLoop() != FC1.L->getParentLoop() ||
+      !analyzeCandidate(Next, FC2))
+    return false;
+  if (FC2.Guard ? FC2.Guard->getParent() != BB
+                : FC2.L->getLoopPreheader() != BB)
+    return false;
+
+  // The code between the loops will run before FC1 once the loops are
+  // fused.  Sync-region markers and debug intrinsics stay in place; all
+  // other code must be side-effect free so it can be hoisted.
+  SmallPtrSet<Instruction *, 16> Hoisted;
+  Instruction *InsertPt = FC1.Entry->getTerminator();
+  for (Instruction *I : Chain) {
+    if (isa<DbgInfoIntrinsic>(I) ||
+        isTapirIntrinsic(Intrinsic::syncregion_start, I) || isSyncUnwind(I))
+      continue;
+    if (auto *Load = dyn_cast<LoadInst>(I)) {
+      if (!Load->isSimple())
+        return false;
+    } else if (I->mayReadOrWriteMemory() ||
+               !isSafeToSpeculativelyExecute(I)) {
+      LLVM_DEBUG(dbgs() << "Cannot hoist instruction between loops: " << *I
+                        << "\n");
+      return false;
+    }
+    for (Value *Op : I->operands())
+      if (auto *OpI = dyn_cast<Instruction>(Op))
+        if (!Hoisted.count(OpI) && !DT.dominates(OpI, InsertPt))
+          return false;
+    Hoisted.insert(I);
+    Hoist.push_back(I);
+  }
+  return true;
+}
+
+bool TapirLoopFusion::haveSameIterationSpace(
+    const FusionCandidate &FC1, const FusionCandidate &FC2,
+    DenseMap<PHINode *, PHINode *> &IVMap) const {
+  TapirLoopHints Hints1(FC1.L), Hints2(FC2.L);
+  if (Hints1.getLoopTarget() != Hints2.getLoopTarget() ||
+      Hints1.getStrategy() != Hints2.getStrategy() ||
+      Hints1.getGrainsize() != Hints2.getGrainsize() ||
+      Hints1.getThreadsPerBlock() != Hints2.getThreadsPerBlock() ||
+      Hints1.getAutoTune() != Hints2.getAutoTune()) {
+    LLVM_DEBUG(dbgs() << "Loop hints differ.\n");
+    return false;
+  }
+
+  const SCEV *BTC1 = SE.getBackedgeTakenCount(FC1.L);
+  const SCEV *BTC2 = SE.getBackedgeTakenCount(FC2.L);
+  if (isa<SCEVCouldNotCompute>(BTC1) || BTC1 != BTC2) {
+    LLVM_DEBUG(dbgs() << "Trip counts differ or are unknown.\n");
+    return false;
+  }
+
+  // Both loops must be guarded by the same condition (or not at all).
+  if (!FC1.Guard != !FC2.Guard)
+    return false;
+  if (FC1.Guard) {
+    bool Enter1 = FC1.Guard->getSuccessor(0) == FC1.L->getLoopPreheader();
+    bool Enter2 = FC2.Guard->getSuccessor(0) == FC2.L->getLoopPreheader();
+    Value *Cond1 = FC1.Guard->getCondition();
+    Value *Cond2 = FC2.Guard->getCondition();
+    if (Enter1 != Enter2)
+      return false;
+    if (Cond1 != Cond2) {
+      auto *Cmp1 = dyn_cast<ICmpInst>(Cond1);
+      auto *Cmp2 = dyn_cast<ICmpInst>(Cond2);
+      if (!Cmp1 || !Cmp2 || Cmp1->getPredicate() != Cmp2->getPredicate() ||
+          Cmp1->getOperand(0)->getType() != Cmp2->getOperand(0)->getType() ||
+          SE.getSCEV(Cmp1->getOperand(0)) != SE.getSCEV(Cmp2->getOperand(0)) ||
+          SE.getSCEV(Cmp1->getOperand(1)) != SE.getSCEV(Cmp2->getOperand(1))) {
+        LLVM_DEBUG(dbgs() << "Loop guards differ.\n");
+        return false;
+      }
+    }
+  }
+
+  // Every induction variable of FC2 must match one of FC1.
+  for (PHINode &PN2 : FC2.L->getHeader()->phis()) {
+    const auto *AR2 = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN2));
+    if (!AR2 || AR2->getLoop() != FC2.L || !AR2->isAffine())
+      return false;
+    PHINode *Match = nullptr;
+    for (PHINode &PN1 : FC1.L->getHeader()->phis()) {
+      const auto *AR1 = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN1));
+      if (AR1 && AR1->getLoop() == FC1.L && AR1->isAffine() &&
+          PN1.getType() == PN2.getType() &&
+          AR1->getStart() == AR2->getStart() &&
+          AR1->getStepRecurrence(SE) == AR2->getStepRecurrence(SE)) {
+        Match = &PN1;
+        break;
+      }
+    }
+    if (!Match) {
+      LLVM_DEBUG(dbgs() << "No matching induction variable for " << PN2
+                        << "\n");
+      return false;
+    }
+    IVMap[&PN2] = Match;
+  }
+  return true;
+}
+
+/// Check that access A in the body of FC1 and access B in the body of FC2
+/// only touch common memory in the same iteration.
+bool TapirLoopFusion::isSafeAccessPair(const FusionCandidate &FC1,
+                                       Instruction *A,
+                                       const FusionCandidate &FC2,
+                                       Instruction *B) const {
+  Value *PtrA = getLoadStorePointerOperand(A);
+  Value *PtrB = getLoadStorePointerOperand(B);
+  if (AA.isNoAlias(MemoryLocation::getBeforeOrAfter(PtrA),
+                   MemoryLocation::getBeforeOrAfter(PtrB)))
+    return true;
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  TypeSize SizeA = DL.getTypeStoreSize(getLoadStoreType(A));
+  TypeSize SizeB = DL.getTypeStoreSize(getLoadStoreType(B));
+  if (SizeA.isScalable() || SizeB.isScalable())
+    return false;
+
+  // Both addresses must advance in lockstep with the induction variables,
+  // by at least the size of the accesses, from the same start.
+  const auto *ARA = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(PtrA));
+  const auto *ARB = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(PtrB));
+  if (!ARA || !ARB || ARA->getLoop() != FC1.L || ARB->getLoop() != FC2.L ||
+      !ARA->isAffine() || !ARB->isAffine() ||
+      ARA->getStart() != ARB->getStart())
+    return false;
+  const SCEV *Step = ARA->getStepRecurrence(SE);
+  const auto *StepC = dyn_cast<SCEVConstant>(Step);
+  if (!StepC || Step != ARB->getStepRecurrence(SE))
+    return false;
+  uint64_t Stride = StepC->getAPInt().abs().getLimitedValue();
+  return Stride >= std::max(SizeA.getFixedValue(), SizeB.getFixedValue());
+}
+
+bool TapirLoopFusion::isLegalToFuse(const FusionCandidate &FC1,
+                                    const FusionCandidate &FC2,
+                                    ArrayRef<Instruction *> Hoist) const {
+  // Loads hoisted above FC1 must not observe its writes.
+  for (Instruction *I : Hoist) {
+    auto *Load = dyn_cast<LoadInst>(I);
+    if (!Load)
+      continue;
+    for (Instruction *W : FC1.Writes)
+      if (isModSet(AA.getModRefInfo(W, MemoryLocation::get(Load))))
+        return false;
+  }
+
+  // Values computed by FC2 must not be used after it, as its header,
+  // latch and exit are removed.
+  for (BasicBlock *BB : FC2.L->blocks())
+    for (Instruction &I : *BB)
+      for (User *U : I.users())
+        if (!FC2.L->contains(cast<Instruction>(U)->getParent()))
+          return false;
+
+  for (Instruction *A : FC1.Writes) {
+    for (Instruction *B : FC2.Reads)
+      if (!isSafeAccessPair(FC1, A, FC2, B))
+        return false;
+    for (Instruction *B : FC2.Writes)
+      if (!isSafeAccessPair(FC1, A, FC2, B))
+        return false;
+  }
+  for (Instruction *A : FC1.Reads)
+    for (Instruction *B : FC2.Writes)
+      if (!isSafeAccessPair(FC1, A, FC2, B))
+        return false;
+  return true;
+}
+
+void TapirLoopFusion::fuse(FusionCandidate &FC1, FusionCandidate &FC2,
+                           const DenseMap<PHINode *, PHINode *> &IVMap,
+                           ArrayRef<Instruction *> Hoist) {
+  LLVM_DEBUG(dbgs() << "Fusing Tapir loops " << FC1.L->getHeader()->getName()
+                    << " and " << FC2.L->getHeader()->getName() << "\n");
+
+  // Hoist the code between the loops so it dominates the fused body.
+  Instruction *InsertPt = FC1.Entry->getTerminator();
+  for (Instruction *I : Hoist)
+    I->moveBefore(InsertPt);
+
+  // The body of FC2 now runs in the iteration of FC1.
+  for (auto &Entry : IVMap)
+    Entry.first->replaceUsesWithIf(Entry.second, [&](Use &U) {
+      return FC2.T->encloses(cast<Instruction>(U.getUser())->getParent());
+    });
+
+  BasicBlock *Body1 = FC1.DI->getDetached();
+  BasicBlock *Body2 = FC2.DI->getDetached();
+  for (Instruction &I : make_early_inc_range(*Body2))
+    if (auto *AI = dyn_cast<AllocaInst>(&I))
+      if (isa<Constant>(AI->getArraySize()))
+        AI->moveBefore(&*Body1->getFirstInsertionPt());
+
+  // Chain the bodies: FC1's body continues into FC2's body, which
+  // reattaches to FC1's latch.
+  BasicBlock *Latch1 = FC1.L->getLoopLatch();
+  BasicBlock *End1 = FC1.RI->getParent();
+  BasicBlock *End2 = FC2.RI->getParent();
+  BranchInst::Create(Body2, FC1.RI);
+  FC1.RI->eraseFromParent();
+  ReattachInst::Create(Latch1, FC1.DI->getSyncRegion(), FC2.RI);
+  FC2.RI->eraseFromParent();
+  for (PHINode &PN : Latch1->phis())
+    PN.replaceIncomingBlockWith(End1, End2);
+
+  // Bypass what is left of FC2.  Its sync now has no tasks to wait on and
+  // is cleaned up by later passes.
+  SmallVector<BasicBlock *, 4> DeadBlocks;
+  for (BasicBlock *BB : FC2.L->blocks())
+    if (!FC2.T->encloses(BB))
+      DeadBlocks.push_back(BB);
+  BasicBlock *Preheader2 = FC2.L->getLoopPreheader();
+  Preheader2->getTerminator()->replaceSuccessorWith(FC2.L->getHeader(),
+                                                    FC2.L->getExitBlock());
+  DeleteDeadBlocks(DeadBlocks);
+  ++NumFused;
+}
+
+bool TapirLoopFusion::run() {
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    FusionCandidate FC1, FC2;
+    SmallVector<Instruction *, 16> Hoist;
+    DenseMap<PHINode *, PHINode *> IVMap;
+    if (!analyzeCandidate(L, FC1) || !findNextCandidate(FC1, FC2, Hoist))
+      continue;
+    if (!haveSameIterationSpace(FC1, FC2, IVMap) ||
+        !isLegalToFuse(FC1, FC2, Hoist))
+      continue;
+    fuse(FC1, FC2, IVMap, Hoist);
+    return true;
+  }
+  return false;
+}
+
+PreservedAnalyses TapirLoopFusionPass::run(Function &F,
+                                           FunctionAnalysisManager &AM) {
+  bool Changed = false;
+  // Each fusion removes a loop; recompute the analyses and look for more
+  // (e.g., a chain of three or more loops).
+  while (true) {
+    auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    auto &LI = AM.getResult<LoopAnalysis>(F);
+    auto &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+    auto &TI = AM.getResult<TaskAnalysis>(F);
+    auto &AA = AM.getResult<AAManager>(F);
+    if (!TapirLoopFusion(F, DT, LI, SE, TI, AA).run())
+      break;
+    Changed = true;
+    AM.invalidate(F, PreservedAnalyses::none());
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
@@ -229,8 +229,58 @@ void TapirLoopInfo::replaceNonPrimaryIVs(PredicatedScalarEvolution &PSE) {
   }
 }
 
+/// Create a canonical induction variable for this loop, which starts at zero
+/// and steps by one, and make it the primary induction.  The loop's other
+/// inductions (e.g., decrementing, strided or pointer inductions) are then
+/// computed from it by replaceNonPrimaryIVs().
+bool TapirLoopInfo::createCanonicalInduction(PredicatedScalarEvolution &PSE) {
+  Loop *L = getLoop();
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (!Preheader || !Latch || pred_size(Header) != 2)
+    return false;
+
+  // The latch condition is rewritten in terms of the new induction, so the
+  // loop must be countable.
+  ScalarEvolution *SE = PSE.getSE();
+  const SCEV *BackedgeTakenCount = SE->getExitCount(L, Latch);
+  if (isa<SCEVCouldNotCompute>(BackedgeTakenCount)) {
+    LLVM_DEBUG(dbgs() << "\tCould not compute backedge-taken count for a "
+                      << "canonical induction.\n");
+    return false;
+  }
+
+  const DataLayout &DL = Header->getModule()->getDataLayout();
+  Type *IdxTy = convertPointerToIntegerType(DL, BackedgeTakenCount->getType());
+  if (WidestIndTy)
+    IdxTy = getWiderType(DL, IdxTy, WidestIndTy);
+  WidestIndTy = IdxTy;
+
+  PHINode *IV =
+      PHINode::Create(IdxTy, 2, "tl.canonical.iv", &Header->front());
+  IV->setDebugLoc(Header->getFirstNonPHI()->getDebugLoc());
+  Instruction *Inc = BinaryOperator::CreateNUWAdd(
+      IV, ConstantInt::get(IdxTy, 1), "tl.canonical.iv.next",
+      Latch->getTerminator());
+  Inc->setDebugLoc(Latch->getTerminator()->getDebugLoc());
+  IV->addIncoming(ConstantInt::get(IdxTy, 0), Preheader);
+  IV->addIncoming(Inc, Latch);
+
+  InductionDescriptor ID;
+  if (!InductionDescriptor::isInductionPHI(IV, L, PSE, ID)) {
+    Inc->eraseFromParent();
+    IV->eraseFromParent();
+    return false;
+  }
+  LLVM_DEBUG(dbgs() << "\tCreated canonical induction " << *IV << "\n");
+  addInductionPhi(IV, ID);
+  return PrimaryInduction == IV;
+}
+
 bool TapirLoopInfo::getLoopCondition(const char *PassName,
-                                     OptimizationRemarkEmitter *ORE) {
+                                     OptimizationRemarkEmitter *ORE,
+                                     bool AllowRelational) {
   Loop *L = getLoop();
 
   // Check that the latch is terminated by a branch instruction.  The
@@ -259,7 +309,7 @@ bool TapirLoopInfo::getLoopCondition(const char *PassName,
                   << "loop-latch condition is not an integer comparison");
       return false;
     }
-    if (!Cond->isEquality()) {
+    if (!Cond->isEquality() && !AllowRelational) {
       LLVM_DEBUG(dbgs() <<
                  "Loop-latch condition is not an equality comparison.\n");
       // TODO: Find a reasonable analysis message to give to users.
@@ -273,8 +323,12 @@ bool TapirLoopInfo::getLoopCondition(const char *PassName,
   Condition = dyn_cast<ICmpInst>(BI->getCondition());
   LLVM_DEBUG(dbgs() << "\tLoop condition " << *Condition << "\n");
 
-  if (Condition->getOperand(0) == PrimaryInduction ||
-      Condition->getOperand(1) == PrimaryInduction) {
+  // A relational condition is replaced with an equality comparison of the
+  // primary induction's increment with the trip count (see
+  // prepareForOutlining()), so its range is never inclusive.
+  if (Condition->isEquality() &&
+      (Condition->getOperand(0) == PrimaryInduction ||
+       Condition->getOperand(1) == PrimaryInduction)) {
     // The condition examines the primary induction before the increment.  Check
     // to see if the condition directs control to exit the loop once
     // PrimaryInduction equals the end value.
@@ -436,6 +490,13 @@ Value *TapirLoopInfo::getOrCreateTripCount(PredicatedScalarEvolution &PSE,
     return nullptr;
   }
 
+  // The backedge-taken count of a loop whose primary induction was created
+  // by createCanonicalInduction() can be narrower than the induction.
+  Type *IdxTy = getWidestInductionType();
+  if (IdxTy && BackedgeTakenCount->getType()->getPrimitiveSizeInBits() <
+                   IdxTy->getPrimitiveSizeInBits())
+    BackedgeTakenCount = SE->getZeroExtendExpr(BackedgeTakenCount, IdxTy);
+
   const SCEV *ExitCount = getExitCount(BackedgeTakenCount, PSE);
 
   if (ExitCount == SE->getSCEV(ConditionEnd)) {
@@ -444,7 +505,6 @@ Value *TapirLoopInfo::getOrCreateTripCount(PredicatedScalarEvolution &PSE,
   }
 
   const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
-  Type *IdxTy = getWidestInductionType();
 
   // Expand the trip count and place the new instructions in the preheader.
   // Notice that the pre-header does not change, only the loop body.
@@ -460,7 +520,7 @@ Value *TapirLoopInfo::getOrCreateTripCount(PredicatedScalarEvolution &PSE,
                                     L->getLoopPreheader()->getTerminator());
 
   // Try to use the existing ConditionEnd for the trip count.
-  if (TripCount != ConditionEnd) {
+  if (TripCount != ConditionEnd && !ConditionEnd->getType()->isPointerTy()) {
     // Compare the SCEV's of the TripCount and ConditionEnd to see if they're
     // equal.  Normalize these SCEV types to be IdxTy.
     const SCEV *TripCountSCEV =
@@ -484,8 +544,10 @@ bool TapirLoopInfo::prepareForOutlining(
   // Collect the IVs in this loop.
   collectIVs(PSE, PassName, &ORE);
 
-  // If no primary induction was found, just bail.
-  if (!PrimaryInduction)
+  // Give a loop whose inductions are not canonical (e.g., a loop that counts
+  // down, has a non-unit stride or steps a pointer) a canonical induction.
+  // If that fails, just bail.
+  if (!PrimaryInduction && !createCanonicalInduction(PSE))
     return false;
 
   LLVM_DEBUG(dbgs() << "\tPrimary induction " << *PrimaryInduction << "\n");
@@ -502,6 +564,8 @@ bool TapirLoopInfo::prepareForOutlining(
   //
   // 2) In the helper itself, the strip-mined loop must iterate to the
   // end-iteration argument, not the total number of iterations.
+  if (!getLoopCondition(PassName, &ORE, /*AllowRelational=*/true))
+    return false;
   Value *TripCount = getOrCreateTripCount(PSE, PassName, &ORE);
   if (!TripCount) {
     ORE.emit(createMissedAnalysis(PassName, "NoTripCount", getLoop())
@@ -513,14 +577,17 @@ bool TapirLoopInfo::prepareForOutlining(
 
   // If necessary, rewrite the loop condition to use TripCount.  This code
   // should run very rarely, since IndVarSimplify should have already simplified
-  // the loop's induction variables.
-  if ((Condition->getOperand(0) != TripCount) &&
-      (Condition->getOperand(1) != TripCount)) {
+  // the loop's induction variables, except for loops given a canonical
+  // induction or with a relational condition.
+  if (!Condition->isEquality() || ((Condition->getOperand(0) != TripCount) &&
+                                   (Condition->getOperand(1) != TripCount))) {
     Loop *L = getLoop();
     // For now, we don't handle the case where there are multiple uses of the
     // condition.
-    assert(Condition->hasOneUse() &&
-           "Attempting to rewrite Condition with multiple uses.");
+    if (!Condition->hasOneUse()) {
+      LLVM_DEBUG(dbgs() << "Loop condition to rewrite has multiple uses.\n");
+      return false;
+    }
     // Get the IV to use for the new condition: either PrimaryInduction or its
     // incremented value, depending on whether the range is inclusive.
     Value *IVForCond =
@@ -608,10 +675,10 @@ Value *llvm::emitTransformedIndex(
   case InductionDescriptor::IK_PtrInduction: {
     assert(isa<SCEVConstant>(Step) &&
            "Expected constant step for pointer induction");
-    return B.CreateGEP(
-        nullptr, StartValue,
-        CreateMul(Index, Exp.expandCodeFor(Step, Index->getType(),
-                                           &*B.GetInsertPoint())));
+    // The step of a pointer induction is in bytes.
+    return B.CreatePtrAdd(
+        StartValue, CreateMul(Index, Exp.expandCodeFor(Step, Index->getType(),
+                                                       &*B.GetInsertPoint())));
   }
   case InductionDescriptor::IK_FpInduction: {
     assert(Step->getType()->isFloatingPointTy() && "Expected FP Step value");
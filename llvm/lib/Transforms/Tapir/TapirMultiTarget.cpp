@@ -0,0 +1,235 @@
+//===- TapirMultiTarget.cpp - Tapir loops for several targets -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the versioning of the Tapir loops of multi-target
+// modules.  A multi-target loop
+//
+//     preheader:
+//       br header
+//
+// becomes
+//
+//     dispatch:
+//       %t = call i32 @__kitrt_select_target()
+//       switch i32 %t, label %preheader [ i32 1, label %preheader.cuda
+//                                         i32 2, label %preheader.hip ]
+//
+// where each preheader leads to a copy of the loop with the corresponding
+// (tapir.loop.target) target.  The default copy runs on the host.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirMultiTarget.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Transforms/Tapir/TapirTargetIDs.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-multi-target"
+
+static cl::list<std::string> MultiTargets(
+    "tapir-multi-targets", cl::CommaSeparated, cl::Hidden,
+    cl::desc("The GPU targets (cuda, hip) the loops of multi-target modules "
+             "are compiled for, along with the host (default: cuda,hip)"));
+
+// The module flag that marks multi-target modules.
+static const char *MultiTargetFlag = "kitsune.multi-target";
+
+namespace {
+struct MultiTargetVersion {
+  TapirTargetID Target;
+  MultiTargetKind Kind;
+  const char *Name;
+};
+} // end anonymous namespace
+
+// Get the GPU versions of multi-target loops.
+static SmallVector<MultiTargetVersion, 2> getGPUVersions() {
+  const MultiTargetVersion GPUVersions[] = {
+      {TapirTargetID::Cuda, MultiTargetKind::Cuda, "cuda"},
+      {TapirTargetID::Hip, MultiTargetKind::Hip, "hip"}};
+  if (MultiTargets.getNumOccurrences() == 0)
+    return SmallVector<MultiTargetVersion, 2>(std::begin(GPUVersions),
+                                               std::end(GPUVersions));
+
+  SmallVector<MultiTargetVersion, 2> Versions;
+  for (const std::string &Name : MultiTargets) {
+    if (Name.empty())
+      continue;
+    auto It = llvm::find_if(GPUVersions, [&Name](const MultiTargetVersion &V) {
+      return Name == V.Name;
+    });
+    if (It == std::end(GPUVersions))
+      report_fatal_error("unknown target '" + Twine(Name) +
+                         "' in -tapir-multi-targets");
+    Versions.push_back(*It);
+  }
+  return Versions;
+}
+
+static FunctionCallee getSelectTargetFn(Module &M) {
+  return M.getOrInsertFunction("__kitrt_select_target",
+                               Type::getInt32Ty(M.getContext()));
+}
+
+bool llvm::isMultiTargetModule(const Module &M) {
+  return M.getModuleFlag(MultiTargetFlag) != nullptr;
+}
+
+// Set the target of the Tapir loop \p L, and of the multi-target loops
+// nested in it, to \p Target.
+static void retargetLoopNest(Loop *L, TapirTargetID Target) {
+  for (Loop *SubL : depth_first(L)) {
+    TapirLoopHints Hints(SubL);
+    if (static_cast<TapirTargetID>(Hints.getLoopTarget()) ==
+        TapirTargetID::Multi)
+      Hints.setLoopTarget(Target);
+  }
+}
+
+// Version the multi-target loop \p L for each of the \p Versions.  The
+// original loop is the host version.  The new loops are added to
+// \p NewLoops.  Returns false if the loop is not in a form that can be
+// versioned.
+static bool versionLoop(Loop *L, ArrayRef<MultiTargetVersion> Versions,
+                        DominatorTree &DT, LoopInfo &LI, ScalarEvolution &SE,
+                        SmallVectorImpl<Loop *> &NewLoops) {
+  // Loops that may throw (or otherwise have several exits) are not
+  // versioned.
+  BasicBlock *Dispatch = L->getLoopPreheader();
+  BasicBlock *ExitingBB = L->getExitingBlock();
+  BasicBlock *Exit = L->getUniqueExitBlock();
+  if (!Dispatch || !ExitingBB || !Exit)
+    return false;
+
+  SE.forgetLoop(L);
+  for (PHINode &PN : Exit->phis())
+    SE.forgetValue(&PN);
+
+  // The loop gets a new (empty) preheader, which is cloned with the loop,
+  // and the old one selects the version to run.
+  Module &M = *Dispatch->getModule();
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Preheader = SplitEdge(Dispatch, Header, &DT, &LI);
+  BasicBlock *OldExitIDom = DT.getNode(Exit)->getIDom()->getBlock();
+
+  Instruction *OldBr = Dispatch->getTerminator();
+  IRBuilder<> B(OldBr);
+  CallInst *Selected = B.CreateCall(getSelectTargetFn(M), {}, "multi.target");
+  Selected->setDoesNotThrow();
+  SwitchInst *Switch = B.CreateSwitch(Selected, Preheader, Versions.size());
+  OldBr->eraseFromParent();
+
+  for (const MultiTargetVersion &V : Versions) {
+    ValueToValueMapTy VMap;
+    SmallVector<BasicBlock *, 16> Blocks;
+    Loop *NewL = cloneLoopWithPreheader(Preheader, Dispatch, L, VMap,
+                                        Twine(".") + V.Name, &LI, &DT, Blocks);
+    remapInstructionsInBlocks(Blocks, VMap);
+    Switch->addCase(B.getInt32(static_cast<unsigned>(V.Kind)),
+                    cast<BasicBlock>(VMap[Preheader]));
+
+    // The loop is in LCSSA form: its values are only used outside of the
+    // loop by the exit block's PHIs.
+    for (PHINode &PN : Exit->phis()) {
+      Value *In = PN.getIncomingValueForBlock(ExitingBB);
+      if (Value *NewIn = VMap.lookup(In))
+        In = NewIn;
+      PN.addIncoming(In, cast<BasicBlock>(VMap[ExitingBB]));
+    }
+    retargetLoopNest(NewL, V.Target);
+    NewLoops.push_back(NewL);
+  }
+  retargetLoopNest(L, TapirTargetID::OpenCilk);
+
+  DT.changeImmediateDominator(
+      Exit, DT.findNearestCommonDominator(OldExitIDom, Dispatch));
+  return true;
+}
+
+bool llvm::versionMultiTargetLoops(Function &F, DominatorTree &DT,
+                                   LoopInfo &LI, TaskInfo &TI,
+                                   ScalarEvolution &SE) {
+  // Find the outermost multi-target Tapir loops.
+  SmallVector<Loop *, 8> MultiLoops;
+  SmallVector<Loop *, 8> Worklist(LI.begin(), LI.end());
+  while (!Worklist.empty()) {
+    Loop *L = Worklist.pop_back_val();
+    TapirLoopHints Hints(L);
+    if (static_cast<TapirTargetID>(Hints.getLoopTarget()) ==
+            TapirTargetID::Multi &&
+        getTaskIfTapirLoop(L, &TI))
+      MultiLoops.push_back(L);
+    else
+      Worklist.append(L->begin(), L->end());
+  }
+  if (MultiLoops.empty())
+    return false;
+
+  Module &M = *F.getParent();
+  if (!isMultiTargetModule(M))
+    M.addModuleFlag(Module::Max, MultiTargetFlag, 1);
+
+  SmallVector<MultiTargetVersion, 2> Versions = getGPUVersions();
+  SmallVector<Loop *, 8> VersionedLoops;
+  SmallVector<Loop *, 8> NewLoops;
+  for (Loop *L : MultiLoops) {
+    if (Versions.empty() || !versionLoop(L, Versions, DT, LI, SE, NewLoops)) {
+      LLVM_DEBUG(dbgs() << "tapir-multi-target: running loop "
+                        << L->getHeader()->getName()
+                        << " on the host only.\n");
+      retargetLoopNest(L, TapirTargetID::OpenCilk);
+      continue;
+    }
+    VersionedLoops.push_back(L);
+  }
+
+  // The versions of a loop share its exit block.  Split it to restore the
+  // dedicated exits of the loop-simplify form.
+  VersionedLoops.append(NewLoops.begin(), NewLoops.end());
+  for (Loop *L : VersionedLoops)
+    formDedicatedExitBlocks(L, &DT, &LI, nullptr, /*PreserveLCSSA*/ true);
+
+  TI.recalculate(F, DT);
+  return true;
+}
+
+void llvm::guardMultiTargetCtor(IRBuilder<> &B, MultiTargetKind Kind) {
+  BasicBlock *BB = B.GetInsertBlock();
+  Module &M = *BB->getModule();
+  if (!isMultiTargetModule(M))
+    return;
+
+  // The runtime of a target that was not selected must not be initialized
+  // (it aborts when it does not find a device).
+  LLVMContext &C = M.getContext();
+  Function *Ctor = BB->getParent();
+  BasicBlock *InitBB = BasicBlock::Create(C, "init", Ctor);
+  BasicBlock *SkipBB = BasicBlock::Create(C, "skip", Ctor);
+  Value *Selected = B.CreateCall(getSelectTargetFn(M), {}, "target");
+  B.CreateCondBr(
+      B.CreateICmpEQ(Selected, B.getInt32(static_cast<unsigned>(Kind))),
+      InitBB, SkipBB);
+  ReturnInst::Create(C, SkipBB);
+  B.SetInsertPoint(InitBB);
+}
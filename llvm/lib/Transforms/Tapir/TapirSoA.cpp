@@ -0,0 +1,244 @@
+//===- TapirSoA.cpp - Store arrays of structs as structs of arrays --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass changes the layout of arrays of structs that Kitsune allocates
+// (with alloc<T>()) from an array of structs to a structure of arrays, for
+// the struct types marked with [[kitsune::soa]].  A Tapir loop that reads
+// one field of such an array makes strided accesses, which on a GPU leaves
+// most of each memory transaction unused; with the fields stored as
+// separate arrays, neighboring iterations access neighboring elements.
+//
+// The layout is private to the function that allocates the array: it is
+// changed only if every use of the allocation is an access to a single
+// field of an element, a[i].f, or the call that frees it.  Before Tapir
+// loops are outlined their bodies are part of that function, so this covers
+// the arrays that are allocated, used by foralls, and freed in one place.
+//
+// An array of N structs is laid out by placing field f's array at byte
+// offset N * offsetof(T, f) of the allocation.  The field offsets of a
+// (non-packed) struct are aligned for the fields and do not overlap, so the
+// field arrays are aligned, disjoint, and fit in the N * sizeof(T) bytes
+// that were allocated.  Accesses to a[i].f become accesses to element i of
+// field f's array.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TapirSoA.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-soa"
+
+STATISTIC(NumSoAArrays, "Number of arrays of structs stored as structs of "
+                        "arrays");
+
+static cl::opt<bool> SoAAllStructs(
+    "tapir-soa-all", cl::Hidden, cl::init(false),
+    cl::desc("Store all eligible arrays of structs as structs of arrays, not "
+             "only those of types marked with [[kitsune::soa]]"));
+
+/// Returns the function that frees memory from the allocation function
+/// named Alloc, or an empty string if Alloc is not a Kitsune runtime
+/// allocation function.
+static StringRef getFreeFunction(StringRef Alloc) {
+  return StringSwitch<StringRef>(Alloc)
+      .Case("__kitcuda_mem_alloc_managed", "__kitcuda_mem_free")
+      .Case("__kithip_mem_alloc_managed", "__kithip_mem_free")
+      .Case("__kitze_mem_alloc_managed", "__kitze_mem_free")
+      .Case("__kitrt_multi_mem_alloc_managed", "__kitrt_multi_mem_free")
+      .Case("__kitrt_default_mem_alloc", "__kitrt_default_mem_free")
+      .Default("");
+}
+
+/// Returns the struct types marked with [[kitsune::soa]] in module M.
+static SmallPtrSet<StructType *, 4> getSoATypes(const Module &M) {
+  SmallPtrSet<StructType *, 4> Types;
+  const NamedMDNode *MD = M.getNamedMetadata("kitsune.soa");
+  if (!MD)
+    return Types;
+  for (const MDNode *N : MD->operands())
+    if (N->getNumOperands() == 1)
+      if (auto *C = mdconst::dyn_extract_or_null<Constant>(N->getOperand(0)))
+        if (auto *STy = dyn_cast<StructType>(C->getType()))
+          Types.insert(STy);
+  return Types;
+}
+
+/// Returns true if all fields of STy are scalars or vectors, at distinct
+/// offsets, so that each field can get an array of its own.
+static bool isSoACandidate(StructType *STy) {
+  if (STy->isOpaque() || STy->isPacked() || STy->getNumElements() < 2)
+    return false;
+  for (Type *FieldTy : STy->elements())
+    if (FieldTy->isAggregateType() || !FieldTy->isSized() ||
+        FieldTy->isScalableTy())
+      return false;
+  return true;
+}
+
+/// Returns the field of its struct that GEP (an element of an array of
+/// structs) addresses, or -1 if it does not address a single field.
+static int getAccessedField(const GetElementPtrInst *GEP) {
+  if (GEP->getNumIndices() == 1)
+    return 0;
+  if (GEP->getNumIndices() != 2)
+    return -1;
+  auto *Field = dyn_cast<ConstantInt>(GEP->getOperand(2));
+  return Field ? (int)Field->getZExtValue() : -1;
+}
+
+/// Returns true if GEP's only users load or store a value of type FieldTy
+/// through it.
+static bool isOnlyFieldAccess(const GetElementPtrInst *GEP, Type *FieldTy) {
+  for (const User *U : GEP->users()) {
+    if (const auto *LI = dyn_cast<LoadInst>(U)) {
+      if (LI->getType() != FieldTy)
+        return false;
+    } else if (const auto *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getValueOperand() == GEP ||
+          SI->getValueOperand()->getType() != FieldTy)
+        return false;
+    } else if (const auto *RMW = dyn_cast<AtomicRMWInst>(U)) {
+      if (RMW->getValOperand() == GEP ||
+          RMW->getValOperand()->getType() != FieldTy)
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Returns the struct type of the array of structs allocated by Alloc, if
+/// every use of the allocation accesses a single field of an element or
+/// frees it.  The field accesses are added to GEPs.
+static StructType *
+getSoAType(CallInst *Alloc, StringRef FreeFn,
+           const SmallPtrSetImpl<StructType *> &SoATypes,
+           SmallVectorImpl<GetElementPtrInst *> &GEPs) {
+  StructType *STy = nullptr;
+  for (User *U : Alloc->users()) {
+    if (auto *CI = dyn_cast<CallInst>(U)) {
+      Function *Callee = CI->getCalledFunction();
+      if (!Callee || Callee->getName() != FreeFn || CI->arg_size() != 1)
+        return nullptr;
+      continue;
+    }
+    auto *GEP = dyn_cast<GetElementPtrInst>(U);
+    if (!GEP || GEP->getPointerOperand() != Alloc)
+      return nullptr;
+    auto *GEPTy = dyn_cast<StructType>(GEP->getSourceElementType());
+    if (!GEPTy || (STy && GEPTy != STy))
+      return nullptr;
+    STy = GEPTy;
+    int Field = getAccessedField(GEP);
+    if (Field < 0 || (unsigned)Field >= STy->getNumElements() ||
+        !isOnlyFieldAccess(GEP, STy->getElementType(Field)))
+      return nullptr;
+    GEPs.push_back(GEP);
+  }
+  if (!STy || !isSoACandidate(STy) || (!SoAAllStructs && !SoATypes.count(STy)))
+    return nullptr;
+  return STy;
+}
+
+/// Store the array of structs of type STy allocated by Alloc as a structure
+/// of arrays, rewriting its field accesses GEPs.
+static void convertToSoA(CallInst *Alloc, StructType *STy,
+                         ArrayRef<GetElementPtrInst *> GEPs) {
+  const DataLayout &DL = Alloc->getModule()->getDataLayout();
+  const StructLayout *SL = DL.getStructLayout(STy);
+  Value *Size = Alloc->getArgOperand(0);
+  Type *SizeTy = Size->getType();
+
+  IRBuilder<> B(Alloc->getNextNode());
+  Value *N = B.CreateUDiv(
+      Size, ConstantInt::get(SizeTy, DL.getTypeAllocSize(STy)), "soa.n");
+  SmallVector<Value *, 8> FieldArrays(STy->getNumElements(), nullptr);
+  auto GetFieldArray = [&](unsigned Field) {
+    if (!FieldArrays[Field]) {
+      uint64_t Offset = SL->getElementOffset(Field);
+      FieldArrays[Field] =
+          Offset == 0 ? Alloc
+                      : B.CreateInBoundsGEP(
+                            B.getInt8Ty(), Alloc,
+                            B.CreateNUWMul(N, ConstantInt::get(SizeTy, Offset)),
+                            "soa.field");
+    }
+    return FieldArrays[Field];
+  };
+
+  for (GetElementPtrInst *GEP : GEPs) {
+    unsigned Field = getAccessedField(GEP);
+    Type *FieldTy = STy->getElementType(Field);
+    Value *FieldArray = GetFieldArray(Field);
+    auto *NewGEP = GetElementPtrInst::Create(
+        FieldTy, FieldArray, {GEP->getOperand(1)}, GEP->getName(), GEP);
+    NewGEP->setIsInBounds(GEP->isInBounds());
+    NewGEP->setDebugLoc(GEP->getDebugLoc());
+
+    // An element of a field array is only aligned for the field, not for
+    // the struct.
+    Align FieldAlign = DL.getABITypeAlign(FieldTy);
+    for (User *U : GEP->users()) {
+      if (auto *LI = dyn_cast<LoadInst>(U))
+        LI->setAlignment(std::min(LI->getAlign(), FieldAlign));
+      else if (auto *SI = dyn_cast<StoreInst>(U))
+        SI->setAlignment(std::min(SI->getAlign(), FieldAlign));
+      else if (auto *RMW = dyn_cast<AtomicRMWInst>(U))
+        RMW->setAlignment(std::min(RMW->getAlign(), FieldAlign));
+    }
+    GEP->replaceAllUsesWith(NewGEP);
+    GEP->eraseFromParent();
+  }
+}
+
+PreservedAnalyses TapirSoAPass::run(Function &F,
+                                    FunctionAnalysisManager &AM) {
+  SmallPtrSet<StructType *, 4> SoATypes = getSoATypes(*F.getParent());
+  if (SoATypes.empty() && !SoAAllStructs)
+    return PreservedAnalyses::all();
+
+  SmallVector<CallInst *, 8> Allocs;
+  for (Instruction &I : instructions(F))
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      if (CI->arg_size() == 1 && CI->getCalledFunction() &&
+          !getFreeFunction(CI->getCalledFunction()->getName()).empty())
+        Allocs.push_back(CI);
+
+  bool Changed = false;
+  for (CallInst *Alloc : Allocs) {
+    StringRef FreeFn = getFreeFunction(Alloc->getCalledFunction()->getName());
+    SmallVector<GetElementPtrInst *, 16> GEPs;
+    StructType *STy = getSoAType(Alloc, FreeFn, SoATypes, GEPs);
+    if (!STy)
+      continue;
+    LLVM_DEBUG(dbgs() << "Storing " << *STy << " array " << *Alloc
+                      << " as a structure of arrays\n");
+    convertToSoA(Alloc, STy, GEPs);
+    ++NumSoAArrays;
+    Changed = true;
+  }
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
@@ -528,7 +528,10 @@ TransformationMode llvm::hasLoopSpawningTransformation(const Loop *L) {
   TapirLoopHints Hints(L);
 
   switch (Hints.getStrategy()) {
-  case TapirLoopHints::ST_DAC: {
+  case TapirLoopHints::ST_DAC:
+  case TapirLoopHints::ST_STATIC:
+  case TapirLoopHints::ST_DYNAMIC:
+  case TapirLoopHints::ST_GUIDED: {
     return TM_ForcedByUser;
   } case TapirLoopHints::ST_SEQ:
     return TM_Disable;
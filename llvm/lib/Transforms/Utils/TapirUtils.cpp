@@ -2317,7 +2317,10 @@ void llvm::TapirLoopHints::setHint(StringRef Name, Metadata *Arg) {
 
   unsigned Val = C->getZExtValue();
   Hint *Hints[] = {&Strategy, &Grainsize, &LoopTarget,
-                   &ThreadsPerBlock, &AutoTune};
+                   &ThreadsPerBlock, &AutoTune, &Hybrid, &Async,
+                   &MaxBlocksPerGrid, &MinBlocksPerMultiproc,
+                   &SharedMemBytes, &ItersPerThread, &Priority, &Specialize,
+                   &GPULanes};
   for (auto H : Hints) {
     if (Name == H->Name) {
       if (H->validate(Val))
@@ -2437,7 +2440,18 @@ void llvm::TapirLoopHints::clearHintsMetadata() {
                   Hint("target", static_cast<unsigned>(TapirTargetID::Serial),
                        HK_LOOPTARGET),
                   Hint("threads.per.block", 0, HK_THREADS_PER_BLOCK),
-                  Hint("launch.auto.tune", false, HK_AUTO_TUNE)};
+                  Hint("launch.auto.tune", false, HK_AUTO_TUNE),
+                  Hint("hybrid", 0, HK_HYBRID),
+                  Hint("async", 0, HK_ASYNC),
+                  Hint("kitsune.launch.max.blocks", 0, HK_LAUNCH_PARAM),
+                  Hint("kitsune.launch.min.blocks.per.multiproc", 0,
+                       HK_LAUNCH_PARAM),
+                  Hint("kitsune.launch.shared.bytes", 0, HK_LAUNCH_PARAM),
+                  Hint("kitsune.launch.iters.per.thread", 0,
+                       HK_LAUNCH_PARAM),
+                  Hint("kitsune.priority", 0, HK_LAUNCH_PARAM),
+                  Hint("kitsune.specialize", 0, HK_LAUNCH_PARAM),
+                  Hint("kitsune.gpu.lanes", 0, HK_LAUNCH_PARAM)};
   LLVMContext &Context = TheLoop->getHeader()->getContext();
   SmallVector<Metadata *, 4> MDs;
 
@@ -2468,6 +2482,9 @@ void llvm::TapirLoopHints::clearHintsMetadata() {
 bool llvm::hintsDemandOutlining(const TapirLoopHints &Hints) {
   switch (Hints.getStrategy()) {
   case TapirLoopHints::ST_DAC:
+  case TapirLoopHints::ST_STATIC:
+  case TapirLoopHints::ST_DYNAMIC:
+  case TapirLoopHints::ST_GUIDED:
     return true;
   case TapirLoopHints::ST_SEQ:
   default:
@@ -2533,3 +2550,106 @@ Task *llvm::getTaskIfTapirLoop(const Loop *L, TaskInfo *TI) {
 
   return T;
 }
+
+/// Returns true if the memory operation I of a logically parallel loop cannot
+/// carry a dependence between iterations.  Two iterations may only access the
+/// same location when both read it, unless they synchronize, and only atomics
+/// synchronize.  A call that does not synchronize -- e.g., a math function
+/// that writes through its pointer arguments -- is as independent of the
+/// other iterations as a plain store.
+bool llvm::isDRFParallelAccess(const Instruction &I) {
+  if (const LoadInst *LI = dyn_cast<LoadInst>(&I))
+    return LI->isUnordered();
+  if (const StoreInst *SI = dyn_cast<StoreInst>(&I))
+    return SI->isUnordered();
+  if (const MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I))
+    return !MI->isVolatile();
+  if (const CallBase *CB = dyn_cast<CallBase>(&I))
+    return !CB->isInlineAsm() && !CB->isConvergent() &&
+           CB->hasFnAttr(Attribute::NoSync);
+  return false;
+}
+
+/// Returns true if the given atomic update can carry (part of) a reduction: its
+/// result is unused and its operation is associative and commutative.
+bool llvm::isAtomicReductionUpdate(const AtomicRMWInst *RMW) {
+  if (RMW->isVolatile() || !RMW->use_empty())
+    return false;
+  Type *Ty = RMW->getValOperand()->getType();
+  switch (RMW->getOperation()) {
+  case AtomicRMWInst::Add:
+  case AtomicRMWInst::And:
+  case AtomicRMWInst::Or:
+  case AtomicRMWInst::Xor:
+  case AtomicRMWInst::Max:
+  case AtomicRMWInst::Min:
+  case AtomicRMWInst::UMax:
+  case AtomicRMWInst::UMin:
+    return Ty->isIntegerTy(32) || Ty->isIntegerTy(64);
+  case AtomicRMWInst::FAdd:
+  case AtomicRMWInst::FMax:
+  case AtomicRMWInst::FMin:
+    return Ty->isFloatTy() || Ty->isDoubleTy();
+  default:
+    return false;
+  }
+}
+
+/// Returns the identity of the reduction operation Op on values of type Ty.
+Constant *llvm::getAtomicReductionIdentity(AtomicRMWInst::BinOp Op, Type *Ty) {
+  switch (Op) {
+  case AtomicRMWInst::Add:
+  case AtomicRMWInst::Or:
+  case AtomicRMWInst::Xor:
+  case AtomicRMWInst::UMax:
+    return ConstantInt::get(Ty, 0);
+  case AtomicRMWInst::And:
+  case AtomicRMWInst::UMin:
+    return Constant::getAllOnesValue(Ty);
+  case AtomicRMWInst::Max:
+    return ConstantInt::get(
+        Ty, APInt::getSignedMinValue(Ty->getIntegerBitWidth()));
+  case AtomicRMWInst::Min:
+    return ConstantInt::get(
+        Ty, APInt::getSignedMaxValue(Ty->getIntegerBitWidth()));
+  case AtomicRMWInst::FAdd:
+    return ConstantFP::getNegativeZero(Ty);
+  case AtomicRMWInst::FMax:
+    return ConstantFP::getInfinity(Ty, /* Negative */ true);
+  case AtomicRMWInst::FMin:
+    return ConstantFP::getInfinity(Ty, /* Negative */ false);
+  default:
+    llvm_unreachable("unexpected reduction operation!");
+  }
+}
+
+/// Emit the non-atomic form of the reduction operation Op on L and R.
+Value *llvm::emitAtomicReductionOp(IRBuilderBase &B, AtomicRMWInst::BinOp Op,
+                                   Value *L, Value *R) {
+  switch (Op) {
+  case AtomicRMWInst::Add:
+    return B.CreateAdd(L, R);
+  case AtomicRMWInst::And:
+    return B.CreateAnd(L, R);
+  case AtomicRMWInst::Or:
+    return B.CreateOr(L, R);
+  case AtomicRMWInst::Xor:
+    return B.CreateXor(L, R);
+  case AtomicRMWInst::Max:
+    return B.CreateBinaryIntrinsic(Intrinsic::smax, L, R);
+  case AtomicRMWInst::Min:
+    return B.CreateBinaryIntrinsic(Intrinsic::smin, L, R);
+  case AtomicRMWInst::UMax:
+    return B.CreateBinaryIntrinsic(Intrinsic::umax, L, R);
+  case AtomicRMWInst::UMin:
+    return B.CreateBinaryIntrinsic(Intrinsic::umin, L, R);
+  case AtomicRMWInst::FAdd:
+    return B.CreateFAdd(L, R);
+  case AtomicRMWInst::FMax:
+    return B.CreateMaxNum(L, R);
+  case AtomicRMWInst::FMin:
+    return B.CreateMinNum(L, R);
+  default:
+    llvm_unreachable("unexpected reduction operation!");
+  }
+}
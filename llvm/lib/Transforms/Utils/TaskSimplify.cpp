@@ -61,6 +61,11 @@ static cl::opt<bool> PreserveAllSpawns(
     cl::desc("Temporary development switch to ensure TaskSimplify does not "
              "eliminate spawns that immediately sync."));
 
+static cl::opt<bool> RemoveRedundantSyncs(
+    "tasksimplify-remove-redundant-syncs", cl::init(true), cl::Hidden,
+    cl::desc("Remove syncs that no task of their sync region can reach, e.g., "
+             "implicit syncs on paths where no spawn happened."));
+
 static bool syncMatchesReachingTask(const Value *SyncSR,
                                     SmallPtrSetImpl<const Task *> &MPTasks) {
   if (MPTasks.empty())
@@ -192,10 +197,12 @@ bool llvm::simplifySyncs(Task *T, MaybeParallelTasks &MPTasks) {
   LLVM_DEBUG(dbgs() << "Simplifying syncs in task @ "
                     << T->getEntry()->getName() << "\n");
 
-  // Remove redundant syncs.  This optimization might not be necessary here,
-  // because SimplifyCFG seems to do a good job removing syncs that cannot sync
-  // anything.
-  //Changed |= removeRedundantSyncs(MPTasks, T);
+  // Remove redundant syncs.  SimplifyCFG removes syncs of empty sync regions
+  // and syncs that immediately follow another sync, but not the syncs on
+  // paths that no spawn of the region reaches, such as the implicit sync at
+  // the end of a scope after a conditional spawn that was not taken.
+  if (RemoveRedundantSyncs)
+    Changed |= removeRedundantSyncs(MPTasks, T);
 
   // Remove redundant sync regions.
   //Changed |= removeRedundantSyncRegions(MPTasks, T);
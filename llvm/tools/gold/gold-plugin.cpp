@@ -231,10 +231,12 @@ namespace options {
         .Case("serial", TapirTargetID::Serial)
         .Case("cuda", TapirTargetID::Cuda)
         .Case("hip", TapirTargetID::Hip)
+        .Case("levelzero", TapirTargetID::LevelZero)
         .Case("opencilk", TapirTargetID::OpenCilk)
         .Case("openmp", TapirTargetID::OpenMP)
         .Case("qthreads", TapirTargetID::Qthreads)
         .Case("realm", TapirTargetID::Realm)
+        .Case("multi", TapirTargetID::Multi)
         .Default(TapirTargetID::Last_TapirTargetID);
   }
 